@@ -37,8 +37,10 @@ option(FORCE_COLORED_OUTPUT "Always produce ANSI-colored output (GNU/Clang only)
 
 if(USE_OPENCL)
   option(TESTBUILD_OPENCL_PROGRAMS "Test-compile opencl programs (needs llvm and clang 3.9+)." ON)
+  option(BUILD_OPENCL_SPIRV "Compile opencl programs to SPIR-V (needs the test-compile toolchain and llvm-spirv)." OFF)
 else()
   set(TESTBUILD_OPENCL_PROGRAMS OFF)
+  set(BUILD_OPENCL_SPIRV OFF)
 endif()
 
 if(APPLE)
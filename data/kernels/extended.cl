@@ -310,6 +310,176 @@ tpdf(unsigned int urandom)
 }
 
 
+/* random dithering, the noise of a pixel is seeded by its position in the full image as in dither.c */
+__kernel void
+dither (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+        const int x0, const int y0, const float dither, const int keep_alpha)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  unsigned int tea_state[2] = { x0 + x, y0 + y };
+  encrypt_tea(tea_state);
+  const float dith = dither * tpdf(tea_state[0]);
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float4 o = clamp(pixel + dith, 0.0f, 1.0f);
+  if(keep_alpha) o.w = pixel.w;
+
+  write_imagef (out, (int2)(x, y), o);
+}
+
+
+/* film grain, the same simplex noise as in grain.c */
+constant int grain_grad3[12][3] = { { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+                                    { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+                                    { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+
+constant int grain_permutation[256] = {
+  151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225, 140, 36, 103, 30,
+  69, 142, 8, 99, 37, 240, 21, 10, 23, 190, 6, 148, 247, 120, 234, 75, 0, 26, 197, 62,
+  94, 252, 219, 203, 117, 35, 11, 32, 57, 177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136,
+  171, 168, 68, 175, 74, 165, 71, 134, 139, 48, 27, 166, 77, 146, 158, 231, 83, 111, 229, 122,
+  60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244, 102, 143, 54, 65, 25, 63, 161,
+  1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169, 200, 196, 135, 130, 116, 188, 159, 86,
+  164, 100, 109, 198, 173, 186, 3, 64, 52, 217, 226, 250, 124, 123, 5, 202, 38, 147, 118, 126,
+  255, 82, 85, 212, 207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42, 223, 183, 170, 213,
+  119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9, 129, 22, 39, 253,
+  19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104, 218, 246, 97, 228, 251, 34, 242, 193,
+  238, 210, 144, 12, 191, 179, 162, 241, 81, 51, 145, 235, 249, 14, 239, 107, 49, 192, 214, 31,
+  181, 199, 106, 157, 184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254, 138, 236, 205, 93,
+  222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180
+};
+
+#define GRAIN_PERM(i) grain_permutation[(i) & 255]
+#define GRAIN_LUT_SIZE 128
+#define GRAIN_OCTAVES 3
+
+float
+grain_simplex_noise(const float xin, const float yin, const float zin)
+{
+  const float F3 = 1.0f / 3.0f;
+  const float s = (xin + yin + zin) * F3;
+  const int i = xin + s > 0.0f ? (int)(xin + s) : (int)(xin + s) - 1;
+  const int j = yin + s > 0.0f ? (int)(yin + s) : (int)(yin + s) - 1;
+  const int k = zin + s > 0.0f ? (int)(zin + s) : (int)(zin + s) - 1;
+  const float G3 = 1.0f / 6.0f;
+  const float t = (i + j + k) * G3;
+  const float x0 = xin - (i - t);
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
+
+  const int xy = x0 >= y0;
+  const int yz = y0 >= z0;
+  const int xz = x0 >= z0;
+  const int i1 = xy && xz;
+  const int j1 = !xy && yz;
+  const int k1 = !yz && !xz;
+  const int i2 = xy || xz;
+  const int j2 = !xy || yz;
+  const int k2 = !yz || !xz;
+
+  const float x1 = x0 - i1 + G3;
+  const float y1 = y0 - j1 + G3;
+  const float z1 = z0 - k1 + G3;
+  const float x2 = x0 - i2 + 2.0f * G3;
+  const float y2 = y0 - j2 + 2.0f * G3;
+  const float z2 = z0 - k2 + 2.0f * G3;
+  const float x3 = x0 - 1.0f + 3.0f * G3;
+  const float y3 = y0 - 1.0f + 3.0f * G3;
+  const float z3 = z0 - 1.0f + 3.0f * G3;
+
+  const int ii = i & 255;
+  const int jj = j & 255;
+  const int kk = k & 255;
+  constant int *g0 = grain_grad3[GRAIN_PERM(ii + GRAIN_PERM(jj + GRAIN_PERM(kk))) % 12];
+  constant int *g1 = grain_grad3[GRAIN_PERM(ii + i1 + GRAIN_PERM(jj + j1 + GRAIN_PERM(kk + k1))) % 12];
+  constant int *g2 = grain_grad3[GRAIN_PERM(ii + i2 + GRAIN_PERM(jj + j2 + GRAIN_PERM(kk + k2))) % 12];
+  constant int *g3 = grain_grad3[GRAIN_PERM(ii + 1 + GRAIN_PERM(jj + 1 + GRAIN_PERM(kk + 1))) % 12];
+
+  float t0 = fmax(0.6f - x0 * x0 - y0 * y0 - z0 * z0, 0.0f);
+  float t1 = fmax(0.6f - x1 * x1 - y1 * y1 - z1 * z1, 0.0f);
+  float t2 = fmax(0.6f - x2 * x2 - y2 * y2 - z2 * z2, 0.0f);
+  float t3 = fmax(0.6f - x3 * x3 - y3 * y3 - z3 * z3, 0.0f);
+  t0 *= t0;
+  t1 *= t1;
+  t2 *= t2;
+  t3 *= t3;
+
+  return 32.0f * (t0 * t0 * (g0[0] * x0 + g0[1] * y0 + g0[2] * z0)
+                  + t1 * t1 * (g1[0] * x1 + g1[1] * y1 + g1[2] * z1)
+                  + t2 * t2 * (g2[0] * x2 + g2[1] * y2 + g2[2] * z2)
+                  + t3 * t3 * (g3[0] * x3 + g3[1] * y3 + g3[2] * z3));
+}
+
+float
+grain_noise(const float x, const float y, const float4 scale, const float4 offset)
+{
+  return grain_simplex_noise(x * scale.x + offset.x, y * scale.x, 0.0f) * 0.2340f
+       + grain_simplex_noise(x * scale.y + offset.y, y * scale.y, 1.0f) * 0.7850f
+       + grain_simplex_noise(x * scale.z + offset.z, y * scale.z, 2.0f) * 1.2150f;
+}
+
+float
+grain_lut_lookup(global const float *lut, const float x, const float y)
+{
+  const float _x = clamp((x + 0.5f) * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+  const float _y = clamp(y * (GRAIN_LUT_SIZE - 1), 0.0f, (float)(GRAIN_LUT_SIZE - 1));
+
+  const int _x0 = _x < GRAIN_LUT_SIZE - 2 ? _x : GRAIN_LUT_SIZE - 2;
+  const int _y0 = _y < GRAIN_LUT_SIZE - 2 ? _y : GRAIN_LUT_SIZE - 2;
+
+  const float x_diff = _x - _x0;
+  const float y_diff = _y - _y0;
+
+  const float l00 = lut[_y0 * GRAIN_LUT_SIZE + _x0];
+  const float l01 = lut[_y0 * GRAIN_LUT_SIZE + _x0 + 1];
+  const float l10 = lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0];
+  const float l11 = lut[(_y0 + 1) * GRAIN_LUT_SIZE + _x0 + 1];
+
+  const float xy0 = (1.0f - y_diff) * l00 + l10 * y_diff;
+  const float xy1 = (1.0f - y_diff) * l01 + l11 * y_diff;
+  return xy0 * (1.0f - x_diff) + xy1 * x_diff;
+}
+
+__kernel void
+grain (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+       const int x0, const int y0, const float xyscale, const float4 scale, const float4 offset,
+       const int filter, const float filtermul, const float strength, global const float *lut)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float wx = (x0 + x) * xyscale;
+  const float wy = (y0 + y) * xyscale;
+
+  float noise = 0.0f;
+  if(filter)
+  {
+    // rank-1 lattice downsampling, fib1 = 34, fib2 = 21
+    const float fib2 = 21.0f, fib1div2 = 34.0f / 21.0f;
+    for(int l = 0; l < 21; l++)
+    {
+      const float px = l / fib2;
+      float py = l * fib1div2;
+      py -= (int)py;
+      noise += (1.0f / fib2) * grain_noise(wx + px * filtermul, wy + py * filtermul, scale, offset);
+    }
+  }
+  else
+    noise = grain_noise(wx, wy, scale, offset);
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.x += grain_lut_lookup(lut, noise * strength, pixel.x / 100.0f);
+
+  write_imagef (out, (int2)(x, y), pixel);
+}
+
+
 __kernel void
 vignette (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
           const float2 scale, const float2 roi_center_scaled, const float2 expt,
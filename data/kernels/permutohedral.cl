@@ -0,0 +1,359 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* 5d permutohedral lattice of the surface blur, see src/iop/Permutohedral.h for the CPU version.
+
+   The lattice points live in an open addressing hash table of `capacity' slots. A slot is claimed by
+   writing the hash of its key to `tokens' with an atomic compare-and-exchange, the key is written next
+   and `ready' is set last. A thread meeting a claimed slot with its own hash whose key is not ready yet
+   can't tell whether it holds the same point, it doesn't wait but leaves the point for the next pass of
+   permutohedral_splat: every claim made in one pass is complete at the next one.
+
+   The replay buffers keep, for each pixel and each of the D+1 vertices of its simplex, the slot of the
+   vertex and its barycentric weight. */
+
+#define PL_D 5
+#define PL_EMPTY 0
+#define PL_MAX_PROBES 4096
+
+// PL_COUNT_RETRY counts the points left for the next pass, PL_COUNT_OVERFLOW is set when the table is full
+#define PL_COUNT_RETRY 0
+#define PL_COUNT_OVERFLOW 1
+
+void
+pl_atomic_add_f(
+    global float *val,
+    const  float  delta)
+{
+#ifdef NVIDIA_SM_20
+  float res = 0;
+  asm volatile ("atom.global.add.f32 %0, [%1], %2;" : "=f"(res) : "l"(val), "f"(delta));
+#else
+  union
+  {
+    float f;
+    unsigned int i;
+  }
+  old_val;
+  union
+  {
+    float f;
+    unsigned int i;
+  }
+  new_val;
+
+  global volatile unsigned int *ival = (global volatile unsigned int *)val;
+
+  do
+  {
+    old_val.i = atomic_add(ival, 0);
+    new_val.f = old_val.f + delta;
+  }
+  while (atomic_cmpxchg (ival, old_val.i, new_val.i) != old_val.i);
+#endif
+}
+
+unsigned int
+pl_hash(const int *key)
+{
+  unsigned int k = 0;
+  for(int i = 0; i < PL_D; i++)
+  {
+    k += key[i];
+    k *= 2531011u;
+  }
+  return k;
+}
+
+// never PL_EMPTY
+int
+pl_token(const unsigned int hash)
+{
+  return (int)(hash | 1u);
+}
+
+int
+pl_key_equal(global const int *keys, const int slot, const int *key)
+{
+  for(int i = 0; i < PL_D; i++)
+    if(keys[PL_D * slot + i] != key[i]) return 0;
+  return 1;
+}
+
+// slot of a point of the complete table, -1 if it is not in the lattice
+int
+pl_lookup(global const int *tokens, global const int *keys, const int capacity, const int *key)
+{
+  const unsigned int hash = pl_hash(key);
+  const int token = pl_token(hash);
+  int h = hash & (capacity - 1);
+  for(int probe = 0; probe < capacity; probe++)
+  {
+    const int t = tokens[h];
+    if(t == PL_EMPTY) return -1;
+    if(t == token && pl_key_equal(keys, h, key)) return h;
+    h = (h + 1) & (capacity - 1);
+  }
+  return -1;
+}
+
+// same as PermutohedralLattice::splat() up to the lookup of the vertices
+void
+pl_simplex(const float *position, int *greedy, int *rank, float *barycentric)
+{
+  float elevated[PL_D + 1];
+  float scale_factor[PL_D];
+  for(int i = 0; i < PL_D; i++)
+    scale_factor[i] = (PL_D + 1) * sqrt(2.0f / 3.0f) / sqrt((float)(i + 1) * (i + 2));
+
+  // first rotate position into the (d+1)-dimensional hyperplane
+  elevated[PL_D] = -PL_D * position[PL_D - 1] * scale_factor[PL_D - 1];
+  for(int i = PL_D - 1; i > 0; i--)
+    elevated[i] = elevated[i + 1] - i * position[i - 1] * scale_factor[i - 1]
+                  + (i + 2) * position[i] * scale_factor[i];
+  elevated[0] = elevated[1] + 2 * position[0] * scale_factor[0];
+
+  const float scale = 1.0f / (PL_D + 1);
+
+  // greedily search for the closest zero-colored lattice point
+  int sum = 0;
+  for(int i = 0; i <= PL_D; i++)
+  {
+    const float v = elevated[i] * scale;
+    const float up = ceil(v) * (PL_D + 1);
+    const float down = floor(v) * (PL_D + 1);
+    greedy[i] = (up - elevated[i] < elevated[i] - down) ? (int)up : (int)down;
+    sum += greedy[i];
+  }
+  sum /= PL_D + 1;
+
+  // rank differential to find the permutation between this simplex and the canonical one
+  for(int i = 0; i <= PL_D; i++) rank[i] = 0;
+  for(int i = 0; i < PL_D; i++)
+    for(int j = i + 1; j <= PL_D; j++)
+      if(elevated[i] - greedy[i] < elevated[j] - greedy[j])
+        rank[i]++;
+      else
+        rank[j]++;
+
+  if(sum > 0)
+  {
+    for(int i = 0; i <= PL_D; i++)
+    {
+      if(rank[i] >= PL_D + 1 - sum)
+      {
+        greedy[i] -= PL_D + 1;
+        rank[i] += sum - (PL_D + 1);
+      }
+      else
+        rank[i] += sum;
+    }
+  }
+  else if(sum < 0)
+  {
+    for(int i = 0; i <= PL_D; i++)
+    {
+      if(rank[i] < -sum)
+      {
+        greedy[i] += PL_D + 1;
+        rank[i] += (PL_D + 1) + sum;
+      }
+      else
+        rank[i] += sum;
+    }
+  }
+
+  for(int i = 0; i <= PL_D + 1; i++) barycentric[i] = 0.0f;
+  for(int i = 0; i <= PL_D; i++)
+  {
+    barycentric[PL_D - rank[i]] += (elevated[i] - greedy[i]) * scale;
+    barycentric[PL_D + 1 - rank[i]] -= (elevated[i] - greedy[i]) * scale;
+  }
+  barycentric[0] += 1.0f + barycentric[PL_D + 1];
+}
+
+kernel void
+permutohedral_zero(global int *tokens, global int *ready, global float4 *values, const int capacity)
+{
+  const int x = get_global_id(0);
+  if(x >= capacity) return;
+
+  tokens[x] = PL_EMPTY;
+  ready[x] = 0;
+  values[x] = (float4)0.0f;
+}
+
+kernel void
+permutohedral_splat(read_only image2d_t in, const int width, const int height, const float isigma_x,
+                    const float isigma_y, const float4 isigma_c,
+                    global int *tokens, global int *ready, global int *keys, const int capacity,
+                    global int *offsets, global float *weights, global int *counters, const int pass)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const size_t r = (size_t)(PL_D + 1) * mad24(y, width, x);
+
+  // all the vertices of this pixel were found in a previous pass
+  if(pass > 0)
+  {
+    int pending = 0;
+    for(int remainder = 0; remainder <= PL_D; remainder++) pending |= offsets[r + remainder] < 0;
+    if(!pending) return;
+  }
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float position[PL_D] = { x * isigma_x, y * isigma_y, pixel.x * isigma_c.x, pixel.y * isigma_c.y,
+                                 pixel.z * isigma_c.z };
+  int greedy[PL_D + 1];
+  int rank[PL_D + 1];
+  float barycentric[PL_D + 2];
+  pl_simplex(position, greedy, rank, barycentric);
+
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+  {
+    if(pass > 0 && offsets[r + remainder] >= 0) continue;
+
+    // coordinates of the vertex, the last one is redundant as they sum to zero
+    int key[PL_D];
+    for(int i = 0; i < PL_D; i++)
+      key[i] = greedy[i] + (rank[i] <= PL_D - remainder ? remainder : remainder - (PL_D + 1));
+
+    const unsigned int hash = pl_hash(key);
+    const int token = pl_token(hash);
+    int h = hash & (capacity - 1);
+    int slot = -1;
+    int probe = 0;
+    for(; probe < PL_MAX_PROBES; probe++)
+    {
+      const int old = atomic_cmpxchg(tokens + h, PL_EMPTY, token);
+      if(old == PL_EMPTY)
+      {
+        // claimed a new slot
+        for(int i = 0; i < PL_D; i++) keys[PL_D * h + i] = key[i];
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+        atomic_xchg(ready + h, 1);
+        slot = h;
+        break;
+      }
+      if(old == token)
+      {
+        // try again on the next pass
+        if(!atomic_add(ready + h, 0)) break;
+        if(pl_key_equal(keys, h, key))
+        {
+          slot = h;
+          break;
+        }
+      }
+      h = (h + 1) & (capacity - 1);
+    }
+
+    if(probe == PL_MAX_PROBES)
+      atomic_xchg(counters + PL_COUNT_OVERFLOW, 1);
+    else if(slot < 0)
+      atomic_inc(counters + PL_COUNT_RETRY);
+
+    offsets[r + remainder] = slot;
+    weights[r + remainder] = barycentric[remainder];
+  }
+}
+
+kernel void
+permutohedral_accumulate(read_only image2d_t in, const int width, const int height,
+                         global const int *offsets, global const float *weights, global float *values)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const size_t r = (size_t)(PL_D + 1) * mad24(y, width, x);
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+  {
+    global float *value = values + 4 * offsets[r + remainder];
+    const float w = weights[r + remainder];
+    pl_atomic_add_f(value, w * pixel.x);
+    pl_atomic_add_f(value + 1, w * pixel.y);
+    pl_atomic_add_f(value + 2, w * pixel.z);
+    pl_atomic_add_f(value + 3, w);
+  }
+}
+
+// blur along one axis of the hyperplane, a step of +1 along the axis of the last, implicit, coordinate
+// moves all the others by +1
+kernel void
+permutohedral_blur(global const int *tokens, global const int *keys, const int capacity, const int axis,
+                   global const float4 *in, global float4 *out)
+{
+  const int x = get_global_id(0);
+  if(x >= capacity) return;
+
+  if(tokens[x] == PL_EMPTY)
+  {
+    out[x] = (float4)0.0f;
+    return;
+  }
+
+  int key1[PL_D], key2[PL_D];
+  for(int i = 0; i < PL_D; i++)
+  {
+    const int k = keys[PL_D * x + i];
+    key1[i] = k + 1;
+    key2[i] = k - 1;
+  }
+  if(axis < PL_D)
+  {
+    key1[axis] = keys[PL_D * x + axis] - PL_D;
+    key2[axis] = keys[PL_D * x + axis] + PL_D;
+  }
+
+  const int n1 = pl_lookup(tokens, keys, capacity, key1);
+  const int n2 = pl_lookup(tokens, keys, capacity, key2);
+  const float4 v1 = n1 < 0 ? (float4)0.0f : in[n1];
+  const float4 v2 = n2 < 0 ? (float4)0.0f : in[n2];
+
+  out[x] = 0.25f * v1 + 0.5f * in[x] + 0.25f * v2;
+}
+
+kernel void
+permutohedral_slice(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                    global const int *offsets, global const float *weights, global const float4 *values)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const size_t r = (size_t)(PL_D + 1) * mad24(y, width, x);
+  float4 sum = (float4)0.0f;
+  for(int remainder = 0; remainder <= PL_D; remainder++)
+    sum += weights[r + remainder] * values[offsets[r + remainder]];
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float4 o = sum / sum.w;
+  o.w = pixel.w;
+
+  write_imagef(out, (int2)(x, y), o);
+}
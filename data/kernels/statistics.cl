@@ -0,0 +1,121 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* Reductions of the pixelpipe buffers for histograms and color pickers, so only their results
+   are read back to the host. Work items stride over the region, each work group accumulates in
+   local memory before merging into the results. */
+
+/* histogram of the 3 first channels of the region, with the bin layout of the CPU histogram:
+   4 interleaved channels per bin. lab selects the scaling of Lab values instead of RGB. */
+kernel void
+histogram_4ch(read_only image2d_t in, const int x0, const int y0, const int width, const int height,
+              const int bins, const float mul, const int lab, global uint *histogram, local uint *buffer)
+{
+  const int lid = get_local_id(0);
+  const int lsz = get_local_size(0);
+
+  for(int k = lid; k < 3 * bins; k += lsz) buffer[k] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  const float4 scale = lab ? (float4)(mul / 100.0f, mul / 256.0f, mul / 256.0f, 0.0f) : (float4)mul;
+  const float4 shift = lab ? (float4)(0.0f, 128.0f, 128.0f, 0.0f) : (float4)0.0f;
+  const float4 top = (float4)(bins - 1);
+
+  for(int k = get_global_id(0); k < width * height; k += get_global_size(0))
+  {
+    const float4 pixel = read_imagef(in, sampleri, (int2)(x0 + k % width, y0 + k / width));
+    // fmax() first sends NaNs to the first bin
+    const int4 bin = convert_int4_rtz(fmin(fmax((pixel + shift) * scale, (float4)0.0f), top));
+    atomic_inc(buffer + 3 * bin.x);
+    atomic_inc(buffer + 3 * bin.y + 1);
+    atomic_inc(buffer + 3 * bin.z + 2);
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int k = lid; k < 3 * bins; k += lsz)
+    if(buffer[k]) atomic_add(histogram + 4 * (k / 3) + k % 3, buffer[k]);
+}
+
+/* B-spline blur of a pixel of the region, clamped to its edges. The CPU color picker denoises
+   the region this way before measuring it. */
+static inline float4
+_picker_denoise(read_only image2d_t in, const int x0, const int y0, const int width, const int height,
+                const int x, const int y)
+{
+  const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
+  float4 accumulator = (float4)0.0f;
+
+  for(int ii = 0; ii < 5; ii++)
+  {
+    const int xx = x0 + clamp(x + ii - 2, 0, width - 1);
+    float4 column = (float4)0.0f;
+    for(int jj = 0; jj < 5; jj++)
+      column += filter[jj] * read_imagef(in, sampleri, (int2)(xx, y0 + clamp(y + jj - 2, 0, height - 1)));
+    accumulator += filter[ii] * column;
+  }
+
+  return accumulator;
+}
+
+/* weighted sum, minimum and maximum of the denoised region, one triplet per work group in partial.
+   the local size needs to be a power of 2. */
+kernel void
+picker_4ch(read_only image2d_t in, const int x0, const int y0, const int width, const int height,
+           const float weight, global float4 *partial, local float4 *buffer)
+{
+  const int lid = get_local_id(0);
+  const int lsz = get_local_size(0);
+
+  float4 sum = (float4)0.0f;
+  float4 mn = (float4)INFINITY;
+  float4 mx = (float4)-INFINITY;
+
+  for(int k = get_global_id(0); k < width * height; k += get_global_size(0))
+  {
+    const float4 pixel = _picker_denoise(in, x0, y0, width, height, k % width, k / width);
+    sum += weight * pixel;
+    mn = fmin(mn, pixel);
+    mx = fmax(mx, pixel);
+  }
+
+  buffer[lid] = sum;
+  buffer[lsz + lid] = mn;
+  buffer[2 * lsz + lid] = mx;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  for(int offset = lsz / 2; offset > 0; offset = offset / 2)
+  {
+    if(lid < offset)
+    {
+      buffer[lid] += buffer[lid + offset];
+      buffer[lsz + lid] = fmin(buffer[lsz + lid], buffer[lsz + lid + offset]);
+      buffer[2 * lsz + lid] = fmax(buffer[2 * lsz + lid], buffer[2 * lsz + lid + offset]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  if(lid == 0)
+  {
+    const int group = get_group_id(0);
+    partial[3 * group] = buffer[0];
+    partial[3 * group + 1] = buffer[lsz];
+    partial[3 * group + 2] = buffer[2 * lsz];
+  }
+}
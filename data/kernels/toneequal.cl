@@ -0,0 +1,308 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* Tone equalizer: luminance mask, fast guided filter and exposure-independent guided filter
+   (EIGF) ported from common/luminance_mask.h, common/fast_guided_filter.h and common/eigf.h.
+   Grey images are single-channel images, the filter statistics are stored in four channels. */
+
+// same as MIN_FLOAT in fast_guided_filter.h
+#define TONEEQ_MIN_FLOAT 1.52587890625e-05f
+
+// same order as dt_iop_luminance_mask_method_t
+typedef enum dt_iop_luminance_mask_method_t
+{
+  DT_TONEEQ_MEAN = 0,
+  DT_TONEEQ_LIGHTNESS,
+  DT_TONEEQ_VALUE,
+  DT_TONEEQ_NORM_1,
+  DT_TONEEQ_NORM_2,
+  DT_TONEEQ_NORM_POWER,
+  DT_TONEEQ_GEOMEAN
+} dt_iop_luminance_mask_method_t;
+
+static inline float
+linear_contrast(const float pixel, const float fulcrum, const float contrast)
+{
+  return fmax((pixel - fulcrum) * contrast + fulcrum, TONEEQ_MIN_FLOAT);
+}
+
+kernel void
+toneeq_luminance_mask(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                      const int method, const float exposure_boost, const float fulcrum,
+                      const float contrast_boost)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float lum = 0.0f;
+
+  switch(method)
+  {
+    case DT_TONEEQ_MEAN:
+      lum = (pixel.x + pixel.y + pixel.z) / 3.0f;
+      break;
+
+    case DT_TONEEQ_LIGHTNESS:
+      lum = (fmax(fmax(pixel.x, pixel.y), pixel.z) + fmin(fmin(pixel.x, pixel.y), pixel.z)) / 2.0f;
+      break;
+
+    case DT_TONEEQ_VALUE:
+      lum = fmax(fmax(pixel.x, pixel.y), pixel.z);
+      break;
+
+    case DT_TONEEQ_NORM_1:
+      lum = fabs(pixel.x) + fabs(pixel.y) + fabs(pixel.z);
+      break;
+
+    case DT_TONEEQ_NORM_2:
+      lum = sqrt(pixel.x * pixel.x + pixel.y * pixel.y + pixel.z * pixel.z);
+      break;
+
+    case DT_TONEEQ_NORM_POWER:
+    {
+      const float4 value = fabs(pixel);
+      const float4 square = value * value;
+      lum = (square.x * value.x + square.y * value.y + square.z * value.z) / (square.x + square.y + square.z);
+      break;
+    }
+
+    case DT_TONEEQ_GEOMEAN:
+      lum = native_powr(fabs(pixel.x * pixel.y * pixel.z), 1.0f / 3.0f);
+      break;
+  }
+
+  write_imagef(out, (int2)(x, y), (float4)(linear_contrast(exposure_boost * lum, fulcrum, contrast_boost)));
+}
+
+/* bilinear resampling of any number of channels, with the same grid as interpolate_bilinear() */
+kernel void
+toneeq_resample(read_only image2d_t in, write_only image2d_t out, const int width_in, const int height_in,
+                const int width_out, const int height_out)
+{
+  const int j = get_global_id(0);
+  const int i = get_global_id(1);
+  if(j >= width_out || i >= height_out) return;
+
+  const float x_in = (float)j / (float)width_out * (float)width_in;
+  const float y_in = (float)i / (float)height_out * (float)height_in;
+
+  const int x_prev = min((int)floor(x_in), width_in - 1);
+  const int x_next = min((int)floor(x_in) + 1, width_in - 1);
+  const int y_prev = min((int)floor(y_in), height_in - 1);
+  const int y_next = min((int)floor(y_in) + 1, height_in - 1);
+
+  const float4 Q_NW = read_imagef(in, sampleri, (int2)(x_prev, y_prev));
+  const float4 Q_NE = read_imagef(in, sampleri, (int2)(x_next, y_prev));
+  const float4 Q_SE = read_imagef(in, sampleri, (int2)(x_next, y_next));
+  const float4 Q_SW = read_imagef(in, sampleri, (int2)(x_prev, y_next));
+
+  // distances to the unclamped next nodes, as on the CPU
+  const float Dy_next = floor(y_in) + 1.0f - y_in;
+  const float Dy_prev = 1.0f - Dy_next;
+  const float Dx_next = floor(x_in) + 1.0f - x_in;
+  const float Dx_prev = 1.0f - Dx_next;
+
+  write_imagef(out, (int2)(j, i), Dy_prev * (Q_SW * Dx_next + Q_SE * Dx_prev)
+                                  + Dy_next * (Q_NW * Dx_next + Q_NE * Dx_prev));
+}
+
+/* posterization of the guide in log2 space, sampling > 0 */
+kernel void
+toneeq_quantize(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                const float sampling, const float clip_min, const float clip_max)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float value = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const float quantized = exp2(floor(log2(value) / sampling) * sampling);
+  write_imagef(out, (int2)(x, y), (float4)(clamp(quantized, clip_min, clip_max)));
+}
+
+/* pack guide and mask for the box averages of the guided filter:
+   { guide, mask, guide * guide, guide * mask } */
+kernel void
+toneeq_guided_pack(read_only image2d_t guide, read_only image2d_t mask, write_only image2d_t out,
+                   const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float g = read_imagef(guide, sampleri, (int2)(x, y)).x;
+  const float m = read_imagef(mask, sampleri, (int2)(x, y)).x;
+  write_imagef(out, (int2)(x, y), (float4)(g, m, g * g, g * m));
+}
+
+/* pack guide and mask for the gaussian averages of the EIGF:
+   { guide, guide * guide, mask, mask * guide } */
+kernel void
+toneeq_eigf_pack(read_only image2d_t guide, read_only image2d_t mask, write_only image2d_t out,
+                 const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float g = read_imagef(guide, sampleri, (int2)(x, y)).x;
+  const float m = read_imagef(mask, sampleri, (int2)(x, y)).x;
+  write_imagef(out, (int2)(x, y), (float4)(g, g * g, m, m * g));
+}
+
+/* box average of the four channels along x then y, over a window of 2 * radius + 1 clipped
+   to the image, like dt_box_mean() with one iteration */
+kernel void
+toneeq_box_mean_x(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                  const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int start = max(x - radius, 0);
+  const int end = min(x + radius, width - 1);
+
+  float4 sum = (float4)0.0f;
+  for(int i = start; i <= end; i++) sum += read_imagef(in, sampleri, (int2)(i, y));
+
+  write_imagef(out, (int2)(x, y), sum / (float)(end - start + 1));
+}
+
+kernel void
+toneeq_box_mean_y(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                  const int radius)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int start = max(y - radius, 0);
+  const int end = min(y + radius, height - 1);
+
+  float4 sum = (float4)0.0f;
+  for(int j = start; j <= end; j++) sum += read_imagef(in, sampleri, (int2)(x, j));
+
+  write_imagef(out, (int2)(x, y), sum / (float)(end - start + 1));
+}
+
+/* linear blending parameters of the guided filter from the averages, a and b go in x and y */
+kernel void
+toneeq_guided_ab(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                 const float feathering)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 avg = read_imagef(in, sampleri, (int2)(x, y));
+  const float d = fmax((avg.z - avg.x * avg.x) + feathering, 1e-15f);
+  const float a = (avg.w - avg.x * avg.y) / d;
+  const float b = avg.y - a * avg.x;
+  write_imagef(out, (int2)(x, y), (float4)(a, b, 0.0f, 0.0f));
+}
+
+/* image = a * image + b, or its geometric mean with image */
+kernel void
+toneeq_guided_blend(read_only image2d_t in, read_only image2d_t ab, write_only image2d_t out,
+                    const int width, const int height, const int geomean)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float image = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const float2 params = read_imagef(ab, sampleri, (int2)(x, y)).xy;
+  const float blended = fmax(image * params.x + params.y, TONEEQ_MIN_FLOAT);
+  write_imagef(out, (int2)(x, y), (float4)(geomean ? sqrt(image * blended) : blended));
+}
+
+/* turn the averages of squares into variance and covariance */
+kernel void
+toneeq_eigf_variance(read_only image2d_t in, write_only image2d_t out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  float4 av = read_imagef(in, sampleri, (int2)(x, y));
+  av.y -= av.x * av.x;
+  av.w -= av.x * av.z;
+  write_imagef(out, (int2)(x, y), av);
+}
+
+kernel void
+toneeq_eigf_blend(read_only image2d_t in, read_only image2d_t mask, read_only image2d_t av,
+                  write_only image2d_t out, const int width, const int height, const float feathering,
+                  const int geomean)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float image = read_imagef(in, sampleri, (int2)(x, y)).x;
+  const float m = read_imagef(mask, sampleri, (int2)(x, y)).x;
+  const float4 stats = read_imagef(av, sampleri, (int2)(x, y));
+
+  const float norm_g = fmax(stats.x * image, 1e-6f);
+  const float norm_m = fmax(stats.z * m, 1e-6f);
+  const float normalized_var_guide = stats.y / norm_g;
+  const float normalized_covar = stats.w / sqrt(norm_g * norm_m);
+  const float a = normalized_covar / (normalized_var_guide + feathering);
+  const float b = stats.z - a * stats.x;
+  const float blended = fmax(image * a + b, TONEEQ_MIN_FLOAT);
+  write_imagef(out, (int2)(x, y), (float4)(geomean ? sqrt(image * blended) : blended));
+}
+
+/* exposure correction read from the LUT of commit_params() over [-8; 0] EV */
+kernel void
+toneeq_apply(read_only image2d_t in, read_only image2d_t luminance, write_only image2d_t out,
+             const int width, const int height, global const float *lut, const int lut_resolution)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float exposure = clamp(log2(read_imagef(luminance, sampleri, (int2)(x, y)).x), -8.0f, 0.0f);
+  const float correction = lut[(uint)round((exposure + 8.0f) * lut_resolution)];
+
+  write_imagef(out, (int2)(x, y), (float4)(correction * pixel.xyz, pixel.w));
+}
+
+/* grey display of the mask, offset to the output region, keeping alpha of the input or not */
+kernel void
+toneeq_show_mask(read_only image2d_t in, read_only image2d_t luminance, write_only image2d_t out,
+                 const int width, const int height, const int offset_x, const int offset_y,
+                 const int copy_alpha)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+
+  const int2 pos = (int2)(x + offset_x, y + offset_y);
+  const float lum = read_imagef(luminance, sampleri, pos).x;
+  const float intensity = sqrt(fmin(fmax(lum - 0.00390625f, 0.0f) / 0.99609375f, 1.0f));
+  const float alpha = copy_alpha ? read_imagef(in, sampleri, pos).w : intensity;
+
+  write_imagef(out, (int2)(x, y), (float4)(intensity, intensity, intensity, alpha));
+}
@@ -73,6 +73,7 @@ static gboolean _widget_scroll(GtkWidget *widget, GdkEventScroll *event);
 static gboolean _widget_key_press(GtkWidget *widget, GdkEventKey *event);
 static void _get_preferred_width(GtkWidget *widget, gint *minimum_size, gint *natural_size);
 static void _style_updated(GtkWidget *widget);
+static void _slider_background_invalidate(struct dt_bauhaus_widget_t *w);
 static void dt_bauhaus_widget_accept(struct dt_bauhaus_widget_t *w, gboolean timeout);
 static void dt_bauhaus_widget_reject(struct dt_bauhaus_widget_t *w);
 static void _combobox_set(GtkWidget *widget, const int pos, gboolean timeout);
@@ -797,6 +798,7 @@ static void _widget_finalize(GObject *widget)
   {
     dt_bauhaus_slider_data_t *d = &w->data.slider;
     if(d->timeout_handle) g_source_remove(d->timeout_handle);
+    _slider_background_invalidate(w);
     free(d->grad_pos);
   }
   else
@@ -1334,6 +1336,7 @@ static void _style_updated(GtkWidget *widget)
 {
   struct dt_bauhaus_widget_t *w = (struct dt_bauhaus_widget_t *)widget;
   _margins_retrieve(w);
+  _slider_background_invalidate(w);
 
   // gtk_widget_set_size_request is the minimal preferred, size.
   // it NEEDS to be defined and will be contextually adapted, possibly overriden by CSS.
@@ -1783,6 +1786,7 @@ void dt_bauhaus_slider_clear_stops(GtkWidget *widget)
   if(w->type != DT_BAUHAUS_SLIDER) return;
   dt_bauhaus_slider_data_t *d = &w->data.slider;
   d->grad_cnt = 0;
+  _slider_background_invalidate(w);
 }
 
 void dt_bauhaus_slider_set_stop(GtkWidget *widget, float stop, float r, float g, float b)
@@ -1796,6 +1800,7 @@ void dt_bauhaus_slider_set_stop(GtkWidget *widget, float stop, float r, float g,
     d->grad_col = malloc(DT_BAUHAUS_SLIDER_MAX_STOPS * sizeof(*d->grad_col));
     d->grad_pos = malloc(DT_BAUHAUS_SLIDER_MAX_STOPS * sizeof(*d->grad_pos));
   }
+  _slider_background_invalidate(w);
   // need to replace stop?
   for(int k = 0; k < d->grad_cnt; k++)
   {
@@ -1894,15 +1899,14 @@ static void dt_bauhaus_draw_quad(struct dt_bauhaus_widget_t *w, cairo_t *cr, con
  * @param cr Cairo object
  * @param width The width of the actual slider baseline (corrected for padding, margin and quad width if needed)
  */
-static void dt_bauhaus_draw_baseline(struct dt_bauhaus_widget_t *w, cairo_t *cr, float width)
+// the background of the line for orientation in slider, only depends on the range and the gradient stops
+static void dt_bauhaus_draw_baseline_background(struct dt_bauhaus_widget_t *w, cairo_t *cr, float width)
 {
-  // draw line for orientation in slider
   cairo_save(cr);
   dt_bauhaus_slider_data_t *d = &w->data.slider;
   const float baseline_top = darktable.bauhaus->line_height + INNER_PADDING;
   const float baseline_height = darktable.bauhaus->baseline_size;
 
-  // the background of the line
   cairo_rectangle(cr, 0, baseline_top, width, baseline_height);
   cairo_pattern_t *gradient = NULL;
   if(d->grad_cnt > 0)
@@ -1923,6 +1927,16 @@ static void dt_bauhaus_draw_baseline(struct dt_bauhaus_widget_t *w, cairo_t *cr,
   }
   cairo_fill(cr);
   if(gradient) cairo_pattern_destroy(gradient);
+  cairo_restore(cr);
+}
+
+// the fill feedback and the 0 reference over the background of the line, they follow the slider position
+static void dt_bauhaus_draw_baseline_foreground(struct dt_bauhaus_widget_t *w, cairo_t *cr, float width)
+{
+  cairo_save(cr);
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  const float baseline_top = darktable.bauhaus->line_height + INNER_PADDING;
+  const float baseline_height = darktable.bauhaus->baseline_size;
 
   // get the reference of the slider aka the position of the 0 value
   const float origin = fmaxf(fminf((d->factor > 0 ? -d->min - d->offset/d->factor
@@ -1958,6 +1972,51 @@ static void dt_bauhaus_draw_baseline(struct dt_bauhaus_widget_t *w, cairo_t *cr,
   cairo_restore(cr);
 }
 
+static void dt_bauhaus_draw_baseline(struct dt_bauhaus_widget_t *w, cairo_t *cr, float width)
+{
+  dt_bauhaus_draw_baseline_background(w, cr, width);
+  dt_bauhaus_draw_baseline_foreground(w, cr, width);
+}
+
+static void _slider_background_invalidate(struct dt_bauhaus_widget_t *w)
+{
+  if(w->type != DT_BAUHAUS_SLIDER) return;
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  if(d->background) cairo_surface_destroy(d->background);
+  d->background = NULL;
+}
+
+// the widget background and the background of the baseline are redrawn only when the size, the state,
+// the range or the gradient change, not at every move of the slider
+static cairo_surface_t *_slider_background(struct dt_bauhaus_widget_t *w, GtkStyleContext *context,
+                                           GtkAllocation *allocation, const GtkStateFlags state,
+                                           const float available_width)
+{
+  dt_bauhaus_slider_data_t *d = &w->data.slider;
+  dt_bauhaus_slider_background_t *key = &d->background_key;
+  if(d->background && key->width == allocation->width && key->height == allocation->height
+     && key->state == state && key->min == d->min && key->max == d->max && key->hard_min == d->hard_min
+     && key->hard_max == d->hard_max)
+    return d->background;
+
+  _slider_background_invalidate(w);
+  d->background = dt_cairo_image_surface_create(CAIRO_FORMAT_ARGB32, allocation->width, allocation->height);
+  cairo_t *cr = cairo_create(d->background);
+  gtk_render_background(context, cr, allocation->x, allocation->y, allocation->width, allocation->height);
+  cairo_translate(cr, w->margin->left + w->padding->left, w->margin->top + w->padding->top);
+  dt_bauhaus_draw_baseline_background(w, cr, available_width);
+  cairo_destroy(cr);
+
+  *key = (dt_bauhaus_slider_background_t){ .width = allocation->width,
+                                           .height = allocation->height,
+                                           .state = state,
+                                           .min = d->min,
+                                           .max = d->max,
+                                           .hard_min = d->hard_min,
+                                           .hard_max = d->hard_max };
+  return d->background;
+}
+
 static void dt_bauhaus_widget_reject(struct dt_bauhaus_widget_t *w)
 {
   switch(w->type)
@@ -2271,12 +2330,19 @@ static gboolean _widget_draw(GtkWidget *widget, cairo_t *crf)
   gtk_style_context_get(context, state, "background-color", &bg_color, NULL);
   _margins_retrieve(w);
 
-  // Paint background first
-  gtk_render_background(context, cr, allocation.x, allocation.y, allocation.width, allocation.height);
-
   // Translate Cairo coordinates to account for the widget spacing
   const float available_width = _widget_get_main_width(w, NULL, NULL);
   const float inner_height = _widget_get_main_height(w, NULL);
+
+  // Paint background first
+  if(w->type == DT_BAUHAUS_SLIDER)
+  {
+    cairo_set_source_surface(cr, _slider_background(w, context, &allocation, state, available_width), 0, 0);
+    cairo_paint(cr);
+  }
+  else
+    gtk_render_background(context, cr, allocation.x, allocation.y, allocation.width, allocation.height);
+
   cairo_translate(cr, w->margin->left + w->padding->left, w->margin->top + w->padding->top);
 
   // draw type specific content:
@@ -2325,8 +2391,8 @@ static gboolean _widget_draw(GtkWidget *widget, cairo_t *crf)
     }
     case DT_BAUHAUS_SLIDER:
     {
-      // line for orientation
-      dt_bauhaus_draw_baseline(w, cr, available_width);
+      // line for orientation, its background is already painted
+      dt_bauhaus_draw_baseline_foreground(w, cr, available_width);
 
       // Paint the non-active quad icon with some transparency, because
       // icons are bolder than the neighbouring text and appear brighter.
@@ -2867,10 +2933,14 @@ static void dt_bauhaus_slider_set_normalized(struct dt_bauhaus_widget_t *w, floa
     const float rounded_value = roundf(new_value * precision) / precision;
     d->pos = (rounded_value - d->min) / (d->max - d->min);
 
-    if(darktable.bauhaus->current == w)
-      gtk_widget_queue_draw(darktable.bauhaus->popup_area);
+    // mouse moves smaller than the displayed precision round to the same value, don't redraw for nothing
+    if(d->pos != old_pos)
+    {
+      if(darktable.bauhaus->current == w)
+        gtk_widget_queue_draw(darktable.bauhaus->popup_area);
 
-    gtk_widget_queue_draw(GTK_WIDGET(w));
+      gtk_widget_queue_draw(GTK_WIDGET(w));
+    }
 
 #if DEBUG
     fprintf(stdout, "%s | %s | %s | min: %f, max: %f, ratio: %f, base : %f, pos: %f\n",
@@ -63,6 +63,14 @@ typedef enum dt_bauhaus_curve_t
 } dt_bauhaus_curve_t;
 
 // data portion for a slider
+// what the cached background of a slider was drawn for
+typedef struct dt_bauhaus_slider_background_t
+{
+  int width, height;
+  GtkStateFlags state;
+  float min, max, hard_min, hard_max;
+} dt_bauhaus_slider_background_t;
+
 typedef struct dt_bauhaus_slider_data_t
 {
   float pos;      // normalized slider value
@@ -86,6 +94,9 @@ typedef struct dt_bauhaus_slider_data_t
 
   gboolean is_dragging;      // indicates is mouse is dragging slider
   guint timeout_handle; // used to store id of timeout routine
+
+  cairo_surface_t *background;                   // widget background and baseline, drawn once per key
+  dt_bauhaus_slider_background_t background_key; // what background was drawn for
 } dt_bauhaus_slider_data_t;
 
 typedef enum dt_bauhaus_combobox_alignment_t
@@ -38,10 +38,16 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "common/points.h"
 #include "control/conf.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_cache.h"
+#ifdef HAVE_HTTP_SERVER
+#include "common/http_server.h"
+#endif
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
@@ -51,6 +57,11 @@
 #include "osx/osx.h"
 #endif
 
+#if defined(HAVE_HTTP_SERVER) && !defined(_WIN32)
+#include <glib-unix.h>
+#include <signal.h>
+#endif
+
 #ifdef _WIN32
 #include "win/main_wrapper.h"
 #endif
@@ -60,6 +71,406 @@
 // Make sure it's OK to limit output extension length
 #define DT_MAX_OUTPUT_EXT_LENGTH 5
 
+/*
+ * batch export pipeline:
+ *  - a decoder thread loads the full-size input of the next images (raw decoding) into the mipmap cache,
+ *    and keeps them locked there so they can't be evicted before being processed,
+ *  - export threads run the pixelpipe and the format writer on the decoded images, so one image can be
+ *    encoded and written while the next one is processed.
+ * At most `inflight` decoded images are held at once, which bounds the memory.
+ */
+typedef struct dt_cli_slot_t
+{
+  int32_t id;
+  int num;
+  dt_mipmap_buffer_t buf;
+} dt_cli_slot_t;
+
+typedef struct dt_cli_pipeline_t
+{
+  GList *ids;
+  int total;
+  int inflight;
+  int held;             // decoded images not yet exported
+  GMutex lock;
+  GCond cond;
+  GAsyncQueue *decoded; // dt_cli_slot_t, id < 0 ends an export thread
+
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_data_t *fdata;
+  gboolean export_masks;
+  dt_colorspaces_color_profile_type_t icc_type;
+  const gchar *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+  int res;
+} dt_cli_pipeline_t;
+
+#define DT_CLI_EXPORT_THREADS 2
+
+static gpointer _decode_thread(gpointer data)
+{
+  dt_cli_pipeline_t *pipeline = (dt_cli_pipeline_t *)data;
+  int num = 1;
+  for(GList *iter = pipeline->ids; iter; iter = g_list_next(iter), num++)
+  {
+    g_mutex_lock(&pipeline->lock);
+    while(pipeline->held >= pipeline->inflight) g_cond_wait(&pipeline->cond, &pipeline->lock);
+    pipeline->held++;
+    g_mutex_unlock(&pipeline->lock);
+
+    dt_cli_slot_t *slot = calloc(1, sizeof(dt_cli_slot_t));
+    slot->id = GPOINTER_TO_INT(iter->data);
+    slot->num = num;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &slot->buf, slot->id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+    g_async_queue_push(pipeline->decoded, slot);
+  }
+
+  for(int k = 0; k < DT_CLI_EXPORT_THREADS; k++)
+  {
+    dt_cli_slot_t *slot = calloc(1, sizeof(dt_cli_slot_t));
+    slot->id = -1;
+    g_async_queue_push(pipeline->decoded, slot);
+  }
+  return NULL;
+}
+
+static gpointer _export_thread(gpointer data)
+{
+  dt_cli_pipeline_t *pipeline = (dt_cli_pipeline_t *)data;
+  dt_imageio_module_format_t *format = pipeline->format;
+
+  // one format struct per thread
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  memcpy(fdata, pipeline->fdata, format->params_size(format));
+
+  while(TRUE)
+  {
+    dt_cli_slot_t *slot = (dt_cli_slot_t *)g_async_queue_pop(pipeline->decoded);
+    if(slot->id < 0)
+    {
+      free(slot);
+      break;
+    }
+
+    // TODO: have a parameter in command line to get the export presets
+    dt_export_metadata_t metadata;
+    metadata.flags = dt_lib_export_metadata_default_flags();
+    metadata.list = NULL;
+    const int res = pipeline->storage->store(pipeline->storage, pipeline->sdata, slot->id, format, fdata,
+                                             slot->num, pipeline->total, TRUE, pipeline->export_masks,
+                                             pipeline->icc_type, pipeline->icc_filename, pipeline->icc_intent,
+                                             &metadata);
+
+    if(slot->buf.buf) dt_mipmap_cache_release(darktable.mipmap_cache, &slot->buf);
+    free(slot);
+
+    g_mutex_lock(&pipeline->lock);
+    if(res != 0) pipeline->res = 1;
+    pipeline->held--;
+    g_cond_signal(&pipeline->cond);
+    g_mutex_unlock(&pipeline->lock);
+  }
+
+  format->free_params(format, fdata);
+  return NULL;
+}
+
+/*
+ * variants: one input rendered with several sidecars. the input is decoded once and held in the mipmap
+ * cache, and the outputs of the raw stages stay in the cache shared between pipes from one export to
+ * the next, so each variant only computes the raw stages whose parameters differ from a previous one.
+ */
+typedef struct dt_cli_variant_t
+{
+  const char *xmp;
+  const char *output;
+} dt_cli_variant_t;
+
+// budget of the shared cache kept over the variants when none is configured, in MiB
+#define DT_CLI_VARIANTS_SHARED_CACHE 1024
+
+static int _export_variant(const int32_t id, const dt_cli_variant_t *variant, const int num, const int total,
+                           const char *output_ext, const int width, const int height, const char *style,
+                           const gboolean style_overwrite, const gboolean export_masks,
+                           dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
+                           dt_iop_color_intent_t icc_intent)
+{
+  dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+  const int failed = dt_exif_xmp_read(image, variant->xmp, 1);
+  // don't write new xmp:
+  dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+  if(failed)
+  {
+    fprintf(stderr, _("error: can't open xmp file %s"), variant->xmp);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  // the extension comes from --out-ext or from the output of the variant, which is stripped of it
+  gchar *filename = g_strdup(variant->output);
+  char *dot = strrchr(filename, '.');
+  if(dot && (strchr(dot, G_DIR_SEPARATOR) || (output_ext && strcmp(dot + 1, output_ext)))) dot = NULL;
+  gchar *ext = g_strdup(output_ext ? output_ext : (dot ? dot + 1 : ""));
+  if(dot) *dot = '\0';
+  if(!strcmp(ext, "jpg"))
+  {
+    g_free(ext);
+    ext = g_strdup("jpeg");
+  }
+  else if(!strcmp(ext, "tif"))
+  {
+    g_free(ext);
+    ext = g_strdup("tiff");
+  }
+
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(ext);
+  dt_imageio_module_storage_t *storage = dt_imageio_get_storage_by_name("disk");
+  if(format == NULL || storage == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), ext);
+    fprintf(stderr, "\n");
+    g_free(ext);
+    g_free(filename);
+    return 1;
+  }
+  g_free(ext);
+
+  dt_imageio_module_data_t *sdata = storage->get_params(storage);
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(sdata == NULL || fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    if(sdata) storage->free_params(storage, sdata);
+    if(fdata) format->free_params(format, fdata);
+    g_free(filename);
+    return 1;
+  }
+  // see the main export for this one
+  g_strlcpy((char *)sdata, filename, DT_MAX_PATH_FOR_PARAMS);
+  g_free(filename);
+
+  fdata->max_width = width;
+  fdata->max_height = height;
+  fdata->style[0] = '\0';
+  fdata->style_append = !style_overwrite;
+  if(style) g_strlcpy(fdata->style, style, sizeof(fdata->style));
+
+  dt_export_metadata_t metadata;
+  metadata.flags = dt_lib_export_metadata_default_flags();
+  metadata.list = NULL;
+  const int res = storage->store(storage, sdata, id, format, fdata, num, total, TRUE, export_masks, icc_type,
+                                 icc_filename, icc_intent, &metadata);
+
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+  return res != 0;
+}
+
+static int _export_variants(const char *input, GList *variants, const char *output_ext, const int width,
+                            const int height, const char *style, const gboolean style_overwrite,
+                            const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type,
+                            const gchar *icc_filename, dt_iop_color_intent_t icc_intent)
+{
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(input);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int32_t id = filmid ? dt_image_import(filmid, input, TRUE) : 0;
+  if(!id)
+  {
+    fprintf(stderr, _("error: can't open file %s"), input);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  // the export pipes release the shared cache when they are done, keep it alive between them
+  const int megabytes = dt_conf_get_int("pixelpipe_shared_cache_memory");
+  dt_dev_pixelpipe_shared_cache_t *shared
+      = dt_dev_pixelpipe_shared_cache_ref((size_t)(megabytes > 0 ? megabytes : DT_CLI_VARIANTS_SHARED_CACHE)
+                                          * 1024 * 1024);
+  if(megabytes <= 0) dt_conf_set_int("pixelpipe_shared_cache_memory", DT_CLI_VARIANTS_SHARED_CACHE);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+
+  int res = 0;
+  const int total = g_list_length(variants);
+  int num = 1;
+  for(GList *iter = variants; iter; iter = g_list_next(iter), num++)
+    res |= _export_variant(id, (dt_cli_variant_t *)iter->data, num, total, output_ext, width, height, style,
+                           style_overwrite, export_masks, icc_type, icc_filename, icc_intent);
+
+  if(buf.buf) dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  if(megabytes <= 0) dt_conf_set_int("pixelpipe_shared_cache_memory", megabytes);
+  dt_dev_pixelpipe_shared_cache_unref(shared);
+  return res;
+}
+
+#ifdef HAVE_HTTP_SERVER
+/*
+ * render server: a long-lived process answering render requests on http://localhost:<port>/render,
+ * so scripts don't pay for the library, OpenCL and module initialization on every image. images stay
+ * imported in the in-memory library between requests, keeping their decoded input in the caches.
+ * parameters, in the url or as an urlencoded POST body:
+ *  - image: path of the input file, required
+ *  - xmp: path of a sidecar whose history is applied, default: the history of a fresh import
+ *  - format: output extension, default: jpeg
+ *  - width, height: bounding box of the output, default: 0 = full resolution
+ *  - style: style appended to the history
+ * the answer is the encoded image.
+ */
+typedef struct dt_cli_server_t
+{
+  gboolean export_masks;
+  dt_colorspaces_color_profile_type_t icc_type;
+  const gchar *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+} dt_cli_server_t;
+
+static void _render_error(SoupMessage *msg, const guint status, const char *error)
+{
+  fprintf(stderr, "[render server] %s\n", error);
+  soup_message_set_status(msg, status);
+  soup_message_set_response(msg, "text/plain", SOUP_MEMORY_COPY, error, strlen(error));
+}
+
+static void _render_request(SoupMessage *msg, GHashTable *query, gpointer user_data)
+{
+  dt_cli_server_t *server = (dt_cli_server_t *)user_data;
+  const char *input = query ? g_hash_table_lookup(query, "image") : NULL;
+  const char *xmp = query ? g_hash_table_lookup(query, "xmp") : NULL;
+  const char *ext = query ? g_hash_table_lookup(query, "format") : NULL;
+  const char *width = query ? g_hash_table_lookup(query, "width") : NULL;
+  const char *height = query ? g_hash_table_lookup(query, "height") : NULL;
+  const char *style = query ? g_hash_table_lookup(query, "style") : NULL;
+
+  if(!input || !g_file_test(input, G_FILE_TEST_IS_REGULAR))
+  {
+    _render_error(msg, SOUP_STATUS_BAD_REQUEST, "missing or unreadable image");
+    return;
+  }
+  if(xmp && !g_file_test(xmp, G_FILE_TEST_IS_REGULAR))
+  {
+    _render_error(msg, SOUP_STATUS_BAD_REQUEST, "unreadable xmp");
+    return;
+  }
+
+  if(!ext || !strcmp(ext, "jpg"))
+    ext = "jpeg";
+  else if(!strcmp(ext, "tif"))
+    ext = "tiff";
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(ext);
+  if(format == NULL)
+  {
+    _render_error(msg, SOUP_STATUS_BAD_REQUEST, "unknown format");
+    return;
+  }
+
+  // importing an image already known returns its id
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(input);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int32_t id = filmid ? dt_image_import(filmid, input, TRUE) : 0;
+  if(!id)
+  {
+    _render_error(msg, SOUP_STATUS_UNPROCESSABLE_ENTITY, "can't import image");
+    return;
+  }
+
+  // the history of the previous request on this image must not leak into this one
+  if(xmp)
+  {
+    dt_image_t *image = dt_image_cache_get(darktable.image_cache, id, 'w');
+    const int failed = dt_exif_xmp_read(image, xmp, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    if(failed)
+    {
+      _render_error(msg, SOUP_STATUS_UNPROCESSABLE_ENTITY, "can't read xmp");
+      return;
+    }
+  }
+  else
+    dt_history_delete_on_image(id);
+
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  if(fdata == NULL)
+  {
+    _render_error(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR, "failed to get parameters from format module");
+    return;
+  }
+  fdata->max_width = width ? MAX(atoi(width), 0) : 0;
+  fdata->max_height = height ? MAX(atoi(height), 0) : 0;
+  fdata->style[0] = '\0';
+  fdata->style_append = 1;
+  if(style) g_strlcpy(fdata->style, style, sizeof(fdata->style));
+
+  gchar *template = g_strdup_printf("ansel-render-XXXXXX.%s", format->extension(fdata));
+  gchar *filename = NULL;
+  const int fd = g_file_open_tmp(template, &filename, NULL);
+  g_free(template);
+  if(fd < 0)
+  {
+    format->free_params(format, fdata);
+    _render_error(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR, "can't create temporary file");
+    return;
+  }
+  close(fd);
+
+  dt_export_metadata_t metadata;
+  metadata.flags = dt_lib_export_metadata_default_flags();
+  metadata.list = NULL;
+  const int res = dt_imageio_export(id, filename, format, fdata, TRUE, TRUE, server->export_masks,
+                                    server->icc_type, server->icc_filename, server->icc_intent, NULL, NULL, 1, 1,
+                                    &metadata);
+
+  gchar *data = NULL;
+  gsize length = 0;
+  if(!res && g_file_get_contents(filename, &data, &length, NULL))
+  {
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    soup_message_set_response(msg, format->mime(fdata), SOUP_MEMORY_TAKE, data, length);
+  }
+  else
+    _render_error(msg, SOUP_STATUS_UNPROCESSABLE_ENTITY, "export failed");
+
+  g_unlink(filename);
+  g_free(filename);
+  format->free_params(format, fdata);
+}
+
+#ifndef _WIN32
+static gboolean _serve_quit(gpointer user_data)
+{
+  g_main_loop_quit((GMainLoop *)user_data);
+  return G_SOURCE_REMOVE;
+}
+#endif
+
+static int _serve(const int port, dt_cli_server_t *params)
+{
+  dt_http_server_t *server = dt_http_server_create_service(port, "/render", _render_request, params);
+  if(server == NULL) return 1;
+
+  fprintf(stderr, _("serving renders on %s\n"), server->url);
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+#ifndef _WIN32
+  g_unix_signal_add(SIGINT, _serve_quit, loop);
+  g_unix_signal_add(SIGTERM, _serve_quit, loop);
+#endif
+  g_main_loop_run(loop);
+  g_main_loop_unref(loop);
+
+  dt_http_server_kill(server);
+  return 0;
+}
+#endif
+
 static void usage(const char *progname)
 {
   fprintf(stderr, "usage: %s [<input file or dir>] [<xmp file>] <output destination> [options] [--core <darktable options>]\n", progname);
@@ -68,6 +479,8 @@ static void usage(const char *progname)
   fprintf(stderr, "   --width <max width> default: 0 = full resolution\n");
   fprintf(stderr, "   --height <max height> default: 0 = full resolution\n");
   fprintf(stderr, "   --bpp <bpp>, unsupported\n");
+  fprintf(stderr, "   --inflight <n> number of images decoded ahead of export, default: 2\n");
+  fprintf(stderr, "                  bounds the memory used by the export pipeline\n");
   fprintf(stderr, "   --export_masks <0|1|false|true>, default: false\n");
   fprintf(stderr, "   --style <style name>\n");
   fprintf(stderr, "   --style-overwrite\n");
@@ -77,11 +490,18 @@ static void usage(const char *progname)
   fprintf(stderr, "                          if specified, takes preference over output\n");
   fprintf(stderr, "   --import <file or dir> specify input file or dir, can be used'\n");
   fprintf(stderr, "                          multiple times instead of input file\n");
+  fprintf(stderr, "   --variant <xmp file> <output destination> export the input file with this xmp\n");
+  fprintf(stderr, "                          can be used multiple times instead of xmp and output,\n");
+  fprintf(stderr, "                          the input is decoded once for all the variants\n");
   fprintf(stderr, "   --icc-type <type> specify icc type, default to NONE\n");
   fprintf(stderr, "                     use --help icc-type for list of supported types\n");
   fprintf(stderr, "   --icc-file <file> specify icc filename, default to NONE\n");
   fprintf(stderr, "   --icc-intent <intent> specify icc intent, default to LAST\n");
   fprintf(stderr, "                     use --help icc-intent for list of supported intents\n");
+#ifdef HAVE_HTTP_SERVER
+  fprintf(stderr, "   --serve <port> keep running and render the images requested on\n");
+  fprintf(stderr, "                  http://localhost:<port>/render instead of exporting\n");
+#endif
   fprintf(stderr, "   --verbose\n");
   fprintf(stderr, "   --help,-h [option]\n");
   fprintf(stderr, "   --version\n");
@@ -195,12 +615,13 @@ int main(int argc, char *arg[])
   gchar *output_ext = NULL;
   char *style = NULL;
   int file_counter = 0;
-  int width = 0, height = 0, bpp = 0;
+  int width = 0, height = 0, bpp = 0, inflight = 2, serve_port = 0;
   gboolean verbose = FALSE,
            style_overwrite = FALSE, custom_presets = TRUE, export_masks = FALSE,
            output_to_dir = FALSE;
 
   GList* inputs = NULL;
+  GList *variants = NULL;
 
   dt_colorspaces_color_profile_type_t icc_type = DT_COLORSPACE_NONE;
   gchar *icc_filename = NULL;
@@ -238,6 +659,11 @@ int main(int argc, char *arg[])
         k++;
         height = MAX(atoi(arg[k]), 0);
       }
+      else if(!strcmp(arg[k], "--inflight") && argc > k + 1)
+      {
+        k++;
+        inflight = MAX(atoi(arg[k]), 1);
+      }
       else if(!strcmp(arg[k], "--bpp") && argc > k + 1)
       {
         k++;
@@ -309,6 +735,13 @@ int main(int argc, char *arg[])
         else
           fprintf(stderr, _("notice: input file or dir '%s' doesn't exist, skipping\n"), arg[k]);
       }
+      else if(!strcmp(arg[k], "--variant") && argc > k + 2)
+      {
+        dt_cli_variant_t *variant = malloc(sizeof(dt_cli_variant_t));
+        variant->xmp = arg[++k];
+        variant->output = arg[++k];
+        variants = g_list_append(variants, variant);
+      }
       else if(!strcmp(arg[k], "--icc-type") && argc > k + 1)
       {
         k++;
@@ -347,6 +780,19 @@ int main(int argc, char *arg[])
           exit(1);
         }
       }
+#ifdef HAVE_HTTP_SERVER
+      else if(!strcmp(arg[k], "--serve") && argc > k + 1)
+      {
+        k++;
+        serve_port = CLAMP(atoi(arg[k]), 0, 65535);
+        if(serve_port == 0)
+        {
+          fprintf(stderr, _("incorrect port for --serve: '%s'\n"), arg[k]);
+          usage(arg[0]);
+          exit(1);
+        }
+      }
+#endif
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -386,6 +832,61 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
+  if(variants)
+  {
+    // the xmp files and outputs come with the variants
+    if(file_counter != 1 || inputs || serve_port)
+    {
+      fprintf(stderr, _("error: --variant takes a single input file and no xmp or output\n"));
+      usage(arg[0]);
+      free(m_arg);
+      g_list_free_full(variants, free);
+      exit(1);
+    }
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
+    {
+      free(m_arg);
+      g_list_free_full(variants, free);
+      exit(1);
+    }
+    const int res = _export_variants(input_filename, variants, output_ext, width, height, style,
+                                     style_overwrite, export_masks, icc_type, icc_filename, icc_intent);
+    g_list_free_full(variants, free);
+    g_free(icc_filename);
+    g_free(output_ext);
+    dt_cleanup();
+    free(m_arg);
+    exit(res);
+  }
+
+#ifdef HAVE_HTTP_SERVER
+  if(serve_port)
+  {
+    // inputs and output come with each request
+    if(file_counter > 0 || inputs)
+    {
+      fprintf(stderr, _("error: --serve doesn't take input or output files\n"));
+      usage(arg[0]);
+      exit(1);
+    }
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
+    dt_cli_server_t params = { .export_masks = export_masks,
+                               .icc_type = icc_type,
+                               .icc_filename = icc_filename,
+                               .icc_intent = icc_intent };
+    const int res = _serve(serve_port, &params);
+    g_free(icc_filename);
+    g_free(output_ext);
+    dt_cleanup();
+    free(m_arg);
+    exit(res);
+  }
+#endif
+
   if( (inputs && file_counter < 1) || (!inputs && file_counter < 2) || file_counter > 3)
   {
     usage(arg[0]);
@@ -708,18 +1209,34 @@ int main(int argc, char *arg[])
 
   // TODO: add a callback to set the bpp without going through the config
 
-  int num = 1, res = 0;
-  for(GList *iter = id_list; iter; iter = g_list_next(iter), num++)
-  {
-    const int id = GPOINTER_TO_INT(iter->data);
-    // TODO: have a parameter in command line to get the export presets
-    dt_export_metadata_t metadata;
-    metadata.flags = dt_lib_export_metadata_default_flags();
-    metadata.list = NULL;
-    if(storage->store(storage, sdata, id, format, fdata, num, total, TRUE, export_masks,
-                      icc_type, icc_filename, icc_intent, &metadata) != 0)
-      res = 1;
-  }
+  dt_cli_pipeline_t pipeline = { .ids = id_list,
+                                 .total = total,
+                                 .inflight = inflight,
+                                 .held = 0,
+                                 .decoded = g_async_queue_new(),
+                                 .storage = storage,
+                                 .sdata = sdata,
+                                 .format = format,
+                                 .fdata = fdata,
+                                 .export_masks = export_masks,
+                                 .icc_type = icc_type,
+                                 .icc_filename = icc_filename,
+                                 .icc_intent = icc_intent,
+                                 .res = 0 };
+  g_mutex_init(&pipeline.lock);
+  g_cond_init(&pipeline.cond);
+
+  GThread *decoder = g_thread_new("cli decode", _decode_thread, &pipeline);
+  GThread *exporters[DT_CLI_EXPORT_THREADS];
+  for(int t = 0; t < DT_CLI_EXPORT_THREADS; t++) exporters[t] = g_thread_new("cli export", _export_thread, &pipeline);
+
+  g_thread_join(decoder);
+  for(int t = 0; t < DT_CLI_EXPORT_THREADS; t++) g_thread_join(exporters[t]);
+
+  const int res = pipeline.res;
+  g_async_queue_unref(pipeline.decoded);
+  g_mutex_clear(&pipeline.lock);
+  g_cond_clear(&pipeline.cond);
 
   // cleanup time
   if(storage->finalize_store) storage->finalize_store(storage, sdata);
@@ -18,6 +18,7 @@
 
 #include "common/bilateral.h"
 #include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align
+#include "develop/pixelpipe_arena.h" // for dt_pixelpipe_alloc_align_float, dt_pixelpipe_free_align
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
@@ -109,31 +110,9 @@ size_t dt_bilateral_singlebuffer_size2(const int width,
 }
 #endif /* !HAVE_OPENCL */
 
-static size_t image_to_grid(const dt_bilateral_t *const b, const int i, const int j, const float L,
-                            float *xf, float *yf, float *zf)
-{
-  float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
-  float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
-  float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int yi = MIN((int)y, b->size_y - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *yf = y - yi;
-  *zf = z - zi;
-  return ((xi + yi * b->size_x) * b->size_z) + zi;
-}
-
-static size_t image_to_relgrid(const dt_bilateral_t *const b, const int i, const float L, float *xf, float *zf)
-{
-  float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
-  float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *zf = z - zi;
-  return (xi * b->size_z) + zi;
-}
+// Number of pixels whose grid coordinates are computed together before they are splatted. The coordinates
+// vectorize, the scatter into the grid does not, so keep them apart.
+#define BILATERAL_SPLAT_BLOCK 16
 
 dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
                                   const int height,    // height of input image
@@ -148,7 +127,9 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->numslices = darktable.num_openmp_threads;
   b->sliceheight = (height + b->numslices - 1) / b->numslices;
   b->slicerows = (b->size_y + b->numslices - 1) / b->numslices + 2;
-  b->buf = dt_calloc_align_float(b->size_x * b->size_z * b->numslices * b->slicerows);
+  const size_t buf_size = b->size_x * b->size_z * b->numslices * b->slicerows;
+  b->buf = dt_pixelpipe_alloc_align_float(buf_size);
+  if(b->buf) memset(b->buf, 0, sizeof(float) * buf_size);
   if (!b->buf)
   {
     fprintf(stderr,"[bilateral] unable to allocate buffer for %zux%zux%zu grid\n",b->size_x,b->size_y,b->size_z);
@@ -160,15 +141,18 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(in:64)
-#endif
+__DT_CLONE_TARGETS__
 void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
 {
   const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
   const int oz = 1;
   const float sigma_s = b->sigma_s * b->sigma_s;
+  const float sigma = b->sigma_s;
+  const float sigma_r = b->sigma_r;
+  const int size_x = b->size_x;
+  const int size_z = b->size_z;
+  const int width = b->width;
   float *const buf = b->buf;
 
   if (!buf) return;
@@ -188,7 +172,7 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, oy, oz, ox, sigma_s, buf, offsets) \
+  dt_omp_firstprivate(in, oy, oz, ox, sigma_s, sigma, sigma_r, size_x, size_z, width, buf, offsets) \
   shared(b)
 #endif
   for(int slice = 0; slice < b->numslices; slice++)
@@ -205,28 +189,48 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
       const int yi = MIN((int)y, b->size_y - 2);
       const float yf = y - yi;
       const size_t base = (size_t)(yi + slice_offset) * oy;
-      for(int i = 0; i < b->width; i++)
+      const float *const row = in + (size_t)4 * j * width;
+
+      for(int i0 = 0; i0 < width; i0 += BILATERAL_SPLAT_BLOCK)
       {
-        size_t index = 4 * (j * b->width + i);
-        float xf, zf;
-        const float L = in[index];
-        // nearest neighbour splatting:
-        const size_t grid_index = base + image_to_relgrid(b, i, L, &xf, &zf);
-        // sum up payload here
-        const dt_aligned_pixel_t contrib =
+        const int n = MIN(BILATERAL_SPLAT_BLOCK, width - i0);
+        size_t DT_ALIGNED_ARRAY grid_index[BILATERAL_SPLAT_BLOCK];
+        float DT_ALIGNED_ARRAY xf[BILATERAL_SPLAT_BLOCK];
+        float DT_ALIGNED_ARRAY zf[BILATERAL_SPLAT_BLOCK];
+
+        // nearest neighbour splatting: grid cells and trilinear weights of the whole block at once
+#ifdef _OPENMP
+#pragma omp simd aligned(grid_index, xf, zf:64)
+#endif
+        for(int k = 0; k < n; k++)
+        {
+          const float x = CLAMPS((i0 + k) / sigma, 0, size_x - 1);
+          const float z = CLAMPS(row[4 * (i0 + k)] / sigma_r, 0, size_z - 1);
+          const int xi = MIN((int)x, size_x - 2);
+          const int zi = MIN((int)z, size_z - 2);
+          xf[k] = x - xi;
+          zf[k] = z - zi;
+          grid_index[k] = base + (size_t)xi * ox + zi;
+        }
+
+        for(int k = 0; k < n; k++)
         {
-          (1.0f - xf) * (1.0f - yf) * 100.0f / sigma_s,	// precompute the contributions along the first two dimensions
-          xf * (1.0f - yf) * 100.0f / sigma_s,
-          (1.0f - xf) * yf * 100.0f / sigma_s,
-          xf * yf * 100.0f / sigma_s
-        };
+          // sum up payload here
+          const dt_aligned_pixel_t contrib =
+          {
+            (1.0f - xf[k]) * (1.0f - yf) * 100.0f / sigma_s,	// precompute the contributions along the first two dimensions
+            xf[k] * (1.0f - yf) * 100.0f / sigma_s,
+            (1.0f - xf[k]) * yf * 100.0f / sigma_s,
+            xf[k] * yf * 100.0f / sigma_s
+          };
 #ifdef _OPENMP
 #pragma omp simd aligned(buf:64)
 #endif
-        for(int k = 0; k < 4; k++)
-        {
-          buf[grid_index + offsets[k]] += (contrib[k] * (1.0f - zf));
-          buf[grid_index + offsets[k+4]] += (contrib[k] * zf);
+          for(int c = 0; c < 4; c++)
+          {
+            buf[grid_index[k] + offsets[c]] += (contrib[c] * (1.0f - zf[k]));
+            buf[grid_index[k] + offsets[c+4]] += (contrib[c] * zf[k]);
+          }
         }
       }
     }
@@ -255,9 +259,7 @@ void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(buf:64)
-#endif
+__DT_CLONE_TARGETS__
 static void blur_line_z(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
                         const int size2, const int size3)
 {
@@ -297,9 +299,7 @@ static void blur_line_z(float *buf, const int offset1, const int offset2, const
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(buf:64)
-#endif
+__DT_CLONE_TARGETS__
 static void blur_line(float *buf, const int offset1, const int offset2, const int offset3, const int size1,
                       const int size2, const int size3)
 {
@@ -358,9 +358,7 @@ void dt_bilateral_blur(const dt_bilateral_t *b)
 }
 
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
-#endif
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
@@ -371,22 +369,41 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
+  const int size_x = b->size_x;
+  const int size_y = b->size_y;
+  const int size_z = b->size_z;
 
   if (!buf) return;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, ox, oy, oz, height, width, buf) \
-    shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, ox, oy, oz, height, width, sigma_s, sigma_r, size_x, size_y, size_z, buf) \
+  shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const size_t base = (size_t)yi * oy;
+
+    // trilinear lookup. Each pixel only reads and writes its own channels, so this is safe in place too,
+    // and the 8 grid reads turn into gathers on the vector clones.
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
+      const size_t index = 4 * ((size_t)j * width + i);
       const float L = in[index];
-      // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(L / sigma_r, 0, size_z - 1);
+      const int xi = MIN((int)x, size_x - 2);
+      const int zi = MIN((int)z, size_z - 2);
+      const float xf = x - xi;
+      const float zf = z - zi;
+      const size_t gi = base + (size_t)xi * ox + zi;
       const float Lout = fmaxf( 0.0f, L
                          + norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
                                    + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
@@ -405,9 +422,7 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
-#endif
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
                                   const float detail)
 {
@@ -419,22 +434,41 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
+  const int size_x = b->size_x;
+  const int size_y = b->size_y;
+  const int size_z = b->size_z;
 
   if (!buf) return;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, oy, oz, ox, buf, width, height) \
-  shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, oy, oz, ox, buf, width, height, sigma_s, sigma_r, size_x, size_y, size_z) \
+  shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const size_t base = (size_t)yi * oy;
+
+    // trilinear lookup. Each pixel only reads and writes its own channels, so this is safe in place too,
+    // and the 8 grid reads turn into gathers on the vector clones.
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
+      const size_t index = 4 * ((size_t)j * width + i);
       const float L = in[index];
-      // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(L / sigma_r, 0, size_z - 1);
+      const int xi = MIN((int)x, size_x - 2);
+      const int zi = MIN((int)z, size_z - 2);
+      const float xf = x - xi;
+      const float zf = z - zi;
+      const size_t gi = base + (size_t)xi * ox + zi;
       const float Lout = norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
                                  + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
                                  + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
@@ -451,7 +485,7 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 void dt_bilateral_free(dt_bilateral_t *b)
 {
   if(!b) return;
-  dt_free_align(b->buf);
+  dt_pixelpipe_free_align(b->buf);
   free(b);
 }
 
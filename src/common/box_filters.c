@@ -28,6 +28,7 @@
 #include "common/math.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
+#include "develop/pixelpipe_arena.h"
 #if defined(__SSE__)
 #include <xmmintrin.h>
 #endif
@@ -47,6 +48,7 @@
 #define PREFETCH_NTA(addr)
 #endif
 
+__DT_CLONE_TARGETS__
 static void blur_horizontal_1ch(float *const restrict buf, const int height, const int width, const int radius,
                                 float *const restrict scanlines, const size_t padded_size)
 {
@@ -110,6 +112,7 @@ static void blur_horizontal_1ch(float *const restrict buf, const int height, con
   return;
 }
 
+__DT_CLONE_TARGETS__
 static void blur_horizontal_2ch(float *const restrict buf, const int height, const int width, const int radius,
                                 float *const restrict scanlines, const size_t padded_size)
 {
@@ -201,35 +204,34 @@ static void sub_4wide(float *const restrict accum, const dt_aligned_pixel_t valu
     accum[c] -= values[c];
 }
 
+// The accurate variants below accumulate in double precision. That keeps the running sums exact enough over
+// any realistic window and image size without Kahan compensation, which needed four dependent operations for
+// every single add or subtract.
+
 // Put the to-be-vectorized loop into a function by itself to nudge the compiler into actually vectorizing...
 // With optimization enabled, this gets inlined and interleaved with other instructions as though it had been
 // written in place, so we get a net win from better vectorization.
-static void load_add_4wide_Kahan(float *const restrict out, dt_aligned_pixel_t accum,
-                                 const float *const restrict values, float *const restrict comp)
+static void load_add_4wide_f64(float *const restrict out, double *const restrict accum,
+                               const float *const restrict values)
 {
-  for_four_channels(c,aligned(accum, comp, out))
+  for_four_channels(c,aligned(accum, out))
   {
     const float v = values[c];
     out[c] = v;
-    // Kahan (compensated) summation
-    const float t1 = v - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
+    accum[c] += v;
   }
 }
 
-static void sub_4wide_Kahan(float *const restrict accum, const dt_aligned_pixel_t values,
-                            float *const restrict comp)
+static void sub_4wide_f64(double *const restrict accum, const dt_aligned_pixel_t values)
 {
-  for_four_channels(c,aligned(accum,comp,values))
-  {
-    // Kahan (compensated) summation
-    const float t1 = -values[c] - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
-  }
+  for_four_channels(c,aligned(accum,values))
+    accum[c] -= values[c];
+}
+
+static void store_scaled_4wide_f64(float *const restrict out, const double *const restrict in, const double scale)
+{
+  for_four_channels(c,aligned(in))
+    out[c] = in[c] / scale;
 }
 
 static void store_scaled_4wide(float *const restrict out, const dt_aligned_pixel_t in, const float scale)
@@ -261,42 +263,39 @@ static void load_add_16wide(float *const restrict out, float *const restrict acc
   }
 }
 
-static void sub_16wide_Kahan(float *const restrict accum, const float *const restrict values,
-                             float *const restrict comp)
+static void sub_16wide_f64(double *const restrict accum, const float *const restrict values)
 {
 #ifdef _OPENMP
-#pragma omp simd aligned(accum,comp : 64) aligned(values : 16)
+#pragma omp simd aligned(accum : 64) aligned(values : 16)
 #endif
   for(size_t c = 0; c < 16; c++)
-  {
-    const float v = -values[c];
-    // Kahan (compensated) summation
-    const float t1 = v - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
-  }
+    accum[c] -= values[c];
 }
 
 // copy 16 floats from a possibly-unaligned buffer into aligned temporary space, and also add to accumulator
-static void load_add_16wide_Kahan(float *const restrict out, float *const restrict accum,
-                                  const float *const restrict in, float *const restrict comp)
+static void load_add_16wide_f64(float *const restrict out, double *const restrict accum,
+                                const float *const restrict in)
 {
 #ifdef _OPENMP
-#pragma omp simd aligned(accum, comp, out : 64)
+#pragma omp simd aligned(accum, out : 64)
 #endif
   for (size_t c = 0; c < 16; c++)
   {
     const float v = in[c];
     out[c] = v;
-    // Kahan (compensated) summation
-    const float t1 = v - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
+    accum[c] += v;
   }
 }
 
+static void store_scaled_16wide_f64(float *const restrict out, const double *const restrict in, const double scale)
+{
+#ifdef _OPENMP
+#pragma omp simd aligned(in : 64)
+#endif
+  for(size_t c = 0; c < 16; c++)
+    out[c] = in[c] / scale;
+}
+
 // copy 16 floats from aligned temporary space back to the possibly-unaligned user buffer
 static void store_16wide(float *const restrict out, const float *const restrict in)
 {
@@ -316,44 +315,32 @@ static void store_scaled_16wide(float *const restrict out, const float *const re
     out[c] = in[c] / scale;
 }
 
-static void sub_Nwide_Kahan(const size_t N, float *const restrict accum, const float *const restrict values,
-                            float *const restrict comp)
+static void sub_Nwide_f64(const size_t N, double *const restrict accum, const float *const restrict values)
 {
 #ifdef _OPENMP
-#pragma omp simd aligned(accum,comp : 64)
+#pragma omp simd aligned(accum : 64)
 #endif
   for(size_t c = 0; c < N; c++)
-  {
-    const float v = -values[c];
-    // Kahan (compensated) summation
-    const float t1 = v - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
-  }
+    accum[c] -= values[c];
 }
 
 // copy N (<=16) floats from a possibly-unaligned buffer into aligned temporary space, and also add to accumulator
-static void load_add_Nwide_Kahan(const size_t N, float *const restrict out, float *const restrict accum,
-                                 const float *const restrict in, float *const restrict comp)
+static void load_add_Nwide_f64(const size_t N, float *const restrict out, double *const restrict accum,
+                               const float *const restrict in)
 {
 #ifdef _OPENMP
-#pragma omp simd aligned(accum, comp : 64)
+#pragma omp simd aligned(accum : 64)
 #endif
   for (size_t c = 0; c < N; c++)
   {
     const float v = in[c];
     out[c] = v;
-    // Kahan (compensated) summation
-    const float t1 = v - comp[c];
-    const float t2 = accum[c] + t1;
-    comp[c] = (t2 - accum[c]) - t1;
-    accum[c] = t2;
+    accum[c] += v;
   }
 }
 
-static void store_scaled_Nwide(const size_t N, float *const restrict out, const float *const restrict in,
-                               const float scale)
+static void store_scaled_Nwide_f64(const size_t N, float *const restrict out, const double *const restrict in,
+                                   const double scale)
 {
 #ifdef _OPENMP
 #pragma omp simd aligned(in : 64)
@@ -363,6 +350,7 @@ static void store_scaled_Nwide(const size_t N, float *const restrict out, const
 }
 
 
+__DT_CLONE_TARGETS__
 static void blur_horizontal_4ch(float *const restrict buf, const size_t height, const size_t width, const size_t radius,
                                 float *const restrict scanlines, const size_t padded_size)
 {
@@ -424,17 +412,16 @@ static void blur_horizontal_4ch(float *const restrict buf, const size_t height,
 }
 
 // invoked inside an OpenMP parallel for, so no need to parallelize
-static void blur_horizontal_4ch_Kahan(float *const restrict buf, const size_t width,
-                                      const size_t radius, float *const restrict scratch)
+static void blur_horizontal_4ch_f64(float *const restrict buf, const size_t width,
+                                    const size_t radius, float *const restrict scratch)
 {
-  dt_aligned_pixel_t L = { 0, 0, 0, 0 };
-  dt_aligned_pixel_t comp = { 0, 0, 0, 0 };
+  double DT_ALIGNED_ARRAY L[4] = { 0, 0, 0, 0 };
   size_t hits = 0;
   // add up the left half of the window
   for (size_t x = 0; x < MIN(radius,width) ; x++)
   {
     hits++;
-    load_add_4wide_Kahan(scratch + 4*x, L, buf + 4*x, comp);
+    load_add_4wide_f64(scratch + 4*x, L, buf + 4*x);
   }
   // process the blur up to the point where we start removing values from the moving average
   size_t x;
@@ -442,50 +429,49 @@ static void blur_horizontal_4ch_Kahan(float *const restrict buf, const size_t wi
   {
     const int np = x + radius;
     hits++;
-    load_add_4wide_Kahan(scratch + 4*np, L, buf + 4*np, comp);
-    store_scaled_4wide(buf + 4*x, L, hits);
+    load_add_4wide_f64(scratch + 4*np, L, buf + 4*np);
+    store_scaled_4wide_f64(buf + 4*x, L, hits);
   }
   // if radius > width/2, we have pixels for which we can neither add new values (x+radius >= width) nor
   //  remove old values (x-radius < 0)
   for(; x <= radius && x < width; x++)
   {
-    store_scaled_4wide(buf + 4*x, L, hits);
+    store_scaled_4wide_f64(buf + 4*x, L, hits);
   }
   // process the blur for the bulk of the scan line
   for(; x + radius < width; x++)
   {
     const int op = x - radius - 1;
     const int np = x + radius;
-    sub_4wide_Kahan(L, scratch + 4*op, comp);
-    load_add_4wide_Kahan(scratch + 4*np, L, buf + 4*np, comp);
-    store_scaled_4wide(buf + 4*x, L, hits);
+    sub_4wide_f64(L, scratch + 4*op);
+    load_add_4wide_f64(scratch + 4*np, L, buf + 4*np);
+    store_scaled_4wide_f64(buf + 4*x, L, hits);
   }
   // process the right end where we have no more values to add to the running sum
   for(; x < width; x++)
   {
     const int op = x - radius - 1;
     hits--;
-    sub_4wide_Kahan(L, scratch + 4*op, comp);
-    store_scaled_4wide(buf + 4*x, L, hits);
+    sub_4wide_f64(L, scratch + 4*op);
+    store_scaled_4wide_f64(buf + 4*x, L, hits);
   }
   return;
 }
 
 // invoked inside an OpenMP parallel for, so no need to parallelize
-static void blur_horizontal_Nch_Kahan(const size_t N, float *const restrict buf, const size_t width,
-                                      const size_t radius, float *const restrict scratch)
+static void blur_horizontal_Nch_f64(const size_t N, float *const restrict buf, const size_t width,
+                                    const size_t radius, float *const restrict scratch)
 {
   if (N > 16) return;
   if (N != 9) return;  // since we only use 9 channels at the moment, give the compiler a big hint
 
-  float DT_ALIGNED_ARRAY L[16] = { 0, 0, 0, 0 };
-  float DT_ALIGNED_ARRAY comp[16] = { 0, 0, 0, 0 };
+  double DT_ALIGNED_ARRAY L[16] = { 0 };
   size_t hits = 0;
   // add up the left half of the window
   for (size_t x = 0; x < MIN(radius,width) ; x++)
   {
     hits++;
-    load_add_Nwide_Kahan(N, scratch + N*x, L, buf + N*x, comp);
+    load_add_Nwide_f64(N, scratch + N*x, L, buf + N*x);
   }
   // process the blur up to the point where we start removing values from the moving average
   size_t x;
@@ -493,31 +479,31 @@ static void blur_horizontal_Nch_Kahan(const size_t N, float *const restrict buf,
   {
     const int np = x + radius;
     hits++;
-    load_add_Nwide_Kahan(N, scratch + N*np, L, buf + N*np, comp);
-    store_scaled_Nwide(N, buf + N*x, L, hits);
+    load_add_Nwide_f64(N, scratch + N*np, L, buf + N*np);
+    store_scaled_Nwide_f64(N, buf + N*x, L, hits);
   }
   // if radius > width/2, we have pixels for which we can neither add new values (x+radius >= width) nor
   //  remove old values (x-radius < 0)
   for(; x <= radius && x < width; x++)
   {
-    store_scaled_Nwide(N, buf + N*x, L, hits);
+    store_scaled_Nwide_f64(N, buf + N*x, L, hits);
   }
   // process the blur for the bulk of the scan line
   for(; x + radius < width; x++)
   {
     const int op = x - radius - 1;
     const int np = x + radius;
-    sub_Nwide_Kahan(N, L, scratch + N*op, comp);
-    load_add_Nwide_Kahan(N, scratch + N*np, L, buf + N*np, comp);
-    store_scaled_Nwide(N, buf + N*x, L, hits);
+    sub_Nwide_f64(N, L, scratch + N*op);
+    load_add_Nwide_f64(N, scratch + N*np, L, buf + N*np);
+    store_scaled_Nwide_f64(N, buf + N*x, L, hits);
   }
   // process the right end where we have no more values to add to the running sum
   for(; x < width; x++)
   {
     const int op = x - radius - 1;
     hits--;
-    sub_Nwide_Kahan(N, L, scratch + N*op, comp);
-    store_scaled_Nwide(N, buf + N*x, L, hits);
+    sub_Nwide_f64(N, L, scratch + N*op);
+    store_scaled_Nwide_f64(N, buf + N*x, L, hits);
   }
   return;
 }
@@ -730,8 +716,8 @@ static void blur_vertical_1wide(float *const restrict buf, const size_t height,
 }
 
 // invoked inside an OpenMP parallel for, so no need to parallelize
-static void blur_vertical_1wide_Kahan(float *const restrict buf, const size_t height, const size_t width,
-                                      const size_t radius, float *const restrict scratch)
+static void blur_vertical_1wide_f64(float *const restrict buf, const size_t height, const size_t width,
+                                    const size_t radius, float *const restrict scratch)
 {
   // To improve cache hit rates, we copy the final result from the scratch space back to the original
   // location in the buffer as soon as we finish the final read of the buffer.  To reduce the working
@@ -741,8 +727,7 @@ static void blur_vertical_1wide_Kahan(float *const restrict buf, const size_t he
   size_t mask = 1;
   for(size_t r = (2*radius+1); r > 1 ; r >>= 1) mask = (mask << 1) | 1;
 
-  float L = 0.0f;
-  float c = 0.0f;
+  double L = 0.0;
   size_t hits = 0;
   // add up the left half of the window
   for (size_t y = 0; y < MIN(radius, height); y++)
@@ -750,7 +735,7 @@ static void blur_vertical_1wide_Kahan(float *const restrict buf, const size_t he
     PREFETCH_NTA(buf + (y+16)*width);
     hits++;
     const float v = buf[y*width];
-    L = Kahan_sum(L, &c, v);
+    L += v;
     scratch[y&mask] = v;
   }
   // process up to the point where we start removing values from the moving average
@@ -762,15 +747,15 @@ static void blur_vertical_1wide_Kahan(float *const restrict buf, const size_t he
     hits++;
     PREFETCH_NTA(buf + (np+16)*width);
     const float v = buf[np*width];
-    L = Kahan_sum(L, &c, v);
+    L += v;
     scratch[np&mask] = v;
-    buf[y*width] = L / hits;
+    buf[y*width] = (float)(L / hits);
   }
   // if radius > height/2, we have pixels for which we can neither add new values (y+radius >= height) nor
   //  remove old values (y-radius < 0)
   for(; y <= radius && y < height; y++)
   {
-    buf[y*width] = L / hits;
+    buf[y*width] = (float)(L / hits);
   }
   // process the bulk of the column
   for( ; y + radius < height; y++)
@@ -778,21 +763,21 @@ static void blur_vertical_1wide_Kahan(float *const restrict buf, const size_t he
     const int np = y + radius;
     const int op = y - radius - 1;
     PREFETCH_NTA(buf + (np+16)*width);
-    L = Kahan_sum(L, &c, -scratch[op&mask]);
+    L -= scratch[op&mask];
     const float v = buf[np*width];
-    L = Kahan_sum(L, &c, v);
+    L += v;
     scratch[np&mask] = v;
     // update the means
-    buf[y*width] = L / hits;
+    buf[y*width] = (float)(L / hits);
   }
   // process the end of the column, where we don't have any more values to add to the mean
   for( ; y < height; y++)
   {
     const int op = y - radius - 1;
     hits--;
-    L = Kahan_sum(L, &c, scratch[op&mask]);
+    L -= scratch[op&mask];
     // update the means
-    buf[y*width] = L / hits;
+    buf[y*width] = (float)(L / hits);
   }
   return;
 }
@@ -865,8 +850,8 @@ static void blur_vertical_4wide(float *const restrict buf, const size_t height,
 }
 
 // invoked inside an OpenMP parallel for, so no need to parallelize
-static void blur_vertical_4wide_Kahan(float *const restrict buf, const size_t height, const size_t width,
-                                      const size_t radius, float *const restrict scratch)
+static void blur_vertical_4wide_f64(float *const restrict buf, const size_t height, const size_t width,
+                                    const size_t radius, float *const restrict scratch)
 {
   // To improve cache hit rates, we copy the final result from the scratch space back to the original
   // location in the buffer as soon as we finish the final read of the buffer.  To reduce the working
@@ -876,15 +861,14 @@ static void blur_vertical_4wide_Kahan(float *const restrict buf, const size_t he
   size_t mask = 1;
   for(size_t r = (2*radius+1); r > 1 ; r >>= 1) mask = (mask << 1) | 1;
 
-  dt_aligned_pixel_t L = { 0, 0, 0, 0 };
-  dt_aligned_pixel_t comp = { 0, 0, 0, 0 };
+  double DT_ALIGNED_ARRAY L[4] = { 0, 0, 0, 0 };
   size_t hits = 0;
   // add up the left half of the window
   for (size_t y = 0; y < MIN(radius, height); y++)
   {
     DT_PREFETCH(buf + (y+16)*width);
     hits++;
-    load_add_4wide_Kahan(scratch + 4*(y&mask), L, buf + y * width, comp);
+    load_add_4wide_f64(scratch + 4*(y&mask), L, buf + y * width);
   }
   // process the blur up to the point where we start removing values
   size_t y;
@@ -894,14 +878,14 @@ static void blur_vertical_4wide_Kahan(float *const restrict buf, const size_t he
     const int np = y + radius;
     hits++;
     DT_PREFETCH(buf + (np+16)*width);
-    load_add_4wide_Kahan(scratch + 4*(np&mask), L, buf + np*width, comp);
-    store_scaled_4wide(buf + y*width, L, hits);
+    load_add_4wide_f64(scratch + 4*(np&mask), L, buf + np*width);
+    store_scaled_4wide_f64(buf + y*width, L, hits);
   }
   // if radius > height/2, we have pixels for which we can neither add new values (y+radius >= height) nor
   //  remove old values (y-radius < 0)
   for(; y <= radius && y < height; y++)
   {
-    store_scaled_4wide(buf + y*width, L, hits);
+    store_scaled_4wide_f64(buf + y*width, L, hits);
   }
   // process the blur for the bulk of the scan line
   for ( ; y + radius < height; y++)
@@ -909,17 +893,17 @@ static void blur_vertical_4wide_Kahan(float *const restrict buf, const size_t he
     const int np = y + radius;
     const int op = y - radius - 1;
     DT_PREFETCH(buf + (np+16)*width);
-    sub_4wide_Kahan(L, scratch + 4*(op&mask), comp);
-    load_add_4wide_Kahan(scratch + 4*(np&mask), L, buf + np*width, comp);
-    store_scaled_4wide(buf + y*width, L, hits);
+    sub_4wide_f64(L, scratch + 4*(op&mask));
+    load_add_4wide_f64(scratch + 4*(np&mask), L, buf + np*width);
+    store_scaled_4wide_f64(buf + y*width, L, hits);
   }
   // process the blur for the end of the scan line, where we don't have any more values to add to the mean
   for ( ; y < height; y++)
   {
     const int op = y - radius - 1;
     hits--;
-    sub_4wide_Kahan(L, scratch + 4*(op&mask), comp);
-    store_scaled_4wide(buf + y*width, L, hits);
+    sub_4wide_f64(L, scratch + 4*(op&mask));
+    store_scaled_4wide_f64(buf + y*width, L, hits);
   }
   return;
 }
@@ -994,8 +978,8 @@ static void blur_vertical_16wide(float *const restrict buf, const size_t height,
 }
 
 // invoked inside an OpenMP parallel for, so no need to parallelize
-static void blur_vertical_16wide_Kahan(float *const restrict buf, const size_t height, const size_t width,
-                                       const size_t radius, float *const restrict scratch)
+static void blur_vertical_16wide_f64(float *const restrict buf, const size_t height, const size_t width,
+                                     const size_t radius, float *const restrict scratch)
 {
   // To improve cache hit rates, we copy the final result from the scratch space back to the original
   // location in the buffer as soon as we finish the final read of the buffer.  To reduce the working
@@ -1005,15 +989,14 @@ static void blur_vertical_16wide_Kahan(float *const restrict buf, const size_t h
   size_t mask = 1;
   for(size_t r = (2*radius+1); r > 1 ; r >>= 1) mask = (mask << 1) | 1;
 
-  float DT_ALIGNED_ARRAY L[16] = { 0, 0, 0, 0 };
-  float DT_ALIGNED_ARRAY comp[16] = { 0, 0, 0, 0 };
+  double DT_ALIGNED_ARRAY L[16] = { 0 };
   float hits = 0;
   // add up the left half of the window
   for (size_t y = 0; y < MIN(radius, height); y++)
   {
     DT_PREFETCH(buf + (y+16)*width);
     hits++;
-    load_add_16wide_Kahan(scratch + 16 * (y&mask), L, buf + y*width, comp);
+    load_add_16wide_f64(scratch + 16 * (y&mask), L, buf + y*width);
   }
   // process the blur up to the point where we start removing values from the moving average
   size_t y;
@@ -1023,14 +1006,14 @@ static void blur_vertical_16wide_Kahan(float *const restrict buf, const size_t h
     const int np = y + radius;
     hits++;
     DT_PREFETCH(buf + (np+16)*width);
-    load_add_16wide_Kahan(scratch + 16 * (np&mask), L, buf + np*width, comp);
-    store_scaled_16wide(buf + y*width, L, hits);
+    load_add_16wide_f64(scratch + 16 * (np&mask), L, buf + np*width);
+    store_scaled_16wide_f64(buf + y*width, L, hits);
   }
   // if radius > height/2, we have pixels for which we can neither add new values (y+radius >= height) nor
   //  remove old values (y-radius < 0)
   for(; y <= radius && y < height; y++)
   {
-    store_scaled_16wide(buf + y*width, L, hits);
+    store_scaled_16wide_f64(buf + y*width, L, hits);
   }
   // process the blur for the bulk of the column
   for ( ; y + radius < height; y++)
@@ -1038,23 +1021,24 @@ static void blur_vertical_16wide_Kahan(float *const restrict buf, const size_t h
     const int np = y + radius;
     const int op = y - radius - 1;
     DT_PREFETCH(buf + (np+16)*width);
-    sub_16wide_Kahan(L, scratch + 16*(op&mask), comp);
-    load_add_16wide_Kahan(scratch + 16*(np&mask), L, buf + np*width, comp);
+    sub_16wide_f64(L, scratch + 16*(op&mask));
+    load_add_16wide_f64(scratch + 16*(np&mask), L, buf + np*width);
     // update the means
-    store_scaled_16wide(buf + y*width, L, hits);
+    store_scaled_16wide_f64(buf + y*width, L, hits);
   }
   // process the blur for the end of the scan line, where we don't have any more values to add to the mean
   for ( ; y < height; y++)
   {
     const int op = y - radius - 1;
     hits--;
-    sub_16wide_Kahan(L, scratch + 16*(op&mask), comp);
+    sub_16wide_f64(L, scratch + 16*(op&mask));
     // update the means
-    store_scaled_16wide(buf + y*width, L, hits);
+    store_scaled_16wide_f64(buf + y*width, L, hits);
   }
   return;
 }
 
+__DT_CLONE_TARGETS__
 static void blur_vertical_1ch(float *const restrict buf, const size_t height, const size_t width, const size_t radius,
                               float *const restrict scanlines, const size_t padded_size)
 {
@@ -1104,7 +1088,7 @@ static void dt_box_mean_1ch(float *const buf, const size_t height, const size_t
   const size_t eff_height = _compute_effective_height(height,radius);
   const size_t size = MAX(width,16*eff_height);
   size_t padded_size;
-  float *const restrict scanlines = dt_alloc_perthread_float(size, &padded_size);
+  float *const restrict scanlines = dt_pixelpipe_alloc_perthread_float(size, &padded_size);
 
   for(unsigned iteration = 0; iteration < iterations; iteration++)
   {
@@ -1112,7 +1096,7 @@ static void dt_box_mean_1ch(float *const buf, const size_t height, const size_t
     blur_vertical_1ch(buf, height, width, radius, scanlines, padded_size);
   }
 
-  dt_free_align(scanlines);
+  dt_pixelpipe_free_align(scanlines);
 }
 
 static void dt_box_mean_4ch(float *const buf, const int height, const int width, const int radius,
@@ -1124,7 +1108,7 @@ static void dt_box_mean_4ch(float *const buf, const int height, const int width,
   const size_t eff_height = _compute_effective_height(height,radius);
   const size_t size = MAX(4*width,16*eff_height);
   size_t padded_size;
-  float *const restrict scanlines = dt_alloc_perthread_float(size, &padded_size);
+  float *const restrict scanlines = dt_pixelpipe_alloc_perthread_float(size, &padded_size);
 
   for(unsigned iteration = 0; iteration < iterations; iteration++)
   {
@@ -1133,14 +1117,15 @@ static void dt_box_mean_4ch(float *const buf, const int height, const int width,
     blur_vertical_1ch(buf, height, 4*width, radius, scanlines, padded_size);
   }
 
-  dt_free_align(scanlines);
+  dt_pixelpipe_free_align(scanlines);
 }
 
-static void box_mean_vert_1ch_Kahan(float *const buf, const int height, const size_t width, const size_t radius)
+__DT_CLONE_TARGETS__
+static void box_mean_vert_1ch_f64(float *const buf, const int height, const size_t width, const size_t radius)
 {
   const size_t eff_height = _compute_effective_height(height,radius);
   size_t padded_size;
-  float *const restrict scratch_buf = dt_alloc_perthread_float(16*eff_height,&padded_size);
+  float *const restrict scratch_buf = dt_pixelpipe_alloc_perthread_float(16*eff_height,&padded_size);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
@@ -1153,30 +1138,31 @@ static void box_mean_vert_1ch_Kahan(float *const buf, const int height, const si
     float *const restrict scratch = dt_get_perthread(scratch_buf,padded_size);
     if (col + 16 <= width)
     {
-      blur_vertical_16wide_Kahan(buf + col, height, width, radius, scratch);
+      blur_vertical_16wide_f64(buf + col, height, width, radius, scratch);
     }
     else
     {
       // handle the 1..15 remaining columns
       size_t col_ = col;
       for( ; col_ < (width & ~3); col_ += 4)
-        blur_vertical_4wide_Kahan(buf + col_, height, width, radius, scratch);
+        blur_vertical_4wide_f64(buf + col_, height, width, radius, scratch);
       for( ; col_ < width; col_++)
-        blur_vertical_1wide_Kahan(buf + col_, height, width, radius, scratch);
+        blur_vertical_1wide_f64(buf + col_, height, width, radius, scratch);
     }
   }
 
-  dt_free_align(scratch_buf);
+  dt_pixelpipe_free_align(scratch_buf);
 }
 
-static void dt_box_mean_4ch_Kahan(float *const buf, const size_t height, const size_t width, const int radius,
-                                  const unsigned iterations)
+__DT_CLONE_TARGETS__
+static void dt_box_mean_4ch_f64(float *const buf, const size_t height, const size_t width, const int radius,
+                                const unsigned iterations)
 {
 
   for(unsigned iteration = 0; iteration < iterations; iteration++)
   {
     size_t padded_size;
-    float *const restrict scanlines = dt_alloc_perthread_float(4*width,&padded_size);
+    float *const restrict scanlines = dt_pixelpipe_alloc_perthread_float(4*width,&padded_size);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(width, height, radius, padded_size) \
@@ -1186,12 +1172,12 @@ static void dt_box_mean_4ch_Kahan(float *const buf, const size_t height, const s
     for (size_t row = 0; row < height; row++)
     {
       float *const restrict scratch = dt_get_perthread(scanlines,padded_size);
-      blur_horizontal_4ch_Kahan(buf + row * 4 * width, width, radius, scratch);
+      blur_horizontal_4ch_f64(buf + row * 4 * width, width, radius, scratch);
     }
 
-    dt_free_align(scanlines);
+    dt_pixelpipe_free_align(scanlines);
 
-    box_mean_vert_1ch_Kahan(buf, height, 4*width, radius);
+    box_mean_vert_1ch_f64(buf, height, 4*width, radius);
   }
 
 }
@@ -1206,7 +1192,7 @@ static inline void box_mean_2ch(float *const restrict in, const size_t height, c
   const size_t eff_height = _compute_effective_height(height, radius);
   const size_t Ndim = MAX(4*width,16*eff_height);
   size_t padded_size;
-  float *const restrict temp = dt_alloc_perthread_float(Ndim, &padded_size);
+  float *const restrict temp = dt_pixelpipe_alloc_perthread_float(Ndim, &padded_size);
   if (temp == NULL) return;
 
   for (unsigned iteration = 0; iteration < iterations; iteration++)
@@ -1214,7 +1200,7 @@ static inline void box_mean_2ch(float *const restrict in, const size_t height, c
     blur_horizontal_2ch(in, height, width, radius, temp, padded_size);
     blur_vertical_1ch(in, height, 2*width, radius, temp, padded_size);
   }
-  dt_free_align(temp);
+  dt_pixelpipe_free_align(temp);
 }
 
 void dt_box_mean(float *const buf, const size_t height, const size_t width, const int ch,
@@ -1230,7 +1216,7 @@ void dt_box_mean(float *const buf, const size_t height, const size_t width, cons
   }
   else if (ch == (4|BOXFILTER_KAHAN_SUM))
   {
-    dt_box_mean_4ch_Kahan(buf,height,width,radius,iterations);
+    dt_box_mean_4ch_f64(buf,height,width,radius,iterations);
   }
   else if (ch == 2) // used by fast_guided_filter.h
   {
@@ -1246,14 +1232,14 @@ void dt_box_mean_horizontal(float *const restrict buf, const size_t width, const
   if (ch == (4|BOXFILTER_KAHAN_SUM))
   {
     float *const restrict scratch = user_scratch ? user_scratch : dt_alloc_align_float(4*width);
-    blur_horizontal_4ch_Kahan(buf, width, radius, scratch);
+    blur_horizontal_4ch_f64(buf, width, radius, scratch);
     if (!user_scratch)
       dt_free_align(scratch);
   }
   else if (ch == (9|BOXFILTER_KAHAN_SUM))
   {
     float *const restrict scratch = user_scratch ? user_scratch : dt_alloc_align_float(9*width);
-    blur_horizontal_Nch_Kahan(9, buf, width, radius, scratch);
+    blur_horizontal_Nch_f64(9, buf, width, radius, scratch);
     if (!user_scratch)
       dt_free_align(scratch);
   }
@@ -1266,125 +1252,118 @@ void dt_box_mean_vertical(float *const buf, const size_t height, const size_t wi
   if ((ch & BOXFILTER_KAHAN_SUM) && (ch & ~BOXFILTER_KAHAN_SUM) <= 16)
   {
     size_t channels = ch & ~BOXFILTER_KAHAN_SUM;
-    box_mean_vert_1ch_Kahan(buf, height, channels*width, radius);
+    box_mean_vert_1ch_f64(buf, height, channels*width, radius);
   }
   else
     dt_unreachable_codepath();
 }
 
-static inline float window_max(const float *x, int n)
-{
-  float m = -(FLT_MAX);
-#ifdef _OPENMP
-#pragma omp simd reduction(max : m)
-#endif
-  for(int j = 0; j < n; j++)
-    m = MAX(m, x[j]);
-  return m;
-}
+// The moving minimum and maximum use the van Herk/Gil-Werman algorithm: the samples are cut into blocks of the
+// size of the window, 2*w+1, aligned so that the window centered on i spans the end of one block and the start of
+// the next one. The extremum over the window is then the one of the suffix of the first block and of the prefix of
+// the second, which both get computed in one pass: 3 comparisons per sample, whatever the size of the window.
+// Windows are clamped to the edges of the image.
+
+// prefix (forward) and suffix (backward) extrema of the blocks of x, N samples with stride 1
+#define VHGW_SCAN_1D(N, x, g, h, w, op)                                                                          \
+  {                                                                                                             \
+    const int k_ = 2 * (w) + 1;                                                                                 \
+    for(int p = 0; p < (N); p++)                                                                                \
+      (g)[p] = (p == 0 || (p + (w)) % k_ == 0) ? (x)[p] : op((g)[p - 1], (x)[p]);                               \
+    for(int p = (N) - 1; p >= 0; p--)                                                                           \
+      (h)[p] = (p == (N) - 1 || (p + 1 + (w)) % k_ == 0) ? (x)[p] : op((h)[p + 1], (x)[p]);                     \
+  }
+
+// whether samples lo and hi belong to the same block
+#define VHGW_SAME_BLOCK(lo, hi, w) (((lo) + (w)) / (2 * (w) + 1) == ((hi) + (w)) / (2 * (w) + 1))
 
 // calculate the one-dimensional moving maximum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_max_1d(int N, const float *const restrict x, float *const restrict y, size_t stride_y, int w)
+// input array x has stride 1 and is followed by 2*N floats of scratch space, output array y has stride stride_y
+static inline void box_max_1d(int N, float *const restrict x, float *const restrict y, size_t stride_y, int w)
 {
-  float m = window_max(x, MIN(w + 1, N));
+  float *const restrict g = x + N;
+  float *const restrict h = x + 2 * N;
+  VHGW_SCAN_1D(N, x, g, h, w, MAX);
   for(int i = 0; i < N; i++)
   {
-    // store maximum of current window at center position
-    y[i * stride_y] = m;
-    // if the earliest member of the current window is the max, we need to
-    // rescan the window to determine the new maximum
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      const int start = i - w + 1;
-      m = window_max(x + start, MIN(i + w + 2, N) - start);
-    }
-    // if the window has not yet exceeded the end of the row/column, update the maximum value
-    if(i + w + 1 < N)
-      m = MAX(x[i + w + 1], m);
+    const int lo = MAX(i - w, 0);
+    const int hi = MIN(i + w, N - 1);
+    y[i * stride_y] = VHGW_SAME_BLOCK(lo, hi, w) ? h[lo] : MAX(h[lo], g[hi]);
   }
 }
 
-static void set_16wide(float *const restrict out, const float value)
+// calculate the one-dimensional moving maximum on 16 adjacent columns over a window of size 2*w+1
+// input/output array 'buf' has stride 'stride' and we will read and write 16 consecutive elements every stride
+// elements (thus processing a cache line at a time). scratch holds 32*N floats.
+static inline void box_max_vert_16wide(const int N, float *const restrict scratch, float *const restrict buf,
+                                       const int stride, const int w)
 {
+  float *const restrict g = scratch;
+  float *const restrict h = scratch + 16 * N;
+  const int k = 2 * w + 1;
+  for(int p = 0; p < N; p++)
+  {
+    PREFETCH_NTA(buf + stride * (p + 24));
+    const float *const restrict x = buf + (size_t)stride * p;
+    if(p == 0 || (p + w) % k == 0)
+    {
 #ifdef _OPENMP
-#pragma omp simd aligned(out : 64)
+#pragma omp simd aligned(g : 64)
 #endif
-  for (size_t c = 0; c < 16; c++)
-    out[c] = value;
-}
-
-static inline void update_max_16wide(float m[16], const float *const restrict base)
-{
+      for(size_t c = 0; c < 16; c++) g[16 * p + c] = x[c];
+    }
+    else
+    {
 #ifdef _OPENMP
-#pragma omp simd aligned(m, base : 64)
+#pragma omp simd aligned(g : 64)
 #endif
-  for (size_t c = 0; c < 16; c++)
-  {
-    m[c] = fmaxf(m[c], base[c]);
+      for(size_t c = 0; c < 16; c++) g[16 * p + c] = fmaxf(g[16 * (p - 1) + c], x[c]);
+    }
   }
-}
-
-static inline void load_update_max_16wide(float *const restrict out, float m[16], const float *const restrict base)
-{
-#ifdef _OPENMP
-#pragma omp simd aligned(out, m : 64)
-#endif
-  for (size_t c = 0; c < 16; c++)
+  for(int p = N - 1; p >= 0; p--)
   {
-    const float v = base[c];
-    out[c] = v;
-    m[c] = fmaxf(m[c], v);
-  }
-}
-
-// calculate the one-dimensional moving maximum on four adjacent columns over a window of size 2*w+1
-// input/output array 'buf' has stride 'stride' and we will write 16 consecutive elements every stride elements
-// (thus processing a cache line at a time)
-static inline void box_max_vert_16wide(const int N, float *const restrict scratch, float *const restrict buf,
-                                       const int stride, const int w, const size_t mask)
-{
-  float DT_ALIGNED_ARRAY m[16] = { -(FLT_MAX), -(FLT_MAX), -(FLT_MAX), -(FLT_MAX),
-                                   -(FLT_MAX), -(FLT_MAX), -(FLT_MAX), -(FLT_MAX),
-                                   -(FLT_MAX), -(FLT_MAX), -(FLT_MAX), -(FLT_MAX),
-                                   -(FLT_MAX), -(FLT_MAX), -(FLT_MAX), -(FLT_MAX) };
-  for(size_t i = 0; i < MIN(w + 1, N); i++)
-  {
-    PREFETCH_NTA(buf + stride*(i+24));
-    load_update_max_16wide(scratch + 16 * (i&mask),m, buf + stride*i);
-  }
-  for(size_t i = 0; i < N; i++)
-  {
-    PREFETCH_NTA(buf + stride*(i+24));
-    // store maximum of current window at center position
-    store_16wide(buf + stride * i, m);
-    // If the earliest member of the current window is the max, we need to
-    // rescan the window to determine the new maximum
-    if (i >= w)
+    const float *const restrict x = buf + (size_t)stride * p;
+    if(p == N - 1 || (p + 1 + w) % k == 0)
     {
-      set_16wide(m, -(FLT_MAX));  // reset max values to lowest possible
-      for(int j = i - w + 1; j < MIN(i + w + 1, N); j++)
-      {
-        update_max_16wide(m,scratch + 16*(j&mask));
-      }
+#ifdef _OPENMP
+#pragma omp simd aligned(h : 64)
+#endif
+      for(size_t c = 0; c < 16; c++) h[16 * p + c] = x[c];
     }
-    // if the window has not yet exceeded the end of the row/column, update the maximum value
-    const size_t n = i + w + 1;
-    if(n < N)
+    else
     {
-      load_update_max_16wide(scratch + 16 * (n&mask), m, buf + stride * n);
+#ifdef _OPENMP
+#pragma omp simd aligned(h : 64)
+#endif
+      for(size_t c = 0; c < 16; c++) h[16 * p + c] = fmaxf(h[16 * (p + 1) + c], x[c]);
     }
   }
+  for(int i = 0; i < N; i++)
+  {
+    const int lo = MAX(i - w, 0);
+    const int hi = MIN(i + w, N - 1);
+    const float *const restrict h_lo = h + 16 * lo;
+    // a window in a single block is clamped to the end of the image or spans the whole block
+    const float *const restrict g_hi = VHGW_SAME_BLOCK(lo, hi, w) ? h_lo : g + 16 * hi;
+    float *const restrict out = buf + (size_t)stride * i;
+#ifdef _OPENMP
+#pragma omp simd aligned(h_lo, g_hi : 64)
+#endif
+    for(size_t c = 0; c < 16; c++) out[c] = fmaxf(h_lo[c], g_hi[c]);
+  }
 }
 
 // calculate the two-dimensional moving maximum over a box of size (2*w+1) x (2*w+1)
 // does the calculation in-place if input and output images are identical
+__DT_CLONE_TARGETS__
 static void box_max_1ch(float *const buf, const size_t height, const size_t width, const unsigned w)
 {
-  const size_t eff_height = _compute_effective_height(height, w);
-  const size_t scratch_size = MAX(width,MAX(height,16*eff_height));
+  // scratch space needed per thread:
+  //   3*width floats to store one row and its block extrema during horizontal pass
+  //   32*height floats for the block extrema of the vertical pass
+  const size_t scratch_size = MAX(3 * width, 32 * height);
   size_t allocsize;
-  float *const restrict scratch_buffers = dt_alloc_perthread_float(scratch_size,&allocsize);
+  float *const restrict scratch_buffers = dt_pixelpipe_alloc_perthread_float(scratch_size,&allocsize);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(w, width, height, buf, allocsize) \
@@ -1399,14 +1378,14 @@ static void box_max_1ch(float *const buf, const size_t height, const size_t widt
   }
 #ifdef _OPENMP
 #pragma omp parallel for default(none)           \
-  dt_omp_firstprivate(w, width, height, buf, allocsize, eff_height) \
+  dt_omp_firstprivate(w, width, height, buf, allocsize) \
   dt_omp_sharedconst(scratch_buffers) \
   schedule(static)
 #endif
   for(int col = 0; col < (width & ~15); col += 16)
   {
     float *const restrict scratch = dt_get_perthread(scratch_buffers,allocsize);
-    box_max_vert_16wide(height, scratch, buf + col, width, w, eff_height-1);
+    box_max_vert_16wide(height, scratch, buf + col, width, w);
   }
   // handle the leftover 0..15 columns
   for (size_t col = width & ~15 ; col < width; col++)
@@ -1416,10 +1395,9 @@ static void box_max_1ch(float *const buf, const size_t height, const size_t widt
       scratch[row] = buf[row * width + col];
     box_max_1d(height, scratch, buf + col, width, w);
   }
-  dt_free_align(scratch_buffers);
+  dt_pixelpipe_free_align(scratch_buffers);
 }
 
-
 // in-place calculate the two-dimensional moving maximum over a box of size (2*radius+1) x (2*radius+1)
 void dt_box_max(float *const buf, const size_t height, const size_t width, const int ch, const int radius)
 {
@@ -1430,108 +1408,90 @@ void dt_box_max(float *const buf, const size_t height, const size_t width, const
     dt_unreachable_codepath();
 }
 
-static inline float window_min(const float *x, int n)
-{
-  float m = FLT_MAX;
-#ifdef _OPENMP
-#pragma omp simd reduction(min : m)
-#endif
-  for(int j = 0; j < n; j++)
-    m = MIN(m, x[j]);
-  return m;
-}
-
 // calculate the one-dimensional moving minimum over a window of size 2*w+1
-// input array x has stride 1, output array y has stride stride_y
-static inline void box_min_1d(int N, const float *x, float *y, size_t stride_y, int w)
+// input array x has stride 1 and is followed by 2*N floats of scratch space, output array y has stride stride_y
+static inline void box_min_1d(int N, float *const restrict x, float *const restrict y, size_t stride_y, int w)
 {
-  float m = window_min(x, MIN(w + 1, N));
+  float *const restrict g = x + N;
+  float *const restrict h = x + 2 * N;
+  VHGW_SCAN_1D(N, x, g, h, w, MIN);
   for(int i = 0; i < N; i++)
   {
-    y[i * stride_y] = m;
-    if(i - w >= 0 && x[i - w] == m)
-    {
-      const int start = (i - w + 1);
-      m = window_min(x + start, MIN((i + w + 2), N) - start);
-    }
-    // if the window has not yet exceeded the end of the row/column, update the minimum value
-    if(i + w + 1 < N)
-      m = MIN(x[i + w + 1], m);
+    const int lo = MAX(i - w, 0);
+    const int hi = MIN(i + w, N - 1);
+    y[i * stride_y] = VHGW_SAME_BLOCK(lo, hi, w) ? h[lo] : MIN(h[lo], g[hi]);
   }
 }
 
-static inline void update_min_16wide(float m[16], const float *const restrict base)
+// calculate the one-dimensional moving minimum on 16 adjacent columns over a window of size 2*w+1
+// see box_max_vert_16wide()
+static inline void box_min_vert_16wide(const int N, float *const restrict scratch, float *const restrict buf,
+                                       const int stride, const int w)
 {
+  float *const restrict g = scratch;
+  float *const restrict h = scratch + 16 * N;
+  const int k = 2 * w + 1;
+  for(int p = 0; p < N; p++)
+  {
+    PREFETCH_NTA(buf + stride * (p + 24));
+    const float *const restrict x = buf + (size_t)stride * p;
+    if(p == 0 || (p + w) % k == 0)
+    {
 #ifdef _OPENMP
-#pragma omp simd aligned(m, base : 64)
+#pragma omp simd aligned(g : 64)
 #endif
-  for (size_t c = 0; c < 16; c++)
-  {
-    m[c] = fminf(m[c], base[c]);
-  }
-}
-
-static inline void load_update_min_16wide(float *const restrict out, float m[16], const float *const restrict base)
-{
+      for(size_t c = 0; c < 16; c++) g[16 * p + c] = x[c];
+    }
+    else
+    {
 #ifdef _OPENMP
-#pragma omp simd aligned(out, m : 64)
+#pragma omp simd aligned(g : 64)
 #endif
-  for (size_t c = 0; c < 16; c++)
-  {
-    const float v = base[c];
-    out[c] = v;
-    m[c] = fminf(m[c], v);
+      for(size_t c = 0; c < 16; c++) g[16 * p + c] = fminf(g[16 * (p - 1) + c], x[c]);
+    }
   }
-}
-
-// calculate the one-dimensional moving minimum on four adjacent columns over a window of size 2*w+1
-// input/output array 'buf' has stride 'stride' and we will write 16 consecutive elements every stride elements
-// (thus processing a cache line at a time)
-static inline void box_min_vert_16wide(const int N, float *const restrict scratch, float *const restrict buf,
-                                       const int stride, const int w, const size_t mask)
-{
-  float DT_ALIGNED_ARRAY m[16] = { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX,
-                                   FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX,
-                                   FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX,
-                                   FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX };
-  for(size_t i = 0; i < MIN(w + 1, N); i++)
-  {
-    PREFETCH_NTA(buf + stride*(i+24));
-    load_update_min_16wide(scratch + 16*(i&mask), m, buf + stride*i);
-  }
-  for(size_t i = 0; i < N; i++)
-  {
-    PREFETCH_NTA(buf + stride*(i+24));
-    // store minimum of current window at center position
-    store_16wide(buf + i * stride, m);
-    // If the earliest member of the current window is the min, we need to
-    // rescan the window to determine the new minimum
-    if (i >= w)
+  for(int p = N - 1; p >= 0; p--)
+  {
+    const float *const restrict x = buf + (size_t)stride * p;
+    if(p == N - 1 || (p + 1 + w) % k == 0)
     {
-      set_16wide(m, FLT_MAX);  // reset min values to the highest possible
-      for(int j = i - w + 1; j < MIN(i + w + 1, N); j++)
-      {
-        update_min_16wide(m,scratch + 16*(j&mask));
-      }
+#ifdef _OPENMP
+#pragma omp simd aligned(h : 64)
+#endif
+      for(size_t c = 0; c < 16; c++) h[16 * p + c] = x[c];
     }
-    // if the window has not yet exceeded the end of the row/column, update the minimum value
-    const size_t n = i + w + 1;
-    if(n < N)
+    else
     {
-      load_update_min_16wide(scratch + 16 * (n&mask), m, buf + stride * n);
+#ifdef _OPENMP
+#pragma omp simd aligned(h : 64)
+#endif
+      for(size_t c = 0; c < 16; c++) h[16 * p + c] = fminf(h[16 * (p + 1) + c], x[c]);
     }
   }
+  for(int i = 0; i < N; i++)
+  {
+    const int lo = MAX(i - w, 0);
+    const int hi = MIN(i + w, N - 1);
+    const float *const restrict h_lo = h + 16 * lo;
+    // a window in a single block is clamped to the end of the image or spans the whole block
+    const float *const restrict g_hi = VHGW_SAME_BLOCK(lo, hi, w) ? h_lo : g + 16 * hi;
+    float *const restrict out = buf + (size_t)stride * i;
+#ifdef _OPENMP
+#pragma omp simd aligned(h_lo, g_hi : 64)
+#endif
+    for(size_t c = 0; c < 16; c++) out[c] = fminf(h_lo[c], g_hi[c]);
+  }
 }
 
-
 // calculate the two-dimensional moving minimum over a box of size (2*w+1) x (2*w+1)
 // does the calculation in-place if input and output images are identical
+__DT_CLONE_TARGETS__
 static void box_min_1ch(float *const buf, const size_t height, const size_t width, const int w)
 {
-  const size_t eff_height = _compute_effective_height(height, w);
-  const size_t scratch_size = MAX(width,MAX(height,16*eff_height));
+  // see box_max_1ch()
+  const size_t scratch_size = MAX(3 * width, 32 * height);
   size_t allocsize;
-  float *const restrict scratch_buffers = dt_alloc_perthread_float(scratch_size,&allocsize);
+  float *const restrict scratch_buffers = dt_pixelpipe_alloc_perthread_float(scratch_size,&allocsize);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(w, width, height, buf, allocsize) \
@@ -1546,14 +1506,14 @@ static void box_min_1ch(float *const buf, const size_t height, const size_t widt
   }
 #ifdef _OPENMP
 #pragma omp parallel for default(none)           \
-  dt_omp_firstprivate(w, width, height, buf,allocsize, eff_height) \
+  dt_omp_firstprivate(w, width, height, buf, allocsize) \
   dt_omp_sharedconst(scratch_buffers) \
   schedule(static)
 #endif
   for(size_t col = 0; col < (width & ~15); col += 16)
   {
     float *const restrict scratch = dt_get_perthread(scratch_buffers,allocsize);
-    box_min_vert_16wide(height, scratch, buf + col, width, w, eff_height-1);
+    box_min_vert_16wide(height, scratch, buf + col, width, w);
   }
   // handle the leftover 0..15 columns
   for (size_t col = width & ~15 ; col < width; col++)
@@ -1564,7 +1524,7 @@ static void box_min_1ch(float *const buf, const size_t height, const size_t widt
     box_min_1d(height, scratch, buf + col, width, w);
   }
 
-  dt_free_align(scratch_buffers);
+  dt_pixelpipe_free_align(scratch_buffers);
 }
 
 void dt_box_min(float *const buf, const size_t height, const size_t width, const int ch, const int radius)
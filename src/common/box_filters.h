@@ -23,8 +23,8 @@
 // default number of iterations to run for dt_box_mean
 #define BOX_ITERATIONS 8
 
-// flag to add to number of channels to request the slower but more accurate version using Kahan (compensated)
-// summation
+// flag to add to number of channels to request the slower but more accurate version, which keeps its running
+// sums in double precision
 #define BOXFILTER_KAHAN_SUM 0x1000000
 
 // ch = number of channels per pixel.  Supported values: 1, 2, 4, and 4|Kahan
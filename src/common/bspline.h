@@ -89,24 +89,35 @@ static inline void sparse_scalar_product(const dt_aligned_pixel_t buf, const siz
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(in, temp)
-#endif
+__DT_CLONE_TARGETS__
 static inline void _bspline_vertical_pass(const float *const restrict in, float *const restrict temp,
                                           size_t row, size_t width, size_t height, int mult, const gboolean clip_negatives)
 {
-  size_t DT_ALIGNED_ARRAY indices[BSPLINE_FSIZE];
-  // compute the index offsets of the pixels of interest; since the offsets are the same for the entire row,
-  // we only need to do this once and can then process the entire row
-  indices[0] = 4 * width * MAX((int)row - 2 * mult, 0);
-  indices[1] = 4 * width * MAX((int)row - mult, 0);
-  indices[2] = 4 * width * row;
-  indices[3] = 4 * width * MIN(row + mult, height-1);
-  indices[4] = 4 * width * MIN(row + 2 * mult, height-1);
-  for(size_t j = 0; j < width; j++)
+  // the five rows of interest are the same for the entire row and each is contiguous, so the vertical blur
+  // of the row is a plain streaming loop over 4 * width floats
+  const float *const restrict r0 = in + 4 * width * MAX((int)row - 2 * mult, 0);
+  const float *const restrict r1 = in + 4 * width * MAX((int)row - mult, 0);
+  const float *const restrict r2 = in + 4 * width * row;
+  const float *const restrict r3 = in + 4 * width * MIN(row + mult, height-1);
+  const float *const restrict r4 = in + 4 * width * MIN(row + 2 * mult, height-1);
+
+  if(clip_negatives)
   {
-    // Compute the vertical blur of the current pixel and store it in the temp buffer for the row
-    sparse_scalar_product(in + j * 4, indices, temp + j * 4, clip_negatives);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t k = 0; k < 4 * width; k++)
+      temp[k] = MAX(0.0f, 1.0f / 16.0f * r0[k] + 4.0f / 16.0f * r1[k] + 6.0f / 16.0f * r2[k]
+                          + 4.0f / 16.0f * r3[k] + 1.0f / 16.0f * r4[k]);
+  }
+  else
+  {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t k = 0; k < 4 * width; k++)
+      temp[k] = 1.0f / 16.0f * r0[k] + 4.0f / 16.0f * r1[k] + 6.0f / 16.0f * r2[k]
+                + 4.0f / 16.0f * r3[k] + 1.0f / 16.0f * r4[k];
   }
 }
 
@@ -129,9 +140,43 @@ static inline void _bspline_horizontal(const float *const restrict temp, float *
   sparse_scalar_product(temp, indices, out, clip_negatives);
 }
 
+__DT_CLONE_TARGETS__
+static inline void _bspline_horizontal_pass(const float *const restrict temp, float *const restrict out,
+                                            size_t width, int mult, const gboolean clip_negatives)
+{
+  // only the 2 * mult columns on each side need clamped indices
+  const size_t border = MIN((size_t)2 * mult, width);
+  const size_t interior_end = (width > 2 * (size_t)mult) ? width - 2 * mult : border;
+
+  for(size_t j = 0; j < border; j++)
+    _bspline_horizontal(temp, out + 4 * j, j, width, mult, clip_negatives);
+  for(size_t j = MAX(interior_end, border); j < width; j++)
+    _bspline_horizontal(temp, out + 4 * j, j, width, mult, clip_negatives);
+
+  // in between, the taps are at fixed offsets and the row is a plain streaming loop
+  const size_t o1 = 4 * mult;
+  const size_t o2 = 8 * mult;
+  if(clip_negatives)
+  {
 #ifdef _OPENMP
-#pragma omp declare simd aligned(in, out:64) aligned(tempbuf:16)
+#pragma omp simd
 #endif
+    for(size_t k = 4 * border; k < 4 * interior_end; k++)
+      out[k] = MAX(0.0f, 1.0f / 16.0f * temp[k - o2] + 4.0f / 16.0f * temp[k - o1] + 6.0f / 16.0f * temp[k]
+                         + 4.0f / 16.0f * temp[k + o1] + 1.0f / 16.0f * temp[k + o2]);
+  }
+  else
+  {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t k = 4 * border; k < 4 * interior_end; k++)
+      out[k] = 1.0f / 16.0f * temp[k - o2] + 4.0f / 16.0f * temp[k - o1] + 6.0f / 16.0f * temp[k]
+               + 4.0f / 16.0f * temp[k + o1] + 1.0f / 16.0f * temp[k + o2];
+  }
+}
+
+__DT_CLONE_TARGETS__
 inline static void blur_2D_Bspline(const float *const restrict in, float *const restrict out,
                                    float *const restrict tempbuf,
                                    const size_t width, const size_t height, const int mult, const gboolean clip_negatives)
@@ -152,16 +197,11 @@ inline static void blur_2D_Bspline(const float *const restrict in, float *const
     // Convolve B-spline filter over columns: for each pixel in the current row, compute vertical blur
     _bspline_vertical_pass(in, temp, i, width, height, mult, clip_negatives);
     // Convolve B-spline filter horizontally over current row
-    for(size_t j = 0; j < width; j++)
-    {
-      _bspline_horizontal(temp, out + (i * width + j) * 4, j, width, mult, clip_negatives);
-    }
+    _bspline_horizontal_pass(temp, out + i * width * 4, width, mult, clip_negatives);
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(in, HF, LF:64) aligned(tempbuf:16)
-#endif
+__DT_CLONE_TARGETS__
 inline static void decompose_2D_Bspline(const float *const restrict in,
                                         float *const restrict HF,
                                         float *const restrict LF,
@@ -184,14 +224,16 @@ inline static void decompose_2D_Bspline(const float *const restrict in,
     // Convolve B-spline filter over columns: for each pixel in the current row, compute vertical blur
     _bspline_vertical_pass(in, temp, i, width, height, mult, TRUE); // always clip negatives
     // Convolve B-spline filter horizontally over current row
-    for(size_t j = 0; j < width; j++)
-    {
-      const size_t index = 4U * (i * width + j);
-      _bspline_horizontal(temp, LF + index, j, width, mult, TRUE); // always clip negatives
-      // compute the HF component by subtracting the LF from the original input
-      for_four_channels(c)
-        HF[index + c] = in[index + c] - LF[index + c];
-    }
+    float *const restrict LF_row = LF + 4 * i * width;
+    float *const restrict HF_row = HF + 4 * i * width;
+    const float *const restrict in_row = in + 4 * i * width;
+    _bspline_horizontal_pass(temp, LF_row, width, mult, TRUE); // always clip negatives
+    // compute the HF component by subtracting the LF from the original input, while the row is still in cache
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(size_t k = 0; k < 4 * width; k++)
+      HF_row[k] = in_row[k] - LF_row[k];
   }
 }
 
@@ -27,7 +27,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-// this implements a concurrent LRU cache
+// this implements a concurrent cache, sharded by key, with clock eviction
+
+// upper bound on the number of shards, as log2
+#define DT_CACHE_MAX_SHARD_BITS 6
+// upper bound on the entries the clock hand of a shard skips per collection, to bound the time the
+// shard stays locked. the next collection picks up where it stopped.
+#define DT_CACHE_GC_MAX_SKIPPED 512
+
+static inline dt_cache_shard_t *_get_shard(const dt_cache_t *cache, const uint32_t key)
+{
+  // fibonacci hashing: consecutive image ids land in different shards
+  const uint32_t shard = cache->shard_bits ? (key * 2654435761u) >> (32 - cache->shard_bits) : 0;
+  return cache->shards + shard;
+}
+
+static inline uint32_t _num_shards(const dt_cache_t *cache)
+{
+  return 1u << cache->shard_bits;
+}
 
 void dt_cache_init(
     dt_cache_t *cache,
@@ -35,46 +53,71 @@ void dt_cache_init(
     size_t cost_quota)
 {
   cache->cost = 0;
-  cache->lru = 0;
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
+  cache->gc_shard = 0;
+
+  // about one shard per thread, more only make the garbage collection walk further.
+  const size_t threads = dt_get_num_threads();
+  cache->shard_bits = 0;
+  while(cache->shard_bits < DT_CACHE_MAX_SHARD_BITS && ((size_t)1 << cache->shard_bits) < threads)
+    cache->shard_bits++;
+
+  cache->shards = dt_alloc_align(sizeof(dt_cache_shard_t) * _num_shards(cache));
+  for(uint32_t k = 0; k < _num_shards(cache); k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_init(&shard->lock, 0);
+    shard->hashtable = g_hash_table_new(0, 0);
+    shard->clock = g_ptr_array_new();
+    shard->hand = 0;
+    shard->cost = 0;
+  }
 }
 
-void dt_cache_cleanup(dt_cache_t *cache)
+static void _free_entry(dt_cache_t *cache, dt_cache_entry_t *entry)
 {
-  g_hash_table_destroy(cache->hashtable);
-  for(GList *l = cache->lru; l; l = g_list_next(l))
+  if(cache->cleanup)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    assert(entry->data_size);
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
 
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+    cache->cleanup(cache->cleanup_data, entry);
+  }
+  else
+    dt_free_align(entry->data);
+}
 
-      cache->cleanup(cache->cleanup_data, entry);
+void dt_cache_cleanup(dt_cache_t *cache)
+{
+  for(uint32_t k = 0; k < _num_shards(cache); k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    g_hash_table_destroy(shard->hashtable);
+    for(guint i = 0; i < shard->clock->len; i++)
+    {
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)g_ptr_array_index(shard->clock, i);
+      _free_entry(cache, entry);
+      dt_pthread_rwlock_destroy(&entry->lock);
+      g_slice_free1(sizeof(*entry), entry);
     }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
+    g_ptr_array_free(shard->clock, TRUE);
+    dt_pthread_mutex_destroy(&shard->lock);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  dt_free_align(cache->shards);
+  cache->shards = NULL;
 }
 
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  int32_t result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_cache_shard_t *shard = _get_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
+  int32_t result = g_hash_table_contains(shard->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&shard->lock);
   return result;
 }
 
@@ -83,25 +126,65 @@ int dt_cache_for_all(
     int (*process)(const uint32_t key, const void *data, void *user_data),
     void *user_data)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  GHashTableIter iter;
-  gpointer key, value;
-
-  g_hash_table_iter_init (&iter, cache->hashtable);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for(uint32_t k = 0; k < _num_shards(cache); k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
-    const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
-    if(err)
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, shard->hashtable);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      dt_pthread_mutex_unlock(&cache->lock);
-      return err;
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
+      const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
+      if(err)
+      {
+        dt_pthread_mutex_unlock(&shard->lock);
+        return err;
+      }
     }
+    dt_pthread_mutex_unlock(&shard->lock);
   }
-  dt_pthread_mutex_unlock(&cache->lock);
   return 0;
 }
 
+// take a write locked entry out of the clock and the cost of its shard. called with the shard lock held.
+// it stays in the hash table, so that lookups wait for _finish_removal() instead of allocating the key
+// again while its cleanup callback, which can write it to disk, runs.
+static void _detach_entry(dt_cache_t *cache, dt_cache_shard_t *shard, dt_cache_entry_t *entry)
+{
+  // the last entry takes the free slot. this reorders the clock a bit, which it can afford.
+  const uint32_t slot = entry->_slot;
+  assert(g_ptr_array_index(shard->clock, slot) == entry);
+  g_ptr_array_remove_index_fast(shard->clock, slot);
+  if(slot < shard->clock->len) ((dt_cache_entry_t *)g_ptr_array_index(shard->clock, slot))->_slot = slot;
+  shard->cost -= entry->cost;
+  __sync_fetch_and_sub(&cache->cost, entry->cost);
+}
+
+// clean up detached entries and forget about them. called without holding any shard lock.
+static void _finish_removal(dt_cache_t *cache, GSList *entries)
+{
+  for(GSList *l = entries; l; l = g_slist_next(l))
+  {
+    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    _free_entry(cache, entry);
+
+    dt_cache_shard_t *shard = _get_shard(cache, entry->key);
+    dt_pthread_mutex_lock(&shard->lock);
+    gboolean removed = g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(entry->key));
+    (void)removed; // make non-assert compile happy
+    assert(removed);
+    dt_pthread_mutex_unlock(&shard->lock);
+
+    dt_pthread_rwlock_unlock(&entry->lock);
+    dt_pthread_rwlock_destroy(&entry->lock);
+    g_slice_free1(sizeof(*entry), entry);
+  }
+  g_slist_free(entries);
+}
+
 // return read locked bucket, or NULL if it's not already there.
 // never attempt to allocate a new slot.
 dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char mode)
@@ -109,9 +192,10 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
   gpointer orig_key, value;
   gboolean res;
   double start = dt_get_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_cache_shard_t *shard = _get_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   {
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -121,13 +205,12 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       return 0;
     }
-    // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    // give it a second chance next time the clock hand passes by:
+    entry->_referenced = 1;
+    dt_pthread_mutex_unlock(&shard->lock);
     double end = dt_get_wtime();
     if(end - start > 0.1)
       fprintf(stderr, "try+ wait time %.06fs mode %c \n", end - start, mode);
@@ -142,13 +225,78 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "try- wait time %.06fs\n", end - start);
   return 0;
 }
 
+// sweep the clock hand of a locked shard, detaching entries that weren't accessed since it last passed.
+// stops once the whole cache is below the fill ratio, or after skipping twice as many entries as the
+// shard held, which is enough to come back to every referenced one.
+static void _gc_shard(dt_cache_t *cache, dt_cache_shard_t *shard, const float fill_ratio, GSList **victims)
+{
+  const guint max_skipped = MIN(2 * shard->clock->len, DT_CACHE_GC_MAX_SKIPPED);
+  guint skipped = 0;
+  while(shard->clock->len && skipped < max_skipped)
+  {
+    if(cache->cost < cache->cost_quota * fill_ratio) break;
+    if(shard->hand >= shard->clock->len) shard->hand = 0;
+    dt_cache_entry_t *entry = (dt_cache_entry_t *)g_ptr_array_index(shard->clock, shard->hand);
+
+    if(entry->_referenced)
+    {
+      entry->_referenced = 0;
+      shard->hand++;
+      skipped++;
+      continue;
+    }
+
+    // if still locked by anyone else give up:
+    if(dt_pthread_rwlock_trywrlock(&entry->lock))
+    {
+      shard->hand++;
+      skipped++;
+      continue;
+    }
+
+    if(entry->_lock_demoting)
+    {
+      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
+      dt_pthread_rwlock_unlock(&entry->lock);
+      shard->hand++;
+      skipped++;
+      continue;
+    }
+
+    // delete! the hand now points to the entry that took its slot.
+    _detach_entry(cache, shard, entry);
+    *victims = g_slist_prepend(*victims, entry);
+  }
+}
+
+// collect the locked shard first, then whichever other shards aren't busy, starting from a
+// different one every time to spread the evictions. returns the evicted entries, to be passed
+// to _finish_removal() once the lock is released.
+static GSList *_gc(dt_cache_t *cache, dt_cache_shard_t *locked, const float fill_ratio)
+{
+  GSList *victims = NULL;
+  if(locked) _gc_shard(cache, locked, fill_ratio, &victims);
+  const uint32_t first = __sync_fetch_and_add(&cache->gc_shard, 1);
+  for(uint32_t k = 0; k < _num_shards(cache); k++)
+  {
+    if(cache->cost < cache->cost_quota * fill_ratio) break;
+    dt_cache_shard_t *shard = cache->shards + ((first + k) & (_num_shards(cache) - 1));
+    if(shard == locked) continue;
+    // never block on a second shard while holding one, that could deadlock:
+    if(dt_pthread_mutex_trylock(&shard->lock)) continue;
+    _gc_shard(cache, shard, fill_ratio, &victims);
+    dt_pthread_mutex_unlock(&shard->lock);
+  }
+  return victims;
+}
+
 // if found, the data void* is returned. if not, it is set to be
 // the given *data and a new hash table entry is created, which can be
 // found using the given key later on.
@@ -157,11 +305,13 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key
   gpointer orig_key, value;
   gboolean res;
   int result;
+  gboolean collected = FALSE;
   double start = dt_get_wtime();
+  dt_cache_shard_t *shard = _get_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   { // yay, found. read lock and pass on.
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -170,14 +320,13 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       g_usleep(5);
       goto restart;
     }
-    // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    // give it a second chance next time the clock hand passes by:
+    entry->_referenced = 1;
+    dt_pthread_mutex_unlock(&shard->lock);
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -205,11 +354,15 @@ restart:
   // else, not found, need to allocate.
 
   // first try to clean up.
-  // also wait if we can't free more than the requested fill ratio.
-  if(cache->cost > 0.8f * cache->cost_quota)
+  // the cleanup callbacks of the evicted entries may write them to disk: run them without
+  // the lock, then look again as another thread may have allocated the key meanwhile.
+  if(!collected && cache->cost > 0.8f * cache->cost_quota)
   {
-    // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    GSList *victims = _gc(cache, shard, 0.8f);
+    dt_pthread_mutex_unlock(&shard->lock);
+    _finish_removal(cache, victims);
+    collected = TRUE;
+    goto restart;
   }
 
   // here dies your 32-bit system:
@@ -219,11 +372,12 @@ restart:
   entry->data = 0;
   entry->data_size = cache->entry_size;
   entry->cost = 1;
-  entry->link = g_list_append(0, entry);
   entry->key = key;
   entry->_lock_demoting = 0;
+  // new entries count as used, as they would be at the recent end of an lru list
+  entry->_referenced = 1;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(shard->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
@@ -242,12 +396,14 @@ restart:
   if(write) dt_pthread_rwlock_wrlock_with_caller(&entry->lock, file, line);
   else      dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  shard->cost += entry->cost;
+  __sync_fetch_and_add(&cache->cost, entry->cost);
 
-  // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  // hand it to the clock:
+  entry->_slot = shard->clock->len;
+  g_ptr_array_add(shard->clock, entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "wait time %.06fs\n", end - start);
@@ -263,22 +419,23 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   gboolean res;
   int result;
   dt_cache_entry_t *entry;
+  dt_cache_shard_t *shard = _get_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
 
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     return 1;
   }
   // need write lock to be able to delete:
   result = dt_pthread_rwlock_trywrlock(&entry->lock);
   if(result)
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
@@ -287,75 +444,21 @@ restart:
   {
     // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
 
-  gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
-  (void)removed; // make non-assert compile happy
-  assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
-
-  if(cache->cleanup)
-  {
-    assert(entry->data_size);
-    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-    cache->cleanup(cache->cleanup_data, entry);
-  }
-  else
-    dt_free_align(entry->data);
-
-  dt_pthread_rwlock_unlock(&entry->lock);
-  dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
-  g_slice_free1(sizeof(*entry), entry);
-
-  dt_pthread_mutex_unlock(&cache->lock);
+  _detach_entry(cache, shard, entry);
+  dt_pthread_mutex_unlock(&shard->lock);
+  _finish_removal(cache, g_slist_prepend(NULL, entry));
   return 0;
 }
 
 // best-effort garbage collection. never blocks, never fails. well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-  GList *l = cache->lru;
-  while(l)
-  {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio) break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-  }
+  _finish_removal(cache, _gc(cache, NULL, fill_ratio));
 }
 
 void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, const char *file, int line)
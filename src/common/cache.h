@@ -28,9 +28,10 @@ typedef struct dt_cache_entry_t
   void *data;
   size_t data_size;
   size_t cost;
-  GList *link;
   dt_pthread_rwlock_t lock;
   int _lock_demoting;
+  int _referenced; // set on access, cleared by the clock hand
+  uint32_t _slot;  // position in the clock array of its shard
   uint32_t key;
 }
 dt_cache_entry_t;
@@ -38,17 +39,27 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
+// entries are spread by key over independently locked shards, so that threads working
+// on different images don't all wait on the same mutex.
+typedef struct dt_cache_shard_t
+{
+  dt_pthread_mutex_t lock;
+  GHashTable *hashtable; // stores (key, entry) pairs
+  GPtrArray *clock;      // all entries of the shard, swept by the hand to find eviction victims
+  guint hand;
+  size_t cost;
+} __attribute__((aligned(64))) dt_cache_shard_t;
+
 typedef struct dt_cache_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_cache_shard_t *shards;
+  uint32_t shard_bits; // log2 of the number of shards
+  uint32_t gc_shard;   // where the next garbage collection starts looking in other shards
 
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
+  size_t cost;       // user supplied cost per cache line (bytes?), summed over all shards
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
-
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
   dt_cache_allocate_t cleanup;
@@ -87,10 +98,10 @@ void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, co
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
-// goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
-// is locked)
+// evicts entries not used recently (clock, or second chance, approximation of the lru order)
+// until the fill ratio of the cache goes below the given parameter, in terms of the user defined
+// cost measure. never waits for locked entries and never fails, but sometimes not free memory
+// (in case all is locked). the cleanup callbacks run without holding the cache locks.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
 // iterate over all currently contained data blocks.
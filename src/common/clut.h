@@ -0,0 +1,80 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/darktable.h"
+
+/** lookup of one pixel in a 3D table of `level`^3 RGB triplets, red varying fastest.
+ *  the input is expected in the unit cube and gets clamped to it.
+ *  from OpenColorIO
+ *  https://github.com/imageworks/OpenColorIO/blob/master/src/OpenColorIO/ops/Lut3D/Lut3DOp.cpp */
+#ifdef _OPENMP
+#pragma omp declare simd uniform(clut, level)
+#endif
+static inline void dt_clut_tetrahedral(const float *const in, float *const out, const float *const restrict clut,
+                                       const int level)
+{
+  const int level2 = level * level;
+  int rgbi[3];
+  dt_aligned_pixel_t rgbd;
+  for(int c = 0; c < 3; ++c)
+  {
+    rgbd[c] = fminf(fmaxf(in[c], 0.0f), 1.0f) * (float)(level - 1);
+    rgbi[c] = CLAMP((int)rgbd[c], 0, level - 2);
+    rgbd[c] -= rgbi[c];
+  }
+
+  // tetrahedral interpolation walks from P000 to P111 along the lattice edges,
+  // taking the axes by decreasing delta. Sort the deltas (and the matching
+  // lattice offsets) with a 3-element network of selects instead of branching
+  // on the 6 tetrahedra, so the loop stays branchless and vectorizes with gathers.
+  float d0 = rgbd[0], d1 = rgbd[1], d2 = rgbd[2];
+  int o0 = 3, o1 = level * 3, o2 = level2 * 3;
+  float dt; int ot;
+  const gboolean s01 = d1 > d0;
+  dt = s01 ? d1 : d0; d1 = s01 ? d0 : d1; d0 = dt;
+  ot = s01 ? o1 : o0; o1 = s01 ? o0 : o1; o0 = ot;
+  const gboolean s12 = d2 > d1;
+  dt = s12 ? d2 : d1; d2 = s12 ? d1 : d2; d1 = dt;
+  ot = s12 ? o2 : o1; o2 = s12 ? o1 : o2; o1 = ot;
+  const gboolean s01b = d1 > d0;
+  dt = s01b ? d1 : d0; d1 = s01b ? d0 : d1; d0 = dt;
+  ot = s01b ? o1 : o0; o1 = s01b ? o0 : o1; o0 = ot;
+
+  // indexes of the 4 vertices of the tetrahedron in clut
+  const int i000 = (rgbi[0] + rgbi[1] * level + rgbi[2] * level2) * 3; // P000
+  const int iA = i000 + o0;                                            // one axis moved
+  const int iB = iA + o1;                                              // two axes moved
+  const int i111 = iB + o2;                                            // P111
+
+  const float w000 = 1.0f - d0;
+  const float wA = d0 - d1;
+  const float wB = d1 - d2;
+  const float w111 = d2;
+
+  out[0] = w000 * clut[i000] + wA * clut[iA] + wB * clut[iB] + w111 * clut[i111];
+  out[1] = w000 * clut[i000 + 1] + wA * clut[iA + 1] + wB * clut[iB + 1] + w111 * clut[i111 + 1];
+  out[2] = w000 * clut[i000 + 2] + wA * clut[iA + 2] + wB * clut[iB + 2] + w111 * clut[i111 + 2];
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -44,6 +44,8 @@
 
 #define SELECT_QUERY "SELECT DISTINCT * FROM %s"
 #define LIMIT_QUERY "LIMIT ?1, ?2"
+// above this number of changed images, it's cheaper to run the query again than to test them one by one
+#define DT_COLLECTION_MAX_INCREMENTAL 64
 
 static const char *comparators[] = {
   "<",  // DT_COLLECTION_RATING_COMP_LT = 0,
@@ -68,6 +70,8 @@ static void _dt_collection_filmroll_imported_callback(gpointer instance, const i
 static int dt_collection_image_offset_with_collection(const dt_collection_t *collection, int imgid);
 /* update aspect ratio for the selected images */
 static void _collection_update_aspect_ratio(const dt_collection_t *collection);
+/* drop the result of the background evaluation in flight, a synchronous update supersedes it */
+static void _collection_async_cancel(void);
 
 const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
 {
@@ -81,6 +85,8 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->where_ext = g_strdupv(clone->where_ext);
     collection->query = g_strdup(clone->query);
     collection->query_no_group = g_strdup(clone->query_no_group);
+    collection->query_member = g_strdup(clone->query_member);
+    collection->query_member_no_group = g_strdup(clone->query_member_no_group);
     collection->clone = 1;
     collection->count = clone->count;
     collection->count_no_group = clone->count_no_group;
@@ -116,6 +122,8 @@ void dt_collection_free(const dt_collection_t *collection)
 
   g_free(collection->query);
   g_free(collection->query_no_group);
+  g_free(collection->query_member);
+  g_free(collection->query_member_no_group);
   g_strfreev(collection->where_ext);
   g_free((dt_collection_t *)collection);
 }
@@ -152,6 +160,8 @@ void dt_collection_memory_update()
   if(!darktable.collection || !darktable.db) return;
   sqlite3_stmt *stmt;
 
+  _collection_async_cancel();
+
   /* check if we can get a query from collection */
   gchar *query = g_strdup(dt_collection_get_query(darktable.collection));
   if(!query) return;
@@ -174,6 +184,7 @@ void dt_collection_memory_update()
 
   // 2. insert collected images into the temporary table
   gchar *ins_query = g_strdup_printf("INSERT INTO memory.collected_images (imgid) %s", query);
+  dt_database_check_query_plan(darktable.db, query, "collection");
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), ins_query, -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
@@ -207,7 +218,8 @@ static void _dt_collection_set_selq_pre_sort(const dt_collection_t *collection,
   // clang-format on
 }
 
-int dt_collection_update(const dt_collection_t *collection)
+// build the query strings of the collection and store them, without touching memory.collected_images
+static int _dt_collection_build_query(const dt_collection_t *collection)
 {
   uint32_t result;
   gchar *wq, *wq_no_group, *sq, *selq_pre, *selq_post, *query, *query_no_group;
@@ -558,6 +570,19 @@ int dt_collection_update(const dt_collection_t *collection)
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
   result = _dt_collection_store(collection, query, query_no_group);
 
+  /* membership tests of a single image ?1, used to maintain memory.collected_images incrementally */
+  g_free(collection->query_member);
+  g_free(collection->query_member_no_group);
+  ((dt_collection_t *)collection)->query_member = NULL;
+  ((dt_collection_t *)collection)->query_member_no_group = NULL;
+  if(!(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  {
+    ((dt_collection_t *)collection)->query_member
+        = g_strdup_printf("%smi.id = ?1 AND (%s)%s", selq_pre, wq, selq_post ? selq_post : "");
+    ((dt_collection_t *)collection)->query_member_no_group
+        = g_strdup_printf("%smi.id = ?1 AND (%s)%s", selq_pre, wq_no_group, selq_post ? selq_post : "");
+  }
+
   /* free memory used */
   g_free(sq);
   g_free(wq);
@@ -567,6 +592,12 @@ int dt_collection_update(const dt_collection_t *collection)
   g_free(query);
   g_free(query_no_group);
 
+  return result;
+}
+
+// refresh what depends on the result of the query: culling restriction, counts and aspect ratios
+static void _dt_collection_update_finish(const dt_collection_t *collection)
+{
   // Handle culling mode across re-queryings : re-restrict collection to selection
   if(darktable.gui && darktable.gui->culling_mode)
   {
@@ -581,7 +612,12 @@ int dt_collection_update(const dt_collection_t *collection)
   dt_collection_hint_message(collection);
 
   _collection_update_aspect_ratio(collection);
+}
 
+int dt_collection_update(const dt_collection_t *collection)
+{
+  const int result = _dt_collection_build_query(collection);
+  _dt_collection_update_finish(collection);
   return result;
 }
 
@@ -1186,12 +1222,12 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query,
   return 1;
 }
 
-static uint32_t _dt_collection_compute_count(const dt_collection_t *collection, gboolean no_group)
+// the query counting the images of the collection, with ?1 and ?2 as limits if *bind_limit is set
+static gchar *_dt_collection_count_query(const dt_collection_t *collection, gboolean no_group,
+                                         gboolean *bind_limit)
 {
-  sqlite3_stmt *stmt = NULL;
-  uint32_t count = 1;
-  const gchar *query = no_group ? dt_collection_get_query_no_group(collection) : dt_collection_get_query(collection);
   gchar *count_query = NULL;
+  const gchar *query = no_group ? dt_collection_get_query_no_group(collection) : dt_collection_get_query(collection);
 
   gchar *fq = g_strstr_len(query, strlen(query), "FROM");
   if((collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
@@ -1203,16 +1239,36 @@ static uint32_t _dt_collection_compute_count(const dt_collection_t *collection,
   else
     count_query = g_strdup_printf("SELECT COUNT(DISTINCT mi.id) %s", fq);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
-  if((collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
-     && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  *bind_limit = (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT)
+                && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT);
+  return count_query;
+}
+
+static uint32_t _dt_collection_run_count(sqlite3 *handle, const gchar *count_query, const gboolean bind_limit)
+{
+  sqlite3_stmt *stmt = NULL;
+  uint32_t count = 1;
+  if(sqlite3_prepare_v2(handle, count_query, -1, &stmt, NULL) != SQLITE_OK)
   {
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+    fprintf(stderr, "[collection] can't prepare count query \"%s\": %s\n", count_query, sqlite3_errmsg(handle));
+    return count;
+  }
+  if(bind_limit)
+  {
+    sqlite3_bind_int(stmt, 1, 0);
+    sqlite3_bind_int(stmt, 2, -1);
   }
 
   if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
+  return count;
+}
+
+static uint32_t _dt_collection_compute_count(const dt_collection_t *collection, gboolean no_group)
+{
+  gboolean bind_limit = FALSE;
+  gchar *count_query = _dt_collection_count_query(collection, no_group, &bind_limit);
+  const uint32_t count = _dt_collection_run_count(dt_database_get(darktable.db), count_query, bind_limit);
   g_free(count_query);
   return count;
 }
@@ -1292,18 +1348,21 @@ int dt_collection_get_nth(const dt_collection_t *collection, int nth)
   if(nth < 0 || nth >= dt_collection_get_count(collection))
     return -1;
   const gchar *query = dt_collection_get_query(collection);
-  sqlite3_stmt *stmt = NULL;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
-
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  // the query only changes with the collection, keep it prepared for the next image
+  sqlite3_stmt *stmt = dt_database_get_statement(reader, query);
   int result = -1;
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  if(stmt)
   {
-    result  = sqlite3_column_int(stmt, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, nth);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      result  = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_reset(stmt);
   }
-
-  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
 
   return result;
 
@@ -2281,10 +2340,253 @@ static void _update_recentcollections()
 }
 
 
+// sort order depends on the given key
+static gboolean _collection_sorted_by(const dt_collection_t *collection, const dt_collection_sort_t sort)
+{
+  return (collection->params.query_flags & COLLECTION_QUERY_USE_SORT)
+         && (collection->params.sort == sort || collection->params.sort_second_order == sort);
+}
+
+// a change of this property on some images can only make them enter or leave the collection,
+// the position of the images staying in it is unchanged
+static gboolean _collection_property_keeps_order(const dt_collection_t *collection,
+                                                 const dt_collection_properties_t property)
+{
+  if(_collection_sorted_by(collection, DT_COLLECTION_SORT_CHANGE_TIMESTAMP)) return FALSE;
+
+  switch(property)
+  {
+    case DT_COLLECTION_PROP_RATING:
+      return !_collection_sorted_by(collection, DT_COLLECTION_SORT_RATING);
+    case DT_COLLECTION_PROP_COLORLABEL:
+      return !_collection_sorted_by(collection, DT_COLLECTION_SORT_COLOR);
+    case DT_COLLECTION_PROP_TAG:
+      return !_collection_sorted_by(collection, DT_COLLECTION_SORT_CUSTOM_ORDER);
+    case DT_COLLECTION_PROP_ASPECT_RATIO:
+      return !_collection_sorted_by(collection, DT_COLLECTION_SORT_ASPECT_RATIO);
+    case DT_COLLECTION_PROP_GEOTAGGING:
+    case DT_COLLECTION_PROP_LOCAL_COPY:
+      return TRUE;
+    default:
+      if(property >= DT_COLLECTION_PROP_METADATA && property < DT_COLLECTION_PROP_METADATA + DT_METADATA_NUMBER)
+        return !_collection_sorted_by(collection, DT_COLLECTION_SORT_TITLE)
+               && !_collection_sorted_by(collection, DT_COLLECTION_SORT_DESCRIPTION);
+      return FALSE;
+  }
+}
+
+static gboolean _collection_can_update_images(const dt_collection_t *collection,
+                                              const dt_collection_change_t query_change,
+                                              const dt_collection_properties_t changed_property, GList *list)
+{
+  return !collection->clone && collection == darktable.collection
+         && query_change == DT_COLLECTION_CHANGE_RELOAD && list
+         && g_list_length(list) <= DT_COLLECTION_MAX_INCREMENTAL
+         && !(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT)
+         && !(darktable.gui && darktable.gui->culling_mode)
+         && _collection_property_keeps_order(collection, changed_property);
+}
+
+// remove row from memory.collected_images and close the gap it leaves
+static void _collection_memory_remove_row(const int rowid)
+{
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM memory.collected_images WHERE rowid = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rowid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  // go through negative rowids so that no intermediate state has two rows with the same rowid
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE memory.collected_images SET rowid = 1 - rowid WHERE rowid > ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rowid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "UPDATE memory.collected_images SET rowid = -rowid WHERE rowid < 0",
+                        NULL, NULL, NULL);
+}
+
+static gint _collection_compare_rowid_desc(gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_INT(b) - GPOINTER_TO_INT(a);
+}
+
+// update memory.collected_images after some properties of the images of list changed, without running
+// the whole query again. only membership is re-evaluated, so this gives up and returns FALSE without
+// touching anything if an image has to enter the collection, as its position would need a full sort.
+static gboolean _collection_memory_update_images(const dt_collection_t *collection, GList *list)
+{
+  if(!collection->query_member || !collection->query_member_no_group) return FALSE;
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt = NULL;
+
+  // with grouping, which image stands for a collapsed group depends on all its members
+  GHashTable *images = g_hash_table_new(NULL, NULL);
+  for(GList *l = list; l; l = g_list_next(l))
+    g_hash_table_add(images, l->data);
+  if(darktable.gui && darktable.gui->grouping)
+  {
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "SELECT id FROM main.images"
+                                " WHERE group_id = (SELECT group_id FROM main.images WHERE id = ?1)",
+                                -1, &stmt, NULL);
+    // clang-format on
+    for(GList *l = list; l; l = g_list_next(l))
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+      while(sqlite3_step(stmt) == SQLITE_ROW)
+        g_hash_table_add(images, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  sqlite3_stmt *member = NULL, *member_no_group = NULL, *cached = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, collection->query_member, -1, &member, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, collection->query_member_no_group, -1, &member_no_group, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT rowid FROM memory.collected_images WHERE imgid = ?1",
+                              -1, &cached, NULL);
+
+  GList *removed_rows = NULL;
+  GList *deselected = NULL;
+  gboolean done = TRUE;
+
+  GHashTableIter it;
+  gpointer key;
+  g_hash_table_iter_init(&it, images);
+  while(g_hash_table_iter_next(&it, &key, NULL))
+  {
+    const int imgid = GPOINTER_TO_INT(key);
+
+    DT_DEBUG_SQLITE3_BIND_INT(member, 1, imgid);
+    const gboolean in = sqlite3_step(member) == SQLITE_ROW;
+    sqlite3_reset(member);
+
+    DT_DEBUG_SQLITE3_BIND_INT(cached, 1, imgid);
+    const int rowid = sqlite3_step(cached) == SQLITE_ROW ? sqlite3_column_int(cached, 0) : -1;
+    sqlite3_reset(cached);
+
+    if(in && rowid < 0)
+    {
+      done = FALSE;
+      break;
+    }
+    if(!in && rowid >= 0) removed_rows = g_list_prepend(removed_rows, GINT_TO_POINTER(rowid));
+
+    DT_DEBUG_SQLITE3_BIND_INT(member_no_group, 1, imgid);
+    if(sqlite3_step(member_no_group) != SQLITE_ROW) deselected = g_list_prepend(deselected, key);
+    sqlite3_reset(member_no_group);
+  }
+  sqlite3_finalize(member);
+  sqlite3_finalize(member_no_group);
+  sqlite3_finalize(cached);
+  g_hash_table_destroy(images);
+
+  if(done)
+  {
+    // from the last row to the first, so that the rowids still to remove don't move
+    removed_rows = g_list_sort(removed_rows, _collection_compare_rowid_desc);
+    for(GList *l = removed_rows; l; l = g_list_next(l))
+      _collection_memory_remove_row(GPOINTER_TO_INT(l->data));
+
+    // as in dt_collection_update_query(), images out of the query don't stay selected
+    gboolean selection_changed = FALSE;
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM main.selected_images WHERE imgid = ?1", -1, &stmt, NULL);
+    for(GList *l = deselected; l; l = g_list_next(l))
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+      sqlite3_step(stmt);
+      if(sqlite3_changes(db) > 0) selection_changed = TRUE;
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    if(selection_changed) DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
+
+    const int nb_removed = g_list_length(removed_rows);
+    if(nb_removed > 0)
+    {
+      dt_collection_t *c = (dt_collection_t *)collection;
+      c->count -= MIN(c->count, nb_removed);
+      c->count_no_group = (darktable.gui && darktable.gui->grouping)
+                            ? _dt_collection_compute_count(collection, TRUE)
+                            : c->count;
+      dt_collection_hint_message(collection);
+    }
+
+    dt_print(DT_DEBUG_SQL, "[collection] %d image(s) left the collection without a full update\n", nb_removed);
+  }
+
+  g_list_free(removed_rows);
+  g_list_free(deselected);
+  return done;
+}
+
+// set the extended where of the collection from the rules of the collect module
+static void _dt_collection_set_rules(const dt_collection_t *collection)
+{
+  char confname[200];
+
+  const int _n_r = dt_conf_get_int("plugins/lighttable/collect/num_rules");
+  const int num_rules = CLAMP(_n_r, 1, 10);
+  char *conj[] = { "AND", "OR", "AND NOT" };
+
+  gchar **query_parts = g_new (gchar*, num_rules + 1);
+  query_parts[num_rules] =  NULL;
+
+  for(int i = 0; i < num_rules; i++)
+  {
+    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/item%1d", i);
+    const int property = dt_conf_get_int(confname);
+    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/string%1d", i);
+    gchar *text = dt_conf_get_string(confname);
+    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/mode%1d", i);
+    const int mode = dt_conf_get_int(confname);
+
+    if(!text || text[0] == '\0')
+    {
+      if (mode == 1) // for OR show all
+        query_parts[i] = g_strdup(" OR 1=1");
+      else
+        query_parts[i] = g_strdup("");
+    }
+    else
+    {
+      gchar *query = get_query_string(property, text);
+
+      query_parts[i] =  g_strdup_printf(" %s %s", conj[mode], query);
+
+      g_free(query);
+    }
+    g_free(text);
+  }
+
+
+  /* set the extended where and the use of it in the query */
+  dt_collection_set_extended_where(collection, query_parts);
+  g_strfreev(query_parts);
+  dt_collection_set_query_flags(collection,
+                                (dt_collection_get_query_flags(collection) | COLLECTION_QUERY_USE_WHERE_EXT));
+
+  /* remove film id from default filter */
+  dt_collection_set_filter_flags(collection,
+                                 (dt_collection_get_filter_flags(collection) & ~COLLECTION_FILTER_FILM_ID));
+}
+
 void dt_collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change,
                                 dt_collection_properties_t changed_property, GList *list)
 {
   int next = -1;
+  if(!collection->clone) _collection_async_cancel();
+
   if(!collection->clone && query_change == DT_COLLECTION_CHANGE_NEW_QUERY && darktable.gui)
   {
     // if the query has changed, we reset the expanded group
@@ -2357,60 +2659,28 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
     }
   }
 
-  char confname[200];
+  _dt_collection_set_rules(collection);
 
-  const int _n_r = dt_conf_get_int("plugins/lighttable/collect/num_rules");
-  const int num_rules = CLAMP(_n_r, 1, 10);
-  char *conj[] = { "AND", "OR", "AND NOT" };
-
-  gchar **query_parts = g_new (gchar*, num_rules + 1);
-  query_parts[num_rules] =  NULL;
-
-  for(int i = 0; i < num_rules; i++)
+  /* update query and at last the visual */
+  // when only some properties of the images in list changed and the query is the same, we just check
+  // whether these images still belong to the collection. full updates are for new queries.
+  gboolean updated_images = FALSE;
+  if(_collection_can_update_images(collection, query_change, changed_property, list))
   {
-    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/item%1d", i);
-    const int property = dt_conf_get_int(confname);
-    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/string%1d", i);
-    gchar *text = dt_conf_get_string(confname);
-    snprintf(confname, sizeof(confname), "plugins/lighttable/collect/mode%1d", i);
-    const int mode = dt_conf_get_int(confname);
-
-    if(!text || text[0] == '\0')
-    {
-      if (mode == 1) // for OR show all
-        query_parts[i] = g_strdup(" OR 1=1");
-      else
-        query_parts[i] = g_strdup("");
-    }
-    else
-    {
-      gchar *query = get_query_string(property, text);
-
-      query_parts[i] =  g_strdup_printf(" %s %s", conj[mode], query);
-
-      g_free(query);
-    }
-    g_free(text);
+    gchar *previous_query = g_strdup(collection->query);
+    _dt_collection_build_query(collection);
+    updated_images = previous_query && !g_strcmp0(previous_query, collection->query)
+                     && _collection_memory_update_images(collection, list);
+    if(!updated_images) _dt_collection_update_finish(collection);
+    g_free(previous_query);
   }
-
-
-  /* set the extended where and the use of it in the query */
-  dt_collection_set_extended_where(collection, query_parts);
-  g_strfreev(query_parts);
-  dt_collection_set_query_flags(collection,
-                                (dt_collection_get_query_flags(collection) | COLLECTION_QUERY_USE_WHERE_EXT));
-
-  /* remove film id from default filter */
-  dt_collection_set_filter_flags(collection,
-                                 (dt_collection_get_filter_flags(collection) & ~COLLECTION_FILTER_FILM_ID));
-
-  /* update query and at last the visual */
-  dt_collection_update(collection);
+  else
+    dt_collection_update(collection);
 
   // remove from selected images where not in this query.
   sqlite3_stmt *stmt = NULL;
   const gchar *cquery = dt_collection_get_query_no_group(collection);
-  if(cquery && cquery[0] != '\0')
+  if(!updated_images && cquery && cquery[0] != '\0')
   {
     gchar *complete_query = g_strdup_printf("DELETE FROM main.selected_images WHERE imgid NOT IN (%s)", cquery);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), complete_query, -1, &stmt, NULL);
@@ -2435,12 +2705,235 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
   /* raise signal of collection change, only if this is an original */
   if(!collection->clone)
   {
-    dt_collection_memory_update();
+    if(!updated_images) dt_collection_memory_update();
     DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED, query_change, changed_property,
                                   list, next);
   }
 }
 
+// background evaluation of the collection, see dt_collection_update_query_async().
+// each request gets a new generation, only the result of the latest one is applied.
+typedef struct _collection_async_t
+{
+  int generation;
+  dt_collection_change_t query_change;
+  dt_collection_properties_t changed_property;
+  gchar *query, *query_no_group, *count_query;
+  gboolean bind_limit;
+  // results
+  GArray *imgids;
+  GList *deselect;
+  uint32_t count_no_group;
+} _collection_async_t;
+
+static GMutex _async_lock;
+static int _async_generation = 0;
+// reader connection of the running evaluation, to interrupt it once it is stale
+static sqlite3 *_async_handle = NULL;
+
+static void _collection_async_free(void *data)
+{
+  _collection_async_t *a = (_collection_async_t *)data;
+  if(!a) return;
+  g_free(a->query);
+  g_free(a->query_no_group);
+  g_free(a->count_query);
+  if(a->imgids) g_array_free(a->imgids, TRUE);
+  g_list_free(a->deselect);
+  g_free(a);
+}
+
+// start a new generation, the evaluation running for an older one is interrupted
+static int _collection_async_new_generation(void)
+{
+  g_mutex_lock(&_async_lock);
+  const int generation = ++_async_generation;
+  if(_async_handle) sqlite3_interrupt(_async_handle);
+  g_mutex_unlock(&_async_lock);
+  return generation;
+}
+
+static void _collection_async_cancel(void)
+{
+  _collection_async_new_generation();
+}
+
+static gboolean _collection_async_is_current(const int generation)
+{
+  g_mutex_lock(&_async_lock);
+  const gboolean current = generation == _async_generation;
+  g_mutex_unlock(&_async_lock);
+  return current;
+}
+
+// gui thread: store the result of the evaluation, as dt_collection_update_query() does
+static gboolean _collection_async_apply(gpointer user_data)
+{
+  _collection_async_t *a = (_collection_async_t *)user_data;
+  dt_collection_t *collection = (dt_collection_t *)darktable.collection;
+
+  // a newer request or a synchronous update happened meanwhile
+  if(!collection || !_collection_async_is_current(a->generation) || g_strcmp0(a->query, collection->query))
+  {
+    _collection_async_free(a);
+    return FALSE;
+  }
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt = NULL;
+
+  dt_database_start_transaction(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.collected_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.sqlite_sequence WHERE name='collected_images'", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO memory.collected_images (imgid) VALUES (?1)", -1, &stmt, NULL);
+  for(guint i = 0; i < a->imgids->len; i++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(a->imgids, int, i));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  // remove from selected images where not in this query.
+  gboolean selection_changed = FALSE;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM main.selected_images WHERE imgid = ?1", -1, &stmt, NULL);
+  for(GList *l = a->deselect; l; l = g_list_next(l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    if(sqlite3_changes(db) > 0) selection_changed = TRUE;
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_transaction(darktable.db);
+
+  if(selection_changed) DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
+
+  collection->count = a->imgids->len;
+  collection->count_no_group = a->count_no_group;
+  dt_collection_hint_message(collection);
+  _collection_update_aspect_ratio(collection);
+
+  _update_recentcollections();
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED, a->query_change,
+                                a->changed_property, (GList *)NULL, -1);
+
+  _collection_async_free(a);
+  return FALSE;
+}
+
+static int32_t _collection_async_job_run(dt_job_t *job)
+{
+  _collection_async_t *a = (_collection_async_t *)dt_control_job_get_params(job);
+
+  sqlite3 *handle = dt_database_get_reader(darktable.db);
+  // only a connection of our own can be interrupted without breaking the queries of other threads
+  const gboolean own = handle != dt_database_get(darktable.db);
+
+  g_mutex_lock(&_async_lock);
+  const gboolean stale = a->generation != _async_generation;
+  if(!stale && own) _async_handle = handle;
+  g_mutex_unlock(&_async_lock);
+
+  int rc = SQLITE_DONE;
+  if(!stale)
+  {
+    sqlite3_stmt *stmt = NULL;
+    a->imgids = g_array_new(FALSE, FALSE, sizeof(int));
+    rc = sqlite3_prepare_v2(handle, a->query, -1, &stmt, NULL);
+    if(rc == SQLITE_OK)
+    {
+      sqlite3_bind_int(stmt, 1, 0);
+      sqlite3_bind_int(stmt, 2, -1);
+      while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+      {
+        const int imgid = sqlite3_column_int(stmt, 0);
+        g_array_append_val(a->imgids, imgid);
+      }
+    }
+    sqlite3_finalize(stmt);
+
+    if(rc == SQLITE_DONE)
+    {
+      a->count_no_group = _dt_collection_run_count(handle, a->count_query, a->bind_limit);
+
+      gchar *query = g_strdup_printf("SELECT imgid FROM main.selected_images WHERE imgid NOT IN (%s)",
+                                     a->query_no_group);
+      rc = sqlite3_prepare_v2(handle, query, -1, &stmt, NULL);
+      if(rc == SQLITE_OK)
+      {
+        sqlite3_bind_int(stmt, 1, 0);
+        sqlite3_bind_int(stmt, 2, -1);
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+          a->deselect = g_list_prepend(a->deselect, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+      }
+      sqlite3_finalize(stmt);
+      g_free(query);
+    }
+  }
+
+  g_mutex_lock(&_async_lock);
+  if(own) _async_handle = NULL;
+  const gboolean current = a->generation == _async_generation;
+  g_mutex_unlock(&_async_lock);
+  dt_database_release_reader(darktable.db, handle);
+
+  if(rc == SQLITE_INTERRUPT || !current)
+    dt_print(DT_DEBUG_SQL, "[collection] stale evaluation %d dropped\n", a->generation);
+  else if(rc != SQLITE_DONE)
+    fprintf(stderr, "[collection] background evaluation failed: %s\n", sqlite3_errstr(rc));
+  else
+  {
+    // hand the result over to the gui thread, the job params are freed with the job
+    _collection_async_t *result = g_malloc(sizeof(_collection_async_t));
+    *result = *a;
+    a->query = a->query_no_group = a->count_query = NULL;
+    a->imgids = NULL;
+    a->deselect = NULL;
+    g_main_context_invoke(NULL, _collection_async_apply, result);
+  }
+  return 0;
+}
+
+void dt_collection_update_query_async(const dt_collection_t *collection, dt_collection_change_t query_change,
+                                      dt_collection_properties_t changed_property)
+{
+  // clones have no memory table, and culling mode restricts it again after each update
+  if(collection->clone || collection != darktable.collection || !darktable.gui || darktable.gui->culling_mode
+     || !dt_control_running())
+  {
+    dt_collection_update_query(collection, query_change, changed_property, NULL);
+    return;
+  }
+
+  const int generation = _collection_async_new_generation();
+
+  // if the query has changed, we reset the expanded group
+  if(query_change == DT_COLLECTION_CHANGE_NEW_QUERY) darktable.gui->expanded_group_id = -1;
+
+  // building the query strings is cheap, only running them is deferred
+  _dt_collection_set_rules(collection);
+  _dt_collection_build_query(collection);
+
+  _collection_async_t *a = g_malloc0(sizeof(_collection_async_t));
+  a->generation = generation;
+  a->query_change = query_change;
+  a->changed_property = changed_property;
+  a->query = g_strdup(dt_collection_get_query(collection));
+  a->query_no_group = g_strdup(dt_collection_get_query_no_group(collection));
+  a->count_query = _dt_collection_count_query(collection, TRUE, &a->bind_limit);
+
+  dt_job_t *job = dt_control_job_create(_collection_async_job_run, "collection query");
+  if(!job)
+  {
+    _collection_async_free(a);
+    dt_collection_update_query(collection, query_change, changed_property, NULL);
+    return;
+  }
+  dt_control_job_set_params(job, a, _collection_async_free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, job);
+}
+
 void dt_pop_collection()
 {
   // Restore previous collection
@@ -174,6 +174,8 @@ typedef struct dt_collection_t
 {
   int clone;
   gchar *query, *query_no_group;
+  // does image ?1 belong to the query, NULL when it can't be tested alone
+  gchar *query_member, *query_member_no_group;
   gchar **where_ext;
   unsigned int count, count_no_group;
   unsigned int tagid;
@@ -268,6 +270,10 @@ uint32_t dt_collection_get_selected_count(const dt_collection_t *collection);
 /** update query by conf vars */
 void dt_collection_update_query(const dt_collection_t *collection, dt_collection_change_t query_change,
                                 dt_collection_properties_t changed_property, GList *list);
+/** same, but the query runs in a background job and the collection changes once it's done. a newer
+ * request or a synchronous update interrupts it, so only the latest result reaches the thumbtable. */
+void dt_collection_update_query_async(const dt_collection_t *collection, dt_collection_change_t query_change,
+                                      dt_collection_properties_t changed_property);
 
 /** updates the hint message for collection */
 void dt_collection_hint_message(const dt_collection_t *collection);
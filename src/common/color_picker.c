@@ -635,6 +635,99 @@ void dt_color_picker_helper(const dt_iop_buffer_dsc_t *dsc, const float *const p
   }
 }
 
+#ifdef HAVE_OPENCL
+// work groups of the reduction, their partial results are merged on the host
+#define DT_COLOR_PICKER_CL_GROUPS 32
+
+dt_color_picker_cl_global_t *dt_color_picker_init_cl_global()
+{
+  dt_color_picker_cl_global_t *g = malloc(sizeof(*g));
+  const int program = 36; // statistics.cl, from programs.conf
+  g->kernel_picker_4ch = dt_opencl_create_kernel(program, "picker_4ch");
+  return g;
+}
+
+void dt_color_picker_free_cl_global(dt_color_picker_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_picker_4ch);
+  free(g);
+}
+
+int dt_color_picker_helper_cl(const int devid, const dt_iop_buffer_dsc_t *dsc, cl_mem img, const int *const box,
+                              dt_aligned_pixel_t picked_color, dt_aligned_pixel_t picked_color_min,
+                              dt_aligned_pixel_t picked_color_max, const dt_iop_colorspace_type_t image_cst,
+                              const dt_iop_colorspace_type_t picker_cst)
+{
+  // mosaiced data and colorspace conversions stay on the CPU
+  if(dsc->channels != 4u || dsc->datatype != TYPE_FLOAT) return FALSE;
+  if(image_cst != picker_cst && picker_cst != IOP_CS_NONE) return FALSE;
+
+  const int kernel = darktable.opencl->color_picker->kernel_picker_4ch;
+  const int x0 = box[0];
+  const int y0 = box[1];
+  const int width = box[2] - box[0];
+  const int height = box[3] - box[1];
+  const size_t size = _box_size(box);
+  if(size == 0) return FALSE;
+
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 3 * 4 * sizeof(float), .overhead = 0,
+                                  .sizex = 1 << 8, .sizey = 1 };
+  if(!dt_opencl_local_buffer_opt(devid, kernel, &locopt)) return FALSE;
+
+  const size_t groups = MIN(DT_COLOR_PICKER_CL_GROUPS, ROUNDUP(size, locopt.sizex) / locopt.sizex);
+  const size_t partial_size = sizeof(float) * 4 * 3 * groups;
+  const float weight = 1.0f / (float)size;
+
+  float *partial = dt_alloc_align(partial_size);
+  cl_mem dev_partial = dt_opencl_alloc_device_buffer(devid, partial_size);
+  cl_int err = DT_OPENCL_DEFAULT_ERROR;
+  if(!partial || !dev_partial) goto error;
+
+  const size_t sizes[3] = { groups * locopt.sizex, 1, 1 };
+  const size_t local[3] = { locopt.sizex, 1, 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), &img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(int), &x0);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), &y0);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(float), &weight);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(cl_mem), &dev_partial);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(float) * 4 * 3 * locopt.sizex, NULL);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, kernel, sizes, local);
+  if(err != CL_SUCCESS) goto error;
+
+  err = dt_opencl_read_buffer_from_device(devid, partial, dev_partial, 0, partial_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  for(size_t g = 0; g < groups; g++)
+  {
+    for(int k = 0; k < 3; k++)
+    {
+      picked_color[k] += partial[4 * (3 * g) + k];
+      picked_color_min[k] = fminf(picked_color_min[k], partial[4 * (3 * g + 1) + k]);
+      picked_color_max[k] = fmaxf(picked_color_max[k], partial[4 * (3 * g + 2) + k]);
+    }
+  }
+  // the CPU path ignores the 4th channel the same way
+  picked_color[3] = 0.0f;
+  picked_color_min[3] = fminf(picked_color_min[3], 0.0f);
+  picked_color_max[3] = fmaxf(picked_color_max[3], 0.0f);
+
+  dt_opencl_release_mem_object(dev_partial);
+  dt_free_align(partial);
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[color_picker_cl] couldn't pick the color on the device: %s\n", cl_errstr(err));
+  dt_opencl_release_mem_object(dev_partial);
+  dt_free_align(partial);
+  return FALSE;
+}
+#endif
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -19,6 +19,9 @@
 #pragma once
 
 #include "common/iop_profile.h"
+#ifdef HAVE_OPENCL
+#include "common/opencl.h"
+#endif
 
 struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
@@ -31,6 +34,24 @@ void dt_color_picker_helper(const struct dt_iop_buffer_dsc_t *dsc, const float *
                             const enum dt_iop_colorspace_type_t picker_cst,
                             const dt_iop_order_iccprofile_info_t *const profile);
 
+#ifdef HAVE_OPENCL
+typedef struct dt_color_picker_cl_global_t
+{
+  int kernel_picker_4ch;
+} dt_color_picker_cl_global_t;
+
+dt_color_picker_cl_global_t *dt_color_picker_init_cl_global(void);
+void dt_color_picker_free_cl_global(dt_color_picker_cl_global_t *g);
+
+/** same as dt_color_picker_helper() over the box of an image on the device, reading back only the
+  * reduced values. returns FALSE for the cases only handled on the CPU or on error. */
+int dt_color_picker_helper_cl(const int devid, const struct dt_iop_buffer_dsc_t *dsc, cl_mem img,
+                              const int *const box, dt_aligned_pixel_t picked_color,
+                              dt_aligned_pixel_t picked_color_min, dt_aligned_pixel_t picked_color_max,
+                              const enum dt_iop_colorspace_type_t image_cst,
+                              const enum dt_iop_colorspace_type_t picker_cst);
+#endif
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
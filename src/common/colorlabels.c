@@ -18,8 +18,11 @@
 #include "common/colorlabels.h"
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/image_cache.h"
+#include "common/image_index.h"
+#include "common/sidecar_writer.h"
 #include "common/undo.h"
 #include "common/grouping.h"
 #include "control/conf.h"
@@ -43,6 +46,9 @@ typedef struct dt_undo_colorlabels_t
 
 int dt_colorlabels_get_labels(const int imgid)
 {
+  const int indexed = dt_image_index_get_color_labels(darktable.image_index, imgid);
+  if(indexed >= 0) return indexed;
+
   sqlite3_stmt *stmt;
   // clang-format off
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -103,6 +109,7 @@ void dt_colorlabels_remove_labels(const int imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_image_index_set_color_labels(darktable.image_index, imgid, 0);
 }
 
 void dt_colorlabels_set_label(const int imgid, const int color)
@@ -117,6 +124,8 @@ void dt_colorlabels_set_label(const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  const int labels = dt_image_index_get_color_labels(darktable.image_index, imgid);
+  if(labels >= 0) dt_image_index_set_color_labels(darktable.image_index, imgid, labels | (1 << color));
 }
 
 void dt_colorlabels_remove_label(const int imgid, const int color)
@@ -131,6 +140,8 @@ void dt_colorlabels_remove_label(const int imgid, const int color)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, color);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  const int labels = dt_image_index_get_color_labels(darktable.image_index, imgid);
+  if(labels >= 0) dt_image_index_set_color_labels(darktable.image_index, imgid, labels & ~(1 << color));
 }
 
 typedef enum dt_colorlabels_actions_t
@@ -140,6 +151,46 @@ typedef enum dt_colorlabels_actions_t
   DT_CA_TOGGLE
 } dt_colorlabels_actions_t;
 
+// apply the action to all images with one statement per label instead of one per image and label.
+// a toggle reaching this point removes the labels, see _colorlabels_execute()
+static void _colorlabels_execute_bulk(const GList *imgs, const int labels, const int action)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  dt_database_set_bulk_images(darktable.db, imgs);
+
+  if(action == DT_CA_SET || action == DT_CA_TOGGLE)
+  {
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "DELETE FROM main.color_labels"
+                                " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)"
+                                "   AND ((1 << color) & ?1) != 0",
+                                -1, &stmt, NULL);
+    // clang-format on
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, action == DT_CA_SET ? 0xff : labels);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+
+  if(action == DT_CA_SET || action == DT_CA_ADD)
+  {
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "INSERT OR IGNORE INTO main.color_labels (imgid, color)"
+                                " SELECT imgid, ?1 FROM memory.bulk_images",
+                                -1, &stmt, NULL);
+    // clang-format on
+    for(int color = 0; color < DT_COLORLABELS_LAST; color++)
+    {
+      if(!(labels & (1 << color))) continue;
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, color);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+}
 
 static void _colorlabels_execute(const GList *imgs, const int labels, GList **undo, const gboolean undo_on, int action)
 {
@@ -161,6 +212,7 @@ static void _colorlabels_execute(const GList *imgs, const int labels, GList **un
     }
   }
 
+  GArray *labels_after = g_array_new(FALSE, FALSE, sizeof(uint8_t));
   for(const GList *image = imgs; image; image = g_list_next((GList *)image))
   {
     const int image_id = GPOINTER_TO_INT(image->data);
@@ -188,11 +240,19 @@ static void _colorlabels_execute(const GList *imgs, const int labels, GList **un
       undocolorlabels->imgid = image_id;
       undocolorlabels->before = before;
       undocolorlabels->after = after;
-      *undo = g_list_append(*undo, undocolorlabels);
+      *undo = g_list_prepend(*undo, undocolorlabels);
     }
-
-    _pop_undo_execute(image_id, before, after);
+    g_array_append_val(labels_after, after);
   }
+  if(undo_on) *undo = g_list_reverse(*undo);
+
+  _colorlabels_execute_bulk(imgs, labels, action);
+
+  guint i = 0;
+  for(const GList *image = imgs; image; image = g_list_next((GList *)image), i++)
+    dt_image_index_set_color_labels(darktable.image_index, GPOINTER_TO_INT(image->data),
+                                    g_array_index(labels_after, uint8_t, i));
+  g_array_free(labels_after, TRUE);
 }
 
 void dt_colorlabels_set_labels(const GList *img, const int labels, const gboolean clear_on,
@@ -231,10 +291,7 @@ void dt_colorlabels_toggle_label_on_list(const GList *list, const int color, con
   }
 
   // synchronise xmp files
-  for(GList *l = (GList *)list; l; l = g_list_next(l))
-  {
-    dt_image_synch_xmp(GPOINTER_TO_INT(l->data));
-  }
+  dt_sidecar_writer_queue_list(list);
 
   if(undo_on)
   {
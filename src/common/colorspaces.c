@@ -1293,6 +1293,226 @@ void dt_colorspaces_cleanup_profile(cmsHPROFILE p)
   cmsCloseProfile(p);
 }
 
+// number of unused transforms kept around
+#define DT_COLORSPACES_TRANSFORMS 16
+
+typedef struct dt_colorspaces_transform_t
+{
+  uint64_t hash;
+  cmsHTRANSFORM xform;
+  cmsUInt32Number input_format;
+  cmsUInt32Number output_format;
+  float *clut;
+  int clut_level;
+  int users;
+} dt_colorspaces_transform_t;
+
+static void _transform_free(dt_colorspaces_transform_t *t)
+{
+  cmsDeleteTransform(t->xform);
+  dt_free_align(t->clut);
+  free(t);
+}
+
+// profiles are compared by content: the same file opened twice, or embedded in two images, is the same profile
+static gboolean _profile_hash(cmsHPROFILE profile, uint64_t *hash)
+{
+  cmsUInt32Number size = 0;
+  if(!cmsSaveProfileToMem(profile, NULL, &size) || size == 0) return FALSE;
+
+  char *data = malloc(size);
+  if(!data) return FALSE;
+  const gboolean res = cmsSaveProfileToMem(profile, data, &size);
+  if(res) *hash = dt_hash(*hash, data, size);
+  free(data);
+  return res;
+}
+
+// with the lock held
+static dt_colorspaces_transform_t *_find_transform(dt_colorspaces_t *self, cmsHTRANSFORM xform)
+{
+  for(GList *iter = self->transforms; iter; iter = g_list_next(iter))
+  {
+    dt_colorspaces_transform_t *t = (dt_colorspaces_transform_t *)iter->data;
+    if(t->xform == xform) return t;
+  }
+  return NULL;
+}
+
+// with the lock held: drop the least recently used transforms nobody uses anymore
+static void _trim_transforms(dt_colorspaces_t *self)
+{
+  int unused = 0;
+  for(GList *iter = self->transforms; iter; iter = g_list_next(iter))
+    if(((dt_colorspaces_transform_t *)iter->data)->users == 0) unused++;
+
+  GList *iter = g_list_last(self->transforms);
+  while(iter && unused > DT_COLORSPACES_TRANSFORMS)
+  {
+    GList *prev = g_list_previous(iter);
+    dt_colorspaces_transform_t *t = (dt_colorspaces_transform_t *)iter->data;
+    if(t->users == 0)
+    {
+      self->transforms = g_list_delete_link(self->transforms, iter);
+      _transform_free(t);
+      unused--;
+    }
+    iter = prev;
+  }
+}
+
+cmsHTRANSFORM dt_colorspaces_get_transform(cmsHPROFILE input, cmsUInt32Number input_format, cmsHPROFILE output,
+                                           cmsUInt32Number output_format, int intent)
+{
+  if(!input || !output) return NULL;
+
+  dt_colorspaces_t *self = darktable.color_profiles;
+  uint64_t hash = 5381;
+  if(!_profile_hash(input, &hash) || !_profile_hash(output, &hash))
+  {
+    // can't identify the profiles: not shared, dt_colorspaces_release_transform() deletes it
+    return cmsCreateTransform(input, input_format, output, output_format, intent, 0);
+  }
+  hash = dt_hash(hash, (const char *)&input_format, sizeof(cmsUInt32Number));
+  hash = dt_hash(hash, (const char *)&output_format, sizeof(cmsUInt32Number));
+  hash = dt_hash(hash, (const char *)&intent, sizeof(int));
+
+  dt_pthread_mutex_lock(&self->transforms_lock);
+  for(GList *iter = self->transforms; iter; iter = g_list_next(iter))
+  {
+    dt_colorspaces_transform_t *t = (dt_colorspaces_transform_t *)iter->data;
+    if(t->hash == hash)
+    {
+      t->users++;
+      self->transforms = g_list_remove_link(self->transforms, iter);
+      self->transforms = g_list_concat(iter, self->transforms);
+      dt_pthread_mutex_unlock(&self->transforms_lock);
+      return t->xform;
+    }
+  }
+  dt_pthread_mutex_unlock(&self->transforms_lock);
+
+  // creating a transform from LUT profiles takes a while, don't block the other pipes meanwhile
+  cmsHTRANSFORM xform = cmsCreateTransform(input, input_format, output, output_format, intent, 0);
+  if(!xform) return NULL;
+
+  dt_colorspaces_transform_t *t = (dt_colorspaces_transform_t *)calloc(1, sizeof(dt_colorspaces_transform_t));
+  if(!t) return xform;
+  t->hash = hash;
+  t->xform = xform;
+  t->input_format = input_format;
+  t->output_format = output_format;
+  t->users = 1;
+
+  dt_pthread_mutex_lock(&self->transforms_lock);
+  self->transforms = g_list_prepend(self->transforms, t);
+  _trim_transforms(self);
+  dt_pthread_mutex_unlock(&self->transforms_lock);
+
+  dt_print(DT_DEBUG_DEV, "[colorspaces] new shared transform %p\n", xform);
+  return xform;
+}
+
+void dt_colorspaces_release_transform(cmsHTRANSFORM xform)
+{
+  if(!xform) return;
+
+  dt_colorspaces_t *self = darktable.color_profiles;
+  dt_pthread_mutex_lock(&self->transforms_lock);
+  dt_colorspaces_transform_t *t = _find_transform(self, xform);
+  if(t)
+  {
+    t->users--;
+    _trim_transforms(self);
+  }
+  dt_pthread_mutex_unlock(&self->transforms_lock);
+
+  if(!t) cmsDeleteTransform(xform);
+}
+
+const float *dt_colorspaces_get_transform_clut(cmsHTRANSFORM xform, const int level)
+{
+  if(!xform || level < 2) return NULL;
+
+  dt_colorspaces_t *self = darktable.color_profiles;
+  dt_pthread_mutex_lock(&self->transforms_lock);
+  dt_colorspaces_transform_t *t = _find_transform(self, xform);
+  const float *clut = (t && t->clut_level == level) ? t->clut : NULL;
+  const cmsUInt32Number input_format = t ? t->input_format : 0;
+  const cmsUInt32Number output_format = t ? t->output_format : 0;
+  dt_pthread_mutex_unlock(&self->transforms_lock);
+
+  // the caller holds the transform, so the entry can't go away in the meantime
+  if(!t || clut) return clut;
+  if(!T_FLOAT(input_format) || T_BYTES(input_format) != 4 || !T_FLOAT(output_format)
+     || T_BYTES(output_format) != 4 || T_CHANNELS(output_format) != 3)
+    return NULL;
+
+  const gboolean is_lab = T_COLORSPACE(input_format) == PT_Lab;
+  const size_t in_stride = T_CHANNELS(input_format) + T_EXTRA(input_format);
+  const size_t out_stride = T_CHANNELS(output_format) + T_EXTRA(output_format);
+  const size_t plane = (size_t)level * level;
+  float *const table = dt_alloc_align_float(plane * level * 3);
+  if(!table) return NULL;
+
+  // one plane of constant third coordinate at a time, red varying fastest
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in_stride, is_lab, level, out_stride, plane, table, xform) \
+  schedule(static)
+#endif
+  for(int b = 0; b < level; b++)
+  {
+    float *const in = dt_alloc_align_float(plane * in_stride);
+    float *const out = dt_alloc_align_float(plane * out_stride);
+    if(in && out)
+    {
+      for(size_t k = 0; k < plane; k++)
+      {
+        const float rgb[3] = { (float)(k % level) / (level - 1), (float)(k / level) / (level - 1),
+                               (float)b / (level - 1) };
+        float *const pixel = in + k * in_stride;
+        for(size_t c = 0; c < in_stride; c++) pixel[c] = 0.0f;
+        if(is_lab)
+        {
+          pixel[0] = 100.0f * rgb[0];
+          pixel[1] = 256.0f * rgb[1] - 128.0f;
+          pixel[2] = 256.0f * rgb[2] - 128.0f;
+        }
+        else
+          for(int c = 0; c < 3; c++) pixel[c] = rgb[c];
+      }
+      cmsDoTransform(xform, in, out, plane);
+      for(size_t k = 0; k < plane; k++)
+        for(int c = 0; c < 3; c++) table[(b * plane + k) * 3 + c] = out[k * out_stride + c];
+    }
+    else
+    {
+      // out of memory: black rather than garbage
+      for(size_t k = 0; k < plane * 3; k++) table[b * plane * 3 + k] = 0.0f;
+    }
+    dt_free_align(in);
+    dt_free_align(out);
+  }
+
+  dt_pthread_mutex_lock(&self->transforms_lock);
+  if(t->clut_level == level)
+  {
+    // another pipe sampled it meanwhile
+    dt_free_align(table);
+  }
+  else
+  {
+    dt_free_align(t->clut);
+    t->clut = table;
+    t->clut_level = level;
+  }
+  clut = t->clut;
+  dt_pthread_mutex_unlock(&self->transforms_lock);
+
+  return clut;
+}
+
 void dt_colorspaces_get_profile_name(cmsHPROFILE p, const char *language, const char *country, char *name,
                                      size_t len)
 {
@@ -1432,7 +1652,7 @@ static void _update_display_transforms(dt_colorspaces_t *self)
 
   self->transform_srgb_to_display = cmsCreateTransform(_get_profile(self, DT_COLORSPACE_SRGB, "",
                                                                     DT_PROFILE_DIRECTION_DISPLAY)->profile,
-                                                       TYPE_RGBA_8,
+                                                       TYPE_BGRA_8,
                                                        display_profile,
                                                        TYPE_BGRA_8,
                                                        self->display_intent,
@@ -1440,7 +1660,7 @@ static void _update_display_transforms(dt_colorspaces_t *self)
 
   self->transform_adobe_rgb_to_display = cmsCreateTransform(_get_profile(self, DT_COLORSPACE_ADOBERGB, "",
                                                                          DT_PROFILE_DIRECTION_DISPLAY)->profile,
-                                                            TYPE_RGBA_8,
+                                                            TYPE_BGRA_8,
                                                             display_profile,
                                                             TYPE_BGRA_8,
                                                             self->display_intent,
@@ -1576,6 +1796,7 @@ dt_colorspaces_t *dt_colorspaces_init()
   _compute_prequantized_primaries(&D65xyY, &Rec709_Primaries, &Rec709_Primaries_Prequantized);
 
   pthread_rwlock_init(&res->xprofile_lock, NULL);
+  dt_pthread_mutex_init(&res->transforms_lock, NULL);
 
   int in_pos = -1,
       out_pos = -1,
@@ -1782,6 +2003,9 @@ void dt_colorspaces_cleanup(dt_colorspaces_t *self)
   }
   g_list_free_full(self->profiles, free);
 
+  g_list_free_full(self->transforms, (GDestroyNotify)_transform_free);
+  dt_pthread_mutex_destroy(&self->transforms_lock);
+
   pthread_rwlock_destroy(&self->xprofile_lock);
   g_free(self->colord_profile_file);
   g_free(self->xprofile_data);
@@ -165,6 +165,10 @@ typedef struct dt_colorspaces_t
 
   cmsHTRANSFORM transform_srgb_to_display, transform_adobe_rgb_to_display;
 
+  // process-wide cache of lcms2 transforms, most recently used first
+  dt_pthread_mutex_t transforms_lock;
+  GList *transforms;
+
 } dt_colorspaces_t;
 
 typedef struct dt_colorspaces_color_profile_t
@@ -239,6 +243,21 @@ int dt_colorspaces_get_matrix_from_input_profile(cmsHPROFILE prof, dt_colormatri
 int dt_colorspaces_get_matrix_from_output_profile(cmsHPROFILE prof, dt_colormatrix_t matrix, float *lutr, float *lutg,
                                                   float *lutb, const int lutsize);
 
+/** get a lcms2 transform between two profiles, shared with every other caller asking for the same profiles
+ *  (compared by content), formats and intent. returns NULL if lcms2 can't create it.
+ *  it must be given back with dt_colorspaces_release_transform(), never deleted directly. */
+cmsHTRANSFORM dt_colorspaces_get_transform(cmsHPROFILE input, cmsUInt32Number input_format, cmsHPROFILE output,
+                                           cmsUInt32Number output_format, int intent);
+
+/** release a transform obtained with dt_colorspaces_get_transform(). NULL is ignored. */
+void dt_colorspaces_release_transform(cmsHTRANSFORM xform);
+
+/** 3D table of `level`^3 samples of a transform obtained with dt_colorspaces_get_transform(), to be evaluated
+ *  with dt_clut_tetrahedral(). it covers L in [0; 100] and a, b in [-128; 128] for Lab inputs, the unit cube
+ *  otherwise. it is computed once and lives as long as the transform. returns NULL for non-float formats or
+ *  outputs other than 3 channels. */
+const float *dt_colorspaces_get_transform_clut(cmsHTRANSFORM xform, const int level);
+
 /** wrapper to get the name from a color profile. this tries to handle character encodings. */
 void dt_colorspaces_get_profile_name(cmsHPROFILE p, const char *language, const char *country, char *name,
                                      size_t len);
@@ -1026,6 +1026,139 @@ static inline void dt_JzAzBz_2_XYZ(const dt_aligned_pixel_t JzAzBz, dt_aligned_p
   XYZ_D65[2] = XYZ[2];
 }
 
+/**
+ * Row variants of the conversions above, converting npixels 4-channel pixels at once. They vectorize
+ * across pixels instead of channels, and the JzAzBz ones use dt_fast_powf() instead of powf(). Compared
+ * to a double precision conversion, they are as accurate as the per-pixel versions: the error on Jz, az
+ * and bz stays below 1e-3 * Jz for XYZ in [0, 1], see src/tests/unittests/common. The alpha channel is copied.
+ * Use them where a whole row is converted before being consumed, like the blending masks.
+ */
+static inline void dt_XYZ_to_Lab_row(const float *const restrict XYZ, float *const restrict Lab,
+                                     const size_t npixels)
+{
+#ifdef _OPENMP
+#pragma omp simd aligned(XYZ, Lab: 16)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float fx = lab_f(XYZ[k] / d50[0]);
+    const float fy = lab_f(XYZ[k + 1] / d50[1]);
+    const float fz = lab_f(XYZ[k + 2] / d50[2]);
+    Lab[k] = 116.0f * fy - 16.0f;
+    Lab[k + 1] = 500.0f * (fx - fy);
+    Lab[k + 2] = 200.0f * (fy - fz);
+    Lab[k + 3] = XYZ[k + 3];
+  }
+}
+
+static inline void dt_Lab_to_XYZ_row(const float *const restrict Lab, float *const restrict XYZ,
+                                     const size_t npixels)
+{
+#ifdef _OPENMP
+#pragma omp simd aligned(XYZ, Lab: 16)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float fy = (Lab[k] + 16.0f) / 116.0f;
+    const float fx = Lab[k + 1] / 500.0f + fy;
+    const float fz = fy - Lab[k + 2] / 200.0f;
+    XYZ[k] = d50[0] * lab_f_inv(fx);
+    XYZ[k + 1] = d50[1] * lab_f_inv(fy);
+    XYZ[k + 2] = d50[2] * lab_f_inv(fz);
+    XYZ[k + 3] = Lab[k + 3];
+  }
+}
+
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float _JzAzBz_PQ(const float x)
+{
+  const float c1 = 0.8359375f; // 3424 / 2^12
+  const float c2 = 18.8515625f; // 2413 / 2^7
+  const float c3 = 18.6875f; // 2392 / 2^7
+  const float n = 0.159301758f; // 2610 / 2^14
+  const float p = 134.034375f; // 1.7 x 2523 / 2^5
+  const float xn = dt_fast_powf(fmaxf(x / 10000.f, 0.0f), n);
+  return dt_fast_powf((c1 + c2 * xn) / (1.0f + c3 * xn), p);
+}
+
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float _JzAzBz_PQ_inv(const float x)
+{
+  const float c1 = 0.8359375f; // 3424 / 2^12
+  const float c2 = 18.8515625f; // 2413 / 2^7
+  const float c3 = 18.6875f; // 2392 / 2^7
+  const float n_inv = 1.0f / 0.159301758f; // 2610 / 2^14
+  const float p_inv = 1.0f / 134.034375f; // 1.7 x 2523 / 2^5
+  const float xp = dt_fast_powf(fmaxf(x, 0.0f), p_inv);
+  return 10000.f * dt_fast_powf(fmaxf((c1 - xp) / (c3 * xp - c2), 0.0f), n_inv);
+}
+
+static inline void dt_XYZ_2_JzAzBz_row(const float *const restrict XYZ_D65, float *const restrict JzAzBz,
+                                       const size_t npixels)
+{
+  const float b = 1.15f;
+  const float g = 0.66f;
+  const float d = -0.56f;
+  const float d0 = 1.6295499532821566e-11f;
+#ifdef _OPENMP
+#pragma omp simd aligned(XYZ_D65, JzAzBz: 16)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    // XYZ -> X'Y'Z
+    const float X = b * XYZ_D65[k] - (b - 1.0f) * XYZ_D65[k + 2];
+    const float Y = g * XYZ_D65[k + 1] - (g - 1.0f) * XYZ_D65[k];
+    const float Z = XYZ_D65[k + 2];
+    // X'Y'Z -> L'M'S'
+    const float L = _JzAzBz_PQ(0.41478972f * X + 0.579999f * Y + 0.0146480f * Z);
+    const float M = _JzAzBz_PQ(-0.2015100f * X + 1.120649f * Y + 0.0531008f * Z);
+    const float S = _JzAzBz_PQ(-0.0166008f * X + 0.264800f * Y + 0.6684799f * Z);
+    // L'M'S' -> Izazbz -> Jzazbz
+    const float Iz = 0.5f * L + 0.5f * M;
+    JzAzBz[k] = fmaxf(((1.0f + d) * Iz) / (1.0f + d * Iz) - d0, 0.f);
+    JzAzBz[k + 1] = 3.524000f * L - 4.066708f * M + 0.542708f * S;
+    JzAzBz[k + 2] = 0.199076f * L + 1.096799f * M - 1.295875f * S;
+    JzAzBz[k + 3] = XYZ_D65[k + 3];
+  }
+}
+
+static inline void dt_JzAzBz_2_XYZ_row(const float *const restrict JzAzBz, float *const restrict XYZ_D65,
+                                       const size_t npixels)
+{
+  const float b = 1.15f;
+  const float g = 0.66f;
+  const float d = -0.56f;
+  const float d0 = 1.6295499532821566e-11f;
+#ifdef _OPENMP
+#pragma omp simd aligned(XYZ_D65, JzAzBz: 16)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float Jz = JzAzBz[k] + d0;
+    const float Iz = fmaxf(Jz / (1.0f + d - d * Jz), 0.f);
+    const float az = JzAzBz[k + 1];
+    const float bz = JzAzBz[k + 2];
+    // IzAzBz -> LMS
+    const float L = _JzAzBz_PQ_inv(Iz + 0.1386050432715393f * az + 0.0580473161561189f * bz);
+    const float M = _JzAzBz_PQ_inv(Iz - 0.1386050432715393f * az - 0.0580473161561189f * bz);
+    const float S = _JzAzBz_PQ_inv(Iz - 0.0960192420263190f * az - 0.8118918960560390f * bz);
+    // LMS -> X'Y'Z
+    const float X = 1.9242264357876067f * L - 1.0047923125953657f * M + 0.0376514040306180f * S;
+    const float Y = 0.3503167620949991f * L + 0.7264811939316552f * M - 0.0653844229480850f * S;
+    const float Z = -0.0909828109828475f * L - 0.3127282905230739f * M + 1.5227665613052603f * S;
+    // X'Y'Z -> XYZ_D65
+    const float X_D65 = (X + (b - 1.0f) * Z) / b;
+    XYZ_D65[k] = X_D65;
+    XYZ_D65[k + 1] = (Y + (g - 1.0f) * X_D65) / g;
+    XYZ_D65[k + 2] = Z;
+    XYZ_D65[k + 3] = JzAzBz[k + 3];
+  }
+}
+
 // Convert CIE 1931 2° XYZ D65 to CIE 2006 LMS D65 (cone space)
 /*
 * The CIE 1931 XYZ 2° observer D65 is converted to CIE 2006 LMS D65 using the approximation by
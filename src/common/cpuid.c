@@ -58,6 +58,15 @@ dt_cpu_flags_t dt_detect_cpu_features()
       if(cx & 0x00080000) cpuflags |= CPU_FLAG_SSE4_2;
 
       if(cx & 0x08000000) cpuflags |= CPU_FLAG_AVX;
+      if(cx & 0x00001000) cpuflags |= CPU_FLAG_FMA;
+    }
+
+    /* Request for structured extended features */
+    if(__get_cpuid_max(0, NULL) >= 0x00000007)
+    {
+      __cpuid_count(0x00000007, 0, ax, bx, cx, dx);
+      if(bx & 0x00000020) cpuflags |= CPU_FLAG_AVX2;
+      if(bx & 0x00010000) cpuflags |= CPU_FLAG_AVX512F;
     }
 
     /* Are there extensions? */
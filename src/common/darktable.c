@@ -26,6 +26,7 @@
 #endif
 #ifdef __APPLE__
 #include <sys/malloc.h>
+#include <malloc/malloc.h>
 #endif
 
 #include "common/collection.h"
@@ -42,16 +43,22 @@
 #include "common/file_location.h"
 #include "common/film.h"
 #include "common/grealpath.h"
+#include "common/history_cache.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/image_index.h"
+#include "common/sidecar_writer.h"
 #include "common/imageio_module.h"
 #include "common/iop_order.h"
 #include "common/l10n.h"
+#include "common/memory_governor.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
 #include "common/resource_limits.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -61,6 +68,7 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "gui/guides.h"
@@ -82,6 +90,9 @@
 #include <unistd.h>
 #include <locale.h>
 #include <limits.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 
 #if defined(__SSE__)
 #include <xmmintrin.h>
@@ -124,7 +135,7 @@ static int usage(const char *argv0)
   printf("  --configdir <user config directory>\n");
   printf("  -d {all,act_on,cache,camctl,camsupport,control,demosaic,dev,history,imageio,\n");
   printf("      input,ioporder,lighttable,lua,masks,memory,nan,opencl,params,\n");
-  printf("      perf,pipe,print,pwstorage,signal,sql,tiling,undo,verbose}\n");
+  printf("      perf,pipe,print,pwstorage,signal,sql,tiling,trace,undo,verbose}\n");
   printf("  --d-signal <signal> \n");
   printf("  --d-signal-act <all,raise,connect,disconnect");
   // clang-format on
@@ -150,6 +161,7 @@ static int usage(const char *argv0)
   printf("  --noiseprofiles <noiseprofiles json file>\n");
   printf("  -t <num openmp threads>\n");
   printf("  --tmpdir <tmp directory>\n");
+  printf("  --trace <chrome trace json file>\n");
   printf("  --version\n");
 #ifdef _WIN32
   printf("\n");
@@ -313,6 +325,28 @@ static void dt_codepaths_init()
   }
 #endif
 
+  // the hot kernels flagged __DT_CLONE_TARGETS__ are resolved once by the loader to the widest
+  // instruction set the CPU supports. Report which one, since generic distro builds depend on it.
+#if !__has_attribute(target_clones) || defined(_WIN32) || defined(__APPLE__) || defined(NATIVE_ARCH)
+  const char *clone_target = "build target, no runtime dispatch";
+#elif defined(__x86_64__) && defined(HAVE_BUILTIN_CPU_SUPPORTS)
+  const char *clone_target = __builtin_cpu_supports("avx512f") ? "avx512f"
+                             : __builtin_cpu_supports("avx2") ? "avx2"
+                             : __builtin_cpu_supports("avx") ? "avx"
+                             : __builtin_cpu_supports("sse4.2") ? "sse4.2"
+                             : "sse2";
+#elif defined(__x86_64__)
+  const dt_cpu_flags_t clone_flags = dt_detect_cpu_features();
+  const char *clone_target = (clone_flags & CPU_FLAG_AVX512F) ? "avx512f"
+                             : (clone_flags & CPU_FLAG_AVX2) ? "avx2"
+                             : (clone_flags & CPU_FLAG_AVX) ? "avx"
+                             : (clone_flags & CPU_FLAG_SSE4_2) ? "sse4.2"
+                             : "sse2";
+#else
+  const char *clone_target = "build target, no runtime dispatch";
+#endif
+  dt_print(DT_DEBUG_PERF, "[dt_codepaths_init] vectorized kernels dispatched to %s\n", clone_target);
+
   // second, apply overrides from conf
   // NOTE: all intrinsics sets can only be overridden to OFF
   if(!dt_conf_get_bool("codepaths/sse2")) darktable.codepath.SSE2 = 0;
@@ -412,6 +446,24 @@ void check_resourcelevel(const char *key, int *fractions, const int level)
   }
 }
 
+static gboolean _init_shortcuts_idle(gpointer user_data)
+{
+  dt_shortcuts_init();
+  return G_SOURCE_REMOVE;
+}
+
+// end of the previous startup phase, see _startup_phase()
+static double _startup_phase_start = 0.0;
+
+// report the time spent since the previous phase with -d perf and in --trace timelines
+static void _startup_phase(const char *name)
+{
+  const double now = dt_get_wtime();
+  dt_trace_span("startup", name, _startup_phase_start, now);
+  dt_print(DT_DEBUG_PERF, "[init] %s took %.3f secs\n", name, now - _startup_phase_start);
+  _startup_phase_start = now;
+}
+
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
   double start_wtime = dt_get_wtime();
@@ -478,6 +530,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   char *tmpdir_from_command = NULL;
   char *configdir_from_command = NULL;
   char *cachedir_from_command = NULL;
+  char *trace_from_command = NULL;
 
 #ifdef HAVE_OPENCL
   gboolean exclude_opencl = FALSE;
@@ -620,6 +673,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k + 1)
+      {
+        trace_from_command = argv[++k];
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--localedir") && argc > k + 1)
       {
         localedir_from_command = argv[++k];
@@ -629,7 +688,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
       else if(argv[k][1] == 'd' && argc > k + 1)
       {
         if(!strcmp(argv[k + 1], "all"))
-          darktable.unmuted = 0xffffffff & ~DT_DEBUG_VERBOSE; // enable all debug information except verbose
+          darktable.unmuted = 0xffffffff & ~(DT_DEBUG_VERBOSE | DT_DEBUG_TRACE); // enable all debug information except verbose and trace
         else if(!strcmp(argv[k + 1], "cache"))
           darktable.unmuted |= DT_DEBUG_CACHE; // enable debugging for lib/film/cache module
         else if(!strcmp(argv[k + 1], "control"))
@@ -684,6 +743,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted |= DT_DEBUG_PIPE;
         else if(!strcmp(argv[k + 1], "history"))
           darktable.unmuted |= DT_DEBUG_HISTORY;
+        else if(!strcmp(argv[k + 1], "trace"))
+          darktable.unmuted |= DT_DEBUG_TRACE; // timeline of the whole application, see --trace
         else
           return usage(argv[0]);
         k++;
@@ -856,6 +917,19 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     }
   }
 
+  // before anything runs jobs or pipes
+  if(trace_from_command)
+    dt_trace_init(trace_from_command);
+  else if(darktable.unmuted & DT_DEBUG_TRACE)
+  {
+    gchar *name = g_strdup_printf("ansel-trace-%d.json", (int)getpid());
+    gchar *filename = g_build_filename(g_get_tmp_dir(), name, NULL);
+    if(dt_trace_init(filename)) fprintf(stderr, "[trace] writing the timeline to %s\n", filename);
+    g_free(filename);
+    g_free(name);
+  }
+  _startup_phase_start = dt_get_wtime();
+
   // get valid directories
   dt_loc_init(datadir_from_command, moduledir_from_command, localedir_from_command, configdir_from_command, cachedir_from_command, tmpdir_from_command);
 
@@ -979,6 +1053,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // initialize datetime data
   dt_datetime_init();
 
+  _startup_phase("configuration");
+
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command, load_data, init_gui);
   if(darktable.db == NULL)
@@ -1022,8 +1098,10 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     return 1;
   }
 
-  //db maintenance on startup (if configured to do so)
-  if(dt_database_maybe_maintenance(darktable.db, init_gui, FALSE))
+  //db maintenance on startup (if configured to do so). once incremental, it runs in the background
+  //when the jobs are available.
+  const gboolean startup_maintenance = dt_database_maybe_maintenance(darktable.db, init_gui, FALSE);
+  if(startup_maintenance && !init_gui)
   {
     dt_database_perform_maintenance(darktable.db);
   }
@@ -1034,15 +1112,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
-  // Make sure that the database and xmp files are in sync
-  // We need conf and db to be up and running for that which is the case here.
-  // FIXME: is this also useful in non-gui mode?
-  GList *changed_xmp_files = NULL;
-  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
-  {
-    changed_xmp_files = dt_control_crawler_run();
-  }
-
   if(init_gui)
   {
     dt_control_init(darktable.control);
@@ -1134,23 +1203,34 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   MagickWandGenesis();
 #endif
 
+  _startup_phase("library and control");
+
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
 #ifdef HAVE_OPENCL
   dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
 #endif
+  dt_tiling_calibration_init();
+  _startup_phase("opencl");
 
   darktable.points = (dt_points_t *)calloc(1, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
+  dt_noiseprofile_init(noiseprofiles_from_command);
 
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
+  darktable.image_index = (dt_image_index_t *)calloc(1, sizeof(dt_image_index_t));
+  dt_image_index_init(darktable.image_index);
+  dt_sidecar_writer_init();
+  dt_history_cache_init();
 
+  // before the caches registering with it
+  dt_memory_governor_init();
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
+  _startup_phase("caches");
 
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
@@ -1170,9 +1250,11 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   }
   else
     darktable.gui = NULL;
+  _startup_phase("gui");
 
   darktable.view_manager = (dt_view_manager_t *)calloc(1, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
+  _startup_phase("views");
 
   // check whether we were able to load darkroom view. if we failed, we'll crash everywhere later on.
   if(!darktable.develop)
@@ -1190,6 +1272,9 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.iop_order_rules = dt_ioppr_get_iop_order_rules();
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
+  // the next instance without data.db starts with the presets made above
+  dt_database_save_startup_snapshot(darktable.db);
+  _startup_phase("processing modules");
   // check if all modules have a iop order assigned
   if(dt_ioppr_check_so_iop_order(darktable.iop, darktable.iop_order_list))
   {
@@ -1210,6 +1295,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   {
     darktable.lib = (dt_lib_t *)calloc(1, sizeof(dt_lib_t));
     dt_lib_init(darktable.lib);
+    _startup_phase("utility modules");
 
     // prevent bauhaus widgets from sending value-changed signals
     // because some of them expect user interactions.
@@ -1219,15 +1305,15 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     dt_view_manager_gui_init(darktable.view_manager);
 
     --darktable.gui->reset;
+    _startup_phase("view guis");
 
-    // Save the default shortcuts
-    dt_shortcuts_save(".defaults", FALSE);
-
-    // Then load any shortcuts if available (wipe defaults first if requested)
-    dt_shortcuts_load(NULL, !dt_conf_get_bool("accel/load_defaults"));
+    // report the GUI stalls in --trace timelines
+    dt_trace_watch_main_loop();
 
-    // Save the shortcuts including defaults
-    dt_shortcuts_save(NULL, TRUE);
+    // the shortcuts need the widgets of all the processing modules, which are built
+    // for nothing on most sessions: defer them until the main loop is idle, or until
+    // the darkroom or the shortcuts preferences need them earlier.
+    g_idle_add(_init_shortcuts_idle, NULL);
 
     // initialize undo struct
     darktable.undo = dt_undo_init();
@@ -1245,6 +1331,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state.state, lua_command);
 #endif
+  _startup_phase("lua");
 
   if(init_gui)
   {
@@ -1270,6 +1357,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     // we have to call dt_ctl_switch_mode_to() here already to not run into a lua deadlock.
     // having another call later is ok
     dt_ctl_switch_mode_to(mode);
+    _startup_phase("first view");
 
 #ifndef MAC_INTEGRATION
     // load image(s) specified on cmdline.
@@ -1286,6 +1374,14 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     }
 #endif
 
+    // the first maintenance turns incremental vacuum on, the next ones don't block
+    if(startup_maintenance && !dt_database_maintenance_in_background(darktable.db))
+      dt_database_perform_maintenance(darktable.db);
+    dt_database_snapshot_in_background(darktable.db);
+
+    // pick up the exports the last session could not finish
+    dt_control_export_resume();
+
     // there might be some info created in dt_configure_runtime_performance() for feedback
     gboolean not_again = TRUE;
     if(last_configure_version && config_info[0])
@@ -1299,11 +1395,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   }
   free(config_info);
 
-  // last but not least construct the popup that asks the user about images whose xmp files are newer than the
-  // db entry
-  if(init_gui && changed_xmp_files)
+  // last but not least make sure that the database and xmp files are in sync. this runs in the background,
+  // the popup that asks the user about images whose xmp files are newer than the db entry comes when done.
+  // FIXME: is this also useful in non-gui mode?
+  if(init_gui && dt_conf_get_bool("run_crawler_on_start"))
   {
-    dt_control_crawler_show_image_list(changed_xmp_files);
+    dt_control_crawler_run_background();
   }
 
   dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
@@ -1408,10 +1505,16 @@ void dt_cleanup()
     free(darktable.gui);
   }
 
+  // pending sidecars need the image cache and the database
+  dt_sidecar_writer_cleanup();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
+  dt_image_index_cleanup(darktable.image_index);
+  free(darktable.image_index);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
+  dt_memory_governor_cleanup();
+  dt_history_cache_cleanup();
   if(init_gui)
   {
     dt_control_cleanup(darktable.control);
@@ -1419,6 +1522,7 @@ void dt_cleanup()
     dt_undo_cleanup(darktable.undo);
   }
   dt_colorspaces_cleanup(darktable.color_profiles);
+  dt_tiling_calibration_cleanup();
   dt_conf_cleanup(darktable.conf);
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
@@ -1430,6 +1534,8 @@ void dt_cleanup()
   darktable.iop_order_rules = NULL;
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
+  if(darktable.unmuted & DT_DEBUG_PERF) dt_metrics_print();
+  dt_trace_cleanup();
   dt_pwstorage_destroy(darktable.pwstorage);
 
 #ifdef HAVE_GRAPHICSMAGICK
@@ -1449,19 +1555,7 @@ void dt_cleanup()
   dt_database_optimize(darktable.db);
   if(perform_snapshot)
   {
-    if(dt_database_snapshot(darktable.db) && snaps_to_remove)
-    {
-      int i = 0;
-      while(snaps_to_remove[i])
-      {
-        // make file to remove writable, mostly problem on windows.
-        g_chmod(snaps_to_remove[i], S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-
-        dt_print(DT_DEBUG_SQL, "[db backup] removing old snap: %s... ", snaps_to_remove[i]);
-        const int retunlink = g_remove(snaps_to_remove[i++]);
-        dt_print(DT_DEBUG_SQL, "%s\n", retunlink == 0 ? "success" : "failed!");
-      }
-    }
+    if(dt_database_snapshot(darktable.db)) dt_database_remove_snaps(snaps_to_remove);
   }
   if(snaps_to_remove)
   {
@@ -1474,11 +1568,7 @@ void dt_cleanup()
     dt_bauhaus_cleanup();
   }
 
-  if (darktable.noiseprofile_parser)
-  {
-    g_object_unref(darktable.noiseprofile_parser);
-    darktable.noiseprofile_parser = NULL;
-  }
+  dt_noiseprofile_cleanup();
 
   dt_capabilities_cleanup();
 
@@ -1528,29 +1618,82 @@ void dt_vprint(dt_debug_thread_t thread, const char *msg, ...)
   }
 }
 
+// size of the block behind an allocation, as the allocator sees it, for dt_metrics_mem_alloc().
+// 0 where the allocator can't tell, the memory of the modules is then not accounted.
+static inline size_t _alloc_block_size(void *block)
+{
+#if defined(_WIN32)
+  return _aligned_msize(block, DT_CACHELINE_BYTES, 0);
+#elif defined(__APPLE__)
+  return malloc_size(block);
+#elif defined(__linux__)
+  return malloc_usable_size(block);
+#else
+  return 0;
+#endif
+}
+
 void *dt_alloc_align(size_t size)
 {
   const size_t alignment = DT_CACHELINE_BYTES;
   const size_t aligned_size = dt_round_size(size, alignment);
 #if defined(__FreeBSD_version) && __FreeBSD_version < 700013
-  return malloc(aligned_size);
+  void *ptr = malloc(aligned_size);
+  if(!ptr) return NULL;
+  dt_metrics_mem_alloc(_alloc_block_size(ptr));
+  return ptr;
 #elif defined(_WIN32)
-  return _aligned_malloc(aligned_size, alignment);
+  void *ptr = _aligned_malloc(aligned_size, alignment);
+  if(!ptr) return NULL;
+  dt_metrics_mem_alloc(_alloc_block_size(ptr));
+  return ptr;
 #elif defined(_DEBUG)
   // for a debug build, ensure that we get a crash if we use plain free() to release the allocated memory, by
   // returning a pointer which isn't a valid memory block address
   void *ptr = NULL;
   if(posix_memalign(&ptr, alignment, aligned_size + alignment)) return NULL;
+  dt_metrics_mem_alloc(_alloc_block_size(ptr));
   short *offset = (short*)(((char*)ptr) + alignment - sizeof(short));
   *offset = alignment;
   return ((char*)ptr) + alignment ;
 #else
+  // pixel buffers are aligned on huge pages, so that transparent huge pages can back them entirely and
+  // save the TLB misses of the 4 KiB pages on full-resolution images
+  const gboolean huge = aligned_size >= DT_HUGE_PAGE_BYTES;
   void *ptr = NULL;
-  if(posix_memalign(&ptr, alignment, aligned_size)) return NULL;
+  if(posix_memalign(&ptr, huge ? DT_HUGE_PAGE_BYTES : alignment, aligned_size)) return NULL;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if(huge) madvise(ptr, aligned_size, MADV_HUGEPAGE);
+#endif
+  dt_metrics_mem_alloc(_alloc_block_size(ptr));
   return ptr;
 #endif
 }
 
+void dt_memzero_parallel(void *const buf, const size_t size)
+{
+  // not worth waking up the threads for less
+  if(size < DT_HUGE_PAGE_BYTES)
+  {
+    memset(buf, 0, size);
+    return;
+  }
+
+  // split in equal contiguous chunks like the schedule(static) loops over the pixels of the modules
+  const size_t page = 4096;
+  const size_t pages = (size + page - 1) / page;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(buf, size, page, pages) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < pages; k++)
+  {
+    const size_t start = k * page;
+    memset((char *)buf + start, 0, MIN(page, size - start));
+  }
+}
+
 size_t dt_round_size(const size_t size, const size_t alignment)
 {
   // Round the size of a buffer to the closest higher multiple
@@ -1564,22 +1707,23 @@ size_t dt_round_size_sse(const size_t size)
 }
 
 
-#ifdef _WIN32
 void dt_free_align(void *mem)
 {
+  if(!mem) return;
+#ifdef _WIN32
+  dt_metrics_mem_free(_alloc_block_size(mem));
   _aligned_free(mem);
-}
 #elif defined(_DEBUG)
-void dt_free_align(void *mem)
-{
   // on a debug build, we deliberately offset the returned pointer from dt_alloc_align, so eliminate the offset
-  if (mem)
-  {
-    short offset = ((short*)mem)[-1];
-    free(((char*)mem)-offset);
-  }
-}
+  short offset = ((short*)mem)[-1];
+  void *block = ((char*)mem) - offset;
+  dt_metrics_mem_free(_alloc_block_size(block));
+  free(block);
+#else
+  dt_metrics_mem_free(_alloc_block_size(mem));
+  free(mem);
 #endif
+}
 
 void dt_show_times(const dt_times_t *start, const char *prefix)
 {
@@ -1634,7 +1778,9 @@ size_t dt_get_available_mem()
     return res->refresource[4*(-level-1)] * 1024lu * 1024lu;
 
   const int fraction = res->fractions[darktable.dtresources.group];
-  return MAX(512lu * 1024lu * 1024lu, total_mem / 1024lu * fraction);
+  // scaled with the memory left by the other processes
+  const size_t budget = (size_t)(total_mem / 1024lu * fraction * dt_memory_governor_factor());
+  return MAX(512lu * 1024lu * 1024lu, budget);
 }
 
 size_t dt_get_singlebuffer_mem()
@@ -1649,6 +1795,26 @@ size_t dt_get_singlebuffer_mem()
   return MAX(2lu * 1024lu * 1024lu, total_mem / 1024lu * fraction);
 }
 
+size_t dt_get_l2_cache_size()
+{
+  // the CPU doesn't change while we run, query it once
+  static size_t l2_size = 0;
+  if(l2_size) return l2_size;
+
+  size_t size = 0;
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+  const long value = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if(value > 0) size = value;
+#elif defined(__APPLE__)
+  uint64_t value = 0;
+  size_t length = sizeof(value);
+  if(!sysctlbyname("hw.l2cachesize", &value, &length, NULL, 0)) size = value;
+#endif
+  l2_size = (size > 0) ? size : 512lu * 1024lu;
+  dt_print(DT_DEBUG_DEV, "[dt_get_l2_cache_size] %zu kiB of L2 cache per core\n", l2_size / 1024);
+  return l2_size;
+}
+
 void dt_configure_runtime_performance(const int old, char *info)
 {
   const size_t threads = dt_get_num_threads();
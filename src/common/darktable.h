@@ -61,6 +61,7 @@
 #include <math.h>
 #include <sqlite3.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -241,6 +242,7 @@ struct dt_control_t;
 struct dt_develop_t;
 struct dt_mipmap_cache_t;
 struct dt_image_cache_t;
+struct dt_image_index_t;
 struct dt_lib_t;
 struct dt_conf_t;
 struct dt_points_t;
@@ -258,6 +260,7 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_CACHE          = 1 <<  0,
   DT_DEBUG_CONTROL        = 1 <<  1,
   DT_DEBUG_DEV            = 1 <<  2,
+  DT_DEBUG_TRACE          = 1 <<  3,
   DT_DEBUG_PERF           = 1 <<  4,
   DT_DEBUG_CAMCTL         = 1 <<  5,
   DT_DEBUG_PWSTORAGE      = 1 <<  6,
@@ -312,7 +315,6 @@ typedef struct darktable_t
   GList *iop_order_list;
   GList *iop_order_rules;
   GList *capabilities;
-  JsonParser *noiseprofile_parser;
   struct dt_conf_t *conf;
   struct dt_develop_t *develop;
   struct dt_lib_t *lib;
@@ -322,6 +324,7 @@ typedef struct darktable_t
   struct dt_gui_gtk_t *gui;
   struct dt_mipmap_cache_t *mipmap_cache;
   struct dt_image_cache_t *image_cache;
+  struct dt_image_index_t *image_index;
   struct dt_bauhaus_t *bauhaus;
   const struct dt_database_t *db;
   const struct dt_pwstorage_t *pwstorage;
@@ -377,6 +380,8 @@ void dt_vprint(dt_debug_thread_t thread, const char *msg, ...) __attribute__((fo
 int dt_worker_threads();
 size_t dt_get_available_mem();
 size_t dt_get_singlebuffer_mem();
+// size of the L2 cache of one core in bytes, 512 kiB when it can't be queried
+size_t dt_get_l2_cache_size();
 
 /**
  * @brief Set the memory buffer to zero as a pack of unsigned char
@@ -395,10 +400,14 @@ static inline void memset_zero(void *const buffer, size_t size)
 }
 
 void *dt_alloc_align(size_t size);
+// zero size bytes of buf. Large buffers are zeroed by the OpenMP threads with the static schedule of the
+// pixel loops, so that each page is first touched, and placed on the NUMA node of, the thread that will
+// process it.
+void dt_memzero_parallel(void *const buf, const size_t size);
 static inline void* dt_calloc_align(size_t size)
 {
   void *buf = dt_alloc_align(size);
-  if(buf) memset(buf, 0, size);
+  if(buf) dt_memzero_parallel(buf, size);
   return buf;
 }
 static inline float *dt_alloc_align_float(size_t pixels)
@@ -408,22 +417,16 @@ static inline float *dt_alloc_align_float(size_t pixels)
 static inline float *dt_calloc_align_float(size_t pixels)
 {
   float *const buf = (float*)dt_alloc_align(pixels * sizeof(float));
-  if(buf) memset(buf, 0, pixels * sizeof(float));
+  if(buf) dt_memzero_parallel(buf, pixels * sizeof(float));
   return (float*)__builtin_assume_aligned(buf, DT_CACHELINE_BYTES);
 }
 size_t dt_round_size(const size_t size, const size_t alignment);
 size_t dt_round_size_sse(const size_t size);
 
-#ifdef _WIN32
-void dt_free_align(void *mem);
-#define dt_free_align_ptr dt_free_align
-#elif _DEBUG // debug build makes sure that we get a crash on using plain free() on an aligned allocation
+// a function on all builds, so the memory held by the pixelpipe modules can be accounted.
+// The debug build makes sure that we get a crash on using plain free() on an aligned allocation.
 void dt_free_align(void *mem);
 #define dt_free_align_ptr dt_free_align
-#else
-#define dt_free_align(A) if(A) free(A)
-#define dt_free_align_ptr free
-#endif
 
 // check whether the specified mask of modifier keys exactly matches, among the set Shift+Control+(Alt/Meta).
 // ignores the state of any other shifting keys
@@ -643,12 +646,48 @@ static inline void dt_unreachable_codepath_with_caller(const char *description,
   __builtin_unreachable();
 }
 
+#define DT_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define DT_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static inline uint64_t dt_hash_rotl(const uint64_t x, const int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t dt_hash_round(const uint64_t acc, const uint64_t input)
+{
+  return dt_hash_rotl(acc + input * DT_HASH_PRIME2, 31) * DT_HASH_PRIME1;
+}
+
 // Scramble bits in str to create an (hopefully) unique hash representing the state of str
-// Dan Bernstein algo v2 http://www.cse.yorku.ca/~oz/hash.html
 // hash should be inited to 5381 if first run, or from a previous hash computed with this function.
+// Blobs are read 8 bytes at a time with the rounds of xxHash64, in 4 independent lanes when they are long,
+// so large params, mask points or buffers don't cost a dependent step per byte.
+// The tail is mixed byte by byte with Dan Bernstein algo v2 http://www.cse.yorku.ca/~oz/hash.html
 static inline uint64_t dt_hash(uint64_t hash, const char *str, size_t size)
 {
-  for(size_t i = 0; i < size; i++)
+  size_t i = 0;
+  if(size >= 32)
+  {
+    uint64_t lanes[4] = { hash + DT_HASH_PRIME1 + DT_HASH_PRIME2, hash + DT_HASH_PRIME2, hash,
+                          hash - DT_HASH_PRIME1 };
+    for(; i + 32 <= size; i += 32)
+      for(int l = 0; l < 4; l++)
+      {
+        uint64_t v;
+        memcpy(&v, str + i + 8 * l, sizeof(v));
+        lanes[l] = dt_hash_round(lanes[l], v);
+      }
+    hash = dt_hash_rotl(lanes[0], 1) + dt_hash_rotl(lanes[1], 7) + dt_hash_rotl(lanes[2], 12)
+           + dt_hash_rotl(lanes[3], 18);
+  }
+  for(; i + 8 <= size; i += 8)
+  {
+    uint64_t v;
+    memcpy(&v, str + i, sizeof(v));
+    hash = dt_hash_rotl(hash ^ dt_hash_round(0, v), 27) * DT_HASH_PRIME1 + DT_HASH_PRIME2;
+  }
+  for(; i < size; i++)
     hash = ((hash << 5) + hash) ^ str[i];
 
   return hash;
@@ -29,6 +29,8 @@
 #include "common/iop_order.h"
 #include "common/styles.h"
 #include "common/history.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #ifdef HAVE_ICU
 #include "common/sqliteicu.h"
 #endif
@@ -49,11 +51,15 @@
 
 // whenever _create_*_schema() gets changed you HAVE to bump this version and add an update path to
 // _upgrade_*_schema_step()!
-#define CURRENT_DATABASE_VERSION_LIBRARY 36
+#define CURRENT_DATABASE_VERSION_LIBRARY 41
 #define CURRENT_DATABASE_VERSION_DATA     9
 
 // #define USE_NESTED_TRANSACTIONS
 #define MAX_NESTED_TRANSACTIONS 0
+// read-only connections handed out by dt_database_get_reader()
+#define DT_DATABASE_READERS 4
+// the memory database is shared with the readers, so they see memory.collected_images & co
+#define DT_DATABASE_MEMORY_URI "file:ansel_memory?mode=memory&cache=shared"
 /* transaction id */
 static dt_atomic_int _trxid;
 
@@ -70,8 +76,19 @@ typedef struct dt_database_t
   /* ondisk DB */
   sqlite3 *handle;
 
+  /* read-only connections for queries which must not wait on writers, opened on first use.
+     only available if the library is in WAL mode. */
+  gboolean use_readers;
+  sqlite3 *readers[DT_DATABASE_READERS];
+  gboolean reader_busy[DT_DATABASE_READERS];
+  dt_pthread_mutex_t readers_mutex;
+
   gchar *error_message, *error_dbfilename;
   int error_other_pid;
+
+  /* state of the built-in presets of an in-memory data database when it was restored from the startup
+     snapshot, see dt_database_save_startup_snapshot() */
+  gchar *data_snapshot_digest;
 } dt_database_t;
 
 
@@ -2150,6 +2167,82 @@ static int _upgrade_library_schema_step(dt_database_t *db, int version)
     TRY_EXEC("DROP TABLE `images_new`", "[init] can't drop temp images table\n");
     new_version = 36;
   }
+  else if(version == 36)
+  {
+    // indexes matching the filters of the collection queries
+    sqlite3_exec(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_maker_model_index ON images (maker, model)",
+             "[init] can't create images_maker_model_index\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_import_timestamp_index ON images (import_timestamp)",
+             "[init] can't create images_import_timestamp_index\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_change_timestamp_index ON images (change_timestamp)",
+             "[init] can't create images_change_timestamp_index\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_export_timestamp_index ON images (export_timestamp)",
+             "[init] can't create images_export_timestamp_index\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.images_print_timestamp_index ON images (print_timestamp)",
+             "[init] can't create images_print_timestamp_index\n");
+    gchar *query = g_strdup_printf("CREATE INDEX IF NOT EXISTS main.images_local_copy_index"
+                                   " ON images (id) WHERE (flags & %d)",
+                                   DT_IMAGE_LOCAL_COPY);
+    TRY_EXEC(query, "[init] can't create images_local_copy_index\n");
+    g_free(query);
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.color_labels_color_index ON color_labels (color, imgid)",
+             "[init] can't create color_labels_color_index\n");
+    // covering versions of the tagid and key indexes, which become redundant
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.tagged_images_tagid_imgid_index ON tagged_images (tagid, imgid)",
+             "[init] can't create tagged_images_tagid_imgid_index\n");
+    TRY_EXEC("DROP INDEX IF EXISTS main.tagged_images_tagid_index",
+             "[init] can't drop tagged_images_tagid_index\n");
+    TRY_EXEC("CREATE INDEX IF NOT EXISTS main.metadata_key_value_index ON meta_data (key, value, id)",
+             "[init] can't create metadata_key_value_index\n");
+    TRY_EXEC("DROP INDEX IF EXISTS main.metadata_index_key",
+             "[init] can't drop metadata_index_key\n");
+
+    sqlite3_exec(db->handle, "COMMIT", NULL, NULL, NULL);
+    new_version = 37;
+  }
+  else if(version == 37)
+  {
+    // images whose sidecar file is still to be written by the sidecar writer
+    TRY_EXEC("CREATE TABLE main.sidecar_pending (imgid INTEGER PRIMARY KEY,"
+             " FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+             "[init] can't create table sidecar_pending\n");
+    new_version = 38;
+  }
+  else if(version == 38)
+  {
+    // directory mtime of the film rolls at the last crawl which found nothing to report
+    TRY_EXEC("CREATE TABLE main.crawler_folders (film_id INTEGER PRIMARY KEY, mtime INTEGER,"
+             " FOREIGN KEY(film_id) REFERENCES film_rolls(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+             "[init] can't create table crawler_folders\n");
+    new_version = 39;
+  }
+  else if(version == 39)
+  {
+    // exported files by the key of their content, see common/export_cache.h
+    TRY_EXEC("CREATE TABLE main.export_cache (hash VARCHAR PRIMARY KEY, imgid INTEGER, filename VARCHAR,"
+             " size INTEGER, mtime INTEGER, width INTEGER, height INTEGER,"
+             " FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+             "[init] can't create table export_cache\n");
+    new_version = 40;
+  }
+  else if(version == 40)
+  {
+    // exports to resume after a restart, see common/export_queue.h
+    TRY_EXEC("CREATE TABLE main.export_queue (id INTEGER PRIMARY KEY AUTOINCREMENT, format VARCHAR,"
+             " format_version INTEGER, format_params BLOB, storage VARCHAR, storage_version INTEGER,"
+             " storage_params BLOB, max_width INTEGER, max_height INTEGER, high_quality INTEGER,"
+             " export_masks INTEGER, style VARCHAR, style_append INTEGER, icc_type INTEGER,"
+             " icc_filename VARCHAR, icc_intent INTEGER, metadata VARCHAR)",
+             "[init] can't create table export_queue\n");
+    TRY_EXEC("CREATE TABLE main.export_queue_images (queue_id INTEGER, imgid INTEGER, position INTEGER,"
+             " done INTEGER, hash BLOB, PRIMARY KEY (queue_id, imgid),"
+             " FOREIGN KEY(queue_id) REFERENCES export_queue(id) ON UPDATE CASCADE ON DELETE CASCADE,"
+             " FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+             "[init] can't create table export_queue_images\n");
+    new_version = 41;
+  }
   else
     new_version = version; // should be the fallback so that calling code sees that we are in an infinite loop
 
@@ -2491,7 +2584,8 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.tagged_images (imgid INTEGER, tagid INTEGER, position INTEGER, "
                            "PRIMARY KEY (imgid, tagid),"
                            "FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_index ON tagged_images (tagid)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_tagid_imgid_index ON tagged_images (tagid, imgid)",
+               NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE INDEX main.tagged_images_position_index ON tagged_images (position)", NULL, NULL, NULL);
   ////////////////////////////// color_labels
   sqlite3_exec(db->handle, "CREATE TABLE main.color_labels (imgid INTEGER, color INTEGER)", NULL, NULL, NULL);
@@ -2501,7 +2595,8 @@ static void _create_library_schema(dt_database_t *db)
   sqlite3_exec(db->handle, "CREATE TABLE main.meta_data (id INTEGER, key INTEGER, value VARCHAR)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE UNIQUE INDEX main.metadata_index ON meta_data (id, key, value)", NULL, NULL, NULL);
 
-  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index_key ON meta_data (key)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_key_value_index ON meta_data (key, value, id)",
+               NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE main.module_order (imgid INTEGER PRIMARY KEY, version INTEGER, iop_list VARCHAR)",
                NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE main.history_hash (imgid INTEGER PRIMARY KEY, "
@@ -2512,7 +2607,52 @@ static void _create_library_schema(dt_database_t *db)
   // v34
   sqlite3_exec(db->handle, "CREATE INDEX main.images_datetime_taken_nc ON images (datetime_taken COLLATE NOCASE)",
                NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "CREATE INDEX main.metadata_index_key ON meta_data (key)", NULL, NULL, NULL);
+
+  // v37
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_maker_model_index ON images (maker, model)", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_import_timestamp_index ON images (import_timestamp)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_change_timestamp_index ON images (change_timestamp)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_export_timestamp_index ON images (export_timestamp)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE INDEX main.images_print_timestamp_index ON images (print_timestamp)",
+               NULL, NULL, NULL);
+  gchar *query = g_strdup_printf("CREATE INDEX main.images_local_copy_index ON images (id) WHERE (flags & %d)",
+                                 DT_IMAGE_LOCAL_COPY);
+  sqlite3_exec(db->handle, query, NULL, NULL, NULL);
+  g_free(query);
+  sqlite3_exec(db->handle, "CREATE INDEX main.color_labels_color_index ON color_labels (color, imgid)",
+               NULL, NULL, NULL);
+
+  // v38
+  sqlite3_exec(db->handle, "CREATE TABLE main.sidecar_pending (imgid INTEGER PRIMARY KEY, "
+               "FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+               NULL, NULL, NULL);
+
+  // v39
+  sqlite3_exec(db->handle, "CREATE TABLE main.crawler_folders (film_id INTEGER PRIMARY KEY, mtime INTEGER, "
+               "FOREIGN KEY(film_id) REFERENCES film_rolls(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+               NULL, NULL, NULL);
+
+  // v40
+  sqlite3_exec(db->handle, "CREATE TABLE main.export_cache (hash VARCHAR PRIMARY KEY, imgid INTEGER, "
+               "filename VARCHAR, size INTEGER, mtime INTEGER, width INTEGER, height INTEGER, "
+               "FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+               NULL, NULL, NULL);
+
+  // v41
+  sqlite3_exec(db->handle, "CREATE TABLE main.export_queue (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+               "format VARCHAR, format_version INTEGER, format_params BLOB, storage VARCHAR, "
+               "storage_version INTEGER, storage_params BLOB, max_width INTEGER, max_height INTEGER, "
+               "high_quality INTEGER, export_masks INTEGER, style VARCHAR, style_append INTEGER, "
+               "icc_type INTEGER, icc_filename VARCHAR, icc_intent INTEGER, metadata VARCHAR)",
+               NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE main.export_queue_images (queue_id INTEGER, imgid INTEGER, "
+               "position INTEGER, done INTEGER, hash BLOB, PRIMARY KEY (queue_id, imgid), "
+               "FOREIGN KEY(queue_id) REFERENCES export_queue(id) ON UPDATE CASCADE ON DELETE CASCADE, "
+               "FOREIGN KEY(imgid) REFERENCES images(id) ON UPDATE CASCADE ON DELETE CASCADE)",
+               NULL, NULL, NULL);
   // clang-format on
 }
 
@@ -2617,6 +2757,10 @@ static void _create_memory_schema(dt_database_t *db)
   sqlite3_exec(db->handle,
       "CREATE TABLE memory.film_folder (id INTEGER PRIMARY KEY, status INTEGER)",
       NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.bulk_images (num INTEGER PRIMARY KEY, imgid INTEGER)", NULL, NULL,
+               NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.history_compress (imgid INTEGER, num INTEGER, new_num INTEGER, "
+                           "PRIMARY KEY (imgid, num))", NULL, NULL, NULL);
   // clang-format on
 }
 
@@ -3019,6 +3163,16 @@ int _get_pragma_int_val(sqlite3 *db, const char* pragma)
   return val;
 }
 
+static void _unlink_wal(const char *filename)
+{
+  gchar *wal = g_strconcat(filename, "-wal", NULL);
+  gchar *shm = g_strconcat(filename, "-shm", NULL);
+  g_unlink(wal);
+  g_unlink(shm);
+  g_free(wal);
+  g_free(shm);
+}
+
 gchar* _get_pragma_string_val(sqlite3 *db, const char* pragma)
 {
   gchar* query= g_strdup_printf("PRAGMA %s", pragma);
@@ -3043,6 +3197,103 @@ gchar* _get_pragma_string_val(sqlite3 *db, const char* pragma)
   return val;
 }
 
+static int _trace_profile(unsigned int type, void *data, void *statement, void *elapsed)
+{
+  if(type != SQLITE_TRACE_PROFILE) return 0;
+
+  // elapsed is in nanoseconds
+  const double seconds = *(sqlite3_int64 *)elapsed * 1e-9;
+  dt_metrics_time(DT_METRICS_SQL, seconds);
+  if(dt_trace_enabled())
+  {
+    const double now = dt_get_wtime();
+    dt_trace_span("sql", sqlite3_sql((sqlite3_stmt *)statement), now - seconds, now);
+  }
+  return 0;
+}
+
+// an in-memory data database is rebuilt on every start, with the built-in presets of all the modules.
+// a copy of it is kept in the cache directory once those are made, to start from next time.
+static gchar *_data_snapshot_filename(void)
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  return g_strdup_printf("%s" G_DIR_SEPARATOR_S "data-%d.db", cachedir, CURRENT_DATABASE_VERSION_DATA);
+}
+
+// the built-in presets keys and stamp of data.db_info, which tell which modules had to rebuild theirs
+static gchar *_data_info_digest(const dt_database_t *db)
+{
+  sqlite3_stmt *stmt;
+  gchar *digest = NULL;
+  sqlite3_prepare_v2(db->handle,
+                     "SELECT GROUP_CONCAT(key || '=' || value, ';')"
+                     " FROM (SELECT key, value FROM data.db_info ORDER BY key)",
+                     -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) digest = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+  return digest;
+}
+
+// copy a whole database in one step, contrary to _backup_db() which lets other connections work meanwhile
+static int _copy_db(sqlite3 *dest, const char *dest_name, sqlite3 *src, const char *src_name)
+{
+  sqlite3_backup *backup = sqlite3_backup_init(dest, dest_name, src, src_name);
+  if(!backup) return sqlite3_errcode(dest);
+  sqlite3_backup_step(backup, -1);
+  return sqlite3_backup_finish(backup);
+}
+
+static gboolean _data_snapshot_restore(dt_database_t *db)
+{
+  gchar *filename = _data_snapshot_filename();
+  sqlite3 *src = NULL;
+  int rc = SQLITE_CANTOPEN;
+  if(g_file_test(filename, G_FILE_TEST_IS_REGULAR)
+     && sqlite3_open_v2(filename, &src, SQLITE_OPEN_READONLY, NULL) == SQLITE_OK)
+    rc = _copy_db(db->handle, "data", src, "main");
+  sqlite3_close(src);
+
+  if(rc == SQLITE_OK)
+  {
+    db->data_snapshot_digest = _data_info_digest(db);
+    dt_print(DT_DEBUG_SQL, "[init sql] data restored from %s\n", filename);
+  }
+  g_free(filename);
+  return rc == SQLITE_OK;
+}
+
+void dt_database_save_startup_snapshot(const dt_database_t *db)
+{
+  if(g_strcmp0(db->dbfilename_data, ":memory:")) return;
+
+  // nothing to do if no module had to make its presets since the snapshot was restored
+  gchar *digest = _data_info_digest(db);
+  const gboolean unchanged = db->data_snapshot_digest && !g_strcmp0(digest, db->data_snapshot_digest);
+  g_free(digest);
+  if(unchanged) return;
+
+  // written aside and renamed, concurrent instances may read or write it
+  gchar *filename = _data_snapshot_filename();
+  gchar *tmp_filename = g_strdup_printf("%s-tmp-XXXXXX", filename);
+  const int fd = g_mkstemp(tmp_filename);
+  if(fd >= 0)
+  {
+    close(fd);
+    sqlite3 *dest = NULL;
+    int rc = sqlite3_open(tmp_filename, &dest);
+    if(rc == SQLITE_OK) rc = _copy_db(dest, "main", db->handle, "data");
+    sqlite3_close(dest);
+
+    if(rc == SQLITE_OK && !g_rename(tmp_filename, filename))
+      dt_print(DT_DEBUG_SQL, "[init sql] data saved to %s\n", filename);
+    else
+      g_unlink(tmp_filename);
+  }
+  g_free(tmp_filename);
+  g_free(filename);
+}
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data, const gboolean has_gui)
 {
   /*  set the threading mode to Serialized */
@@ -3097,6 +3348,7 @@ start:
 
   /* create database */
   dt_database_t *db = (dt_database_t *)g_malloc0(sizeof(dt_database_t));
+  dt_pthread_mutex_init(&db->readers_mutex, NULL);
   db->dbfilename_data = g_strdup(dbfilename_data);
   db->dbfilename_library = g_strdup(dbfilename_library);
 
@@ -3134,7 +3386,8 @@ start:
 
 
   /* opening / creating database */
-  if(sqlite3_open(db->dbfilename_library, &db->handle))
+  if(sqlite3_open_v2(db->dbfilename_library, &db->handle,
+                     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL))
   {
     fprintf(stderr, "[init] could not find database ");
     if(dbname)
@@ -3154,10 +3407,19 @@ start:
     return NULL;
   }
 
+  // time every statement for the metrics
+  sqlite3_trace_v2(db->handle, SQLITE_TRACE_PROFILE, _trace_profile, NULL);
+
   /* attach a memory database to db connection for use with temporary tables
      used during instance life time, which is discarded on exit.
+     the read connections share it, which makes no sense for an in-memory library.
   */
-  sqlite3_exec(db->handle, "attach database ':memory:' as memory", NULL, NULL, NULL);
+  const gboolean wal = dt_conf_get_bool("database_wal") && g_strcmp0(db->dbfilename_library, ":memory:")
+                       && g_strcmp0(dbfilename_data, ":memory:");
+  if(wal)
+    sqlite3_exec(db->handle, "attach database '" DT_DATABASE_MEMORY_URI "' as memory", NULL, NULL, NULL);
+  else
+    sqlite3_exec(db->handle, "attach database ':memory:' as memory", NULL, NULL, NULL);
 
   // attach the data database which contains presets, styles, tags and similar things not tied to single images
   sqlite3_stmt *stmt;
@@ -3174,10 +3436,26 @@ start:
   }
   sqlite3_finalize(stmt);
 
-  // some sqlite3 config
-  sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  // some sqlite3 config. the page size has to be set before switching to WAL.
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
+  gchar *journal_mode = wal ? _get_pragma_string_val(db->handle, "journal_mode = WAL") : NULL;
+  if(journal_mode && !g_ascii_strncasecmp(journal_mode, "wal", 3))
+  {
+    // with WAL, NORMAL can only lose the last commits on power loss, never corrupt the library.
+    // checkpoints run passively every 1000 pages (32 MB) and the log is truncated back to 64 MB
+    // afterwards, a last one empties it on close.
+    sqlite3_exec(db->handle, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA wal_autocheckpoint = 1000", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_size_limit = 67108864", NULL, NULL, NULL);
+    db->use_readers = TRUE;
+  }
+  else
+  {
+    if(wal) fprintf(stderr, "[init] couldn't enable WAL on the database, the readers are disabled\n");
+    sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+  }
+  g_free(journal_mode);
 
   // WARNING: the foreign_keys pragma must not be used, the integrity of the
   // database rely on it.
@@ -3189,7 +3467,8 @@ start:
   // over when updating that one
   if(!have_data_db)
   {
-    _create_data_schema(db); // a brand new db it seems
+    // a brand new db it seems. the in-memory one of non-gui instances starts from the startup snapshot
+    if(load_data || !_data_snapshot_restore(db)) _create_data_schema(db);
   }
   else
   {
@@ -3334,6 +3613,8 @@ start:
         fprintf(stderr, " ... ok\n");
       else
         fprintf(stderr, " ... failed\n");
+      // the write-ahead log of the damaged database must not be replayed onto the restored one
+      _unlink_wal(dbfilename_data);
 
       if(resp == GTK_RESPONSE_ACCEPT && data_snap)
       {
@@ -3512,6 +3793,8 @@ start:
       fprintf(stderr, " ... ok\n");
     else
       fprintf(stderr, " ... failed\n");
+    // the write-ahead log of the damaged database must not be replayed onto the restored one
+    _unlink_wal(dbfilename_library);
 
     if(resp == GTK_RESPONSE_ACCEPT && data_snap)
     {
@@ -3619,7 +3902,16 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  for(int k = 0; k < DT_DATABASE_READERS; k++)
+    if(db->readers[k])
+    {
+      _stmt_cache_forget_handle(db->readers[k]);
+      sqlite3_close(db->readers[k]);
+    }
+  _stmt_cache_forget_handle(db->handle);
+  if(db->use_readers) sqlite3_exec(db->handle, "PRAGMA wal_checkpoint(TRUNCATE)", NULL, NULL, NULL);
   sqlite3_close(db->handle);
+  dt_pthread_mutex_destroy(&((dt_database_t *)db)->readers_mutex);
   if (db->lockfile_data)
   {
     g_unlink(db->lockfile_data);
@@ -3632,16 +3924,158 @@ void dt_database_destroy(const dt_database_t *db)
   }
   g_free(db->dbfilename_data);
   g_free(db->dbfilename_library);
+  g_free(db->data_snapshot_digest);
   g_free((dt_database_t *)db);
 
   sqlite3_shutdown();
 }
 
+// prepared statements of dt_database_get_statement(), one table per thread: connection -> (query -> statement).
+// all tables are listed here so that the statements of a connection can be finalized before it is closed
+static GMutex _stmt_cache_lock;
+static GList *_stmt_caches = NULL;
+
+static void _stmt_cache_free(gpointer data)
+{
+  GHashTable *cache = (GHashTable *)data;
+  g_mutex_lock(&_stmt_cache_lock);
+  _stmt_caches = g_list_remove(_stmt_caches, cache);
+  g_hash_table_destroy(cache);
+  g_mutex_unlock(&_stmt_cache_lock);
+}
+
+static GPrivate _stmt_cache_key = G_PRIVATE_INIT(_stmt_cache_free);
+
+// the idle statements of a connection are dropped when it has more than this, collection queries come and go
+#define DT_DATABASE_STATEMENT_CACHE_SIZE 64
+
+static gboolean _stmt_cache_is_idle(gpointer key, gpointer value, gpointer user_data)
+{
+  return !sqlite3_stmt_busy((sqlite3_stmt *)value);
+}
+
+sqlite3_stmt *dt_database_get_statement(sqlite3 *handle, const char *query)
+{
+  GHashTable *cache = g_private_get(&_stmt_cache_key);
+  if(!cache)
+  {
+    cache = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_hash_table_destroy);
+    g_private_set(&_stmt_cache_key, cache);
+    g_mutex_lock(&_stmt_cache_lock);
+    _stmt_caches = g_list_prepend(_stmt_caches, cache);
+    g_mutex_unlock(&_stmt_cache_lock);
+  }
+
+  g_mutex_lock(&_stmt_cache_lock);
+  GHashTable *stmts = g_hash_table_lookup(cache, handle);
+  if(!stmts)
+  {
+    stmts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)sqlite3_finalize);
+    g_hash_table_insert(cache, handle, stmts);
+  }
+  sqlite3_stmt *stmt = g_hash_table_lookup(stmts, query);
+  g_mutex_unlock(&_stmt_cache_lock);
+
+  if(stmt)
+  {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return stmt;
+  }
+
+  if(sqlite3_prepare_v2(handle, query, -1, &stmt, NULL) != SQLITE_OK)
+  {
+    fprintf(stderr, "[dt_database_get_statement] can't prepare '%s': %s\n", query, sqlite3_errmsg(handle));
+    sqlite3_finalize(stmt);
+    return NULL;
+  }
+
+  g_mutex_lock(&_stmt_cache_lock);
+  if(g_hash_table_size(stmts) >= DT_DATABASE_STATEMENT_CACHE_SIZE)
+    g_hash_table_foreach_remove(stmts, _stmt_cache_is_idle, NULL);
+  g_hash_table_insert(stmts, g_strdup(query), stmt);
+  g_mutex_unlock(&_stmt_cache_lock);
+  return stmt;
+}
+
+// finalize the cached statements of all threads on handle, before it is closed
+static void _stmt_cache_forget_handle(sqlite3 *handle)
+{
+  g_mutex_lock(&_stmt_cache_lock);
+  for(GList *l = _stmt_caches; l; l = g_list_next(l)) g_hash_table_remove((GHashTable *)l->data, handle);
+  g_mutex_unlock(&_stmt_cache_lock);
+}
+
 sqlite3 *dt_database_get(const dt_database_t *db)
 {
   return db ? db->handle : NULL;
 }
 
+static sqlite3 *_database_open_reader(const dt_database_t *db)
+{
+  sqlite3 *handle = NULL;
+  if(sqlite3_open_v2(db->dbfilename_library, &handle, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, NULL))
+  {
+    fprintf(stderr, "[sql] couldn't open a read connection on `%s': %s\n", db->dbfilename_library,
+            sqlite3_errmsg(handle));
+    sqlite3_close(handle);
+    return NULL;
+  }
+  // readers of a shared cache don't lock its tables
+  sqlite3_exec(handle, "PRAGMA read_uncommitted = 1", NULL, NULL, NULL);
+  sqlite3_busy_timeout(handle, 100);
+
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(handle, "ATTACH DATABASE ?1 AS data", -1, &stmt, NULL);
+  sqlite3_bind_text(stmt, 1, db->dbfilename_data, -1, SQLITE_TRANSIENT);
+  if(rc == SQLITE_OK) rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  sqlite3_finalize(stmt);
+  if(rc == SQLITE_OK)
+    rc = sqlite3_exec(handle, "ATTACH DATABASE '" DT_DATABASE_MEMORY_URI "' AS memory", NULL, NULL, NULL);
+  if(rc != SQLITE_OK)
+  {
+    fprintf(stderr, "[sql] couldn't attach to a read connection: %s\n", sqlite3_errmsg(handle));
+    sqlite3_close(handle);
+    return NULL;
+  }
+#ifdef HAVE_ICU
+  sqlite3IcuInit(handle);
+#endif
+  return handle;
+}
+
+sqlite3 *dt_database_get_reader(const dt_database_t *db)
+{
+  if(!db || !db->use_readers) return dt_database_get(db);
+
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3 *handle = NULL;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  for(int k = 0; k < DT_DATABASE_READERS && !handle; k++)
+  {
+    if(d->reader_busy[k]) continue;
+    if(!d->readers[k]) d->readers[k] = _database_open_reader(db);
+    if(!d->readers[k]) break;
+    d->reader_busy[k] = TRUE;
+    handle = d->readers[k];
+  }
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+
+  // all taken: rather share the main connection than wait
+  return handle ? handle : db->handle;
+}
+
+void dt_database_release_reader(const dt_database_t *db, sqlite3 *handle)
+{
+  if(!db || handle == db->handle) return;
+
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  for(int k = 0; k < DT_DATABASE_READERS; k++)
+    if(d->readers[k] == handle) d->reader_busy[k] = FALSE;
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+}
+
 const gchar *dt_database_get_path(const struct dt_database_t *db)
 {
   return db->dbfilename_library;
@@ -3704,6 +4138,9 @@ gboolean dt_database_get_lock_acquired(const dt_database_t *db)
 
 void dt_database_cleanup_busy_statements(const struct dt_database_t *db)
 {
+  // the cached statements are no leftovers, finalize them first
+  _stmt_cache_forget_handle(db->handle);
+
   sqlite3_stmt *stmt = NULL;
   while( (stmt = sqlite3_next_stmt(db->handle, NULL)) != NULL)
   {
@@ -3720,11 +4157,93 @@ void dt_database_cleanup_busy_statements(const struct dt_database_t *db)
   }
 }
 
+// a step of a query plan reading a whole table, "SCAN images" or "SCAN TABLE images" depending on the sqlite
+// version. full scans of an index ("SCAN images USING COVERING INDEX ...") and of subqueries don't count.
+static gboolean _query_plan_is_table_scan(const char *detail)
+{
+  if(!detail || !g_str_has_prefix(detail, "SCAN ")) return FALSE;
+  const char *name = detail + strlen("SCAN ");
+  if(g_str_has_prefix(name, "TABLE ")) name += strlen("TABLE ");
+  return !strstr(name, " USING ") && !g_str_has_prefix(name, "SUBQUERY") && !g_str_has_prefix(name, "(subquery")
+         && !g_str_has_prefix(name, "CONSTANT ROW");
+}
+
+void dt_database_check_query_plan(const struct dt_database_t *db, const char *query, const char *context)
+{
+  if(!(darktable.unmuted & DT_DEBUG_SQL) || !query) return;
+
+  gchar *explain = g_strdup_printf("EXPLAIN QUERY PLAN %s", query);
+  sqlite3_stmt *stmt = NULL;
+  // the plan doesn't depend on the values of the parameters, they can stay unbound
+  if(sqlite3_prepare_v2(db->handle, explain, -1, &stmt, NULL) == SQLITE_OK)
+  {
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      // the detail is the 4th column in every format of EXPLAIN QUERY PLAN
+      const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+      if(_query_plan_is_table_scan(detail))
+        dt_print(DT_DEBUG_SQL, "[sql] %s: query falls back to a table scan (%s): '%s'\n", context, detail, query);
+    }
+  }
+  else
+    dt_print(DT_DEBUG_SQL, "[sql] %s: can't explain query '%s': %s\n", context, query, sqlite3_errmsg(db->handle));
+  sqlite3_finalize(stmt);
+  g_free(explain);
+}
+
+void dt_database_set_bulk_images(const struct dt_database_t *db, const GList *imgs)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "DELETE FROM memory.bulk_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db->handle, "INSERT INTO memory.bulk_images (num, imgid) VALUES (?1, ?2)", -1, &stmt,
+                              NULL);
+  int num = 1;
+  for(const GList *l = imgs; l; l = g_list_next((GList *)l))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, num++);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+// with incremental auto vacuum, the free pages can be given back to the file system a few at a time
+static gboolean _incremental_vacuum(const struct dt_database_t *db)
+{
+  return _get_pragma_int_val(db->handle, "main.auto_vacuum") == 2
+         && _get_pragma_int_val(db->handle, "data.auto_vacuum") == 2;
+}
+
 #define ERRCHECK {if (err!=NULL) {dt_print(DT_DEBUG_SQL, "[db maintenance] maintenance error: '%s'\n",err); sqlite3_free(err); err=NULL;}}
 void dt_database_perform_maintenance(const struct dt_database_t *db)
 {
   char* err = NULL;
 
+  if(_incremental_vacuum(db))
+  {
+    // no need to rewrite the whole files, truncating them is enough
+    const int main_pre_free_count = _get_pragma_int_val(db->handle, "main.freelist_count");
+    const int data_pre_free_count = _get_pragma_int_val(db->handle, "data.freelist_count");
+    DT_DEBUG_SQLITE3_EXEC(db->handle, "PRAGMA data.incremental_vacuum", NULL, NULL, &err);
+    ERRCHECK
+    DT_DEBUG_SQLITE3_EXEC(db->handle, "PRAGMA main.incremental_vacuum", NULL, NULL, &err);
+    ERRCHECK
+    DT_DEBUG_SQLITE3_EXEC(db->handle, "ANALYZE", NULL, NULL, &err);
+    ERRCHECK
+    dt_print(DT_DEBUG_SQL, "[db maintenance] incremental vacuum done, %d pages freed.\n",
+             main_pre_free_count + data_pre_free_count
+             - _get_pragma_int_val(db->handle, "main.freelist_count")
+             - _get_pragma_int_val(db->handle, "data.freelist_count"));
+    return;
+  }
+
+  // the VACUUM below applies this, so that the next maintenances are incremental
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "PRAGMA data.auto_vacuum = INCREMENTAL", NULL, NULL, &err);
+  ERRCHECK
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "PRAGMA main.auto_vacuum = INCREMENTAL", NULL, NULL, &err);
+  ERRCHECK
+
   const int main_pre_free_count = _get_pragma_int_val(db->handle, "main.freelist_count");
   const int main_page_size = _get_pragma_int_val(db->handle, "main.page_size");
   const int data_pre_free_count = _get_pragma_int_val(db->handle, "data.freelist_count");
@@ -3773,8 +4292,47 @@ void dt_database_perform_maintenance(const struct dt_database_t *db)
     dt_print(DT_DEBUG_SQL, "[db maintenance] maintenance problem. if no errors logged, it should work fine next time.\n");
   }
 }
+
+// pages given back per step of the background maintenance, and pause between steps to let other
+// threads use the database
+#define DT_DATABASE_VACUUM_PAGES 256
+#define DT_DATABASE_IDLE_MS 25
+
+static int32_t _maintenance_job_run(dt_job_t *job)
+{
+  const struct dt_database_t *db = darktable.db;
+  char* err = NULL;
+  const char *schemas[] = { "data", "main" };
+  for(int k = 0; k < 2; k++)
+  {
+    gchar *freelist = g_strdup_printf("%s.freelist_count", schemas[k]);
+    gchar *vacuum = g_strdup_printf("PRAGMA %s.incremental_vacuum(%d)", schemas[k], DT_DATABASE_VACUUM_PAGES);
+    while(dt_control_running() && _get_pragma_int_val(db->handle, freelist) > 0)
+    {
+      DT_DEBUG_SQLITE3_EXEC(db->handle, vacuum, NULL, NULL, &err);
+      if(err) break;
+      sqlite3_sleep(DT_DATABASE_IDLE_MS);
+    }
+    ERRCHECK
+    g_free(freelist);
+    g_free(vacuum);
+  }
+  // unlike ANALYZE, only looks at the tables whose statistics are out of date
+  if(dt_control_running()) dt_database_optimize(db);
+  dt_print(DT_DEBUG_SQL, "[db maintenance] background maintenance done.\n");
+  return 0;
+}
 #undef ERRCHECK
 
+gboolean dt_database_maintenance_in_background(const struct dt_database_t *db)
+{
+  if(!_incremental_vacuum(db)) return FALSE;
+  dt_job_t *job = dt_control_job_create(&_maintenance_job_run, "database maintenance");
+  if(!job) return FALSE;
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  return TRUE;
+}
+
 gboolean _ask_for_maintenance(const gboolean has_gui, const gboolean closing_time, const guint64 size)
 {
   if(!has_gui)
@@ -3919,7 +4477,8 @@ static int _backup_db(
   sqlite3 *src_db,               /* Database handle to back up */
   const char *src_db_name,       /* Database name to back up */
   const char *dest_filename,      /* Name of file to back up to */
-  void(*xProgress)(int, int)  /* Progress function to invoke */
+  void(*xProgress)(int, int),  /* Progress function to invoke */
+  const gboolean background    /* pause between steps to let the other threads work, and stop on exit */
 )
 {
   sqlite3 *dest_db;             /* Database connection opened on zFilename */
@@ -3947,9 +4506,15 @@ static int _backup_db(
             sqlite3_backup_remaining(sb_dest),
             sqlite3_backup_pagecount(sb_dest)
           );
-        if( rc==SQLITE_OK || rc==SQLITE_BUSY || rc==SQLITE_LOCKED )
+        if(background && rc == SQLITE_OK && !dt_control_running())
         {
-          sqlite3_sleep(25);
+          rc = SQLITE_INTERRUPT;
+          break;
+        }
+        // when nothing else runs, only wait for the locks
+        if((background && rc == SQLITE_OK) || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+        {
+          sqlite3_sleep(DT_DATABASE_IDLE_MS);
         }
       }
       while( rc==SQLITE_OK || rc==SQLITE_BUSY || rc==SQLITE_LOCKED );
@@ -3957,7 +4522,7 @@ static int _backup_db(
       /* Release resources allocated by backup_init(). */
       (void)sqlite3_backup_finish(sb_dest);
     }
-    rc = sqlite3_errcode(dest_db);
+    if(rc != SQLITE_INTERRUPT) rc = sqlite3_errcode(dest_db);
   }
   /* Close the database connection opened on database file zFilename
   ** and return the result of this function. */
@@ -3965,7 +4530,7 @@ static int _backup_db(
   return rc;
 }
 
-gboolean dt_database_snapshot(const struct dt_database_t *db)
+static gboolean _database_snapshot(const struct dt_database_t *db, const gboolean background)
 {
   // backing up memory db is pointelss
   if(_is_mem_db(db))
@@ -3980,7 +4545,7 @@ gboolean dt_database_snapshot(const struct dt_database_t *db)
   gchar *lib_backup_file = g_strdup_printf(file_pattern, db->dbfilename_library, date_suffix);
   gchar *lib_tmpbackup_file = g_strdup_printf(temp_pattern, db->dbfilename_library, date_suffix);
 
-  int rc = _backup_db(db->handle, "main", lib_tmpbackup_file, _print_backup_progress);
+  int rc = _backup_db(db->handle, "main", lib_tmpbackup_file, _print_backup_progress, background);
   if(!(rc==SQLITE_OK))
   {
     g_unlink(lib_tmpbackup_file);
@@ -3999,7 +4564,7 @@ gboolean dt_database_snapshot(const struct dt_database_t *db)
 
   g_free(date_suffix);
 
-  rc = _backup_db(db->handle, "data", dat_tmpbackup_file, _print_backup_progress);
+  rc = _backup_db(db->handle, "data", dat_tmpbackup_file, _print_backup_progress, background);
   if(!(rc==SQLITE_OK))
   {
     g_unlink(dat_tmpbackup_file);
@@ -4015,6 +4580,47 @@ gboolean dt_database_snapshot(const struct dt_database_t *db)
   return TRUE;
 }
 
+gboolean dt_database_snapshot(const struct dt_database_t *db)
+{
+  return _database_snapshot(db, FALSE);
+}
+
+void dt_database_remove_snaps(gchar **snaps_to_remove)
+{
+  for(int i = 0; snaps_to_remove && snaps_to_remove[i]; i++)
+  {
+    // make file to remove writable, mostly problem on windows.
+    g_chmod(snaps_to_remove[i], S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+    dt_print(DT_DEBUG_SQL, "[db backup] removing old snap: %s... ", snaps_to_remove[i]);
+    const int retunlink = g_remove(snaps_to_remove[i]);
+    dt_print(DT_DEBUG_SQL, "%s\n", retunlink == 0 ? "success" : "failed!");
+  }
+}
+
+static int32_t _snapshot_job_run(dt_job_t *job)
+{
+  gchar **snaps_to_remove = dt_database_snaps_to_remove(darktable.db);
+  if(_database_snapshot(darktable.db, TRUE))
+  {
+    dt_database_remove_snaps(snaps_to_remove);
+    dt_print(DT_DEBUG_SQL, "[db backup] background snapshot done.\n");
+  }
+  g_strfreev(snaps_to_remove);
+  return 0;
+}
+
+void dt_database_snapshot_in_background(const struct dt_database_t *db)
+{
+  // snapshots on close are taken at exit, by definition
+  if(!g_strcmp0(dt_conf_get_string_const("database/create_snapshot"), "on close")) return;
+  if(!dt_database_maybe_snapshot(db)) return;
+
+  dt_job_t *job = dt_control_job_create(&_snapshot_job_run, "database snapshot");
+  if(!job) return;
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+}
+
 gboolean dt_database_maybe_snapshot(const struct dt_database_t *db)
 {
   if(_is_mem_db(db))
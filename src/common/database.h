@@ -28,6 +28,15 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/** get a read-only connection for queries which must not wait on the writes of other threads, memory.*
+    tables included. falls back to the main handle if WAL is off or all readers are taken.
+    give it back with dt_database_release_reader() once its statements are finalized or reset. */
+struct sqlite3 *dt_database_get_reader(const struct dt_database_t *db);
+void dt_database_release_reader(const struct dt_database_t *db, struct sqlite3 *handle);
+/** prepared statement for query on handle, from a cache of the calling thread. it comes reset and without
+    bindings. it stays owned by the cache: sqlite3_reset() it when done instead of finalizing it. not for
+    loops which may run the same query again on the same thread before they are done */
+struct sqlite3_stmt *dt_database_get_statement(struct sqlite3 *handle, const char *query);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
@@ -39,16 +48,30 @@ void dt_database_optimize(const struct dt_database_t *);
 /** conditionally perfrom db maintenance */
 gboolean dt_database_maybe_maintenance(const struct dt_database_t *db, const gboolean has_gui, const gboolean closing_time);
 void dt_database_perform_maintenance(const struct dt_database_t *db);
+/** give the free pages back in small steps in a background job. only once the databases are in incremental
+    auto vacuum mode, which the first dt_database_perform_maintenance() sets. returns FALSE if not */
+gboolean dt_database_maintenance_in_background(const struct dt_database_t *db);
+/** with -d sql, print the steps of the plan of query which read a whole table. context names the caller */
+void dt_database_check_query_plan(const struct dt_database_t *db, const char *query, const char *context);
+/** fill memory.bulk_images with imgs, numbered from 1 in list order, for the set based updates of
+    tags and color labels. gui thread only, the table is shared */
+void dt_database_set_bulk_images(const struct dt_database_t *db, const GList *imgs);
 /** cleanup busy statements on closing dt, just before performing maintenance */
 void dt_database_cleanup_busy_statements(const struct dt_database_t *db);
 /** simply create db snapshot of both library and data */
 gboolean dt_database_snapshot(const struct dt_database_t *db);
 /** check if creating database snapshot is recommended */
 gboolean dt_database_maybe_snapshot(const struct dt_database_t *db);
+/** take the snapshot due by the time based rules in a background job, so that exit doesn't have to */
+void dt_database_snapshot_in_background(const struct dt_database_t *db);
+/** remove the snapshot files listed by dt_database_snaps_to_remove() */
+void dt_database_remove_snaps(gchar **snaps_to_remove);
 /** get list of snapshot files to remove after successful snapshot */
 char **dt_database_snaps_to_remove(const struct dt_database_t *db);
 /** get possibly the freshest snapshot to restore */
 gchar *dt_database_get_most_recent_snap(const char* db_filename);
+/** keep a copy of an in-memory data database holding the built-in presets, for the next start */
+void dt_database_save_startup_snapshot(const struct dt_database_t *db);
 
 
 // nested transactions support
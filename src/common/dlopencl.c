@@ -182,6 +182,8 @@ dt_dlopencl_t *dt_dlopencl_init(const char *name)
                                            (void (**)(void)) & ocl->symbols->dt_clGetKernelInfo);
     success = success && dt_gmodule_symbol(module, "clEnqueueBarrier",
                                            (void (**)(void)) & ocl->symbols->dt_clEnqueueBarrier);
+    success = success && dt_gmodule_symbol(module, "clEnqueueMarker",
+                                           (void (**)(void)) & ocl->symbols->dt_clEnqueueMarker);
     success = success && dt_gmodule_symbol(module, "clGetKernelWorkGroupInfo",
                                            (void (**)(void)) & ocl->symbols->dt_clGetKernelWorkGroupInfo);
     success = success && dt_gmodule_symbol(module, "clEnqueueReadBuffer",
@@ -203,6 +205,11 @@ dt_dlopencl_t *dt_dlopencl_init(const char *name)
     success = success && dt_gmodule_symbol(module, "clGetImageInfo",
                                            ((void (**)(void)) & ocl->symbols->dt_clGetImageInfo));
 
+    /* optional symbols */
+    if(!dt_gmodule_symbol(module, "clCreateProgramWithIL",
+                          (void (**)(void)) & ocl->symbols->dt_clCreateProgramWithIL))
+      ocl->symbols->dt_clCreateProgramWithIL = NULL;
+
     ocl->have_opencl = success;
 
     if(!success)
@@ -22,10 +22,17 @@
 #include "config.h"
 #endif
 
+#include "common/trace.h"
+
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <inttypes.h>
+#ifdef __linux__
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
 
 #ifdef _WIN32
 #include "win/dtwin.h"
@@ -90,6 +97,88 @@ void dt_pthread_setname(const char *name)
   pthread_setname_np(name);
 #elif defined _WIN32
   dtwin_set_thread_name((DWORD)-1, name);
+#endif
+  // same label on the track of the thread in --trace timelines
+  dt_trace_name_thread(name);
+}
+
+#ifdef __linux__
+// parse a cpulist of sysfs ("0-15,32-47") into set, returns the number of CPUs in it
+static int _parse_cpulist(const char *list, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  int count = 0;
+  const char *p = list;
+  while(*p && *p != '\n')
+  {
+    char *end = NULL;
+    const long first = strtol(p, &end, 10);
+    if(end == p) break;
+    long last = first;
+    p = end;
+    if(*p == '-')
+    {
+      last = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+    {
+      CPU_SET(cpu, set);
+      count++;
+    }
+    if(*p == ',') p++;
+  }
+  return count;
+}
+
+static int _node_cpus(const int node, cpu_set_t *set)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  FILE *f = fopen(path, "r");
+  if(!f) return 0;
+  char list[4096] = { 0 };
+  const int count = fgets(list, sizeof(list), f) ? _parse_cpulist(list, set) : 0;
+  fclose(f);
+  return count;
+}
+#endif
+
+int dt_pthread_numa_nodes(void)
+{
+#ifdef __linux__
+  static int nodes = -1;
+  if(nodes < 0)
+  {
+    // nodes without CPU (memory only, like CXL expanders) can't run a pipe
+    int count = 0;
+    cpu_set_t set;
+    for(int node = 0; node < 1024; node++)
+      if(_node_cpus(node, &set) > 0) count++;
+    nodes = count > 0 ? count : 1;
+  }
+  return nodes;
+#else
+  return 1;
+#endif
+}
+
+int dt_pthread_bind_numa_node(const int node)
+{
+#ifdef __linux__
+  // find the node-th node having CPUs
+  cpu_set_t set;
+  for(int k = 0, found = 0; k < 1024; k++)
+  {
+    if(_node_cpus(k, &set) == 0) continue;
+    if(found++ < node) continue;
+    // the OpenMP threads started from this thread inherit the mask, and the first-touch policy of the
+    // kernel then places the pages they write on the same node
+    return sched_setaffinity(0, sizeof(cpu_set_t), &set);
+  }
+  return 1;
+#else
+  return 1;
 #endif
 }
 
@@ -369,6 +369,13 @@ int dt_pthread_create(pthread_t *thread, void *(*start_routine)(void *), void *a
 
 void dt_pthread_setname(const char *name);
 
+// number of NUMA nodes having CPUs, 1 where that can't be known
+int dt_pthread_numa_nodes(void);
+
+// restrict the calling thread, and the threads it starts later, to the CPUs of the node-th NUMA node having
+// CPUs. Returns 0 on success.
+int dt_pthread_bind_numa_node(const int node);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -37,6 +37,9 @@
 #define DT_CACHELINE_PIXELS 4
 #endif /* __APPLE__ && __aarch64__ */
 
+// Size of a transparent huge page on x86-64 and most aarch64 kernels. Large pixel buffers are aligned on it.
+#define DT_HUGE_PAGE_BYTES ((size_t)2 << 20)
+
 // Helper to force heap vectors to be aligned on 64 byte blocks to enable AVX2
 // If this is applied to a struct member and the struct is allocated on the heap, then it must be allocated
 // on a 64 byte boundary to avoid crashes or undefined behavior because of unaligned memory access.
@@ -113,6 +113,7 @@ static void dwt_get_image_layer(float *const layer, dwt_params_t *const p)
 }
 
 // first, "vertical" pass of wavelet decomposition
+__DT_CLONE_TARGETS__
 static void dwt_decompose_vert(float *const restrict out, const float *const restrict in,
                                const size_t height, const size_t width, const size_t lev)
 {
@@ -150,6 +151,7 @@ static void dwt_decompose_vert(float *const restrict out, const float *const res
 
 // second, horizontal pass of wavelet decomposition; generates 'coarse' into the output buffer and overwrites
 //   the input buffer with 'details'
+__DT_CLONE_TARGETS__
 static void dwt_decompose_horiz(float *const restrict out, float *const restrict in, float *const temp,
                                 const size_t height, const size_t width, const size_t lev)
 {
@@ -265,6 +267,9 @@ static void dwt_wavelet_decompose(float *img, dwt_params_t *const p, _dwt_layer_
   unsigned int hpass = 0;
   for(unsigned int lev = 0; lev < p->scales && bcontinue; lev++)
   {
+    // the pipe gave up on this output, don't compute the next scales
+    if(dt_dev_pixelpipe_cancelled()) goto cleanup;
+
     unsigned int lpass = (1 - (lev & 1));
 
     dwt_decompose_layer(buffer[lpass], buffer[hpass], temp, lev, p);
@@ -383,6 +388,7 @@ void dwt_decompose(dwt_params_t *p, _dwt_layer_func layer_func)
 }
 
 // first, "vertical" pass of wavelet decomposition
+__DT_CLONE_TARGETS__
 static void dwt_denoise_vert_1ch(float *const restrict out, const float *const restrict in,
                                  const size_t height, const size_t width, const size_t lev)
 {
@@ -419,6 +425,7 @@ static void dwt_denoise_vert_1ch(float *const restrict out, const float *const r
 
 // second, horizontal pass of wavelet decomposition; generates 'coarse' into the output buffer and overwrites
 //   the input buffer with 'details'
+__DT_CLONE_TARGETS__
 static void dwt_denoise_horiz_1ch(float *const restrict out, float *const restrict in,
                                   float *const restrict accum, const size_t height, const size_t width,
                                   const size_t lev, const float thold, const int last)
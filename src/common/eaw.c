@@ -128,6 +128,7 @@ static inline __m128 weight_sse2(const __m128 *c1, const __m128 *c2, const float
   pcoarse += 4;
 #endif
 
+__DT_CLONE_TARGETS__
 void eaw_decompose(float *const restrict out, const float *const restrict in, float *const restrict detail,
                    const int scale, const float sharpen, const int32_t width, const int32_t height)
 {
@@ -297,6 +298,7 @@ void eaw_decompose_sse2(float *const restrict out, const float *const restrict i
 }
 #endif
 
+__DT_CLONE_TARGETS__
 void eaw_synthesize(float *const out, const float *const in, const float *const restrict detail,
                     const float *const restrict threshold, const float *const restrict boost,
                     const int32_t width, const int32_t height)
@@ -433,6 +435,7 @@ static inline _aligned_pixel add_float4(_aligned_pixel acc, _aligned_pixel newva
   } while(0)
 #endif
 
+// the detail is not stored: eaw_dn_synthesize() takes it back from the fine and coarse buffers
 #undef SUM_PIXEL_EPILOGUE
 #define SUM_PIXEL_EPILOGUE                                                                                   \
   for_each_channel(c)      										     \
@@ -440,11 +443,9 @@ static inline _aligned_pixel add_float4(_aligned_pixel acc, _aligned_pixel newva
     sum[c] /= wgt[c];                                                   				     \
     pcoarse[c] = sum[c];                                                                                     \
     const float det = (px[c] - sum[c]);									     \
-    pdetail[c] = det;    		                                              			     \
     sum_sq.v[c] += (det*det);					                                             \
   }                                                                       				     \
   px += 4;                                                                                                   \
-  pdetail += 4;                                                                                              \
   pcoarse += 4;
 
 #if defined(__SSE__)
@@ -453,14 +454,13 @@ static inline _aligned_pixel add_float4(_aligned_pixel acc, _aligned_pixel newva
   sum = sum / wgt;		                                                                             \
   _mm_stream_ps(pcoarse, sum);                                                                               \
   sum = *px - sum;											     \
-  _mm_stream_ps(pdetail, sum);                                                                               \
   sum_sq.sse = sum_sq.sse + sum*sum;				                                             \
   px++;                                                                                                      \
-  pdetail += 4;                                                                                              \
   pcoarse += 4;
 #endif
 
-void eaw_dn_decompose(float *const restrict out, const float *const restrict in, float *const restrict detail,
+__DT_CLONE_TARGETS__
+void eaw_dn_decompose(float *const restrict out, const float *const restrict in,
                       dt_aligned_pixel_t sum_squared, const int scale, const float inv_sigma2,
                       const int32_t width, const int32_t height)
 {
@@ -473,7 +473,7 @@ void eaw_dn_decompose(float *const restrict out, const float *const restrict in,
 #if !(defined(__apple_build_version__) && __apple_build_version__ < 11030000) //makes Xcode 11.3.1 compiler crash
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(detail, filter, height, in, inv_sigma2, mult, boundary, out, width) \
+  dt_omp_firstprivate(filter, height, in, inv_sigma2, mult, boundary, out, width) \
   reduction(vsum: sum_sq) \
   schedule(static)
 #endif
@@ -483,7 +483,6 @@ void eaw_dn_decompose(float *const restrict out, const float *const restrict in,
     const size_t j = dwt_interleave_rows(rowid, height, mult);
     const float *px = ((float *)in) + (size_t)4 * j * width;
     const float *px2;
-    float *pdetail = detail + (size_t)4 * j * width;
     float *pcoarse = out + (size_t)4 * j * width;
 
     // for the first and last 'boundary' rows, we have to perform boundary tests for the entire row;
@@ -557,7 +556,7 @@ void eaw_dn_decompose(float *const restrict out, const float *const restrict in,
 
 
 #if defined(__SSE2__)
-void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict in, float *const restrict detail,
+void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict in,
                           dt_aligned_pixel_t sum_squared, const int scale, const float inv_sigma2,
                                  const int32_t width, const int32_t height)
 {
@@ -570,7 +569,7 @@ void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict
 #if !(defined(__apple_build_version__) && __apple_build_version__ < 11030000) //makes Xcode 11.3.1 compiler crash
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(detail, filter, height, in, inv_sigma2, mult, boundary, out, width) \
+  dt_omp_firstprivate(filter, height, in, inv_sigma2, mult, boundary, out, width) \
   reduction(vsum: sum_sq) \
   schedule(static)
 #endif
@@ -580,7 +579,6 @@ void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict
     const size_t j = dwt_interleave_rows(rowid, height, mult);
     const __m128 *px = ((__m128 *)in) + (size_t)j * width;
     const __m128 *px2;
-    float *pdetail = detail + (size_t)4 * j * width;
     float *pcoarse = out + (size_t)4 * j * width;
 
     // for the first and last 'boundary' rows, we have to use the macros with tests for the entire row;
@@ -652,6 +650,32 @@ void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict
 #undef SUM_PIXEL_PROLOGUE_SSE
 #undef SUM_PIXEL_EPILOGUE_SSE
 #endif
+
+__DT_CLONE_TARGETS__
+void eaw_dn_synthesize(float *const restrict out, const float *const restrict fine,
+                       const float *const restrict coarse, const float *const restrict threshold,
+                       const float *const restrict boost, const int32_t width, const int32_t height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(height, width) \
+  dt_omp_sharedconst(out, fine, coarse, threshold, boost) \
+  schedule(simd:static)
+#endif
+  for(size_t k = 0; k < (size_t)width * height; k++)
+  {
+#ifdef _OPENMP
+#pragma omp simd simdlen(4) aligned(out, fine, coarse, threshold, boost)
+#endif
+    for(size_t c = 0; c < 4; c++)
+    {
+      // same detail as eaw_dn_decompose() measured, shrunk like in eaw_synthesize()
+      const float detail = fine[4*k+c] - coarse[4*k+c];
+      const float amount = MAX(detail - threshold[c], 0.0f) + MIN(detail + threshold[c], 0.0f);
+      out[4*k + c] += boost[c] * amount;
+    }
+  }
+}
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -41,16 +41,22 @@ void eaw_synthesize_sse2(float *const restrict out, const float *const restrict
                          const float *const restrict thrsf, const float *const restrict boostf,
                          const int32_t width, const int32_t height);
 
-typedef void((*eaw_dn_decompose_t)(float *const restrict out, const float *const restrict in, float *const restrict detail,
+// the dn variants only write the coarse scale and the sum of the squared details, the detail
+// is the difference of in and out and gets thresholded into the result by eaw_dn_synthesize()
+typedef void((*eaw_dn_decompose_t)(float *const restrict out, const float *const restrict in,
                                    dt_aligned_pixel_t sum_squared, const int scale, const float inv_sigma2,
                                    const int32_t width, const int32_t height));
 
-void eaw_dn_decompose(float *const restrict out, const float *const restrict in, float *const restrict detail,
+void eaw_dn_decompose(float *const restrict out, const float *const restrict in,
                       dt_aligned_pixel_t sum_squared, const int scale, const float inv_sigma2,
                       const int32_t width, const int32_t height);
-void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict in, float *const restrict detail,
+void eaw_dn_decompose_sse(float *const restrict out, const float *const restrict in,
                           dt_aligned_pixel_t sum_squared, const int scale, const float inv_sigma2,
                           const int32_t width, const int32_t height);
+// out += boost * (fine - coarse) shrunk by thrsf
+void eaw_dn_synthesize(float *const restrict out, const float *const restrict fine,
+                       const float *const restrict coarse, const float *const restrict thrsf,
+                       const float *const restrict boostf, const int32_t width, const int32_t height);
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -60,6 +60,7 @@ extern "C" {
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/exif.h"
+#include "common/exif_header.h"
 #include "common/imageio_jpeg.h"
 #include "common/metadata.h"
 #include "common/ratings.h"
@@ -860,6 +861,28 @@ static void _find_exif_model(Exiv2::ExifData &exifData,
       }
 }
 
+static void _exif_tidy_lens_name(char *lens, const size_t lens_size)
+{
+  /* Use pretty name for Canon RF & RF-S lenses (as exiftool/exiv2/lensfun) */
+  if(g_str_has_prefix(lens, "RF"))
+  {
+    char *pretty;
+    if(lens[2] == '-')
+      pretty = g_strconcat("Canon RF-S ", &lens[4], (char *)NULL);
+    else
+      pretty = g_strconcat("Canon RF ", &lens[2], (char *)NULL);
+    g_strlcpy(lens, pretty, lens_size);
+    g_free(pretty);
+  }
+
+  /* Capitalize Nikon Z-mount lenses properly for UI presentation */
+  if(g_str_has_prefix(lens, "NIKKOR") || g_str_has_prefix(lens, "TAMRON"))
+  {
+    for(size_t i = 1; i <= 5; ++i)
+      lens[i] = g_ascii_tolower(lens[i]);
+  }
+}
+
 static bool _exif_decode_exif_data(dt_image_t *img, Exiv2::ExifData &exifData)
 {
   try
@@ -1249,24 +1272,7 @@ static bool _exif_decode_exif_data(dt_image_t *img, Exiv2::ExifData &exifData)
       dt_strlcpy_to_utf8(img->exif_lens, sizeof(img->exif_lens), pos, exifData);
     }
 
-    /* Use pretty name for Canon RF & RF-S lenses (as exiftool/exiv2/lensfun) */
-    if(g_str_has_prefix(img->exif_lens, "RF"))
-    {
-      char *pretty;
-      if(img->exif_lens[2] == '-')
-        pretty = g_strconcat("Canon RF-S ", &img->exif_lens[4], (char *)NULL);
-      else
-        pretty = g_strconcat("Canon RF ", &img->exif_lens[2], (char *)NULL);
-      g_strlcpy(img->exif_lens, pretty, sizeof(img->exif_lens));
-      g_free(pretty);
-    }
-
-    /* Capitalize Nikon Z-mount lenses properly for UI presentation */
-    if(g_str_has_prefix(img->exif_lens, "NIKKOR") || g_str_has_prefix(img->exif_lens, "TAMRON"))
-    {
-      for(size_t i = 1; i <= 5; ++i)
-        img->exif_lens[i] = g_ascii_tolower(img->exif_lens[i]);
-    }
+    _exif_tidy_lens_name(img->exif_lens, sizeof(img->exif_lens));
 
     // finally the lens has only numbers and parentheses, let's try to use
     // Exif.Photo.LensModel if defined.
@@ -1637,11 +1643,107 @@ int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size)
   }
 }
 
+// the embedded previews extracted last. the import dialog, the checks run on import and the first
+// mipmaps of the new images all ask for the same ones within a short time, keyed by path, size and
+// modification time of the file
+#define DT_EXIF_PREVIEW_CACHE_BYTES (64 << 20)
+#define DT_EXIF_PREVIEW_CACHE_AGE (5 * 60 * G_USEC_PER_SEC)
+
+typedef struct dt_exif_preview_t
+{
+  gchar *path;
+  time_t mtime;
+  off_t filesize;
+  gint64 stamp; // when it was extracted, the queue is sorted by it
+  uint8_t *data;
+  size_t size;
+  char *mime_type;
+} dt_exif_preview_t;
+
+static GMutex _previews_lock;
+static GQueue _previews = G_QUEUE_INIT;
+static size_t _previews_size = 0;
+
+static void _preview_free(dt_exif_preview_t *p)
+{
+  g_free(p->path);
+  free(p->data);
+  free(p->mime_type);
+  g_free(p);
+}
+
+// drop what expired and the oldest entries above the size limit, with the lock held
+static void _previews_trim(const gint64 now)
+{
+  while(!g_queue_is_empty(&_previews))
+  {
+    dt_exif_preview_t *p = (dt_exif_preview_t *)g_queue_peek_tail(&_previews);
+    if(_previews_size <= DT_EXIF_PREVIEW_CACHE_BYTES && now - p->stamp < DT_EXIF_PREVIEW_CACHE_AGE) break;
+    g_queue_pop_tail(&_previews);
+    _previews_size -= p->size;
+    _preview_free(p);
+  }
+}
+
+static bool _previews_get(const char *path, const struct stat *st, uint8_t **buffer, size_t *size,
+                          char **mime_type)
+{
+  bool found = false;
+  g_mutex_lock(&_previews_lock);
+  _previews_trim(g_get_monotonic_time());
+  for(GList *l = _previews.head; l; l = g_list_next(l))
+  {
+    const dt_exif_preview_t *p = (dt_exif_preview_t *)l->data;
+    if(p->mtime != st->st_mtime || p->filesize != st->st_size || strcmp(p->path, path)) continue;
+    *buffer = (uint8_t *)malloc(p->size);
+    if(*buffer)
+    {
+      memcpy(*buffer, p->data, p->size);
+      *size = p->size;
+      *mime_type = strdup(p->mime_type);
+      found = true;
+    }
+    break;
+  }
+  g_mutex_unlock(&_previews_lock);
+  return found;
+}
+
+static void _previews_add(const char *path, const struct stat *st, const uint8_t *buffer, const size_t size,
+                          const char *mime_type)
+{
+  if(size > DT_EXIF_PREVIEW_CACHE_BYTES / 4) return;
+  dt_exif_preview_t *p = g_new0(dt_exif_preview_t, 1);
+  p->data = (uint8_t *)malloc(size);
+  if(!p->data)
+  {
+    g_free(p);
+    return;
+  }
+  memcpy(p->data, buffer, size);
+  p->size = size;
+  p->path = g_strdup(path);
+  p->mime_type = strdup(mime_type);
+  p->mtime = st->st_mtime;
+  p->filesize = st->st_size;
+  p->stamp = g_get_monotonic_time();
+
+  g_mutex_lock(&_previews_lock);
+  g_queue_push_head(&_previews, p);
+  _previews_size += size;
+  _previews_trim(p->stamp);
+  g_mutex_unlock(&_previews_lock);
+}
+
 /**
  * Get the largest possible thumbnail from the image
  */
 int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char **mime_type)
 {
+  struct stat statbuf;
+  const bool cacheable = !stat(path, &statbuf);
+  if(cacheable && _previews_get(path, &statbuf, buffer, size, mime_type)) return 0;
+
   try
   {
     std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
@@ -1678,6 +1780,7 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 
     memcpy(*buffer, tmp, _size);
 
+    if(cacheable) _previews_add(path, &statbuf, *buffer, _size, *mime_type);
     return 0;
   }
   catch(Exiv2::AnyError &e)
@@ -1691,6 +1794,98 @@ int dt_exif_get_thumbnail(const char *path, uint8_t **buffer, size_t *size, char
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
+static void _exif_check_mono_preview(dt_image_t *img, const char *path)
+{
+  if(!dt_conf_get_bool("ui/detect_mono_exif")) return;
+
+  const int oldflags = dt_image_monochrome_flags(img) | (img->flags & DT_IMAGE_MONOCHROME_WORKFLOW);
+  if(dt_imageio_has_mono_preview(path))
+    img->flags |= (DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
+  else
+    img->flags &= ~(DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
+
+  if(oldflags != (dt_image_monochrome_flags(img) | (img->flags & DT_IMAGE_MONOCHROME_WORKFLOW)))
+    dt_imageio_update_monochrome_workflow_tag(img->id, dt_image_monochrome_flags(img));
+}
+
+// the fields of main.images straight from the exif header, the way _exif_decode_exif_data() finds them,
+// without having exiv2 parse the whole file. returns false, with img untouched, if exiv2 has to read it
+static bool _exif_read_header(dt_image_t *img, const char *path)
+{
+  dt_exif_header_t h;
+  if(!dt_exif_header_read(&h, path)) return false;
+
+  // without a 35mm equivalent exiv2 works the crop factor out of the sensor size
+  float crop = img->exif_crop;
+  if(h.has_focal_length_35mm)
+    crop = (h.focal_length_35mm > 0.0f && h.focal_length > 0.0f) ? h.focal_length_35mm / h.focal_length : 0.0f;
+  if(crop == 0.0f && h.has_focal_plane_resolution)
+  {
+    dt_exif_header_cleanup(&h);
+    return false;
+  }
+
+  g_strlcpy(img->exif_maker, h.maker, sizeof(img->exif_maker));
+  g_strlcpy(img->exif_model, h.model, sizeof(img->exif_model));
+  dt_image_refresh_makermodel(img);
+
+  img->exif_exposure = h.exposure;
+  if(h.has_exposure_bias) img->exif_exposure_bias = h.exposure_bias;
+  img->exif_aperture = h.aperture;
+  img->exif_iso = h.iso;
+  img->exif_focal_length = h.focal_length;
+  img->exif_crop = crop;
+  if(h.subject_distance >= 0.0f) img->exif_focus_distance = h.subject_distance;
+  if(h.orientation) img->orientation = dt_image_orientation_to_flip_bits(h.orientation);
+
+  double value = 0.0;
+  if(h.has_latitude
+     && dt_util_gps_rationale_to_number(h.gps_latitude[0], h.gps_latitude[1], h.gps_latitude[2],
+                                        h.gps_latitude[3], h.gps_latitude[4], h.gps_latitude[5],
+                                        h.gps_latitude_ref, &value))
+    img->geoloc.latitude = value;
+  if(h.has_longitude
+     && dt_util_gps_rationale_to_number(h.gps_longitude[0], h.gps_longitude[1], h.gps_longitude[2],
+                                        h.gps_longitude[3], h.gps_longitude[4], h.gps_longitude[5],
+                                        h.gps_longitude_ref, &value))
+    img->geoloc.longitude = value;
+  if(h.has_elevation
+     && dt_util_gps_elevation_to_number(h.gps_elevation[0], h.gps_elevation[1], h.gps_elevation_ref, &value))
+    img->geoloc.elevation = value;
+
+  g_strlcpy(img->exif_lens, h.lens, sizeof(img->exif_lens));
+  _exif_tidy_lens_name(img->exif_lens, sizeof(img->exif_lens));
+
+  char datetime[DT_DATETIME_LENGTH];
+  g_strlcpy(datetime, h.datetime, sizeof(datetime));
+  if(h.subsec[0]) dt_datetime_add_subsec_to_exif(datetime, sizeof(datetime), h.subsec);
+  dt_datetime_exif_to_img(img, datetime);
+
+  if(h.artist) dt_metadata_set_import(img->id, "Xmp.dc.creator", h.artist);
+  if(h.description) dt_metadata_set_import(img->id, "Xmp.dc.description", h.description);
+  if(h.copyright) dt_metadata_set_import(img->id, "Xmp.dc.rights", h.copyright);
+  dt_image_set_xmp_rating(img, h.rating);
+
+  if(dt_image_is_hdr(img)) dt_imageio_set_hdr_tag(img);
+
+  if(dt_image_is_ldr(img))
+  {
+    if(h.colorspace == 0x01)
+      img->colorspace = DT_IMAGE_COLORSPACE_SRGB;
+    else if(h.colorspace == 0x02)
+      img->colorspace = DT_IMAGE_COLORSPACE_ADOBE_RGB;
+  }
+
+  img->exif_inited = TRUE;
+  _exif_check_mono_preview(img, path);
+
+  img->height = h.height;
+  img->width = h.width;
+
+  dt_exif_header_cleanup(&h);
+  return true;
+}
+
 int dt_exif_read(dt_image_t *img, const char *path)
 {
   // at least set datetime taken to something useful in case there is no exif data in this file (pfm, png,
@@ -1702,6 +1897,10 @@ int dt_exif_read(dt_image_t *img, const char *path)
     dt_datetime_unix_to_img(img, &statbuf.st_mtime);
   }
 
+  // most files have everything we keep in their plain exif header, that is much cheaper to read than having
+  // exiv2 parse the whole file, maker notes included
+  if(_exif_read_header(img, path)) return 0;
+
   try
   {
     std::unique_ptr<Exiv2::Image> image(Exiv2::ImageFactory::open(WIDEN(path)));
@@ -1714,17 +1913,7 @@ int dt_exif_read(dt_image_t *img, const char *path)
     if(!exifData.empty())
     {
       res = _exif_decode_exif_data(img, exifData);
-      if(dt_conf_get_bool("ui/detect_mono_exif"))
-      {
-        const int oldflags = dt_image_monochrome_flags(img) | (img->flags & DT_IMAGE_MONOCHROME_WORKFLOW);
-        if(dt_imageio_has_mono_preview(path))
-          img->flags |= (DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
-        else
-          img->flags &= ~(DT_IMAGE_MONOCHROME_PREVIEW | DT_IMAGE_MONOCHROME_WORKFLOW);
-
-        if(oldflags != (dt_image_monochrome_flags(img) | (img->flags & DT_IMAGE_MONOCHROME_WORKFLOW)))
-          dt_imageio_update_monochrome_workflow_tag(img->id, dt_image_monochrome_flags(img));
-      }
+      _exif_check_mono_preview(img, path);
     }
     else
       img->exif_inited = 1;
@@ -4212,211 +4401,215 @@ static void dt_remove_iptc_key(Exiv2::IptcData &iptc, const char *key)
   }
 }
 
-int dt_exif_xmp_attach_export(const int imgid, const char *filename, void *metadata)
+// the metadata of an export of imgid, as m asks for it. exifData holds the exif data going with the image,
+// xmpData and iptcData are filled from the source image, its sidecar and the database.
+static void _exif_export_data(const int imgid, dt_export_metadata_t *m, Exiv2::ExifData &exifData,
+                              Exiv2::XmpData &xmpData, Exiv2::IptcData &iptcData)
 {
-  dt_export_metadata_t *m = (dt_export_metadata_t *)metadata;
+  char input_filename[PATH_MAX] = { 0 };
+  gboolean from_cache = TRUE;
+  dt_image_full_path(imgid,  input_filename,  sizeof(input_filename),  &from_cache, __FUNCTION__);
+
   try
   {
-    char input_filename[PATH_MAX] = { 0 };
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid,  input_filename,  sizeof(input_filename),  &from_cache, __FUNCTION__);
-
-    std::unique_ptr<Exiv2::Image> img(Exiv2::ImageFactory::open(WIDEN(filename)));
-    // unfortunately it seems we have to read the metadata, to not erase the exif (which we just wrote).
-    // will make export slightly slower, oh well.
-    // img->clearXmpPacket();
-    read_metadata_threadsafe(img);
-
-    try
-    {
-      // initialize XMP and IPTC data with the one from the original file
-      std::unique_ptr<Exiv2::Image> input_image(Exiv2::ImageFactory::open(WIDEN(input_filename)));
-      if(input_image.get() != 0)
-      {
-        read_metadata_threadsafe(input_image);
-        img->setIptcData(input_image->iptcData());
-        img->setXmpData(input_image->xmpData());
-      }
-    }
-    catch(Exiv2::AnyError &e)
+    // initialize XMP and IPTC data with the one from the original file
+    std::unique_ptr<Exiv2::Image> input_image(Exiv2::ImageFactory::open(WIDEN(input_filename)));
+    if(input_image.get() != 0)
     {
-      std::cerr << "[xmp_attach] " << input_filename << ": caught exiv2 exception '" << e << "'\n";
+      read_metadata_threadsafe(input_image);
+      iptcData = input_image->iptcData();
+      xmpData = input_image->xmpData();
     }
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::cerr << "[xmp_attach] " << input_filename << ": caught exiv2 exception '" << e << "'\n";
+  }
 
-    Exiv2::XmpData &xmpData = img->xmpData();
-
-    // now add whatever we have in the sidecar XMP. this overwrites stuff from the source image
-    dt_image_path_append_version(imgid, input_filename, sizeof(input_filename));
-    g_strlcat(input_filename, ".xmp", sizeof(input_filename));
-    if(g_file_test(input_filename, G_FILE_TEST_EXISTS))
-    {
-      Exiv2::XmpData sidecarXmpData;
-      std::string xmpPacket;
+  // now add whatever we have in the sidecar XMP. this overwrites stuff from the source image
+  dt_image_path_append_version(imgid, input_filename, sizeof(input_filename));
+  g_strlcat(input_filename, ".xmp", sizeof(input_filename));
+  if(g_file_test(input_filename, G_FILE_TEST_EXISTS))
+  {
+    Exiv2::XmpData sidecarXmpData;
+    std::string xmpPacket;
 
-      Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(input_filename));
+    Exiv2::DataBuf buf = Exiv2::readFile(WIDEN(input_filename));
 #if EXIV2_TEST_VERSION(0,28,0)
-      xmpPacket.assign(buf.c_str(), buf.size());
+    xmpPacket.assign(buf.c_str(), buf.size());
 #else
-      xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
+    xmpPacket.assign(reinterpret_cast<char *>(buf.pData_), buf.size_);
 #endif
-      Exiv2::XmpParser::decode(sidecarXmpData, xmpPacket);
+    Exiv2::XmpParser::decode(sidecarXmpData, xmpPacket);
 
-      for(Exiv2::XmpData::const_iterator it = sidecarXmpData.begin(); it != sidecarXmpData.end(); ++it)
-        xmpData.add(*it);
-    }
+    for(Exiv2::XmpData::const_iterator it = sidecarXmpData.begin(); it != sidecarXmpData.end(); ++it)
+      xmpData.add(*it);
+  }
 
-    dt_remove_known_keys(xmpData); // is this needed?
+  dt_remove_known_keys(xmpData); // is this needed?
 
-    {
-      // We also want to make sure to not have some tags that might
-      // have come in from XMP files created by digikam or similar
-      static const char *keys[] = {
-        "Xmp.tiff.Orientation"
-      };
-      static const guint n_keys = G_N_ELEMENTS(keys);
-      dt_remove_xmp_keys(xmpData, keys, n_keys);
-    }
+  {
+    // We also want to make sure to not have some tags that might
+    // have come in from XMP files created by digikam or similar
+    static const char *keys[] = {
+      "Xmp.tiff.Orientation"
+    };
+    static const guint n_keys = G_N_ELEMENTS(keys);
+    dt_remove_xmp_keys(xmpData, keys, n_keys);
+  }
 
-    // last but not least attach what we have in DB to the XMP. in theory that should be
-    // the same as what we just copied over from the sidecar file, but you never know ...
-    // make sure to remove all geotags if necessary
-    if(m)
+  // last but not least attach what we have in DB to the XMP. in theory that should be
+  // the same as what we just copied over from the sidecar file, but you never know ...
+  // make sure to remove all geotags if necessary
+  if(m)
+  {
+    Exiv2::ExifData exifOldData;
+    if(!(m->flags & DT_META_EXIF))
     {
-      Exiv2::ExifData exifOldData;
-      Exiv2::ExifData &exifData = img->exifData();
-      if(!(m->flags & DT_META_EXIF))
+      for(Exiv2::ExifData::const_iterator i = exifData.begin(); i != exifData.end() ; ++i)
       {
-        for(Exiv2::ExifData::const_iterator i = exifData.begin(); i != exifData.end() ; ++i)
-        {
-          exifOldData[i->key()] = i->value();
-        }
-        img->clearExifData();
+        exifOldData[i->key()] = i->value();
       }
+      exifData.clear();
+    }
 
-      _exif_xmp_read_data_export(xmpData, imgid, m);
-
-      Exiv2::IptcData &iptcData = img->iptcData();
-
-      if(!(m->flags & DT_META_GEOTAG))
-        dt_remove_exif_geotag(exifData);
-      // calculated metadata
-      dt_variables_params_t *params;
-      dt_variables_params_init(&params);
-      params->filename = input_filename;
-      params->jobcode = "infos";
-      params->sequence = 0;
-      params->imgid = imgid;
+    _exif_xmp_read_data_export(xmpData, imgid, m);
 
-      dt_variables_set_tags_flags(params, m->flags);
-      for (GList *tags = m->list; tags; tags = g_list_next(tags))
+    if(!(m->flags & DT_META_GEOTAG))
+      dt_remove_exif_geotag(exifData);
+    // calculated metadata
+    dt_variables_params_t *params;
+    dt_variables_params_init(&params);
+    params->filename = input_filename;
+    params->jobcode = "infos";
+    params->sequence = 0;
+    params->imgid = imgid;
+
+    dt_variables_set_tags_flags(params, m->flags);
+    for (GList *tags = m->list; tags; tags = g_list_next(tags))
+    {
+      gchar *tagname = (gchar *)tags->data;
+      tags = g_list_next(tags);
+      if (!tags) break;
+      gchar *formula = (gchar *)tags->data;
+      if (formula[0])
       {
-        gchar *tagname = (gchar *)tags->data;
-        tags = g_list_next(tags);
-        if (!tags) break;
-        gchar *formula = (gchar *)tags->data;
-        if (formula[0])
+        if(!(m->flags & DT_META_EXIF) && (formula[0] == '=') && g_str_has_prefix(tagname, "Exif."))
         {
-          if(!(m->flags & DT_META_EXIF) && (formula[0] == '=') && g_str_has_prefix(tagname, "Exif."))
+          // remove this specific exif
+          Exiv2::ExifData::const_iterator pos;
+          if(_exif_read_exif_tag(exifOldData, &pos, tagname))
           {
-            // remove this specific exif
-            Exiv2::ExifData::const_iterator pos;
-            if(_exif_read_exif_tag(exifOldData, &pos, tagname))
-            {
-              exifData[tagname] = pos->value();
-            }
+            exifData[tagname] = pos->value();
           }
-          else
+        }
+        else
+        {
+          gchar *result = dt_variables_expand(params, formula, FALSE);
+          if(result && result[0])
           {
-            gchar *result = dt_variables_expand(params, formula, FALSE);
-            if(result && result[0])
+            if(g_str_has_prefix(tagname, "Xmp."))
             {
-              if(g_str_has_prefix(tagname, "Xmp."))
+              const char *type = _exif_get_exiv2_tag_type(tagname);
+              // if xmpBag or xmpSeq, split the list when necessary
+              // else provide the string as is (can be a list of strings)
+              if(!g_strcmp0(type, "XmpBag") || !g_strcmp0(type, "XmpSeq"))
               {
-                const char *type = _exif_get_exiv2_tag_type(tagname);
-                // if xmpBag or xmpSeq, split the list when necessary
-                // else provide the string as is (can be a list of strings)
-                if(!g_strcmp0(type, "XmpBag") || !g_strcmp0(type, "XmpSeq"))
+                char *tuple = g_strrstr(result, ",");
+                while(tuple)
                 {
-                  char *tuple = g_strrstr(result, ",");
-                  while(tuple)
-                  {
-                    tuple[0] = '\0';
-                    tuple++;
-                    xmpData[tagname] = tuple;
-                    tuple = g_strrstr(result, ",");
-                  }
+                  tuple[0] = '\0';
+                  tuple++;
+                  xmpData[tagname] = tuple;
+                  tuple = g_strrstr(result, ",");
                 }
-                xmpData[tagname] = result;
               }
-              else if(g_str_has_prefix(tagname, "Iptc."))
+              xmpData[tagname] = result;
+            }
+            else if(g_str_has_prefix(tagname, "Iptc."))
+            {
+              const char *type = _exif_get_exiv2_tag_type(tagname);
+              if(!g_strcmp0(type, "String-R"))
               {
-                const char *type = _exif_get_exiv2_tag_type(tagname);
-                if(!g_strcmp0(type, "String-R"))
+                // clean up the original tags before giving new values
+                dt_remove_iptc_key(iptcData, tagname);
+                // convert the input list (separator ", ") into different tags
+                // FIXME if an element of the list contains a ", " it is not correctly exported
+                Exiv2::IptcKey key(tagname);
+                Exiv2::Iptcdatum id(key);
+                gchar **values = g_strsplit(result, ", ", 0);
+                if(values)
                 {
-                  // clean up the original tags before giving new values
-                  dt_remove_iptc_key(iptcData, tagname);
-                  // convert the input list (separator ", ") into different tags
-                  // FIXME if an element of the list contains a ", " it is not correctly exported
-                  Exiv2::IptcKey key(tagname);
-                  Exiv2::Iptcdatum id(key);
-                  gchar **values = g_strsplit(result, ", ", 0);
-                  if(values)
+                  gchar **entry = values;
+                  while (*entry)
                   {
-                    gchar **entry = values;
-                    while (*entry)
+                    char *e = g_strstrip(*entry);
+                    if(*e)
                     {
-                      char *e = g_strstrip(*entry);
-                      if(*e)
-                      {
-                        id.setValue(e);
-                        iptcData.add(id);
-                      }
-                      entry++;
+                      id.setValue(e);
+                      iptcData.add(id);
                     }
+                    entry++;
                   }
-                g_strfreev(values);
                 }
-                else iptcData[tagname] = result;
+              g_strfreev(values);
               }
-              else if(g_str_has_prefix(tagname, "Exif."))
+              else iptcData[tagname] = result;
+            }
+            else if(g_str_has_prefix(tagname, "Exif."))
+            {
+              const char *type = _exif_get_exiv2_tag_type(tagname);
+              if((!g_strcmp0(type, "Rational") || !g_strcmp0(type, "SRational")) &&
+                 (g_strstr_len(result, strlen(result), "/") == NULL))
               {
-                const char *type = _exif_get_exiv2_tag_type(tagname);
-                if((!g_strcmp0(type, "Rational") || !g_strcmp0(type, "SRational")) &&
-                   (g_strstr_len(result, strlen(result), "/") == NULL))
+                float float_value = (float)std::atof(result);
+                if(!std::isnan(float_value))
                 {
-                  float float_value = (float)std::atof(result);
-                  if(!std::isnan(float_value))
+                  g_free(result);
+                  int int_value = (int)float_value;
+                  int divisor = 1;
+                  while(fabs(float_value - int_value) > 0.000001)
                   {
-                    g_free(result);
-                    int int_value = (int)float_value;
-                    int divisor = 1;
-                    while(fabs(float_value - int_value) > 0.000001)
-                    {
-                      divisor *= 10;
-                      float_value *= 10.0;
-                      int_value = (int)float_value;
-                    }
-                    result = g_strdup_printf("%d/%d", (int)float_value, divisor);
+                    divisor *= 10;
+                    float_value *= 10.0;
+                    int_value = (int)float_value;
                   }
+                  result = g_strdup_printf("%d/%d", (int)float_value, divisor);
                 }
-                exifData[tagname] = result;
               }
+              exifData[tagname] = result;
             }
-            g_free(result);
           }
-        }
-        else
-        {
-          if (g_str_has_prefix(tagname, "Xmp."))
-            dt_remove_xmp_key(xmpData, tagname);
-          else if (g_str_has_prefix(tagname, "Exif."))
-            dt_remove_exif_key(exifData, tagname);
-          else if (g_str_has_prefix(tagname, "Iptc."))
-            dt_remove_iptc_key(iptcData, tagname);
+          g_free(result);
         }
       }
-      dt_variables_params_destroy(params);
+      else
+      {
+        if (g_str_has_prefix(tagname, "Xmp."))
+          dt_remove_xmp_key(xmpData, tagname);
+        else if (g_str_has_prefix(tagname, "Exif."))
+          dt_remove_exif_key(exifData, tagname);
+        else if (g_str_has_prefix(tagname, "Iptc."))
+          dt_remove_iptc_key(iptcData, tagname);
+      }
     }
+    dt_variables_params_destroy(params);
+  }
+}
+
+int dt_exif_xmp_attach_export(const int imgid, const char *filename, void *metadata)
+{
+  dt_export_metadata_t *m = (dt_export_metadata_t *)metadata;
+  try
+  {
+    std::unique_ptr<Exiv2::Image> img(Exiv2::ImageFactory::open(WIDEN(filename)));
+    // unfortunately it seems we have to read the metadata, to not erase the exif (which we just wrote).
+    // will make export slightly slower, oh well.
+    // img->clearXmpPacket();
+    read_metadata_threadsafe(img);
+
+    Exiv2::XmpData &xmpData = img->xmpData();
+    _exif_export_data(imgid, m, img->exifData(), xmpData, img->iptcData());
 
     try
     {
@@ -4456,6 +4649,44 @@ int dt_exif_xmp_attach_export(const int imgid, const char *filename, void *metad
   }
 }
 
+char *dt_exif_xmp_export_packet(const int imgid, void *metadata, uint8_t **exif, int *exif_len)
+{
+  dt_export_metadata_t *m = (dt_export_metadata_t *)metadata;
+  try
+  {
+    Exiv2::ExifData exifData;
+    if(*exif && *exif_len > 0) Exiv2::ExifParser::decode(exifData, *exif, *exif_len);
+    Exiv2::XmpData xmpData;
+    Exiv2::IptcData iptcData;
+    _exif_export_data(imgid, m, exifData, xmpData, iptcData);
+
+    // iptc goes to a container specific block, and a packet too large for a jpeg segment loses the history
+    // in dt_exif_xmp_attach_export(). both are left to exiv2.
+    if(!iptcData.empty()) return NULL;
+    std::string xmpPacket;
+    if(Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0 || xmpPacket.size() > DT_EXIF_XMP_PACKET_MAX) return NULL;
+
+    Exiv2::Blob blob;
+    if(!exifData.empty()) Exiv2::ExifParser::encode(blob, Exiv2::bigEndian, exifData);
+    uint8_t *buf = NULL;
+    if(!blob.empty())
+    {
+      buf = (uint8_t *)malloc(blob.size());
+      if(!buf) return NULL;
+      memcpy(buf, &(blob[0]), blob.size());
+    }
+    free(*exif);
+    *exif = buf;
+    *exif_len = blob.size();
+    return g_strdup(xmpPacket.c_str());
+  }
+  catch(Exiv2::AnyError &e)
+  {
+    std::cerr << "[dt_exif_xmp_export_packet] " << imgid << ": caught exiv2 exception '" << e << "'\n";
+    return NULL;
+  }
+}
+
 // write xmp sidecar file:
 int dt_exif_xmp_write(const int imgid, const char *filename)
 {
@@ -4672,6 +4903,12 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+
+  g_mutex_lock(&_previews_lock);
+  g_queue_foreach(&_previews, (GFunc)_preview_free, NULL);
+  g_queue_clear(&_previews);
+  _previews_size = 0;
+  g_mutex_unlock(&_previews_lock);
 }
 
 // clang-format off
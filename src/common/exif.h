@@ -84,6 +84,14 @@ int dt_exif_xmp_write(const int imgid, const char *filename);
 /** write xmp packet inside an image. */
 int dt_exif_xmp_attach_export(const int imgid, const char *filename, void *metadata);
 
+/** the largest xmp packet fitting in a jpeg APP1 segment, after the namespace */
+#define DT_EXIF_XMP_PACKET_MAX 65504
+
+/** the xmp packet dt_exif_xmp_attach_export() would write for imgid, for formats embedding it themselves. the
+    exif blob is replaced by the one to go with it. returns NULL, leaving the blob alone, when the metadata needs
+    dt_exif_xmp_attach_export(). free with g_free(). */
+char *dt_exif_xmp_export_packet(const int imgid, void *metadata, uint8_t **exif, int *exif_len);
+
 /** get the xmp blob for imgid. */
 char *dt_exif_xmp_read_string(const int imgid);
 
@@ -0,0 +1,592 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/exif_header.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the first read, the header of nearly all files fits in there
+#define DT_EXIF_HEADER_FIRST_READ (64 * 1024)
+// never read further than this into a file
+#define DT_EXIF_HEADER_MAX_READ (1024 * 1024)
+// more entries than this is no ifd we want to decode
+#define DT_EXIF_HEADER_MAX_ENTRIES 256
+// exiv2 looks for the primary image in that many sub-ifds
+#define DT_EXIF_HEADER_MAX_SUBIFDS 9
+
+// tiff field types
+enum
+{
+  _BYTE = 1,
+  _ASCII = 2,
+  _SHORT = 3,
+  _LONG = 4,
+  _RATIONAL = 5,
+  _SBYTE = 6,
+  _UNDEFINED = 7,
+  _SSHORT = 8,
+  _SLONG = 9,
+  _SRATIONAL = 10,
+  _FLOAT = 11,
+  _DOUBLE = 12,
+  _IFD = 13
+};
+
+static const int _type_size[] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8, 4 };
+
+// makers whose lens, focus distance or iso exiv2 takes from the maker notes
+static const char *_makernote_makers[]
+    = { "Canon", "NIKON", "SONY", "Minolta", "KONICA MINOLTA", "PENTAX", "RICOH", "OLYMPUS", "OM Digital",
+        "Panasonic", "LEICA", "SAMSUNG", "CASIO", "SIGMA", NULL };
+
+typedef struct _reader_t
+{
+  FILE *f;            // NULL once everything there is to read is in data
+  const uint8_t *data;
+  uint8_t *buf;       // data read from f
+  size_t len;
+  size_t alloc;
+} _reader_t;
+
+typedef struct _tiff_t
+{
+  _reader_t *r;
+  size_t base;        // offset of the tiff header in the file, ifd offsets are relative to it
+  gboolean motorola;  // big endian
+} _tiff_t;
+
+typedef struct _entry_t
+{
+  uint16_t tag;
+  uint16_t type;
+  uint32_t count;
+  size_t offset;      // of the value in the file
+  uint64_t size;
+} _entry_t;
+
+typedef struct _ifd_t
+{
+  int count;
+  uint32_t next;
+  _entry_t entries[DT_EXIF_HEADER_MAX_ENTRIES];
+} _ifd_t;
+
+// make [offset, offset + size) available, reading more of the file if needed
+static gboolean _reader_has(_reader_t *r, const size_t offset, const uint64_t size)
+{
+  if(size > DT_EXIF_HEADER_MAX_READ || offset > DT_EXIF_HEADER_MAX_READ - size) return FALSE;
+  const size_t end = offset + size;
+  if(end <= r->len) return TRUE;
+  if(!r->f) return FALSE;
+
+  size_t alloc = MAX(r->alloc, DT_EXIF_HEADER_FIRST_READ);
+  while(alloc < end) alloc *= 2;
+  alloc = MIN(alloc, DT_EXIF_HEADER_MAX_READ);
+  r->buf = g_realloc(r->buf, alloc);
+  r->alloc = alloc;
+  r->data = r->buf;
+
+  const size_t got = fread(r->buf + r->len, 1, r->alloc - r->len, r->f);
+  r->len += got;
+  if(r->len < r->alloc) r->f = NULL;
+  return end <= r->len;
+}
+
+static uint16_t _get16(const _tiff_t *t, const size_t offset)
+{
+  const uint8_t *p = t->r->data + offset;
+  return t->motorola ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static uint32_t _get32(const _tiff_t *t, const size_t offset)
+{
+  const uint8_t *p = t->r->data + offset;
+  return t->motorola ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+                     : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static gboolean _tiff_read_ifd(const _tiff_t *t, const uint32_t offset, _ifd_t *ifd)
+{
+  const size_t at = t->base + offset;
+  ifd->count = 0;
+  ifd->next = 0;
+  if(offset == 0 || !_reader_has(t->r, at, 2)) return FALSE;
+
+  const int n = _get16(t, at);
+  if(n > DT_EXIF_HEADER_MAX_ENTRIES || !_reader_has(t->r, at + 2, 12 * n + 4)) return FALSE;
+
+  for(int k = 0; k < n; k++)
+  {
+    const size_t e = at + 2 + 12 * k;
+    _entry_t *entry = ifd->entries + ifd->count;
+    entry->tag = _get16(t, e);
+    entry->type = _get16(t, e + 2);
+    entry->count = _get32(t, e + 4);
+    if(entry->type >= G_N_ELEMENTS(_type_size) || _type_size[entry->type] == 0) continue;
+
+    entry->size = (uint64_t)_type_size[entry->type] * entry->count;
+    entry->offset = entry->size <= 4 ? e + 8 : t->base + _get32(t, e + 8);
+    ifd->count++;
+  }
+  ifd->next = _get32(t, at + 2 + 12 * n);
+  return TRUE;
+}
+
+static const _entry_t *_ifd_find(const _ifd_t *ifd, const uint16_t tag)
+{
+  for(int k = 0; k < ifd->count; k++)
+    if(ifd->entries[k].tag == tag) return ifd->entries + k;
+  return NULL;
+}
+
+// the tag from the first ifd which has it
+static const _entry_t *_ifd_find2(const _ifd_t *first, const _ifd_t *second, const uint16_t tag)
+{
+  const _entry_t *e = _ifd_find(first, tag);
+  return e ? e : _ifd_find(second, tag);
+}
+
+static gboolean _entry_rational(const _tiff_t *t, const _entry_t *e, const uint32_t i, double *num, double *den)
+{
+  if(!e || i >= e->count || (e->type != _RATIONAL && e->type != _SRATIONAL)
+     || !_reader_has(t->r, e->offset, e->size))
+    return FALSE;
+  const size_t at = e->offset + 8 * (size_t)i;
+  if(e->type == _RATIONAL)
+  {
+    *num = _get32(t, at);
+    *den = _get32(t, at + 4);
+  }
+  else
+  {
+    *num = (int32_t)_get32(t, at);
+    *den = (int32_t)_get32(t, at + 4);
+  }
+  return TRUE;
+}
+
+// value number i of a numerical entry, the way exiv2's toFloat() gives it
+static gboolean _entry_number(const _tiff_t *t, const _entry_t *e, const uint32_t i, float *value)
+{
+  if(!e || i >= e->count || !_reader_has(t->r, e->offset, e->size)) return FALSE;
+
+  const size_t at = e->offset + (size_t)_type_size[e->type] * i;
+  switch(e->type)
+  {
+    case _BYTE:
+    case _UNDEFINED:
+      *value = t->r->data[at];
+      return TRUE;
+    case _SBYTE:
+      *value = (int8_t)t->r->data[at];
+      return TRUE;
+    case _SHORT:
+      *value = _get16(t, at);
+      return TRUE;
+    case _SSHORT:
+      *value = (int16_t)_get16(t, at);
+      return TRUE;
+    case _LONG:
+    case _IFD:
+      *value = _get32(t, at);
+      return TRUE;
+    case _SLONG:
+      *value = (int32_t)_get32(t, at);
+      return TRUE;
+    case _RATIONAL:
+    case _SRATIONAL:
+    {
+      double num, den;
+      _entry_rational(t, e, i, &num, &den);
+      *value = den != 0.0 ? num / den : 0.0f;
+      return TRUE;
+    }
+    case _FLOAT:
+    {
+      union { uint32_t i; float f; } u = { .i = _get32(t, at) };
+      *value = u.f;
+      return TRUE;
+    }
+    case _DOUBLE:
+    {
+      const uint64_t hi = _get32(t, at + (t->motorola ? 0 : 4));
+      const uint64_t lo = _get32(t, at + (t->motorola ? 4 : 0));
+      union { uint64_t i; double d; } u = { .i = (hi << 32) | lo };
+      *value = u.d;
+      return TRUE;
+    }
+    default:
+      return FALSE;
+  }
+}
+
+// value number i of an offset or size entry
+static gboolean _entry_uint(const _tiff_t *t, const _entry_t *e, const uint32_t i, uint32_t *value)
+{
+  if(!e || i >= e->count || !_reader_has(t->r, e->offset, e->size)) return FALSE;
+  const size_t at = e->offset + (size_t)_type_size[e->type] * i;
+  if(e->type == _SHORT)
+    *value = _get16(t, at);
+  else if(e->type == _LONG || e->type == _IFD)
+    *value = _get32(t, at);
+  else
+    return FALSE;
+  return TRUE;
+}
+
+// text of an entry up to its first nul, converted to utf-8 as dt_strlcpy_to_utf8() does
+static gchar *_entry_string(const _tiff_t *t, const _entry_t *e)
+{
+  if(!e || (e->type != _ASCII && e->type != _BYTE && e->type != _UNDEFINED)
+     || !_reader_has(t->r, e->offset, e->size))
+    return NULL;
+  const char *s = (const char *)t->r->data + e->offset;
+  const size_t len = strnlen(s, e->count);
+  gchar *utf8 = g_locale_to_utf8(s, len, NULL, NULL, NULL);
+  return utf8 ? utf8 : g_strndup(s, len);
+}
+
+static gboolean _entry_copy_string(const _tiff_t *t, const _entry_t *e, char *dest, const size_t dest_size)
+{
+  gchar *s = _entry_string(t, e);
+  if(s) g_strlcpy(dest, s, dest_size);
+  g_free(s);
+  return s != NULL;
+}
+
+static void _strip_trailing_spaces(char *s)
+{
+  for(size_t len = strlen(s); len > 0 && s[len - 1] == ' '; len--) s[len - 1] = '\0';
+}
+
+// the user comment as exiv2's CommentValue gives it. FALSE if that takes exiv2 (unicode, jis, binary)
+static gboolean _user_comment(const _tiff_t *t, const _entry_t *e, gchar **comment)
+{
+  if(e->count < 8 || !_reader_has(t->r, e->offset, e->size)) return FALSE;
+  const char *charset = (const char *)t->r->data + e->offset;
+  const char *text = charset + 8;
+  const size_t len = strnlen(text, e->count - 8);
+
+  if(!memcmp(charset, "ASCII\0\0\0", 8))
+  {
+    *comment = g_strndup(text, len);
+    return TRUE;
+  }
+  // undefined charset, fine as long as it is empty
+  if(!memcmp(charset, "\0\0\0\0\0\0\0\0", 8))
+  {
+    for(size_t k = 0; k < e->count - 8; k++)
+      if(text[k] != '\0' && text[k] != ' ') return FALSE;
+    *comment = g_strdup("");
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static gboolean _needs_makernote(const char *maker)
+{
+  for(const char **m = _makernote_makers; *m; m++)
+    if(!g_ascii_strncasecmp(maker, *m, strlen(*m))) return TRUE;
+  return FALSE;
+}
+
+static void _tiff_read_gps(const _tiff_t *t, const _ifd_t *gps, dt_exif_header_t *h)
+{
+  double r[6];
+  gchar *ref = _entry_string(t, _ifd_find(gps, 0x0001));
+  const _entry_t *lat = _ifd_find(gps, 0x0002);
+  if(ref && lat && lat->count == 3 && _entry_rational(t, lat, 0, r, r + 1)
+     && _entry_rational(t, lat, 1, r + 2, r + 3) && _entry_rational(t, lat, 2, r + 4, r + 5))
+  {
+    memcpy(h->gps_latitude, r, sizeof(r));
+    h->gps_latitude_ref = ref[0];
+    h->has_latitude = TRUE;
+  }
+  g_free(ref);
+
+  ref = _entry_string(t, _ifd_find(gps, 0x0003));
+  const _entry_t *lon = _ifd_find(gps, 0x0004);
+  if(ref && lon && lon->count == 3 && _entry_rational(t, lon, 0, r, r + 1)
+     && _entry_rational(t, lon, 1, r + 2, r + 3) && _entry_rational(t, lon, 2, r + 4, r + 5))
+  {
+    memcpy(h->gps_longitude, r, sizeof(r));
+    h->gps_longitude_ref = ref[0];
+    h->has_longitude = TRUE;
+  }
+  g_free(ref);
+
+  // the altitude reference is a byte, exiv2 prints it as a digit
+  float alt_ref;
+  if(_entry_number(t, _ifd_find(gps, 0x0005), 0, &alt_ref)
+     && _entry_rational(t, _ifd_find(gps, 0x0006), 0, r, r + 1))
+  {
+    memcpy(h->gps_elevation, r, 2 * sizeof(double));
+    h->gps_elevation_ref = '0' + (int)alt_ref;
+    h->has_elevation = TRUE;
+  }
+}
+
+static gboolean _tiff_parse(_tiff_t *t, dt_exif_header_t *h)
+{
+  if(!_reader_has(t->r, t->base, 8)) return FALSE;
+  const uint8_t *p = t->r->data + t->base;
+  if(p[0] == 'I' && p[1] == 'I')
+    t->motorola = FALSE;
+  else if(p[0] == 'M' && p[1] == 'M')
+    t->motorola = TRUE;
+  else
+    return FALSE;
+  // the variants of orf and rw2 keep their exif elsewhere
+  if(_get16(t, t->base + 2) != 42) return FALSE;
+
+  _ifd_t *ifd0 = g_new(_ifd_t, 1);
+  _ifd_t *ifd = g_new(_ifd_t, 1);
+  gboolean ok = FALSE;
+
+  if(!_tiff_read_ifd(t, _get32(t, t->base + 4), ifd0)) goto end;
+
+  // xmp, iptc, photoshop resources and dng tags are exiv2's
+  if(_ifd_find(ifd0, 0x02BC) || _ifd_find(ifd0, 0x83BB) || _ifd_find(ifd0, 0x8649) || _ifd_find(ifd0, 0xC612))
+    goto end;
+
+  if(!_entry_copy_string(t, _ifd_find(ifd0, 0x010F), h->maker, sizeof(h->maker))
+     || !_entry_copy_string(t, _ifd_find(ifd0, 0x0110), h->model, sizeof(h->model)))
+    goto end;
+  _strip_trailing_spaces(h->maker);
+  _strip_trailing_spaces(h->model);
+
+  float value;
+  if(_entry_number(t, _ifd_find(ifd0, 0x0112), 0, &value)) h->orientation = value;
+
+  h->artist = _entry_string(t, _ifd_find(ifd0, 0x013B));
+  h->copyright = _entry_string(t, _ifd_find(ifd0, 0x8298));
+  h->description = _entry_string(t, _ifd_find(ifd0, 0x010E));
+
+  if(_entry_number(t, _ifd_find(ifd0, 0x4746), 0, &value))
+    h->rating = value;
+  else if(_entry_number(t, _ifd_find(ifd0, 0x4749), 0, &value))
+    h->rating = (int)value * 5. / 100;
+
+  // the primary image, where exiv2 takes the pixel size from: the first of the image and its sub-images
+  // flagged as such, the image otherwise
+  float subfile_type;
+  gboolean found_primary = _entry_number(t, _ifd_find(ifd0, 0x00FE), 0, &subfile_type) && subfile_type == 0;
+  gboolean primary_is_subifd = FALSE;
+  if(!found_primary)
+  {
+    const _entry_t *subifds = _ifd_find(ifd0, 0x014A);
+    const uint32_t n = subifds ? MIN(subifds->count, DT_EXIF_HEADER_MAX_SUBIFDS) : 0;
+    for(uint32_t k = 0; k < n && !found_primary; k++)
+    {
+      uint32_t offset;
+      if(_entry_uint(t, subifds, k, &offset) && _tiff_read_ifd(t, offset, ifd)
+         && _entry_number(t, _ifd_find(ifd, 0x00FE), 0, &subfile_type) && subfile_type == 0)
+      {
+        found_primary = primary_is_subifd = TRUE;
+        _entry_uint(t, _ifd_find(ifd, 0x0100), 0, &h->width);
+        _entry_uint(t, _ifd_find(ifd, 0x0101), 0, &h->height);
+      }
+    }
+  }
+  if(!primary_is_subifd)
+  {
+    _entry_uint(t, _ifd_find(ifd0, 0x0100), 0, &h->width);
+    _entry_uint(t, _ifd_find(ifd0, 0x0101), 0, &h->height);
+  }
+
+  // some backs keep the orientation of the raw in the thumbnail ifd
+  if(_tiff_read_ifd(t, ifd0->next, ifd) && _entry_number(t, _ifd_find(ifd, 0x0106), 0, &value) && value == 32803)
+    goto end;
+
+  uint32_t offset;
+  if(!_entry_uint(t, _ifd_find(ifd0, 0x8769), 0, &offset) || !_tiff_read_ifd(t, offset, ifd)) goto end;
+  const _ifd_t *exif = ifd;
+
+  if(_ifd_find(exif, 0x927C) && _needs_makernote(h->maker)) goto end;
+
+  // exiv2 looks at the exif ifd before the image one, except for the date
+  const _entry_t *e = _ifd_find2(ifd0, exif, 0x9003);
+  if(!e || e->count != sizeof(h->datetime) || !_entry_copy_string(t, e, h->datetime, sizeof(h->datetime)))
+    goto end;
+  e = _ifd_find(exif, 0x9291);
+  if(e && e->count > 1) _entry_copy_string(t, e, h->subsec, sizeof(h->subsec));
+
+  if(!_entry_number(t, _ifd_find2(exif, ifd0, 0x829A), 0, &h->exposure)
+     || !_entry_number(t, _ifd_find2(exif, ifd0, 0x829D), 0, &h->aperture)
+     || !_entry_number(t, _ifd_find2(exif, ifd0, 0x920A), 0, &h->focal_length))
+    goto end;
+
+  // a pair for the lo and hi modes of some cameras
+  e = _ifd_find(exif, 0x8827);
+  if(!_entry_number(t, e, e && e->count > 1 ? 1 : 0, &h->iso) && !_entry_number(t, _ifd_find(ifd0, 0x8827), 0, &h->iso))
+    goto end;
+  // out of range of the tag, exiv2 knows where the camera put it
+  if(h->iso == 0.0f || h->iso == 65535.0f) goto end;
+
+  if(!_entry_copy_string(t, _ifd_find(exif, 0xA434), h->lens, sizeof(h->lens)) || !h->lens[0]) goto end;
+
+  h->has_exposure_bias = _entry_number(t, _ifd_find2(exif, ifd0, 0x9204), 0, &h->exposure_bias);
+  if(!_entry_number(t, _ifd_find2(exif, ifd0, 0x9206), 0, &h->subject_distance)) h->subject_distance = -1.0f;
+  h->has_focal_length_35mm = _entry_number(t, _ifd_find(exif, 0xA405), 0, &h->focal_length_35mm);
+  h->has_focal_plane_resolution = _ifd_find(exif, 0xA20E) != NULL;
+
+  if(_entry_number(t, _ifd_find(exif, 0xA001), 0, &value))
+  {
+    h->colorspace = value;
+    // uncalibrated, exiv2 decodes the interoperability ifd
+    if(h->colorspace == 0xffff) goto end;
+  }
+
+  e = _ifd_find(exif, 0x9286);
+  if(e)
+  {
+    g_free(h->description);
+    h->description = NULL;
+    if(!_user_comment(t, e, &h->description)) goto end;
+    h->has_user_comment = TRUE;
+  }
+
+  if(_entry_uint(t, _ifd_find(ifd0, 0x8825), 0, &offset) && _tiff_read_ifd(t, offset, ifd))
+    _tiff_read_gps(t, ifd, h);
+
+  ok = TRUE;
+
+end:
+  g_free(ifd0);
+  g_free(ifd);
+  return ok;
+}
+
+static gboolean _jpeg_parse(_reader_t *r, dt_exif_header_t *h)
+{
+  _tiff_t tiff = { .r = r };
+  gboolean has_exif = FALSE;
+  size_t pos = 2;
+
+  while(_reader_has(r, pos, 4))
+  {
+    if(r->data[pos] != 0xFF) return FALSE;
+    const uint8_t marker = r->data[pos + 1];
+    // fill bytes and markers without segment
+    if(marker == 0xFF)
+    {
+      pos++;
+      continue;
+    }
+    if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+    {
+      pos += 2;
+      continue;
+    }
+
+    const size_t seg = pos + 4;
+    const size_t seg_len = (r->data[pos + 2] << 8) | r->data[pos + 3];
+    if(seg_len < 2) return FALSE;
+    const size_t data_len = seg_len - 2;
+
+    if(marker == 0xE1 && !has_exif && data_len > 6 && _reader_has(r, seg, 6) && !memcmp(r->data + seg, "Exif\0\0", 6))
+    {
+      tiff.base = seg + 6;
+      if(!_tiff_parse(&tiff, h)) return FALSE;
+      has_exif = TRUE;
+    }
+    else if(marker == 0xE1)
+    {
+      // xmp, in any of its forms, is exiv2's
+      static const char xmp[] = "http://ns.adobe.com/";
+      if(_reader_has(r, seg, sizeof(xmp) - 1) && !memcmp(r->data + seg, xmp, sizeof(xmp) - 1)) return FALSE;
+    }
+    // photoshop resources, with the iptc in them
+    else if(marker == 0xED)
+      return FALSE;
+    else if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+    {
+      // start of frame, the header ends here
+      if(!_reader_has(r, seg, 5)) return FALSE;
+      h->height = (r->data[seg + 1] << 8) | r->data[seg + 2];
+      h->width = (r->data[seg + 3] << 8) | r->data[seg + 4];
+      return has_exif;
+    }
+    else if(marker == 0xDA || marker == 0xD9)
+      return has_exif;
+
+    pos = seg + data_len;
+  }
+  return FALSE;
+}
+
+static gboolean _parse(_reader_t *r, dt_exif_header_t *h)
+{
+  memset(h, 0, sizeof(dt_exif_header_t));
+  h->rating = -2;
+  h->subject_distance = -1.0f;
+
+  gboolean ok = FALSE;
+  if(_reader_has(r, 0, 4))
+  {
+    if(r->data[0] == 0xFF && r->data[1] == 0xD8)
+      ok = _jpeg_parse(r, h);
+    else
+    {
+      _tiff_t tiff = { .r = r, .base = 0 };
+      ok = _tiff_parse(&tiff, h);
+    }
+  }
+
+  if(!ok) dt_exif_header_cleanup(h);
+  return ok;
+}
+
+gboolean dt_exif_header_parse(dt_exif_header_t *h, const uint8_t *data, const size_t size)
+{
+  _reader_t r = { .data = data, .len = size };
+  return _parse(&r, h);
+}
+
+gboolean dt_exif_header_read(dt_exif_header_t *h, const char *filename)
+{
+  FILE *f = g_fopen(filename, "rb");
+  if(!f)
+  {
+    memset(h, 0, sizeof(dt_exif_header_t));
+    return FALSE;
+  }
+
+  _reader_t r = { .f = f };
+  const gboolean ok = _parse(&r, h);
+  g_free(r.buf);
+  fclose(f);
+  return ok;
+}
+
+void dt_exif_header_cleanup(dt_exif_header_t *h)
+{
+  g_free(h->artist);
+  g_free(h->copyright);
+  g_free(h->description);
+  h->artist = h->copyright = h->description = NULL;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,73 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+// reader of the plain exif header of tiff based files and jpegs, for the fields kept in main.images.
+// it only reads the beginning of the file, in bounded chunks, and only decodes the standard ifds (image,
+// exif, gps). whenever a field is missing, or the file carries data only exiv2 can decode the way the
+// rest of dt expects it (maker notes of the makers whose lens and focus distance come from there, dng
+// tags, embedded xmp or iptc...), it gives up and the file has to go through exiv2.
+
+typedef struct dt_exif_header_t
+{
+  char maker[64];
+  char model[64];
+  char lens[128];
+  char datetime[20]; // exif format, DT_DATETIME_EXIF_LENGTH
+  char subsec[4];
+  float exposure;
+  float exposure_bias;
+  float aperture;
+  float iso;
+  float focal_length;
+  float focal_length_35mm;     // 0 if not set
+  float subject_distance;      // < 0 if not set
+  int orientation;             // exif orientation, 0 if not set
+  int rating;                  // stars, -2 if not set
+  int colorspace;              // Exif.Photo.ColorSpace, 0 if not set
+  gboolean has_exposure_bias;
+  gboolean has_focal_length_35mm;
+  gboolean has_focal_plane_resolution;
+  // gps rationals (degrees, minutes, seconds as numerator, denominator) and their reference
+  gboolean has_latitude, has_longitude, has_elevation;
+  double gps_latitude[6], gps_longitude[6], gps_elevation[2];
+  char gps_latitude_ref, gps_longitude_ref, gps_elevation_ref;
+  // NULL if not set, else to be freed by dt_exif_header_cleanup()
+  gchar *artist;
+  gchar *copyright;
+  gchar *description;
+  gboolean has_user_comment;   // description comes from the user comment then, even if empty
+  uint32_t width, height;      // pixel size as exiv2 reports it, 0 if unknown
+} dt_exif_header_t;
+
+// fill h from the header of the file. returns FALSE if exiv2 has to read it, h is cleaned up then
+gboolean dt_exif_header_read(dt_exif_header_t *h, const char *filename);
+// same from a buffer holding the start of a file
+gboolean dt_exif_header_parse(dt_exif_header_t *h, const uint8_t *data, const size_t size);
+void dt_exif_header_cleanup(dt_exif_header_t *h);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,273 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_cache.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "control/conf.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static void _checksum_int(GChecksum *sum, const int64_t value)
+{
+  g_checksum_update(sum, (const guchar *)&value, sizeof(value));
+}
+
+static void _checksum_string(GChecksum *sum, const char *str)
+{
+  // include the terminating 0 so that consecutive strings can't be confused
+  if(str) g_checksum_update(sum, (const guchar *)str, strlen(str) + 1);
+  else g_checksum_update(sum, (const guchar *)"", 1);
+}
+
+static void _checksum_column(GChecksum *sum, sqlite3_stmt *stmt, const int col)
+{
+  _checksum_int(sum, sqlite3_column_type(stmt, col));
+  const int len = sqlite3_column_bytes(stmt, col);
+  const void *buf = sqlite3_column_blob(stmt, col);
+  _checksum_int(sum, len);
+  if(buf && len > 0) g_checksum_update(sum, (const guchar *)buf, len);
+}
+
+// everything of the image going into the output: source file, history, module order and exif metadata.
+// returns FALSE if the source file is missing
+static gboolean _checksum_image(GChecksum *sum, const int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT f.folder || '" G_DIR_SEPARATOR_S "' || i.filename,"
+                              "       h.current_hash, o.version, o.iop_list,"
+                              "       i.flags, i.datetime_taken, i.longitude, i.latitude, i.altitude,"
+                              "       (SELECT GROUP_CONCAT(tagid) FROM main.tagged_images WHERE imgid = i.id),"
+                              "       (SELECT GROUP_CONCAT(key || '=' || value, '\n')"
+                              "          FROM main.meta_data WHERE id = i.id),"
+                              "       (SELECT GROUP_CONCAT(color) FROM main.color_labels WHERE imgid = i.id)"
+                              " FROM main.images AS i"
+                              " JOIN main.film_rolls AS f ON f.id = i.film_id"
+                              " LEFT JOIN main.history_hash AS h ON h.imgid = i.id"
+                              " LEFT JOIN main.module_order AS o ON o.imgid = i.id"
+                              " WHERE i.id = ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  gboolean found = FALSE;
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *path = (const char *)sqlite3_column_text(stmt, 0);
+    // the source file is identified by its path, size and modification time, reading it all to hash its
+    // content would cost about as much as decoding it
+    GStatBuf st;
+    if(path && !g_stat(path, &st))
+    {
+      _checksum_string(sum, path);
+      _checksum_int(sum, st.st_size);
+      _checksum_int(sum, st.st_mtime);
+      for(int col = 1; col < sqlite3_column_count(stmt); col++) _checksum_column(sum, stmt, col);
+      found = TRUE;
+    }
+  }
+  sqlite3_finalize(stmt);
+  return found;
+}
+
+// the content of the style applied on export, it can be edited under the same name
+static void _checksum_style(GChecksum *sum, const char *name)
+{
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT si.num, si.module, si.operation, si.op_params, si.enabled,"
+                              "       si.blendop_params, si.blendop_version, si.multi_priority, si.multi_name,"
+                              "       s.iop_list"
+                              " FROM data.styles AS s"
+                              " JOIN data.style_items AS si ON si.styleid = s.id"
+                              " WHERE s.name = ?1"
+                              " ORDER BY si.num",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, -1, SQLITE_TRANSIENT);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    for(int col = 0; col < sqlite3_column_count(stmt); col++) _checksum_column(sum, stmt, col);
+  sqlite3_finalize(stmt);
+}
+
+gchar *dt_export_cache_key(const int32_t imgid, dt_imageio_module_format_t *format,
+                           dt_imageio_module_data_t *format_params, const gboolean ignore_exif,
+                           const gboolean high_quality, const gboolean is_scaling, const gboolean copy_metadata,
+                           const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type,
+                           const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                           dt_export_metadata_t *metadata)
+{
+  if(dt_conf_is_equal("plugins/lighttable/export/cache", "off")) return NULL;
+
+  GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+  if(!_checksum_image(sum, imgid))
+  {
+    g_checksum_free(sum);
+    return NULL;
+  }
+
+  // the pipeline itself may change between versions
+  _checksum_string(sum, darktable_package_version);
+
+  // format and its parameters, as they are serialized for the presets. the output size in the common header
+  // is set by the export itself.
+  _checksum_string(sum, format->plugin_name);
+  const size_t params_size = format->params_size(format);
+  guchar *params = g_malloc(params_size);
+  memcpy(params, format_params, params_size);
+  dt_imageio_module_data_t *header = (dt_imageio_module_data_t *)params;
+  header->width = header->height = 0;
+  g_checksum_update(sum, params, params_size);
+  g_free(params);
+  if(format_params->style[0] != '\0') _checksum_style(sum, format_params->style);
+
+  _checksum_int(sum, ignore_exif);
+  _checksum_int(sum, high_quality);
+  _checksum_int(sum, copy_metadata);
+  _checksum_int(sum, export_masks);
+  _checksum_int(sum, is_scaling);
+  if(is_scaling)
+  {
+    gchar *factor = dt_conf_get_string("plugins/lighttable/export/resizing_factor");
+    _checksum_string(sum, factor);
+    g_free(factor);
+  }
+  _checksum_int(sum, dt_conf_get_bool("plugins/lighttable/export/early_downscale"));
+  _checksum_int(sum, dt_conf_get_bool("plugins/lighttable/export/performance_profile"));
+  _checksum_int(sum, icc_type);
+  _checksum_string(sum, icc_filename);
+  _checksum_int(sum, icc_intent);
+  if(metadata)
+  {
+    _checksum_int(sum, metadata->flags);
+    for(const GList *l = metadata->list; l; l = g_list_next(l)) _checksum_string(sum, (const char *)l->data);
+  }
+
+  gchar *key = g_strdup(g_checksum_get_string(sum));
+  g_checksum_free(sum);
+  return key;
+}
+
+static void _export_cache_forget(const char *key)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.export_cache WHERE hash = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+gboolean dt_export_cache_reuse(const char *key, const char *filename, int *width, int *height)
+{
+  if(!key) return FALSE;
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT filename, size, mtime, width, height"
+                              " FROM main.export_cache"
+                              " WHERE hash = ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) != SQLITE_ROW)
+  {
+    sqlite3_finalize(stmt);
+    return FALSE;
+  }
+  gchar *cached = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+  const int64_t size = sqlite3_column_int64(stmt, 1);
+  const int64_t mtime = sqlite3_column_int64(stmt, 2);
+  *width = sqlite3_column_int(stmt, 3);
+  *height = sqlite3_column_int(stmt, 4);
+  sqlite3_finalize(stmt);
+
+  // the cached file may have been deleted or edited since
+  GStatBuf st;
+  if(!cached || g_stat(cached, &st) || st.st_size != size || st.st_mtime != mtime)
+  {
+    _export_cache_forget(key);
+    g_free(cached);
+    return FALSE;
+  }
+
+  gboolean done = !strcmp(cached, filename);
+  if(!done)
+  {
+    g_unlink(filename);
+#ifndef _WIN32
+    // a hard link keeps the modification time, so the entry stays valid through both files
+    if(dt_conf_is_equal("plugins/lighttable/export/cache", "hard link")) done = !link(cached, filename);
+#endif
+  }
+  if(!done)
+  {
+    GFile *src = g_file_new_for_path(cached);
+    GFile *dest = g_file_new_for_path(filename);
+    done = g_file_copy(src, dest, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, NULL);
+    g_object_unref(src);
+    g_object_unref(dest);
+  }
+
+  dt_print(DT_DEBUG_IMAGEIO, "[export_cache] %s `%s' from `%s'\n", done ? "reused" : "failed to reuse", filename,
+           cached);
+  g_free(cached);
+  return done;
+}
+
+void dt_export_cache_store(const char *key, const int32_t imgid, const char *filename, const int width,
+                           const int height)
+{
+  if(!key) return;
+
+  GStatBuf st;
+  if(g_stat(filename, &st)) return;
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO main.export_cache"
+                              " (hash, imgid, filename, size, mtime, width, height)"
+                              " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, filename, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT64(stmt, 4, st.st_size);
+  DT_DEBUG_SQLITE3_BIND_INT64(stmt, 5, st.st_mtime);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 6, width);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 7, height);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
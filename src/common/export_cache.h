@@ -0,0 +1,53 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+#include "common/imageio_module.h"
+#include "common/metadata_export.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+// cache of exported files, addressed by everything that makes up their content: the source file, the
+// history and module order, the image metadata going to exif and the export settings.
+// an export whose key is known reuses the file written last time, by hard link or copy, as long as that
+// file is still there and unchanged. entries live in main.export_cache.
+
+/** the key of an export of imgid with these settings, to be freed with g_free(). NULL when the cache is
+    disabled or can't be used for this export */
+gchar *dt_export_cache_key(const int32_t imgid, dt_imageio_module_format_t *format,
+                           dt_imageio_module_data_t *format_params, const gboolean ignore_exif,
+                           const gboolean high_quality, const gboolean is_scaling, const gboolean copy_metadata,
+                           const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type,
+                           const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                           dt_export_metadata_t *metadata);
+
+/** put the file cached under key at filename. returns TRUE and the size of the image on success */
+gboolean dt_export_cache_reuse(const char *key, const char *filename, int *width, int *height);
+
+/** record filename, just written, under key */
+void dt_export_cache_store(const char *key, const int32_t imgid, const char *filename, const int width,
+                           const int height);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,228 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_queue.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+
+#include <string.h>
+
+gboolean dt_export_queue_supported(dt_imageio_module_storage_t *storage)
+{
+  return storage && !storage->initialize_store && !storage->finalize_store;
+}
+
+int32_t dt_export_queue_add(const dt_export_queue_entry_t *entry)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  dt_database_start_transaction(darktable.db);
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "INSERT INTO main.export_queue"
+                              " (format, format_version, format_params, storage, storage_version, storage_params,"
+                              "  max_width, max_height, high_quality, export_masks, style, style_append,"
+                              "  icc_type, icc_filename, icc_intent, metadata)"
+                              " VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16)",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, entry->format, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, entry->format_version);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 3, entry->format_params, entry->format_size, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, entry->storage, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 5, entry->storage_version);
+  DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 6, entry->storage_params, entry->storage_size, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 7, entry->max_width);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 8, entry->max_height);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, entry->high_quality);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 10, entry->export_masks);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 11, entry->style, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, entry->style_append);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 13, entry->icc_type);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 14, entry->icc_filename, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 15, entry->icc_intent);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 16, entry->metadata_export, -1, SQLITE_TRANSIENT);
+  const gboolean inserted = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+
+  int32_t id = 0;
+  if(inserted)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT MAX(id) FROM main.export_queue", -1, &stmt, NULL);
+    if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+
+  if(id > 0)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "INSERT OR IGNORE INTO main.export_queue_images (queue_id, imgid, position, done)"
+                                " VALUES (?1, ?2, ?3, 0)",
+                                -1, &stmt, NULL);
+    int position = 0;
+    for(const GList *l = entry->imgs; l; l = g_list_next(l))
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, GPOINTER_TO_INT(l->data));
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, position++);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  dt_database_release_transaction(darktable.db);
+  return id;
+}
+
+void dt_export_queue_image_done(const int32_t id, const int32_t imgid)
+{
+  if(id <= 0) return;
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "UPDATE main.export_queue_images"
+                              " SET done = 1,"
+                              "     hash = (SELECT current_hash FROM main.history_hash WHERE imgid = ?2)"
+                              " WHERE queue_id = ?1 AND imgid = ?2",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+void dt_export_queue_remove(const int32_t id)
+{
+  if(id <= 0) return;
+
+  // the images go along through the foreign key
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "DELETE FROM main.export_queue WHERE id = ?1", -1,
+                              &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+static void *_column_blob(sqlite3_stmt *stmt, const int col, size_t *size)
+{
+  const void *blob = sqlite3_column_blob(stmt, col);
+  *size = sqlite3_column_bytes(stmt, col);
+  if(!blob || *size == 0) return NULL;
+  void *copy = g_malloc(*size);
+  memcpy(copy, blob, *size);
+  return copy;
+}
+
+// the images of the export id not written yet, or written with another history than the current one
+static GList *_pending_images(const int32_t id)
+{
+  GList *imgs = NULL;
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT q.imgid"
+                              " FROM main.export_queue_images AS q"
+                              " LEFT JOIN main.history_hash AS h ON h.imgid = q.imgid"
+                              " WHERE q.queue_id = ?1 AND (q.done = 0 OR q.hash IS NOT h.current_hash)"
+                              " ORDER BY q.position",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  while(sqlite3_step(stmt) == SQLITE_ROW) imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  return g_list_reverse(imgs);
+}
+
+GList *dt_export_queue_pending(void)
+{
+  GList *entries = NULL;
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id, format, format_version, format_params, storage, storage_version,"
+                              "       storage_params, max_width, max_height, high_quality, export_masks, style,"
+                              "       style_append, icc_type, icc_filename, icc_intent, metadata"
+                              " FROM main.export_queue"
+                              " ORDER BY id",
+                              -1, &stmt, NULL);
+  // clang-format on
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_export_queue_entry_t *entry = g_malloc0(sizeof(dt_export_queue_entry_t));
+    entry->id = sqlite3_column_int(stmt, 0);
+    g_strlcpy(entry->format, (const char *)sqlite3_column_text(stmt, 1), sizeof(entry->format));
+    entry->format_version = sqlite3_column_int(stmt, 2);
+    entry->format_params = _column_blob(stmt, 3, &entry->format_size);
+    g_strlcpy(entry->storage, (const char *)sqlite3_column_text(stmt, 4), sizeof(entry->storage));
+    entry->storage_version = sqlite3_column_int(stmt, 5);
+    entry->storage_params = _column_blob(stmt, 6, &entry->storage_size);
+    entry->max_width = sqlite3_column_int(stmt, 7);
+    entry->max_height = sqlite3_column_int(stmt, 8);
+    entry->high_quality = sqlite3_column_int(stmt, 9);
+    entry->export_masks = sqlite3_column_int(stmt, 10);
+    g_strlcpy(entry->style, (const char *)sqlite3_column_text(stmt, 11), sizeof(entry->style));
+    entry->style_append = sqlite3_column_int(stmt, 12);
+    entry->icc_type = sqlite3_column_int(stmt, 13);
+    entry->icc_filename = g_strdup((const char *)sqlite3_column_text(stmt, 14));
+    entry->icc_intent = sqlite3_column_int(stmt, 15);
+    entry->metadata_export = g_strdup((const char *)sqlite3_column_text(stmt, 16));
+    entries = g_list_prepend(entries, entry);
+  }
+  sqlite3_finalize(stmt);
+
+  // the exports having written all their images since have nothing to resume
+  GList *pending = NULL;
+  for(GList *l = entries; l; l = g_list_next(l))
+  {
+    dt_export_queue_entry_t *entry = (dt_export_queue_entry_t *)l->data;
+    entry->imgs = _pending_images(entry->id);
+    if(entry->imgs)
+      pending = g_list_prepend(pending, entry);
+    else
+    {
+      dt_export_queue_remove(entry->id);
+      dt_export_queue_entry_free(entry);
+    }
+  }
+  g_list_free(entries);
+  return pending;
+}
+
+void dt_export_queue_entry_free(dt_export_queue_entry_t *entry)
+{
+  if(!entry) return;
+  g_list_free(entry->imgs);
+  g_free(entry->format_params);
+  g_free(entry->storage_params);
+  g_free(entry->icc_filename);
+  g_free(entry->metadata_export);
+  g_free(entry);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
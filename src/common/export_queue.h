@@ -0,0 +1,74 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+#include "common/imageio_module.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+// exports of the user queue, recorded in main.export_queue with the completion state of each of their images
+// in main.export_queue_images. an export interrupted by a crash or by quitting is resumed at the next start,
+// without the images already written, unless their history changed since.
+// only storages writing each image on its own can be resumed, not the ones making a single output out of all
+// the images (initialize_store() or finalize_store()).
+
+typedef struct dt_export_queue_entry_t
+{
+  int32_t id;
+  GList *imgs; // imgids still to export, in order
+  // module names, versions and raw params as returned by their get_params()
+  char format[128], storage[128];
+  int format_version, storage_version;
+  void *format_params, *storage_params;
+  size_t format_size, storage_size;
+  int max_width, max_height;
+  gboolean high_quality, export_masks;
+  char style[128];
+  gboolean style_append;
+  dt_colorspaces_color_profile_type_t icc_type;
+  gchar *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+  gchar *metadata_export;
+} dt_export_queue_entry_t;
+
+/** whether an export to storage can be resumed */
+gboolean dt_export_queue_supported(dt_imageio_module_storage_t *storage);
+
+/** record the export of entry->imgs, returns its id, 0 if it couldn't be recorded */
+int32_t dt_export_queue_add(const dt_export_queue_entry_t *entry);
+
+/** imgid has been written by the export id, with the current history of the image */
+void dt_export_queue_image_done(const int32_t id, const int32_t imgid);
+
+/** forget the export id */
+void dt_export_queue_remove(const int32_t id);
+
+/** the recorded exports with images left to write, a list of dt_export_queue_entry_t. the exports without
+    any are removed */
+GList *dt_export_queue_pending(void);
+
+void dt_export_queue_entry_free(dt_export_queue_entry_t *entry);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -21,6 +21,7 @@
 #include "common/debug.h"
 #include "common/dtpthread.h"
 #include "common/image_cache.h"
+#include "common/image_index.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -486,6 +487,7 @@ void dt_film_remove(const int id)
     dt_image_local_copy_reset(imgid);
     dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
     dt_image_cache_remove(darktable.image_cache, imgid);
+    dt_image_index_remove(darktable.image_index, imgid);
   }
   sqlite3_finalize(stmt);
 
@@ -42,30 +42,34 @@ static inline uint8_t float_to_uint8(const float i)
   return (uint8_t)(i * 255.0f);
 }
 
-static inline void dt_focuspeaking(cairo_t *cr, int width, int height,
-                                   uint8_t *const restrict image,
-                                   const int buf_width, const int buf_height)
+/** compute the focus-peaking overlay of image, 8 bits BGRx pixels without stride.
+ *  returns a new ARGB32 surface of the size of image, to be destroyed by the caller.
+ *  it only depends on the image, so callers drawing the same buffer again should keep it. */
+static inline cairo_surface_t *dt_focuspeaking_surface(const uint8_t *const restrict image,
+                                                       const int buf_width, const int buf_height)
 {
   float *const restrict luma = dt_alloc_align_float((size_t)buf_width * buf_height);
-  uint8_t *const restrict focus_peaking = dt_alloc_align(sizeof(uint8_t) * buf_width * buf_height * 4);
+  cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, buf_width, buf_height);
+  cairo_surface_flush(surface);
+  // ARGB32 rows are 4 * width bytes, so the surface holds the overlay without stride
+  uint8_t *const restrict focus_peaking = cairo_image_surface_get_data(surface);
+
+  // remove gamma 2.2 and take the square is equivalent to this, for the 256 possible values:
+  const float exponent = 2.0f * 2.2f;
+  float squares[256];
+  for(int k = 0; k < 256; k++) squares[k] = powf(uint8_to_float(k), exponent);
 
   const size_t npixels = (size_t)buf_height * buf_width;
   // Create a luma buffer as the euclidian norm of RGB channels
 #ifdef _OPENMP
 #pragma omp parallel for simd default(none)             \
-  dt_omp_firstprivate(image, luma, npixels)             \
-  schedule(static) aligned(image, luma:64)
+  dt_omp_firstprivate(image, luma, npixels, squares)    \
+  schedule(static) aligned(luma:64)
 #endif
   for(size_t index = 0; index < npixels; index++)
     {
       const size_t index_RGB = index * 4;
-
-      // remove gamma 2.2 and take the square is equivalent to this:
-      const float exponent = 2.0f * 2.2f;
-
-      luma[index] = sqrtf( powf(uint8_to_float(image[index_RGB]), exponent) +
-                           powf(uint8_to_float(image[index_RGB + 1]), exponent) +
-                           powf(uint8_to_float(image[index_RGB + 2]), exponent) );
+      luma[index] = sqrtf(squares[image[index_RGB]] + squares[image[index_RGB + 1]] + squares[image[index_RGB + 2]]);
     }
 
   // Prefilter noise
@@ -192,8 +196,8 @@ schedule(static) collapse(2) aligned(luma:64) reduction(+:TV_sum)
 
 #ifdef _OPENMP
 #pragma omp parallel for simd default(none) \
-dt_omp_firstprivate(focus_peaking, luma, buf_height, buf_width, TV_sum) \
-schedule(static) collapse(2) aligned(focus_peaking, luma:64) reduction(+:sigma)
+dt_omp_firstprivate(luma, buf_height, buf_width, TV_sum) \
+schedule(static) collapse(2) aligned(luma:64) reduction(+:sigma)
 #endif
   for(size_t i = 2; i < buf_height - 2; ++i)
     for(size_t j = 2; j < buf_width - 2; ++j)
@@ -245,24 +249,33 @@ schedule(static) collapse(2) aligned(focus_peaking, luma:64) reduction(+:sigma)
       }
     }
 
-  // draw the focus peaking overlay
+  cairo_surface_mark_dirty(surface);
+
+  // cleanup
+  dt_free_align(luma);
+  dt_free_align(luma_ds);
+  return surface;
+}
+
+/** draw an overlay computed by dt_focuspeaking_surface() */
+static inline void dt_focuspeaking_draw(cairo_t *cr, cairo_surface_t *surface)
+{
   cairo_save(cr);
-  cairo_rectangle(cr, 0, 0, buf_width, buf_height);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((unsigned char *)focus_peaking,
-                                                                 CAIRO_FORMAT_ARGB32,
-                                                                 buf_width, buf_height,
-                                                                 cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, buf_width));
+  cairo_rectangle(cr, 0, 0, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface));
   cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
   cairo_set_source_surface(cr, surface, 0.0, 0.0);
   cairo_pattern_set_filter(cairo_get_source (cr), darktable.gui->filter_image);
   cairo_fill(cr);
   cairo_restore(cr);
+}
 
-  // cleanup
+static inline void dt_focuspeaking(cairo_t *cr, int width, int height,
+                                   uint8_t *const restrict image,
+                                   const int buf_width, const int buf_height)
+{
+  cairo_surface_t *surface = dt_focuspeaking_surface(image, buf_width, buf_height);
+  dt_focuspeaking_draw(cr, surface);
   cairo_surface_destroy(surface);
-  dt_free_align(luma);
-  dt_free_align(luma_ds);
-  dt_free_align(focus_peaking);
 }
 
 // clang-format off
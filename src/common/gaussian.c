@@ -19,9 +19,6 @@
 
 #include <assert.h>
 #include <math.h>
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
 #include "common/gaussian.h"
 #include "common/math.h"
 #include "common/opencl.h"
@@ -153,70 +150,83 @@ error:
 }
 
 
-void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
-{
+// Number of adjacent columns filtered together by the vertical pass. Their pixels are contiguous in memory,
+// so each row step works on whole vectors instead of striding over the image one pixel at a time.
+#define GAUSS_COLUMNS 8
 
+__DT_CLONE_TARGETS__
+static void _gaussian_blur_vertical(const dt_gaussian_t *g, const float *const in, float *const temp,
+                                    const float a0, const float a1, const float a2, const float a3,
+                                    const float b1, const float b2, const float coefp, const float coefn)
+{
   const int width = g->width;
   const int height = g->height;
-  const int ch = MIN(4, g->channels); // just to appease zealous compiler warnings about stack usage
-
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
-
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  const int ch = MIN(4, g->channels);
+  const int blocks = (width + GAUSS_COLUMNS - 1) / GAUSS_COLUMNS;
 
-  float *temp = g->buf;
-
-  float *Labmax = g->max;
-  float *Labmin = g->min;
+  // clamping bounds, repeated for each pixel of a block
+  float DT_ALIGNED_ARRAY Labmin[GAUSS_COLUMNS * 4];
+  float DT_ALIGNED_ARRAY Labmax[GAUSS_COLUMNS * 4];
+  for(int k = 0; k < GAUSS_COLUMNS * ch; k++)
+  {
+    Labmin[k] = g->min[k % ch];
+    Labmax[k] = g->max[k % ch];
+  }
 
-// vertical blur column by column
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, width, height, ch) \
-  shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
+  dt_omp_firstprivate(in, temp, width, height, ch, blocks, a0, a1, a2, a3, b1, b2, coefp, coefn) \
+  shared(Labmin, Labmax) \
   schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(int block = 0; block < blocks; block++)
   {
-    dt_aligned_pixel_t xp = {0.0f};
-    dt_aligned_pixel_t yb = {0.0f};
-    dt_aligned_pixel_t yp = {0.0f};
+    const int i = block * GAUSS_COLUMNS;
+    const int n = MIN(GAUSS_COLUMNS, width - i) * ch;
+
+    float DT_ALIGNED_ARRAY xp[GAUSS_COLUMNS * 4];
+    float DT_ALIGNED_ARRAY yb[GAUSS_COLUMNS * 4];
+    float DT_ALIGNED_ARRAY yp[GAUSS_COLUMNS * 4];
 
     // forward filter
-    for(int k = 0; k < ch; k++)
+    const float *const first = in + (size_t)i * ch;
+    for(int k = 0; k < n; k++)
     {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
+      xp[k] = CLAMPF(first[k], Labmin[k], Labmax[k]);
       yb[k] = xp[k] * coefp;
       yp[k] = yb[k];
     }
 
-    dt_aligned_pixel_t xc = {0.0f};
-    dt_aligned_pixel_t yc = {0.0f};
-    dt_aligned_pixel_t xn = {0.0f};
-    dt_aligned_pixel_t xa = {0.0f};
-    dt_aligned_pixel_t yn = {0.0f};
-    dt_aligned_pixel_t ya = {0.0f};
     for(int j = 0; j < height; j++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
+      const size_t offset = ((size_t)j * width + i) * ch;
 
-      for(int k = 0; k < ch; k++)
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for(int k = 0; k < n; k++)
       {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
+        const float xc = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
+        const float yc = (a0 * xc) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
 
-        temp[offset + k] = yc[k];
+        temp[offset + k] = yc;
 
-        xp[k] = xc[k];
+        xp[k] = xc;
         yb[k] = yp[k];
-        yp[k] = yc[k];
+        yp[k] = yc;
       }
     }
 
     // backward filter
-    for(int k = 0; k < ch; k++)
+    float DT_ALIGNED_ARRAY xn[GAUSS_COLUMNS * 4];
+    float DT_ALIGNED_ARRAY xa[GAUSS_COLUMNS * 4];
+    float DT_ALIGNED_ARRAY yn[GAUSS_COLUMNS * 4];
+    float DT_ALIGNED_ARRAY ya[GAUSS_COLUMNS * 4];
+
+    const float *const last = in + ((size_t)(height - 1) * width + i) * ch;
+    for(int k = 0; k < n; k++)
     {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
+      xn[k] = CLAMPF(last[k], Labmin[k], Labmax[k]);
       xa[k] = xn[k];
       yn[k] = xn[k] * coefn;
       ya[k] = yn[k];
@@ -224,29 +234,42 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
 
     for(int j = height - 1; j > -1; j--)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
+      const size_t offset = ((size_t)j * width + i) * ch;
 
-      for(int k = 0; k < ch; k++)
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for(int k = 0; k < n; k++)
       {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+        const float xc = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
+        const float yc = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
 
         xa[k] = xn[k];
-        xn[k] = xc[k];
+        xn[k] = xc;
         ya[k] = yn[k];
-        yn[k] = yc[k];
+        yn[k] = yc;
 
-        temp[offset + k] += yc[k];
+        temp[offset + k] += yc;
       }
     }
   }
+}
+
+__DT_CLONE_TARGETS__
+static void _gaussian_blur_horizontal(const dt_gaussian_t *g, const float *const temp, float *const out,
+                                      const float a0, const float a1, const float a2, const float a3,
+                                      const float b1, const float b2, const float coefp, const float coefn)
+{
+  const int width = g->width;
+  const int height = g->height;
+  const int ch = MIN(4, g->channels);
+  const float *const Labmax = g->max;
+  const float *const Labmin = g->min;
 
 // horizontal blur line by line
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(out, ch, width, height) \
-  shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
+  dt_omp_firstprivate(out, temp, ch, width, height, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
   schedule(static)
 #endif
   for(int j = 0; j < height; j++)
@@ -317,181 +340,22 @@ void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
   }
 }
 
-
-
-#if defined(__SSE__)
-static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, float *const out)
+void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
 {
-
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = 4;
-
-  assert(g->channels == 4);
-
   float a0, a1, a2, a3, b1, b2, coefp, coefn;
 
   compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
-
-  float *temp = g->buf;
-
-
-// vertical blur column by column
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, Labmin, Labmax, width, height, ch) \
-  shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
-  schedule(static)
-#endif
-  for(int i = 0; i < width; i++)
-  {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in + i * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(temp + offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
-
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
-
-      _mm_store_ps(temp + offset, _mm_add_ps(_mm_load_ps(temp + offset), yc));
-    }
-  }
-
-// horizontal blur line by line
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(out, Labmin, Labmax, width, height, ch) \
-  shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
-  schedule(static)
-#endif
-  for(size_t j = 0; j < height; j++)
-  {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(out + offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-
-    for(int i = width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
-
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
-
-      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
-    }
-  }
+  _gaussian_blur_vertical(g, in, g->buf, a0, a1, a2, a3, b1, b2, coefp, coefn);
+  _gaussian_blur_horizontal(g, g->buf, out, a0, a1, a2, a3, b1, b2, coefp, coefn);
 }
-#endif
 
+// The generic path is dispatched at runtime to the widest vector instruction set of the CPU (see
+// __DT_CLONE_TARGETS__), and is vectorized for NEON on ARM, so it replaces the former SSE-only variant.
 void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
 {
-  if(darktable.codepath.OPENMP_SIMD) return dt_gaussian_blur(g, in, out);
-#if defined(__SSE__)
-  else if(darktable.codepath.SSE2)
-    return dt_gaussian_blur_4c_sse(g, in, out);
-#endif
-  else
-    dt_unreachable_codepath();
+  assert(g->channels == 4);
+  dt_gaussian_blur(g, in, out);
 }
 
 void dt_gaussian_free(dt_gaussian_t *g)
@@ -38,6 +38,10 @@ typedef struct dt_gpx_t
   GList *trkpts;
   GList *trksegs;
 
+  /* the track records sorted by time, for lookups */
+  dt_gpx_track_point_t **points;
+  guint nb_points;
+
   /* currently parsed track point */
   dt_gpx_track_point_t *current_track_point;
   _gpx_parser_element_t current_parser_element;
@@ -107,6 +111,11 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
   gpx->trkpts = g_list_sort(gpx->trkpts, _sort_track);
   gpx->trksegs = g_list_sort(gpx->trksegs, _sort_segment);
 
+  gpx->nb_points = g_list_length(gpx->trkpts);
+  gpx->points = g_new(dt_gpx_track_point_t *, gpx->nb_points);
+  guint i = 0;
+  for(GList *tp = gpx->trkpts; tp; tp = g_list_next(tp)) gpx->points[i++] = (dt_gpx_track_point_t *)tp->data;
+
   return gpx;
 
 error:
@@ -143,109 +152,118 @@ void dt_gpx_destroy(struct dt_gpx_t *gpx)
 
   if(gpx->trkpts) g_list_free_full(gpx->trkpts, (GDestroyNotify)_track_pts_free);
   if(gpx->trksegs) g_list_free_full(gpx->trksegs, (GDestroyNotify)_track_seg_free);
+  g_free(gpx->points);
 
   g_free(gpx);
 }
 
-gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GDateTime *timestamp, dt_image_geoloc_t *geoloc)
+// fill geoloc with the location between tp and tp_next at timestamp
+static void _gpx_interpolate(const dt_gpx_track_point_t *tp, const dt_gpx_track_point_t *tp_next,
+                             GDateTime *timestamp, dt_image_geoloc_t *geoloc)
 {
-  g_assert(gpx != NULL);
+  GTimeSpan seg_diff = g_date_time_difference(tp_next->time, tp->time);
+  GTimeSpan diff = g_date_time_difference(timestamp, tp->time);
+  if(seg_diff == 0 || diff == 0)
+  {
+    geoloc->longitude = tp->longitude;
+    geoloc->latitude = tp->latitude;
+    geoloc->elevation = tp->elevation;
+  }
+  else
+  {
+    /* get the point by interpolation according to timestamp
 
-  /* verify that we got at least 2 trackpoints */
-  if(g_list_shorter_than(gpx->trkpts,2)) return FALSE;
+    We assume that the maximum difference in longitude is less or equal 180º:
+    since the bigger use case is that of an airplane, never an airplane flies more than 180º in longitude */
 
-  for(GList *item = gpx->trkpts; item; item = g_list_next(item))
-  {
-    dt_gpx_track_point_t *tp = (dt_gpx_track_point_t *)item->data;
+    const double lat1 = tp->latitude;
+    const double lon1 = tp->longitude;
+    const double lat2 = tp_next->latitude;
+    const double lon2 = tp_next->longitude;
 
-    /* if timestamp is out of time range return false but fill
-       closest location value start or end point */
-    const gint cmp = g_date_time_compare(timestamp, tp->time);
-    if((!item->next && cmp >= 0) || (cmp <= 0))
+    double lat, lon;
+
+    const double f = (double)diff / (double)seg_diff; /* the fraction of the distance */
+
+    if(fabs(lat2 - lat1) < DT_MINIMUM_ANGULAR_DELTA_FOR_GEODESIC
+        && fabs(lon2 - lon1) < DT_MINIMUM_ANGULAR_DELTA_FOR_GEODESIC)
     {
-      geoloc->longitude = tp->longitude;
-      geoloc->latitude = tp->latitude;
-      geoloc->elevation = tp->elevation;
-      return FALSE;
+      /* short distance (< 10 km), no need for geodesic interpolation */
+      lon = lon1 + (lon2 - lon1) * f;
+      lat = lat1 + (lat2 - lat1) * f;
     }
-
-    dt_gpx_track_point_t *tp_next = (dt_gpx_track_point_t *)item->next->data;
-    /* check if timestamp is within current and next trackpoint */
-    const gint cmp_n = g_date_time_compare(timestamp, tp_next->time);
-    if(item->next && cmp_n <= 0)
+    else
     {
-      GTimeSpan seg_diff = g_date_time_difference(tp_next->time, tp->time);
-      GTimeSpan diff = g_date_time_difference(timestamp, tp->time);
-      if(seg_diff == 0 || diff == 0)
-      {
-        geoloc->longitude = tp->longitude;
-        geoloc->latitude = tp->latitude;
-        geoloc->elevation = tp->elevation;
-      }
-      else
-      {
-        /* get the point by interpolation according to timestamp
-
-        We assume that the maximum difference in longitude is less or equal 180º:
-        since the bigger use case is that of an airplane, never an airplane flies more than 180º in longitude */
-
-        const double lat1 = tp->latitude;
-        const double lon1 = tp->longitude;
-        const double lat2 = tp_next->latitude;
-        const double lon2 = tp_next->longitude;
-
-        double lat, lon;
-
-        const double f = (double)diff / (double)seg_diff; /* the fraction of the distance */
-
-        if(fabs(lat2 - lat1) < DT_MINIMUM_ANGULAR_DELTA_FOR_GEODESIC
-            && fabs(lon2 - lon1) < DT_MINIMUM_ANGULAR_DELTA_FOR_GEODESIC)
-        {
-          /* short distance (< 10 km), no need for geodesic interpolation */
-          lon = lon1 + (lon2 - lon1) * f;
-          lat = lat1 + (lat2 - lat1) * f;
-        }
-        else
-        {
-          /* interpolation on the earth surface
-             formulas from http://www.movable-type.co.uk/scripts/latlong.html
-
-             the formulas are correct even if the two point are across the day line, e.g [(0, -179), (0,179)]
-             TO DO: in this case the line which is drawn is incorrect, but this should be a osm_gps issue
-          */
-
-          /* first, calculate the distance on the earth surface */
-          double d, delta;
-          dt_gpx_geodesic_distance(lat1, lon1,
-                                   lat2, lon2,
-                                   &d, &delta);
-          /* d is the distance on the surface in metres,
-             delta is the angle defined by the two points*/
-
-          /* then, calculate the intermediate point */
-          dt_gpx_geodesic_intermediate_point(lat1, lon1,
-                                             lat2, lon2,
-                                             delta,
-                                             TRUE,
-                                             f,
-                                             &lat, &lon);
-        }
-
-        geoloc->latitude = lat;
-        geoloc->longitude = lon;
-
-        /* make a simple linear interpolation on elevation */
-        if(tp_next->elevation == NAN || tp->elevation == NAN)
-          geoloc->elevation = NAN;
-        else
-          geoloc->elevation = tp->elevation + (tp_next->elevation - tp->elevation) * f;
-      }
-      return TRUE;
+      /* interpolation on the earth surface
+         formulas from http://www.movable-type.co.uk/scripts/latlong.html
+
+         the formulas are correct even if the two point are across the day line, e.g [(0, -179), (0,179)]
+         TO DO: in this case the line which is drawn is incorrect, but this should be a osm_gps issue
+      */
+
+      /* first, calculate the distance on the earth surface */
+      double d, delta;
+      dt_gpx_geodesic_distance(lat1, lon1,
+                               lat2, lon2,
+                               &d, &delta);
+      /* d is the distance on the surface in metres,
+         delta is the angle defined by the two points*/
+
+      /* then, calculate the intermediate point */
+      dt_gpx_geodesic_intermediate_point(lat1, lon1,
+                                         lat2, lon2,
+                                         delta,
+                                         TRUE,
+                                         f,
+                                         &lat, &lon);
     }
+
+    geoloc->latitude = lat;
+    geoloc->longitude = lon;
+
+    /* make a simple linear interpolation on elevation */
+    if(tp_next->elevation == NAN || tp->elevation == NAN)
+      geoloc->elevation = NAN;
+    else
+      geoloc->elevation = tp->elevation + (tp_next->elevation - tp->elevation) * f;
+  }
+}
+
+gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GDateTime *timestamp, dt_image_geoloc_t *geoloc)
+{
+  g_assert(gpx != NULL);
+
+  /* verify that we got at least 2 trackpoints */
+  if(gpx->nb_points < 2) return FALSE;
+
+  /* if timestamp is out of time range return false but fill
+     closest location value start or end point */
+  const dt_gpx_track_point_t *first = gpx->points[0];
+  const dt_gpx_track_point_t *last = gpx->points[gpx->nb_points - 1];
+  const dt_gpx_track_point_t *out = g_date_time_compare(timestamp, first->time) <= 0 ? first
+                                    : g_date_time_compare(timestamp, last->time) > 0 ? last
+                                    : NULL;
+  if(out)
+  {
+    geoloc->longitude = out->longitude;
+    geoloc->latitude = out->latitude;
+    geoloc->elevation = out->elevation;
+    return FALSE;
+  }
+
+  /* binary search of the last trackpoint before timestamp, the next one is at or after it */
+  guint lo = 0, hi = gpx->nb_points - 1;
+  while(hi - lo > 1)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if(g_date_time_compare(timestamp, gpx->points[mid]->time) > 0)
+      lo = mid;
+    else
+      hi = mid;
   }
 
-  /* should not reach this point */
-  return FALSE;
+  _gpx_interpolate(gpx->points[lo], gpx->points[hi], timestamp, geoloc);
+  return TRUE;
 }
 
 /*
@@ -19,12 +19,22 @@
 #include "common/grouping.h"
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/image_cache.h"
 #include "common/selection.h"
 #include "control/signal.h"
 #include "gui/gtk.h"
 
+// the images of a group are rewritten one by one through the image cache, commit them at once.
+// grouping also happens while importing, which is already done in transactions.
+static gboolean _grouping_start_transaction()
+{
+  if(!sqlite3_get_autocommit(dt_database_get(darktable.db))) return FALSE;
+  dt_database_start_transaction(darktable.db);
+  return TRUE;
+}
+
 /** add an image to a group */
 void dt_grouping_add_to_group(const int group_id, const int32_t image_id)
 {
@@ -51,6 +61,7 @@ int dt_grouping_remove_from_group(const int32_t image_id)
   dt_image_cache_read_release(darktable.image_cache, img);
   if(img_group_id == image_id)
   {
+    const gboolean transaction = _grouping_start_transaction();
     // get a new group_id for all the others in the group. also write it to the dt_image_t struct.
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "SELECT id FROM main.images WHERE group_id = ?1 AND id != ?2", -1, &stmt, NULL);
@@ -77,7 +88,8 @@ int dt_grouping_remove_from_group(const int32_t image_id)
       sqlite3_step(stmt);
       sqlite3_finalize(stmt);
     }
-    else
+    if(transaction) dt_database_release_transaction(darktable.db);
+    if(new_group_id == -1)
     {
       // no change was made, no point in raising signal, bailing early
       return -1;
@@ -108,19 +120,23 @@ int dt_grouping_change_representative(const int32_t image_id)
   const int group_id = img->group_id;
   dt_image_cache_read_release(darktable.image_cache, img);
 
+  // read all the members before rewriting them, the query would otherwise see its own updates
   GList *imgs = NULL;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT id FROM main.images WHERE group_id = ?1", -1,
                               &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, group_id);
   while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  const gboolean transaction = _grouping_start_transaction();
+  for(GList *l = imgs; l; l = g_list_next(l))
   {
-    const int other_id = sqlite3_column_int(stmt, 0);
-    dt_image_t *other_img = dt_image_cache_get(darktable.image_cache, other_id, 'w');
+    dt_image_t *other_img = dt_image_cache_get(darktable.image_cache, GPOINTER_TO_INT(l->data), 'w');
     other_img->group_id = image_id;
     dt_image_cache_write_release(darktable.image_cache, other_img, DT_IMAGE_CACHE_SAFE);
-    imgs = g_list_prepend(imgs, GINT_TO_POINTER(other_id));
   }
-  sqlite3_finalize(stmt);
+  if(transaction) dt_database_release_transaction(darktable.db);
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_IMAGE_INFO_CHANGED, imgs);
 
   return image_id;
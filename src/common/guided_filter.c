@@ -32,6 +32,7 @@
 #include "common/guided_filter.h"
 #include "common/math.h"
 #include "common/opencl.h"
+#include "develop/pixelpipe_arena.h"
 #include <assert.h>
 #include <float.h>
 #include <stdlib.h>
@@ -98,11 +99,11 @@ static inline float *get_color_pixel(color_image img, size_t i)
 //    6 variance (R-R, R-G, R-B, G-G, G-B, B-B)
 // for computational efficiency, we'll pack them into a four-channel image and a 9-channel image
 // image instead of running 13 separate box filters: guide+input, R/G/B/R-R/R-G/R-B/G-G/G-B/B-B.
-static void guided_filter_tiling(color_image imgg, gray_image img, gray_image img_out, tile target, const int w,
-                                 const float eps, const float guide_weight, const float min, const float max)
+//
+// returns the box mean of the coefficients a_r, a_g, a_b and b of the linear model, for each pixel of source
+static color_image guided_filter_coefficients(color_image imgg, gray_image img, const tile source, const int w,
+                                              const float eps, const float guide_weight)
 {
-  const tile source = { max_i(target.left - 2 * w, 0), min_i(target.right + 2 * w, imgg.width),
-                        max_i(target.lower - 2 * w, 0), min_i(target.upper + 2 * w, imgg.height) };
   const int width = source.right - source.left;
   const int height = source.upper - source.lower;
   size_t size = (size_t)width * (size_t)height;
@@ -125,7 +126,7 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
   color_image variance = new_color_image(width, height, 9);
   const size_t img_dimen = mean.width;
   size_t img_bak_sz;
-  float *img_bak = dt_alloc_perthread_float(9*img_dimen, &img_bak_sz);
+  float *img_bak = dt_pixelpipe_alloc_perthread_float(9*img_dimen, &img_bak_sz);
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) shared(img, imgg, mean, variance, img_bak) \
   dt_omp_firstprivate(img_bak_sz, img_dimen, w, guide_weight) dt_omp_sharedconst(source)
@@ -161,7 +162,7 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
     dt_box_mean_horizontal(meanpx, mean.width, 4|BOXFILTER_KAHAN_SUM, w, scratch);
     dt_box_mean_horizontal(varpx, variance.width, 9|BOXFILTER_KAHAN_SUM, w, scratch);
   }
-  dt_free_align(img_bak);
+  dt_pixelpipe_free_align(img_bak);
   dt_box_mean_vertical(mean.data, mean.height, mean.width, 4|BOXFILTER_KAHAN_SUM, w);
   dt_box_mean_vertical(variance.data, variance.height, variance.width, 9|BOXFILTER_KAHAN_SUM, w);
   // we will recycle memory of 'mean' for the new coefficient arrays a_? and b to reduce memory foot print
@@ -230,6 +231,16 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
   free_color_image(&variance);
 
   dt_box_mean(a_b.data, a_b.height, a_b.width, a_b.stride|BOXFILTER_KAHAN_SUM, w, 1);
+  return a_b;
+}
+
+static void guided_filter_tiling(color_image imgg, gray_image img, gray_image img_out, tile target, const int w,
+                                 const float eps, const float guide_weight, const float min, const float max)
+{
+  const tile source = { max_i(target.left - 2 * w, 0), min_i(target.right + 2 * w, imgg.width),
+                        max_i(target.lower - 2 * w, 0), min_i(target.upper + 2 * w, imgg.height) };
+  const int width = source.right - source.left;
+  color_image a_b = guided_filter_coefficients(imgg, img, source, w, eps, guide_weight);
 
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) \
@@ -252,7 +263,62 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
       img_out.data[i_imgg + (size_t)j_imgg * imgg.width] = CLAMP(res, min, max);
     }
   }
-  free_color_image(&mean);
+  free_color_image(&a_b);
+}
+
+// same as guided_filter_tiling() with the coefficients computed on the downscaled images ds_imgg and ds_img,
+// over ds_target, and interpolated bilinearly to be applied on the matching pixels of imgg
+static void guided_filter_upsample_tiling(color_image imgg, color_image ds_imgg, gray_image ds_img,
+                                          gray_image img_out, tile ds_target, const int w, const float eps,
+                                          const float guide_weight, const float min, const float max)
+{
+  const tile source = { max_i(ds_target.left - 2 * w, 0), min_i(ds_target.right + 2 * w, ds_imgg.width),
+                        max_i(ds_target.lower - 2 * w, 0), min_i(ds_target.upper + 2 * w, ds_imgg.height) };
+  const int width = source.right - source.left;
+  const float scale_x = (float)imgg.width / ds_imgg.width;
+  const float scale_y = (float)imgg.height / ds_imgg.height;
+  // the last tiles extend to the edges of the full image
+  const tile target = { (int)(ds_target.left * scale_x),
+                        ds_target.right == ds_imgg.width ? imgg.width : (int)(ds_target.right * scale_x),
+                        (int)(ds_target.lower * scale_y),
+                        ds_target.upper == ds_imgg.height ? imgg.height : (int)(ds_target.upper * scale_y) };
+  color_image a_b = guided_filter_coefficients(ds_imgg, ds_img, source, w, eps, guide_weight);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) \
+  shared(target, imgg, ds_imgg, a_b, img_out) dt_omp_sharedconst(source) \
+  dt_omp_firstprivate(min, max, width, guide_weight, scale_x, scale_y)
+#endif
+  for(int j_imgg = target.lower; j_imgg < target.upper; j_imgg++)
+  {
+    // neighbouring rows in the downscaled image, the tile margin keeps them within source
+    const float y = CLAMP((j_imgg + 0.5f) / scale_y - 0.5f, 0.f, (float)(ds_imgg.height - 1));
+    const int y0 = (int)y;
+    const int y1 = min_i(y0 + 1, ds_imgg.height - 1);
+    const float fy = y - y0;
+    const float *const row0 = a_b.data + (size_t)4 * (y0 - source.lower) * width;
+    const float *const row1 = a_b.data + (size_t)4 * (y1 - source.lower) * width;
+    for(int i_imgg = target.left; i_imgg < target.right; i_imgg++)
+    {
+      const float x = CLAMP((i_imgg + 0.5f) / scale_x - 0.5f, 0.f, (float)(ds_imgg.width - 1));
+      const int x0 = (int)x;
+      const int x1 = min_i(x0 + 1, ds_imgg.width - 1);
+      const float fx = x - x0;
+      const float *const ab00 = row0 + 4 * (x0 - source.left);
+      const float *const ab01 = row0 + 4 * (x1 - source.left);
+      const float *const ab10 = row1 + 4 * (x0 - source.left);
+      const float *const ab11 = row1 + 4 * (x1 - source.left);
+      dt_aligned_pixel_t px_ab;
+      for_four_channels(c)
+        px_ab[c] = (1.f - fy) * ((1.f - fx) * ab00[c] + fx * ab01[c]) + fy * ((1.f - fx) * ab10[c] + fx * ab11[c]);
+
+      const float *pixel = get_color_pixel(imgg, i_imgg + (size_t)j_imgg * imgg.width);
+      float res = guide_weight * (px_ab[A_RED] * pixel[0] + px_ab[A_GREEN] * pixel[1] + px_ab[A_BLUE] * pixel[2]);
+      res += px_ab[B];
+      img_out.data[i_imgg + (size_t)j_imgg * imgg.width] = CLAMP(res, min, max);
+    }
+  }
+  free_color_image(&a_b);
 }
 
 static int compute_tile_height(const int height, const int w)
@@ -332,6 +398,34 @@ void guided_filter(const float *const guide, const float *const in, float *const
   }
 }
 
+void guided_filter_upsample(const float *const guide, const float *const ds_guide, const float *const ds_in,
+                            float *const out, const int width, const int height, const int ds_width,
+                            const int ds_height, const int ch, const int w, const float sqrt_eps,
+                            const float guide_weight, const float min, const float max)
+{
+  assert(ch >= 3);
+  assert(w >= 1);
+  assert(ds_width <= width && ds_height <= height);
+
+  color_image img_guide = (color_image){ (float *)guide, width, height, ch };
+  color_image ds_img_guide = (color_image){ (float *)ds_guide, ds_width, ds_height, ch };
+  gray_image ds_img_in = (gray_image){ (float *)ds_in, ds_width, ds_height };
+  gray_image img_out = (gray_image){ out, width, height };
+  const int tile_width = compute_tile_width(ds_width, w);
+  const int tile_height = compute_tile_height(ds_height, w);
+  const float eps = sqrt_eps * sqrt_eps; // this is the regularization parameter of the original papers
+
+  for(int j = 0; j < ds_height; j += tile_height)
+  {
+    for(int i = 0; i < ds_width; i += tile_width)
+    {
+      tile target = { i, min_i(i + tile_width, ds_width), j, min_i(j + tile_height, ds_height) };
+      guided_filter_upsample_tiling(img_guide, ds_img_guide, ds_img_in, img_out, target, w, eps, guide_weight,
+                                    min, max);
+    }
+  }
+}
+
 #ifdef HAVE_OPENCL
 
 dt_guided_filter_cl_global_t *dt_guided_filter_init_cl_global()
@@ -83,6 +83,13 @@ static inline int max_i(int a, int b)
 void guided_filter(const float *guide, const float *in, float *out, int width, int height, int ch, int w,
                    float sqrt_eps, float guide_weight, float min, float max);
 
+// fast guided filter (Kaiming He, Jian Sun, https://arxiv.org/abs/1505.00996): the filter of ds_in guided by
+// ds_guide, both downscaled copies, with its linear coefficients interpolated to be applied on guide, the full
+// size image
+void guided_filter_upsample(const float *guide, const float *ds_guide, const float *ds_in, float *out, int width,
+                            int height, int ds_width, int ds_height, int ch, int w, float sqrt_eps,
+                            float guide_weight, float min, float max);
+
 #ifdef HAVE_OPENCL
 
 typedef struct dt_guided_filter_cl_global_t
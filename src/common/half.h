@@ -0,0 +1,120 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// conversions between float and IEEE half floats, rounding to nearest even.
+// the buffer versions use F16C on x86 and the fp16 conversions of aarch64 when the compiler targets them.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+typedef union dt_fp32_t
+{
+  uint32_t u;
+  float f;
+} dt_fp32_t;
+
+/* from https://gist.github.com/rygorous/2156668 */
+static inline float dt_half_to_float(const uint16_t h)
+{
+  static const dt_fp32_t magic = { 113 << 23 };
+  static const uint32_t shifted_exp = 0x7c00 << 13; // exponent mask after shift
+  dt_fp32_t o;
+
+  o.u = (h & 0x7fff) << 13;         // exponent/mantissa bits
+  const uint32_t exp = shifted_exp & o.u; // just the exponent
+  o.u += (127 - 15) << 23;          // exponent adjust
+
+  // handle exponent special cases
+  if(exp == shifted_exp) // Inf/NaN?
+    o.u += (128 - 16) << 23; // extra exp adjust
+  else if(exp == 0) // Zero/Denormal?
+  {
+    o.u += 1 << 23; // extra exp adjust
+    o.f -= magic.f; // renormalize
+  }
+
+  o.u |= (h & 0x8000) << 16; // sign bit
+  return o.f;
+}
+
+static inline uint16_t dt_float_to_half(const float f)
+{
+  static const uint32_t f32infty = 255u << 23;
+  static const uint32_t f16max = (127u + 16) << 23;
+  static const dt_fp32_t denorm_magic = { ((127 - 15) + (23 - 10) + 1) << 23 };
+  dt_fp32_t in = { .f = f };
+  uint16_t o;
+
+  const uint32_t sign = in.u & 0x80000000u;
+  in.u ^= sign;
+
+  if(in.u >= f16max) // overflows to Inf, NaN stays NaN
+    o = (in.u > f32infty) ? 0x7e00 : 0x7c00;
+  else if(in.u < (113u << 23)) // denormal or zero, let the float addition do the rounding
+  {
+    in.f += denorm_magic.f;
+    o = in.u - denorm_magic.u;
+  }
+  else
+  {
+    const uint32_t mant_odd = (in.u >> 13) & 1;
+    in.u += ((uint32_t)(15 - 127) << 23) + 0xfff; // exponent adjust and rounding bias
+    in.u += mant_odd;
+    o = in.u >> 13;
+  }
+
+  return o | (sign >> 16);
+}
+
+static inline void dt_float_to_half_buf(uint16_t *const out, const float *const in, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  for(; k + 8 <= n; k += 8)
+    _mm_storeu_si128((__m128i *)(out + k), _mm256_cvtps_ph(_mm256_loadu_ps(in + k), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__aarch64__)
+  for(; k + 4 <= n; k += 4) vst1_u16(out + k, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + k))));
+#endif
+  for(; k < n; k++) out[k] = dt_float_to_half(in[k]);
+}
+
+static inline void dt_half_to_float_buf(float *const out, const uint16_t *const in, const size_t n)
+{
+  size_t k = 0;
+#if defined(__F16C__)
+  for(; k + 8 <= n; k += 8)
+    _mm256_storeu_ps(out + k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + k))));
+#elif defined(__aarch64__)
+  for(; k + 4 <= n; k += 4) vst1q_f32(out + k, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + k))));
+#endif
+  for(; k < n; k++) out[k] = dt_half_to_float(in[k]);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
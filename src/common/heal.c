@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/conf.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/openmp_maths.h"
@@ -34,9 +35,8 @@
  * but subtract them I2 = I0 - I1, where I0 is the sample image to be
  * corrected, I1 is the reference pattern. Then we solve DeltaI=0
  * (Laplace) with I2 Dirichlet conditions at the borders of the
- * mask. The solver is a red/black checker Gauss-Seidel with over-relaxation.
- * It could benefit from a multi-grid evaluation of an initial solution
- * before the main iteration loop.
+ * mask. The solver is a red/black checker Gauss-Seidel with over-relaxation,
+ * started from a cascadic multi-grid evaluation of an initial solution.
  *
  * I reduced the convergence criteria to 0.1% (0.001) as we are
  * dealing here with RGB integer components, more is overkill.
@@ -377,6 +377,200 @@ cleanup:
 }
 
 
+// below this size, the heal stamp is solved by the Gauss-Seidel loop alone
+#define HEAL_MG_MIN_SIZE 16
+// smoothing sweeps after the prolongation to each intermediate level
+#define HEAL_MG_SWEEPS 8
+
+// One red/black Gauss-Seidel sweep with over-relaxation w over the masked pixels of an interleaved
+// 4-channel image. Like in _heal_laplace_iteration(), neighbours outside of the stamp are left out.
+static void _heal_mg_relax(float *const restrict img, const float *const restrict mask, const int width,
+                           const int height, const float w)
+{
+  for(int parity = 0; parity < 2; parity++)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(img, mask, width, height, w, parity) \
+    schedule(static)
+#endif
+    for(int row = 0; row < height; row++)
+    {
+      for(int col = (row + parity) & 1; col < width; col += 2)
+      {
+        const size_t k = (size_t)row * width + col;
+        if(!mask[k]) continue;
+
+        dt_aligned_pixel_t sum = { 0.f };
+        float n = 0.f;
+        if(row > 0)
+        {
+          for_each_channel(c) sum[c] += img[4 * (k - width) + c];
+          n++;
+        }
+        if(row + 1 < height)
+        {
+          for_each_channel(c) sum[c] += img[4 * (k + width) + c];
+          n++;
+        }
+        if(col > 0)
+        {
+          for_each_channel(c) sum[c] += img[4 * (k - 1) + c];
+          n++;
+        }
+        if(col + 1 < width)
+        {
+          for_each_channel(c) sum[c] += img[4 * (k + 1) + c];
+          n++;
+        }
+        if(n == 0.f) continue;
+
+        for_each_channel(c) img[4 * k + c] += w * (sum[c] / n - img[4 * k + c]);
+      }
+    }
+  }
+}
+
+// Cascadic multigrid: solve the Laplace equation on a half-resolution copy of the stamp first, and
+// interpolate its solution into the masked pixels. The smooth, low-frequency part of the solution is what
+// takes Gauss-Seidel thousands of iterations to propagate over large stamps; on the coarse levels it
+// only takes a few sweeps, leaving the fine iterations to polish the details.
+static void _heal_multigrid(float *const restrict img, const float *const restrict mask, const int width,
+                            const int height, const gboolean finest)
+{
+  if(width < 2 * HEAL_MG_MIN_SIZE || height < 2 * HEAL_MG_MIN_SIZE)
+  {
+    // the coarsest level is small enough to be solved directly
+    if(!finest)
+      for(int i = 0; i < 2 * MAX(width, height); i++) _heal_mg_relax(img, mask, width, height, 1.5f);
+    return;
+  }
+
+  const int cwidth = (width + 1) / 2;
+  const int cheight = (height + 1) / 2;
+  float *const restrict cimg = dt_alloc_align_float((size_t)4 * cwidth * cheight);
+  float *const restrict cmask = dt_alloc_align_float((size_t)cwidth * cheight);
+  if(cimg == NULL || cmask == NULL) goto cleanup;
+
+  // restrict: a coarse pixel is a boundary condition as soon as one of its 4 fine pixels is
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(img, mask, cimg, cmask, width, height, cwidth, cheight) \
+  schedule(static)
+#endif
+  for(int row = 0; row < cheight; row++)
+  {
+    for(int col = 0; col < cwidth; col++)
+    {
+      dt_aligned_pixel_t known = { 0.f };
+      dt_aligned_pixel_t all = { 0.f };
+      float nknown = 0.f;
+      float nall = 0.f;
+      for(int y = 2 * row; y < MIN(2 * row + 2, height); y++)
+        for(int x = 2 * col; x < MIN(2 * col + 2, width); x++)
+        {
+          const size_t k = (size_t)y * width + x;
+          for_each_channel(c) all[c] += img[4 * k + c];
+          nall++;
+          if(!mask[k])
+          {
+            for_each_channel(c) known[c] += img[4 * k + c];
+            nknown++;
+          }
+        }
+
+      const size_t ck = (size_t)row * cwidth + col;
+      cmask[ck] = (nknown > 0.f) ? 0.f : 1.f;
+      for_each_channel(c) cimg[4 * ck + c] = (nknown > 0.f) ? known[c] / nknown : all[c] / nall;
+    }
+  }
+
+  _heal_multigrid(cimg, cmask, cwidth, cheight, FALSE);
+
+  // prolongate: bilinear interpolation of the coarse solution into the masked fine pixels
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(img, mask, cimg, width, height, cwidth, cheight) \
+  schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+  {
+    const float fy = CLAMPS((row + 0.5f) * 0.5f - 0.5f, 0.f, cheight - 1);
+    const int y0 = (int)fy;
+    const int y1 = MIN(y0 + 1, cheight - 1);
+    const float wy = fy - y0;
+    for(int col = 0; col < width; col++)
+    {
+      const size_t k = (size_t)row * width + col;
+      if(!mask[k]) continue;
+
+      const float fx = CLAMPS((col + 0.5f) * 0.5f - 0.5f, 0.f, cwidth - 1);
+      const int x0 = (int)fx;
+      const int x1 = MIN(x0 + 1, cwidth - 1);
+      const float wx = fx - x0;
+      const float *const p00 = cimg + 4 * ((size_t)y0 * cwidth + x0);
+      const float *const p01 = cimg + 4 * ((size_t)y0 * cwidth + x1);
+      const float *const p10 = cimg + 4 * ((size_t)y1 * cwidth + x0);
+      const float *const p11 = cimg + 4 * ((size_t)y1 * cwidth + x1);
+      for_each_channel(c)
+        img[4 * k + c] = (1.f - wy) * ((1.f - wx) * p00[c] + wx * p01[c]) + wy * ((1.f - wx) * p10[c] + wx * p11[c]);
+    }
+  }
+
+  // the finest level is smoothed by the main solver
+  if(!finest)
+    for(int i = 0; i < HEAL_MG_SWEEPS; i++) _heal_mg_relax(img, mask, width, height, 1.f);
+
+cleanup:
+  if(cimg) dt_free_align(cimg);
+  if(cmask) dt_free_align(cmask);
+}
+
+// replace the masked pixels of dest_buffer by a multigrid estimate of the healed result
+static void _heal_initial_guess(const float *const restrict src_buffer, float *const restrict dest_buffer,
+                                const float *const restrict mask_buffer, const int width, const int height)
+{
+  if(width < 2 * HEAL_MG_MIN_SIZE || height < 2 * HEAL_MG_MIN_SIZE) return;
+
+  const size_t npixels = (size_t)width * height;
+  float *const restrict diff = dt_alloc_align_float(4 * npixels);
+  if(diff == NULL) return;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(src_buffer, dest_buffer, diff, npixels) \
+  schedule(static) aligned(src_buffer, dest_buffer, diff:64)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k++) diff[k] = dest_buffer[k] - src_buffer[k];
+
+  _heal_multigrid(diff, mask_buffer, width, height, TRUE);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(src_buffer, dest_buffer, mask_buffer, diff, npixels) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+    if(mask_buffer[k])
+      for_each_channel(c) dest_buffer[4 * k + c] = src_buffer[4 * k + c] + diff[4 * k + c];
+
+  dt_free_align(diff);
+}
+
+int dt_heal_max_iter(const dt_dev_pixelpipe_type_t pipetype, const int max_iter)
+{
+  // with the multigrid initial guess, a quarter of the iterations is visually converged. Small previews
+  // always use it, the darkroom main view only if the user traded quality for interactivity.
+  // Exports always iterate until convergence or max_iter.
+  const int fast_iter = MAX(max_iter / 4, 1);
+  if(pipetype & (DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_THUMBNAIL))
+    return fast_iter;
+  if((pipetype & DT_DEV_PIXELPIPE_FULL) && dt_conf_get_bool("plugins/darkroom/retouch/fast_heal_interactive"))
+    return fast_iter;
+  return max_iter;
+}
+
+
 /* Original Algorithm Design:
  *
  * T. Georgiev, "Photoshop Healing Brush: a Tool for Seamless Cloning
@@ -399,6 +593,9 @@ void dt_heal(const float *const src_buffer, float *dest_buffer, const float *con
     goto cleanup;
   }
 
+  /* start the solver from a coarse solution of the masked area */
+  _heal_initial_guess(src_buffer, dest_buffer, mask_buffer, width, height);
+
   /* subtract pattern from image and store the result split by 'red' and 'black' positions  */
   _heal_sub(dest_buffer, src_buffer, red_buffer, black_buffer, width, height);
 
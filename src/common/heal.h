@@ -19,12 +19,17 @@
 #ifndef DT_DEVELOP_HEAL_H
 #define DT_DEVELOP_HEAL_H
 
+#include "develop/pixelpipe.h"
+
 /* heals dest_buffer using src_buffer as a reference and mask_buffer to define the area to be healed
  * the 3 buffers must have the same size, but mask_buffer is 1 channel and is tested for != 0.f
  */
 void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
              const int height, const int ch, const int max_iter);
 
+/* number of heal iterations to run in a pipe of type pipetype, previews may trade accuracy for speed */
+int dt_heal_max_iter(const dt_dev_pixelpipe_type_t pipetype, const int max_iter);
+
 #ifdef HAVE_OPENCL
 
 typedef struct dt_heal_cl_global_t
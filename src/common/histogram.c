@@ -79,17 +79,6 @@ inline void dt_histogram_helper_cs_RAW_uint16(const dt_dev_histogram_collection_
 
 //------------------------------------------------------------------------------
 
-inline static void __attribute__((__unused__)) histogram_helper_cs_rgb_helper_process_pixel_float(
-    const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram)
-{
-  const uint32_t R = PS(pixel[0], histogram_params);
-  const uint32_t G = PS(pixel[1], histogram_params);
-  const uint32_t B = PS(pixel[2], histogram_params);
-  histogram[4 * R]++;
-  histogram[4 * G + 1]++;
-  histogram[4 * B + 2]++;
-}
-
 inline static void __attribute__((__unused__)) histogram_helper_cs_rgb_helper_process_pixel_float_compensated(
     const dt_dev_histogram_collection_params_t *const histogram_params, const float *pixel, uint32_t *histogram,
     const dt_iop_order_iccprofile_info_t *const profile_info)
@@ -159,25 +148,50 @@ inline static void histogram_helper_cs_rgb_helper_process_pixel_m128_compensated
 }
 #endif
 
+// pixels whose bins are computed together before being counted
+#define HISTOGRAM_CHUNK 64
+
 inline static void histogram_helper_cs_rgb(const dt_dev_histogram_collection_params_t *const histogram_params,
                                            const void *pixel, uint32_t *histogram, int j,
                                            const dt_iop_order_iccprofile_info_t *const profile_info)
 {
   const dt_histogram_roi_t *roi = histogram_params->roi;
   float *in = (float *)pixel + 4 * (roi->width * j + roi->crop_x);
+  const int width = roi->width - roi->crop_width - roi->crop_x;
 
-  // process aligned pixels with SSE
-  for(int i = 0; i < roi->width - roi->crop_width - roi->crop_x; i++, in += 4)
+  if(darktable.codepath.OPENMP_SIMD)
   {
-    if(darktable.codepath.OPENMP_SIMD)
-      histogram_helper_cs_rgb_helper_process_pixel_float(histogram_params, in, histogram);
+    // the bins of a chunk of pixels are computed with SIMD, then counted: only the increments stay scalar
+    const float mul = histogram_params->mul;
+    const float max = histogram_params->bins_count - 1;
+    uint32_t bins[4 * HISTOGRAM_CHUNK] __attribute__((aligned(64)));
+    for(int i = 0; i < width; i += HISTOGRAM_CHUNK)
+    {
+      const int n = MIN(HISTOGRAM_CHUNK, width - i);
+      const float *const restrict chunk = in + 4 * i;
+#ifdef _OPENMP
+#pragma omp simd aligned(bins:64) aligned(chunk:16)
+#endif
+      for(int k = 0; k < 4 * n; k++) bins[k] = (uint32_t)fminf(fmaxf(mul * chunk[k], 0.0f), max);
+
+      for(int k = 0; k < 4 * n; k += 4)
+      {
+        histogram[4 * bins[k]]++;
+        histogram[4 * bins[k + 1] + 1]++;
+        histogram[4 * bins[k + 2] + 2]++;
+      }
+    }
+  }
 #if defined(__SSE2__)
-    else if(darktable.codepath.SSE2)
+  else if(darktable.codepath.SSE2)
+  {
+    // process aligned pixels with SSE
+    for(int i = 0; i < width; i++, in += 4)
       histogram_helper_cs_rgb_helper_process_pixel_m128(histogram_params, in, histogram);
-#endif
-    else
-      dt_unreachable_codepath();
   }
+#endif
+  else
+    dt_unreachable_codepath();
 }
 
 inline static void histogram_helper_cs_rgb_compensated(const dt_dev_histogram_collection_params_t *const histogram_params,
@@ -449,6 +463,100 @@ void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_sta
   }
 }
 
+#ifdef HAVE_OPENCL
+// work groups of the reduction, enough to fill a GPU while keeping the final merge cheap
+#define DT_HISTOGRAM_CL_GROUPS 32
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global()
+{
+  dt_histogram_cl_global_t *g = malloc(sizeof(*g));
+  const int program = 36; // statistics.cl, from programs.conf
+  g->kernel_histogram_4ch = dt_opencl_create_kernel(program, "histogram_4ch");
+  return g;
+}
+
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_histogram_4ch);
+  free(g);
+}
+
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, const dt_iop_colorspace_type_t cst,
+                           const dt_iop_colorspace_type_t cst_to, cl_mem img, uint32_t **histogram,
+                           const int compensate_middle_grey,
+                           const dt_iop_order_iccprofile_info_t *const profile_info)
+{
+  // raw, LCh and middle-grey compensated histograms stay on the CPU
+  const gboolean lab = (cst != IOP_CS_RGB);
+  if(cst == IOP_CS_RAW || (lab && cst_to == IOP_CS_LCH) || (!lab && compensate_middle_grey && profile_info))
+    return FALSE;
+
+  const int kernel = darktable.opencl->histogram->kernel_histogram_4ch;
+  const int bins = histogram_params->bins_count;
+  const dt_histogram_roi_t *const roi = histogram_params->roi;
+  const int x0 = roi->crop_x;
+  const int y0 = roi->crop_y;
+  const int width = roi->width - roi->crop_width - roi->crop_x;
+  const int height = roi->height - roi->crop_height - roi->crop_y;
+  if(bins <= 0 || width <= 0 || height <= 0) return FALSE;
+
+  // the per-group histogram needs to fit in local memory
+  dt_opencl_local_buffer_t locopt
+    = (dt_opencl_local_buffer_t){ .xoffset = 0, .xfactor = 1, .yoffset = 0, .yfactor = 1,
+                                  .cellsize = 0, .overhead = sizeof(uint32_t) * 3 * bins,
+                                  .sizex = 1 << 8, .sizey = 1 };
+  if(!dt_opencl_local_buffer_opt(devid, kernel, &locopt)) return FALSE;
+
+  if(histogram_params->mul == 0) histogram_params->mul = (double)(bins - 1);
+  const float mul = histogram_params->mul;
+
+  const size_t buf_size = sizeof(uint32_t) * 4 * bins;
+  uint32_t *hist = calloc(1, buf_size);
+  cl_mem dev_hist = dt_opencl_alloc_device_buffer(devid, buf_size);
+  cl_int err = DT_OPENCL_DEFAULT_ERROR;
+  if(!hist || !dev_hist) goto error;
+
+  err = dt_opencl_write_buffer_to_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  const size_t groups = MIN(DT_HISTOGRAM_CL_GROUPS, ROUNDUP((size_t)width * height, locopt.sizex) / locopt.sizex);
+  const size_t sizes[3] = { groups * locopt.sizex, 1, 1 };
+  const size_t local[3] = { locopt.sizex, 1, 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), &img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(int), &x0);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), &y0);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), &bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(float), &mul);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(int), &lab);
+  dt_opencl_set_kernel_arg(devid, kernel, 8, sizeof(cl_mem), &dev_hist);
+  dt_opencl_set_kernel_arg(devid, kernel, 9, sizeof(uint32_t) * 3 * bins, NULL);
+  err = dt_opencl_enqueue_kernel_2d_with_local(devid, kernel, sizes, local);
+  if(err != CL_SUCCESS) goto error;
+
+  err = dt_opencl_read_buffer_from_device(devid, hist, dev_hist, 0, buf_size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_hist);
+  free(*histogram);
+  *histogram = hist;
+
+  histogram_stats->bins_count = bins;
+  histogram_stats->pixels = (uint32_t)width * height;
+  histogram_stats->ch = 3u;
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[histogram_cl] couldn't compute the histogram on the device: %s\n", cl_errstr(err));
+  dt_opencl_release_mem_object(dev_hist);
+  free(hist);
+  return FALSE;
+}
+#endif
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
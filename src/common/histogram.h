@@ -23,6 +23,9 @@
 #include "develop/imageop.h"
 #include "develop/pixelpipe.h"
 #include "common/iop_profile.h"
+#ifdef HAVE_OPENCL
+#include "common/opencl.h"
+#endif
 
 /*
  * histogram region of interest
@@ -58,6 +61,24 @@ void dt_histogram_max_helper(const dt_dev_histogram_stats_t *const histogram_sta
                              const dt_iop_colorspace_type_t cst, const dt_iop_colorspace_type_t cst_to,
                              uint32_t **histogram, uint32_t *histogram_max);
 
+#ifdef HAVE_OPENCL
+typedef struct dt_histogram_cl_global_t
+{
+  int kernel_histogram_4ch;
+} dt_histogram_cl_global_t;
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global(void);
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g);
+
+/** same as dt_histogram_helper() for an image on the device, without reading it back.
+  * returns FALSE, leaving the histogram alone, for the cases only handled on the CPU or on error. */
+int dt_histogram_helper_cl(const int devid, dt_dev_histogram_collection_params_t *histogram_params,
+                           dt_dev_histogram_stats_t *histogram_stats, const dt_iop_colorspace_type_t cst,
+                           const dt_iop_colorspace_type_t cst_to, cl_mem img, uint32_t **histogram,
+                           const int compensate_middle_grey,
+                           const dt_iop_order_iccprofile_info_t *const profile_info);
+#endif
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -17,14 +17,17 @@
 */
 
 #include "common/history.h"
+#include "common/atomic.h"
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/history_snapshot.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/mipmap_cache.h"
+#include "common/sidecar_writer.h"
 #include "common/tags.h"
 #include "common/undo.h"
 #include "common/utility.h"
@@ -114,7 +117,7 @@ void dt_history_delete_on_image_ext(int32_t imgid, gboolean undo)
   if(dt_dev_is_current_image(darktable.develop, imgid)) dt_dev_reload_history_items(darktable.develop);
 
   /* make sure mipmaps are recomputed */
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_regenerate(darktable.mipmap_cache, imgid);
   dt_image_update_final_size(imgid);
 
   /* remove darktable|style|* tags */
@@ -175,7 +178,7 @@ int dt_history_load_and_apply(const int imgid, gchar *filename, int history_only
     dt_image_cache_write_release(darktable.image_cache, img,
     // ugly but if not history_only => called from crawler - do not write the xmp
                                  history_only ? DT_IMAGE_CACHE_SAFE : DT_IMAGE_CACHE_RELAXED);
-    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    dt_mipmap_cache_regenerate(darktable.mipmap_cache, imgid);
     dt_image_update_final_size(imgid);
   }
   // signal that the mipmap need to be updated
@@ -481,37 +484,23 @@ int dt_history_merge_module_into_history(dt_develop_t *dev_dest, dt_develop_t *d
   return module_added;
 }
 
-static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_imgid, GList *ops, const gboolean copy_full)
+// read the history of the source image, to be pasted on any number of images
+static void _history_paste_source_init(dt_develop_t *dev_src, const int32_t imgid)
 {
-  GList *modules_used = NULL;
-
-  dt_develop_t _dev_src = { 0 };
-  dt_develop_t _dev_dest = { 0 };
-
-  dt_develop_t *dev_src = &_dev_src;
-  dt_develop_t *dev_dest = &_dev_dest;
-
-  // we will do the copy/paste on memory so we can deal with masks
   dt_dev_init(dev_src, FALSE);
-  dt_dev_init(dev_dest, FALSE);
-
   dev_src->iop = dt_iop_load_modules_ext(dev_src, TRUE);
-  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
-
   dt_dev_read_history_ext(dev_src, imgid, TRUE);
 
-  // This prepends the default modules and converts just in case it's an empty history
-  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
-
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge ");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
 
   dt_dev_pop_history_items_ext(dev_src, dt_dev_get_history_end(dev_src));
-  dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
 
   dt_ioppr_check_iop_order(dev_src, imgid, "_history_copy_and_paste_on_image_merge 1");
-  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
+}
 
+// the modules of the source history to paste
+static GList *_history_paste_source_modules(dt_develop_t *dev_src, GList *ops, const gboolean copy_full)
+{
   GList *mod_list = NULL;
 
   if(ops)
@@ -558,7 +547,30 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   }
   if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv\n");
 
-  mod_list = g_list_reverse(mod_list);   // list was built in reverse order, so un-reverse it
+  return g_list_reverse(mod_list);   // list was built in reverse order, so un-reverse it
+}
+
+// merge the modules of dev_src into the history of dest_imgid. dev_src is only read, so that several
+// images can be merged at once from the same source
+static void _history_paste_merge(dt_develop_t *dev_src, GList *mod_list, const int32_t dest_imgid)
+{
+  GList *modules_used = NULL;
+
+  dt_develop_t _dev_dest = { 0 };
+  dt_develop_t *dev_dest = &_dev_dest;
+
+  // we will do the copy/paste on memory so we can deal with masks
+  dt_dev_init(dev_dest, FALSE);
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+
+  // This prepends the default modules and converts just in case it's an empty history
+  dt_dev_read_history_ext(dev_dest, dest_imgid, TRUE);
+
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge ");
+
+  dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
+
+  dt_ioppr_check_iop_order(dev_dest, dest_imgid, "_history_copy_and_paste_on_image_merge 1");
 
   // update iop-order list to have entries for the new modules
   dt_ioppr_update_for_modules(dev_dest, mod_list, FALSE);
@@ -577,14 +589,53 @@ static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_im
   // write history and forms to db
   dt_dev_write_history_ext(dev_dest, dest_imgid);
 
-  dt_dev_cleanup(dev_src);
   dt_dev_cleanup(dev_dest);
 
   g_list_free(modules_used);
+}
+
+static int _history_copy_and_paste_on_image_merge(int32_t imgid, int32_t dest_imgid, GList *ops, const gboolean copy_full)
+{
+  dt_develop_t _dev_src = { 0 };
+  dt_develop_t *dev_src = &_dev_src;
+
+  _history_paste_source_init(dev_src, imgid);
+  GList *mod_list = _history_paste_source_modules(dev_src, ops, copy_full);
+  _history_paste_merge(dev_src, mod_list, dest_imgid);
+
+  g_list_free(mod_list);
+  dt_dev_cleanup(dev_src);
 
   return 0;
 }
 
+// the SQL list of the operations not to copy
+static gchar *_history_skip_modules(const gboolean copy_full)
+{
+  gchar *skip_modules = NULL;
+
+  if(!copy_full)
+  {
+    for(GList *modules = darktable.iop; modules; modules = g_list_next(modules))
+    {
+      dt_iop_module_so_t *module = (dt_iop_module_so_t *)modules->data;
+
+      if(dt_history_module_skip_copy(module->flags()))
+      {
+        if(skip_modules)
+          skip_modules = dt_util_dstrcat(skip_modules, ",");
+
+        skip_modules = dt_util_dstrcat(skip_modules, "'%s'", module->op);
+      }
+    }
+  }
+
+  if(!skip_modules)
+    skip_modules = g_strdup("'@'");
+
+  return skip_modules;
+}
+
 static int _history_copy_and_paste_on_image_overwrite(const int32_t imgid, const int32_t dest_imgid, GList *ops, const gboolean copy_full)
 {
   int ret_val = 0;
@@ -617,26 +668,7 @@ static int _history_copy_and_paste_on_image_overwrite(const int32_t imgid, const
   if(!ops)
   {
     // let's build the list of IOP to not copy
-    gchar *skip_modules = NULL;
-
-    if(!copy_full)
-    {
-      for(GList *modules = darktable.iop; modules; modules = g_list_next(modules))
-      {
-        dt_iop_module_so_t *module = (dt_iop_module_so_t *)modules->data;
-
-        if(dt_history_module_skip_copy(module->flags()))
-        {
-          if(skip_modules)
-            skip_modules = dt_util_dstrcat(skip_modules, ",");
-
-          skip_modules = dt_util_dstrcat(skip_modules, "'%s'", module->op);
-        }
-      }
-    }
-
-    if(!skip_modules)
-      skip_modules = g_strdup("'@'");
+    gchar *skip_modules = _history_skip_modules(copy_full);
 
     // clang-format off
     gchar *query = g_strdup_printf
@@ -806,7 +838,7 @@ gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t d
   /* update xmp file */
   dt_image_synch_xmp(dest_imgid);
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  dt_mipmap_cache_regenerate(darktable.mipmap_cache, dest_imgid);
   dt_image_update_final_size(imgid);
 
   /* update the aspect ratio. recompute only if really needed for performance reasons */
@@ -821,6 +853,250 @@ gboolean dt_history_copy_and_paste_on_image(const int32_t imgid, const int32_t d
   return ret_val;
 }
 
+// clear the history of all images of memory.bulk_images
+static void _history_clear_bulk(void)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  // clang-format off
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM main.history"
+                            " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM main.masks_history"
+                            " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "UPDATE main.images SET history_end = 0, aspect_ratio = 0.0"
+                            " WHERE id IN (SELECT imgid FROM memory.bulk_images)", NULL, NULL, NULL);
+  // clang-format on
+}
+
+// overwrite the history of all images of memory.bulk_images by the one of imgid, as
+// _history_copy_and_paste_on_image_overwrite() does without ops, one statement per table
+static void _history_overwrite_bulk(const int32_t imgid, const gboolean copy_full)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  gchar *skip_modules = _history_skip_modules(copy_full);
+
+  _history_clear_bulk();
+
+  // clang-format off
+  gchar *query = g_strdup_printf
+    ("INSERT INTO main.history "
+     "            (imgid,num,module,operation,op_params,enabled,blendop_params, "
+     "             blendop_version,multi_priority,multi_name)"
+     " SELECT b.imgid,h.num,h.module,h.operation,h.op_params,h.enabled,h.blendop_params, "
+     "        h.blendop_version,h.multi_priority,h.multi_name "
+     " FROM main.history AS h, memory.bulk_images AS b"
+     " WHERE h.imgid=?1"
+     "       AND h.operation NOT IN (%s)"
+     " ORDER BY b.num, h.num", skip_modules);
+  // clang-format on
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  // clang-format off
+  query = g_strdup_printf
+    ("INSERT INTO main.masks_history "
+     "           (imgid, num, formid, form, name, version, points, points_count, source)"
+     " SELECT b.imgid, m.num, m.formid, m.form, m.name, m.version, m.points, m.points_count, m.source "
+     "  FROM main.masks_history AS m, memory.bulk_images AS b"
+     "  WHERE m.imgid = ?1"
+     "    AND m.num NOT IN (SELECT num FROM history WHERE imgid=?1 AND OPERATION IN (%s))", skip_modules);
+  // clang-format on
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_free(skip_modules);
+
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "UPDATE main.images"
+                              " SET history_end = IFNULL((SELECT history_end FROM main.images WHERE id = ?1), 0)"
+                              " WHERE id IN (SELECT imgid FROM memory.bulk_images)",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  // copy the module order
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "INSERT OR REPLACE INTO main.module_order (imgid, iop_list, version)"
+                              " SELECT b.imgid, o.iop_list, o.version"
+                              "   FROM main.module_order AS o, memory.bulk_images AS b"
+                              "   WHERE o.imgid = ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  // and the history hash, except mipmap hash. the source image may have none yet
+  // clang-format off
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM main.history_hash"
+                            " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "INSERT INTO main.history_hash"
+                              "    (imgid, basic_hash, auto_hash, current_hash)"
+                              " SELECT b.imgid, h.basic_hash, h.auto_hash, h.current_hash"
+                              "   FROM main.history_hash AS h, memory.bulk_images AS b"
+                              "   WHERE h.imgid = ?1",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// merges of one source history into many images, spread over a few threads with a develop each
+#define DT_HISTORY_PASTE_THREADS 8
+
+typedef struct dt_history_paste_t
+{
+  dt_develop_t *dev_src;
+  GList *mod_list;
+  const int32_t *dest;
+  int count;
+  dt_atomic_int next;
+} dt_history_paste_t;
+
+static gpointer _history_paste_merge_thread(gpointer data)
+{
+  dt_history_paste_t *paste = (dt_history_paste_t *)data;
+  for(int k = dt_atomic_add_int(&paste->next, 1); k < paste->count; k = dt_atomic_add_int(&paste->next, 1))
+    _history_paste_merge(paste->dev_src, paste->mod_list, paste->dest[k]);
+  return NULL;
+}
+
+static void _history_paste_merge_list(const int32_t imgid, const int32_t *dest, const int count, GList *ops,
+                                      const gboolean copy_full)
+{
+  dt_develop_t _dev_src = { 0 };
+  dt_develop_t *dev_src = &_dev_src;
+  _history_paste_source_init(dev_src, imgid);
+
+  dt_history_paste_t paste = { .dev_src = dev_src,
+                               .mod_list = _history_paste_source_modules(dev_src, ops, copy_full),
+                               .dest = dest,
+                               .count = count };
+  dt_atomic_set_int(&paste.next, 0);
+
+  const int nthreads = MIN(count, MIN(DT_HISTORY_PASTE_THREADS, (int)dt_get_num_threads()));
+  if(nthreads <= 1)
+    _history_paste_merge_thread(&paste);
+  else
+  {
+    GThread *threads[DT_HISTORY_PASTE_THREADS];
+    for(int t = 0; t < nthreads; t++) threads[t] = g_thread_new("history paste", _history_paste_merge_thread, &paste);
+    for(int t = 0; t < nthreads; t++) g_thread_join(threads[t]);
+  }
+
+  g_list_free(paste.mod_list);
+  dt_dev_cleanup(dev_src);
+}
+
+void dt_history_copy_and_paste_on_list(const int32_t imgid, const GList *list, const gboolean merge, GList *ops,
+                                       const gboolean copy_iop_order, const gboolean copy_full)
+{
+  if(imgid == -1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return;
+  }
+
+  GList *dests = NULL;
+  for(const GList *l = list; l; l = g_list_next(l))
+    if(GPOINTER_TO_INT(l->data) != imgid) dests = g_list_prepend(dests, l->data);
+  dests = g_list_reverse(dests);
+  const int count = g_list_length(dests);
+  if(count == 0) return;
+
+  // be sure the current history is written before pasting some other history data
+  const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+  if(cv->view((dt_view_t *)cv) == DT_VIEW_DARKROOM) dt_dev_write_history(darktable.develop);
+
+  int32_t *dest = malloc(sizeof(int32_t) * count);
+  dt_undo_lt_history_t **hist = malloc(sizeof(dt_undo_lt_history_t *) * count);
+  int k = 0;
+  for(const GList *l = dests; l; l = g_list_next(l), k++)
+  {
+    dest[k] = GPOINTER_TO_INT(l->data);
+    hist[k] = dt_history_snapshot_item_init();
+    hist[k]->imgid = dest[k];
+    dt_history_snapshot_undo_create(hist[k]->imgid, &hist[k]->before, &hist[k]->before_history_end);
+  }
+
+  if(copy_iop_order)
+  {
+    GList *iop_list = dt_ioppr_get_iop_order_list(imgid, FALSE);
+    for(k = 0; k < count; k++) dt_ioppr_write_iop_order_list(iop_list, dest[k]);
+    g_list_free_full(iop_list, g_free);
+  }
+
+  if(!merge)
+  {
+    dt_database_set_bulk_images(darktable.db, dests);
+    dt_database_start_transaction(darktable.db);
+    if(ops)
+      _history_clear_bulk();
+    else
+      _history_overwrite_bulk(imgid, copy_full);
+    dt_database_release_transaction(darktable.db);
+  }
+  // since the history and masks where deleted we can do a merge
+  if(merge || ops) _history_paste_merge_list(imgid, dest, count, ops, copy_full);
+
+  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+  for(k = 0; k < count; k++)
+  {
+    dt_history_snapshot_undo_create(hist[k]->imgid, &hist[k]->after, &hist[k]->after_history_end);
+    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist[k],
+                   dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+  }
+  dt_undo_end_group(darktable.undo);
+
+  /* attach changed tag reflecting actual change */
+  guint tagid = 0;
+  if(dt_tag_new("darktable|changed", &tagid)) dt_tag_attach_images(tagid, dests, FALSE);
+
+  for(k = 0; k < count; k++)
+  {
+    /* set change_timestamp */
+    dt_image_cache_set_change_timestamp(darktable.image_cache, dest[k]);
+
+    /* if current image in develop reload history */
+    // FIXME: this is GUI update. That doesn't belong to history management.
+    if(dt_dev_is_current_image(darktable.develop, dest[k]))
+    {
+      dt_dev_reload_history_items(darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    }
+
+    dt_mipmap_cache_regenerate(darktable.mipmap_cache, dest[k]);
+    dt_image_update_final_size(dest[k]);
+
+    /* update the aspect ratio. recompute only if really needed for performance reasons */
+    if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
+      dt_image_set_aspect_ratio(dest[k], FALSE);
+    else
+      dt_image_reset_aspect_ratio(dest[k], FALSE);
+  }
+
+  /* update xmp files */
+  dt_sidecar_writer_queue_list(dests);
+
+  // signal that the mipmaps need to be updated
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, count > 1 ? -1 : dest[0]);
+
+  free(hist);
+  free(dest);
+  g_list_free(dests);
+}
+
 char *dt_history_item_as_string(const char *name, gboolean enabled)
 {
   return g_strconcat(enabled ? "\342\227\217" : "\342\227\213", "  ", name, NULL);
@@ -915,174 +1191,97 @@ char *dt_history_get_items_as_string(const int32_t imgid)
   return result;
 }
 
-static int dt_history_end_attop(const int32_t imgid)
+// compress the history of all images of memory.bulk_images at once: keep the last entry of each module
+// instance below history_end and the last masks, then number the entries from 0 without gaps, with a mask
+// manager entry first if there are masks. one statement per step for the whole batch.
+static void _history_compress_bulk(void)
 {
-  int size=0;
-  int end=0;
-  sqlite3_stmt *stmt;
+  sqlite3 *db = dt_database_get(darktable.db);
 
-  // get highest num in history
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT MAX(num) FROM main.history WHERE imgid=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    size = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  // get history_end
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    end = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  // fprintf(stderr,"\ndt_history_end_attop for image %i: size %i, end %i",imgid,size,end);
+  dt_database_start_transaction(darktable.db);
 
-  // a special case right after removing all history
-  // It must be absolutely fresh and untouched so history_end is always on top
-  if ((size==0) && (end==0)) return -1;
+  // compress history, keep disabled modules as documented. the mask manager entries are all dropped,
+  // there will be one at the start if there are masks left
+  // clang-format off
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "DELETE FROM main.history"
+                        " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)"
+                        "   AND (operation = 'mask_manager'"
+                        "        OR num >= (SELECT history_end FROM main.images WHERE id = main.history.imgid)"
+                        "        OR EXISTS (SELECT 1 FROM main.history AS h"
+                        "                    WHERE h.imgid = main.history.imgid"
+                        "                      AND h.operation = main.history.operation"
+                        "                      AND h.multi_priority = main.history.multi_priority"
+                        "                      AND h.num > main.history.num"
+                        "                      AND h.num < (SELECT history_end FROM main.images"
+                        "                                    WHERE id = main.history.imgid)))",
+                        NULL, NULL, NULL);
 
-  // return 1 if end is larger than size
-  if (end > size) return 1;
+  // compress masks history
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "DELETE FROM main.masks_history"
+                        " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)"
+                        "   AND num NOT IN (SELECT IFNULL(MAX(m.num), -1) FROM main.masks_history AS m"
+                        "                    WHERE m.imgid = main.masks_history.imgid"
+                        "                      AND m.num < (SELECT history_end FROM main.images"
+                        "                                    WHERE id = main.masks_history.imgid))",
+                        NULL, NULL, NULL);
+
+  // the new numbers, shifted by one when the mask manager goes first. they are computed apart
+  // because the update can't read the table it is renumbering
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.history_compress", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "INSERT INTO memory.history_compress (imgid, num, new_num)"
+                        " SELECT h.imgid, h.num,"
+                        "        (SELECT COUNT(*) FROM main.history AS p"
+                        "          WHERE p.imgid = h.imgid AND p.num < h.num)"
+                        "        + EXISTS (SELECT 1 FROM main.masks_history AS m WHERE m.imgid = h.imgid)"
+                        "  FROM main.history AS h"
+                        "  WHERE h.imgid IN (SELECT imgid FROM memory.bulk_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "UPDATE main.history"
+                        " SET num = (SELECT new_num FROM memory.history_compress AS c"
+                        "             WHERE c.imgid = main.history.imgid AND c.num = main.history.num)"
+                        " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)",
+                        NULL, NULL, NULL);
+
+  // the masks are owned by the manager at slot 0
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "UPDATE main.masks_history SET num = 0"
+                        " WHERE imgid IN (SELECT imgid FROM memory.bulk_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "INSERT INTO main.history (imgid, num, operation, op_params, module, enabled, "
+                        "                          blendop_params, blendop_version, multi_priority, multi_name)"
+                        " SELECT b.imgid, 0, 'mask_manager', NULL, 1, 0, NULL, 0, 0, ''"
+                        "  FROM memory.bulk_images AS b"
+                        "  WHERE EXISTS (SELECT 1 FROM main.masks_history AS m WHERE m.imgid = b.imgid)",
+                        NULL, NULL, NULL);
+
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "UPDATE main.images"
+                        " SET history_end = (SELECT COUNT(*) FROM main.history WHERE imgid = main.images.id)"
+                        " WHERE id IN (SELECT imgid FROM memory.bulk_images)",
+                        NULL, NULL, NULL);
+  // clang-format on
 
-  // no compression as history_end is right in the middle of stack
-  return 0;
+  dt_database_release_transaction(darktable.db);
 }
 
-
 /* Please note: dt_history_compress_on_image
   - is used in lighttable and darkroom mode
   - It compresses history *exclusively* in the database and does *not* touch anything on the history stack
 */
 void dt_history_compress_on_image(const int32_t imgid)
 {
-  sqlite3_stmt *stmt;
-
-  // get history_end for image
-  int my_history_end = 0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT history_end FROM main.images WHERE id=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    my_history_end = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  if (my_history_end == 0)
-  {
-    dt_history_delete_on_image(imgid);
-    return;
-  }
-
-  int masks_count = 0;
-  const char *op_mask_manager = "mask_manager";
-  gboolean manager_position = FALSE;
-
-  dt_database_start_transaction(darktable.db);
-
-  // We must know for sure whether there is a mask manager at slot 0 in history
-  // because only if this is **not** true history nums and history_end must be increased
-  // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT COUNT(*) FROM main.history WHERE imgid = ?1 AND operation = ?2 AND num = 0", -1, &stmt, NULL);
-  // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    if (sqlite3_column_int(stmt, 0) == 1) manager_position = TRUE;
-  }
-  sqlite3_finalize(stmt);
-
-  // compress history, keep disabled modules as documented
-  // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.history"
-                              " WHERE imgid = ?1 AND num NOT IN"
-                              "   (SELECT MAX(num) FROM main.history"
-                              "     WHERE imgid = ?1 AND num < ?2"
-                              "     GROUP BY operation, multi_priority)",
-                              -1, &stmt, NULL);
-  // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, my_history_end);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  // delete all mask_manager entries
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "DELETE FROM main.history WHERE imgid = ?1 AND operation = ?2", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  // compress masks history
-  // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "DELETE FROM main.masks_history"
-                              " WHERE imgid = ?1 "
-                              "   AND num NOT IN (SELECT MAX(num)"
-                              "                   FROM main.masks_history"
-                              "                   WHERE imgid = ?1 AND num < ?2)", -1, &stmt, NULL);
-  // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, my_history_end);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-
-  // if there are masks create a mask manager entry, so we need to count them
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-    "SELECT COUNT(*) FROM main.masks_history WHERE imgid = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW) masks_count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
-
-  if(masks_count > 0)
-  {
-    // Set num in masks history to make sure they are owned by the manager at slot 0.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-      "UPDATE main.masks_history SET num = 0 WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    if (!manager_position)
-    {
-      // make room for mask manager history entry
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.history SET num=num+1 WHERE imgid = ?1", -1, &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-
-      // update history end
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.images SET history_end = history_end+1 WHERE id = ?1", -1, &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-    }
+  GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+  dt_database_set_bulk_images(darktable.db, imgs);
+  g_list_free(imgs);
 
-    // create a mask manager entry in history as first entry
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT INTO main.history (imgid, num, operation, op_params, module, enabled, "
-                                "                          blendop_params, blendop_version, multi_priority, multi_name) "
-                                " VALUES(?1, 0, ?2, NULL, 1, 0, NULL, 0, 0, '')",
-                                -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, op_mask_manager, -1, SQLITE_TRANSIENT);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-  }
+  _history_compress_bulk();
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
 
-  dt_database_release_transaction(darktable.db);
-
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, imgid);
 }
 
@@ -1146,81 +1345,48 @@ void dt_history_truncate_on_image(const int32_t imgid, const int32_t history_end
 
 int dt_history_compress_on_list(const GList *imgs)
 {
-  int uncompressed=0;
+  int uncompressed = 0;
+  sqlite3_stmt *stmt;
 
-  // Get the list of selected images
-  for(const GList *l = imgs; l; l = g_list_next(l))
+  // only the histories whose end is at the top get compressed, read that for all images at once
+  dt_database_set_bulk_images(darktable.db, imgs);
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT b.imgid, IFNULL(i.history_end, 0),"
+                              "       IFNULL((SELECT MAX(num) FROM main.history WHERE imgid = b.imgid), 0)"
+                              " FROM memory.bulk_images AS b"
+                              " LEFT JOIN main.images AS i ON i.id = b.imgid",
+                              -1, &stmt, NULL);
+  // clang-format on
+  GList *attop = NULL;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    const int imgid = GPOINTER_TO_INT(l->data);
-    const int test = dt_history_end_attop(imgid);
-    if(test == 1) // we do a compression and we know for sure history_end is at the top!
-    {
-      dt_history_compress_on_image(imgid);
-
-      // now the modules are in right order but need renumbering to remove leaks
-      int max=0;    // the maximum num in main_history for an image
-      int size=0;   // the number of items in main_history for an image
-      int done=0;   // used for renumbering index
-
-      sqlite3_stmt *stmt2;
-
-      // get highest num in history
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT MAX(num) FROM main.history WHERE imgid=?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      if (sqlite3_step(stmt2) == SQLITE_ROW)
-        max = sqlite3_column_int(stmt2, 0);
-      sqlite3_finalize(stmt2);
-
-      // get number of items in main.history
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "SELECT COUNT(*) FROM main.history WHERE imgid = ?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      if(sqlite3_step(stmt2) == SQLITE_ROW)
-        size = sqlite3_column_int(stmt2, 0);
-      sqlite3_finalize(stmt2);
+    const int end = sqlite3_column_int(stmt, 1);
+    const int size = sqlite3_column_int(stmt, 2);
+    if(size == 0 && end == 0) continue; // fresh image, nothing to do
+    if(end > size)
+      attop = g_list_prepend(attop, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    else
+      uncompressed++; // no compression as history_end is right in the middle of history
+  }
+  sqlite3_finalize(stmt);
+  attop = g_list_reverse(attop);
 
-      if ((size>0) && (max>0))
-      {
-        for (int index=0;index<(max+1);index++)
-        {
-          sqlite3_stmt *stmt3;
-          DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-            "SELECT num FROM main.history WHERE imgid=?1 AND num=?2", -1, &stmt3, NULL);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 1, imgid);
-          DT_DEBUG_SQLITE3_BIND_INT(stmt3, 2, index);
-          if (sqlite3_step(stmt3) == SQLITE_ROW)
-          {
-            sqlite3_stmt *stmt4;
-            // step by step set the correct num
-            DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-              "UPDATE main.history SET num = ?3 WHERE imgid = ?1 AND num = ?2", -1, &stmt4, NULL);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 1, imgid);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 2, index);
-            DT_DEBUG_SQLITE3_BIND_INT(stmt4, 3, done);
-            sqlite3_step(stmt4);
-            sqlite3_finalize(stmt4);
-
-            done++;
-          }
-          sqlite3_finalize(stmt3);
-        }
-      }
-      // update history end
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-        "UPDATE main.images SET history_end = ?2 WHERE id = ?1", -1, &stmt2, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 1, imgid);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt2, 2, done);
-      sqlite3_step(stmt2);
-      sqlite3_finalize(stmt2);
+  if(attop)
+  {
+    dt_database_set_bulk_images(darktable.db, attop);
+    _history_compress_bulk();
+  }
 
-      dt_image_write_sidecar_file(imgid);
-    }
-    if(test == 0) // no compression as history_end is right in the middle of history
-      uncompressed++;
+  for(const GList *l = imgs; l; l = g_list_next(l))
+    dt_history_hash_write_from_history(GPOINTER_TO_INT(l->data), DT_HISTORY_HASH_CURRENT);
 
-    dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
+  if(attop)
+  {
+    dt_sidecar_writer_queue_list(attop);
+    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, -1);
   }
+  g_list_free(attop);
 
   return uncompressed;
 }
@@ -1680,15 +1846,10 @@ gboolean dt_history_paste_on_list(const GList *list, gboolean undo)
   const gboolean merge = dt_conf_get_bool("plugins/lighttable/copy_history/pastemode");
 
   if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  for(GList *l = (GList *)list; l; l = g_list_next(l))
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest, merge,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
-  }
+  dt_history_copy_and_paste_on_list(darktable.view_manager->copy_paste.copied_imageid, list, merge,
+                                    darktable.view_manager->copy_paste.selops,
+                                    darktable.view_manager->copy_paste.copy_iop_order,
+                                    darktable.view_manager->copy_paste.full_copy);
   if(undo) dt_undo_end_group(darktable.undo);
 
   // In darkroom and if there is a copy of the iop-order we need to rebuild the pipe
@@ -1729,15 +1890,10 @@ gboolean dt_history_paste_parts_on_list(const GList *list, gboolean undo)
   const gboolean merge = dt_conf_get_bool("plugins/lighttable/copy_history/pastemode");
 
   if(undo) dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-  for (const GList *l = l_copy; l; l = g_list_next(l))
-  {
-    const int dest = GPOINTER_TO_INT(l->data);
-    dt_history_copy_and_paste_on_image(darktable.view_manager->copy_paste.copied_imageid,
-                                       dest, merge,
-                                       darktable.view_manager->copy_paste.selops,
-                                       darktable.view_manager->copy_paste.copy_iop_order,
-                                       darktable.view_manager->copy_paste.full_copy);
-  }
+  dt_history_copy_and_paste_on_list(darktable.view_manager->copy_paste.copied_imageid, l_copy, merge,
+                                    darktable.view_manager->copy_paste.selops,
+                                    darktable.view_manager->copy_paste.copy_iop_order,
+                                    darktable.view_manager->copy_paste.full_copy);
   if(undo) dt_undo_end_group(darktable.undo);
 
   g_list_free(l_copy);
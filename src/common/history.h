@@ -67,6 +67,11 @@ int dt_history_merge_module_into_history(struct dt_develop_t *dev_dest, struct d
 /** copy history from imgid and pasts on dest_imgid, merge or overwrite... */
 int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops, gboolean copy_iop_order, const gboolean copy_full);
 
+/** copy history from imgid and pastes on all images of list, merge or overwrite. the source history is read once,
+    overwrites without ops are plain SQL copies and merges run on a few threads */
+void dt_history_copy_and_paste_on_list(const int32_t imgid, const GList *list, const gboolean merge, GList *ops,
+                                       const gboolean copy_iop_order, const gboolean copy_full);
+
 /** delete all history for the given image */
 void dt_history_delete_on_image(int32_t imgid);
 
@@ -0,0 +1,181 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/history_cache.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "control/conf.h"
+
+#include <sqlite3.h>
+#include <string.h>
+
+typedef struct _entry_t
+{
+  int32_t imgid;
+  guint8 *blob;
+  size_t size;
+} _entry_t;
+
+typedef struct dt_history_cache_t
+{
+  GMutex lock;
+  GHashTable *entries; // imgid -> _entry_t
+  GQueue order;        // _entry_t, oldest first
+  size_t memory;
+  size_t max_memory;
+} dt_history_cache_t;
+
+static dt_history_cache_t _cache = { 0 };
+
+static void _entry_free(_entry_t *entry)
+{
+  g_free(entry->blob);
+  free(entry);
+}
+
+// with the lock held
+static void _remove(const int32_t imgid)
+{
+  _entry_t *entry = (_entry_t *)g_hash_table_lookup(_cache.entries, GINT_TO_POINTER(imgid));
+  if(!entry) return;
+  g_hash_table_remove(_cache.entries, GINT_TO_POINTER(imgid));
+  g_queue_remove(&_cache.order, entry);
+  _cache.memory -= entry->size;
+  _entry_free(entry);
+}
+
+// called by the triggers for each row of main.history written
+static void _history_changed(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  if(argc == 1 && sqlite3_value_type(argv[0]) == SQLITE_INTEGER)
+    dt_history_cache_remove(sqlite3_value_int(argv[0]));
+  sqlite3_result_null(context);
+}
+
+void dt_history_cache_init(void)
+{
+  _cache.max_memory = (size_t)MAX(dt_conf_get_int("history_cache_memory"), 0) * 1024 * 1024;
+  if(_cache.max_memory == 0) return;
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  if(sqlite3_create_function(db, "dt_history_changed", 1, SQLITE_UTF8, NULL, _history_changed, NULL, NULL)
+     != SQLITE_OK)
+  {
+    fprintf(stderr, "[history_cache] can't register the invalidation function, cache disabled\n");
+    _cache.max_memory = 0;
+    return;
+  }
+
+  // the triggers are temporary: they only exist for this connection and don't touch the library schema
+  // clang-format off
+  int rc = sqlite3_exec(db,
+                        "CREATE TEMP TRIGGER IF NOT EXISTS dt_history_cache_insert AFTER INSERT ON main.history"
+                        " BEGIN SELECT dt_history_changed(NEW.imgid); END;"
+                        "CREATE TEMP TRIGGER IF NOT EXISTS dt_history_cache_update AFTER UPDATE ON main.history"
+                        " BEGIN SELECT dt_history_changed(OLD.imgid); SELECT dt_history_changed(NEW.imgid); END;"
+                        "CREATE TEMP TRIGGER IF NOT EXISTS dt_history_cache_delete AFTER DELETE ON main.history"
+                        " BEGIN SELECT dt_history_changed(OLD.imgid); END;",
+                        NULL, NULL, NULL);
+  // clang-format on
+  if(rc != SQLITE_OK)
+  {
+    fprintf(stderr, "[history_cache] can't create the invalidation triggers, cache disabled: %s\n",
+            sqlite3_errmsg(db));
+    _cache.max_memory = 0;
+    return;
+  }
+
+  _cache.entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&_cache.order);
+}
+
+void dt_history_cache_cleanup(void)
+{
+  if(!_cache.entries) return;
+  g_mutex_lock(&_cache.lock);
+  g_queue_foreach(&_cache.order, (GFunc)_entry_free, NULL);
+  g_queue_clear(&_cache.order);
+  g_hash_table_destroy(_cache.entries);
+  _cache.entries = NULL;
+  _cache.memory = 0;
+  g_mutex_unlock(&_cache.lock);
+}
+
+gboolean dt_history_cache_get(const int32_t imgid, guint8 **blob, size_t *size)
+{
+  if(!_cache.entries) return FALSE;
+
+  g_mutex_lock(&_cache.lock);
+  _entry_t *entry = (_entry_t *)g_hash_table_lookup(_cache.entries, GINT_TO_POINTER(imgid));
+  if(entry)
+  {
+    *blob = g_malloc(entry->size);
+    memcpy(*blob, entry->blob, entry->size);
+    *size = entry->size;
+  }
+  g_mutex_unlock(&_cache.lock);
+
+  dt_print(DT_DEBUG_HISTORY, "[history_cache] history of image %i %s\n", imgid, entry ? "cached" : "not cached");
+  return entry != NULL;
+}
+
+void dt_history_cache_put(const int32_t imgid, guint8 *blob, const size_t size)
+{
+  if(!_cache.entries || size > _cache.max_memory)
+  {
+    g_free(blob);
+    return;
+  }
+
+  _entry_t *entry = (_entry_t *)malloc(sizeof(_entry_t));
+  if(!entry)
+  {
+    g_free(blob);
+    return;
+  }
+  entry->imgid = imgid;
+  entry->blob = blob;
+  entry->size = size;
+
+  g_mutex_lock(&_cache.lock);
+  _remove(imgid);
+  while(_cache.memory + size > _cache.max_memory)
+  {
+    _entry_t *oldest = (_entry_t *)g_queue_peek_head(&_cache.order);
+    _remove(oldest->imgid);
+  }
+  g_hash_table_insert(_cache.entries, GINT_TO_POINTER(imgid), entry);
+  g_queue_push_tail(&_cache.order, entry);
+  _cache.memory += size;
+  g_mutex_unlock(&_cache.lock);
+}
+
+void dt_history_cache_remove(const int32_t imgid)
+{
+  if(!_cache.entries) return;
+  g_mutex_lock(&_cache.lock);
+  _remove(imgid);
+  g_mutex_unlock(&_cache.lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,50 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/**
+ * Keeps the history stacks read by dt_dev_read_history_ext(), already validated and upgraded to the current
+ * module versions, as one blob per image. The next read of the same image rebuilds the stack from the blob
+ * instead of checking and converting each row of main.history, and doesn't rewrite the rows.
+ *
+ * The blobs only live as long as the process: within it the modules and their params don't change. Temporary
+ * triggers on main.history drop the blob of an image as soon as any code path writes its rows, so a blob always
+ * matches the database. The memory taken is bounded by the `history_cache_memory` preference, the oldest blobs
+ * go first.
+ */
+
+void dt_history_cache_init(void);
+void dt_history_cache_cleanup(void);
+
+/** copy of the blob of imgid in *blob, to be freed with g_free(). FALSE if there is none */
+gboolean dt_history_cache_get(const int32_t imgid, guint8 **blob, size_t *size);
+
+/** take ownership of blob as the history of imgid */
+void dt_history_cache_put(const int32_t imgid, guint8 *blob, const size_t size);
+
+void dt_history_cache_remove(const int32_t imgid);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -40,6 +40,12 @@ typedef struct _connection_t
   gpointer user_data;
 } _connection_t;
 
+typedef struct _service_t
+{
+  dt_http_server_request_callback callback;
+  gpointer user_data;
+} _service_t;
+
 static const char reply[]
     = "<!DOCTYPE html>\n"
       "<html>\n"
@@ -119,30 +125,30 @@ end:
   }
 }
 
-dt_http_server_t *dt_http_server_create(const int *ports, const int n_ports, const char *id,
-                                        const dt_http_server_callback callback, gpointer user_data)
+// bind a new server on 127.0.0.1 to the first free port of ports, written to *port.
+static SoupServer *_server_listen(const int *ports, const int n_ports, int *port)
 {
   SoupServer *httpserver = NULL;
-  int port = 0;
+  *port = 0;
 
 #ifdef OLD_API
   dt_print(DT_DEBUG_CONTROL, "[http server] using the old libsoup api\n");
 
   for(int i = 0; i < n_ports; i++)
   {
-    port = ports[i];
+    *port = ports[i];
 
-    SoupAddress *httpaddress = soup_address_new("127.0.0.1", port);
+    SoupAddress *httpaddress = soup_address_new("127.0.0.1", *port);
 
     if(!httpaddress)
     {
-      fprintf(stderr, "couldn't create libsoup httpaddress on port %d\n", port);
+      fprintf(stderr, "couldn't create libsoup httpaddress on port %d\n", *port);
       return NULL;
     }
 
     if(soup_address_resolve_sync(httpaddress, NULL) != SOUP_STATUS_OK)
     {
-      fprintf(stderr, "error: can't resolve 127.0.0.1:%d\n", port);
+      fprintf(stderr, "error: can't resolve 127.0.0.1:%d\n", *port);
       return NULL;
     }
 
@@ -172,20 +178,31 @@ dt_http_server_t *dt_http_server_create(const int *ports, const int n_ports, con
 
   for(int i = 0; i < n_ports; i++)
   {
-    port = ports[i];
+    *port = ports[i];
 
-    if(soup_server_listen_local(httpserver, port, 0, NULL)) break;
+    if(soup_server_listen_local(httpserver, *port, 0, NULL)) break;
 
-    port = 0;
+    *port = 0;
   }
-  if(port == 0)
+  if(*port == 0)
   {
     fprintf(stderr, "error: can't bind to any port from our pool\n");
+    g_object_unref(httpserver);
     return NULL;
   }
 
 #endif
 
+  return httpserver;
+}
+
+dt_http_server_t *dt_http_server_create(const int *ports, const int n_ports, const char *id,
+                                        const dt_http_server_callback callback, gpointer user_data)
+{
+  int port = 0;
+  SoupServer *httpserver = _server_listen(ports, n_ports, &port);
+  if(httpserver == NULL) return NULL;
+
   dt_http_server_t *server = (dt_http_server_t *)malloc(sizeof(dt_http_server_t));
   server->server = httpserver;
 
@@ -211,6 +228,57 @@ dt_http_server_t *dt_http_server_create(const int *ports, const int n_ports, con
   return server;
 }
 
+// this is always in the thread running the default main loop
+static void _service_request(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+                             SoupClientContext *client, gpointer user_data)
+{
+  _service_t *service = (_service_t *)user_data;
+  GHashTable *form = NULL;
+
+  if(msg->method == SOUP_METHOD_POST)
+  {
+    // urlencoded form fields in the body replace the ones of the url
+    if(msg->request_body->length > 0) form = soup_form_decode(msg->request_body->data);
+    query = form;
+  }
+  else if(msg->method != SOUP_METHOD_GET)
+  {
+    soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+    return;
+  }
+
+  service->callback(msg, query, service->user_data);
+
+  if(form) g_hash_table_unref(form);
+}
+
+dt_http_server_t *dt_http_server_create_service(const int port, const char *path,
+                                                const dt_http_server_request_callback callback,
+                                                gpointer user_data)
+{
+  int bound = 0;
+  SoupServer *httpserver = _server_listen(&port, 1, &bound);
+  if(httpserver == NULL) return NULL;
+
+  dt_http_server_t *server = (dt_http_server_t *)malloc(sizeof(dt_http_server_t));
+  server->server = httpserver;
+  server->url = g_strdup_printf("http://localhost:%d%s", bound, path);
+
+  _service_t *service = (_service_t *)malloc(sizeof(_service_t));
+  service->callback = callback;
+  service->user_data = user_data;
+
+  soup_server_add_handler(httpserver, path, _service_request, service, free);
+
+#ifdef OLD_API
+  soup_server_run_async(httpserver);
+#endif
+
+  dt_print(DT_DEBUG_CONTROL, "[http server] serving %s\n", server->url);
+
+  return server;
+}
+
 void dt_http_server_kill(dt_http_server_t *server)
 {
   if(server->server)
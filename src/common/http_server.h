@@ -22,6 +22,10 @@
 
 typedef gboolean (*dt_http_server_callback)(GHashTable *query, gpointer user_data);
 
+/** answers one request of a service: sets the status and the response of msg.
+ *  query holds the url parameters, or the form fields of a POST body, and may be NULL. */
+typedef void (*dt_http_server_request_callback)(SoupMessage *msg, GHashTable *query, gpointer user_data);
+
 typedef struct dt_http_server_t
 {
   SoupServer *server;
@@ -35,6 +39,13 @@ typedef struct dt_http_server_t
 dt_http_server_t *dt_http_server_create(const int *ports, const int n_ports, const char *id,
                                         const dt_http_server_callback callback, gpointer user_data);
 
+/** create a long-lived http server on 127.0.0.1:port, answering every GET or POST request on path
+ *  with callback until it is killed. requests are handled one at a time by the default main loop.
+ */
+dt_http_server_t *dt_http_server_create_service(const int port, const char *path,
+                                                const dt_http_server_request_callback callback,
+                                                gpointer user_data);
+
 /** call this to kill a server manually. don't call this if the request was received.
  *  this also frees server.
  */
@@ -26,6 +26,7 @@
 #include "common/history.h"
 #include "common/history_snapshot.h"
 #include "common/image_cache.h"
+#include "common/image_index.h"
 #include "common/imageio.h"
 #include "common/imageio_rawspeed.h"
 #include "common/imageio_libraw.h"
@@ -39,6 +40,7 @@
 #include "control/control.h"
 #include "control/jobs.h"
 #include "develop/lightroom.h"
+#include "develop/pixelpipe_cache_disk.h"
 #include "win/filepath.h"
 #ifdef USE_LUA
 #include "lua/image.h"
@@ -84,7 +86,8 @@ typedef struct dt_undo_duplicate_t
 } dt_undo_duplicate_t;
 
 static void _pop_undo_execute(const int imgid, const gboolean before, const gboolean after);
-static int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t newversion, const gboolean undo);
+static int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t newversion, const gboolean undo,
+                                             const gboolean reload);
 static void _pop_undo(gpointer user_data, const dt_undo_type_t type, dt_undo_data_t data, const dt_undo_action_t action, GList **imgs);
 
 static int64_t max_image_position()
@@ -589,7 +592,7 @@ static void _pop_undo(gpointer user_data, const dt_undo_type_t type, dt_undo_dat
     {
       // restore image, note that we record the new imgid created while
       // restoring the duplicate.
-      undo->new_imgid = _image_duplicate_with_version(undo->orig_imgid, undo->version, FALSE);
+      undo->new_imgid = _image_duplicate_with_version(undo->orig_imgid, undo->version, FALSE, TRUE);
       *imgs = g_list_prepend(*imgs, GINT_TO_POINTER(undo->new_imgid));
     }
   }
@@ -612,6 +615,8 @@ static void _geotag_undo_data_free(gpointer data)
 
 static void _image_set_location(GList *imgs, const dt_image_geoloc_t *geoloc, GList **undo, const gboolean undo_on)
 {
+  // one transaction for the whole list instead of one per image
+  dt_database_start_transaction(darktable.db);
   for(GList *images = imgs; images; images = g_list_next(images))
   {
     const int32_t imgid = GPOINTER_TO_INT(images->data);
@@ -624,11 +629,12 @@ static void _image_set_location(GList *imgs, const dt_image_geoloc_t *geoloc, GL
 
       memcpy(&undogeotag->after, geoloc, sizeof(dt_image_geoloc_t));
 
-      *undo = g_list_append(*undo, undogeotag);
+      *undo = g_list_prepend(*undo, undogeotag);
     }
 
     _set_location(imgid, geoloc);
   }
+  dt_database_release_transaction(darktable.db);
 }
 
 void dt_image_set_locations(const GList *imgs, const dt_image_geoloc_t *geoloc, const gboolean undo_on)
@@ -666,6 +672,8 @@ static void _image_set_images_locations(const GList *img, const GArray *gloc,
                                         GList **undo, const gboolean undo_on)
 {
   int i = 0;
+  // one transaction for the whole list instead of one per image
+  dt_database_start_transaction(darktable.db);
   for(GList *imgs = (GList *)img; imgs; imgs = g_list_next(imgs))
   {
     const int32_t imgid = GPOINTER_TO_INT(imgs->data);
@@ -684,6 +692,7 @@ static void _image_set_images_locations(const GList *img, const GArray *gloc,
     _set_location(imgid, geoloc);
     i++;
   }
+  dt_database_release_transaction(darktable.db);
 }
 
 void dt_image_set_images_locations(const GList *imgs, const GArray *gloc, const gboolean undo_on)
@@ -722,9 +731,10 @@ void dt_image_update_final_size(const int32_t imgid)
 gboolean dt_image_get_final_size(const int32_t imgid, int *width, int *height)
 {
   // get the img strcut
-  dt_image_t *imgtmp = dt_image_cache_get(darktable.image_cache, imgid, 'r');
-  dt_image_t img = *imgtmp;
-  dt_image_cache_read_release(darktable.image_cache, imgtmp);
+  const dt_image_t *snapshot = dt_image_cache_snapshot(darktable.image_cache, imgid);
+  if(!snapshot) return 0;
+  dt_image_t img = *snapshot;
+  dt_image_cache_snapshot_release(darktable.image_cache, snapshot);
   // if we already have computed them
   if(img.final_height > 0 && img.final_width > 0)
   {
@@ -756,7 +766,7 @@ gboolean dt_image_get_final_size(const int32_t imgid, int *width, int *height)
   }
   dt_dev_cleanup(&dev);
 
-  imgtmp = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+  dt_image_t *imgtmp = dt_image_cache_get(darktable.image_cache, imgid, 'w');
   imgtmp->final_width = *width = wd;
   imgtmp->final_height = *height = ht;
   dt_image_cache_write_release(darktable.image_cache, imgtmp, DT_IMAGE_CACHE_RELAXED);
@@ -807,7 +817,7 @@ void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t orienta
 
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  dt_mipmap_cache_regenerate(darktable.mipmap_cache, imgid);
   dt_image_update_final_size(imgid);
   // write that through to xmp:
   dt_image_write_sidecar_file(imgid);
@@ -1108,6 +1118,7 @@ static int32_t _image_duplicate_with_version_ext(const int32_t imgid, const int3
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_image_index_reload_color_labels(darktable.image_index, newid);
 
     // clang-format off
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -1203,7 +1214,8 @@ static int32_t _image_duplicate_with_version_ext(const int32_t imgid, const int3
   return newid;
 }
 
-static int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t newversion, const gboolean undo)
+static int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t newversion, const gboolean undo,
+                                             const gboolean reload)
 {
   const int32_t newid = _image_duplicate_with_version_ext(imgid, newversion);
 
@@ -1235,14 +1247,20 @@ static int32_t _image_duplicate_with_version(const int32_t imgid, const int32_t
     }
     dt_grouping_add_to_group(grpid, newid);
 
-    dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, NULL);
+    if(reload)
+      dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, NULL);
   }
   return newid;
 }
 
 int32_t dt_image_duplicate_with_version(const int32_t imgid, const int32_t newversion)
 {
-  return _image_duplicate_with_version(imgid, newversion, TRUE);
+  return _image_duplicate_with_version(imgid, newversion, TRUE, TRUE);
+}
+
+int32_t dt_image_duplicate_no_reload(const int32_t imgid)
+{
+  return _image_duplicate_with_version(imgid, -1, TRUE, FALSE);
 }
 
 void dt_image_remove(const int32_t imgid)
@@ -1258,6 +1276,7 @@ void dt_image_remove(const int32_t imgid)
 
   // make sure we remove from the cache first, or else the cache will look for imgid in sql
   dt_image_cache_remove(darktable.image_cache, imgid);
+  dt_image_index_remove(darktable.image_index, imgid);
 
   const int new_group_id = dt_grouping_remove_from_group(imgid);
   if(darktable.gui && darktable.gui->expanded_group_id == old_group_id)
@@ -1277,6 +1296,9 @@ void dt_image_remove(const int32_t imgid)
 
   // also clear all thumbnails in mipmap_cache.
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+
+  // and the pipeline buffers stored on disk
+  dt_dev_pixelpipe_cache_disk_remove(imgid);
 }
 
 gboolean dt_image_altered(const int32_t imgid)
@@ -2191,6 +2213,7 @@ int32_t dt_image_copy_rename(const int32_t imgid, const int32_t filmid, const gc
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
         sqlite3_step(stmt);
         sqlite3_finalize(stmt);
+        dt_image_index_reload_color_labels(darktable.image_index, newid);
         // clang-format off
         DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                     "INSERT INTO main.meta_data (id, key, value)"
@@ -333,6 +333,9 @@ void dt_image_remove(const int32_t imgid);
 int32_t dt_image_duplicate_with_version(const int32_t imgid, const int32_t newversion);
 /** duplicates the given image in the database. */
 int32_t dt_image_duplicate(const int32_t imgid);
+/** duplicates the given image in the database without updating the collection, for callers duplicating
+    many images that update it once at the end. */
+int32_t dt_image_duplicate_no_reload(const int32_t imgid);
 /** flips the image, clock wise, if given flag. */
 void dt_image_flip(const int32_t imgid, const int32_t cw);
 void dt_image_set_flip(const int32_t imgid, const dt_image_orientation_t user_flip);
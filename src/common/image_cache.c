@@ -17,10 +17,13 @@
 */
 
 #include "common/image_cache.h"
+#include "common/atomic.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/image.h"
+#include "common/image_index.h"
+#include "common/sidecar_writer.h"
 #include "common/datetime.h"
 #include "control/conf.h"
 #include "develop/develop.h"
@@ -28,6 +31,51 @@
 #include <sqlite3.h>
 #include <inttypes.h>
 
+// a published version of an image struct, freed with its last reference
+typedef struct dt_image_cache_snapshot_t
+{
+  dt_image_t img; // first, so that the dt_image_t handed out is the snapshot itself
+  dt_atomic_int refs;
+} dt_image_cache_snapshot_t;
+
+static void _snapshot_unref(gpointer data)
+{
+  dt_image_cache_snapshot_t *snapshot = (dt_image_cache_snapshot_t *)data;
+  if(dt_atomic_sub_int(&snapshot->refs, 1) == 1) g_free(snapshot);
+}
+
+// make a copy of img the current version of image imgid, unless replace is FALSE and there is one already.
+// needs the read or write lock on the cache entry. returns the current version, with a reference for the
+// caller.
+static dt_image_cache_snapshot_t *_snapshot_publish(dt_image_cache_t *cache, const int32_t imgid,
+                                                    const dt_image_t *img, const gboolean replace)
+{
+  dt_image_cache_snapshot_t *fresh = (dt_image_cache_snapshot_t *)g_malloc(sizeof(dt_image_cache_snapshot_t));
+  memcpy(&fresh->img, img, sizeof(dt_image_t));
+  // owned by the cache entry, which may free them while the snapshot lives
+  fresh->img.profile = NULL;
+  fresh->img.profile_size = 0;
+  fresh->img.dng_gain_maps = NULL;
+  fresh->img.cache_entry = NULL;
+  dt_atomic_set_int(&fresh->refs, 1); // the table's
+
+  g_mutex_lock(&cache->snapshots_lock);
+  dt_image_cache_snapshot_t *current
+      = replace ? NULL : (dt_image_cache_snapshot_t *)g_hash_table_lookup(cache->snapshots, GINT_TO_POINTER(imgid));
+  if(!current)
+  {
+    // the previous version goes away with its last reader
+    g_hash_table_replace(cache->snapshots, GINT_TO_POINTER(imgid), fresh);
+    current = fresh;
+    fresh = NULL;
+  }
+  dt_atomic_add_int(&current->refs, 1);
+  g_mutex_unlock(&cache->snapshots_lock);
+
+  if(fresh) _snapshot_unref(fresh);
+  return current;
+}
+
 void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
 {
   entry->cost = sizeof(dt_image_t);
@@ -36,9 +84,8 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
   dt_image_init(img);
   entry->data = img;
   // load stuff from db and store in cache:
-  sqlite3_stmt *stmt;
   // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(
+  sqlite3_stmt *stmt = dt_database_get_statement(
       dt_database_get(darktable.db),
       "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure,"
       "       aperture, iso, focal_length, datetime_taken, flags, crop, orientation,"
@@ -46,11 +93,10 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
       "       colorspace, version, raw_black, raw_maximum, aspect_ratio, exposure_bias,"
       "       import_timestamp, change_timestamp, export_timestamp, print_timestamp, output_width, output_height"
       "  FROM main.images"
-      "  WHERE id = ?1",
-      -1, &stmt, NULL);
+      "  WHERE id = ?1");
   // clang-format on
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  if(stmt) DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
+  if(stmt && sqlite3_step(stmt) == SQLITE_ROW)
   {
     img->id = sqlite3_column_int(stmt, 0);
     img->group_id = sqlite3_column_int(stmt, 1);
@@ -158,7 +204,7 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
     fprintf(stderr, "[image_cache_allocate] failed to open image %" PRIu32 " from database: %s\n", entry->key,
             sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  if(stmt) sqlite3_reset(stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
@@ -166,6 +212,12 @@ void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
 
 void dt_image_cache_deallocate(void *data, dt_cache_entry_t *entry)
 {
+  // the next snapshot reloads the image like the cache does
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
+  g_mutex_lock(&cache->snapshots_lock);
+  g_hash_table_remove(cache->snapshots, GINT_TO_POINTER(entry->key));
+  g_mutex_unlock(&cache->snapshots_lock);
+
   dt_image_t *img = (dt_image_t *)entry->data;
   g_free(img->profile);
   g_list_free_full(img->dng_gain_maps, g_free);
@@ -185,6 +237,8 @@ void dt_image_cache_init(dt_image_cache_t *cache)
   dt_cache_init(&cache->cache, sizeof(dt_image_t), max_mem);
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate, cache);
   dt_cache_set_cleanup_callback(&cache->cache, &dt_image_cache_deallocate, cache);
+  cache->snapshots = g_hash_table_new_full(NULL, NULL, NULL, _snapshot_unref);
+  g_mutex_init(&cache->snapshots_lock);
 
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
 }
@@ -192,6 +246,8 @@ void dt_image_cache_init(dt_image_cache_t *cache)
 void dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
   dt_cache_cleanup(&cache->cache);
+  g_hash_table_destroy(cache->snapshots);
+  g_mutex_clear(&cache->snapshots_lock);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
@@ -222,6 +278,30 @@ dt_image_t *dt_image_cache_testget(dt_image_cache_t *cache, const int32_t imgid,
   return img;
 }
 
+const dt_image_t *dt_image_cache_snapshot(dt_image_cache_t *cache, const int32_t imgid)
+{
+  if(imgid <= 0) return NULL;
+
+  g_mutex_lock(&cache->snapshots_lock);
+  dt_image_cache_snapshot_t *snapshot
+      = (dt_image_cache_snapshot_t *)g_hash_table_lookup(cache->snapshots, GINT_TO_POINTER(imgid));
+  if(snapshot) dt_atomic_add_int(&snapshot->refs, 1);
+  g_mutex_unlock(&cache->snapshots_lock);
+  if(snapshot) return &snapshot->img;
+
+  // not read since it was loaded: publish the cached version
+  const dt_image_t *img = dt_image_cache_get(cache, imgid, 'r');
+  if(!img) return NULL;
+  snapshot = _snapshot_publish(cache, imgid, img, FALSE);
+  dt_image_cache_read_release(cache, img);
+  return &snapshot->img;
+}
+
+void dt_image_cache_snapshot_release(dt_image_cache_t *cache, const dt_image_t *img)
+{
+  if(img) _snapshot_unref((gpointer)img);
+}
+
 // drops the read lock on an image struct
 void dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
 {
@@ -307,14 +387,17 @@ void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_i
   const int rc = sqlite3_step(stmt);
   if(rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
   sqlite3_finalize(stmt);
+  if(rc == SQLITE_DONE) dt_image_index_update(darktable.image_index, img);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
-    // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    // also synch dttags file, in the background:
+    dt_sidecar_writer_queue(img->id);
   }
+  // readers see the new version from now on
+  _snapshot_unref(_snapshot_publish(cache, img->id, img, TRUE));
   dt_cache_release(&cache->cache, img->cache_entry);
 }
 
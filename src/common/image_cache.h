@@ -24,6 +24,9 @@
 typedef struct dt_image_cache_t
 {
   dt_cache_t cache;
+  // imgid -> the current immutable copy of the image struct, see dt_image_cache_snapshot()
+  GHashTable *snapshots;
+  GMutex snapshots_lock;
 }
 dt_image_cache_t;
 
@@ -63,6 +66,15 @@ void dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
 // is present, also to xmp sidecar files (safe setting).
 void dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_image_cache_write_mode_t mode);
 
+// returns an immutable copy of the image struct as of its last write release, without keeping any lock:
+// readers never wait for a writer syncing to the database and writers never wait for readers. only the
+// first snapshot of an image waits for its read lock. profile, dng_gain_maps and cache_entry are NULL in
+// the copy. returns NULL if imgid isn't valid. must be given back with dt_image_cache_snapshot_release().
+const dt_image_t *dt_image_cache_snapshot(dt_image_cache_t *cache, const int32_t imgid);
+
+// drops the reference on a snapshot
+void dt_image_cache_snapshot_release(dt_image_cache_t *cache, const dt_image_t *img);
+
 // remove the image from the cache
 void dt_image_cache_remove(dt_image_cache_t *cache, const int32_t imgid);
 
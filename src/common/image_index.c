@@ -0,0 +1,189 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/image_index.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+
+#include <string.h>
+
+// grow all arrays so that imgid has a slot, the new slots are empty. needs the write lock.
+static void _image_index_reserve(dt_image_index_t *index, const int32_t imgid)
+{
+  if(imgid < 0 || (size_t)imgid < index->size) return;
+
+  size_t size = MAX(index->size, 1024);
+  while(size <= (size_t)imgid) size *= 2;
+  const size_t added = size - index->size;
+
+#define _GROW(field)                                                                                         \
+  index->field = g_renew(__typeof__(*index->field), index->field, size);                                   \
+  memset(index->field + index->size, 0, sizeof(*index->field) * added);
+
+  _GROW(film_id);
+  _GROW(group_id);
+  _GROW(flags);
+  _GROW(datetime_taken);
+  _GROW(aspect_ratio);
+  _GROW(color_labels);
+#undef _GROW
+
+  index->size = size;
+}
+
+static inline gboolean _image_index_has(const dt_image_index_t *index, const int32_t imgid)
+{
+  return imgid > 0 && (size_t)imgid < index->size && index->film_id[imgid] != 0;
+}
+
+void dt_image_index_init(dt_image_index_t *index)
+{
+  memset(index, 0, sizeof(dt_image_index_t));
+  dt_pthread_rwlock_init(&index->lock, NULL);
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+
+  int32_t max_id = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT MAX(id) FROM main.images", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) max_id = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  _image_index_reserve(index, max_id);
+
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "SELECT id, film_id, group_id, flags, datetime_taken, aspect_ratio"
+                              " FROM main.images",
+                              -1, &stmt, NULL);
+  // clang-format on
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t id = sqlite3_column_int(stmt, 0);
+    if(id <= 0) continue;
+    _image_index_reserve(index, id);
+    index->film_id[id] = sqlite3_column_int(stmt, 1);
+    index->group_id[id] = sqlite3_column_int(stmt, 2);
+    index->flags[id] = sqlite3_column_int(stmt, 3);
+    index->datetime_taken[id] = sqlite3_column_int64(stmt, 4);
+    index->aspect_ratio[id] = sqlite3_column_double(stmt, 5);
+  }
+  sqlite3_finalize(stmt);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT imgid, color FROM main.color_labels", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t id = sqlite3_column_int(stmt, 0);
+    const int color = sqlite3_column_int(stmt, 1);
+    if(_image_index_has(index, id) && color >= 0 && color < 8) index->color_labels[id] |= 1 << color;
+  }
+  sqlite3_finalize(stmt);
+
+  dt_print(DT_DEBUG_CACHE, "[image_index] %zu slots for images up to id %d\n", index->size, max_id);
+}
+
+void dt_image_index_cleanup(dt_image_index_t *index)
+{
+  g_free(index->film_id);
+  g_free(index->group_id);
+  g_free(index->flags);
+  g_free(index->datetime_taken);
+  g_free(index->aspect_ratio);
+  g_free(index->color_labels);
+  index->size = 0;
+  dt_pthread_rwlock_destroy(&index->lock);
+}
+
+void dt_image_index_update(dt_image_index_t *index, const dt_image_t *img)
+{
+  if(!index || !img || img->id <= 0) return;
+
+  dt_pthread_rwlock_wrlock(&index->lock);
+  const gboolean added = !_image_index_has(index, img->id);
+  _image_index_reserve(index, img->id);
+  index->film_id[img->id] = img->film_id;
+  index->group_id[img->id] = img->group_id;
+  index->flags[img->id] = img->flags;
+  index->datetime_taken[img->id] = img->exif_datetime_taken;
+  index->aspect_ratio[img->id] = img->aspect_ratio;
+  dt_pthread_rwlock_unlock(&index->lock);
+
+  // an image new to the index may already carry labels, e.g. a duplicate
+  if(added) dt_image_index_reload_color_labels(index, img->id);
+}
+
+void dt_image_index_remove(dt_image_index_t *index, const int32_t imgid)
+{
+  if(!index) return;
+
+  dt_pthread_rwlock_wrlock(&index->lock);
+  if(_image_index_has(index, imgid))
+  {
+    index->film_id[imgid] = 0;
+    index->group_id[imgid] = 0;
+    index->flags[imgid] = 0;
+    index->datetime_taken[imgid] = 0;
+    index->aspect_ratio[imgid] = 0.0f;
+    index->color_labels[imgid] = 0;
+  }
+  dt_pthread_rwlock_unlock(&index->lock);
+}
+
+int dt_image_index_get_color_labels(dt_image_index_t *index, const int32_t imgid)
+{
+  if(!index) return -1;
+
+  dt_pthread_rwlock_rdlock(&index->lock);
+  const int labels = _image_index_has(index, imgid) ? index->color_labels[imgid] : -1;
+  dt_pthread_rwlock_unlock(&index->lock);
+  return labels;
+}
+
+void dt_image_index_set_color_labels(dt_image_index_t *index, const int32_t imgid, const uint8_t labels)
+{
+  if(!index) return;
+
+  dt_pthread_rwlock_wrlock(&index->lock);
+  if(_image_index_has(index, imgid)) index->color_labels[imgid] = labels;
+  dt_pthread_rwlock_unlock(&index->lock);
+}
+
+void dt_image_index_reload_color_labels(dt_image_index_t *index, const int32_t imgid)
+{
+  if(!index) return;
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT color FROM main.color_labels WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  uint8_t labels = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int color = sqlite3_column_int(stmt, 0);
+    if(color >= 0 && color < 8) labels |= 1 << color;
+  }
+  sqlite3_finalize(stmt);
+
+  dt_image_index_set_color_labels(index, imgid, labels);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
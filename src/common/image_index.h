@@ -0,0 +1,62 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/dtpthread.h"
+#include "common/image.h"
+
+// in-memory mirror of the fields of main.images the lighttable reads all the time, plus the color labels.
+// one array per field, indexed by image id, so that scanning a field doesn't touch the others.
+// it is filled from the database at startup and kept in sync by dt_image_cache_write_release() and the
+// color label setters.
+typedef struct dt_image_index_t
+{
+  dt_pthread_rwlock_t lock;
+  // number of slots of each array, image ids above that are not indexed
+  size_t size;
+  // 0 for slots without image
+  int32_t *film_id;
+  int32_t *group_id;
+  // rating and rejected flag are in here, see DT_VIEW_RATINGS_MASK and DT_IMAGE_REJECTED
+  int32_t *flags;
+  GTimeSpan *datetime_taken;
+  float *aspect_ratio;
+  // bitmask of dt_colorlabels_enum
+  uint8_t *color_labels;
+} dt_image_index_t;
+
+void dt_image_index_init(dt_image_index_t *index);
+void dt_image_index_cleanup(dt_image_index_t *index);
+
+// store the fields of img, called when it is written back to the database
+void dt_image_index_update(dt_image_index_t *index, const dt_image_t *img);
+void dt_image_index_remove(dt_image_index_t *index, const int32_t imgid);
+
+// color labels of imgid, -1 if the image isn't indexed and the database has to be asked
+int dt_image_index_get_color_labels(dt_image_index_t *index, const int32_t imgid);
+// set the color labels of an indexed image, does nothing for the others
+void dt_image_index_set_color_labels(dt_image_index_t *index, const int32_t imgid, const uint8_t labels);
+// read the color labels of imgid again from the database, after they were changed there directly
+void dt_image_index_reload_color_labels(dt_image_index_t *index, const int32_t imgid);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
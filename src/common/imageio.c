@@ -25,6 +25,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_cache.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
@@ -71,6 +72,7 @@
 #endif
 
 #include <assert.h>
+#include <gio/gio.h>
 #include <glib/gstdio.h>
 #include <inttypes.h>
 #include <math.h>
@@ -78,11 +80,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef USE_LUA
 #include "lua/image.h"
 #endif
 
+// rows handed to the strip writers of the formats at a time
+#define DT_IMAGEIO_STRIP_HEIGHT 64
+
 // note `dng` is not included anywhere as it can be anything. For this images we'll need to open it for "real"
 static const gchar *_supported_raw[]
     = { "3fr", "ari", "arw", "bay", "cr2", "cr3", "crw", "dc2", "dcr", "erf", "fff",
@@ -124,6 +135,67 @@ dt_image_flags_t dt_imageio_get_type_from_extension(const char *extension)
 }
 
 // load a full-res thumbnail:
+// a page fault over the network costs a round trip each, a buffered read streams the file instead
+static gboolean _imageio_is_remote(const char *filename)
+{
+  GFile *file = g_file_new_for_path(filename);
+  GFileInfo *info = g_file_query_filesystem_info(file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE, NULL, NULL);
+  const gboolean remote = info && g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+  if(info) g_object_unref(info);
+  g_object_unref(file);
+  return remote;
+}
+
+const void *dt_imageio_map_file(const char *filename, size_t *size)
+{
+  *size = 0;
+#ifdef _WIN32
+  return NULL;
+#else
+  if(_imageio_is_remote(filename)) return NULL;
+
+  const int fd = g_open(filename, O_RDONLY, 0);
+  if(fd < 0) return NULL;
+
+  struct stat st;
+  void *data = NULL;
+  if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED)
+      data = NULL;
+    else
+    {
+      // decoders walk the file forward: read ahead aggressively and drop the pages behind
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      *size = st.st_size;
+    }
+  }
+  // the mapping keeps its own reference of the file
+  close(fd);
+  return data;
+#endif
+}
+
+void dt_imageio_unmap_file(const void *data, const size_t size)
+{
+#ifndef _WIN32
+  if(data) munmap((void *)data, size);
+#endif
+}
+
+void dt_imageio_float_to_uint8(uint8_t *out, const float *in, const size_t pixels, const int out_channels)
+{
+  for(size_t k = 0; k < pixels; k++, in += 4, out += out_channels)
+    for(int c = 0; c < 3; c++) out[c] = roundf(CLAMP(in[c] * 0xff, 0, 0xff));
+}
+
+void dt_imageio_float_to_uint16(uint16_t *out, const float *in, const size_t pixels, const int out_channels)
+{
+  for(size_t k = 0; k < pixels; k++, in += 4, out += out_channels)
+    for(int c = 0; c < 3; c++) out[c] = roundf(CLAMP(in[c] * 0xffff, 0, 0xffff));
+}
+
 int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height,
                                dt_colorspaces_color_profile_type_t *color_space)
 {
@@ -660,8 +732,8 @@ int dt_imageio_export(const int32_t imgid, const char *filename, dt_imageio_modu
 {
   if(strcmp(format->mime(format_params), "x-copy") == 0)
     /* This is a just a copy, skip process and just export */
-    return format->write_image(format_params, filename, NULL, icc_type, icc_filename, NULL, 0, imgid, num, total, NULL,
-                               export_masks);
+    return format->write_image(format_params, filename, NULL, icc_type, icc_filename, NULL, 0, NULL, imgid, num,
+                               total, NULL, export_masks);
   else
   {
     const gboolean is_scaling =
@@ -673,6 +745,162 @@ int dt_imageio_export(const int32_t imgid, const char *filename, dt_imageio_modu
   }
 }
 
+// Can a downscaled export be resized right at demosaic instead of at the end of the pipe, without
+// visible difference ? This holds as long as all modules after demosaic work the same at any scale,
+// and no mask needs to be refined at full resolution.
+static gboolean _export_can_downscale_early(dt_dev_pixelpipe_t *pipe)
+{
+  gboolean after_demosaic = !dt_image_is_raw(&pipe->image);
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!strcmp(piece->module->op, "demosaic"))
+    {
+      after_demosaic = TRUE;
+      continue;
+    }
+    if(!after_demosaic || !piece->enabled) continue;
+
+    if(!(piece->module->flags() & IOP_FLAGS_SCALE_INDEPENDENT))
+    {
+      dt_print(DT_DEBUG_IMAGEIO, "[dt_imageio_export] `%s' needs a full resolution processing\n", piece->module->op);
+      return FALSE;
+    }
+
+    const dt_develop_blend_params_t *const blend = (const dt_develop_blend_params_t *)piece->blendop_data;
+    if(blend && (blend->mask_mode & DEVELOP_MASK_ENABLED)
+       && (blend->feathering_radius > 0.0f || blend->blur_radius > 0.0f || blend->details != 0.0f))
+    {
+      dt_print(DT_DEBUG_IMAGEIO, "[dt_imageio_export] mask of `%s' needs a full resolution processing\n",
+               piece->module->op);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// convert the output of the pipe in place to what format->write_image() expects
+static void _export_convert_output(uint8_t *outbuf, const int bpp, const gboolean display_byteorder,
+                                   const gboolean late_downscale, const int width, const int height)
+{
+  // downconversion to low-precision formats:
+  if(bpp == 8)
+  {
+    if(display_byteorder)
+    {
+      if(late_downscale)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < (size_t)width * height; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      // else processing output was 8-bit already, and no need to swap order
+    }
+    else // need to flip
+    {
+      // ldr output: char
+      if(late_downscale)
+      {
+        const float *const inbuf = (float *)outbuf;
+        for(size_t k = 0; k < (size_t)width * height; k++)
+        {
+          // convert in place, this is unfortunately very serial..
+          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
+          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
+          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
+          outbuf[4 * k + 0] = r;
+          outbuf[4 * k + 1] = g;
+          outbuf[4 * k + 2] = b;
+        }
+      }
+      else
+      { // !display_byteorder, need to swap:
+        uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(width, height, buf8) \
+  schedule(static)
+#endif
+        // just flip byte order
+        for(size_t k = 0; k < (size_t)width * height; k++)
+        {
+          uint8_t tmp = buf8[4 * k + 0];
+          buf8[4 * k + 0] = buf8[4 * k + 2];
+          buf8[4 * k + 2] = tmp;
+        }
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float *buff = (float *)outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(int y = 0; y < height; y++)
+      for(int x = 0; x < width; x++)
+      {
+        const size_t k = (size_t)width * y + x;
+        for(int i = 0; i < 3; i++) buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
+      }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+// feed the float output of the pipe to the strip writer of the format, in blocks of rows
+static int _export_write_strips(dt_imageio_module_format_t *format, void *handle, const float *in,
+                                const int width, const int height)
+{
+  for(int y = 0; y < height; y += DT_IMAGEIO_STRIP_HEIGHT)
+  {
+    const int rows = MIN(DT_IMAGEIO_STRIP_HEIGHT, height - y);
+    if(format->write_image_strip(handle, in + (size_t)4 * width * y, rows))
+    {
+      format->write_image_end(handle, TRUE);
+      return 1;
+    }
+  }
+  return format->write_image_end(handle, FALSE);
+}
+
+// tell lua and the signal listeners about an exported file
+static void _export_tmpfile_written(const int32_t imgid, const char *filename,
+                                    dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
+                                    dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params)
+{
+#ifdef USE_LUA
+  //Synchronous calling of lua intermediate-export-image events
+  dt_lua_lock();
+
+  lua_State *L = darktable.lua_state.state;
+
+  luaA_push(L, dt_lua_image_t, &imgid);
+
+  lua_pushstring(L, filename);
+
+  luaA_push_type(L, format->parameter_lua_type, format_params);
+
+  if(storage)
+    luaA_push_type(L, storage->parameter_lua_type, storage_params);
+  else
+    lua_pushnil(L);
+
+  dt_lua_event_trigger(L, "intermediate-export-image", 4);
+
+  dt_lua_unlock();
+#endif
+
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, filename, format,
+                                format_params, storage, storage_params);
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_format_t *format, dt_imageio_module_data_t *format_params,
@@ -684,6 +912,24 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_data_t *storage_params, int num, int total,
                                  dt_export_metadata_t *metadata)
 {
+  // the same export done before is reused as it is, before building anything
+  gchar *cache_key = NULL;
+  if(storage && !thumbnail_export && !filter && strcmp(format->mime(format_params), "memory")
+     && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE))
+  {
+    cache_key = dt_export_cache_key(imgid, format, format_params, ignore_exif, high_quality, is_scaling,
+                                    copy_metadata, export_masks, icc_type, icc_filename, icc_intent, metadata);
+    int cached_width = 0, cached_height = 0;
+    if(dt_export_cache_reuse(cache_key, filename, &cached_width, &cached_height))
+    {
+      format_params->width = cached_width;
+      format_params->height = cached_height;
+      _export_tmpfile_written(imgid, filename, format, format_params, storage, storage_params);
+      g_free(cache_key);
+      return 0;
+    }
+  }
+
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_dev_load_image(&dev, imgid);
@@ -902,8 +1148,23 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
 
   const int bpp = format->bpp(format_params);
 
+  // High quality processing keeps the full resolution until finalscale. When downscaling, it is not worth it
+  // if nothing in the pipe would make a difference.
+  const gboolean early_downscale = high_quality && !thumbnail_export && scale < 1.0
+                                   && dt_conf_get_bool("plugins/lighttable/export/early_downscale")
+                                   && _export_can_downscale_early(&pipe);
+  const gboolean late_downscale = high_quality && !early_downscale;
+
+  dt_print(DT_DEBUG_IMAGEIO, "[dt_imageio_export] imgid %d, downscaling %s\n", imgid,
+           late_downscale ? "before output" : "at demosaic");
+
+  // processing at full resolution for a smaller file, the modules may approximate what won't show in it
+  if(late_downscale && !thumbnail_export && scale < 1.0
+     && dt_conf_get_bool("plugins/lighttable/export/performance_profile"))
+    pipe.export_scale = scale;
+
   dt_get_times(&start);
-  if(high_quality)
+  if(late_downscale)
   {
     /*
      * if high quality processing was requested, downsampling will be done
@@ -951,102 +1212,53 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
     goto error;
   }
 
-  // downconversion to low-precision formats:
-  if(bpp == 8)
-  {
-    if(display_byteorder)
-    {
-      if(high_quality)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
-    }
-    else // need to flip
-    {
-      // ldr output: char
-      if(high_quality)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = roundf(CLAMP(inbuf[4 * k + 0] * 0xff, 0, 0xff));
-          const uint8_t g = roundf(CLAMP(inbuf[4 * k + 1] * 0xff, 0, 0xff));
-          const uint8_t b = roundf(CLAMP(inbuf[4 * k + 2] * 0xff, 0, 0xff));
-          outbuf[4 * k + 0] = r;
-          outbuf[4 * k + 1] = g;
-          outbuf[4 * k + 2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(processed_width, processed_height, buf8) \
-  schedule(static)
-#endif
-        // just flip byte order
-        for(size_t k = 0; k < (size_t)processed_width * processed_height; k++)
-        {
-          uint8_t tmp = buf8[4 * k + 0];
-          buf8[4 * k + 0] = buf8[4 * k + 2];
-          buf8[4 * k + 2] = tmp;
-        }
-      }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float *buff = (float *)outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y = 0; y < processed_height; y++)
-      for(int x = 0; x < processed_width; x++)
-      {
-        const size_t k = (size_t)processed_width * y + x;
-        for(int i = 0; i < 3; i++) buf16[4 * k + i] = roundf(CLAMP(buff[4 * k + i] * 0xffff, 0, 0xffff));
-      }
-  }
-  // else output float, no further harm done to the pixels :)
-
   format_params->width = processed_width;
   format_params->height = processed_height;
 
+  int length = 0;
+  uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
+                                // adding new tags could make it go over that... so let it be and see what
+                                // happens when we write the image
   if(!ignore_exif)
   {
-    int length;
-    uint8_t *exif_profile = NULL; // Exif data should be 65536 bytes max, but if original size is close to that,
-                                  // adding new tags could make it go over that... so let it be and see what
-                                  // happens when we write the image
     char pathname[PATH_MAX] = { 0 };
     gboolean from_cache = TRUE;
     dt_image_full_path(imgid,  pathname,  sizeof(pathname),  &from_cache, __FUNCTION__);
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(&exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
+
+  // formats embedding the metadata get it along with the pixels, the others have exiv2 add it to the written file
+  const int format_flags = format->flags(format_params);
+  gboolean attach_xmp = copy_metadata && (format_flags & FORMAT_FLAGS_SUPPORT_XMP);
+  char *xmp = NULL;
+  if(copy_metadata && (format_flags & FORMAT_FLAGS_EMBED_XMP))
+  {
+    xmp = dt_exif_xmp_export_packet(imgid, metadata, &exif_profile, &length);
+    if(xmp) attach_xmp = FALSE;
+  }
 
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, imgid,
-                              num, total, &pipe, export_masks);
+  // formats writing strips convert the float output while they encode it, no full size 8 or 16 bit copy
+  void *strip_writer = NULL;
+  if((bpp > 8 || late_downscale) && !display_byteorder && format->write_image_begin
+     && format->write_image_strip && format->write_image_end)
+    strip_writer = format->write_image_begin(format_params, filename, icc_type, icc_filename, exif_profile, length,
+                                             xmp, imgid, num, total, &pipe, export_masks);
 
-    free(exif_profile);
+  if(strip_writer)
+  {
+    res = _export_write_strips(format, strip_writer, (const float *)outbuf, processed_width, processed_height);
   }
   else
   {
-    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, NULL, 0, imgid, num, total,
-                              &pipe, export_masks);
+    _export_convert_output(outbuf, bpp, display_byteorder, late_downscale, processed_width, processed_height);
+    res = format->write_image(format_params, filename, outbuf, icc_type, icc_filename, exif_profile, length, xmp,
+                              imgid, num, total, &pipe, export_masks);
   }
 
+  free(exif_profile);
+  g_free(xmp);
+
   if(res)
     goto error;
 
@@ -1056,7 +1268,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   dt_dev_cleanup(&dev);
 
   /* now write xmp into that container, if possible */
-  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP))
+  if(attach_xmp)
   {
     dt_exif_xmp_attach_export(imgid, filename, metadata);
     // no need to cancel the export if this fails
@@ -1065,31 +1277,10 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   if(!thumbnail_export && strcmp(format->mime(format_params), "memory")
     && !(format->flags(format_params) & FORMAT_FLAGS_NO_TMPFILE))
   {
-#ifdef USE_LUA
-    //Synchronous calling of lua intermediate-export-image events
-    dt_lua_lock();
-
-    lua_State *L = darktable.lua_state.state;
-
-    luaA_push(L, dt_lua_image_t, &imgid);
-
-    lua_pushstring(L, filename);
-
-    luaA_push_type(L, format->parameter_lua_type, format_params);
-
-    if(storage)
-      luaA_push_type(L, storage->parameter_lua_type, storage_params);
-    else
-      lua_pushnil(L);
-
-    dt_lua_event_trigger(L, "intermediate-export-image", 4);
-
-    dt_lua_unlock();
-#endif
-
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_IMAGE_EXPORT_TMPFILE, imgid, filename, format,
-                            format_params, storage, storage_params);
+    dt_export_cache_store(cache_key, imgid, filename, processed_width, processed_height);
+    _export_tmpfile_written(imgid, filename, format, format_params, storage, storage_params);
   }
+  g_free(cache_key);
 
   return 0; // success
 
@@ -1098,6 +1289,7 @@ error:
 error_early:
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  g_free(cache_key);
   return 1;
 }
 
@@ -117,6 +117,17 @@ gboolean dt_imageio_lookup_makermodel(const char *maker, const char *model,
 // get the type of image from its extension
 dt_image_flags_t dt_imageio_get_type_from_extension(const char *extension);
 
+// map the whole file read-only, for the loaders that read it from start to end. returns NULL where the
+// buffered read is the better choice (remote file systems, no mmap, empty file): read it the usual way then.
+// the mapping is released with dt_imageio_unmap_file()
+const void *dt_imageio_map_file(const char *filename, size_t *size);
+void dt_imageio_unmap_file(const void *data, const size_t size);
+
+// convert pixels of 4 floats to 3 channels of 8 or 16 bits, rounded the way exports always did.
+// out_channels is the stride of the output, the 4th channel is left alone if it is 4
+void dt_imageio_float_to_uint8(uint8_t *out, const float *in, const size_t pixels, const int out_channels);
+void dt_imageio_float_to_uint16(uint16_t *out, const float *in, const size_t pixels, const int out_channels);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -244,13 +244,22 @@ dt_imageio_retval_t dt_imageio_open_libraw(dt_image_t *img, const char *filename
   libraw_data_t *raw = libraw_init(0);
   if(!raw) return DT_IMAGEIO_FILE_CORRUPTED;
 
+  // decode from a mapping of the file where possible, libraw reads the file itself otherwise.
+  // libraw works on the buffer until closed, so the mapping lives until then
+  size_t mapped_size = 0;
+  const void *mapped = dt_imageio_map_file(filename, &mapped_size);
+  if(mapped)
+    libraw_err = libraw_open_buffer(raw, mapped, mapped_size);
+  else
+  {
 #if defined(_WIN32) && (defined(UNICODE) || defined(_UNICODE))
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  libraw_err = libraw_open_wfile(raw, wfilename);
-  g_free(wfilename);
+    wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+    libraw_err = libraw_open_wfile(raw, wfilename);
+    g_free(wfilename);
 #else
-  libraw_err = libraw_open_file(raw, filename);
+    libraw_err = libraw_open_file(raw, filename);
 #endif
+  }
   if(libraw_err != LIBRAW_SUCCESS) goto error;
 
   libraw_err = libraw_unpack(raw);
@@ -295,7 +304,9 @@ dt_imageio_retval_t dt_imageio_open_libraw(dt_image_t *img, const char *filename
   img->crop_height = raw->rawdata.sizes.raw_height - ric->cheight - ric->ctop;
 
   // In general we should run through entire post-processing to get corrected filters.
-  // This incurs a significant performance penalty.
+  // The filters are final once pre_interpolate() merged the second green, the demosaicing after it only
+  // produces an image we don't use: skip it, this was most of the time spent here.
+  raw->params.no_interpolation = 1;
   libraw_err = libraw_dcraw_process(raw);
   if(libraw_err != LIBRAW_SUCCESS) goto error;
   img->buf_dsc.filters = raw->idata.filters;
@@ -360,6 +371,7 @@ error:
   if(libraw_err != LIBRAW_SUCCESS)
     fprintf(stderr, "[libraw_open] `%s': %s\n", img->filename, libraw_strerror(libraw_err));
   libraw_close(raw);
+  dt_imageio_unmap_file(mapped, mapped_size);
   return err;
 }
 #endif
@@ -39,7 +39,9 @@ typedef enum dt_imageio_format_flags_t
 {
   FORMAT_FLAGS_SUPPORT_XMP = 1,
   FORMAT_FLAGS_NO_TMPFILE = 2,
-  FORMAT_FLAGS_SUPPORT_LAYERS = 4
+  FORMAT_FLAGS_SUPPORT_LAYERS = 4,
+  // write_image() embeds the xmp packet and exif data given to it, no exiv2 pass over the written file
+  FORMAT_FLAGS_EMBED_XMP = 8
 } dt_imageio_format_flags_t;
 
 /**
@@ -147,6 +147,69 @@ int read_image(dt_imageio_png_t *png, void *out)
 
 
 
+// rows decoded at once before being converted, small enough to stay in cache
+#define DT_PNG_BAND_ROWS 64
+
+static void _convert_rows(float *const out, const uint8_t *const in, const size_t width, const size_t rows,
+                          const uint16_t bpp)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(out, in, width, rows, bpp) schedule(static)
+#endif
+  for(size_t j = 0; j < rows; j++)
+  {
+    if(bpp < 16)
+      for(size_t i = 0; i < width; i++)
+        for(int k = 0; k < 3; k++)
+          out[4 * (j * width + i) + k] = in[3 * (j * width + i) + k] * (1.0f / 255.0f);
+    else
+      for(size_t i = 0; i < width; i++)
+        for(int k = 0; k < 3; k++)
+          out[4 * (j * width + i) + k] = (256.0f * in[2 * (3 * (j * width + i) + k)]
+                                          + in[2 * (3 * (j * width + i) + k) + 1]) * (1.0f / 65535.0f);
+  }
+}
+
+// Decode non-interlaced images progressively, by bands of rows converted to float on all cores
+// while they are still in cache, instead of holding the whole 8/16-bit image in between.
+// Interlaced images need all the passes, they go through read_image().
+static int _read_image_bands(dt_imageio_png_t *png, float *mipbuf, const uint16_t bpp)
+{
+  const size_t rowbytes = png_get_rowbytes(png->png_ptr, png->info_ptr);
+  const size_t height = png->height;
+  const size_t band = MIN(DT_PNG_BAND_ROWS, height);
+  uint8_t *buf = dt_alloc_align(band * rowbytes);
+  png_bytep *row_pointers = malloc(sizeof(png_bytep) * band);
+
+  if(!buf || !row_pointers) goto error;
+
+  if(setjmp(png_jmpbuf(png->png_ptr))) goto error;
+
+  for(size_t y = 0; y < band; y++) row_pointers[y] = buf + y * rowbytes;
+
+  for(size_t y = 0; y < height; y += band)
+  {
+    const size_t rows = MIN(band, height - y);
+    png_read_rows(png->png_ptr, row_pointers, NULL, rows);
+    _convert_rows(mipbuf + 4 * y * png->width, buf, png->width, rows, bpp);
+  }
+
+  png_read_end(png->png_ptr, png->info_ptr);
+  png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
+
+  dt_free_align(buf);
+  free(row_pointers);
+  fclose(png->f);
+  return 0;
+
+error:
+  dt_free_align(buf);
+  free(row_pointers);
+  fclose(png->f);
+  png_destroy_read_struct(&png->png_ptr, &png->info_ptr, NULL);
+  return 1;
+}
+
 dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *mbuf)
 {
   const char *ext = filename + strlen(filename);
@@ -178,38 +241,37 @@ dt_imageio_retval_t dt_imageio_open_png(dt_image_t *img, const char *filename, d
     return DT_IMAGEIO_CACHE_FULL;
   }
 
-  buf = dt_alloc_align((size_t)image.height * png_get_rowbytes(image.png_ptr, image.info_ptr));
-
-  if(!buf)
+  if(png_get_interlace_type(image.png_ptr, image.info_ptr) == PNG_INTERLACE_NONE)
   {
-    fclose(image.f);
-    png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
-    fprintf(stderr, "[png_open] could not alloc intermediate buffer for image `%s'\n", img->filename);
-    return DT_IMAGEIO_CACHE_FULL;
+    if(_read_image_bands(&image, mipbuf, bpp) != 0)
+    {
+      fprintf(stderr, "[png_open] could not read image `%s'\n", img->filename);
+      return DT_IMAGEIO_FILE_CORRUPTED;
+    }
   }
-
-  if(read_image(&image, (void *)buf) != 0)
+  else
   {
+    buf = dt_alloc_align((size_t)image.height * png_get_rowbytes(image.png_ptr, image.info_ptr));
+
+    if(!buf)
+    {
+      fclose(image.f);
+      png_destroy_read_struct(&image.png_ptr, &image.info_ptr, NULL);
+      fprintf(stderr, "[png_open] could not alloc intermediate buffer for image `%s'\n", img->filename);
+      return DT_IMAGEIO_CACHE_FULL;
+    }
+
+    if(read_image(&image, (void *)buf) != 0)
+    {
+      dt_free_align(buf);
+      fprintf(stderr, "[png_open] could not read image `%s'\n", img->filename);
+      return DT_IMAGEIO_FILE_CORRUPTED;
+    }
+
+    _convert_rows(mipbuf, buf, width, height, bpp);
     dt_free_align(buf);
-    fprintf(stderr, "[png_open] could not read image `%s'\n", img->filename);
-    return DT_IMAGEIO_FILE_CORRUPTED;
   }
 
-  for(size_t j = 0; j < height; j++)
-  {
-    if(bpp < 16)
-      for(size_t i = 0; i < width; i++)
-        for(int k = 0; k < 3; k++)
-          mipbuf[4 * (j * width + i) + k] = buf[3 * (j * width + i) + k] * (1.0f / 255.0f);
-    else
-      for(size_t i = 0; i < width; i++)
-        for(int k = 0; k < 3; k++)
-          mipbuf[4 * (j * width + i) + k] = (256.0f * buf[2 * (3 * (j * width + i) + k)]
-                                             + buf[2 * (3 * (j * width + i) + k) + 1]) * (1.0f / 65535.0f);
-  }
-
-  dt_free_align(buf);
-
   img->buf_dsc.cst = IOP_CS_RGB; // png is always RGB
   img->buf_dsc.filters = 0u;
   img->flags &= ~DT_IMAGE_RAW;
@@ -29,7 +29,9 @@
 #define TYPE_FLOAT32 RawImageType::F32
 #define TYPE_USHORT16 RawImageType::UINT16
 
+#include <limits>
 #include <memory>
+#include <optional>
 
 #define __STDC_LIMIT_MACROS
 
@@ -57,6 +59,33 @@ int rawspeed_get_number_of_processor_cores()
 
 using namespace rawspeed;
 
+namespace
+{
+// read-only mapping of the raw file, released on every way out of the loader
+struct MappedFile
+{
+  const void *data = nullptr;
+  size_t size = 0;
+
+  explicit MappedFile(const char *filename)
+  {
+    data = dt_imageio_map_file(filename, &size);
+    // rawspeed buffers can't address more, the buffered read reports the error then
+    if(data && size > std::numeric_limits<Buffer::size_type>::max()) reset();
+  }
+  ~MappedFile() { reset(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  void reset()
+  {
+    dt_imageio_unmap_file(data, size);
+    data = nullptr;
+    size = 0;
+  }
+};
+}
+
 static dt_imageio_retval_t dt_imageio_open_rawspeed_sraw (dt_image_t *img,
                                                           const RawImage r,
                                                           dt_mipmap_buffer_t *buf);
@@ -151,9 +180,19 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    dt_pthread_mutex_lock(&darktable.readFile_mutex);
-    auto [storage, storageBuf] = f.readFile();
-    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    // the mapping shares the page cache and only faults in what the decoder reads,
+    // the buffered read stays for the files that can't or shouldn't be mapped
+    MappedFile mapped(filename);
+    std::optional<decltype(f.readFile())> storage;
+    if(!mapped.data)
+    {
+      dt_pthread_mutex_lock(&darktable.readFile_mutex);
+      storage.emplace(f.readFile());
+      dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    }
+    const Buffer storageBuf = mapped.data ? Buffer(static_cast<const uint8_t *>(mapped.data),
+                                                   static_cast<Buffer::size_type>(mapped.size))
+                                          : storage->second;
 
     RawParser t(storageBuf);
     std::unique_ptr<RawDecoder> d = t.getDecoder(meta);
@@ -254,6 +293,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     /* free auto pointers on spot */
     d.reset();
     storage.reset();
+    mapped.reset();
 
     // Grab the WB
     for(int i = 0; i < 4; i++)
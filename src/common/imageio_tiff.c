@@ -20,6 +20,7 @@
 #include "common/colorspaces.h"
 #include "common/darktable.h"
 #include "common/exif.h"
+#include "common/half.h"
 #include "control/conf.h"
 #include "develop/develop.h"
 #include "imageio.h"
@@ -46,164 +47,118 @@ typedef struct tiff_t
   tdata_t buf;
 } tiff_t;
 
-typedef union fp32_t
-{
-  uint32_t u;
-  float f;
-} fp32_t;
-
-static inline float _half_to_float(uint16_t h)
-{
-  /* see https://en.wikipedia.org/wiki/Half-precision_floating-point_format#Exponent_encoding
-     and https://en.wikipedia.org/wiki/Single-precision_floating-point_format#Exponent_encoding */
-
-  /* TODO: use intrinsics when possible */
-
-  /* from https://gist.github.com/rygorous/2156668 */
-  static const fp32_t magic = { 113 << 23 };
-  static const uint32_t shifted_exp = 0x7c00 << 13; // exponent mask after shift
-  fp32_t o;
-
-  o.u = (h & 0x7fff) << 13;     // exponent/mantissa bits
-  uint32_t exp = shifted_exp & o.u;   // just the exponent
-  o.u += (127 - 15) << 23;        // exponent adjust
-
-  // handle exponent special cases
-  if (exp == shifted_exp) // Inf/NaN?
-    o.u += (128 - 16) << 23;    // extra exp adjust
-  else if (exp == 0) // Zero/Denormal?
-  {
-    o.u += 1 << 23;             // extra exp adjust
-    o.f -= magic.f;             // renormalize
+// convert n pixels of one row of the file to RGBA floats, grey is copied to the 3 channels
+#define CONVERT_PIXELS(type, expr)                                                                          \
+  for(uint32_t i = 0; i < n; i++, out += 4)                                                                 \
+  {                                                                                                         \
+    const type *const px = (const type *)in + (size_t)i * t->spp;                                           \
+    const int step = (t->spp == 1) ? 0 : 1;                                                                 \
+    for(int c = 0; c < 3; c++)                                                                              \
+    {                                                                                                       \
+      const type v = px[c * step];                                                                          \
+      out[c] = (expr);                                                                                      \
+    }                                                                                                       \
+    out[3] = 0;                                                                                             \
   }
 
-  o.u |= (h & 0x8000) << 16;    // sign bit
-  return o.f;
-}
-
-static inline int _read_chunky_8(tiff_t *t)
+static inline void _convert_pixels(const tiff_t *t, const void *const in, float *out, const uint32_t n)
 {
-  for(uint32_t row = 0; row < t->height; row++)
-  {
-    uint8_t *in = ((uint8_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
-
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
+  if(t->bpp == 8)
+    CONVERT_PIXELS(uint8_t, (float)v * (1.0f / 255.0f))
+  else if(t->bpp == 16 && t->sampleformat == SAMPLEFORMAT_UINT)
+    CONVERT_PIXELS(uint16_t, (float)v * (1.0f / 65535.0f))
+  else if(t->bpp == 16)
+    CONVERT_PIXELS(uint16_t, dt_half_to_float(v))
+  else
+    CONVERT_PIXELS(float, v)
+}
 
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
-    {
-      /* set rgb to first sample from scanline */
-      out[0] = ((float)in[0]) * (1.0f / 255.0f);
+#undef CONVERT_PIXELS
 
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 255.0f);
-        out[2] = ((float)in[2]) * (1.0f / 255.0f);
-      }
-
-      out[3] = 0;
-    }
-  }
-
-  return 1;
+static TIFF *_open_file(const char *filename)
+{
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tiff = TIFFOpenW(wfilename, "rb");
+  g_free(wfilename);
+  return tiff;
+#else
+  return TIFFOpen(filename, "rb");
+#endif
 }
 
-static inline int _read_chunky_16(tiff_t *t)
+// Strips and tiles are compressed independently, so they are decoded on all cores and converted
+// to float right away, while still in cache. libtiff handles are not thread-safe: each thread
+// but the first one opens the file again. This also reads tiled files, which scanlines can't.
+static int _read_chunks(tiff_t *t, const char *filename)
 {
-  for(uint32_t row = 0; row < t->height; row++)
+  const gboolean tiled = TIFFIsTiled(t->tiff);
+  uint32_t chunk_width = t->width;
+  uint32_t chunk_height = t->height;
+  if(tiled)
   {
-    uint16_t *in = ((uint16_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
-
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
-
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
-    {
-      out[0] = ((float)in[0]) * (1.0f / 65535.0f);
-
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
-      {
-        out[1] = ((float)in[1]) * (1.0f / 65535.0f);
-        out[2] = ((float)in[2]) * (1.0f / 65535.0f);
-      }
-
-      out[3] = 0;
-    }
+    TIFFGetField(t->tiff, TIFFTAG_TILEWIDTH, &chunk_width);
+    TIFFGetField(t->tiff, TIFFTAG_TILELENGTH, &chunk_height);
   }
-
-  return 1;
-}
-
-static inline int _read_chunky_h(tiff_t *t)
-{
-  for(uint32_t row = 0; row < t->height; row++)
+  else
+    TIFFGetFieldDefaulted(t->tiff, TIFFTAG_ROWSPERSTRIP, &chunk_height);
+  chunk_height = MIN(chunk_height, t->height);
+  if(chunk_width == 0 || chunk_height == 0) return -1;
+
+  const uint32_t chunks = tiled ? TIFFNumberOfTiles(t->tiff) : TIFFNumberOfStrips(t->tiff);
+  const tmsize_t chunk_size = tiled ? TIFFTileSize(t->tiff) : TIFFStripSize(t->tiff);
+  const uint32_t across = tiled ? (t->width + chunk_width - 1) / chunk_width : 1;
+  const size_t rowsize = (size_t)chunk_width * t->spp * (t->bpp / 8);
+  if(chunks == 0 || chunk_size <= 0 || (size_t)chunk_size < rowsize) return -1;
+
+  const int threads = MIN(dt_get_num_threads(), chunks);
+  int failed = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(threads) default(none) \
+  dt_omp_firstprivate(t, filename, tiled, chunk_width, chunk_height, chunks, chunk_size, across, rowsize) \
+  reduction(| : failed)
+#endif
   {
-    uint16_t *in = ((uint16_t *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+    TIFF *tiff = (dt_get_thread_num() == 0) ? t->tiff : _open_file(filename);
+    tdata_t buf = tiff ? _TIFFmalloc(chunk_size) : NULL;
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
-
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for(uint32_t c = 0; c < chunks; c++)
     {
-      out[0] = _half_to_float(in[0]);
-
-      if(t->spp == 1)
+      if(!buf)
       {
-        out[1] = out[2] = out[0];
+        failed = 1;
+        continue;
       }
-      else
-      {
-        out[1] = _half_to_float(in[1]);
-        out[2] = _half_to_float(in[2]);
-      }
-
-      out[3] = 0;
-    }
-  }
-
-  return 1;
-}
 
-static inline int _read_chunky_f(tiff_t *t)
-{
-  for(uint32_t row = 0; row < t->height; row++)
-  {
-    float *in = ((float *)t->buf);
-    float *out = ((float *)t->mipbuf) + (size_t)4 * row * t->width;
+      const uint32_t row0 = (c / across) * chunk_height;
+      const uint32_t col0 = (c % across) * chunk_width;
+      if(row0 >= t->height) continue;
 
-    /* read scanline */
-    if(TIFFReadScanline(t->tiff, in, row, 0) == -1) return -1;
-
-    for(uint32_t i = 0; i < t->width; i++, in += t->spp, out += 4)
-    {
-      out[0] = in[0];
-
-      if(t->spp == 1)
-      {
-        out[1] = out[2] = out[0];
-      }
-      else
+      const tmsize_t read = tiled ? TIFFReadEncodedTile(tiff, c, buf, chunk_size)
+                                  : TIFFReadEncodedStrip(tiff, c, buf, chunk_size);
+      const uint32_t rows = MIN(chunk_height, t->height - row0);
+      const uint32_t cols = MIN(chunk_width, t->width - col0);
+      // strips are allowed to stop at the last row of the image
+      if(read < 0 || (size_t)read < rowsize * rows)
       {
-        out[1] = in[1];
-        out[2] = in[2];
+        failed = 1;
+        continue;
       }
 
-      out[3] = 0;
+      for(uint32_t r = 0; r < rows; r++)
+        _convert_pixels(t, (const uint8_t *)buf + rowsize * r,
+                        t->mipbuf + (size_t)4 * ((size_t)(row0 + r) * t->width + col0), cols);
     }
+
+    if(buf) _TIFFfree(buf);
+    if(tiff && tiff != t->tiff) TIFFClose(tiff);
   }
 
-  return 1;
+  return failed ? -1 : 1;
 }
 
 static inline int _read_chunky_8_Lab(tiff_t *t, uint16_t photometric)
@@ -353,14 +308,7 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
   uint16_t inkset;
 
   t.image = img;
-
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  t.tiff = TIFFOpenW(wfilename, "rb");
-  g_free(wfilename);
-#else
-  t.tiff = TIFFOpen(filename, "rb");
-#endif
+  t.tiff = _open_file(filename);
 
   if(t.tiff == NULL) return DT_IMAGEIO_FILE_CORRUPTED;
 
@@ -457,14 +405,10 @@ dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename,
     ok = _read_chunky_16_Lab(&t, photometric);
     t.image->buf_dsc.cst = IOP_CS_LAB;
   }
-  else if(t.bpp == 8 && t.sampleformat == SAMPLEFORMAT_UINT)
-    ok = _read_chunky_8(&t);
-  else if(t.bpp == 16 && t.sampleformat == SAMPLEFORMAT_UINT)
-    ok = _read_chunky_16(&t);
-  else if(t.bpp == 16 && t.sampleformat == SAMPLEFORMAT_IEEEFP)
-    ok = _read_chunky_h(&t);
-  else if(t.bpp == 32 && t.sampleformat == SAMPLEFORMAT_IEEEFP)
-    ok = _read_chunky_f(&t);
+  else if((t.bpp == 8 || t.bpp == 16) && t.sampleformat == SAMPLEFORMAT_UINT)
+    ok = _read_chunks(&t, filename);
+  else if((t.bpp == 16 || t.bpp == 32) && t.sampleformat == SAMPLEFORMAT_IEEEFP)
+    ok = _read_chunks(&t, filename);
   else
   {
     fprintf(stderr, "[tiff_open] error: not a supported tiff image format.\n");
@@ -494,13 +438,7 @@ int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out)
 
   if(!(filename && *filename && out)) return 0;
 
-#ifdef _WIN32
-  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
-  tiff = TIFFOpenW(wfilename, "rb");
-  g_free(wfilename);
-#else
-  tiff = TIFFOpen(filename, "rb");
-#endif
+  tiff = _open_file(filename);
 
   if(tiff == NULL) return 0;
 
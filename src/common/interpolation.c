@@ -580,16 +580,19 @@ float dt_interpolation_compute_sample(const struct dt_interpolation *itor,
  * Pixel interpolation function (see usage in iop/lens.c and iop/clipping.c)
  * ------------------------------------------------------------------------*/
 
-void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
-                                      const float *in,
-                                      float *out,
-                                      const float x,
-                                      const float y,
-                                      const int width,
-                                      const int height,
-                                      const int linestride)
+// half_width is itor->width. Passing it as a constant from the callers below lets the compiler unroll and
+// vectorize the tap loops for each interpolator.
+static inline void _compute_pixel4c(const struct dt_interpolation *itor,
+                                    const float *in,
+                                    float *out,
+                                    const float x,
+                                    const float y,
+                                    const int width,
+                                    const int height,
+                                    const int linestride,
+                                    const int half_width)
 {
-  assert(itor->width < (MAX_HALF_FILTER_WIDTH + 1));
+  assert(half_width < (MAX_HALF_FILTER_WIDTH + 1));
 
   // Quite a bit of space for kernels
   float DT_ALIGNED_ARRAY kernelh[MAX_KERNEL_REQ];
@@ -609,18 +612,18 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
   int ix = (int)x;
   int iy = (int)y;
 
-  if(ix >= (itor->width - 1)
-    && iy >= (itor->width - 1)
-    && ix < (width - itor->width)
-    && iy < (height - itor->width))
+  if(ix >= (half_width - 1)
+    && iy >= (half_width - 1)
+    && ix < (width - half_width)
+    && iy < (height - half_width))
   {
     // Inside image boundary case
 
     // Go to top left pixel
     in = (float *)in + linestride * iy + ix * 4;
-    in = in - (itor->width - 1) * (4 + linestride);
+    in = in - (half_width - 1) * (4 + linestride);
 
-    const size_t itor_width = 2 * itor->width;
+    const size_t itor_width = 2 * half_width;
 
     // Apply the kernel
     dt_aligned_pixel_t pixel = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -648,8 +651,8 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
     // At least a valid coordinate
 
     // Point to the upper left pixel index wise
-    iy -= itor->width - 1;
-    ix -= itor->width - 1;
+    iy -= half_width - 1;
+    ix -= half_width - 1;
 
     static const enum border_mode bordermode = INTERPOLATION_BORDER_MODE;
     assert(bordermode != BORDER_CLAMP); // XXX in clamp mode, norms would be wrong
@@ -657,12 +660,12 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
     int xtap_first;
     int xtap_last;
     _prepare_tap_boundaries(&xtap_first, &xtap_last,
-                           bordermode, 2 * itor->width, ix, width);
+                           bordermode, 2 * half_width, ix, width);
 
     int ytap_first;
     int ytap_last;
     _prepare_tap_boundaries(&ytap_first, &ytap_last,
-                           bordermode, 2 * itor->width, iy, height);
+                           bordermode, 2 * half_width, iy, height);
 
     // Apply the kernel
     dt_aligned_pixel_t pixel = { 0.0f, 0.0f, 0.0f, 0.0f };
@@ -695,6 +698,51 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
   }
 }
 
+void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor,
+                                      const float *in,
+                                      float *out,
+                                      const float x,
+                                      const float y,
+                                      const int width,
+                                      const int height,
+                                      const int linestride)
+{
+  _compute_pixel4c(itor, in, out, x, y, width, height, linestride, itor->width);
+}
+
+__DT_CLONE_TARGETS__
+void dt_interpolation_compute_row4c(const struct dt_interpolation *itor,
+                                    const float *in,
+                                    float *out,
+                                    const float *const coords,
+                                    const int n,
+                                    const int width,
+                                    const int height,
+                                    const int linestride)
+{
+  // one specialized loop per filter size, so the tap loops have compile-time bounds
+  switch(itor->width)
+  {
+    case 1:
+      for(int k = 0; k < n; k++)
+        _compute_pixel4c(itor, in, out + 4 * k, coords[2 * k], coords[2 * k + 1], width, height, linestride, 1);
+      break;
+    case 2:
+      for(int k = 0; k < n; k++)
+        _compute_pixel4c(itor, in, out + 4 * k, coords[2 * k], coords[2 * k + 1], width, height, linestride, 2);
+      break;
+    case 3:
+      for(int k = 0; k < n; k++)
+        _compute_pixel4c(itor, in, out + 4 * k, coords[2 * k], coords[2 * k + 1], width, height, linestride, 3);
+      break;
+    default:
+      for(int k = 0; k < n; k++)
+        _compute_pixel4c(itor, in, out + 4 * k, coords[2 * k], coords[2 * k + 1], width, height, linestride,
+                         itor->width);
+      break;
+  }
+}
+
 /* --------------------------------------------------------------------------
  * Interpolation factory
  * ------------------------------------------------------------------------*/
@@ -993,6 +1041,7 @@ static gboolean _prepare_resampling_plan(const struct dt_interpolation *itor,
   return FALSE;
 }
 
+__DT_CLONE_TARGETS__
 static void _interpolation_resample_plain(const struct dt_interpolation *itor,
                                           float *out,
                                           const dt_iop_roi_t *const roi_out,
@@ -1399,6 +1448,7 @@ int dt_interpolation_resample_roi_cl(const struct dt_interpolation *itor,
 }
 #endif
 
+__DT_CLONE_TARGETS__
 static void _interpolation_resample_1c_plain(const struct dt_interpolation *itor,
                                              float *out,
                                              const dt_iop_roi_t *const roi_out,
@@ -101,6 +101,22 @@ void dt_interpolation_compute_pixel4c(const struct dt_interpolation *itor, const
                                       const float x, const float y, const int width, const int height,
                                       const int linestride);
 
+/** Compute several interpolated 4 channels pixels at once, typically a whole output row of a distortion.
+ * This is faster than calling dt_interpolation_compute_pixel4c() per pixel, because the filter loops are
+ * specialized for the interpolator.
+ * @param itor interpolator to be used
+ * @param in input image
+ * @param out [out] n consecutive 4 channels output pixels
+ * @param coords interleaved x,y input coordinates of the n pixels to compute
+ * @param n number of pixels
+ * @param width Width of the input image
+ * @param height Width of the input image
+ * @param linestride Stride in number of pixels for complete line
+ */
+void dt_interpolation_compute_row4c(const struct dt_interpolation *itor, const float *in, float *out,
+                                    const float *const coords, const int n, const int width, const int height,
+                                    const int linestride);
+
 /** Get an interpolator from type
  * @param type Interpolator to search for
  * @return requested interpolator or default if not found (this function can't fail)
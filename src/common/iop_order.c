@@ -539,6 +539,47 @@ gboolean dt_ioppr_is_iop_before(GList *iop_order_list, const char *base_operatio
   return op_order < base_order;
 }
 
+// key of an (operation, instance) pair in the index, instance -1 stands for the first instance in the list
+static inline void _index_key(char *key, const size_t size, const char *op_name, const int multi_priority)
+{
+  snprintf(key, size, "%s/%d", op_name, multi_priority);
+}
+
+GHashTable *dt_ioppr_iop_order_index_new(GList *iop_order_list)
+{
+  GHashTable *index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  char key[64];
+
+  for(GList *l = iop_order_list; l; l = g_list_next(l))
+  {
+    const dt_iop_order_entry_t *const restrict entry = (dt_iop_order_entry_t *)l->data;
+
+    // the first entry wins, as with dt_ioppr_get_iop_order_link()
+    _index_key(key, sizeof(key), entry->operation, entry->instance);
+    if(!g_hash_table_contains(index, key)) g_hash_table_insert(index, g_strdup(key), l);
+    _index_key(key, sizeof(key), entry->operation, -1);
+    if(!g_hash_table_contains(index, key)) g_hash_table_insert(index, g_strdup(key), l);
+  }
+
+  return index;
+}
+
+GList *dt_ioppr_index_get_iop_order_link(GHashTable *index, const char *op_name, const int multi_priority)
+{
+  char key[64];
+  _index_key(key, sizeof(key), op_name, multi_priority);
+  return (GList *)g_hash_table_lookup(index, key);
+}
+
+int dt_ioppr_index_get_iop_order(GHashTable *index, const char *op_name, const int multi_priority)
+{
+  const GList *const restrict link = dt_ioppr_index_get_iop_order_link(index, op_name, multi_priority);
+  if(link) return ((dt_iop_order_entry_t *)link->data)->o.iop_order;
+
+  fprintf(stderr, "cannot get iop-order for %s instance %d\n", op_name, multi_priority);
+  return INT_MAX;
+}
+
 gint dt_sort_iop_list_by_order(gconstpointer a, gconstpointer b)
 {
   const dt_iop_order_entry_t *const restrict am = (const dt_iop_order_entry_t *)a;
@@ -885,6 +926,7 @@ void dt_ioppr_resync_modules_order(dt_develop_t *dev)
 
   // and reset all module iop_order
 
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
   GList *modules = dev->iop;
   while(modules)
   {
@@ -894,10 +936,11 @@ void dt_ioppr_resync_modules_order(dt_develop_t *dev)
     // modules with iop_order set to INT_MAX we keep them as they will be removed (non visible)
     // _lib_modulegroups_update_iop_visibility.
     if(mod->iop_order != INT_MAX)
-      mod->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, mod->op, mod->multi_priority);
+      mod->iop_order = dt_ioppr_index_get_iop_order(index, mod->op, mod->multi_priority);
 
     modules = next;
   }
+  g_hash_table_destroy(index);
 
   dev->iop = g_list_sort(dev->iop, dt_sort_iop_by_order);
 }
@@ -1243,6 +1286,7 @@ void dt_ioppr_update_for_style_items(dt_develop_t *dev, GList *st_items, gboolea
 
   // write back the multi-priority
 
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
   GList *el = e_list;
   for(const GList *si_list = st_items; si_list; si_list = g_list_next(si_list))
   {
@@ -1250,9 +1294,10 @@ void dt_ioppr_update_for_style_items(dt_develop_t *dev, GList *st_items, gboolea
     const dt_iop_order_entry_t *const restrict e = (dt_iop_order_entry_t *)el->data;
 
     si->multi_priority = e->instance;
-    si->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, si->operation, si->multi_priority);
+    si->iop_order = dt_ioppr_index_get_iop_order(index, si->operation, si->multi_priority);
     el = g_list_next(el);
   }
+  g_hash_table_destroy(index);
 
   g_list_free(e_list);
 }
@@ -1279,6 +1324,7 @@ void dt_ioppr_update_for_modules(dt_develop_t *dev, GList *modules, gboolean app
 
   // write back the multi-priority
 
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
   GList *el = e_list;
   for(const GList *m_list = modules; m_list; m_list = g_list_next(m_list))
   {
@@ -1286,10 +1332,11 @@ void dt_ioppr_update_for_modules(dt_develop_t *dev, GList *modules, gboolean app
     dt_iop_order_entry_t *e = (dt_iop_order_entry_t *)el->data;
 
     mod->multi_priority = e->instance;
-    mod->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, mod->op, mod->multi_priority);
+    mod->iop_order = dt_ioppr_index_get_iop_order(index, mod->op, mod->multi_priority);
 
     el = g_list_next(el);
   }
+  g_hash_table_destroy(index);
 
   g_list_free_full(e_list, free);
 }
@@ -184,6 +184,13 @@ int dt_ioppr_get_iop_order(GList *iop_order_list, const char *op_name, const int
 /** returns TRUE if operation/multi-priority is before base_operation (first in pipe) on the iop-list */
 gboolean dt_ioppr_is_iop_before(GList *iop_order_list, const char *base_operation,
                                 const char *operation, const int multi_priority);
+/** hash index of iop_order_list by operation and instance, to look up many modules at once instead of scanning
+    the list for each. it points into the list, which must not be changed while the index is in use.
+    free with g_hash_table_destroy() */
+GHashTable *dt_ioppr_iop_order_index_new(GList *iop_order_list);
+/** same as dt_ioppr_get_iop_order_link() and dt_ioppr_get_iop_order() on the list of index */
+GList *dt_ioppr_index_get_iop_order_link(GHashTable *index, const char *op_name, const int multi_priority);
+int dt_ioppr_index_get_iop_order(GHashTable *index, const char *op_name, const int multi_priority);
 /* write iop-order list for the given image */
 gboolean dt_ioppr_write_iop_order_list(GList *iop_order_list, const int32_t imgid);
 gboolean dt_ioppr_write_iop_order(const dt_iop_order_t kind, GList *iop_order_list, const int32_t imgid);
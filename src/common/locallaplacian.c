@@ -19,6 +19,8 @@
 #include "common/darktable.h"
 #include "common/locallaplacian.h"
 #include "common/math.h"
+#include "develop/pixelpipe_arena.h"
+#include "develop/pixelpipe_hb.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -130,6 +132,7 @@ static inline void ll_fill_boundary2(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
+__DT_CLONE_TARGETS__
 static void pad_by_replication(
     float *buf,			// the buffer to be padded
     const uint32_t w,		// width of a line
@@ -148,6 +151,7 @@ static void pad_by_replication(
   }
 }
 
+__DT_CLONE_TARGETS__
 static inline void gauss_expand(
     const float *const input, // coarse input
     float *const fine,        // upsampled, blurry output
@@ -238,6 +242,7 @@ static inline void gauss_reduce_sse2(
 }
 #endif
 
+__DT_CLONE_TARGETS__
 static inline void gauss_reduce(
     const float *const input, // fine input buffer
     float *const coarse,      // coarse scale, blurred input buf
@@ -271,6 +276,7 @@ static inline void gauss_reduce(
 
 // allocate output buffer with monochrome brightness channel from input, padded
 // up by max_supp on all four sides, dimensions written to wd2 ht2
+__DT_CLONE_TARGETS__
 static inline float *ll_pad_input(
     const float *const input,
     const int wd,
@@ -396,6 +402,56 @@ static inline float ll_laplacian(
   return fine[j*wd+i] - c;
 }
 
+// weight of gamma level k in the blend of the two levels bracketing brightness v
+static inline float ll_gamma_weight(const float v, const float *const gamma, const int k)
+{
+  int hi = 1;
+  for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
+  const int lo = hi-1;
+  const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
+  if(k == lo) return 1.0f - a;
+  if(k == hi) return a;
+  return 0.0f;
+}
+
+// add the laplacian coefficients of one gamma level to an output level, weighted by how much that
+// gamma level contributes to each pixel
+__DT_CLONE_TARGETS__
+static void ll_accumulate_laplacian(
+    const float *const coarse,  // coarse res gaussian of the gamma level
+    const float *const fine,    // fine res gaussian of the gamma level
+    const float *const padded,  // padded input at the same res
+    float *const output,        // output level to accumulate into
+    const float *const gamma,
+    const int k,                // gamma level
+    const int wd,               // fine width
+    const int ht)               // fine height
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(coarse, fine, padded, output, gamma, k, wd, ht) \
+  schedule(static) \
+  collapse(2)
+#endif
+  for(int j=0;j<ht;j++) for(int i=0;i<wd;i++)
+  {
+    const float weight = ll_gamma_weight(padded[j*wd+i], gamma, k);
+    if(weight > 0.0f)
+      output[j*wd+i] += weight * ll_laplacian(coarse, fine, i, j, wd, ht);
+  }
+}
+
+__DT_CLONE_TARGETS__
+static void ll_add(float *const out, const float *const in, const size_t n)
+{
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(out, in, n) \
+  schedule(static) aligned(out, in:64)
+#endif
+  for(size_t k=0;k<n;k++) out[k] += in[k];
+}
+
 static inline float curve_scalar(
     const float x,
     const float g,
@@ -530,6 +586,7 @@ void apply_curve_sse2(
 #endif
 
 // scalar version
+__DT_CLONE_TARGETS__
 void apply_curve(
     float *const out,
     const float *const in,
@@ -617,31 +674,40 @@ void local_laplacian_internal(
   for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
   // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
 
-  // allocate memory for intermediate laplacian pyramids
-  float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
-    buf[k][l] = dt_alloc_align_float((size_t)dl(w,l)*dl(h,l));
+  // the output laplacian blends, per pixel, the two gamma levels bracketing the input brightness. The blend
+  // is linear, so each gamma level is accumulated into output[] as soon as its pyramid is built, and the
+  // pyramid buffers are reused for the next level instead of keeping num_gamma pyramids alive.
+  float *buf[max_levels] = {0};
+  for(int l=0;l<=last_level;l++)
+    buf[l] = dt_pixelpipe_alloc_align_float((size_t)dl(w,l)*dl(h,l));
+  for(int l=0;l<last_level;l++)
+    memset(output[l], 0, sizeof(float) * dl(w,l) * dl(h,l));
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
   for(int k=0;k<num_gamma;k++)
   { // process images
+    if(dt_dev_pixelpipe_cancelled()) goto cancelled;
 #if defined(__SSE2__)
     if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
+      apply_curve_sse2(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
     else // brackets in next line needed for silly gcc warning:
 #endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    {apply_curve(buf[0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
 
     // create gaussian pyramids
     for(int l=1;l<=last_level;l++)
 #if defined(__SSE2__)
       if(use_sse2)
-        gauss_reduce_sse2(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+        gauss_reduce_sse2(buf[l-1], buf[l], dl(w,l-1), dl(h,l-1));
       else
 #endif
-        gauss_reduce(buf[k][l-1], buf[k][l], dl(w,l-1), dl(h,l-1));
+        gauss_reduce(buf[l-1], buf[l], dl(w,l-1), dl(h,l-1));
+
+    // add the weighted laplacian coefficients of this gamma level
+    for(int l=0;l<last_level;l++)
+      ll_accumulate_laplacian(buf[l+1], buf[l], padded[l], output[l], gamma, k, dl(w,l), dl(h,l));
   }
 
   // resample output[last_level] from preview
@@ -705,38 +771,17 @@ void local_laplacian_internal(
   // assemble output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
   {
+    if(dt_dev_pixelpipe_cancelled()) goto cancelled;
     const int pw = dl(w,l), ph = dl(h,l);
 
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(ph, pw) \
-    shared(w,h,buf,output,l,gamma,padded) \
-    schedule(static) \
-    collapse(2)
-#endif
-    for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
-    {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
-      // we could do this to save on memory (no need for finest buf[][]).
-      // unfortunately it results in a quite noticeable loss of sharpness, i think
-      // the extra level is worth it.
-      // else if(l == 0) // use finest scale from input to not amplify noise (and use less memory)
-      //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
-    }
+    // the gamma pyramids are done, so their buffers can hold the upsampled coarse output
+    gauss_expand(output[l+1], buf[l], pw, ph);
+    ll_add(output[l], buf[l], (size_t)pw * ph);
   }
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(ht, input, max_supp, out, wd) \
-  shared(w,output,buf) \
+  shared(w,output) \
   schedule(static) \
   collapse(2)
 #endif
@@ -746,6 +791,8 @@ void local_laplacian_internal(
     out[4*(j*wd+i)+1] = input[4*(j*wd+i)+1]; // copy original colour channels
     out[4*(j*wd+i)+2] = input[4*(j*wd+i)+2];
   }
+cancelled:
+  // the pipe gave up on this output: skip to the cleanup, buffers keep the same owners
   if(b && b->mode == 1)
   { // output the buffers for later re-use
     b->pad0 = padded[0];
@@ -761,7 +808,7 @@ void local_laplacian_internal(
   {
     if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
     if(!b || b->mode != 1)        dt_free_align(output[l]);
-    for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
+    dt_pixelpipe_free_align(buf[l]);
   }
 }
 
@@ -777,7 +824,7 @@ size_t local_laplacian_memory_use(const int width,     // width of input image
   size_t memory_use = 0;
 
   for(int l=0;l<num_levels;l++)
-    memory_use += sizeof(float) * (2 + num_gamma) * dl(paddwd, l) * dl(paddht, l);
+    memory_use += sizeof(float) * 3 * dl(paddwd, l) * dl(paddht, l);
 
   return memory_use;
 }
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <float.h>
 #include <stddef.h>
 #include <math.h>
 #include <stdint.h>
@@ -329,6 +330,56 @@ static inline void dt_fast_expf_4wide(const float x[4], float result[4])
   }
 }
 
+// vectorizable log2f() for finite x >= FLT_MIN, without calls into libm.
+// x is split into 2^e * m with m in [sqrt(1/2), sqrt(2)), and log2(m) is taken from the series
+// of atanh((m - 1) / (m + 1)), which converges fast enough there to stop after the 9th power.
+// The error is below 2e-7 * max(1, |log2(x)|), i.e. about one float ulp of the result.
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float dt_fast_log2f(const float x)
+{
+  union float_int u = { .f = x };
+  float e = (float)((u.k >> 23) & 0xff) - 127.0f;
+  u.k = (u.k & 0x007fffff) | 0x3f800000;
+  const int upper = u.f > 1.41421356f;
+  const float m = upper ? 0.5f * u.f : u.f;
+  e += upper ? 1.0f : 0.0f;
+  const float s = (m - 1.0f) / (m + 1.0f);
+  const float s2 = s * s;
+  // 2 / ln(2) * (s + s^3 / 3 + s^5 / 5 + s^7 / 7 + s^9 / 9)
+  const float series = s * (2.885390082f + s2 * (0.961796694f + s2 * (0.577078016f
+                                                 + s2 * (0.412198583f + s2 * 0.320598898f))));
+  return e + series;
+}
+
+// vectorizable exp2f() for x in [-126, 126], without calls into libm.
+// x is split into an integer, which goes straight into the exponent bits, and a remainder in
+// [-0.5, 0.5] evaluated by the Taylor polynomial of 2^r up to degree 7. Relative error is below 1e-7.
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float dt_fast_exp2f(const float x)
+{
+  const float xc = fminf(fmaxf(x, -126.0f), 126.0f);
+  const float n = rintf(xc);
+  const float r = xc - n;
+  const float poly = 1.0f + r * (0.693147181f + r * (0.240226507f + r * (0.0555041087f + r * (0.00961812911f
+                     + r * (0.00133335581f + r * (0.000154035304f + r * 1.52527338e-05f))))));
+  union float_int u = { .k = ((int)n + 127) << 23 };
+  return poly * u.f;
+}
+
+// vectorizable powf() for x >= 0, built on dt_fast_log2f() and dt_fast_exp2f(). Denormal x return 0.
+// The relative error grows with |y * log2(x)|, it is about 1e-6 * |y| for x in [0, 1].
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float dt_fast_powf(const float x, const float y)
+{
+  return (x >= FLT_MIN) ? dt_fast_exp2f(y * dt_fast_log2f(x)) : 0.0f;
+}
+
 #if defined(__SSE2__)
 #define ALIGNED(a) __attribute__((aligned(a)))
 #define VEC4(a)                                                                                              \
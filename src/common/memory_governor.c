@@ -0,0 +1,218 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/memory_governor.h"
+#include "common/atomic.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "control/conf.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+// factors are stored in 1/1000
+#define DT_GOVERNOR_ONE 1000
+#define DT_GOVERNOR_MIN 250
+#define DT_GOVERNOR_MAX 2000
+// share of the time tasks stalled on memory in the last 10 s, in %, from which we shrink
+#define DT_GOVERNOR_PRESSURE 10.0
+#define DT_GOVERNOR_PERIOD G_USEC_PER_SEC
+
+typedef struct _consumer_t
+{
+  dt_memory_governor_budget_t budget;
+  void *data;
+} _consumer_t;
+
+typedef struct dt_memory_governor_t
+{
+  GMutex lock;
+  GCond cond;
+  GList *consumers; // _consumer_t, called with the lock held
+  gboolean running;
+  gboolean started;
+  pthread_t thread;
+  dt_atomic_int factor; // in 1/1000
+} dt_memory_governor_t;
+
+static dt_memory_governor_t _governor = { 0 };
+
+// share of the time tasks stalled on memory over the last 10 s in %, -1 if unknown
+static double _pressure(void)
+{
+#if defined(__linux__)
+  FILE *f = fopen("/proc/pressure/memory", "r");
+  if(!f) return -1.0;
+  double avg10 = -1.0;
+  char line[256];
+  while(fgets(line, sizeof(line), f))
+    if(!strncmp(line, "some ", 5) && sscanf(line, "some avg10=%lf", &avg10) == 1) break;
+  fclose(f);
+  return avg10;
+#elif defined(__APPLE__)
+  // 1: normal, 2: warning, 4: critical
+  int level = 0;
+  size_t size = sizeof(level);
+  if(sysctlbyname("kern.memorystatus_vm_pressure_level", &level, &size, NULL, 0)) return -1.0;
+  return level >= 4 ? 60.0 : level >= 2 ? 20.0 : 0.0;
+#else
+  return -1.0;
+#endif
+}
+
+// bytes of memory the system can give without swapping, 0 if unknown
+static size_t _available(void)
+{
+#if defined(__linux__)
+  FILE *f = fopen("/proc/meminfo", "r");
+  if(!f) return 0;
+  size_t kb = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), f))
+    if(sscanf(line, "MemAvailable: %zu kB", &kb) == 1) break;
+  fclose(f);
+  return kb * 1024lu;
+#else
+  return 0;
+#endif
+}
+
+static int _next_factor(const int factor, const double pressure, const size_t available, const size_t total)
+{
+  const gboolean short_of_memory = available > 0 && available < total / 16;
+  if(pressure >= DT_GOVERNOR_PRESSURE || short_of_memory) return MAX(DT_GOVERNOR_MIN, factor / 2);
+
+  // wait for the pressure to settle before growing again
+  if(pressure >= 1.0) return MIN(factor, DT_GOVERNOR_ONE);
+
+  if(available > total / 4) return MIN(DT_GOVERNOR_MAX, factor + factor / 10);
+  if(factor < DT_GOVERNOR_ONE) return MIN(DT_GOVERNOR_ONE, factor + factor / 10);
+  return factor > DT_GOVERNOR_ONE ? MAX(DT_GOVERNOR_ONE, factor - factor / 10) : factor;
+}
+
+static void _notify(const int factor)
+{
+  for(GList *c = _governor.consumers; c; c = g_list_next(c))
+  {
+    _consumer_t *consumer = (_consumer_t *)c->data;
+    consumer->budget(consumer->data, factor / (double)DT_GOVERNOR_ONE);
+  }
+}
+
+static void *_governor_thread(void *data)
+{
+  dt_pthread_setname("memgovernor");
+
+  g_mutex_lock(&_governor.lock);
+  while(_governor.running)
+  {
+    g_mutex_unlock(&_governor.lock);
+    const double pressure = _pressure();
+    const size_t available = _available();
+    g_mutex_lock(&_governor.lock);
+
+    const int old = dt_atomic_get_int(&_governor.factor);
+    const int factor = _next_factor(old, pressure, available, darktable.dtresources.total_memory);
+    if(factor != old)
+    {
+      dt_atomic_set_int(&_governor.factor, factor);
+      dt_print(DT_DEBUG_MEMORY, "[memory_governor] budgets scaled by %.2f, pressure %.1f%%, %zu MiB available\n",
+               factor / (double)DT_GOVERNOR_ONE, pressure, available / (1024 * 1024));
+      // the caches shrink first, the next allocations see the new budgets
+      _notify(factor);
+    }
+
+    g_cond_wait_until(&_governor.cond, &_governor.lock, g_get_monotonic_time() + DT_GOVERNOR_PERIOD);
+  }
+  g_mutex_unlock(&_governor.lock);
+  return NULL;
+}
+
+void dt_memory_governor_init(void)
+{
+  dt_atomic_set_int(&_governor.factor, DT_GOVERNOR_ONE);
+  // debug resource levels use fixed settings
+  if(!dt_conf_get_bool("memory_governor") || darktable.dtresources.level < 0 || _pressure() < 0.0) return;
+
+  _governor.running = TRUE;
+  if(dt_pthread_create(&_governor.thread, _governor_thread, NULL))
+  {
+    fprintf(stderr, "[memory_governor] can't create governor thread\n");
+    _governor.running = FALSE;
+    return;
+  }
+  _governor.started = TRUE;
+}
+
+void dt_memory_governor_cleanup(void)
+{
+  if(_governor.started)
+  {
+    g_mutex_lock(&_governor.lock);
+    _governor.running = FALSE;
+    g_cond_broadcast(&_governor.cond);
+    g_mutex_unlock(&_governor.lock);
+    pthread_join(_governor.thread, NULL);
+    _governor.started = FALSE;
+  }
+  g_list_free_full(_governor.consumers, free);
+  _governor.consumers = NULL;
+}
+
+double dt_memory_governor_factor(void)
+{
+  const int factor = dt_atomic_get_int(&_governor.factor);
+  // before init
+  return factor > 0 ? factor / (double)DT_GOVERNOR_ONE : 1.0;
+}
+
+void dt_memory_governor_register(dt_memory_governor_budget_t budget, void *data)
+{
+  _consumer_t *consumer = (_consumer_t *)malloc(sizeof(_consumer_t));
+  if(!consumer) return;
+  consumer->budget = budget;
+  consumer->data = data;
+
+  g_mutex_lock(&_governor.lock);
+  _governor.consumers = g_list_prepend(_governor.consumers, consumer);
+  budget(data, dt_memory_governor_factor());
+  g_mutex_unlock(&_governor.lock);
+}
+
+void dt_memory_governor_unregister(void *data)
+{
+  g_mutex_lock(&_governor.lock);
+  for(GList *c = _governor.consumers; c; c = g_list_next(c))
+  {
+    _consumer_t *consumer = (_consumer_t *)c->data;
+    if(consumer->data != data) continue;
+    _governor.consumers = g_list_delete_link(_governor.consumers, c);
+    free(consumer);
+    break;
+  }
+  g_mutex_unlock(&_governor.lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,61 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Scales the memory budgets of the resource level with the memory state of the whole system.
+ *
+ * The fractions of the resource level give static budgets: the host memory for tiling, the thumbnail cache
+ * and the pixelpipe caches. A thread samples the memory pressure of the system every second (PSI on Linux,
+ * the pressure level of the kernel on macOS) and the memory still available, and derives a factor the
+ * budgets are multiplied by:
+ * - under pressure the factor halves, down to 1/4, and the caches registered here are shrunk right away,
+ *   before the next pipe runs allocate anything,
+ * - while there is no pressure and a quarter of the memory is available, the factor grows slowly up to 2,
+ *   so that memory nobody else uses serves as cache,
+ * - otherwise it goes back to 1.
+ *
+ * The hashed pixelpipe caches read the factor each time they make room, dt_get_available_mem() applies it
+ * to the tiling budget. Without sampling support, or with the `memory_governor` preference off, the factor
+ * stays 1.
+ */
+
+/** called with the new factor each time it changes, from the governor thread */
+typedef void (*dt_memory_governor_budget_t)(void *data, const double factor);
+
+void dt_memory_governor_init(void);
+void dt_memory_governor_cleanup(void);
+
+/** current factor of the static budgets, lock-free */
+double dt_memory_governor_factor(void);
+
+/** have budget(data, factor) called on each change of the factor, until unregistered. budget is called right
+ *  away with the current factor. */
+void dt_memory_governor_register(dt_memory_governor_budget_t budget, void *data);
+
+/** stop calling the budget callback of data. Once this returns, the callback doesn't run anymore. */
+void dt_memory_governor_unregister(void *data);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
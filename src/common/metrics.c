@@ -0,0 +1,336 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2023 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/metrics.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// counters are summed over the shards, so threads rarely write to the same cache line
+#define DT_METRICS_SHARDS 16
+
+// histograms of microseconds: values below 8 have their own bucket, then 8 buckets per power of two
+// up to 2^37 us (38 hours), longer values go to the last bucket
+#define DT_METRICS_SUB_BITS 3
+#define DT_METRICS_SUB (1 << DT_METRICS_SUB_BITS)
+#define DT_METRICS_MAX_EXP 37
+#define DT_METRICS_BUCKETS ((DT_METRICS_MAX_EXP - DT_METRICS_SUB_BITS + 2) * DT_METRICS_SUB)
+
+// distinct module operations, as loaded
+#define DT_METRICS_MODULES 128
+
+typedef struct _shard_t
+{
+  uint64_t counters[DT_METRICS_COUNTER_LAST];
+} __attribute__((aligned(64))) _shard_t;
+
+typedef struct _histogram_t
+{
+  uint64_t count;
+  uint64_t total; // us
+  uint64_t max;   // us
+  uint64_t buckets[DT_METRICS_BUCKETS];
+} _histogram_t;
+
+typedef struct _module_t
+{
+  int state; // 0: free, 1: being claimed, 2: ready
+  char op[20];
+  _histogram_t cpu, opencl;
+  uint64_t mem_peak[DT_METRICS_PIPES];
+} _module_t;
+
+// what the current thread allocates for a module
+typedef struct _mem_context_t
+{
+  _module_t *module; // NULL when not accounting
+  int pipe;
+  int64_t current; // may go below 0 when the module frees older buffers
+  int64_t peak;
+} _mem_context_t;
+
+static _shard_t _shards[DT_METRICS_SHARDS];
+static int _next_shard = 0;
+static __thread int _shard = -1;
+
+static _histogram_t _timers[DT_METRICS_TIMER_LAST];
+static _module_t _modules[DT_METRICS_MODULES];
+static const char *_pipes[DT_METRICS_PIPES];
+static __thread _mem_context_t _mem = { NULL, 0, 0, 0 };
+
+static const char *_counter_names[DT_METRICS_COUNTER_LAST]
+    = { "pixelpipe cache hits", "pixelpipe cache misses", "mipmap cache hits", "mipmap cache misses",
+        "tiled processing" };
+
+static const char *_timer_names[DT_METRICS_TIMER_LAST] = { "job queue wait", "sql" };
+
+static inline int _bucket(const uint64_t us)
+{
+  if(us < DT_METRICS_SUB) return (int)us;
+  const int exp = MIN(63 - __builtin_clzll(us), DT_METRICS_MAX_EXP);
+  if(exp == DT_METRICS_MAX_EXP) return DT_METRICS_BUCKETS - 1;
+  const int sub = (int)(us >> (exp - DT_METRICS_SUB_BITS)) & (DT_METRICS_SUB - 1);
+  return (exp - DT_METRICS_SUB_BITS + 1) * DT_METRICS_SUB + sub;
+}
+
+// middle of the values falling in a bucket, in us
+static inline double _bucket_value(const int bucket)
+{
+  if(bucket < DT_METRICS_SUB) return bucket;
+  const int exp = bucket / DT_METRICS_SUB + DT_METRICS_SUB_BITS - 1;
+  const int sub = bucket % DT_METRICS_SUB;
+  const double width = ldexp(1.0, exp - DT_METRICS_SUB_BITS);
+  return (DT_METRICS_SUB + sub) * width + 0.5 * width;
+}
+
+static void _histogram_add(_histogram_t *h, const double seconds)
+{
+  const uint64_t us = (uint64_t)fmax(seconds * 1e6, 0.0);
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->total, us, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->buckets[_bucket(us)], 1, __ATOMIC_RELAXED);
+
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while(us > max && !__atomic_compare_exchange_n(&h->max, &max, us, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static double _histogram_quantile(const uint64_t *buckets, const uint64_t count, const double q)
+{
+  const uint64_t rank = (uint64_t)ceil(q * count);
+  uint64_t seen = 0;
+  for(int b = 0; b < DT_METRICS_BUCKETS; b++)
+  {
+    seen += buckets[b];
+    if(seen >= rank && seen > 0) return _bucket_value(b) * 1e-6;
+  }
+  return 0.0;
+}
+
+static void _histogram_summary(const _histogram_t *h, dt_metrics_summary_t *summary)
+{
+  uint64_t buckets[DT_METRICS_BUCKETS];
+  uint64_t count = 0;
+  for(int b = 0; b < DT_METRICS_BUCKETS; b++)
+  {
+    buckets[b] = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+    count += buckets[b];
+  }
+
+  // take the count from the buckets, so the quantiles stay consistent with it
+  summary->count = count;
+  summary->total = __atomic_load_n(&h->total, __ATOMIC_RELAXED) * 1e-6;
+  summary->max = __atomic_load_n(&h->max, __ATOMIC_RELAXED) * 1e-6;
+  summary->p50 = _histogram_quantile(buckets, count, 0.50);
+  summary->p90 = _histogram_quantile(buckets, count, 0.90);
+  summary->p99 = _histogram_quantile(buckets, count, 0.99);
+}
+
+void dt_metrics_count(const dt_metrics_counter_t counter, const uint64_t value)
+{
+  if(_shard < 0) _shard = __atomic_fetch_add(&_next_shard, 1, __ATOMIC_RELAXED) % DT_METRICS_SHARDS;
+  __atomic_fetch_add(&_shards[_shard].counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void dt_metrics_time(const dt_metrics_timer_t timer, const double seconds)
+{
+  _histogram_add(&_timers[timer], seconds);
+}
+
+static _module_t *_get_module(const char *op)
+{
+  // open addressing, slots are never released
+  const guint start = g_str_hash(op) % DT_METRICS_MODULES;
+  for(int k = 0; k < DT_METRICS_MODULES; k++)
+  {
+    _module_t *m = &_modules[(start + k) % DT_METRICS_MODULES];
+    int state = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+    if(state == 0)
+    {
+      int expected = 0;
+      if(__atomic_compare_exchange_n(&m->state, &expected, 1, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      {
+        g_strlcpy(m->op, op, sizeof(m->op));
+        __atomic_store_n(&m->state, 2, __ATOMIC_RELEASE);
+        return m;
+      }
+      state = expected;
+    }
+    // another thread is claiming this slot, it may be for the same op
+    while(state == 1) state = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+    if(!strncmp(m->op, op, sizeof(m->op))) return m;
+  }
+  return NULL;
+}
+
+void dt_metrics_time_module(const char *op, const gboolean opencl, const double seconds)
+{
+  _module_t *m = _get_module(op);
+  if(m) _histogram_add(opencl ? &m->opencl : &m->cpu, seconds);
+}
+
+static int _get_pipe(const char *pipe)
+{
+  for(int k = 0; k < DT_METRICS_PIPES; k++)
+  {
+    const char *name = __atomic_load_n(&_pipes[k], __ATOMIC_ACQUIRE);
+    if(!name && __atomic_compare_exchange_n(&_pipes[k], &name, pipe, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return k;
+    if(name == pipe || !strcmp(name, pipe)) return k;
+  }
+  return -1;
+}
+
+void dt_metrics_mem_begin(const char *pipe, const char *op)
+{
+  const int p = _get_pipe(pipe);
+  _mem.module = p < 0 ? NULL : _get_module(op);
+  _mem.pipe = p;
+  _mem.current = _mem.peak = 0;
+}
+
+size_t dt_metrics_mem_end(void)
+{
+  _module_t *m = _mem.module;
+  if(!m) return 0;
+  _mem.module = NULL;
+
+  uint64_t *slot = &m->mem_peak[_mem.pipe];
+  const uint64_t peak = _mem.peak;
+  uint64_t max = __atomic_load_n(slot, __ATOMIC_RELAXED);
+  while(peak > max && !__atomic_compare_exchange_n(slot, &max, peak, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return peak;
+}
+
+void dt_metrics_mem_alloc(const size_t size)
+{
+  if(!_mem.module) return;
+  _mem.current += size;
+  if(_mem.current > _mem.peak) _mem.peak = _mem.current;
+}
+
+void dt_metrics_mem_free(const size_t size)
+{
+  if(_mem.module) _mem.current -= size;
+}
+
+static gint _sort_modules(gconstpointer a, gconstpointer b)
+{
+  const dt_metrics_module_t *ma = (const dt_metrics_module_t *)a;
+  const dt_metrics_module_t *mb = (const dt_metrics_module_t *)b;
+  const double ta = ma->cpu.total + ma->opencl.total;
+  const double tb = mb->cpu.total + mb->opencl.total;
+  return (ta < tb) - (ta > tb);
+}
+
+void dt_metrics_snapshot(dt_metrics_snapshot_t *snapshot)
+{
+  memset(snapshot, 0, sizeof(dt_metrics_snapshot_t));
+
+  for(int s = 0; s < DT_METRICS_SHARDS; s++)
+    for(int c = 0; c < DT_METRICS_COUNTER_LAST; c++)
+      snapshot->counters[c] += __atomic_load_n(&_shards[s].counters[c], __ATOMIC_RELAXED);
+
+  for(int t = 0; t < DT_METRICS_TIMER_LAST; t++) _histogram_summary(&_timers[t], &snapshot->timers[t]);
+
+  for(int k = 0; k < DT_METRICS_MODULES; k++)
+  {
+    const _module_t *m = &_modules[k];
+    if(__atomic_load_n(&m->state, __ATOMIC_ACQUIRE) != 2) continue;
+    dt_metrics_module_t *module = g_malloc0(sizeof(dt_metrics_module_t));
+    g_strlcpy(module->op, m->op, sizeof(module->op));
+    _histogram_summary(&m->cpu, &module->cpu);
+    _histogram_summary(&m->opencl, &module->opencl);
+    for(int p = 0; p < DT_METRICS_PIPES; p++)
+      module->mem_peak[p] = __atomic_load_n(&m->mem_peak[p], __ATOMIC_RELAXED);
+    snapshot->modules = g_list_prepend(snapshot->modules, module);
+  }
+  snapshot->modules = g_list_sort(snapshot->modules, _sort_modules);
+
+  for(int p = 0; p < DT_METRICS_PIPES; p++) snapshot->pipes[p] = __atomic_load_n(&_pipes[p], __ATOMIC_ACQUIRE);
+}
+
+void dt_metrics_snapshot_cleanup(dt_metrics_snapshot_t *snapshot)
+{
+  g_list_free_full(snapshot->modules, g_free);
+  snapshot->modules = NULL;
+}
+
+const char *dt_metrics_counter_name(const dt_metrics_counter_t counter)
+{
+  return counter < DT_METRICS_COUNTER_LAST ? _counter_names[counter] : NULL;
+}
+
+const char *dt_metrics_timer_name(const dt_metrics_timer_t timer)
+{
+  return timer < DT_METRICS_TIMER_LAST ? _timer_names[timer] : NULL;
+}
+
+static void _print_summary(const char *name, const dt_metrics_summary_t *s)
+{
+  if(s->count == 0) return;
+  printf("  %-24s %8" G_GUINT64_FORMAT " calls %10.3fs total, p50 %.4fs p90 %.4fs p99 %.4fs max %.4fs\n", name,
+         s->count, s->total, s->p50, s->p90, s->p99, s->max);
+}
+
+void dt_metrics_print(void)
+{
+  dt_metrics_snapshot_t snapshot;
+  dt_metrics_snapshot(&snapshot);
+
+  printf("[metrics] counters\n");
+  for(int c = 0; c < DT_METRICS_COUNTER_LAST; c++)
+    printf("  %-24s %8" G_GUINT64_FORMAT "\n", _counter_names[c], snapshot.counters[c]);
+
+  printf("[metrics] timers\n");
+  for(int t = 0; t < DT_METRICS_TIMER_LAST; t++) _print_summary(_timer_names[t], &snapshot.timers[t]);
+
+  printf("[metrics] modules\n");
+  for(const GList *l = snapshot.modules; l; l = g_list_next(l))
+  {
+    const dt_metrics_module_t *m = (const dt_metrics_module_t *)l->data;
+    gchar *cpu = g_strdup_printf("%s (CPU)", m->op);
+    gchar *cl = g_strdup_printf("%s (GPU)", m->op);
+    _print_summary(cpu, &m->cpu);
+    _print_summary(cl, &m->opencl);
+    g_free(cpu);
+    g_free(cl);
+  }
+
+  printf("[metrics] memory peaks\n");
+  for(const GList *l = snapshot.modules; l; l = g_list_next(l))
+  {
+    const dt_metrics_module_t *m = (const dt_metrics_module_t *)l->data;
+    GString *peaks = g_string_new(NULL);
+    for(int p = 0; p < DT_METRICS_PIPES && snapshot.pipes[p]; p++)
+      if(m->mem_peak[p])
+        g_string_append_printf(peaks, " %s %.1f MiB", snapshot.pipes[p], m->mem_peak[p] / (1024.0 * 1024.0));
+    if(peaks->len) printf("  %-24s%s\n", m->op, peaks->str);
+    g_string_free(peaks, TRUE);
+  }
+
+  dt_metrics_snapshot_cleanup(&snapshot);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
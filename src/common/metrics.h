@@ -0,0 +1,114 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2023 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+/**
+ * Always-on counters and latency histograms of the pixelpipe, the caches, the control jobs and the
+ * library database. Recording doesn't lock: counters are spread over per-thread shards, and latencies
+ * go to log-linear histograms with 8 buckets per power of two, so quantiles are within 12.5 %.
+ *
+ * The memory allocated with dt_alloc_align() while a module processes is accounted to the module and the
+ * pipe, from the thread running the pipe. Buffers allocated by OpenMP workers are not seen.
+ *
+ * Read them with dt_metrics_snapshot(). `-d perf` prints them at exit.
+ */
+
+// distinct pipe names accounted for memory
+#define DT_METRICS_PIPES 6
+
+typedef enum dt_metrics_counter_t
+{
+  DT_METRICS_PIXELPIPE_CACHE_HIT = 0, // node output reused from the pixelpipe, shared or disk caches
+  DT_METRICS_PIXELPIPE_CACHE_MISS,    // node output computed
+  DT_METRICS_MIPMAP_CACHE_HIT,        // mipmap found at the requested size
+  DT_METRICS_MIPMAP_CACHE_MISS,       // mipmap generated, replaced by another size, or not found
+  DT_METRICS_TILING,                  // modules processed with tiling
+  DT_METRICS_COUNTER_LAST
+} dt_metrics_counter_t;
+
+typedef enum dt_metrics_timer_t
+{
+  DT_METRICS_JOB_WAIT = 0, // time control jobs spend queued
+  DT_METRICS_SQL,          // time spent running SQL statements
+  DT_METRICS_TIMER_LAST
+} dt_metrics_timer_t;
+
+typedef struct dt_metrics_summary_t
+{
+  uint64_t count;
+  // in seconds
+  double total, max;
+  double p50, p90, p99;
+} dt_metrics_summary_t;
+
+typedef struct dt_metrics_module_t
+{
+  char op[20];
+  dt_metrics_summary_t cpu, opencl;
+  uint64_t mem_peak[DT_METRICS_PIPES]; // bytes, indexed like dt_metrics_snapshot_t.pipes
+} dt_metrics_module_t;
+
+typedef struct dt_metrics_snapshot_t
+{
+  uint64_t counters[DT_METRICS_COUNTER_LAST];
+  dt_metrics_summary_t timers[DT_METRICS_TIMER_LAST];
+  GList *modules; // of dt_metrics_module_t, by decreasing total processing time
+  const char *pipes[DT_METRICS_PIPES]; // names of the pipes seen so far, NULL past them
+} dt_metrics_snapshot_t;
+
+/** add value to a counter */
+void dt_metrics_count(const dt_metrics_counter_t counter, const uint64_t value);
+
+/** record a duration, in seconds */
+void dt_metrics_time(const dt_metrics_timer_t timer, const double seconds);
+
+/** record the processing time of a module, in seconds */
+void dt_metrics_time_module(const char *op, const gboolean opencl, const double seconds);
+
+/** account the memory allocated from this thread to the module op of the pipe, until dt_metrics_mem_end().
+ *  pipe must be a static string. */
+void dt_metrics_mem_begin(const char *pipe, const char *op);
+
+/** record the peak of the memory allocated since dt_metrics_mem_begin() and return it, in bytes */
+size_t dt_metrics_mem_end(void);
+
+/** called by dt_alloc_align() and dt_free_align(), with the size of the block */
+void dt_metrics_mem_alloc(const size_t size);
+void dt_metrics_mem_free(const size_t size);
+
+/** read all metrics recorded so far. Concurrent recordings may or may not be accounted. */
+void dt_metrics_snapshot(dt_metrics_snapshot_t *snapshot);
+
+/** free what dt_metrics_snapshot() allocated */
+void dt_metrics_snapshot_cleanup(dt_metrics_snapshot_t *snapshot);
+
+const char *dt_metrics_counter_name(const dt_metrics_counter_t counter);
+const char *dt_metrics_timer_name(const dt_metrics_timer_t timer);
+
+/** print a snapshot on stdout */
+void dt_metrics_print(void);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -26,7 +26,13 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/memory_governor.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/mipmap_codec.h"
+#include "common/mipmap_pack.h"
 #include "control/conf.h"
+#include "control/control.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
 
@@ -56,6 +62,9 @@
 #define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
 #define DT_MIPMAP_CACHE_FILE_VERSION 23
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
+// time edits are gathered before thumbnails get regenerated, and images rendered by one job
+#define DT_MIPMAP_REGENERATE_DELAY 1000
+#define DT_MIPMAP_REGENERATE_BATCH 8
 
 typedef enum dt_mipmap_buffer_dsc_flags
 {
@@ -198,6 +207,18 @@ static inline dt_mipmap_size_t get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 28);
 }
 
+// read for each thumbnail, resolved once per change of the preferences
+static dt_conf_handle_t _conf_disk_backend = DT_CONF_HANDLE("cache_disk_backend");
+static dt_conf_handle_t _conf_disk_backend_full = DT_CONF_HANDLE("cache_disk_backend_full");
+static dt_conf_handle_t _conf_mip_pyramid = DT_CONF_HANDLE("cache_mip_pyramid");
+static dt_conf_handle_t _conf_color_managed = DT_CONF_HANDLE("cache_color_managed");
+
+static inline gboolean _disk_backend_enabled(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip)
+{
+  return cache->cachedir[0] && ((dt_conf_handle_get_bool(&_conf_disk_backend) && mip < DT_MIPMAP_8)
+                                || (dt_conf_handle_get_bool(&_conf_disk_backend_full) && mip == DT_MIPMAP_8));
+}
+
 static int dt_mipmap_cache_get_filename(gchar *mipmapfilename, size_t size)
 {
   int r = -1;
@@ -307,6 +328,205 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+static int _read_packed_thumbnail(dt_mipmap_cache_t *cache, dt_cache_entry_t *entry,
+                                  struct dt_mipmap_buffer_dsc *dsc)
+{
+  const uint32_t imgid = get_imgid(entry->key);
+  const dt_mipmap_size_t mip = get_size(entry->key);
+  size_t len = 0;
+  int color_space = DT_COLORSPACE_NONE;
+  uint8_t *blob = dt_mipmap_pack_read(cache->pack, imgid, mip, &len, &color_space);
+  if(!blob) return 0;
+
+  int loaded = 0;
+  uint32_t width = 0, height = 0;
+  dt_colorspaces_color_profile_type_t blob_color_space;
+  if(dt_mipmap_codec_decode(blob, len, (uint8_t *)entry->data + sizeof(*dsc), cache->max_width[mip],
+                            cache->max_height[mip], &width, &height, &blob_color_space))
+  {
+    fprintf(stderr, "[mipmap_cache] failed to decompress packed thumbnail for image %" PRIu32 "!\n", imgid);
+    dt_mipmap_pack_remove(cache->pack, imgid, mip);
+  }
+  else
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " from packed disk cache\n", mip,
+             imgid);
+    dsc->width = width;
+    dsc->height = height;
+    dsc->iscale = 1.0f;
+    // jpeg blobs don't know their colour space, the index does
+    dsc->color_space = color_space;
+    loaded = 1;
+  }
+  dt_free_align(blob);
+  return loaded;
+}
+
+static void _write_packed_thumbnail(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                                    const struct dt_mipmap_buffer_dsc *dsc)
+{
+  // Don't rewrite existing thumbnails as both performance and quality (lossy jpg) suffer
+  if(dt_mipmap_pack_contains(cache->pack, imgid, mip)) return;
+
+  // the colour space goes into the index record, so no exif block is needed
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  size_t len = 0;
+  uint8_t *blob = dt_mipmap_codec_encode(cache->codec, (const uint8_t *)(dsc + 1), dsc->width, dsc->height,
+                                         MIN(100, MAX(10, cache_quality)), dsc->color_space, &len);
+  if(!blob) return;
+  if(dt_mipmap_pack_write(cache->pack, imgid, mip, blob, len, dsc->color_space))
+    fprintf(stderr, "[mipmap_cache] failed to write packed thumbnail for image %" PRIu32 "\n", imgid);
+  dt_free_align(blob);
+}
+
+static void _thumbnail_filename(const dt_mipmap_cache_t *cache, char *filename, const size_t size,
+                                const uint32_t imgid, const dt_mipmap_size_t mip, const dt_mipmap_codec_t codec)
+{
+  snprintf(filename, size, "%s.d/%d/%" PRIu32 ".%s", cache->cachedir, (int)mip, imgid,
+           dt_mipmap_codec_extension(codec));
+}
+
+// compressed memory tier: thumbnails evicted from mip_thumbs are encoded with the disk codec and kept in
+// memory, so a thumbnail scrolled back into view is decoded from there instead of read from disk or
+// rendered again.
+typedef struct _compressed_t
+{
+  uint32_t key;
+  uint8_t *blob;
+  size_t length;
+  dt_colorspaces_color_profile_type_t color_space;
+  GList link; // in cache->compressed_lru
+} _compressed_t;
+
+static void _compressed_free(_compressed_t *c)
+{
+  dt_free_align(c->blob);
+  g_free(c);
+}
+
+// the raw codec would take as much memory as the uncompressed buffers
+static inline dt_mipmap_codec_t _compressed_codec(const dt_mipmap_cache_t *cache)
+{
+  return cache->codec == DT_MIPMAP_CODEC_RAW ? DT_MIPMAP_CODEC_JPEG : cache->codec;
+}
+
+static inline gboolean _compressed_enabled(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip)
+{
+  // full size previews are too slow to encode on each eviction
+  return cache->compressed_quota > 0 && mip < DT_MIPMAP_8;
+}
+
+// drop the least recently used blobs until the tier fits its quota. compressed_mutex is held.
+static void _compressed_trim(dt_mipmap_cache_t *cache)
+{
+  while(cache->compressed_size > cache->compressed_quota && cache->compressed_lru.head)
+  {
+    _compressed_t *c = (_compressed_t *)cache->compressed_lru.head->data;
+    g_queue_unlink(&cache->compressed_lru, &c->link);
+    cache->compressed_size -= c->length;
+    g_hash_table_remove(cache->compressed, GUINT_TO_POINTER(c->key));
+  }
+}
+
+static void _compressed_store(dt_mipmap_cache_t *cache, const uint32_t key, const struct dt_mipmap_buffer_dsc *dsc)
+{
+  dt_pthread_mutex_lock(&cache->compressed_mutex);
+  const gboolean known = g_hash_table_contains(cache->compressed, GUINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&cache->compressed_mutex);
+  // the blob the buffer was decoded from is still there, don't lose quality encoding it again
+  if(known) return;
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  size_t len = 0;
+  uint8_t *blob = dt_mipmap_codec_encode(_compressed_codec(cache), (const uint8_t *)(dsc + 1), dsc->width,
+                                         dsc->height, MIN(100, MAX(10, cache_quality)), dsc->color_space, &len);
+  if(!blob) return;
+  if(len > cache->compressed_quota)
+  {
+    dt_free_align(blob);
+    return;
+  }
+
+  _compressed_t *c = g_new0(_compressed_t, 1);
+  c->key = key;
+  c->blob = blob;
+  c->length = len;
+  c->color_space = dsc->color_space;
+  c->link.data = c;
+
+  dt_pthread_mutex_lock(&cache->compressed_mutex);
+  _compressed_t *old = g_hash_table_lookup(cache->compressed, GUINT_TO_POINTER(key));
+  if(old)
+  {
+    g_queue_unlink(&cache->compressed_lru, &old->link);
+    cache->compressed_size -= old->length;
+  }
+  g_hash_table_replace(cache->compressed, GUINT_TO_POINTER(key), c);
+  g_queue_push_tail_link(&cache->compressed_lru, &c->link);
+  cache->compressed_size += len;
+  _compressed_trim(cache);
+  dt_pthread_mutex_unlock(&cache->compressed_mutex);
+}
+
+static void _compressed_remove(dt_mipmap_cache_t *cache, const uint32_t key)
+{
+  if(!cache->compressed) return;
+  dt_pthread_mutex_lock(&cache->compressed_mutex);
+  _compressed_t *c = g_hash_table_lookup(cache->compressed, GUINT_TO_POINTER(key));
+  if(c)
+  {
+    g_queue_unlink(&cache->compressed_lru, &c->link);
+    cache->compressed_size -= c->length;
+    g_hash_table_remove(cache->compressed, GUINT_TO_POINTER(key));
+  }
+  dt_pthread_mutex_unlock(&cache->compressed_mutex);
+}
+
+static int _read_compressed_thumbnail(dt_mipmap_cache_t *cache, dt_cache_entry_t *entry,
+                                      struct dt_mipmap_buffer_dsc *dsc)
+{
+  const dt_mipmap_size_t mip = get_size(entry->key);
+  // copy the blob, so that other threads can trim the tier while this one decodes
+  dt_pthread_mutex_lock(&cache->compressed_mutex);
+  _compressed_t *c = g_hash_table_lookup(cache->compressed, GUINT_TO_POINTER(entry->key));
+  uint8_t *blob = NULL;
+  size_t len = 0;
+  dt_colorspaces_color_profile_type_t color_space = DT_COLORSPACE_NONE;
+  if(c && (blob = dt_alloc_align(c->length)))
+  {
+    memcpy(blob, c->blob, c->length);
+    len = c->length;
+    color_space = c->color_space;
+    // most recently used
+    g_queue_unlink(&cache->compressed_lru, &c->link);
+    g_queue_push_tail_link(&cache->compressed_lru, &c->link);
+  }
+  dt_pthread_mutex_unlock(&cache->compressed_mutex);
+  if(!blob) return 0;
+
+  int loaded = 0;
+  uint32_t width = 0, height = 0;
+  dt_colorspaces_color_profile_type_t blob_color_space;
+  if(dt_mipmap_codec_decode(blob, len, (uint8_t *)entry->data + sizeof(*dsc), cache->max_width[mip],
+                            cache->max_height[mip], &width, &height, &blob_color_space))
+  {
+    _compressed_remove(cache, entry->key);
+  }
+  else
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " from compressed memory\n", mip,
+             get_imgid(entry->key));
+    dsc->width = width;
+    dsc->height = height;
+    dsc->iscale = 1.0f;
+    // jpeg blobs don't know their colour space
+    dsc->color_space = color_space;
+    loaded = 1;
+  }
+  dt_free_align(blob);
+  return loaded;
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -369,14 +589,23 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
   int loaded_from_disk = 0;
   if(mip < DT_MIPMAP_F)
   {
-    if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
-                              || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
+    if(_compressed_enabled(cache, mip)) loaded_from_disk = _read_compressed_thumbnail(cache, entry, dsc);
+    if(!loaded_from_disk && _disk_backend_enabled(cache, mip))
     {
       // try and load from disk, if successful set flag
+      if(cache->pack) loaded_from_disk = _read_packed_thumbnail(cache, entry, dsc);
+      // then from the one-file-per-thumbnail store, which also covers thumbnails written
+      // before the packed store was enabled. these are migrated as they get evicted.
+      // files written with the current codec first, then jpeg ones from before it was changed.
       char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-               get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
+      FILE *f = NULL;
+      for(int pass = 0; pass < 2 && !loaded_from_disk && !f; pass++)
+      {
+        const dt_mipmap_codec_t codec = pass ? DT_MIPMAP_CODEC_JPEG : cache->codec;
+        if(pass && codec == cache->codec) break;
+        _thumbnail_filename(cache, filename, sizeof(filename), get_imgid(entry->key), mip, codec);
+        f = g_fopen(filename, "rb");
+      }
       if(f)
       {
         uint8_t *blob = 0;
@@ -389,11 +618,9 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         const int rd = fread(blob, sizeof(uint8_t), len, f);
         if(rd != len) goto read_error;
         dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, (uint8_t *)entry->data + sizeof(*dsc)))
+        uint32_t width = 0, height = 0;
+        if(dt_mipmap_codec_decode(blob, len, (uint8_t *)entry->data + sizeof(*dsc), cache->max_width[mip],
+                                  cache->max_height[mip], &width, &height, &color_space))
         {
           fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from `%s'!\n",
                   get_imgid(entry->key), filename);
@@ -401,8 +628,8 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         }
         dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " from disk cache\n", mip,
                  get_imgid(entry->key));
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
+        dsc->width = width;
+        dsc->height = height;
         dsc->iscale = 1.0f;
         dsc->color_space = color_space;
         loaded_from_disk = 1;
@@ -441,8 +668,98 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
   if(cache->cachedir[0])
   {
     char filename[PATH_MAX] = { 0 };
-    snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
-    g_unlink(filename);
+    for(dt_mipmap_codec_t codec = 0; codec < DT_MIPMAP_CODEC_LAST; codec++)
+    {
+      _thumbnail_filename(cache, filename, sizeof(filename), imgid, mip, codec);
+      g_unlink(filename);
+    }
+  }
+  if(cache->pack) dt_mipmap_pack_remove(cache->pack, imgid, mip);
+  _compressed_remove(cache, get_key(imgid, mip));
+}
+
+// writes the thumbnail to the disk cache, unless it is already there
+static void _write_thumbnail(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                             const struct dt_mipmap_buffer_dsc *dsc)
+{
+  if(cache->pack)
+  {
+    _write_packed_thumbnail(cache, imgid, mip, dsc);
+    return;
+  }
+
+  // serialize to disk
+  char filename[PATH_MAX] = {0};
+  snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
+  const int mkd = g_mkdir_with_parents(filename, 0750);
+  if(!mkd)
+  {
+    _thumbnail_filename(cache, filename, sizeof(filename), imgid, mip, cache->codec);
+    // Don't write existing files as both performance and quality (lossy jpg) suffer
+    FILE *f = NULL;
+    if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
+    {
+      // first check the disk isn't full
+      struct statvfs vfsbuf;
+      if (!statvfs(filename, &vfsbuf))
+      {
+        const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+        if (free_mb < 100)
+        {
+          fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
+          goto write_error;
+        }
+      }
+      else
+      {
+        fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
+        goto write_error;
+      }
+
+      const int cache_quality = dt_conf_get_int("database_cache_quality");
+      int failed;
+      if(cache->codec != DT_MIPMAP_CODEC_JPEG)
+      {
+        size_t len = 0;
+        uint8_t *blob = dt_mipmap_codec_encode(cache->codec, (const uint8_t *)(dsc + 1),
+                                               dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)),
+                                               dsc->color_space, &len);
+        failed = !blob || fwrite(blob, 1, len, f) != len;
+        dt_free_align(blob);
+      }
+      else
+      {
+        const uint8_t *exif = NULL;
+        int exif_len = 0;
+        if(dsc->color_space == DT_COLORSPACE_SRGB)
+        {
+          exif = dt_mipmap_cache_exif_data_srgb;
+          exif_len = dt_mipmap_cache_exif_data_srgb_length;
+        }
+        else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
+        {
+          exif = dt_mipmap_cache_exif_data_adobergb;
+          exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+        }
+        // libjpeg wants RGBA
+        const size_t pixels = (size_t)dsc->width * dsc->height;
+        uint8_t *rgba = dt_alloc_align(pixels * 4);
+        failed = !rgba;
+        if(rgba)
+        {
+          dt_mipmap_codec_swap_red_blue(rgba, (const uint8_t *)(dsc + 1), pixels);
+          failed = dt_imageio_jpeg_write(filename, rgba, dsc->width, dsc->height,
+                                         MIN(100, MAX(10, cache_quality)), exif, exif_len);
+          dt_free_align(rgba);
+        }
+      }
+      if(failed)
+      {
+write_error:
+        g_unlink(filename);
+      }
+    }
+    if(f) fclose(f);
   }
 }
 
@@ -460,59 +777,10 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       {
         dt_mipmap_cache_unlink_ondisk_thumbnail(data, get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
-                                     || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
+      else
       {
-        // serialize to disk
-        char filename[PATH_MAX] = {0};
-        snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
-        const int mkd = g_mkdir_with_parents(filename, 0750);
-        if(!mkd)
-        {
-          snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
-                   get_imgid(entry->key));
-          // Don't write existing files as both performance and quality (lossy jpg) suffer
-          FILE *f = NULL;
-          if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
-          {
-            // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if (!statvfs(filename, &vfsbuf))
-            {
-              const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if (free_mb < 100)
-              {
-                fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
-                goto write_error;
-              }
-            }
-            else
-            {
-              fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
-              goto write_error;
-            }
-
-            const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
-            {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
-            }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
-            {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
-            }
-            if(dt_imageio_jpeg_write(filename, (uint8_t *)entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
-            {
-write_error:
-              g_unlink(filename);
-            }
-          }
-          if(f) fclose(f);
-        }
+        if(_compressed_enabled(cache, mip)) _compressed_store(cache, entry->key, dsc);
+        if(_disk_backend_enabled(cache, mip)) _write_thumbnail(cache, get_imgid(entry->key), mip, dsc);
       }
     }
   }
@@ -526,9 +794,42 @@ static uint32_t nearest_power_of_two(const uint32_t value)
   return rc;
 }
 
+// thumbnails are the first thing to drop under memory pressure, they are cheap to load again from disk
+static void _thumbs_budget(void *data, const double factor)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)data;
+  cache->mip_thumbs.cache.cost_quota = (size_t)(cache->thumbs_quota * factor);
+  dt_cache_gc(&cache->mip_thumbs.cache, 1.0f);
+  if(cache->compressed_quota_base)
+  {
+    dt_pthread_mutex_lock(&cache->compressed_mutex);
+    cache->compressed_quota = (size_t)(cache->compressed_quota_base * factor);
+    _compressed_trim(cache);
+    dt_pthread_mutex_unlock(&cache->compressed_mutex);
+  }
+}
+
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
+  cache->codec = dt_mipmap_codec_get_default();
+  cache->pack = NULL;
+  dt_pthread_mutex_init(&cache->regen_mutex, NULL);
+  cache->regen_pending = g_hash_table_new(NULL, NULL);
+  cache->regen_scheduled = FALSE;
+  dt_pthread_mutex_init(&cache->compressed_mutex, NULL);
+  cache->compressed = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)_compressed_free);
+  g_queue_init(&cache->compressed_lru);
+  cache->compressed_size = 0;
+  cache->compressed_quota_base = cache->compressed_quota
+      = (size_t)MAX(dt_conf_get_int("cache_memory_compressed"), 0) << 20;
+  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend_packed"))
+  {
+    char packdir[PATH_MAX] = { 0 };
+    snprintf(packdir, sizeof(packdir), "%s.pack", cache->cachedir);
+    cache->pack = dt_mipmap_pack_open(packdir);
+    if(!cache->pack) fprintf(stderr, "[mipmap_cache] couldn't open packed disk cache `%s'\n", packdir);
+  }
   // make sure static memory is initialized
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_mipmap_cache_static_dead_image;
   dead_image_f((dt_mipmap_buffer_t *)(dsc + 1));
@@ -582,6 +883,8 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
+  cache->thumbs_quota = max_mem;
+  dt_memory_governor_register(_thumbs_budget, cache);
 
   // even with one thread you want two buffers. one for dr one for thumbs.
   // Also have the nr of cache entries larger than worker threads
@@ -605,9 +908,23 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  dt_memory_governor_unregister(cache);
+  // the compressed tier won't be read anymore, don't encode everything into it
+  cache->compressed_quota_base = cache->compressed_quota = 0;
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+  // after the caches, their cleanup callbacks still write to the store
+  if(cache->pack) dt_mipmap_pack_close(cache->pack);
+  cache->pack = NULL;
+  g_hash_table_destroy(cache->regen_pending);
+  cache->regen_pending = NULL;
+  dt_pthread_mutex_destroy(&cache->regen_mutex);
+  g_queue_init(&cache->compressed_lru);
+  g_hash_table_destroy(cache->compressed);
+  cache->compressed = NULL;
+  cache->compressed_size = 0;
+  dt_pthread_mutex_destroy(&cache->compressed_mutex);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -622,6 +939,11 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   printf("[mipmap_cache] full  fill %"PRIu32"/%"PRIu32" slots (%.2f%%)\n",
          (uint32_t)cache->mip_full.cache.cost, (uint32_t)cache->mip_full.cache.cost_quota,
          100.0f * (float)cache->mip_full.cache.cost / (float)cache->mip_full.cache.cost_quota);
+  if(cache->compressed_quota)
+    printf("[mipmap_cache] compressed fill %.2f/%.2f MB (%.2f%%), %u thumbnails\n",
+           cache->compressed_size / (1024.0 * 1024.0), cache->compressed_quota / (1024.0 * 1024.0),
+           100.0f * (float)cache->compressed_size / (float)cache->compressed_quota,
+           g_hash_table_size(cache->compressed));
 
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -676,6 +998,54 @@ static dt_mipmap_cache_one_t *_get_cache(dt_mipmap_cache_t *cache, const dt_mipm
   }
 }
 
+// fill the smaller 8-bit levels of imgid which aren't in memory yet from the level just generated, each from
+// the next larger one, so the thumbnail pipe doesn't have to run again for them.
+static void _init_smaller_8(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip,
+                            const struct dt_mipmap_buffer_dsc *src)
+{
+  const uint8_t *in = (const uint8_t *)(src + 1);
+  uint32_t iw = src->width, ih = src->height;
+  const dt_colorspaces_color_profile_type_t color_space = src->color_space;
+  dt_cache_entry_t *prev = NULL;
+  for(int k = (int)mip - 1; k >= DT_MIPMAP_0; k--)
+  {
+    const uint32_t key = get_key(imgid, k);
+    if(dt_cache_contains(&cache->mip_thumbs.cache, key)) continue;
+
+    dt_cache_entry_t *entry = dt_cache_get(&cache->mip_thumbs.cache, key, 'w');
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    // got loaded from disk meanwhile
+    if(!(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE))
+    {
+      dt_cache_release(&cache->mip_thumbs.cache, entry);
+      continue;
+    }
+
+    // DO NOT UPSCALE !!!
+    const float scale = fmaxf(1.0f, fmaxf(iw / (float)cache->max_width[k], ih / (float)cache->max_height[k]));
+    const uint32_t ow = MAX(1, MIN(cache->max_width[k], iw / scale));
+    const uint32_t oh = MAX(1, MIN(cache->max_height[k], ih / scale));
+    ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
+    dt_iop_downscale_box_8(in, iw, ih, (uint8_t *)(dsc + 1), ow, oh);
+    dt_print(DT_DEBUG_CACHE, "[mipmap_cache] generate mip %d for image %" PRIu32 " from level %d\n", k, imgid,
+             k + 1);
+    dsc->width = ow;
+    dsc->height = oh;
+    dsc->iscale = 1.0f;
+    dsc->color_space = color_space;
+    dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+
+    // the new level is the source of the next one, keep it locked until then
+    if(prev) dt_cache_release(&cache->mip_thumbs.cache, prev);
+    prev = entry;
+    in = (const uint8_t *)(dsc + 1);
+    iw = ow;
+    ih = oh;
+  }
+  if(prev) dt_cache_release(&cache->mip_thumbs.cache, prev);
+}
+
 void dt_mipmap_cache_get_with_caller(
     dt_mipmap_cache_t *cache,
     dt_mipmap_buffer_t *buf,
@@ -732,10 +1102,8 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_has_disk_thumbnail(cache, imgid, mip)) return;
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_BLOCKING)
@@ -752,6 +1120,7 @@ void dt_mipmap_cache_get_with_caller(
     if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
     {
       mipmap_generated = 1;
+      const double generate_start = dt_get_wtime();
 
       __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_fetches), 1);
       // fprintf(stderr, "[mipmap cache get] now initializing buffer for img %u mip %d!\n", imgid, mip);
@@ -828,6 +1197,13 @@ void dt_mipmap_cache_get_with_caller(
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+
+      if(dt_trace_enabled())
+      {
+        gchar *name = g_strdup_printf("mip %d of image %d", (int)mip, (int)imgid);
+        dt_trace_span("mipmap", name, generate_start, dt_get_wtime());
+        g_free(name);
+      }
     }
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
@@ -859,8 +1235,14 @@ void dt_mipmap_cache_get_with_caller(
     }
 #endif
 
+    dt_metrics_count(mipmap_generated ? DT_METRICS_MIPMAP_CACHE_MISS : DT_METRICS_MIPMAP_CACHE_HIT, 1);
     if(mipmap_generated)
     {
+      // the smaller levels come for free now, locks are always taken from the larger level to the smaller
+      if(mip < DT_MIPMAP_F && mip > DT_MIPMAP_0 && dsc->width > 8 && dsc->height > 8
+         && dt_conf_handle_get_bool(&_conf_mip_pyramid))
+        _init_smaller_8(cache, imgid, mip, dsc);
+
       /* raise signal that mipmaps has been flushed to cache */
       g_idle_add(_raise_signal_mipmap_updated, GINT_TO_POINTER(imgid));
     }
@@ -899,6 +1281,7 @@ void dt_mipmap_cache_get_with_caller(
       if(buf->buf && buf->width > 0 && buf->height > 0)
       {
         if(mip != k) __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
+        dt_metrics_count(mip == k ? DT_METRICS_MIPMAP_CACHE_HIT : DT_METRICS_MIPMAP_CACHE_MISS, 1);
         return;
       }
       // didn't succeed the first time? prefetch for later!
@@ -917,19 +1300,16 @@ void dt_mipmap_cache_get_with_caller(
       if(buf->buf && buf->width > 0 && buf->height > 0)
       {
         __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_standin), 1);
+        dt_metrics_count(DT_METRICS_MIPMAP_CACHE_MISS, 1);
         return;
       }
     }
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
+    dt_metrics_count(DT_METRICS_MIPMAP_CACHE_MISS, 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_has_disk_thumbnail(cache, imgid, mip))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -1019,6 +1399,149 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid)
     dt_mipmap_cache_remove_at_size(cache, imgid, k);
   }
 }
+typedef struct _regenerate_t
+{
+  uint32_t imgid;
+  uint32_t sizes; // bitmask of the mip levels to render
+} _regenerate_t;
+
+static int32_t _regenerate_job_run(dt_job_t *job);
+
+static gboolean _regenerate_start(gpointer user_data)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)user_data;
+  dt_job_t *job = dt_control_job_create(&_regenerate_job_run, "regenerate thumbnails");
+  if(job) dt_control_job_set_params(job, cache, NULL);
+  // the pending images stay queued if this failed, the next edit schedules a new job
+  if(!job || dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job))
+  {
+    dt_pthread_mutex_lock(&cache->regen_mutex);
+    cache->regen_scheduled = FALSE;
+    dt_pthread_mutex_unlock(&cache->regen_mutex);
+  }
+  return FALSE; // only call once
+}
+
+static int _regenerate_take(dt_mipmap_cache_t *cache, const uint32_t imgid, _regenerate_t *batch, int count)
+{
+  dt_pthread_mutex_lock(&cache->regen_mutex);
+  const uint32_t sizes = GPOINTER_TO_UINT(g_hash_table_lookup(cache->regen_pending, GUINT_TO_POINTER(imgid)));
+  if(sizes) g_hash_table_remove(cache->regen_pending, GUINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->regen_mutex);
+  if(sizes)
+  {
+    batch[count].imgid = imgid;
+    batch[count].sizes = sizes;
+    count++;
+  }
+  return count;
+}
+
+// picks the next images to render in lighttable order: from the first row shown downwards, then upwards,
+// and the images out of the collection last
+static int _regenerate_pick(dt_mipmap_cache_t *cache, _regenerate_t *batch)
+{
+  dt_pthread_mutex_lock(&cache->regen_mutex);
+  const gboolean empty = g_hash_table_size(cache->regen_pending) == 0;
+  dt_pthread_mutex_unlock(&cache->regen_mutex);
+  if(empty) return 0;
+
+  int count = 0;
+  const int offset = MAX(1, dt_conf_get_int("plugins/lighttable/recentcollect/pos0"));
+  for(int pass = 0; pass < 2 && count < DT_MIPMAP_REGENERATE_BATCH; pass++)
+  {
+    // clang-format off
+    const char *query = pass == 0
+      ? "SELECT imgid FROM memory.collected_images WHERE rowid >= ?1 ORDER BY rowid"
+      : "SELECT imgid FROM memory.collected_images WHERE rowid < ?1 ORDER BY rowid DESC";
+    // clang-format on
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset);
+    while(count < DT_MIPMAP_REGENERATE_BATCH && sqlite3_step(stmt) == SQLITE_ROW)
+      count = _regenerate_take(cache, sqlite3_column_int(stmt, 0), batch, count);
+    sqlite3_finalize(stmt);
+  }
+
+  dt_pthread_mutex_lock(&cache->regen_mutex);
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, cache->regen_pending);
+  while(count < DT_MIPMAP_REGENERATE_BATCH && g_hash_table_iter_next(&iter, &key, &value))
+  {
+    batch[count].imgid = GPOINTER_TO_UINT(key);
+    batch[count].sizes = GPOINTER_TO_UINT(value);
+    count++;
+    g_hash_table_iter_remove(&iter);
+  }
+  dt_pthread_mutex_unlock(&cache->regen_mutex);
+  return count;
+}
+
+static void _regenerate_one(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
+{
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING, 'r');
+  // store it right away, the disk cache is what survives the memory cache and restarts
+  if(buf.buf && buf.width > 8 && buf.height > 8 && _disk_backend_enabled(cache, mip))
+    _write_thumbnail(cache, imgid, mip, (const struct dt_mipmap_buffer_dsc *)buf.cache_entry->data);
+  dt_mipmap_cache_release(cache, &buf);
+}
+
+static int32_t _regenerate_job_run(dt_job_t *job)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)dt_control_job_get_params(job);
+
+  _regenerate_t batch[DT_MIPMAP_REGENERATE_BATCH];
+  const int count = _regenerate_pick(cache, batch);
+  for(int i = 0; i < count && dt_control_running(); i++)
+  {
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) break;
+    for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
+      if(batch[i].sizes & (1u << k)) _regenerate_one(cache, batch[i].imgid, k);
+  }
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] regenerated thumbnails of %d images\n", count);
+
+  // go on at the end of the queue, or later on if the user is waiting for thumbnails meanwhile
+  dt_pthread_mutex_lock(&cache->regen_mutex);
+  const gboolean more = g_hash_table_size(cache->regen_pending) > 0 && dt_control_running();
+  cache->regen_scheduled = more;
+  dt_pthread_mutex_unlock(&cache->regen_mutex);
+  if(more)
+  {
+    if(dt_atomic_get_int(&darktable.control->queue_length[DT_JOB_QUEUE_SYSTEM_FG]) > 0)
+      g_timeout_add(DT_MIPMAP_REGENERATE_DELAY, _regenerate_start, cache);
+    else
+      _regenerate_start(cache);
+  }
+  return 0;
+}
+
+void dt_mipmap_cache_regenerate(dt_mipmap_cache_t *cache, const uint32_t imgid)
+{
+  // only the sizes which were in use are worth rendering again, the others are done on demand
+  uint32_t sizes = 0;
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
+    if(dt_cache_contains(&_get_cache(cache, k)->cache, get_key(imgid, k))
+       || dt_mipmap_cache_has_disk_thumbnail(cache, imgid, k))
+      sizes |= 1u << k;
+
+  dt_mipmap_cache_remove(cache, imgid);
+
+  // without lighttable there is nobody waiting for thumbnails
+  if(!sizes || !darktable.gui) return;
+
+  dt_pthread_mutex_lock(&cache->regen_mutex);
+  sizes |= GPOINTER_TO_UINT(g_hash_table_lookup(cache->regen_pending, GUINT_TO_POINTER(imgid)));
+  g_hash_table_insert(cache->regen_pending, GUINT_TO_POINTER(imgid), GUINT_TO_POINTER(sizes));
+  const gboolean schedule = !cache->regen_scheduled;
+  cache->regen_scheduled = TRUE;
+  dt_pthread_mutex_unlock(&cache->regen_mutex);
+
+  // wait a bit so that a burst of edits, like pasting a history onto a selection, ends up in a few jobs
+  if(schedule) g_timeout_add(DT_MIPMAP_REGENERATE_DELAY, _regenerate_start, cache);
+}
+
 void dt_mipmap_cache_evict_at_size(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip)
 {
   const uint32_t key = get_key(imgid, mip);
@@ -1152,8 +1675,8 @@ static int _bpp(dt_imageio_module_data_t *data)
 
 static int _write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
                         dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                        void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                        const gboolean export_masks)
+                        void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                        dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   _dummy_data_t *d = (_dummy_data_t *)data;
   memcpy(d->buf, in, sizeof(uint32_t) * data->width * data->height);
@@ -1181,6 +1704,8 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
 
   const gboolean altered = dt_image_altered(imgid);
   int res = 1;
+  // the embedded thumbnails are decoded to RGBA
+  gboolean rgba = FALSE;
 
   const dt_image_t *cimg = dt_image_cache_get(darktable.image_cache, imgid, 'r');
   // the orientation for this camera is not read correctly from exiv2, so we need
@@ -1216,6 +1741,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
           // scale to fit
           dt_print(DT_DEBUG_CACHE, "[mipmap_cache] generate mip %d for image %d from jpeg\n", size, imgid);
           dt_iop_flip_and_zoom_8(tmp, jpg.width, jpg.height, buf, wd, ht, orientation, width, height);
+          rgba = TRUE;
           res = 0;
         }
         dt_free_align(tmp);
@@ -1242,6 +1768,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
           // scale to fit
           dt_print(DT_DEBUG_CACHE, "[mipmap_cache] generate mip %d for image %d from embedded jpeg\n", size, imgid);
           dt_iop_flip_and_zoom_8(tmp, thumb_width, thumb_height, buf, wd, ht, orientation, width, height);
+          rgba = TRUE;
         }
         dt_free_align(tmp);
       }
@@ -1279,9 +1806,9 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     dat.head.max_width = wd;
     dat.head.max_height = ht;
     dat.buf = buf;
-    // export with flags: ignore exif (don't load from disk), don't swap byte order, don't do hq processing,
-    // no upscaling and signal we want thumbnail export
-    res = dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, TRUE, FALSE, FALSE,
+    // export with flags: ignore exif (don't load from disk), keep the display byte order of the pipe,
+    // don't do hq processing, no upscaling and signal we want thumbnail export
+    res = dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, TRUE, TRUE, FALSE,
                                        FALSE, TRUE, NULL, FALSE, FALSE, DT_COLORSPACE_NONE, NULL, DT_INTENT_LAST, NULL,
                                        NULL, 1, 1, NULL);
     if(!res)
@@ -1308,21 +1835,39 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     return;
   }
 
+  if(rgba) dt_mipmap_codec_swap_red_blue(buf, buf, (size_t)*width * *height);
+
   // TODO: various speed optimizations:
-  // TODO: also init all smaller mips!
   // TODO: use mipf, but:
   // TODO: if output is cropped, don't use mipf!
 }
 
 dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace()
 {
-  if(dt_conf_get_bool("cache_color_managed"))
+  if(dt_conf_handle_get_bool(&_conf_color_managed))
     return DT_COLORSPACE_ADOBERGB;
   return DT_COLORSPACE_DISPLAY;
 }
 
+gboolean dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                            const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0]) return FALSE;
+  if(cache->pack && dt_mipmap_pack_contains(cache->pack, imgid, mip)) return TRUE;
+  char filename[PATH_MAX] = { 0 };
+  _thumbnail_filename(cache, filename, sizeof(filename), imgid, mip, cache->codec);
+  if(g_file_test(filename, G_FILE_TEST_EXISTS)) return TRUE;
+  _thumbnail_filename(cache, filename, sizeof(filename), imgid, mip, DT_MIPMAP_CODEC_JPEG);
+  return g_file_test(filename, G_FILE_TEST_EXISTS);
+}
+
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid)
 {
+  if(cache->pack && dt_conf_get_bool("cache_disk_backend"))
+  {
+    for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
+      dt_mipmap_pack_copy(cache->pack, dst_imgid, src_imgid, mip);
+  }
   if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend"))
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
@@ -1330,8 +1875,8 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
       // try and load from disk, if successful set flag
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
-      snprintf(srcpath, sizeof(srcpath), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, src_imgid);
-      snprintf(dstpath, sizeof(dstpath), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, dst_imgid);
+      _thumbnail_filename(cache, srcpath, sizeof(srcpath), src_imgid, mip, cache->codec);
+      _thumbnail_filename(cache, dstpath, sizeof(dstpath), dst_imgid, mip, cache->codec);
       GFile *src = g_file_new_for_path(srcpath);
       GFile *dst = g_file_new_for_path(dstpath);
       GError *gerror = NULL;
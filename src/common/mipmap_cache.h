@@ -60,6 +60,9 @@ typedef enum dt_mipmap_get_flags_t
 } dt_mipmap_get_flags_t;
 
 // struct to be alloc'ed by the client, filled by dt_mipmap_cache_get()
+// 8-bit buffers hold blue, green, red and a padding byte per pixel, without row padding: this is
+// the layout of CAIRO_FORMAT_RGB24 surfaces, so they can be drawn straight from the locked buffer
+// with cairo_image_surface_create_for_data(). float buffers are RGBA.
 typedef struct dt_mipmap_buffer_t
 {
   dt_mipmap_size_t size;
@@ -98,7 +101,26 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_thumbs;
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
+  // cost quota of the thumbnails before the memory governor scales it
+  size_t thumbs_quota;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // packed disk backend, NULL unless cache_disk_backend_packed is set
+  struct dt_mipmap_pack_t *pack;
+  // codec new disk thumbnails are written with, a dt_mipmap_codec_t
+  int codec;
+  // images waiting for dt_mipmap_cache_regenerate(), imgid -> bitmask of the mip levels to render
+  GHashTable *regen_pending;
+  dt_pthread_mutex_t regen_mutex;
+  // a regeneration job is queued or about to be
+  gboolean regen_scheduled;
+  // thumbnails evicted from mip_thumbs, kept compressed in memory. key -> blob, least recently used first
+  // in compressed_lru. compressed_quota is 0 when disabled.
+  GHashTable *compressed;
+  GQueue compressed_lru;
+  size_t compressed_size, compressed_quota;
+  // compressed_quota before the memory governor scales it
+  size_t compressed_quota_base;
+  dt_pthread_mutex_t compressed_mutex;
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -142,6 +164,9 @@ void dt_mipmap_cache_release_with_caller(dt_mipmap_cache_t *cache, dt_mipmap_buf
 // remove thumbnails, so they will be regenerated:
 void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid);
 void dt_mipmap_cache_remove_at_size(dt_mipmap_cache_t *cache, const uint32_t imgid, const dt_mipmap_size_t mip);
+// same as dt_mipmap_cache_remove() after the history of imgid changed, but the sizes it had are rendered
+// again by a background job and stored in the disk cache. repeated calls are merged until the job runs.
+void dt_mipmap_cache_regenerate(dt_mipmap_cache_t *cache, const uint32_t imgid);
 
 // evict thumbnails from cache. They will be written to disc if not existing
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid);
@@ -161,6 +186,10 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(
 // returns the colorspace to use for created thumbnails, takes config into account
 dt_colorspaces_color_profile_type_t dt_mipmap_cache_get_colorspace();
 
+// whether a thumbnail for imgid at this mip level exists in the disk cache, packed or not
+gboolean dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                            const dt_mipmap_size_t mip);
+
 // copy over thumbnails. used by file operation that copies raw files, to speed up thumbnail generation.
 // only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid);
@@ -0,0 +1,272 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_codec.h"
+#include "common/darktable.h"
+#include "common/imageio_jpeg.h"
+#include "control/conf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_WEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+#define DT_MIPMAP_CODEC_MAGIC "DTMC"
+#define DT_MIPMAP_CODEC_MAGIC_LEN 4
+// 2: pixels are stored in the byte order of the cache instead of RGBA
+#define DT_MIPMAP_CODEC_VERSION 2
+
+// header of the non-jpeg blobs
+typedef struct dt_mipmap_codec_header_t
+{
+  char magic[DT_MIPMAP_CODEC_MAGIC_LEN];
+  uint8_t codec;
+  uint8_t version;
+  int16_t color_space;
+  uint32_t width;
+  uint32_t height;
+} dt_mipmap_codec_header_t;
+
+static const char *_codec_names[DT_MIPMAP_CODEC_LAST] = { "jpeg", "webp", "raw" };
+static const char *_codec_extensions[DT_MIPMAP_CODEC_LAST] = { "jpg", "webp", "rgba" };
+
+gboolean dt_mipmap_codec_available(const dt_mipmap_codec_t codec)
+{
+  switch(codec)
+  {
+    case DT_MIPMAP_CODEC_JPEG:
+    case DT_MIPMAP_CODEC_RAW:
+      return TRUE;
+    case DT_MIPMAP_CODEC_WEBP:
+#ifdef HAVE_WEBP
+      return TRUE;
+#else
+      return FALSE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+dt_mipmap_codec_t dt_mipmap_codec_get_default(void)
+{
+  const char *name = dt_conf_get_string_const("cache_disk_codec");
+  for(int k = 0; k < DT_MIPMAP_CODEC_LAST; k++)
+    if(!g_strcmp0(name, _codec_names[k]) && dt_mipmap_codec_available(k)) return k;
+  return DT_MIPMAP_CODEC_JPEG;
+}
+
+const char *dt_mipmap_codec_name(const dt_mipmap_codec_t codec)
+{
+  return codec < DT_MIPMAP_CODEC_LAST ? _codec_names[codec] : "unknown";
+}
+
+const char *dt_mipmap_codec_extension(const dt_mipmap_codec_t codec)
+{
+  return codec < DT_MIPMAP_CODEC_LAST ? _codec_extensions[codec] : _codec_extensions[DT_MIPMAP_CODEC_JPEG];
+}
+
+void dt_mipmap_codec_swap_red_blue(uint8_t *out, const uint8_t *in, const size_t pixels)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(in, out, pixels) schedule(static)
+#endif
+  for(size_t k = 0; k < pixels; k++)
+  {
+    const uint8_t r = in[4 * k + 2];
+    const uint8_t b = in[4 * k + 0];
+    out[4 * k + 0] = r;
+    out[4 * k + 1] = in[4 * k + 1];
+    out[4 * k + 2] = b;
+    out[4 * k + 3] = in[4 * k + 3];
+  }
+}
+
+static uint8_t *_encode_jpeg(const uint8_t *in, const uint32_t width, const uint32_t height, const int quality,
+                             size_t *length)
+{
+  // dt_imageio_jpeg_compress() assumes the jpeg fits in the size of the uncompressed buffer,
+  // which isn't true of tiny images once the headers are accounted for. these are cheap to
+  // regenerate anyway.
+  const size_t size = (size_t)4 * width * height;
+  if(size < 4096) return NULL;
+  uint8_t *blob = dt_alloc_align(size);
+  // libjpeg wants RGBA
+  uint8_t *rgba = dt_alloc_align(size);
+  if(!blob || !rgba)
+  {
+    dt_free_align(blob);
+    dt_free_align(rgba);
+    return NULL;
+  }
+  dt_mipmap_codec_swap_red_blue(rgba, in, (size_t)width * height);
+  const int len = dt_imageio_jpeg_compress(rgba, blob, width, height, quality);
+  dt_free_align(rgba);
+  // returns 1 on error, no valid jpeg is that short
+  if(len <= 1)
+  {
+    dt_free_align(blob);
+    return NULL;
+  }
+  *length = len;
+  return blob;
+}
+
+static uint8_t *_alloc_with_header(const dt_mipmap_codec_t codec, const uint32_t width, const uint32_t height,
+                                   const dt_colorspaces_color_profile_type_t color_space, const size_t payload)
+{
+  uint8_t *blob = dt_alloc_align(sizeof(dt_mipmap_codec_header_t) + payload);
+  if(!blob) return NULL;
+  dt_mipmap_codec_header_t header = { .codec = codec, .version = DT_MIPMAP_CODEC_VERSION,
+                                      .color_space = color_space, .width = width, .height = height };
+  memcpy(header.magic, DT_MIPMAP_CODEC_MAGIC, DT_MIPMAP_CODEC_MAGIC_LEN);
+  memcpy(blob, &header, sizeof(header));
+  return blob;
+}
+
+#ifdef HAVE_WEBP
+static uint8_t *_encode_webp(const uint8_t *in, const uint32_t width, const uint32_t height, const int quality,
+                             const dt_colorspaces_color_profile_type_t color_space, size_t *length)
+{
+  WebPConfig config;
+  WebPPicture pic;
+  WebPMemoryWriter writer;
+  if(!WebPConfigInit(&config) || !WebPPictureInit(&pic)) return NULL;
+  config.quality = quality;
+  // favour encoding speed, thumbnails are written while browsing
+  config.method = 2;
+  pic.width = width;
+  pic.height = height;
+  pic.use_argb = 1;
+  // the alpha channel of thumbnails carries nothing
+  if(!WebPPictureImportBGRX(&pic, in, 4 * width)) return NULL;
+  WebPMemoryWriterInit(&writer);
+  pic.writer = WebPMemoryWrite;
+  pic.custom_ptr = &writer;
+  const int ok = WebPEncode(&config, &pic);
+  WebPPictureFree(&pic);
+
+  uint8_t *blob = ok ? _alloc_with_header(DT_MIPMAP_CODEC_WEBP, width, height, color_space, writer.size) : NULL;
+  if(blob)
+  {
+    memcpy(blob + sizeof(dt_mipmap_codec_header_t), writer.mem, writer.size);
+    *length = sizeof(dt_mipmap_codec_header_t) + writer.size;
+  }
+  free(writer.mem);
+  return blob;
+}
+#endif
+
+static uint8_t *_encode_raw(const uint8_t *in, const uint32_t width, const uint32_t height,
+                            const dt_colorspaces_color_profile_type_t color_space, size_t *length)
+{
+  const size_t size = (size_t)4 * width * height;
+  uint8_t *blob = _alloc_with_header(DT_MIPMAP_CODEC_RAW, width, height, color_space, size);
+  if(!blob) return NULL;
+  memcpy(blob + sizeof(dt_mipmap_codec_header_t), in, size);
+  *length = sizeof(dt_mipmap_codec_header_t) + size;
+  return blob;
+}
+
+uint8_t *dt_mipmap_codec_encode(const dt_mipmap_codec_t codec, const uint8_t *in, const uint32_t width,
+                                const uint32_t height, const int quality,
+                                const dt_colorspaces_color_profile_type_t color_space, size_t *length)
+{
+  switch(codec)
+  {
+    case DT_MIPMAP_CODEC_JPEG:
+      return _encode_jpeg(in, width, height, quality, length);
+#ifdef HAVE_WEBP
+    case DT_MIPMAP_CODEC_WEBP:
+      return _encode_webp(in, width, height, quality, color_space, length);
+#endif
+    case DT_MIPMAP_CODEC_RAW:
+      return _encode_raw(in, width, height, color_space, length);
+    default:
+      return NULL;
+  }
+}
+
+static int _decode_jpeg(const uint8_t *blob, const size_t length, uint8_t *out, const uint32_t max_width,
+                        const uint32_t max_height, uint32_t *width, uint32_t *height,
+                        dt_colorspaces_color_profile_type_t *color_space)
+{
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(blob, length, &jpg)) return 1;
+  if(jpg.width > max_width || jpg.height > max_height)
+  {
+    jpeg_destroy_decompress(&jpg.dinfo);
+    return 1;
+  }
+  // has to be read before decompressing
+  *color_space = dt_imageio_jpeg_read_color_space(&jpg);
+  if(dt_imageio_jpeg_decompress(&jpg, out)) return 1;
+  dt_mipmap_codec_swap_red_blue(out, out, (size_t)jpg.width * jpg.height);
+  *width = jpg.width;
+  *height = jpg.height;
+  return 0;
+}
+
+int dt_mipmap_codec_decode(const uint8_t *blob, const size_t length, uint8_t *out, const uint32_t max_width,
+                           const uint32_t max_height, uint32_t *width, uint32_t *height,
+                           dt_colorspaces_color_profile_type_t *color_space)
+{
+  dt_mipmap_codec_header_t header;
+  if(length < sizeof(header) || memcmp(blob, DT_MIPMAP_CODEC_MAGIC, DT_MIPMAP_CODEC_MAGIC_LEN))
+    return _decode_jpeg(blob, length, out, max_width, max_height, width, height, color_space);
+
+  memcpy(&header, blob, sizeof(header));
+  if(header.version != DT_MIPMAP_CODEC_VERSION || header.width > max_width || header.height > max_height) return 1;
+  const uint8_t *payload = blob + sizeof(header);
+  const size_t payload_length = length - sizeof(header);
+  const size_t size = (size_t)4 * header.width * header.height;
+
+  switch(header.codec)
+  {
+#ifdef HAVE_WEBP
+    case DT_MIPMAP_CODEC_WEBP:
+    {
+      int w = 0, h = 0;
+      if(!WebPGetInfo(payload, payload_length, &w, &h) || w != header.width || h != header.height) return 1;
+      if(!WebPDecodeBGRAInto(payload, payload_length, out, size, 4 * header.width)) return 1;
+      break;
+    }
+#endif
+    case DT_MIPMAP_CODEC_RAW:
+      if(payload_length != size) return 1;
+      memcpy(out, payload, size);
+      break;
+    default:
+      // written by a build with more codecs than this one
+      return 1;
+  }
+
+  *width = header.width;
+  *height = header.height;
+  *color_space = header.color_space;
+  return 0;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,71 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * Codecs of the thumbnails stored by the disk backend of the mipmap cache.
+ *
+ * Thumbnails are 8-bit buffers in the byte order of the mipmap cache, blue, green, red and a
+ * padding byte (see dt_mipmap_buffer_t). JPEG blobs are plain JPEG files, as written by older
+ * versions. The other codecs are wrapped in a small header holding the size and the colour space
+ * of the thumbnail. decoding recognizes the codec from the blob itself, so changing the
+ * cache_disk_codec preference doesn't invalidate the thumbnails already on disk.
+ */
+
+typedef enum dt_mipmap_codec_t
+{
+  DT_MIPMAP_CODEC_JPEG = 0, // lossy, the default
+  DT_MIPMAP_CODEC_WEBP = 1, // lossy, smaller than jpeg at the same quality but slower to decode
+  DT_MIPMAP_CODEC_RAW = 2,  // uncompressed, the fastest to decode but several times larger
+  DT_MIPMAP_CODEC_LAST
+} dt_mipmap_codec_t;
+
+// codec selected in the preferences, falling back to jpeg if it isn't compiled in
+dt_mipmap_codec_t dt_mipmap_codec_get_default(void);
+gboolean dt_mipmap_codec_available(const dt_mipmap_codec_t codec);
+const char *dt_mipmap_codec_name(const dt_mipmap_codec_t codec);
+// extension of the thumbnail files written with this codec, without the dot
+const char *dt_mipmap_codec_extension(const dt_mipmap_codec_t codec);
+
+// swap the red and blue channels of 8-bit pixels, in and out may be the same buffer
+void dt_mipmap_codec_swap_red_blue(uint8_t *out, const uint8_t *in, const size_t pixels);
+
+// compress the 8-bit buffer in. returns a blob allocated with dt_alloc_align(), or NULL.
+// jpeg blobs carry no colour space, the caller has to store it if it needs it.
+uint8_t *dt_mipmap_codec_encode(const dt_mipmap_codec_t codec, const uint8_t *in, const uint32_t width,
+                                const uint32_t height, const int quality,
+                                const dt_colorspaces_color_profile_type_t color_space, size_t *length);
+
+// decompress blob into out, which holds at least max_width * max_height pixels.
+// returns 0 on success.
+int dt_mipmap_codec_decode(const uint8_t *blob, const size_t length, uint8_t *out, const uint32_t max_width,
+                           const uint32_t max_height, uint32_t *width, uint32_t *height,
+                           dt_colorspaces_color_profile_type_t *color_space);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,476 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DT_MIPMAP_PACK_MAGIC "DTMPACK1"
+#define DT_MIPMAP_PACK_MAGIC_LEN 8
+#define DT_MIPMAP_PACK_INDEX "index.dat"
+// segments are rolled over once they reach this size
+#define DT_MIPMAP_PACK_SEGMENT_SIZE ((int64_t)256 << 20)
+// don't bother compacting for less wasted space than this
+#define DT_MIPMAP_PACK_MIN_DEAD ((int64_t)64 << 20)
+// segment id of a record marking its thumbnail as removed
+#define DT_MIPMAP_PACK_REMOVED 0xffff
+
+// one entry of the index log, written as is: the cache is local to the machine
+typedef struct dt_mipmap_pack_record_t
+{
+  uint32_t imgid;
+  uint8_t mip;
+  uint8_t color_space;
+  uint16_t segment;
+  uint32_t offset;
+  uint32_t length;
+} dt_mipmap_pack_record_t;
+
+struct dt_mipmap_pack_t
+{
+  gchar *dir;
+  GMutex lock;
+  GHashTable *entries; // key -> dt_mipmap_pack_record_t *
+  GPtrArray *segments; // segment id -> FILE *, opened on demand
+  FILE *index;         // append handle of the index log
+  uint16_t current;    // segment new thumbnails are appended to
+  int64_t current_size;
+  int64_t live_bytes;  // bytes referenced by the index
+  int64_t total_bytes; // bytes in all segments
+};
+
+static inline gpointer _key(const uint32_t imgid, const int mip)
+{
+  return GUINT_TO_POINTER(((uint32_t)mip << 28) | (imgid & 0x0fffffff));
+}
+
+static gchar *_segment_path(const dt_mipmap_pack_t *pack, const uint16_t segment)
+{
+  return g_strdup_printf("%s/segment-%05u.dat", pack->dir, (unsigned int)segment);
+}
+
+static int64_t _file_size(const gchar *path)
+{
+  GStatBuf st;
+  return g_stat(path, &st) ? -1 : (int64_t)st.st_size;
+}
+
+static FILE *_get_segment(dt_mipmap_pack_t *pack, const uint16_t segment)
+{
+  if(segment >= pack->segments->len) g_ptr_array_set_size(pack->segments, segment + 1);
+  FILE *f = g_ptr_array_index(pack->segments, segment);
+  if(!f)
+  {
+    // only the current segment is ever written to
+    gchar *path = _segment_path(pack, segment);
+    f = g_fopen(path, segment == pack->current ? "a+b" : "rb");
+    g_free(path);
+    g_ptr_array_index(pack->segments, segment) = f;
+  }
+  return f;
+}
+
+static void _close_segments(dt_mipmap_pack_t *pack)
+{
+  for(guint i = 0; i < pack->segments->len; i++)
+  {
+    FILE *f = g_ptr_array_index(pack->segments, i);
+    if(f) fclose(f);
+    g_ptr_array_index(pack->segments, i) = NULL;
+  }
+}
+
+static dt_mipmap_pack_record_t *_dup_record(const dt_mipmap_pack_record_t *rec)
+{
+  dt_mipmap_pack_record_t *copy = g_malloc(sizeof(dt_mipmap_pack_record_t));
+  *copy = *rec;
+  return copy;
+}
+
+// replay one record of the index log into the table
+static void _apply(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  const gpointer key = _key(rec->imgid, rec->mip);
+  const dt_mipmap_pack_record_t *old = g_hash_table_lookup(pack->entries, key);
+  if(old) pack->live_bytes -= old->length;
+
+  if(rec->segment == DT_MIPMAP_PACK_REMOVED)
+  {
+    g_hash_table_remove(pack->entries, key);
+    return;
+  }
+  g_hash_table_insert(pack->entries, key, _dup_record(rec));
+  pack->live_bytes += rec->length;
+}
+
+static int _append_record(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  if(!pack->index) return 1;
+  if(fwrite(rec, sizeof(dt_mipmap_pack_record_t), 1, pack->index) != 1) return 1;
+  fflush(pack->index);
+  _apply(pack, rec);
+  return 0;
+}
+
+// write the whole table as a fresh index and make it the current one
+static int _write_index(dt_mipmap_pack_t *pack, GHashTable *entries)
+{
+  gchar *path = g_build_filename(pack->dir, DT_MIPMAP_PACK_INDEX, NULL);
+  gchar *tmp = g_build_filename(pack->dir, DT_MIPMAP_PACK_INDEX ".tmp", NULL);
+  int err = 1;
+  FILE *f = g_fopen(tmp, "wb");
+  if(f)
+  {
+    err = fwrite(DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_MAGIC_LEN, 1, f) != 1;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, entries);
+    while(!err && g_hash_table_iter_next(&iter, NULL, &value))
+      err = fwrite(value, sizeof(dt_mipmap_pack_record_t), 1, f) != 1;
+    err |= fclose(f) != 0;
+  }
+
+  if(!err)
+  {
+    if(pack->index) fclose(pack->index);
+    pack->index = NULL;
+#ifdef _WIN32
+    g_unlink(path);
+#endif
+    err = g_rename(tmp, path) != 0;
+  }
+  if(err) g_unlink(tmp);
+  if(!pack->index) pack->index = g_fopen(path, "ab");
+
+  g_free(tmp);
+  g_free(path);
+  return err;
+}
+
+static void _load_index(dt_mipmap_pack_t *pack)
+{
+  gchar *path = g_build_filename(pack->dir, DT_MIPMAP_PACK_INDEX, NULL);
+  gboolean rewrite = TRUE;
+
+  GMappedFile *map = g_mapped_file_new(path, FALSE, NULL);
+  if(map)
+  {
+    const gsize size = g_mapped_file_get_length(map);
+    const char *data = g_mapped_file_get_contents(map);
+    if(size >= DT_MIPMAP_PACK_MAGIC_LEN && !memcmp(data, DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_MAGIC_LEN))
+    {
+      const size_t count = (size - DT_MIPMAP_PACK_MAGIC_LEN) / sizeof(dt_mipmap_pack_record_t);
+      for(size_t i = 0; i < count; i++)
+      {
+        dt_mipmap_pack_record_t rec;
+        memcpy(&rec, data + DT_MIPMAP_PACK_MAGIC_LEN + i * sizeof(rec), sizeof(rec));
+        _apply(pack, &rec);
+      }
+      // a record torn by a crash at the end of the log would misalign everything appended after it
+      rewrite = (size - DT_MIPMAP_PACK_MAGIC_LEN) % sizeof(dt_mipmap_pack_record_t) != 0;
+    }
+    g_mapped_file_unref(map);
+  }
+
+  // drop entries pointing past the end of their segment, in case the segment didn't make it to disk
+  GHashTable *sizes = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, pack->entries);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    const dt_mipmap_pack_record_t *rec = value;
+    gpointer seg_key = GUINT_TO_POINTER(rec->segment + 1);
+    int64_t seg_size;
+    if(!g_hash_table_contains(sizes, seg_key))
+    {
+      gchar *seg_path = _segment_path(pack, rec->segment);
+      seg_size = _file_size(seg_path);
+      g_free(seg_path);
+      g_hash_table_insert(sizes, seg_key, GINT_TO_POINTER((gint)MIN(seg_size, G_MAXINT)));
+    }
+    seg_size = GPOINTER_TO_INT(g_hash_table_lookup(sizes, seg_key));
+    if((int64_t)rec->offset + rec->length > seg_size)
+    {
+      pack->live_bytes -= rec->length;
+      g_hash_table_iter_remove(&iter);
+      rewrite = TRUE;
+      continue;
+    }
+    pack->current = MAX(pack->current, rec->segment);
+  }
+
+  // forget about segments no entry points to anymore, typically left over by an interrupted compaction
+  GDir *dir = g_dir_open(pack->dir, 0, NULL);
+  if(dir)
+  {
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      unsigned int segment;
+      if(sscanf(name, "segment-%05u.dat", &segment) != 1 || segment >= DT_MIPMAP_PACK_REMOVED) continue;
+      gchar *seg_path = g_build_filename(pack->dir, name, NULL);
+      if(g_hash_table_contains(sizes, GUINT_TO_POINTER(segment + 1)))
+        pack->total_bytes += MAX(_file_size(seg_path), 0);
+      else
+        g_unlink(seg_path);
+      g_free(seg_path);
+    }
+    g_dir_close(dir);
+  }
+  g_hash_table_destroy(sizes);
+
+  gchar *seg_path = _segment_path(pack, pack->current);
+  pack->current_size = MAX(_file_size(seg_path), 0);
+  g_free(seg_path);
+
+  if(rewrite)
+    _write_index(pack, pack->entries);
+  else
+    pack->index = g_fopen(path, "ab");
+  g_free(path);
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *dir)
+{
+  if(g_mkdir_with_parents(dir, 0750)) return NULL;
+
+  dt_mipmap_pack_t *pack = g_malloc0(sizeof(dt_mipmap_pack_t));
+  pack->dir = g_strdup(dir);
+  g_mutex_init(&pack->lock);
+  pack->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  pack->segments = g_ptr_array_new();
+  _load_index(pack);
+
+  if(!pack->index)
+  {
+    fprintf(stderr, "[mipmap_pack] can't open the thumbnail index in `%s'\n", dir);
+    dt_mipmap_pack_close(pack);
+    return NULL;
+  }
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] %u thumbnails in `%s', %" PRId64 " MiB used of %" PRId64 " MiB\n",
+           g_hash_table_size(pack->entries), dir, pack->live_bytes >> 20, pack->total_bytes >> 20);
+  return pack;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  if(pack->index) dt_mipmap_pack_compact(pack, FALSE);
+  _close_segments(pack);
+  if(pack->index) fclose(pack->index);
+  g_ptr_array_free(pack->segments, TRUE);
+  g_hash_table_destroy(pack->entries);
+  g_mutex_clear(&pack->lock);
+  g_free(pack->dir);
+  g_free(pack);
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip)
+{
+  g_mutex_lock(&pack->lock);
+  const gboolean found = g_hash_table_contains(pack->entries, _key(imgid, mip));
+  g_mutex_unlock(&pack->lock);
+  return found;
+}
+
+// read the blob of rec. called with the lock held.
+static uint8_t *_read_blob(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  FILE *f = _get_segment(pack, rec->segment);
+  if(!f || !rec->length) return NULL;
+  uint8_t *blob = dt_alloc_align(rec->length);
+  if(!blob) return NULL;
+  if(fseek(f, rec->offset, SEEK_SET) || fread(blob, 1, rec->length, f) != rec->length)
+  {
+    dt_free_align(blob);
+    return NULL;
+  }
+  return blob;
+}
+
+uint8_t *dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, size_t *length,
+                             int *color_space)
+{
+  uint8_t *blob = NULL;
+  g_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_record_t *rec = g_hash_table_lookup(pack->entries, _key(imgid, mip));
+  if(rec && (blob = _read_blob(pack, rec)))
+  {
+    *length = rec->length;
+    *color_space = rec->color_space;
+  }
+  g_mutex_unlock(&pack->lock);
+  return blob;
+}
+
+// append blob to segment, rolling over to a new segment when it's full. called with the lock held.
+static int _append_blob(dt_mipmap_pack_t *pack, const uint8_t *blob, const size_t length,
+                        uint16_t *segment, uint32_t *offset)
+{
+  if(pack->current_size > 0 && pack->current_size + (int64_t)length > DT_MIPMAP_PACK_SEGMENT_SIZE)
+  {
+    if(pack->current + 1 >= DT_MIPMAP_PACK_REMOVED) return 1;
+    pack->current++;
+    pack->current_size = 0;
+  }
+  FILE *f = _get_segment(pack, pack->current);
+  if(!f || fseek(f, 0, SEEK_END)) return 1;
+  const long end = ftell(f);
+  if(end < 0 || fwrite(blob, 1, length, f) != length || fflush(f))
+    return 1;
+  *segment = pack->current;
+  *offset = (uint32_t)end;
+  pack->current_size = end + length;
+  pack->total_bytes += length;
+  return 0;
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, const uint8_t *blob,
+                         const size_t length, const int color_space)
+{
+  if(length == 0 || length > DT_MIPMAP_PACK_SEGMENT_SIZE) return 1;
+  g_mutex_lock(&pack->lock);
+  dt_mipmap_pack_record_t rec = { .imgid = imgid, .mip = mip, .color_space = color_space,
+                                  .length = (uint32_t)length };
+  const int err = _append_blob(pack, blob, length, &rec.segment, &rec.offset) || _append_record(pack, &rec);
+  g_mutex_unlock(&pack->lock);
+  return err;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip)
+{
+  g_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->entries, _key(imgid, mip)))
+  {
+    const dt_mipmap_pack_record_t rec = { .imgid = imgid, .mip = mip, .segment = DT_MIPMAP_PACK_REMOVED };
+    _append_record(pack, &rec);
+  }
+  g_mutex_unlock(&pack->lock);
+}
+
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack, const uint32_t dst_imgid, const uint32_t src_imgid,
+                         const int mip)
+{
+  g_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_record_t *src = g_hash_table_lookup(pack->entries, _key(src_imgid, mip));
+  if(src)
+  {
+    dt_mipmap_pack_record_t rec = *src;
+    rec.imgid = dst_imgid;
+    _append_record(pack, &rec);
+    // the bytes are shared, don't count them twice
+    pack->live_bytes -= rec.length;
+  }
+  g_mutex_unlock(&pack->lock);
+}
+
+static gint _sort_records(gconstpointer a, gconstpointer b)
+{
+  const dt_mipmap_pack_record_t *ra = a;
+  const dt_mipmap_pack_record_t *rb = b;
+  if(ra->mip != rb->mip) return ra->mip < rb->mip ? -1 : 1;
+  if(ra->imgid != rb->imgid) return ra->imgid < rb->imgid ? -1 : 1;
+  return 0;
+}
+
+void dt_mipmap_pack_compact(dt_mipmap_pack_t *pack, const gboolean force)
+{
+  g_mutex_lock(&pack->lock);
+  const int64_t dead = pack->total_bytes - pack->live_bytes;
+  if(!force && (dead < DT_MIPMAP_PACK_MIN_DEAD || dead < pack->live_bytes))
+  {
+    g_mutex_unlock(&pack->lock);
+    return;
+  }
+
+  const double start = dt_get_wtime();
+  const uint16_t old_current = pack->current;
+  const int64_t old_current_size = pack->current_size;
+  const int64_t old_total = pack->total_bytes;
+
+  // copy the live thumbnails, in browsing order, to new segments after the existing ones
+  GArray *records = g_array_sized_new(FALSE, FALSE, sizeof(dt_mipmap_pack_record_t),
+                                      g_hash_table_size(pack->entries));
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, pack->entries);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+    g_array_append_vals(records, value, 1);
+  g_array_sort(records, _sort_records);
+
+  GHashTable *compacted = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  int err = old_current + 1 >= DT_MIPMAP_PACK_REMOVED;
+  if(!err)
+  {
+    pack->current = old_current + 1;
+    pack->current_size = 0;
+  }
+  for(guint i = 0; i < records->len && !err; i++)
+  {
+    dt_mipmap_pack_record_t rec = g_array_index(records, dt_mipmap_pack_record_t, i);
+    uint8_t *blob = _read_blob(pack, &rec);
+    err = !blob || _append_blob(pack, blob, rec.length, &rec.segment, &rec.offset);
+    dt_free_align(blob);
+    if(!err) g_hash_table_insert(compacted, _key(rec.imgid, rec.mip), _dup_record(&rec));
+  }
+  if(!err) err = _write_index(pack, compacted);
+
+  const uint16_t first = err ? old_current + 1 : 0;
+  const uint16_t last = err ? pack->current : old_current;
+  _close_segments(pack);
+  for(unsigned int segment = first; segment <= last && segment < DT_MIPMAP_PACK_REMOVED; segment++)
+  {
+    // on failure, drop what we wrote so far, otherwise the old segments
+    gchar *path = _segment_path(pack, segment);
+    g_unlink(path);
+    g_free(path);
+  }
+
+  if(err)
+  {
+    fprintf(stderr, "[mipmap_pack] failed to compact the thumbnails in `%s'\n", pack->dir);
+    pack->current = old_current;
+    pack->current_size = old_current_size;
+    pack->total_bytes = old_total;
+    g_hash_table_destroy(compacted);
+  }
+  else
+  {
+    dt_print(DT_DEBUG_CACHE | DT_DEBUG_PERF, "[mipmap_pack] compacted %u thumbnails from %" PRId64 " to %"
+             PRId64 " MiB in %.3fs\n", records->len, old_total >> 20, (pack->total_bytes - old_total) >> 20,
+             dt_get_wtime() - start);
+    g_hash_table_destroy(pack->entries);
+    pack->entries = compacted;
+    pack->total_bytes -= old_total;
+    pack->live_bytes = pack->total_bytes;
+  }
+
+  g_array_free(records, TRUE);
+  g_mutex_unlock(&pack->lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,67 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * Packed disk backend of the mipmap cache.
+ *
+ * Instead of one jpeg file per image and per mip level, the compressed thumbnails are appended
+ * to a few large segment files, and their location is recorded in an append-only index log.
+ * The index is mapped and replayed into a hash table when the store is opened, so reading a
+ * thumbnail is a hash lookup plus one read in an already opened segment.
+ *
+ * Removed or replaced thumbnails leave dead bytes behind in the segments. dt_mipmap_pack_compact()
+ * rewrites the live ones, sorted by mip level then image id, so that browsing a collection reads
+ * the segments mostly sequentially.
+ *
+ * All functions are thread-safe.
+ */
+
+typedef struct dt_mipmap_pack_t dt_mipmap_pack_t;
+
+// open or create the store in directory dir. returns NULL if the directory can't be used.
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *dir);
+// compact the store if enough space is wasted, then close it
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip);
+// returns the blob stored for imgid and mip, allocated with dt_alloc_align(), or NULL
+uint8_t *dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, size_t *length,
+                             int *color_space);
+// store blob for imgid and mip, replacing any previous one. returns 0 on success.
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip, const uint8_t *blob,
+                         const size_t length, const int color_space);
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid, const int mip);
+// make dst_imgid share the blob of src_imgid at this mip level
+void dt_mipmap_pack_copy(dt_mipmap_pack_t *pack, const uint32_t dst_imgid, const uint32_t src_imgid,
+                         const int mip);
+
+// rewrite the live thumbnails into new segments and drop the old ones.
+// with force = FALSE, only if at least half of the stored bytes are dead.
+void dt_mipmap_pack_compact(dt_mipmap_pack_t *pack, const gboolean force);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -18,11 +18,13 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include "common/conf.h"
 #include "common/math.h"
 #include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "iop/iop_api.h"
 #include "common/nlmeans_core.h"
@@ -137,6 +139,17 @@ define_patches(const dt_nlmeans_param_t *const params, const int stride, int *nu
   return patches;
 }
 
+int nlmeans_search_decimate(const dt_dev_pixelpipe_type_t pipetype)
+{
+  // small previews always get away with half the patches, the darkroom main view only if the
+  // user traded quality for interactivity. Exports always search the whole window.
+  if(pipetype & (DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_THUMBNAIL))
+    return 1;
+  if(pipetype & DT_DEV_PIXELPIPE_FULL)
+    return dt_conf_get_bool("plugins/darkroom/nlmeans/fast_interactive") ? 1 : 0;
+  return 0;
+}
+
 static float compute_center_pixel_norm(const float center_weight, const int radius)
 {
   // scale the central pixel's contribution by the size of the patch so that the center-weight
@@ -172,6 +185,30 @@ static inline float diff_of_pixels_diff(const float* const pix1, const float* pi
   return sum[0] + sum[1] + sum[2];
 }
 
+// same as pixel_difference() and diff_of_pixels_diff(), written out channel by channel so that
+// they can be inlined into loops which are vectorized across columns rather than channels
+static inline float pixel_difference_scalar(const float* const pix1, const float* pix2, const float *const norm)
+{
+  const float diff0 = pix1[0] - pix2[0];
+  const float diff1 = pix1[1] - pix2[1];
+  const float diff2 = pix1[2] - pix2[2];
+  return diff0 * diff0 * norm[0] + diff1 * diff1 * norm[1] + diff2 * diff2 * norm[2];
+}
+
+static inline float diff_of_pixels_diff_scalar(const float* const pix1, const float* pix2,
+                                               const float* const pix3, const float* pix4,
+                                               const float *const norm)
+{
+  const float diff0 = pix1[0] - pix2[0];
+  const float diff1 = pix1[1] - pix2[1];
+  const float diff2 = pix1[2] - pix2[2];
+  const float diff3 = pix3[0] - pix4[0];
+  const float diff4 = pix3[1] - pix4[1];
+  const float diff5 = pix3[2] - pix4[2];
+  return (diff0 * diff0 - diff3 * diff3) * norm[0] + (diff1 * diff1 - diff4 * diff4) * norm[1]
+         + (diff2 * diff2 - diff5 * diff5) * norm[2];
+}
+
 #if defined(__SSE2__)
 // compute the channel-normed squared difference between two pixels; don't do horizontal sum until later
 static inline __m128 channel_difference_sse2(const float* const pix1, const float* pix2, const dt_aligned_pixel_t norm)
@@ -407,18 +444,21 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
   struct patch_t* patches = define_patches(params,stride,&num_patches,&max_shift);
   // allocate scratch space, including an overrun area on each end so we don't need a boundary check on every access
   const int radius = params->patch_radius;
+  // the first SLICE_WIDTH floats hold the patch distortions of the current row
 #if defined(CACHE_PIXDIFFS)
-  const size_t scratch_size = (2*radius+3)*(SLICE_WIDTH + 2*radius + 1);
+  const size_t scratch_size = SLICE_WIDTH + (2*radius+3)*(SLICE_WIDTH + 2*radius + 1);
 #else
-  const size_t scratch_size = SLICE_WIDTH + 2*radius + 1 + 48; // getting false sharing without the +48....
+  const size_t scratch_size = SLICE_WIDTH + SLICE_WIDTH + 2*radius + 1 + 48; // getting false sharing without the +48....
 #endif /* CACHE_PIXDIFFS */
   size_t padded_scratch_size;
-  float *const restrict scratch_buf = dt_alloc_perthread_float(scratch_size, &padded_scratch_size);
+  float *const restrict scratch_buf = dt_pixelpipe_alloc_perthread_float(scratch_size, &padded_scratch_size);
   const int chk_height = compute_slice_height(roi_out->height);
   const int chk_width = compute_slice_width(roi_out->width);
+  // OpenMP workers don't see the kill switch of the pipe, hand it over
+  dt_atomic_int *const cancel = dt_dev_pixelpipe_get_cancel_flag();
 #ifdef _OPENMP
 #pragma omp parallel for default(none) num_threads(darktable.num_openmp_threads) \
-      dt_omp_firstprivate(patches, num_patches, scratch_buf, padded_scratch_size, chk_height, chk_width, radius) \
+      dt_omp_firstprivate(patches, num_patches, scratch_buf, padded_scratch_size, chk_height, chk_width, radius, cancel) \
       dt_omp_sharedconst(params, roi_out, outbuf, inbuf, stride, center_norm, skip_blend, weight, invert) \
       schedule(static) \
       collapse(2)
@@ -427,10 +467,14 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      // params changed meanwhile, skip the remaining chunks
+      if(cancel && dt_atomic_get_int(cancel)) continue;
+
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
-      float *const col_sums =  tmpbuf + (radius+1) - chunk_left;
+      float *const row_dist = tmpbuf - chunk_left;
+      float *const col_sums =  tmpbuf + SLICE_WIDTH + (radius+1) - chunk_left;
       // determine which horizontal slice of the image to process
       const int chunk_bot = MIN(chunk_top + chk_height, roi_out->height);
       // determine which vertical slice of the image to process
@@ -469,6 +513,13 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
           {
             distortion += col_sums[i];
           }
+          // the sliding window is a serial dependency, so only slide it here and leave the weights and
+          // the accumulation into the output to a second pass which vectorizes across columns
+          for (int col = col_min; col < col_max; col++)
+          {
+            distortion += (col_sums[col+radius] - col_sums[col-radius-1]);
+            row_dist[col] = distortion;
+          }
           // now proceed down the current row of the image
           const float *in = inbuf + stride * row;
           float *const out = outbuf + (size_t)4 * width * row;
@@ -477,95 +528,110 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
           if (params->center_weight < 0)
           {
             // computation as used by denoise(non-local) iop
+#ifdef _OPENMP
+#pragma omp simd
+#endif
             for (int col = col_min; col < col_max; col++)
             {
-              distortion += (col_sums[col+radius] - col_sums[col-radius-1]);
-              const float wt = gh(distortion * sharpness);
-              const float *const inpx = in+4*col;
-              const dt_aligned_pixel_t pixel = { inpx[offset],  inpx[offset+1], inpx[offset+2], 1.0f };
-              for_four_channels(c,aligned(pixel,out:16))
-              {
-                out[4*col+c] += pixel[c] * wt;
-              }
-              _mm_prefetch(in+4*col+offset+stride,_MM_HINT_T0);	// try to ensure next row is ready in time
+              const float wt = gh(row_dist[col] * sharpness);
+              const float *const inpx = in + 4*col + offset;
+              out[4*col+0] += inpx[0] * wt;
+              out[4*col+1] += inpx[1] * wt;
+              out[4*col+2] += inpx[2] * wt;
+              out[4*col+3] += wt;
             }
           }
           else
           {
             // computation as used by denoiseprofiled iop with non-local means
+            const float center_weight = params->center_weight;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
             for (int col = col_min; col < col_max; col++)
             {
-              distortion += (col_sums[col+radius] - col_sums[col-radius-1]);
-              const float dissimilarity = (distortion + pixel_difference(in+4*col,in+4*col+offset,center_norm))
-                                           / (1.0f + params->center_weight);
+              const float dissimilarity = (row_dist[col] + pixel_difference_scalar(in+4*col,in+4*col+offset,center_norm))
+                                           / (1.0f + center_weight);
               const float wt = gh(fmaxf(0.0f, dissimilarity * sharpness - 2.0f));
-              const float *const inpx = in + 4*col;
-              const dt_aligned_pixel_t pixel = { inpx[offset],  inpx[offset+1], inpx[offset+2], 1.0f };
-              for_four_channels(c,aligned(pixel,out:16))
-              {
-                out[4*col+c] += pixel[c] * wt;
-              }
-              _mm_prefetch(in+4*col+offset+stride,_MM_HINT_T0);	// try to ensure next row is ready in time
+              const float *const inpx = in + 4*col + offset;
+              out[4*col+0] += inpx[0] * wt;
+              out[4*col+1] += inpx[1] * wt;
+              out[4*col+2] += inpx[2] * wt;
+              out[4*col+3] += wt;
             }
           }
           const int pcol_min = chunk_left - MIN(radius,MIN(chunk_left,chunk_left+scol));
           const int pcol_max = chunk_right + MIN(radius,MIN(width-chunk_right,width-(chunk_right+scol)));
+          const float *const norm = params->norm;
           if (row < MIN(row_top, row_bot))
           {
             // top edge of patch was above top of RoI, so it had a value of zero; just add in the new row
             const float *bot_row = inbuf + (row+1+radius)*stride;
+#ifdef CACHE_PIXDIFFS
             for (int col = pcol_min; col < pcol_max; col++)
             {
               const float *const bot_px = bot_row + 4*col;
-              const float diff = pixel_difference(bot_px,bot_px+offset,params->norm);
-              _mm_prefetch(bot_px+stride, _MM_HINT_T0);
-#ifdef CACHE_PIXDIFFS
+              const float diff = pixel_difference(bot_px,bot_px+offset,norm);
               set_pixdiff(col_sums,radius,row+radius+1,col,diff);
-#endif
               col_sums[col] += diff;
-              _mm_prefetch(bot_px+offset+stride, _MM_HINT_T0);
             }
+#else
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+            for (int col = pcol_min; col < pcol_max; col++)
+            {
+              const float *const bot_px = bot_row + 4*col;
+              col_sums[col] += pixel_difference_scalar(bot_px,bot_px+offset,norm);
+            }
+#endif /* CACHE_PIXDIFFS */
           }
           else if (row < row_bot)
           {
-#ifndef CACHE_PIXDIFFS
-            const float *const top_row = inbuf + (row-radius)*stride   /* +(2*radius+1)*stride*/ ;
-#endif /* !CACHE_PIXDIFFS */
             const float *const bot_row = inbuf + (row+1+radius)*stride ;
             // both prior and new positions are entirely within the RoI, so subtract the old row and add the new one
+#ifdef CACHE_PIXDIFFS
             for (int col = pcol_min; col < pcol_max; col++)
             {
-#ifdef CACHE_PIXDIFFS
               const float *const bot_px = bot_row + 4*col;
-              const float diff = pixel_difference(bot_px,bot_px+offset,params->norm);
+              const float diff = pixel_difference(bot_px,bot_px+offset,norm);
               col_sums[col] += diff - get_pixdiff(col_sums,radius,row-radius,col);
               _mm_prefetch(bot_px+stride, _MM_HINT_T0);
               set_pixdiff(col_sums,radius,row+1+radius,col,diff);
+              _mm_prefetch(bot_px+offset+stride, _MM_HINT_T0);
+            }
 #else
+            const float *const top_row = inbuf + (row-radius)*stride;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+            for (int col = pcol_min; col < pcol_max; col++)
+            {
               const float *const top_px = top_row + 4*col;
               const float *const bot_px = bot_row + 4*col;
-              const float diff = diff_of_pixels_diff(bot_px,bot_px+offset,top_px,top_px+offset,params->norm);
-              _mm_prefetch(bot_px+stride, _MM_HINT_T0);
-              col_sums[col] += diff;
-#endif /* CACHE_PIXDIFFS */
-              _mm_prefetch(bot_px+offset+stride, _MM_HINT_T0);
+              col_sums[col] += diff_of_pixels_diff_scalar(bot_px,bot_px+offset,top_px,top_px+offset,norm);
             }
+#endif /* CACHE_PIXDIFFS */
           }
           else if (row >= row_top && row + 1 < row_max) // don't bother updating if last iteration
           {
             // new row of the patch is below the bottom of RoI, so its value is zero; just subtract the old row
-#ifndef CACHE_PIXDIFFS
-            const float *top_row = inbuf + (row-radius)*stride;
-#endif /* !CACHE_PIXDIFFS */
+#ifdef CACHE_PIXDIFFS
             for (int col = pcol_min; col < pcol_max; col++)
             {
-#ifdef CACHE_PIXDIFFS
               col_sums[col] -= get_pixdiff(col_sums,radius,row-radius,col);
+            }
 #else
+            const float *top_row = inbuf + (row-radius)*stride;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+            for (int col = pcol_min; col < pcol_max; col++)
+            {
               const float *const top_px = top_row + 4*col;
-              col_sums[col] -= pixel_difference(top_px,top_px+offset,params->norm);
-#endif /* CACHE_PIXDIFFS */
+              col_sums[col] -= pixel_difference_scalar(top_px,top_px+offset,norm);
             }
+#endif /* CACHE_PIXDIFFS */
           }
         }
       }
@@ -605,7 +671,7 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
 
   // clean up: free the work space
   dt_free_align(patches);
-  dt_free_align(scratch_buf);
+  dt_pixelpipe_free_align(scratch_buf);
   return;
 }
 
@@ -637,12 +703,14 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
   const size_t scratch_size = SLICE_WIDTH + 2*radius + 1 + 48; // getting false sharing without the +48....
 #endif /* CACHE_PIXDIFFS_SSE */
   size_t padded_scratch_size;
-  float *const restrict scratch_buf = dt_alloc_perthread_float(scratch_size, &padded_scratch_size);
+  float *const restrict scratch_buf = dt_pixelpipe_alloc_perthread_float(scratch_size, &padded_scratch_size);
   const int chk_height = compute_slice_height(roi_out->height);
   const int chk_width = compute_slice_width(roi_out->width);
+  // OpenMP workers don't see the kill switch of the pipe, hand it over
+  dt_atomic_int *const cancel = dt_dev_pixelpipe_get_cancel_flag();
 #ifdef _OPENMP
 #pragma omp parallel for default(none) num_threads(darktable.num_openmp_threads) \
-      dt_omp_firstprivate(patches, num_patches, scratch_buf, padded_scratch_size, chk_height, chk_width, radius) \
+      dt_omp_firstprivate(patches, num_patches, scratch_buf, padded_scratch_size, chk_height, chk_width, radius, cancel) \
       dt_omp_sharedconst(params, roi_out, outbuf, inbuf, stride, center_norm, skip_blend, weight, invert) \
       schedule(static) \
       collapse(2)
@@ -651,6 +719,9 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      // params changed meanwhile, skip the remaining chunks
+      if(cancel && dt_atomic_get_int(cancel)) continue;
+
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
@@ -823,7 +894,7 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
 
   // clean up: free the work space
   dt_free_align(patches);
-  dt_free_align(scratch_buf);
+  dt_pixelpipe_free_align(scratch_buf);
   return;
 }
 #endif /* __SSE2__ */
@@ -40,6 +40,10 @@ struct dt_nlmeans_param_t
 };
 typedef struct dt_nlmeans_param_t dt_nlmeans_param_t;
 
+// whether the patches of the search window should be subsampled (params->decimate) for this pipe,
+// trading denoising quality for speed on previews and, if enabled by the user, in the darkroom
+int nlmeans_search_decimate(const dt_dev_pixelpipe_type_t pipetype);
+
 void nlmeans_denoise(const float *const inbuf, float *const outbuf,
                      const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                      const dt_nlmeans_param_t *const params);
@@ -20,6 +20,8 @@
 #include "common/file_location.h"
 #include "control/control.h"
 
+#include <json-glib/json-glib.h>
+
 // bump this when the noiseprofiles are getting a different layout or meaning (raw-raw data, ...)
 #define DT_NOISE_PROFILE_VERSION 0
 
@@ -27,12 +29,58 @@ const dt_noiseprofile_t dt_noiseprofile_generic = {N_("generic poissonian"), "",
 
 static gboolean dt_noiseprofile_verify(JsonParser *parser);
 
-JsonParser *dt_noiseprofile_init(const char *alternative)
+// the profiles of one maker, model -> GList of dt_noiseprofile_t sorted by iso
+typedef struct _maker_t
+{
+  gchar *maker;
+  GHashTable *models;
+} _maker_t;
+
+// file given on the command line, NULL for the default locations
+static gchar *_alternative = NULL;
+// _maker_t, in the order of the file. loaded on first lookup
+static GPtrArray *_makers = NULL;
+static gboolean _loaded = FALSE;
+static dt_pthread_mutex_t _load_mutex;
+
+static void _maker_free(gpointer data)
+{
+  _maker_t *maker = (_maker_t *)data;
+  g_free(maker->maker);
+  g_hash_table_destroy(maker->models);
+  g_free(maker);
+}
+
+static void _profiles_free(gpointer data)
+{
+  g_list_free_full((GList *)data, dt_noiseprofile_free);
+}
+
+void dt_noiseprofile_init(const char *alternative)
+{
+  // parsing and checking the whole file is left to the first image that needs a profile
+  _alternative = g_strdup(alternative);
+  _makers = NULL;
+  _loaded = FALSE;
+  dt_pthread_mutex_init(&_load_mutex, NULL);
+}
+
+void dt_noiseprofile_cleanup(void)
+{
+  if(_makers) g_ptr_array_free(_makers, TRUE);
+  _makers = NULL;
+  _loaded = FALSE;
+  g_free(_alternative);
+  _alternative = NULL;
+  dt_pthread_mutex_destroy(&_load_mutex);
+}
+
+static JsonParser *_parse(void)
 {
   GError *error = NULL;
   char filename[PATH_MAX] = { 0 };
 
-  if(alternative == NULL)
+  if(_alternative == NULL)
   {
     char dir[PATH_MAX] = { 0 };
 
@@ -46,12 +94,11 @@ JsonParser *dt_noiseprofile_init(const char *alternative)
     }
   }
   else
-    g_strlcpy(filename, alternative, sizeof(filename));
+    g_strlcpy(filename, _alternative, sizeof(filename));
 
   dt_print(DT_DEBUG_CONTROL, "[noiseprofile] loading noiseprofiles from `%s'\n", filename);
   if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return NULL;
 
-  // TODO: shall we cache the content? for now this looks fast enough(TM)
   JsonParser *parser = json_parser_new();
   if(!json_parser_load_from_file(parser, filename, &error))
   {
@@ -229,143 +276,165 @@ end:
 }
 #undef _ERROR
 
-GList *dt_noiseprofile_get_matching(const dt_image_t *cimg)
+// read the profiles of a model, the reader being on its `profiles' member
+static GList *_read_profiles(JsonReader *reader, const char *maker, const char *model)
 {
-  JsonParser *parser = darktable.noiseprofile_parser;
-  JsonReader *reader = NULL;
   GList *result = NULL;
+  const int n_profiles = json_reader_count_elements(reader);
+  for(int k = 0; k < n_profiles; k++)
+  {
+    dt_noiseprofile_t tmp_profile = { 0 };
 
-  if(!parser) goto end;
+    json_reader_read_element(reader, k);
 
-  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] looking for maker `%s', model `%s'\n", cimg->camera_maker, cimg->camera_model);
+    gchar** member_names = json_reader_list_members(reader);
 
-  JsonNode *root = json_parser_get_root(parser);
+    // do we want to skip this entry?
+    if(is_member(member_names, "skip"))
+    {
+      json_reader_read_member(reader, "skip");
+      gboolean skip = json_reader_get_boolean_value(reader);
+      json_reader_end_member(reader);
+      if(skip)
+      {
+        json_reader_end_element(reader);
+        g_strfreev(member_names);
+        continue;
+      }
+    }
 
-  reader = json_reader_new(root);
+    tmp_profile.maker = g_strdup(maker);
+    tmp_profile.model = g_strdup(model);
 
-  json_reader_read_member(reader, "noiseprofiles");
+    // name
+    json_reader_read_member(reader, "name");
+    tmp_profile.name = g_strdup(json_reader_get_string_value(reader));
+    json_reader_end_member(reader);
 
-  // go through all makers
-  const int n_makers = json_reader_count_elements(reader);
-  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d makers\n", n_makers);
-  for(int i = 0; i < n_makers; i++)
-  {
-    json_reader_read_element(reader, i);
+    // iso
+    json_reader_read_member(reader, "iso");
+    tmp_profile.iso = json_reader_get_double_value(reader);
+    json_reader_end_member(reader);
 
-    json_reader_read_member(reader, "maker");
+    // a
+    json_reader_read_member(reader, "a");
+    for(int a = 0; a < 3; a++)
+    {
+      json_reader_read_element(reader, a);
+      tmp_profile.a[a] = json_reader_get_double_value(reader);
+      json_reader_end_element(reader);
+    }
+    json_reader_end_member(reader);
 
-    if(g_strstr_len(cimg->camera_maker, -1, json_reader_get_string_value(reader)))
+    // b
+    json_reader_read_member(reader, "b");
+    for(int b = 0; b < 3; b++)
     {
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s'\n", cimg->camera_maker, json_reader_get_string_value(reader));
-      // go through all models and check those
-      json_reader_end_member(reader);
+      json_reader_read_element(reader, b);
+      tmp_profile.b[b] = json_reader_get_double_value(reader);
+      json_reader_end_element(reader);
+    }
+    json_reader_end_member(reader);
 
-      json_reader_read_member(reader, "models");
+    json_reader_end_element(reader);
+
+    // everything worked out, add tmp_profile to result
+    dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+    *new_profile = tmp_profile;
+    result = g_list_prepend(result, new_profile);
+
+    g_strfreev(member_names);
+  }
+  return g_list_sort(result, _sort_by_iso);
+}
 
-      const int n_models = json_reader_count_elements(reader);
-      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d models\n", n_models);
-      for(int j = 0; j < n_models; j++)
+// parse the file into a table of makers with their models hashed, once
+static GPtrArray *_load(void)
+{
+  dt_pthread_mutex_lock(&_load_mutex);
+  if(!_loaded)
+  {
+    JsonParser *parser = _parse();
+    if(parser)
+    {
+      _makers = g_ptr_array_new_with_free_func(_maker_free);
+      JsonReader *reader = json_reader_new(json_parser_get_root(parser));
+      json_reader_read_member(reader, "noiseprofiles");
+      const int n_makers = json_reader_count_elements(reader);
+      for(int i = 0; i < n_makers; i++)
       {
-        json_reader_read_element(reader, j);
+        json_reader_read_element(reader, i);
 
-        json_reader_read_member(reader, "model");
+        _maker_t *maker = g_new0(_maker_t, 1);
+        json_reader_read_member(reader, "maker");
+        maker->maker = g_strdup(json_reader_get_string_value(reader));
+        json_reader_end_member(reader);
+        maker->models = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _profiles_free);
 
-        if(!g_strcmp0(cimg->camera_model, json_reader_get_string_value(reader)))
+        json_reader_read_member(reader, "models");
+        const int n_models = json_reader_count_elements(reader);
+        for(int j = 0; j < n_models; j++)
         {
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %s\n", cimg->camera_model);
-          // we got a match, return at most bufsize elements
+          json_reader_read_element(reader, j);
+          json_reader_read_member(reader, "model");
+          const char *model = json_reader_get_string_value(reader);
           json_reader_end_member(reader);
-
-          json_reader_read_member(reader, "profiles");
-
-          const int n_profiles = json_reader_count_elements(reader);
-          dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %d profiles\n", n_profiles);
-          for(int k = 0; k < n_profiles; k++)
+          // the first entry of a model wins, as with the linear search through the file
+          if(model && !g_hash_table_contains(maker->models, model))
           {
-            dt_noiseprofile_t tmp_profile = { 0 };
-
-            json_reader_read_element(reader, k);
-
-            gchar** member_names = json_reader_list_members(reader);
-
-            // do we want to skip this entry?
-            if(is_member(member_names, "skip"))
-            {
-              json_reader_read_member(reader, "skip");
-              gboolean skip = json_reader_get_boolean_value(reader);
-              json_reader_end_member(reader);
-              if(skip)
-              {
-                json_reader_end_element(reader);
-                g_strfreev(member_names);
-                continue;
-              }
-            }
-
-            // maker
-            tmp_profile.maker = g_strdup(cimg->camera_maker);
-
-            // model
-            tmp_profile.model = g_strdup(cimg->camera_model);
-
-            // name
-            json_reader_read_member(reader, "name");
-            tmp_profile.name = g_strdup(json_reader_get_string_value(reader));
+            json_reader_read_member(reader, "profiles");
+            g_hash_table_insert(maker->models, g_strdup(model), _read_profiles(reader, maker->maker, model));
             json_reader_end_member(reader);
-
-            // iso
-            json_reader_read_member(reader, "iso");
-            tmp_profile.iso = json_reader_get_double_value(reader);
-            json_reader_end_member(reader);
-
-            // a
-            json_reader_read_member(reader, "a");
-            for(int a = 0; a < 3; a++)
-            {
-              json_reader_read_element(reader, a);
-              tmp_profile.a[a] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
-            // b
-            json_reader_read_member(reader, "b");
-            for(int b = 0; b < 3; b++)
-            {
-              json_reader_read_element(reader, b);
-              tmp_profile.b[b] = json_reader_get_double_value(reader);
-              json_reader_end_element(reader);
-            }
-            json_reader_end_member(reader);
-
-            json_reader_end_element(reader);
-
-            // everything worked out, add tmp_profile to result
-            dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
-            *new_profile = tmp_profile;
-            result = g_list_prepend(result, new_profile);
-
-            g_strfreev(member_names);
-          } // profiles
-
-          goto end;
+          }
+          json_reader_end_element(reader);
         }
-
         json_reader_end_member(reader);
+
+        g_ptr_array_add(_makers, maker);
         json_reader_end_element(reader);
-      } // models
+      }
+      json_reader_end_member(reader);
+      g_object_unref(reader);
+      g_object_unref(parser);
+      dt_print(DT_DEBUG_CONTROL, "[noiseprofile] indexed %u makers\n", _makers->len);
     }
+    _loaded = TRUE;
+  }
+  dt_pthread_mutex_unlock(&_load_mutex);
+  return _makers;
+}
 
-    json_reader_end_member(reader);
-    json_reader_end_element(reader);
-  } // makers
+GList *dt_noiseprofile_get_matching(const dt_image_t *cimg)
+{
+  GPtrArray *makers = _load();
+  if(!makers) return NULL;
 
-  json_reader_end_member(reader);
+  dt_print(DT_DEBUG_CONTROL, "[noiseprofile] looking for maker `%s', model `%s'\n", cimg->camera_maker, cimg->camera_model);
 
-end:
-  if(reader) g_object_unref(reader);
-  if(result) result = g_list_sort(result, _sort_by_iso);
-  return result;
+  for(guint i = 0; i < makers->len; i++)
+  {
+    const _maker_t *maker = (const _maker_t *)g_ptr_array_index(makers, i);
+    if(!maker->maker || !g_strstr_len(cimg->camera_maker, -1, maker->maker)) continue;
+
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found `%s' as `%s'\n", cimg->camera_maker, maker->maker);
+    if(!g_hash_table_contains(maker->models, cimg->camera_model)) continue;
+
+    dt_print(DT_DEBUG_CONTROL, "[noiseprofile] found %s\n", cimg->camera_model);
+    // copies the caller owns, with the maker and model of the image
+    GList *result = NULL;
+    for(const GList *l = g_hash_table_lookup(maker->models, cimg->camera_model); l; l = g_list_next(l))
+    {
+      const dt_noiseprofile_t *profile = (const dt_noiseprofile_t *)l->data;
+      dt_noiseprofile_t *new_profile = (dt_noiseprofile_t *)malloc(sizeof(dt_noiseprofile_t));
+      *new_profile = *profile;
+      new_profile->name = g_strdup(profile->name);
+      new_profile->maker = g_strdup(cimg->camera_maker);
+      new_profile->model = g_strdup(cimg->camera_model);
+      result = g_list_prepend(result, new_profile);
+    }
+    return g_list_reverse(result);
+  }
+  return NULL;
 }
 
 void dt_noiseprofile_free(gpointer data)
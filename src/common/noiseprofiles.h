@@ -20,7 +20,6 @@
 
 #include "common/image.h"
 #include <glib.h>
-#include <json-glib/json-glib.h>
 
 typedef struct dt_noiseprofile_t
 {
@@ -35,8 +34,10 @@ dt_noiseprofile_t;
 
 extern const dt_noiseprofile_t dt_noiseprofile_generic;
 
-/** read the noiseprofile file once on startup (kind of)*/
-JsonParser *dt_noiseprofile_init(const char *alternative);
+/** set the noiseprofile file up, alternative overrides the default locations. the file is read and
+    indexed by maker and model when the first profile is looked up */
+void dt_noiseprofile_init(const char *alternative);
+void dt_noiseprofile_cleanup(void);
 
 /*
  * returns the noiseprofiles matching the image's exif data.
@@ -20,6 +20,7 @@
 
 #include "common/opencl.h"
 #include "common/bilateralcl.h"
+#include "common/color_picker.h"
 #include "common/darktable.h"
 #include "common/dlopencl.h"
 #include "common/dwt.h"
@@ -27,11 +28,13 @@
 #include "common/gaussian.h"
 #include "common/guided_filter.h"
 #include "common/heal.h"
+#include "common/histogram.h"
 #include "common/interpolation.h"
 #include "common/locallaplaciancl.h"
 #include "common/nvidia_gpus.h"
 #include "common/opencl_drivers_blacklist.h"
 #include "common/tea.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -67,6 +70,18 @@ static dt_opencl_sync_cache_t dt_opencl_get_sync_cache(void);
 static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t profile);
 /** set opencl specific synchronization timeout */
 static void dt_opencl_set_synchronization_timeout(int value);
+/** build programs in the background */
+static void _opencl_build_job(gpointer data, gpointer user_data);
+/** load the local sizes tuned in previous sessions for a device */
+static void _autotune_load(const int devid);
+/** pick the local size of a kernel being tuned, returns what to measure or NULL */
+static struct dt_opencl_tune_entry_t *_autotune_begin(const int devid, const int kernel, const size_t *sizes,
+                                                      const size_t **local, size_t *tuned_local, int *candidate);
+/** record the time taken by a kernel being tuned */
+static void _autotune_end(const int devid, struct dt_opencl_tune_entry_t *entry, const int candidate,
+                          const size_t *sizes, const double start);
+/** synchronize an image stored on its host buffer, see dt_opencl_alloc_device_shared() */
+static int _sync_shared(const int devid, cl_mem mem, const size_t *region, const cl_map_flags flags);
 
 const char *cl_errstr(cl_int error)
 {
@@ -339,6 +354,8 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   memset(cl->dev[dev].kernel_used, 0x0, sizeof(int) * DT_OPENCL_MAX_KERNELS);
   cl->dev[dev].eventlist = NULL;
   cl->dev[dev].eventtags = NULL;
+  cl->dev[dev].pool = NULL;
+  cl->dev[dev].pool_size = 0;
   cl->dev[dev].numevents = 0;
   cl->dev[dev].eventsconsolidated = 0;
   cl->dev[dev].maxevents = 0;
@@ -362,9 +379,19 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   cl->dev[dev].avoid_atomics = 0;
   cl->dev[dev].micro_nap = 250;
   cl->dev[dev].pinned_memory = DT_OPENCL_PINNING_OFF;
+  cl->dev[dev].unified_memory = 0;
+  cl->dev[dev].spirv = 0;
   cl->dev[dev].clroundup_wd = 16;
   cl->dev[dev].clroundup_ht = 16;
   cl->dev[dev].benchmark = 0.0f;
+  cl->dev[dev].timings = NULL;
+  cl->dev[dev].busy_until = 0.0;
+  cl->dev[dev].tuning = NULL;
+  cl->dev[dev].tune_pending = NULL;
+  cl->dev[dev].tune_file = NULL;
+  memset(cl->dev[dev].program_state, 0x0, sizeof(int) * DT_OPENCL_MAX_PROGRAMS);
+  memset(cl->dev[dev].includemd5, 0x0, sizeof(char *) * DT_OPENCL_MAX_INCLUDES);
+  cl->dev[dev].cachedir = NULL;
   cl->dev[dev].use_events = 1;
   cl->dev[dev].event_handles = 128;
   cl->dev[dev].asyncmode = 0;
@@ -396,6 +423,7 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   cl_bool device_available = 0;
   cl_uint vendor_id = 0;
   cl_bool little_endian = 0;
+  cl_bool unified_memory = 0;
   cl_platform_id platform_id = 0;
 
   char *dtcache = calloc(PATH_MAX, sizeof(char));
@@ -408,7 +436,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   char kerneldir[PATH_MAX] = { 0 };
   char *filename = calloc(PATH_MAX, sizeof(char));
   char *confentry = calloc(PATH_MAX, sizeof(char));
-  char *binname = calloc(PATH_MAX, sizeof(char));
   dt_print_nts(DT_DEBUG_OPENCL, "\n[dt_opencl_device_init]\n");
 
   // test GPU availability, vendor, memory, image support etc:
@@ -498,8 +525,20 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   (cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong),
                                            &(cl->dev[dev].max_mem_alloc), NULL);
   (cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_ENDIAN_LITTLE, sizeof(cl_bool), &little_endian, NULL);
+  // deprecated by OpenCL 2.0 but still answered by the drivers, and there is no other way to tell
+  (cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified_memory,
+                                           NULL);
 
   cl->dev[dev].cltype = (unsigned int)type;
+  cl->dev[dev].unified_memory = unified_memory && dt_conf_get_bool("opencl_unified_memory");
+
+  if(cl->dlocl->symbols->dt_clCreateProgramWithIL && dt_conf_get_bool("opencl_spirv"))
+  {
+    char ilversion[256] = { 0 };
+    if((cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_IL_VERSION, sizeof(ilversion) - 1, ilversion,
+                                                NULL) == CL_SUCCESS)
+      cl->dev[dev].spirv = (strstr(ilversion, "SPIR-V") != NULL);
+  }
 
 
   if(!strncasecmp(vendor, "NVIDIA", 6))
@@ -522,6 +561,9 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
       ((type & CL_DEVICE_TYPE_CPU) == CL_DEVICE_TYPE_CPU) ? "CPU" : "",
       ((type & CL_DEVICE_TYPE_GPU) == CL_DEVICE_TYPE_GPU) ? "GPU" : "",
       (type & CL_DEVICE_TYPE_ACCELERATOR)                 ? ", Accelerator" : "" );
+  dt_print_nts(DT_DEBUG_OPENCL, "   UNIFIED MEMORY:           %s%s\n", unified_memory ? "YES" : "NO",
+      (unified_memory && !cl->dev[dev].unified_memory) ? ", NOT USED" : "");
+  dt_print_nts(DT_DEBUG_OPENCL, "   SPIR-V PROGRAMS:          %s\n", cl->dev[dev].spirv ? "YES" : "NO");
 
   if(is_cpu_device && newdevice)
   {
@@ -641,15 +683,16 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   }
   // create a command queue for first device the context reported
   cl->dev[dev].cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(
-      cl->dev[dev].context, devid, (darktable.unmuted & DT_DEBUG_PERF) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+      cl->dev[dev].context, devid,
+      ((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled()) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
   if(err != CL_SUCCESS)
   {
     dt_print_nts(DT_DEBUG_OPENCL, "   *** could not create command queue *** %s\n", cl_errstr(err));
     res = -1;
     goto end;
   }
+  dt_trace_name_device(dev, infostr);
 
-  double tstart, tend, tdiff;
   dt_loc_get_user_cache_dir(dtcache, PATH_MAX * sizeof(char));
 
   int len = MIN(strlen(infostr),1024 * sizeof(char));;
@@ -672,6 +715,13 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     goto end;
   }
 
+  // the tuned local sizes depend on the device and driver as much as the compiled kernels
+  if(cl->autotune)
+  {
+    cl->dev[dev].tune_file = g_build_filename(cachedir, "autotune.txt", NULL);
+    _autotune_load(dev);
+  }
+
   dt_loc_get_kerneldir(kerneldir, sizeof(kerneldir));
   dt_print_nts(DT_DEBUG_OPENCL, "   KERNEL DIRECTORY:         %s\n", kerneldir);
 
@@ -722,8 +772,8 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
   escapedkerneldir = NULL;
 
   const char *clincludes[DT_OPENCL_MAX_INCLUDES] = { "rgb_norms.h", "noise_generator.h", "color_conversion.h", "colorspaces.cl", "colorspace.h", "common.h", NULL };
-  char *includemd5[DT_OPENCL_MAX_INCLUDES] = { NULL };
-  dt_opencl_md5sum(clincludes, includemd5);
+  dt_opencl_md5sum(clincludes, cl->dev[dev].includemd5);
+  cl->dev[dev].cachedir = g_strdup(cachedir);
 
   if(newdevice) // so far the device seems to be ok. Make sure to write&export the conf database to
   {
@@ -731,9 +781,8 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     dt_conf_save(darktable.conf);
   }
 
-  // now load all darktable cl kernels.
-  // TODO: compile as a job?
-  tstart = dt_get_wtime();
+  // register the programs of all darktable cl kernels. They are only built on first use of one of their
+  // kernels, see _opencl_kernel_ready(), so a cold kernel cache doesn't delay the startup.
   FILE *f = g_fopen(filename, "rb");
   if(f)
   {
@@ -772,34 +821,18 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
 
       prog = programnumber ? strtol(programnumber, NULL, 10) : -1;
 
-      if(!programname || programname[0] == '\0' || prog < 0)
+      if(!programname || programname[0] == '\0' || prog < 0 || prog >= DT_OPENCL_MAX_PROGRAMS)
       {
         dt_print(DT_DEBUG_OPENCL, "[dt_opencl_device_init] malformed entry in programs.conf `%s'; ignoring it!\n", confentry);
-        continue;
-      }
-
-      snprintf(filename, PATH_MAX * sizeof(char), "%s" G_DIR_SEPARATOR_S "%s", kerneldir, programname);
-      snprintf(binname, PATH_MAX * sizeof(char), "%s" G_DIR_SEPARATOR_S "%s.bin", cachedir, programname);
-      dt_vprint(DT_DEBUG_OPENCL, "[dt_opencl_device_init] testing program `%s' ..\n", programname);
-      int loaded_cached;
-      char md5sum[33];
-      if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, includemd5, &loaded_cached)
-         && dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached) != CL_SUCCESS)
-      {
-        dt_print(DT_DEBUG_OPENCL, "[dt_opencl_device_init] failed to compile program `%s'!\n", programname);
-        fclose(f);
         g_strfreev(tokens);
-        res = -1;
-        goto end;
+        continue;
       }
 
+      if(!cl->program_file[prog]) cl->program_file[prog] = g_strdup(programname);
       g_strfreev(tokens);
     }
 
     fclose(f);
-    tend = dt_get_wtime();
-    tdiff = tend - tstart;
-    dt_print_nts(DT_DEBUG_OPENCL, "   KERNEL LOADING TIME:       %2.4lf sec\n", tdiff);
   }
   else
   {
@@ -807,7 +840,6 @@ static int dt_opencl_device_init(dt_opencl_t *cl, const int dev, cl_device_id *d
     res = -1;
     goto end;
   }
-  for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(includemd5[n]);
   res = 0;
 
 end:
@@ -829,7 +861,6 @@ end:
 
   free(filename);
   free(confentry);
-  free(binname);
 
   return res;
 }
@@ -837,6 +868,17 @@ end:
 void dt_opencl_init(dt_opencl_t *cl, const gboolean exclude_opencl, const gboolean print_statistics)
 {
   dt_pthread_mutex_init(&cl->lock, NULL);
+  dt_pthread_mutex_init(&cl->pool_lock, NULL);
+  cl->pool_owned = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+  cl->pool_percent = CLAMP(dt_conf_get_int("opencl_memory_pool"), 0, 100);
+  cl->cpu_timings = NULL;
+  cl->cpu_pipes = 0;
+  cl->autotune = dt_conf_get_bool("opencl_autotune");
+  cl->lazy_build = FALSE;
+  cl->build_pool = NULL;
+  memset(cl->program_file, 0x0, sizeof(gchar *) * DT_OPENCL_MAX_PROGRAMS);
+  memset(cl->kernel_program, 0x0, sizeof(int) * DT_OPENCL_MAX_KERNELS);
+  memset(cl->kernel_name, 0x0, sizeof(gchar *) * DT_OPENCL_MAX_KERNELS);
   cl->inited = 0;
   cl->enabled = 0;
   cl->stopped = 0;
@@ -1062,6 +1104,8 @@ finally:
     cl->heal = dt_heal_init_cl_global();
     cl->colorspaces = dt_colorspaces_init_cl_global();
     cl->guided_filter = dt_guided_filter_init_cl_global();
+    cl->histogram = dt_histogram_init_cl_global();
+    cl->color_picker = dt_color_picker_init_cl_global();
 
     // make sure all active cl devices have a benchmark result
     for(int n = 0; n < cl->num_devs; n++)
@@ -1073,6 +1117,11 @@ finally:
       }
     }
 
+    // from now on, programs are built in the background on first use and the modules waiting for them
+    // run on the CPU meanwhile. The benchmark above needed its kernels right away.
+    cl->build_pool = g_thread_pool_new(_opencl_build_job, NULL, MAX(1, dt_get_num_threads() / 2), FALSE, NULL);
+    cl->lazy_build = (cl->build_pool != NULL);
+
     char checksum[64];
     snprintf(checksum, sizeof(checksum), "%u", cl->crc);
     const char *oldchecksum = dt_conf_get_string_const("opencl_checksum");
@@ -1141,7 +1190,7 @@ finally:
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        if(cl->dev[i].kernel[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -1152,6 +1201,13 @@ finally:
         free(cl->dev[i].eventlist);
         free(cl->dev[i].eventtags);
       }
+      if(cl->dev[i].timings) g_hash_table_destroy(cl->dev[i].timings);
+      if(cl->dev[i].tuning) g_hash_table_destroy(cl->dev[i].tuning);
+      free(cl->dev[i].tune_pending);
+      g_free(cl->dev[i].tune_file);
+      g_free(cl->dev[i].cachedir);
+      for(int n = 0; n < DT_OPENCL_MAX_INCLUDES; n++) g_free(cl->dev[i].includemd5[n]);
+
       free((void *)(cl->dev[i].vendor));
       free((void *)(cl->dev[i].name));
       free((void *)(cl->dev[i].cname));
@@ -1177,6 +1233,10 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
 {
   if(cl->inited)
   {
+    // drop the builds not started yet, wait for the running ones
+    if(cl->build_pool) g_thread_pool_free(cl->build_pool, TRUE, TRUE);
+    cl->build_pool = NULL;
+
     dt_develop_blend_free_cl_global(cl->blendop);
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
@@ -1185,12 +1245,15 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
     dt_heal_free_cl_global(cl->heal);
     dt_colorspaces_free_cl_global(cl->colorspaces);
     dt_guided_filter_free_cl_global(cl->guided_filter);
+    dt_histogram_free_cl_global(cl->histogram);
+    dt_color_picker_free_cl_global(cl->color_picker);
 
     for(int i = 0; i < cl->num_devs; i++)
     {
+      dt_opencl_pool_flush(i);
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
       for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++)
-        if(cl->dev[i].kernel_used[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
+        if(cl->dev[i].kernel[k]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[i].kernel[k]);
       for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++)
         if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
@@ -1245,6 +1308,13 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
   }
 
   free(cl->dev);
+  if(cl->pool_owned) g_hash_table_destroy(cl->pool_owned);
+  cl->pool_owned = NULL;
+  if(cl->cpu_timings) g_hash_table_destroy(cl->cpu_timings);
+  cl->cpu_timings = NULL;
+  for(int k = 0; k < DT_OPENCL_MAX_PROGRAMS; k++) g_free(cl->program_file[k]);
+  for(int k = 0; k < DT_OPENCL_MAX_KERNELS; k++) g_free(cl->kernel_name[k]);
+  dt_pthread_mutex_destroy(&cl->pool_lock);
   dt_pthread_mutex_destroy(&cl->lock);
 }
 
@@ -1447,6 +1517,33 @@ int dt_opencl_enqueue_barrier(const int devid)
   return (cl->dlocl->symbols->dt_clEnqueueBarrier)(cl->dev[devid].cmd_queue);
 }
 
+cl_event dt_opencl_enqueue_marker(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return NULL;
+  cl_event marker = NULL;
+  const cl_int err = (cl->dlocl->symbols->dt_clEnqueueMarker)(cl->dev[devid].cmd_queue, &marker);
+  if(err != CL_SUCCESS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_enqueue_marker] could not enqueue marker on device %d: %s\n", devid,
+             cl_errstr(err));
+    return NULL;
+  }
+  // make sure the commands before the marker get submitted to the device
+  (cl->dlocl->symbols->dt_clFlush)(cl->dev[devid].cmd_queue);
+  return marker;
+}
+
+int dt_opencl_wait_for_marker(const int devid, cl_event marker)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return -1;
+  if(marker == NULL) return dt_opencl_finish(devid) ? CL_SUCCESS : -1;
+  const cl_int err = (cl->dlocl->symbols->dt_clWaitForEvents)(1, &marker);
+  (cl->dlocl->symbols->dt_clReleaseEvent)(marker);
+  return err;
+}
+
 static int _take_from_list(int *list, int value)
 {
   int result = -1;
@@ -1696,6 +1793,9 @@ static void dt_opencl_update_priorities(const char *configstr)
              cl->mandatory[1], cl->mandatory[2], cl->mandatory[3]);
 }
 
+// polled while waiting for a device
+static dt_conf_handle_t _conf_mandatory_timeout = DT_CONF_HANDLE("opencl_mandatory_timeout");
+
 int dt_opencl_lock_device(const int pipetype)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -1737,7 +1837,7 @@ int dt_opencl_lock_device(const int pipetype)
   if(priority)
   {
     const int usec = 5000;
-    const int nloop = MAX(0, dt_conf_get_int("opencl_mandatory_timeout"));
+    const int nloop = MAX(0, dt_conf_handle_get_int(&_conf_mandatory_timeout));
 
     // check for free opencl device repeatedly if mandatory is TRUE, else give up after first try
     for(int n = 0; n < nloop; n++)
@@ -1787,9 +1887,160 @@ void dt_opencl_unlock_device(const int dev)
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited) return;
   if(dev < 0 || dev >= cl->num_devs) return;
+  dt_pthread_mutex_lock(&cl->lock);
+  cl->dev[dev].busy_until = 0.0;
+  dt_pthread_mutex_unlock(&cl->lock);
   dt_pthread_mutex_BAD_unlock(&cl->dev[dev].lock);
 }
 
+int dt_opencl_trylock_device(const int dev)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+  if(dev < 0 || dev >= cl->num_devs || cl->dev[dev].disabled) return -1;
+  return dt_pthread_mutex_BAD_trylock(&cl->dev[dev].lock) ? -1 : dev;
+}
+
+// seconds per megapixel of a module on a device, -1 for the CPU. Modules not measured there yet are
+// scaled from another device by the ratio of benchmarks, or estimated from the benchmark alone.
+static double _schedule_module_cost(dt_opencl_t *cl, const int devid, const char *op)
+{
+  GHashTable *timings = (devid < 0) ? cl->cpu_timings : cl->dev[devid].timings;
+  const float benchmark = (devid < 0) ? cl->cpubenchmark : cl->dev[devid].benchmark;
+
+  const float *measured = timings ? g_hash_table_lookup(timings, op) : NULL;
+  if(measured) return *measured;
+
+  for(int k = -1; k < cl->num_devs; k++)
+  {
+    if(k == devid) continue;
+    GHashTable *other = (k < 0) ? cl->cpu_timings : cl->dev[k].timings;
+    const float other_benchmark = (k < 0) ? cl->cpubenchmark : cl->dev[k].benchmark;
+    const float *t = (other && other_benchmark > 0.0f) ? g_hash_table_lookup(other, op) : NULL;
+    if(t) return *t * benchmark / other_benchmark;
+  }
+
+  // the benchmark blurs 1 megapixel 5 times
+  return benchmark / 5.0f;
+}
+
+// expected processing time of the enabled modules of a pipe on a device, -1 for the CPU
+static double _schedule_pipe_cost(dt_opencl_t *cl, const int devid, dt_dev_pixelpipe_t *pipe, const double mpix)
+{
+  double cost = 0.0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece->enabled) cost += _schedule_module_cost(cl, devid, piece->module->op);
+  }
+  return cost * mpix;
+}
+
+int dt_opencl_schedule_device(dt_dev_pixelpipe_t *pipe, const double mpix)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return -1;
+
+  if(cl->scheduling_profile != OPENCL_PROFILE_DYNAMIC)
+  {
+    const int devid = dt_opencl_lock_device(pipe->type);
+    if(devid < 0) dt_atomic_add_int(&cl->cpu_pipes, 1);
+    return devid;
+  }
+
+  // cost[0] is the CPU, cost[k + 1] the device k
+  double *cost = malloc(sizeof(double) * (cl->num_devs + 1));
+  dt_pthread_mutex_lock(&cl->lock);
+  for(int k = -1; k < cl->num_devs; k++)
+    cost[k + 1] = (k < 0 || !cl->dev[k].disabled) ? _schedule_pipe_cost(cl, k, pipe, mpix) : INFINITY;
+  dt_pthread_mutex_unlock(&cl->lock);
+
+  const int usec = 5000;
+  const int nloop = MAX(1, dt_conf_handle_get_int(&_conf_mandatory_timeout));
+  int devid = -1;
+
+  // wait for the device expected to finish first while it is busy, unless the CPU gets there first
+  for(int n = 0; n < nloop; n++)
+  {
+    dt_pthread_mutex_lock(&cl->lock);
+    const double now = dt_get_wtime();
+
+    // the pipes running on the CPU share its cores
+    double best_time = cost[0] * (1 + dt_atomic_get_int(&cl->cpu_pipes));
+    int best = -1;
+    for(int k = 0; k < cl->num_devs; k++)
+    {
+      const double wait = (cl->dev[k].busy_until > 0.0) ? MAX(usec * 1e-6, cl->dev[k].busy_until - now) : 0.0;
+      if(wait + cost[k + 1] < best_time)
+      {
+        best_time = wait + cost[k + 1];
+        best = k;
+      }
+    }
+
+    gboolean done = (best < 0);
+    if(best >= 0)
+    {
+      if(!dt_pthread_mutex_BAD_trylock(&cl->dev[best].lock))
+      {
+        devid = best;
+        done = TRUE;
+      }
+      else if(cl->dev[best].busy_until <= 0.0)
+      {
+        // locked outside of the scheduler, assume it runs a pipe like ours
+        cl->dev[best].busy_until = now + cost[best + 1];
+      }
+    }
+
+    if(done)
+    {
+      if(devid >= 0) cl->dev[devid].busy_until = now + cost[devid + 1];
+      dt_pthread_mutex_unlock(&cl->lock);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_schedule_device] pipe type %d expected in %.3f secs on %s\n",
+               pipe->type, best_time, (devid >= 0) ? cl->dev[devid].name : "CPU");
+      break;
+    }
+
+    dt_pthread_mutex_unlock(&cl->lock);
+    dt_iop_nap(usec);
+  }
+
+  free(cost);
+  if(devid < 0) dt_atomic_add_int(&cl->cpu_pipes, 1);
+  return devid;
+}
+
+void dt_opencl_unschedule_cpu(void)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return;
+  dt_atomic_sub_int(&cl->cpu_pipes, 1);
+}
+
+void dt_opencl_record_timing(const int devid, const char *op, const double mpix, const double seconds)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid >= cl->num_devs || mpix <= 0.0) return;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  GHashTable **timings = (devid < 0) ? &cl->cpu_timings : &cl->dev[devid].timings;
+  if(*timings == NULL) *timings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  // smooth out the variations between runs
+  const float sample = seconds / mpix;
+  float *t = g_hash_table_lookup(*timings, op);
+  if(t)
+    *t = 0.75f * *t + 0.25f * sample;
+  else
+  {
+    t = g_new(float, 1);
+    *t = sample;
+    g_hash_table_insert(*timings, g_strdup(op), t);
+  }
+  dt_pthread_mutex_unlock(&cl->lock);
+}
+
 static FILE *fopen_stat(const char *filename, struct stat *st)
 {
   FILE *f = g_fopen(filename, "rb");
@@ -1862,8 +2113,29 @@ void dt_opencl_md5sum(const char **files, char **md5sums)
   }
 }
 
-int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *binname,
-                           const char *cachedir, char *md5sum, char **includemd5, int *loaded_cached)
+// create a program from a SPIR-V file, NULL if it doesn't exist or the driver doesn't take it
+static cl_program _create_program_with_il(const int dev, const char *ilname)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  gchar *il = NULL;
+  gsize ilsize = 0;
+  if(!g_file_get_contents(ilname, &il, &ilsize, NULL)) return NULL;
+
+  cl_int err = CL_SUCCESS;
+  cl_program program = (cl->dlocl->symbols->dt_clCreateProgramWithIL)(cl->dev[dev].context, il, ilsize, &err);
+  g_free(il);
+  if(err != CL_SUCCESS || program == NULL)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_load_program] could not create program from SPIR-V `%s'! (%s)\n", ilname,
+             cl_errstr(err));
+    return NULL;
+  }
+  return program;
+}
+
+int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *ilname,
+                           const char *binname, const char *cachedir, char *md5sum, char **includemd5,
+                           int *loaded_cached)
 {
   cl_int err;
   dt_opencl_t *cl = darktable.opencl;
@@ -2007,11 +2279,18 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
     g_unlink(dup);
 #endif //!defined(_WIN32)
 
-    dt_print(DT_DEBUG_OPENCL,
-             "[opencl_load_program] could not load cached binary program, trying to compile source\n");
-
-    cl->dev[dev].program[prog] = (cl->dlocl->symbols->dt_clCreateProgramWithSource)(
-        cl->dev[dev].context, 1, (const char **)&file, &filesize, &err);
+    // the SPIR-V file is compiled from the same sources at build time, so the md5sum holds for it too
+    cl->dev[dev].program[prog] = ilname ? _create_program_with_il(dev, ilname) : NULL;
+    err = CL_SUCCESS;
+    if(cl->dev[dev].program[prog])
+      dt_vprint(DT_DEBUG_OPENCL, "[opencl_load_program] could not load cached binary program, using SPIR-V\n");
+    else
+    {
+      dt_print(DT_DEBUG_OPENCL,
+               "[opencl_load_program] could not load cached binary program, trying to compile source\n");
+      cl->dev[dev].program[prog] = (cl->dlocl->symbols->dt_clCreateProgramWithSource)(
+          cl->dev[dev].context, 1, (const char **)&file, &filesize, &err);
+    }
     free(file);
     if((err != CL_SUCCESS) || (cl->dev[dev].program[prog] == NULL))
     {
@@ -2134,23 +2413,17 @@ int dt_opencl_build_program(const int dev, const int prog, const char *binname,
           if(bytes_written != binary_sizes[i]) goto ret;
           fclose(f);
 
-          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328)
-          char cwd[PATH_MAX] = { 0 };
-          if(!getcwd(cwd, sizeof(cwd))) goto ret;
-          if(chdir(cachedir) != 0) goto ret;
-          char dup[PATH_MAX] = { 0 };
-          g_strlcpy(dup, binname, sizeof(dup));
-          char *bname = basename(dup);
+          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328). The target is relative
+          // to the directory of the link, no chdir() which would race with the other builds.
 #if defined(_WIN32)
           //CreateSymbolicLink in Windows requires admin privileges, which we don't want/need
           //store has using a simple filerename
           char finalfilename[PATH_MAX] = { 0 };
-          snprintf(finalfilename, sizeof(finalfilename), "%s" G_DIR_SEPARATOR_S "%s.%s", cachedir, bname, md5sum);
+          snprintf(finalfilename, sizeof(finalfilename), "%s.%s", binname, md5sum);
           rename(link_dest, finalfilename);
 #else
-          if(symlink(md5sum, bname) != 0) goto ret;
+          if(symlink(md5sum, binname) != 0) goto ret;
 #endif //!defined(_WIN32)
-          if(chdir(cwd) != 0) goto ret;
         }
 
     ret:
@@ -2163,6 +2436,120 @@ int dt_opencl_build_program(const int dev, const int prog, const char *binname,
   }
 }
 
+// loads or compiles a program for a device, called by the build pool or synchronously during init
+static void _opencl_build(const int dev, const int prog)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  char kerneldir[PATH_MAX] = { 0 };
+  char filename[PATH_MAX] = { 0 };
+  char binname[PATH_MAX] = { 0 };
+  dt_loc_get_kerneldir(kerneldir, sizeof(kerneldir));
+  snprintf(filename, sizeof(filename), "%s" G_DIR_SEPARATOR_S "%s", kerneldir, cl->program_file[prog]);
+  snprintf(binname, sizeof(binname), "%s" G_DIR_SEPARATOR_S "%s.bin", cl->dev[dev].cachedir,
+           cl->program_file[prog]);
+
+  // SPIR-V compiled at build time, next to the sources: foo.cl -> spirv/foo.spv
+  char ilname[PATH_MAX] = { 0 };
+  if(cl->dev[dev].spirv)
+  {
+    gchar *base = g_strndup(cl->program_file[prog], strcspn(cl->program_file[prog], "."));
+    snprintf(ilname, sizeof(ilname), "%s" G_DIR_SEPARATOR_S "spirv" G_DIR_SEPARATOR_S "%s.spv", kerneldir, base);
+    g_free(base);
+  }
+
+  const double tstart = dt_get_wtime();
+  int loaded_cached = 0;
+  char md5sum[33];
+  gboolean success
+      = dt_opencl_load_program(dev, prog, filename, ilname[0] ? ilname : NULL, binname, cl->dev[dev].cachedir,
+                               md5sum, cl->dev[dev].includemd5, &loaded_cached)
+        && dt_opencl_build_program(dev, prog, binname, cl->dev[dev].cachedir, md5sum, loaded_cached) == CL_SUCCESS;
+
+  if(!success && ilname[0] && !loaded_cached)
+  {
+    // SPIR-V support is young in some drivers, their OpenCL C compiler may still do better
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build] SPIR-V of program `%s' failed on device %d, trying the source\n",
+             cl->program_file[prog], dev);
+    if(cl->dev[dev].program_used[prog])
+    {
+      (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[dev].program[prog]);
+      cl->dev[dev].program[prog] = NULL;
+      cl->dev[dev].program_used[prog] = 0;
+    }
+    success = dt_opencl_load_program(dev, prog, filename, NULL, binname, cl->dev[dev].cachedir, md5sum,
+                                     cl->dev[dev].includemd5, &loaded_cached)
+              && dt_opencl_build_program(dev, prog, binname, cl->dev[dev].cachedir, md5sum, loaded_cached)
+                     == CL_SUCCESS;
+  }
+
+  if(success)
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build] %s program `%s' for device %d in %.3f secs\n",
+             loaded_cached ? "loaded" : "compiled", cl->program_file[prog], dev, dt_get_wtime() - tstart);
+  else
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build] failed to compile program `%s' for device %d, its kernels will "
+                              "run on the CPU\n", cl->program_file[prog], dev);
+
+  dt_pthread_mutex_lock(&cl->lock);
+  cl->dev[dev].program_state[prog] = success ? DT_OPENCL_PROGRAM_READY : DT_OPENCL_PROGRAM_FAILED;
+  dt_pthread_mutex_unlock(&cl->lock);
+}
+
+static void _opencl_build_job(gpointer data, gpointer user_data)
+{
+  const int job = GPOINTER_TO_INT(data) - 1;
+  _opencl_build(job / DT_OPENCL_MAX_PROGRAMS, job % DT_OPENCL_MAX_PROGRAMS);
+}
+
+// creates a kernel on a device once its program is built. Until then, the program is queued for all the
+// devices and FALSE is returned, so the module falls back to the CPU. cl->lock must not be held.
+static gboolean _opencl_kernel_ready(const int dev, const int kernel)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->dev[dev].kernel[kernel]) return TRUE;
+  if(!cl->dev[dev].kernel_used[kernel]) return FALSE;
+
+  const int prog = cl->kernel_program[kernel];
+  if(!cl->program_file[prog]) return FALSE;
+
+  dt_pthread_mutex_lock(&cl->lock);
+  if(cl->dev[dev].program_state[prog] == DT_OPENCL_PROGRAM_NONE)
+  {
+    if(cl->lazy_build)
+    {
+      for(int d = 0; d < cl->num_devs; d++)
+        if(cl->dev[d].program_state[prog] == DT_OPENCL_PROGRAM_NONE)
+        {
+          cl->dev[d].program_state[prog] = DT_OPENCL_PROGRAM_QUEUED;
+          g_thread_pool_push(cl->build_pool, GINT_TO_POINTER(d * DT_OPENCL_MAX_PROGRAMS + prog + 1), NULL);
+        }
+    }
+    else
+    {
+      cl->dev[dev].program_state[prog] = DT_OPENCL_PROGRAM_QUEUED;
+      dt_pthread_mutex_unlock(&cl->lock);
+      _opencl_build(dev, prog);
+      dt_pthread_mutex_lock(&cl->lock);
+    }
+  }
+
+  if(cl->dev[dev].program_state[prog] == DT_OPENCL_PROGRAM_READY && !cl->dev[dev].kernel[kernel])
+  {
+    cl_int err;
+    cl->dev[dev].kernel[kernel]
+        = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], cl->kernel_name[kernel], &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%s)\n",
+               cl->kernel_name[kernel], cl_errstr(err));
+      cl->dev[dev].kernel[kernel] = NULL;
+    }
+  }
+  const gboolean ready = (cl->dev[dev].kernel[kernel] != NULL);
+  dt_pthread_mutex_unlock(&cl->lock);
+
+  return ready;
+}
+
 int dt_opencl_create_kernel(const int prog, const char *name)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -2176,21 +2563,14 @@ int dt_opencl_create_kernel(const int prog, const char *name)
     for(; k < DT_OPENCL_MAX_KERNELS; k++)
       if(!cl->dev[dev].kernel_used[k])
       {
+        // the kernel itself is created once its program is built
         cl->dev[dev].kernel_used[k] = 1;
-        cl->dev[dev].kernel[k]
-            = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
-        if(err != CL_SUCCESS)
-        {
-          dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%s)\n", name, cl_errstr(err));
-          cl->dev[dev].kernel_used[k] = 0;
-          goto error;
-        }
-        else
-          break;
+        cl->dev[dev].kernel[k] = NULL;
+        break;
       }
     if(k < DT_OPENCL_MAX_KERNELS)
     {
-      dt_vprint(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n",
+      dt_vprint(DT_DEBUG_OPENCL, "[opencl_create_kernel] registered kernel `%s' (%d) for device %d\n",
                name, k, dev);
     }
     else
@@ -2199,6 +2579,12 @@ int dt_opencl_create_kernel(const int prog, const char *name)
       goto error;
     }
   }
+  if(k < DT_OPENCL_MAX_KERNELS)
+  {
+    cl->kernel_program[k] = prog;
+    g_free(cl->kernel_name[k]);
+    cl->kernel_name[k] = g_strdup(name);
+  }
   dt_pthread_mutex_unlock(&cl->lock);
   return k;
 error:
@@ -2215,8 +2601,11 @@ void dt_opencl_free_kernel(const int kernel)
   for(int dev = 0; dev < cl->num_devs; dev++)
   {
     cl->dev[dev].kernel_used[kernel] = 0;
-    (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    if(cl->dev[dev].kernel[kernel]) (cl->dlocl->symbols->dt_clReleaseKernel)(cl->dev[dev].kernel[kernel]);
+    cl->dev[dev].kernel[kernel] = NULL;
   }
+  g_free(cl->kernel_name[kernel]);
+  cl->kernel_name[kernel] = NULL;
   dt_pthread_mutex_unlock(&cl->lock);
 }
 
@@ -2253,6 +2642,7 @@ int dt_opencl_get_kernel_work_group_size(const int dev, const int kernel, size_t
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(!_opencl_kernel_ready(dev, kernel)) return DT_OPENCL_DEFAULT_ERROR;
 
   return (cl->dlocl->symbols->dt_clGetKernelWorkGroupInfo)(cl->dev[dev].kernel[kernel], cl->dev[dev].devid,
                                                            CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t),
@@ -2266,6 +2656,7 @@ int dt_opencl_set_kernel_arg(const int dev, const int kernel, const int num, con
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(!_opencl_kernel_ready(dev, kernel)) return DT_OPENCL_DEFAULT_ERROR;
   return (cl->dlocl->symbols->dt_clSetKernelArg)(cl->dev[dev].kernel[kernel], num, size, arg);
 }
 
@@ -2281,15 +2672,25 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
   if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(!_opencl_kernel_ready(dev, kernel)) return DT_OPENCL_DEFAULT_ERROR;
 
   char buf[256];
   buf[0] = '\0';
   if(darktable.unmuted & DT_DEBUG_OPENCL)
     (cl->dlocl->symbols->dt_clGetKernelInfo)(cl->dev[dev].kernel[kernel], CL_KERNEL_FUNCTION_NAME, 256, buf, NULL);
+
+  size_t tuned_local[3] = { 1, 1, 1 };
+  int candidate = -1;
+  struct dt_opencl_tune_entry_t *tune
+      = cl->autotune ? _autotune_begin(dev, kernel, sizes, &local, tuned_local, &candidate) : NULL;
+  const double start = tune ? dt_get_wtime() : 0.0;
+
   cl_event *eventp = dt_opencl_events_get_slot(dev, buf);
   cl_int err = (cl->dlocl->symbols->dt_clEnqueueNDRangeKernel)(cl->dev[dev].cmd_queue, cl->dev[dev].kernel[kernel],
                                                         2, NULL, sizes, local, 0, NULL, eventp);
 
+  if(tune && err == CL_SUCCESS) _autotune_end(dev, tune, candidate, sizes, start);
+
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[dt_opencl_enqueue_kernel_2d_with_local] kernel %i on device %d: %s\n", kernel, dev, cl_errstr(err));
 
@@ -2314,6 +2715,9 @@ int dt_opencl_read_host_from_device_rowpitch(const int devid, void *host, void *
   if(!darktable.opencl->inited || devid < 0) return -1;
   const size_t origin[] = { 0, 0, 0 };
   const size_t region[] = { width, height, 1 };
+  // the image lives on this very buffer, reading it onto itself is undefined. Mapping it makes sure
+  // the kernels are done and the host sees their results, without copying on unified memory.
+  if(dt_opencl_mem_is_shared(device, host)) return _sync_shared(devid, device, region, CL_MAP_READ);
   // blocking.
   return dt_opencl_read_host_from_device_raw(devid, host, device, origin, region, rowpitch, CL_TRUE);
 }
@@ -2361,6 +2765,7 @@ int dt_opencl_write_host_to_device_rowpitch(const int devid, void *host, void *d
   if(!darktable.opencl->inited || devid < 0) return -1;
   const size_t origin[] = { 0, 0, 0 };
   const size_t region[] = { width, height, 1 };
+  if(dt_opencl_mem_is_shared(device, host)) return _sync_shared(devid, device, region, CL_MAP_WRITE);
   // blocking.
   return dt_opencl_write_host_to_device_raw(devid, host, device, origin, region, rowpitch, CL_TRUE);
 }
@@ -2516,6 +2921,115 @@ void *dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
 }
 
 
+/* device memory pool.
+   Pipe runs allocate and release the same intermediate images and buffers over and over, and driver-side
+   allocation is expensive. Objects allocated through the pool are not released but kept in a per-device free
+   list, and handed out again for a request with the same kind, size, format and flags. All commands of a
+   device go through its single in-order queue, so an object can be reused as soon as it is released. */
+typedef struct dt_opencl_pool_entry_t
+{
+  cl_mem mem;
+  int devid;
+  gboolean image;
+  int width, height;
+  cl_image_format fmt;
+  cl_mem_flags flags;
+  size_t size;
+} dt_opencl_pool_entry_t;
+
+static inline gboolean _pool_entry_matches(const dt_opencl_pool_entry_t *a, const dt_opencl_pool_entry_t *b)
+{
+  return a->image == b->image && a->width == b->width && a->height == b->height
+         && a->fmt.image_channel_order == b->fmt.image_channel_order
+         && a->fmt.image_channel_data_type == b->fmt.image_channel_data_type && a->flags == b->flags
+         && a->size == b->size;
+}
+
+// take a matching object out of the free list of the device, or NULL
+static cl_mem _pool_take(const dt_opencl_pool_entry_t *request)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->pool_percent == 0) return NULL;
+
+  cl_mem mem = NULL;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  dt_opencl_device_t *dev = &cl->dev[request->devid];
+  for(GList *l = dev->pool; l; l = g_list_next(l))
+  {
+    dt_opencl_pool_entry_t *entry = (dt_opencl_pool_entry_t *)l->data;
+    if(_pool_entry_matches(entry, request))
+    {
+      mem = entry->mem;
+      dev->pool_size -= entry->size;
+      dev->pool = g_list_delete_link(dev->pool, l);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  return mem;
+}
+
+// remember a newly allocated object so it goes back to the pool when released
+static void _pool_register(cl_mem mem, const dt_opencl_pool_entry_t *request)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->pool_percent == 0 || mem == NULL) return;
+
+  dt_opencl_pool_entry_t *entry = malloc(sizeof(dt_opencl_pool_entry_t));
+  *entry = *request;
+  entry->mem = mem;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  g_hash_table_insert(cl->pool_owned, mem, entry);
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+}
+
+// put a released object back in the free list. Returns FALSE if it has to be really released
+static gboolean _pool_give_back(cl_mem mem)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->pool_owned == NULL) return FALSE;
+
+  gboolean kept = FALSE;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  dt_opencl_pool_entry_t *entry = (dt_opencl_pool_entry_t *)g_hash_table_lookup(cl->pool_owned, mem);
+  if(entry)
+  {
+    dt_opencl_device_t *dev = &cl->dev[entry->devid];
+    // high-water mark of the free list tied to the memory we allow ourselves to use on the device
+    const size_t limit = dt_opencl_get_device_available(entry->devid) / 100 * cl->pool_percent;
+    if(dev->pool_size + entry->size <= limit)
+    {
+      dev->pool = g_list_prepend(dev->pool, entry);
+      dev->pool_size += entry->size;
+      kept = TRUE;
+    }
+    else
+      g_hash_table_remove(cl->pool_owned, mem);
+  }
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  return kept;
+}
+
+void dt_opencl_pool_flush(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || devid >= cl->num_devs) return;
+
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  GList *pool = cl->dev[devid].pool;
+  cl->dev[devid].pool = NULL;
+  cl->dev[devid].pool_size = 0;
+  for(GList *l = pool; l; l = g_list_next(l))
+  {
+    cl_mem mem = ((dt_opencl_pool_entry_t *)l->data)->mem;
+    g_hash_table_remove(cl->pool_owned, mem);
+    dt_opencl_memory_statistics(devid, mem, OPENCL_MEMORY_SUB);
+    (cl->dlocl->symbols->dt_clReleaseMemObject)(mem);
+  }
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  g_list_free(pool);
+}
+
 void dt_opencl_release_mem_object(cl_mem mem)
 {
   if(!darktable.opencl->inited) return;
@@ -2524,6 +3038,8 @@ void dt_opencl_release_mem_object(cl_mem mem)
   // case in a centralized way at this place
   if(mem == NULL) return;
 
+  if(_pool_give_back(mem)) return;
+
   dt_opencl_memory_statistics(-1, mem, OPENCL_MEMORY_SUB);
 
   (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
@@ -2570,18 +3086,77 @@ void *dt_opencl_alloc_device(const int devid, const int width, const int height,
   else
     return NULL;
 
-  cl_mem dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
+  const dt_opencl_pool_entry_t request = { .devid = devid, .image = TRUE, .width = width, .height = height,
+                                           .fmt = fmt, .flags = CL_MEM_READ_WRITE,
+                                           .size = (size_t)width * height * bpp };
+  cl_mem dev = _pool_take(&request);
+  if(dev) return dev;
+
+  dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
       darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  if(err != CL_SUCCESS && darktable.opencl->dev[devid].pool)
+  {
+    // the memory might be held by the pool
+    dt_opencl_pool_flush(devid);
+    dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D)(
+        darktable.opencl->dev[devid].context, CL_MEM_READ_WRITE, &fmt, width, height, 0, NULL, &err);
+  }
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device] could not alloc img buffer on device %d: %s\n", devid,
              cl_errstr(err));
 
   dt_opencl_memory_statistics(devid, dev, OPENCL_MEMORY_ADD);
+  if(err == CL_SUCCESS) _pool_register(dev, &request);
 
   return dev;
 }
 
 
+gboolean dt_opencl_mem_is_shared(void *mem, const void *host)
+{
+  if(!darktable.opencl->inited || mem == NULL || host == NULL) return FALSE;
+  cl_mem_flags flags = 0;
+  void *ptr = NULL;
+  if((darktable.opencl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL)
+         != CL_SUCCESS
+     || !(flags & CL_MEM_USE_HOST_PTR))
+    return FALSE;
+  if((darktable.opencl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_HOST_PTR, sizeof(ptr), &ptr, NULL)
+     != CL_SUCCESS)
+    return FALSE;
+  return ptr == host;
+}
+
+// map and unmap a whole image stored on its host buffer: the driver synchronizes the host memory
+// and the device caches, and only copies if it could not use the buffer in place.
+static int _sync_shared(const int devid, cl_mem mem, const size_t *region, const cl_map_flags flags)
+{
+  const size_t origin[] = { 0, 0, 0 };
+  size_t rowpitch = 0;
+  cl_int err = CL_SUCCESS;
+  cl_event *eventp = dt_opencl_events_get_slot(devid, "[Map Image]");
+  void *ptr = (darktable.opencl->dlocl->symbols->dt_clEnqueueMapImage)(
+      darktable.opencl->dev[devid].cmd_queue, mem, CL_TRUE, flags, origin, region, &rowpitch, NULL, 0, NULL,
+      eventp, &err);
+  if(err != CL_SUCCESS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl sync_shared] could not map image on device %d: %s\n", devid,
+             cl_errstr(err));
+    return err;
+  }
+  return dt_opencl_unmap_mem_object(devid, mem, ptr);
+}
+
+void *dt_opencl_alloc_device_shared(const int devid, const int width, const int height, const int bpp,
+                                    void *host)
+{
+  if(!darktable.opencl->inited || devid < 0 || host == NULL) return NULL;
+  if(!darktable.opencl->dev[devid].unified_memory) return NULL;
+  // the driver copies behind our back if the host buffer doesn't suit the device, so this only pays
+  // off on unified memory.
+  return dt_opencl_alloc_device_use_host_pointer(devid, width, height, bpp, width * bpp, host);
+}
+
 void *dt_opencl_alloc_device_use_host_pointer(const int devid, const int width, const int height,
                                               const int bpp, const int rowpitch, void *host)
 {
@@ -2618,13 +3193,26 @@ void *dt_opencl_alloc_device_buffer(const int devid, const size_t size)
   if(!darktable.opencl->inited) return NULL;
   cl_int err;
 
-  cl_mem buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
-                                                                     CL_MEM_READ_WRITE, size, NULL, &err);
+  const dt_opencl_pool_entry_t request = { .devid = devid, .image = FALSE, .flags = CL_MEM_READ_WRITE,
+                                           .size = size };
+  cl_mem buf = _pool_take(&request);
+  if(buf) return buf;
+
+  buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
+                                                              CL_MEM_READ_WRITE, size, NULL, &err);
+  if(err != CL_SUCCESS && darktable.opencl->dev[devid].pool)
+  {
+    // the memory might be held by the pool
+    dt_opencl_pool_flush(devid);
+    buf = (darktable.opencl->dlocl->symbols->dt_clCreateBuffer)(darktable.opencl->dev[devid].context,
+                                                                CL_MEM_READ_WRITE, size, NULL, &err);
+  }
   if(err != CL_SUCCESS)
     dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %s\n", devid,
              cl_errstr(err));
 
   dt_opencl_memory_statistics(devid, buf, OPENCL_MEMORY_ADD);
+  if(err == CL_SUCCESS) _pool_register(buf, &request);
 
   return buf;
 }
@@ -2958,8 +3546,13 @@ void dt_opencl_disable(void)
 int dt_opencl_update_settings(void)
 {
   dt_opencl_t *cl = darktable.opencl;
-  // FIXME: This pulls in prefs every time the pixelpipe runs. Instead have a callback for DT_SIGNAL_PREFERENCES_CHANGE?
   if(!cl->inited) return FALSE;
+
+  // called for each run of the pixelpipe: only parse the prefs again once they changed
+  const uint32_t generation = dt_conf_generation();
+  if(cl->conf_generation == generation) return (cl->enabled && !cl->stopped);
+  cl->conf_generation = generation;
+
   const int prefs = dt_conf_get_bool("opencl");
 
   if(cl->enabled != prefs)
@@ -3003,6 +3596,8 @@ static dt_opencl_scheduling_profile_t dt_opencl_get_scheduling_profile(void)
     profile = OPENCL_PROFILE_MULTIPLE_GPUS;
   else if(!strcmp(pstr, "very fast GPU"))
     profile = OPENCL_PROFILE_VERYFAST_GPU;
+  else if(!strcmp(pstr, "dynamic"))
+    profile = OPENCL_PROFILE_DYNAMIC;
 
   return profile;
 }
@@ -3052,6 +3647,7 @@ static void dt_opencl_apply_scheduling_profile(dt_opencl_scheduling_profile_t pr
   switch(profile)
   {
     case OPENCL_PROFILE_MULTIPLE_GPUS:
+    case OPENCL_PROFILE_DYNAMIC:
       dt_opencl_update_priorities("*/*/*/*/*");
       dt_opencl_set_synchronization_timeout(20);
       break;
@@ -3119,6 +3715,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
     {
       (*eventtags)[*numevents - 1].tag[0] = '\0';
     }
+    (*eventtags)[*numevents - 1].queued = dt_get_wtime();
 
     (*totalevents)++;
     return (*eventlist) + *numevents - 1;
@@ -3162,6 +3759,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
   {
     (*eventtags)[*numevents - 1].tag[0] = '\0';
   }
+  (*eventtags)[*numevents - 1].queued = dt_get_wtime();
 
   (*totalevents)++;
   *maxeventslot = MAX(*maxeventslot, *numevents - 1);
@@ -3291,9 +3889,10 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     else
       (*totalsuccess)++;
 
-    if(darktable.unmuted & DT_DEBUG_PERF)
+    if((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled())
     {
-      // get profiling info of event (only if darktable was called with '-d perf')
+      // get profiling info of event (only if darktable was called with '-d perf' or '--trace')
+      cl_ulong queued;
       cl_ulong start;
       cl_ulong end;
       cl_int errs = (cl->dlocl->symbols->dt_clGetEventProfilingInfo)(
@@ -3303,6 +3902,17 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
       if(errs == CL_SUCCESS && erre == CL_SUCCESS)
       {
         (*eventtags)[k].timelapsed = end - start;
+
+        // the device clock has its own origin: place the command relatively to the host time it was
+        // queued at, which is when the event slot was taken.
+        if(dt_trace_enabled()
+           && (cl->dlocl->symbols->dt_clGetEventProfilingInfo)((*eventlist)[k], CL_PROFILING_COMMAND_QUEUED,
+                                                               sizeof(cl_ulong), &queued, NULL) == CL_SUCCESS)
+        {
+          const double host_start = (*eventtags)[k].queued + (start - queued) * 1e-9;
+          dt_trace_device_span(devid, tag[0] == '\0' ? "<?>" : tag, host_start,
+                               host_start + (end - start) * 1e-9);
+        }
       }
       else
       {
@@ -3435,6 +4045,219 @@ static int nextpow2(int n)
 
 // utility function to calculate optimal work group dimensions for a given kernel
 // taking device specific restrictions and local memory limitations into account
+/* Opt-in autotuning of the local work group sizes. A kernel and the size picked by the heuristics of
+   dt_opencl_local_buffer_opt() (0 x 0 for kernels leaving the choice to the driver) make a key. The first
+   runs of a key try a few candidate sizes in turn, DT_OPENCL_TUNE_SAMPLES times each, timing them
+   synchronously. The fastest is then used for good and saved beside the compiled kernels of the
+   device, so later sessions skip the measures. Every candidate is a valid configuration, tuning only
+   costs the synchronizations. */
+
+#define DT_OPENCL_TUNE_CANDIDATES 6
+#define DT_OPENCL_TUNE_SAMPLES 3
+
+typedef struct dt_opencl_tune_entry_t
+{
+  int sizex[DT_OPENCL_TUNE_CANDIDATES];
+  int sizey[DT_OPENCL_TUNE_CANDIDATES];
+  double time[DT_OPENCL_TUNE_CANDIDATES]; // accumulated seconds per megapixel of work items
+  int samples[DT_OPENCL_TUNE_CANDIDATES];
+  int candidates;
+  int current; // candidate being measured
+  int best;    // -1 until tuned
+} dt_opencl_tune_entry_t;
+
+static gchar *_autotune_key(const int devid, const int kernel, const int sizex, const int sizey)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  char name[256] = { 0 };
+  (cl->dlocl->symbols->dt_clGetKernelInfo)(cl->dev[devid].kernel[kernel], CL_KERNEL_FUNCTION_NAME,
+                                           sizeof(name), name, NULL);
+  return g_strdup_printf("%s %d %d", name, sizex, sizey);
+}
+
+static dt_opencl_tune_entry_t *_autotune_entry(const int devid, const char *key)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  if(!dev->tuning) dev->tuning = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+  return g_hash_table_lookup(dev->tuning, key);
+}
+
+static dt_opencl_tune_entry_t *_autotune_new_entry(const int devid, const char *key)
+{
+  dt_opencl_tune_entry_t *entry = calloc(1, sizeof(dt_opencl_tune_entry_t));
+  entry->best = -1;
+  g_hash_table_insert(darktable.opencl->dev[devid].tuning, g_strdup(key), entry);
+  return entry;
+}
+
+static void _autotune_load(const int devid)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  FILE *f = g_fopen(dev->tune_file, "rb");
+  if(!f) return;
+
+  char name[256];
+  int sizex, sizey, bestx, besty;
+  while(fscanf(f, "%255s %d %d %d %d", name, &sizex, &sizey, &bestx, &besty) == 5)
+  {
+    gchar *key = g_strdup_printf("%s %d %d", name, sizex, sizey);
+    dt_opencl_tune_entry_t *entry = _autotune_entry(devid, key);
+    if(!entry) entry = _autotune_new_entry(devid, key);
+    entry->sizex[0] = bestx;
+    entry->sizey[0] = besty;
+    entry->candidates = 1;
+    entry->best = 0;
+    g_free(key);
+  }
+  fclose(f);
+
+  dt_print_nts(DT_DEBUG_OPENCL, "   AUTOTUNE FILE:            %s, %u tuned kernels\n", dev->tune_file,
+               g_hash_table_size(dev->tuning));
+}
+
+static void _autotune_save(const int devid)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  if(!dev->tune_file) return;
+
+  FILE *f = g_fopen(dev->tune_file, "wb");
+  if(!f)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_autotune] can't write `%s'\n", dev->tune_file);
+    return;
+  }
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, dev->tuning);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    const dt_opencl_tune_entry_t *entry = (dt_opencl_tune_entry_t *)value;
+    if(entry->best >= 0)
+      fprintf(f, "%s %d %d\n", (const char *)key, entry->sizex[entry->best], entry->sizey[entry->best]);
+  }
+  fclose(f);
+}
+
+// candidates of kernels using local memory: the size fitting the device, then halvings of it
+static void _autotune_local_buffer(const int devid, const int kernel, dt_opencl_local_buffer_t *factors)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  gchar *key = _autotune_key(devid, kernel, factors->sizex, factors->sizey);
+  dt_opencl_tune_entry_t *entry = _autotune_entry(devid, key);
+
+  if(!entry)
+  {
+    entry = _autotune_new_entry(devid, key);
+    int sizex = factors->sizex;
+    int sizey = factors->sizey;
+    while(entry->candidates < DT_OPENCL_TUNE_CANDIDATES && sizex * sizey >= 16)
+    {
+      entry->sizex[entry->candidates] = sizex;
+      entry->sizey[entry->candidates] = sizey;
+      entry->candidates++;
+      if(sizex > sizey)
+        sizex >>= 1;
+      else
+        sizey >>= 1;
+    }
+    if(entry->candidates < 2) entry->best = 0;
+  }
+  g_free(key);
+
+  const int pick = (entry->best >= 0) ? entry->best : entry->current;
+  factors->sizex = entry->sizex[pick];
+  factors->sizey = entry->sizey[pick];
+
+  if(!dev->tune_pending) dev->tune_pending = calloc(DT_OPENCL_MAX_KERNELS, sizeof(dt_opencl_tune_entry_t *));
+  dev->tune_pending[kernel] = (entry->best < 0) ? entry : NULL;
+}
+
+// candidates of kernels leaving the local size to the driver: that choice, then a few usual shapes
+static dt_opencl_tune_entry_t *_autotune_driver_entry(const int devid, const int kernel)
+{
+  gchar *key = _autotune_key(devid, kernel, 0, 0);
+  dt_opencl_tune_entry_t *entry = _autotune_entry(devid, key);
+
+  if(!entry)
+  {
+    entry = _autotune_new_entry(devid, key);
+    const int shapes[DT_OPENCL_TUNE_CANDIDATES][2] = { { 0, 0 }, { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 } };
+    size_t kernelworkgroupsize = 0;
+    dt_opencl_get_kernel_work_group_size(devid, kernel, &kernelworkgroupsize);
+    for(int k = 0; k < DT_OPENCL_TUNE_CANDIDATES; k++)
+    {
+      if((size_t)shapes[k][0] * shapes[k][1] > kernelworkgroupsize) continue;
+      entry->sizex[entry->candidates] = shapes[k][0];
+      entry->sizey[entry->candidates] = shapes[k][1];
+      entry->candidates++;
+    }
+    if(entry->candidates < 2) entry->best = 0;
+  }
+  g_free(key);
+  return entry;
+}
+
+static dt_opencl_tune_entry_t *_autotune_begin(const int devid, const int kernel, const size_t *sizes,
+                                               const size_t **local, size_t *tuned_local, int *candidate)
+{
+  dt_opencl_device_t *dev = &darktable.opencl->dev[devid];
+  dt_opencl_tune_entry_t *entry = NULL;
+
+  if(*local)
+  {
+    // the size was picked by dt_opencl_local_buffer_opt(), find which candidate it is
+    entry = dev->tune_pending ? dev->tune_pending[kernel] : NULL;
+    if(!entry || entry->best >= 0) return NULL;
+    for(int k = 0; k < entry->candidates; k++)
+      if(entry->sizex[k] == (*local)[0] && entry->sizey[k] == (*local)[1]) *candidate = k;
+    if(*candidate < 0) return NULL;
+  }
+  else
+  {
+    entry = _autotune_driver_entry(devid, kernel);
+    const int pick = (entry->best >= 0) ? entry->best : entry->current;
+
+    // local sizes need to divide the global ones, the driver keeps the choice otherwise
+    if(entry->sizex[pick] == 0 || sizes[0] % entry->sizex[pick] || sizes[1] % entry->sizey[pick]) return NULL;
+    tuned_local[0] = entry->sizex[pick];
+    tuned_local[1] = entry->sizey[pick];
+    *local = tuned_local;
+
+    if(entry->best >= 0) return NULL;
+    *candidate = pick;
+  }
+
+  // measure this kernel alone
+  dt_opencl_finish(devid);
+  return entry;
+}
+
+static void _autotune_end(const int devid, dt_opencl_tune_entry_t *entry, const int candidate,
+                          const size_t *sizes, const double start)
+{
+  if(!dt_opencl_finish(devid)) return;
+  const double mpix = (double)sizes[0] * sizes[1] / 1e6;
+  if(mpix <= 0.0) return;
+
+  entry->time[candidate] += (dt_get_wtime() - start) / mpix;
+  entry->samples[candidate]++;
+
+  // move on to the next candidate, the measures are done once the last one has all its samples
+  while(entry->current < entry->candidates && entry->samples[entry->current] >= DT_OPENCL_TUNE_SAMPLES)
+    entry->current++;
+  if(entry->current < entry->candidates) return;
+
+  entry->best = 0;
+  for(int k = 1; k < entry->candidates; k++)
+    if(entry->time[k] / entry->samples[k] < entry->time[entry->best] / entry->samples[entry->best])
+      entry->best = k;
+
+  dt_print(DT_DEBUG_OPENCL, "[opencl_autotune] local size %d x %d is the fastest of %d on device %d\n",
+           entry->sizex[entry->best], entry->sizey[entry->best], entry->candidates, devid);
+  _autotune_save(devid);
+}
+
 int dt_opencl_local_buffer_opt(const int devid, const int kernel, dt_opencl_local_buffer_t *factors)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -3475,6 +4298,8 @@ int dt_opencl_local_buffer_opt(const int devid, const int kernel, dt_opencl_loca
     return FALSE;
   }
 
+  if(cl->autotune) _autotune_local_buffer(devid, kernel, factors);
+
   return TRUE;
 }
 
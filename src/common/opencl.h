@@ -42,6 +42,7 @@
 
 #ifdef HAVE_OPENCL
 
+#include "common/atomic.h"
 #include "common/dlopencl.h"
 #include "common/dtpthread.h"
 #include "common/iop_profile.h"
@@ -74,7 +75,8 @@ typedef enum dt_opencl_scheduling_profile_t
 {
   OPENCL_PROFILE_DEFAULT,
   OPENCL_PROFILE_MULTIPLE_GPUS,
-  OPENCL_PROFILE_VERYFAST_GPU
+  OPENCL_PROFILE_VERYFAST_GPU,
+  OPENCL_PROFILE_DYNAMIC
 } dt_opencl_scheduling_profile_t;
 
 typedef enum dt_opencl_sync_cache_t
@@ -91,6 +93,7 @@ typedef struct dt_opencl_eventtag_t
 {
   cl_int retval;
   cl_ulong timelapsed;
+  double queued; // host time, see dt_get_wtime()
   char tag[DT_OPENCL_EVENTNAMELENGTH];
 } dt_opencl_eventtag_t;
 
@@ -101,6 +104,14 @@ typedef enum dt_opencl_tunemode_t
   DT_OPENCL_TUNE_PINNED  = 2
 } dt_opencl_tunemode_t;
 
+typedef enum dt_opencl_program_state_t
+{
+  DT_OPENCL_PROGRAM_NONE = 0,
+  DT_OPENCL_PROGRAM_QUEUED,
+  DT_OPENCL_PROGRAM_READY,
+  DT_OPENCL_PROGRAM_FAILED
+} dt_opencl_program_state_t;
+
 typedef enum dt_opencl_pinmode_t
 {
   DT_OPENCL_PINNING_OFF = 0,
@@ -127,6 +138,11 @@ typedef struct dt_opencl_device_t
   cl_kernel kernel[DT_OPENCL_MAX_KERNELS];
   int program_used[DT_OPENCL_MAX_PROGRAMS];
   int kernel_used[DT_OPENCL_MAX_KERNELS];
+  // programs are built on first use of one of their kernels (dt_opencl_program_state_t),
+  // from the sources or the compiled kernels cache. protected by dt_opencl_t.lock
+  int program_state[DT_OPENCL_MAX_PROGRAMS];
+  gchar *cachedir;
+  char *includemd5[DT_OPENCL_MAX_INCLUDES];
   cl_event *eventlist;
   dt_opencl_eventtag_t *eventtags;
   int numevents;
@@ -145,6 +161,18 @@ typedef struct dt_opencl_device_t
   cl_int summary;
   // the benchmark value must not be changed by the user
   float benchmark;
+  // seconds per megapixel measured for each module (op -> float) on pipes run by this device,
+  // and expected end of the pipe currently running, for the dynamic scheduling profile.
+  // protected by dt_opencl_t.lock
+  GHashTable *timings;
+  double busy_until;
+
+  // local work group sizes tuned for each kernel (dt_opencl_tune_entry_t), the entries still being
+  // measured by kernel, and the file keeping them between sessions. only used with opencl_autotune
+  GHashTable *tuning;
+  struct dt_opencl_tune_entry_t **tune_pending;
+  gchar *tune_file;
+
   size_t memory_in_use;
   size_t peak_memory;
   size_t tuned_available;
@@ -175,6 +203,14 @@ typedef struct dt_opencl_device_t
   // 2 -> disabled under all circumstances. This could/should be used if we give away / ship specific keys for buggy systems
   int pinned_memory;
 
+  // the device shares the physical memory with the host (integrated GPUs). The pixelpipe then hands
+  // the cache lines to the kernels as images on the host memory instead of copying them.
+  int unified_memory;
+
+  // the driver takes SPIR-V programs: the ones compiled at build time are used instead of the sources,
+  // skipping its OpenCL C compiler.
+  int spirv;
+
   // in OpenCL processing round width/height of global work groups to a multiple of these values.
   // reasonable values are powers of 2. this parameter can have high impact on OpenCL performance.
   int clroundup_wd;
@@ -204,6 +240,10 @@ typedef struct dt_opencl_device_t
   // Some devices are known to be unused by other apps so there is no need to test for available memory at all.
   // Also some devices might behave badly with the checking code, in this case we could enforce a headroom here.
   int forced_headroom;
+
+  // released device images and buffers kept for reuse (dt_opencl_pool_entry_t), protected by dt_opencl_t.pool_lock
+  GList *pool;
+  size_t pool_size;
 } dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
@@ -212,6 +252,8 @@ struct dt_dwt_cl_global_t; // wavelet decompose
 struct dt_heal_cl_global_t; // healing
 struct dt_colorspaces_cl_global_t; // colorspaces transform
 struct dt_guided_filter_cl_global_t;
+struct dt_histogram_cl_global_t;
+struct dt_color_picker_cl_global_t;
 
 /**
  * main struct, stored in darktable.opencl.
@@ -229,6 +271,7 @@ typedef struct dt_opencl_t
   int error_count;
   int opencl_synchronization_timeout;
   dt_opencl_scheduling_profile_t scheduling_profile;
+  uint32_t conf_generation; // of the prefs last applied by dt_opencl_update_settings()
   uint32_t crc;
   int mandatory[5];
   int *dev_priority_image;
@@ -238,8 +281,28 @@ typedef struct dt_opencl_t
   dt_opencl_device_t *dev;
   dt_dlopencl_t *dlocl;
 
+  // device memory pool: every cl_mem allocated through it, mapped to its dt_opencl_pool_entry_t.
+  // At most pool_percent % of the available memory of a device is kept in its free list.
+  dt_pthread_mutex_t pool_lock;
+  GHashTable *pool_owned;
+  int pool_percent;
+
   // we want the cpu benchmark to be available
   float cpubenchmark;
+  // same as dt_opencl_device_t.timings for the pipes run on the CPU, and the number of those running
+  GHashTable *cpu_timings;
+  dt_atomic_int cpu_pipes;
+  // tune the local work group sizes of the kernels, see dt_opencl_local_buffer_opt()
+  int autotune;
+
+  // programs listed in programs.conf, and the program and name of the kernels, by number.
+  // the kernels are only created on the devices once their program is built by build_pool.
+  gchar *program_file[DT_OPENCL_MAX_PROGRAMS];
+  int kernel_program[DT_OPENCL_MAX_KERNELS];
+  gchar *kernel_name[DT_OPENCL_MAX_KERNELS];
+  GThreadPool *build_pool;
+  // FALSE while initializing, the programs are then built when needed in the calling thread
+  int lazy_build;
   // global kernels for blending operations.
   struct dt_blendop_cl_global_t *blendop;
 
@@ -266,6 +329,10 @@ typedef struct dt_opencl_t
 
   // global kernels for guided filter.
   struct dt_guided_filter_cl_global_t *guided_filter;
+
+  // global kernels for histogram and color picker reductions.
+  struct dt_histogram_cl_global_t *histogram;
+  struct dt_color_picker_cl_global_t *color_picker;
 } dt_opencl_t;
 
 /** description of memory requirements of local buffer
@@ -305,18 +372,44 @@ int dt_opencl_finish_sync_pipe(const int devid, const int pipetype);
 /** enqueues a synchronization point. */
 int dt_opencl_enqueue_barrier(const int devid);
 
+/** enqueues a marker and returns its event, to be waited for by dt_opencl_wait_for_marker(). NULL on error. */
+cl_event dt_opencl_enqueue_marker(const int devid);
+
+/** blocks until all commands enqueued before the marker are done, then releases the marker */
+int dt_opencl_wait_for_marker(const int devid, cl_event marker);
+
 /** locks a device for your thread's exclusive use */
 int dt_opencl_lock_device(const int pipetype);
 
 /** done with your command queue. */
 void dt_opencl_unlock_device(const int dev);
 
+struct dt_dev_pixelpipe_t;
+/** locks the device a pipe should run on, -1 for the CPU. with the dynamic scheduling profile, this is
+  * the one expected to finish first given the modules of the pipe, their timings and the pipes already
+  * running. otherwise same as dt_opencl_lock_device(pipe->type). */
+int dt_opencl_schedule_device(struct dt_dev_pixelpipe_t *pipe, const double mpix);
+
+/** done with a pipe run on the CPU after dt_opencl_schedule_device() returned -1 */
+void dt_opencl_unschedule_cpu(void);
+
+/** records the time a module took to process mpix megapixels in a pipe run by devid, -1 for the CPU */
+void dt_opencl_record_timing(const int devid, const char *op, const double mpix, const double seconds);
+
+/** releases the device memory kept for reuse by the pool of a device */
+void dt_opencl_pool_flush(const int devid);
+
+/** locks a given device for your thread's exclusive use if it is free, returns the device or -1 */
+int dt_opencl_trylock_device(const int dev);
+
 /** calculates md5sums for a list of CL include files. */
 void dt_opencl_md5sum(const char **files, char **md5sums);
 
-/** loads the given .cl file and returns a reference to an internal program. */
-int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *binname,
-                           const char *cachedir, char *md5sum, char **includemd5, int *loaded_cached);
+/** loads the given .cl file and returns a reference to an internal program. Without a cached binary, the
+ * program is created from the SPIR-V file ilname if given and taken by the driver, from the source otherwise. */
+int dt_opencl_load_program(const int dev, const int prog, const char *filename, const char *ilname,
+                           const char *binname, const char *cachedir, char *md5sum, char **includemd5,
+                           int *loaded_cached);
 
 /** builds the given program. */
 int dt_opencl_build_program(const int dev, const int prog, const char *binname, const char *cachedir,
@@ -413,6 +506,13 @@ int dt_opencl_enqueue_copy_image(const int devid, cl_mem src, cl_mem dst, size_t
 
 void *dt_opencl_alloc_device(const int devid, const int width, const int height, const int bpp);
 
+/** image on the host buffer of the pixelpipe if the device shares the host memory, NULL otherwise */
+void *dt_opencl_alloc_device_shared(const int devid, const int width, const int height, const int bpp,
+                                    void *host);
+
+/** TRUE if the image is stored on this host buffer */
+gboolean dt_opencl_mem_is_shared(void *mem, const void *host);
+
 void *dt_opencl_alloc_device_use_host_pointer(const int devid, const int width, const int height,
                                               const int bpp, const int rowpitch, void *host);
 
@@ -538,6 +638,25 @@ static inline int dt_opencl_lock_device(const int dev)
 static inline void dt_opencl_unlock_device(const int dev)
 {
 }
+struct dt_dev_pixelpipe_t;
+static inline int dt_opencl_schedule_device(struct dt_dev_pixelpipe_t *pipe, const double mpix)
+{
+  return -1;
+}
+static inline void dt_opencl_unschedule_cpu(void)
+{
+}
+static inline void dt_opencl_record_timing(const int devid, const char *op, const double mpix,
+                                           const double seconds)
+{
+}
+static inline int dt_opencl_trylock_device(const int dev)
+{
+  return -1;
+}
+static inline void dt_opencl_pool_flush(const int devid)
+{
+}
 static inline int dt_opencl_load_program(const int dev, const char *filename)
 {
   return -1;
@@ -17,9 +17,11 @@
 */
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/image_cache.h"
 #include "common/ratings.h"
+#include "common/sidecar_writer.h"
 #include "common/undo.h"
 #include "common/grouping.h"
 #include "views/view.h"
@@ -72,8 +74,8 @@ static void _ratings_apply_to_image(const int imgid, const int rating)
       image->flags = (image->flags & ~(DT_IMAGE_REJECTED | DT_VIEW_RATINGS_MASK))
         | (DT_VIEW_RATINGS_MASK & new_rating);
     }
-    // synch through:
-    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_SAFE);
+    // the sidecar files are written by the caller, in one go for all images
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
   }
   else
   {
@@ -122,6 +124,8 @@ static void _ratings_apply(const GList *imgs, const int rating, GList **undo, co
     }
   }
 
+  // one transaction for the whole list instead of one per image
+  dt_database_start_transaction(darktable.db);
   for(const GList *images = imgs; images; images = g_list_next(images))
   {
     const int image_id = GPOINTER_TO_INT(images->data);
@@ -152,6 +156,9 @@ static void _ratings_apply(const GList *imgs, const int rating, GList **undo, co
 
     _ratings_apply_to_image(image_id, new_rating);
   }
+  dt_database_release_transaction(darktable.db);
+
+  dt_sidecar_writer_queue_list(imgs);
 }
 
 void dt_ratings_apply_on_list(const GList *img, const int rating, const gboolean undo_on)
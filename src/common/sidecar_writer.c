@@ -0,0 +1,267 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/sidecar_writer.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/dtpthread.h"
+#include "common/image.h"
+#include "common/utility.h"
+
+#include <string.h>
+
+// time a sidecar waits for further changes of its image before it is written, in microseconds
+#define DT_SIDECAR_WRITER_DELAY (G_USEC_PER_SEC / 2)
+// files written in parallel, this is mostly waiting for the disk or the network share
+#define DT_SIDECAR_WRITER_THREADS 4
+// images recorded in main.sidecar_pending per statement
+#define DT_SIDECAR_WRITER_CHUNK 500
+
+typedef struct dt_sidecar_writer_t
+{
+  GMutex lock;
+  GCond cond;
+  // imgid -> (gint64 *) monotonic time at which its sidecar is due
+  GHashTable *pending;
+  // imgids whose sidecar is being written
+  GHashTable *writing;
+  gboolean running;
+  int num_threads;
+  pthread_t threads[DT_SIDECAR_WRITER_THREADS];
+} dt_sidecar_writer_t;
+
+static dt_sidecar_writer_t _writer = { 0 };
+
+// remove imgid from main.sidecar_pending, with the lock held so that a concurrent queue can't lose its record
+static void _sidecar_writer_forget(const int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.sidecar_pending WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+static void _sidecar_writer_record(GList *imgids)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  while(imgids)
+  {
+    gchar *values = NULL;
+    for(int i = 0; imgids && i < DT_SIDECAR_WRITER_CHUNK; i++, imgids = g_list_next(imgids))
+      values = dt_util_dstrcat(values, "(%d),", GPOINTER_TO_INT(imgids->data));
+    values[strlen(values) - 1] = '\0';
+
+    gchar *query = g_strdup_printf("INSERT OR IGNORE INTO main.sidecar_pending (imgid) VALUES %s", values);
+    DT_DEBUG_SQLITE3_EXEC(db, query, NULL, NULL, NULL);
+    g_free(query);
+    g_free(values);
+  }
+}
+
+// take the next due image which isn't being written already, 0 if there is none. next_due is set to the
+// time at which the next image becomes due. needs the lock
+static int32_t _sidecar_writer_take(gint64 *next_due)
+{
+  const gint64 now = g_get_monotonic_time();
+  *next_due = G_MAXINT64;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, _writer.pending);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    if(g_hash_table_contains(_writer.writing, key)) continue;
+    const gint64 due = *(gint64 *)value;
+    if(due <= now || !_writer.running)
+    {
+      g_hash_table_iter_remove(&iter);
+      g_hash_table_add(_writer.writing, key);
+      return GPOINTER_TO_INT(key);
+    }
+    *next_due = MIN(*next_due, due);
+  }
+  return 0;
+}
+
+static void *_sidecar_writer_thread(void *data)
+{
+  dt_pthread_setname("sidecar");
+
+  g_mutex_lock(&_writer.lock);
+  while(TRUE)
+  {
+    gint64 next_due;
+    const int32_t imgid = _sidecar_writer_take(&next_due);
+    if(imgid > 0)
+    {
+      g_mutex_unlock(&_writer.lock);
+      dt_image_write_sidecar_file(imgid);
+      g_mutex_lock(&_writer.lock);
+
+      // queued again while being written: keep the record, the next write clears it
+      if(!g_hash_table_contains(_writer.pending, GINT_TO_POINTER(imgid))) _sidecar_writer_forget(imgid);
+      g_hash_table_remove(_writer.writing, GINT_TO_POINTER(imgid));
+      g_cond_broadcast(&_writer.cond);
+      continue;
+    }
+
+    // stopping, and everything this thread could take is written
+    if(!_writer.running) break;
+
+    if(next_due == G_MAXINT64)
+      g_cond_wait(&_writer.cond, &_writer.lock);
+    else
+      g_cond_wait_until(&_writer.cond, &_writer.lock, next_due);
+  }
+  g_mutex_unlock(&_writer.lock);
+  return NULL;
+}
+
+// add imgids to the pending images, the ones already pending keep their time. returns the new ones
+static GList *_sidecar_writer_add(const GList *imgs, const gint64 due)
+{
+  GList *added = NULL;
+  g_mutex_lock(&_writer.lock);
+  for(const GList *l = imgs; l; l = g_list_next((GList *)l))
+  {
+    if(GPOINTER_TO_INT(l->data) <= 0 || g_hash_table_contains(_writer.pending, l->data)) continue;
+    gint64 *when = g_new(gint64, 1);
+    *when = due;
+    g_hash_table_insert(_writer.pending, l->data, when);
+    added = g_list_prepend(added, l->data);
+  }
+  g_cond_broadcast(&_writer.cond);
+  g_mutex_unlock(&_writer.lock);
+  return added;
+}
+
+void dt_sidecar_writer_init()
+{
+  _writer.pending = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  _writer.writing = g_hash_table_new(NULL, NULL);
+
+  // the sidecars not written by the previous session, due right away
+  GList *leftover = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT imgid FROM main.sidecar_pending", -1,
+                              &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    leftover = g_list_prepend(leftover, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(leftover)
+  {
+    dt_print(DT_DEBUG_IMAGEIO, "[sidecar_writer] writing %u sidecar files left over from the last session\n",
+             g_list_length(leftover));
+    g_list_free(_sidecar_writer_add(leftover, 0));
+    g_list_free(leftover);
+  }
+
+  _writer.running = TRUE;
+  for(int k = 0; k < DT_SIDECAR_WRITER_THREADS; k++)
+  {
+    if(dt_pthread_create(&_writer.threads[_writer.num_threads], _sidecar_writer_thread, NULL))
+      fprintf(stderr, "[sidecar_writer] can't create writer thread\n");
+    else
+      _writer.num_threads++;
+  }
+  if(_writer.num_threads == 0)
+  {
+    // write synchronously, as before
+    _writer.running = FALSE;
+    dt_sidecar_writer_flush();
+  }
+}
+
+void dt_sidecar_writer_cleanup()
+{
+  g_mutex_lock(&_writer.lock);
+  _writer.running = FALSE;
+  g_cond_broadcast(&_writer.cond);
+  g_mutex_unlock(&_writer.lock);
+
+  // the threads only quit once nothing is pending anymore
+  for(int k = 0; k < _writer.num_threads; k++) pthread_join(_writer.threads[k], NULL);
+  _writer.num_threads = 0;
+
+  g_hash_table_destroy(_writer.pending);
+  g_hash_table_destroy(_writer.writing);
+  _writer.pending = _writer.writing = NULL;
+}
+
+void dt_sidecar_writer_queue_list(const GList *imgs)
+{
+  if(!imgs || dt_image_get_xmp_mode() == DT_WRITE_XMP_NEVER) return;
+
+  if(!_writer.running)
+  {
+    dt_image_synch_xmps(imgs);
+    return;
+  }
+
+  GList *added = _sidecar_writer_add(imgs, g_get_monotonic_time() + DT_SIDECAR_WRITER_DELAY);
+  _sidecar_writer_record(added);
+  g_list_free(added);
+}
+
+void dt_sidecar_writer_queue(const int32_t imgid)
+{
+  GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+  dt_sidecar_writer_queue_list(imgs);
+  g_list_free(imgs);
+}
+
+void dt_sidecar_writer_flush()
+{
+  if(!_writer.pending) return;
+
+  g_mutex_lock(&_writer.lock);
+  if(_writer.num_threads == 0)
+  {
+    // no threads to hand over to, write here
+    gint64 next_due;
+    int32_t imgid;
+    while((imgid = _sidecar_writer_take(&next_due)) > 0)
+    {
+      g_mutex_unlock(&_writer.lock);
+      dt_image_write_sidecar_file(imgid);
+      g_mutex_lock(&_writer.lock);
+      _sidecar_writer_forget(imgid);
+      g_hash_table_remove(_writer.writing, GINT_TO_POINTER(imgid));
+    }
+  }
+  else
+  {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, _writer.pending);
+    while(g_hash_table_iter_next(&iter, NULL, &value)) *(gint64 *)value = 0;
+    g_cond_broadcast(&_writer.cond);
+    while(g_hash_table_size(_writer.pending) > 0 || g_hash_table_size(_writer.writing) > 0)
+      g_cond_wait(&_writer.cond, &_writer.lock);
+  }
+  g_mutex_unlock(&_writer.lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
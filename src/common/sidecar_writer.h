@@ -0,0 +1,44 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+
+// background writer of xmp sidecar files.
+// the database stays the source of truth, a sidecar is just written some time after the last change of its
+// image: changes within the delay are coalesced into one write, and several files are written in parallel.
+// queued images are recorded in main.sidecar_pending until written, so that the sidecars left over by a
+// crash are written on the next start.
+
+void dt_sidecar_writer_init();
+// writes all pending sidecars and stops the writer threads
+void dt_sidecar_writer_cleanup();
+
+// write the sidecar of imgid soon. writes it right away if the writer isn't running
+void dt_sidecar_writer_queue(const int32_t imgid);
+void dt_sidecar_writer_queue_list(const GList *imgs);
+// write all pending sidecars now and wait for them
+void dt_sidecar_writer_flush();
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -26,6 +26,7 @@
 #include "common/history_snapshot.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
+#include "common/sidecar_writer.h"
 #include "common/tags.h"
 #include "control/control.h"
 #include "develop/develop.h"
@@ -568,6 +569,205 @@ gboolean dt_styles_create_from_image(const char *name, const char *description,
   return FALSE;
 }
 
+// a style as read from the database once, to be applied to any number of images
+typedef struct dt_style_apply_t
+{
+  const char *name;
+  int32_t id;
+  GList *items;    // dt_style_item_t, in application order
+  GList *iop_list; // the module order of the style, if it has one
+} dt_style_apply_t;
+
+static gboolean _style_apply_init(dt_style_apply_t *style, const char *name)
+{
+  style->name = name;
+  style->id = dt_styles_get_id_by_name(name);
+  style->items = NULL;
+  style->iop_list = NULL;
+  if(style->id == 0) return FALSE;
+
+  style->iop_list = dt_styles_module_order_list(name);
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT num, module, operation, op_params, enabled,"
+                              "  blendop_params, blendop_version, multi_priority, multi_name"
+                              " FROM data.style_items WHERE styleid=?1 "
+                              " ORDER BY operation, multi_priority",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, style->id);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
+
+    style_item->num = sqlite3_column_int(stmt, 0);
+    style_item->selimg_num = 0;
+    style_item->enabled = sqlite3_column_int(stmt, 4);
+    style_item->multi_priority = sqlite3_column_int(stmt, 7);
+    style_item->name = NULL;
+    style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
+    style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
+    style_item->module_version = sqlite3_column_int(stmt, 1);
+    style_item->blendop_version = sqlite3_column_int(stmt, 6);
+    style_item->params_size = sqlite3_column_bytes(stmt, 3);
+    style_item->params = (void *)malloc(style_item->params_size);
+    memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
+    style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
+    style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
+    memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
+    style_item->iop_order = 0;
+
+    style->items = g_list_prepend(style->items, style_item);
+  }
+  sqlite3_finalize(stmt);
+  style->items = g_list_reverse(style->items);  // list was built in reverse order, so un-reverse it
+  return TRUE;
+}
+
+static void _style_apply_cleanup(dt_style_apply_t *style)
+{
+  g_list_free_full(style->items, dt_style_item_free);
+  g_list_free_full(style->iop_list, g_free);
+  style->items = NULL;
+  style->iop_list = NULL;
+}
+
+// merge the style into the history of imgid (or of its duplicate) and write it back.
+// returns the id of the image the style went to, or -1. tags, sidecar and thumbnails are
+// left to the caller so that they can be done once for a whole list.
+static int32_t _style_apply_to_image(dt_style_apply_t *style, const gboolean duplicate, const gboolean overwrite,
+                                     const int32_t imgid)
+{
+  int32_t newimgid;
+  /* check if we should make a duplicate before applying style */
+  if(duplicate)
+  {
+    newimgid = dt_image_duplicate(imgid);
+    if(newimgid == -1) return -1;
+    if(overwrite)
+      dt_history_delete_on_image_ext(newimgid, FALSE);
+    else
+      dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE, TRUE);
+  }
+  else
+    newimgid = imgid;
+
+  // now deal with the history
+  GList *modules_used = NULL;
+
+  dt_develop_t _dev_dest = { 0 };
+
+  dt_develop_t *dev_dest = &_dev_dest;
+
+  dt_dev_init(dev_dest, FALSE);
+
+  dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
+  dev_dest->image_storage.id = imgid;
+
+  // now let's deal with the iop-order (possibly merging style & target lists)
+  if(style->iop_list)
+  {
+    GList *iop_list = dt_ioppr_iop_order_copy_deep(style->iop_list);
+    // the style has an iop-order, we need to merge the multi-instance from target image
+    // get target image iop-order list:
+    GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
+    // get multi-instance modules if any:
+    GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
+    // if some where found merge them with the style list
+    if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
+    // finally we have the final list for the image
+    dt_ioppr_write_iop_order_list(iop_list, newimgid);
+    g_list_free_full(iop_list, g_free);
+    g_list_free_full(img_iop_order_list, g_free);
+    g_list_free_full(mi, g_free);
+  }
+
+  dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
+
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
+
+  dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
+
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
+
+  if (DT_IOP_ORDER_INFO)
+    fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i",imgid, dt_dev_get_history_end(dev_dest));
+
+  // the iop order of the items depends on the image
+  dt_ioppr_update_for_style_items(dev_dest, style->items, FALSE);
+
+  // go through all entries in style
+  for(GList *l = style->items; l; l = g_list_next(l))
+  {
+    dt_style_item_t *style_item = (dt_style_item_t *)l->data;
+    dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
+  }
+
+  if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
+
+  dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
+
+  dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
+  hist->imgid = newimgid;
+  dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
+
+  // write history and forms to db
+  dt_dev_write_history_ext(dev_dest, newimgid);
+
+  dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
+  dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
+  dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
+                 dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
+  dt_undo_end_group(darktable.undo);
+
+  dt_dev_cleanup(dev_dest);
+
+  g_list_free(modules_used);
+
+  dt_image_cache_set_change_timestamp(darktable.image_cache, imgid);
+
+  /* if current image in develop reload history */
+  if(dt_dev_is_current_image(darktable.develop, newimgid))
+  {
+    dt_dev_reload_history_items(darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    dt_dev_modules_update_multishow(darktable.develop);
+  }
+
+  /* the thumbnails are obsolete, render them again */
+  dt_mipmap_cache_regenerate(darktable.mipmap_cache, newimgid);
+  dt_image_update_final_size(newimgid);
+
+  /* update the aspect ratio. recompute only if really needed for performance reasons */
+  if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
+    dt_image_set_aspect_ratio(newimgid, TRUE);
+  else
+    dt_image_reset_aspect_ratio(newimgid, TRUE);
+
+  return newimgid;
+}
+
+// tag the styled images, queue their sidecars and redraw their thumbnails, once for all of them
+static void _style_apply_finish(const char *name, const GList *imgs)
+{
+  if(!imgs) return;
+
+  guint tagid = 0;
+  gchar ntag[512] = { 0 };
+  g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
+  if(dt_tag_new(ntag, &tagid)) dt_tag_attach_images(tagid, imgs, FALSE);
+  if(dt_tag_new("darktable|changed", &tagid)) dt_tag_attach_images(tagid, imgs, FALSE);
+
+  /* update xmp files */
+  dt_sidecar_writer_queue_list(imgs);
+
+  /* redraw center view to update visible mipmaps */
+  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,
+                                imgs->next ? -1 : GPOINTER_TO_INT(imgs->data));
+}
+
 void dt_styles_apply_to_list(const char *name, const GList *list, gboolean duplicate)
 {
   gboolean selected = FALSE;
@@ -581,10 +781,19 @@ void dt_styles_apply_to_list(const char *name, const GList *list, gboolean dupli
   const int mode = dt_conf_get_int("plugins/lighttable/style/applymode");
   const gboolean is_overwrite = (mode == DT_STYLE_HISTORY_OVERWRITE);
 
+  /* the style is read once for all images */
+  dt_style_apply_t style;
+  if(!_style_apply_init(&style, name))
+  {
+    _style_apply_cleanup(&style);
+    return;
+  }
+
   /* for each selected image apply style */
   dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
 
   dt_undo_lt_history_t *hist = NULL;
+  GList *styled = NULL;
 
   for(const GList *l = list; l; l = g_list_next(l))
   {
@@ -599,7 +808,8 @@ void dt_styles_apply_to_list(const char *name, const GList *list, gboolean dupli
       if(!duplicate) dt_history_delete_on_image_ext(imgid, FALSE);
     }
 
-    dt_styles_apply_to_image(name, duplicate, is_overwrite, imgid);
+    const int32_t newimgid = _style_apply_to_image(&style, duplicate, is_overwrite, imgid);
+    if(newimgid != -1) styled = g_list_prepend(styled, GINT_TO_POINTER(newimgid));
 
     if(is_overwrite)
     {
@@ -611,6 +821,11 @@ void dt_styles_apply_to_list(const char *name, const GList *list, gboolean dupli
     selected = TRUE;
   }
 
+  styled = g_list_reverse(styled);
+  _style_apply_finish(name, styled);
+  g_list_free(styled);
+  _style_apply_cleanup(&style);
+
   dt_undo_end_group(darktable.undo);
 
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
@@ -652,6 +867,14 @@ void dt_multiple_styles_apply_to_list(GList *styles, const GList *list, gboolean
   const int mode = dt_conf_get_int("plugins/lighttable/style/applymode");
   const gboolean is_overwrite = (mode == DT_STYLE_HISTORY_OVERWRITE);
 
+  /* the styles are read once for all images */
+  const int styles_nb = g_list_length(styles);
+  dt_style_apply_t *parsed = calloc(styles_nb, sizeof(dt_style_apply_t));
+  GList **styled = calloc(styles_nb, sizeof(GList *));
+  int k = 0;
+  for(const GList *style = styles; style; style = g_list_next(style), k++)
+    _style_apply_init(&parsed[k], (const char *)style->data);
+
   /* for each selected image apply style */
   dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
   for(const GList *l = list; l; l = g_list_next(l))
@@ -660,17 +883,27 @@ void dt_multiple_styles_apply_to_list(GList *styles, const GList *list, gboolean
     if(is_overwrite && !duplicate)
       dt_history_delete_on_image_ext(imgid, FALSE);
 
-    for (GList *style = styles; style; style = g_list_next(style))
+    for(k = 0; k < styles_nb; k++)
     {
-      dt_styles_apply_to_image((char*)style->data, duplicate, is_overwrite, imgid);
+      if(parsed[k].id == 0) continue;
+      const int32_t newimgid = _style_apply_to_image(&parsed[k], duplicate, is_overwrite, imgid);
+      if(newimgid != -1) styled[k] = g_list_prepend(styled[k], GINT_TO_POINTER(newimgid));
     }
   }
+  for(k = 0; k < styles_nb; k++)
+  {
+    styled[k] = g_list_reverse(styled[k]);
+    _style_apply_finish(parsed[k].name, styled[k]);
+    g_list_free(styled[k]);
+    _style_apply_cleanup(&parsed[k]);
+  }
+  free(styled);
+  free(parsed);
   dt_undo_end_group(darktable.undo);
 
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 
-  const guint styles_cnt = g_list_length(styles);
-  dt_control_log(ngettext("style successfully applied!", "styles successfully applied!", styles_cnt));
+  dt_control_log(ngettext("style successfully applied!", "styles successfully applied!", styles_nb));
 }
 
 void dt_styles_create_from_list(const GList *list)
@@ -789,170 +1022,18 @@ void dt_styles_apply_style_item(dt_develop_t *dev, dt_style_item_t *style_item,
 
 void dt_styles_apply_to_image(const char *name, const gboolean duplicate, const gboolean overwrite, const int32_t imgid)
 {
-  int id = 0;
-  sqlite3_stmt *stmt;
-
-  if((id = dt_styles_get_id_by_name(name)) != 0)
+  dt_style_apply_t style;
+  if(_style_apply_init(&style, name))
   {
-    int32_t newimgid;
-    /* check if we should make a duplicate before applying style */
-    if(duplicate)
-    {
-      newimgid = dt_image_duplicate(imgid);
-      if(newimgid != -1)
-      {
-        if(overwrite)
-          dt_history_delete_on_image_ext(newimgid, FALSE);
-        else
-          dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE, TRUE);
-      }
-    }
-    else
-      newimgid = imgid;
-
-    // now deal with the history
-    GList *modules_used = NULL;
-
-    dt_develop_t _dev_dest = { 0 };
-
-    dt_develop_t *dev_dest = &_dev_dest;
-
-    dt_dev_init(dev_dest, FALSE);
-
-    dev_dest->iop = dt_iop_load_modules_ext(dev_dest, TRUE);
-    dev_dest->image_storage.id = imgid;
-
-    // now let's deal with the iop-order (possibly merging style & target lists)
-    GList *iop_list = dt_styles_module_order_list(name);
-    if(iop_list)
-    {
-      // the style has an iop-order, we need to merge the multi-instance from target image
-      // get target image iop-order list:
-      GList *img_iop_order_list = dt_ioppr_get_iop_order_list(newimgid, FALSE);
-      // get multi-instance modules if any:
-      GList *mi = dt_ioppr_extract_multi_instances_list(img_iop_order_list);
-      // if some where found merge them with the style list
-      if(mi) iop_list = dt_ioppr_merge_multi_instance_iop_order_list(iop_list, mi);
-      // finally we have the final list for the image
-      dt_ioppr_write_iop_order_list(iop_list, newimgid);
-      g_list_free_full(iop_list, g_free);
-      g_list_free_full(img_iop_order_list, g_free);
-    }
-
-    dt_dev_read_history_ext(dev_dest, newimgid, TRUE);
-
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image ");
-
-    dt_dev_pop_history_items_ext(dev_dest, dt_dev_get_history_end(dev_dest));
-
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 1");
-
-    if (DT_IOP_ORDER_INFO)
-      fprintf(stderr,"\n^^^^^ Apply style on image %i, history size %i",imgid, dt_dev_get_history_end(dev_dest));
-
-    // go through all entries in style
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT num, module, operation, op_params, enabled,"
-                                "  blendop_params, blendop_version, multi_priority, multi_name"
-                                " FROM data.style_items WHERE styleid=?1 "
-                                " ORDER BY operation, multi_priority",
-                                -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    GList *si_list = NULL;
-    while(sqlite3_step(stmt) == SQLITE_ROW)
+    const int32_t newimgid = _style_apply_to_image(&style, duplicate, overwrite, imgid);
+    if(newimgid != -1)
     {
-      dt_style_item_t *style_item = (dt_style_item_t *)malloc(sizeof(dt_style_item_t));
-
-      style_item->num = sqlite3_column_int(stmt, 0);
-      style_item->selimg_num = 0;
-      style_item->enabled = sqlite3_column_int(stmt, 4);
-      style_item->multi_priority = sqlite3_column_int(stmt, 7);
-      style_item->name = NULL;
-      style_item->operation = g_strdup((char *)sqlite3_column_text(stmt, 2));
-      style_item->multi_name = g_strdup((char *)sqlite3_column_text(stmt, 8));
-      style_item->module_version = sqlite3_column_int(stmt, 1);
-      style_item->blendop_version = sqlite3_column_int(stmt, 6);
-      style_item->params_size = sqlite3_column_bytes(stmt, 3);
-      style_item->params = (void *)malloc(style_item->params_size);
-      memcpy(style_item->params, (void *)sqlite3_column_blob(stmt, 3), style_item->params_size);
-      style_item->blendop_params_size = sqlite3_column_bytes(stmt, 5);
-      style_item->blendop_params = (void *)malloc(style_item->blendop_params_size);
-      memcpy(style_item->blendop_params, (void *)sqlite3_column_blob(stmt, 5), style_item->blendop_params_size);
-      style_item->iop_order = 0;
-
-      si_list = g_list_prepend(si_list, style_item);
+      GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(newimgid));
+      _style_apply_finish(name, imgs);
+      g_list_free(imgs);
     }
-    sqlite3_finalize(stmt);
-    si_list = g_list_reverse(si_list);  // list was built in reverse order, so un-reverse it
-
-    dt_ioppr_update_for_style_items(dev_dest, si_list, FALSE);
-
-    for(GList *l = si_list; l; l = g_list_next(l))
-    {
-      dt_style_item_t *style_item = (dt_style_item_t *)l->data;
-      dt_styles_apply_style_item(dev_dest, style_item, &modules_used, FALSE);
-    }
-
-    g_list_free_full(si_list, dt_style_item_free);
-
-    if (DT_IOP_ORDER_INFO) fprintf(stderr,"\nvvvvv --> look for written history below\n");
-
-    dt_ioppr_check_iop_order(dev_dest, newimgid, "dt_styles_apply_to_image 2");
-
-    dt_undo_lt_history_t *hist = dt_history_snapshot_item_init();
-    hist->imgid = newimgid;
-    dt_history_snapshot_undo_create(hist->imgid, &hist->before, &hist->before_history_end);
-
-    // write history and forms to db
-    dt_dev_write_history_ext(dev_dest, newimgid);
-
-    dt_history_snapshot_undo_create(hist->imgid, &hist->after, &hist->after_history_end);
-    dt_undo_start_group(darktable.undo, DT_UNDO_LT_HISTORY);
-    dt_undo_record(darktable.undo, NULL, DT_UNDO_LT_HISTORY, (dt_undo_data_t)hist,
-                   dt_history_snapshot_undo_pop, dt_history_snapshot_undo_lt_history_data_free);
-    dt_undo_end_group(darktable.undo);
-
-    dt_dev_cleanup(dev_dest);
-
-    g_list_free(modules_used);
-
-    /* add tag */
-    guint tagid = 0;
-    gchar ntag[512] = { 0 };
-    g_snprintf(ntag, sizeof(ntag), "darktable|style|%s", name);
-    if(dt_tag_new(ntag, &tagid)) dt_tag_attach(tagid, newimgid, FALSE, FALSE);
-    if(dt_tag_new("darktable|changed", &tagid))
-    {
-      dt_tag_attach(tagid, newimgid, FALSE, FALSE);
-      dt_image_cache_set_change_timestamp(darktable.image_cache, imgid);
-    }
-
-    /* if current image in develop reload history */
-    if(dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items(darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-      dt_dev_modules_update_multishow(darktable.develop);
-    }
-
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
-
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
-    dt_image_update_final_size(newimgid);
-
-    /* update the aspect ratio. recompute only if really needed for performance reasons */
-    if(darktable.collection->params.sort == DT_COLLECTION_SORT_ASPECT_RATIO)
-      dt_image_set_aspect_ratio(newimgid, TRUE);
-    else
-      dt_image_reset_aspect_ratio(newimgid, TRUE);
-
-    /* redraw center view to update visible mipmaps */
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED, newimgid);
   }
+  _style_apply_cleanup(&style);
 }
 
 void dt_styles_delete_by_name_adv(const char *name, const gboolean raise)
@@ -18,6 +18,7 @@
 #include "common/tags.h"
 #include "common/collection.h"
 #include "common/darktable.h"
+#include "common/database.h"
 #include "common/debug.h"
 #include "common/grouping.h"
 #include "common/selection.h"
@@ -384,9 +385,97 @@ typedef enum dt_tag_actions_t
 
 static GList *_tag_get_tags(const gint imgid, const dt_tag_type_t type);
 
+// attach or detach tags on all images with one statement per tag. the tags of the images are read in
+// one go as well, for the undo records and to tell whether anything changes
+static gboolean _tag_execute_bulk(const GList *tags, const GList *imgs, GList **undo, const gboolean undo_on,
+                                  const gint action)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  dt_database_set_bulk_images(darktable.db, imgs);
+
+  GHashTable *attached = g_hash_table_new(NULL, NULL);
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "SELECT I.imgid, I.tagid"
+                              "  FROM main.tagged_images AS I"
+                              "  JOIN data.tags T on T.id = I.tagid"
+                              "  WHERE I.imgid IN (SELECT imgid FROM memory.bulk_images)",
+                              -1, &stmt, NULL);
+  // clang-format on
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    gpointer imgid = GINT_TO_POINTER(sqlite3_column_int(stmt, 0));
+    GList *img_tags = g_hash_table_lookup(attached, imgid);
+    g_hash_table_insert(attached, imgid, g_list_prepend(img_tags, GINT_TO_POINTER(sqlite3_column_int(stmt, 1))));
+  }
+  sqlite3_finalize(stmt);
+
+  gboolean res = FALSE;
+  for(const GList *images = imgs; images; images = g_list_next(images))
+  {
+    dt_undo_tags_t *undotags = (dt_undo_tags_t *)malloc(sizeof(dt_undo_tags_t));
+    undotags->imgid = GPOINTER_TO_INT(images->data);
+    // the list moves to the undo record, duplicates in imgs get a copy
+    undotags->before = g_list_copy(g_hash_table_lookup(attached, images->data));
+    undotags->after = g_list_copy(undotags->before);
+    if(action == DT_TA_ATTACH ? _tag_add_tags_to_list(&undotags->after, tags)
+                              : _tag_remove_tags_from_list(&undotags->after, tags))
+      res = TRUE;
+    if(undo_on)
+      *undo = g_list_prepend(*undo, undotags);
+    else
+      _undo_tags_free(undotags);
+  }
+  if(undo_on) *undo = g_list_reverse(*undo);
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, attached);
+  while(g_hash_table_iter_next(&iter, NULL, &value)) g_list_free((GList *)value);
+  g_hash_table_destroy(attached);
+
+  if(!res) return FALSE;
+
+  if(action == DT_TA_ATTACH)
+  {
+    // new attachments go to the end of the tag's custom order, in the order of imgs
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "INSERT OR IGNORE INTO main.tagged_images (imgid, tagid, position)"
+                                "  SELECT imgid, ?1,"
+                                "         (SELECT (IFNULL(MAX(position),0) & 0xFFFFFFFF00000000)"
+                                "            FROM main.tagged_images) + (num << 32)"
+                                "  FROM memory.bulk_images",
+                                -1, &stmt, NULL);
+    // clang-format on
+  }
+  else
+  {
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "DELETE FROM main.tagged_images"
+                                "  WHERE tagid = ?1"
+                                "    AND imgid IN (SELECT imgid FROM memory.bulk_images)",
+                                -1, &stmt, NULL);
+    // clang-format on
+  }
+  for(const GList *t = tags; t; t = g_list_next(t))
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(t->data));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  return TRUE;
+}
+
 static gboolean _tag_execute(const GList *tags, const GList *imgs, GList **undo, const gboolean undo_on,
                              const gint action)
 {
+  if(action == DT_TA_ATTACH || action == DT_TA_DETACH)
+    return _tag_execute_bulk(tags, imgs, undo, undo_on, action);
+
   gboolean res = FALSE;
   for(const GList *images = imgs; images; images = g_list_next(images))
   {
@@ -396,14 +485,6 @@ static gboolean _tag_execute(const GList *tags, const GList *imgs, GList **undo,
     undotags->before = _tag_get_tags(image_id, DT_TAG_TYPE_ALL);
     switch(action)
     {
-      case DT_TA_ATTACH:
-        undotags->after = g_list_copy(undotags->before);
-        if(_tag_add_tags_to_list(&undotags->after, tags)) res = TRUE;
-        break;
-      case DT_TA_DETACH:
-        undotags->after = g_list_copy(undotags->before);
-        if(_tag_remove_tags_from_list(&undotags->after, tags)) res = TRUE;
-        break;
       case DT_TA_SET:
         undotags->after = g_list_copy((GList *)tags);
         // preserve dt tags
@@ -0,0 +1,237 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2023 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/trace.h"
+#include "common/atomic.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+
+// processes of the timeline: the threads of ansel, and the OpenCL devices
+#define DT_TRACE_PID_HOST 1
+#define DT_TRACE_PID_OPENCL 2
+
+static FILE *_trace = NULL;
+static dt_pthread_mutex_t _trace_lock;
+static double _trace_start = 0.0;
+static gboolean _trace_empty = TRUE;
+
+// small numbers are easier to read than thread ids in the viewers
+static dt_atomic_int _trace_threads;
+static __thread int _trace_tid = 0;
+static __thread char _trace_thread_name[32] = { 0 };
+
+// flows link the spans of different threads following the same request
+static dt_atomic_int _trace_flows;
+
+// the GUI main loop is idle while it polls, the time between two polls is spent dispatching its sources.
+// Dispatches longer than this are reported as stalls.
+#define DT_TRACE_STALL 0.010
+static GPollFunc _trace_poll_func = NULL;
+static double _trace_poll_return = 0.0;
+
+// write a JSON string, the names are ours but the job descriptions may hold file names
+static void _write_string(const char *s)
+{
+  fputc('"', _trace);
+  for(const char *c = s ? s : ""; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+      fprintf(_trace, "\\%c", *c);
+    else if((unsigned char)*c >= 0x20)
+      fputc(*c, _trace);
+  }
+  fputc('"', _trace);
+}
+
+// all callers hold _trace_lock
+static void _write_separator(void)
+{
+  fputs(_trace_empty ? "\n" : ",\n", _trace);
+  _trace_empty = FALSE;
+}
+
+static void _write_metadata(const int pid, const int tid, const char *what, const char *name)
+{
+  _write_separator();
+  fputs("{\"ph\":\"M\",\"name\":", _trace);
+  _write_string(what);
+  fprintf(_trace, ",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, tid);
+  _write_string(name);
+  fputs("}}", _trace);
+}
+
+static void _write_span(const int pid, const int tid, const char *category, const char *name,
+                        const double start, const double end)
+{
+  _write_separator();
+  fputs("{\"ph\":\"X\",\"name\":", _trace);
+  _write_string(name);
+  fputs(",\"cat\":", _trace);
+  _write_string(category);
+  // microseconds since the trace was opened
+  fprintf(_trace, ",\"pid\":%d,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}", pid, tid,
+          (start - _trace_start) * 1e6, MAX(end - start, 0.0) * 1e6);
+}
+
+static void _write_flow(const int pid, const int tid, const int id, const char *phase, const char *name,
+                        const double ts)
+{
+  _write_separator();
+  fprintf(_trace, "{\"ph\":\"%s\",\"id\":%d,\"bp\":\"e\",\"cat\":\"flow\",\"name\":", phase, id);
+  _write_string(name);
+  fprintf(_trace, ",\"pid\":%d,\"tid\":%d,\"ts\":%.1f}", pid, tid, (ts - _trace_start) * 1e6);
+}
+
+// all callers hold _trace_lock. Threads get their track the first time they record something.
+static int _thread_track(void)
+{
+  if(_trace_tid == 0)
+  {
+    _trace_tid = dt_atomic_add_int(&_trace_threads, 1) + 1;
+    char label[32];
+    if(_trace_thread_name[0])
+      g_strlcpy(label, _trace_thread_name, sizeof(label));
+    else
+      snprintf(label, sizeof(label), "thread %d", _trace_tid);
+    _write_metadata(DT_TRACE_PID_HOST, _trace_tid, "thread_name", label);
+  }
+  return _trace_tid;
+}
+
+gboolean dt_trace_init(const char *filename)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[dt_trace_init] can't write trace file `%s'\n", filename);
+    return FALSE;
+  }
+
+  dt_pthread_mutex_init(&_trace_lock, NULL);
+  dt_atomic_set_int(&_trace_threads, 0);
+  dt_atomic_set_int(&_trace_flows, 0);
+  _trace_start = dt_get_wtime();
+  _trace_empty = TRUE;
+  _trace = f;
+
+  fputc('[', _trace);
+  _write_metadata(DT_TRACE_PID_HOST, 0, "process_name", "ansel");
+  _write_metadata(DT_TRACE_PID_OPENCL, 0, "process_name", "OpenCL");
+  return TRUE;
+}
+
+void dt_trace_cleanup(void)
+{
+  if(!_trace) return;
+
+  dt_pthread_mutex_lock(&_trace_lock);
+  fputs("\n]\n", _trace);
+  fclose(_trace);
+  _trace = NULL;
+  dt_pthread_mutex_unlock(&_trace_lock);
+  dt_pthread_mutex_destroy(&_trace_lock);
+}
+
+gboolean dt_trace_enabled(void)
+{
+  return _trace != NULL;
+}
+
+void dt_trace_span(const char *category, const char *name, const double start, const double end)
+{
+  if(!_trace) return;
+
+  dt_pthread_mutex_lock(&_trace_lock);
+  if(_trace) _write_span(DT_TRACE_PID_HOST, _thread_track(), category, name, start, end);
+  dt_pthread_mutex_unlock(&_trace_lock);
+}
+
+void dt_trace_name_thread(const char *name)
+{
+  // kept even when not tracing, the track is only created on the first span
+  g_strlcpy(_trace_thread_name, name, sizeof(_trace_thread_name));
+  if(!_trace || _trace_tid == 0) return;
+
+  dt_pthread_mutex_lock(&_trace_lock);
+  if(_trace) _write_metadata(DT_TRACE_PID_HOST, _trace_tid, "thread_name", name);
+  dt_pthread_mutex_unlock(&_trace_lock);
+}
+
+int dt_trace_flow_new(void)
+{
+  if(!_trace) return 0;
+  return dt_atomic_add_int(&_trace_flows, 1) + 1;
+}
+
+void dt_trace_flow(const int id, const dt_trace_flow_phase_t phase, const char *name, const double ts)
+{
+  if(!_trace || id == 0) return;
+
+  static const char *phases[] = { "s", "t", "f" };
+  dt_pthread_mutex_lock(&_trace_lock);
+  if(_trace) _write_flow(DT_TRACE_PID_HOST, _thread_track(), id, phases[phase], name, ts);
+  dt_pthread_mutex_unlock(&_trace_lock);
+}
+
+static gint _trace_poll(GPollFD *ufds, guint nfds, gint timeout)
+{
+  const double now = dt_get_wtime();
+  if(_trace_poll_return > 0.0 && now - _trace_poll_return > DT_TRACE_STALL)
+    dt_trace_span("gui", "main loop stall", _trace_poll_return, now);
+
+  const gint ret = _trace_poll_func(ufds, nfds, timeout);
+  _trace_poll_return = dt_get_wtime();
+  return ret;
+}
+
+void dt_trace_watch_main_loop(void)
+{
+  if(!_trace || _trace_poll_func) return;
+
+  dt_trace_name_thread("gui");
+  GMainContext *context = g_main_context_default();
+  _trace_poll_func = g_main_context_get_poll_func(context);
+  g_main_context_set_poll_func(context, _trace_poll);
+}
+
+void dt_trace_name_device(const int devid, const char *name)
+{
+  if(!_trace) return;
+
+  dt_pthread_mutex_lock(&_trace_lock);
+  if(_trace) _write_metadata(DT_TRACE_PID_OPENCL, devid, "thread_name", name);
+  dt_pthread_mutex_unlock(&_trace_lock);
+}
+
+void dt_trace_device_span(const int devid, const char *name, const double start, const double end)
+{
+  if(!_trace) return;
+
+  dt_pthread_mutex_lock(&_trace_lock);
+  if(_trace) _write_span(DT_TRACE_PID_OPENCL, devid, "opencl", name, start, end);
+  dt_pthread_mutex_unlock(&_trace_lock);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,74 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2023 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Timeline of the control jobs, pixelpipe modules and OpenCL commands, written as a Chrome trace
+ * (JSON array format) that chrome://tracing and ui.perfetto.dev open. Enabled by `--trace <file>`,
+ * or by `-d trace` which writes it to the temporary directory.
+ *
+ * All times are given in seconds as returned by dt_get_wtime(). Host spans go on the track of the
+ * calling thread, OpenCL commands on one track per device. Flows draw arrows between the spans of
+ * different threads, from a GUI change to the pipe run and the redraw it causes.
+ */
+
+typedef enum dt_trace_flow_phase_t
+{
+  DT_TRACE_FLOW_START = 0,
+  DT_TRACE_FLOW_STEP,
+  DT_TRACE_FLOW_END
+} dt_trace_flow_phase_t;
+
+/** open the trace file, returns FALSE if it can't be written */
+gboolean dt_trace_init(const char *filename);
+
+/** close the JSON array and the file */
+void dt_trace_cleanup(void);
+
+/** TRUE while a trace is being written */
+gboolean dt_trace_enabled(void);
+
+/** record a span of the calling thread */
+void dt_trace_span(const char *category, const char *name, const double start, const double end);
+
+/** label the track of the calling thread, may be called before dt_trace_init() */
+void dt_trace_name_thread(const char *name);
+
+/** new flow id, 0 when not tracing */
+int dt_trace_flow_new(void);
+
+/** attach a step of a flow to the span of the calling thread enclosing ts */
+void dt_trace_flow(const int id, const dt_trace_flow_phase_t phase, const char *name, const double ts);
+
+/** record the stalls of the GUI main loop, to be called from the GUI thread */
+void dt_trace_watch_main_loop(void);
+
+/** label the track of an OpenCL device */
+void dt_trace_name_device(const int devid, const char *name);
+
+/** record a command run by an OpenCL device */
+void dt_trace_device_span(const int devid, const char *name, const double start, const double end);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -20,6 +20,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/image.h"
+#include "common/sidecar_writer.h"
 #include "control/control.h"
 #include <glib.h>   // for GList, gpointer, g_list_prepend
 #include <stdlib.h> // for NULL, malloc, free
@@ -254,9 +255,8 @@ static void _undo_do_undo_redo(dt_undo_t *self, uint32_t filter, dt_undo_action_
     for(const GList *img = imgs; img; img = g_list_next(img))
       while(img->next && img->data == img->next->data)
         imgs = g_list_delete_link(imgs, img->next);
-    // udpate xmp for updated images
-
-    dt_image_synch_xmps(imgs);
+    // udpate xmp for updated images, in the background
+    dt_sidecar_writer_queue_list(imgs);
   }
 
   dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, imgs);
@@ -340,6 +340,39 @@ void dt_undo_clear(dt_undo_t *self, uint32_t filter)
   UNLOCK;
 }
 
+gboolean dt_undo_drop_oldest(dt_undo_t *self, uint32_t filter)
+{
+  if(!self) return FALSE;
+
+  LOCK;
+
+  // the list is in reverse chronological order
+  GList *oldest = NULL;
+  int count = 0;
+  for(GList *l = g_list_last(self->undo_list); l && count < 2; l = g_list_previous(l))
+  {
+    dt_undo_item_t *item = (dt_undo_item_t *)l->data;
+    if(!item->is_group && (item->type & filter))
+    {
+      if(!oldest) oldest = l;
+      count++;
+    }
+  }
+
+  const gboolean drop = count > 1;
+  if(drop)
+  {
+    dt_undo_item_t *item = (dt_undo_item_t *)oldest->data;
+    self->undo_list = g_list_delete_link(self->undo_list, oldest);
+    _free_undo_data((void *)item);
+    dt_print(DT_DEBUG_UNDO, "[undo] drop oldest for %d (length %d)\n", filter, g_list_length(self->undo_list));
+  }
+
+  UNLOCK;
+
+  return drop;
+}
+
 static void _undo_iterate(GList *list, uint32_t filter, gpointer user_data,
                           void (*apply)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item))
 {
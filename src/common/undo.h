@@ -86,6 +86,10 @@ void dt_undo_do_redo(dt_undo_t *self, uint32_t filter);
 //  removes all items which correspond to filter in the undo/redo lists
 void dt_undo_clear(dt_undo_t *self, uint32_t filter);
 
+//  removes the oldest item which correspond to filter from the undo list, to bound the memory taken by the
+//  records. the most recent one is always kept. returns FALSE if there was nothing to remove
+gboolean dt_undo_drop_oldest(dt_undo_t *self, uint32_t filter);
+
 void dt_undo_iterate_internal(dt_undo_t *self, uint32_t filter, gpointer user_data,
                               void (*apply)(gpointer user_data, dt_undo_type_t type, dt_undo_data_t item));
 
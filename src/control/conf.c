@@ -31,6 +31,7 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 typedef struct dt_conf_dreggn_t
@@ -39,6 +40,10 @@ typedef struct dt_conf_dreggn_t
   const char *match;
 } dt_conf_dreggn_t;
 
+// bumped by every write, the handles compare it to the one their value was resolved at. 0 is never used,
+// so a zeroed handle is always resolved on its first read.
+static uint32_t _generation = 1;
+
 static void _free_confgen_value(void *value)
 {
   dt_confgen_value_t *s = (dt_confgen_value_t *)value;
@@ -95,6 +100,8 @@ static int dt_conf_set_if_not_overridden(const char *name, char *str)
   if(!is_overridden)
   {
     g_hash_table_insert(darktable.conf->table, g_strdup(name), str);
+    if(__atomic_add_fetch(&_generation, 1, __ATOMIC_RELEASE) == 0)
+      __atomic_add_fetch(&_generation, 1, __ATOMIC_RELEASE);
   }
 
   dt_pthread_mutex_unlock(&darktable.conf->mutex);
@@ -327,6 +334,66 @@ const char *dt_conf_get_string_const(const char *name)
   return dt_conf_get_var(name);
 }
 
+uint32_t dt_conf_generation(void)
+{
+  return __atomic_load_n(&_generation, __ATOMIC_ACQUIRE);
+}
+
+// the value bits of the handle, if they were resolved since the last write
+static inline gboolean _handle_lookup(dt_conf_handle_t *handle, uint32_t *bits)
+{
+  const uint64_t cache = __atomic_load_n(&handle->cache, __ATOMIC_ACQUIRE);
+  if((uint32_t)(cache >> 32) != dt_conf_generation()) return FALSE;
+  *bits = (uint32_t)cache;
+  return TRUE;
+}
+
+// generation has to be read before the value: a write racing with the resolution
+// then leaves a stale generation, and the next read resolves again.
+static inline void _handle_store(dt_conf_handle_t *handle, const uint32_t generation, const uint32_t bits)
+{
+  __atomic_store_n(&handle->cache, ((uint64_t)generation << 32) | bits, __ATOMIC_RELEASE);
+}
+
+int dt_conf_handle_get_int(dt_conf_handle_t *handle)
+{
+  uint32_t bits;
+  if(_handle_lookup(handle, &bits)) return (int32_t)bits;
+
+  const uint32_t generation = dt_conf_generation();
+  const int val = dt_conf_get_int(handle->name);
+  _handle_store(handle, generation, (uint32_t)val);
+  return val;
+}
+
+float dt_conf_handle_get_float(dt_conf_handle_t *handle)
+{
+  uint32_t bits;
+  float val;
+  if(_handle_lookup(handle, &bits))
+  {
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+  }
+
+  const uint32_t generation = dt_conf_generation();
+  val = dt_conf_get_float(handle->name);
+  memcpy(&bits, &val, sizeof(bits));
+  _handle_store(handle, generation, bits);
+  return val;
+}
+
+gboolean dt_conf_handle_get_bool(dt_conf_handle_t *handle)
+{
+  uint32_t bits;
+  if(_handle_lookup(handle, &bits)) return bits != 0;
+
+  const uint32_t generation = dt_conf_generation();
+  const gboolean val = dt_conf_get_bool(handle->name) != 0;
+  _handle_store(handle, generation, val);
+  return val;
+}
+
 gboolean dt_conf_key_not_empty(const char *name)
 {
   const char *val = dt_conf_get_string_const(name);
@@ -104,6 +104,26 @@ gboolean dt_conf_key_not_empty(const char *key);
 GSList *dt_conf_all_string_entries(const char *dir);
 void dt_conf_string_entry_free(gpointer data);
 
+/** typed handle on a configuration key, to be read from hot paths. Declare it static where it is used:
+ *    static dt_conf_handle_t _fusion = DT_CONF_HANDLE("pixelpipe_fusion");
+ *    if(dt_conf_handle_get_bool(&_fusion)) ...
+ *  The value is resolved, with the clamping of dt_conf_get_int() and friends, the first time it is read and
+ *  again after any dt_conf_set_*(). Other reads are a couple of atomic loads: no lock, no string hashing. */
+typedef struct dt_conf_handle_t
+{
+  const char *name;
+  uint64_t cache; // generation of the value << 32 | bits of the value
+} dt_conf_handle_t;
+
+#define DT_CONF_HANDLE(key) { .name = (key), .cache = 0 }
+
+int dt_conf_handle_get_int(dt_conf_handle_t *handle);
+float dt_conf_handle_get_float(dt_conf_handle_t *handle);
+gboolean dt_conf_handle_get_bool(dt_conf_handle_t *handle);
+
+/** changes each time a configuration value is written, to refresh values derived from several keys */
+uint32_t dt_conf_generation(void);
+
 #define DT_CONF_SET_SANITIZED_INT(name, val, min, max) dt_conf_set_int(name, CLAMPS(val, min,max));
 #define DT_CONF_SET_SANITIZED_INT6464(name, val, min, max) dt_conf_set_int(name, CLAMPS(val, min,max));
 #define DT_CONF_SET_SANITIZED_FLOAT(name, val, min, max) dt_conf_set_float(name, CLAMPS(val, min,max));
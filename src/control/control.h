@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "common/atomic.h"
 #include "common/darktable.h"
 #include "common/dtpthread.h"
 #include "common/action.h"
@@ -173,15 +174,21 @@ typedef struct dt_control_t
 
   // job management
   int32_t running;
-  gboolean export_scheduled;
-  dt_pthread_mutex_t queue_mutex, cond_mutex, run_mutex;
+  dt_atomic_int export_scheduled;
+  dt_pthread_mutex_t cond_mutex, run_mutex;
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread, kick_on_workers_thread;
-  dt_job_t **job;
 
-  GList *queues[DT_JOB_QUEUE_MAX];
-  size_t queue_length[DT_JOB_QUEUE_MAX];
+  // one set of queues per worker thread. jobs are dealt to them in turn,
+  // idle workers steal from the others.
+  struct dt_control_worker_queue_t *worker_queues;
+  dt_atomic_int next_worker;
+  dt_atomic_int queue_length[DT_JOB_QUEUE_MAX];
+
+  // DT_JOB_QUEUE_SYSTEM_FG jobs queued or running, for constant-time deduplication
+  dt_pthread_mutex_t dedup_mutex;
+  GHashTable *dedup;
 
   dt_pthread_mutex_t res_mutex;
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
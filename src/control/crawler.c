@@ -27,6 +27,7 @@
 #include "common/debug.h"
 #include "common/history.h"
 #include "common/image.h"
+#include "common/image_cache.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "crawler.h"
@@ -103,162 +104,315 @@ static void _set_modification_time(char *filename,
   if(info) g_clear_object(&info);
 }
 
-GList *dt_control_crawler_run(void)
+// an image as read from the database, with the flags it gets from the crawl
+typedef struct _crawler_image_t
 {
-  sqlite3_stmt *stmt, *inner_stmt;
-  GList *result = NULL;
-  gboolean look_for_xmp = (dt_image_get_xmp_mode() != DT_WRITE_XMP_NEVER);
+  int id;
+  time_t timestamp;
+  int version;
+  int flags, new_flags;
+  gchar *image_path;
+} _crawler_image_t;
+
+// the images of one film roll, crawled by one thread
+typedef struct _crawler_folder_t
+{
+  int film_id;
+  gchar *folder;
+  // directory mtime recorded by the last crawl which found nothing to report, -1 if none
+  gint64 crawled_mtime;
+  gint64 mtime;
+  gboolean skipped;
+  GArray *images; // _crawler_image_t
+  GList *result;  // dt_control_crawler_result_t, in reverse order
+} _crawler_folder_t;
+
+static void _crawler_folder_free(gpointer data)
+{
+  _crawler_folder_t *f = (_crawler_folder_t *)data;
+  for(guint k = 0; k < f->images->len; k++) g_free(g_array_index(f->images, _crawler_image_t, k).image_path);
+  g_array_free(f->images, TRUE);
+  g_free(f->folder);
+  g_free(f);
+}
 
-  // clang-format off
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "SELECT i.id, write_timestamp, version,"
-                     "       folder || '" G_DIR_SEPARATOR_S "' || filename, flags"
-                     " FROM main.images i, main.film_rolls f"
-                     " ON i.film_id = f.id"
-                     " ORDER BY f.id, filename",
-                     -1, &stmt, NULL);
-  // clang-format on
-  sqlite3_prepare_v2(dt_database_get(darktable.db),
-                     "UPDATE main.images SET flags = ?1 WHERE id = ?2", -1,
-                     &inner_stmt, NULL);
+// look for a newer xmp file and for .txt or .wav files of one image. safe to run in parallel, nothing here
+// touches the database or the image cache
+static void _crawler_check_image(_crawler_folder_t *f, _crawler_image_t *img, const gboolean look_for_xmp)
+{
+  const gchar *image_path = img->image_path;
+  img->new_flags = img->flags;
 
-  // let's wrap this into a transaction, it might make it a little faster.
-  dt_database_start_transaction(darktable.db);
+  // if the image is missing we ignore it.
+  if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, img->id);
+    return;
+  }
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  // no need to look for xmp files if none get written anyway.
+  if(look_for_xmp)
   {
-    const int id = sqlite3_column_int(stmt, 0);
-    const time_t timestamp = sqlite3_column_int(stmt, 1);
-    const int version = sqlite3_column_int(stmt, 2);
-    const gchar *image_path = (char *)sqlite3_column_text(stmt, 3);
-    int flags = sqlite3_column_int(stmt, 4);
-
-    // if the image is missing we ignore it.
-    if(!g_file_test(image_path, G_FILE_TEST_EXISTS))
+    // construct the xmp filename for this image
+    gchar xmp_path[PATH_MAX] = { 0 };
+    g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
+    dt_image_path_append_version_no_db(img->version, xmp_path, sizeof(xmp_path));
+    size_t len = strlen(xmp_path);
+    if(len + 4 >= PATH_MAX) return;
+    xmp_path[len++] = '.';
+    xmp_path[len++] = 'x';
+    xmp_path[len++] = 'm';
+    xmp_path[len++] = 'p';
+    xmp_path[len] = '\0';
+
+    // on Windows the encoding might not be UTF8
+    gchar *xmp_path_locale = dt_util_normalize_path(xmp_path);
+    int stat_res = -1;
+#ifdef _WIN32
+    // UTF8 paths fail in this context, but converting to UTF16 works
+    struct _stati64 statbuf;
+    if(xmp_path_locale) // in Windows dt_util_normalize_path returns
+                        // NULL if file does not exist
     {
-      dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' (id: %d) is missing.\n", image_path, id);
-      continue;
+      wchar_t *wfilename = g_utf8_to_utf16(xmp_path_locale, -1, NULL, NULL, NULL);
+      stat_res = _wstati64(wfilename, &statbuf);
+      g_free(wfilename);
     }
+#else
+    struct stat statbuf;
+    stat_res = stat(xmp_path_locale, &statbuf);
+#endif
+    g_free(xmp_path_locale);
+    if(stat_res) return; // TODO: shall we report these?
 
-    // no need to look for xmp files if none get written anyway.
-    if(look_for_xmp)
+    // step 1: check if the xmp is newer than our db entry
+    // FIXME: allow for a few seconds difference?
+    if(img->timestamp < statbuf.st_mtime)
     {
-      // construct the xmp filename for this image
-      gchar xmp_path[PATH_MAX] = { 0 };
-      g_strlcpy(xmp_path, image_path, sizeof(xmp_path));
-      dt_image_path_append_version_no_db(version, xmp_path, sizeof(xmp_path));
-      size_t len = strlen(xmp_path);
-      if(len + 4 >= PATH_MAX) continue;
-      xmp_path[len++] = '.';
-      xmp_path[len++] = 'x';
-      xmp_path[len++] = 'm';
-      xmp_path[len++] = 'p';
-      xmp_path[len] = '\0';
-
-      // on Windows the encoding might not be UTF8
-      gchar *xmp_path_locale = dt_util_normalize_path(xmp_path);
-      int stat_res = -1;
-#ifdef _WIN32
-      // UTF8 paths fail in this context, but converting to UTF16 works
-      struct _stati64 statbuf;
-      if(xmp_path_locale) // in Windows dt_util_normalize_path returns
-                          // NULL if file does not exist
-      {
-        wchar_t *wfilename = g_utf8_to_utf16(xmp_path_locale, -1, NULL, NULL, NULL);
-        stat_res = _wstati64(wfilename, &statbuf);
-        g_free(wfilename);
-      }
- #else
-      struct stat statbuf;
-      stat_res = stat(xmp_path_locale, &statbuf);
-#endif
-      g_free(xmp_path_locale);
-      if(stat_res) continue; // TODO: shall we report these?
-
-      // step 1: check if the xmp is newer than our db entry
-      // FIXME: allow for a few seconds difference?
-      if(timestamp < statbuf.st_mtime)
-      {
-        dt_control_crawler_result_t *item
-            = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
-        item->id = id;
-        item->timestamp_xmp = statbuf.st_mtime;
-        item->timestamp_db = timestamp;
-        item->image_path = g_strdup(image_path);
-        item->xmp_path = g_strdup(xmp_path);
-
-        result = g_list_prepend(result, item);
-        dt_print(DT_DEBUG_CONTROL,
-                 "[crawler] `%s' (id: %d) is a newer XMP file.\n", xmp_path, id);
-      }
-      // older timestamps are the case for all images after the db
-      // upgrade. better not report these
+      dt_control_crawler_result_t *item
+          = (dt_control_crawler_result_t *)malloc(sizeof(dt_control_crawler_result_t));
+      item->id = img->id;
+      item->timestamp_xmp = statbuf.st_mtime;
+      item->timestamp_db = img->timestamp;
+      item->image_path = g_strdup(image_path);
+      item->xmp_path = g_strdup(xmp_path);
+
+      f->result = g_list_prepend(f->result, item);
+      dt_print(DT_DEBUG_CONTROL,
+               "[crawler] `%s' (id: %d) is a newer XMP file.\n", xmp_path, img->id);
     }
+    // older timestamps are the case for all images after the db
+    // upgrade. better not report these
+  }
+
+  // step 2: check if the image has associated files (.txt, .wav)
+  size_t len = strlen(image_path);
+  const char *c = image_path + len;
+  while((c > image_path) && (*c != '.')) c--;
+  len = c - image_path + 1;
+
+  char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
+  g_strlcpy(extra_path, image_path, len + 1);
 
-    // step 2: check if the image has associated files (.txt, .wav)
-    size_t len = strlen(image_path);
-    const char *c = image_path + len;
-    while((c > image_path) && (*c != '.')) c--;
-    len = c - image_path + 1;
+  extra_path[len] = 't';
+  extra_path[len + 1] = 'x';
+  extra_path[len + 2] = 't';
+  gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_txt)
+  {
+    extra_path[len] = 'T';
+    extra_path[len + 1] = 'X';
+    extra_path[len + 2] = 'T';
+    has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  extra_path[len] = 'w';
+  extra_path[len + 1] = 'a';
+  extra_path[len + 2] = 'v';
+  gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+
+  if(!has_wav)
+  {
+    extra_path[len] = 'W';
+    extra_path[len + 1] = 'A';
+    extra_path[len + 2] = 'V';
+    has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  }
+
+  // TODO: decide if we want to remove the flag for images that lost
+  // their extra file. currently we do (the else cases)
+  if(has_txt)
+    img->new_flags |= DT_IMAGE_HAS_TXT;
+  else
+    img->new_flags &= ~DT_IMAGE_HAS_TXT;
+  if(has_wav)
+    img->new_flags |= DT_IMAGE_HAS_WAV;
+  else
+    img->new_flags &= ~DT_IMAGE_HAS_WAV;
+
+  free(extra_path);
+}
+
+static void _crawler_check_folder(_crawler_folder_t *f, const gboolean skip_unchanged, const gboolean look_for_xmp)
+{
+  GStatBuf statbuf;
+  f->mtime = g_stat(f->folder, &statbuf) ? -1 : (gint64)statbuf.st_mtime;
+
+  // adding, removing or replacing an xmp, txt or wav file changes the mtime of its folder
+  if(skip_unchanged && f->mtime != -1 && f->mtime == f->crawled_mtime)
+  {
+    dt_print(DT_DEBUG_CONTROL, "[crawler] `%s' is unchanged since the last crawl.\n", f->folder);
+    f->skipped = TRUE;
+    return;
+  }
+
+  for(guint k = 0; k < f->images->len; k++)
+    _crawler_check_image(f, &g_array_index(f->images, _crawler_image_t, k), look_for_xmp);
+}
 
-    char *extra_path = (char *)calloc(len + 3 + 1, sizeof(char));
-    g_strlcpy(extra_path, image_path, len + 1);
+// store the new txt and wav flags through the image cache, which may hold the image by now, and remember
+// the folders without anything to report
+static void _crawler_store(GPtrArray *folders)
+{
+  sqlite3_stmt *stmt, *forget_stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO main.crawler_folders (film_id, mtime) VALUES (?1, ?2)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.crawler_folders WHERE film_id = ?1",
+                              -1, &forget_stmt, NULL);
+  // clang-format on
 
-    extra_path[len] = 't';
-    extra_path[len + 1] = 'x';
-    extra_path[len + 2] = 't';
-    gboolean has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+  for(guint i = 0; i < folders->len; i++)
+  {
+    _crawler_folder_t *f = g_ptr_array_index(folders, i);
+    if(f->skipped) continue;
 
-    if(!has_txt)
+    for(guint k = 0; k < f->images->len; k++)
     {
-      extra_path[len] = 'T';
-      extra_path[len + 1] = 'X';
-      extra_path[len + 2] = 'T';
-      has_txt = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      const _crawler_image_t *img = &g_array_index(f->images, _crawler_image_t, k);
+      if(img->flags == img->new_flags) continue;
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, img->id, 'w');
+      if(!image) continue;
+      image->flags = (image->flags & ~(DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV))
+                     | (img->new_flags & (DT_IMAGE_HAS_TXT | DT_IMAGE_HAS_WAV));
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
     }
 
-    extra_path[len] = 'w';
-    extra_path[len + 1] = 'a';
-    extra_path[len + 2] = 'v';
-    gboolean has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
-
-    if(!has_wav)
+    // a folder with newer xmp files is crawled again until the user sorted them out
+    if(f->mtime != -1 && !f->result)
     {
-      extra_path[len] = 'W';
-      extra_path[len + 1] = 'A';
-      extra_path[len + 2] = 'V';
-      has_wav = g_file_test(extra_path, G_FILE_TEST_EXISTS);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, f->film_id);
+      DT_DEBUG_SQLITE3_BIND_INT64(stmt, 2, f->mtime);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
     }
+    else if(f->crawled_mtime != -1)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(forget_stmt, 1, f->film_id);
+      sqlite3_step(forget_stmt);
+      sqlite3_reset(forget_stmt);
+    }
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(forget_stmt);
+}
 
-    // TODO: decide if we want to remove the flag for images that lost
-    // their extra file. currently we do (the else cases)
-    int new_flags = flags;
-    if(has_txt)
-      new_flags |= DT_IMAGE_HAS_TXT;
-    else
-      new_flags &= ~DT_IMAGE_HAS_TXT;
-    if(has_wav)
-      new_flags |= DT_IMAGE_HAS_WAV;
-    else
-      new_flags &= ~DT_IMAGE_HAS_WAV;
-    if(flags != new_flags)
+static GList *_crawler_run(const gboolean skip_unchanged)
+{
+  const gboolean look_for_xmp = (dt_image_get_xmp_mode() != DT_WRITE_XMP_NEVER);
+  const double start = dt_get_wtime();
+
+  // read everything first, the file system checks then run per folder in parallel
+  GPtrArray *folders = g_ptr_array_new_with_free_func(_crawler_folder_free);
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT i.id, write_timestamp, version,"
+                              "       folder || '" G_DIR_SEPARATOR_S "' || filename, flags,"
+                              "       f.id, f.folder, IFNULL(c.mtime, -1)"
+                              " FROM main.images i"
+                              " JOIN main.film_rolls f ON i.film_id = f.id"
+                              " LEFT JOIN main.crawler_folders c ON c.film_id = f.id"
+                              " ORDER BY f.id, filename",
+                              -1, &stmt, NULL);
+  // clang-format on
+  _crawler_folder_t *f = NULL;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int film_id = sqlite3_column_int(stmt, 5);
+    if(!f || f->film_id != film_id)
     {
-      sqlite3_bind_int(inner_stmt, 1, new_flags);
-      sqlite3_bind_int(inner_stmt, 2, id);
-      sqlite3_step(inner_stmt);
-      sqlite3_reset(inner_stmt);
-      sqlite3_clear_bindings(inner_stmt);
+      f = g_new0(_crawler_folder_t, 1);
+      f->film_id = film_id;
+      f->folder = g_strdup((const char *)sqlite3_column_text(stmt, 6));
+      f->crawled_mtime = sqlite3_column_int64(stmt, 7);
+      f->images = g_array_new(FALSE, FALSE, sizeof(_crawler_image_t));
+      g_ptr_array_add(folders, f);
     }
+    _crawler_image_t img = { .id = sqlite3_column_int(stmt, 0),
+                             .timestamp = sqlite3_column_int(stmt, 1),
+                             .version = sqlite3_column_int(stmt, 2),
+                             .image_path = g_strdup((const char *)sqlite3_column_text(stmt, 3)),
+                             .flags = sqlite3_column_int(stmt, 4) };
+    img.new_flags = img.flags;
+    g_array_append_val(f->images, img);
+  }
+  sqlite3_finalize(stmt);
+
+  const int nb_folders = folders->len;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(folders, nb_folders, skip_unchanged, look_for_xmp) \
+  schedule(dynamic)
+#endif
+  for(int i = 0; i < nb_folders; i++)
+    _crawler_check_folder(g_ptr_array_index(folders, i), skip_unchanged, look_for_xmp);
+
+  _crawler_store(folders);
 
-    free(extra_path);
+  GList *result = NULL;
+  int skipped = 0;
+  for(guint i = 0; i < folders->len; i++)
+  {
+    _crawler_folder_t *folder = g_ptr_array_index(folders, i);
+    if(folder->skipped) skipped++;
+    // each folder's list is in reverse order, so un-reverse it
+    result = g_list_concat(result, g_list_reverse(folder->result));
+    folder->result = NULL;
   }
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF, "[crawler] %d folders checked, %d unchanged, in %.3f secs\n",
+           nb_folders - skipped, skipped, dt_get_wtime() - start);
+  g_ptr_array_free(folders, TRUE);
 
-  dt_database_release_transaction(darktable.db);
+  return result;
+}
 
-  sqlite3_finalize(stmt);
-  sqlite3_finalize(inner_stmt);
+GList *dt_control_crawler_run(void)
+{
+  return _crawler_run(FALSE);
+}
+
+static gboolean _crawler_show_image_list(gpointer user_data)
+{
+  dt_control_crawler_show_image_list((GList *)user_data);
+  return FALSE;
+}
 
-  return g_list_reverse(result); // list was built in reverse order, so un-reverse it
+static int32_t _crawler_job_run(dt_job_t *job)
+{
+  GList *result = _crawler_run(TRUE);
+  // the popup belongs to the gui thread
+  if(result) g_main_context_invoke(NULL, _crawler_show_image_list, result);
+  return 0;
+}
+
+void dt_control_crawler_run_background(void)
+{
+  dt_job_t *job = dt_control_job_create(&_crawler_job_run, "look for updated xmp files");
+  if(job) dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, job);
 }
 
 
@@ -20,10 +20,8 @@
 
 #include <glib.h>
 
-/** this isn't a background job on purpose. it has to be really fast so it shouldn't
- *  require locking from image cache or anything like that.
- *  should we find out that we want to have a background job that crawls over all images
- *  we can maybe refactor this, but for now it's good the way it is.
+/** the file system checks run per film roll folder in parallel, without touching the database or
+ *  the image cache. only the resulting txt/wav flags go through the image cache.
  */
 
 // this function iterates over ALL images from the database and checks whether
@@ -33,6 +31,10 @@
 // it returns the list of images with a (supposedly) updated xmp file to let the user decide
 GList *dt_control_crawler_run();
 
+// the same from a background job, skipping the folders whose mtime didn't change since the last crawl
+// which found nothing to report. shows the popup on the gui thread if there is something to report
+void dt_control_crawler_run_background();
+
 // show a popup with the images, let the user decide what to do and free the list afterwards
 void dt_control_crawler_show_image_list(GList *images);
 
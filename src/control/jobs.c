@@ -17,6 +17,8 @@
 */
 
 #include "control/jobs.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #include "control/control.h"
 
 #define DT_CONTROL_FG_PRIORITY 4
@@ -32,6 +34,15 @@ typedef struct worker_thread_parameters_t
   int32_t threadid;
 } worker_thread_parameters_t;
 
+/* per-worker queues. The worker owning them serves them first, then it steals from the other workers.
+   Each set has its own lock, so submitting a job or scheduling one never contends on a global lock.
+*/
+typedef struct dt_control_worker_queue_t
+{
+  dt_pthread_mutex_t mutex;
+  GQueue queues[DT_JOB_QUEUE_MAX]; // head is the next job to run
+} dt_control_worker_queue_t;
+
 typedef struct _dt_job_t
 {
   dt_job_execute_callback execute;
@@ -44,6 +55,7 @@ typedef struct _dt_job_t
   dt_pthread_mutex_t wait_mutex;
 
   dt_job_state_t state;
+  double queued; // when the job was queued, for the metrics
   unsigned char priority;
   dt_job_queue_t queue;
 
@@ -70,6 +82,38 @@ static inline int dt_control_job_equal(_dt_job_t *j1, _dt_job_t *j2)
           && (g_strcmp0(j1->description, j2->description) == 0));
 }
 
+/** hash and equality used to index jobs in the deduplication table. Stricter than dt_control_job_equal()
+    regarding params sizes, so that equal jobs always have equal hashes.
+ */
+static guint _job_hash(gconstpointer key)
+{
+  const _dt_job_t *job = (const _dt_job_t *)key;
+  uint64_t hash = dt_hash(5381, (const char *)&job->execute, sizeof(job->execute));
+  hash = dt_hash(hash, (const char *)&job->state_changed_cb, sizeof(job->state_changed_cb));
+  hash = dt_hash(hash, (const char *)&job->queue, sizeof(job->queue));
+  if(job->params_size != 0)
+    hash = dt_hash(hash, (const char *)job->params, job->params_size);
+  else
+    hash = dt_hash(hash, job->description, strlen(job->description));
+  return (guint)(hash ^ (hash >> 32));
+}
+
+static gboolean _job_equal(gconstpointer a, gconstpointer b)
+{
+  _dt_job_t *j1 = (_dt_job_t *)a;
+  _dt_job_t *j2 = (_dt_job_t *)b;
+  return j1->params_size == j2->params_size && dt_control_job_equal(j1, j2);
+}
+
+// forget a job in the deduplication table, unless it has been superseded by an equal one
+static void _dedup_remove(dt_control_t *control, _dt_job_t *job)
+{
+  if(!job || job->queue != DT_JOB_QUEUE_SYSTEM_FG) return;
+  dt_pthread_mutex_lock(&control->dedup_mutex);
+  if(g_hash_table_lookup(control->dedup, job) == job) g_hash_table_remove(control->dedup, job);
+  dt_pthread_mutex_unlock(&control->dedup_mutex);
+}
+
 static void dt_control_job_set_state(_dt_job_t *job, dt_job_state_t state)
 {
   if(!job) return;
@@ -79,6 +123,10 @@ static void dt_control_job_set_state(_dt_job_t *job, dt_job_state_t state)
     dt_control_progress_destroy(darktable.control, job->progress);
     job->progress = NULL;
   }
+  if(state == DT_JOB_STATE_QUEUED)
+    job->queued = dt_get_wtime();
+  else if(state == DT_JOB_STATE_RUNNING && job->state == DT_JOB_STATE_QUEUED)
+    dt_metrics_time(DT_METRICS_JOB_WAIT, dt_get_wtime() - job->queued);
   job->state = state;
   /* pass state change to callback */
   if(job->state_changed_cb) job->state_changed_cb(job, state);
@@ -212,7 +260,9 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
     dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_get_wtime();
     job->result = job->execute(job);
+    dt_trace_span("job", job->description, start, dt_get_wtime());
 
     dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
     dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
@@ -224,7 +274,7 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
   return 0;
 }
 
-static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
+static _dt_job_t *_pop_job(dt_control_t *control, dt_control_worker_queue_t *worker)
 {
   /*
    * job scheduling works like this:
@@ -237,56 +287,82 @@ static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
    * - the jobs that didn't get picked this round get their priority incremented
    */
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
+  dt_pthread_mutex_lock(&worker->mutex);
 
-  // find the job
   _dt_job_t *job = NULL;
   int winner_queue = DT_JOB_QUEUE_MAX;
-  int max_priority = -1;
-  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+  gboolean skip_export = dt_atomic_get_int(&control->export_scheduled);
+
+  while(TRUE)
   {
-    if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
-    _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
-    if(_job->priority > max_priority)
+    // find the job
+    job = NULL;
+    winner_queue = DT_JOB_QUEUE_MAX;
+    int max_priority = -1;
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
     {
-      max_priority = _job->priority;
-      job = _job;
-      winner_queue = i;
+      if(g_queue_is_empty(&worker->queues[i])) continue;
+      if(skip_export && i == DT_JOB_QUEUE_USER_EXPORT) continue;
+      _dt_job_t *_job = (_dt_job_t *)g_queue_peek_head(&worker->queues[i]);
+      if(_job->priority > max_priority)
+      {
+        max_priority = _job->priority;
+        job = _job;
+        winner_queue = i;
+      }
     }
+
+    // only one export may run at a time, among all workers
+    if(job && winner_queue == DT_JOB_QUEUE_USER_EXPORT)
+    {
+      int expected = FALSE;
+      if(!dt_atomic_CAS_int(&control->export_scheduled, &expected, TRUE))
+      {
+        skip_export = TRUE;
+        continue;
+      }
+    }
+    break;
   }
 
   if(!job)
   {
-    dt_pthread_mutex_unlock(&control->queue_mutex);
+    dt_pthread_mutex_unlock(&worker->mutex);
     return NULL;
   }
 
-  // the order of the queues in control->queues matches our priority, and we only update job when the priority
+  // the order of the queues in worker->queues matches our priority, and we only update job when the priority
   // is strictly bigger
   // invariant -> job is the one we are looking for
 
   // remove the to be scheduled job from its queue
-  GList **queue = &control->queues[winner_queue];
-  *queue = g_list_delete_link(*queue, *queue);
-  control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
-
-  // and place it in scheduled job array (for job deduping)
-  control->job[dt_control_get_threadid()] = job;
+  g_queue_pop_head(&worker->queues[winner_queue]);
+  dt_atomic_sub_int(&control->queue_length[winner_queue], 1);
 
   // increment the priorities of the others
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
-    if(i == winner_queue || control->queues[i] == NULL) continue;
-    ((_dt_job_t *)control->queues[i]->data)->priority++;
+    if(i == winner_queue || g_queue_is_empty(&worker->queues[i])) continue;
+    ((_dt_job_t *)g_queue_peek_head(&worker->queues[i]))->priority++;
   }
 
-  dt_pthread_mutex_unlock(&control->queue_mutex);
+  dt_pthread_mutex_unlock(&worker->mutex);
 
   return job;
 }
 
+static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
+{
+  // serve our own queues first, then steal from the next workers
+  const int self = dt_control_get_threadid();
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    _dt_job_t *job = _pop_job(control, &control->worker_queues[(self + k) % control->num_threads]);
+    if(job) return job;
+  }
+  return NULL;
+}
+
 static void dt_control_job_execute(_dt_job_t *job)
 {
   dt_print(DT_DEBUG_CONTROL, "[run_job+] %02d %f ", DT_CTL_WORKER_RESERVED + dt_control_get_threadid(),
@@ -297,7 +373,9 @@ static void dt_control_job_execute(_dt_job_t *job)
   dt_control_job_set_state(job, DT_JOB_STATE_RUNNING);
 
   /* execute job */
+  const double start = dt_get_wtime();
   job->result = job->execute(job);
+  dt_trace_span("job", job->description, start, dt_get_wtime());
 
   dt_control_job_set_state(job, DT_JOB_STATE_FINISHED);
 
@@ -320,11 +398,9 @@ static int32_t dt_control_run_job(dt_control_t *control)
 
   dt_pthread_mutex_unlock(&job->wait_mutex);
 
-  // remove the job from scheduled job array (for job deduping)
-  dt_pthread_mutex_lock(&control->queue_mutex);
-  control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
-  dt_pthread_mutex_unlock(&control->queue_mutex);
+  // remove the job from the deduplication table, and let the next export run
+  _dedup_remove(control, job);
+  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) dt_atomic_set_int(&control->export_scheduled, FALSE);
 
   // and free it
   dt_control_job_dispose(job);
@@ -388,14 +464,12 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
 
   job->queue = queue_id;
 
+  // deal jobs to the workers in turn
+  const int worker_id = (unsigned int)dt_atomic_add_int(&control->next_worker, 1) % control->num_threads;
+  dt_control_worker_queue_t *worker = &control->worker_queues[worker_id];
   _dt_job_t *job_for_disposal = NULL;
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
-  GList **queue = &control->queues[queue_id];
-  size_t length = control->queue_length[queue_id];
-
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", length);
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %d | ", dt_atomic_get_int(&control->queue_length[queue_id]));
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
@@ -405,59 +479,47 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
     job->priority = DT_CONTROL_FG_PRIORITY;
 
     // check if we have already scheduled the job
-    for(int k = 0; k < control->num_threads; k++)
+    dt_pthread_mutex_lock(&control->dedup_mutex);
+    _dt_job_t *other_job = (_dt_job_t *)g_hash_table_lookup(control->dedup, job);
+    if(other_job && dt_control_job_get_state(other_job) == DT_JOB_STATE_RUNNING)
     {
-      _dt_job_t *other_job = (_dt_job_t *)control->job[k];
-      if(dt_control_job_equal(job, other_job))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
+      dt_pthread_mutex_unlock(&control->dedup_mutex);
 
-        dt_pthread_mutex_unlock(&control->queue_mutex);
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
+      dt_control_job_print(other_job);
+      dt_print(DT_DEBUG_CONTROL, "\n");
 
-        dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
-        dt_control_job_dispose(job);
+      dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
+      dt_control_job_dispose(job);
 
-        return 0; // there can't be any further copy
-      }
+      return 0; // there can't be any further copy
     }
 
-    // if the job is already in the queue -> move it to the top
-    for(GList *iter = *queue; iter; iter = g_list_next(iter))
+    // if the job is already in a queue, the new one supersedes it on top of the stack.
+    // The old one is discarded now and disposed when a worker pops it.
+    if(other_job)
     {
-      _dt_job_t *other_job = (_dt_job_t *)iter->data;
-      if(dt_control_job_equal(job, other_job))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
-
-        *queue = g_list_delete_link(*queue, iter);
-        length--;
-
-        job_for_disposal = job;
-
-        job = other_job;
-        break; // there can't be any further copy in the list
-      }
+      dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
+      dt_control_job_print(other_job);
+      dt_print(DT_DEBUG_CONTROL, "\n");
+      dt_control_job_set_state(other_job, DT_JOB_STATE_DISCARDED);
     }
+    g_hash_table_replace(control->dedup, job, job);
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    dt_pthread_mutex_unlock(&control->dedup_mutex);
 
-    // now we can add the new job to the list
-    *queue = g_list_prepend(*queue, job);
-    length++;
+    // now we can add the new job to the stack
+    dt_pthread_mutex_lock(&worker->mutex);
+    g_queue_push_head(&worker->queues[queue_id], job);
 
-    // and take care of the maximal queue size
-    if(length > DT_CONTROL_MAX_JOBS)
+    // and take care of the maximal queue size, dropping the oldest job of this worker
+    if(dt_atomic_add_int(&control->queue_length[queue_id], 1) >= DT_CONTROL_MAX_JOBS
+       && g_queue_get_length(&worker->queues[queue_id]) > 1)
     {
-      GList *last = g_list_last(*queue);
-      dt_control_job_set_state((_dt_job_t *)last->data, DT_JOB_STATE_DISCARDED);
-      dt_control_job_dispose((_dt_job_t *)last->data);
-      *queue = g_list_delete_link(*queue, last);
-      length--;
+      job_for_disposal = (_dt_job_t *)g_queue_pop_tail(&worker->queues[queue_id]);
+      dt_atomic_sub_int(&control->queue_length[queue_id], 1);
     }
-
-    control->queue_length[queue_id] = length;
+    dt_pthread_mutex_unlock(&worker->mutex);
   }
   else
   {
@@ -468,11 +530,13 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
       job->priority = 0;
     else
       job->priority = DT_CONTROL_FG_PRIORITY;
-    *queue = g_list_append(*queue, job);
-    control->queue_length[queue_id]++;
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+
+    dt_pthread_mutex_lock(&worker->mutex);
+    g_queue_push_tail(&worker->queues[queue_id], job);
+    dt_atomic_add_int(&control->queue_length[queue_id], 1);
+    dt_pthread_mutex_unlock(&worker->mutex);
   }
-  dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
-  dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // notify workers
   dt_pthread_mutex_lock(&control->cond_mutex);
@@ -480,12 +544,58 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   dt_pthread_mutex_unlock(&control->cond_mutex);
 
   // dispose of dropped job, if any
-  dt_control_job_set_state(job_for_disposal, DT_JOB_STATE_DISCARDED);
-  dt_control_job_dispose(job_for_disposal);
+  if(job_for_disposal)
+  {
+    _dedup_remove(control, job_for_disposal);
+    dt_control_job_set_state(job_for_disposal, DT_JOB_STATE_DISCARDED);
+    dt_control_job_dispose(job_for_disposal);
+  }
 
   return 0;
 }
 
+int dt_control_discard_jobs(dt_control_t *control, dt_job_queue_t queue_id, dt_job_execute_callback execute,
+                            dt_job_filter_callback filter, void *data)
+{
+  if(((unsigned int)queue_id) >= DT_JOB_QUEUE_MAX || !control->worker_queues) return 0;
+
+  GSList *discarded = NULL;
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_control_worker_queue_t *worker = &control->worker_queues[k];
+    dt_pthread_mutex_lock(&worker->mutex);
+    GList *l = worker->queues[queue_id].head;
+    while(l)
+    {
+      GList *next = g_list_next(l);
+      _dt_job_t *job = (_dt_job_t *)l->data;
+      if(job->execute == execute && filter(job->params, data))
+      {
+        g_queue_delete_link(&worker->queues[queue_id], l);
+        dt_atomic_sub_int(&control->queue_length[queue_id], 1);
+        discarded = g_slist_prepend(discarded, job);
+      }
+      l = next;
+    }
+    dt_pthread_mutex_unlock(&worker->mutex);
+  }
+
+  // the jobs left the queues, nobody else can reach them now
+  int count = 0;
+  for(GSList *l = discarded; l; l = g_slist_next(l))
+  {
+    _dt_job_t *job = (_dt_job_t *)l->data;
+    _dedup_remove(control, job);
+    dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
+    dt_control_job_dispose(job);
+    count++;
+  }
+  g_slist_free(discarded);
+
+  if(count) dt_print(DT_DEBUG_CONTROL, "[discard_jobs] %d jobs dropped from queue %d\n", count, queue_id);
+  return count;
+}
+
 static __thread int threadid = -1;
 
 int32_t dt_control_get_threadid()
@@ -607,7 +717,18 @@ void dt_control_jobs_init(dt_control_t *control)
   // start threads
   control->num_threads = dt_worker_threads();
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
-  control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  control->worker_queues
+      = (dt_control_worker_queue_t *)calloc(control->num_threads, sizeof(dt_control_worker_queue_t));
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_pthread_mutex_init(&control->worker_queues[k].mutex, NULL);
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++) g_queue_init(&control->worker_queues[k].queues[i]);
+  }
+  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++) dt_atomic_set_int(&control->queue_length[i], 0);
+  dt_atomic_set_int(&control->next_worker, 0);
+  dt_atomic_set_int(&control->export_scheduled, FALSE);
+  dt_pthread_mutex_init(&control->dedup_mutex, NULL);
+  control->dedup = g_hash_table_new(_job_hash, _job_equal);
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -637,7 +758,16 @@ void dt_control_jobs_init(dt_control_t *control)
 
 void dt_control_jobs_cleanup(dt_control_t *control)
 {
-  free(control->job);
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++) g_queue_clear(&control->worker_queues[k].queues[i]);
+    dt_pthread_mutex_destroy(&control->worker_queues[k].mutex);
+  }
+  free(control->worker_queues);
+  control->worker_queues = NULL;
+  g_hash_table_destroy(control->dedup);
+  control->dedup = NULL;
+  dt_pthread_mutex_destroy(&control->dedup_mutex);
   free(control->thread);
 }
 
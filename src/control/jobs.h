@@ -54,6 +54,7 @@ typedef struct _dt_job_t dt_job_t;
 typedef int32_t (*dt_job_execute_callback)(dt_job_t *);
 typedef void (*dt_job_state_change_callback)(dt_job_t *, dt_job_state_t state);
 typedef void (*dt_job_destroy_callback)(void *data);
+typedef gboolean (*dt_job_filter_callback)(void *params, void *data);
 
 /** create a new initialized job */
 dt_job_t *dt_control_job_create(dt_job_execute_callback execute, const char *msg, ...) __attribute__((format(printf, 2, 3)));
@@ -86,6 +87,11 @@ void dt_control_jobs_cleanup(struct dt_control_t *control);
 
 int dt_control_add_job(struct dt_control_t *control, dt_job_queue_t queue_id, dt_job_t *job);
 int32_t dt_control_add_job_res(struct dt_control_t *s, dt_job_t *job, int32_t res);
+/** drop the jobs of queue_id running execute that are still waiting for a worker and for which filter returns
+  * TRUE. filter is called with the job params, under the lock of the worker queues, it has to be cheap.
+  * returns the number of dropped jobs. */
+int dt_control_discard_jobs(struct dt_control_t *control, dt_job_queue_t queue_id, dt_job_execute_callback execute,
+                            dt_job_filter_callback filter, void *data);
 
 int32_t dt_control_get_threadid();
 
@@ -21,6 +21,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/export_queue.h"
 #include "common/film.h"
 #include "common/gpx.h"
 #include "common/history.h"
@@ -30,6 +31,7 @@
 #include "common/imageio_dng.h"
 #include "common/imageio_module.h"
 #include "common/mipmap_cache.h"
+#include "common/opencl.h"
 #include "common/tags.h"
 #include "common/undo.h"
 #include "common/grouping.h"
@@ -88,6 +90,14 @@ typedef struct dt_control_export_t
   gchar *icc_filename;
   dt_iop_color_intent_t icc_intent;
   gchar *metadata_export;
+  // dt_control_export_files() writes to these files, one per image, instead of a storage (storage_index -1)
+  GList *filenames;
+  dt_imageio_module_data_t *fdata;
+  dt_control_export_image_callback_t image_done;
+  void (*done)(gpointer user_data);
+  gpointer user_data;
+  // entry of the export in main.export_queue, 0 if it is not recorded
+  int32_t queue_id;
 } dt_control_export_t;
 
 
@@ -285,6 +295,9 @@ typedef struct dt_control_merge_hdr_t
   float adobe_XYZ_to_CAM[4][3];
   char camera_makermodel[128];
 
+  // background merge of the previous frame, if any
+  GThread *merger;
+
   // 0 - ok; 1 - errors, abort
   gboolean abort;
 } dt_control_merge_hdr_t;
@@ -330,11 +343,119 @@ static float envelope(const float xx)
   }
 }
 
+typedef struct dt_control_merge_hdr_frame_t
+{
+  dt_control_merge_hdr_t *d;
+  float *in;
+  float cal, photoncnt, saturation;
+  // white level as of this frame, the next one may raise it while we merge
+  float whitelevel;
+} dt_control_merge_hdr_frame_t;
+
+static gpointer _merge_hdr_accumulate(gpointer data)
+{
+  dt_control_merge_hdr_frame_t *frame = (dt_control_merge_hdr_frame_t *)data;
+  dt_control_merge_hdr_t *d = frame->d;
+  const float *const restrict in = frame->in;
+  float *const restrict pixels = d->pixels;
+  float *const restrict weight = d->weight;
+  const int wd = d->wd;
+  const int ht = d->ht;
+  const float cal = frame->cal;
+  const float photoncnt = frame->photoncnt;
+  const float saturation = frame->saturation;
+  const float whitelevel = frame->whitelevel;
+  const float epsw = d->epsw;
+
+  // need some safety margin due to upsampling and 16-bit quantization + dithering?
+  const float offset = 3000.0f / (float)UINT16_MAX;
+
+  // the envelope is shared by the 2x2 block of pixels, so evaluate it once per
+  // block rather than once per pixel.
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, pixels, weight, wd, ht, cal, photoncnt, saturation, whitelevel, epsw, offset) \
+  schedule(static)
+#endif
+  for(int yy = 0; yy < ht; yy += 2)
+    for(int xx = 0; xx < wd; xx += 2)
+    {
+      // weights based on siggraph 12 poster
+      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
+      // 2d denoising factor for high dynamic range imaging
+      float w = photoncnt;
+
+      // cannot do an envelope based on single pixel values here, need to get
+      // maximum value of all color channels. to find that, go through the
+      // pattern block (we conservatively do a 3x3 for bayer or xtrans):
+      float M = 0.0f, m = FLT_MAX;
+      if(xx < wd - 2 && yy < ht - 2)
+      {
+        for(int j = 0; j < 3; j++)
+          for(int i = 0; i < 3; i++)
+          {
+            M = MAX(M, in[xx + i + (size_t)wd * (yy + j)]);
+            m = MIN(m, in[xx + i + (size_t)wd * (yy + j)]);
+          }
+        // move envelope a little to allow non-zero weight even for clipped regions.
+        // this is because even if the 2x2 block is clipped somewhere, the other channels
+        // might still prove useful. we'll check for individual channel saturation below.
+        w *= epsw + envelope((M + offset) / saturation);
+      }
+      const gboolean clipped = M + offset >= saturation;
+      const gboolean all_clipped = m + offset >= saturation;
+
+      for(int y = yy; y < MIN(yy + 2, ht); y++)
+        for(int x = xx; x < MIN(xx + 2, wd); x++)
+        {
+          const size_t k = (size_t)wd * y + x;
+          // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
+          // this is the output of the rawprepare iop.
+          const float v = in[k];
+          if(clipped)
+          {
+            if(weight[k] <= 0.0f)
+            { // only consider saturated pixels in case we have nothing better:
+              if(weight[k] == 0 || m < -weight[k])
+              {
+                if(all_clipped)
+                  pixels[k] = 1.0f; // let's admit we were completely clipped, too
+                else
+                  pixels[k] = v * cal / whitelevel;
+                weight[k] = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
+              }
+            }
+            // else silently ignore, others have filled in a better color here already
+          }
+          else
+          {
+            if(weight[k] <= 0.0)
+            { // cleanup potentially blown highlights from earlier images
+              pixels[k] = 0.0f;
+              weight[k] = 0.0f;
+            }
+            pixels[k] += w * v * cal;
+            weight[k] += w;
+          }
+        }
+    }
+
+  dt_free_align(frame->in);
+  free(frame);
+  return NULL;
+}
+
+static void _merge_hdr_wait(dt_control_merge_hdr_t *d)
+{
+  if(d->merger) g_thread_join(d->merger);
+  d->merger = NULL;
+}
+
 static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const char *filename,
                                         const void *const ivoid,
                                         dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                                        void *exif, int exif_len, int imgid, int num, int total,
-                                        dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+                                        void *exif, int exif_len, const char *xmp, int imgid, int num,
+                                        int total, dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   dt_control_merge_hdr_format_t *data = (dt_control_merge_hdr_format_t *)datai;
   dt_control_merge_hdr_t *d = data->d;
@@ -392,77 +513,30 @@ static int dt_control_merge_hdr_process(dt_imageio_module_data_t *datai, const c
   const float aperture = M_PI * rad * rad;
   const float iso = image.exif_iso > 0.0f ? image.exif_iso : 100.0f;
   const float exp = image.exif_exposure > 0.0f ? image.exif_exposure : 1.0f;
-  const float cal = 100.0f / (aperture * exp * iso);
-  // about proportional to how many photons we can expect from this shot:
-  const float photoncnt = 100.0f * aperture * exp / iso;
-  float saturation = 1.0f;
-  d->whitelevel = fmaxf(d->whitelevel, saturation * cal);
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ivoid, cal, photoncnt) \
-  shared(d, saturation) \
-  schedule(static) collapse(2)
-#endif
-  for(int y = 0; y < d->ht; y++)
-    for(int x = 0; x < d->wd; x++)
-    {
-      // read unclamped raw value with subtracted black and rescaled to 1.0 saturation.
-      // this is the output of the rawprepare iop.
-      const float in = ((float *)ivoid)[x + d->wd * y];
-      // weights based on siggraph 12 poster
-      // zijian zhu, zhengguo li, susanto rahardja, pasi fraenti
-      // 2d denoising factor for high dynamic range imaging
-      float w = photoncnt;
+  const float saturation = 1.0f;
 
-      // need some safety margin due to upsampling and 16-bit quantization + dithering?
-      float offset = 3000.0f / (float)UINT16_MAX;
-
-      // cannot do an envelope based on single pixel values here, need to get
-      // maximum value of all color channels. to find that, go through the
-      // pattern block (we conservatively do a 3x3 for bayer or xtrans):
-      int xx = x & ~1, yy = y & ~1;
-      float M = 0.0f, m = FLT_MAX;
-      if(xx < d->wd - 2 && yy < d->ht - 2)
-      {
-        for(int i = 0; i < 3; i++)
-          for(int j = 0; j < 3; j++)
-          {
-            M = MAX(M, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-            m = MIN(m, ((float *)ivoid)[xx + i + d->wd * (yy + j)]);
-          }
-        // move envelope a little to allow non-zero weight even for clipped regions.
-        // this is because even if the 2x2 block is clipped somewhere, the other channels
-        // might still prove useful. we'll check for individual channel saturation below.
-        w *= d->epsw + envelope((M + offset) / saturation);
-      }
+  // the export buffer only lives until we return, so take a copy and merge it
+  // in the background while the pipeline decodes and prepares the next frame.
+  dt_control_merge_hdr_frame_t *frame = malloc(sizeof(dt_control_merge_hdr_frame_t));
+  frame->in = dt_alloc_align_float((size_t)d->wd * d->ht);
+  if(!frame->in)
+  {
+    free(frame);
+    d->abort = TRUE;
+    return 1;
+  }
+  memcpy(frame->in, ivoid, sizeof(float) * d->wd * d->ht);
+  frame->d = d;
+  frame->cal = 100.0f / (aperture * exp * iso);
+  // about proportional to how many photons we can expect from this shot:
+  frame->photoncnt = 100.0f * aperture * exp / iso;
+  frame->saturation = saturation;
+  d->whitelevel = fmaxf(d->whitelevel, saturation * frame->cal);
+  frame->whitelevel = d->whitelevel;
 
-      if(M + offset >= saturation)
-      {
-        if(d->weight[x + d->wd * y] <= 0.0f)
-        { // only consider saturated pixels in case we have nothing better:
-          if(d->weight[x + d->wd * y] == 0 || m < -d->weight[x + d->wd * y])
-          {
-            if(m + offset >= saturation)
-              d->pixels[x + d->wd * y] = 1.0f; // let's admit we were completely clipped, too
-            else
-              d->pixels[x + d->wd * y] = in * cal / d->whitelevel;
-            d->weight[x + d->wd * y]
-                = -m; // could use -cal here, but m is per pixel and safer for varying illumination conditions
-          }
-        }
-        // else silently ignore, others have filled in a better color here already
-      }
-      else
-      {
-        if(d->weight[x + d->wd * y] <= 0.0)
-        { // cleanup potentially blown highlights from earlier images
-          d->pixels[x + d->wd * y] = 0.0f;
-          d->weight[x + d->wd * y] = 0.0f;
-        }
-        d->pixels[x + d->wd * y] += w * in * cal;
-        d->weight[x + d->wd * y] += w;
-      }
-    }
+  // frames have to be merged in order, and we keep at most one in flight
+  _merge_hdr_wait(d);
+  d->merger = g_thread_new("merge hdr", _merge_hdr_accumulate, frame);
 
   return 0;
 }
@@ -509,6 +583,7 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
     num++;
   }
 
+  _merge_hdr_wait(&d);
   if(d.abort) goto end;
 
 // normalize by white level to make clipping at 1.0 work as expected
@@ -564,6 +639,7 @@ static int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
   dt_control_queue_redraw_center();
 
 end:
+  _merge_hdr_wait(&d);
   free(d.pixels);
   free(d.weight);
 
@@ -582,21 +658,26 @@ static int32_t dt_control_duplicate_images_job_run(dt_job_t *job)
 
   snprintf(message, sizeof(message), ngettext("duplicating %d image", "duplicating %d images", total), total);
   dt_control_job_set_progress_message(job, message);
+  gboolean duplicated = FALSE;
   while(t)
   {
     const int imgid = GPOINTER_TO_INT(t->data);
-    const int newimgid = dt_image_duplicate(imgid);
+    // the collection is reloaded once all the duplicates exist
+    const int newimgid = dt_image_duplicate_no_reload(imgid);
     if(newimgid != -1)
     {
       if(GPOINTER_TO_INT(params->data))
         dt_history_delete_on_image(newimgid);
       else
+      {
         dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL, TRUE, TRUE);
+        // same history, same thumbnails: reuse the ones on disk instead of processing the duplicate again
+        dt_mipmap_cache_copy_thumbnails(darktable.mipmap_cache, newimgid, imgid);
+      }
 
       // a duplicate should keep the change time stamp of the original
       dt_image_cache_set_change_timestamp_from_image(darktable.image_cache, newimgid, imgid);
-
-      dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, NULL);
+      duplicated = TRUE;
     }
     t = g_list_next(t);
     fraction += 1.0 / total;
@@ -605,6 +686,9 @@ static int32_t dt_control_duplicate_images_job_run(dt_job_t *job)
 
   dt_undo_end_group(darktable.undo);
 
+  if(duplicated)
+    dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_UNDEF, NULL);
+
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
   dt_control_queue_redraw_center();
   return 0;
@@ -1313,6 +1397,216 @@ static int32_t dt_control_refresh_exif_run(dt_job_t *job)
 }
 
 
+// state shared by all the threads of one export job
+typedef struct dt_control_export_state_t
+{
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_data_t *fdata;
+  dt_export_metadata_t *metadata;
+  guint tagid, etagid;
+  gboolean tag_change;
+  GList *t;            // next image to export
+  GList *f;            // its file, for dt_control_export_files()
+  guint total, done;
+  int omp_threads;     // OpenMP threads per export thread
+  int numa_nodes;      // export threads are spread over that many NUMA nodes, 1 for no binding
+  int threads;         // export threads started so far
+  dt_pthread_mutex_t lock;
+} dt_control_export_state_t;
+
+// export one image with its own (thread-private) format data, to the storage or to filename if set.
+// Returns non-zero if the export has to stop.
+static int _export_image(dt_control_export_state_t *state, dt_imageio_module_data_t *fdata, const int imgid,
+                         const guint num, const char *filename)
+{
+  dt_control_export_t *settings = state->settings;
+  int res = 0;
+  gboolean written = FALSE;
+
+  // check if image still exists:
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
+  if(image)
+  {
+    char imgfilename[PATH_MAX] = { 0 };
+    gboolean from_cache = TRUE;
+    dt_image_full_path(image->id,  imgfilename,  sizeof(imgfilename),  &from_cache, __FUNCTION__);
+    if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
+    {
+      dt_control_log(_("image `%s' is currently unavailable"), image->filename);
+      fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
+      // dt_image_remove(imgid);
+      dt_image_cache_read_release(darktable.image_cache, image);
+    }
+    else
+    {
+      dt_image_cache_read_release(darktable.image_cache, image);
+      if(filename)
+        // a failed file doesn't stop the others, the caller is told about each one
+        written = !dt_imageio_export(imgid, filename, state->mformat, fdata, TRUE, FALSE, settings->export_masks,
+                                     settings->icc_type, settings->icc_filename, settings->icc_intent, NULL,
+                                     NULL, num, state->total, state->metadata);
+      else
+      {
+        res = state->mstorage->store(state->mstorage, state->sdata, imgid, state->mformat, fdata, num,
+                                     state->total, TRUE, settings->export_masks, settings->icc_type,
+                                     settings->icc_filename, settings->icc_intent, state->metadata);
+        // a restart won't write it again
+        if(!res) dt_export_queue_image_done(settings->queue_id, imgid);
+      }
+    }
+  }
+
+  if(filename && settings->image_done) settings->image_done(imgid, filename, written, settings->user_data);
+  return res;
+}
+
+// pick the next image to export and do the bookkeeping on it. Returns -1 when there is nothing left.
+static int _export_next_image(dt_control_export_state_t *state, guint *num, const char **filename)
+{
+  dt_pthread_mutex_lock(&state->lock);
+  if(!state->t || dt_control_job_get_state(state->job) == DT_JOB_STATE_CANCELLED)
+  {
+    dt_pthread_mutex_unlock(&state->lock);
+    return -1;
+  }
+
+  const int imgid = GPOINTER_TO_INT(state->t->data);
+  state->t = g_list_next(state->t);
+  *num = state->total - g_list_length(state->t);
+  *filename = state->f ? (const char *)state->f->data : NULL;
+  state->f = g_list_next(state->f);
+
+  // progress message
+  char message[512] = { 0 };
+  if(state->mstorage)
+    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), *num, state->total,
+             state->mstorage->name(state->mstorage));
+  else
+    snprintf(message, sizeof(message), _("exporting %d / %d"), *num, state->total);
+  // update the message. initialize_store() might have changed the number of images
+  dt_control_job_set_progress_message(state->job, message);
+
+  // remove 'changed' tag from image
+  if(dt_tag_detach(state->tagid, imgid, FALSE, FALSE)) state->tag_change = TRUE;
+  // make sure the 'exported' tag is set on the image
+  if(dt_tag_attach(state->etagid, imgid, FALSE, FALSE)) state->tag_change = TRUE;
+
+  /* register export timestamp in cache */
+  dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
+
+  dt_pthread_mutex_unlock(&state->lock);
+  return imgid;
+}
+
+static void _export_image_done(dt_control_export_state_t *state, const int res)
+{
+  dt_pthread_mutex_lock(&state->lock);
+  if(res != 0) dt_control_job_cancel(state->job);
+  state->done++;
+  dt_control_job_set_progress(state->job, MIN(1.0, (double)state->done / state->total));
+  dt_pthread_mutex_unlock(&state->lock);
+}
+
+static void *_export_thread(void *data)
+{
+  dt_control_export_state_t *state = (dt_control_export_state_t *)data;
+  dt_pthread_setname("export");
+
+  // keep the pipe of this thread, its OpenMP threads and the memory they touch first on one socket
+  if(state->numa_nodes > 1)
+  {
+    dt_pthread_mutex_lock(&state->lock);
+    const int node = state->threads++ % state->numa_nodes;
+    dt_pthread_mutex_unlock(&state->lock);
+    if(!dt_pthread_bind_numa_node(node))
+      dt_print(DT_DEBUG_PERF, "[export] export thread bound to NUMA node %i\n", node);
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(state->omp_threads);
+#endif
+
+  // each thread gets its own fdata (one jpeg struct per thread etc), the pixelpipe is created per image
+  dt_imageio_module_data_t *fdata = state->mformat->get_params(state->mformat);
+  if(!fdata) return NULL;
+  memcpy(fdata, state->fdata, state->mformat->params_size(state->mformat));
+
+  guint num = 0;
+  int imgid;
+  const char *filename;
+  while((imgid = _export_next_image(state, &num, &filename)) >= 0)
+    _export_image_done(state, _export_image(state, fdata, imgid, num, filename));
+
+  state->mformat->free_params(state->mformat, fdata);
+  return NULL;
+}
+
+/* number of images to export at once. Each one runs its own pixelpipe, so that is bounded by the host
+   memory we are allowed to use, by the CPU cores (a pipe without OpenCL device should still get a few
+   cores for its own OpenMP loops) and by the number of OpenCL devices that can take a pipe each.
+   Storages merging all images in a single output (gallery, pdf...) always export serially.
+ */
+static int _export_parallel_jobs(dt_control_export_state_t *state, const uint32_t w, const uint32_t h)
+{
+  if(state->total < 2 || (state->mstorage && state->mstorage->finalize_store)
+     || (state->mformat->flags(state->fdata) & FORMAT_FLAGS_NO_TMPFILE))
+    return 1;
+
+  int jobs = dt_conf_get_int("export_parallel_images");
+  if(jobs <= 0)
+  {
+    // a pipe holds a few 4×float buffers of the full image before the final downscaling: be conservative
+    // with full-size exports, we don't know the size of the images yet.
+    const size_t pixels = (w > 0 && h > 0) ? (size_t)w * h : (size_t)64 * 1024 * 1024;
+    const size_t per_image = MAX((size_t)256 * 1024 * 1024, pixels * 4 * sizeof(float) * 8);
+    const int by_memory = MAX(1, (int)(dt_get_available_mem() / per_image));
+
+    int devices = 0;
+#ifdef HAVE_OPENCL
+    if(dt_opencl_is_inited()) devices = darktable.opencl->num_devs;
+#endif
+    const int by_cores = MAX(1, (int)dt_get_num_threads() / 4) + devices;
+    jobs = MIN(by_memory, by_cores);
+  }
+
+  jobs = CLAMP(jobs, 1, (int)state->total);
+  dt_print(DT_DEBUG_PERF, "[export] exporting %i images in parallel\n", jobs);
+  return jobs;
+}
+
+// export all the images of state, in parallel when possible
+static void _export_run(dt_control_export_state_t *state)
+{
+  dt_imageio_module_data_t *fdata = state->fdata;
+  const int jobs = _export_parallel_jobs(state, fdata->max_width, fdata->max_height);
+  if(jobs > 1)
+  {
+    // split the cores between the export threads
+    state->omp_threads = MAX(1, darktable.num_openmp_threads / jobs);
+    if(dt_conf_get_bool("export_numa_binding")) state->numa_nodes = MIN(dt_pthread_numa_nodes(), jobs);
+    pthread_t *threads = (pthread_t *)calloc(jobs, sizeof(pthread_t));
+    int started = 0;
+    for(int k = 0; k < jobs; k++)
+      if(!dt_pthread_create(&threads[started], _export_thread, state)) started++;
+
+    // if no thread could be started, do the work ourselves
+    if(started == 0) _export_thread(state);
+    for(int k = 0; k < started; k++) pthread_join(threads[k], NULL);
+    free(threads);
+  }
+  else
+  {
+    guint num = 0;
+    int imgid;
+    const char *filename;
+    while((imgid = _export_next_image(state, &num, &filename)) >= 0)
+      _export_image_done(state, _export_image(state, fdata, imgid, num, filename));
+  }
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -1326,8 +1620,10 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
 
   gboolean tag_change = FALSE;
 
-  // get a thread-safe fdata struct (one jpeg struct per thread etc):
+  // get a thread-safe fdata struct (one jpeg struct per thread etc), with the params of the format at the time
+  // the export was queued:
   dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
+  if(settings->fdata) memcpy(fdata, settings->fdata, mformat->params_size(mformat));
 
   if(mstorage->initialize_store)
   {
@@ -1362,8 +1658,6 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   else
     dt_control_log(_("no image to export"));
 
-  double fraction = 0;
-
   // set up the fdata struct
   fdata->max_width = (settings->max_width != 0 && w != 0) ? MIN(w, settings->max_width) : MAX(w, settings->max_width);
   fdata->max_height = (settings->max_height != 0 && h != 0) ? MIN(h, settings->max_height) : MAX(h, settings->max_height);
@@ -1384,54 +1678,28 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     metadata.list = g_list_remove(metadata.list, metadata.list->data);
   }
 
-  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
-  {
-    const int imgid = GPOINTER_TO_INT(t->data);
-    t = g_list_next(t);
-    const guint num = total - g_list_length(t);
-
-    // progress message
-    char message[512] = { 0 };
-    snprintf(message, sizeof(message), _("exporting %d / %d to %s"), num, total, mstorage->name(mstorage));
-    // update the message. initialize_store() might have changed the number of images
-    dt_control_job_set_progress_message(job, message);
-
-    // remove 'changed' tag from image
-    if(dt_tag_detach(tagid, imgid, FALSE, FALSE)) tag_change = TRUE;
-    // make sure the 'exported' tag is set on the image
-    if(dt_tag_attach(etagid, imgid, FALSE, FALSE)) tag_change = TRUE;
-
-    /* register export timestamp in cache */
-    dt_image_cache_set_export_timestamp(darktable.image_cache, imgid);
-
-    // check if image still exists:
-    const dt_image_t *image = dt_image_cache_get(darktable.image_cache, (int32_t)imgid, 'r');
-    if(image)
-    {
-      char imgfilename[PATH_MAX] = { 0 };
-      gboolean from_cache = TRUE;
-      dt_image_full_path(image->id,  imgfilename,  sizeof(imgfilename),  &from_cache, __FUNCTION__);
-      if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR))
-      {
-        dt_control_log(_("image `%s' is currently unavailable"), image->filename);
-        fprintf(stderr, "image `%s' is currently unavailable\n", imgfilename);
-        // dt_image_remove(imgid);
-        dt_image_cache_read_release(darktable.image_cache, image);
-      }
-      else
-      {
-        dt_image_cache_read_release(darktable.image_cache, image);
-        if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, TRUE,
-                           settings->export_masks, settings->icc_type, settings->icc_filename, settings->icc_intent,
-                           &metadata) != 0)
-          dt_control_job_cancel(job);
-      }
-    }
-
-    fraction += 1.0 / total;
-    if(fraction > 1.0) fraction = 1.0;
-    dt_control_job_set_progress(job, fraction);
-  }
+  dt_control_export_state_t state = { .job = job,
+                                      .settings = settings,
+                                      .mformat = mformat,
+                                      .mstorage = mstorage,
+                                      .sdata = sdata,
+                                      .fdata = fdata,
+                                      .metadata = &metadata,
+                                      .tagid = tagid,
+                                      .etagid = etagid,
+                                      .tag_change = FALSE,
+                                      .t = t,
+                                      .total = total,
+                                      .done = 0,
+                                      .omp_threads = darktable.num_openmp_threads,
+                                      .numa_nodes = 1,
+                                      .threads = 0 };
+  dt_pthread_mutex_init(&state.lock, NULL);
+
+  _export_run(&state);
+
+  tag_change = state.tag_change;
+  dt_pthread_mutex_destroy(&state.lock);
   g_list_free_full(metadata.list, g_free);
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
@@ -1447,6 +1715,45 @@ end:
   return 0;
 }
 
+static int32_t dt_control_export_files_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
+  dt_control_export_t *settings = (dt_control_export_t *)params->data;
+  dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(settings->format_index);
+  g_assert(mformat);
+
+  guint tagid = 0, etagid = 0;
+  dt_tag_new("darktable|changed", &tagid);
+  dt_tag_new("darktable|exported", &etagid);
+
+  dt_control_export_state_t state = { .job = job,
+                                      .settings = settings,
+                                      .mformat = mformat,
+                                      .mstorage = NULL,
+                                      .sdata = NULL,
+                                      .fdata = settings->fdata,
+                                      .metadata = NULL,
+                                      .tagid = tagid,
+                                      .etagid = etagid,
+                                      .tag_change = FALSE,
+                                      .t = params->index,
+                                      .f = settings->filenames,
+                                      .total = g_list_length(params->index),
+                                      .done = 0,
+                                      .omp_threads = darktable.num_openmp_threads,
+                                      .numa_nodes = 1,
+                                      .threads = 0 };
+  dt_pthread_mutex_init(&state.lock, NULL);
+
+  _export_run(&state);
+
+  dt_pthread_mutex_destroy(&state.lock);
+
+  if(settings->done) settings->done(settings->user_data);
+  if(state.tag_change) DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+  return 0;
+}
+
 static dt_control_image_enumerator_t *dt_control_gpx_apply_alloc()
 {
   dt_control_image_enumerator_t *params = dt_control_image_enumerator_alloc();
@@ -1820,10 +2127,19 @@ static void dt_control_export_cleanup(void *p)
   dt_control_image_enumerator_t *params = p;
 
   dt_control_export_t *settings = (dt_control_export_t *)params->data;
-  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(settings->storage_index);
-  dt_imageio_module_data_t *sdata = settings->sdata;
-
-  mstorage->free_params(mstorage, sdata);
+  // the job is done or discarded. when darktable is quitting, it is left to the next start
+  if(settings->queue_id && dt_control_running()) dt_export_queue_remove(settings->queue_id);
+  if(settings->storage_index >= 0)
+  {
+    dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(settings->storage_index);
+    mstorage->free_params(mstorage, settings->sdata);
+  }
+  if(settings->fdata)
+  {
+    dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(settings->format_index);
+    mformat->free_params(mformat, settings->fdata);
+  }
+  g_list_free_full(settings->filenames, g_free);
 
   g_free(settings->icc_filename);
   g_free(settings->metadata_export);
@@ -1832,17 +2148,25 @@ static void dt_control_export_cleanup(void *p)
   dt_control_image_enumerator_cleanup(params);
 }
 
-void dt_control_export(GList *imgid_list, int max_width, int max_height, int format_index, int storage_index,
-                       gboolean high_quality, gboolean export_masks, char *style, gboolean style_append,
-                       dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
-                       dt_iop_color_intent_t icc_intent, const gchar *metadata_export)
+// queue the export of imgid_list with the format and storage params fdata and sdata, the job takes over all
+// three. queue_id is the entry of the export in main.export_queue, 0 if none
+static void _control_export(GList *imgid_list, const int max_width, const int max_height, const int format_index,
+                            const int storage_index, dt_imageio_module_data_t *fdata,
+                            dt_imageio_module_data_t *sdata, const gboolean export_masks, const char *style,
+                            const gboolean style_append, dt_colorspaces_color_profile_type_t icc_type,
+                            const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+                            const gchar *metadata_export, const int32_t queue_id)
 {
   dt_job_t *job = dt_control_job_create(&dt_control_export_job_run, "export");
-  if(!job) return;
-  dt_control_image_enumerator_t *params = dt_control_export_alloc();
+  dt_control_image_enumerator_t *params = job ? dt_control_export_alloc() : NULL;
   if(!params)
   {
-    dt_control_job_dispose(job);
+    if(job) dt_control_job_dispose(job);
+    g_list_free(imgid_list);
+    dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(format_index);
+    mformat->free_params(mformat, fdata);
+    dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(storage_index);
+    mstorage->free_params(mstorage, sdata);
     return;
   }
   dt_control_job_set_params(job, params, dt_control_export_cleanup);
@@ -1854,17 +2178,7 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
   data->max_height = max_height;
   data->format_index = format_index;
   data->storage_index = storage_index;
-  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(storage_index);
-  g_assert(mstorage);
-  // get shared storage param struct (global sequence counter, one picasa connection etc)
-  dt_imageio_module_data_t *sdata = mstorage->get_params(mstorage);
-  if(sdata == NULL)
-  {
-    dt_control_log(_("failed to get parameters from storage module `%s', aborting export.."),
-                   mstorage->name(mstorage));
-    dt_control_job_dispose(job);
-    return;
-  }
+  data->fdata = fdata;
   data->sdata = sdata;
   data->export_masks = export_masks;
   g_strlcpy(data->style, style, sizeof(data->style));
@@ -1873,14 +2187,153 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
   data->icc_filename = g_strdup(icc_filename);
   data->icc_intent = icc_intent;
   data->metadata_export = g_strdup(metadata_export);
+  data->queue_id = queue_id;
 
   dt_control_job_add_progress(job, _("export images"), TRUE);
   dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_EXPORT, job);
+}
+
+void dt_control_export(GList *imgid_list, int max_width, int max_height, int format_index, int storage_index,
+                       gboolean high_quality, gboolean export_masks, char *style, gboolean style_append,
+                       dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
+                       dt_iop_color_intent_t icc_intent, const gchar *metadata_export)
+{
+  dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_index(format_index);
+  g_assert(mformat);
+  dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(storage_index);
+  g_assert(mstorage);
+  // get shared storage param struct (global sequence counter, one picasa connection etc)
+  dt_imageio_module_data_t *sdata = mstorage->get_params(mstorage);
+  if(sdata == NULL)
+  {
+    dt_control_log(_("failed to get parameters from storage module `%s', aborting export.."),
+                   mstorage->name(mstorage));
+    g_list_free(imgid_list);
+    return;
+  }
+  dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
+  if(fdata == NULL)
+  {
+    dt_control_log(_("failed to get parameters from format module `%s', aborting export.."),
+                   mformat->name());
+    mstorage->free_params(mstorage, sdata);
+    g_list_free(imgid_list);
+    return;
+  }
+
+  // record the export to resume it after a restart
+  int32_t queue_id = 0;
+  if(dt_export_queue_supported(mstorage))
+  {
+    dt_export_queue_entry_t entry = { .imgs = imgid_list,
+                                      .format_version = mformat->version(),
+                                      .storage_version = mstorage->version(),
+                                      .format_params = fdata,
+                                      .storage_params = sdata,
+                                      .format_size = mformat->params_size(mformat),
+                                      .storage_size = mstorage->params_size(mstorage),
+                                      .max_width = max_width,
+                                      .max_height = max_height,
+                                      .high_quality = high_quality,
+                                      .export_masks = export_masks,
+                                      .style_append = style_append,
+                                      .icc_type = icc_type,
+                                      .icc_filename = (gchar *)icc_filename,
+                                      .icc_intent = icc_intent,
+                                      .metadata_export = (gchar *)metadata_export };
+    g_strlcpy(entry.format, mformat->plugin_name, sizeof(entry.format));
+    g_strlcpy(entry.storage, mstorage->plugin_name, sizeof(entry.storage));
+    g_strlcpy(entry.style, style, sizeof(entry.style));
+    queue_id = dt_export_queue_add(&entry);
+  }
+
+  _control_export(imgid_list, max_width, max_height, format_index, storage_index, fdata, sdata, export_masks,
+                  style, style_append, icc_type, icc_filename, icc_intent, metadata_export, queue_id);
 
   // tell the storage that we got its params for an export so it can reset itself to a safe state
   mstorage->export_dispatched(mstorage);
 }
 
+void dt_control_export_resume()
+{
+  GList *pending = dt_export_queue_pending();
+  int resumed = 0;
+  for(GList *l = pending; l; l = g_list_next(l))
+  {
+    dt_export_queue_entry_t *entry = (dt_export_queue_entry_t *)l->data;
+    dt_imageio_module_format_t *mformat = dt_imageio_get_format_by_name(entry->format);
+    dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_name(entry->storage);
+    // the modules must still be there and read their params the same way
+    dt_imageio_module_data_t *fdata = NULL, *sdata = NULL;
+    if(mformat && mstorage && dt_export_queue_supported(mstorage) && mformat->version() == entry->format_version
+       && mstorage->version() == entry->storage_version && mformat->params_size(mformat) == entry->format_size
+       && mstorage->params_size(mstorage) == entry->storage_size)
+    {
+      fdata = mformat->get_params(mformat);
+      sdata = mstorage->get_params(mstorage);
+    }
+    if(!fdata || !sdata)
+    {
+      dt_print(DT_DEBUG_IMAGEIO, "[export] can't resume the export %d to `%s'\n", entry->id, entry->storage);
+      if(fdata) mformat->free_params(mformat, fdata);
+      if(sdata) mstorage->free_params(mstorage, sdata);
+      dt_export_queue_remove(entry->id);
+      continue;
+    }
+    memcpy(fdata, entry->format_params, entry->format_size);
+    memcpy(sdata, entry->storage_params, entry->storage_size);
+
+    resumed += g_list_length(entry->imgs);
+    _control_export(entry->imgs, entry->max_width, entry->max_height, dt_imageio_get_index_of_format(mformat),
+                    dt_imageio_get_index_of_storage(mstorage), fdata, sdata, entry->export_masks, entry->style,
+                    entry->style_append, entry->icc_type, entry->icc_filename, entry->icc_intent,
+                    entry->metadata_export, entry->id);
+    // taken over by the job
+    entry->imgs = NULL;
+  }
+  g_list_free_full(pending, (GDestroyNotify)dt_export_queue_entry_free);
+
+  if(resumed)
+    dt_control_log(ngettext("resuming the interrupted export of %d image",
+                            "resuming the interrupted export of %d images", resumed), resumed);
+}
+
+void dt_control_export_files(GList *imgid_list, GList *filenames, dt_imageio_module_format_t *format,
+                             dt_imageio_module_data_t *fdata, dt_control_export_image_callback_t image_done,
+                             void (*done)(gpointer user_data), gpointer user_data)
+{
+  dt_job_t *job = dt_control_job_create(&dt_control_export_files_job_run, "export files");
+  dt_control_image_enumerator_t *params = job ? dt_control_export_alloc() : NULL;
+  if(!params)
+  {
+    if(job) dt_control_job_dispose(job);
+    g_list_free(imgid_list);
+    g_list_free_full(filenames, g_free);
+    format->free_params(format, fdata);
+    return;
+  }
+  dt_control_job_set_params(job, params, dt_control_export_cleanup);
+
+  params->index = imgid_list;
+
+  dt_control_export_t *data = params->data;
+  data->format_index = dt_imageio_get_index_of_format(format);
+  data->storage_index = -1;
+  data->filenames = filenames;
+  data->fdata = fdata;
+  data->image_done = image_done;
+  data->done = done;
+  data->user_data = user_data;
+  // the same settings as the single image exports of lua
+  data->export_masks = dt_conf_get_bool("plugins/lighttable/export/export_masks");
+  data->icc_type = sanitize_colorspaces(dt_conf_get_int("plugins/lighttable/export/icctype"));
+  data->icc_filename = dt_conf_get_string("plugins/lighttable/export/iccprofile");
+  data->icc_intent = DT_INTENT_LAST;
+
+  dt_control_job_add_progress(job, _("export images"), TRUE);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_EXPORT, job);
+}
+
 static void _add_datetime_offset(const char *odt, const long int offset, char *ndt)
 {
   // get the datetime_taken and calculate the new time
@@ -2307,35 +2760,24 @@ void _write_xmp_id(const char *filename, int32_t imgid)
 }
 
 /**
- * @brief process to copy (or not) and import an image to database.
+ * @brief import an image, copied already if needed, to database.
  *
- * @param img the current image.
+ * @param filename the original file path.
+ * @param img_path_to_db the file path to import, empty if the copy failed.
  * @param data info from import module.
- * @param index current loop's index.
  * @return gboolean
  */
-gboolean _import_image(const GList *img, dt_control_import_t *data, const int index, GList **discarded)
+gboolean _import_image(const char *filename, const char *img_path_to_db, dt_control_import_t *data)
 {
-  const char *filename = (const char*) img->data;
   fprintf(stdout, "Filename: %s\n", filename);
 
-  gchar img_path_to_db[PATH_MAX] = { 0 };
-  gboolean process_error = 0;
-
-  if(data->copy)
-    // Copy the file to destination folder, expanding variables internally
-    process_error = _import_copy_file(filename, index, data, img_path_to_db, sizeof(img_path_to_db), discarded);
-  else
-    // destination = origin, nothing to do
-    g_strlcpy(img_path_to_db, filename, sizeof(img_path_to_db));
-
-  process_error |= (*img_path_to_db == 0);
+  gboolean process_error = (*img_path_to_db == 0);
 
   if(process_error)
     fprintf(stdout, "Process Error\n");
   else
   {
-    const int32_t imgid = _import_job(data, img_path_to_db);
+    const int32_t imgid = _import_job(data, (gchar *)img_path_to_db);
 
     if(imgid == -1)
     {
@@ -2355,6 +2797,68 @@ gboolean _import_image(const GList *img, dt_control_import_t *data, const int in
   return process_error;
 }
 
+/* Files are copied to their destination by a few threads, ahead of the job thread which adds them to the
+   database in their original order. The database writes are grouped in transactions of a few images and
+   the lighttable is refreshed after each of them. EXIF and XMP are read by the database stage, as they are
+   stored right away under the new image id, and exiv2 is serialised anyway. */
+typedef struct dt_control_import_state_t
+{
+  dt_control_import_t *data;
+  GList *next;   // next file to copy
+  int next_index;
+  gchar **paths; // per file, the path to import once copied, empty if the copy failed
+  gboolean stop;
+  dt_pthread_mutex_t lock;
+  pthread_cond_t copied;
+} dt_control_import_state_t;
+
+static void *_import_copy_thread(void *user_data)
+{
+  dt_control_import_state_t *state = (dt_control_import_state_t *)user_data;
+  dt_pthread_setname("import");
+
+  // dt_build_filename_from_pattern() stores the target directory in the import data: use our own
+  dt_control_import_t data = *state->data;
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&state->lock);
+    const GList *img = state->stop ? NULL : state->next;
+    const int index = state->next_index;
+    if(img)
+    {
+      state->next = g_list_next(img);
+      state->next_index++;
+    }
+    dt_pthread_mutex_unlock(&state->lock);
+    if(!img) break;
+
+    gchar img_path_to_db[PATH_MAX] = { 0 };
+    GList *discarded = NULL;
+    data.target_dir = NULL;
+    // Copy the file to destination folder, expanding variables internally
+    const gboolean error = _import_copy_file((const char *)img->data, index, &data, img_path_to_db,
+                                             sizeof(img_path_to_db), &discarded);
+    g_free(data.target_dir);
+
+    dt_pthread_mutex_lock(&state->lock);
+    state->paths[index] = g_strdup(error ? "" : img_path_to_db);
+    state->data->discarded = g_list_concat(discarded, state->data->discarded);
+    pthread_cond_broadcast(&state->copied);
+    dt_pthread_mutex_unlock(&state->lock);
+  }
+  return NULL;
+}
+
+static const char *_import_wait_copied(dt_control_import_state_t *state, const int index)
+{
+  dt_pthread_mutex_lock(&state->lock);
+  while(!state->paths[index]) dt_pthread_cond_wait(&state->copied, &state->lock);
+  const char *path = state->paths[index];
+  dt_pthread_mutex_unlock(&state->lock);
+  return path;
+}
+
 void _refresh_progress_counter(dt_job_t *job, const int elements, const int index)
 {
   gchar message[32] = { 0 };
@@ -2372,25 +2876,79 @@ static int32_t _control_import_job_run(dt_job_t *job)
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
   dt_control_import_t *data = params->data;
 
+  const int total = g_list_length(data->imgs);
+  dt_control_import_state_t state = { .data = data,
+                                      .next = data->imgs,
+                                      .next_index = 0,
+                                      .paths = (gchar **)g_malloc0_n(MAX(total, 1), sizeof(gchar *)),
+                                      .stop = FALSE };
+  dt_pthread_mutex_init(&state.lock, NULL);
+  pthread_cond_init(&state.copied, NULL);
+
+  int threads_count = 0;
+  pthread_t *threads = NULL;
+  if(data->copy && total > 0)
+  {
+    const int copiers = CLAMP(dt_conf_get_int("import_copy_threads"), 1, total);
+    threads = (pthread_t *)calloc(copiers, sizeof(pthread_t));
+    for(int k = 0; k < copiers; k++)
+      if(!dt_pthread_create(&threads[threads_count], _import_copy_thread, &state)) threads_count++;
+    // if no thread could be started, copy everything ourselves
+    if(threads_count == 0) _import_copy_thread(&state);
+  }
+
+  const int batch_size = MAX(1, dt_conf_get_int("import_batch_size"));
+  int in_batch = 0;
+  gboolean in_transaction = FALSE;
   int index = 0;
 
   for(GList *img = g_list_first(data->imgs); img; img = g_list_next(img))
   {
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) break;
+
     fprintf(stdout, "\nIMG %i.\n", index + 1);
 
     _refresh_progress_counter(job, data->elements, index);
 
-    if(_import_image(img, data, index, &data->discarded))
+    // destination = origin if not copying, nothing to do
+    const char *filename = (const char *)img->data;
+    const char *img_path_to_db = data->copy ? _import_wait_copied(&state, index) : filename;
+
+    if(!in_transaction) dt_database_start_transaction(darktable.db);
+    in_transaction = TRUE;
+
+    if(_import_image(filename, img_path_to_db, data))
       fprintf(stderr, "Skipping this one.\n");
     else
     {
       data->total_imported_elements += 1;
+      in_batch++;
       fprintf(stdout, "N: %i\n", data->total_imported_elements);
     }
     index++;
 
+    if(in_batch >= batch_size)
+    {
+      dt_database_release_transaction(darktable.db);
+      in_transaction = FALSE;
+      in_batch = 0;
+      // show what we have so far
+      if(img->next) DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, data->filmid);
+    }
+
     fprintf(stdout, "BOTTOM LOOP.\n\n");
   }
+  if(in_transaction) dt_database_release_transaction(darktable.db);
+
+  dt_pthread_mutex_lock(&state.lock);
+  state.stop = TRUE;
+  dt_pthread_mutex_unlock(&state.lock);
+  for(int k = 0; k < threads_count; k++) pthread_join(threads[k], NULL);
+  free(threads);
+  for(int k = 0; k < total; k++) g_free(state.paths[k]);
+  g_free(state.paths);
+  pthread_cond_destroy(&state.copied);
+  dt_pthread_mutex_destroy(&state.lock);
 
   if(data->total_imported_elements == 0 && data->filmid == -1)
   {
@@ -67,6 +67,17 @@ void dt_control_export(GList *imgid_list, int max_width, int max_height, int for
                        char *style, gboolean style_append,
                        dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
                        dt_iop_color_intent_t icc_intent, const gchar *metadata_export);
+/** queue again the exports interrupted by the end of the last session, see common/export_queue.h */
+void dt_control_export_resume();
+/** called from the export threads after each image of dt_control_export_files() */
+typedef void (*dt_control_export_image_callback_t)(const int32_t imgid, const char *filename,
+                                                   const gboolean success, gpointer user_data);
+/** export each image of imgid_list to the file at the same place in filenames, with format and fdata, which
+    the job takes over like both lists. the images go through the parallel export engine, without storage.
+    image_done is called for each image and done once they are all processed, both can be NULL */
+void dt_control_export_files(GList *imgid_list, GList *filenames, dt_imageio_module_format_t *format,
+                             dt_imageio_module_data_t *fdata, dt_control_export_image_callback_t image_done,
+                             void (*done)(gpointer user_data), gpointer user_data);
 void dt_control_merge_hdr();
 
 /**
@@ -62,6 +62,19 @@ dt_job_t *dt_image_load_job_create(int32_t id, dt_mipmap_size_t mip)
   return job;
 }
 
+static gboolean _image_load_job_unneeded(void *params, void *data)
+{
+  const dt_image_load_t *load = (dt_image_load_t *)params;
+  GHashTable *keep = (GHashTable *)data;
+  return !keep || !g_hash_table_contains(keep, GINT_TO_POINTER(load->imgid));
+}
+
+int dt_image_load_jobs_discard(dt_job_queue_t queue_id, GHashTable *keep)
+{
+  return dt_control_discard_jobs(darktable.control, queue_id, &dt_image_load_job_run, _image_load_job_unneeded,
+                                 keep);
+}
+
 typedef struct dt_image_import_t
 {
   uint32_t film_id;
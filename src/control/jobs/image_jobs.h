@@ -24,6 +24,9 @@
 #include <inttypes.h>
 
 dt_job_t *dt_image_load_job_create(int32_t imgid, dt_mipmap_size_t mip);
+/** drop the load jobs of queue_id not yet started for the images missing from keep, a set of GINT_TO_POINTER
+  * imgids. with keep == NULL, all of them are dropped. returns the number of dropped jobs. */
+int dt_image_load_jobs_discard(dt_job_queue_t queue_id, GHashTable *keep);
 
 dt_job_t *dt_image_import_job_create(uint32_t filmid, const char *filename);
 
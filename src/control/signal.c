@@ -240,6 +240,8 @@ typedef struct _signal_param_t
   GValue *instance_and_params;
   guint signal_id;
   guint n_params;
+  dt_signal_t signal;
+  GHashTable *ids; // image ids of the list parameter of a pending coalesced signal
 } _signal_param_t;
 
 static gboolean _signal_raise(gpointer user_data)
@@ -247,11 +249,144 @@ static gboolean _signal_raise(gpointer user_data)
   _signal_param_t *params = (_signal_param_t *)user_data;
   g_signal_emitv(params->instance_and_params, params->signal_id, 0, NULL);
   for(int i = 0; i <= params->n_params; i++) g_value_unset(&params->instance_and_params[i]);
+  if(params->ids) g_hash_table_destroy(params->ids);
   free(params->instance_and_params);
   free(params);
   return FALSE;
 }
 
+/* some signals are raised once per image by bulk operations (rating, tagging, geotagging 5000 images...) and
+   each emission refreshes the thumbtable and the side panels. such signals are not emitted right away but from
+   the next main loop iteration, and raising one again while it is still pending merges it into the pending one:
+   its other parameters must be the same, its list of image ids is added to the pending list.
+   returns whether signal is coalesced, list_param is the index of its list of image ids (0 if none) and
+   latest_param the index of a parameter taken from the latest raise rather than compared (0 if none). */
+static gboolean _signal_coalesces(const dt_signal_t signal, guint *list_param, guint *latest_param)
+{
+  *list_param = *latest_param = 0;
+  switch(signal)
+  {
+    case DT_SIGNAL_IMAGE_INFO_CHANGED:
+    case DT_SIGNAL_GEOTAG_CHANGED:
+      *list_param = 1;
+      return TRUE;
+    case DT_SIGNAL_COLLECTION_CHANGED:
+      // the image to move to after the change comes from the latest raise
+      *list_param = 3;
+      *latest_param = 4;
+      return TRUE;
+    case DT_SIGNAL_TAG_CHANGED:
+    case DT_SIGNAL_METADATA_CHANGED:
+    case DT_SIGNAL_FILMROLLS_CHANGED:
+    case DT_SIGNAL_DEVELOP_MIPMAP_UPDATED:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+// pending coalesced signals, in the order they were first raised
+static GMutex _pending_lock;
+static GList *_pending = NULL;
+
+static gboolean _signal_raise_pending(gpointer user_data)
+{
+  g_mutex_lock(&_pending_lock);
+  _pending = g_list_remove(_pending, user_data);
+  g_mutex_unlock(&_pending_lock);
+  return _signal_raise(user_data);
+}
+
+static gboolean _signal_params_equal(const GValue *a, const GValue *b)
+{
+  switch(G_VALUE_TYPE(a))
+  {
+    case G_TYPE_UINT:
+      return g_value_get_uint(a) == g_value_get_uint(b);
+    case G_TYPE_STRING:
+      return !g_strcmp0(g_value_get_string(a), g_value_get_string(b));
+    case G_TYPE_POINTER:
+      return g_value_get_pointer(a) == g_value_get_pointer(b);
+    default:
+      return FALSE;
+  }
+}
+
+// add the image ids of the list parameter of params to the pending signal, skipping those already there
+static void _signal_merge_ids(_signal_param_t *pending, const guint list_param, GList *imgs)
+{
+  GValue *value = &pending->instance_and_params[list_param];
+  GList *list = (GList *)g_value_get_pointer(value);
+
+  if(!pending->ids)
+  {
+    pending->ids = g_hash_table_new(NULL, NULL);
+    for(const GList *l = list; l; l = g_list_next(l)) g_hash_table_add(pending->ids, l->data);
+  }
+
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    if(g_hash_table_contains(pending->ids, l->data)) continue;
+    g_hash_table_add(pending->ids, l->data);
+    list = g_list_prepend(list, l->data);
+  }
+  g_value_set_pointer(value, list);
+}
+
+// queue params for the next main loop iteration, or merge them into the latest pending raise of the same
+// signal. params is consumed.
+static void _signal_coalesce(_signal_param_t *params, const guint list_param, const guint latest_param)
+{
+  g_mutex_lock(&_pending_lock);
+
+  _signal_param_t *pending = NULL;
+  for(GList *l = g_list_last(_pending); l; l = g_list_previous(l))
+  {
+    _signal_param_t *p = (_signal_param_t *)l->data;
+    if(p->signal == params->signal)
+    {
+      pending = p;
+      break;
+    }
+  }
+
+  // only the latest pending raise may take this one, so that raises with other parameters keep their order
+  for(guint i = 1; pending && i <= params->n_params; i++)
+  {
+    if(i == list_param || i == latest_param) continue;
+    if(!_signal_params_equal(&pending->instance_and_params[i], &params->instance_and_params[i])) pending = NULL;
+  }
+
+  if(!pending)
+  {
+    _pending = g_list_append(_pending, params);
+    g_mutex_unlock(&_pending_lock);
+    g_idle_add_full(G_PRIORITY_HIGH_IDLE, _signal_raise_pending, params, NULL);
+    return;
+  }
+
+  if(list_param)
+  {
+    GValue *value = &params->instance_and_params[list_param];
+    GList *imgs = (GList *)g_value_get_pointer(value);
+    _signal_merge_ids(pending, list_param, imgs);
+    // the merged list is freed by the destructor of the pending signal
+    g_list_free(imgs);
+    g_value_set_pointer(value, NULL);
+  }
+  if(latest_param)
+    g_value_copy(&params->instance_and_params[latest_param], &pending->instance_and_params[latest_param]);
+
+  g_mutex_unlock(&_pending_lock);
+
+  if(darktable.unmuted_signal_dbg_acts & DT_DEBUG_SIGNAL_ACT_RAISE && darktable.unmuted_signal_dbg[params->signal])
+    dt_print(DT_DEBUG_SIGNAL, "[signal] coalesced: %s\n", _signal_description[params->signal].name);
+
+  for(int i = 0; i <= params->n_params; i++) g_value_unset(&params->instance_and_params[i]);
+  free(params->instance_and_params);
+  free(params);
+}
+
 typedef struct async_com_data
 {
   GCond end_cond;
@@ -353,8 +488,15 @@ void dt_control_signal_raise(const dt_control_signal_t *ctlsig, dt_signal_t sign
   params->instance_and_params = instance_and_params;
   params->signal_id = g_signal_lookup(_signal_description[signal].name, _signal_type);
   params->n_params = signal_description->n_params;
+  params->signal = signal;
+  params->ids = NULL;
 
-  if(!signal_description->synchronous)
+  guint list_param, latest_param;
+  if(!signal_description->synchronous && _signal_coalesces(signal, &list_param, &latest_param))
+  {
+    _signal_coalesce(params, list_param, latest_param);
+  }
+  else if(!signal_description->synchronous)
   {
     g_main_context_invoke(NULL, _signal_raise, params);
   }
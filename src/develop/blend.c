@@ -24,6 +24,7 @@
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/masks.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "develop/imageop_math.h"
 #include <math.h>
@@ -236,17 +237,34 @@ static inline float _detail_mask_threshold(const float level, const gboolean det
   return 0.005f * (detail ? powf(level, 2.0f) : 1.0f - powf(fabs(level), 0.5f ));
 }
 
-static void _refine_with_detail_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *mask, const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out, const float level)
+// refine the raw detail mask for level, before distortion
+static float *_detail_mask_calc(struct dt_dev_pixelpipe_iop_t *piece, const float level)
 {
-  if(level == 0.0f) return;
-  const gboolean info = ((darktable.unmuted & DT_DEBUG_MASKS) && (piece->pipe->type == DT_DEV_PIXELPIPE_FULL));
-
   const gboolean detail = (level > 0.0f);
   const float threshold = _detail_mask_threshold(level, detail);
 
-  float *tmp = NULL;
-  float *lum = NULL;
-  float *warp_mask = NULL;
+  dt_dev_pixelpipe_t *p = piece->pipe;
+  const int iwidth  = p->rawdetail_mask_roi.width;
+  const int iheight = p->rawdetail_mask_roi.height;
+
+  float *tmp = dt_pixelpipe_alloc_align_float((size_t)iwidth * iheight);
+  float *lum = dt_alloc_align_float((size_t)iwidth * iheight);
+  if((tmp == NULL) || (lum == NULL))
+  {
+    dt_free_align(lum);
+    dt_pixelpipe_free_align(tmp);
+    return NULL;
+  }
+
+  dt_masks_calc_detail_mask(p->rawdetail_mask_data, lum, tmp, iwidth, iheight, threshold, detail);
+  dt_pixelpipe_free_align(tmp);
+  return lum;
+}
+
+static void _refine_with_detail_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *mask, const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out, const float level)
+{
+  if(level == 0.0f) return;
+  const gboolean info = ((darktable.unmuted & DT_DEBUG_MASKS) && (piece->pipe->type == DT_DEV_PIXELPIPE_FULL));
 
   dt_dev_pixelpipe_t *p = piece->pipe;
   if(p->rawdetail_mask_data == NULL) return;
@@ -257,22 +275,14 @@ static void _refine_with_detail_mask(struct dt_iop_module_t *self, struct dt_dev
   const int oheight = roi_out->height;
   if(info) fprintf(stderr, "[_refine_with_detail_mask] in module %s %ix%i --> %ix%i\n", self->op, iwidth, iheight, owidth, oheight);
 
-  const int bufsize = MAX(iwidth * iheight, owidth * oheight);
-
-  tmp = dt_alloc_align_float(bufsize);
-  lum = dt_alloc_align_float(bufsize);
-  if((tmp == NULL) || (lum == NULL)) goto error;
-
-  dt_masks_calc_detail_mask(p->rawdetail_mask_data, lum, tmp, iwidth, iheight, threshold, detail);
-  dt_free_align(tmp);
-  tmp = NULL;
-
-  // here we have the slightly blurred full detail mask available
-  warp_mask = dt_dev_distort_detail_mask(p, lum, self);
-  dt_free_align(lum);
-  lum = NULL;
-
-  if(warp_mask == NULL) goto error;
+  // the slightly blurred full detail mask distorted up to here, shared with the other modules using the same level.
+  // the pipe keeps it.
+  const float *const warp_mask = dt_dev_get_detail_mask(piece, level, _detail_mask_calc);
+  if(warp_mask == NULL)
+  {
+    dt_control_log(_("detail mask blending error"));
+    return;
+  }
 
   const int msize = owidth * oheight;
 #ifdef _OPENMP
@@ -284,15 +294,6 @@ static void _refine_with_detail_mask(struct dt_iop_module_t *self, struct dt_dev
   {
     mask[idx] = mask[idx] * warp_mask[idx];
   }
-  dt_free_align(warp_mask);
-
-  return;
-
-  error:
-  dt_control_log(_("detail mask blending error"));
-  dt_free_align(warp_mask);
-  dt_free_align(lum);
-  dt_free_align(tmp);
 }
 
 static size_t _develop_mask_get_post_operations(const dt_develop_blend_params_t *const params,
@@ -369,6 +370,135 @@ static inline void _develop_blend_process_free_region(float *const restrict inpu
   dt_free_align(input);
 }
 
+// find the smallest rectangle holding all the non-zero pixels of the mask, as { x, y, width, height }.
+// returns FALSE if the mask is empty.
+static gboolean _develop_blend_mask_bounding_box(const float *const restrict mask, const int width,
+                                                 const int height, int box[4])
+{
+  int xmin = width, xmax = -1, ymin = height, ymax = -1;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(mask, width, height) \
+  reduction(min:xmin, ymin) reduction(max:xmax, ymax) \
+  schedule(static)
+#endif
+  for(int y = 0; y < height; y++)
+  {
+    const float *const restrict row = mask + (size_t)y * width;
+    int first = 0;
+    while(first < width && !(row[first] > 0.f)) first++;
+    if(first == width) continue;
+
+    int last = width - 1;
+    while(last > first && !(row[last] > 0.f)) last--;
+
+    xmin = MIN(xmin, first);
+    xmax = MAX(xmax, last);
+    ymin = MIN(ymin, y);
+    ymax = MAX(ymax, y);
+  }
+
+  if(xmax < 0) return FALSE;
+
+  box[0] = xmin;
+  box[1] = ymin;
+  box[2] = xmax - xmin + 1;
+  box[3] = ymax - ymin + 1;
+  return TRUE;
+}
+
+// blend only the part of the image covered by the mask. In scene-referred RGB, non-reversed blend modes
+// reduce to the module input where the opacity is 0, so pixels outside of the bounding box of the mask
+// are copied from the input instead of running them through the blend operator.
+// returns FALSE if nothing was done, in which case the caller has to blend the full image.
+static gboolean _develop_blend_process_sparse(struct dt_dev_pixelpipe_iop_t *piece, const float *const restrict ivoid,
+                                              float *const restrict ovoid, const struct dt_iop_roi_t *const roi_in,
+                                              const struct dt_iop_roi_t *const roi_out,
+                                              const float *const restrict mask)
+{
+  if(piece->colors != 4) return FALSE;
+
+  const size_t ch = 4;
+  const int xoffs = roi_out->x - roi_in->x;
+  const int yoffs = roi_out->y - roi_in->y;
+  const int iwidth = roi_in->width;
+  const int owidth = roi_out->width;
+  const int oheight = roi_out->height;
+
+  int box[4] = { 0, 0, 0, 0 };
+  const gboolean empty = !_develop_blend_mask_bounding_box(mask, owidth, oheight, box);
+
+  // copying the box back and forth is not worth it when the mask covers most of the image
+  if(!empty && (size_t)box[2] * box[3] * 4 > (size_t)owidth * oheight * 3) return FALSE;
+
+  float *sub_out = NULL;
+  float *sub_mask = NULL;
+  if(!empty)
+  {
+    sub_out = _develop_blend_process_copy_region(ovoid, ch * owidth, ch * box[0], box[1], ch * box[2], box[3]);
+    sub_mask = _develop_blend_process_copy_region(mask, owidth, box[0], box[1], box[2], box[3]);
+    if(!sub_out || !sub_mask)
+    {
+      if(sub_out) _develop_blend_process_free_region(sub_out);
+      if(sub_mask) _develop_blend_process_free_region(sub_mask);
+      return FALSE;
+    }
+  }
+
+  // the blend operator writes the opacity into the alpha channel, unless an earlier module displays its mask
+  const gboolean keep_alpha = (piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) != 0;
+  const int x0 = empty ? owidth : box[0];
+  const int x1 = empty ? owidth : box[0] + box[2];
+  const int y0 = empty ? oheight : box[1];
+  const int y1 = empty ? oheight : box[1] + box[3];
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ivoid, ovoid, ch, xoffs, yoffs, iwidth, owidth, oheight, keep_alpha, x0, x1, y0, y1) \
+  schedule(static)
+#endif
+  for(int y = 0; y < oheight; y++)
+  {
+    const float *const restrict in = ivoid + ((size_t)(y + yoffs) * iwidth + xoffs) * ch;
+    float *const restrict out = ovoid + (size_t)y * owidth * ch;
+    const gboolean inside = (y >= y0 && y < y1);
+    for(int x = 0; x < owidth; x++)
+    {
+      if(inside && x == x0)
+      {
+        x = x1 - 1;
+        continue;
+      }
+      for(size_t c = 0; c < 3; c++) out[x * ch + c] = in[x * ch + c];
+      out[x * ch + 3] = keep_alpha ? in[x * ch + 3] : 0.f;
+    }
+  }
+
+  if(empty) return TRUE;
+
+  dt_iop_roi_t sub_roi = *roi_out;
+  sub_roi.x += box[0];
+  sub_roi.y += box[1];
+  sub_roi.width = box[2];
+  sub_roi.height = box[3];
+  dt_develop_blendif_rgb_jzczhz_blend(piece, ivoid, sub_out, roi_in, &sub_roi, sub_mask,
+                                      DT_DEV_PIXELPIPE_DISPLAY_NONE);
+
+  const size_t row_size = sizeof(float) * ch * box[2];
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(ovoid, sub_out, box, ch, owidth, row_size) \
+  schedule(static)
+#endif
+  for(int y = 0; y < box[3]; y++)
+    memcpy(ovoid + ((size_t)(y + box[1]) * owidth + box[0]) * ch, sub_out + (size_t)y * box[2] * ch, row_size);
+
+  _develop_blend_process_free_region(sub_out);
+  _develop_blend_process_free_region(sub_mask);
+  return TRUE;
+}
+
 
 static void _develop_blend_process_feather(const float *const guide, float *const mask, const size_t width,
                                            const size_t height, const int ch, const float guide_weight,
@@ -378,12 +508,12 @@ static void _develop_blend_process_feather(const float *const guide, float *cons
   int w = (int)(2 * feathering_radius * scale + 0.5f);
   if(w < 1) w = 1;
 
-  float *const restrict mask_bak = dt_alloc_align_float(width * height);
+  float *const restrict mask_bak = dt_pixelpipe_alloc_align_float(width * height);
   if(mask_bak)
   {
     memcpy(mask_bak, mask, sizeof(float) * width * height);
     guided_filter(guide, mask_bak, mask, width, height, ch, w, sqrt_eps, guide_weight, 0.f, 1.f);
-    dt_free_align(mask_bak);
+    dt_pixelpipe_free_align(mask_bak);
   }
 }
 
@@ -422,6 +552,105 @@ static void _develop_blend_process_mask_tone_curve(float *const restrict mask, c
 }
 
 
+static void _develop_blend_process_make_mask(struct dt_dev_pixelpipe_iop_t *piece,
+                                             const dt_develop_blend_colorspace_t blend_csp,
+                                             const float *const restrict a, const float *const restrict b,
+                                             const struct dt_iop_roi_t *const roi_in,
+                                             const struct dt_iop_roi_t *const roi_out, float *const restrict mask)
+{
+  switch(blend_csp)
+  {
+    case DEVELOP_BLEND_CS_LAB:
+      dt_develop_blendif_lab_make_mask(piece, a, b, roi_in, roi_out, mask);
+      break;
+    case DEVELOP_BLEND_CS_RGB_DISPLAY:
+      dt_develop_blendif_rgb_hsl_make_mask(piece, a, b, roi_in, roi_out, mask);
+      break;
+    case DEVELOP_BLEND_CS_RGB_SCENE:
+      dt_develop_blendif_rgb_jzczhz_make_mask(piece, a, b, roi_in, roi_out, mask);
+      break;
+    case DEVELOP_BLEND_CS_RAW:
+      dt_develop_blendif_raw_make_mask(piece, a, b, roi_in, roi_out, mask);
+      break;
+    default:
+      break;
+  }
+}
+
+static void _develop_blend_process_blend(struct dt_dev_pixelpipe_iop_t *piece,
+                                         const dt_develop_blend_colorspace_t blend_csp,
+                                         const float *const restrict a, float *const restrict b,
+                                         const struct dt_iop_roi_t *const roi_in,
+                                         const struct dt_iop_roi_t *const roi_out, const float *const restrict mask,
+                                         const dt_dev_pixelpipe_display_mask_t request_mask_display)
+{
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+
+  // select the blend operator
+  switch(blend_csp)
+  {
+    case DEVELOP_BLEND_CS_LAB:
+      dt_develop_blendif_lab_blend(piece, a, b, roi_in, roi_out, mask, request_mask_display);
+      break;
+    case DEVELOP_BLEND_CS_RGB_DISPLAY:
+      dt_develop_blendif_rgb_hsl_blend(piece, a, b, roi_in, roi_out, mask, request_mask_display);
+      break;
+    case DEVELOP_BLEND_CS_RGB_SCENE:
+      // small drawn masks only need blending over their bounding box
+      if(!(request_mask_display & DT_DEV_PIXELPIPE_DISPLAY_ANY)
+         && (d->blend_mode & DEVELOP_BLEND_REVERSE) != DEVELOP_BLEND_REVERSE
+         && _develop_blend_process_sparse(piece, a, b, roi_in, roi_out, mask))
+        break;
+      dt_develop_blendif_rgb_jzczhz_blend(piece, a, b, roi_in, roi_out, mask, request_mask_display);
+      break;
+    case DEVELOP_BLEND_CS_RAW:
+      dt_develop_blendif_raw_blend(piece, a, b, roi_in, roi_out, mask, request_mask_display);
+      break;
+    default:
+      break;
+  }
+}
+
+// bytes of input, output and mask processed per block of rows by _develop_blend_process_fused()
+#define DT_BLEND_FUSED_BLOCK_SIZE ((size_t)4 << 20)
+
+// compute the parametric mask and blend block of rows by block of rows, so that the input and output
+// are read from the cache by the blend operator instead of being streamed from memory twice
+static void _develop_blend_process_fused(struct dt_dev_pixelpipe_iop_t *piece,
+                                         const dt_develop_blend_colorspace_t blend_csp,
+                                         const float *const restrict a, float *const restrict b,
+                                         const struct dt_iop_roi_t *const roi_in,
+                                         const struct dt_iop_roi_t *const roi_out, float *const restrict mask,
+                                         const gboolean tone_curve,
+                                         const dt_dev_pixelpipe_display_mask_t request_mask_display)
+{
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  const float opacity = fminf(fmaxf(d->opacity / 100.0f, 0.0f), 1.0f);
+  const size_t ch = piece->colors;
+  const int owidth = roi_out->width;
+  const int oheight = roi_out->height;
+
+  // at least one row per thread
+  const size_t row_size = sizeof(float) * owidth * (2 * ch + 1);
+  const int rows = MIN(MAX(DT_BLEND_FUSED_BLOCK_SIZE / MAX(row_size, 1), dt_get_num_threads()), oheight);
+
+  for(int y = 0; y < oheight; y += rows)
+  {
+    dt_iop_roi_t block = *roi_out;
+    block.y += y;
+    block.height = MIN(rows, oheight - y);
+
+    float *const restrict block_out = b + (size_t)y * owidth * ch;
+    float *const restrict block_mask = mask + (size_t)y * owidth;
+
+    _develop_blend_process_make_mask(piece, blend_csp, a, block_out, roi_in, &block, block_mask);
+    if(tone_curve)
+      _develop_blend_process_mask_tone_curve(block_mask, (size_t)owidth * block.height, d->contrast,
+                                             d->brightness, opacity);
+    _develop_blend_process_blend(piece, blend_csp, a, block_out, roi_in, &block, block_mask, request_mask_display);
+  }
+}
+
 void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                               const void *const ivoid, void *const ovoid, const struct dt_iop_roi_t *const roi_in,
                               const struct dt_iop_roi_t *const roi_out)
@@ -484,6 +713,14 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
   // get the clipped opacity value  0 - 1
   const float opacity = fminf(fmaxf(d->opacity / 100.0f, 0.0f), 1.0f);
 
+  // a parametric mask only needs the pixels it is blending, unless it is feathered, blurred or refined
+  // with the detail mask, so both can be streamed together
+  const gboolean fused = !suppress_mask && !(mask_mode & DEVELOP_MASK_RASTER)
+                         && (mask_mode & DEVELOP_MASK_CONDITIONAL) && d->details == 0.0f
+                         && (post_operations_size == 0
+                             || (post_operations_size == 1
+                                 && post_operations[0] == DEVELOP_MASK_POST_TONE_CURVE));
+
   // allocate space for blend mask
   float *const restrict _mask = dt_alloc_align_float(buffsize);
   if(!_mask)
@@ -558,97 +795,70 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
       const float fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
       dt_iop_image_fill(mask, fill, owidth, oheight, 1); //mask[k] = fill;
     }
-    _refine_with_detail_mask(self, piece, mask, roi_in, roi_out, d->details);
 
-    // get parametric mask (if any) and apply global opacity
-    switch(blend_csp)
+    if(fused)
     {
-      case DEVELOP_BLEND_CS_LAB:
-        dt_develop_blendif_lab_make_mask(piece, (const float *const restrict)ivoid,
-                                         (const float *const restrict)ovoid, roi_in, roi_out, mask);
-        break;
-      case DEVELOP_BLEND_CS_RGB_DISPLAY:
-        dt_develop_blendif_rgb_hsl_make_mask(piece, (const float *const restrict)ivoid,
-                                             (const float *const restrict)ovoid, roi_in, roi_out, mask);
-        break;
-      case DEVELOP_BLEND_CS_RGB_SCENE:
-        dt_develop_blendif_rgb_jzczhz_make_mask(piece, (const float *const restrict)ivoid,
-                                                (const float *const restrict)ovoid, roi_in, roi_out, mask);
-        break;
-      case DEVELOP_BLEND_CS_RAW:
-        dt_develop_blendif_raw_make_mask(piece, (const float *const restrict)ivoid,
-                                         (const float *const restrict)ovoid, roi_in, roi_out, mask);
-        break;
-      default:
-        break;
+      // get the parametric mask and blend, one block of rows at a time, while they are still in cache
+      _develop_blend_process_fused(piece, blend_csp, (const float *const restrict)ivoid,
+                                   (float *const restrict)ovoid, roi_in, roi_out, mask, post_operations_size > 0,
+                                   request_mask_display);
     }
-
-    // post processing the mask
-    for(size_t index = 0; index < post_operations_size; ++index)
+    else
     {
-      _develop_mask_post_processing operation = post_operations[index];
-      if(operation == DEVELOP_MASK_POST_FEATHER_IN)
-      {
-        const float guide_weight = cst == IOP_CS_RGB ? 100.0f : 1.0f;
-        float *restrict guide = (float *restrict)ivoid;
-        if(!rois_equal)
-          guide = _develop_blend_process_copy_region(guide, ch * iwidth, ch * xoffs, ch * yoffs,
-                                                     ch * owidth, ch * oheight);
-        if(guide)
-          _develop_blend_process_feather(guide, mask, owidth, oheight, ch, guide_weight,
-                                         d->feathering_radius, roi_out->scale / piece->iscale);
-        if(!rois_equal)
-          _develop_blend_process_free_region(guide);
-      }
-      else if(operation == DEVELOP_MASK_POST_FEATHER_OUT)
-      {
-        const float guide_weight = cst == IOP_CS_RGB ? 100.0f : 1.0f;
-        _develop_blend_process_feather((const float *const restrict)ovoid, mask, owidth, oheight, ch,
-                                       guide_weight, d->feathering_radius, roi_out->scale / piece->iscale);
-      }
-      else if(operation == DEVELOP_MASK_POST_BLUR)
-      {
-        const float sigma = d->blur_radius * roi_out->scale / piece->iscale;
-        const float mmax[] = { 1.0f };
-        const float mmin[] = { 0.0f };
+      _refine_with_detail_mask(self, piece, mask, roi_in, roi_out, d->details);
+
+      // get parametric mask (if any) and apply global opacity
+      _develop_blend_process_make_mask(piece, blend_csp, (const float *const restrict)ivoid,
+                                       (const float *const restrict)ovoid, roi_in, roi_out, mask);
 
-        dt_gaussian_t *g = dt_gaussian_init(owidth, oheight, 1, mmax, mmin, sigma, 0);
-        if(g)
+      // post processing the mask
+      for(size_t index = 0; index < post_operations_size; ++index)
+      {
+        _develop_mask_post_processing operation = post_operations[index];
+        if(operation == DEVELOP_MASK_POST_FEATHER_IN)
         {
-          dt_gaussian_blur(g, mask, mask);
-          dt_gaussian_free(g);
+          const float guide_weight = cst == IOP_CS_RGB ? 100.0f : 1.0f;
+          float *restrict guide = (float *restrict)ivoid;
+          if(!rois_equal)
+            guide = _develop_blend_process_copy_region(guide, ch * iwidth, ch * xoffs, ch * yoffs,
+                                                       ch * owidth, ch * oheight);
+          if(guide)
+            _develop_blend_process_feather(guide, mask, owidth, oheight, ch, guide_weight,
+                                           d->feathering_radius, roi_out->scale / piece->iscale);
+          if(!rois_equal)
+            _develop_blend_process_free_region(guide);
+        }
+        else if(operation == DEVELOP_MASK_POST_FEATHER_OUT)
+        {
+          const float guide_weight = cst == IOP_CS_RGB ? 100.0f : 1.0f;
+          _develop_blend_process_feather((const float *const restrict)ovoid, mask, owidth, oheight, ch,
+                                         guide_weight, d->feathering_radius, roi_out->scale / piece->iscale);
+        }
+        else if(operation == DEVELOP_MASK_POST_BLUR)
+        {
+          const float sigma = d->blur_radius * roi_out->scale / piece->iscale;
+          const float mmax[] = { 1.0f };
+          const float mmin[] = { 0.0f };
+
+          dt_gaussian_t *g = dt_gaussian_init(owidth, oheight, 1, mmax, mmin, sigma, 0);
+          if(g)
+          {
+            dt_gaussian_blur(g, mask, mask);
+            dt_gaussian_free(g);
+          }
+        }
+        else if(operation == DEVELOP_MASK_POST_TONE_CURVE)
+        {
+          _develop_blend_process_mask_tone_curve(mask, buffsize, d->contrast, d->brightness, opacity);
         }
-      }
-      else if(operation == DEVELOP_MASK_POST_TONE_CURVE)
-      {
-        _develop_blend_process_mask_tone_curve(mask, buffsize, d->contrast, d->brightness, opacity);
       }
     }
   }
 
   // now apply blending with per-pixel opacity value as defined in mask
-  // select the blend operator
-  switch(blend_csp)
-  {
-    case DEVELOP_BLEND_CS_LAB:
-      dt_develop_blendif_lab_blend(piece, (const float *const restrict)ivoid, (float *const restrict)ovoid,
-                                   roi_in, roi_out, mask, request_mask_display);
-      break;
-    case DEVELOP_BLEND_CS_RGB_DISPLAY:
-      dt_develop_blendif_rgb_hsl_blend(piece, (const float *const restrict)ivoid, (float *const restrict)ovoid,
-                                       roi_in, roi_out, mask, request_mask_display);
-      break;
-    case DEVELOP_BLEND_CS_RGB_SCENE:
-      dt_develop_blendif_rgb_jzczhz_blend(piece, (const float *const restrict)ivoid, (float *const restrict)ovoid,
-                                          roi_in, roi_out, mask, request_mask_display);
-      break;
-    case DEVELOP_BLEND_CS_RAW:
-      dt_develop_blendif_raw_blend(piece, (const float *const restrict)ivoid, (float *const restrict)ovoid,
-                                   roi_in, roi_out, mask, request_mask_display);
-      break;
-    default:
-      break;
-  }
+  if(!fused)
+    _develop_blend_process_blend(piece, blend_csp, (const float *const restrict)ivoid,
+                                 (float *const restrict)ovoid, roi_in, roi_out, mask, request_mask_display);
 
   // register if _this_ module should expose mask or display channel
   if(request_mask_display & (DT_DEV_PIXELPIPE_DISPLAY_MASK | DT_DEV_PIXELPIPE_DISPLAY_CHANNEL))
@@ -670,12 +880,9 @@ void dt_develop_blend_process(struct dt_iop_module_t *self, struct dt_dev_pixelp
 }
 
 #ifdef HAVE_OPENCL
-static void _refine_with_detail_mask_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *mask, const struct dt_iop_roi_t *roi_in,
-                                const struct dt_iop_roi_t *roi_out, const float level, const int devid)
+// refine the raw detail mask for level on the device, before distortion
+static float *_detail_mask_calc_cl(struct dt_dev_pixelpipe_iop_t *piece, const float level)
 {
-  if(level == 0.0f) return;
-  const gboolean info = ((darktable.unmuted & DT_DEBUG_MASKS) && (piece->pipe->type == DT_DEV_PIXELPIPE_FULL));
-
   const int detail = (level > 0.0f);
   const float threshold = _detail_mask_threshold(level, detail);
   float *lum = NULL;
@@ -684,13 +891,9 @@ static void _refine_with_detail_mask_cl(struct dt_iop_module_t *self, struct dt_
   cl_mem out = NULL;
 
   dt_dev_pixelpipe_t *p = piece->pipe;
-  if(p->rawdetail_mask_data == NULL) return;
-
+  const int devid = p->devid;
   const int iwidth  = p->rawdetail_mask_roi.width;
   const int iheight = p->rawdetail_mask_roi.height;
-  const int owidth  = roi_out->width;
-  const int oheight = roi_out->height;
-  if(info) fprintf(stderr, "[_refine_with_detail_mask_cl] in module %s %ix%i --> %ix%i\n", self->op, iwidth, iheight, owidth, oheight);
 
   lum = dt_alloc_align_float((size_t)iwidth * iheight);
   if(lum == NULL) goto error;
@@ -774,13 +977,38 @@ static void _refine_with_detail_mask_cl(struct dt_iop_module_t *self, struct dt_
   dt_opencl_release_mem_object(tmp);
   dt_opencl_release_mem_object(blur);
   dt_opencl_release_mem_object(out);
-  tmp = blur = out = NULL;
+  return lum;
 
-  // here we have the slightly blurred full detail available
-  float *warp_mask = dt_dev_distort_detail_mask(p, lum, self);
-  if(warp_mask == NULL) goto error;
+  error:
   dt_free_align(lum);
-  lum = NULL;
+  dt_opencl_release_mem_object(tmp);
+  dt_opencl_release_mem_object(blur);
+  dt_opencl_release_mem_object(out);
+  return NULL;
+}
+
+static void _refine_with_detail_mask_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *mask, const struct dt_iop_roi_t *roi_in,
+                                const struct dt_iop_roi_t *roi_out, const float level)
+{
+  if(level == 0.0f) return;
+  const gboolean info = ((darktable.unmuted & DT_DEBUG_MASKS) && (piece->pipe->type == DT_DEV_PIXELPIPE_FULL));
+
+  dt_dev_pixelpipe_t *p = piece->pipe;
+  if(p->rawdetail_mask_data == NULL) return;
+
+  const int iwidth  = p->rawdetail_mask_roi.width;
+  const int iheight = p->rawdetail_mask_roi.height;
+  const int owidth  = roi_out->width;
+  const int oheight = roi_out->height;
+  if(info) fprintf(stderr, "[_refine_with_detail_mask_cl] in module %s %ix%i --> %ix%i\n", self->op, iwidth, iheight, owidth, oheight);
+
+  // here we have the slightly blurred full detail available, distorted up to here and kept by the pipe
+  const float *const warp_mask = dt_dev_get_detail_mask(piece, level, _detail_mask_calc_cl);
+  if(warp_mask == NULL)
+  {
+    dt_control_log(_("detail mask CL blending problem"));
+    return;
+  }
 
   const int msize = owidth * oheight;
 #ifdef _OPENMP
@@ -792,15 +1020,6 @@ static void _refine_with_detail_mask_cl(struct dt_iop_module_t *self, struct dt_
   {
     mask[idx] = mask[idx] * warp_mask[idx];
   }
-  dt_free_align(warp_mask);
-  return;
-
-  error:
-  dt_control_log(_("detail mask CL blending problem"));
-  dt_free_align(lum);
-  dt_opencl_release_mem_object(tmp);
-  dt_opencl_release_mem_object(blur);
-  dt_opencl_release_mem_object(out);
 }
 
 static inline void _blend_process_cl_exchange(cl_mem *a, cl_mem *b)
@@ -1033,7 +1252,7 @@ int dt_develop_blend_process_cl(struct dt_iop_module_t *self, struct dt_dev_pixe
       const float fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
       dt_iop_image_fill(mask, fill, owidth, oheight, 1); //mask[k] = fill;
     }
-    _refine_with_detail_mask_cl(self, piece, mask, roi_in, roi_out, d->details, devid);
+    _refine_with_detail_mask_cl(self, piece, mask, roi_in, roi_out, d->details);
 
     // write mask from host to device
     dev_mask_2 = dt_opencl_alloc_device(devid, owidth, oheight, sizeof(float));
@@ -34,6 +34,8 @@
 
 #define DT_BLENDIF_RGB_CH 4
 #define DT_BLENDIF_RGB_BCH 3
+// number of pixels converted at once by the Jz/Cz/hz parametric masks
+#define DT_BLENDIF_JZ_BLOCK 64
 
 
 typedef void(_blend_row_func)(const float *const restrict a, const float *const restrict b, const float p,
@@ -131,33 +133,38 @@ static inline void _blendif_rgb_blue(const float *const restrict pixels, float *
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(pixels, invert_mask: 16) uniform(parameters, invert_mask, stride, profile)
-#endif
 static inline void _blendif_jzczhz(const float *const restrict pixels, float *const restrict mask,
                                    const size_t stride, const float *const restrict parameters,
                                    const unsigned int *const restrict invert_mask,
                                    const dt_iop_order_iccprofile_info_t *const restrict profile)
 {
-  for(size_t x = 0, j = 0; x < stride; x++, j += DT_BLENDIF_RGB_CH)
+  // convert the row by blocks so that the JzAzBz conversion runs across pixels
+  for(size_t x0 = 0; x0 < stride; x0 += DT_BLENDIF_JZ_BLOCK)
   {
-    dt_aligned_pixel_t XYZ_D65;
-    dt_aligned_pixel_t JzAzBz;
-    dt_aligned_pixel_t JzCzhz;
+    const size_t npixels = MIN(DT_BLENDIF_JZ_BLOCK, stride - x0);
+    float DT_ALIGNED_ARRAY XYZ_D65[4 * DT_BLENDIF_JZ_BLOCK];
+    float DT_ALIGNED_ARRAY JzAzBz[4 * DT_BLENDIF_JZ_BLOCK];
 
     // use the matrix_out of the hacked profile for blending to use the
     // conversion from RGB to XYZ D65 (instead of XYZ D50)
-    dt_ioppr_rgb_matrix_to_xyz(pixels + j, XYZ_D65, profile->matrix_out_transposed, profile->lut_in,
-                               profile->unbounded_coeffs_in, profile->lutsize, profile->nonlinearlut);
+    for(size_t x = 0; x < npixels; x++)
+      dt_ioppr_rgb_matrix_to_xyz(pixels + (x0 + x) * DT_BLENDIF_RGB_CH, XYZ_D65 + 4 * x,
+                                 profile->matrix_out_transposed, profile->lut_in, profile->unbounded_coeffs_in,
+                                 profile->lutsize, profile->nonlinearlut);
 
-    dt_XYZ_2_JzAzBz(XYZ_D65, JzAzBz);
-    dt_JzAzBz_2_JzCzhz(JzAzBz, JzCzhz);
+    dt_XYZ_2_JzAzBz_row(XYZ_D65, JzAzBz, npixels);
 
-    float factor = 1.0f;
-    for(size_t i = 0; i < 3; i++)
-      factor *= _blendif_compute_factor(JzCzhz[i], invert_mask[i],
-                                        parameters + DEVELOP_BLENDIF_PARAMETER_ITEMS * i);
-    mask[x] *= factor;
+    for(size_t x = 0; x < npixels; x++)
+    {
+      dt_aligned_pixel_t JzCzhz;
+      dt_JzAzBz_2_JzCzhz(JzAzBz + 4 * x, JzCzhz);
+
+      float factor = 1.0f;
+      for(size_t i = 0; i < 3; i++)
+        factor *= _blendif_compute_factor(JzCzhz[i], invert_mask[i],
+                                          parameters + DEVELOP_BLENDIF_PARAMETER_ITEMS * i);
+      mask[x0 + x] *= factor;
+    }
   }
 }
 
@@ -27,11 +27,13 @@
 #include "common/atomic.h"
 #include "common/debug.h"
 #include "common/history.h"
+#include "common/history_cache.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
 #include "common/tags.h"
+#include "common/trace.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
@@ -68,12 +70,16 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dev->image_invalid_cnt = 0;
   dev->pipe = dev->preview_pipe = NULL;
   dt_pthread_mutex_init(&dev->pipe_mutex, NULL);
+  dt_pthread_mutex_init(&dev->preview_pipe_mutex, NULL);
   dev->histogram_pre_tonecurve = NULL;
   dev->histogram_pre_levels = NULL;
   dev->forms = NULL;
   dev->form_visible = NULL;
   dev->form_gui = NULL;
   dev->allforms = NULL;
+  dev->mask_rasters = NULL;
+  dev->mask_rasters_size = 0;
+  dt_pthread_mutex_init(&dev->mask_rasters_mutex, NULL);
 
   if(dev->gui_attached)
   {
@@ -147,6 +153,7 @@ void dt_dev_cleanup(dt_develop_t *dev)
   if(!dev) return;
   // image_cache does not have to be unref'd, this is done outside develop module.
   dt_pthread_mutex_destroy(&dev->pipe_mutex);
+  dt_pthread_mutex_destroy(&dev->preview_pipe_mutex);
 
   if(dev->raw_histogram.buffer) dt_free_align(dev->raw_histogram.buffer);
   if(dev->output_histogram.buffer) dt_free_align(dev->output_histogram.buffer);
@@ -194,6 +201,8 @@ void dt_dev_cleanup(dt_develop_t *dev)
 
   g_list_free_full(dev->forms, (void (*)(void *))dt_masks_free_form);
   g_list_free_full(dev->allforms, (void (*)(void *))dt_masks_free_form);
+  dt_masks_raster_cache_cleanup(dev);
+  dt_pthread_mutex_destroy(&dev->mask_rasters_mutex);
 
   dt_conf_set_int("darkroom/ui/rawoverexposed/mode", dev->rawoverexposed.mode);
   dt_conf_set_int("darkroom/ui/rawoverexposed/colorscheme", dev->rawoverexposed.colorscheme);
@@ -300,9 +309,27 @@ void dt_dev_invalidate_all_real(dt_develop_t *dev)
   dt_dev_invalidate_preview(dev);
 }
 
-void dt_dev_process_preview_job(dt_develop_t *dev)
+// headless developments (benchmarks) run the darkroom jobs without a GUI, at 1 pixel per point
+static inline float _dev_ppd(void)
 {
-  dt_pthread_mutex_lock(&dev->pipe_mutex);
+  return darktable.gui ? darktable.gui->ppd : 1.0f;
+}
+
+// The preview and main pipes run at the same time after each change. Give each one its own share of
+// the cores, instead of two full OpenMP teams fighting for them.
+static int _dev_pipe_threads(const dt_develop_t *dev, const gboolean preview)
+{
+  const int cores = darktable.num_openmp_threads;
+  int share = dt_conf_get_int("darkroom_preview_threads");
+  if(!dev->gui_attached || share < 0 || cores < 2) return cores;
+  if(share == 0) share = MAX(1, cores / 4);
+  share = MIN(share, cores - 1);
+  return preview ? share : cores - share;
+}
+
+static void _dev_process_preview_job(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
   dt_control_log_busy_enter();
   dt_control_toast_busy_enter();
   dev->preview_status = DT_DEV_PIXELPIPE_RUNNING;
@@ -316,7 +343,7 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
     dt_control_log_busy_leave();
     dt_control_toast_busy_leave();
     dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    dt_pthread_mutex_unlock(&dev->pipe_mutex);
+    dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
     return;
   }
 
@@ -347,7 +374,7 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
       dt_control_toast_busy_leave();
       dev->preview_status = DT_DEV_PIXELPIPE_INVALID;
       dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-      dt_pthread_mutex_unlock(&dev->pipe_mutex);
+      dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
       return;
     }
   }
@@ -361,13 +388,27 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
   dt_control_log_busy_leave();
   dt_control_toast_busy_leave();
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-  dt_pthread_mutex_unlock(&dev->pipe_mutex);
+  dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
 
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED);
 }
 
 
-void dt_dev_process_image_job(dt_develop_t *dev)
+void dt_dev_process_preview_job(dt_develop_t *dev)
+{
+  // omp_set_num_threads() only applies to parallel regions started by this thread
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(_dev_pipe_threads(dev, TRUE));
+#endif
+  _dev_process_preview_job(dev);
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
+
+static void _dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
   dt_control_log_busy_enter();
@@ -389,10 +430,18 @@ void dt_dev_process_image_job(dt_develop_t *dev)
 
   dt_dev_pixelpipe_set_input(dev->pipe, dev, (float *)buf.buf, buf.width, buf.height, 1.0);
 
+  int trace_flow = 0;
+  double trace_start = 0.0;
+
 restart:;
   dt_times_t start;
   dt_get_times(&start);
 
+  // a restart follows the newer history change, if any
+  const int flow = dt_atomic_exch_int(&dev->trace_flow, 0);
+  if(flow) trace_flow = flow;
+  trace_start = dt_get_wtime();
+
   // adjust pipeline according to changed flag set by {add,pop}_history_item.
   // dt_dev_pixelpipe_change() will clear the changed value
   dt_dev_pixelpipe_change_t pipe_changed = dev->pipe->changed;
@@ -414,33 +463,50 @@ restart:;
     dt_control_set_dev_zoom_y(zoom_y);
   }
 
-  float scale = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) * darktable.gui->ppd;
-  int window_width = dev->width * darktable.gui->ppd;
-  int window_height = dev->height * darktable.gui->ppd;
-  if(closeup)
-  {
-    window_width /= 1<<closeup;
-    window_height /= 1<<closeup;
-  }
-  const int wd = MIN(window_width, dev->pipe->processed_width * scale);
-  const int ht = MIN(window_height, dev->pipe->processed_height * scale);
-  int x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - wd / 2);
-  int y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - ht / 2);
+  const float scale = dt_dev_get_zoom_scale(dev, zoom, 1.0f, 0) * _dev_ppd();
+  int vis_x, vis_y, vis_wd, vis_ht;
+  dt_dev_get_viewport(dev, scale, zoom_x, zoom_y, closeup, 0.f, &vis_x, &vis_y, &vis_wd, &vis_ht);
 
-  dt_get_times(&start);
+  // When the pipe has been slow lately, show coarse passes at 1/4 and 1/2 of the final scale first.
+  // Each one replaces the previous in the backbuffer, until the full resolution one lands.
+  const int progressive_delay = dt_conf_get_int("darkroom_progressive_delay");
+  const int passes
+      = (dev->gui_attached && progressive_delay > 0 && dev->average_delay > (uint32_t)progressive_delay) ? 2 : 0;
 
-  if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, wd, ht, scale))
+  for(int pass = passes; pass >= 0; pass--)
   {
-    if(dt_atomic_get_int(&dev->pipe->shutdown))
-      goto restart; // restart only if pipeline was shutdown, aka no error
-    else
+    const float downscale = 1.0f / (float)(1 << pass);
+
+    dt_get_times(&start);
+
+    if(dt_dev_pixelpipe_process(dev->pipe, dev, vis_x * downscale, vis_y * downscale, vis_wd * downscale,
+                                vis_ht * downscale, scale * downscale))
     {
-      dt_control_log_busy_leave();
-      dt_control_toast_busy_leave();
-      dev->image_status = DT_DEV_PIXELPIPE_INVALID;
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-      dt_pthread_mutex_unlock(&dev->pipe_mutex);
-      return;
+      if(dt_atomic_get_int(&dev->pipe->shutdown))
+        goto restart; // restart only if pipeline was shutdown, aka no error
+      else
+      {
+        dt_control_log_busy_leave();
+        dt_control_toast_busy_leave();
+        dev->image_status = DT_DEV_PIXELPIPE_INVALID;
+        dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+        dt_pthread_mutex_unlock(&dev->pipe_mutex);
+        return;
+      }
+    }
+
+    dev->pipe->backbuf_scale = scale;
+    dev->pipe->backbuf_zoom_x = zoom_x;
+    dev->pipe->backbuf_zoom_y = zoom_y;
+    dev->pipe->backbuf_downscale = downscale;
+    dev->pipe->backbuf_x = vis_x;
+    dev->pipe->backbuf_y = vis_y;
+
+    if(pass > 0)
+    {
+      // params changed in the meantime: don't bother refining a stale image
+      if(dt_atomic_get_int(&dev->pipe->shutdown)) goto restart;
+      dt_control_queue_redraw_center();
     }
   }
 
@@ -448,22 +514,57 @@ restart:;
   dt_dev_average_delay_update(&start, &dev->average_delay);
 
   // cool, we got a new image!
-  dev->pipe->backbuf_scale = scale;
-  dev->pipe->backbuf_zoom_x = zoom_x;
-  dev->pipe->backbuf_zoom_y = zoom_y;
-
   dev->image_status = DT_DEV_PIXELPIPE_VALID;
   dev->image_invalid_cnt = 0;
+
+  // After a pan or a zoom, render a ring around the visible region while the user looks at the image,
+  // so the next pans only need to move the backbuffer on screen. Any new change aborts it.
+  const float pan_margin = dt_conf_get_int("darkroom_pan_margin") / 100.f;
+  int ext_x, ext_y, ext_wd, ext_ht;
+  dt_dev_get_viewport(dev, scale, zoom_x, zoom_y, closeup, pan_margin, &ext_x, &ext_y, &ext_wd, &ext_ht);
+  if(dev->gui_attached && pan_margin > 0.f && pipe_changed == DT_DEV_PIPE_ZOOMED
+     && (ext_wd > vis_wd || ext_ht > vis_ht))
+  {
+    dt_control_queue_redraw_center();
+    if(dt_dev_pixelpipe_process(dev->pipe, dev, ext_x, ext_y, ext_wd, ext_ht, scale))
+    {
+      if(dt_atomic_get_int(&dev->pipe->shutdown)) goto restart;
+    }
+    else
+    {
+      dev->pipe->backbuf_x = ext_x;
+      dev->pipe->backbuf_y = ext_y;
+    }
+  }
   // if a widget needs to be redrawn there's the DT_SIGNAL_*_PIPE_FINISHED signals
   dt_control_log_busy_leave();
   dt_control_toast_busy_leave();
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
   dt_pthread_mutex_unlock(&dev->pipe_mutex);
 
+  if(dt_trace_enabled())
+  {
+    dt_trace_span("dev", "full pipe", trace_start, dt_get_wtime());
+    dt_trace_flow(trace_flow, DT_TRACE_FLOW_STEP, "history change", trace_start);
+    dt_atomic_set_int(&dev->trace_redraw_flow, trace_flow);
+  }
+
   if(dev->gui_attached)
     DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED);
 }
 
+void dt_dev_process_image_job(dt_develop_t *dev)
+{
+#ifdef _OPENMP
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(_dev_pipe_threads(dev, FALSE));
+#endif
+  _dev_process_image_job(dev);
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#endif
+}
+
 
 static inline void _dt_dev_load_pipeline_defaults(dt_develop_t *dev)
 {
@@ -510,6 +611,34 @@ void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid)
   dt_dev_load_image(dev, imgid);
 }
 
+void dt_dev_get_viewport(const dt_develop_t *dev, const float scale, const float zoom_x, const float zoom_y,
+                         const int closeup, const float margin, int *x, int *y, int *wd, int *ht)
+{
+  int window_width = dev->width * _dev_ppd();
+  int window_height = dev->height * _dev_ppd();
+  if(closeup)
+  {
+    window_width /= 1<<closeup;
+    window_height /= 1<<closeup;
+  }
+  window_width *= 1.f + 2.f * margin;
+  window_height *= 1.f + 2.f * margin;
+
+  const int full_wd = dev->pipe->processed_width * scale;
+  const int full_ht = dev->pipe->processed_height * scale;
+  *wd = MIN(window_width, full_wd);
+  *ht = MIN(window_height, full_ht);
+  *x = MAX(0, scale * dev->pipe->processed_width  * (.5 + zoom_x) - *wd / 2);
+  *y = MAX(0, scale * dev->pipe->processed_height * (.5 + zoom_y) - *ht / 2);
+
+  // the margin may go past the borders of the image, shift it inside
+  if(margin > 0.f)
+  {
+    *x = MAX(0, MIN(*x, full_wd - *wd));
+    *y = MAX(0, MIN(*y, full_ht - *ht));
+  }
+}
+
 float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_factor, int preview)
 {
   float zoom_scale;
@@ -687,6 +816,15 @@ void dt_dev_add_history_item_ext(dt_develop_t *dev, struct dt_iop_module_t *modu
 
   module->hash = dt_iop_module_hash(module);
 
+  // shapes can be shared between modules or edited from the mask manager, hash the drawn masks of the
+  // other modules again so their pipe nodes don't keep rasters of the previous shapes
+  if(include_masks)
+    for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+    {
+      dt_iop_module_t *mod = (dt_iop_module_t *)modules->data;
+      if(mod != module && mod->mask_hash) mod->hash = dt_iop_module_hash(mod);
+    }
+
   // look for leaks on top of history in two steps
   // first remove obsolete items above history_end
   // but keep the always-on modules
@@ -825,6 +963,7 @@ const dt_dev_history_item_t *dt_dev_get_history_item(dt_develop_t *dev, const ch
 
 void dt_dev_add_history_item_real(dt_develop_t *dev, dt_iop_module_t *module, gboolean enable)
 {
+  const double trace_start = dt_get_wtime();
   dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
   dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
 
@@ -863,6 +1002,15 @@ void dt_dev_add_history_item_real(dt_develop_t *dev, dt_iop_module_t *module, gb
     /* recreate mask list */
     dt_dev_masks_list_change(dev);
   }
+
+  if(dt_trace_enabled())
+  {
+    // the next run of the main pipe picks the flow up
+    const int flow = dt_trace_flow_new();
+    dt_trace_span("dev", module ? module->op : "history change", trace_start, dt_get_wtime());
+    dt_trace_flow(flow, DT_TRACE_FLOW_START, "history change", trace_start);
+    dt_atomic_set_int(&dev->trace_flow, flow);
+  }
 }
 
 void dt_dev_free_history_item(gpointer data)
@@ -953,6 +1101,7 @@ static inline void _dt_dev_modules_reload_defaults(dt_develop_t *dev)
   // modules to history, then setting said history to the previous defaults.
   // Worse, some modules (temperature.c) grabbed their params at runtime (WB as shot in camera),
   // meaning the defaults were not even static values.
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
   for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
   {
     dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
@@ -961,10 +1110,11 @@ static inline void _dt_dev_modules_reload_defaults(dt_develop_t *dev)
     module->enabled = module->default_enabled;
 
     if(module->multi_priority == 0)
-      module->iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, module->op, module->multi_priority);
+      module->iop_order = dt_ioppr_index_get_iop_order(index, module->op, module->multi_priority);
     else
       module->iop_order = INT_MAX;
   }
+  g_hash_table_destroy(index);
 }
 
 
@@ -1063,6 +1213,44 @@ void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt)
   dt_dev_refresh_ui_images(dev);
 }
 
+void dt_dev_pop_history_items_synch(dt_develop_t *dev, int32_t cnt)
+{
+  ++darktable.gui->reset;
+
+  dt_pthread_mutex_lock(&dev->history_mutex);
+
+  dt_ioppr_check_iop_order(dev, 0, "dt_dev_pop_history_items_synch");
+
+  // remember the state of the modules to find the ones that change
+  GHashTable *hashes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
+    uint64_t *hash = g_malloc(sizeof(uint64_t));
+    *hash = dt_iop_module_hash(module) ^ (uint64_t)module->enabled;
+    g_hash_table_insert(hashes, module, hash);
+  }
+
+  dt_dev_pop_history_items_ext(dev, cnt);
+
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
+    const uint64_t *hash = (uint64_t *)g_hash_table_lookup(hashes, module);
+    if(!hash || *hash != (dt_iop_module_hash(module) ^ (uint64_t)module->enabled)) dt_iop_gui_update(module);
+  }
+  g_hash_table_destroy(hashes);
+
+  --darktable.gui->reset;
+
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+
+  // the pipes compare the nodes to their previous state and only invalidate what is downstream
+  dt_dev_invalidate_all(dev);
+  dt_dev_masks_list_change(dev);
+  dt_dev_refresh_ui_images(dev);
+}
+
 static void _cleanup_history(const int imgid)
 {
   sqlite3_stmt *stmt;
@@ -1545,82 +1733,171 @@ void _dev_write_history(dt_develop_t *dev, const int imgid)
   }
 }
 
-// helper function for debug strings
-char * _print_validity(gboolean state)
+// Find the module instance a history item applies to, loading a new instance if the history has more
+// instances than the pipeline. NULL if the module is not installed.
+static dt_iop_module_t *_dev_get_history_module(dt_develop_t *dev, const char *module_name,
+                                                const int multi_priority, const char *multi_name,
+                                                const int iop_order)
 {
-  if(state)
-    return "ok";
-  else
-    return "WRONG";
+  dt_iop_module_t *find_op = NULL;
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    if(!strcmp(module->op, module_name))
+    {
+      if(module->multi_priority == multi_priority)
+      {
+        if(multi_name)
+          g_strlcpy(module->multi_name, multi_name, sizeof(module->multi_name));
+        else
+          memset(module->multi_name, 0, sizeof(module->multi_name));
+        return module;
+      }
+      else if(multi_priority > 0)
+      {
+        // we just say that we find the name, so we just have to add new instance of this module
+        find_op = module;
+      }
+    }
+  }
+  if(!find_op) return NULL;
+
+  // we have to add a new instance of this module and set index to modindex
+  dt_iop_module_t *new_module = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
+  if(dt_iop_load_module(new_module, find_op->so, dev)) return NULL; // frees new_module
+  dt_iop_update_multi_priority(new_module, multi_priority);
+  new_module->iop_order = iop_order;
+
+  g_strlcpy(new_module->multi_name, multi_name, sizeof(new_module->multi_name));
+
+  dev->iop = g_list_append(dev->iop, new_module);
+
+  new_module->instance = find_op->instance;
+  return new_module;
 }
 
-void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_image)
+// One item of the history blob kept by the history cache, followed by the params and the blend params.
+typedef struct _history_record_t
 {
-  if(imgid <= 0) return;
-  if(!dev->iop) return;
-  dt_dev_undo_start_record(dev);
+  char op_name[20];
+  char multi_name[128];
+  int32_t multi_priority;
+  int32_t enabled;
+  int32_t params_size;
+} _history_record_t;
 
-  int auto_apply_modules = 0;
-  gboolean first_run = FALSE;
-  gboolean legacy_params = FALSE;
-
-  dt_ioppr_set_default_iop_order(dev, imgid);
+// Serialize the history, as just written to the database, for the history cache.
+static void _dev_cache_history(dt_develop_t *dev, const int imgid)
+{
+  size_t size = 0;
+  for(GList *history = dev->history; history; history = g_list_next(history))
+  {
+    const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    size += sizeof(_history_record_t) + hist->module->params_size + sizeof(dt_develop_blend_params_t);
+  }
 
-  if(!no_image)
+  guint8 *blob = g_malloc(MAX(size, 1));
+  guint8 *p = blob;
+  for(GList *history = dev->history; history; history = g_list_next(history))
   {
-    // cleanup
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.history", NULL, NULL, NULL);
+    const dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    _history_record_t record = { { 0 } };
+    g_strlcpy(record.op_name, hist->op_name, sizeof(record.op_name));
+    g_strlcpy(record.multi_name, hist->multi_name, sizeof(record.multi_name));
+    record.multi_priority = hist->multi_priority;
+    record.enabled = hist->enabled;
+    record.params_size = hist->module->params_size;
+    memcpy(p, &record, sizeof(record));
+    p += sizeof(record);
+    memcpy(p, hist->params, record.params_size);
+    p += record.params_size;
+    memcpy(p, hist->blend_params, sizeof(dt_develop_blend_params_t));
+    p += sizeof(dt_develop_blend_params_t);
+  }
 
-    dt_print(DT_DEBUG_PARAMS, "[history] temporary history deleted\n");
+  dt_history_cache_put(imgid, blob, size);
+}
 
-    // make sure all modules default params are loaded to init history
-    _dt_dev_load_pipeline_defaults(dev);
+// Rebuild the history from a blob of the history cache. The items were checked and converted when the blob
+// was made, and the rows of main.history were rewritten from them, numbered from 0.
+static void _dev_read_history_blob(dt_develop_t *dev, const guint8 *blob, const size_t size,
+                                   const int history_end_current)
+{
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
+  const guint8 *p = blob;
+  while(p + sizeof(_history_record_t) <= blob + size)
+  {
+    _history_record_t record;
+    memcpy(&record, p, sizeof(record));
+    p += sizeof(record);
+    const guint8 *params = p;
+    const guint8 *blend_params = p + record.params_size;
+    p += record.params_size + sizeof(dt_develop_blend_params_t);
 
-    // prepend all default modules to memory.history
-    _dev_add_default_modules(dev, imgid);
-    const int default_modules = _dev_get_module_nb_records();
+    const int iop_order = dt_ioppr_index_get_iop_order(index, record.op_name, record.multi_priority);
+    dt_iop_module_t *module
+        = _dev_get_history_module(dev, record.op_name, record.multi_priority, record.multi_name, iop_order);
+    if(!module || module->params_size != record.params_size)
+    {
+      fprintf(stderr, "[dev_read_history] can't restore the module `%s' of image `%s' from the history cache\n",
+              record.op_name, dev->image_storage.filename);
+      continue;
+    }
 
-    // maybe add auto-presets to memory.history
-    first_run = _dev_auto_apply_presets(dev);
-    auto_apply_modules = _dev_get_module_nb_records() - default_modules;
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)calloc(1, sizeof(dt_dev_history_item_t));
+    hist->module = module;
+    hist->enabled = record.enabled;
+    hist->num = dt_dev_get_history_end(dev);
+    hist->iop_order = iop_order;
+    hist->multi_priority = record.multi_priority;
+    g_strlcpy(hist->op_name, module->op, sizeof(hist->op_name));
+    g_strlcpy(hist->multi_name, record.multi_name, sizeof(hist->multi_name));
+    hist->params = malloc(module->params_size);
+    memcpy(hist->params, params, module->params_size);
+    hist->blend_params = malloc(sizeof(dt_develop_blend_params_t));
+    memcpy(hist->blend_params, blend_params, sizeof(dt_develop_blend_params_t));
 
-    dt_print(DT_DEBUG_PARAMS, "[history] temporary history initialised with default params and presets\n");
+    // update module iop_order only on active history entries
+    if(history_end_current > dt_dev_get_history_end(dev)) module->iop_order = iop_order;
 
-    // now merge memory.history into main.history
-    _dev_merge_history(dev, imgid);
+    dt_iop_commit_blend_params(module, hist->blend_params);
+    hist->hash = module->hash = dt_iop_module_hash(module);
 
-    dt_print(DT_DEBUG_PARAMS, "[history] temporary history merged with image history\n");
+    dev->history = g_list_append(dev->history, hist);
+    dt_dev_set_history_end(dev, dt_dev_get_history_end(dev) + 1);
   }
+  g_hash_table_destroy(index);
+}
 
-  sqlite3_stmt *stmt;
-
-  // Get the end of the history - What's that ???
-
-  int history_end_current = 0;
+// helper function for debug strings
+char * _print_validity(gboolean state)
+{
+  if(state)
+    return "ok";
+  else
+    return "WRONG";
+}
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT history_end FROM main.images WHERE id = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW) // seriously, this should never fail
-    if(sqlite3_column_type(stmt, 0) != SQLITE_NULL)
-      history_end_current = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+// Load the history of imgid from main.history, checking each item and converting the legacy params and
+// blend params. Returns TRUE if anything was converted.
+static gboolean _dev_read_history_rows(dt_develop_t *dev, const int imgid, const int history_end_current)
+{
+  gboolean legacy_params = FALSE;
+  sqlite3_stmt *stmt;
 
   // Load current image history from DB
   // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT imgid, num, module, operation,"
-                              "       op_params, enabled, blendop_params,"
-                              "       blendop_version, multi_priority, multi_name"
-                              " FROM main.history"
-                              " WHERE imgid = ?1"
-                              " ORDER BY num",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(dt_database_get(darktable.db),
+                                   "SELECT imgid, num, module, operation,"
+                                   "       op_params, enabled, blendop_params,"
+                                   "       blendop_version, multi_priority, multi_name"
+                                   " FROM main.history"
+                                   " WHERE imgid = ?1"
+                                   " ORDER BY num");
   // clang-format on
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
 
-  dt_dev_set_history_end(dev, 0); // actually, will be sanitized to 1
+  GHashTable *index = dt_ioppr_iop_order_index_new(dev->iop_order_list);
 
   // Strip rows from DB lookup. One row == One module in history
   while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -1651,51 +1928,12 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_ima
       continue;
     }
 
-    const int iop_order = dt_ioppr_get_iop_order(dev->iop_order_list, module_name, multi_priority);
+    const int iop_order = dt_ioppr_index_get_iop_order(index, module_name, multi_priority);
 
     dt_dev_history_item_t *hist = (dt_dev_history_item_t *)calloc(1, sizeof(dt_dev_history_item_t));
-    hist->module = NULL;
 
     // Find a .so file that matches our history entry, aka a module to run the params stored in DB
-    dt_iop_module_t *find_op = NULL;
-    for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
-    {
-      dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
-      if(!strcmp(module->op, module_name))
-      {
-        if(module->multi_priority == multi_priority)
-        {
-          hist->module = module;
-          if(multi_name)
-            g_strlcpy(module->multi_name, multi_name, sizeof(module->multi_name));
-          else
-            memset(module->multi_name, 0, sizeof(module->multi_name));
-          break;
-        }
-        else if(multi_priority > 0)
-        {
-          // we just say that we find the name, so we just have to add new instance of this module
-          find_op = module;
-        }
-      }
-    }
-    if(!hist->module && find_op)
-    {
-      // we have to add a new instance of this module and set index to modindex
-      dt_iop_module_t *new_module = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
-      if(!dt_iop_load_module(new_module, find_op->so, dev))
-      {
-        dt_iop_update_multi_priority(new_module, multi_priority);
-        new_module->iop_order = iop_order;
-
-        g_strlcpy(new_module->multi_name, multi_name, sizeof(new_module->multi_name));
-
-        dev->iop = g_list_append(dev->iop, new_module);
-
-        new_module->instance = find_op->instance;
-        hist->module = new_module;
-      }
-    }
+    hist->module = _dev_get_history_module(dev, module_name, multi_priority, multi_name, iop_order);
 
     if(!hist->module)
     {
@@ -1823,21 +2061,91 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_ima
     dev->history = g_list_append(dev->history, hist);
     dt_dev_set_history_end(dev, dt_dev_get_history_end(dev) + 1);
   }
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
+  g_hash_table_destroy(index);
+
+  return legacy_params;
+}
+
+void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_image)
+{
+  if(imgid <= 0) return;
+  if(!dev->iop) return;
+  dt_dev_undo_start_record(dev);
+
+  int auto_apply_modules = 0;
+  gboolean first_run = FALSE;
+  gboolean legacy_params = FALSE;
+
+  dt_ioppr_set_default_iop_order(dev, imgid);
+
+  if(!no_image)
+  {
+    // cleanup
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.history", NULL, NULL, NULL);
+
+    dt_print(DT_DEBUG_PARAMS, "[history] temporary history deleted\n");
+
+    // make sure all modules default params are loaded to init history
+    _dt_dev_load_pipeline_defaults(dev);
+
+    // prepend all default modules to memory.history
+    _dev_add_default_modules(dev, imgid);
+    const int default_modules = _dev_get_module_nb_records();
+
+    // maybe add auto-presets to memory.history
+    first_run = _dev_auto_apply_presets(dev);
+    auto_apply_modules = _dev_get_module_nb_records() - default_modules;
+
+    dt_print(DT_DEBUG_PARAMS, "[history] temporary history initialised with default params and presets\n");
+
+    // now merge memory.history into main.history
+    _dev_merge_history(dev, imgid);
+
+    dt_print(DT_DEBUG_PARAMS, "[history] temporary history merged with image history\n");
+  }
+
+  sqlite3_stmt *stmt;
+
+  // Get the end of the history - What's that ???
+
+  int history_end_current = 0;
+
+  // these run for every image opened or processed, keep them prepared
+  stmt = dt_database_get_statement(dt_database_get(darktable.db),
+                                   "SELECT history_end FROM main.images WHERE id = ?1");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW) // seriously, this should never fail
+    if(sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+      history_end_current = sqlite3_column_int(stmt, 0);
+  sqlite3_reset(stmt);
+
+  dt_dev_set_history_end(dev, 0); // actually, will be sanitized to 1
+
+  // a history read before in this session comes already checked and converted, and matches main.history
+  guint8 *blob = NULL;
+  size_t blob_size = 0;
+  const gboolean cached = dt_history_cache_get(imgid, &blob, &blob_size);
+  if(cached)
+  {
+    _dev_read_history_blob(dev, blob, blob_size, history_end_current);
+    g_free(blob);
+  }
+  else
+    legacy_params = _dev_read_history_rows(dev, imgid, history_end_current);
 
   dt_ioppr_resync_modules_order(dev);
 
   // find the new history end
   // Note: dt_dev_set_history_end sanitizes the value with the actual history size.
   // It needs to run after dev->history is fully populated
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT history_end FROM main.images WHERE id = ?1",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(dt_database_get(darktable.db),
+                                   "SELECT history_end FROM main.images WHERE id = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW) // seriously, this should never fail
     if(sqlite3_column_type(stmt, 0) != SQLITE_NULL)
       dt_dev_set_history_end(dev, sqlite3_column_int(stmt, 0));
-  sqlite3_finalize(stmt);
+  sqlite3_reset(stmt);
 
   dt_ioppr_check_iop_order(dev, imgid, "dt_dev_read_history_no_image end");
 
@@ -1850,8 +2158,14 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_ima
   }
   dt_dev_masks_list_change(dev);
 
-  // make sure module_dev is in sync with history
-  _dev_write_history(dev, imgid);
+  // make sure module_dev is in sync with history. A cached history is already.
+  if(cached)
+    _warn_about_history_overuse(dev);
+  else
+  {
+    _dev_write_history(dev, imgid);
+    _dev_cache_history(dev, imgid);
+  }
   dt_ioppr_write_iop_order_list(dev->iop_order_list, imgid);
   dt_history_hash_t flags = DT_HISTORY_HASH_CURRENT;
   if(first_run)
@@ -1879,8 +2193,9 @@ void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_ima
     }
     dt_history_hash_write_from_history(imgid, flags);
   }
-  else
+  else if(!cached)
   {
+    // the rows of a cached history didn't change since their hash was written
     dt_history_hash_write_from_history(imgid, flags);
   }
 
@@ -2110,9 +2425,9 @@ void dt_dev_masks_selection_change(dt_develop_t *dev, struct dt_iop_module_t *mo
     dev->proxy.masks.selection_change(dev->proxy.masks.module, module, selectid, throw_event);
 }
 
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename)
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface)
 {
-  dev->proxy.snapshot.filename = filename;
+  dev->proxy.snapshot.surface = surface;
   dev->proxy.snapshot.request = TRUE;
   dt_control_queue_redraw_center();
 }
@@ -2382,16 +2697,10 @@ int dt_dev_distort_transform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, c
 int dt_dev_distort_backtransform_locked(dt_develop_t *dev, dt_dev_pixelpipe_t *pipe, const double iop_order,
                                         const int transf_direction, float *points, size_t points_count)
 {
-  GList *modules = g_list_last(pipe->iop);
-  GList *pieces = g_list_last(pipe->nodes);
-  while(modules)
+  for(int k = pipe->num_pieces - 1; k >= 0; k--)
   {
-    if(!pieces)
-    {
-      return 0;
-    }
-    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    dt_iop_module_t *module = piece->module;
     if(piece->enabled
        && ((transf_direction == DT_DEV_TRANSFORM_DIR_ALL)
            || (transf_direction == DT_DEV_TRANSFORM_DIR_FORW_INCL && module->iop_order >= iop_order)
@@ -2403,8 +2712,6 @@ int dt_dev_distort_backtransform_locked(dt_develop_t *dev, dt_dev_pixelpipe_t *p
     {
       module->distort_backtransform(module, piece, points, points_count);
     }
-    modules = g_list_previous(modules);
-    pieces = g_list_previous(pieces);
   }
   return 1;
 }
@@ -2421,9 +2728,9 @@ int dt_dev_distort_backtransform_plus(dt_develop_t *dev, dt_dev_pixelpipe_t *pip
 dt_dev_pixelpipe_iop_t *dt_dev_distort_get_iop_pipe(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe,
                                                     struct dt_iop_module_t *module)
 {
-  for(const GList *pieces = g_list_last(pipe->nodes); pieces; pieces = g_list_previous(pieces))
+  for(int k = pipe->num_pieces - 1; k >= 0; k--)
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
     if(piece->module == module)
     {
       return piece;
@@ -2499,12 +2806,7 @@ uint64_t dt_dev_hash(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
 {
   uint64_t hash = 0;
   dt_pthread_mutex_lock(&dev->history_mutex);
-  GList *pieces = g_list_last(pipe->nodes);
-  if(pieces)
-  {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)(pieces->data);
-    hash = piece->global_hash;
-  }
+  if(pipe->num_pieces > 0) hash = pipe->pieces[pipe->num_pieces - 1]->global_hash;
   dt_pthread_mutex_unlock(&dev->history_mutex);
   return hash;
 }
@@ -23,6 +23,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 
+#include "common/atomic.h"
 #include "common/debug.h"
 #include "common/darktable.h"
 #include "common/dtpthread.h"
@@ -147,6 +148,9 @@ typedef struct dt_dev_proxy_exposure_t
 
 struct dt_dev_pixelpipe_t;
 
+// longest side of the buffers kept for the scopes, in pixels
+#define DT_BACKBUF_SIZE 512
+
 typedef struct dt_backbuf_t
 {
   void *buffer;         // image data
@@ -167,6 +171,8 @@ typedef struct dt_develop_t
   int32_t image_invalid_cnt;
   uint32_t average_delay;
   uint32_t preview_average_delay;
+  // --trace flows from the last history change to the pipe run and the redraw it causes, 0 if none
+  dt_atomic_int trace_flow, trace_redraw_flow;
   struct dt_iop_module_t *gui_module; // this module claims gui expose/event callbacks.
 
   // width, height: dimensions of window
@@ -175,6 +181,7 @@ typedef struct dt_develop_t
   // image processing pipeline with caching
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
   dt_pthread_mutex_t pipe_mutex; // these are locked while the pipes are still in use
+  dt_pthread_mutex_t preview_pipe_mutex; // the preview pipe runs alongside the main one, with its own lock
 
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
@@ -212,6 +219,11 @@ typedef struct dt_develop_t
   struct dt_masks_form_gui_t *form_gui;
   // all forms to be linked here for cleanup:
   GList *allforms;
+  // drawn masks rasterised by the full and preview pipes, reused while the shapes, the ROI and the
+  // upstream distortions don't change. see dt_masks_group_render_roi()
+  GList *mask_rasters;
+  size_t mask_rasters_size;
+  dt_pthread_mutex_t mask_rasters_mutex;
 
   //full preview stuff
   int full_preview;
@@ -263,9 +275,9 @@ typedef struct dt_develop_t
     struct
     {
       // this flag is set by snapshot plugin to signal that expose of darkroom
-      // should store cairo surface as snapshot to disk using filename.
+      // should store a copy of its cairo surface as snapshot in *surface.
       gboolean request;
-      const gchar *filename;
+      cairo_surface_t **surface;
     } snapshot;
 
     // masks plugin hooks
@@ -361,6 +373,10 @@ void dt_dev_add_history_item_real(dt_develop_t *dev, struct dt_iop_module_t *mod
 void dt_dev_reload_history_items(dt_develop_t *dev);
 void dt_dev_pop_history_items_ext(dt_develop_t *dev, int32_t cnt);
 void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt);
+/** like dt_dev_pop_history_items() when the history uses the modules of the pipe and their order as they
+    are: only the modules whose state changes get their gui updated and the pipes resynchronize their
+    parameters instead of being rebuilt, so only the nodes after the first change are recomputed */
+void dt_dev_pop_history_items_synch(dt_develop_t *dev, int32_t cnt);
 void dt_dev_write_history_ext(dt_develop_t *dev, const int imgid);
 void dt_dev_write_history(dt_develop_t *dev);
 void dt_dev_read_history_ext(dt_develop_t *dev, const int imgid, gboolean no_image);
@@ -410,6 +426,10 @@ void dt_dev_get_processed_size(const dt_develop_t *dev, int *procw, int *proch);
 void dt_dev_check_zoom_bounds(dt_develop_t *dev, float *zoom_x, float *zoom_y, dt_dev_zoom_t zoom,
                               int closeup, float *boxw, float *boxh);
 float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_factor, int mode);
+// region of the main pipe output shown in the center view for the given scale and zoom position,
+// enlarged by margin times the window size on each side and clamped to the image.
+void dt_dev_get_viewport(const dt_develop_t *dev, const float scale, const float zoom_x, const float zoom_y,
+                         const int closeup, const float margin, int *x, int *y, int *wd, int *ht);
 void dt_dev_get_pointer_zoom_pos(dt_develop_t *dev, const float px, const float py, float *zoom_x,
                                  float *zoom_y);
 
@@ -447,7 +467,7 @@ void dt_dev_reorder_gui_module_list(dt_develop_t *dev);
 gboolean dt_dev_modulegroups_is_visible(dt_develop_t *dev, gchar *module);
 
 /** request snapshot */
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
@@ -28,6 +28,7 @@
 #include "common/interpolation.h"
 #include "common/module.h"
 #include "common/opencl.h"
+#include "common/trace.h"
 #include "common/usermanual_url.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -1116,14 +1117,26 @@ void dt_iop_cleanup_histogram(gpointer data, gpointer user_data)
 
 static void _init_presets(dt_iop_module_so_t *module_so)
 {
+  const int32_t module_version = module_so->version();
+
+  // the built-in presets and the legacy ones have been dealt with on a previous start
+  if(dt_gui_presets_builtin_cached(module_so->op, module_version)) return;
+
+  const double start = dt_get_wtime();
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM data.presets WHERE operation = ?1 AND writeprotect = 1", -1, &stmt,
+                              NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module_so->op, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
   if(module_so->init_presets) module_so->init_presets(module_so);
 
   // this seems like a reasonable place to check for and update legacy
   // presets.
 
-  const int32_t module_version = module_so->version();
-
-  sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(
       dt_database_get(darktable.db),
       "SELECT name, op_version, op_params, blendop_version, blendop_params FROM data.presets WHERE operation = ?1",
@@ -1310,6 +1323,12 @@ static void _init_presets(dt_iop_module_so_t *module_so)
     }
   }
   sqlite3_finalize(stmt);
+
+  dt_gui_presets_builtin_set_cached(module_so->op, module_version);
+
+  gchar *name = g_strdup_printf("presets %s", module_so->op);
+  dt_trace_span("startup", name, start, dt_get_wtime());
+  g_free(name);
 }
 
 static void _init_presets_actions(dt_iop_module_so_t *module)
@@ -1342,41 +1361,49 @@ static void _init_module_so(void *m)
 
     // Calling the accelerator initialization callback, if present
     _init_presets_actions(module);
+  }
+}
 
-    // create a gui and have the widgets register their accelerators
-    dt_iop_module_t *module_instance = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
+// create a gui and have the widgets register their accelerators
+static void _init_module_so_widget_actions(dt_iop_module_so_t *module)
+{
+  const double start = dt_get_wtime();
+  dt_iop_module_t *module_instance = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
 
-    if(module->gui_init && !dt_iop_load_module_by_so(module_instance, module, NULL))
+  if(module->gui_init && !dt_iop_load_module_by_so(module_instance, module, NULL))
+  {
+    darktable.control->accel_initialising = TRUE;
+    dt_iop_gui_init(module_instance);
+
+    static gboolean blending_accels_initialized = FALSE;
+    if(!blending_accels_initialized)
     {
-      darktable.control->accel_initialising = TRUE;
-      dt_iop_gui_init(module_instance);
+      dt_iop_colorspace_type_t cst = module->blend_colorspace(module_instance, NULL, NULL);
 
-      static gboolean blending_accels_initialized = FALSE;
-      if(!blending_accels_initialized)
+      if((module->flags() & IOP_FLAGS_SUPPORTS_BLENDING) &&
+         !(module->flags() & IOP_FLAGS_NO_MASKS) &&
+         (cst == IOP_CS_LAB || cst == IOP_CS_RGB))
       {
-        dt_iop_colorspace_type_t cst = module->blend_colorspace(module_instance, NULL, NULL);
-
-        if((module->flags() & IOP_FLAGS_SUPPORTS_BLENDING) &&
-           !(module->flags() & IOP_FLAGS_NO_MASKS) &&
-           (cst == IOP_CS_LAB || cst == IOP_CS_RGB))
-        {
-          GtkWidget *iopw = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
-          dt_iop_gui_init_blending(iopw, module_instance);
-          dt_iop_gui_cleanup_blending(module_instance);
-          gtk_widget_destroy(iopw);
+        GtkWidget *iopw = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+        dt_iop_gui_init_blending(iopw, module_instance);
+        dt_iop_gui_cleanup_blending(module_instance);
+        gtk_widget_destroy(iopw);
 
-          blending_accels_initialized = TRUE;
-        }
+        blending_accels_initialized = TRUE;
       }
-
-      module->gui_cleanup(module_instance);
-      darktable.control->accel_initialising = FALSE;
-
-      dt_iop_cleanup_module(module_instance);
     }
 
-    free(module_instance);
+    module->gui_cleanup(module_instance);
+    darktable.control->accel_initialising = FALSE;
+
+    dt_iop_cleanup_module(module_instance);
   }
+
+  free(module_instance);
+
+  gchar *name = g_strdup_printf("actions %s", module->op);
+  dt_trace_span("startup", name, start, dt_get_wtime());
+  g_free(name);
 }
 
 void dt_iop_load_modules_so(void)
@@ -1385,6 +1412,16 @@ void dt_iop_load_modules_so(void)
                                          _init_module_so, NULL);
 }
 
+void dt_iop_init_widget_actions(void)
+{
+  static gboolean initialised = FALSE;
+  if(initialised || !darktable.gui) return;
+  initialised = TRUE;
+
+  for(GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+    _init_module_so_widget_actions((dt_iop_module_so_t *)iop->data);
+}
+
 int dt_iop_load_module(dt_iop_module_t *module, dt_iop_module_so_t *module_so, dt_develop_t *dev)
 {
   memset(module, 0, sizeof(dt_iop_module_t));
@@ -1657,7 +1694,8 @@ uint64_t dt_iop_module_hash(dt_iop_module_t *module)
     if(module->dev)
     {
       dt_masks_form_t *grp = dt_masks_get_from_id(module->dev, module->blend_params->mask_id);
-      hash = dt_masks_group_get_hash(hash, grp);
+      module->mask_hash = grp ? dt_masks_group_get_hash(5381, grp) : 0;
+      hash = dt_hash(hash, (char *)&module->mask_hash, sizeof(uint64_t));
     }
     else
     {
@@ -1677,6 +1715,8 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
                           dt_dev_pixelpipe_iop_t *piece)
 {
   assert(piece->pipe == pipe);
+  // committed outside of dt_dev_pixelpipe_synch_all(), which sets the key again
+  piece->commit_key = 0;
   if(!piece->enabled)
   {
     piece->global_hash = piece->hash = 0;
@@ -1696,18 +1736,35 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
   if(module->flags() & IOP_FLAGS_ALLOW_TILING)
     piece->process_tiling_ready = 1;
 
+  // same for the per-pixel kernel
+  piece->process_pixels_ready = (module->process_pixels != NULL);
+
   if(darktable.unmuted & DT_DEBUG_PARAMS && module->so->get_introspection())
     _iop_validate_params(module->so->get_introspection()->field, params, TRUE);
 
   module->commit_params(module, params, pipe, piece);
 
   // 2. compute the hash
+  dt_iop_commit_hash(module, piece);
+
+  dt_print(DT_DEBUG_PIPE, "[pipe] commit for %s (%s) in pipe %i with hash %lu\n", module->op, module->multi_name, pipe->type, (long unsigned int)piece->hash);
+}
+
+void dt_iop_commit_hash(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  piece->mask_hash = module->mask_hash;
+  if(!piece->enabled)
+  {
+    piece->global_hash = piece->hash = 0;
+    return;
+  }
+
   // piece->hash = dt_hash(module->hash, (const char *)piece->data, piece->data_size);
   // That's actually too aggressive and unneeded, fetch only user-params checksum here.
   // We need to take mask display into account too because it's set in various ways from GUI.
-  piece->global_hash = piece->hash = dt_hash(module->hash, (const char *)&module->request_mask_display, sizeof(int));
-
-  dt_print(DT_DEBUG_PIPE, "[pipe] commit for %s (%s) in pipe %i with hash %lu\n", module->op, module->multi_name, pipe->type, (long unsigned int)piece->hash);
+  // Displaying only the mask doesn't change the output of the module though, see dt_pixelpipe_get_global_hash().
+  const int mask_display = module->request_mask_display & ~DT_DEV_PIXELPIPE_DISPLAY_MASK;
+  piece->global_hash = piece->hash = dt_hash(module->hash, (const char *)&mask_display, sizeof(int));
 }
 
 void dt_iop_gui_cleanup_module(dt_iop_module_t *module)
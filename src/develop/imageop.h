@@ -104,6 +104,11 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_ALLOW_FAST_PIPE = 1 << 12,   // Module can work with a fast pipe
   IOP_FLAGS_UNSAFE_COPY = 1 << 13,       // Unsafe to copy as part of history
   IOP_FLAGS_GUIDES_SPECIAL_DRAW = 1 << 14, // handle the grid drawing directly
+  IOP_FLAGS_SCALE_INDEPENDENT = 1 << 15,   // Output doesn't depend on the processing scale (point ops, warping)
+  IOP_FLAGS_DISPLAY_REFERRED = 1 << 16,    // Output, and all outputs after it, only need display precision
+  IOP_FLAGS_INPLACE = 1 << 17,             // process() on CPU is correct with the same buffer as input and output
+  IOP_FLAGS_FUSED_OUTPUT = 1 << 18,        // process() on CPU calls dt_dev_pixelpipe_fused_output() on its output
+  IOP_FLAGS_VOLATILE_COMMIT = 1 << 19,     // commit_params() reads state besides its params (GUI, preferences)
 } dt_iop_flags_t;
 
 typedef struct dt_iop_gui_data_t
@@ -291,6 +296,8 @@ typedef struct dt_iop_module_t
 
   // parameters hash
   uint64_t hash;
+  // hash of the drawn masks alone, part of hash. 0 without drawn masks
+  uint64_t mask_hash;
 } dt_iop_module_t;
 
 typedef struct dt_action_target_t
@@ -301,6 +308,8 @@ typedef struct dt_action_target_t
 
 /** loads and inits the modules in the plugins/ directory. */
 void dt_iop_load_modules_so(void);
+/** has the widgets of all the modules register their actions, once, see dt_shortcuts_init(). */
+void dt_iop_init_widget_actions(void);
 /** cleans up the dlopen refs. */
 void dt_iop_unload_modules_so(void);
 /** load a module for a given .so */
@@ -350,6 +359,8 @@ void dt_iop_gui_update_header(dt_iop_module_t *module);
 void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
                           struct dt_develop_blend_params_t *blendop_params, struct dt_dev_pixelpipe_t *pipe,
                           struct dt_dev_pixelpipe_iop_t *piece);
+/** updates the piece hash only, for params already committed. */
+void dt_iop_commit_hash(dt_iop_module_t *module, struct dt_dev_pixelpipe_iop_t *piece);
 void dt_iop_commit_blend_params(dt_iop_module_t *module, const struct dt_develop_blend_params_t *blendop_params);
 /** make sure the raster mask is advertised if available */
 void dt_iop_set_mask_mode(dt_iop_module_t *module, int mask_mode);
@@ -90,6 +90,38 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *
   }
 }
 
+void dt_iop_downscale_box_8(const uint8_t *in, const int32_t iw, const int32_t ih, uint8_t *out, const int32_t ow,
+                            const int32_t oh)
+{
+  const float sx = iw / (float)ow;
+  const float sy = ih / (float)oh;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, iw, ih, ow, oh, sx, sy) \
+  schedule(static)
+#endif
+  for(int32_t j = 0; j < oh; j++)
+  {
+    const int32_t y0 = j * sy;
+    const int32_t y1 = MIN(ih, MAX(y0 + 1, (int32_t)((j + 1) * sy)));
+    uint8_t *out2 = out + (size_t)4 * ow * j;
+    for(int32_t i = 0; i < ow; i++)
+    {
+      const int32_t x0 = i * sx;
+      const int32_t x1 = MIN(iw, MAX(x0 + 1, (int32_t)((i + 1) * sx)));
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+      for(int32_t y = y0; y < y1; y++)
+      {
+        const uint8_t *in2 = in + (size_t)4 * ((size_t)iw * y + x0);
+        for(int32_t x = x0; x < x1; x++, in2 += 4)
+          for(int c = 0; c < 4; c++) sum[c] += in2[c];
+      }
+      const uint32_t n = (uint32_t)(y1 - y0) * (x1 - x0);
+      for(int c = 0; c < 4; c++) out2[4 * i + c] = (sum[c] + n / 2) / n;
+    }
+  }
+}
+
 void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw,
                             int32_t ibh, uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh,
                             int32_t obw, int32_t obh)
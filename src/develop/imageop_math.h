@@ -36,6 +36,11 @@
 void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *out, int32_t ow, int32_t oh,
                             const dt_image_orientation_t orientation, uint32_t *width, uint32_t *height);
 
+/** box filter downscaling of packed 4-channel 8-bit buffers: each output pixel is the mean of the input
+ * pixels it covers. ow and oh must not be larger than iw and ih. */
+void dt_iop_downscale_box_8(const uint8_t *in, const int32_t iw, const int32_t ih, uint8_t *out, const int32_t ow,
+                            const int32_t oh);
+
 /** for homebrew pixel pipe: zoom pixel array. */
 void dt_iop_clip_and_zoom(float *out, const float *const in, const struct dt_iop_roi_t *const roi_out,
                           const struct dt_iop_roi_t *const roi_in, const int32_t out_stride,
@@ -346,6 +346,8 @@ int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
                           float **buffer, int *roi, float scale);
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                               const dt_iop_roi_t *roi, float *buffer);
+/** free the drawn masks rasterised by dt_masks_group_render_roi() for the pipes of dev */
+void dt_masks_raster_cache_cleanup(dt_develop_t *dev);
 
 // returns current masks version
 int dt_masks_version(void);
@@ -70,6 +70,9 @@
   returning a pointer to a distorted mask (DT) with same size as used in the module wanting the refinement.
   This DM is finally used to refine the original mask.
 
+  The pipe keeps the IM and DM through dt_dev_get_detail_mask(), so modules refining with the same threshold
+  share the IM and only distort it from the closest module before them.
+
   All other refinements and parametric parameters are untouched.
 
   Some additional comments:
@@ -662,13 +662,141 @@ static int _group_get_mask_roi(const dt_iop_module_t *const restrict module,
   return nb_ok != 0;
 }
 
+// memory kept by the rasterised masks of the GUI pipes
+#define DT_MASKS_RASTER_CACHE_SIZE ((size_t)128 << 20)
+
+typedef struct dt_masks_raster_t
+{
+  uint64_t hash; // shapes, ROI and upstream distortions
+  size_t size;
+  float *mask;
+} dt_masks_raster_t;
+
+static void _raster_free(dt_masks_raster_t *raster)
+{
+  dt_free_align(raster->mask);
+  free(raster);
+}
+
+static uint64_t _raster_hash(const dt_iop_module_t *const module, const dt_dev_pixelpipe_iop_t *const piece,
+                             dt_masks_form_t *const form, const dt_iop_roi_t *const roi)
+{
+  const dt_dev_pixelpipe_t *const pipe = piece->pipe;
+  const dt_develop_t *const dev = module->dev;
+
+  // the shapes were hashed when the module was committed, walking all their points again on each run
+  // is measurable with hundreds of them
+  uint64_t hash = piece->mask_hash ? piece->mask_hash : dt_masks_group_get_hash(5381, form);
+  hash = dt_hash(hash, (const char *)&pipe->image.id, sizeof(int32_t));
+  hash = dt_hash(hash, (const char *)&pipe->iwidth, sizeof(int));
+  hash = dt_hash(hash, (const char *)&pipe->iheight, sizeof(int));
+  hash = dt_hash(hash, (const char *)&pipe->iscale, sizeof(float));
+  hash = dt_hash(hash, (const char *)roi, sizeof(dt_iop_roi_t));
+
+  // the shapes are brought to the module through the distortions of the modules up to itself,
+  // see dt_dev_distort_transform_locked()
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *const p = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(p->module->iop_order > module->iop_order) break;
+
+    if(p->enabled && (p->module->operation_tags() & IOP_TAG_DISTORT)
+       && !(dev->gui_module && dev->gui_module != p->module
+            && (dev->gui_module->operation_tags_filter() & p->module->operation_tags())))
+    {
+      hash = dt_hash(hash, (const char *)&p->hash, sizeof(uint64_t));
+      hash = dt_hash(hash, (const char *)&p->buf_in, sizeof(dt_iop_roi_t));
+      hash = dt_hash(hash, (const char *)&p->buf_out, sizeof(dt_iop_roi_t));
+    }
+  }
+
+  return hash;
+}
+
+// copy a cached mask to buffer and make it the most recent, FALSE if there is none
+static gboolean _raster_cache_get(dt_develop_t *dev, const uint64_t hash, const size_t size, float *buffer)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&dev->mask_rasters_mutex);
+  for(GList *l = dev->mask_rasters; l; l = g_list_next(l))
+  {
+    dt_masks_raster_t *raster = (dt_masks_raster_t *)l->data;
+    if(raster->hash == hash && raster->size == size)
+    {
+      memcpy(buffer, raster->mask, size * sizeof(float));
+      dev->mask_rasters = g_list_remove_link(dev->mask_rasters, l);
+      dev->mask_rasters = g_list_concat(l, dev->mask_rasters);
+      found = TRUE;
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&dev->mask_rasters_mutex);
+  return found;
+}
+
+static void _raster_cache_put(dt_develop_t *dev, const uint64_t hash, const size_t size, const float *buffer)
+{
+  if(size * sizeof(float) > DT_MASKS_RASTER_CACHE_SIZE / 4) return;
+
+  dt_masks_raster_t *raster = malloc(sizeof(dt_masks_raster_t));
+  float *mask = dt_alloc_align_float(size);
+  if(!raster || !mask)
+  {
+    free(raster);
+    dt_free_align(mask);
+    return;
+  }
+  memcpy(mask, buffer, size * sizeof(float));
+  raster->hash = hash;
+  raster->size = size;
+  raster->mask = mask;
+
+  dt_pthread_mutex_lock(&dev->mask_rasters_mutex);
+  dev->mask_rasters = g_list_prepend(dev->mask_rasters, raster);
+  dev->mask_rasters_size += size * sizeof(float);
+
+  // drop the least recently used masks
+  while(dev->mask_rasters_size > DT_MASKS_RASTER_CACHE_SIZE)
+  {
+    GList *last = g_list_last(dev->mask_rasters);
+    dt_masks_raster_t *old = (dt_masks_raster_t *)last->data;
+    dev->mask_rasters_size -= old->size * sizeof(float);
+    dev->mask_rasters = g_list_delete_link(dev->mask_rasters, last);
+    _raster_free(old);
+  }
+  dt_pthread_mutex_unlock(&dev->mask_rasters_mutex);
+}
+
+void dt_masks_raster_cache_cleanup(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->mask_rasters_mutex);
+  g_list_free_full(dev->mask_rasters, (GDestroyNotify)_raster_free);
+  dev->mask_rasters = NULL;
+  dev->mask_rasters_size = 0;
+  dt_pthread_mutex_unlock(&dev->mask_rasters_mutex);
+}
+
 int dt_masks_group_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form,
                               const dt_iop_roi_t *roi, float *buffer)
 {
   const double start = dt_get_wtime();
   if(!form) return 0;
 
+  // The full and preview pipes of the darkroom share their rasterised masks, so only shape edits
+  // render them again. Exports render once and the hash reads the shapes from the darkroom.
+  const gboolean cacheable = module->dev == darktable.develop
+                             && (piece->pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW));
+  const size_t size = (size_t)roi->width * roi->height;
+  const uint64_t hash = cacheable ? _raster_hash(module, piece, form, roi) : 0;
+
+  if(cacheable && _raster_cache_get(module->dev, hash, size, buffer))
+  {
+    dt_vprint(DT_DEBUG_MASKS, "[masks] reusing the rasterised masks of %s\n", module->op);
+    return 1;
+  }
+
   const int ok = dt_masks_get_mask_roi(module, piece, form, roi, buffer);
+  if(ok && cacheable) _raster_cache_put(module->dev, hash, size, buffer);
 
   if(darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_MASKS, "[masks] render all masks took %0.04f sec\n", dt_get_wtime() - start);
@@ -1914,87 +1914,68 @@ void dt_masks_update_image(dt_develop_t *dev)
   dt_dev_refresh_ui_images(dev);
 }
 
-// adds formid to used array
-// if formid is a group it adds all the forms that belongs to that group
-static void _cleanup_unused_recurs(GList *forms, int formid, int *used, int nb)
+// adds formid to the used set
+// if formid is a group it adds all the forms that belongs to that group. forms already in the set have
+// been walked through, so each form is visited once however many groups share it
+static void _cleanup_unused_recurs(GHashTable *forms, const int formid, GHashTable *used)
 {
-  // first, we search for the formid in used table
-  for(int i = 0; i < nb; i++)
-  {
-    if(used[i] == 0)
-    {
-      // we store the formid
-      used[i] = formid;
-      break;
-    }
-    if(used[i] == formid) break;
-  }
+  if(g_hash_table_contains(used, GINT_TO_POINTER(formid))) return;
+  g_hash_table_add(used, GINT_TO_POINTER(formid));
 
   // if the form is a group, we iterate through the sub-forms
-  dt_masks_form_t *form = dt_masks_get_from_id_ext(forms, formid);
+  dt_masks_form_t *form = (dt_masks_form_t *)g_hash_table_lookup(forms, GINT_TO_POINTER(formid));
   if(form && (form->type & DT_MASKS_GROUP))
   {
     for(GList *grpts = form->points; grpts; grpts = g_list_next(grpts))
     {
       dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)grpts->data;
-      _cleanup_unused_recurs(forms, grpt->formid, used, nb);
+      _cleanup_unused_recurs(forms, grpt->formid, used);
     }
   }
 }
 
-// removes from _forms all forms that are not used in history_list up to history_end
-static int _masks_cleanup_unused(GList **_forms, GList *history_list, const int history_end)
+// removes from _forms all forms that are not used in history up to history_end.
+// first_use maps the mask_id of the history items to the index of the first item using it
+static int _masks_cleanup_unused(GList **_forms, GHashTable *first_use, const int history_end)
 {
   int masks_removed = 0;
-  GList *forms = *_forms;
-
-  // we create a table to store the ids of used forms
-  guint nbf = g_list_length(forms);
-  int *used = calloc(nbf, sizeof(int));
 
-  // check in history if the module has drawn masks and add it to used array
-  int num = 0;
-  for(GList *history = history_list; history && num < history_end; history = g_list_next(history))
+  // index the forms by id, keeping the first one as dt_masks_get_from_id_ext() does
+  GHashTable *forms = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for(GList *l = *_forms; l; l = g_list_next(l))
   {
-    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
-    dt_develop_blend_params_t *blend_params = hist->blend_params;
-    if(blend_params)
-    {
-      if(blend_params->mask_id > 0) _cleanup_unused_recurs(forms, blend_params->mask_id, used, nbf);
-    }
-    num++;
+    dt_masks_form_t *f = (dt_masks_form_t *)l->data;
+    if(!g_hash_table_contains(forms, GINT_TO_POINTER(f->formid)))
+      g_hash_table_insert(forms, GINT_TO_POINTER(f->formid), f);
   }
 
+  // the masks drawn by the modules before history_end, with all the forms they group
+  GHashTable *used = g_hash_table_new(g_direct_hash, g_direct_equal);
+  GHashTableIter iter;
+  gpointer mask_id, index;
+  g_hash_table_iter_init(&iter, first_use);
+  while(g_hash_table_iter_next(&iter, &mask_id, &index))
+    if(GPOINTER_TO_INT(index) < history_end) _cleanup_unused_recurs(forms, GPOINTER_TO_INT(mask_id), used);
+
   // and we delete all unused forms
-  GList *shapes = forms;
-  while(shapes)
+  GList *kept = NULL;
+  for(GList *l = *_forms; l; l = g_list_next(l))
   {
-    dt_masks_form_t *f = (dt_masks_form_t *)shapes->data;
-    int u = 0;
-    for(int i = 0; i < nbf; i++)
-    {
-      if(used[i] == f->formid)
-      {
-        u = 1;
-        break;
-      }
-      if(used[i] == 0) break;
-    }
-
-    shapes = g_list_next(shapes); // need to get 'next' now, because we may be removing the current node
-
-    if(u == 0)
+    dt_masks_form_t *f = (dt_masks_form_t *)l->data;
+    if(g_hash_table_contains(used, GINT_TO_POINTER(f->formid)))
+      kept = g_list_prepend(kept, f);
+    else
     {
-      forms = g_list_remove(forms, f);
       // and add it to allforms for cleanup
-      darktable.develop->allforms = g_list_append(darktable.develop->allforms, f);
+      darktable.develop->allforms = g_list_prepend(darktable.develop->allforms, f);
       masks_removed = 1;
     }
   }
+  g_list_free(*_forms);
+  *_forms = g_list_reverse(kept);
 
-  free(used);
-
-  *_forms = forms;
+  g_hash_table_destroy(used);
+  g_hash_table_destroy(forms);
 
   return masks_removed;
 }
@@ -2005,20 +1986,35 @@ static int _masks_cleanup_unused(GList **_forms, GList *history_list, const int
 // for a more accurate cleanup the user should compress history
 void dt_masks_cleanup_unused_from_list(GList *history_list)
 {
+  // the first history item using each mask, so that each hist->forms entry only looks at the masks
+  // and not at the whole history before it
+  GHashTable *first_use = g_hash_table_new(g_direct_hash, g_direct_equal);
+  int num = 0;
+  for(const GList *history = history_list; history; history = g_list_next(history))
+  {
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    dt_develop_blend_params_t *blend_params = hist->blend_params;
+    if(blend_params && blend_params->mask_id > 0
+       && !g_hash_table_contains(first_use, GINT_TO_POINTER(blend_params->mask_id)))
+      g_hash_table_insert(first_use, GINT_TO_POINTER(blend_params->mask_id), GINT_TO_POINTER(num));
+    num++;
+  }
+
   // a mask is used in a given hist->forms entry if it is used up to the next hist->forms
   // so we are going to remove for each hist->forms from the top
-  int num = g_list_length(history_list);
   int history_end = num;
   for(const GList *history = g_list_last(history_list); history; history = g_list_previous(history))
   {
     dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
     if(hist->forms && strcmp(hist->op_name, "mask_manager") == 0)
     {
-      _masks_cleanup_unused(&hist->forms, history_list, history_end);
+      _masks_cleanup_unused(&hist->forms, first_use, history_end);
       history_end = num - 1;
     }
     num--;
   }
+
+  g_hash_table_destroy(first_use);
 }
 
 void dt_masks_cleanup_unused(dt_develop_t *dev)
@@ -2765,6 +2765,126 @@ static void _path_falloff_roi(float *buffer, int *p0, int *p1, int bw, int bh)
   }
 }
 
+// add the coverage of the span [xa; xb] of a row, pixel k covering [k - 0.5; k + 0.5[.
+// Crossings clamped to the roi borders by _path_crop_to_roi() cover the whole border pixel.
+static inline void _path_fill_span(float *const line, const int width, const float xa, const float xb)
+{
+  const float a = (xa <= 0.0f) ? -0.5f : xa;
+  const float b = (xb >= width - 1) ? width - 0.5f : xb;
+  if(b <= a) return;
+
+  const int ka = (int)floorf(a + 0.5f);
+  const int kb = MIN((int)floorf(b + 0.5f), width - 1);
+
+  if(ka == kb)
+  {
+    line[ka] = MIN(line[ka] + b - a, 1.0f);
+    return;
+  }
+
+  line[ka] = MIN(line[ka] + (float)ka + 0.5f - a, 1.0f);
+  for(int k = ka + 1; k < kb; k++) line[k] = 1.0f;
+  line[kb] = MIN(line[kb] + b - (float)kb + 0.5f, 1.0f);
+}
+
+// even-odd fill of a closed polygon sampled at the center of the rows yymin to yymax.
+// The crossings of the edges are bucketed per row first, then each row sorts its own
+// and fills its spans independently of the others.
+static int _path_fill_scanlines(const float *const poly, const int count, float *const buffer,
+                                const int width, const int yymin, const int yymax)
+{
+  const int rows = yymax - yymin + 1;
+  if(rows <= 0 || count < 2) return 1;
+
+  int *const offsets = calloc((size_t)rows + 1, sizeof(int));
+  int *const cursor = malloc(sizeof(int) * rows);
+  if(!offsets || !cursor)
+  {
+    free(offsets);
+    free(cursor);
+    return 0;
+  }
+
+  float *crossings = NULL;
+
+  // first pass counts the crossings of each row, second pass stores them
+  for(int pass = 0; pass < 2; pass++)
+  {
+    float xlast = poly[(count - 1) * 2];
+    float ylast = poly[(count - 1) * 2 + 1];
+
+    for(int i = 0; i < count; i++)
+    {
+      float xstart = xlast;
+      float ystart = ylast;
+      float xend = xlast = poly[i * 2];
+      float yend = ylast = poly[i * 2 + 1];
+
+      if(ystart > yend)
+      {
+        float tmp;
+        tmp = ystart, ystart = yend, yend = tmp;
+        tmp = xstart, xstart = xend, xend = tmp;
+      }
+
+      // horizontal edges don't cross any row center
+      const float m = (xstart - xend) / (ystart - yend);
+
+      for(int yy = MAX((int)ceilf(ystart), yymin); (float)yy < yend && yy <= yymax; yy++)
+      {
+        if(pass == 0)
+          offsets[yy - yymin + 1]++;
+        else
+          crossings[cursor[yy - yymin]++] = xstart + m * (yy - ystart);
+      }
+    }
+
+    if(pass == 0)
+    {
+      for(int r = 0; r < rows; r++)
+      {
+        offsets[r + 1] += offsets[r];
+        cursor[r] = offsets[r];
+      }
+      crossings = dt_alloc_align_float(MAX(offsets[rows], 1));
+      if(!crossings)
+      {
+        free(offsets);
+        free(cursor);
+        return 0;
+      }
+    }
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(rows, yymin, width, offsets, crossings, buffer) \
+  schedule(static)
+#endif
+  for(int r = 0; r < rows; r++)
+  {
+    float *const xs = crossings + offsets[r];
+    const int n = offsets[r + 1] - offsets[r];
+
+    // a handful of crossings per row : insertion sort
+    for(int k = 1; k < n; k++)
+    {
+      const float v = xs[k];
+      int j = k - 1;
+      for(; j >= 0 && xs[j] > v; j--) xs[j + 1] = xs[j];
+      xs[j + 1] = v;
+    }
+
+    float *const line = buffer + (size_t)(r + yymin) * width;
+    for(int k = 0; k + 1 < n; k += 2) _path_fill_span(line, width, xs[k], xs[k + 1]);
+  }
+
+  dt_free_align(crossings);
+  free(offsets);
+  free(cursor);
+  return 1;
+}
+
 // build a stamp which can be combined with other shapes in the same group
 // prerequisite: 'buffer' is all zeros
 static int _path_get_mask_roi(const dt_iop_module_t *const module, const dt_dev_pixelpipe_iop_t *const piece,
@@ -2949,80 +3069,17 @@ static int _path_get_mask_roi(const dt_iop_module_t *const module, const dt_dev_
     }
     else
     {
-      // all other cases
-
-      // edge-flag polygon fill: we write all the point around the path into the buffer
-      float xlast = cpoints[(points_count - 1) * 2];
-      float ylast = cpoints[(points_count - 1) * 2 + 1];
-
-      for(int i = nb_corner * 3; i < points_count; i++)
-      {
-        float xstart = xlast;
-        float ystart = ylast;
-
-        float xend = xlast = cpoints[i * 2];
-        float yend = ylast = cpoints[i * 2 + 1];
-
-        if(ystart > yend)
-        {
-          float tmp;
-          tmp = ystart, ystart = yend, yend = tmp;
-          tmp = xstart, xstart = xend, xend = tmp;
-        }
-
-        const float m = (xstart - xend) / (ystart - yend); // we don't need special handling of ystart==yend
-                                                           // as following loop will take care
-
-        for(int yy = (int)ceilf(ystart); (float)yy < yend;
-            yy++) // this would normally never touch the last roi line => see comment further above
-        {
-          const float xcross = xstart + m * (yy - ystart);
-
-          int xx = floorf(xcross);
-          if((float)xx + 0.5f <= xcross) xx++;
-
-          if(xx < 0 || xx >= width || yy < 0 || yy >= height)
-            continue; // sanity check just to be on the safe side
-
-          const size_t index = (size_t)yy * width + xx;
-
-          buffer[index] = 1.0f - buffer[index];
-        }
-      }
-
-      if(darktable.unmuted & DT_DEBUG_PERF)
-      {
-        dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill draw path took %0.04f sec\n", form->name,
-                 dt_get_wtime() - start2);
-        start2 = dt_get_wtime();
-      }
-
-      // we fill the inside plain
-      // we don't need to deal with parts of shape outside of roi
-      const int xxmin = MAX(xmin, 0);
-      const int xxmax = MIN(xmax, width - 1);
+      // all other cases : scanline fill of the part of the path within roi
       const int yymin = MAX(ymin, 0);
       const int yymax = MIN(ymax, height - 1);
 
-#ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__)
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(xxmin, xxmax, yymin, yymax, width) \
-  shared(buffer) schedule(static) num_threads(MIN(8,darktable.num_openmp_threads))
-#else
-#pragma omp parallel for shared(buffer)
-#endif
-#endif
-      for(int yy = yymin; yy <= yymax; yy++)
+      if(!_path_fill_scanlines(cpoints + 2 * (nb_corner * 3), points_count - nb_corner * 3, buffer, width,
+                               yymin, yymax))
       {
-        int state = 0;
-        for(int xx = xxmin; xx <= xxmax; xx++)
-        {
-          const size_t index = (size_t)yy * width + xx;
-          const float v = buffer[index];
-          if(v > 0.5f) state = !state;
-          if(state) buffer[index] = 1.0f;
-        }
+        dt_free_align(cpoints);
+        dt_free_align(points);
+        dt_free_align(border);
+        return 0;
       }
 
       if(darktable.unmuted & DT_DEBUG_PERF)
@@ -0,0 +1,256 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/pixelpipe_arena.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "common/metrics.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// smaller blocks are cheap enough to get from the system. Per-thread scratch of a few rows is often just above.
+#define DT_ARENA_MIN_SIZE ((size_t)64 << 10)
+#define DT_ARENA_MIN_BIT 15 // log2(DT_ARENA_MIN_SIZE / 2)
+// 4 classes per power of two from DT_ARENA_MIN_SIZE / 2, up to 2^63 bytes
+#define DT_ARENA_CLASSES (4 * (64 - DT_ARENA_MIN_BIT))
+#define DT_ARENA_MAGIC 0x61726e61u
+
+// in front of each block, the buffer handed out starts DT_CACHELINE_BYTES after it
+typedef struct _header_t
+{
+  dt_dev_pixelpipe_arena_t *arena; // NULL if the block goes back to the system
+  struct _header_t *next;          // in the free list of its size class
+  size_t size;                     // usable bytes after the header
+  uint32_t magic;
+  int size_class;
+} _header_t;
+
+struct dt_dev_pixelpipe_arena_t
+{
+  dt_pthread_mutex_t lock;
+  _header_t *free[DT_ARENA_CLASSES];
+  size_t max_memory;  // usable bytes kept in the free lists at most
+  size_t free_memory; // usable bytes in the free lists
+  int used;           // blocks handed out and not released yet
+  gboolean closed;    // the pipe is gone, the last released block frees the arena
+  uint64_t reused, requests;
+};
+
+static __thread dt_dev_pixelpipe_arena_t *_current = NULL;
+
+// blocks of size lie in ]class_size(c - 1); class_size(c)], 4 classes per power of two
+static int _size_class(const size_t size)
+{
+  const size_t n = size - 1;
+  const int bit = 63 - __builtin_clzll((unsigned long long)n);
+  const int top = (int)(n >> (bit - 2)); // 4 to 7
+  return 4 * (bit - DT_ARENA_MIN_BIT) + top - 4;
+}
+
+static size_t _class_size(const int size_class)
+{
+  const int bit = size_class / 4 + DT_ARENA_MIN_BIT;
+  const size_t top = size_class % 4 + 4;
+  return (top + 1) << (bit - 2);
+}
+
+// blocks from DT_HUGE_PAGE_BYTES on are aligned and advised for transparent huge pages
+static void *_block_alloc(const size_t total)
+{
+  const gboolean huge = total >= DT_HUGE_PAGE_BYTES;
+  const size_t alignment = huge ? DT_HUGE_PAGE_BYTES : DT_CACHELINE_BYTES;
+#ifdef _WIN32
+  return _aligned_malloc(total, alignment);
+#else
+  void *block = NULL;
+  if(posix_memalign(&block, alignment, total)) return NULL;
+#ifdef MADV_HUGEPAGE
+  if(huge) madvise(block, total, MADV_HUGEPAGE);
+#endif
+  return block;
+#endif
+}
+
+static void _block_free(_header_t *header)
+{
+#ifdef _WIN32
+  _aligned_free(header);
+#else
+  free(header);
+#endif
+}
+
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_new(const size_t max_memory)
+{
+  dt_dev_pixelpipe_arena_t *arena = (dt_dev_pixelpipe_arena_t *)calloc(1, sizeof(dt_dev_pixelpipe_arena_t));
+  if(!arena) return NULL;
+  dt_pthread_mutex_init(&arena->lock, NULL);
+  arena->max_memory = max_memory;
+  return arena;
+}
+
+static void _arena_free(dt_dev_pixelpipe_arena_t *arena)
+{
+  dt_pthread_mutex_destroy(&arena->lock);
+  free(arena);
+}
+
+void dt_dev_pixelpipe_arena_destroy(dt_dev_pixelpipe_arena_t *arena)
+{
+  if(!arena) return;
+
+  _header_t *blocks = NULL;
+  dt_pthread_mutex_lock(&arena->lock);
+  arena->closed = TRUE;
+  for(int k = 0; k < DT_ARENA_CLASSES; k++)
+  {
+    while(arena->free[k])
+    {
+      _header_t *header = arena->free[k];
+      arena->free[k] = header->next;
+      header->next = blocks;
+      blocks = header;
+    }
+  }
+  arena->free_memory = 0;
+  const gboolean unused = (arena->used == 0);
+  dt_pthread_mutex_unlock(&arena->lock);
+
+  while(blocks)
+  {
+    _header_t *next = blocks->next;
+    _block_free(blocks);
+    blocks = next;
+  }
+  if(unused) _arena_free(arena);
+}
+
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_set_current(dt_dev_pixelpipe_arena_t *arena)
+{
+  dt_dev_pixelpipe_arena_t *previous = _current;
+  _current = arena;
+  return previous;
+}
+
+void dt_dev_pixelpipe_arena_print(dt_dev_pixelpipe_arena_t *arena, const char *name)
+{
+  if(!arena || !(darktable.unmuted & DT_DEBUG_MEMORY)) return;
+
+  dt_pthread_mutex_lock(&arena->lock);
+  fprintf(stderr, "[pixelpipe_arena] %s: %llu of %llu buffers reused, %zu MiB kept\n", name,
+          (long long unsigned int)arena->reused, (long long unsigned int)arena->requests,
+          arena->free_memory / (1024 * 1024));
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+void *dt_pixelpipe_alloc_align(const size_t size)
+{
+  dt_dev_pixelpipe_arena_t *arena = (size >= DT_ARENA_MIN_SIZE) ? _current : NULL;
+  const int size_class = arena ? _size_class(size) : -1;
+  const size_t usable = arena ? _class_size(size_class) : dt_round_size(size, DT_CACHELINE_BYTES);
+
+  _header_t *header = NULL;
+  if(arena)
+  {
+    dt_pthread_mutex_lock(&arena->lock);
+    header = arena->free[size_class];
+    if(header)
+    {
+      arena->free[size_class] = header->next;
+      arena->free_memory -= usable;
+      arena->reused++;
+    }
+    arena->requests++;
+    arena->used++;
+    dt_pthread_mutex_unlock(&arena->lock);
+  }
+
+  if(!header)
+  {
+    header = (_header_t *)_block_alloc(DT_CACHELINE_BYTES + usable);
+    if(!header)
+    {
+      // give the slot back, the arena may have been closed meanwhile
+      if(arena)
+      {
+        dt_pthread_mutex_lock(&arena->lock);
+        const gboolean last = (--arena->used == 0) && arena->closed;
+        dt_pthread_mutex_unlock(&arena->lock);
+        if(last) _arena_free(arena);
+      }
+      return NULL;
+    }
+    header->arena = arena;
+    header->size = usable;
+    header->magic = DT_ARENA_MAGIC;
+    header->size_class = size_class;
+  }
+  header->next = NULL;
+
+  dt_metrics_mem_alloc(DT_CACHELINE_BYTES + usable);
+  return (char *)header + DT_CACHELINE_BYTES;
+}
+
+void *dt_pixelpipe_alloc_perthread(const size_t n, const size_t objsize, size_t *padded_size)
+{
+  const size_t cache_lines = (n * objsize + DT_CACHELINE_BYTES - 1) / DT_CACHELINE_BYTES;
+  *padded_size = DT_CACHELINE_BYTES * cache_lines / objsize;
+  return dt_pixelpipe_alloc_align(DT_CACHELINE_BYTES * cache_lines * dt_get_num_threads());
+}
+
+void dt_pixelpipe_free_align(void *mem)
+{
+  if(!mem) return;
+
+  _header_t *header = (_header_t *)((char *)mem - DT_CACHELINE_BYTES);
+  assert(header->magic == DT_ARENA_MAGIC);
+  dt_metrics_mem_free(DT_CACHELINE_BYTES + header->size);
+
+  dt_dev_pixelpipe_arena_t *arena = header->arena;
+  if(!arena)
+  {
+    _block_free(header);
+    return;
+  }
+
+  dt_pthread_mutex_lock(&arena->lock);
+  arena->used--;
+  const gboolean keep = !arena->closed && arena->free_memory + header->size <= arena->max_memory;
+  if(keep)
+  {
+    header->next = arena->free[header->size_class];
+    arena->free[header->size_class] = header;
+    arena->free_memory += header->size;
+  }
+  const gboolean last = arena->closed && arena->used == 0;
+  dt_pthread_mutex_unlock(&arena->lock);
+
+  if(!keep) _block_free(header);
+  if(last) _arena_free(arena);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
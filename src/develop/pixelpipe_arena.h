@@ -0,0 +1,82 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+/**
+ * Recycles the large temporary buffers of the modules from one run of a pipe to the next.
+ *
+ * Each darkroom pipe owns an arena when the `pixelpipe_arena_memory` budget is set. While a module
+ * processes, the arena of its pipe is the current one of the thread running the pipe, and
+ * dt_pixelpipe_alloc_align() takes blocks from it: freed blocks go back to free lists by size class
+ * (4 per power of two) instead of the system, so the next run of the module gets the same pages back
+ * without faulting them in again. Blocks of 2 MiB and more are backed by transparent huge pages where
+ * the system supports it.
+ *
+ * The per-thread scratch of the OpenMP loops of the modules comes from the same place through
+ * dt_pixelpipe_alloc_perthread(), so the workspace of each thread is set up once per pipe rather than on
+ * each call.
+ *
+ * Outside of a module run, from other threads or without arena, dt_pixelpipe_alloc_align() falls back
+ * to a plain aligned allocation. Blocks must always be released with dt_pixelpipe_free_align(), which
+ * may be called from any thread, even after the pipe is gone.
+ */
+
+typedef struct dt_dev_pixelpipe_arena_t dt_dev_pixelpipe_arena_t;
+
+/** new arena keeping up to max_memory bytes of free blocks */
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_new(const size_t max_memory);
+
+/** release the free blocks. The arena itself goes away with the last block still in use. */
+void dt_dev_pixelpipe_arena_destroy(dt_dev_pixelpipe_arena_t *arena);
+
+/** make arena the current one of this thread, NULL for none. Returns the previous one. */
+dt_dev_pixelpipe_arena_t *dt_dev_pixelpipe_arena_set_current(dt_dev_pixelpipe_arena_t *arena);
+
+/** print how many requests were served from the free lists, with -d memory */
+void dt_dev_pixelpipe_arena_print(dt_dev_pixelpipe_arena_t *arena, const char *name);
+
+/** allocate size bytes aligned on DT_CACHELINE_BYTES, from the current arena if any */
+void *dt_pixelpipe_alloc_align(const size_t size);
+
+static inline float *dt_pixelpipe_alloc_align_float(const size_t pixels)
+{
+  return (float *)dt_pixelpipe_alloc_align(pixels * sizeof(float));
+}
+
+/** n objects of objsize bytes for each thread, like dt_alloc_perthread(): *padded_size objects per thread
+ *  so that each thread starts on its own cache line. Access with dt_get_perthread(), release with
+ *  dt_pixelpipe_free_align(). */
+void *dt_pixelpipe_alloc_perthread(const size_t n, const size_t objsize, size_t *padded_size);
+
+static inline float *dt_pixelpipe_alloc_perthread_float(const size_t n, size_t *padded_size)
+{
+  return (float *)dt_pixelpipe_alloc_perthread(n, sizeof(float), padded_size);
+}
+
+/** release a block of dt_pixelpipe_alloc_align() */
+void dt_pixelpipe_free_align(void *mem);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
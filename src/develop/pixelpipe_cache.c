@@ -17,10 +17,16 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/half.h"
+#include "common/memory_governor.h"
+#ifdef HAVE_OPENCL
+#include "common/opencl.h"
+#endif
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
 #include "libs/colorpicker.h"
+#include <float.h>
 #include <stdlib.h>
 
 
@@ -33,8 +39,150 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
+typedef struct dt_dev_pixelpipe_cache_line_t
+{
+  uint64_t hash;
+  void *data;
+  size_t size;
+  dt_iop_buffer_dsc_t dsc;
+  uint64_t last_used; // value of cache->clock at the last query hitting this line
+  int32_t weight;     // added to the age, negative values make the line more important
+  double cost;        // time in seconds it took to compute the content of the line
+  uint64_t hits;
+  size_t used_size;   // bytes of data requested when the line was filled
+  gboolean allow_half; // the content tolerates being kept as half floats
+  gboolean packed;    // data holds used_size / 2 bytes of half floats, size is that
+} dt_dev_pixelpipe_cache_line_t;
+
+static void _line_free(gpointer data)
+{
+  dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)data;
+  dt_free_align(line->data);
+  free(line);
+}
+
+#ifdef HAVE_OPENCL
+typedef struct dt_dev_pixelpipe_cache_device_t
+{
+  void *data;         // host buffer of the line, key of the device index
+  uint64_t hash;      // hash of the line when the device copy was kept
+  void *mem;          // cl_mem owned by the cache
+  int devid;
+  int width, height, bpp;
+  uint64_t last_used; // value of cache->queries at the last use
+} dt_dev_pixelpipe_cache_device_t;
+
+static inline size_t _device_size(const dt_dev_pixelpipe_cache_device_t *entry)
+{
+  return (size_t)entry->width * entry->height * entry->bpp;
+}
+
+// hash of the line currently held by the host buffer, (uint64_t)-1 if none.
+static uint64_t _data_hash(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+    return (line && !line->packed) ? line->hash : (uint64_t)-1;
+  }
+
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) return cache->hash[k];
+  return -1;
+}
+
+// remove the device copy from the index and release it. If to_host is set and the line still holds
+// the same content, copy it back to the host buffer first, or invalidate the line if that fails.
+static void _device_drop(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_device_t *entry,
+                         const gboolean to_host)
+{
+  g_hash_table_remove(cache->device, entry->data);
+  cache->device_memory -= _device_size(entry);
+
+  if(to_host && entry->hash != (uint64_t)-1 && _data_hash(cache, entry->data) == entry->hash)
+  {
+    // the device may be locked by another pipe meanwhile, but command queues are thread-safe.
+    if(dt_opencl_copy_device_to_host(entry->devid, entry->data, entry->mem, entry->width, entry->height,
+                                     entry->bpp) != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[pixelpipe_cache] couldn't copy back a cache line from device %i\n", entry->devid);
+      dt_dev_pixelpipe_cache_invalidate(cache, entry->data);
+    }
+  }
+
+  dt_opencl_release_mem_object(entry->mem);
+  free(entry);
+}
+
+// the host buffer gets a new content or is freed: its device copy is worthless.
+static void _device_forget(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  if(!cache->device || !data) return;
+  dt_dev_pixelpipe_cache_device_t *entry
+      = (dt_dev_pixelpipe_cache_device_t *)g_hash_table_lookup(cache->device, data);
+  if(entry) _device_drop(cache, entry, FALSE);
+}
+
+static void _device_forget_all(dt_dev_pixelpipe_cache_t *cache)
+{
+  if(!cache->device) return;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, cache->device);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    dt_dev_pixelpipe_cache_device_t *entry = (dt_dev_pixelpipe_cache_device_t *)value;
+    dt_opencl_release_mem_object(entry->mem);
+    free(entry);
+    g_hash_table_iter_remove(&iter);
+  }
+  cache->device_memory = 0;
+}
+
+static gboolean _on_device(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  return cache->device && g_hash_table_contains(cache->device, data);
+}
+#else
+static inline void _device_forget(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+}
+
+static inline void _device_forget_all(dt_dev_pixelpipe_cache_t *cache)
+{
+}
+
+static inline gboolean _on_device(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  return FALSE;
+}
+#endif
+
+int dt_dev_pixelpipe_cache_init_hashed(dt_dev_pixelpipe_cache_t *cache, size_t max_memory)
+{
+  memset(cache, 0, sizeof(dt_dev_pixelpipe_cache_t));
+  cache->mode = DT_DEV_PIXELPIPE_CACHE_HASHED;
+  cache->max_memory = max_memory;
+  cache->pinned = -1;
+  // keys of the hash index point to the hash stored inside the line, so lines need to be
+  // removed from the index before their hash is changed.
+  cache->lines = g_hash_table_new(g_int64_hash, g_int64_equal);
+  cache->buffers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _line_free);
+  return (cache->lines && cache->buffers);
+}
+
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
 {
+  cache->mode = DT_DEV_PIXELPIPE_CACHE_LINES;
+  cache->lines = cache->buffers = NULL;
+#ifdef HAVE_OPENCL
+  cache->device = NULL;
+  cache->max_device_memory = cache->device_memory = 0;
+#endif
+  cache->max_memory = cache->current_memory = 0;
+  cache->clock = 0;
+  cache->pinned = -1;
   cache->entries = entries;
   cache->data = (void **)calloc(entries, sizeof(void *));
   cache->size = (size_t *)calloc(entries, sizeof(size_t));
@@ -60,7 +208,7 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
     cache->hash[k] = -1;
     cache->used[k] = 0;
   }
-  cache->queries = cache->misses = 0;
+  cache->queries = cache->misses = cache->evictions = 0;
   return 1;
 
 alloc_memory_fail:
@@ -80,6 +228,21 @@ alloc_memory_fail:
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
+  _device_forget_all(cache);
+#ifdef HAVE_OPENCL
+  if(cache->device) g_hash_table_destroy(cache->device);
+  cache->device = NULL;
+#endif
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    g_hash_table_destroy(cache->lines);
+    g_hash_table_destroy(cache->buffers);
+    cache->lines = cache->buffers = NULL;
+    cache->current_memory = 0;
+    return;
+  }
+
   for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
   free(cache->data);
   free(cache->dsc);
@@ -90,6 +253,9 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+    return g_hash_table_contains(cache->lines, &hash);
+
   // search for hash in cache
   for(int32_t k = 0; k < cache->entries; k++)
     if(cache->hash[k] == hash) return 1;
@@ -102,9 +268,241 @@ int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache,const uint64_t ha
   return dt_dev_pixelpipe_cache_get_weighted(cache, hash, size, data, dsc, 0);
 }
 
+// lower scores get evicted first: cheap, large and old lines go away before expensive, small and recent ones.
+static inline double _line_score(const dt_dev_pixelpipe_cache_t *cache, const dt_dev_pixelpipe_cache_line_t *line)
+{
+  if(line->hash == (uint64_t)-1) return -1.0;
+  const double age = fmax((double)(cache->clock - line->last_used) + (double)line->weight, 1.0);
+  const double megabytes = fmax((double)line->size / (1024.0 * 1024.0), 1e-3);
+  return (line->cost + 1e-4) / (megabytes * age);
+}
+
+static dt_dev_pixelpipe_cache_line_t *_pick_victim(dt_dev_pixelpipe_cache_t *cache)
+{
+  dt_dev_pixelpipe_cache_line_t *victim = NULL;
+  double min_score = DBL_MAX;
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, cache->buffers);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)value;
+
+    // The line returned by the previous query is the input of the module being processed,
+    // and the current query is for its output. Never recycle those.
+    if(line->last_used + 1 >= cache->clock) continue;
+
+    // Nor the input of the focused module.
+    if(cache->pinned != (uint64_t)-1 && line->hash == cache->pinned) continue;
+
+    const double score = _line_score(cache, line);
+    if(score < min_score)
+    {
+      min_score = score;
+      victim = line;
+    }
+  }
+  return victim;
+}
+
+// detach a line from both indexes without freeing its buffer
+static void _line_detach(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  if(line->hash != (uint64_t)-1) g_hash_table_remove(cache->lines, &line->hash);
+  g_hash_table_steal(cache->buffers, line->data);
+  cache->current_memory -= line->size;
+}
+
+// number of floats converted per thread at once
+#define DT_PIXELPIPE_CACHE_HALF_CHUNK 65536
+
+static void _convert_line(void *const out, const void *const in, const size_t floats, const gboolean to_half)
+{
+  const size_t chunks = (floats + DT_PIXELPIPE_CACHE_HALF_CHUNK - 1) / DT_PIXELPIPE_CACHE_HALF_CHUNK;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(out, in, floats, to_half, chunks) schedule(static)
+#endif
+  for(size_t c = 0; c < chunks; c++)
+  {
+    const size_t start = c * DT_PIXELPIPE_CACHE_HALF_CHUNK;
+    const size_t n = MIN(DT_PIXELPIPE_CACHE_HALF_CHUNK, floats - start);
+    if(to_half)
+      dt_float_to_half_buf((uint16_t *)out + start, (const float *)in + start, n);
+    else
+      dt_half_to_float_buf((float *)out + start, (const uint16_t *)in + start, n);
+  }
+}
+
+// replace the buffer of the line by a half float copy, it then takes half the memory. The line
+// keeps its hash and answers the next queries once unpacked.
+static gboolean _pack_line(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  if(!cache->pack_half || !line->allow_half || line->packed || line->hash == (uint64_t)-1
+     || line->dsc.datatype != TYPE_FLOAT || line->used_size % sizeof(float) || _on_device(cache, line->data))
+    return FALSE;
+
+  const size_t floats = line->used_size / sizeof(float);
+  uint16_t *half = dt_alloc_align(floats * sizeof(uint16_t));
+  if(!half) return FALSE;
+
+  ASAN_UNPOISON_MEMORY_REGION(line->data, line->used_size);
+  _convert_line(half, line->data, floats, TRUE);
+
+  g_hash_table_steal(cache->buffers, line->data);
+  cache->current_memory -= line->size;
+  dt_free_align(line->data);
+  line->data = half;
+  line->size = floats * sizeof(uint16_t);
+  line->packed = TRUE;
+  cache->current_memory += line->size;
+  g_hash_table_insert(cache->buffers, line->data, line);
+  return TRUE;
+}
+
+static dt_dev_pixelpipe_cache_line_t *_make_room(dt_dev_pixelpipe_cache_t *cache, const size_t size);
+
+// back to floats before the line is handed out. Returns FALSE, with the line freed, if there is no
+// memory for that.
+static gboolean _unpack_line(dt_dev_pixelpipe_cache_t *cache, dt_dev_pixelpipe_cache_line_t *line)
+{
+  // out of the indexes while room is made, that must not evict the line itself
+  _line_detach(cache, line);
+
+  void *full = NULL;
+  dt_dev_pixelpipe_cache_line_t *recycled = _make_room(cache, line->used_size);
+  if(recycled)
+  {
+    full = recycled->data;
+    free(recycled);
+  }
+  else
+    full = dt_alloc_align(line->used_size);
+
+  if(!full)
+  {
+    _line_free(line);
+    return FALSE;
+  }
+
+  _convert_line(full, line->data, line->used_size / sizeof(float), FALSE);
+  dt_free_align(line->data);
+  line->data = full;
+  line->size = line->used_size;
+  line->packed = FALSE;
+
+  cache->current_memory += line->size;
+  g_hash_table_insert(cache->buffers, line->data, line);
+  g_hash_table_insert(cache->lines, &line->hash, line);
+  return TRUE;
+}
+
+// evict lines until size bytes fit in the budget. Returns an evicted line of matching size
+// that can be recycled as-is, or NULL if a new buffer needs to be allocated.
+static dt_dev_pixelpipe_cache_line_t *_make_room(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  dt_dev_pixelpipe_cache_line_t *recycled = NULL;
+  const size_t budget = (size_t)(cache->max_memory * dt_memory_governor_factor());
+  while(cache->current_memory + size > budget)
+  {
+    dt_dev_pixelpipe_cache_line_t *victim = _pick_victim(cache);
+
+    // Everything left is in use: go over budget rather than stalling the pipe.
+    if(!victim) break;
+
+    // lines allowing it are packed to half floats first, and only evicted when picked again
+    if(_pack_line(cache, victim)) continue;
+
+    _line_detach(cache, victim);
+    _device_forget(cache, victim->data);
+    cache->evictions++;
+    if(!recycled && victim->size == size)
+      recycled = victim;
+    else
+      _line_free(victim);
+  }
+  return recycled;
+}
+
+static int _get_hashed(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size, void **data,
+                       dt_iop_buffer_dsc_t **dsc, int weight)
+{
+  cache->queries++;
+  cache->clock++;
+
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->lines, &hash);
+
+  if(line && line->packed && line->used_size >= size && !_unpack_line(cache, line)) line = NULL;
+
+  if(line && !line->packed && line->size >= size)
+  {
+    line->last_used = cache->clock;
+    line->weight = weight;
+    line->hits++;
+    *data = line->data;
+    *dsc = &line->dsc;
+
+    ASAN_POISON_MEMORY_REGION(*data, line->size);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    return 0;
+  }
+
+  // found, but too small for the current request: drop it
+  if(line)
+  {
+    _line_detach(cache, line);
+    _device_forget(cache, line->data);
+    _line_free(line);
+  }
+
+  line = _make_room(cache, size);
+  if(!line)
+  {
+    line = (dt_dev_pixelpipe_cache_line_t *)calloc(1, sizeof(dt_dev_pixelpipe_cache_line_t));
+    if(line) line->data = dt_alloc_align(size);
+    if(!line || !line->data)
+    {
+      fprintf(stderr, "[pixelpipe_cache] unable to allocate %zu bytes for a new cache line\n", size);
+      if(line) free(line);
+      *data = NULL;
+      cache->misses++;
+      return 1;
+    }
+    line->size = size;
+  }
+
+  cache->current_memory += line->size;
+  g_hash_table_insert(cache->buffers, line->data, line);
+
+  // first, update our copy, then update the pointer to point at our copy
+  line->dsc = **dsc;
+  *dsc = &line->dsc;
+
+  line->hash = hash;
+  line->last_used = cache->clock;
+  line->weight = weight;
+  line->cost = 0.0;
+  line->hits = 0;
+  line->used_size = size;
+  line->allow_half = FALSE;
+  line->packed = FALSE;
+  g_hash_table_insert(cache->lines, &line->hash, line);
+
+  *data = line->data;
+  ASAN_POISON_MEMORY_REGION(*data, line->size);
+  ASAN_UNPOISON_MEMORY_REGION(*data, size);
+
+  cache->misses++;
+  return 1;
+}
+
 int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash,
                                         const size_t size, void **data, dt_iop_buffer_dsc_t **dsc, int weight)
 {
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+    return _get_hashed(cache, hash, size, data, dsc, weight);
+
   cache->queries++;
   *data = NULL;
   int max_used = -1;
@@ -112,8 +510,8 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
   size_t sz = 0;
   for(int k = 0; k < cache->entries; k++)
   {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
+    // search for hash in cache, never evict the pinned line
+    if(cache->used[k] > max_used && (cache->hash[k] != cache->pinned || cache->pinned == (uint64_t)-1))
     {
       max_used = cache->used[k];
       index_max = k;
@@ -138,6 +536,7 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", index_max, cache->entries,
     // weight);
+    _device_forget(cache, cache->data[index_max]);
     if(cache->size[index_max] < size)
     {
       dt_free_align(cache->data[index_max]);
@@ -163,8 +562,36 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     return 0;
 }
 
+void dt_dev_pixelpipe_cache_trim(dt_dev_pixelpipe_cache_t *cache)
+{
+  if(cache->mode != DT_DEV_PIXELPIPE_CACHE_HASHED) return;
+  // nothing of size 0 can be recycled
+  _make_room(cache, 0);
+}
+
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
+  cache->pinned = -1;
+  _device_forget_all(cache);
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    // keep the buffers around for recycling, only forget their content
+    g_hash_table_remove_all(cache->lines);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->buffers);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)value;
+      line->hash = -1;
+      line->weight = 0;
+      line->packed = FALSE;
+      ASAN_POISON_MEMORY_REGION(line->data, line->size);
+    }
+    return;
+  }
+
   for(int k = 0; k < cache->entries; k++)
   {
     cache->hash[k] = -1;
@@ -175,6 +602,14 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+    if(line) line->weight = -(int32_t)g_hash_table_size(cache->buffers);
+    return;
+  }
+
   for(int k = 0; k < cache->entries; k++)
   {
     if(cache->data[k] == data)
@@ -186,6 +621,21 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
+  _device_forget(cache, data);
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+    if(line && line->hash != (uint64_t)-1)
+    {
+      g_hash_table_remove(cache->lines, &line->hash);
+      line->hash = -1;
+      ASAN_POISON_MEMORY_REGION(line->data, line->size);
+    }
+    return;
+  }
+
   for(int k = 0; k < cache->entries; k++)
   {
     if(cache->data[k] == data)
@@ -196,8 +646,335 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
   }
 }
 
+void dt_dev_pixelpipe_cache_invalidate_hash(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  if(hash == (uint64_t)-1) return;
+  if(cache->pinned == hash) cache->pinned = -1;
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->lines, &hash);
+    if(line) dt_dev_pixelpipe_cache_invalidate(cache, line->data);
+    return;
+  }
+
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->hash[k] == hash)
+    {
+      _device_forget(cache, cache->data[k]);
+      cache->hash[k] = -1;
+      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
+    }
+  }
+}
+
+gboolean dt_dev_pixelpipe_cache_reuse(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
+                                      void *data, dt_iop_buffer_dsc_t **dsc)
+{
+  // the host copy would be overwritten while the device one is still considered valid
+  if(!data || _on_device(cache, data)) return FALSE;
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+    if(!line || line->packed || line->size < size || line->hash == (uint64_t)-1
+       || (cache->pinned != (uint64_t)-1 && line->hash == cache->pinned))
+      return FALSE;
+
+    if(line->hash != hash)
+    {
+      dt_dev_pixelpipe_cache_invalidate_hash(cache, hash);
+      g_hash_table_remove(cache->lines, &line->hash);
+      line->hash = hash;
+      g_hash_table_insert(cache->lines, &line->hash, line);
+    }
+    line->dsc = **dsc;
+    *dsc = &line->dsc;
+    line->last_used = ++cache->clock;
+    line->cost = 0.0;
+    line->hits = 0;
+    line->used_size = size;
+    line->allow_half = FALSE;
+    ASAN_UNPOISON_MEMORY_REGION(data, size);
+    return TRUE;
+  }
+
+  int index = -1;
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) index = k;
+  if(index < 0 || cache->size[index] < size || cache->hash[index] == (uint64_t)-1
+     || (cache->pinned != (uint64_t)-1 && cache->hash[index] == cache->pinned))
+    return FALSE;
+
+  for(int k = 0; k < cache->entries; k++)
+    if(k != index && cache->hash[k] == hash) cache->hash[k] = -1;
+  cache->dsc[index] = **dsc;
+  *dsc = &cache->dsc[index];
+  cache->hash[index] = hash;
+  cache->used[index] = 0;
+  ASAN_UNPOISON_MEMORY_REGION(data, size);
+  return TRUE;
+}
+
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  cache->pinned = -1;
+  if(!data) return;
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    dt_dev_pixelpipe_cache_line_t *line
+        = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+    if(line) cache->pinned = line->hash;
+    return;
+  }
+
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) cache->pinned = cache->hash[k];
+}
+
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, const double cost)
+{
+  if(cache->mode != DT_DEV_PIXELPIPE_CACHE_HASHED) return;
+
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+  if(line) line->cost = cost;
+}
+
+void dt_dev_pixelpipe_cache_allow_half(dt_dev_pixelpipe_cache_t *cache, void *data)
+{
+  if(cache->mode != DT_DEV_PIXELPIPE_CACHE_HASHED || !cache->pack_half) return;
+
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(cache->buffers, data);
+  if(line) line->allow_half = TRUE;
+}
+
+#ifdef HAVE_OPENCL
+void dt_dev_pixelpipe_cache_init_device(dt_dev_pixelpipe_cache_t *cache, size_t max_memory)
+{
+  cache->device = g_hash_table_new(g_direct_hash, g_direct_equal);
+  cache->max_device_memory = max_memory;
+  cache->device_memory = 0;
+}
+
+gboolean dt_dev_pixelpipe_cache_keep_device(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem,
+                                            const int devid, const int width, const int height, const int bpp)
+{
+  const size_t size = (size_t)width * height * bpp;
+  const uint64_t hash = _data_hash(cache, data);
+  if(!cache->device || !mem || hash == (uint64_t)-1 || size > cache->max_device_memory) return FALSE;
+
+  _device_forget(cache, data);
+
+  dt_dev_pixelpipe_cache_device_t *entry
+      = (dt_dev_pixelpipe_cache_device_t *)malloc(sizeof(dt_dev_pixelpipe_cache_device_t));
+  if(!entry) return FALSE;
+
+  *entry = (dt_dev_pixelpipe_cache_device_t){ .data = data, .hash = hash, .mem = mem, .devid = devid,
+                                              .width = width, .height = height, .bpp = bpp,
+                                              .last_used = cache->queries };
+  g_hash_table_insert(cache->device, data, entry);
+  cache->device_memory += size;
+
+  // over budget: the least recently used copies go back to the host
+  while(cache->device_memory > cache->max_device_memory)
+  {
+    dt_dev_pixelpipe_cache_device_t *oldest = NULL;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->device);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      dt_dev_pixelpipe_cache_device_t *e = (dt_dev_pixelpipe_cache_device_t *)value;
+      if(e != entry && (!oldest || e->last_used < oldest->last_used)) oldest = e;
+    }
+    if(!oldest) break;
+    _device_drop(cache, oldest, TRUE);
+  }
+
+  return TRUE;
+}
+
+void *dt_dev_pixelpipe_cache_get_device(dt_dev_pixelpipe_cache_t *cache, void *data, const int devid)
+{
+  if(!cache->device || !data) return NULL;
+
+  dt_dev_pixelpipe_cache_device_t *entry
+      = (dt_dev_pixelpipe_cache_device_t *)g_hash_table_lookup(cache->device, data);
+  if(!entry) return NULL;
+
+  if(entry->hash != _data_hash(cache, data))
+  {
+    _device_drop(cache, entry, FALSE);
+    return NULL;
+  }
+
+  entry->last_used = cache->queries;
+
+  if(devid == entry->devid)
+  {
+    // the consumer may change its input in place, so it gets its own copy, made without leaving the device
+    void *mem = dt_opencl_alloc_device(devid, entry->width, entry->height, entry->bpp);
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { entry->width, entry->height, 1 };
+    if(mem && dt_opencl_enqueue_copy_image(devid, entry->mem, mem, origin, origin, region) == CL_SUCCESS)
+      return mem;
+    dt_opencl_release_mem_object(mem);
+  }
+
+  // other device, or CPU consumer: the host buffer is needed now
+  _device_drop(cache, entry, TRUE);
+  return NULL;
+}
+
+void dt_dev_pixelpipe_cache_release_device(dt_dev_pixelpipe_cache_t *cache)
+{
+  if(!cache->device) return;
+  // _device_drop() removes the entries from the index
+  GList *entries = g_hash_table_get_values(cache->device);
+  for(GList *l = entries; l; l = g_list_next(l))
+    _device_drop(cache, (dt_dev_pixelpipe_cache_device_t *)l->data, TRUE);
+  g_list_free(entries);
+}
+#endif
+
+static GMutex _shared_cache_lock;
+static dt_dev_pixelpipe_shared_cache_t *_shared_cache = NULL;
+
+static void _shared_cache_budget(void *data, const double factor)
+{
+  dt_dev_pixelpipe_shared_cache_t *shared = (dt_dev_pixelpipe_shared_cache_t *)data;
+  g_mutex_lock(&shared->lock);
+  dt_dev_pixelpipe_cache_trim(&shared->cache);
+  g_mutex_unlock(&shared->lock);
+}
+
+dt_dev_pixelpipe_shared_cache_t *dt_dev_pixelpipe_shared_cache_ref(size_t max_memory)
+{
+  g_mutex_lock(&_shared_cache_lock);
+  if(!_shared_cache)
+  {
+    dt_dev_pixelpipe_shared_cache_t *shared
+        = (dt_dev_pixelpipe_shared_cache_t *)calloc(1, sizeof(dt_dev_pixelpipe_shared_cache_t));
+    if(shared && dt_dev_pixelpipe_cache_init_hashed(&shared->cache, max_memory))
+    {
+      g_mutex_init(&shared->lock);
+      _shared_cache = shared;
+      dt_memory_governor_register(_shared_cache_budget, shared);
+    }
+    else
+      free(shared);
+  }
+  if(_shared_cache) _shared_cache->refs++;
+  dt_dev_pixelpipe_shared_cache_t *shared = _shared_cache;
+  g_mutex_unlock(&_shared_cache_lock);
+  return shared;
+}
+
+void dt_dev_pixelpipe_shared_cache_unref(dt_dev_pixelpipe_shared_cache_t *shared)
+{
+  if(!shared) return;
+
+  g_mutex_lock(&_shared_cache_lock);
+  if(--shared->refs == 0)
+  {
+    dt_memory_governor_unregister(shared);
+    dt_dev_pixelpipe_cache_cleanup(&shared->cache);
+    g_mutex_clear(&shared->lock);
+    free(shared);
+    if(_shared_cache == shared) _shared_cache = NULL;
+  }
+  g_mutex_unlock(&_shared_cache_lock);
+}
+
+int dt_dev_pixelpipe_shared_cache_available(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash)
+{
+  g_mutex_lock(&shared->lock);
+  const int available = dt_dev_pixelpipe_cache_available(&shared->cache, hash);
+  g_mutex_unlock(&shared->lock);
+  return available;
+}
+
+int dt_dev_pixelpipe_shared_cache_fetch(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash,
+                                        void *data, const size_t size, dt_iop_buffer_dsc_t *dsc)
+{
+  int missing = 1;
+  g_mutex_lock(&shared->lock);
+  dt_dev_pixelpipe_cache_line_t *line
+      = (dt_dev_pixelpipe_cache_line_t *)g_hash_table_lookup(shared->cache.lines, &hash);
+  shared->cache.queries++;
+  shared->cache.clock++;
+  if(line && line->size >= size)
+  {
+    ASAN_UNPOISON_MEMORY_REGION(line->data, size);
+    memcpy(data, line->data, size);
+    *dsc = line->dsc;
+    line->last_used = shared->cache.clock;
+    line->hits++;
+    missing = 0;
+  }
+  else
+    shared->cache.misses++;
+  g_mutex_unlock(&shared->lock);
+  return missing;
+}
+
+void dt_dev_pixelpipe_shared_cache_publish(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash,
+                                           const void *data, const size_t size, const dt_iop_buffer_dsc_t *dsc)
+{
+  g_mutex_lock(&shared->lock);
+  if(!dt_dev_pixelpipe_cache_available(&shared->cache, hash))
+  {
+    void *line_data = NULL;
+    dt_iop_buffer_dsc_t line_dsc = *dsc;
+    dt_iop_buffer_dsc_t *line_dsc_ptr = &line_dsc;
+    if(_get_hashed(&shared->cache, hash, size, &line_data, &line_dsc_ptr, 0) && line_data)
+    {
+      memcpy(line_data, data, size);
+      *line_dsc_ptr = *dsc;
+    }
+  }
+  g_mutex_unlock(&shared->lock);
+}
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
+#ifdef HAVE_OPENCL
+  if(cache->device)
+    dt_print(DT_DEBUG_CACHE, "pixelpipe cache device memory: %u lines, %zu MiB used out of %zu MiB\n",
+             g_hash_table_size(cache->device), cache->device_memory / (1024 * 1024),
+             cache->max_device_memory / (1024 * 1024));
+#endif
+
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+  {
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cache->buffers);
+    while(g_hash_table_iter_next(&iter, &key, &value))
+    {
+      dt_dev_pixelpipe_cache_line_t *line = (dt_dev_pixelpipe_cache_line_t *)value;
+      if(line->hash == (uint64_t)-1)
+        dt_print(DT_DEBUG_CACHE, "pixelpipe cacheline %p unused, %zu bytes\n", line->data, line->size);
+      else
+        dt_print(DT_DEBUG_CACHE, "pixelpipe cacheline %p by %llu: %zu bytes%s, %llu hits, cost %.3f s, age %llu\n",
+                 line->data, (long long unsigned int)line->hash, line->size, line->packed ? " (half)" : "",
+                 (long long unsigned int)line->hits, line->cost,
+                 (long long unsigned int)(cache->clock - line->last_used));
+    }
+    dt_print(DT_DEBUG_CACHE, "pixelpipe cache memory: %zu MiB used out of %zu MiB, %llu evictions\n",
+             cache->current_memory / (1024 * 1024), cache->max_memory / (1024 * 1024),
+             (long long unsigned int)cache->evictions);
+    dt_print(DT_DEBUG_CACHE, "cache hit rate so far: %.3f\n",
+             (cache->queries - cache->misses) / (float)cache->queries);
+    return;
+  }
+
   for(int k = 0; k < cache->entries; k++)
   {
     if(cache->hash[k] == (uint64_t)-1)
@@ -18,38 +18,97 @@
 
 #pragma once
 
+#include <glib.h>
 #include <inttypes.h>
+#include <stddef.h>
 
 struct dt_dev_pixelpipe_t;
 struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
+struct dt_dev_pixelpipe_cache_line_t;
 
 /**
  * implements a simple pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ *
+ * two modes are available:
+ * - lines: a fixed number of cache lines, optimized for very few entries (~5),
+ *   so most operations are O(N).
+ * - hashed: cache lines are indexed by hash and allocated on demand until a global
+ *   byte budget is reached. Eviction then weighs the time it took to compute a line
+ *   against its size and age, so expensive and small outputs stay longer.
+ *   Optionally, lines whose content tolerates it are packed to half floats before
+ *   being evicted, and unpacked when queried again.
+ *
+ * in both modes, the content of a line can also stay on the OpenCL device only, up to a
+ * separate budget. The host buffer is then stale until a CPU consumer asks for it, or the
+ * device copy is evicted.
  */
 
+typedef enum dt_dev_pixelpipe_cache_mode_t
+{
+  DT_DEV_PIXELPIPE_CACHE_LINES = 0,
+  DT_DEV_PIXELPIPE_CACHE_HASHED = 1
+} dt_dev_pixelpipe_cache_mode_t;
+
 typedef struct dt_dev_pixelpipe_cache_t
 {
+  dt_dev_pixelpipe_cache_mode_t mode;
+
+  // lines mode
   int32_t entries;
   void **data;
   size_t *size;
   struct dt_iop_buffer_dsc_t *dsc;
   uint64_t *hash;
   int32_t *used;
+
+  // hashed mode
+  GHashTable *lines;   // uint64_t hash -> dt_dev_pixelpipe_cache_line_t
+  GHashTable *buffers; // data pointer -> dt_dev_pixelpipe_cache_line_t, owns the lines
+  size_t max_memory;
+  size_t current_memory;
+  uint64_t clock;      // incremented on each query, used to age lines
+  gboolean pack_half;  // pack the lines allowing it to half floats instead of evicting them
+
+  // hash of the line that is never evicted, (uint64_t)-1 if none.
+  // this is the input of the module focused in darkroom.
+  uint64_t pinned;
+
 #ifdef HAVE_OPENCL
-  void **gpu_mem;
+  // both modes, optional: device copies of lines whose host buffer was never written back.
+  GHashTable *device;      // host data pointer -> dt_dev_pixelpipe_cache_device_t, NULL if disabled
+  size_t max_device_memory;
+  size_t device_memory;
 #endif
+
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  uint64_t evictions; // hashed mode, lines dropped to stay within max_memory
 } dt_dev_pixelpipe_cache_t;
 
+/**
+ * process-wide cache shared by all pipes of the current image, storing copies of the outputs of early
+ * (raw) stages. It is created by the first pipe referencing it and destroyed when the last one releases it.
+ * Buffers are copied in and out under the lock, so a pipe never holds on to memory owned by another pipe.
+ */
+typedef struct dt_dev_pixelpipe_shared_cache_t
+{
+  dt_dev_pixelpipe_cache_t cache; // always in hashed mode
+  GMutex lock;
+  int refs;
+} dt_dev_pixelpipe_shared_cache_t;
+
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
   \param[out] returns 0 if fail to allocate mem cache.
 */
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+
+/** constructs a new hash-indexed cache bounded by max_memory bytes. Lines are allocated on demand.
+  \param[out] returns 0 if fail to allocate the index.
+*/
+int dt_dev_pixelpipe_cache_init_hashed(dt_dev_pixelpipe_cache_t *cache, size_t max_memory);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
 
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
@@ -64,6 +123,9 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache,
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
+/** hashed mode: evict lines until the cache fits in its budget, as scaled by the memory governor now. */
+void dt_dev_pixelpipe_cache_trim(dt_dev_pixelpipe_cache_t *cache);
+
 /** invalidates all cachelines. */
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 
@@ -73,6 +135,64 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** mark the cache line matching hash as invalid, if any. */
+void dt_dev_pixelpipe_cache_invalidate_hash(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
+
+/** let the cache line holding data, an input about to be overwritten by a module working in place,
+  * hold the output of given hash instead. Like dt_dev_pixelpipe_cache_get(), *dsc is copied into the
+  * line and updated to point at the copy. FALSE, with nothing changed, if data isn't a cache line,
+  * is too small, is pinned or lives on the OpenCL device: a new line has to be reserved then. */
+gboolean dt_dev_pixelpipe_cache_reuse(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const size_t size,
+                                      void *data, struct dt_iop_buffer_dsc_t **dsc);
+
+/** protect the cache line holding the given buffer from eviction, until another one is pinned
+  * or the cache is flushed. NULL unpins. */
+void dt_dev_pixelpipe_cache_pin(dt_dev_pixelpipe_cache_t *cache, void *data);
+
+/** record how long it took (in seconds) to compute the content of the given cache line pointer.
+  * Used by the hashed mode to keep expensive lines longer. No-op in lines mode. */
+void dt_dev_pixelpipe_cache_set_cost(dt_dev_pixelpipe_cache_t *cache, void *data, const double cost);
+
+/** allow the cache line holding the given buffer to be kept as half floats, for display-referred
+  * float content. Only used in hashed mode with pack_half set. */
+void dt_dev_pixelpipe_cache_allow_half(dt_dev_pixelpipe_cache_t *cache, void *data);
+
+#ifdef HAVE_OPENCL
+/** enable the device copies of lines, bounded by max_memory bytes of device memory. */
+void dt_dev_pixelpipe_cache_init_device(dt_dev_pixelpipe_cache_t *cache, size_t max_memory);
+
+/** hand over mem, an OpenCL image of width x height pixels of bpp bytes on device devid, as the content of the
+  * cache line holding the given host buffer, instead of copying it back to that buffer.
+  * returns FALSE if the cache can't take it, mem is then still owned by the caller. */
+gboolean dt_dev_pixelpipe_cache_keep_device(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem,
+                                            const int devid, const int width, const int height, const int bpp);
+
+/** for a line just returned by dt_dev_pixelpipe_cache_get(), return a new OpenCL image with its content,
+  * owned by the caller, if it is kept on device devid. Otherwise, or if devid is -1, make sure the host
+  * buffer is up to date and return NULL. */
+void *dt_dev_pixelpipe_cache_get_device(dt_dev_pixelpipe_cache_t *cache, void *data, const int devid);
+
+/** copy all the lines kept on devices back to their host buffers and release the device copies,
+  * invalidating the lines that can't be copied. */
+void dt_dev_pixelpipe_cache_release_device(dt_dev_pixelpipe_cache_t *cache);
+#endif
+
+/** get a reference on the shared cache, creating it with max_memory bytes of budget if needed.
+  * returns NULL if it could not be created. */
+dt_dev_pixelpipe_shared_cache_t *dt_dev_pixelpipe_shared_cache_ref(size_t max_memory);
+/** release a reference on the shared cache, freeing it with the last one. */
+void dt_dev_pixelpipe_shared_cache_unref(dt_dev_pixelpipe_shared_cache_t *shared);
+
+/** test availability of a buffer in the shared cache. */
+int dt_dev_pixelpipe_shared_cache_available(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash);
+/** copy the shared buffer matching hash into data and dsc. returns 0 on success, 1 if not found. */
+int dt_dev_pixelpipe_shared_cache_fetch(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash,
+                                        void *data, const size_t size, struct dt_iop_buffer_dsc_t *dsc);
+/** store a copy of data under the given hash, unless it is already there. */
+void dt_dev_pixelpipe_shared_cache_publish(dt_dev_pixelpipe_shared_cache_t *shared, const uint64_t hash,
+                                           const void *data, const size_t size,
+                                           const struct dt_iop_buffer_dsc_t *dsc);
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
@@ -0,0 +1,323 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "develop/pixelpipe_cache_disk.h"
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/image.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
+#include "develop/format.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DT_PIXELPIPE_CACHE_DISK_MAGIC "ANSELPC1"
+
+typedef struct dt_dev_pixelpipe_cache_disk_header_t
+{
+  char magic[8];
+  uint64_t hash;
+  uint64_t size;
+  dt_iop_buffer_dsc_t dsc;
+} dt_dev_pixelpipe_cache_disk_header_t;
+
+typedef struct dt_dev_pixelpipe_cache_disk_file_t
+{
+  gchar *path;
+  goffset size;
+  time_t mtime;
+} dt_dev_pixelpipe_cache_disk_file_t;
+
+typedef struct dt_dev_pixelpipe_cache_disk_job_t
+{
+  int32_t imgid;
+  int width, height;
+  dt_dev_pixelpipe_cache_disk_header_t header;
+  void *data;
+} dt_dev_pixelpipe_cache_disk_job_t;
+
+
+gboolean dt_dev_pixelpipe_cache_disk_enabled()
+{
+  return dt_conf_get_bool("pixelpipe_disk_cache");
+}
+
+static gchar *_get_cache_dir()
+{
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  return g_build_filename(cachedir, "pixelpipe", NULL);
+}
+
+static gchar *_get_prefix(const int32_t imgid, const int width, const int height)
+{
+  return g_strdup_printf("%" PRId32 "-%dx%d-", imgid, width, height);
+}
+
+static gchar *_get_filename(const int32_t imgid, const int width, const int height, const uint64_t hash)
+{
+  gchar *dir = _get_cache_dir();
+  gchar *prefix = _get_prefix(imgid, width, height);
+  gchar *name = g_strdup_printf("%s%016" PRIx64 ".buf", prefix, hash);
+  gchar *filename = g_build_filename(dir, name, NULL);
+  g_free(name);
+  g_free(prefix);
+  g_free(dir);
+  return filename;
+}
+
+uint64_t dt_dev_pixelpipe_cache_disk_checksum(const int32_t imgid)
+{
+  char filename[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(imgid, filename, sizeof(filename), &from_cache, __FUNCTION__);
+
+  uint64_t hash = dt_hash(5381, filename, strlen(filename));
+
+  GStatBuf st;
+  if(!g_stat(filename, &st))
+  {
+    const int64_t size = st.st_size;
+    const int64_t mtime = st.st_mtime;
+    hash = dt_hash(hash, (const char *)&size, sizeof(int64_t));
+    hash = dt_hash(hash, (const char *)&mtime, sizeof(int64_t));
+  }
+  return hash;
+}
+
+int dt_dev_pixelpipe_cache_disk_read(const int32_t imgid, const int width, const int height, const uint64_t hash,
+                                     void *data, const size_t size, dt_iop_buffer_dsc_t *dsc)
+{
+  gchar *filename = _get_filename(imgid, width, height, hash);
+  GMappedFile *file = g_mapped_file_new(filename, FALSE, NULL);
+  int error = 1;
+
+  if(file)
+  {
+    const gchar *contents = g_mapped_file_get_contents(file);
+    const size_t length = g_mapped_file_get_length(file);
+    const dt_dev_pixelpipe_cache_disk_header_t *header = (const dt_dev_pixelpipe_cache_disk_header_t *)contents;
+
+    if(contents && length >= sizeof(dt_dev_pixelpipe_cache_disk_header_t)
+       && !memcmp(header->magic, DT_PIXELPIPE_CACHE_DISK_MAGIC, sizeof(header->magic))
+       && header->hash == hash && header->size == size
+       && length == sizeof(dt_dev_pixelpipe_cache_disk_header_t) + size)
+    {
+      memcpy(data, contents + sizeof(dt_dev_pixelpipe_cache_disk_header_t), size);
+      *dsc = header->dsc;
+      error = 0;
+    }
+    g_mapped_file_unref(file);
+
+    if(error)
+    {
+      // truncated or from another version: don't try again
+      dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache_disk] removing invalid entry `%s'\n", filename);
+      g_unlink(filename);
+    }
+    else
+    {
+      // the modification time is what the LRU cleanup sorts on
+      g_utime(filename, NULL);
+      dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache_disk] read image %" PRId32 " from `%s'\n", imgid, filename);
+    }
+  }
+
+  g_free(filename);
+  return error;
+}
+
+static gint _sort_by_mtime(gconstpointer a, gconstpointer b)
+{
+  const dt_dev_pixelpipe_cache_disk_file_t *fa = (const dt_dev_pixelpipe_cache_disk_file_t *)a;
+  const dt_dev_pixelpipe_cache_disk_file_t *fb = (const dt_dev_pixelpipe_cache_disk_file_t *)b;
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+static void _file_free(gpointer data)
+{
+  dt_dev_pixelpipe_cache_disk_file_t *file = (dt_dev_pixelpipe_cache_disk_file_t *)data;
+  g_free(file->path);
+  free(file);
+}
+
+// remove the entries starting with prefix except keep, or all of them if prefix is NULL
+// and the directory size is above the budget, oldest first.
+static void _cleanup(const gchar *prefix, const gchar *keep)
+{
+  gchar *dir = _get_cache_dir();
+  GDir *gdir = g_dir_open(dir, 0, NULL);
+  if(!gdir)
+  {
+    g_free(dir);
+    return;
+  }
+
+  GList *files = NULL;
+  goffset total = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(gdir)))
+  {
+    if(!g_str_has_suffix(name, ".buf")) continue;
+
+    gchar *path = g_build_filename(dir, name, NULL);
+    if(prefix)
+    {
+      if(g_str_has_prefix(name, prefix) && g_strcmp0(path, keep)) g_unlink(path);
+      g_free(path);
+      continue;
+    }
+
+    GStatBuf st;
+    if(g_stat(path, &st))
+    {
+      g_free(path);
+      continue;
+    }
+
+    dt_dev_pixelpipe_cache_disk_file_t *file = malloc(sizeof(dt_dev_pixelpipe_cache_disk_file_t));
+    file->path = path;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    files = g_list_prepend(files, file);
+    total += st.st_size;
+  }
+  g_dir_close(gdir);
+  g_free(dir);
+
+  const goffset budget = (goffset)MAX(dt_conf_get_int("pixelpipe_disk_cache_size"), 0) * 1024 * 1024;
+  files = g_list_sort(files, _sort_by_mtime);
+  for(GList *f = files; f && total > budget; f = g_list_next(f))
+  {
+    dt_dev_pixelpipe_cache_disk_file_t *file = (dt_dev_pixelpipe_cache_disk_file_t *)f->data;
+    if(!g_unlink(file->path)) total -= file->size;
+  }
+  g_list_free_full(files, _file_free);
+}
+
+static void _write(const dt_dev_pixelpipe_cache_disk_job_t *params)
+{
+  gchar *dir = _get_cache_dir();
+  const int mkd = g_mkdir_with_parents(dir, 0750);
+  g_free(dir);
+  if(mkd) return;
+
+  gchar *filename = _get_filename(params->imgid, params->width, params->height, params->header.hash);
+  if(g_file_test(filename, G_FILE_TEST_EXISTS))
+  {
+    g_free(filename);
+    return;
+  }
+
+  // write to a temporary file first so readers never map a partial entry
+  gchar *tmp_filename = g_strdup_printf("%s.tmp", filename);
+  FILE *f = g_fopen(tmp_filename, "wb");
+  gboolean success = FALSE;
+  if(f)
+  {
+    success = fwrite(&params->header, sizeof(dt_dev_pixelpipe_cache_disk_header_t), 1, f) == 1
+              && fwrite(params->data, 1, params->header.size, f) == params->header.size;
+    success &= (fclose(f) == 0);
+  }
+
+  if(success && !g_rename(tmp_filename, filename))
+  {
+    dt_print(DT_DEBUG_CACHE, "[pixelpipe_cache_disk] wrote image %" PRId32 " to `%s'\n", params->imgid, filename);
+
+    // entries of the same image and size computed with another history are stale now
+    gchar *prefix = _get_prefix(params->imgid, params->width, params->height);
+    _cleanup(prefix, filename);
+    g_free(prefix);
+
+    // enforce the size budget
+    _cleanup(NULL, NULL);
+  }
+  else
+    g_unlink(tmp_filename);
+
+  g_free(tmp_filename);
+  g_free(filename);
+}
+
+static void _job_params_free(void *data)
+{
+  dt_dev_pixelpipe_cache_disk_job_t *params = (dt_dev_pixelpipe_cache_disk_job_t *)data;
+  dt_free_align(params->data);
+  free(params);
+}
+
+static int32_t _write_job_run(dt_job_t *job)
+{
+  _write((dt_dev_pixelpipe_cache_disk_job_t *)dt_control_job_get_params(job));
+  return 0;
+}
+
+void dt_dev_pixelpipe_cache_disk_write(const int32_t imgid, const int width, const int height,
+                                       const uint64_t hash, const void *data, const size_t size,
+                                       const dt_iop_buffer_dsc_t *dsc)
+{
+  dt_dev_pixelpipe_cache_disk_job_t *params = calloc(1, sizeof(dt_dev_pixelpipe_cache_disk_job_t));
+  if(!params) return;
+
+  params->imgid = imgid;
+  params->width = width;
+  params->height = height;
+  memcpy(params->header.magic, DT_PIXELPIPE_CACHE_DISK_MAGIC, sizeof(params->header.magic));
+  params->header.hash = hash;
+  params->header.size = size;
+  params->header.dsc = *dsc;
+
+  // the pipe buffer belongs to the pipe cache and will be recycled, so take a copy.
+  params->data = dt_alloc_align(size);
+  if(!params->data)
+  {
+    free(params);
+    return;
+  }
+  memcpy(params->data, data, size);
+
+  dt_job_t *job = dt_control_running() ? dt_control_job_create(&_write_job_run, "write pixelpipe cache") : NULL;
+  if(job)
+  {
+    dt_control_job_set_params(job, params, _job_params_free);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  }
+  else
+  {
+    _write(params);
+    _job_params_free(params);
+  }
+}
+
+void dt_dev_pixelpipe_cache_disk_remove(const int32_t imgid)
+{
+  gchar *prefix = g_strdup_printf("%" PRId32 "-", imgid);
+  _cleanup(prefix, NULL);
+  g_free(prefix);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
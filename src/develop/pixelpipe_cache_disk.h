@@ -0,0 +1,60 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+struct dt_iop_buffer_dsc_t;
+
+/**
+ * Disk tier behind the pixelpipe cache, for the outputs of the raw stages (up to demosaic)
+ * which are the most expensive to recompute when reopening an image.
+ *
+ * Entries are stored in the user cache directory as `pixelpipe/<imgid>-<width>x<height>-<hash>.buf`.
+ * Writing an entry removes the other entries of the same image and size, which were computed
+ * from a different history. Files are memory-mapped back on read, and the least recently used
+ * ones are removed when the directory outgrows the `pixelpipe_disk_cache_size` budget.
+ */
+
+/** is the disk tier enabled in preferences ? */
+gboolean dt_dev_pixelpipe_cache_disk_enabled();
+
+/** checksum of the image source file identity (path, size, modification time),
+ *  to be mixed with the node hash so entries don't survive a change of the raw file. */
+uint64_t dt_dev_pixelpipe_cache_disk_checksum(const int32_t imgid);
+
+/** copy the entry for hash into data and dsc. returns 0 on success, 1 if not found or invalid. */
+int dt_dev_pixelpipe_cache_disk_read(const int32_t imgid, const int width, const int height, const uint64_t hash,
+                                     void *data, const size_t size, struct dt_iop_buffer_dsc_t *dsc);
+
+/** store a copy of data for hash. The actual write happens in a background job if possible. */
+void dt_dev_pixelpipe_cache_disk_write(const int32_t imgid, const int width, const int height,
+                                       const uint64_t hash, const void *data, const size_t size,
+                                       const struct dt_iop_buffer_dsc_t *dsc);
+
+/** remove all the entries of an image, e.g. when it is removed from the library. */
+void dt_dev_pixelpipe_cache_disk_remove(const int32_t imgid);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
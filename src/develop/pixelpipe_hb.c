@@ -24,6 +24,9 @@
 #include "common/imageio.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
+#include "common/iop_profile.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "control/signal.h"
@@ -31,6 +34,8 @@
 #include "develop/format.h"
 #include "develop/imageop_math.h"
 #include "develop/pixelpipe.h"
+#include "develop/pixelpipe_arena.h"
+#include "develop/pixelpipe_cache_disk.h"
 #include "develop/tiling.h"
 #include "develop/masks.h"
 #include "gui/gtk.h"
@@ -111,6 +116,22 @@ inline static void _copy_buffer(const char *const input, char *const output,
 }
 
 
+// decimate by point sampling: averaging would narrow the distributions the scopes show
+inline static void _subsample_buffer(const char *const input, char *const output, const size_t i_width,
+                                     const size_t o_width, const size_t o_height, const size_t step,
+                                     const size_t bpp)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+          dt_omp_firstprivate(input, output, bpp, i_width, o_width, o_height, step) \
+          schedule(static)
+#endif
+  for(size_t j = 0; j < o_height; j++)
+    for(size_t i = 0; i < o_width; i++)
+      memcpy(output + bpp * (j * o_width + i), input + bpp * (j * step * i_width + i * step), bpp);
+}
+
+
 inline static void _uint8_to_float(const uint8_t *const input, float *const output,
                                    const size_t width, const size_t height, const size_t chan)
 {
@@ -132,26 +153,58 @@ inline static void _uint8_to_float(const uint8_t *const input, float *const outp
 }
 
 
+// Memory budget of the hash-indexed cache, in bytes. 0 means using a fixed number of cache lines.
+static size_t _get_cache_memory()
+{
+  const int megabytes = dt_conf_get_int("pixelpipe_cache_memory");
+  return (megabytes > 0) ? (size_t)megabytes * 1024 * 1024 : 0;
+}
+
+// Attach the pipe to the cache shared among pipes, if enabled.
+static void _init_shared_cache(dt_dev_pixelpipe_t *pipe)
+{
+  const int megabytes = dt_conf_get_int("pixelpipe_shared_cache_memory");
+  if(megabytes > 0)
+    pipe->shared_cache = dt_dev_pixelpipe_shared_cache_ref((size_t)megabytes * 1024 * 1024);
+}
+
+// Let the darkroom pipes recycle the temporary buffers of the modules, if enabled.
+static void _init_arena(dt_dev_pixelpipe_t *pipe)
+{
+  const int megabytes = dt_conf_get_int("pixelpipe_arena_memory");
+  if(megabytes > 0) pipe->arena = dt_dev_pixelpipe_arena_new((size_t)megabytes * 1024 * 1024);
+}
+
+// Let the darkroom pipes keep module outputs on the OpenCL device, if enabled.
+static void _init_device_cache(dt_dev_pixelpipe_t *pipe)
+{
+#ifdef HAVE_OPENCL
+  const int megabytes = dt_conf_get_int("pixelpipe_cache_device_memory");
+  if(megabytes > 0) dt_dev_pixelpipe_cache_init_device(&pipe->cache, (size_t)megabytes * 1024 * 1024);
+#endif
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels,
                                  gboolean store_masks)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 2);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_EXPORT;
   pipe->levels = levels;
+  _init_shared_cache(pipe);
   pipe->store_all_raster_masks = store_masks;
   return res;
 }
 
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 2);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
 
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 0);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, 0, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
@@ -160,8 +213,12 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // Init with the size of MIPMAP_F
   int32_t cachelines = MAX(dt_conf_get_int("cachelines"), 8);
-  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * 720 * 450, cachelines);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * 720 * 450, cachelines,
+                                               _get_cache_memory());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
+  _init_shared_cache(pipe);
+  _init_device_cache(pipe);
+  _init_arena(pipe);
   return res;
 }
 
@@ -179,29 +236,47 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
     height *= darktable.gui->ppd;
   }
 
-  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, cachelines);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * width * height, cachelines,
+                                               _get_cache_memory());
   pipe->type = DT_DEV_PIXELPIPE_FULL;
+  _init_shared_cache(pipe);
+  _init_device_cache(pipe);
+  _init_arena(pipe);
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
   pipe->processed_width = pipe->backbuf_width = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
+  pipe->pieces = NULL;
+  pipe->num_pieces = 0;
+  pipe->shared_cache = NULL;
+  pipe->arena = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  if(memory > 0)
+  {
+    if(!dt_dev_pixelpipe_cache_init_hashed(&(pipe->cache), memory)) return 0;
+    pipe->cache.pack_half = dt_conf_get_bool("pixelpipe_cache_half");
+  }
+  else if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size))
+    return 0;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.0f;
   pipe->backbuf_zoom_x = 0.0f;
   pipe->backbuf_zoom_y = 0.0f;
+  pipe->backbuf_downscale = 1.0f;
+  pipe->backbuf_x = pipe->backbuf_y = 0;
 
   pipe->output_backbuf = NULL;
   pipe->output_backbuf_width = 0;
   pipe->output_backbuf_height = 0;
   pipe->output_imgid = 0;
+  pipe->run_stats = NULL;
+  pipe->run_time = 0.0;
 
   pipe->rawdetail_mask_data = NULL;
   pipe->want_detail_mask = DT_DEV_DETAIL_MASK_NONE;
@@ -213,6 +288,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->bypass_blendif = 0;
   pipe->input_timestamp = 0;
+  pipe->export_scale = 1.0f;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
   dt_pthread_mutex_init(&(pipe->busy_mutex), NULL);
@@ -223,6 +299,18 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->iop_order_list = NULL;
   pipe->forms = NULL;
   pipe->store_all_raster_masks = FALSE;
+  for(int k = 0; k < DT_DEV_RASTER_MASK_CACHE; k++)
+  {
+    pipe->raster_mask_cache[k].hash = 0;
+    pipe->raster_mask_cache[k].mask = NULL;
+  }
+  pipe->raster_mask_cache_next = 0;
+  for(int k = 0; k < DT_DEV_DETAIL_MASK_CACHE; k++)
+  {
+    pipe->detail_mask_cache[k].hash = 0;
+    pipe->detail_mask_cache[k].mask = NULL;
+  }
+  pipe->detail_mask_cache_next = 0;
   pipe->work_profile_info = NULL;
   pipe->input_profile_info = NULL;
   pipe->output_profile_info = NULL;
@@ -258,6 +346,11 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_shared_cache_unref(pipe->shared_cache);
+  pipe->shared_cache = NULL;
+  dt_dev_pixelpipe_arena_print(pipe->arena, _pipe_type_to_str(pipe->type));
+  dt_dev_pixelpipe_arena_destroy(pipe->arena);
+  pipe->arena = NULL;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -270,6 +363,8 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   pipe->output_backbuf_width = 0;
   pipe->output_backbuf_height = 0;
   pipe->output_imgid = 0;
+  g_list_free_full(pipe->run_stats, free);
+  pipe->run_stats = NULL;
 
   dt_dev_clear_rawdetail_mask(pipe);
 
@@ -280,6 +375,16 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   }
 }
 
+static void _raster_mask_cache_flush(dt_dev_pixelpipe_t *pipe)
+{
+  for(int k = 0; k < DT_DEV_RASTER_MASK_CACHE; k++)
+  {
+    dt_free_align(pipe->raster_mask_cache[k].mask);
+    pipe->raster_mask_cache[k].mask = NULL;
+    pipe->raster_mask_cache[k].hash = 0;
+  }
+}
+
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
 {
   // FIXME: either this or all process() -> gdk mutices have to be changed!
@@ -287,9 +392,9 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   // [[does the above still apply?]]
   dt_pthread_mutex_lock(&pipe->busy_mutex); // block until the pipe has shut down
   // destroy all nodes
-  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  for(int k = 0; k < pipe->num_pieces; k++)
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
     // printf("cleanup module `%s'\n", piece->module->name());
     piece->module->cleanup_pipe(piece->module, pipe, piece);
     free(piece->blendop_data);
@@ -302,6 +407,9 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  free(pipe->pieces);
+  pipe->pieces = NULL;
+  pipe->num_pieces = 0;
   // also cleanup iop here
   if(pipe->iop)
   {
@@ -311,6 +419,7 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   // and iop order
   g_list_free_full(pipe->iop_order_list, free);
   pipe->iop_order_list = NULL;
+  _raster_mask_cache_flush(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);	// safe for others to mess with the pipe now
 }
 
@@ -328,6 +437,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   // currently, that loads 84 modules of which a solid third are not used anymore.
   // if(module->flags() & IOP_FLAGS_DEPRECATED && !(module->enabled)) continue;
   pipe->iop = g_list_copy(dev->iop);
+  pipe->pieces = (dt_dev_pixelpipe_iop_t **)calloc(g_list_length(pipe->iop), sizeof(dt_dev_pixelpipe_iop_t *));
   for(GList *modules = pipe->iop; modules; modules = g_list_next(modules))
   {
     dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
@@ -350,6 +460,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     piece->data = NULL;
     piece->hash = 0;
     piece->global_hash = 0;
+    piece->input_hash = 0;
     piece->bypass_cache = FALSE;
     piece->process_cl_ready = 0;
     piece->process_tiling_ready = 0;
@@ -357,8 +468,10 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
     memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
     dt_iop_init_pipe(piece->module, pipe, piece);
-    pipe->nodes = g_list_append(pipe->nodes, piece);
+    pipe->nodes = g_list_prepend(pipe->nodes, piece);
+    pipe->pieces[pipe->num_pieces++] = piece;
   }
+  pipe->nodes = g_list_reverse(pipe->nodes);
   dt_pthread_mutex_unlock(&pipe->busy_mutex); // safe for others to use/mess with the pipe now
 }
 
@@ -389,6 +502,47 @@ static uint64_t _node_hash(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_
 }
 
 
+// Outputs of modules working on raw data are shared with the other pipes. Later stages depend too much
+// on the zoom and the display to be worth it.
+static gboolean _is_shared(const dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  return pipe->shared_cache && piece && !piece->bypass_cache && dt_image_is_raw(&pipe->image)
+         && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE
+         && piece->module->default_colorspace(piece->module, (dt_dev_pixelpipe_t *)pipe, piece) == IOP_CS_RAW;
+}
+
+static uint64_t _shared_hash(const dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_t *piece,
+                             const dt_iop_roi_t *roi_out)
+{
+  // The node hash only accounts for user params, but modules may commit different data
+  // for downscaled pipes (e.g. fast demosaicing). Also, ROI are relative to the input buffer,
+  // which is a downscaled mipmap for preview and thumbnail pipes. Account for both.
+  // Pipes with the same raw stages but a different crop or output size need different regions.
+  const int downscaled = (pipe->type & (DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_PREVIEW2
+                                        | DT_DEV_PIXELPIPE_THUMBNAIL)) != 0;
+  uint64_t hash = dt_hash(piece->global_hash, (const char *)&downscaled, sizeof(int));
+  hash = dt_hash(hash, (const char *)&pipe->iwidth, sizeof(int));
+  hash = dt_hash(hash, (const char *)&pipe->iheight, sizeof(int));
+  return dt_hash(hash, (const char *)roi_out, sizeof(dt_iop_roi_t));
+}
+
+// The output of the last raw stage (demosaic) of full and export pipes is stored on disk, when it
+// covers the whole image. It's the most expensive part to recompute when reopening an image.
+static gboolean _is_disk_cached(const dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                                const dt_iop_roi_t *roi_out)
+{
+  dt_dev_pixelpipe_t *p = (dt_dev_pixelpipe_t *)pipe;
+  return piece && !piece->bypass_cache && dt_image_is_raw(&pipe->image)
+         && (pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_EXPORT))
+         && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE
+         && piece->module->default_colorspace(piece->module, p, piece) == IOP_CS_RAW
+         && piece->module->output_colorspace(piece->module, p, piece) != IOP_CS_RAW
+         && roi_out->x == 0 && roi_out->y == 0
+         && roi_out->width >= (int)(piece->buf_out.width * roi_out->scale) - 1
+         && roi_out->height >= (int)(piece->buf_out.height * roi_out->scale) - 1
+         && dt_dev_pixelpipe_cache_disk_enabled();
+}
+
 void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   /* Traverse the pipeline node by node and compute the cumulative (global) hash of each module.
@@ -404,13 +558,18 @@ void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   // Bypassing cache contaminates downstream modules.
   gboolean bypass_cache = FALSE;
 
-  for(GList *node = g_list_first(pipe->nodes); node; node = g_list_next(node))
+  for(int k = 0; k < pipe->num_pieces; k++)
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
 
-    // Combine with the previous bypass states
+    // Combine with the previous bypass states.
+    // Displaying only the mask of a module doesn't change its output, which carries the mask
+    // in its alpha channel anyway, only what the modules after it do with it.
+    const gboolean mask_only = piece->module->request_mask_display == DT_DEV_PIXELPIPE_DISPLAY_MASK;
+    piece->bypass_cache = bypass_cache || (piece->module->bypass_cache && !mask_only);
     bypass_cache |= piece->module->bypass_cache;
-    piece->bypass_cache = bypass_cache;
+
+    piece->input_hash = hash;
 
     if(piece->enabled)
     {
@@ -427,6 +586,10 @@ void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     }
 
     piece->global_hash = hash;
+
+    // Modules after one displaying its mask or channels only pass their input through
+    if(piece->enabled && piece->module->request_mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE)
+      hash = dt_hash(hash, (const char *)&piece->module->request_mask_display, sizeof(int));
   }
 }
 
@@ -452,9 +615,9 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
   else if(rawprep_img)
     pipe->want_detail_mask |= DT_DEV_DETAIL_MASK_RAWPREPARE;
 
-  for(GList *nodes = g_list_first(pipe->nodes); nodes; nodes = g_list_next(nodes))
+  for(int k = 0; k < pipe->num_pieces; k++)
   {
-    piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece = pipe->pieces[k];
 
     if(piece->module == hist->module)
     {
@@ -471,38 +634,111 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
   }
 }
 
-void dt_dev_pixelpipe_synch_all_real(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const char *caller_func)
+// the state of the pipe that commit_params() of the modules may read, besides their own params
+static uint64_t _synch_context_hash(const dt_dev_pixelpipe_t *pipe)
 {
-  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  uint64_t hash = dt_hash(5381, (const char *)&pipe->type, sizeof(pipe->type));
+  hash = dt_hash(hash, (const char *)&pipe->image.id, sizeof(pipe->image.id));
+  hash = dt_hash(hash, (const char *)&pipe->image.flags, sizeof(pipe->image.flags));
+  hash = dt_hash(hash, (const char *)&pipe->dsc.filters, sizeof(pipe->dsc.filters));
+  hash = dt_hash(hash, (const char *)&pipe->iwidth, sizeof(pipe->iwidth));
+  hash = dt_hash(hash, (const char *)&pipe->iheight, sizeof(pipe->iheight));
+  hash = dt_hash(hash, (const char *)&pipe->iscale, sizeof(pipe->iscale));
+  hash = dt_hash(hash, (const char *)&pipe->want_detail_mask, sizeof(pipe->want_detail_mask));
+  hash = dt_hash(hash, (const char *)&pipe->icc_type, sizeof(pipe->icc_type));
+  hash = dt_hash(hash, (const char *)&pipe->icc_intent, sizeof(pipe->icc_intent));
+  if(pipe->icc_filename) hash = dt_hash(hash, pipe->icc_filename, strlen(pipe->icc_filename));
+  return hash;
+}
 
-  dt_print(DT_DEBUG_DEV, "[pixelpipe] synch all modules with defaults_params for pipe %i called from %s\n", pipe->type, caller_func);
+static uint64_t _synch_commit_key(const dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_t *piece,
+                                  const uint64_t context, const gboolean enabled, const dt_iop_params_t *params,
+                                  const dt_develop_blend_params_t *blend_params)
+{
+  uint64_t hash = dt_hash(context, (const char *)&enabled, sizeof(enabled));
+  hash = dt_hash(hash, (const char *)params, piece->module->params_size);
+  hash = dt_hash(hash, (const char *)blend_params, sizeof(dt_develop_blend_params_t));
+  // colorin sets the work profile when it commits, the modules after it read it
+  const dt_iop_order_iccprofile_info_t *work_profile = dt_ioppr_get_pipe_work_profile_info((dt_dev_pixelpipe_t *)pipe);
+  if(work_profile)
+  {
+    hash = dt_hash(hash, (const char *)&work_profile->type, sizeof(work_profile->type));
+    hash = dt_hash(hash, work_profile->filename, strlen(work_profile->filename));
+    hash = dt_hash(hash, (const char *)&work_profile->intent, sizeof(work_profile->intent));
+  }
+  // 0 means "nothing committed by the synch"
+  return hash ? hash : 1;
+}
 
-  // call reset_params on all pieces first. This is mandatory to init utility modules that don't have an history stack
-  for(GList *nodes = g_list_first(pipe->nodes); nodes; nodes = g_list_next(nodes))
-  {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-    piece->hash = 0;
-    piece->global_hash = 0;
-    piece->enabled = piece->module->default_enabled;
-    dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params,
-                         pipe, piece);
-  }
+void dt_dev_pixelpipe_synch_all_real(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const char *caller_func)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
 
   dt_print(DT_DEBUG_DEV, "[pixelpipe] synch all modules with history for pipe %i called from %s\n", pipe->type, caller_func);
 
-  // go through all history items and adjust params
-  // note that we don't necessarily process the whole history
-  const uint32_t history_end = dt_dev_get_history_end(dev);
+  // the state of each module is its last history item, or its defaults if it has none.
+  // note that we don't necessarily process the whole history:
   // because history_end is shifted by 1, it is actually the step after the last one we want
+  GHashTable *items = g_hash_table_new(NULL, NULL);
+  const uint32_t history_end = dt_dev_get_history_end(dev);
   uint32_t k = 0;
-
   for(GList *history = g_list_first(dev->history);
       history && k < history_end;
       history = g_list_next(history))
   {
-    dt_dev_pixelpipe_synch(pipe, dev, history);
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    g_hash_table_insert(items, hist->module, hist);
     ++k;
   }
+
+  // rawprepare and demosaic read the detail mask request when they commit, so set it first
+  pipe->want_detail_mask &= DT_DEV_DETAIL_MASK_REQUIRED;
+  if(dt_image_is_raw(&pipe->image))
+    pipe->want_detail_mask |= DT_DEV_DETAIL_MASK_DEMOSAIC;
+  else if(dt_image_is_rawprepare_supported(&pipe->image))
+    pipe->want_detail_mask |= DT_DEV_DETAIL_MASK_RAWPREPARE;
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, items);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    const dt_dev_history_item_t *hist = (const dt_dev_history_item_t *)value;
+    if(hist->enabled && hist->blend_params && hist->blend_params->details != 0.0f)
+      pipe->want_detail_mask |= DT_DEV_DETAIL_MASK_REQUIRED;
+  }
+
+  // commit in the order of the pipe, and only the modules whose state changed since the last synch.
+  // commit_params() can be expensive (lcms transforms, lensfun, LUT files) and most changes only touch
+  // one module.
+  const uint64_t context = _synch_context_hash(pipe);
+  int committed = 0;
+  for(int i = 0; i < pipe->num_pieces; i++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[i];
+    dt_iop_module_t *module = piece->module;
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)g_hash_table_lookup(items, module);
+    const gboolean enabled = hist ? hist->enabled : module->default_enabled;
+    dt_iop_params_t *params = hist ? hist->params : module->default_params;
+    dt_develop_blend_params_t *blend_params = hist ? hist->blend_params : module->default_blendop_params;
+
+    const uint64_t key = _synch_commit_key(pipe, piece, context, enabled, params, blend_params);
+    if(key == piece->commit_key && piece->enabled == enabled && !(module->flags() & IOP_FLAGS_VOLATILE_COMMIT)
+       && module != dev->gui_module)
+    {
+      // masks are not part of the params, the hash may still change
+      dt_iop_commit_hash(module, piece);
+      continue;
+    }
+
+    piece->enabled = enabled;
+    dt_iop_commit_params(module, params, blend_params, pipe, piece);
+    piece->commit_key = key;
+    committed++;
+  }
+  g_hash_table_destroy(items);
+
+  dt_print(DT_DEBUG_DEV, "[pixelpipe] synch all committed %i of %i modules for pipe %i\n", committed,
+           pipe->num_pieces, pipe->type);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -523,6 +759,44 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+typedef struct _node_state_t
+{
+  uint64_t hash;
+  uint64_t global_hash;
+  int enabled;
+} _node_state_t;
+
+static _node_state_t *_save_node_states(dt_dev_pixelpipe_t *pipe)
+{
+  _node_state_t *states = g_malloc_n(MAX(pipe->num_pieces, 1), sizeof(_node_state_t));
+  for(int k = 0; k < pipe->num_pieces; k++)
+  {
+    const dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    states[k] = (_node_state_t){ piece->hash, piece->global_hash, piece->enabled };
+  }
+  return states;
+}
+
+// Drop the cached outputs of the first module whose params changed and of everything after it.
+// Upstream outputs are still valid and stay in the cache, so the next run resumes from there.
+static void _invalidate_downstream(dt_dev_pixelpipe_t *pipe, const _node_state_t *states)
+{
+  gboolean changed = FALSE;
+  for(int k = 0; k < pipe->num_pieces; k++)
+  {
+    const dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    if(!changed && piece->hash == states[k].hash) continue;
+
+    if(!changed)
+      dt_print(DT_DEBUG_PIPE, "[dt_dev_pixelpipe_change] pipe %i resumes from module %s\n", pipe->type,
+               piece->module->op);
+    changed = TRUE;
+
+    // disabled nodes carry the hash of the previous enabled one, which may be upstream.
+    if(states[k].enabled) dt_dev_pixelpipe_cache_invalidate_hash(&pipe->cache, states[k].global_hash);
+  }
+}
+
 void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
 {
   dt_times_t start;
@@ -538,6 +812,12 @@ void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
 
   dt_print(DT_DEBUG_DEV, "[dt_dev_pixelpipe_change] pipeline state changing for pipe %i, flag %i\n", pipe->type, pipe->changed);
 
+  // if only params changed, remember the previous state of the nodes to invalidate what is downstream
+  _node_state_t *states = (!(pipe->changed & DT_DEV_PIPE_REMOVE)
+                           && (pipe->changed & (DT_DEV_PIPE_SYNCH | DT_DEV_PIPE_TOP_CHANGED)))
+                              ? _save_node_states(pipe)
+                              : NULL;
+
   // case DT_DEV_PIPE_UNCHANGED: case DT_DEV_PIPE_ZOOMED:
   if(pipe->changed & DT_DEV_PIPE_REMOVE)
   {
@@ -558,6 +838,12 @@ void dt_dev_pixelpipe_change(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev)
     dt_dev_pixelpipe_synch_top(pipe, dev);
   }
 
+  if(states)
+  {
+    _invalidate_downstream(pipe, states);
+    g_free(states);
+  }
+
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
 
   // Get the final output size of the pipe, for GUI coordinates mapping between image buffer and window
@@ -623,8 +909,8 @@ static void histogram_collect(dt_dev_pixelpipe_iop_t *piece, const void *pixel,
 #ifdef HAVE_OPENCL
 // helper to get per module histogram for OpenCL
 //
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// the histogram is reduced on the device when the colorspace allows it. otherwise the whole image
+// is copied back to the host, which is only acceptable for small image sizes like in image preview
 static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_mem img,
                                  const dt_iop_roi_t *roi, uint32_t **histogram, uint32_t *histogram_max,
                                  float *buffer, size_t bufsize)
@@ -632,21 +918,6 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
   float *tmpbuf = NULL;
   float *pixel = NULL;
 
-  // if buffer is supplied and if size fits let's use it
-  if(buffer && bufsize >= (size_t)roi->width * roi->height * 4 * sizeof(float))
-    pixel = buffer;
-  else
-    pixel = tmpbuf = dt_alloc_align_float((size_t)4 * roi->width * roi->height);
-
-  if(!pixel) return;
-
-  cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, sizeof(float) * 4);
-  if(err != CL_SUCCESS)
-  {
-    if(tmpbuf) dt_free_align(tmpbuf);
-    return;
-  }
-
   dt_dev_histogram_collection_params_t histogram_params = piece->histogram_params;
 
   dt_histogram_roi_t histogram_roi;
@@ -662,9 +933,32 @@ static void histogram_collect_cl(int devid, dt_dev_pixelpipe_iop_t *piece, cl_me
   }
 
   const dt_iop_colorspace_type_t cst = piece->module->input_colorspace(piece->module, piece->pipe, piece);
+  const dt_iop_order_iccprofile_info_t *const profile_info = dt_ioppr_get_pipe_work_profile_info(piece->pipe);
+
+  if(dt_histogram_helper_cl(devid, &histogram_params, &piece->histogram_stats, cst, piece->module->histogram_cst,
+                            img, histogram, piece->module->histogram_middle_grey, profile_info))
+  {
+    dt_histogram_max_helper(&piece->histogram_stats, cst, piece->module->histogram_cst, histogram, histogram_max);
+    return;
+  }
+
+  // if buffer is supplied and if size fits let's use it
+  if(buffer && bufsize >= (size_t)roi->width * roi->height * 4 * sizeof(float))
+    pixel = buffer;
+  else
+    pixel = tmpbuf = dt_alloc_align_float((size_t)4 * roi->width * roi->height);
+
+  if(!pixel) return;
+
+  cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, sizeof(float) * 4);
+  if(err != CL_SUCCESS)
+  {
+    if(tmpbuf) dt_free_align(tmpbuf);
+    return;
+  }
 
   dt_histogram_helper(&histogram_params, &piece->histogram_stats, cst, piece->module->histogram_cst, pixel, histogram,
-      piece->module->histogram_middle_grey, dt_ioppr_get_pipe_work_profile_info(piece->pipe));
+      piece->module->histogram_middle_grey, profile_info);
   dt_histogram_max_helper(&piece->histogram_stats, cst, piece->module->histogram_cst, histogram, histogram_max);
 
   if(tmpbuf) dt_free_align(tmpbuf);
@@ -700,24 +994,33 @@ static void pixelpipe_get_histogram_backbuf(dt_dev_pixelpipe_t *pipe, dt_develop
   if(backbuf == NULL) return; // This module is not wired to global histograms
   if(backbuf->hash == hash) return; // Hash didn't change, nothing to update.
 
+  // The scopes only need a bounded number of samples, whatever the size of the preview
+  const size_t step = MAX(1, (MAX(roi->width, roi->height) + DT_BACKBUF_SIZE - 1) / DT_BACKBUF_SIZE);
+  const size_t width = (roi->width + step - 1) / step;
+  const size_t height = (roi->height + step - 1) / step;
+
+  // gamma outputs uint8, but its bpp count is still 16 like the modules outputting float32
+  const gboolean is_uint8 = !strcmp(module->op, "gamma") || bpp == 4 * sizeof(uint8_t);
+  const size_t pixel_size = is_uint8 ? 4 * sizeof(uint8_t) : bpp;
+
   // Prepare the buffer if needed
   if(backbuf->buffer == NULL)
   {
     // Buffer uninited
-    backbuf->buffer = dt_alloc_align(roi->width * roi->height * bpp);
-    backbuf->height = roi->height;
-    backbuf->width = roi->width;
+    backbuf->buffer = dt_alloc_align(width * height * bpp);
+    backbuf->height = height;
+    backbuf->width = width;
     backbuf->bpp = bpp;
   }
-  else if((backbuf->height != roi->height) || (backbuf->width != roi->width) || (backbuf->bpp != bpp))
+  else if((backbuf->height != height) || (backbuf->width != width) || (backbuf->bpp != bpp))
   {
     // Cached buffer size doesn't match current one.
     // There is no reason yet why this should happen because the preview pipe doesn't change size during its lifetime.
     // But let's future-proof it in case someone gets creative.
     dt_free_align(backbuf->buffer); // maybe write a dt_realloc_align routine ?
-    backbuf->buffer = dt_alloc_align(roi->width * roi->height * bpp);
-    backbuf->height = roi->height;
-    backbuf->width = roi->width;
+    backbuf->buffer = dt_alloc_align(width * height * bpp);
+    backbuf->height = height;
+    backbuf->width = width;
     backbuf->bpp = bpp;
   }
 
@@ -738,29 +1041,42 @@ static void pixelpipe_get_histogram_backbuf(dt_dev_pixelpipe_t *pipe, dt_develop
 #ifdef HAVE_OPENCL
   if(cl_mem_output && module->process_cl && piece->process_cl_ready)
   {
-    cl_int err = dt_opencl_copy_device_to_host(pipe->devid, backbuf->buffer, cl_mem_output, roi->width, roi->height, bpp);
+    // The device can't decimate while copying, so go through a full-size host buffer when needed
+    char *host = (step == 1) ? (char *)backbuf->buffer : dt_alloc_align((size_t)roi->width * roi->height * bpp);
+    cl_int err = host ? dt_opencl_copy_device_to_host(pipe->devid, host, cl_mem_output, roi->width, roi->height, bpp)
+                      : DT_OPENCL_DEFAULT_ERROR;
+    if(err == CL_SUCCESS && step > 1)
+      _subsample_buffer(host, (char *)backbuf->buffer, roi->width, width, height, step, pixel_size);
+    if(host != backbuf->buffer) dt_free_align(host);
 
     // Notify the histogram that the backbuf is unusable
     if(err != CL_SUCCESS) backbuf->hash = -1;
   }
   else if(output)
   {
-    _copy_buffer(output, (char *)backbuf->buffer, roi->height, roi->width, roi->width, 0, 0, roi->width * bpp, bpp);
+    if(step == 1)
+      _copy_buffer(output, (char *)backbuf->buffer, roi->height, roi->width, roi->width, 0, 0, roi->width * bpp, bpp);
+    else
+      _subsample_buffer(output, (char *)backbuf->buffer, roi->width, width, height, step, pixel_size);
   }
 #else
   if(output)
-    _copy_buffer(output, (char *)backbuf->buffer, roi->height, roi->width, roi->width, 0, 0, roi->width * bpp, bpp);
+  {
+    if(step == 1)
+      _copy_buffer(output, (char *)backbuf->buffer, roi->height, roi->width, roi->width, 0, 0, roi->width * bpp, bpp);
+    else
+      _subsample_buffer(output, (char *)backbuf->buffer, roi->width, width, height, step, pixel_size);
+  }
 #endif
 
-  // gamma outputs uint8, but its bpp count is still 16 like the modules outputting float32
-  if(!strcmp(module->op, "gamma") || bpp == 4 * sizeof(uint8_t))
+  if(is_uint8)
   {
     // We got 8 bits data, we need to convert it back to float32 for uniform handling
-    float *new_buffer = dt_alloc_align(roi->width * roi->height * 4 * sizeof(float));
+    float *new_buffer = dt_alloc_align(width * height * 4 * sizeof(float));
     if(new_buffer == NULL) return;
 
     uint8_t *old_buffer = (uint8_t *)backbuf->buffer;
-    _uint8_to_float(old_buffer, new_buffer, roi->width, roi->height, 4);
+    _uint8_to_float(old_buffer, new_buffer, width, height, 4);
     backbuf->buffer = (void *)new_buffer;
     dt_free_align(old_buffer);
   }
@@ -880,8 +1196,8 @@ static void pixelpipe_picker(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
 #ifdef HAVE_OPENCL
 // helper for OpenCL color picking
 //
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// the picked area is reduced on the device when no colorspace conversion is needed. otherwise it
+// is copied back to the host, which is only acceptable for small areas
 static void pixelpipe_picker_cl(int devid, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
                                 dt_iop_buffer_dsc_t *dsc, cl_mem img, const dt_iop_roi_t *roi,
                                 float *picked_color, float *picked_color_min, float *picked_color_max,
@@ -902,6 +1218,28 @@ static void pixelpipe_picker_cl(int devid, dt_iop_module_t *module, dt_dev_pixel
     return;
   }
 
+  {
+    dt_aligned_pixel_t min, max, avg;
+    for(int k = 0; k < 4; k++)
+    {
+      min[k] = INFINITY;
+      max[k] = -INFINITY;
+      avg[k] = 0.0f;
+    }
+
+    if(dt_color_picker_helper_cl(devid, dsc, img, box, avg, min, max, image_cst,
+                                 dt_iop_color_picker_get_active_cst(module)))
+    {
+      for(int k = 0; k < 4; k++)
+      {
+        picked_color_min[k] = min[k];
+        picked_color_max[k] = max[k];
+        picked_color[k] = avg[k];
+      }
+      return;
+    }
+  }
+
   const size_t origin[3] = { box[0], box[1], 0 };
   const size_t region[3] = { box[2] - box[0], box[3] - box[1], 1 };
 
@@ -1092,6 +1430,45 @@ static dt_iop_colorspace_type_t _transform_for_picker(dt_iop_module_t *self, con
   }
 }
 
+// Kill switch of the pipe whose module is being processed by the current thread.
+static __thread dt_atomic_int *_cancel_flag = NULL;
+
+gboolean dt_dev_pixelpipe_cancelled(void)
+{
+  return _cancel_flag && dt_atomic_get_int(_cancel_flag);
+}
+
+dt_atomic_int *dt_dev_pixelpipe_get_cancel_flag(void)
+{
+  return _cancel_flag;
+}
+
+void dt_dev_pixelpipe_set_cancel_flag(dt_atomic_int *flag)
+{
+  _cancel_flag = flag;
+}
+
+// Is this the module the user is editing in darkroom?
+static gboolean _is_focused_module(const dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                                   const dt_iop_module_t *module)
+{
+  return dev->gui_attached && (pipe == dev->pipe || pipe == dev->preview_pipe) && dev->gui_module
+         && module == dev->gui_module;
+}
+
+// Is the output of this module display-referred, because it or a module before it said so?
+// Such outputs only need the precision of half floats.
+static gboolean _is_display_referred(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module)
+{
+  for(const GList *node = pipe->nodes; node; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(piece->enabled && (piece->module->flags() & IOP_FLAGS_DISPLAY_REFERRED)) return TRUE;
+    if(piece->module == module) break;
+  }
+  return FALSE;
+}
+
 static gboolean _request_color_pick(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module)
 {
   // Does the current active module need a picker?
@@ -1253,13 +1630,238 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
 
 static dt_dev_pixelpipe_iop_t *_last_node_in_pipe(dt_dev_pixelpipe_t *pipe)
 {
-  for(GList *node = g_list_last(pipe->nodes); node; node = g_list_previous(node))
+  for(int k = pipe->num_pieces - 1; k >= 0; k--)
+    if(pipe->pieces[k]->enabled) return pipe->pieces[k];
+
+  return NULL;
+}
+
+// Number of pixels processed at once by a fused run of modules. 8192 RGBa float pixels are 128 kiB,
+// so a block stays in L2 cache while going through all the modules of the run.
+#define DT_PIXELPIPE_FUSION_BLOCK 8192
+
+// Can the output of this piece stay out of the cache ? Blending, histograms, pickers and the GUI
+// need it as a full buffer.
+static gboolean _output_is_private(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_module_t *module = piece->module;
+  const dt_develop_blend_params_t *const blend = (const dt_develop_blend_params_t *)piece->blendop_data;
+
+  return piece->enabled && !piece->bypass_cache
+         && !(blend && (blend->mask_mode & DEVELOP_MASK_ENABLED))
+         && !(piece->request_histogram & DT_REQUEST_ON)
+         && !_is_focused_module(pipe, dev, module)
+         && module->request_color_pick == DT_REQUEST_COLORPICK_OFF
+         && _get_backuf(dev, module->op) == NULL;
+}
+
+// Can this piece run fused with its neighbours, through its per-pixel kernel ?
+// Anything needing the full output buffer of the module, or a specific processing, rules it out.
+// Only the last module of a run may output something else than RGB, the next ones expect RGB.
+static gboolean _is_fusible(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece,
+                            const gboolean last)
+{
+  dt_iop_module_t *module = piece->module;
+
+  return module->process_pixels && piece->process_pixels_ready
+         && _output_is_private(pipe, dev, piece)
+         && module->default_colorspace(module, pipe, piece) == IOP_CS_RGB
+         && module->input_colorspace(module, pipe, piece) == IOP_CS_RGB
+         && (last || module->output_colorspace(module, pipe, piece) == IOP_CS_RGB)
+         && !memcmp(&piece->planned_roi_in, &piece->planned_roi_out, sizeof(dt_iop_roi_t));
+}
+
+// Can this piece write its output over its input ? Only pipes running each module once per image don't
+// need the input line anymore after that, and only if nothing else reads it after the processing:
+// blending, pickers, histograms, or tiles overlapping their neighbours.
+static gboolean _can_process_inplace(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece,
+                                     const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const size_t in_bpp,
+                                     const size_t out_bpp, const dt_develop_tiling_t *tiling)
+{
+  dt_iop_module_t *module = piece->module;
+  const dt_develop_blend_params_t *const blend = (const dt_develop_blend_params_t *)piece->blendop_data;
+
+  return (module->flags() & IOP_FLAGS_INPLACE)
+         && (pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))
+         && pipe->devid < 0
+         && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE
+         && !(blend && blend->mask_mode != DEVELOP_MASK_DISABLED)
+         && !(piece->request_histogram & DT_REQUEST_ON)
+         && !_request_color_pick(pipe, dev, module)
+         && tiling->overlap == 0
+         && in_bpp == out_bpp && !memcmp(roi_in, roi_out, sizeof(dt_iop_roi_t));
+}
+
+static dt_conf_handle_t _conf_fusion = DT_CONF_HANDLE("pixelpipe_fusion");
+
+// Find the run of fusible modules ending with the one at pos, whose intermediate outputs are not cached.
+// Returns the number of enabled modules in the run, and the position of its first one.
+// A run of one module is processed as usual.
+static int _get_fused_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int pos, int *first_pos)
+{
+  *first_pos = pos;
+
+  if(pipe->devid >= 0 || pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE
+     || !dt_conf_handle_get_bool(&_conf_fusion))
+    return 1;
+
+  if(!_is_fusible(pipe, dev, pipe->pieces[pos - 1], TRUE)) return 1;
+
+  int count = 1;
+  for(int p = pos - 1; p > 0; p--)
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
-    if(piece->enabled) return piece;
+    dt_dev_pixelpipe_iop_t *prev = pipe->pieces[p - 1];
+    if(!prev->enabled) continue;
+
+    // a cached output is a better starting point than anything we could fuse before it
+    if(!_is_fusible(pipe, dev, prev, FALSE) || dt_dev_pixelpipe_cache_available(&(pipe->cache), prev->global_hash)
+       || _is_shared(pipe, prev) || _is_disk_cached(pipe, prev, &prev->planned_roi_out))
+      break;
+
+    *first_pos = p;
+    count++;
   }
 
-  return NULL;
+  return count;
+}
+
+// Run the per-pixel kernels of the fused modules one after the other on each block of rows,
+// from the input of the first one to the output of the last one.
+static void _process_fused(dt_dev_pixelpipe_t *pipe, const int first_pos, const int count, const float *const input,
+                           float *const output, const dt_iop_roi_t *const roi)
+{
+  const size_t width = roi->width;
+  const size_t height = roi->height;
+  const size_t rows = MAX(1, DT_PIXELPIPE_FUSION_BLOCK / MAX(width, 1));
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(pipe, first_pos, count, input, output, width, height, rows) \
+  schedule(dynamic)
+#endif
+  for(size_t y = 0; y < height; y += rows)
+  {
+    if(dt_atomic_get_int(&pipe->shutdown)) continue;
+
+    const size_t npixels = MIN(rows, height - y) * width;
+    const float *in = input + 4 * y * width;
+    float *const out = output + 4 * y * width;
+
+    int done = 0;
+    for(int k = first_pos - 1; k < pipe->num_pieces && done < count; k++)
+    {
+      dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+      if(!piece->enabled) continue;
+      piece->module->process_pixels(piece->module, piece, in, out, npixels);
+      // the next modules work in place on the output block
+      in = out;
+      done++;
+    }
+  }
+}
+
+// The module right before a fused run can apply the kernels of the run itself, on its output while it
+// writes it, if it supports it. That output then never goes through memory as a full buffer.
+// Only for pipes processing each module once per image, where nothing else needs that output.
+// Returns the position of that module, or 0.
+static int _get_fused_head(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const int first_pos, const int count)
+{
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL)) || pipe->devid >= 0
+     || pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE || !dt_conf_handle_get_bool(&_conf_fusion))
+    return 0;
+
+  // longer runs were checked when building them
+  if(count == 1 && !_is_fusible(pipe, dev, pipe->pieces[first_pos - 1], TRUE)) return 0;
+
+  int pos = first_pos - 1;
+  while(pos > 0 && !pipe->pieces[pos - 1]->enabled) pos--;
+  if(pos == 0) return 0;
+
+  dt_dev_pixelpipe_iop_t *head = pipe->pieces[pos - 1];
+  dt_iop_module_t *module = head->module;
+  if(!(module->flags() & IOP_FLAGS_FUSED_OUTPUT) || !_output_is_private(pipe, dev, head)
+     || module->output_colorspace(module, pipe, head) != IOP_CS_RGB
+     || dt_dev_pixelpipe_cache_available(&(pipe->cache), head->global_hash) || _is_shared(pipe, head)
+     || _is_disk_cached(pipe, head, &head->planned_roi_out)
+     || memcmp(&head->planned_roi_out, &pipe->pieces[first_pos - 1]->planned_roi_in, sizeof(dt_iop_roi_t)))
+    return 0;
+
+  return pos;
+}
+
+// The intermediate modules of a fused run don't produce any buffer, only keep their bookkeeping straight.
+// format goes from the input of the run to the input of its last module.
+static void _chain_fused_formats(dt_dev_pixelpipe_t *pipe, const int first_pos, const int pos,
+                                 const dt_iop_roi_t *roi, dt_iop_buffer_dsc_t *format)
+{
+  for(int k = first_pos - 1; k < pos - 1; k++)
+  {
+    dt_dev_pixelpipe_iop_t *member = pipe->pieces[k];
+    if(!member->enabled) continue;
+    member->run_state = DT_DEV_PIXELPIPE_RUN_FUSED;
+    member->processed_roi_in = member->processed_roi_out = *roi;
+    member->dsc_out = member->dsc_in = *format;
+    member->module->output_format(member->module, pipe, member, &member->dsc_out);
+    *format = member->dsc_out;
+  }
+}
+
+// Process the module before a fused run, which applies the kernels of the run on its output.
+static int _process_fused_head(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *head,
+                               const int first_pos, const int count, void *input,
+                               dt_iop_buffer_dsc_t *input_format, void **output, dt_iop_buffer_dsc_t **out_format,
+                               dt_pixelpipe_flow_t *pixelpipe_flow)
+{
+  dt_iop_module_t *module = head->module;
+  const dt_iop_roi_t *roi_in = &head->processed_roi_in;
+  const dt_iop_roi_t *roi_out = &head->processed_roi_out;
+
+  dt_develop_tiling_t tiling = { 0 };
+  tiling.factor_cl = tiling.maxbuf_cl = -1;
+  module->tiling_callback(module, head, roi_in, roi_out, &tiling);
+  dt_tiling_calibrated_factor(module->op, &tiling.factor);
+
+  pipe->dsc = head->dsc_out;
+  head->fused_first = first_pos;
+  head->fused_count = count;
+  const int err = pixelpipe_process_on_CPU(pipe, dev, input, input_format, roi_in, output, out_format, roi_out,
+                                           module, head, &tiling, pixelpipe_flow);
+  head->fused_count = 0;
+  head->dsc_out = pipe->dsc;
+  head->run_state = DT_DEV_PIXELPIPE_RUN_FUSED;
+  return err;
+}
+
+void dt_dev_pixelpipe_fused_output(dt_dev_pixelpipe_iop_t *piece, float *const out, const size_t npixels)
+{
+  if(piece->fused_count <= 0) return;
+
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  const int first_pos = piece->fused_first;
+  const int count = piece->fused_count;
+
+  // called on a whole buffer, spread it over the threads. Called from a parallel region, on the rows
+  // the thread just wrote, which are still in its cache.
+#ifdef _OPENMP
+  if(!omp_in_parallel() && npixels > DT_PIXELPIPE_FUSION_BLOCK)
+  {
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(piece, out, npixels) \
+  schedule(static)
+    for(size_t k = 0; k < npixels; k += DT_PIXELPIPE_FUSION_BLOCK)
+      dt_dev_pixelpipe_fused_output(piece, out + 4 * k, MIN(DT_PIXELPIPE_FUSION_BLOCK, npixels - k));
+    return;
+  }
+#endif
+
+  int done = 0;
+  for(int k = first_pos - 1; k < pipe->num_pieces && done < count; k++)
+  {
+    dt_dev_pixelpipe_iop_t *member = pipe->pieces[k];
+    if(!member->enabled) continue;
+    member->module->process_pixels(member->module, member, out, out, npixels);
+    done++;
+  }
 }
 
 #ifdef HAVE_OPENCL
@@ -1325,13 +1927,18 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
 
     if(possible_cl)
     {
+      gboolean use_tiling = !fits_on_device;
       if(fits_on_device)
       {
         /* image is small enough -> try to directly process entire image with opencl */
         /* input is not on gpu memory -> copy it there */
         if(cl_mem_input == NULL)
         {
-          cl_mem_input = dt_opencl_alloc_device(pipe->devid, roi_in->width, roi_in->height, in_bpp);
+          // devices sharing the host memory work on the cache line in place
+          cl_mem_input = dt_opencl_alloc_device_shared(pipe->devid, roi_in->width, roi_in->height, in_bpp,
+                                                       input);
+          if(cl_mem_input == NULL)
+            cl_mem_input = dt_opencl_alloc_device(pipe->devid, roi_in->width, roi_in->height, in_bpp);
           if(cl_mem_input == NULL)
           {
             dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't generate input buffer for module %s\n",
@@ -1339,7 +1946,7 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
             success_opencl = FALSE;
           }
 
-          if(success_opencl)
+          if(success_opencl && !dt_opencl_mem_is_shared(cl_mem_input, input))
           {
             cl_int err = dt_opencl_write_host_to_device(pipe->devid, input, cl_mem_input,
                                                                      roi_in->width, roi_in->height, in_bpp);
@@ -1356,7 +1963,10 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
         /* try to allocate GPU memory for output */
         if(success_opencl)
         {
-          *cl_mem_output = dt_opencl_alloc_device(pipe->devid, roi_out->width, roi_out->height, bpp);
+          *cl_mem_output = dt_opencl_alloc_device_shared(pipe->devid, roi_out->width, roi_out->height, bpp,
+                                                         *output);
+          if(*cl_mem_output == NULL)
+            *cl_mem_output = dt_opencl_alloc_device(pipe->devid, roi_out->width, roi_out->height, bpp);
           if(*cl_mem_output == NULL)
           {
             dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't allocate output buffer for module %s\n",
@@ -1470,8 +2080,24 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
         if(success_opencl)
           success_opencl = dt_opencl_finish_sync_pipe(pipe->devid, pipe->type);
 
+        /* the estimate was too optimistic, or the device memory is fragmented or taken by other pipes:
+           smaller tiles may still fit, which is much faster than the CPU path. Modules don't spoil their
+           input on errors, so it can be used again. */
+        if(!success_opencl && piece->process_tiling_ready)
+        {
+          dt_print(DT_DEBUG_OPENCL | DT_DEBUG_TILING,
+                   "[opencl_pixelpipe] module '%s' failed on the whole image, retrying with tiling\n", module->op);
+          if(*cl_mem_output != NULL)
+          {
+            dt_opencl_release_mem_object(*cl_mem_output);
+            *cl_mem_output = NULL;
+          }
+          use_tiling = TRUE;
+          success_opencl = TRUE;
+        }
       }
-      else if(piece->process_tiling_ready)
+
+      if(use_tiling && piece->process_tiling_ready)
       {
         /* image is too big for direct opencl processing -> try to process image via tiling */
 
@@ -1490,6 +2116,8 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
                 DT_DEBUG_OPENCL,
                 "[opencl_pixelpipe (a)] late opencl error detected while copying back to cpu buffer: %s\n", cl_errstr(err));
             dt_opencl_release_mem_object(cl_mem_input);
+            // the input only lived on the device, its host buffer holds nothing valid
+            dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
             pipe->opencl_error = 1;
             return 1;
           }
@@ -1577,7 +2205,7 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
           success_opencl = dt_opencl_finish_sync_pipe(pipe->devid, pipe->type);
 
       }
-      else
+      else if(use_tiling)
       {
         /* image is too big for direct opencl and tiling is not allowed -> no opencl processing for this
          * module */
@@ -1601,10 +2229,26 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
            Also, since the cache actually works and can use a lot more memory, caching GPU output
            enables to bypass a serious number of modules, so the memory I/O cost is a good overall investment.
         */
-        /* write back input into cache for faster re-usal (not for export or thumbnails) */
+        /* in darkroom, the cache can also keep the input on the device, so the next run starting from it
+           doesn't need any copy at all. The host copy is only made when a CPU consumer asks for it.
+           An input on the host memory has nothing to gain there, it only needs to be synchronized. */
+        const gboolean input_shared = dt_opencl_mem_is_shared(cl_mem_input, input);
+        if(cl_mem_input != NULL && !input_shared && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE
+           && dt_dev_pixelpipe_cache_keep_device(&(pipe->cache), input, cl_mem_input, pipe->devid, roi_in->width,
+                                                 roi_in->height, in_bpp))
+        {
+          /* the cache owns the buffer now, and the cache line stays valid */
+          valid_input_on_gpu_only = FALSE;
+          input_format->cst = input_cst_cl;
+          cl_mem_input = NULL;
+        }
+
+        /* write back input into cache for faster re-usal (not for export or thumbnails).
+           A shared input was changed in place, it must be synchronized in any case. */
         if(cl_mem_input != NULL
-            && (pipe->type & DT_DEV_PIXELPIPE_EXPORT) != DT_DEV_PIXELPIPE_EXPORT
-            && (pipe->type & DT_DEV_PIXELPIPE_THUMBNAIL) != DT_DEV_PIXELPIPE_THUMBNAIL)
+            && (input_shared
+                || ((pipe->type & DT_DEV_PIXELPIPE_EXPORT) != DT_DEV_PIXELPIPE_EXPORT
+                    && (pipe->type & DT_DEV_PIXELPIPE_THUMBNAIL) != DT_DEV_PIXELPIPE_THUMBNAIL)))
         {
           /* copy input to host memory, so we can find it in cache */
           cl_int err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_in->width,
@@ -1663,6 +2307,8 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
                 DT_DEBUG_OPENCL,
                 "[opencl_pixelpipe (b)] late opencl error detected while copying back to cpu buffer: %s\n", cl_errstr(err));
             dt_opencl_release_mem_object(cl_mem_input);
+            // the input only lived on the device, its host buffer holds nothing valid
+            dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
             pipe->opencl_error = 1;
             return 1;
           }
@@ -1701,6 +2347,8 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
               DT_DEBUG_OPENCL,
               "[opencl_pixelpipe (c)] late opencl error detected while copying back to cpu buffer: %s\n", cl_errstr(err));
           dt_opencl_release_mem_object(cl_mem_input);
+          // the input only lived on the device, its host buffer holds nothing valid
+          dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
           pipe->opencl_error = 1;
           return 1;
         }
@@ -1759,6 +2407,14 @@ static void _print_perf_debug(dt_dev_pixelpipe_t *pipe, const dt_pixelpipe_flow_
           ? "GPU"
           : pixelpipe_flow & PIXELPIPE_FLOW_BLENDED_ON_CPU ? "CPU" : "",
       _pipe_type_to_str(pipe->type));
+
+  if(dt_trace_enabled())
+  {
+    gchar *span = g_strdup_printf("%s [%s, %s]", module_label, _pipe_type_to_str(pipe->type),
+                                  pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? "GPU" : "CPU");
+    dt_trace_span("pixelpipe", span, start->clock, dt_get_wtime());
+    g_free(span);
+  }
   g_free(module_label);
 }
 
@@ -1847,11 +2503,18 @@ static int _init_base_buffer(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
                              const gboolean bypass_cache,
                              const size_t bufsize, const size_t bpp)
 {
-// we're looking for the full buffer
-  if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width
-      && pipe->iheight == roi_out->height)
-  {
-    *output = pipe->input;
+  // Whole rows of the input at 1:1 are contiguous in the locked mipmap buffer: hand them over as they are.
+  // That's the full image, but also the bands of rows a raw needs when the darkroom zoom crops it
+  // vertically only, which would otherwise be copied before rawprepare reads them once.
+  // Kernels and OpenCL expect aligned buffers, so bands starting off a cache line are still copied.
+  const size_t band_offset = (roi_out->y > 0) ? (size_t)roi_out->y * pipe->iwidth * bpp : 0;
+  if(roi_out->scale == 1.0 && roi_out->x == 0 && pipe->iwidth == roi_out->width && roi_out->y >= 0
+     && roi_out->y + roi_out->height <= pipe->iheight
+     && (((uintptr_t)pipe->input + band_offset) % DT_CACHELINE_BYTES) == 0)
+  {
+    *output = (char *)pipe->input + band_offset;
+    dt_print(DT_DEBUG_PIPE, "[pixelpipe] base buffer rows %i to %i taken from the input without copy [%s]\n",
+             roi_out->y, roi_out->y + roi_out->height, _pipe_type_to_str(pipe->type));
     return 0;
   }
   else if(bypass_cache || dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format))
@@ -1901,6 +2564,19 @@ static int _init_base_buffer(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
   return 0;
 }
 
+// The mask of a module is left in the alpha channel of its output by blending, so displaying only
+// the mask reuses the cached output as it is. Tell the modules after it, as blending would have done.
+static void _register_mask_display(dt_dev_pixelpipe_t *pipe, const dt_develop_t *dev,
+                                   const dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_iop_module_t *module = piece->module;
+  const dt_develop_blend_params_t *const d = (const dt_develop_blend_params_t *const)piece->blendop_data;
+  if(module->request_mask_display == DT_DEV_PIXELPIPE_DISPLAY_MASK && d && piece->enabled
+     && dev->gui_attached && module == dev->gui_module && pipe == dev->pipe && !pipe->bypass_blendif
+     && (d->mask_mode & DEVELOP_MASK_ENABLED) && (d->mask_mode & DEVELOP_MASK_MASK_CONDITIONAL))
+    pipe->mask_display = module->request_mask_display;
+}
+
 static int _process_masks_preview(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_iop_t *piece,
                                   void *input, void **output,
                                   void *cl_mem_input, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
@@ -1940,7 +2616,7 @@ static int _process_masks_preview(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, d
 // recursive helper for process:
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
-                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
+                                        const dt_iop_roi_t *roi_out, int pos)
 {
   // The pipeline is executed recursively, from the end. For each module n, starting from the end,
   // if output is cached, take it, else if input is cached, take it, process it and output,
@@ -1956,14 +2632,12 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   dt_iop_module_t *module = NULL;
   dt_dev_pixelpipe_iop_t *piece = NULL;
 
-  if(modules)
+  // skip disabled modules, pos is the number of nodes before the output of this step
+  while(pos > 0 && !pipe->pieces[pos - 1]->enabled) pos--;
+  if(pos > 0)
   {
-    module = (dt_iop_module_t *)modules->data;
-    piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
-    // skip this module?
-    if(!piece->enabled)
-      return dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, &roi_in,
-                                          g_list_previous(modules), g_list_previous(pieces), pos - 1);
+    piece = pipe->pieces[pos - 1];
+    module = piece->module;
   }
 
   KILL_SWITCH_ABORT;
@@ -1984,19 +2658,81 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
 
+#ifdef HAVE_OPENCL
+    // an output kept on the device goes on from there on the GPU, or is copied back now for the CPU
+    const gboolean on_gpu = dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0;
+    *cl_mem_output = dt_dev_pixelpipe_cache_get_device(&(pipe->cache), *output, on_gpu ? pipe->devid : -1);
+#endif
+
     // Get the pipe-global histograms. We want float32 buffers, so we take all outputs
     // except for gamma which outputs uint8 so we need to deal with that internally
-    pixelpipe_get_histogram_backbuf(pipe, dev, *output, NULL, *out_format, roi_out, module, piece, hash, bpp);
+    pixelpipe_get_histogram_backbuf(pipe, dev, *output, *cl_mem_output, *out_format, roi_out, module, piece, hash,
+                                    bpp);
+
+    if(module)
+    {
+      _register_mask_display(pipe, dev, piece);
+      piece->run_state = DT_DEV_PIXELPIPE_RUN_CACHED;
+    }
+    dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_HIT, 1);
 
     KILL_SWITCH_AND_FLUSH_CACHE;
     return 0;
   }
 
+  // 1b) if another pipe already computed it, copy it.
+  const gboolean shared = _is_shared(pipe, piece);
+  if(shared && dt_dev_pixelpipe_shared_cache_available(pipe->shared_cache, _shared_hash(pipe, piece, roi_out)))
+  {
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    if(*output
+       && !dt_dev_pixelpipe_shared_cache_fetch(pipe->shared_cache, _shared_hash(pipe, piece, roi_out), *output, bufsize,
+                                               *out_format))
+    {
+      dt_print(DT_DEBUG_PIPE, "[pixelpipe] dt_dev_pixelpipe_process_rec, shared cache available for pipe %i and module %s with hash %llu\n",
+               pipe->type, module->op, (long long unsigned int)hash);
+      piece->dsc_out = **out_format;
+      pixelpipe_get_histogram_backbuf(pipe, dev, *output, NULL, *out_format, roi_out, module, piece, hash, bpp);
+      piece->run_state = DT_DEV_PIXELPIPE_RUN_SHARED;
+      dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_HIT, 1);
+      KILL_SWITCH_AND_FLUSH_CACHE;
+      return 0;
+    }
+    // evicted in the meantime, compute it as usual.
+    if(*output) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  }
+
+  // 1c) if it was stored on disk in a previous session, load it.
+  const gboolean on_disk = _is_disk_cached(pipe, piece, roi_out);
+  const uint64_t disk_hash
+      = (on_disk) ? dt_hash(hash, (const char *)&(uint64_t){ dt_dev_pixelpipe_cache_disk_checksum(pipe->image.id) },
+                            sizeof(uint64_t))
+                  : 0;
+  if(on_disk)
+  {
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    if(*output
+       && !dt_dev_pixelpipe_cache_disk_read(pipe->image.id, roi_out->width, roi_out->height, disk_hash, *output,
+                                            bufsize, *out_format))
+    {
+      dt_print(DT_DEBUG_PIPE, "[pixelpipe] dt_dev_pixelpipe_process_rec, disk cache available for pipe %i and module %s with hash %llu\n",
+               pipe->type, module->op, (long long unsigned int)hash);
+      piece->dsc_out = **out_format;
+      piece->run_state = DT_DEV_PIXELPIPE_RUN_DISK;
+      dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_HIT, 1);
+      KILL_SWITCH_AND_FLUSH_CACHE;
+      return 0;
+    }
+    if(*output) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  }
+
   // 2) if history changed or exit event, abort processing?
   KILL_SWITCH_ABORT;
 
+  dt_metrics_count(DT_METRICS_PIXELPIPE_CACHE_MISS, 1);
+
   // 3) input -> output
-  if(!modules)
+  if(!module)
   {
     // If no modules, we are at the step 0 of the pipe:
     // fetching input buffer.
@@ -2009,6 +2745,12 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       return 1;
 
     dt_show_times_f(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+    {
+      gchar *span = g_strdup_printf("base buffer [%s]", _pipe_type_to_str(pipe->type));
+      dt_trace_span("pixelpipe", span, start.clock, dt_get_wtime());
+      g_free(span);
+    }
     return 0;
   }
 
@@ -2024,35 +2766,45 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   dt_iop_buffer_dsc_t _input_format = { 0 };
   dt_iop_buffer_dsc_t *input_format = &_input_format;
 
-  piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
   piece->processed_roi_in = roi_in;
   piece->processed_roi_out = *roi_out;
 
-  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &roi_in,
-                                  g_list_previous(modules), g_list_previous(pieces), pos - 1))
+  // Consecutive per-pixel modules before this one are run together with it, block by block,
+  // so we start from the input of the first one. ROI don't change along the run.
+  // When the module before the run can apply it on its own output, we start from its input.
+  int fused_pos = pos;
+  const int fused = _get_fused_run(pipe, dev, pos, &fused_pos);
+  const int head_pos = _get_fused_head(pipe, dev, fused_pos, fused);
+  dt_dev_pixelpipe_iop_t *const head = (head_pos > 0) ? pipe->pieces[head_pos - 1] : NULL;
+  dt_iop_roi_t head_roi_in = (head) ? head->planned_roi_in : roi_in;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, (head) ? &head_roi_in : &roi_in,
+                                  (head) ? head_pos - 1 : fused_pos - 1))
     return 1;
 
   KILL_SWITCH_ABORT;
 
+  // the input format of the head lives in its input line, keep it aside
+  dt_iop_buffer_dsc_t head_format = *input_format;
+  if(head)
+  {
+    head->processed_roi_in = head_roi_in;
+    head->processed_roi_out = roi_in;
+    head->dsc_out = head->dsc_in = head_format;
+    head->module->output_format(head->module, pipe, head, &head->dsc_out);
+    _input_format = head->dsc_out;
+    input_format = &_input_format;
+  }
+
   const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
+
+  if(fused > 1) _chain_fused_formats(pipe, fused_pos, pos, &roi_in, input_format);
+
   piece->dsc_out = piece->dsc_in = *input_format;
   module->output_format(module, pipe, piece, &piece->dsc_out);
   **out_format = pipe->dsc = piece->dsc_out;
   const size_t out_bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
 
-  // reserve new cache line: output
-  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
-
-  dt_times_t start;
-  dt_get_times(&start);
-
-  dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
-
-  // Bypass pixel filtering and return early if we only want the pipe to display mask previews
-  if(!_process_masks_preview(pipe, dev, piece, input, output, cl_mem_input, cl_mem_output, out_format, &roi_in, roi_out,
-                         in_bpp, out_bpp, module))
-    return 0;
-
   /* get tiling requirement of module */
   dt_develop_tiling_t tiling = { 0 };
   tiling.factor_cl = tiling.maxbuf_cl = -1;	// set sentinel value to detect whether callback set sizes
@@ -2060,6 +2812,10 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   if (tiling.factor_cl < 0) tiling.factor_cl = tiling.factor; // default to CPU size if callback didn't set GPU
   if (tiling.maxbuf_cl < 0) tiling.maxbuf_cl = tiling.maxbuf;
 
+  // the memory needs measured for this module, if any, replace its estimate on CPU
+  const float declared_factor = tiling.factor;
+  dt_tiling_calibrated_factor(module->op, &tiling.factor);
+
   /* does this module involve blending? */
   if(piece->blendop_data && ((dt_develop_blend_params_t *)piece->blendop_data)->mask_mode != DEVELOP_MASK_DISABLED)
   {
@@ -2083,28 +2839,149 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   assert(tiling.factor > 0.0f);
   assert(tiling.factor_cl > 0.0f);
 
-  // Actual pixel processing for this module
+  // reserve new cache line: output. Modules working in place take over the line of their input instead,
+  // so they need one full buffer less and tile less often.
+  gboolean inplace = fused <= 1 && !head
+                     && _can_process_inplace(pipe, dev, piece, &roi_in, roi_out, in_bpp, out_bpp, &tiling);
+  if(inplace)
+  {
+    // the input format is stored in the input line, which is about to describe the output
+    _input_format = *input_format;
+    input_format = &_input_format;
+    inplace = dt_dev_pixelpipe_cache_reuse(&(pipe->cache), hash, bufsize, input, out_format);
+  }
+  if(inplace)
+  {
+    *output = input;
+    tiling.factor = fmaxf(1.0f, tiling.factor - 1.0f);
+    dt_print(DT_DEBUG_PIPE, "[pixelpipe] %s: %s processed in place\n", _pipe_type_to_str(pipe->type), module->op);
+  }
+  else
+    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  piece->run_state = DT_DEV_PIXELPIPE_RUN_COMPUTED;
+
+  dt_pixelpipe_flow_t pixelpipe_flow = (PIXELPIPE_FLOW_NONE | PIXELPIPE_FLOW_HISTOGRAM_NONE);
+
+  // Bypass pixel filtering and return early if we only want the pipe to display mask previews
+  if(!_process_masks_preview(pipe, dev, piece, input, output, cl_mem_input, cl_mem_output, out_format, &roi_in, roi_out,
+                         in_bpp, out_bpp, module))
+    return 0;
+
+  // Actual pixel processing for this module. Long computations may poll the kill switch meanwhile,
+  // a partial output is then flushed from the cache below.
+  dt_metrics_mem_begin(_pipe_type_to_str(pipe->type), module->op);
+  dt_dev_pixelpipe_arena_t *const previous_arena = dt_dev_pixelpipe_arena_set_current(pipe->arena);
+  dt_dev_pixelpipe_set_cancel_flag(&pipe->shutdown);
+  int process_err = 0;
+  if(head)
+  {
+    process_err = _process_fused_head(pipe, dev, head, fused_pos, fused, input, &head_format, output, out_format,
+                                      &pixelpipe_flow);
+    // the head may have changed its output format while processing
+    dt_iop_buffer_dsc_t format = head->dsc_out;
+    _chain_fused_formats(pipe, fused_pos, pos, &roi_in, &format);
+    piece->dsc_out = piece->dsc_in = format;
+    module->output_format(module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+    pipe->dsc.cst = module->output_colorspace(module, pipe, piece);
+    dt_print(DT_DEBUG_PIPE, "[pixelpipe] %s: %s applied %i fused modules ending with %s\n",
+             _pipe_type_to_str(pipe->type), head->module->op, fused, module->op);
+  }
+  else if(fused > 1)
+  {
+    const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+    dt_ioppr_transform_image_colorspace(module, input, input, roi_in.width, roi_in.height, input_format->cst,
+                                        IOP_CS_RGB, &input_format->cst, work_profile);
+    _process_fused(pipe, fused_pos, fused, (const float *)input, (float *)*output, roi_out);
+    pipe->dsc.cst = module->output_colorspace(module, pipe, piece);
+    pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
+    dt_print(DT_DEBUG_PIPE, "[pixelpipe] %s: fused %i modules ending with %s\n", _pipe_type_to_str(pipe->type),
+             fused, module->op);
+  }
+  else
+  {
 #ifdef HAVE_OPENCL
-  if (pixelpipe_process_on_GPU(pipe, dev, input, cl_mem_input, input_format, &roi_in, output, cl_mem_output, out_format, roi_out,
-                               module, piece, &tiling, &pixelpipe_flow, in_bpp, bpp))
-    return 1;
+    process_err
+        = pixelpipe_process_on_GPU(pipe, dev, input, cl_mem_input, input_format, &roi_in, output, cl_mem_output,
+                                   out_format, roi_out, module, piece, &tiling, &pixelpipe_flow, in_bpp, bpp);
 #else
-  if (pixelpipe_process_on_CPU(pipe, dev, input, input_format, &roi_in, output, out_format, roi_out,
-                               module, piece, &tiling, &pixelpipe_flow))
-    return 1;
+    process_err = pixelpipe_process_on_CPU(pipe, dev, input, input_format, &roi_in, output, out_format,
+                                           roi_out, module, piece, &tiling, &pixelpipe_flow);
 #endif
+  }
+  dt_dev_pixelpipe_set_cancel_flag(NULL);
+  dt_dev_pixelpipe_arena_set_current(previous_arena);
+  const size_t allocated = dt_metrics_mem_end();
+  if(process_err)
+  {
+    // the output line was reserved but never filled
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    return 1;
+  }
+
+  piece->run_time = dt_get_wtime() - start.clock;
+
+  // let the scheduler learn how long this module takes on this device. Fused runs mix several modules.
+  if(fused <= 1 && !head)
+  {
+    dt_times_t end;
+    dt_get_times(&end);
+    dt_opencl_record_timing(pipe->devid, module->op, (double)roi_out->width * roi_out->height / 1e6,
+                            end.clock - start.clock);
+    dt_metrics_time_module(module->op, (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU) != 0,
+                           end.clock - start.clock);
+  }
+  if(pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING) dt_metrics_count(DT_METRICS_TILING, 1);
+  else if(fused <= 1 && !head && (pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_CPU))
+    dt_tiling_calibration_record(module->op, &roi_in, roi_out, in_bpp, out_bpp, declared_factor, allocated);
 
   // Get the pipe-global histograms. We want float32 buffers, so we take all outputs
   // except for gamma which outputs uint8 so we need to deal with that internally
   pixelpipe_get_histogram_backbuf(pipe, dev, *output, *cl_mem_output, *out_format, roi_out, module, piece, hash, bpp);
 
   // Don't cache outputs if we requested to bypass the cache
-  if(bypass_cache) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  if(bypass_cache)
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  else
+  {
+    dt_times_t end;
+    dt_get_times(&end);
+    dt_dev_pixelpipe_cache_set_cost(&(pipe->cache), *output, end.clock - start.clock);
+    if(pipe->cache.pack_half && (*out_format)->datatype == TYPE_FLOAT && _is_display_referred(pipe, module))
+      dt_dev_pixelpipe_cache_allow_half(&(pipe->cache), *output);
+  }
+
+  // Keep the input of the focused module while its params are being edited, so the next runs
+  // only need to recompute it and what comes after it.
+  if(_is_focused_module(pipe, dev, module)) dt_dev_pixelpipe_cache_pin(&(pipe->cache), input);
 
   KILL_SWITCH_AND_FLUSH_CACHE;
 
   _print_perf_debug(pipe, pixelpipe_flow, piece, module, &start);
 
+  // let the other pipes reuse this output. Skip outputs living only on the GPU, copying them back
+  // would cost more than what we expect to save.
+  if(shared && *cl_mem_output == NULL)
+    dt_dev_pixelpipe_shared_cache_publish(pipe->shared_cache, _shared_hash(pipe, piece, roi_out), *output, bufsize,
+                                          &pipe->dsc);
+
+  // store it for the next time this image is opened.
+  if(on_disk)
+  {
+    gboolean valid = TRUE;
+#ifdef HAVE_OPENCL
+    if(*cl_mem_output != NULL)
+      valid = (dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width,
+                                             roi_out->height, bpp) == CL_SUCCESS);
+#endif
+    if(valid)
+      dt_dev_pixelpipe_cache_disk_write(pipe->image.id, roi_out->width, roi_out->height, disk_hash, *output,
+                                        bufsize, &pipe->dsc);
+  }
+
   // in case we get this buffer from the cache in the future, cache some stuff:
   **out_format = piece->dsc_out = pipe->dsc;
 
@@ -2129,15 +3006,9 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *de
                                       int height, float scale)
 {
   // temporarily disable gamma mapping.
-  GList *gammap = g_list_last(pipe->nodes);
-  dt_dev_pixelpipe_iop_t *gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
-  while(strcmp(gamma->module->op, "gamma"))
-  {
-    gamma = NULL;
-    gammap = g_list_previous(gammap);
-    if(!gammap) break;
-    gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
-  }
+  dt_dev_pixelpipe_iop_t *gamma = NULL;
+  for(int k = pipe->num_pieces - 1; k >= 0 && !gamma; k--)
+    if(!strcmp(pipe->pieces[k]->module->op, "gamma")) gamma = pipe->pieces[k];
   if(gamma) gamma->enabled = 0;
   const int ret = dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
   if(gamma) gamma->enabled = 1;
@@ -2146,16 +3017,8 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *de
 
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op)
 {
-  GList *nodes = g_list_last(pipe->nodes);
-  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-  while(strcmp(piece->module->op, op))
-  {
-    piece->enabled = 0;
-    piece = NULL;
-    nodes = g_list_previous(nodes);
-    if(!nodes) break;
-    piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-  }
+  for(int k = pipe->num_pieces - 1; k >= 0 && strcmp(pipe->pieces[k]->module->op, op); k--)
+    pipe->pieces[k]->enabled = 0;
 }
 
 void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
@@ -2172,17 +3035,28 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
   }
 }
 
+gboolean dt_dev_pixelpipe_performance_allows(const dt_dev_pixelpipe_t *pipe, const char *op,
+                                             const float max_scale)
+{
+  if(!(pipe->type & DT_DEV_PIXELPIPE_EXPORT) || pipe->export_scale >= 1.0f) return FALSE;
+
+  gchar *key = g_strdup_printf("plugins/lighttable/export/performance/%s", op);
+  const float threshold = dt_conf_key_exists(key) ? dt_conf_get_float(key) : max_scale;
+  g_free(key);
+
+  return pipe->export_scale <= threshold;
+}
+
 static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
-                                                     const dt_iop_roi_t *roi_out, GList *modules, GList *pieces,
-                                                     int pos)
+                                                     const dt_iop_roi_t *roi_out, int pos)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   darktable.dtresources.group = 4 * darktable.dtresources.level;
 #ifdef HAVE_OPENCL
   dt_opencl_check_tuning(pipe->devid);
 #endif
-  int ret = dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, roi_out, modules, pieces, pos);
+  int ret = dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, roi_out, pos);
 #ifdef HAVE_OPENCL
   // copy back final opencl buffer (if any) to CPU
   if(ret)
@@ -2204,6 +3078,7 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
         /* this indicates a opencl problem earlier in the pipeline */
         dt_print(DT_DEBUG_OPENCL,
                  "[dt_dev_pixelpipe_process_rec_and_backcopy] late opencl error detected while copying back to cpu buffer: %s\n", cl_errstr(err));
+        dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
         pipe->opencl_error = 1;
         ret = 1;
       }
@@ -2215,13 +3090,33 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 }
 
 
+// copy what the run did for each enabled module, for readers not holding the pipe
+static GList *_collect_run_stats(dt_dev_pixelpipe_t *pipe)
+{
+  GList *stats = NULL;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    dt_dev_pixelpipe_run_stats_t *stat = calloc(1, sizeof(dt_dev_pixelpipe_run_stats_t));
+    g_strlcpy(stat->op, piece->module->op, sizeof(stat->op));
+    g_strlcpy(stat->multi_name, piece->module->multi_name, sizeof(stat->multi_name));
+    stat->state = piece->run_state;
+    stat->time = piece->run_time;
+    stats = g_list_prepend(stats, stat);
+  }
+  return g_list_reverse(stats);
+}
+
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
   pipe->processing = 1;
   pipe->opencl_enabled = dt_opencl_update_settings(); // update enabled flag and profile from preferences
-  pipe->devid = (pipe->opencl_enabled) ? dt_opencl_lock_device(pipe->type)
+  pipe->devid = (pipe->opencl_enabled) ? dt_opencl_schedule_device(pipe, (double)width * height / 1e6)
                                        : -1; // try to get/lock opencl resource
+  // the scheduler counts the pipes running on the CPU
+  const gboolean cpu_scheduled = pipe->opencl_enabled && pipe->devid < 0;
 
   dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type),
            pipe->devid);
@@ -2238,17 +3133,29 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
   // printf("pixelpipe homebrew process start\n");
   if(darktable.unmuted & DT_DEBUG_DEV) dt_dev_pixelpipe_cache_print(&pipe->cache);
 
+  // nothing is edited anymore, release the input of the previously focused module
+  if(!dev->gui_module) dt_dev_pixelpipe_cache_pin(&pipe->cache, NULL);
+
+  // give back what the memory governor asked for since the last run, before allocating anything
+  dt_dev_pixelpipe_cache_trim(&pipe->cache);
+
   // get a snapshot of mask list
   if(pipe->forms) g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
   pipe->forms = dt_masks_dup_forms_deep(dev->forms, NULL);
 
   //  go through list of modules from the end:
-  const guint pos = g_list_length(pipe->iop);
-  GList *modules = g_list_last(pipe->iop);
-  GList *pieces = g_list_last(pipe->nodes);
+  const int pos = pipe->num_pieces;
+
+  const double run_start = dt_get_wtime();
 
 // re-entry point: in case of late opencl errors we start all over again with opencl-support disabled
 restart:;
+  for(int k = 0; k < pipe->num_pieces; k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    piece->run_state = DT_DEV_PIXELPIPE_RUN_SKIPPED;
+    piece->run_time = 0.0;
+  }
   void *buf = NULL;
   void *cl_mem_out = NULL;
 
@@ -2262,8 +3169,7 @@ restart:;
 
   // run pixelpipe recursively and get error status
   const int err =
-    dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, modules,
-                                              pieces, pos);
+    dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, pos);
 
   // get status summary of opencl queue by checking the eventlist
   const int oclerr = (pipe->devid >= 0) ? (dt_opencl_events_flush(pipe->devid, 1) != 0) : 0;
@@ -2296,7 +3202,14 @@ restart:;
       dt_capabilities_remove("opencl");
     }
 
-    dt_dev_pixelpipe_flush_caches(pipe);
+    // a command failed on the device: whatever was computed there may be wrong. Otherwise only a
+    // transfer failed, the lines already written back are good and the CPU run resumes from them.
+    if(oclerr)
+      dt_dev_pixelpipe_flush_caches(pipe);
+#ifdef HAVE_OPENCL
+    else
+      dt_dev_pixelpipe_cache_release_device(&pipe->cache);
+#endif
     dt_dev_pixelpipe_change(pipe, dev);
     dt_dev_pixelpipe_get_roi_in(pipe, dev, roi);
     dt_pixelpipe_get_global_hash(pipe, dev);
@@ -2317,6 +3230,7 @@ restart:;
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  if(cpu_scheduled) dt_opencl_unschedule_cpu();
   // ... and in case of other errors ...
   if(err)
   {
@@ -2325,7 +3239,11 @@ restart:;
   }
 
   // terminate
+  GList *run_stats = _collect_run_stats(pipe);
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  g_list_free_full(pipe->run_stats, free);
+  pipe->run_stats = run_stats;
+  pipe->run_time = dt_get_wtime() - run_start;
   const dt_dev_pixelpipe_iop_t *last_module = _last_node_in_pipe(pipe);
   pipe->backbuf_hash = _node_hash(pipe, last_module, &roi, pos);
   pipe->backbuf = buf;
@@ -2366,12 +3284,10 @@ void dt_dev_pixelpipe_get_roi_out(dt_dev_pixelpipe_t *pipe, struct dt_develop_t
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   dt_iop_roi_t roi_in = (dt_iop_roi_t){ 0, 0, width_in, height_in, 1.0 };
   dt_iop_roi_t roi_out;
-  GList *modules = g_list_first(pipe->iop);
-  GList *pieces = g_list_first(pipe->nodes);
-  while(modules)
+  for(int k = 0; k < pipe->num_pieces; k++)
   {
-    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    dt_iop_module_t *module = piece->module;
 
     piece->buf_in = roi_in;
 
@@ -2390,9 +3306,6 @@ void dt_dev_pixelpipe_get_roi_out(dt_dev_pixelpipe_t *pipe, struct dt_develop_t
 
     piece->buf_out = roi_out;
     roi_in = roi_out;
-
-    modules = g_list_next(modules);
-    pieces = g_list_next(pieces);
   }
   *width = roi_out.width;
   *height = roi_out.height;
@@ -2412,12 +3325,10 @@ void dt_dev_pixelpipe_get_roi_in(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   dt_iop_roi_t roi_out_temp = roi_out;
   dt_iop_roi_t roi_in;
-  GList *modules = g_list_last(pipe->iop);
-  GList *pieces = g_list_last(pipe->nodes);
-  while(modules)
+  for(int k = pipe->num_pieces - 1; k >= 0; k--)
   {
-    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    dt_dev_pixelpipe_iop_t *piece = pipe->pieces[k];
+    dt_iop_module_t *module = piece->module;
 
     piece->planned_roi_out = roi_out_temp;
 
@@ -2440,13 +3351,41 @@ void dt_dev_pixelpipe_get_roi_in(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *
 
     piece->planned_roi_in = roi_in;
     roi_out_temp = roi_in;
-
-    modules = g_list_previous(modules);
-    pieces = g_list_previous(pieces);
   }
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+// Does this node apply to raster masks passing through it, and does it actually change them ?
+static gboolean _distorts_raster_mask(const dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!piece->enabled
+     || (piece->module->dev->gui_module
+         && (piece->module->dev->gui_module->operation_tags_filter() & piece->module->operation_tags())))
+    return FALSE;
+
+  return piece->module->distort_mask
+         && !(!strcmp(piece->module->op, "finalscale") // hack against pipes not using finalscale
+              && piece->processed_roi_in.width == 0
+              && piece->processed_roi_in.height == 0);
+}
+
+static float *_raster_mask_cache_get(const dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  for(int k = 0; k < DT_DEV_RASTER_MASK_CACHE; k++)
+    if(pipe->raster_mask_cache[k].mask && pipe->raster_mask_cache[k].hash == hash)
+      return pipe->raster_mask_cache[k].mask;
+  return NULL;
+}
+
+static void _raster_mask_cache_put(dt_dev_pixelpipe_t *pipe, const uint64_t hash, float *mask)
+{
+  dt_dev_raster_mask_cache_t *entry = &pipe->raster_mask_cache[pipe->raster_mask_cache_next];
+  dt_free_align(entry->mask);
+  entry->mask = mask;
+  entry->hash = hash;
+  pipe->raster_mask_cache_next = (pipe->raster_mask_cache_next + 1) % DT_DEV_RASTER_MASK_CACHE;
+}
+
 float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *raster_mask_source,
                               const int raster_mask_id, const dt_iop_module_t *target_module,
                               gboolean *free_mask)
@@ -2473,46 +3412,76 @@ float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const dt_iop_modul
       raster_mask = g_hash_table_lookup(source_piece->raster_masks, GINT_TO_POINTER(raster_mask_id));
       if(raster_mask)
       {
+        // The distorted mask only depends on the source output and on the nodes distorting it, which are all
+        // identified by their global hash. Nodes bypassing the cache can't be trusted that way.
+        gboolean cacheable = !source_piece->bypass_cache;
+        gboolean distorted = FALSE;
+        uint64_t hash = dt_hash(source_piece->global_hash, (const char *)&raster_mask_id, sizeof(int));
+        for(GList *iter = g_list_next(source_iter); iter; iter = g_list_next(iter))
+        {
+          const dt_dev_pixelpipe_iop_t *module = (dt_dev_pixelpipe_iop_t *)iter->data;
+          if(_distorts_raster_mask(module))
+          {
+            distorted = TRUE;
+            cacheable &= !module->bypass_cache;
+            hash = dt_hash(hash, (const char *)&module->global_hash, sizeof(uint64_t));
+            hash = dt_hash(hash, (const char *)&module->processed_roi_out, sizeof(dt_iop_roi_t));
+          }
+          if(module->module == target_module) break;
+        }
+
+        if(distorted && cacheable)
+        {
+          float *cached = _raster_mask_cache_get(pipe, hash);
+          if(cached)
+          {
+            dt_vprint(DT_DEBUG_MASKS, "[dt_dev_get_raster_mask] reusing distorted mask of %s for module %s\n",
+                      raster_mask_source->op, target_module ? target_module->op : "none");
+            return cached;
+          }
+        }
+
         for(GList *iter = g_list_next(source_iter); iter; iter = g_list_next(iter))
         {
           dt_dev_pixelpipe_iop_t *module = (dt_dev_pixelpipe_iop_t *)iter->data;
 
-          if(module->enabled
-             && !(module->module->dev->gui_module
-                  && (module->module->dev->gui_module->operation_tags_filter() & module->module->operation_tags())))
+          if(_distorts_raster_mask(module))
           {
-            if(module->module->distort_mask
-              && !(!strcmp(module->module->op, "finalscale") // hack against pipes not using finalscale
-                    && module->processed_roi_in.width == 0
-                    && module->processed_roi_in.height == 0))
-            {
-              float *transformed_mask = dt_alloc_align_float((size_t)module->processed_roi_out.width
-                                                              * module->processed_roi_out.height);
-              module->module->distort_mask(module->module,
-                                          module,
-                                          raster_mask,
-                                          transformed_mask,
-                                          &module->processed_roi_in,
-                                          &module->processed_roi_out);
-              if(*free_mask) dt_free_align(raster_mask);
-              *free_mask = TRUE;
-              raster_mask = transformed_mask;
-            }
-            else if(!module->module->distort_mask &&
-                    (module->processed_roi_in.width != module->processed_roi_out.width ||
-                     module->processed_roi_in.height != module->processed_roi_out.height ||
-                     module->processed_roi_in.x != module->processed_roi_out.x ||
-                     module->processed_roi_in.y != module->processed_roi_out.y))
-              fprintf(stderr, "FIXME: module `%s' changed the roi from %d x %d @ %d / %d to %d x %d | %d / %d but doesn't have "
-                     "distort_mask() implemented!\n", module->module->op, module->processed_roi_in.width,
-                     module->processed_roi_in.height, module->processed_roi_in.x, module->processed_roi_in.y,
-                     module->processed_roi_out.width, module->processed_roi_out.height, module->processed_roi_out.x,
-                     module->processed_roi_out.y);
+            float *transformed_mask = dt_alloc_align_float((size_t)module->processed_roi_out.width
+                                                            * module->processed_roi_out.height);
+            module->module->distort_mask(module->module,
+                                        module,
+                                        raster_mask,
+                                        transformed_mask,
+                                        &module->processed_roi_in,
+                                        &module->processed_roi_out);
+            if(*free_mask) dt_free_align(raster_mask);
+            *free_mask = TRUE;
+            raster_mask = transformed_mask;
           }
+          else if(module->enabled && !module->module->distort_mask
+                  && !(module->module->dev->gui_module
+                       && (module->module->dev->gui_module->operation_tags_filter() & module->module->operation_tags()))
+                  && (module->processed_roi_in.width != module->processed_roi_out.width ||
+                      module->processed_roi_in.height != module->processed_roi_out.height ||
+                      module->processed_roi_in.x != module->processed_roi_out.x ||
+                      module->processed_roi_in.y != module->processed_roi_out.y))
+            fprintf(stderr, "FIXME: module `%s' changed the roi from %d x %d @ %d / %d to %d x %d | %d / %d but doesn't have "
+                   "distort_mask() implemented!\n", module->module->op, module->processed_roi_in.width,
+                   module->processed_roi_in.height, module->processed_roi_in.x, module->processed_roi_in.y,
+                   module->processed_roi_out.width, module->processed_roi_out.height, module->processed_roi_out.x,
+                   module->processed_roi_out.y);
 
           if(module->module == target_module)
             break;
         }
+
+        // keep it for the next runs, the pipe owns it now.
+        if(*free_mask && cacheable)
+        {
+          _raster_mask_cache_put((dt_dev_pixelpipe_t *)pipe, hash, raster_mask);
+          *free_mask = FALSE;
+        }
       }
     }
   }
@@ -2520,10 +3489,40 @@ float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const dt_iop_modul
   return raster_mask;
 }
 
+static void _detail_mask_cache_flush(dt_dev_pixelpipe_t *pipe)
+{
+  for(int k = 0; k < DT_DEV_DETAIL_MASK_CACHE; k++)
+  {
+    dt_free_align(pipe->detail_mask_cache[k].mask);
+    pipe->detail_mask_cache[k].mask = NULL;
+    pipe->detail_mask_cache[k].hash = 0;
+  }
+}
+
+static float *_detail_mask_cache_get(const dt_dev_pixelpipe_t *pipe, const uint64_t hash)
+{
+  for(int k = 0; k < DT_DEV_DETAIL_MASK_CACHE; k++)
+    if(pipe->detail_mask_cache[k].mask && pipe->detail_mask_cache[k].hash == hash)
+      return pipe->detail_mask_cache[k].mask;
+  return NULL;
+}
+
+// the pipe owns mask from now on, a hash of 0 only keeps it alive until it is recycled
+static void _detail_mask_cache_put(dt_dev_pixelpipe_t *pipe, const uint64_t hash, float *mask)
+{
+  dt_dev_detail_mask_cache_t *entry = &pipe->detail_mask_cache[pipe->detail_mask_cache_next];
+  dt_free_align(entry->mask);
+  entry->mask = mask;
+  entry->hash = hash;
+  pipe->detail_mask_cache_next = (pipe->detail_mask_cache_next + 1) % DT_DEV_DETAIL_MASK_CACHE;
+}
+
 void dt_dev_clear_rawdetail_mask(dt_dev_pixelpipe_t *pipe)
 {
   if(pipe->rawdetail_mask_data) dt_free_align(pipe->rawdetail_mask_data);
   pipe->rawdetail_mask_data = NULL;
+  // everything derived from it is stale too
+  _detail_mask_cache_flush(pipe);
 }
 
 gboolean dt_dev_write_rawdetail_mask(dt_dev_pixelpipe_iop_t *piece, float *const rgb, const dt_iop_roi_t *const roi_in, const int mode)
@@ -2652,74 +3651,133 @@ gboolean dt_dev_write_rawdetail_mask_cl(dt_dev_pixelpipe_iop_t *piece, cl_mem in
 }
 #endif
 
-// this expects a mask prepared by the demosaicer and distorts the mask through all pipeline modules
-// until target
-float *dt_dev_distort_detail_mask(const dt_dev_pixelpipe_t *pipe, float *src, const dt_iop_module_t *target_module)
+// find the node writing the raw detail mask, NULL if it isn't valid in this pipe
+static GList *_detail_mask_source(const dt_dev_pixelpipe_t *pipe)
 {
   if(!pipe->rawdetail_mask_data) return NULL;
-  gboolean valid = FALSE;
   const int check = pipe->want_detail_mask & ~DT_DEV_DETAIL_MASK_REQUIRED;
 
-  GList *source_iter;
-  for(source_iter = pipe->nodes; source_iter; source_iter = g_list_next(source_iter))
+  for(GList *source_iter = pipe->nodes; source_iter; source_iter = g_list_next(source_iter))
   {
     const dt_dev_pixelpipe_iop_t *candidate = (dt_dev_pixelpipe_iop_t *)source_iter->data;
     if(((!strcmp(candidate->module->op, "demosaic")) && candidate->enabled) && (check == DT_DEV_DETAIL_MASK_DEMOSAIC))
-    {
-      valid = TRUE;
-      break;
-    }
+      return source_iter;
     if(((!strcmp(candidate->module->op, "rawprepare")) && candidate->enabled) && (check == DT_DEV_DETAIL_MASK_RAWPREPARE))
-    {
-      valid = TRUE;
-      break;
-    }
+      return source_iter;
   }
+  return NULL;
+}
 
-  if(!valid) return NULL;
-  dt_vprint(DT_DEBUG_MASKS, "[dt_dev_distort_detail_mask] (%ix%i) for module %s\n", pipe->rawdetail_mask_roi.width, pipe->rawdetail_mask_roi.height, target_module->op);
-
+// distorts src through the nodes from source_iter on, until target
+static float *_distort_detail_mask(float *src, GList *source_iter, const dt_iop_module_t *target_module)
+{
   float *resmask = src;
   float *inmask  = src;
-  if(source_iter)
+  for(GList *iter = source_iter; iter; iter = g_list_next(iter))
   {
-    for(GList *iter = source_iter; iter; iter = g_list_next(iter))
+    dt_dev_pixelpipe_iop_t *module = (dt_dev_pixelpipe_iop_t *)iter->data;
+    if(module->enabled
+       && !(module->module->dev->gui_module
+            && module->module->dev->gui_module->operation_tags_filter() & module->module->operation_tags()))
     {
-      dt_dev_pixelpipe_iop_t *module = (dt_dev_pixelpipe_iop_t *)iter->data;
-      if(module->enabled
-         && !(module->module->dev->gui_module
-              && module->module->dev->gui_module->operation_tags_filter() & module->module->operation_tags()))
+      if(module->module->distort_mask
+            && !(!strcmp(module->module->op, "finalscale") // hack against pipes not using finalscale
+                  && module->processed_roi_in.width == 0
+                  && module->processed_roi_in.height == 0))
       {
-        if(module->module->distort_mask
-              && !(!strcmp(module->module->op, "finalscale") // hack against pipes not using finalscale
-                    && module->processed_roi_in.width == 0
-                    && module->processed_roi_in.height == 0))
-        {
-          float *tmp = dt_alloc_align_float((size_t)module->processed_roi_out.width * module->processed_roi_out.height);
-          dt_vprint(DT_DEBUG_MASKS, "   %s %ix%i -> %ix%i\n", module->module->op, module->processed_roi_in.width, module->processed_roi_in.height, module->processed_roi_out.width, module->processed_roi_out.height);
-          module->module->distort_mask(module->module, module, inmask, tmp, &module->processed_roi_in, &module->processed_roi_out);
-          resmask = tmp;
-          if(inmask != src) dt_free_align(inmask);
-          inmask = tmp;
-        }
-        else if(!module->module->distort_mask &&
-                (module->processed_roi_in.width != module->processed_roi_out.width ||
-                 module->processed_roi_in.height != module->processed_roi_out.height ||
-                 module->processed_roi_in.x != module->processed_roi_out.x ||
-                 module->processed_roi_in.y != module->processed_roi_out.y))
-              fprintf(stderr, "FIXME: module `%s' changed the roi from %d x %d @ %d / %d to %d x %d | %d / %d but doesn't have "
-                 "distort_mask() implemented!\n", module->module->op, module->processed_roi_in.width,
-                 module->processed_roi_in.height, module->processed_roi_in.x, module->processed_roi_in.y,
-                 module->processed_roi_out.width, module->processed_roi_out.height, module->processed_roi_out.x,
-                 module->processed_roi_out.y);
-
-        if(module->module == target_module) break;
+        float *tmp = dt_alloc_align_float((size_t)module->processed_roi_out.width * module->processed_roi_out.height);
+        dt_vprint(DT_DEBUG_MASKS, "   %s %ix%i -> %ix%i\n", module->module->op, module->processed_roi_in.width, module->processed_roi_in.height, module->processed_roi_out.width, module->processed_roi_out.height);
+        module->module->distort_mask(module->module, module, inmask, tmp, &module->processed_roi_in, &module->processed_roi_out);
+        resmask = tmp;
+        if(inmask != src) dt_free_align(inmask);
+        inmask = tmp;
       }
+      else if(!module->module->distort_mask &&
+              (module->processed_roi_in.width != module->processed_roi_out.width ||
+               module->processed_roi_in.height != module->processed_roi_out.height ||
+               module->processed_roi_in.x != module->processed_roi_out.x ||
+               module->processed_roi_in.y != module->processed_roi_out.y))
+            fprintf(stderr, "FIXME: module `%s' changed the roi from %d x %d @ %d / %d to %d x %d | %d / %d but doesn't have "
+               "distort_mask() implemented!\n", module->module->op, module->processed_roi_in.width,
+               module->processed_roi_in.height, module->processed_roi_in.x, module->processed_roi_in.y,
+               module->processed_roi_out.width, module->processed_roi_out.height, module->processed_roi_out.x,
+               module->processed_roi_out.y);
+
+      if(module->module == target_module) break;
     }
   }
   return resmask;
 }
 
+// this expects a mask prepared by the demosaicer and distorts the mask through all pipeline modules
+// until target
+float *dt_dev_distort_detail_mask(const dt_dev_pixelpipe_t *pipe, float *src, const dt_iop_module_t *target_module)
+{
+  GList *source_iter = _detail_mask_source(pipe);
+  if(!source_iter) return NULL;
+  dt_vprint(DT_DEBUG_MASKS, "[dt_dev_distort_detail_mask] (%ix%i) for module %s\n", pipe->rawdetail_mask_roi.width, pipe->rawdetail_mask_roi.height, target_module->op);
+
+  return _distort_detail_mask(src, source_iter, target_module);
+}
+
+float *dt_dev_get_detail_mask(dt_dev_pixelpipe_iop_t *piece, const float level, dt_dev_detail_mask_calc_t calc_mask)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  GList *source_iter = _detail_mask_source(pipe);
+  if(!source_iter) return NULL;
+
+  // The refined mask after each node distorting it only depends on the level and on these nodes, which are
+  // identified by their global hash. Nodes bypassing the cache can't be trusted that way.
+  // Consumers upstream with the same level have left their mask at their own position, start from the last one.
+  uint64_t hash = dt_hash(5381, (const char *)&level, sizeof(float));
+  hash = dt_hash(hash, (const char *)&pipe->rawdetail_mask_roi, sizeof(dt_iop_roi_t));
+  const uint64_t source_hash = hash;
+  float *start = _detail_mask_cache_get(pipe, hash);
+  GList *start_iter = source_iter;
+  gboolean cacheable = TRUE;
+  gboolean distorted = FALSE;
+  for(GList *iter = source_iter; iter; iter = g_list_next(iter))
+  {
+    const dt_dev_pixelpipe_iop_t *module = (dt_dev_pixelpipe_iop_t *)iter->data;
+    if(_distorts_raster_mask(module))
+    {
+      cacheable &= !module->bypass_cache;
+      hash = dt_hash(hash, (const char *)&module->global_hash, sizeof(uint64_t));
+      hash = dt_hash(hash, (const char *)&module->processed_roi_out, sizeof(dt_iop_roi_t));
+      float *cached = cacheable ? _detail_mask_cache_get(pipe, hash) : NULL;
+      if(cached)
+      {
+        start = cached;
+        start_iter = g_list_next(iter);
+        distorted = FALSE;
+      }
+      else
+        distorted = TRUE;
+    }
+    if(module->module == piece->module) break;
+  }
+
+  if(start && !distorted)
+  {
+    dt_vprint(DT_DEBUG_MASKS, "[dt_dev_get_detail_mask] reusing detail mask for module %s\n", piece->module->op);
+    return start;
+  }
+
+  if(!start)
+  {
+    start = calc_mask(piece, level);
+    if(!start) return NULL;
+    _detail_mask_cache_put(pipe, source_hash, start);
+  }
+
+  dt_vprint(DT_DEBUG_MASKS, "[dt_dev_get_detail_mask] (%ix%i) for module %s\n", pipe->rawdetail_mask_roi.width,
+            pipe->rawdetail_mask_roi.height, piece->module->op);
+
+  float *mask = _distort_detail_mask(start, start_iter, piece->module);
+  if(mask != start) _detail_mask_cache_put(pipe, cacheable ? hash : 0, mask);
+  return mask;
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -36,6 +36,25 @@ struct dt_iop_module_t;
 struct dt_dev_raster_mask_t;
 struct dt_iop_order_iccprofile_info_t;
 
+// what the last run of a pipe did for a module, shown by the pipeline statistics overlay of darkroom
+typedef enum dt_dev_pixelpipe_run_state_t
+{
+  DT_DEV_PIXELPIPE_RUN_SKIPPED = 0, // not reached, the output of a later module came from a cache
+  DT_DEV_PIXELPIPE_RUN_CACHED,      // output found in the cache of the pipe
+  DT_DEV_PIXELPIPE_RUN_SHARED,      // output copied from another pipe
+  DT_DEV_PIXELPIPE_RUN_DISK,        // output read from the disk cache
+  DT_DEV_PIXELPIPE_RUN_FUSED,       // computed together with the next module
+  DT_DEV_PIXELPIPE_RUN_COMPUTED     // output computed
+} dt_dev_pixelpipe_run_state_t;
+
+typedef struct dt_dev_pixelpipe_run_stats_t
+{
+  char op[20];
+  char multi_name[128];
+  dt_dev_pixelpipe_run_state_t state;
+  double time; // seconds spent computing the output, 0 if it wasn't
+} dt_dev_pixelpipe_run_stats_t;
+
 typedef struct dt_dev_pixelpipe_raster_mask_t
 {
   int id; // 0 is reserved for the reusable masks written in blend.c
@@ -68,6 +87,17 @@ typedef struct dt_dev_pixelpipe_iop_t
   // for the current ROI.
   uint64_t global_hash;
 
+  // Cumulative hash of the upstream modules only, for the current ROI: the state of the input of this module.
+  // Modules caching something computed from their input alone use it in their own keys.
+  uint64_t input_hash;
+
+  // Hash of the drawn masks of the module when it was committed, 0 without drawn masks
+  uint64_t mask_hash;
+
+  // What the last dt_dev_pixelpipe_synch_all() committed: params, blend params, enabled state and the pipe
+  // state commit_params() reads. 0 when the params were committed otherwise.
+  uint64_t commit_key;
+
   int bpc;             // bits per channel, 32 means float
   int colors;          // how many colors per pixel
   dt_iop_roi_t buf_in,
@@ -76,6 +106,7 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t planned_roi_in, planned_roi_out; // sizes planned ahead for cache hash
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   int process_tiling_ready;   // set this to 0 in commit_params to temporarily disable tiling
+  int process_pixels_ready;   // set this to 0 in commit_params to temporarily disable process_pixels
 
   // the following are used internally for caching:
   dt_iop_buffer_dsc_t dsc_in, dsc_out;
@@ -83,6 +114,13 @@ typedef struct dt_dev_pixelpipe_iop_t
   // bypass the cache for this module
   gboolean bypass_cache;
 
+  // position and number of the modules run by dt_dev_pixelpipe_fused_output() on the output of this one
+  int fused_first, fused_count;
+
+  // what the current run did for this piece so far, see dt_dev_pixelpipe_t.run_stats
+  dt_dev_pixelpipe_run_state_t run_state;
+  double run_time;
+
   GHashTable *raster_masks; // GList* of dt_dev_pixelpipe_raster_mask_t
 } dt_dev_pixelpipe_iop_t;
 
@@ -96,6 +134,24 @@ typedef enum dt_dev_pixelpipe_change_t
   DT_DEV_PIPE_ZOOMED = 1 << 3 // zoom event, preview pipe does not need changes
 } dt_dev_pixelpipe_change_t;
 
+// number of raster masks kept once distorted for their consumers, per pipe
+#define DT_DEV_RASTER_MASK_CACHE 4
+
+typedef struct dt_dev_raster_mask_cache_t
+{
+  uint64_t hash; // source mask and distortions applied to it, 0 if unused
+  float *mask;
+} dt_dev_raster_mask_cache_t;
+
+// number of refined detail masks kept once distorted for their consumers, per pipe
+#define DT_DEV_DETAIL_MASK_CACHE 4
+
+typedef struct dt_dev_detail_mask_cache_t
+{
+  uint64_t hash; // refinement level and distortions applied to the raw detail mask, 0 if unused
+  float *mask;
+} dt_dev_detail_mask_cache_t;
+
 /**
  * this encapsulates the pixelpipe.
  * a develop module will need several of these:
@@ -106,6 +162,10 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // copies of the raw stages outputs, shared with the other pipes. Can be NULL.
+  dt_dev_pixelpipe_shared_cache_t *shared_cache;
+  // temporary buffers of the modules, recycled from one run to the next. Can be NULL.
+  struct dt_dev_pixelpipe_arena_t *arena;
   // input buffer
   float *input;
   // width and height of input buffer
@@ -128,6 +188,10 @@ typedef struct dt_dev_pixelpipe_t
 
   // instances of pixelpipe, stored in GList of dt_dev_pixelpipe_iop_t
   GList *nodes;
+  // the same nodes in pipe order, for the processing and the traversals done on each run.
+  // pieces[k]->module is the k-th module of iop. Built with the nodes.
+  struct dt_dev_pixelpipe_iop_t **pieces;
+  int num_pieces;
   // event flag
   dt_dev_pixelpipe_change_t changed;
   // backbuffer (output)
@@ -136,17 +200,27 @@ typedef struct dt_dev_pixelpipe_t
   int backbuf_width, backbuf_height;
   float backbuf_scale;
   float backbuf_zoom_x, backbuf_zoom_y;
+  float backbuf_downscale; // < 1 when the backbuffer is a coarse pass rendered at backbuf_scale * backbuf_downscale
+  int backbuf_x, backbuf_y; // origin of the backbuffer in the output of the pipe, at backbuf_scale
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // output buffer (for display)
   uint8_t *output_backbuf;
   int output_backbuf_width, output_backbuf_height;
+  // GList of dt_dev_pixelpipe_run_stats_t for the enabled modules, in pipe order, and duration in seconds
+  // of the last complete run. Both protected by backbuf_mutex.
+  GList *run_stats;
+  double run_time;
 
   // the data for the luminance mask are kept in a buffer written by demosaic or rawprepare
   // as we have to scale the mask later ke keep roi at that stage
   float *rawdetail_mask_data;
   struct dt_iop_roi_t rawdetail_mask_roi;
   int want_detail_mask;
+  // the raw detail mask refined and distorted for its consumers, at the positions they have in the pipe.
+  // released along with the raw detail mask.
+  dt_dev_detail_mask_cache_t detail_mask_cache[DT_DEV_DETAIL_MASK_CACHE];
+  int detail_mask_cache_next;
 
   int output_imgid;
   // working?
@@ -166,6 +240,9 @@ typedef struct dt_dev_pixelpipe_t
   // input data based on this timestamp:
   int input_timestamp;
   dt_dev_pixelpipe_type_t type;
+  // export performance profile: scale of the exported file relative to the processed image when it is downscaled
+  // at the end of the pipe, 1 otherwise and for the other pipes. see dt_dev_pixelpipe_performance_allows().
+  float export_scale;
   // the final output pixel format this pixelpipe will be converted to
   dt_imageio_levels_t levels;
   // opencl device that has been locked for this pipe.
@@ -184,6 +261,10 @@ typedef struct dt_dev_pixelpipe_t
   GList *forms;
   // the masks generated in the pipe for later reusal are inside dt_dev_pixelpipe_iop_t
   gboolean store_all_raster_masks;
+  // raster masks already distorted up to their consumer, reused while their source and the distortions
+  // in between don't change
+  dt_dev_raster_mask_cache_t raster_mask_cache[DT_DEV_RASTER_MASK_CACHE];
+  int raster_mask_cache_next;
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
@@ -202,7 +283,8 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 // distortions)
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
 // inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// if memory is non-zero, the cache is hash-indexed and bounded to that many bytes instead.
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memory);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -241,6 +323,21 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
 
+// cooperative cancellation: while a module processes a buffer, the calling thread watches the kill switch
+// of its pipe. Long loops in process() and in the helpers it calls can poll dt_dev_pixelpipe_cancelled()
+// between row blocks, scales or iterations and return early, the output is discarded anyway.
+// Always FALSE outside of a pipe and in OpenMP worker threads, so poll it out of parallel regions.
+gboolean dt_dev_pixelpipe_cancelled(void);
+// get/set the kill switch watched by the current thread, to hand it over to helper threads.
+dt_atomic_int *dt_dev_pixelpipe_get_cancel_flag(void);
+void dt_dev_pixelpipe_set_cancel_flag(dt_atomic_int *flag);
+
+// TRUE when module op may use a cheaper approximation in this pipe because the export is downscaled at the end
+// to max_scale or less, in which case the difference doesn't show in the file. max_scale is the default of the
+// module, plugins/lighttable/export/performance/<op> in darktablerc overrides it, 0 disables it.
+gboolean dt_dev_pixelpipe_performance_allows(const dt_dev_pixelpipe_t *pipe, const char *op,
+                                             const float max_scale);
+
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
 // disable given op and all that comes before it in the pipe:
@@ -251,10 +348,17 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op);
 void dt_dev_pixelpipe_add_node(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int n);
 void dt_dev_pixelpipe_remove_node(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int n);
 
-// helper function to pass a raster mask through a (so far) processed pipe
+// helper function to pass a raster mask through a (so far) processed pipe.
+// the pipe may keep the result, so don't free it unless free_mask is set.
 float *dt_dev_get_raster_mask(const dt_dev_pixelpipe_t *pipe, const struct dt_iop_module_t *raster_mask_source,
                               const int raster_mask_id, const struct dt_iop_module_t *target_module,
                               gboolean *free_mask);
+
+/** for modules flagged IOP_FLAGS_FUSED_OUTPUT: run the per-pixel kernels of the modules fused after this
+ *  piece in place on npixels contiguous pixels of its output. Each pixel of the output has to go through it
+ *  once, when nothing reads it anymore. It does nothing when no module is fused. */
+void dt_dev_pixelpipe_fused_output(dt_dev_pixelpipe_iop_t *piece, float *const out, const size_t npixels);
+
 // some helper functions related to the details mask interface
 void dt_dev_clear_rawdetail_mask(dt_dev_pixelpipe_t *pipe);
 
@@ -266,6 +370,16 @@ gboolean dt_dev_write_rawdetail_mask_cl(dt_dev_pixelpipe_iop_t *piece, cl_mem in
 // helper function writing the pipe-processed ctmask data to dest
 float *dt_dev_distort_detail_mask(const dt_dev_pixelpipe_t *pipe, float *src, const struct dt_iop_module_t *target_module);
 
+// computes the raw detail mask refined for a level, before any distortion. the result is freed by the pipe.
+typedef float *(*dt_dev_detail_mask_calc_t)(struct dt_dev_pixelpipe_iop_t *piece, const float level);
+
+// helper function returning the raw detail mask refined for level and distorted up to the module of piece.
+// the refined mask is only computed with calc_mask if no consumer before has the same level, and only the
+// distortions that follow the closest of these are applied.
+// the pipe keeps the result until the raw detail mask is rewritten, don't free it.
+float *dt_dev_get_detail_mask(struct dt_dev_pixelpipe_iop_t *piece, const float level,
+                              dt_dev_detail_mask_calc_t calc_mask);
+
 // Compute the sequential hash over the pipeline for each module.
 // Need to run after dt_dev_pixelpipe_get_roi_in() has updated processed ROI in/out
 void dt_pixelpipe_get_global_hash(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
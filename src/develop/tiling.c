@@ -18,12 +18,18 @@
 
 
 #include "develop/tiling.h"
+#include "common/file_location.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/pixelpipe.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <assert.h>
+#include <glib/gstdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -588,13 +594,288 @@ static int _fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_
 
 
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
+/* tile-parallel CPU processing.
+   The geometry of all tiles is computed first, then the tiles are processed by a small team of threads,
+   each owning one input/output buffer pair from a pool and a share of the OpenMP threads.
+   Modules read and write piece->pipe->dsc (processed_maximum) from process(), so every worker runs on
+   private copies of the piece and of the pipe. GUI pipes stay serial: some modules look for their GUI
+   feedback by comparing piece->pipe with the pipes of the develop object. */
+typedef struct _tiling_tile_t
+{
+  dt_iop_roi_t iroi, oroi;  // full tile as handed to process()
+  size_t ioffs, ooffs;      // offsets of the tile into ivoid and of its good part into ovoid
+  int origin_x, origin_y;   // origin of the good part into the output tile
+  int good_wd, good_ht;     // size of the good part
+} _tiling_tile_t;
+
+typedef struct _tiling_ctx_t
+{
+  struct dt_iop_module_t *self;
+  struct dt_dev_pixelpipe_iop_t *piece;
+  const void *ivoid;
+  void *ovoid;
+  int in_bpp, out_bpp;
+  size_t ipitch, opitch;
+  const char *label;
+
+  _tiling_tile_t *tiles;
+  int num_tiles;
+  dt_atomic_int next_tile;
+  dt_atomic_int failed;
+  dt_atomic_int *cancel;    // kill switch of the pipe, watched by all workers
+
+  void **pool;              // 2 buffers per worker: input, output
+  size_t in_size, out_size;
+  int workers;
+  int omp_threads;
+
+  dt_aligned_pixel_t processed_maximum_saved;
+  dt_aligned_pixel_t processed_maximum_new;
+  gboolean have_maximum;
+  dt_pthread_mutex_t lock;
+} _tiling_ctx_t;
+
+typedef struct _tiling_worker_t
+{
+  _tiling_ctx_t *ctx;
+  int index;
+} _tiling_worker_t;
+
+/* number of tiles we would like to process at once for this piece. 1 means serial processing */
+static int _tiling_parallel_wanted(struct dt_dev_pixelpipe_iop_t *piece)
+{
+  if(piece->pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_PREVIEW2))
+    return 1;
+
+  const int wanted = dt_conf_get_int("host_tiling_parallel");
+  if(wanted > 0) return wanted;
+
+  // auto: keep at least 4 cores per tile for the OpenMP loops of the module
+  return MAX(1, darktable.num_openmp_threads / 4);
+}
+
+static void _tiling_process_tile(_tiling_ctx_t *ctx, struct dt_dev_pixelpipe_iop_t *piece,
+                                 const _tiling_tile_t *tile, void *input, void *output)
+{
+  const int in_bpp = ctx->in_bpp;
+  const int out_bpp = ctx->out_bpp;
+  const size_t ipitch = ctx->ipitch;
+  const size_t opitch = ctx->opitch;
+  const void *const ivoid = ctx->ivoid;
+  void *const ovoid = ctx->ovoid;
+  const dt_iop_roi_t *const iroi = &tile->iroi;
+  const dt_iop_roi_t *const oroi = &tile->oroi;
+
+  /* prepare input tile buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in_bpp, ipitch, ivoid, input, iroi, tile) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < iroi->height; j++)
+    memcpy((char *)input + j * iroi->width * in_bpp, (char *)ivoid + tile->ioffs + j * ipitch,
+           (size_t)iroi->width * in_bpp);
+
+  /* take original processed_maximum as starting point */
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_saved[k];
+
+  /* call process() of module */
+  ctx->self->process(ctx->self, piece, input, output, iroi, oroi);
+
+  /* aggregate resulting processed_maximum */
+  /* TODO: check if there really can be differences between tiles and take
+           appropriate action (calculate minimum, maximum, average, ...?) */
+  dt_pthread_mutex_lock(&ctx->lock);
+  for(int k = 0; k < 4; k++)
+  {
+    if(ctx->have_maximum && fabs(ctx->processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+      dt_print(DT_DEBUG_TILING, "[%s] processed_maximum[%d] differs between tiles in module '%s'\n",
+               ctx->label, k, ctx->self->op);
+    ctx->processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
+  }
+  ctx->have_maximum = TRUE;
+  dt_pthread_mutex_unlock(&ctx->lock);
+
+  /* copy "good" part of tile to output buffer */
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(opitch, out_bpp, ovoid, output, oroi, tile) \
+  schedule(static)
+#endif
+  for(size_t j = 0; j < tile->good_ht; j++)
+    memcpy((char *)ovoid + tile->ooffs + j * opitch,
+           (char *)output + ((j + tile->origin_y) * oroi->width + tile->origin_x) * out_bpp,
+           (size_t)tile->good_wd * out_bpp);
+}
+
+static void *_tiling_worker(void *data)
+{
+  _tiling_worker_t *worker = (_tiling_worker_t *)data;
+  _tiling_ctx_t *ctx = worker->ctx;
+  void *input = ctx->pool[2 * worker->index];
+  void *output = ctx->pool[2 * worker->index + 1];
+
+  struct dt_dev_pixelpipe_iop_t *piece = ctx->piece;
+  struct dt_dev_pixelpipe_iop_t *piece_copy = NULL;
+  dt_dev_pixelpipe_t *pipe_copy = NULL;
+
+  if(ctx->workers > 1)
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(ctx->omp_threads);
+#endif
+    piece_copy = malloc(sizeof(struct dt_dev_pixelpipe_iop_t));
+    pipe_copy = malloc(sizeof(dt_dev_pixelpipe_t));
+    memcpy(piece_copy, ctx->piece, sizeof(struct dt_dev_pixelpipe_iop_t));
+    memcpy(pipe_copy, ctx->piece->pipe, sizeof(dt_dev_pixelpipe_t));
+    piece_copy->pipe = pipe_copy;
+    piece = piece_copy;
+  }
+  dt_dev_pixelpipe_set_cancel_flag(ctx->cancel);
+
+  int t;
+  while(!dt_dev_pixelpipe_cancelled() && (t = dt_atomic_add_int(&ctx->next_tile, 1)) < ctx->num_tiles)
+  {
+    const _tiling_tile_t *tile = &ctx->tiles[t];
+    dt_print(DT_DEBUG_TILING, "[%s] process tile %d/%d with %dx%d at origin [%d,%d] on worker %d\n",
+             ctx->label, t + 1, ctx->num_tiles, tile->iroi.width, tile->iroi.height, tile->iroi.x,
+             tile->iroi.y, worker->index);
+    piece->pipe->tiling = 1;
+    _tiling_process_tile(ctx, piece, tile, input, output);
+  }
+
+  free(piece_copy);
+  free(pipe_copy);
+  return NULL;
+}
+
+/* process all tiles of ctx with up to `workers` threads. Returns non-zero if no buffer could be allocated */
+static int _tiling_run(_tiling_ctx_t *ctx, int workers)
+{
+  workers = CLAMP(workers, 1, ctx->num_tiles);
+
+  /* reserve the buffers pool, run on less workers if memory is short */
+  ctx->pool = calloc(2 * workers, sizeof(void *));
+  int allocated = 0;
+  for(; allocated < workers; allocated++)
+  {
+    ctx->pool[2 * allocated] = dt_alloc_align(ctx->in_size);
+    ctx->pool[2 * allocated + 1] = dt_alloc_align(ctx->out_size);
+    if(!ctx->pool[2 * allocated] || !ctx->pool[2 * allocated + 1])
+    {
+      dt_free_align(ctx->pool[2 * allocated]);
+      dt_free_align(ctx->pool[2 * allocated + 1]);
+      ctx->pool[2 * allocated] = ctx->pool[2 * allocated + 1] = NULL;
+      break;
+    }
+  }
+
+  if(allocated == 0)
+  {
+    dt_print(DT_DEBUG_TILING, "[%s] could not alloc tile buffers for module '%s'\n", ctx->label, ctx->self->op);
+    free(ctx->pool);
+    ctx->pool = NULL;
+    return 1;
+  }
+
+  ctx->workers = allocated;
+  ctx->cancel = dt_dev_pixelpipe_get_cancel_flag();
+  ctx->omp_threads = MAX(1, darktable.num_openmp_threads / allocated);
+  dt_atomic_set_int(&ctx->next_tile, 0);
+  ctx->have_maximum = FALSE;
+  for_four_channels(k) ctx->processed_maximum_saved[k] = ctx->piece->pipe->dsc.processed_maximum[k];
+  for_four_channels(k) ctx->processed_maximum_new[k] = 1.0f;
+  dt_pthread_mutex_init(&ctx->lock, NULL);
+
+  if(allocated > 1)
+    dt_print(DT_DEBUG_TILING, "[%s] processing %d tiles on %d workers with %d threads each\n", ctx->label,
+             ctx->num_tiles, allocated, ctx->omp_threads);
+
+  _tiling_worker_t *params = calloc(allocated, sizeof(_tiling_worker_t));
+  pthread_t *threads = calloc(allocated, sizeof(pthread_t));
+  gboolean *started = calloc(allocated, sizeof(gboolean));
+
+  // worker 0 is the calling thread
+  for(int k = 1; k < allocated; k++)
+  {
+    params[k] = (_tiling_worker_t){ .ctx = ctx, .index = k };
+    started[k] = !dt_pthread_create(&threads[k], _tiling_worker, &params[k]);
+  }
+
+#ifdef _OPENMP
+  const int omp_threads_saved = omp_get_max_threads();
+#endif
+  params[0] = (_tiling_worker_t){ .ctx = ctx, .index = 0 };
+  _tiling_worker(&params[0]);
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads_saved);
+#endif
+
+  for(int k = 1; k < allocated; k++)
+    if(started[k]) pthread_join(threads[k], NULL);
+
+  free(started);
+  free(threads);
+  free(params);
+
+  /* copy back final processed_maximum */
+  for(int k = 0; k < 4; k++) ctx->piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_new[k];
+  ctx->piece->pipe->tiling = 0;
+
+  dt_pthread_mutex_destroy(&ctx->lock);
+  for(int k = 0; k < 2 * allocated; k++) dt_free_align(ctx->pool[k]);
+  free(ctx->pool);
+  ctx->pool = NULL;
+  return 0;
+}
+
+/* geometry of the tiles for roi_in == roi_out, returns the number of tiles to process */
+static int _tiling_ptp_tiles(_tiling_tile_t *tiles, const dt_iop_roi_t *const roi_in,
+                             const dt_iop_roi_t *const roi_out, const int width, const int height,
+                             const int tile_wd, const int tile_ht, const int tiles_x, const int tiles_y,
+                             const int overlap, const int in_bpp, const int out_bpp)
+{
+  const size_t ipitch = (size_t)roi_in->width * in_bpp;
+  const size_t opitch = (size_t)roi_out->width * out_bpp;
+  int num_tiles = 0;
+  for(size_t tx = 0; tx < tiles_x; tx++)
+  {
+    const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
+    for(size_t ty = 0; ty < tiles_y; ty++)
+    {
+      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
+
+      /* no need to process end-tiles that are smaller than the total overlap area */
+      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
+
+      _tiling_tile_t *tile = &tiles[num_tiles++];
+
+      /* roi_in and roi_out for process on subbuffer */
+      tile->iroi = (dt_iop_roi_t){ roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
+      tile->oroi = (dt_iop_roi_t){ roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
+
+      /* offsets of tile into ivoid and ovoid */
+      tile->ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
+      tile->ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
+
+      /* correct origin and region of tile for overlap.
+         make sure that we only copy back the "good" part. */
+      tile->origin_x = tx > 0 ? overlap : 0;
+      tile->origin_y = ty > 0 ? overlap : 0;
+      tile->good_wd = wd - tile->origin_x;
+      tile->good_ht = ht - tile->origin_y;
+      tile->ooffs += (size_t)tile->origin_x * out_bpp + (size_t)tile->origin_y * opitch;
+    }
+  }
+  return num_tiles;
+}
+
 static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                         const void *const ivoid, void *const ovoid,
                                         const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                                         const int in_bpp)
 {
-  void *input = NULL;
-  void *output = NULL;
+  _tiling_tile_t *tiles = NULL;
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] **** tiling module '%s' for image with size %dx%d --> %dx%d\n",
            self->op, roi_in->width, roi_in->height, roi_out->width, roi_out->height);
   dt_iop_buffer_dsc_t dsc;
@@ -635,6 +916,10 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   const float maxbuf = fmaxf(tiling.maxbuf, 1.0f);
   singlebuffer = fmaxf(available / factor, singlebuffer);
 
+  /* smaller tiles if we want to process several of them at once */
+  const int parallel = _tiling_parallel_wanted(piece);
+  singlebuffer /= parallel;
+
   int width = roi_in->width;
   int height = roi_in->height;
 
@@ -707,117 +992,30 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] (%dx%d) tiles with max dimensions %dx%d and overlap %d\n",
            tiles_x, tiles_y, width, height, overlap);
 
-  /* reserve input and output buffers for tiles */
-  input = dt_alloc_align((size_t)width * height * in_bpp);
-  if(input == NULL)
-  {
-    dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n",
-             self->op);
-    goto error;
-  }
-  output = dt_alloc_align((size_t)width * height * out_bpp);
-  if(output == NULL)
-  {
-    dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n",
-             self->op);
-    goto error;
-  }
-
-  /* store processed_maximum to be re-used and aggregated */
-  dt_aligned_pixel_t processed_maximum_saved;
-  dt_aligned_pixel_t processed_maximum_new = { 1.0f };
-  for_four_channels(k) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
-
-  /* iterate over tiles */
-  for(size_t tx = 0; tx < tiles_x; tx++)
-  {
-    const size_t wd = tx * tile_wd + width > roi_in->width ? roi_in->width - tx * tile_wd : width;
-    for(size_t ty = 0; ty < tiles_y; ty++)
-    {
-      piece->pipe->tiling = 1;
-
-      const size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height - ty * tile_ht : height;
-
-      /* no need to process end-tiles that are smaller than the total overlap area */
-      if((wd <= 2 * overlap && tx > 0) || (ht <= 2 * overlap && ty > 0)) continue;
-
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
-
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x + tx * tile_wd, roi_in->y + ty * tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x + tx * tile_wd, roi_out->y + ty * tile_ht, wd, ht, roi_out->scale };
-
-      /* offsets of tile into ivoid and ovoid */
-      const size_t ioffs = (ty * tile_ht) * ipitch + (tx * tile_wd) * in_bpp;
-      size_t ooffs = (ty * tile_ht) * opitch + (tx * tile_wd) * out_bpp;
-
-      dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] tile (%zu,%zu) with %zux%zu at origin [%zu,%zu]\n",
-               tx, ty, wd, ht, tx * tile_wd, ty * tile_ht);
-
-/* prepare input tile buffer */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(ht, in_bpp, ipitch, ivoid, wd) \
-      dt_omp_sharedconst(ioffs) \
-      shared(input, width) \
-      schedule(static)
-#endif
-      for(size_t j = 0; j < ht; j++)
-        memcpy((char *)input + j * wd * in_bpp, (char *)ivoid + ioffs + j * ipitch, (size_t)wd * in_bpp);
-
-      /* take original processed_maximum as starting point */
-      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k = 0; k < 4; k++)
-      {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
-          dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n",
-                   k, self->op);
-        processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
-      }
-
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += (size_t)overlap * out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += (size_t)overlap * opitch;
-      }
-
-/* copy "good" part of tile to output buffer */
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(opitch, out_bpp, ovoid, wd) \
-      shared(ooffs, output, width, origin, region) \
-      schedule(static)
-#endif
-      for(size_t j = 0; j < region[1]; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin[1]) * wd + origin[0]) * out_bpp, (size_t)region[0] * out_bpp);
-    }
-  }
-
-  /* copy back final processed_maximum */
-  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
-
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
-  piece->pipe->tiling = 0;
+  /* compute the geometry of all tiles */
+  tiles = calloc((size_t)tiles_x * tiles_y, sizeof(_tiling_tile_t));
+  const int num_tiles = _tiling_ptp_tiles(tiles, roi_in, roi_out, width, height, tile_wd, tile_ht, tiles_x,
+                                          tiles_y, overlap, in_bpp, out_bpp);
+
+  _tiling_ctx_t ctx = { .self = self,
+                        .piece = piece,
+                        .ivoid = ivoid,
+                        .ovoid = ovoid,
+                        .in_bpp = in_bpp,
+                        .out_bpp = out_bpp,
+                        .ipitch = ipitch,
+                        .opitch = opitch,
+                        .label = "default_process_tiling_ptp",
+                        .tiles = tiles,
+                        .num_tiles = num_tiles,
+                        .in_size = (size_t)width * height * in_bpp,
+                        .out_size = (size_t)width * height * out_bpp };
+
+  /* as many tiles at once as fit into the memory left */
+  const int fitting = MAX(1, (int)(available / fmaxf((float)width * height * max_bpp * factor, 1.0f)));
+  if(_tiling_run(&ctx, MIN(parallel, fitting))) goto error;
+
+  free(tiles);
   return;
 
 error:
@@ -825,8 +1023,7 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  free(tiles);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n",
            self->op);
@@ -843,8 +1040,7 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
                                         const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                                         const int in_bpp)
 {
-  void *input = NULL;
-  void *output = NULL;
+  _tiling_tile_t *tiles = NULL;
 
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] **** tiling module '%s' for image input size %dx%d --> %dx%d\n",
            self->op, roi_in->width, roi_in->height, roi_out->width, roi_out->height);
@@ -897,6 +1093,10 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   const float maxbuf = fmaxf(tiling.maxbuf, 1.0f);
   singlebuffer = fmaxf(available / factor, singlebuffer);
 
+  /* smaller tiles if we want to process several of them at once */
+  const int parallel = _tiling_parallel_wanted(piece);
+  singlebuffer /= parallel;
+
   int width = _max(roi_in->width, roi_out->width);
   int height = _max(roi_in->height, roi_out->height);
 
@@ -986,17 +1186,13 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] (%dx%d) tiles with max dimensions %dx%d, good %dx%d, overlap %d->%d\n",
            tiles_x, tiles_y, width, height, tile_wd, tile_ht, overlap_in, overlap_out);
 
-  /* store processed_maximum to be re-used and aggregated */
-  dt_aligned_pixel_t processed_maximum_saved;
-  dt_aligned_pixel_t processed_maximum_new = { 1.0f };
-  for_four_channels(k) processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
-
-  /* iterate over tiles */
+  /* compute the geometry of all tiles */
+  tiles = calloc((size_t)tiles_x * tiles_y, sizeof(_tiling_tile_t));
+  int num_tiles = 0;
+  size_t in_size = 0, out_size = 0;
   for(size_t tx = 0; tx < tiles_x; tx++)
     for(size_t ty = 0; ty < tiles_y; ty++)
     {
-      piece->pipe->tiling = 1;
-
       /* the output dimensions of the good part of this specific tile */
       const size_t wd = (tx + 1) * tile_wd > roi_out->width ? (size_t)roi_out->width - tx * tile_wd : tile_wd;
       const size_t ht = (ty + 1) * tile_ht > roi_out->height ? (size_t)roi_out->height - ty * tile_ht : tile_ht;
@@ -1079,79 +1275,42 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
 
       /* offsets of tile into ivoid and ovoid */
       const size_t ioffs = ((size_t)iroi_full.y - roi_in->y)  * ipitch + ((size_t)iroi_full.x - roi_in->x) * in_bpp;
-            size_t ooffs = ((size_t)oroi_good.y - roi_out->y) * opitch + ((size_t)oroi_good.x - roi_out->x) * out_bpp;
-
-      dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] process tile (%zu,%zu) size %dx%d at origin [%d,%d]\n",
-               tx, ty, iroi_full.width, iroi_full.height, iroi_full.x, iroi_full.y);
-
-      /* prepare input tile buffer */
-      input = dt_alloc_align((size_t)iroi_full.width * iroi_full.height * in_bpp);
-      if(input == NULL)
-      {
-        dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n",
-                 self->op);
-        goto error;
-      }
-      output = dt_alloc_align((size_t)oroi_full.width * oroi_full.height * out_bpp);
-      if(output == NULL)
-      {
-        dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n",
-                 self->op);
-        goto error;
-      }
-
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(in_bpp, ipitch, ivoid) \
-      dt_omp_sharedconst(ioffs) shared(input, iroi_full) \
-      schedule(static)
-#endif
-      for(size_t j = 0; j < iroi_full.height; j++)
-        memcpy((char *)input + j * iroi_full.width * in_bpp, (char *)ivoid + ioffs + j * ipitch,
-               (size_t)iroi_full.width * in_bpp);
-
-      /* take original processed_maximum as starting point */
-      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_saved[k];
-
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi_full, &oroi_full);
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k = 0; k < 4; k++)
-      {
-        if(tx + ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
-          dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] processed_maximum[%d] differs between tiles in module '%s'\n",
-              k, self->op);
-        processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
-      }
-
-      /* copy "good" part of tile to output buffer */
-      const int origin_x = oroi_good.x - oroi_full.x;
-      const int origin_y = oroi_good.y - oroi_full.y;
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-      dt_omp_firstprivate(opitch, origin_x, origin_y, out_bpp, ovoid) \
-      shared(ooffs, output, oroi_good, oroi_full) \
-      schedule(static)
-#endif
-      for(size_t j = 0; j < oroi_good.height; j++)
-        memcpy((char *)ovoid + ooffs + j * opitch,
-               (char *)output + ((j + origin_y) * oroi_full.width + origin_x) * out_bpp,
-               (size_t)oroi_good.width * out_bpp);
-
-      dt_free_align(input);
-      dt_free_align(output);
-      input = output = NULL;
+      const size_t ooffs = ((size_t)oroi_good.y - roi_out->y) * opitch + ((size_t)oroi_good.x - roi_out->x) * out_bpp;
+
+      _tiling_tile_t *tile = &tiles[num_tiles++];
+      tile->iroi = iroi_full;
+      tile->oroi = oroi_full;
+      tile->ioffs = ioffs;
+      tile->ooffs = ooffs;
+      tile->origin_x = oroi_good.x - oroi_full.x;
+      tile->origin_y = oroi_good.y - oroi_full.y;
+      tile->good_wd = oroi_good.width;
+      tile->good_ht = oroi_good.height;
+
+      /* the buffers of the pool have to fit the largest tile */
+      in_size = MAX(in_size, (size_t)iroi_full.width * iroi_full.height * in_bpp);
+      out_size = MAX(out_size, (size_t)oroi_full.width * oroi_full.height * out_bpp);
     }
 
-  /* copy back final processed_maximum */
-  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = processed_maximum_new[k];
-
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
-  piece->pipe->tiling = 0;
+  _tiling_ctx_t ctx = { .self = self,
+                        .piece = piece,
+                        .ivoid = ivoid,
+                        .ovoid = ovoid,
+                        .in_bpp = in_bpp,
+                        .out_bpp = out_bpp,
+                        .ipitch = ipitch,
+                        .opitch = opitch,
+                        .label = "default_process_tiling_roi",
+                        .tiles = tiles,
+                        .num_tiles = num_tiles,
+                        .in_size = in_size,
+                        .out_size = out_size };
+
+  /* as many tiles at once as fit into the memory left */
+  const int fitting = MAX(1, (int)(available / fmaxf((float)(in_size + out_size) / 2.0f * factor, 1.0f)));
+  if(_tiling_run(&ctx, MIN(parallel, fitting))) goto error;
+
+  free(tiles);
   return;
 
 error:
@@ -1159,8 +1318,7 @@ error:
 // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  free(tiles);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n",
            self->op);
@@ -1189,6 +1347,362 @@ void default_process_tiling(struct dt_iop_module_t *self, struct dt_dev_pixelpip
 
 
 #ifdef HAVE_OPENCL
+/* multi-device OpenCL tiling: the tiles of one module are spread over the device locked by the pipe and
+   over all other devices that are free right now. Each extra device runs in its own thread on private
+   copies of the piece and pipe (with their own devid), tiles are uploaded from and gathered into the
+   host buffers with blocking transfers. */
+typedef struct _tiling_cl_worker_t
+{
+  _tiling_ctx_t *ctx;
+  struct dt_dev_pixelpipe_iop_t *piece;
+  int devid;
+  cl_int err;
+} _tiling_cl_worker_t;
+
+static void *_tiling_cl_worker(void *data)
+{
+  _tiling_cl_worker_t *worker = (_tiling_cl_worker_t *)data;
+  _tiling_ctx_t *ctx = worker->ctx;
+  struct dt_dev_pixelpipe_iop_t *piece = worker->piece;
+  const int devid = worker->devid;
+  dt_dev_pixelpipe_set_cancel_flag(ctx->cancel);
+
+  int t;
+  while(!dt_atomic_get_int(&ctx->failed) && !dt_dev_pixelpipe_cancelled()
+        && (t = dt_atomic_add_int(&ctx->next_tile, 1)) < ctx->num_tiles)
+  {
+    const _tiling_tile_t *tile = &ctx->tiles[t];
+    piece->pipe->tiling = 1;
+
+    dt_print(DT_DEBUG_TILING, "[%s] process tile %d/%d with %dx%d at origin [%d,%d] on device %d\n", ctx->label,
+             t + 1, ctx->num_tiles, tile->iroi.width, tile->iroi.height, tile->iroi.x, tile->iroi.y, devid);
+
+    cl_mem input = dt_opencl_alloc_device(devid, tile->iroi.width, tile->iroi.height, ctx->in_bpp);
+    cl_mem output = dt_opencl_alloc_device(devid, tile->oroi.width, tile->oroi.height, ctx->out_bpp);
+    worker->err = (input && output) ? CL_SUCCESS : CL_MEM_OBJECT_ALLOCATION_FAILURE;
+
+    /* blocking direct memory transfer: host input image -> opencl/device tile */
+    size_t iorigin[] = { 0, 0, 0 };
+    size_t iregion[] = { tile->iroi.width, tile->iroi.height, 1 };
+    if(worker->err == CL_SUCCESS)
+      worker->err = dt_opencl_write_host_to_device_raw(devid, (char *)ctx->ivoid + tile->ioffs, input, iorigin,
+                                                       iregion, ctx->ipitch, CL_TRUE);
+
+    if(worker->err == CL_SUCCESS)
+    {
+      /* take original processed_maximum as starting point */
+      for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_saved[k];
+
+      /* call process_cl of module */
+      if(!ctx->self->process_cl(ctx->self, piece, input, output, &tile->iroi, &tile->oroi))
+        worker->err = -999;
+    }
+
+    if(worker->err == CL_SUCCESS)
+    {
+      dt_pthread_mutex_lock(&ctx->lock);
+      for(int k = 0; k < 4; k++)
+      {
+        if(ctx->have_maximum
+           && fabs(ctx->processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+          dt_print(DT_DEBUG_TILING, "[%s] processed_maximum[%d] differs between tiles in module '%s'\n",
+                   ctx->label, k, ctx->self->op);
+        ctx->processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
+      }
+      ctx->have_maximum = TRUE;
+      dt_pthread_mutex_unlock(&ctx->lock);
+
+      /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
+      size_t oorigin[] = { tile->origin_x, tile->origin_y, 0 };
+      size_t oregion[] = { tile->good_wd, tile->good_ht, 1 };
+      worker->err = dt_opencl_read_host_from_device_raw(devid, (char *)ctx->ovoid + tile->ooffs, output, oorigin,
+                                                        oregion, ctx->opitch, CL_TRUE);
+    }
+
+    dt_opencl_release_mem_object(input);
+    dt_opencl_release_mem_object(output);
+
+    /* block until opencl queue has finished to free all used event handlers */
+    dt_opencl_finish_sync_pipe(devid, piece->pipe->type);
+
+    if(worker->err != CL_SUCCESS) dt_atomic_set_int(&ctx->failed, TRUE);
+  }
+  return NULL;
+}
+
+/* lock the free devices able to take tiles of the given size, besides the one of the pipe */
+static int _tiling_cl_extra_devices(struct dt_dev_pixelpipe_iop_t *piece, const int width, const int height,
+                                    const float required, int *devices)
+{
+  if(!dt_conf_get_bool("opencl_tiling_multi_device")) return 0;
+
+  int count = 0;
+  for(int dev = 0; dev < darktable.opencl->num_devs; dev++)
+  {
+    if(dev == piece->pipe->devid) continue;
+    if(dt_opencl_trylock_device(dev) < 0) continue;
+    if(darktable.opencl->dev[dev].max_image_width < width || darktable.opencl->dev[dev].max_image_height < height
+       || (float)dt_opencl_get_device_available(dev) < required)
+    {
+      dt_opencl_unlock_device(dev);
+      continue;
+    }
+    devices[count++] = dev;
+  }
+  return count;
+}
+
+/* process the tiles of ctx on the pipe device and on the extra devices, then unlock the extra devices */
+static int _tiling_cl_run(_tiling_ctx_t *ctx, const int *devices, const int num_devices)
+{
+  const int workers = num_devices + 1;
+  _tiling_cl_worker_t *params = calloc(workers, sizeof(_tiling_cl_worker_t));
+  pthread_t *threads = calloc(workers, sizeof(pthread_t));
+  gboolean *started = calloc(workers, sizeof(gboolean));
+  struct dt_dev_pixelpipe_iop_t *pieces = calloc(workers, sizeof(struct dt_dev_pixelpipe_iop_t));
+  dt_dev_pixelpipe_t *pipes = calloc(workers, sizeof(dt_dev_pixelpipe_t));
+
+  dt_atomic_set_int(&ctx->next_tile, 0);
+  dt_atomic_set_int(&ctx->failed, FALSE);
+  ctx->cancel = dt_dev_pixelpipe_get_cancel_flag();
+  ctx->have_maximum = FALSE;
+  for_four_channels(k) ctx->processed_maximum_saved[k] = ctx->piece->pipe->dsc.processed_maximum[k];
+  for_four_channels(k) ctx->processed_maximum_new[k] = 1.0f;
+  dt_pthread_mutex_init(&ctx->lock, NULL);
+
+  dt_print(DT_DEBUG_TILING | DT_DEBUG_OPENCL, "[%s] spreading %d tiles of module '%s' over %d devices\n",
+           ctx->label, ctx->num_tiles, ctx->self->op, workers);
+
+  for(int k = 1; k < workers; k++)
+  {
+    memcpy(&pipes[k], ctx->piece->pipe, sizeof(dt_dev_pixelpipe_t));
+    memcpy(&pieces[k], ctx->piece, sizeof(struct dt_dev_pixelpipe_iop_t));
+    pipes[k].devid = devices[k - 1];
+    pieces[k].pipe = &pipes[k];
+    params[k] = (_tiling_cl_worker_t){ .ctx = ctx, .piece = &pieces[k], .devid = devices[k - 1], .err = CL_SUCCESS };
+    started[k] = !dt_pthread_create(&threads[k], _tiling_cl_worker, &params[k]);
+  }
+
+  // the pipe device is served by the calling thread, on the real piece
+  params[0] = (_tiling_cl_worker_t){ .ctx = ctx, .piece = ctx->piece, .devid = ctx->piece->pipe->devid,
+                                     .err = CL_SUCCESS };
+  _tiling_cl_worker(&params[0]);
+
+  for(int k = 1; k < workers; k++)
+    if(started[k]) pthread_join(threads[k], NULL);
+
+  for(int k = 0; k < num_devices; k++) dt_opencl_unlock_device(devices[k]);
+
+  const int success = !dt_atomic_get_int(&ctx->failed);
+  for(int k = 0; k < 4; k++)
+    ctx->piece->pipe->dsc.processed_maximum[k]
+        = success ? ctx->processed_maximum_new[k] : ctx->processed_maximum_saved[k];
+  ctx->piece->pipe->tiling = 0;
+
+  if(!success)
+    for(int k = 0; k < workers; k++)
+      if(params[k].err != CL_SUCCESS)
+        dt_print(DT_DEBUG_TILING | DT_DEBUG_OPENCL, "[%s] couldn't run process_cl() for module '%s' on device %d: %s\n",
+                 ctx->label, ctx->self->op, params[k].devid, cl_errstr(params[k].err));
+
+  dt_pthread_mutex_destroy(&ctx->lock);
+  free(pipes);
+  free(pieces);
+  free(started);
+  free(threads);
+  free(params);
+  return success;
+}
+
+/* double-buffered OpenCL tiling for roi_in == roi_out: transfers are non-blocking and every tile has a marker
+   event, so the host prepares and uploads tile N+1 while the device still computes tile N, and the
+   download of tile N-1 is only waited for when its slot is needed again. */
+typedef struct _tiling_cl_slot_t
+{
+  cl_mem pinned_input, pinned_output;
+  void *input_buffer, *output_buffer;
+  cl_event done;
+  const _tiling_tile_t *pending; // tile whose download is in flight
+} _tiling_cl_slot_t;
+
+// wait for the tile in flight in this slot, and copy it to the host output if it went through pinned memory
+static cl_int _tiling_cl_slot_drain(_tiling_ctx_t *ctx, const int devid, _tiling_cl_slot_t *slot,
+                                    const gboolean use_pinned_memory)
+{
+  if(!slot->pending) return CL_SUCCESS;
+  const cl_int err = dt_opencl_wait_for_marker(devid, slot->done);
+  const _tiling_tile_t *tile = slot->pending;
+  slot->done = NULL;
+  slot->pending = NULL;
+  if(err != CL_SUCCESS || !use_pinned_memory) return err;
+
+  /* copy "good" part of tile from pinned output buffer to output image */
+  for(size_t j = 0; j < tile->good_ht; j++)
+    memcpy((char *)ctx->ovoid + tile->ooffs + j * ctx->opitch,
+           (char *)slot->output_buffer + ((j + tile->origin_y) * tile->oroi.width + tile->origin_x) * ctx->out_bpp,
+           (size_t)tile->good_wd * ctx->out_bpp);
+  return CL_SUCCESS;
+}
+
+static void _tiling_cl_slots_free(const int devid, _tiling_cl_slot_t *slots)
+{
+  for(int s = 0; s < 2; s++)
+  {
+    if(slots[s].input_buffer) dt_opencl_unmap_mem_object(devid, slots[s].pinned_input, slots[s].input_buffer);
+    if(slots[s].output_buffer) dt_opencl_unmap_mem_object(devid, slots[s].pinned_output, slots[s].output_buffer);
+    dt_opencl_release_mem_object(slots[s].pinned_input);
+    dt_opencl_release_mem_object(slots[s].pinned_output);
+    slots[s].pinned_input = slots[s].pinned_output = NULL;
+    slots[s].input_buffer = slots[s].output_buffer = NULL;
+  }
+}
+
+static int _tiling_cl_ptp_double_buffered(_tiling_ctx_t *ctx, const int devid, gboolean use_pinned_memory)
+{
+  struct dt_dev_pixelpipe_iop_t *piece = ctx->piece;
+  _tiling_cl_slot_t slots[2] = { { 0 } };
+  cl_int err = CL_SUCCESS;
+  cl_mem input = NULL;
+  cl_mem output = NULL;
+
+  /* reserve two sets of pinned input and output memory for host<->device data transfer */
+  for(int s = 0; s < 2 && use_pinned_memory; s++)
+  {
+    slots[s].pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, ctx->in_size,
+                                                                     CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    slots[s].pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, ctx->out_size,
+                                                                      CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    if(slots[s].pinned_input)
+      slots[s].input_buffer = dt_opencl_map_buffer(devid, slots[s].pinned_input, CL_TRUE, CL_MAP_WRITE, 0,
+                                                   ctx->in_size);
+    if(slots[s].pinned_output)
+      slots[s].output_buffer = dt_opencl_map_buffer(devid, slots[s].pinned_output, CL_TRUE, CL_MAP_READ, 0,
+                                                    ctx->out_size);
+    if(!slots[s].input_buffer || !slots[s].output_buffer)
+    {
+      dt_print(DT_DEBUG_OPENCL | DT_DEBUG_TILING,
+               "[%s] could not alloc pinned buffers for module '%s', using direct transfers\n", ctx->label,
+               ctx->self->op);
+      _tiling_cl_slots_free(devid, slots);
+      use_pinned_memory = FALSE;
+    }
+  }
+
+  for_four_channels(k) ctx->processed_maximum_saved[k] = piece->pipe->dsc.processed_maximum[k];
+  for_four_channels(k) ctx->processed_maximum_new[k] = 1.0f;
+
+  for(int t = 0; t < ctx->num_tiles; t++)
+  {
+    const _tiling_tile_t *tile = &ctx->tiles[t];
+    _tiling_cl_slot_t *slot = &slots[t & 1];
+    piece->pipe->tiling = 1;
+
+    /* the slot is free again once the tile processed two steps before is downloaded */
+    err = _tiling_cl_slot_drain(ctx, devid, slot, use_pinned_memory);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_print(DT_DEBUG_TILING, "[%s] tile %d/%d size %dx%d at origin [%d,%d], slot %d\n", ctx->label, t + 1,
+             ctx->num_tiles, tile->iroi.width, tile->iroi.height, tile->iroi.x, tile->iroi.y, t & 1);
+
+    /* get input and output buffers. They are released as soon as enqueued commands are done with them */
+    input = dt_opencl_alloc_device(devid, tile->iroi.width, tile->iroi.height, ctx->in_bpp);
+    if(input == NULL) goto error;
+    output = dt_opencl_alloc_device(devid, tile->oroi.width, tile->oroi.height, ctx->out_bpp);
+    if(output == NULL) goto error;
+
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { tile->iroi.width, tile->iroi.height, 1 };
+    if(use_pinned_memory)
+    {
+      /* prepare pinned input tile buffer: copy part of input image while the device still works */
+      const size_t in_pitch = (size_t)tile->iroi.width * ctx->in_bpp;
+      for(size_t j = 0; j < tile->iroi.height; j++)
+        memcpy((char *)slot->input_buffer + j * in_pitch, (char *)ctx->ivoid + tile->ioffs + j * ctx->ipitch,
+               in_pitch);
+
+      /* non-blocking memory transfer: pinned host input buffer -> opencl/device tile */
+      err = dt_opencl_write_host_to_device_raw(devid, slot->input_buffer, input, origin, region, in_pitch, CL_FALSE);
+    }
+    else
+    {
+      /* non-blocking direct memory transfer: host input image -> opencl/device tile */
+      err = dt_opencl_write_host_to_device_raw(devid, (char *)ctx->ivoid + tile->ioffs, input, origin, region,
+                                               ctx->ipitch, CL_FALSE);
+    }
+    if(err != CL_SUCCESS) goto error;
+
+    /* take original processed_maximum as starting point */
+    for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_saved[k];
+
+    /* call process_cl of module */
+    if(!ctx->self->process_cl(ctx->self, piece, input, output, &tile->iroi, &tile->oroi))
+    {
+      err = -999;
+      goto error;
+    }
+
+    /* aggregate resulting processed_maximum */
+    for(int k = 0; k < 4; k++)
+    {
+      if(t > 0 && fabs(ctx->processed_maximum_new[k] - piece->pipe->dsc.processed_maximum[k]) > 1.0e-6f)
+        dt_print(DT_DEBUG_TILING, "[%s] processed_maximum[%d] differs between tiles in module '%s'\n",
+                 ctx->label, k, ctx->self->op);
+      ctx->processed_maximum_new[k] = piece->pipe->dsc.processed_maximum[k];
+    }
+
+    if(use_pinned_memory)
+    {
+      /* non-blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
+      region[0] = tile->oroi.width;
+      region[1] = tile->oroi.height;
+      err = dt_opencl_read_host_from_device_raw(devid, slot->output_buffer, output, origin, region,
+                                                tile->oroi.width * ctx->out_bpp, CL_FALSE);
+    }
+    else
+    {
+      /* non-blocking direct memory transfer: good part of opencl/device tile -> host output image */
+      size_t good_origin[] = { tile->origin_x, tile->origin_y, 0 };
+      size_t good_region[] = { tile->good_wd, tile->good_ht, 1 };
+      err = dt_opencl_read_host_from_device_raw(devid, (char *)ctx->ovoid + tile->ooffs, output, good_origin,
+                                                good_region, ctx->opitch, CL_FALSE);
+    }
+    if(err != CL_SUCCESS) goto error;
+
+    slot->done = dt_opencl_enqueue_marker(devid);
+    slot->pending = tile;
+
+    dt_opencl_release_mem_object(input);
+    dt_opencl_release_mem_object(output);
+    input = output = NULL;
+  }
+
+  /* wait for the last two tiles */
+  for(int s = 0; s < 2; s++)
+  {
+    err = _tiling_cl_slot_drain(ctx, devid, &slots[(ctx->num_tiles + s) & 1], use_pinned_memory);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  /* copy back final processed_maximum */
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_new[k];
+  _tiling_cl_slots_free(devid, slots);
+  dt_opencl_finish_sync_pipe(devid, piece->pipe->type);
+  piece->pipe->tiling = 0;
+  return TRUE;
+
+error:
+  for(int s = 0; s < 2; s++) _tiling_cl_slot_drain(ctx, devid, &slots[s], FALSE);
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = ctx->processed_maximum_saved[k];
+  dt_opencl_release_mem_object(input);
+  dt_opencl_release_mem_object(output);
+  _tiling_cl_slots_free(devid, slots);
+  piece->pipe->tiling = 0;
+  dt_print(DT_DEBUG_TILING | DT_DEBUG_OPENCL,
+           "[%s] couldn't run process_cl() for module '%s' in double-buffered tiling mode: %s\n", ctx->label,
+           ctx->self->op, cl_errstr(err));
+  return FALSE;
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                                           const void *const ivoid, void *const ovoid,
@@ -1227,7 +1741,10 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   // avoid problems when pinned buffer size gets too close to max_mem_alloc size
   const float pinned_buffer_slack = use_pinned_memory ? 0.85f : 1.0f;
   const float available = (float)dt_opencl_get_device_available(devid);
-  const float factor = fmaxf(tiling.factor_cl + pinned_buffer_overhead, 1.0f);
+  /* double buffering keeps a second set of tile buffers (and pinned buffers) alive */
+  const gboolean double_buffer = dt_conf_get_bool("opencl_tiling_double_buffer");
+  const float factor = fmaxf(tiling.factor_cl + pinned_buffer_overhead * (double_buffer ? 2 : 1)
+                             + (double_buffer ? 2 : 0), 1.0f);
   const float singlebuffer = fminf(fmaxf((available - tiling.overhead) / factor, 0.0f),
                                   pinned_buffer_slack * (float)(dt_opencl_get_device_memalloc(devid)));
   const float maxbuf = fmaxf(tiling.maxbuf_cl, 1.0f);
@@ -1310,6 +1827,57 @@ static int _default_process_tiling_cl_ptp(struct dt_iop_module_t *self, struct d
   dt_print(DT_DEBUG_TILING, "[default_process_tiling_cl_ptp] (%dx%d) tiles with max dimensions %dx%d, pinned=%s, good %dx%d and overlap %d\n",
            tiles_x, tiles_y, width, height, (use_pinned_memory) ? "ON" : "OFF", tile_wd, tile_ht, overlap);
 
+  /* spread the tiles over all free devices if we can */
+  if(tiles_x * tiles_y > 1)
+  {
+    int *devices = calloc(darktable.opencl->num_devs, sizeof(int));
+    const float required = (float)width * height * max_bpp * tiling.factor_cl + tiling.overhead;
+    const int num_devices = _tiling_cl_extra_devices(piece, width, height, required, devices);
+    if(num_devices > 0)
+    {
+      _tiling_tile_t *tiles = calloc((size_t)tiles_x * tiles_y, sizeof(_tiling_tile_t));
+      _tiling_ctx_t ctx = { .self = self,
+                            .piece = piece,
+                            .ivoid = ivoid,
+                            .ovoid = ovoid,
+                            .in_bpp = in_bpp,
+                            .out_bpp = out_bpp,
+                            .ipitch = ipitch,
+                            .opitch = opitch,
+                            .label = "default_process_tiling_cl_ptp",
+                            .tiles = tiles,
+                            .num_tiles = _tiling_ptp_tiles(tiles, roi_in, roi_out, width, height, tile_wd,
+                                                           tile_ht, tiles_x, tiles_y, overlap, in_bpp, out_bpp) };
+      const int success = _tiling_cl_run(&ctx, devices, num_devices);
+      free(tiles);
+      free(devices);
+      return success;
+    }
+    free(devices);
+  }
+
+  if(double_buffer && tiles_x * tiles_y > 1)
+  {
+    _tiling_tile_t *tiles = calloc((size_t)tiles_x * tiles_y, sizeof(_tiling_tile_t));
+    _tiling_ctx_t ctx = { .self = self,
+                          .piece = piece,
+                          .ivoid = ivoid,
+                          .ovoid = ovoid,
+                          .in_bpp = in_bpp,
+                          .out_bpp = out_bpp,
+                          .ipitch = ipitch,
+                          .opitch = opitch,
+                          .label = "default_process_tiling_cl_ptp",
+                          .tiles = tiles,
+                          .num_tiles = _tiling_ptp_tiles(tiles, roi_in, roi_out, width, height, tile_wd, tile_ht,
+                                                         tiles_x, tiles_y, overlap, in_bpp, out_bpp),
+                          .in_size = (size_t)width * height * in_bpp,
+                          .out_size = (size_t)width * height * out_bpp };
+    const int success = _tiling_cl_ptp_double_buffered(&ctx, devid, use_pinned_memory);
+    free(tiles);
+    return success;
+  }
+
   /* store processed_maximum to be re-used and aggregated */
   dt_aligned_pixel_t processed_maximum_saved;
   dt_aligned_pixel_t processed_maximum_new = { 1.0f };
@@ -2058,6 +2626,117 @@ int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, co
     return FALSE;
 }
 
+/* measured tiling factors of the modules, as multiples of the largest of the input and output buffers.
+   They are saved to tilingfactors.txt in the config directory, one "op factor" per line. */
+typedef struct _tiling_calibration_t
+{
+  float factor;   // largest measured
+  float declared; // by the tiling callback of the module, 0 if not seen in this session
+} _tiling_calibration_t;
+
+static GHashTable *_calibration = NULL;
+static dt_pthread_mutex_t _calibration_lock;
+static gchar *_calibration_file = NULL;
+static gboolean _calibrating = FALSE;
+
+void dt_tiling_calibration_init(void)
+{
+  dt_pthread_mutex_init(&_calibration_lock, NULL);
+  _calibration = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  _calibrating = dt_conf_get_bool("tiling_calibration");
+
+  char configdir[PATH_MAX] = { 0 };
+  dt_loc_get_user_config_dir(configdir, sizeof(configdir));
+  _calibration_file = g_build_filename(configdir, "tilingfactors.txt", NULL);
+
+  FILE *f = g_fopen(_calibration_file, "rb");
+  if(!f) return;
+
+  char op[256];
+  float factor;
+  while(fscanf(f, "%255s %f", op, &factor) == 2)
+  {
+    if(!(factor > 0.0f)) continue;
+    _tiling_calibration_t *c = g_new0(_tiling_calibration_t, 1);
+    c->factor = factor;
+    g_hash_table_insert(_calibration, g_strdup(op), c);
+  }
+  fclose(f);
+
+  dt_print(DT_DEBUG_TILING, "[tiling] %u measured tiling factors loaded from `%s'\n",
+           g_hash_table_size(_calibration), _calibration_file);
+}
+
+void dt_tiling_calibration_cleanup(void)
+{
+  if(!_calibration) return;
+
+  if(_calibrating)
+  {
+    FILE *f = g_fopen(_calibration_file, "wb");
+    if(f)
+    {
+      GHashTableIter iter;
+      gpointer key, value;
+      g_hash_table_iter_init(&iter, _calibration);
+      while(g_hash_table_iter_next(&iter, &key, &value))
+      {
+        const _tiling_calibration_t *c = (_tiling_calibration_t *)value;
+        fprintf(f, "%s %.3f\n", (const char *)key, c->factor);
+        if(c->declared > 0.0f)
+          dt_print(DT_DEBUG_TILING, "[tiling] %-20s measured factor %.2f, estimated %.2f\n", (const char *)key,
+                   c->factor, c->declared);
+      }
+      fclose(f);
+    }
+    else
+      dt_print(DT_DEBUG_TILING, "[tiling] can't write `%s'\n", _calibration_file);
+  }
+
+  g_hash_table_destroy(_calibration);
+  _calibration = NULL;
+  g_free(_calibration_file);
+  _calibration_file = NULL;
+  dt_pthread_mutex_destroy(&_calibration_lock);
+}
+
+void dt_tiling_calibration_record(const char *op, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                                  const unsigned in_bpp, const unsigned out_bpp, const float declared,
+                                  const size_t allocated)
+{
+  if(!_calibrating || !_calibration) return;
+
+  // same buffer size as the one dt_tiling_piece_fits_host_memory() multiplies the factor with
+  const size_t buffer = (size_t)MAX(roi_in->width, roi_out->width) * MAX(roi_in->height, roi_out->height)
+                        * MAX(in_bpp, out_bpp);
+  if(buffer == 0) return;
+  const size_t used = (size_t)roi_in->width * roi_in->height * in_bpp
+                      + (size_t)roi_out->width * roi_out->height * out_bpp + allocated;
+  const float factor = (float)used / (float)buffer;
+
+  dt_pthread_mutex_lock(&_calibration_lock);
+  _tiling_calibration_t *c = g_hash_table_lookup(_calibration, op);
+  if(!c)
+  {
+    c = g_new0(_tiling_calibration_t, 1);
+    g_hash_table_insert(_calibration, g_strdup(op), c);
+  }
+  c->factor = fmaxf(c->factor, factor);
+  c->declared = declared;
+  dt_pthread_mutex_unlock(&_calibration_lock);
+}
+
+gboolean dt_tiling_calibrated_factor(const char *op, float *factor)
+{
+  if(!_calibration) return FALSE;
+
+  dt_pthread_mutex_lock(&_calibration_lock);
+  const _tiling_calibration_t *c = g_hash_table_lookup(_calibration, op);
+  if(c) *factor = c->factor;
+  dt_pthread_mutex_unlock(&_calibration_lock);
+  return c != NULL;
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -74,6 +74,22 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
                                      const float factor, const size_t overhead);
 
+/** load the measured tiling factors, and start measuring if the tiling_calibration conf is set */
+void dt_tiling_calibration_init(void);
+
+/** save the measured tiling factors when measuring, and free them */
+void dt_tiling_calibration_cleanup(void);
+
+/** account allocated bytes, seen while the module op processed without tiling on the CPU, to its factor.
+    declared is the factor given by its tiling callback. */
+void dt_tiling_calibration_record(const char *op, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                                  const unsigned in_bpp, const unsigned out_bpp, const float declared,
+                                  const size_t allocated);
+
+/** replace factor by the one measured for the module op, if any. Only allocations made by the thread
+    running the pipe are measured, see dt_metrics_mem_begin(). */
+gboolean dt_tiling_calibrated_factor(const char *op, float *factor);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
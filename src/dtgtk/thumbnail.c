@@ -23,6 +23,7 @@
 
 #include "bauhaus/bauhaus.h"
 #include "common/collection.h"
+#include "common/colorlabels.h"
 #include "common/debug.h"
 #include "common/focus.h"
 #include "common/focus_peaking.h"
@@ -66,11 +67,11 @@ static void _image_update_group_tooltip(dt_thumbnail_t *thumb)
     tt = g_strdup_printf("\n\u2022 <b>%s (%s)</b>", _("current"), _("leader"));
   else
   {
-    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->groupid, 'r');
+    const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->groupid);
     if(img)
     {
       tt = g_strdup_printf("%s\n\u2022 <b>%s (%s)</b>", _("\nclick here to set this image as group leader\n"), img->filename, _("leader"));
-      dt_image_cache_read_release(darktable.image_cache, img);
+      dt_image_cache_snapshot_release(darktable.image_cache, img);
     }
   }
 
@@ -136,7 +137,7 @@ static void _image_get_infos(dt_thumbnail_t *thumb)
 
   const int old_rating = thumb->rating;
   thumb->rating = 0;
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
   if(img)
   {
     thumb->has_localcopy = (img->flags & DT_IMAGE_LOCAL_COPY);
@@ -147,7 +148,7 @@ static void _image_get_infos(dt_thumbnail_t *thumb)
 
     thumb->groupid = img->group_id;
 
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
   }
   // if the rating as changed, update the rejected
   if(old_rating != thumb->rating)
@@ -155,26 +156,15 @@ static void _image_get_infos(dt_thumbnail_t *thumb)
     _thumb_update_rating_class(thumb);
   }
 
-  // colorlabels
+  // colorlabels, served by the image index without a database round trip
   thumb->colorlabels = 0;
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_color);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_color);
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_color, 1, thumb->imgid);
-  while(sqlite3_step(darktable.view_manager->statements.get_color) == SQLITE_ROW)
-  {
-    const int col = sqlite3_column_int(darktable.view_manager->statements.get_color, 0);
-    // we reuse CPF_* flags, as we'll pass them to the paint fct after
-    if(col == 0)
-      thumb->colorlabels |= CPF_LABEL_RED;
-    else if(col == 1)
-      thumb->colorlabels |= CPF_LABEL_YELLOW;
-    else if(col == 2)
-      thumb->colorlabels |= CPF_LABEL_GREEN;
-    else if(col == 3)
-      thumb->colorlabels |= CPF_LABEL_BLUE;
-    else if(col == 4)
-      thumb->colorlabels |= CPF_LABEL_PURPLE;
-  }
+  const int labels = dt_colorlabels_get_labels(thumb->imgid);
+  // we reuse CPF_* flags, as we'll pass them to the paint fct after
+  if(labels & (1 << DT_COLORLABELS_RED)) thumb->colorlabels |= CPF_LABEL_RED;
+  if(labels & (1 << DT_COLORLABELS_YELLOW)) thumb->colorlabels |= CPF_LABEL_YELLOW;
+  if(labels & (1 << DT_COLORLABELS_GREEN)) thumb->colorlabels |= CPF_LABEL_GREEN;
+  if(labels & (1 << DT_COLORLABELS_BLUE)) thumb->colorlabels |= CPF_LABEL_BLUE;
+  if(labels & (1 << DT_COLORLABELS_PURPLE)) thumb->colorlabels |= CPF_LABEL_PURPLE;
   if(thumb->w_color)
   {
     GtkDarktableThumbnailBtn *btn = (GtkDarktableThumbnailBtn *)thumb->w_color;
@@ -345,11 +335,11 @@ static void _get_dimensions_for_img_to_fit(dt_thumbnail_t *thumb, int max_width,
   if(ar < 0.001)
   {
     // let's try with the aspect_ratio store in image structure, even if it's less accurate
-    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
+    const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
     if(img)
     {
       ar = img->aspect_ratio;
-      dt_image_cache_read_release(darktable.image_cache, img);
+      dt_image_cache_snapshot_release(darktable.image_cache, img);
     }
   }
 
@@ -380,7 +370,7 @@ static void _get_dimensions_for_zoomed_img(dt_thumbnail_t *thumb, int max_width,
   // calling dt_thumbnail_get_zoom100 is used to get the max zoom, but also to ensure that final_width and
   // height are available.
   const float zoom_100 = dt_thumbnail_get_zoom100(thumb);
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
   if(img)
   {
     if(img->final_width > 0 && img->final_height > 0)
@@ -388,7 +378,7 @@ static void _get_dimensions_for_zoomed_img(dt_thumbnail_t *thumb, int max_width,
       iw = img->final_width;
       ih = img->final_height;
     }
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
   }
 
   // scale first to "img to fit", then apply the zoom ratio to get the resulting final (zoomed) image
@@ -1294,7 +1284,7 @@ dt_thumbnail_t *dt_thumbnail_new(int width, int height, float zoom_ratio, int im
   thumb->expose_again_timeout_id = 0;
 
   // we read and cache all the infos from dt_image_t that we need
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
   if(img)
   {
     thumb->filename = g_strdup(img->filename);
@@ -1303,7 +1293,7 @@ dt_thumbnail_t *dt_thumbnail_new(int width, int height, float zoom_ratio, int im
       thumb->has_audio = (img->flags & DT_IMAGE_HAS_WAV);
       thumb->has_localcopy = (img->flags & DT_IMAGE_LOCAL_COPY);
     }
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
   }
 
   // we read all other infos
@@ -1359,6 +1349,56 @@ void dt_thumbnail_destroy(dt_thumbnail_t *thumb)
   free(thumb);
 }
 
+void dt_thumbnail_set_image(dt_thumbnail_t *thumb, int imgid, int rowid)
+{
+  if(thumb->expose_again_timeout_id != 0) g_source_remove(thumb->expose_again_timeout_id);
+  thumb->expose_again_timeout_id = 0;
+
+  thumb->imgid = imgid;
+  thumb->rowid = rowid;
+
+  // we forget everything about the previous image
+  if(thumb->img_surf && cairo_surface_get_reference_count(thumb->img_surf) > 0)
+    cairo_surface_destroy(thumb->img_surf);
+  thumb->img_surf = NULL;
+  thumb->img_surf_preview = FALSE;
+  thumb->img_width = thumb->img_height = 0;
+  thumb->zoom = 1.0f;
+  thumb->zoomx = thumb->zoomy = 0.0;
+  thumb->zoom_100 = 0.0f;
+  thumb->busy = FALSE;
+  dt_thumbnail_set_group_border(thumb, DT_THUMBNAIL_BORDER_NONE);
+
+  // we read and cache all the infos from dt_image_t that we need
+  g_free(thumb->filename);
+  thumb->filename = NULL;
+  thumb->has_audio = thumb->has_localcopy = FALSE;
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
+  if(img)
+  {
+    thumb->filename = g_strdup(img->filename);
+    if(thumb->over != DT_THUMBNAIL_OVERLAYS_NONE)
+    {
+      thumb->has_audio = (img->flags & DT_IMAGE_HAS_WAV);
+      thumb->has_localcopy = (img->flags & DT_IMAGE_LOCAL_COPY);
+    }
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
+  }
+  _image_get_infos(thumb);
+
+  _dt_active_images_callback(NULL, thumb);
+  _dt_selection_changed_callback(NULL, thumb);
+  dt_thumbnail_set_mouseover(thumb, dt_control_get_mouse_over_id() == thumb->imgid);
+
+  _thumb_write_extension(thumb);
+  _thumb_update_icons(thumb);
+
+  // the image area depends on the aspect ratio of the new image
+  gtk_widget_set_size_request(thumb->w_image, -1, -1);
+  _thumb_set_image_area(thumb, IMG_TO_FIT);
+  dt_thumbnail_image_refresh(thumb);
+}
+
 void dt_thumbnail_update_infos(dt_thumbnail_t *thumb)
 {
   if(!thumb) return;
@@ -1658,7 +1698,7 @@ float dt_thumbnail_get_zoom_ratio(dt_thumbnail_t *thumb)
 // force the reload of image infos
 void dt_thumbnail_reload_infos(dt_thumbnail_t *thumb)
 {
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, thumb->imgid, 'r');
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, thumb->imgid);
   if(img)
   {
     if(thumb->over != DT_THUMBNAIL_OVERLAYS_NONE)
@@ -1668,7 +1708,7 @@ void dt_thumbnail_reload_infos(dt_thumbnail_t *thumb)
       thumb->has_localcopy = (img->flags & DT_IMAGE_LOCAL_COPY);
     }
 
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
   }
 
   // we read all other infos
@@ -119,6 +119,8 @@ typedef struct
 
 dt_thumbnail_t *dt_thumbnail_new(int width, int height, float zoom_ratio, int imgid, int rowid, dt_thumbnail_overlay_t over);
 void dt_thumbnail_destroy(dt_thumbnail_t *thumb);
+// rebind an existing thumbnail, and its widgets, to another image
+void dt_thumbnail_set_image(dt_thumbnail_t *thumb, int imgid, int rowid);
 GtkWidget *dt_thumbnail_create_widget(dt_thumbnail_t *thumb, float zoom_ratio);
 void dt_thumbnail_resize(dt_thumbnail_t *thumb, int width, int height, gboolean force, float zoom_ratio);
 void dt_thumbnail_set_group_border(dt_thumbnail_t *thumb, dt_thumbnail_border_t border);
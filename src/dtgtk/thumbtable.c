@@ -51,6 +51,73 @@ static void _list_remove_thumb(gpointer user_data)
   dt_thumbnail_destroy(thumb);
 }
 
+// position in the list of a thumb to create, see dt_thumbtable_full_redraw()
+typedef struct _thumbtable_slot_t
+{
+  int imgid, rowid;
+  int x, y;
+  GList *link;
+} _thumbtable_slot_t;
+
+// pooled thumbnails get resized when reused, but their overlays are built once
+static gboolean _thumb_reusable(dt_thumbtable_t *table, dt_thumbnail_t *thumb)
+{
+  return thumb->over == table->overlays;
+}
+
+// take a thumbnail out of the view, keeping it for reuse while the pool holds less than a page
+static void _thumb_release(dt_thumbtable_t *table, dt_thumbnail_t *thumb)
+{
+  if(_thumb_reusable(table, thumb) && g_list_length(table->pool) < table->thumbs_per_row * table->rows)
+  {
+    gtk_widget_hide(thumb->w_main);
+    table->pool = g_list_prepend(table->pool, thumb);
+  }
+  else
+    _list_remove_thumb(thumb);
+}
+
+static void _thumbs_pool_clear(dt_thumbtable_t *table)
+{
+  g_list_free_full(table->pool, _list_remove_thumb);
+  table->pool = NULL;
+}
+
+// get a thumbnail for imgid at posx,posy, rebinding one of the pool if possible
+static dt_thumbnail_t *_thumb_acquire(dt_thumbtable_t *table, const int imgid, const int rowid, const int posx,
+                                      const int posy)
+{
+  dt_thumbnail_t *thumb = NULL;
+  while(table->pool && !thumb)
+  {
+    dt_thumbnail_t *th = (dt_thumbnail_t *)table->pool->data;
+    table->pool = g_list_delete_link(table->pool, table->pool);
+    if(_thumb_reusable(table, th))
+      thumb = th;
+    else
+      _list_remove_thumb(th);
+  }
+
+  if(thumb)
+  {
+    thumb->x = posx;
+    thumb->y = posy;
+    gtk_layout_move(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
+    gtk_widget_show(thumb->w_main);
+    dt_gui_remove_class(thumb->w_main, "dt_last_active");
+    dt_thumbnail_resize(thumb, table->thumb_size, table->thumb_size, FALSE, IMG_TO_FIT);
+    dt_thumbnail_set_image(thumb, imgid, rowid);
+  }
+  else
+  {
+    thumb = dt_thumbnail_new(table->thumb_size, table->thumb_size, IMG_TO_FIT, imgid, rowid, table->overlays);
+    thumb->x = posx;
+    thumb->y = posy;
+    gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
+  }
+  return thumb;
+}
+
 // get the class name associated with the overlays mode
 static gchar *_thumbs_get_overlays_class(dt_thumbnail_overlay_t over)
 {
@@ -136,15 +203,18 @@ static dt_thumbnail_t *_thumb_get_under_mouse(dt_thumbtable_t *table)
 static int _thumb_get_imgid(int rowid)
 {
   int id = -1;
-  sqlite3_stmt *stmt;
-  gchar *query = g_strdup_printf("SELECT imgid FROM memory.collected_images WHERE rowid=%d", rowid);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt = dt_database_get_statement(reader, "SELECT imgid FROM memory.collected_images WHERE rowid=?1");
+  if(stmt)
   {
-    id = sqlite3_column_int(stmt, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rowid);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      id = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_reset(stmt);
   }
-  g_free(query);
-  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
   return id;
 }
 
@@ -152,15 +222,18 @@ static int _thumb_get_imgid(int rowid)
 static int _thumb_get_rowid(int imgid)
 {
   int id = -1;
-  sqlite3_stmt *stmt;
-  gchar *query = g_strdup_printf("SELECT rowid FROM memory.collected_images WHERE imgid=%d", imgid);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  sqlite3 *reader = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt = dt_database_get_statement(reader, "SELECT rowid FROM memory.collected_images WHERE imgid=?1");
+  if(stmt)
   {
-    id = sqlite3_column_int(stmt, 0);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      id = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_reset(stmt);
   }
-  g_free(query);
-  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, reader);
   return id;
 }
 
@@ -347,8 +420,7 @@ static int _thumbs_remove_unneeded(dt_thumbtable_t *table)
            && (th->x + table->thumb_size <= 0 || th->x > table->view_width)))
     {
       table->list = g_list_remove_link(table->list, l);
-      gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(th->w_main)), th->w_main);
-      dt_thumbnail_destroy(th);
+      _thumb_release(table, th);
       g_list_free(l);
       l = table->list;
       changed++;
@@ -400,16 +472,11 @@ static int _thumbs_load_needed(dt_thumbtable_t *table)
     {
       if(posy < table->view_height) // we don't load invisible thumbs
       {
-        dt_thumbnail_t *thumb = dt_thumbnail_new(
-            table->thumb_size, table->thumb_size, IMG_TO_FIT, sqlite3_column_int(stmt, 1),
-            sqlite3_column_int(stmt, 0), table->overlays);
-
-        thumb->x = posx;
-        thumb->y = posy;
+        dt_thumbnail_t *thumb = _thumb_acquire(table, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0),
+                                               posx, posy);
         table->list = g_list_prepend(table->list, thumb);
         gtk_widget_set_margin_start(thumb->w_image_box, old_margin_start);
         gtk_widget_set_margin_top(thumb->w_image_box, old_margin_top);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
         changed++;
       }
       _pos_get_previous(table, &posx, &posy);
@@ -450,16 +517,11 @@ static int _thumbs_load_needed(dt_thumbtable_t *table)
     {
       if(posy + table->thumb_size >= 0) // we don't load invisible thumbs
       {
-        dt_thumbnail_t *thumb = dt_thumbnail_new
-          (table->thumb_size, table->thumb_size, IMG_TO_FIT, sqlite3_column_int(stmt, 1),
-           sqlite3_column_int(stmt, 0), table->overlays);
-
-        thumb->x = posx;
-        thumb->y = posy;
+        dt_thumbnail_t *thumb = _thumb_acquire(table, sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 0),
+                                               posx, posy);
         table->list = g_list_append(table->list, thumb);
         gtk_widget_set_margin_start(thumb->w_image_box, old_margin_start);
         gtk_widget_set_margin_top(thumb->w_image_box, old_margin_top);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
         changed++;
       }
       _pos_get_next(table, &posx, &posy);
@@ -471,6 +533,100 @@ static int _thumbs_load_needed(dt_thumbtable_t *table)
   return changed;
 }
 
+// how many seconds of scrolling ahead of the view get prefetched
+#define THUMBTABLE_PREFETCH_LOOKAHEAD 0.5
+
+// update the scrolling speed after a move of moved rows toward the end of the collection
+static void _scroll_speed_update(dt_thumbtable_t *table, const float moved)
+{
+  const double now = dt_get_wtime();
+  const double elapsed = now - table->last_move_time;
+  table->last_move_time = now;
+
+  // after a pause or a change of direction, we start over from a slow move
+  if(elapsed > THUMBTABLE_PREFETCH_LOOKAHEAD || moved * table->scroll_speed < 0.0f)
+    table->scroll_speed = moved / THUMBTABLE_PREFETCH_LOOKAHEAD;
+  else
+    table->scroll_speed = 0.5f * table->scroll_speed + 0.5f * moved / MAX(elapsed, 0.01);
+}
+
+// queue the thumbnails of the rows about to enter the view, and drop the pending loads of the images that
+// left the view and its margin. visible thumbnails are requested on the foreground queue when they are drawn,
+// prefetches go to the background queue, so they only get the workers the visible ones leave idle.
+static void _thumbs_prefetch(dt_thumbtable_t *table, const float moved)
+{
+  if(!table->list) return;
+
+  _scroll_speed_update(table, moved);
+
+  const int per_row = MAX(table->thumbs_per_row, 1);
+  const int base = dt_conf_get_int("plugins/lighttable/thumbtable/prefetch_rows");
+  // the faster we scroll, the further we look, up to a few pages
+  const int max_rows = 4 * MAX(table->rows, 1);
+  const int ahead
+      = base > 0 ? MIN(base + (int)(fabsf(table->scroll_speed) * THUMBTABLE_PREFETCH_LOOKAHEAD), max_rows) : 0;
+  const int margin = MAX(ahead, 1) * per_row;
+  const gboolean forward = table->scroll_speed >= 0.0f;
+
+  const dt_thumbnail_t *first = (dt_thumbnail_t *)table->list->data;
+  const dt_thumbnail_t *last = (dt_thumbnail_t *)g_list_last(table->list)->data;
+  const int fetch_start = forward ? last->rowid + 1 : first->rowid - ahead * per_row;
+  const int fetch_end = forward ? last->rowid + ahead * per_row : first->rowid - 1;
+
+  // images shown or close enough to the view to be kept, and the ones to prefetch, nearest first
+  GHashTable *keep = g_hash_table_new(NULL, NULL);
+  GList *fetch = NULL;
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT rowid, imgid"
+                              " FROM memory.collected_images"
+                              " WHERE rowid BETWEEN ?1 AND ?2"
+                              " ORDER BY rowid",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first->rowid - margin);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, last->rowid + margin);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int rowid = sqlite3_column_int(stmt, 0);
+    const int imgid = sqlite3_column_int(stmt, 1);
+    g_hash_table_add(keep, GINT_TO_POINTER(imgid));
+    if(rowid >= fetch_start && rowid <= fetch_end) fetch = g_list_prepend(fetch, GINT_TO_POINTER(imgid));
+  }
+  sqlite3_finalize(stmt);
+  if(forward) fetch = g_list_reverse(fetch);
+
+  // thumbnails still shown are requested again when they get drawn, so dropping a little too much is harmless
+  dt_image_load_jobs_discard(DT_JOB_QUEUE_SYSTEM_FG, keep);
+  // the previous prefetches are superseded by these ones
+  dt_image_load_jobs_discard(DT_JOB_QUEUE_SYSTEM_BG, NULL);
+  g_hash_table_destroy(keep);
+
+  if(fetch)
+  {
+    // the size the thumbnails shown are drawn at
+    int image_w = 0;
+    int image_h = 0;
+    gtk_widget_get_size_request(first->w_image_box, &image_w, &image_h);
+    if(image_w <= 0 || image_h <= 0) image_w = image_h = table->thumb_size;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
+        darktable.mipmap_cache, image_w * darktable.gui->ppd, image_h * darktable.gui->ppd);
+
+    for(const GList *l = fetch; l; l = g_list_next(l))
+    {
+      const int imgid = GPOINTER_TO_INT(l->data);
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK, 'r');
+      const gboolean cached = (buf.buf != NULL);
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+      if(!cached)
+        dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, dt_image_load_job_create(imgid, mip));
+    }
+    g_list_free(fetch);
+  }
+}
+
 // move all thumbs from the table.
 // if clamp, we verify that the move is allowed (collection bounds, etc...)
 static gboolean _move(dt_thumbtable_t *table, const int x, const int y, gboolean clamp)
@@ -568,6 +724,10 @@ static gboolean _move(dt_thumbtable_t *table, const int x, const int y, gboolean
   // if there has been changed, we recompute thumbs area
   if(changed > 0) _pos_compute_area(table);
 
+  // we anticipate the next rows, and forget about the ones that went away
+  const int moved = (table->mode == DT_THUMBTABLE_MODE_FILMSTRIP) ? posx : posy;
+  _thumbs_prefetch(table, -(float)moved / table->thumb_size);
+
   // we update the offset
   if(table->mode == DT_THUMBTABLE_MODE_FILEMANAGER)
   {
@@ -1379,18 +1539,20 @@ static void _event_dnd_begin(GtkWidget *widget, GdkDragContext *context, gpointe
 
       if(buf.buf)
       {
-        for(size_t i = 3; i < (size_t)4 * buf.width * buf.height; i += 4) buf.buf[i] = UINT8_MAX;
-
         int w = ts, h = ts;
         if(buf.width < buf.height)
           w = (buf.width * ts) / buf.height; // portrait
         else
           h = (buf.height * ts) / buf.width; // landscape
 
-        GdkPixbuf *source = gdk_pixbuf_new_from_data(buf.buf, GDK_COLORSPACE_RGB, TRUE, 8, buf.width, buf.height,
-                                                     buf.width * 4, NULL, NULL);
-        GdkPixbuf *scaled = gdk_pixbuf_scale_simple(source, w, h, GDK_INTERP_HYPER);
-        gtk_drag_set_icon_pixbuf(context, scaled, 0, h);
+        // the mipmap is in the layout of cairo surfaces
+        cairo_surface_t *surface = cairo_image_surface_create_for_data(
+            buf.buf, CAIRO_FORMAT_RGB24, buf.width, buf.height,
+            cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width));
+        GdkPixbuf *source = gdk_pixbuf_get_from_surface(surface, 0, 0, buf.width, buf.height);
+        cairo_surface_destroy(surface);
+        GdkPixbuf *scaled = source ? gdk_pixbuf_scale_simple(source, w, h, GDK_INTERP_HYPER) : NULL;
+        if(scaled) gtk_drag_set_icon_pixbuf(context, scaled, 0, h);
 
         if(source) g_object_unref(source);
         if(scaled) g_object_unref(scaled);
@@ -1634,6 +1796,8 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table, gboolean force)
 
     // we add the thumbs
     GList *newlist = NULL;
+    // links of newlist still waiting for a thumbnail, once the old ones are released
+    GSList *missing = NULL;
     int nbnew = 0;
     gchar *query
         = g_strdup_printf("SELECT rowid, imgid FROM memory.collected_images WHERE rowid>=%d LIMIT %d",
@@ -1665,24 +1829,34 @@ void dt_thumbtable_full_redraw(dt_thumbtable_t *table, gboolean force)
       }
       else
       {
-        // we create a completely new thumb
-        dt_thumbnail_t *thumb
-            = dt_thumbnail_new(table->thumb_size, table->thumb_size, IMG_TO_FIT, nid, nrow, table->overlays);
-        thumb->x = posx;
-        thumb->y = posy;
-        newlist = g_list_prepend(newlist, thumb);
-        gtk_widget_set_margin_start(thumb->w_image_box, old_margin_start);
-        gtk_widget_set_margin_top(thumb->w_image_box, old_margin_top);
-        gtk_layout_put(GTK_LAYOUT(table->widget), thumb->w_main, posx, posy);
-        nbnew++;
+        // we need a new thumb, we keep its place in the list
+        _thumbtable_slot_t *slot = g_malloc(sizeof(_thumbtable_slot_t));
+        slot->imgid = nid;
+        slot->rowid = nrow;
+        slot->x = posx;
+        slot->y = posy;
+        newlist = g_list_prepend(newlist, NULL);
+        slot->link = newlist;
+        missing = g_slist_prepend(missing, slot);
       }
       _pos_get_next(table, &posx, &posy);
       // if it's the offset, we record the imgid
       if(nrow == table->offset) table->offset_imgid = nid;
     }
 
-    // now we cleanup all remaining thumbs from old table->list and set it again
-    g_list_free_full(table->list, _list_remove_thumb);
+    // now we release all remaining thumbs from old table->list, and reuse them for the new images
+    for(GList *l = table->list; l; l = g_list_next(l)) _thumb_release(table, (dt_thumbnail_t *)l->data);
+    g_list_free(table->list);
+    for(GSList *l = missing; l; l = g_slist_next(l))
+    {
+      _thumbtable_slot_t *slot = (_thumbtable_slot_t *)l->data;
+      dt_thumbnail_t *thumb = _thumb_acquire(table, slot->imgid, slot->rowid, slot->x, slot->y);
+      gtk_widget_set_margin_start(thumb->w_image_box, old_margin_start);
+      gtk_widget_set_margin_top(thumb->w_image_box, old_margin_top);
+      slot->link->data = thumb;
+      nbnew++;
+    }
+    g_slist_free_full(missing, g_free);
     table->list = g_list_reverse(newlist);  // list was built in reverse order, so un-reverse it
 
     _pos_compute_area(table);
@@ -1771,6 +1945,8 @@ void dt_thumbtable_set_parent(dt_thumbtable_t *table, GtkWidget *new_parent, dt_
       dt_thumbnail_t *thumb = (dt_thumbnail_t *)l->data;
       thumb->disable_actions = (mode == DT_THUMBTABLE_MODE_FILMSTRIP);
     }
+    // and the pooled ones were set up for the other mode
+    _thumbs_pool_clear(table);
 
     table->mode = mode;
 
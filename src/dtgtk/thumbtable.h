@@ -58,6 +58,9 @@ typedef struct dt_thumbtable_t
   // for filmstrip and filemanager, this is all the images drawn at screen (even partially)
   // for zoommable, this is all the images in the row drawn at screen. We don't load laterals images on fly.
   GList *list;
+  // thumbnails that left the view, kept hidden in the widget to be rebound to the images entering it
+  // rebinding a thumbnail is much cheaper than creating its widgets
+  GList *pool;
 
   // rowid of the main shown image inside 'memory.collected_images'
   // for filmstrip this is the image in the center.
@@ -98,6 +101,10 @@ typedef struct dt_thumbtable_t
   // let's remember previous thumbnail generation settings to detect if they change
   int pref_embedded;
   int pref_hq;
+
+  // scrolling speed, in rows per second along the collection order, to prefetch the rows to come
+  double last_move_time;
+  float scroll_speed;
 } dt_thumbtable_t;
 
 dt_thumbtable_t *dt_thumbtable_new();
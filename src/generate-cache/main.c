@@ -32,7 +32,9 @@
 #include "common/database.h"     // for dt_database_get
 #include "common/debug.h"        // for DT_DEBUG_SQLITE3_PREPARE_V2
 #include "common/mipmap_cache.h" // for dt_mipmap_size_t, etc
+#include "common/mipmap_codec.h" // for dt_mipmap_codec_encode, etc
 #include "common/file_location.h"
+#include "common/datetime.h"     // for dt_string_to_datetime
 #include "common/history.h"      // for dt_history_hash_set_mipmap
 #include "config.h"              // for GETTEXT_PACKAGE, etc
 #include "control/conf.h"        // for dt_conf_get_bool
@@ -45,10 +47,162 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+typedef struct codec_benchmark_t
 {
+  size_t count;
+  size_t pixels;
+  size_t bytes;
+  double encode_time;
+  double decode_time;
+} codec_benchmark_t;
+
+// encode and decode one thumbnail with every codec compiled in
+static void benchmark_codecs(codec_benchmark_t *bench, const dt_mipmap_buffer_t *buf, const dt_mipmap_size_t mip)
+{
+  if(!buf->buf || buf->width <= 8 || buf->height <= 8) return;
+  const int quality = MIN(100, MAX(10, dt_conf_get_int("database_cache_quality")));
+  const uint32_t max_width = darktable.mipmap_cache->max_width[mip];
+  const uint32_t max_height = darktable.mipmap_cache->max_height[mip];
+  uint8_t *out = dt_alloc_align((size_t)4 * max_width * max_height);
+  if(!out) return;
+
+  for(dt_mipmap_codec_t codec = 0; codec < DT_MIPMAP_CODEC_LAST; codec++)
+  {
+    if(!dt_mipmap_codec_available(codec)) continue;
+    size_t length = 0;
+    const double start = dt_get_wtime();
+    uint8_t *blob = dt_mipmap_codec_encode(codec, buf->buf, buf->width, buf->height, quality,
+                                           buf->color_space, &length);
+    const double encoded = dt_get_wtime();
+    if(!blob) continue;
+    uint32_t width, height;
+    dt_colorspaces_color_profile_type_t color_space;
+    const int err = dt_mipmap_codec_decode(blob, length, out, max_width, max_height, &width, &height,
+                                           &color_space);
+    const double decoded = dt_get_wtime();
+    dt_free_align(blob);
+    if(err) continue;
+
+    bench[codec].count++;
+    bench[codec].pixels += (size_t)width * height;
+    bench[codec].bytes += length;
+    bench[codec].encode_time += encoded - start;
+    bench[codec].decode_time += decoded - encoded;
+  }
+  dt_free_align(out);
+}
+
+static void print_benchmark(const codec_benchmark_t *bench, const dt_mipmap_size_t mip)
+{
+  fprintf(stderr, "thumbnail codecs at mip %d:\n", (int)mip);
+  fprintf(stderr, "  %-6s %8s %12s %12s %12s %12s\n", "codec", "images", "bits/pixel", "MiB",
+          "encode ms", "decode ms");
+  for(dt_mipmap_codec_t codec = 0; codec < DT_MIPMAP_CODEC_LAST; codec++)
+  {
+    if(!bench[codec].count) continue;
+    fprintf(stderr, "  %-6s %8zu %12.2f %12.1f %12.2f %12.2f\n", dt_mipmap_codec_name(codec), bench[codec].count,
+            8.0 * bench[codec].bytes / bench[codec].pixels, bench[codec].bytes / (1024.0 * 1024.0),
+            1000.0 * bench[codec].encode_time / bench[codec].count,
+            1000.0 * bench[codec].decode_time / bench[codec].count);
+  }
+}
+
+// key of the progress checkpoint in main.db_info
+#define CHECKPOINT_KEY "generate-cache/checkpoint"
+// write the checkpoint every that many images
+#define CHECKPOINT_INTERVAL 256
+
+typedef struct generate_options_t
+{
+  dt_mipmap_size_t min_mip, max_mip;
+  int32_t min_imgid, max_imgid;
+  GTimeSpan since; // only images changed or imported since then, 0 for all
+  int jobs;        // number of images processed concurrently
+  gboolean resume;
+  gboolean benchmark;
+} generate_options_t;
+
+// the checkpoint is only valid for a run on the same mips and dates
+static gchar *checkpoint_prefix(const generate_options_t *opt)
+{
+  return g_strdup_printf("%d %d %" G_GINT64_FORMAT " ", (int)opt->min_mip, (int)opt->max_mip, (gint64)opt->since);
+}
+
+// returns the id up to which all images were done by an interrupted run with the same options, or -1
+static int32_t read_checkpoint(const generate_options_t *opt)
+{
+  int32_t last = -1;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT value FROM main.db_info WHERE key = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, CHECKPOINT_KEY, -1, SQLITE_STATIC);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *value = (const char *)sqlite3_column_text(stmt, 0);
+    gchar *prefix = checkpoint_prefix(opt);
+    if(value && g_str_has_prefix(value, prefix))
+      last = atoi(value + strlen(prefix));
+    else
+      fprintf(stderr, _("warning: the checkpoint was written with other options, starting over\n"));
+    g_free(prefix);
+  }
+  sqlite3_finalize(stmt);
+  return last;
+}
+
+static void write_checkpoint(const generate_options_t *opt, const int32_t last)
+{
+  gchar *prefix = checkpoint_prefix(opt);
+  gchar *value = g_strdup_printf("%s%d", prefix, last);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO main.db_info (key, value) VALUES (?1, ?2)", -1, &stmt,
+                              NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, CHECKPOINT_KEY, -1, SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, value, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(value);
+  g_free(prefix);
+}
+
+static void clear_checkpoint(void)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "DELETE FROM main.db_info WHERE key = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, CHECKPOINT_KEY, -1, SQLITE_STATIC);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// loading, processing and writing one image. each worker goes through all the steps for its image,
+// so with several workers the disk reads and writes of some overlap with the processing of others.
+static void generate_image(const generate_options_t *opt, const int32_t imgid)
+{
+  for(int k = opt->max_mip; k >= opt->min_mip && k >= 0; k--)
+  {
+    char filename[PATH_MAX] = { 0 };
+    snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
+
+    // if a valid thumbnail file is already on disc - do nothing
+    if(dt_util_test_image_file(filename)) continue;
+    // same if it is in the packed store or was written with another codec
+    if(dt_mipmap_cache_has_disk_thumbnail(darktable.mipmap_cache, imgid, k)) continue;
+
+    // else, generate thumbnail and store in mipmap cache.
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+    dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  }
+}
+
+static int generate_thumbnail_cache(const generate_options_t *opt)
+{
+  codec_benchmark_t bench[DT_MIPMAP_CODEC_LAST] = { { 0 } };
+
   fprintf(stderr, _("creating cache directories\n"));
-  for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
+  for(dt_mipmap_size_t k = opt->min_mip; k <= opt->max_mip; k++)
   {
     char dirname[PATH_MAX] = { 0 };
     snprintf(dirname, sizeof(dirname), "%s.d/%d", darktable.mipmap_cache->cachedir, k);
@@ -61,56 +215,73 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // some progress counter
+  int32_t min_imgid = opt->min_imgid;
+  if(opt->resume)
+  {
+    const int32_t last = read_checkpoint(opt);
+    if(last >= min_imgid)
+    {
+      fprintf(stderr, _("resuming after image id %d\n"), last);
+      min_imgid = last + 1;
+    }
+  }
+
+  // collect the ids first, the statement can't stay open while the workers use the database
+  GArray *ids = g_array_new(FALSE, FALSE, sizeof(int32_t));
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
+  // clang-format off
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT id FROM main.images"
+                              " WHERE id >= ?1 AND id <= ?2"
+                              "   AND (?3 = 0 OR change_timestamp >= ?3 OR import_timestamp >= ?3)"
+                              " ORDER BY id",
+                              -1, &stmt, 0);
+  // clang-format on
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    image_count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
-  else
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, opt->max_imgid);
+  DT_DEBUG_SQLITE3_BIND_INT64(stmt, 3, opt->since);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    return 1;
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    g_array_append_val(ids, imgid);
   }
+  sqlite3_finalize(stmt);
 
+  const size_t image_count = ids->len;
   if(!image_count)
   {
     fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
-    if(min_imgid > max_imgid)
+    if(min_imgid > opt->max_imgid)
     {
       fprintf(stderr, _("warning: did you want to swap these boundaries?\n"));
     }
   }
 
-  // go through all images:
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id, filename FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  // images are handed out in id order but finish in any order: the checkpoint is the last id
+  // before the first image still in flight.
+  uint8_t *done = g_malloc0(MAX(image_count, 1));
+  size_t counter = 0, watermark = 0, checkpointed = 0;
+  GMutex progress_lock;
+  g_mutex_init(&progress_lock);
+  const int32_t *const imgids = (const int32_t *)ids->data;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(dynamic, 1) num_threads(opt->jobs) \
+  dt_omp_firstprivate(imgids, image_count, opt) \
+  shared(bench, done, counter, watermark, checkpointed, progress_lock, stderr, darktable)
+#endif
+  for(size_t i = 0; i < image_count; i++)
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-    const char *imgfilename = (const char*)sqlite3_column_text(stmt, 1);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d, file=%s)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid, imgfilename);
+    const int32_t imgid = imgids[i];
+    generate_image(opt, imgid);
 
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
+    if(opt->benchmark)
     {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if a valid thumbnail file is already on disc - do nothing
-      if(dt_util_test_image_file(filename)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
       dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, opt->max_mip, DT_MIPMAP_BLOCKING, 'r');
+      g_mutex_lock(&progress_lock);
+      benchmark_codecs(bench, &buf, opt->max_mip);
+      g_mutex_unlock(&progress_lock);
       dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
     }
 
@@ -118,9 +289,28 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
     // thumbnail in sync with image
     dt_history_hash_set_mipmap(imgid);
+
+    g_mutex_lock(&progress_lock);
+    counter++;
+    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count,
+            imgid);
+    done[i] = 1;
+    while(watermark < image_count && done[watermark]) watermark++;
+    if(watermark >= checkpointed + CHECKPOINT_INTERVAL)
+    {
+      write_checkpoint(opt, imgids[watermark - 1]);
+      checkpointed = watermark;
+    }
+    g_mutex_unlock(&progress_lock);
   }
 
-  sqlite3_finalize(stmt);
+  g_mutex_clear(&progress_lock);
+  g_free(done);
+  g_array_free(ids, TRUE);
+  // the run went through, nothing to resume
+  clear_checkpoint();
+
+  if(opt->benchmark) print_benchmark(bench, opt->max_mip);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -131,14 +321,23 @@ static void usage(const char *progname)
   fprintf(stderr,
           "usage: %s [-h, --help; --version]\n"
           "  [--min-mip <0-8> (default = 0)] [-m, --max-mip <0-8> (default = 2)]\n"
-          "  [--min-imgid <N>] [--max-imgid <N>]\n"
+          "  [--min-imgid <N>] [--max-imgid <N>] [--since <date>]\n"
+          "  [-j, --jobs <N> (default = number of cores)] [--resume] [--benchmark-codecs]\n"
           "  [--core <darktable options>]\n"
           "\n"
           "When multiple mipmap sizes are requested, the biggest one is computed\n"
           "while the rest are quickly downsampled.\n"
           "\n"
           "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-          "numbers to work on.\n",
+          "numbers to work on. --since only keeps the images changed or imported\n"
+          "since the given date, like 2024:06:30 or 2024:06:30 18:00:00.\n"
+          "\n"
+          "--jobs sets how many images are processed at the same time. the progress\n"
+          "is recorded in the library, and --resume continues an interrupted run\n"
+          "with the same mip and date options where it stopped.\n"
+          "\n"
+          "--benchmark-codecs compresses the biggest thumbnail of every image with\n"
+          "each thumbnail codec available and reports their size and speed.\n",
           progname);
 }
 
@@ -164,6 +363,10 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  gboolean benchmark = FALSE;
+  gboolean resume = FALSE;
+  const char *since = NULL;
+  int jobs = 0;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -199,6 +402,24 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if(!strcmp(arg[k], "--since") && argc > k + 1)
+    {
+      k++;
+      since = arg[k];
+    }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      jobs = MAX(atoi(arg[k]), 1);
+    }
+    else if(!strcmp(arg[k], "--resume"))
+    {
+      resume = TRUE;
+    }
+    else if(!strcmp(arg[k], "--benchmark-codecs"))
+    {
+      benchmark = TRUE;
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -250,9 +471,28 @@ int main(int argc, char *arg[])
     exit(EXIT_FAILURE);
   }
 
+  generate_options_t opt = { .min_mip = min_mip, .max_mip = max_mip, .min_imgid = min_imgid,
+                             .max_imgid = max_imgid, .since = 0, .resume = resume, .benchmark = benchmark };
+  // the workers mostly wait on the disk and on each other's locks, one per core keeps them all busy
+  opt.jobs = jobs ? jobs : (int)dt_get_num_threads();
+
+  if(since)
+  {
+    GDateTime *gdt = dt_string_to_datetime(since);
+    if(!gdt)
+    {
+      fprintf(stderr, _("error: can't parse the date '%s'\n"), since);
+      dt_cleanup();
+      free(m_arg);
+      exit(EXIT_FAILURE);
+    }
+    opt.since = dt_datetime_gdatetime_to_gtimespan(gdt);
+    g_date_time_unref(gdt);
+  }
+
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(&opt))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
@@ -21,6 +21,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/file_location.h"
+#include "common/trace.h"
 #include "common/utility.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -2167,6 +2168,8 @@ static void _import_clicked(GtkButton *button, gpointer user_data)
 
 GtkWidget *dt_shortcuts_prefs(GtkWidget *widget)
 {
+  dt_shortcuts_init();
+
   // Save the shortcuts before editing
   dt_shortcuts_save(".edit", FALSE);
 
@@ -2451,8 +2454,35 @@ static void _shortcuts_save(const gchar *shortcuts_file, const dt_input_device_t
   }
 }
 
+void dt_shortcuts_init(void)
+{
+  static gboolean initialised = FALSE;
+  if(initialised || !darktable.gui) return;
+  // set first, saving and loading below come back here
+  initialised = TRUE;
+
+  const double start = dt_get_wtime();
+
+  dt_iop_init_widget_actions();
+
+  // Save the default shortcuts
+  dt_shortcuts_save(".defaults", FALSE);
+
+  // Then load any shortcuts if available (wipe defaults first if requested)
+  dt_shortcuts_load(NULL, !dt_conf_get_bool("accel/load_defaults"));
+
+  // Save the shortcuts including defaults
+  dt_shortcuts_save(NULL, TRUE);
+
+  dt_trace_span("startup", "shortcuts", start, dt_get_wtime());
+  dt_print(DT_DEBUG_PERF, "[init] shortcuts took %.3f secs\n", dt_get_wtime() - start);
+}
+
 void dt_shortcuts_save(const gchar *ext, const gboolean backup)
 {
+  // never overwrite the shortcuts file with a partial set
+  dt_shortcuts_init();
+
   char shortcuts_file[PATH_MAX] = { 0 };
   dt_loc_get_user_config_dir(shortcuts_file, sizeof(shortcuts_file));
   g_strlcat(shortcuts_file, "/shortcutsrc", PATH_MAX);
@@ -2737,6 +2767,9 @@ static void _shortcuts_load(const gchar *shortcuts_file, dt_input_device_t file_
 
 void dt_shortcuts_load(const gchar *ext, const gboolean clear)
 {
+  // the actions of the module widgets must exist, else their shortcuts are dropped
+  dt_shortcuts_init();
+
   char shortcuts_file[PATH_MAX] = { 0 };
   dt_loc_get_user_config_dir(shortcuts_file, sizeof(shortcuts_file));
   g_strlcat(shortcuts_file, "/shortcutsrc", PATH_MAX);
@@ -3770,6 +3803,9 @@ gboolean dt_shortcut_dispatcher(GtkWidget *w, GdkEvent *event, gpointer user_dat
   // Let ALT be used by Gtk menu mnemonics. It is ugly, like the rest of this file.
   if(event->key.state & GDK_MOD1_MASK) return FALSE;
 
+  // events come before the idle time the shortcuts are deferred to
+  dt_shortcuts_init();
+
   if((event->type == GDK_BUTTON_PRESS || event->type == GDK_BUTTON_RELEASE
       || event->type == GDK_DOUBLE_BUTTON_PRESS || event->type == GDK_TRIPLE_BUTTON_PRESS)
      && event->button.button > 7)
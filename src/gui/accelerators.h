@@ -27,6 +27,10 @@
 GtkWidget *dt_shortcuts_prefs(GtkWidget *widget);
 GHashTable *dt_shortcut_category_lists(dt_view_type_flags_t v);
 
+// register the actions of the module widgets and load the shortcuts, once. Deferred from startup
+// to the first idle time of the main loop or to the first use of the shortcuts.
+void dt_shortcuts_init(void);
+
 void dt_shortcuts_save(const gchar *ext, const gboolean backup);
 
 void dt_shortcuts_load(const gchar *ext, const gboolean clear);
@@ -57,13 +57,79 @@ static const char *_gui_presets_format_value_str[5]
     = { N_("non-raw"), N_("raw"), N_("HDR"), N_("monochrome"), N_("color") };
 static const int _gui_presets_format_flag[5] = { FOR_LDR, FOR_RAW, FOR_HDR, FOR_NOT_MONO, FOR_NOT_COLOR };
 
+// The built-in presets of a module are kept in data.db from one start to the next while its
+// version is unchanged, with a 'presets:<op>' key in data.db_info. They are translated and
+// may be changed by any release, so all the keys are dropped when the version of ansel or the
+// language of the GUI differ from the ones stamped in 'presets_stamp'.
+static void _builtin_check_stamp(void)
+{
+  static gboolean checked = FALSE;
+  if(checked) return;
+  checked = TRUE;
+
+  gchar *stamp = g_strdup_printf("%s %s", darktable_package_version, g_get_language_names()[0]);
+  gboolean valid = FALSE;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT value FROM data.db_info WHERE key = 'presets_stamp'", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    valid = !g_strcmp0((const char *)sqlite3_column_text(stmt, 0), stamp);
+  sqlite3_finalize(stmt);
+
+  if(!valid)
+  {
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "DELETE FROM data.db_info WHERE key LIKE 'presets:%'", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT OR REPLACE INTO data.db_info (key, value) VALUES ('presets_stamp', ?1)",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, stamp, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+  g_free(stamp);
+}
+
 // this is also called for non-gui applications linking to libansel!
 // so beware, don't use any darktable.gui stuff here .. (or change this behaviour in darktable.c)
 void dt_gui_presets_init()
 {
-  // remove auto generated presets from plugins, not the user included ones.
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM data.presets WHERE writeprotect = 1", NULL,
-                        NULL, NULL);
+  _builtin_check_stamp();
+
+  // remove auto generated presets from plugins, not the user included ones, unless they are
+  // still valid for the current version of their module.
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "DELETE FROM data.presets"
+                        " WHERE writeprotect = 1"
+                        "   AND 'presets:' || operation NOT IN (SELECT key FROM data.db_info)",
+                        NULL, NULL, NULL);
+}
+
+gboolean dt_gui_presets_builtin_cached(const char *op, const int32_t version)
+{
+  _builtin_check_stamp();
+
+  gboolean cached = FALSE;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT value FROM data.db_info WHERE key = 'presets:' || ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    cached = (sqlite3_column_int(stmt, 0) == version);
+  sqlite3_finalize(stmt);
+  return cached;
+}
+
+void dt_gui_presets_builtin_set_cached(const char *op, const int32_t version)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "INSERT OR REPLACE INTO data.db_info (key, value) VALUES ('presets:' || ?1, ?2)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, version);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
 }
 
 void dt_gui_presets_add_generic(const char *name, dt_dev_operation_t op, const int32_t version,
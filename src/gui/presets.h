@@ -71,6 +71,12 @@ typedef struct dt_gui_presets_edit_dialog_t
 /** create a db table with presets for all operations. */
 void dt_gui_presets_init();
 
+/** whether the built-in presets of this operation are still in the db for this version of the module. */
+gboolean dt_gui_presets_builtin_cached(const char *op, const int32_t version);
+
+/** remember that the built-in presets of this operation are in the db for this version of the module. */
+void dt_gui_presets_builtin_set_cached(const char *op, const int32_t version);
+
 /** add or replace a generic (i.e. non-exif specific) preset for this operation. */
 void dt_gui_presets_add_generic(const char *name, dt_dev_operation_t op, const int32_t version,
                                 const void *params, const int32_t params_size,
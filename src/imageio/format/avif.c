@@ -211,6 +211,7 @@ int write_image(struct dt_imageio_module_data_t *data,
                 const char *over_filename,
                 void *exif,
                 int exif_len,
+                const char *xmp,
                 int imgid,
                 int num,
                 int total,
@@ -463,12 +464,14 @@ int write_image(struct dt_imageio_module_data_t *data,
   if(exif && exif_len > 0)
     avifImageSetMetadataExif(image, exif, exif_len);
 
-  /* TODO: workaround; remove when exiv2 implements AVIF write support and update flags() */
-  char *xmp_string = dt_exif_xmp_read_string(imgid);
-  size_t xmp_len;
-  if(xmp_string && (xmp_len = strlen(xmp_string)) > 0)
+  if(xmp)
+    avifImageSetMetadataXMP(image, (const uint8_t *)xmp, strlen(xmp));
+  else
   {
-    avifImageSetMetadataXMP(image, (const uint8_t *)xmp_string, xmp_len);
+    /* TODO: workaround; exiv2 can't write AVIF, so there is no fallback for the export metadata */
+    char *xmp_string = dt_exif_xmp_read_string(imgid);
+    if(xmp_string && strlen(xmp_string) > 0)
+      avifImageSetMetadataXMP(image, (const uint8_t *)xmp_string, strlen(xmp_string));
     g_free(xmp_string);
   }
 
@@ -503,6 +506,14 @@ int write_image(struct dt_imageio_module_data_t *data,
       break;
   }
 
+  /*
+   * The encoder gets the threads the export thread has: all the cores when images are exported one at a
+   * time, its share of them when they are exported in parallel (see _export_run()), so both don't
+   * oversubscribe the cores. libaom splits the rows of each tile between the threads, so they are not
+   * bounded by the number of tiles.
+   */
+  encoder->maxThreads = MAX(1, omp_get_max_threads());
+
   /*
    * Tiling reduces the image quality but it has a negligible impact on
    * still images.
@@ -516,7 +527,6 @@ int write_image(struct dt_imageio_module_data_t *data,
     {
       size_t width_tile_size  = AVIF_DEFAULT_TILE_SIZE;
       size_t height_tile_size = AVIF_DEFAULT_TILE_SIZE;
-      size_t max_threads;
 
       if(width >= 6144)
       {
@@ -535,14 +545,6 @@ int write_image(struct dt_imageio_module_data_t *data,
 
       encoder->tileColsLog2 = floor_log2(width / width_tile_size) / 2;
       encoder->tileRowsLog2 = floor_log2(height / height_tile_size) / 2;
-
-      /*
-       * This should be set to the final number of tiles, based on
-       * encoder->tileColsLog2 and encoder->tileRowsLog2.
-       */
-      max_threads = (1 << encoder->tileRowsLog2) * (1 << encoder->tileColsLog2);
-
-      encoder->maxThreads = MIN(max_threads, dt_get_num_threads());
     }
     case AVIF_TILING_OFF:
       break;
@@ -712,7 +714,7 @@ int flags(struct dt_imageio_module_data_t *data)
    * direct XMP embedding workaround using avifImageSetMetadataXMP() above
    * can be removed.
    */
-  return 0; /* FORMAT_FLAGS_SUPPORT_XMP; */
+  return FORMAT_FLAGS_EMBED_XMP;
 }
 
 static void bit_depth_changed(GtkWidget *widget, gpointer user_data)
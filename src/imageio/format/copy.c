@@ -32,8 +32,8 @@ DT_MODULE(1)
 // FIXME: we can't rely on darktable to avoid file overwriting -- it doesn't know the filename (extension).
 int write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+                void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   int status = 1;
   gboolean from_cache = TRUE;
@@ -75,11 +75,22 @@ OPTIONAL(int, dimension, struct dt_imageio_module_format_t *self, struct dt_imag
 // writing functions:
 /* bits per pixel and color channel we want to write: 8: char x3, 16: uint16_t x3, 32: float x3. */
 REQUIRED(int, bpp, struct dt_imageio_module_data_t *data);
-/* write to file, with exif if not NULL, and icc profile if supported. */
+/* write to file, with exif if not NULL, and icc profile if supported. formats flagged FORMAT_FLAGS_EMBED_XMP
+   embed the xmp packet if not NULL, the export then doesn't add the metadata to the file afterwards. */
 REQUIRED(int, write_image, struct dt_imageio_module_data_t *data, const char *filename, const void *in,
                            dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                           void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                           const gboolean export_masks);
+                           void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                           struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks);
+/* strip-wise writing, for formats that can encode the image while the float output of the pipe is converted.
+   write_image_begin() creates the file and returns a handle, or NULL to have the export go through write_image().
+   write_image_strip() then gets the rows top to bottom, 4 floats per pixel, and write_image_end() closes the file,
+   adds the exif data unless abort is set, and frees the handle. exif and xmp are valid until then. all but begin return non-zero on error. */
+OPTIONAL(void *, write_image_begin, struct dt_imageio_module_data_t *data, const char *filename,
+                                    dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                                    void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                                    struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks);
+OPTIONAL(int, write_image_strip, void *handle, const float *in, const int height);
+OPTIONAL(int, write_image_end, void *handle, const gboolean abort);
 /* flag that describes the available precision/levels of output format. mainly used for dithering. */
 OPTIONAL(int, levels, struct dt_imageio_module_data_t *data);
 
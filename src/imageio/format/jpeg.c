@@ -301,15 +301,256 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
+static void _set_compress_params(const dt_imageio_jpeg_t *jpg, struct jpeg_compress_struct *cinfo)
+{
+  cinfo->image_width = jpg->global.width;
+  cinfo->image_height = jpg->global.height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, jpg->quality, TRUE);
+  if(jpg->quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(jpg->quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(jpg->quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(jpg->quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(jpg->quality < 80) cinfo->smoothing_factor = 20;
+  if(jpg->quality < 60) cinfo->smoothing_factor = 40;
+  if(jpg->quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
+
+  const int resolution = dt_conf_get_int("metadata/resolution");
+  cinfo->density_unit = 1;
+  cinfo->X_density = resolution;
+  cinfo->Y_density = resolution;
+}
+
+// the output profile to embed, NULL if there is none
+static unsigned char *_get_icc_profile(int imgid, dt_colorspaces_color_profile_type_t over_type,
+                                       const char *over_filename, uint32_t *len)
+{
+  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
+  *len = 0;
+  cmsSaveProfileToMem(out_profile, NULL, len);
+  if(*len == 0) return NULL;
+  unsigned char *buf = malloc(sizeof(unsigned char) * *len);
+  if(buf) cmsSaveProfileToMem(out_profile, buf, len);
+  return buf;
+}
+
+// exif data larger than an APP1 segment is added by exiv2 once the file is written
+static gboolean _exif_in_segment(const void *exif, const int exif_len)
+{
+  return exif && exif_len > 0 && exif_len + 6 <= 65533;
+}
+
+static void _write_app1(j_compress_ptr cinfo, const char *signature, const unsigned int signature_len,
+                        const void *data, const unsigned int len)
+{
+  jpeg_write_m_header(cinfo, JPEG_APP0 + 1, signature_len + len);
+  for(unsigned int i = 0; i < signature_len; i++) jpeg_write_m_byte(cinfo, signature[i]);
+  const JOCTET *d = (const JOCTET *)data;
+  for(unsigned int i = 0; i < len; i++) jpeg_write_m_byte(cinfo, d[i]);
+}
+
+// exif and xmp go in APP1 segments, right after the JFIF header as exiv2 would put them
+static void _write_metadata(j_compress_ptr cinfo, const void *exif, const int exif_len, const char *xmp)
+{
+  if(_exif_in_segment(exif, exif_len)) _write_app1(cinfo, "Exif\0\0", 6, exif, exif_len);
+  // the namespace with its terminating 0
+  if(xmp && strlen(xmp) <= DT_EXIF_XMP_PACKET_MAX)
+    _write_app1(cinfo, "http://ns.adobe.com/xap/1.0/", 29, xmp, strlen(xmp));
+}
+
+// compression settings, metadata and icc profile, errors longjmp to the caller
+static void _start_compress(const dt_imageio_jpeg_t *jpg, struct jpeg_compress_struct *cinfo,
+                            dt_colorspaces_color_profile_type_t over_type, const char *over_filename, int imgid,
+                            const void *exif, const int exif_len, const char *xmp)
+{
+  _set_compress_params(jpg, cinfo);
+  jpeg_start_compress(cinfo, TRUE);
+  _write_metadata(cinfo, exif, exif_len, xmp);
+
+  uint32_t len = 0;
+  unsigned char *buf = _get_icc_profile(imgid, over_type, over_filename, &len);
+  if(buf)
+  {
+    write_icc_profile(cinfo, buf, len);
+    free(buf);
+  }
+}
+
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+/* Parallel encoding: the image is cut in slices of whole MCU rows, each encoded on its own into memory with a
+ * restart marker after every MCU row and the standard huffman tables. The entropy-coded data of all slices then
+ * goes behind the headers of the first one, each slice ending where a restart marker would have been anyway.
+ * Restart markers are numbered modulo 8 and the slices have a multiple of 8 MCU rows, so the numbering goes on
+ * seamlessly from one slice to the next. */
+typedef struct dt_imageio_jpeg_slice_t
+{
+  unsigned char *data;
+  unsigned long size;
+  size_t sos_end;  // offset of the entropy-coded data
+  size_t sof;      // offset of the frame header, 0 if none
+} dt_imageio_jpeg_slice_t;
+
+static gboolean _encode_slice(const dt_imageio_jpeg_t *jpg, const uint8_t *in, const int rows,
+                              const unsigned char *icc, const uint32_t icc_len, const void *exif,
+                              const int exif_len, const char *xmp, dt_imageio_jpeg_slice_t *slice)
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  uint8_t *row = dt_alloc_align(sizeof(uint8_t) * 3 * jpg->global.width);
+  if(!row) return FALSE;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    dt_free_align(row);
+    // libjpeg may have moved the output buffer already, better leak it than free it twice
+    slice->data = NULL;
+    return FALSE;
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &slice->data, &slice->size);
+
+  _set_compress_params(jpg, &cinfo);
+  cinfo.image_height = rows;
+  cinfo.optimize_coding = 0;
+  cinfo.restart_in_rows = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+  _write_metadata(&cinfo, exif, exif_len, xmp);
+  if(icc) write_icc_profile(&cinfo, icc, icc_len);
+
+  while(cinfo.next_scanline < cinfo.image_height)
+  {
+    JSAMPROW tmp[1] = { row };
+    const uint8_t *buf = in + (size_t)cinfo.next_scanline * cinfo.image_width * 4;
+    for(int i = 0; i < jpg->global.width; i++)
+      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
+    jpeg_write_scanlines(&cinfo, tmp, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  dt_free_align(row);
+
+  // find the frame header and where the scan starts
+  const unsigned char *d = slice->data;
+  size_t pos = 2;
+  while(pos + 4 <= slice->size && d[pos] == 0xFF)
+  {
+    const unsigned char marker = d[pos + 1];
+    const size_t len = (d[pos + 2] << 8) | d[pos + 3];
+    if(marker == 0xC0) slice->sof = pos;
+    pos += 2 + len;
+    if(marker == 0xDA)
+    {
+      slice->sos_end = pos;
+      break;
+    }
+  }
+  return slice->sos_end && slice->sos_end + 2 <= slice->size && d[slice->size - 2] == 0xFF
+         && d[slice->size - 1] == 0xD9;
+}
+
+// returns 0 on success, 1 on error and -1 if the image doesn't get enough slices to be worth it
+static int _write_image_sliced(const dt_imageio_jpeg_t *jpg, const char *filename, const uint8_t *in,
+                               const unsigned char *icc, const uint32_t icc_len, const void *exif,
+                               const int exif_len, const char *xmp)
+{
+  // the mcu height of the settings jpeg_set_quality() and _set_compress_params() end up with
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  _set_compress_params(jpg, &cinfo);
+  const int mcu_height = DCTSIZE * cinfo.comp_info[0].v_samp_factor;
+  // smoothing looks across rows, the slices would show at low qualities
+  const gboolean smoothing = cinfo.smoothing_factor > 0;
+  jpeg_destroy_compress(&cinfo);
+  if(smoothing) return -1;
+
+  const int height = jpg->global.height;
+  const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+  const int threads = dt_get_num_threads();
+  const int slice_mcu_rows = 8 * MAX(1, (mcu_rows + 8 * threads - 1) / (8 * threads));
+  const int slice_rows = slice_mcu_rows * mcu_height;
+  const int n = (height + slice_rows - 1) / slice_rows;
+  if(n < 2) return -1;
+
+  dt_imageio_jpeg_slice_t *slices = calloc(n, sizeof(dt_imageio_jpeg_slice_t));
+  if(!slices) return 1;
+  const size_t width = jpg->global.width;
+  int err = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(jpg, in, icc, icc_len, exif, exif_len, xmp, slices, n, slice_rows, height, width) \
+  reduction(|:err) schedule(dynamic)
+#endif
+  for(int k = 0; k < n; k++)
+  {
+    const int rows = MIN(slice_rows, height - k * slice_rows);
+    // the headers of the first slice are the ones of the file
+    if(!_encode_slice(jpg, in + (size_t)4 * width * slice_rows * k, rows, k == 0 ? icc : NULL, icc_len,
+                      k == 0 ? exif : NULL, exif_len, k == 0 ? xmp : NULL, slices + k))
+      err |= 1;
+  }
+
+  FILE *f = NULL;
+  if(!err && slices[0].sof && (f = g_fopen(filename, "wb")))
+  {
+    // the headers of the first slice, with the height of the whole image
+    unsigned char *sof = slices[0].data + slices[0].sof;
+    sof[5] = height >> 8;
+    sof[6] = height & 0xFF;
+    err = fwrite(slices[0].data, 1, slices[0].sos_end, f) != slices[0].sos_end;
+
+    for(int k = 0; k < n && !err; k++)
+    {
+      const size_t len = slices[k].size - 2 - slices[k].sos_end;
+      err = fwrite(slices[k].data + slices[k].sos_end, 1, len, f) != len;
+      // the restart marker of the last mcu row of the slice
+      const unsigned char marker[2] = { 0xFF, k < n - 1 ? 0xD0 + ((slice_mcu_rows * (k + 1) - 1) & 7) : 0xD9 };
+      if(!err) err = fwrite(marker, 1, 2, f) != 2;
+    }
+    err |= fclose(f) != 0;
+  }
+  else
+    err = 1;
+
+  for(int k = 0; k < n; k++) free(slices[k].data);
+  free(slices);
+  return err ? 1 : 0;
+}
+#endif
+
 int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+                void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
   const uint8_t *in = (const uint8_t *)in_tmp;
   struct dt_imageio_jpeg_error_mgr jerr;
 
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+  if(dt_conf_get_bool("plugins/imageio/format/jpeg/parallel") && dt_get_num_threads() > 1)
+  {
+    uint32_t icc_len = 0;
+    unsigned char *icc = _get_icc_profile(imgid, over_type, over_filename, &icc_len);
+    const int rc = _write_image_sliced(jpg, filename, in, icc, icc_len, exif, exif_len, xmp);
+    free(icc);
+    if(rc == 1) return 1;
+    if(rc == 0)
+    {
+      if(exif && !_exif_in_segment(exif, exif_len)) dt_exif_write_blob(exif, exif_len, filename, 1);
+      return 0;
+    }
+  }
+#endif
+
   jpg->cinfo.err = jpeg_std_error(&jerr.pub);
   jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
   if(setjmp(jerr.setjmp_buffer))
@@ -322,41 +563,7 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   if(!f) return 1;
   jpeg_stdio_dest(&(jpg->cinfo), f);
 
-  jpg->cinfo.image_width = jpg->global.width;
-  jpg->cinfo.image_height = jpg->global.height;
-  jpg->cinfo.input_components = 3;
-  jpg->cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
-
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  jpg->cinfo.density_unit = 1;
-  jpg->cinfo.X_density = resolution;
-  jpg->cinfo.Y_density = resolution;
-
-  jpeg_start_compress(&(jpg->cinfo), TRUE);
-
-  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
-  uint32_t len = 0;
-  cmsSaveProfileToMem(out_profile, NULL, &len);
-  if(len > 0)
-  {
-    unsigned char *buf = malloc(sizeof(unsigned char) * len);
-    if(buf)
-    {
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
-    }
-  }
+  _start_compress(jpg, &(jpg->cinfo), over_type, over_filename, imgid, exif, exif_len, xmp);
 
   uint8_t *row = dt_alloc_align(sizeof(uint8_t) * 3 * jpg->global.width);
   const uint8_t *buf;
@@ -374,11 +581,104 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
 
-  dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(exif && !_exif_in_segment(exif, exif_len)) dt_exif_write_blob(exif, exif_len, filename, 1);
+
+  return 0;
+}
+
+// state of a strip-wise export, see write_image_begin()
+typedef struct dt_imageio_jpeg_writer_t
+{
+  struct jpeg_compress_struct cinfo;
+  struct dt_imageio_jpeg_error_mgr jerr;
+  FILE *f;
+  uint8_t *row;
+  char *filename;
+  void *exif;
+  int exif_len;
+} dt_imageio_jpeg_writer_t;
+
+static void _writer_free(dt_imageio_jpeg_writer_t *w)
+{
+  jpeg_destroy_compress(&(w->cinfo));
+  if(w->f) fclose(w->f);
+  dt_free_align(w->row);
+  g_free(w->filename);
+  free(w);
+}
+
+void *write_image_begin(dt_imageio_module_data_t *jpg_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                        struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+{
+  const dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
+
+  // the slices of the parallel encoding need the whole image
+  if(dt_conf_get_bool("plugins/imageio/format/jpeg/parallel") && dt_get_num_threads() > 1) return NULL;
 
+  dt_imageio_jpeg_writer_t *w = calloc(1, sizeof(dt_imageio_jpeg_writer_t));
+  if(!w) return NULL;
+
+  w->cinfo.err = jpeg_std_error(&w->jerr.pub);
+  w->jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if(setjmp(w->jerr.setjmp_buffer))
+  {
+    _writer_free(w);
+    return NULL;
+  }
+  jpeg_create_compress(&(w->cinfo));
+  w->row = dt_alloc_align(sizeof(uint8_t) * 3 * jpg->global.width);
+  w->f = g_fopen(filename, "wb");
+  if(!w->row || !w->f)
+  {
+    _writer_free(w);
+    return NULL;
+  }
+  jpeg_stdio_dest(&(w->cinfo), w->f);
+
+  _start_compress(jpg, &(w->cinfo), over_type, over_filename, imgid, exif, exif_len, xmp);
+
+  w->filename = g_strdup(filename);
+  w->exif = exif;
+  w->exif_len = exif_len;
+  return w;
+}
+
+int write_image_strip(void *handle, const float *in, const int height)
+{
+  dt_imageio_jpeg_writer_t *w = (dt_imageio_jpeg_writer_t *)handle;
+  if(setjmp(w->jerr.setjmp_buffer)) return 1;
+
+  for(int y = 0; y < height; y++, in += (size_t)4 * w->cinfo.image_width)
+  {
+    JSAMPROW tmp[1] = { w->row };
+    dt_imageio_float_to_uint8(w->row, in, w->cinfo.image_width, 3);
+    jpeg_write_scanlines(&(w->cinfo), tmp, 1);
+  }
   return 0;
 }
 
+int write_image_end(void *handle, const gboolean abort)
+{
+  dt_imageio_jpeg_writer_t *w = (dt_imageio_jpeg_writer_t *)handle;
+  int rc = abort ? 1 : 0;
+
+  if(setjmp(w->jerr.setjmp_buffer))
+    rc = 1;
+  else if(!abort)
+    jpeg_finish_compress(&(w->cinfo));
+
+  // the file has to be closed before exiv2 adds exif data too large for its segment
+  fclose(w->f);
+  w->f = NULL;
+  if(rc == 0 && w->exif && !_exif_in_segment(w->exif, w->exif_len))
+    dt_exif_write_blob(w->exif, w->exif_len, w->filename, 1);
+
+  _writer_free(w);
+  return rc;
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 {
   jpg->f = g_fopen(filename, "rb");
@@ -533,7 +833,7 @@ const char *extension(dt_imageio_module_data_t *data)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 void init(dt_imageio_module_format_t *self)
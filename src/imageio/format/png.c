@@ -117,40 +117,12 @@ static void PNGwriteRawProfile(png_struct *ping, png_info *ping_info, char *prof
   png_free(ping, text);
 }
 
-int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
-                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+// everything up to the pixels, errors longjmp to the caller
+static void _write_header(dt_imageio_png_t *p, FILE *f, png_structp png_ptr, png_infop info_ptr,
+                          dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                          void *exif, int exif_len, const char *xmp, int imgid)
 {
-  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
   const int width = p->global.width, height = p->global.height;
-  FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
-
-  png_structp png_ptr;
-  png_infop info_ptr;
-
-  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if(!png_ptr)
-  {
-    fclose(f);
-    return 1;
-  }
-
-  info_ptr = png_create_info_struct(png_ptr);
-  if(!info_ptr)
-  {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, NULL);
-    return 1;
-  }
-
-  if(setjmp(png_jmpbuf(png_ptr)))
-  {
-    fclose(f);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    return 1;
-  }
 
   png_init_io(png_ptr, f);
 
@@ -204,6 +176,21 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
     }
   }
 
+#ifdef PNG_iTXt_SUPPORTED
+  // the xmp packet, in the uncompressed iTXt chunk exiv2 and adobe use
+  if(xmp)
+  {
+    png_text text = { 0 };
+    text.compression = PNG_ITXT_COMPRESSION_NONE;
+    text.key = (png_charp) "XML:com.adobe.xmp";
+    text.text = (png_charp)xmp;
+    text.itxt_length = strlen(xmp);
+    text.lang = (png_charp) "";
+    text.lang_key = (png_charp) "";
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+#endif
+
   png_write_info(png_ptr, info_ptr);
 
   /*
@@ -212,13 +199,54 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
    */
   png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  png_bytep *row_pointers = dt_alloc_align(sizeof(png_bytep) * height);
-
   if(p->bpp > 8)
   {
     /* swap bytes of 16 bit files to most significant bit first */
     png_set_swap(png_ptr);
+  }
+}
 
+int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const void *ivoid,
+                dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  const int width = p->global.width, height = p->global.height;
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return 1;
+
+  png_structp png_ptr;
+  png_infop info_ptr;
+
+  png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!png_ptr)
+  {
+    fclose(f);
+    return 1;
+  }
+
+  info_ptr = png_create_info_struct(png_ptr);
+  if(!info_ptr)
+  {
+    fclose(f);
+    png_destroy_write_struct(&png_ptr, NULL);
+    return 1;
+  }
+
+  if(setjmp(png_jmpbuf(png_ptr)))
+  {
+    fclose(f);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return 1;
+  }
+
+  _write_header(p, f, png_ptr, info_ptr, over_type, over_filename, exif, exif_len, xmp, imgid);
+
+  png_bytep *row_pointers = dt_alloc_align(sizeof(png_bytep) * height);
+
+  if(p->bpp > 8)
+  {
     for(unsigned i = 0; i < height; i++) row_pointers[i] = (png_bytep)((uint16_t *)ivoid + (size_t)4 * i * width);
   }
   else
@@ -236,6 +264,81 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
   return 0;
 }
 
+// state of a strip-wise export, see write_image_begin()
+typedef struct dt_imageio_png_writer_t
+{
+  int bpp;
+  int width;
+  FILE *f;
+  png_structp png_ptr;
+  png_infop info_ptr;
+  void *row; // 4 channels per pixel, the filler gets dropped by libpng
+} dt_imageio_png_writer_t;
+
+void *write_image_begin(dt_imageio_module_data_t *p_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                        struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+{
+  dt_imageio_png_t *p = (dt_imageio_png_t *)p_tmp;
+  dt_imageio_png_writer_t *w = calloc(1, sizeof(dt_imageio_png_writer_t));
+  if(!w) return NULL;
+  w->bpp = p->bpp;
+  w->width = p->global.width;
+  w->row = dt_alloc_align((size_t)4 * w->width * (p->bpp > 8 ? sizeof(uint16_t) : sizeof(uint8_t)));
+  w->f = g_fopen(filename, "wb");
+  if(!w->row || !w->f) goto error;
+
+  w->png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if(!w->png_ptr) goto error;
+  w->info_ptr = png_create_info_struct(w->png_ptr);
+  if(!w->info_ptr) goto error;
+  if(setjmp(png_jmpbuf(w->png_ptr))) goto error;
+
+  _write_header(p, w->f, w->png_ptr, w->info_ptr, over_type, over_filename, exif, exif_len, xmp, imgid);
+  return w;
+
+error:
+  if(w->png_ptr) png_destroy_write_struct(&w->png_ptr, w->info_ptr ? &w->info_ptr : NULL);
+  if(w->f) fclose(w->f);
+  dt_free_align(w->row);
+  free(w);
+  return NULL;
+}
+
+int write_image_strip(void *handle, const float *in, const int height)
+{
+  dt_imageio_png_writer_t *w = (dt_imageio_png_writer_t *)handle;
+  if(setjmp(png_jmpbuf(w->png_ptr))) return 1;
+
+  for(int y = 0; y < height; y++, in += (size_t)4 * w->width)
+  {
+    if(w->bpp > 8)
+      dt_imageio_float_to_uint16((uint16_t *)w->row, in, w->width, 4);
+    else
+      dt_imageio_float_to_uint8((uint8_t *)w->row, in, w->width, 4);
+    png_write_row(w->png_ptr, (png_bytep)w->row);
+  }
+  return 0;
+}
+
+int write_image_end(void *handle, const gboolean abort)
+{
+  dt_imageio_png_writer_t *w = (dt_imageio_png_writer_t *)handle;
+  int rc = abort ? 1 : 0;
+
+  if(setjmp(png_jmpbuf(w->png_ptr)))
+    rc = 1;
+  else if(!abort)
+    png_write_end(w->png_ptr, w->info_ptr);
+
+  png_destroy_write_struct(&w->png_ptr, &w->info_ptr);
+  fclose(w->f);
+  dt_free_align(w->row);
+  free(w);
+  return rc;
+}
+
 static int __attribute__((__unused__)) read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
 {
   dt_imageio_png_t *png = (dt_imageio_png_t *)p_tmp;
@@ -572,7 +675,11 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
+#ifdef PNG_iTXt_SUPPORTED
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
+#else
   return FORMAT_FLAGS_SUPPORT_XMP;
+#endif
 }
 
 // clang-format off
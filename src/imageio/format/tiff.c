@@ -31,6 +31,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 // it would be nice to save space by storing the masks as single channel float data,
 // but at least GIMP can't open TIFF files where not all layers have the same format.
@@ -57,10 +58,202 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
+// http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
+// "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
+// "software vendors. This code should be considered obsolete. We recommend"
+// "that TIFF implementations recognize and read the obsolete code but only"
+// "write the official compression code (0x0008)."
+// http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
+// http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
+static void _set_compression(TIFF *tif, const dt_imageio_tiff_t *d)
+{
+  if(d->compress == 1)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+  else if(d->compress == 2)
+  {
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    if(d->bpp == 32)
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+    else
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
+  }
+}
+
+// libtiff deflates strip after strip. when the predictor is one we can apply ourselves, the strips are
+// compressed on all cores instead and handed to libtiff as they are
+static gboolean _deflate_in_parallel(const dt_imageio_tiff_t *d)
+{
+  return G_BYTE_ORDER == G_LITTLE_ENDIAN && dt_get_num_threads() > 1
+         && (d->compress == 1 || (d->compress == 2 && d->bpp != 32));
+}
+
+static void _set_image_fields(TIFF *tif, const dt_imageio_tiff_t *d, const uint16_t layers)
+{
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (d->bpp == 32) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)d->global.width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->global.height);
+  if(layers == 3)
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  else
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+  // bigger strips for the parallel deflate, the 8 KiB of libtiff's default compress too poorly
+  const size_t rowsize = (size_t)d->global.width * layers * d->bpp / 8;
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP,
+               _deflate_in_parallel(d) ? (uint32_t)MAX(1, (256 << 10) / rowsize) : TIFFDefaultStripSize(tif, 0));
+
+  const int resolution = dt_conf_get_int("metadata/resolution");
+  TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
+  TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
+  TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
+}
+
+// rows of the image on their way to the file, see _rows_next() and _rows_push()
+typedef struct dt_imageio_tiff_rows_t
+{
+  const dt_imageio_tiff_t *d;
+  uint16_t layers;
+  size_t rowsize;
+  uint32_t row;        // next row of the image
+  uint8_t *buf;        // one row, or a batch of strips when deflating in parallel
+  gboolean deflate;
+  uint32_t strip_rows;
+  uint32_t batch_rows;
+  uint32_t filled;     // rows of the batch
+  uint32_t strip;      // next strip of the file
+  uLong bound;         // room for one compressed strip
+  uint8_t *out;
+  uLongf *out_len;
+} dt_imageio_tiff_rows_t;
+
+static gboolean _rows_init(dt_imageio_tiff_rows_t *r, TIFF *tif, const dt_imageio_tiff_t *d,
+                           const uint16_t layers)
+{
+  memset(r, 0, sizeof(dt_imageio_tiff_rows_t));
+  r->d = d;
+  r->layers = layers;
+  r->rowsize = (size_t)d->global.width * layers * d->bpp / 8;
+  r->deflate = _deflate_in_parallel(d);
+  if(!r->deflate)
+  {
+    r->buf = malloc(r->rowsize);
+    return r->buf != NULL;
+  }
+
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &r->strip_rows);
+  r->strip_rows = MIN(r->strip_rows, (uint32_t)d->global.height);
+  const size_t strips = 2 * dt_get_num_threads();
+  r->batch_rows = strips * r->strip_rows;
+  r->bound = compressBound(r->rowsize * r->strip_rows);
+  r->buf = dt_alloc_align(r->rowsize * r->batch_rows);
+  r->out = dt_alloc_align(r->bound * strips);
+  r->out_len = malloc(sizeof(uLongf) * strips);
+  return r->buf && r->out && r->out_len;
+}
+
+static void _rows_cleanup(dt_imageio_tiff_rows_t *r)
+{
+  if(r->deflate)
+  {
+    dt_free_align(r->buf);
+    dt_free_align(r->out);
+    free(r->out_len);
+  }
+  else
+    free(r->buf);
+  r->buf = r->out = NULL;
+  r->out_len = NULL;
+}
+
+// where the caller packs the next row
+static void *_rows_next(dt_imageio_tiff_rows_t *r)
+{
+  return r->buf + (r->deflate ? r->filled * r->rowsize : 0);
+}
+
+// horizontal differencing of a row, the way libtiff's PREDICTOR_HORIZONTAL does it
+static void _predict_row(uint8_t *row, const size_t samples, const uint16_t layers, const int bpp)
+{
+  if(bpp == 16)
+  {
+    uint16_t *s = (uint16_t *)row;
+    for(size_t i = samples - 1; i >= layers; i--) s[i] -= s[i - layers];
+  }
+  else
+  {
+    for(size_t i = samples - 1; i >= layers; i--) row[i] -= row[i - layers];
+  }
+}
+
+static int _rows_flush(TIFF *tif, dt_imageio_tiff_rows_t *r)
+{
+  const dt_imageio_tiff_t *d = r->d;
+  const int strips = (r->filled + r->strip_rows - 1) / r->strip_rows;
+  const size_t samples = (size_t)d->global.width * r->layers;
+  int err = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(r, d, strips, samples) \
+  reduction(|:err) schedule(dynamic)
+#endif
+  for(int k = 0; k < strips; k++)
+  {
+    uint8_t *in = r->buf + r->rowsize * r->strip_rows * k;
+    const uint32_t rows = MIN(r->strip_rows, r->filled - r->strip_rows * k);
+    if(d->compress == 2)
+      for(uint32_t y = 0; y < rows; y++) _predict_row(in + r->rowsize * y, samples, r->layers, d->bpp);
+    r->out_len[k] = r->bound;
+    if(compress2(r->out + r->bound * k, &r->out_len[k], in, r->rowsize * rows, d->compresslevel) != Z_OK)
+      err |= 1;
+  }
+
+  for(int k = 0; k < strips && !err; k++)
+    if(TIFFWriteRawStrip(tif, r->strip++, r->out + r->bound * k, r->out_len[k]) == -1) err = 1;
+
+  r->filled = 0;
+  return err;
+}
+
+// the row from _rows_next() is ready, returns non-zero on error
+static int _rows_push(TIFF *tif, dt_imageio_tiff_rows_t *r)
+{
+  if(!r->deflate) return TIFFWriteScanline(tif, r->buf, r->row++, 0) == -1;
+
+  r->row++;
+  r->filled++;
+  if(r->filled == r->batch_rows || r->row == r->d->global.height) return _rows_flush(tif, r);
+  return 0;
+}
+
+// the output profile of the image, FALSE if out of memory
+static gboolean _get_profile(const int imgid, dt_colorspaces_color_profile_type_t over_type,
+                             const char *over_filename, uint8_t **profile, uint32_t *profile_len)
+{
+  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
+  cmsSaveProfileToMem(out_profile, 0, profile_len);
+  if(*profile_len > 0)
+  {
+    *profile = malloc(*profile_len);
+    if(!*profile) return FALSE;
+    cmsSaveProfileToMem(out_profile, *profile, profile_len);
+  }
+  return TRUE;
+}
+
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+                void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
 
@@ -70,6 +263,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFF *tif = NULL;
 
   void *rowdata = NULL;
+  dt_imageio_tiff_rows_t rows = { 0 };
 
   gboolean free_mask = FALSE;
   float *raster_mask = NULL;
@@ -78,20 +272,10 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 #endif
   int rc = 1; // default to error
 
-  if(imgid > 0)
+  if(imgid > 0 && !_get_profile(imgid, over_type, over_filename, &profile, &profile_len))
   {
-    cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
-    cmsSaveProfileToMem(out_profile, 0, &profile_len);
-    if(profile_len > 0)
-    {
-      profile = malloc(profile_len);
-      if(!profile)
-      {
-        rc = 1;
-        goto exit;
-      }
-      cmsSaveProfileToMem(out_profile, profile, &profile_len);
-    }
+    rc = 1;
+    goto exit;
   }
 
   uint16_t n_pages = 1;
@@ -126,33 +310,13 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 
   TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
 
-  // http://partners.adobe.com/public/developer/en/tiff/TIFFphotoshop.pdf (dated 2002)
-  // "A proprietary ZIP/Flate compression code (0x80b2) has been used by some"
-  // "software vendors. This code should be considered obsolete. We recommend"
-  // "that TIFF implementations recognize and read the obsolete code but only"
-  // "write the official compression code (0x0008)."
-  // http://www.awaresystems.be/imaging/tiff/tifftags/compression.html
-  // http://www.awaresystems.be/imaging/tiff/tifftags/predictor.html
-  if(d->compress == 1)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
-  else if(d->compress == 2)
-  {
-    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-    if(d->bpp == 32)
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
-    else
-      TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
-    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-  }
+  _set_compression(tif, d);
 
   if(profile != NULL)
   {
     TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
   }
+  if(xmp) TIFFSetField(tif, TIFFTAG_XMLPACKET, (uint32_t)strlen(xmp), xmp);
 
 /* Howto check for a grayscale image?
    We test every pixel for differences between the rgb channels using specific thresholds
@@ -227,27 +391,11 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   if(layers == 1)
     dt_control_log(_("will export as a grayscale image"));
 
-  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
-  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)d->bpp);
-  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (d->bpp == 32) ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
-  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)d->global.width);
-  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)d->global.height);
-  if(layers == 3)
-    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-  else
-    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-
-  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-  TIFFSetField(tif, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
-
+  _set_image_fields(tif, d, layers);
   const int resolution = dt_conf_get_int("metadata/resolution");
-  TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
-  TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
-  TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
 
   const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  if((rowdata = malloc(rowsize)) == NULL || !_rows_init(&rows, tif, d, layers))
   {
     rc = 1;
     goto exit;
@@ -258,14 +406,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     for(int y = 0; y < d->global.height; y++)
     {
       float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      float *out = (float *)rowdata;
+      float *out = (float *)_rows_next(&rows);
 
       for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
       {
         memcpy(out, in, sizeof(float) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(_rows_push(tif, &rows))
       {
         rc = 1;
         goto exit;
@@ -277,14 +425,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     for(int y = 0; y < d->global.height; y++)
     {
       uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
+      uint16_t *out = (uint16_t *)_rows_next(&rows);
 
       for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
       {
         memcpy(out, in, sizeof(uint16_t) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(_rows_push(tif, &rows))
       {
         rc = 1;
         goto exit;
@@ -296,14 +444,14 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
     for(int y = 0; y < d->global.height; y++)
     {
       uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
-      uint8_t *out = (uint8_t *)rowdata;
+      uint8_t *out = (uint8_t *)_rows_next(&rows);
 
       for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
       {
         memcpy(out, in, sizeof(uint8_t) * layers);
       }
 
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
+      if(_rows_push(tif, &rows))
       {
         rc = 1;
         goto exit;
@@ -386,21 +534,7 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
         else
           TIFFSetField(tif, TIFFTAG_PAGENAME, piece->module->name());
 
-        if(d->compress == 1)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-          TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_NONE);
-          TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-        }
-        else if(d->compress == 2)
-        {
-          TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
-          if(d->bpp == 32)
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
-          else
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
-          TIFFSetField(tif, TIFFTAG_ZIPQUALITY, (uint16_t)d->compresslevel);
-        }
+        _set_compression(tif, d);
 
         TIFFSetField(tif, TIFFTAG_XRESOLUTION, (float)resolution);
         TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
@@ -531,6 +665,7 @@ exit:
   profile = NULL;
   free(rowdata);
   rowdata = NULL;
+  _rows_cleanup(&rows);
 #ifdef _WIN32
   g_free(wfilename);
 #endif
@@ -541,6 +676,119 @@ exit:
 }
 
 #if 0
+// state of a strip-wise export, see write_image_begin()
+typedef struct dt_imageio_tiff_writer_t
+{
+  const dt_imageio_tiff_t *d;
+  TIFF *tif;
+  dt_imageio_tiff_rows_t rows;
+  char *filename;
+  void *exif;
+  int exif_len;
+} dt_imageio_tiff_writer_t;
+
+void *write_image_begin(dt_imageio_module_data_t *d_tmp, const char *filename,
+                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
+                        void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                        dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
+{
+  const dt_imageio_tiff_t *d = (dt_imageio_tiff_t *)d_tmp;
+
+  // the grayscale check needs the whole image and the masks go to extra pages, write_image() does both
+  if(dt_conf_key_exists("plugins/imageio/format/tiff/shortfile")
+     && dt_conf_get_int("plugins/imageio/format/tiff/shortfile"))
+    return NULL;
+  if(export_masks && pipe)
+  {
+    for(GList *iter = pipe->nodes; iter; iter = g_list_next(iter))
+      if(g_hash_table_size(((dt_dev_pixelpipe_iop_t *)iter->data)->raster_masks)) return NULL;
+  }
+
+  uint8_t *profile = NULL;
+  uint32_t profile_len = 0;
+  if(imgid > 0 && !_get_profile(imgid, over_type, over_filename, &profile, &profile_len)) return NULL;
+
+  // Create little endian tiff image
+#ifdef _WIN32
+  wchar_t *wfilename = g_utf8_to_utf16(filename, -1, NULL, NULL, NULL);
+  TIFF *tif = TIFFOpenW(wfilename, "wl");
+  g_free(wfilename);
+#else
+  TIFF *tif = TIFFOpen(filename, "wl");
+#endif
+  if(!tif)
+  {
+    free(profile);
+    return NULL;
+  }
+
+  TIFFSetField(tif, TIFFTAG_SUBFILETYPE, 0);
+  TIFFSetField(tif, TIFFTAG_DOCUMENTNAME, filename);
+  _set_compression(tif, d);
+  if(profile != NULL) TIFFSetField(tif, TIFFTAG_ICCPROFILE, (uint32_t)profile_len, profile);
+  free(profile);
+  if(xmp) TIFFSetField(tif, TIFFTAG_XMLPACKET, (uint32_t)strlen(xmp), xmp);
+  _set_image_fields(tif, d, 3);
+
+  dt_imageio_tiff_writer_t *w = calloc(1, sizeof(dt_imageio_tiff_writer_t));
+  if(!w || !_rows_init(&w->rows, tif, d, 3))
+  {
+    if(w) _rows_cleanup(&w->rows);
+    free(w);
+    TIFFClose(tif);
+    return NULL;
+  }
+  w->d = d;
+  w->tif = tif;
+  w->filename = g_strdup(filename);
+  w->exif = exif;
+  w->exif_len = exif_len;
+  return w;
+}
+
+int write_image_strip(void *handle, const float *in, const int height)
+{
+  dt_imageio_tiff_writer_t *w = (dt_imageio_tiff_writer_t *)handle;
+  const int width = w->d->global.width;
+
+  for(int y = 0; y < height; y++, in += (size_t)4 * width)
+  {
+    void *row = _rows_next(&w->rows);
+    if(w->d->bpp == 32)
+    {
+      float *out = (float *)row;
+      for(int x = 0; x < width; x++, out += 3) memcpy(out, in + 4 * x, sizeof(float) * 3);
+    }
+    else if(w->d->bpp == 16)
+      dt_imageio_float_to_uint16((uint16_t *)row, in, width, 3);
+    else
+      dt_imageio_float_to_uint8((uint8_t *)row, in, width, 3);
+
+    if(_rows_push(w->tif, &w->rows)) return 1;
+  }
+  return 0;
+}
+
+int write_image_end(void *handle, const gboolean abort)
+{
+  dt_imageio_tiff_writer_t *w = (dt_imageio_tiff_writer_t *)handle;
+  int rc = abort ? 1 : 0;
+
+  // close the file before adding exif data
+  TIFFClose(w->tif);
+  if(rc == 0 && w->exif)
+  {
+    rc = dt_exif_write_blob(w->exif, w->exif_len, w->filename, w->d->compress > 0);
+    // Until we get symbolic error status codes, if rc is 1, return 0
+    rc = (rc == 1) ? 0 : 1;
+  }
+
+  _rows_cleanup(&w->rows);
+  g_free(w->filename);
+  free(w);
+  return rc;
+}
+
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
   tiff->handle = TIFFOpen(filename, "rl");
@@ -863,7 +1111,8 @@ void gui_reset(dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_LAYERS;
+  // the exif data still goes through exiv2, the xmp packet is a tag of the first page
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_SUPPORT_LAYERS | FORMAT_FLAGS_EMBED_XMP;
 }
 
 // clang-format off
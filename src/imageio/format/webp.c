@@ -22,7 +22,6 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
-#include "common/exif.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
@@ -119,8 +118,8 @@ void cleanup(dt_imageio_module_format_t *self)
 
 int write_image(dt_imageio_module_data_t *webp, const char *filename, const void *in_tmp,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                void *exif, int exif_len, int imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
-                const gboolean export_masks)
+                void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                struct dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   int res = 1;
   FILE *out = NULL;
@@ -152,6 +151,9 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
   // TODO(jinxos): these values should be adjusted as needed and ideally determined at runtime.
   config.segments = 4;
   config.partition_limit = 70;
+  // analysis and encoding overlap in a second thread. export threads running in parallel get 1 OpenMP
+  // thread each once the cores are shared out, don't add to them then.
+  config.thread_level = omp_get_max_threads() > 1;
   if(!WebPValidateConfig(&config))
   {
     fprintf(stderr, "[webp export] error validating encoder configuration\n");
@@ -219,6 +221,26 @@ int write_image(dt_imageio_module_data_t *webp, const char *filename, const void
     goto out;
   }
 
+  // metadata chunks, the data is copied into the mux
+  if(exif && exif_len > 0)
+  {
+    const WebPData chunk = { .bytes = (const uint8_t *)exif, .size = exif_len };
+    if(WebPMuxSetChunk(mux, "EXIF", &chunk, 1) != WEBP_MUX_OK)
+    {
+      fprintf(stderr, "[webp export] error adding exif data to WebP stream\n");
+      goto out;
+    }
+  }
+  if(xmp)
+  {
+    const WebPData chunk = { .bytes = (const uint8_t *)xmp, .size = strlen(xmp) };
+    if(WebPMuxSetChunk(mux, "XMP ", &chunk, 1) != WEBP_MUX_OK)
+    {
+      fprintf(stderr, "[webp export] error adding xmp data to WebP stream\n");
+      goto out;
+    }
+  }
+
   // finally write out assembled data to file
   err = WebPMuxAssemble(mux, &assembled_data);
   if(err != WEBP_MUX_OK)
@@ -247,8 +269,7 @@ out:
   g_free(buf); // instead of WebPDataClear(&icc_profile)
   WebPDataClear(&assembled_data);
   WebPMuxDelete(mux);
-  fclose(out);
-  if(!res && exif) dt_exif_write_blob(exif, exif_len, filename, 1);
+  if(out) fclose(out);
   return res;
 }
 
@@ -439,7 +460,7 @@ void gui_reset(dt_imageio_module_format_t *self)
 int flags(dt_imageio_module_data_t *data)
 {
   // TODO(jinxos): support embedded ICC
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 // clang-format off
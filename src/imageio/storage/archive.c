@@ -0,0 +1,699 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/image.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/utility.h"
+#include "common/variables.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "dtgtk/button.h"
+#include "dtgtk/paint.h"
+#include "gui/gtk.h"
+#include "gui/gtkentry.h"
+#include "imageio/storage/imageio_storage_api.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+DT_MODULE(1)
+
+// the images are written one after the other into a single zip or tar file, as they are exported. the
+// format modules only know how to write to a file name, so each image goes to a memory backed file first
+// (a temporary file where the system has none) and is copied from there into the archive.
+
+#define ARCHIVE_COPY_CHUNK (1 << 20)
+#define ZIP_MAX32 0xFFFFFFFFu
+#define ZIP_MAX16 0xFFFFu
+
+typedef struct _archive_entry_t
+{
+  uint32_t crc;
+  uint64_t size;
+  uint64_t offset;
+  gchar *name;
+} _archive_entry_t;
+
+typedef struct _archive_t
+{
+  FILE *f;
+  gchar *path;
+  gboolean tar;      // else zip
+  gboolean failed;
+  uint64_t offset;   // bytes written so far
+  uint16_t dos_time, dos_date;
+  GArray *entries;   // _archive_entry_t, for the zip central directory
+  GHashTable *names; // to keep the names unique
+} _archive_t;
+
+// gui data
+typedef struct archive_t
+{
+  GtkEntry *entry;
+  GtkEntry *name_entry;
+} archive_t;
+
+// saved params
+typedef struct dt_imageio_archive_t
+{
+  char filename[DT_MAX_PATH_FOR_PARAMS]; // the archive, its extension picks tar or zip
+  char member[DT_MAX_PATH_FOR_PARAMS];   // name of the images in it
+  dt_variables_params_t *vp;
+  _archive_t *archive;                   // opened with the first image
+} dt_imageio_archive_t;
+
+
+const char *name(const struct dt_imageio_module_storage_t *self)
+{
+  return _("Archive on disk");
+}
+
+static void _put16(uint8_t *p, const uint16_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+static void _put32(uint8_t *p, const uint32_t v)
+{
+  _put16(p, v & 0xffff);
+  _put16(p + 2, v >> 16);
+}
+
+static void _put64(uint8_t *p, const uint64_t v)
+{
+  _put32(p, v & 0xffffffffu);
+  _put32(p + 4, v >> 32);
+}
+
+static void _archive_write(_archive_t *a, const void *data, const size_t size)
+{
+  if(a->failed || size == 0) return;
+  if(fwrite(data, 1, size, a->f) != size)
+    a->failed = TRUE;
+  else
+    a->offset += size;
+}
+
+static void _archive_pad(_archive_t *a)
+{
+  static const uint8_t zeros[512] = { 0 };
+  if(a->offset % 512) _archive_write(a, zeros, 512 - a->offset % 512);
+}
+
+static _archive_t *_archive_open(const char *path)
+{
+  FILE *f = g_fopen(path, "wb");
+  if(!f) return NULL;
+
+  _archive_t *a = g_new0(_archive_t, 1);
+  a->f = f;
+  a->path = g_strdup(path);
+  a->tar = g_str_has_suffix(path, ".tar") || g_str_has_suffix(path, ".TAR");
+  a->entries = g_array_new(FALSE, FALSE, sizeof(_archive_entry_t));
+  a->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  GDateTime *now = g_date_time_new_now_local();
+  a->dos_time = (g_date_time_get_hour(now) << 11) | (g_date_time_get_minute(now) << 5)
+                | (g_date_time_get_second(now) / 2);
+  a->dos_date = ((MAX(g_date_time_get_year(now), 1980) - 1980) << 9) | (g_date_time_get_month(now) << 5)
+                | g_date_time_get_day_of_month(now);
+  g_date_time_unref(now);
+  return a;
+}
+
+static void _tar_octal(char *field, const int len, const uint64_t v)
+{
+  // len - 1 octal digits and the terminating NUL, base-256 (GNU) when that does not fit
+  if(len < 24 && v >> (3 * (len - 1)))
+  {
+    uint64_t x = v;
+    for(int k = len - 1; k > 0; k--, x >>= 8) field[k] = x & 0xff;
+    field[0] = (char)0x80;
+  }
+  else
+    snprintf(field, len, "%0*" PRIo64, len - 1, v);
+}
+
+// the directory separator to split a long name on into the ustar prefix and name fields, NULL if none fits
+static const char *_tar_split(const char *name)
+{
+  const size_t len = strlen(name);
+  const char *split = NULL;
+  for(const char *c = strchr(name, '/'); c && !split; c = strchr(c + 1, '/'))
+    if(c - name <= 155 && len - (c - name) - 1 <= 100 && c[1]) split = c;
+  return split;
+}
+
+static void _tar_header(_archive_t *a, const char *name, const uint64_t size, const char type, const int64_t mtime)
+{
+  char h[512] = { 0 };
+  const size_t len = strlen(name);
+  if(len <= 100)
+    memcpy(h, name, len);
+  else
+  {
+    // the caller has written a long name record if it does not split, that one gets truncated
+    const char *split = _tar_split(name);
+    if(split)
+    {
+      memcpy(h + 345, name, split - name);
+      memcpy(h, split + 1, len - (split - name) - 1);
+    }
+    else
+      memcpy(h, name, 100);
+  }
+  _tar_octal(h + 100, 8, 0644);
+  _tar_octal(h + 108, 8, 0);
+  _tar_octal(h + 116, 8, 0);
+  _tar_octal(h + 124, 12, size);
+  _tar_octal(h + 136, 12, MAX(mtime, 0));
+  h[156] = type;
+  memcpy(h + 257, "ustar", 6);
+  memcpy(h + 263, "00", 2);
+
+  memset(h + 148, ' ', 8);
+  unsigned int sum = 0;
+  for(int k = 0; k < 512; k++) sum += (uint8_t)h[k];
+  snprintf(h + 148, 8, "%06o", sum);
+
+  _archive_write(a, h, sizeof(h));
+}
+
+static void _tar_begin(_archive_t *a, const char *name, const uint64_t size)
+{
+  const int64_t mtime = g_get_real_time() / G_USEC_PER_SEC;
+  const size_t len = strlen(name);
+  if(len > 100 && !_tar_split(name))
+  {
+    _tar_header(a, "././@LongLink", len + 1, 'L', mtime);
+    _archive_write(a, name, len + 1);
+    _archive_pad(a);
+  }
+  _tar_header(a, name, size, '0', mtime);
+}
+
+static void _zip_begin(_archive_t *a, const _archive_entry_t *e)
+{
+  const gboolean zip64 = e->size >= ZIP_MAX32;
+  const size_t len = strlen(e->name);
+  uint8_t h[30 + 20] = { 0 };
+  _put32(h, 0x04034b50);
+  _put16(h + 4, zip64 ? 45 : 20);
+  _put16(h + 6, 0x0800); // utf-8 names
+  _put16(h + 8, 0);      // stored, the images are compressed already
+  _put16(h + 10, a->dos_time);
+  _put16(h + 12, a->dos_date);
+  _put32(h + 14, e->crc);
+  _put32(h + 18, zip64 ? ZIP_MAX32 : e->size);
+  _put32(h + 22, zip64 ? ZIP_MAX32 : e->size);
+  _put16(h + 26, len);
+  _put16(h + 28, zip64 ? 20 : 0);
+  _archive_write(a, h, 30);
+  _archive_write(a, e->name, len);
+  if(zip64)
+  {
+    _put16(h + 30, 0x0001);
+    _put16(h + 32, 16);
+    _put64(h + 34, e->size);
+    _put64(h + 42, e->size);
+    _archive_write(a, h + 30, 20);
+  }
+}
+
+static void _zip_end(_archive_t *a)
+{
+  const uint64_t cd_offset = a->offset;
+  for(guint k = 0; k < a->entries->len; k++)
+  {
+    const _archive_entry_t *e = &g_array_index(a->entries, _archive_entry_t, k);
+    const gboolean big = e->size >= ZIP_MAX32, far = e->offset >= ZIP_MAX32;
+    const size_t len = strlen(e->name);
+    uint8_t h[46 + 28] = { 0 };
+    _put32(h, 0x02014b50);
+    _put16(h + 4, (3 << 8) | 45); // unix
+    _put16(h + 6, big || far ? 45 : 20);
+    _put16(h + 8, 0x0800);
+    _put16(h + 10, 0);
+    _put16(h + 12, a->dos_time);
+    _put16(h + 14, a->dos_date);
+    _put32(h + 16, e->crc);
+    _put32(h + 20, big ? ZIP_MAX32 : e->size);
+    _put32(h + 24, big ? ZIP_MAX32 : e->size);
+    _put16(h + 28, len);
+    _put32(h + 38, 0100644u << 16);
+    _put32(h + 42, far ? ZIP_MAX32 : e->offset);
+
+    // zip64 extra field with only the values that did not fit
+    size_t extra = 0;
+    if(big)
+    {
+      _put64(h + 46 + 4 + extra, e->size);
+      _put64(h + 46 + 4 + extra + 8, e->size);
+      extra += 16;
+    }
+    if(far)
+    {
+      _put64(h + 46 + 4 + extra, e->offset);
+      extra += 8;
+    }
+    if(extra)
+    {
+      _put16(h + 46, 0x0001);
+      _put16(h + 48, extra);
+      extra += 4;
+    }
+    _put16(h + 30, extra);
+    _archive_write(a, h, 46);
+    _archive_write(a, e->name, len);
+    _archive_write(a, h + 46, extra);
+  }
+  const uint64_t cd_size = a->offset - cd_offset;
+  const uint64_t count = a->entries->len;
+
+  uint8_t h[56 + 20 + 22] = { 0 };
+  size_t len = 0;
+  if(count >= ZIP_MAX16 || cd_size >= ZIP_MAX32 || cd_offset >= ZIP_MAX32)
+  {
+    // zip64 end of central directory record and its locator
+    const uint64_t eocd64 = a->offset;
+    _put32(h, 0x06064b50);
+    _put64(h + 4, 44);
+    _put16(h + 12, (3 << 8) | 45);
+    _put16(h + 14, 45);
+    _put64(h + 24, count);
+    _put64(h + 32, count);
+    _put64(h + 40, cd_size);
+    _put64(h + 48, cd_offset);
+    _put32(h + 56, 0x07064b50);
+    _put64(h + 64, eocd64);
+    _put32(h + 72, 1);
+    len = 76;
+  }
+  _put32(h + len, 0x06054b50);
+  _put16(h + len + 8, MIN(count, ZIP_MAX16));
+  _put16(h + len + 10, MIN(count, ZIP_MAX16));
+  _put32(h + len + 12, MIN(cd_size, ZIP_MAX32));
+  _put32(h + len + 16, MIN(cd_offset, ZIP_MAX32));
+  _archive_write(a, h, len + 22);
+}
+
+// append the file behind fd to the archive
+static gboolean _archive_add(_archive_t *a, const char *name, const int fd)
+{
+  const int64_t end = lseek(fd, 0, SEEK_END);
+  if(end < 0) return FALSE;
+
+  uint8_t *buf = g_malloc(ARCHIVE_COPY_CHUNK);
+  _archive_entry_t e = { .size = end, .offset = a->offset, .name = g_strdup(name) };
+
+  // the zip local header comes with the crc, that is one more pass over data in memory
+  if(!a->tar)
+  {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    lseek(fd, 0, SEEK_SET);
+    ssize_t n;
+    while((n = read(fd, buf, ARCHIVE_COPY_CHUNK)) > 0) crc = crc32(crc, buf, n);
+    e.crc = crc;
+    _zip_begin(a, &e);
+  }
+  else
+    _tar_begin(a, name, e.size);
+
+  lseek(fd, 0, SEEK_SET);
+  uint64_t copied = 0;
+  ssize_t n;
+  while(!a->failed && (n = read(fd, buf, ARCHIVE_COPY_CHUNK)) > 0)
+  {
+    _archive_write(a, buf, n);
+    copied += n;
+  }
+  g_free(buf);
+  if(copied != e.size) a->failed = TRUE;
+
+  if(a->tar) _archive_pad(a);
+  if(a->failed)
+  {
+    g_free(e.name);
+    return FALSE;
+  }
+  g_array_append_val(a->entries, e);
+  return TRUE;
+}
+
+static gboolean _archive_close(_archive_t *a)
+{
+  if(a->tar)
+  {
+    static const uint8_t zeros[1024] = { 0 };
+    _archive_write(a, zeros, sizeof(zeros));
+  }
+  else
+    _zip_end(a);
+
+  if(fclose(a->f)) a->failed = TRUE;
+  const gboolean ok = !a->failed;
+  for(guint k = 0; k < a->entries->len; k++) g_free(g_array_index(a->entries, _archive_entry_t, k).name);
+  g_array_free(a->entries, TRUE);
+  g_hash_table_destroy(a->names);
+  g_free(a->path);
+  g_free(a);
+  return ok;
+}
+
+// a file to have the format module write the image into, returns its fd and fills the name to give it
+static int _scratch_open(char *filename, const size_t size, gchar **tmpname)
+{
+  *tmpname = NULL;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  const int fd = memfd_create("ansel-archive", MFD_CLOEXEC);
+  if(fd >= 0)
+  {
+    snprintf(filename, size, "/proc/self/fd/%d", fd);
+    return fd;
+  }
+#endif
+  const int tfd = g_file_open_tmp("ansel_archive_XXXXXX", tmpname, NULL);
+  if(tfd >= 0) g_strlcpy(filename, *tmpname, size);
+  return tfd;
+}
+
+static void _scratch_close(const int fd, gchar *tmpname)
+{
+  close(fd);
+  if(tmpname) g_unlink(tmpname);
+  g_free(tmpname);
+}
+
+static void button_clicked(GtkWidget *widget, dt_imageio_module_storage_t *self)
+{
+  archive_t *d = (archive_t *)self->gui_data;
+  GtkWidget *win = dt_ui_main_window(darktable.gui->ui);
+  GtkFileChooserNative *filechooser = gtk_file_chooser_native_new(
+        _("select archive"), GTK_WINDOW(win), GTK_FILE_CHOOSER_ACTION_SAVE,
+        _("_select as output destination"), _("_cancel"));
+
+  gchar *old = g_strdup(gtk_entry_get_text(d->entry));
+  char *c = g_strstr_len(old, -1, "$");
+  if(c) *c = '\0';
+  gchar *dir = g_path_get_dirname(old);
+  gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(filechooser), dir);
+  g_free(dir);
+  g_free(old);
+  if(gtk_native_dialog_run(GTK_NATIVE_DIALOG(filechooser)) == GTK_RESPONSE_ACCEPT)
+  {
+    gchar *file = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(filechooser));
+    // same escaping of '\' as the disk storage, for the variable substitution
+    gchar *escaped = dt_util_str_replace(file, "\\", "\\\\");
+    gtk_entry_set_text(GTK_ENTRY(d->entry), escaped); // the signal handler will write this to conf
+    gtk_editable_set_position(GTK_EDITABLE(d->entry), strlen(escaped));
+    g_free(file);
+    g_free(escaped);
+  }
+  g_object_unref(filechooser);
+}
+
+static void entry_changed_callback(GtkEntry *entry, gpointer user_data)
+{
+  dt_conf_set_string("plugins/imageio/storage/archive/file", gtk_entry_get_text(entry));
+}
+
+static void name_changed_callback(GtkEntry *entry, gpointer user_data)
+{
+  dt_conf_set_string("plugins/imageio/storage/archive/name", gtk_entry_get_text(entry));
+}
+
+void gui_init(dt_imageio_module_storage_t *self)
+{
+  archive_t *d = (archive_t *)malloc(sizeof(archive_t));
+  self->gui_data = (void *)d;
+  self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+  GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
+  GtkWidget *widget;
+
+  widget = gtk_entry_new();
+  gtk_entry_set_width_chars(GTK_ENTRY(widget), 0);
+  gtk_box_pack_start(GTK_BOX(hbox), widget, TRUE, TRUE, 0);
+  const char *text = dt_conf_get_string_const("plugins/imageio/storage/archive/file");
+  if(text)
+  {
+    gtk_entry_set_text(GTK_ENTRY(widget), text);
+    gtk_editable_set_position(GTK_EDITABLE(widget), strlen(text));
+  }
+  d->entry = GTK_ENTRY(widget);
+
+  dt_gtkentry_setup_completion(GTK_ENTRY(widget), dt_gtkentry_get_default_path_compl_list());
+
+  gtk_widget_set_tooltip_text(widget,
+      _("enter the path of the archive, ending in .zip or .tar\nvariables support bash like string manipulation\n"
+        "type '$(' to activate the completion and see the list of variables"));
+  g_signal_connect(G_OBJECT(widget), "changed", G_CALLBACK(entry_changed_callback), self);
+
+  widget = dtgtk_button_new(dtgtk_cairo_paint_directory, CPF_NONE, NULL);
+  gtk_widget_set_name(widget, "non-flat");
+  gtk_widget_set_tooltip_text(widget, _("select archive"));
+  gtk_box_pack_start(GTK_BOX(hbox), widget, FALSE, FALSE, 0);
+  g_signal_connect(G_OBJECT(widget), "clicked", G_CALLBACK(button_clicked), self);
+
+  hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+  gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), dt_ui_label_new(_("name")), FALSE, FALSE, 0);
+  d->name_entry = GTK_ENTRY(gtk_entry_new());
+  gtk_entry_set_width_chars(d->name_entry, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), GTK_WIDGET(d->name_entry), TRUE, TRUE, 0);
+  dt_gtkentry_setup_completion(d->name_entry, dt_gtkentry_get_default_path_compl_list());
+  gtk_widget_set_tooltip_text(GTK_WIDGET(d->name_entry),
+                              _("enter the name of the images in the archive, '/' makes folders"));
+  text = dt_conf_get_string_const("plugins/imageio/storage/archive/name");
+  if(text) gtk_entry_set_text(d->name_entry, text);
+  g_signal_connect(G_OBJECT(d->name_entry), "changed", G_CALLBACK(name_changed_callback), self);
+}
+
+void gui_cleanup(dt_imageio_module_storage_t *self)
+{
+  free(self->gui_data);
+}
+
+void gui_reset(dt_imageio_module_storage_t *self)
+{
+  archive_t *d = (archive_t *)self->gui_data;
+  gtk_entry_set_text(d->entry, dt_confgen_get("plugins/imageio/storage/archive/file", DT_DEFAULT));
+  gtk_entry_set_text(d->name_entry, dt_confgen_get("plugins/imageio/storage/archive/name", DT_DEFAULT));
+  dt_conf_set_string("plugins/imageio/storage/archive/file", gtk_entry_get_text(d->entry));
+  dt_conf_set_string("plugins/imageio/storage/archive/name", gtk_entry_get_text(d->name_entry));
+}
+
+gboolean supported(struct dt_imageio_module_storage_t *self, struct dt_imageio_module_format_t *format)
+{
+  // formats writing their file only at the end have nothing to put in the archive per image
+  return !(format->flags(NULL) & FORMAT_FLAGS_NO_TMPFILE);
+}
+
+// name of the image in the archive, unique in it
+static gchar *_member_name(dt_imageio_archive_t *d, const char *ext)
+{
+  gchar *expanded = dt_variables_expand(d->vp, d->member, TRUE);
+  gchar *name = dt_util_str_replace(expanded, "\\", "/");
+  g_free(expanded);
+
+  // no absolute nor parent paths in there
+  const char *start = name;
+  while(*start == '/' || g_str_has_prefix(start, "../")) start += (*start == '/') ? 1 : 3;
+  if(!*start) start = "image";
+
+  gchar *result = g_strdup_printf("%s.%s", start, ext);
+  for(int seq = 1; g_hash_table_contains(d->archive->names, result); seq++)
+  {
+    g_free(result);
+    result = g_strdup_printf("%s_%.2d.%s", start, seq, ext);
+  }
+  g_free(name);
+  g_hash_table_add(d->archive->names, g_strdup(result));
+  return result;
+}
+
+int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const int imgid,
+          dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total,
+          const gboolean high_quality, const gboolean export_masks,
+          dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename, dt_iop_color_intent_t icc_intent,
+          dt_export_metadata_t *metadata)
+{
+  dt_imageio_archive_t *d = (dt_imageio_archive_t *)sdata;
+
+  char input_dir[PATH_MAX] = { 0 };
+  gboolean from_cache = FALSE;
+  dt_image_full_path(imgid, input_dir, sizeof(input_dir), &from_cache, __FUNCTION__);
+  dt_variables_set_max_width_height(d->vp, fdata->max_width, fdata->max_height);
+
+  gchar *member = NULL;
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  {
+    d->vp->filename = input_dir;
+    d->vp->jobcode = "export";
+    d->vp->imgid = imgid;
+    d->vp->sequence = num;
+
+    if(!d->archive)
+    {
+      // the path of the archive is expanded once, with the first image
+      gchar *fixed_path = dt_util_fix_path(d->filename);
+      gchar *path = dt_variables_expand(d->vp, fixed_path, TRUE);
+      g_free(fixed_path);
+      gchar *output_dir = g_path_get_dirname(path);
+      if(g_mkdir_with_parents(output_dir, 0755) == 0) d->archive = _archive_open(path);
+      if(!d->archive)
+      {
+        fprintf(stderr, "[imageio_storage_archive] could not create archive: `%s'!\n", path);
+        dt_control_log(_("could not create archive `%s'!"), path);
+      }
+      g_free(output_dir);
+      g_free(path);
+    }
+    if(d->archive && !d->archive->failed) member = _member_name(d, format->extension(fdata));
+  }
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  if(!member) return 1;
+
+  char filename[PATH_MAX] = { 0 };
+  gchar *tmpname = NULL;
+  const int fd = _scratch_open(filename, sizeof(filename), &tmpname);
+  if(fd < 0)
+  {
+    g_free(member);
+    return 1;
+  }
+
+  if(dt_imageio_export(imgid, filename, format, fdata, high_quality, TRUE, export_masks, icc_type,
+                       icc_filename, icc_intent, self, sdata, num, total, metadata) != 0)
+  {
+    fprintf(stderr, "[imageio_storage_archive] could not export `%s'!\n", member);
+    dt_control_log(_("could not export `%s'!"), member);
+    _scratch_close(fd, tmpname);
+    g_free(member);
+    return 1;
+  }
+
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  const gboolean added = _archive_add(d->archive, member, fd);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  _scratch_close(fd, tmpname);
+
+  if(!added)
+  {
+    fprintf(stderr, "[imageio_storage_archive] could not write to archive: `%s'!\n", d->archive->path);
+    dt_control_log(_("could not write to archive `%s'!"), d->archive->path);
+    g_free(member);
+    return 1;
+  }
+
+  fprintf(stderr, "[export_job] exported `%s' to `%s'\n", member, d->archive->path);
+  dt_control_log(ngettext("%d/%d exported to `%s'", "%d/%d exported to `%s'", num), num, total, member);
+  g_free(member);
+  return 0;
+}
+
+void finalize_store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data)
+{
+  dt_imageio_archive_t *d = (dt_imageio_archive_t *)data;
+  if(!d->archive) return;
+
+  gchar *path = g_strdup(d->archive->path);
+  if(!_archive_close(d->archive))
+  {
+    fprintf(stderr, "[imageio_storage_archive] could not write to archive: `%s'!\n", path);
+    dt_control_log(_("could not write to archive `%s'!"), path);
+  }
+  d->archive = NULL;
+  g_free(path);
+}
+
+size_t params_size(dt_imageio_module_storage_t *self)
+{
+  return sizeof(dt_imageio_archive_t) - 2 * sizeof(void *);
+}
+
+void init(dt_imageio_module_storage_t *self)
+{
+#ifdef USE_LUA
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_archive_t, filename,
+                                char_path_length);
+  dt_lua_register_module_member(darktable.lua_state.state, self, dt_imageio_archive_t, member,
+                                char_path_length);
+#endif
+}
+
+void *get_params(dt_imageio_module_storage_t *self)
+{
+  dt_imageio_archive_t *d = (dt_imageio_archive_t *)calloc(1, sizeof(dt_imageio_archive_t));
+
+  const char *text = dt_conf_get_string_const("plugins/imageio/storage/archive/file");
+  g_strlcpy(d->filename, text, sizeof(d->filename));
+
+  text = dt_conf_get_string_const("plugins/imageio/storage/archive/name");
+  g_strlcpy(d->member, text, sizeof(d->member));
+
+  d->vp = NULL;
+  d->archive = NULL;
+  dt_variables_params_init(&d->vp);
+
+  return d;
+}
+
+void free_params(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *params)
+{
+  if(!params) return;
+  dt_imageio_archive_t *d = (dt_imageio_archive_t *)params;
+  // export cancelled before finalize_store(): still leave a readable archive
+  if(d->archive) _archive_close(d->archive);
+  dt_variables_params_destroy(d->vp);
+  free(params);
+}
+
+int set_params(dt_imageio_module_storage_t *self, const void *params, const int size)
+{
+  dt_imageio_archive_t *d = (dt_imageio_archive_t *)params;
+  archive_t *g = (archive_t *)self->gui_data;
+
+  if(size != self->params_size(self)) return 1;
+
+  gtk_entry_set_text(GTK_ENTRY(g->entry), d->filename);
+  gtk_editable_set_position(GTK_EDITABLE(g->entry), strlen(d->filename));
+  gtk_entry_set_text(g->name_entry, d->member);
+  return 0;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
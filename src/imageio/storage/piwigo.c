@@ -45,6 +45,11 @@ DT_MODULE(1)
 
 #define MAX_ALBUM_NAME_SIZE 100
 
+// uploads running at the same time, multiplexed over one connection where the server speaks http/2
+#define PIWIGO_CONCURRENT_UPLOADS 3
+// tries of an upload before giving up, waiting 1s, 2s, 4s... in between
+#define PIWIGO_UPLOAD_ATTEMPTS 4
+
 typedef struct _piwigo_api_context_t
 {
   /// curl context
@@ -100,6 +105,29 @@ typedef struct _curl_args_t
   char value[512];
 } _curl_args_t;
 
+/** an exported file waiting for, or in, its upload */
+typedef struct _piwigo_upload_t
+{
+  gchar *filename;
+  GList *args;
+  int num, total;
+  int attempts;
+  gint64 retry_at;
+  CURL *curl;
+  curl_mime *form;
+  GString *response;
+} _piwigo_upload_t;
+
+/** uploads the exported files in the background while the next images are processed */
+typedef struct _piwigo_uploader_t
+{
+  GThread *thread;
+  GAsyncQueue *queue;
+  gchar *url;
+  struct curl_slist *cookies; // of the session the export logged in with
+  gint failed;
+} _piwigo_uploader_t;
+
 typedef struct dt_storage_piwigo_params_t
 {
   _piwigo_api_context_t *api;
@@ -110,6 +138,7 @@ typedef struct dt_storage_piwigo_params_t
   int privacy;
   gboolean export_tags; // deprecated - let here not to change params size. to be removed on next version change
   gchar *tags;
+  _piwigo_uploader_t *uploader;
 } dt_storage_piwigo_params_t;
 
 /* low-level routine doing the HTTP POST request */
@@ -705,8 +734,189 @@ static gboolean _piwigo_api_create_new_album(dt_storage_piwigo_params_t *p)
   return TRUE;
 }
 
-static gboolean _piwigo_api_upload_photo(dt_storage_piwigo_params_t *p, gchar *fname,
-                                         gchar *author, gchar *caption, gchar *description)
+// pushed to the queue to have the uploader finish
+static char _piwigo_upload_end;
+
+static void _piwigo_upload_free(_piwigo_upload_t *u)
+{
+  g_unlink(u->filename);
+  g_free(u->filename);
+  g_list_free_full(u->args, free);
+  if(u->response) g_string_free(u->response, TRUE);
+  g_free(u);
+}
+
+static void _piwigo_upload_start(_piwigo_uploader_t *up, CURLM *multi, _piwigo_upload_t *u)
+{
+  u->curl = curl_easy_init();
+  dt_curl_init(u->curl, piwigo_EXTRA_VERBOSE);
+  g_string_truncate(u->response, 0);
+
+  curl_easy_setopt(u->curl, CURLOPT_URL, up->url);
+  curl_easy_setopt(u->curl, CURLOPT_POST, 1);
+  curl_easy_setopt(u->curl, CURLOPT_WRITEFUNCTION, curl_write_data_cb);
+  curl_easy_setopt(u->curl, CURLOPT_WRITEDATA, u->response);
+  curl_easy_setopt(u->curl, CURLOPT_PRIVATE, u);
+  // wait for the connection to multiplex on rather than opening one per upload
+  curl_easy_setopt(u->curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(u->curl, CURLOPT_PIPEWAIT, 1L);
+  curl_easy_setopt(u->curl, CURLOPT_COOKIEFILE, "");
+  for(const struct curl_slist *c = up->cookies; c; c = c->next)
+    curl_easy_setopt(u->curl, CURLOPT_COOKIELIST, c->data);
+
+  u->form = curl_mime_init(u->curl);
+  for(const GList *a = u->args; a; a = g_list_next(a))
+  {
+    _curl_args_t *ca = (_curl_args_t *)a->data;
+    curl_mimepart *field = curl_mime_addpart(u->form);
+    curl_mime_name(field, ca->name);
+    curl_mime_data(field, ca->value, CURL_ZERO_TERMINATED);
+  }
+  curl_mimepart *field = curl_mime_addpart(u->form);
+  curl_mime_name(field, "image");
+  curl_mime_filedata(field, u->filename);
+  curl_easy_setopt(u->curl, CURLOPT_MIMEPOST, u->form);
+
+  u->attempts++;
+  curl_multi_add_handle(multi, u->curl);
+}
+
+static gboolean _piwigo_upload_done(CURLM *multi, _piwigo_upload_t *u, const CURLcode res)
+{
+  long http_code = 0;
+  curl_easy_getinfo(u->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  curl_multi_remove_handle(multi, u->curl);
+  curl_easy_cleanup(u->curl);
+  curl_mime_free(u->form);
+  u->curl = NULL;
+  u->form = NULL;
+
+  if(res != CURLE_OK || http_code >= 400) return FALSE;
+
+  gboolean ok = FALSE;
+  JsonParser *parser = json_parser_new();
+  if(json_parser_load_from_data(parser, u->response->str, u->response->len, NULL))
+  {
+    JsonNode *root = json_parser_get_root(parser);
+    if(json_node_get_node_type(root) == JSON_NODE_OBJECT)
+    {
+      const char *status = json_object_get_string_member(json_node_get_object(root), "stat");
+      ok = !(status && strcmp(status, "fail") == 0);
+    }
+  }
+  g_object_unref(parser);
+  return ok;
+}
+
+static gpointer _piwigo_uploader_run(gpointer data)
+{
+  _piwigo_uploader_t *up = (_piwigo_uploader_t *)data;
+  CURLM *multi = curl_multi_init();
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+  GList *waiting = NULL; // failed uploads waiting for their next try
+  int active = 0;
+  gboolean closing = FALSE;
+
+  while(!closing || active || waiting)
+  {
+    // take new files while there is room, block when there is nothing else to do
+    while(!closing && active + g_list_length(waiting) < PIWIGO_CONCURRENT_UPLOADS)
+    {
+      gpointer item = (active || waiting) ? g_async_queue_try_pop(up->queue) : g_async_queue_pop(up->queue);
+      if(!item) break;
+      if(item == &_piwigo_upload_end)
+      {
+        closing = TRUE;
+        break;
+      }
+      _piwigo_upload_start(up, multi, (_piwigo_upload_t *)item);
+      active++;
+    }
+
+    const gint64 now = g_get_monotonic_time();
+    for(GList *l = waiting; l;)
+    {
+      GList *next = g_list_next(l);
+      _piwigo_upload_t *u = (_piwigo_upload_t *)l->data;
+      if(u->retry_at <= now)
+      {
+        waiting = g_list_delete_link(waiting, l);
+        _piwigo_upload_start(up, multi, u);
+        active++;
+      }
+      l = next;
+    }
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int left = 0;
+    while((msg = curl_multi_info_read(multi, &left)))
+    {
+      if(msg->msg != CURLMSG_DONE) continue;
+      _piwigo_upload_t *u = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&u);
+      active--;
+      if(_piwigo_upload_done(multi, u, msg->data.result))
+      {
+        dt_control_log(ngettext("%d/%d exported to piwigo webalbum", "%d/%d exported to piwigo webalbum", u->num),
+                       u->num, u->total);
+        _piwigo_upload_free(u);
+      }
+      else if(u->attempts < PIWIGO_UPLOAD_ATTEMPTS)
+      {
+        u->retry_at = g_get_monotonic_time() + (G_USEC_PER_SEC << (u->attempts - 1));
+        waiting = g_list_append(waiting, u);
+      }
+      else
+      {
+        fprintf(stderr, "[imageio_storage_piwigo] could not upload to piwigo!\n");
+        dt_control_log(_("could not upload to piwigo!"));
+        g_atomic_int_inc(&up->failed);
+        _piwigo_upload_free(u);
+      }
+    }
+
+    if(active)
+      curl_multi_wait(multi, NULL, 0, 100, NULL);
+    else if(waiting)
+      g_usleep(100000);
+  }
+
+  curl_multi_cleanup(multi);
+  return NULL;
+}
+
+static _piwigo_uploader_t *_piwigo_uploader_new(_piwigo_api_context_t *api)
+{
+  _piwigo_uploader_t *up = g_new0(_piwigo_uploader_t, 1);
+  up->queue = g_async_queue_new();
+  up->url = g_strdup(api->url);
+  curl_easy_getinfo(api->curl_ctx, CURLINFO_COOKIELIST, &up->cookies);
+  up->thread = g_thread_new("piwigo upload", _piwigo_uploader_run, up);
+  return up;
+}
+
+// wait for the queued uploads, returns the number of failed ones
+static int _piwigo_uploader_finish(_piwigo_uploader_t **up)
+{
+  if(!*up) return 0;
+  g_async_queue_push((*up)->queue, &_piwigo_upload_end);
+  g_thread_join((*up)->thread);
+  const int failed = (*up)->failed;
+  g_async_queue_unref((*up)->queue);
+  curl_slist_free_all((*up)->cookies);
+  g_free((*up)->url);
+  g_free(*up);
+  *up = NULL;
+  return failed;
+}
+
+static void _piwigo_api_upload_photo(dt_storage_piwigo_params_t *p, gchar *fname,
+                                     gchar *author, gchar *caption, gchar *description, const int num,
+                                     const int total)
 {
   GList *args = NULL;
   char cat[10];
@@ -734,11 +944,15 @@ static gboolean _piwigo_api_upload_photo(dt_storage_piwigo_params_t *p, gchar *f
   if(p->tags && strlen(p->tags)>0)
     args = _piwigo_query_add_arguments(args, "tags", p->tags);
 
-  _piwigo_api_post(p->api, args, fname, FALSE);
+  if(!p->uploader) p->uploader = _piwigo_uploader_new(p->api);
 
-  g_list_free(args);
-
-  return !p->api->error_occured;
+  _piwigo_upload_t *u = g_new0(_piwigo_upload_t, 1);
+  u->filename = g_strdup(fname);
+  u->args = args;
+  u->num = num;
+  u->total = total;
+  u->response = g_string_new("");
+  g_async_queue_push(p->uploader->queue, u);
 }
 
 // Login button pressed...
@@ -944,6 +1158,8 @@ static gboolean _finalize_store(gpointer user_data)
 
 void finalize_store(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data)
 {
+  dt_storage_piwigo_params_t *p = (dt_storage_piwigo_params_t *)data;
+  if(p) _piwigo_uploader_finish(&p->uploader);
   g_main_context_invoke(NULL, _finalize_store, self->gui_data);
 }
 
@@ -956,6 +1172,7 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   dt_storage_piwigo_gui_data_t *ui = self->gui_data;
 
   gint result = 0;
+  gboolean queued = FALSE;
 
   const char *ext = format->extension(fdata);
 
@@ -1040,20 +1257,18 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
 
     if(status)
     {
-      status = _piwigo_api_upload_photo(p, fname, author, caption, description);
-      if(!status)
-      {
-        fprintf(stderr, "[imageio_storage_piwigo] could not upload to piwigo!\n");
-        dt_control_log(_("could not upload to piwigo!"));
-        result = 1;
-      }
-      else if(p->new_album)
+      // the uploader takes the file from here, and removes it once uploaded
+      _piwigo_api_upload_photo(p, fname, author, caption, description, num, total);
+      queued = TRUE;
+      if(p->new_album)
       {
         // we do not want to create more albums when multiple upload
         p->new_album = FALSE;
         _piwigo_refresh_albums(ui, p->album);
       }
     }
+    else
+      result = 1;
     if(p->tags)
     {
       g_free(p->tags);
@@ -1065,17 +1280,11 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
 cleanup:
 
   // And remove from filesystem..
-  g_unlink(fname);
+  if(!queued) g_unlink(fname);
   g_free(caption);
   g_free(description);
   g_free(author);
 
-  if(!result)
-  {
-    // this makes sense only if the export was successful
-    dt_control_log(ngettext("%d/%d exported to piwigo webalbum", "%d/%d exported to piwigo webalbum", num),
-                   num, total);
-  }
   return result;
 }
 
@@ -1217,6 +1426,7 @@ void free_params(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *pa
 
   if(p)
   {
+    _piwigo_uploader_finish(&p->uploader);
     g_free(p->album);
     g_free(p->tags);
     _piwigo_ctx_destroy(&p->api);
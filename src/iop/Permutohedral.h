@@ -37,11 +37,13 @@ DAMAGE.
 
 #include <algorithm>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <iostream>
+#include <vector>
 
 /*******************************************************************
  * Hash table implementation for permutohedral lattice             *
@@ -346,7 +348,9 @@ public:
    *    vd_ : dimensionality of value vectors
    * nData_ : number of points in the input
    */
-  PermutohedralLattice(size_t nData_, int nThreads_ = 1) : nData(nData_), nThreads(nThreads_)
+  PermutohedralLattice(size_t nData_, int nThreads_ = 1)
+    : nData(nData_), nThreads(nThreads_), shards(nullptr), nShards(0), shardBase(nullptr), keys(nullptr),
+      values(nullptr), nVertices(0)
   {
     // Allocate storage for various arrays
     float *scaleFactorTmp = new float[D];
@@ -396,7 +400,15 @@ public:
     delete[] scaleFactor;
     delete[] replay;
     delete[] canonical;
+    // with a single thread, the lattice is the splat table itself
+    if(shards != hashTables)
+    {
+      delete[] shards;
+      delete[] keys;
+      delete[] values;
+    }
     delete[] hashTables;
+    delete[] shardBase;
   }
 
   PermutohedralLattice &operator=(const PermutohedralLattice &) = delete;
@@ -508,53 +520,116 @@ public:
     }
   }
 
-  /* Merge the multiple threads' hash tables into the totals. */
+  /* Merge the multiple threads' hash tables into the totals.
+   *
+   * The lattice points are dealt into as many shards as there are threads, by their hash. Each shard is
+   * filled from all the thread tables by a single thread, so the merge runs in parallel without any
+   * locking, and the shards are then laid end to end to index the vertices of the whole lattice.
+   */
   void merge_splat_threads()
   {
-    if(nThreads <= 1) return;
-
-    /* Because growing the hash table is expensive, we want to avoid having to do it multiple times.
-     * Only a small percentage of entries in the individual hash tables have the same key, so we
-     * won't waste much space if we simply grow the destination table enough to hold the sum of the
-     * entries in the individual tables
-     */
-    size_t total_entries = hashTables[0].size();
-    for(int i = 1; i < nThreads; i++) total_entries += hashTables[i].size();
-    int order = 0;
-    while(total_entries > hashTables[0].maxFill())
-    {
-      order++;
-      total_entries /= 2;
-    }
-    if(order > 0) hashTables[0].grow(order);
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
+    if(nThreads <= 1)
+    {
+      shards = hashTables;
+      nShards = 1;
+      shardBase = new size_t[2];
+      shardBase[0] = 0;
+      shardBase[1] = nVertices = hashTables[0].size();
+      keys = hashTables[0].getKeys();
+      values = hashTables[0].getValues();
+      return;
+    }
+
+    nShards = nThreads;
+    shards = new HashTable[nShards];
+    shardBase = new size_t[nShards + 1];
+
+    // sort the entries of each thread table by destination shard
+    std::vector<int> *dealt = new std::vector<int>[nThreads * nShards];
     int **offset_remap = new int *[nThreads];
-    for(int i = 1; i < nThreads; i++)
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int t = 0; t < nThreads; t++)
     {
-      const Key *oldKeys = hashTables[i].getKeys();
-      const Value *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
-      for(int j = 0; j < filled; j++)
+      const Key *oldKeys = hashTables[t].getKeys();
+      const int filled = hashTables[t].size();
+      offset_remap[t] = new int[filled];
+      for(int j = 0; j < filled; j++) dealt[t * nShards + shardOf(oldKeys[j])].push_back(j);
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for(int s = 0; s < nShards; s++)
+    {
+      /* Because growing the hash table is expensive, we want to avoid having to do it multiple times.
+       * Only a small percentage of entries in the individual hash tables have the same key, so we
+       * won't waste much space if we simply grow the shard enough to hold the sum of its entries
+       */
+      size_t total_entries = 0;
+      for(int t = 0; t < nThreads; t++) total_entries += dealt[t * nShards + s].size();
+      int order = 0;
+      while(total_entries > shards[s].maxFill())
+      {
+        order++;
+        total_entries /= 2;
+      }
+      if(order > 0) shards[s].grow(order);
+
+      for(int t = 0; t < nThreads; t++)
       {
-        Value *val = hashTables[0].lookup(oldKeys[j], true);
-        val->add(oldVals[j]);
-        offset_remap[i][j] = val - hashTables[0].getValues();
+        const Key *oldKeys = hashTables[t].getKeys();
+        const Value *oldVals = hashTables[t].getValues();
+        for(const int j : dealt[t * nShards + s])
+        {
+          const int offset = shards[s].lookupOffset(oldKeys[j], true);
+          shards[s].getValues()[offset].add(oldVals[j]);
+          offset_remap[t][j] = offset;
+        }
       }
     }
 
+    shardBase[0] = 0;
+    for(int s = 0; s < nShards; s++) shardBase[s + 1] = shardBase[s] + shards[s].size();
+    nVertices = shardBase[nShards];
+
+    // shard offsets to lattice offsets
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int t = 0; t < nThreads; t++)
+      for(int s = 0; s < nShards; s++)
+        for(const int j : dealt[t * nShards + s]) offset_remap[t][j] += shardBase[s];
+
     /* Rewrite the offsets in the replay structure from the above generated table. */
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
     for(int i = 0; i < nData; i++)
     {
-      if(replay[i].table > 0)
-      {
-        for(int dim = 0; dim <= D; dim++)
-          replay[i].offset[dim] = offset_remap[replay[i].table][replay[i].offset[dim]];
-      }
+      for(int dim = 0; dim <= D; dim++)
+        replay[i].offset[dim] = offset_remap[replay[i].table][replay[i].offset[dim]];
     }
 
-    for(int i = 1; i < nThreads; i++) delete[] offset_remap[i];
+    for(int t = 0; t < nThreads; t++) delete[] offset_remap[t];
     delete[] offset_remap;
+    delete[] dealt;
+    // the splat tables are not needed anymore, make room for the lattice
+    delete[] hashTables;
+    hashTables = nullptr;
+
+    Key *latticeKeys = new Key[nVertices];
+    values = new Value[nVertices];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int s = 0; s < nShards; s++)
+    {
+      std::copy(shards[s].getKeys(), shards[s].getKeys() + shards[s].size(), latticeKeys + shardBase[s]);
+      std::copy(shards[s].getValues(), shards[s].getValues() + shards[s].size(), values + shardBase[s]);
+    }
+    keys = latticeKeys;
   }
 
   /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
@@ -563,12 +638,11 @@ public:
    */
   void slice(float *col, size_t replay_index) const
   {
-    const Value *base = hashTables[0].getValues();
     Value::clear(col);
     ReplayEntry &r = replay[replay_index];
     for(int i = 0; i <= D; i++)
     {
-      base[r.offset[i]].addTo(col, r.weight[i]);
+      values[r.offset[i]].addTo(col, r.weight[i]);
     }
   }
 
@@ -576,11 +650,10 @@ public:
   void blur() const
   {
     // Prepare arrays
-    Value *newValue = new Value[hashTables[0].size()];
-    Value *oldValue = hashTables[0].getValues();
-    const Value *hashTableBase = oldValue;
-    const Key *keyBase = hashTables[0].getKeys();
+    Value *newValue = new Value[nVertices];
+    Value *oldValue = values;
     const Value zero{ 0 };
+    const int n = nVertices;
 
     // For each of d+1 axes,
     for(int j = 0; j <= D; j++)
@@ -589,20 +662,20 @@ public:
 #pragma omp parallel for shared(j, oldValue, newValue)
 #endif
       // For each vertex in the lattice,
-      for(int i = 0; i < hashTables[0].size(); i++) // blur point i in dimension j
+      for(int i = 0; i < n; i++) // blur point i in dimension j
       {
-        const Key &key = keyBase[i]; // keys to current vertex
+        const Key &key = keys[i]; // keys to current vertex
         // construct keys to the neighbors along the given axis.
         Key neighbor1(key, j, +1);
         Key neighbor2(key, j, -1);
 
         const Value *oldVal = oldValue + i;
 
-        const Value *vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        vm1 = vm1 ? vm1 - hashTableBase + oldValue : &zero;
+        const int offset1 = lookupVertex(neighbor1); // look up first neighbor
+        const Value *vm1 = offset1 < 0 ? &zero : oldValue + offset1;
 
-        const Value *vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        vp1 = vp1 ? vp1 - hashTableBase + oldValue : &zero;
+        const int offset2 = lookupVertex(neighbor2); // look up second neighbor
+        const Value *vp1 = offset2 < 0 ? &zero : oldValue + offset2;
 
         // Mix values of the three vertices
         newValue[i].mix(vm1, oldVal, vp1);
@@ -612,9 +685,9 @@ public:
     }
 
     // depending where we ended up, we may have to copy data
-    if(oldValue != hashTableBase)
+    if(oldValue != values)
     {
-      std::copy(oldValue, oldValue + hashTables[0].size(), hashTables[0].getValues());
+      std::copy(oldValue, oldValue + nVertices, values);
       delete[] oldValue;
     }
     else
@@ -640,6 +713,29 @@ private:
   } * replay;
 
   HashTable *hashTables;
+
+  // the merged lattice, see merge_splat_threads()
+  HashTable *shards;
+  int nShards;
+  size_t *shardBase;
+  const Key *keys;
+  Value *values;
+  size_t nVertices;
+
+  // the shard of a lattice point. the hash tables index their buckets with the low bits of the hash,
+  // scramble it and take the high bits so that every shard still uses all of its buckets
+  int shardOf(const Key &key) const
+  {
+    return (int)(((uint64_t)(uint32_t)(key.hash * 0x9e3779b1u) * nShards) >> 32);
+  }
+
+  // offset of a lattice point in keys and values, -1 if it is not in the lattice
+  int lookupVertex(const Key &key) const
+  {
+    const int s = shardOf(key);
+    const int offset = shards[s].lookupOffset(key, false);
+    return offset < 0 ? -1 : (int)shardBase[s] + offset;
+  }
 };
 
 // clang-format off
@@ -31,6 +31,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "dtgtk/button.h"
 #include "dtgtk/expander.h"
@@ -83,6 +84,7 @@
 #define NMS_EPSILON 1e-3                    // break criterion for Nelder-Mead simplex
 #define NMS_SCALE 1.0                       // scaling factor for Nelder-Mead simplex
 #define NMS_ITERATIONS 400                  // number of iterations for Nelder-Mead simplex
+#define NMS_STARTS 2                        // number of starting points for Nelder-Mead simplex
 #define NMS_CROP_EPSILON 100.0              // break criterion for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_SCALE 0.5                  // scaling factor for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_ITERATIONS 100             // number of iterations for Nelder-Mead simplex on crop fitting
@@ -138,7 +140,7 @@ const char **description(struct dt_iop_module_t *self)
 int flags()
 {
   return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_ALLOW_FAST_PIPE
-         | IOP_FLAGS_GUIDES_SPECIAL_DRAW;
+         | IOP_FLAGS_GUIDES_SPECIAL_DRAW | IOP_FLAGS_SCALE_INDEPENDENT | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int default_group()
@@ -418,6 +420,23 @@ typedef struct dt_iop_ashift_cropfit_params_t
   float edges[4][3];
 } dt_iop_ashift_cropfit_params_t;
 
+// the lines found by LSD in the preview buffer, before any selection or outlier removal
+typedef struct dt_iop_ashift_detected_t
+{
+  uint64_t hash;
+  dt_iop_ashift_enhance_t enhance;
+  dt_iop_ashift_line_t *lines;
+  int lines_count;
+  int vertical_count;
+  int horizontal_count;
+  float vertical_weight;
+  float horizontal_weight;
+  int width;
+  int height;
+  int x_off;
+  int y_off;
+} dt_iop_ashift_detected_t;
+
 typedef struct dt_iop_ashift_gui_data_t
 {
   GtkWidget *rotation;
@@ -478,6 +497,7 @@ typedef struct dt_iop_ashift_gui_data_t
   uint64_t lines_hash;
   uint64_t grid_hash;
   uint64_t buf_hash;
+  dt_iop_ashift_detected_t detected;
   dt_iop_ashift_fitaxis_t lastfit;
   float lastx;
   float lasty;
@@ -1613,11 +1633,13 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
   int x_off = 0;
   int y_off = 0;
   float scale = 0.0f;
+  uint64_t hash = 0;
 
   dt_iop_gui_enter_critical_section(module);
   // read buffer data if they are available
   if(g->buf != NULL)
   {
+    hash = g->buf_hash;
     width = g->buf_width;
     height = g->buf_height;
     x_off = g->buf_x_off;
@@ -1640,29 +1662,48 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
   free(g->lines);
   g->lines = NULL;
 
-  dt_iop_ashift_line_t *lines;
-  int lines_count;
-  int vertical_count;
-  int horizontal_count;
-  float vertical_weight;
-  float horizontal_weight;
+  dt_iop_ashift_detected_t *detected = &g->detected;
 
-  // get new structural data
-  if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
-                  &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
-                  enhance, dt_image_is_raw(&module->dev->image_storage)))
-    goto error;
+  // the preview input didn't change since the last detection: refitting only needs the lines
+  if(detected->lines == NULL || detected->hash != hash || detected->enhance != enhance
+     || detected->width != width || detected->height != height)
+  {
+    free(detected->lines);
+    detected->lines = NULL;
+
+    // get new structural data
+    if(!line_detect(buffer, width, height, x_off, y_off, scale, &detected->lines, &detected->lines_count,
+                    &detected->vertical_count, &detected->horizontal_count, &detected->vertical_weight,
+                    &detected->horizontal_weight, enhance, dt_image_is_raw(&module->dev->image_storage)))
+    {
+      free(detected->lines);
+      detected->lines = NULL;
+      goto error;
+    }
+
+    detected->hash = hash;
+    detected->enhance = enhance;
+    detected->width = width;
+    detected->height = height;
+    detected->x_off = x_off;
+    detected->y_off = y_off;
+  }
+
+  // g->lines gets its types changed by the outlier removal and the selection, so work on a copy
+  dt_iop_ashift_line_t *lines = (dt_iop_ashift_line_t *)malloc(sizeof(dt_iop_ashift_line_t) * detected->lines_count);
+  if(lines == NULL) goto error;
+  memcpy(lines, detected->lines, sizeof(dt_iop_ashift_line_t) * detected->lines_count);
 
   // save new structural data
-  g->lines_in_width = width;
-  g->lines_in_height = height;
-  g->lines_x_off = x_off;
-  g->lines_y_off = y_off;
-  g->lines_count = lines_count;
-  g->vertical_count = vertical_count;
-  g->horizontal_count = horizontal_count;
-  g->vertical_weight = vertical_weight;
-  g->horizontal_weight = horizontal_weight;
+  g->lines_in_width = detected->width;
+  g->lines_in_height = detected->height;
+  g->lines_x_off = detected->x_off;
+  g->lines_y_off = detected->y_off;
+  g->lines_count = detected->lines_count;
+  g->vertical_count = detected->vertical_count;
+  g->horizontal_count = detected->horizontal_count;
+  g->vertical_weight = detected->vertical_weight;
+  g->horizontal_weight = detected->horizontal_weight;
   g->lines_version++;
   g->lines = lines;
 
@@ -2275,18 +2316,46 @@ static dt_iop_ashift_nmsresult_t nmsfit(dt_iop_module_t *module, dt_iop_ashift_p
     return NMS_NOT_ENOUGH_LINES;
   }
 
-  // start the simplex fit
-  int iter = simplex(model_fitness, params, fit.params_count, NMS_EPSILON, NMS_SCALE, NMS_ITERATIONS, NULL, (void*)&fit);
+  // start the simplex fit from the current parameters and from the neutral ones (0 in logit space),
+  // both in parallel, and keep the better of the converged results. The fitness only reads the fit
+  // structure, so both runs can share it.
+  double starts[NMS_STARTS][4] = { { 0.0 } };
+  int iters[NMS_STARTS];
+  double quality[NMS_STARTS];
+  memcpy(starts[0], params, sizeof(double) * pcount);
+  int nstarts = 1;
+  for(int k = 0; k < pcount; k++)
+    if(params[k] != 0.0) nstarts = NMS_STARTS;
+
+  dt_iop_ashift_fit_params_t *const fitp = &fit;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(fitp, nstarts) \
+  shared(iters, quality, starts) \
+  schedule(static, 1) if(nstarts > 1)
+#endif
+  for(int s = 0; s < nstarts; s++)
+  {
+    iters[s] = simplex(model_fitness, starts[s], fitp->params_count, NMS_EPSILON, NMS_SCALE, NMS_ITERATIONS, NULL,
+                       (void *)fitp);
+    quality[s] = model_fitness(starts[s], (void *)fitp);
+  }
+
+  int best = -1;
+  for(int s = 0; s < nstarts; s++)
+    if(iters[s] < NMS_ITERATIONS && (best < 0 || quality[s] < quality[best])) best = s;
 
   // error case: the fit did not converge
-  if(iter >= NMS_ITERATIONS)
+  if(best < 0)
   {
 #ifdef ASHIFT_DEBUG
-    printf("optimization not successful: maximum number of iterations reached (%d)\n", iter);
+    printf("optimization not successful: maximum number of iterations reached (%d)\n", iters[0]);
 #endif
     return NMS_DID_NOT_CONVERGE;
   }
 
+  memcpy(params, starts[best], sizeof(double) * pcount);
+
   // fit was successful: now consolidate the results (order matters!!!)
   pcount = 0;
   fit.rotation = isnan(fit.rotation) ? ilogit(params[pcount++], -fit.rotation_range, fit.rotation_range) : fit.rotation;
@@ -2295,7 +2364,7 @@ static dt_iop_ashift_nmsresult_t nmsfit(dt_iop_module_t *module, dt_iop_ashift_p
   fit.shear = isnan(fit.shear) ? ilogit(params[pcount++], -fit.shear_range, fit.shear_range) : fit.shear;
 #ifdef ASHIFT_DEBUG
   printf("params after optimization (%d iterations): rotation %f, lensshift_v %f, lensshift_h %f, shear %f\n",
-         iter, fit.rotation, fit.lensshift_v, fit.lensshift_h, fit.shear);
+         iters[best], fit.rotation, fit.lensshift_v, fit.lensshift_h, fit.shear);
 #endif
 
   // sanity check: in case of extreme values the image gets distorted so strongly that it spans an insanely huge area. we check that
@@ -3085,6 +3154,16 @@ static void do_fit(dt_iop_module_t *module, dt_iop_ashift_params_t *p, dt_iop_as
   --darktable.gui->reset;
 }
 
+// global hash of the module feeding this one: it only changes with the preview input buffer,
+// unlike the hash of the whole pipe which also follows our own parameters
+static uint64_t _input_hash(const dt_dev_pixelpipe_iop_t *piece)
+{
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  for(int k = 1; k < pipe->num_pieces; k++)
+    if(pipe->pieces[k] == piece) return pipe->pieces[k - 1]->global_hash;
+  return 0;
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -3125,7 +3204,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     const int isflipped = fabs(fmod(alpha + M_PI, M_PI) - M_PI / 2.0f) < M_PI / 4.0f ? 1 : 0;
 
     // did modules prior to this one in pixelpipe have changed? -> check via hash value
-    uint64_t hash = dt_dev_hash(self->dev, self->dev->preview_pipe);
+    const uint64_t hash = _input_hash(piece);
 
     dt_iop_gui_enter_critical_section(self);
     g->isflipped = isflipped;
@@ -3174,9 +3253,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float cx = roi_out->scale * fullwidth * data->cl;
   const float cy = roi_out->scale * fullheight * data->ct;
 
+  // one row of input coordinates per thread, interpolated in a single batch
+  size_t coords_padded;
+  float *const coords_buf = dt_pixelpipe_alloc_perthread_float(2 * roi_out->width, &coords_padded);
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, ch_width, cx, cy, ivoid, ovoid, roi_in, roi_out) \
+  dt_omp_firstprivate(ch, ch_width, cx, cy, ivoid, ovoid, roi_in, roi_out, coords_buf, coords_padded) \
   shared(ihomograph, interpolation) \
   schedule(static)
 #endif
@@ -3184,6 +3267,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   for(int j = 0; j < roi_out->height; j++)
   {
     float *const restrict out = ((float *)ovoid) + (size_t)ch * j * roi_out->width;
+    float *const coords = dt_get_perthread(coords_buf, coords_padded);
     for(int i = 0; i < roi_out->width; i++)
     {
       float pin[3], pout[3];
@@ -3206,11 +3290,14 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       pin[0] -= roi_in->x;
       pin[1] -= roi_in->y;
 
-      // get output values by interpolation from input image
-      dt_interpolation_compute_pixel4c(interpolation, (float *)ivoid, out + ch*i, pin[0], pin[1], roi_in->width,
-                                       roi_in->height, ch_width);
+      coords[2 * i] = pin[0];
+      coords[2 * i + 1] = pin[1];
     }
+    // get output values by interpolation from input image
+    dt_interpolation_compute_row4c(interpolation, (float *)ivoid, out, coords, roi_out->width, roi_in->width,
+                                   roi_in->height, ch_width);
   }
+  dt_pixelpipe_free_align(coords_buf);
 }
 
 #ifdef HAVE_OPENCL
@@ -3258,7 +3345,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     const int isflipped = fabs(fmod(alpha + M_PI, M_PI) - M_PI / 2.0f) < M_PI / 4.0f ? 1 : 0;
 
     // do modules coming before this one in pixelpipe have changed? -> check via hash value
-    uint64_t hash = dt_dev_hash(self->dev, self->dev->preview_pipe);
+    const uint64_t hash = _input_hash(piece);
 
     dt_iop_gui_enter_critical_section(self);
     g->isflipped = isflipped;
@@ -5683,6 +5770,7 @@ void gui_cleanup(struct dt_iop_module_t *self)
 
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)self->gui_data;
   if(g->lines) free(g->lines);
+  if(g->detected.lines) free(g->detected.lines);
   if(g->buf) free(g->buf);
   if(g->points) free(g->points);
   if(g->points_idx) free(g->points_idx);
@@ -645,10 +645,9 @@ static image_double gaussian_sampler( image_double in, double scale,
                                       double sigma_scale )
 {
   image_double aux,out;
-  ntuple_list kernel;
-  unsigned int N,M,h,n,x,y,i;
-  int xc,yc,j,double_x_size,double_y_size;
-  double sigma,xx,yy,sum,prec;
+  unsigned int N,M,h,n;
+  int double_x_size,double_y_size;
+  double sigma,prec;
 
   /* check parameters */
   if( in == NULL || in->data == NULL || in->xsize == 0 || in->ysize == 0 )
@@ -679,34 +678,45 @@ static image_double gaussian_sampler( image_double in, double scale,
   prec = 3.0;
   h = (unsigned int) ceil( sigma * sqrt( 2.0 * prec * log(10.0) ) );
   n = 1+2*h; /* kernel size */
-  kernel = new_ntuple_list(n);
 
   /* auxiliary double image size variables */
   double_x_size = (int) (2 * in->xsize);
   double_y_size = (int) (2 * in->ysize);
 
+  /* the columns, then the rows, are independent: each thread computes
+     its own kernel for the columns or rows it samples */
+#ifdef _OPENMP
+#pragma omp parallel default(none) \
+  dt_omp_firstprivate(aux, double_x_size, double_y_size, h, in, n, out, scale, sigma)
+#endif
+  {
+  ntuple_list kernel = new_ntuple_list(n);
+
   /* First subsampling: x axis */
-  for(x=0;x<aux->xsize;x++)
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+  for(unsigned int x=0;x<aux->xsize;x++)
     {
       /*
          x   is the coordinate in the new image.
          xx  is the corresponding x-value in the original size image.
          xc  is the integer value, the pixel coordinate of xx.
        */
-      xx = (double) x / scale;
+      const double xx = (double) x / scale;
       /* coordinate (0.0,0.0) is in the center of pixel (0,0),
          so the pixel with xc=0 get the values of xx from -0.5 to 0.5 */
-      xc = (int) floor( xx + 0.5 );
+      const int xc = (int) floor( xx + 0.5 );
       gaussian_kernel( kernel, sigma, (double) h + xx - (double) xc );
       /* the kernel must be computed for each x because the fine
          offset xx-xc is different in each case */
 
-      for(y=0;y<aux->ysize;y++)
+      for(unsigned int y=0;y<aux->ysize;y++)
         {
-          sum = 0.0;
-          for(i=0;i<kernel->dim;i++)
+          double sum = 0.0;
+          for(unsigned int i=0;i<kernel->dim;i++)
             {
-              j = xc - h + i;
+              int j = xc - h + i;
 
               /* symmetry boundary condition */
               while( j < 0 ) j += double_x_size;
@@ -719,28 +729,31 @@ static image_double gaussian_sampler( image_double in, double scale,
         }
     }
 
-  /* Second subsampling: y axis */
-  for(y=0;y<out->ysize;y++)
+  /* Second subsampling: y axis, once all the columns are done */
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+  for(unsigned int y=0;y<out->ysize;y++)
     {
       /*
          y   is the coordinate in the new image.
          yy  is the corresponding x-value in the original size image.
          yc  is the integer value, the pixel coordinate of xx.
        */
-      yy = (double) y / scale;
+      const double yy = (double) y / scale;
       /* coordinate (0.0,0.0) is in the center of pixel (0,0),
          so the pixel with yc=0 get the values of yy from -0.5 to 0.5 */
-      yc = (int) floor( yy + 0.5 );
+      const int yc = (int) floor( yy + 0.5 );
       gaussian_kernel( kernel, sigma, (double) h + yy - (double) yc );
       /* the kernel must be computed for each y because the fine
          offset yy-yc is different in each case */
 
-      for(x=0;x<out->xsize;x++)
+      for(unsigned int x=0;x<out->xsize;x++)
         {
-          sum = 0.0;
-          for(i=0;i<kernel->dim;i++)
+          double sum = 0.0;
+          for(unsigned int i=0;i<kernel->dim;i++)
             {
-              j = yc - h + i;
+              int j = yc - h + i;
 
               /* symmetry boundary condition */
               while( j < 0 ) j += double_y_size;
@@ -753,8 +766,10 @@ static image_double gaussian_sampler( image_double in, double scale,
         }
     }
 
-  /* free memory */
   free_ntuple_list(kernel);
+  }
+
+  /* free memory */
   free_image_double(aux);
 
   return out;
@@ -787,8 +802,8 @@ static image_double ll_angle( image_double in, double threshold,
                               image_double * modgrad, unsigned int n_bins )
 {
   image_double g;
-  unsigned int n,p,x,y,adr,i;
-  double com1,com2,gx,gy,norm,norm2;
+  unsigned int n,p,x,y,i;
+  double norm;
   /* the rest of the variables are used for pseudo-ordering
      the gradient magnitude values */
   int list_count = 0;
@@ -833,11 +848,21 @@ static image_double ll_angle( image_double in, double threshold,
   for(x=0;x<p;x++) g->data[(n-1)*p+x] = NOTDEF;
   for(y=0;y<n;y++) g->data[p*y+p-1]   = NOTDEF;
 
-  /* compute gradient on the remaining pixels */
-  for(x=0;x<p-1;x++)
-    for(y=0;y<n-1;y++)
+  /* compute gradient on the remaining pixels, rows in parallel */
+  double *const modgrad_data = (*modgrad)->data;
+  double *const g_data = g->data;
+  const double *const in_data = in->data;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(g_data, in_data, modgrad_data, n, p, threshold) \
+  reduction(max : max_grad) \
+  schedule(static)
+#endif
+  for(unsigned int y=0;y<n-1;y++)
+    for(unsigned int x=0;x<p-1;x++)
       {
-        adr = y*p+x;
+        const unsigned int adr = y*p+x;
+        double com1,com2,gx,gy,norm,norm2;
 
         /*
            Norm 2 computation using 2x2 pixel window:
@@ -850,22 +875,22 @@ static image_double ll_angle( image_double in, double threshold,
              gy = C+D - (A+B)   vertical difference
            com1 and com2 are just to avoid 2 additions.
          */
-        com1 = in->data[adr+p+1] - in->data[adr];
-        com2 = in->data[adr+1]   - in->data[adr+p];
+        com1 = in_data[adr+p+1] - in_data[adr];
+        com2 = in_data[adr+1]   - in_data[adr+p];
 
         gx = com1+com2; /* gradient x component */
         gy = com1-com2; /* gradient y component */
         norm2 = gx*gx+gy*gy;
         norm = sqrt( norm2 / 4.0 ); /* gradient norm */
 
-        (*modgrad)->data[adr] = norm; /* store gradient norm */
+        modgrad_data[adr] = norm; /* store gradient norm */
 
         if( norm <= threshold ) /* norm too small, gradient no defined */
-          g->data[adr] = NOTDEF; /* gradient angle not defined */
+          g_data[adr] = NOTDEF; /* gradient angle not defined */
         else
           {
             /* gradient angle computation */
-            g->data[adr] = atan2(gx,-gy);
+            g_data[adr] = atan2(gx,-gy);
 
             /* look for the maximum of the gradient */
             if( norm > max_grad ) max_grad = norm;
@@ -304,6 +304,9 @@ static void process_wavelets(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   // that we don't need to store it past the current scale's iteration
   for(int scale = 0; scale < max_scale; scale++)
   {
+    // params changed meanwhile, the pipe will discard this output
+    if(dt_dev_pixelpipe_cancelled()) break;
+
     decompose(buf2, buf1, detail, scale, sharp[scale], width, height);
     synthesize(out, out, detail, thrs[scale], boost[scale], width, height);
     if(scale == 0) buf1 = (float *)tmp2; // now switch to second scratch for buffer ping-pong between buf1 and buf2
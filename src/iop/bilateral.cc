@@ -24,11 +24,13 @@ extern "C" {
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/imagebuf.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -68,6 +70,15 @@ typedef struct dt_iop_bilateral_data_t
   float sigma[5];
 } dt_iop_bilateral_data_t;
 
+typedef struct dt_iop_bilateral_global_data_t
+{
+  int kernel_permutohedral_zero;
+  int kernel_permutohedral_splat;
+  int kernel_permutohedral_accumulate;
+  int kernel_permutohedral_blur;
+  int kernel_permutohedral_slice;
+} dt_iop_bilateral_global_data_t;
+
 const char *name()
 {
   return _("surface blur");
@@ -144,7 +155,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       for(int k = -rad; k <= rad; k++) m[l * wd + k] /= weight;
 
     size_t padded_weights_size;
-    float *const weights_buf = dt_alloc_perthread_float(weights_size, &padded_weights_size);
+    float *const weights_buf = dt_pixelpipe_alloc_perthread_float(weights_size, &padded_weights_size);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
@@ -186,7 +197,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
     }
 
-    dt_free_align(weights_buf);
+    dt_pixelpipe_free_align(weights_buf);
 
     // fill unprocessed border
     for(int j = 0; j < rad; j++)
@@ -254,6 +265,212 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+#ifdef HAVE_OPENCL
+// bounded number of passes of the splat kernel, see permutohedral.cl. a pass only leaves out the points
+// whose slot was claimed but not yet written in the same pass, in practice the second one finds them all.
+#define PERMUTOHEDRAL_SPLAT_PASSES 8
+
+// slots of the hash table of the lattice on the device. it gives up and returns to the CPU path when
+// it gets full.
+static int _permutohedral_capacity(const size_t npixels)
+{
+  int capacity = 1 << 15;
+  while((size_t)capacity < npixels && capacity < (1 << 30)) capacity <<= 1;
+  return capacity;
+}
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  dt_iop_bilateral_data_t *data = (dt_iop_bilateral_data_t *)piece->data;
+  dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)self->global_data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int capacity = _permutohedral_capacity((size_t)width * height);
+  const size_t replay_size = (size_t)6 * width * height;
+
+  cl_mem dev_tokens = NULL;
+  cl_mem dev_ready = NULL;
+  cl_mem dev_keys = NULL;
+  cl_mem dev_values = NULL;
+  cl_mem dev_blurred = NULL;
+  cl_mem dev_offsets = NULL;
+  cl_mem dev_weights = NULL;
+  cl_mem dev_counters = NULL;
+  int counters[2] = { 0, 0 };
+  int pass = 0;
+
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { (size_t)width, (size_t)height, 1 };
+  size_t sizes[] = { (size_t)ROUNDUPDWD(width, devid), (size_t)ROUNDUPDHT(height, devid), 1 };
+  size_t table_sizes[] = { (size_t)ROUNDUPDWD(capacity, devid), 1, 1 };
+
+  float sigma[5];
+  sigma[0] = data->sigma[0] * roi_in->scale / piece->iscale;
+  sigma[1] = data->sigma[1] * roi_in->scale / piece->iscale;
+  sigma[2] = data->sigma[2];
+  sigma[3] = data->sigma[3];
+  sigma[4] = data->sigma[4];
+  const int rad = (int)(3.0 * fmaxf(sigma[0], sigma[1]) + 1.0);
+  const float isigma_x = 1.0f / sigma[0];
+  const float isigma_y = 1.0f / sigma[1];
+  const float isigma_c[4] = { 1.0f / sigma[2], 1.0f / sigma[3], 1.0f / sigma[4], 0.0f };
+
+  // same shortcuts as process()
+  if(fmaxf(sigma[0], sigma[1]) < .1
+     || (rad <= 6 && ((piece->pipe->type & DT_DEV_PIXELPIPE_THUMBNAIL) == DT_DEV_PIXELPIPE_THUMBNAIL)))
+  {
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+  // the small radius version is left to the CPU
+  if(rad <= 6) return FALSE;
+
+  dev_tokens = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * capacity);
+  if(dev_tokens == NULL) goto error;
+  dev_ready = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * capacity);
+  if(dev_ready == NULL) goto error;
+  dev_keys = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * 5 * capacity);
+  if(dev_keys == NULL) goto error;
+  dev_values = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * 4 * capacity);
+  if(dev_values == NULL) goto error;
+  dev_blurred = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * 4 * capacity);
+  if(dev_blurred == NULL) goto error;
+  dev_offsets = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(int) * replay_size);
+  if(dev_offsets == NULL) goto error;
+  dev_weights = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(float) * replay_size);
+  if(dev_weights == NULL) goto error;
+  dev_counters = (cl_mem)dt_opencl_alloc_device_buffer(devid, sizeof(counters));
+  if(dev_counters == NULL) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_zero, 0, sizeof(cl_mem), (void *)&dev_tokens);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_zero, 1, sizeof(cl_mem), (void *)&dev_ready);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_zero, 2, sizeof(cl_mem), (void *)&dev_values);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_zero, 3, sizeof(int), (void *)&capacity);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_zero, table_sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // splat: insert the vertices of the simplex of every pixel in the lattice
+  for(pass = 0; pass < PERMUTOHEDRAL_SPLAT_PASSES; pass++)
+  {
+    counters[0] = counters[1] = 0;
+    err = dt_opencl_write_buffer_to_device(devid, counters, dev_counters, 0, sizeof(counters), CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 1, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 2, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 3, sizeof(float), (void *)&isigma_x);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 4, sizeof(float), (void *)&isigma_y);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 5, 4 * sizeof(float), (void *)isigma_c);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 6, sizeof(cl_mem), (void *)&dev_tokens);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 7, sizeof(cl_mem), (void *)&dev_ready);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 8, sizeof(cl_mem), (void *)&dev_keys);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 9, sizeof(int), (void *)&capacity);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 10, sizeof(cl_mem), (void *)&dev_offsets);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 11, sizeof(cl_mem), (void *)&dev_weights);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 12, sizeof(cl_mem), (void *)&dev_counters);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_splat, 13, sizeof(int), (void *)&pass);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_splat, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    err = dt_opencl_read_buffer_from_device(devid, counters, dev_counters, 0, sizeof(counters), CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    if(counters[1])
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_bilateral] lattice doesn't fit in %d vertices\n", capacity);
+      goto error;
+    }
+    if(counters[0] == 0) break;
+  }
+  if(pass == PERMUTOHEDRAL_SPLAT_PASSES) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 1, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 2, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 3, sizeof(cl_mem), (void *)&dev_offsets);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 4, sizeof(cl_mem), (void *)&dev_weights);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_accumulate, 5, sizeof(cl_mem), (void *)&dev_values);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_accumulate, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // blur along each of the d+1 axes, ping-ponging between the two value buffers
+  for(int axis = 0; axis <= 5; axis++)
+  {
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 0, sizeof(cl_mem), (void *)&dev_tokens);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 1, sizeof(cl_mem), (void *)&dev_keys);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 2, sizeof(int), (void *)&capacity);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 3, sizeof(int), (void *)&axis);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 4, sizeof(cl_mem), (void *)&dev_values);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_blur, 5, sizeof(cl_mem), (void *)&dev_blurred);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_blur, table_sizes);
+    if(err != CL_SUCCESS) goto error;
+    std::swap(dev_values, dev_blurred);
+  }
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 4, sizeof(cl_mem), (void *)&dev_offsets);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 5, sizeof(cl_mem), (void *)&dev_weights);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_permutohedral_slice, 6, sizeof(cl_mem), (void *)&dev_values);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_permutohedral_slice, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_tokens);
+  dt_opencl_release_mem_object(dev_ready);
+  dt_opencl_release_mem_object(dev_keys);
+  dt_opencl_release_mem_object(dev_values);
+  dt_opencl_release_mem_object(dev_blurred);
+  dt_opencl_release_mem_object(dev_offsets);
+  dt_opencl_release_mem_object(dev_weights);
+  dt_opencl_release_mem_object(dev_counters);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_tokens);
+  dt_opencl_release_mem_object(dev_ready);
+  dt_opencl_release_mem_object(dev_keys);
+  dt_opencl_release_mem_object(dev_values);
+  dt_opencl_release_mem_object(dev_blurred);
+  dt_opencl_release_mem_object(dev_offsets);
+  dt_opencl_release_mem_object(dev_weights);
+  dt_opencl_release_mem_object(dev_counters);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_bilateral] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 38; // permutohedral.cl, from programs.conf
+  dt_iop_bilateral_global_data_t *gd
+      = (dt_iop_bilateral_global_data_t *)malloc(sizeof(dt_iop_bilateral_global_data_t));
+  module->data = gd;
+  gd->kernel_permutohedral_zero = dt_opencl_create_kernel(program, "permutohedral_zero");
+  gd->kernel_permutohedral_splat = dt_opencl_create_kernel(program, "permutohedral_splat");
+  gd->kernel_permutohedral_accumulate = dt_opencl_create_kernel(program, "permutohedral_accumulate");
+  gd->kernel_permutohedral_blur = dt_opencl_create_kernel(program, "permutohedral_blur");
+  gd->kernel_permutohedral_slice = dt_opencl_create_kernel(program, "permutohedral_slice");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_permutohedral_zero);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_splat);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_accumulate);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_blur);
+  dt_opencl_free_kernel(gd->kernel_permutohedral_slice);
+  free(module->data);
+  module->data = NULL;
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -287,6 +504,10 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   sigma[1] = data->sigma[1] * roi_in->scale / piece->iscale;
   const int rad = (int)(3.0 * fmaxf(sigma[0], sigma[1]) + 1.0);
   tiling->factor = 2.0 /*input+output*/ + 80.0/16/*worst-case hashtable*/ + 52.0/16/*replay buffer*/;
+  // tokens, keys and two value buffers of the hash table with up to 2 slots per pixel, offsets and
+  // weights of the replay
+  tiling->factor_cl = 2.0 /*input+output*/ + 2.0 * 60.0/16/*hashtable*/ + 48.0/16/*replay buffer*/;
+  tiling->maxbuf_cl = 2.0 * 20.0/16;
   tiling->overhead = 0;
   tiling->overlap = rad;
   tiling->xalign = 1;
@@ -148,6 +148,7 @@ typedef struct dt_iop_channelmixer_rgb_gui_data_t
   GtkWidget *color_picker;
   float xy[2];
   float XYZ[4];
+  uint64_t XYZ_hash;        // input of the pipe and detection method XYZ was detected from, 0 if none
 
   point_t box[4];           // the current coordinates, possibly non rectangle, of the bounding box for the color checker
   point_t ideal_box[4];     // the desired coordinates of the perfect rectangle bounding box for the color checker
@@ -238,7 +239,8 @@ const char **description(struct dt_iop_module_t *self)
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING
+         | IOP_FLAGS_SCALE_INDEPENDENT | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int default_group()
@@ -1037,6 +1039,30 @@ static inline void auto_detect_WB(const float *const restrict in, dt_illuminant_
   dt_free_align(temp);
 }
 
+// The edges and surfaces are sampled every OFF pixels over a copy of the image reduced to this size,
+// so the detection costs the same whatever the size of the image and the zoom level.
+#define WB_DETECTION_SIZE 1024
+
+static void auto_detect_WB_reduced(const float *const restrict in, dt_illuminant_t illuminant,
+                                   const dt_iop_roi_t *const roi_in, const dt_colormatrix_t RGB_to_XYZ,
+                                   dt_aligned_pixel_t xyz)
+{
+  const float scale = fminf((float)WB_DETECTION_SIZE / (float)MAX(roi_in->width, roi_in->height), 1.f);
+  if(scale == 1.f)
+  {
+    auto_detect_WB(in, illuminant, roi_in->width, roi_in->height, 4, RGB_to_XYZ, xyz);
+    return;
+  }
+
+  const dt_iop_roi_t roi_full = { 0, 0, roi_in->width, roi_in->height, 1.f };
+  dt_iop_roi_t roi_small = { 0, 0, MAX((int)(roi_in->width * scale), 1), MAX((int)(roi_in->height * scale), 1),
+                             scale };
+  float *const restrict small = dt_alloc_sse_ps((size_t)roi_small.width * roi_small.height * 4);
+  dt_iop_clip_and_zoom(small, in, &roi_small, &roi_full, roi_small.width, roi_full.width);
+  auto_detect_WB(small, illuminant, roi_small.width, roi_small.height, 4, RGB_to_XYZ, xyz);
+  dt_free_align(small);
+}
+
 static void declare_cat_on_pipe(struct dt_iop_module_t *self, gboolean preset)
 {
   // Advertise to the pipeline that we are doing chromatic adaptation here
@@ -1867,9 +1893,15 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     {
       if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL)
       {
-        // detection on full image only
+        // detection on full image only, once for a given input
+        const uint64_t hash = dt_hash(piece->input_hash, (const char *)&data->illuminant_type,
+                                      sizeof(data->illuminant_type));
         dt_iop_gui_enter_critical_section(self);
-        auto_detect_WB(in, data->illuminant_type, roi_in->width, roi_in->height, ch, RGB_to_XYZ, g->XYZ);
+        if(g->XYZ_hash != hash)
+        {
+          auto_detect_WB_reduced(in, data->illuminant_type, roi_in, RGB_to_XYZ, g->XYZ);
+          g->XYZ_hash = hash;
+        }
         dt_iop_gui_leave_critical_section(self);
       }
 
@@ -3945,6 +3977,7 @@ void gui_init(struct dt_iop_module_t *self)
   g->delta_E_label_text = NULL;
 
   g->XYZ[0] = NAN;
+  g->XYZ_hash = 0;
 
   DT_DEBUG_CONTROL_SIGNAL_CONNECT(darktable.signals, DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED,
                             G_CALLBACK(_develop_ui_pipe_finished_callback), self);
@@ -25,6 +25,7 @@
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_arena.h"
 #include "dtgtk/resetlabel.h"
 #include "gui/gtk.h"
 #include "iop/iop_api.h"
@@ -122,7 +123,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float slope = data->slope;
 
   size_t destbuf_size;
-  float *const restrict dest_buf = dt_alloc_perthread_float(roi_out->width, &destbuf_size);
+  float *const restrict dest_buf = dt_pixelpipe_alloc_perthread_float(roi_out->width, &destbuf_size);
 
 // CLAHE
 #ifdef _OPENMP
@@ -245,7 +246,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
   }
 
-  dt_free_align(dest_buf);
+  dt_pixelpipe_free_align(dest_buf);
 
   // Cleanup
   free(luminance);
@@ -30,6 +30,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -331,7 +332,7 @@ int default_group()
 int flags()
 {
   return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_ALLOW_FAST_PIPE
-         | IOP_FLAGS_GUIDES_SPECIAL_DRAW | IOP_FLAGS_DEPRECATED;
+         | IOP_FLAGS_GUIDES_SPECIAL_DRAW | IOP_FLAGS_DEPRECATED | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int operation_tags()
@@ -989,9 +990,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     if(d->k_apply == 1)
       keystone_get_matrix(k_space, kxa, kxb, kxc, kxd, kya, kyb, kyc, kyd, &ma, &mb, &md, &me, &mg, &mh);
 
+    // one row of input coordinates per thread, interpolated in a single batch
+    size_t coords_padded;
+    float *const coords_buf = dt_pixelpipe_alloc_perthread_float(2 * roi_out->width, &coords_padded);
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(ch, ch_width, ivoid, kxa, kya, ovoid, roi_in, roi_out) \
+    dt_omp_firstprivate(ch, ch_width, ivoid, kxa, kya, ovoid, roi_in, roi_out, coords_buf, coords_padded) \
     dt_omp_sharedconst(k_space) \
     shared(d, interpolation, ma, mb, md, me, mg, mh) \
     schedule(static)
@@ -1001,6 +1006,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     for(int j = 0; j < roi_out->height; j++)
     {
       float *out = ((float *)ovoid) + (size_t)ch * j * roi_out->width;
+      float *const coords = dt_get_perthread(coords_buf, coords_padded);
       for(int i = 0; i < roi_out->width; i++)
       {
         float pi[2], po[2];
@@ -1030,10 +1036,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         po[0] -= roi_in->x + 0.5f;
         po[1] -= roi_in->y + 0.5f;
 
-        dt_interpolation_compute_pixel4c(interpolation, (float *)ivoid, out + ch*i, po[0], po[1], roi_in->width,
-                                         roi_in->height, ch_width);
+        coords[2 * i] = po[0];
+        coords[2 * i + 1] = po[1];
       }
+      dt_interpolation_compute_row4c(interpolation, (float *)ivoid, out, coords, roi_out->width, roi_in->width,
+                                     roi_in->height, ch_width);
     }
+    dt_pixelpipe_free_align(coords_buf);
   }
 }
 
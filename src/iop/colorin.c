@@ -146,7 +146,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -815,6 +815,48 @@ static void process_cmatrix_fastpath(struct dt_iop_module_t *self, dt_dev_pixelp
   }
 }
 
+// the matrix fast path only, see commit_params()
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
+
+  if(d->nrgb == NULL)
+  {
+    dt_colormatrix_t cmatrix;
+    transpose_3xSSE(d->cmatrix, cmatrix);
+
+    for(size_t k = 0; k < npixels; k++)
+    {
+      dt_aligned_pixel_t _xyz = { 0.0f, 0.0f, 0.0f, 0.0f };
+      dt_apply_transposed_color_matrix(in + 4 * k, cmatrix, _xyz);
+      dt_XYZ_to_Lab(_xyz, out + 4 * k);
+    }
+  }
+  else
+  {
+    dt_colormatrix_t nmatrix;
+    dt_colormatrix_t lmatrix;
+    transpose_3xSSE(d->nmatrix, nmatrix);
+    transpose_3xSSE(d->lmatrix, lmatrix);
+
+    for(size_t k = 0; k < npixels; k++)
+    {
+      dt_aligned_pixel_t nRGB;
+      dt_apply_transposed_color_matrix(in + 4 * k, nmatrix, nRGB);
+
+      dt_aligned_pixel_t cRGB = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for_each_channel(c)
+        cRGB[c] = CLAMP(nRGB[c], 0.0f, 1.0f);
+
+      dt_aligned_pixel_t XYZ;
+      dt_apply_transposed_color_matrix(cRGB, lmatrix, XYZ);
+
+      dt_XYZ_to_Lab(XYZ, out + 4 * k);
+    }
+  }
+}
+
 static void process_cmatrix_proper(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                    const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                    const dt_iop_roi_t *const roi_out)
@@ -1458,17 +1500,17 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   if(d->xform_cam_Lab)
   {
-    cmsDeleteTransform(d->xform_cam_Lab);
+    dt_colorspaces_release_transform(d->xform_cam_Lab);
     d->xform_cam_Lab = NULL;
   }
   if(d->xform_cam_nrgb)
   {
-    cmsDeleteTransform(d->xform_cam_nrgb);
+    dt_colorspaces_release_transform(d->xform_cam_nrgb);
     d->xform_cam_nrgb = NULL;
   }
   if(d->xform_nrgb_Lab)
   {
-    cmsDeleteTransform(d->xform_nrgb_Lab);
+    dt_colorspaces_release_transform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
 
@@ -1610,9 +1652,10 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0][0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent, 0);
-      d->xform_cam_nrgb = cmsCreateTransform(d->input, input_format, d->nrgb, TYPE_RGBA_FLT, p->intent, 0);
-      d->xform_nrgb_Lab = cmsCreateTransform(d->nrgb, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_get_transform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent);
+      d->xform_cam_nrgb
+          = dt_colorspaces_get_transform(d->input, input_format, d->nrgb, TYPE_RGBA_FLT, p->intent);
+      d->xform_nrgb_Lab = dt_colorspaces_get_transform(d->nrgb, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent);
     }
     else
     {
@@ -1631,7 +1674,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0][0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_get_transform(d->input, input_format, Lab, TYPE_LabA_FLT, p->intent);
     }
   }
 
@@ -1640,12 +1683,12 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     if(d->xform_cam_nrgb)
     {
-      cmsDeleteTransform(d->xform_cam_nrgb);
+      dt_colorspaces_release_transform(d->xform_cam_nrgb);
       d->xform_cam_nrgb = NULL;
     }
     if(d->xform_nrgb_Lab)
     {
-      cmsDeleteTransform(d->xform_nrgb_Lab);
+      dt_colorspaces_release_transform(d->xform_nrgb_Lab);
       d->xform_nrgb_Lab = NULL;
     }
     d->nrgb = NULL;
@@ -1668,7 +1711,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
     {
       piece->process_cl_ready = 0;
       d->cmatrix[0][0] = NAN;
-      d->xform_cam_Lab = cmsCreateTransform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent, 0);
+      d->xform_cam_Lab = dt_colorspaces_get_transform(d->input, TYPE_RGBA_FLT, Lab, TYPE_LabA_FLT, p->intent);
     }
   }
 
@@ -1694,6 +1737,11 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
       d->unbounded_coeffs[k][0] = -1.0f;
   }
 
+  // the per-pixel kernel only covers the plain matrix path
+  piece->process_pixels_ready
+      = d->type != DT_COLORSPACE_LAB && !isnan(d->cmatrix[0][0]) && d->nonlinearlut == 0
+        && !(d->blue_mapping && dt_image_is_matrix_correction_supported(&pipe->image));
+
   // commit color profiles to pipeline
   dt_ioppr_set_pipe_work_profile_info(self->dev, piece->pipe, d->type_work, d->filename_work, DT_INTENT_PERCEPTUAL);
   dt_ioppr_set_pipe_input_profile_info(self->dev, piece->pipe, d->type, d->filename, p->intent, d->cmatrix);
@@ -1717,17 +1765,17 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
   if(d->input && d->clear_input) dt_colorspaces_cleanup_profile(d->input);
   if(d->xform_cam_Lab)
   {
-    cmsDeleteTransform(d->xform_cam_Lab);
+    dt_colorspaces_release_transform(d->xform_cam_Lab);
     d->xform_cam_Lab = NULL;
   }
   if(d->xform_cam_nrgb)
   {
-    cmsDeleteTransform(d->xform_cam_nrgb);
+    dt_colorspaces_release_transform(d->xform_cam_nrgb);
     d->xform_cam_nrgb = NULL;
   }
   if(d->xform_nrgb_Lab)
   {
-    cmsDeleteTransform(d->xform_nrgb_Lab);
+    dt_colorspaces_release_transform(d->xform_nrgb_Lab);
     d->xform_nrgb_Lab = NULL;
   }
 
@@ -30,6 +30,7 @@
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "dtgtk/drawingarea.h"
 #include "dtgtk/resetlabel.h"
@@ -526,7 +527,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
 
     size_t allocsize;
-    float *const weight_buf = dt_alloc_perthread(data->n, sizeof(float), &allocsize);
+    float *const weight_buf = dt_pixelpipe_alloc_perthread(data->n, sizeof(float), &allocsize);
 
 #ifdef _OPENMP
 #pragma omp parallel default(none) \
@@ -565,7 +566,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
     }
 
-    dt_free_align(weight_buf);
+    dt_pixelpipe_free_align(weight_buf);
     free(var_ratio);
     free(mapio);
   }
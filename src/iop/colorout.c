@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/clut.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/dttypes.h"
@@ -48,6 +49,8 @@
 // must be in synch with dt_colorspaces_color_profile_t
 #define DT_IOP_COLOR_ICC_LEN 512
 #define LUT_SAMPLES 0x10000
+// samples per axis of the Lab table replacing lcms2 for LUT output profiles
+#define CLUT_LEVEL 65
 
 DT_MODULE_INTROSPECTION(5, dt_iop_colorout_params_t)
 
@@ -58,6 +61,7 @@ typedef struct dt_iop_colorout_data_t
   float lut[3][LUT_SAMPLES];
   dt_colormatrix_t cmatrix;
   cmsHTRANSFORM *xform;
+  const float *clut;            // CLUT_LEVEL^3 samples of xform, owned by the shared transform
   float unbounded_coeffs[3][3]; // for extrapolation of shaper curves
 } dt_iop_colorout_data_t;
 
@@ -99,7 +103,8 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_HISTORY_STACK;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_HISTORY_STACK | IOP_FLAGS_SCALE_INDEPENDENT
+         | IOP_FLAGS_DISPLAY_REFERRED | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -358,6 +363,24 @@ static void process_fastpath_apply_tonecurves(struct dt_iop_module_t *self, dt_d
   }
 }
 
+__DT_CLONE_TARGETS__
+static void _process_clut(const float *const restrict clut, const float *const restrict in,
+                          float *const restrict out, const size_t npixels)
+{
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(clut, in, npixels, out) \
+  schedule(static) aligned(in, out:64)
+#endif
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    // the table spans L in [0; 100], a and b in [-128; 128]
+    const dt_aligned_pixel_t Lab = { in[k] / 100.0f, (in[k + 1] + 128.0f) / 256.0f,
+                                     (in[k + 2] + 128.0f) / 256.0f, 0.0f };
+    dt_clut_tetrahedral(Lab, out + k, clut, CLUT_LEVEL);
+  }
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -398,6 +421,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
     process_fastpath_apply_tonecurves(self, piece, in, out, roi_in, roi_out);
   }
+  else if(d->clut)
+  {
+    _process_clut(d->clut, (const float *const)ivoid, out, npixels);
+  }
   else
   {
 // fprintf(stderr,"Using xform codepath\n");
@@ -471,6 +498,10 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
     process_fastpath_apply_tonecurves(self, piece, ivoid, ovoid, roi_in, roi_out);
   }
+  else if(d->clut)
+  {
+    _process_clut(d->clut, (const float *const)ivoid, out, npixels);
+  }
   else
   {
     // fprintf(stderr,"Using xform codepath\n");
@@ -510,6 +541,16 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 }
 #endif
 
+// softproofing needs its own transform on a temporary profile, everything else is shared between pipes
+static cmsHTRANSFORM _get_transform(cmsHPROFILE Lab, cmsHPROFILE output, cmsUInt32Number output_format,
+                                    cmsHPROFILE softproof, dt_iop_color_intent_t intent, uint32_t flags)
+{
+  if(softproof)
+    return cmsCreateProofingTransform(Lab, TYPE_LabA_FLT, output, output_format, softproof, intent,
+                                      INTENT_RELATIVE_COLORIMETRIC, flags);
+  return dt_colorspaces_get_transform(Lab, TYPE_LabA_FLT, output, output_format, intent);
+}
+
 static cmsHPROFILE _make_clipping_profile(cmsHPROFILE profile)
 {
   cmsUInt32Number size;
@@ -551,11 +592,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   d->mode = (pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL ? darktable.color_profiles->mode : DT_PROFILE_NORMAL;
 
-  if(d->xform)
-  {
-    cmsDeleteTransform(d->xform);
-    d->xform = NULL;
-  }
+  dt_colorspaces_release_transform(d->xform);
+  d->xform = NULL;
+  d->clut = NULL;
   d->cmatrix[0][0] = NAN;
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -710,8 +749,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     d->cmatrix[0][0] = NAN;
     piece->process_cl_ready = 0;
-    d->xform = cmsCreateProofingTransform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
-                                          out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
+    d->xform = _get_transform(Lab, output, output_format, softproof, out_intent, transformFlags);
   }
 
   // user selected a non-supported output profile, check that:
@@ -728,11 +766,15 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
       d->cmatrix[0][0] = NAN;
       piece->process_cl_ready = 0;
 
-      d->xform = cmsCreateProofingTransform(Lab, TYPE_LabA_FLT, output, output_format, softproof,
-                                            out_intent, INTENT_RELATIVE_COLORIMETRIC, transformFlags);
+      d->xform = _get_transform(Lab, output, output_format, softproof, out_intent, transformFlags);
     }
   }
 
+  // LUT profiles: sample the transform once and interpolate it instead of running lcms2 on each row.
+  // softproofing and gamut check stay on lcms2, and so does the user asking for it explicitly.
+  if(d->xform && d->mode == DT_PROFILE_NORMAL && !force_lcms2)
+    d->clut = dt_colorspaces_get_transform_clut(d->xform, CLUT_LEVEL);
+
   if(out_type == DT_COLORSPACE_DISPLAY)
     pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
@@ -773,11 +815,9 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_colorout_data_t *d = (dt_iop_colorout_data_t *)piece->data;
-  if(d->xform)
-  {
-    cmsDeleteTransform(d->xform);
-    d->xform = NULL;
-  }
+  dt_colorspaces_release_transform(d->xform);
+  d->xform = NULL;
+  d->clut = NULL;
 
   free(piece->data);
   piece->data = NULL;
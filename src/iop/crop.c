@@ -161,7 +161,7 @@ int default_group()
 int flags()
 {
   return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_ALLOW_FAST_PIPE
-         | IOP_FLAGS_GUIDES_SPECIAL_DRAW;
+         | IOP_FLAGS_GUIDES_SPECIAL_DRAW | IOP_FLAGS_SCALE_INDEPENDENT | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int operation_tags()
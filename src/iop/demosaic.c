@@ -34,6 +34,7 @@
 #include "develop/imageop_gui.h"
 #include "develop/masks.h"
 #include "develop/openmp_maths.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 
 #include "bauhaus/bauhaus.h"
@@ -240,6 +241,22 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
                                const dt_image_t *const img,
                                const dt_iop_roi_t *const roi_out)
 {
+  // Preview and thumbnail pipes asking for at most half (Bayer) or a third (X-Trans) of the sensor resolution
+  // average whole CFA cells straight to the output scale, instead of demosaicing at full size and
+  // downscaling afterwards. Those don't produce the raw detail mask, keep full scale when it's needed.
+  const gboolean downscaled_pipe = (piece->pipe->type & (DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_THUMBNAIL)) != 0;
+  const float max_scale = (piece->pipe->dsc.filters == 9u) ? 1.0f / 3.0f : 0.5f;
+  if(downscaled_pipe && roi_out->scale <= max_scale
+     && !(img->flags & DT_IMAGE_4BAYER)
+     && !(piece->pipe->want_detail_mask & DT_DEV_DETAIL_MASK_REQUIRED)
+     && dt_conf_get_bool("plugins/darkroom/demosaic/fast_downscaled"))
+    return DEMOSAIC_XTRANS_FULL;
+
+  // exports downscaled to half size or less at the end of the pipe can't show the finer artifacts of RCD and
+  // single pass Markesteijn over the slower methods
+  if(dt_dev_pixelpipe_performance_allows(piece->pipe, "demosaic", 0.5f))
+    return DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL | DEMOSAIC_MEDIUM_QUAL;
+
   return DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
 }
 
@@ -250,7 +267,8 @@ void amaze_demosaic_RT(
     float *out,
     const dt_iop_roi_t *const roi_in,
     const dt_iop_roi_t *const roi_out,
-    const uint32_t filters);
+    const uint32_t filters,
+    const int final_output);
 
 
 // Mind the order of includes, there are internal dependencies
@@ -286,7 +304,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_FENCE;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_FENCE | IOP_FLAGS_FUSED_OUTPUT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -506,11 +524,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     demosaicing_method = (piece->pipe->dsc.filters != 9u) ? DT_IOP_DEMOSAIC_RCD : DT_IOP_DEMOSAIC_MARKESTEIJN;
 
   const float *const pixels = (float *)i;
+  // the modules fused after us are applied by RCD and AMaZE on each tile when nothing reads their output
+  // afterwards, else on the whole output at the end
+  gboolean fused_done = FALSE;
 
   if(qual_flags & DEMOSAIC_FULL_SCALE)
   {
     // Full demosaic and then scaling if needed
     const int scaled = (roi_out->width != roi_in->width || roi_out->height != roi_in->height);
+    const gboolean final_output = !scaled && !(demosaicing_method & DEMOSAIC_DUAL) && !data->color_smoothing
+                                  && !(piece->pipe->want_detail_mask & DT_DEV_DETAIL_MASK_REQUIRED);
     float *tmp = (float *) o;
     if(scaled)
     {
@@ -584,7 +607,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
       else if((demosaicing_method & ~DEMOSAIC_DUAL) == DT_IOP_DEMOSAIC_RCD)
       {
-        rcd_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters);
+        rcd_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters, final_output);
+        fused_done = final_output;
       }
       else if(demosaicing_method == DT_IOP_DEMOSAIC_LMMSE)
       {
@@ -608,7 +632,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         demosaic_ppg(tmp, in, &roo, &roi, piece->pipe->dsc.filters,
                      data->median_thrs); // wanted ppg or zoomed out a lot and quality is limited to 1
       else
-        amaze_demosaic_RT(piece, in, tmp, &roi, &roo, piece->pipe->dsc.filters);
+      {
+        amaze_demosaic_RT(piece, in, tmp, &roi, &roo, piece->pipe->dsc.filters, final_output);
+        fused_done = final_output;
+      }
 
       if(!(img->flags & DT_IMAGE_4BAYER) && data->green_eq != DT_IOP_GREEN_EQ_NO) dt_free_align(in);
     }
@@ -655,6 +682,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
   if(data->color_smoothing)
     color_smoothing(o, roi_out, data->color_smoothing);
+
+  if(!fused_done) dt_dev_pixelpipe_fused_output(piece, (float *)o, (size_t)roi_out->width * roi_out->height);
 }
 
 #ifdef HAVE_OPENCL
@@ -939,6 +968,12 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   }
 
   const int qual_flags = demosaic_qual_flags(piece, &self->dev->image_storage, roi_out);
+  if((qual_flags & DEMOSAIC_MEDIUM_QUAL)
+  && (demosaicing_method != DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME)
+  && (demosaicing_method != DT_IOP_DEMOSAIC_PASSTHROUGH_COLOR)
+  && !((demosaicing_method & DEMOSAIC_DUAL) && showmask))
+    demosaicing_method = (piece->pipe->dsc.filters != 9u) ? DT_IOP_DEMOSAIC_RCD : DT_IOP_DEMOSAIC_MARKESTEIJN;
+
   cl_mem high_image = NULL;
   cl_mem low_image = NULL;
   cl_mem blend = NULL;
@@ -1081,11 +1116,17 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   const float smooth = data->color_smoothing ? ioratio : 0.0f;
   const float greeneq
       = ((piece->pipe->dsc.filters != 9u) && (data->green_eq != DT_IOP_GREEN_EQ_NO)) ? 0.25f : 0.0f;
-  const dt_iop_demosaic_method_t demosaicing_method = data->demosaicing_method & ~DEMOSAIC_DUAL;
+  dt_iop_demosaic_method_t demosaicing_method = data->demosaicing_method & ~DEMOSAIC_DUAL;
 
   const int qual_flags = demosaic_qual_flags(piece, &self->dev->image_storage, roi_out);
   const int full_scale_demosaicing = qual_flags & DEMOSAIC_FULL_SCALE;
 
+  // the method process() falls back to
+  if((qual_flags & DEMOSAIC_MEDIUM_QUAL)
+     && (demosaicing_method != DT_IOP_DEMOSAIC_PASSTHROUGH_MONOCHROME)
+     && (demosaicing_method != DT_IOP_DEMOSAIC_PASSTHROUGH_COLOR))
+    demosaicing_method = (piece->pipe->dsc.filters != 9u) ? DT_IOP_DEMOSAIC_RCD : DT_IOP_DEMOSAIC_MARKESTEIJN;
+
   // check if output buffer has same dimension as input buffer (thus avoiding one
   // additional temporary buffer)
   const int unscaled = (roi_out->width == roi_in->width && roi_out->height == roi_in->height);
@@ -33,7 +33,8 @@ void amaze_demosaic_RT(
     float *out,
     const dt_iop_roi_t *const roi_in,
     const dt_iop_roi_t *const roi_out,
-    const int filters);
+    const int filters,
+    const int final_output);
 }
 
 #include <algorithm>
@@ -320,7 +321,7 @@ template <typename _Tp> static inline const _Tp ULIM(const _Tp a, const _Tp b, c
 
 void amaze_demosaic_RT(dt_dev_pixelpipe_iop_t *piece, const float *const in,
                        float *out, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
-                       const int filters)
+                       const int filters, const int final_output)
 {
   int winx = roi_out->x;
   int winy = roi_out->y;
@@ -2377,6 +2378,20 @@ void amaze_demosaic_RT(dt_dev_pixelpipe_iop_t *piece, const float *const in,
               out[(row * roi_out->width + col) * 4 + 1] = clampnan(rgbgreen[indx], 0.0f, 1.0f);
           }
         }
+
+        // apply the modules fused after demosaic while the tile is still in cache
+        if(final_output)
+        {
+          const int first_col = left + 16;
+          const int last_col = std::min(left + cc1 - 16, roi_out->width);
+          for(int rr = 16; rr < rr1 - 16; rr++)
+          {
+            const int row = rr + top;
+            if(row < roi_out->height && first_col < last_col)
+              dt_dev_pixelpipe_fused_output(piece, out + ((size_t)row * roi_out->width + first_col) * 4,
+                                            last_col - first_col);
+          }
+        }
       }
     } // end of main loop
 
@@ -8,6 +8,8 @@
 #define SQR(x) ((x) * (x))
 // tile size, optimized to keep data in L2 cache
 #define TS 122
+// largest tile of Markesteijn, whose size follows the L2 cache
+#define TS_MAX 192
 
 /** Lookup for allhex[], making sure that row/col aren't negative **/
 static inline const short * hexmap(const int row, const int col, short (*const allhex)[3][8])
@@ -33,8 +35,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 {
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
 
   short allhex[3][3][8];
   // sgrow/sgcol is the offset in the sensor matrix of the solitary
@@ -44,10 +45,19 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int width = roi_out->width;
   const int height = roi_out->height;
   const int ndir = 4 << (passes > 1);
+  // extra passes propagates out errors at edges, hence need more padding
+  const int pad_tile = (passes == 1) ? 12 : 17;
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
+  // tile size: the buffer of each thread should stay in its L2 cache. Tiles overlap by 2 * pad_tile,
+  // below 5 * pad_tile they would spend more time recomputing their borders than waiting for memory.
+  // The size must be even, the green refinement below tests the parity of the row offset.
+  const size_t tile_pixel_size = (size_t)(ndir * 4 + 3) * sizeof(float);
+  const int ts = CLAMP((int)sqrtf((float)dt_get_l2_cache_size() / tile_pixel_size), 5 * pad_tile, TS_MAX) & ~1;
+  const short dir[4] = { 1, ts, ts + 1, ts - 1 };
+
+  const size_t buffer_size = (size_t)ts * ts * tile_pixel_size;
   size_t padded_buffer_size;
-  char *const all_buffers = (char *)dt_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
+  char *const all_buffers = (char *)dt_pixelpipe_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
   if(!all_buffers)
   {
     printf("[demosaic] not able to allocate Markesteijn buffers\n");
@@ -77,45 +87,43 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             const int v = orth[d] * patt[g][c * 2] + orth[d + 1] * patt[g][c * 2 + 1];
             const int h = orth[d + 2] * patt[g][c * 2] + orth[d + 3] * patt[g][c * 2 + 1];
             // offset within TSxTS buffer
-            allhex[row][col][c ^ (g * 2 & d)] = h + v * TS;
+            allhex[row][col][c ^ (g * 2 & d)] = h + v * ts;
           }
       }
 
-  // extra passes propagates out errors at edges, hence need more padding
-  const int pad_tile = (passes == 1) ? 12 : 17;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(all_buffers, padded_buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, width, xtrans) \
+  dt_omp_firstprivate(all_buffers, padded_buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, ts, width, xtrans) \
   shared(sgrow, sgcol, allhex, out) \
   schedule(static)
 #endif
   // step through TSxTS cells of image, each tile overlapping the
   // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
+  for(int top = -pad_tile; top < height - pad_tile; top += ts - (pad_tile*2))
   {
     char *const buffer = dt_get_perthread(all_buffers, padded_buffer_size);
     // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
+    float(*rgb)[ts][ts][3] = (float(*)[ts][ts][3])buffer;
     // yuv points to 3 channel (Y, u, and v) TSxTS tiles
     // note that channels come before tiles to allow for a
     // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
+    float (*const yuv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
     // drv points to ndir TSxTS tiles, each a single channel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
+    float (*const drv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3 + 3) * sizeof(float));
     // gmin and gmax reuse memory which is used later by yuv buffer;
     // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
+    float (*const gmin)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+    float (*const gmax)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3 + 1) * sizeof(float));
     // homo and homosum reuse memory which is used earlier in the
     // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
-                                                            + TS * TS * ndir * sizeof(uint8_t));
+    uint8_t (*const homo)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+    uint8_t (*const homosum)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float)
+                                                            + ts * ts * ndir * sizeof(uint8_t));
 
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
+    for(int left = -pad_tile; left < width - pad_tile; left += ts - (pad_tile*2))
     {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
+      int mrow = MIN(top + ts, height + pad_tile);
+      int mcol = MIN(left + ts, width + pad_tile);
 
       // Copy current tile from in to image buffer. If border goes
       // beyond edges of image, fill with mirrored/interpolated edges.
@@ -302,7 +310,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
             // results. Each pass which outputs moves on to the next
             // rgb[] for input of interp greens.
-            for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+            for(int i = 1, d = 0; d < 6; d++, i ^= ts ^ 1, h ^= 2)
             {
               // look 1 and 2 pixels distance from solitary green to
               // red then blue or blue then red
@@ -332,7 +340,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                 const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
                 rfx[0][0] = color[0][d_out] / 2.f;
                 rfx[0][2] = color[1][d_out] / 2.f;
-                rfx += TS * TS;
+                rfx += ts * ts;
               }
             }
           }
@@ -345,9 +353,9 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             const int f = 2 - FCxtrans(row, col, roi_in, xtrans);
             if(f == 1) continue;
             float(*rfx)[3] = &rgb[0][row - top][col - left];
-            const int c = (row - sgrow) % 3 ? TS : 1;
-            const int h = 3 * (c ^ TS ^ 1);
-            for(int d = 0; d < 4; d++, rfx += TS * TS)
+            const int c = (row - sgrow) % 3 ? ts : 1;
+            const int h = 3 * (c ^ ts ^ 1);
+            for(int d = 0; d < 4; d++, rfx += ts * ts)
             {
               const int i = d > 1 || ((d ^ c) & 1) ||
                 ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
@@ -366,7 +374,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
               {
                 float(*rfx)[3] = &rgb[0][row - top][col - left];
                 const short *const hex = hexmap(row,col,allhex);
-                for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+                for(int d = 0; d < ndir; d += 2, rfx += ts * ts)
                   if(hex[d] + hex[d + 1])
                   {
                     const float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
@@ -385,7 +393,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
       // jump back to the first set of rgb buffers (this is a nop
       // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
+      rgb = (float(*)[ts][ts][3])buffer;
       // from here on out, mainly are working within the current tile
       // rather than in reference to the image, so don't offset
       // mrow/mcol by top/left of tile
@@ -415,7 +423,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             yuv[2][row][col] = (rx[0] - y) * 0.67815f;
           }
         // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
+        // (-ts or ts). The row-wise offsets cause the undefined
         // behavior sanitizer to warn of an out of bounds index, but
         // as yfx is multi-dimensional and there is sufficient
         // padding, that is not actually so.
@@ -424,7 +432,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
         for(int row = pad_drv; row < mrow - pad_drv; row++)
           for(int col = pad_drv; col < mcol - pad_drv; col++)
           {
-            const float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+            const float(*yfx)[ts][ts] = (float(*)[ts][ts]) & yuv[0][row][col];
             drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
                                + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
                                + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
@@ -432,20 +440,33 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
       }
 
       /* Build homogeneity maps from the derivatives:                   */
-      memset_zero(homo, sizeof(uint8_t) * ndir * TS * TS);
+      memset_zero(homo, sizeof(uint8_t) * ndir * ts * ts);
       const int pad_homo = (passes == 1) ? 10 : 15;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
+      {
+        // threshold of each pixel of the row: 8 times its smallest derivative in all directions
+        float tr[ts];
         for(int col = pad_homo; col < mcol - pad_homo; col++)
         {
-          float tr = FLT_MAX;
-          for(int d = 0; d < ndir; d++)
-            if(tr > drv[d][row][col]) tr = drv[d][row][col];
-          tr *= 8;
-          for(int d = 0; d < ndir; d++)
+          float min = FLT_MAX;
+          for(int d = 0; d < ndir; d++) min = fminf(min, drv[d][row][col]);
+          tr[col] = 8.0f * min;
+        }
+        // then count the neighbours below it one direction at a time, along contiguous columns
+        for(int d = 0; d < ndir; d++)
+        {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+          for(int col = pad_homo; col < mcol - pad_homo; col++)
+          {
+            uint8_t count = 0;
             for(int v = -1; v <= 1; v++)
-              for(int h = -1; h <= 1; h++)
-                homo[d][row][col] += ((drv[d][row + v][col + h] <= tr) ? 1 : 0);
+              for(int h = -1; h <= 1; h++) count += (drv[d][row + v][col + h] <= tr[col]);
+            homo[d][row][col] = count;
+          }
         }
+      }
 
       /* Build 5x5 sum of homogeneity maps for each pixel & direction */
       for(int d = 0; d < ndir; d++)
@@ -499,7 +520,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
         }
     }
   }
-  dt_free_align(all_buffers);
+  dt_pixelpipe_free_align(all_buffers);
 }
 
 #undef TS
@@ -1053,7 +1074,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
 
   const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 7) * sizeof(float);
   size_t padded_buffer_size;
-  char *const all_buffers = (char *)dt_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
+  char *const all_buffers = (char *)dt_pixelpipe_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
   if(!all_buffers)
   {
     fprintf(stderr, "[demosaic] not able to allocate FDC base buffers\n");
@@ -1618,7 +1639,7 @@ static void xtrans_fdc_interpolate(struct dt_iop_module_t *self, float *out, con
         }
     }
   }
-  dt_free_align(all_buffers);
+  dt_pixelpipe_free_align(all_buffers);
 }
 
 #ifdef HAVE_OPENCL
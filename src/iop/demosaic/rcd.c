@@ -280,7 +280,7 @@ static void rcd_ppg_border(float *const out, const float *const in, const int wi
   #pragma omp declare simd aligned(in, out)
 #endif
 static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict out, const float *const restrict in, dt_iop_roi_t *const roi_out,
-                                   const dt_iop_roi_t *const roi_in, const uint32_t filters)
+                                   const dt_iop_roi_t *const roi_in, const uint32_t filters, const gboolean final_output)
 {
   const int width = roi_in->width;
   const int height = roi_in->height;
@@ -301,7 +301,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
 
 #ifdef _OPENMP
   #pragma omp parallel \
-  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler)
+  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler, piece, final_output)
 #endif
   {
     float *const VH_Dir = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE);
@@ -555,6 +555,10 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
             out[o_idx+2] = scaler * fmaxf(0.0f, rgb[2][idx]);
             out[o_idx+3] = 0.0f;
           }
+          // apply the modules fused after demosaic while the row is still in cache
+          if(final_output)
+            dt_dev_pixelpipe_fused_output(piece, out + ((size_t)row * width + first_horizontal) * 4,
+                                          last_horizontal - first_horizontal);
         }
       }
     }
@@ -565,6 +569,18 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
     dt_free_align(P_CDiff_Hpf);
     dt_free_align(Q_CDiff_Hpf);
   }
+
+  // the border ring interpolated by rcd_ppg_border(), not covered by the tiles
+  if(final_output)
+  {
+    dt_dev_pixelpipe_fused_output(piece, out, (size_t)RCD_MARGIN * width);
+    dt_dev_pixelpipe_fused_output(piece, out + (size_t)(height - RCD_MARGIN) * width * 4, (size_t)RCD_MARGIN * width);
+    for(int row = RCD_MARGIN; row < height - RCD_MARGIN; row++)
+    {
+      dt_dev_pixelpipe_fused_output(piece, out + (size_t)row * width * 4, RCD_MARGIN);
+      dt_dev_pixelpipe_fused_output(piece, out + ((size_t)row * width + width - RCD_MARGIN) * 4, RCD_MARGIN);
+    }
+  }
 }
 
 #ifdef HAVE_OPENCL
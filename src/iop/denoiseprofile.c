@@ -788,7 +788,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
 
     const int max_filter_radius = (1u << max_scale); // 2 * 2^max_scale
 
-    tiling->factor = 5.0f; // in + out + precond + tmp + reducebuffer
+    tiling->factor = 4.0f; // in + out + precond + tmp, the detail scales are accumulated into out
     tiling->factor_cl = 3.5f + max_scale; // in + out + tmp + reducebuffer + scale buffers
     tiling->maxbuf = 1.0f;
     tiling->maxbuf_cl = 1.0f;
@@ -1263,8 +1263,7 @@ static void variance_stabilizing_xform(dt_aligned_pixel_t thrs, const int scale,
 
 static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                              const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
-                             const dt_iop_roi_t *const roi_out, const eaw_dn_decompose_t decompose,
-                             const eaw_synthesize_t synthesize)
+                             const dt_iop_roi_t *const roi_out, const eaw_dn_decompose_t decompose)
 {
   // this is called for preview and full pipe separately, each with its own pixelpipe piece.
   // get our data struct:
@@ -1304,11 +1303,10 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     return;
   }
 
-  float *buf = NULL;
   float *restrict precond = NULL;
   float *restrict tmp = NULL;
 
-  if (!dt_iop_alloc_image_buffers(self, roi_in, roi_out, 4, &precond, 4, &tmp, 4, &buf, 0))
+  if (!dt_iop_alloc_image_buffers(self, roi_in, roi_out, 4, &precond, 4, &tmp, 0))
   {
     dt_iop_copy_image_roi(out, in, piece->colors, roi_in, roi_out, TRUE);
     return;
@@ -1369,23 +1367,26 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   float *restrict buf1 = precond;
   float *restrict buf2 = tmp;
 
-  // clear the output buffer, which will be accumulating all of the detail scales
+  // clear the output buffer, which will be accumulating all of the detail scales as soon as they are
+  // known: only the fine and the coarse buffers of the current scale are kept, the detail is their difference
   memset(out, 0, sizeof(float) * 4 * npixels);
 
   for(int scale = 0; scale < max_scale; scale++)
   {
+    // params changed meanwhile, the pipe will discard this output
+    if(dt_dev_pixelpipe_cancelled()) break;
+
     const float sigma = 1.0f;
     const float varf = sqrtf(2.0f + 2.0f * 4.0f * 4.0f + 6.0f * 6.0f) / 16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) * sigma;
     dt_aligned_pixel_t sum_y2;
-    decompose(buf2, buf1, buf, sum_y2, scale, 1.0f / (sigma_band * sigma_band), width, height);
+    decompose(buf2, buf1, sum_y2, scale, 1.0f / (sigma_band * sigma_band), width, height);
     debug_dump_PFM(piece,"/tmp/coarse_%d.pfm",buf2,width,height,scale);
-    debug_dump_PFM(piece,"/tmp/detail_%d.pfm",buf,width,height,scale);
 
     const dt_aligned_pixel_t boost = { 1.0f, 1.0f, 1.0f, 1.0f };
     dt_aligned_pixel_t thrs;
     variance_stabilizing_xform(thrs, scale, max_scale, npixels, sum_y2, d);
-    synthesize(out, out, buf, thrs, boost, width, height);
+    eaw_dn_synthesize(out, buf1, buf2, thrs, boost, width, height);
 
     float *buf3 = buf2;
     buf2 = buf1;
@@ -1412,7 +1413,6 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     backtransform_Y0U0V0(out, width, height, d->a[1] * compensate_p, p, d->b[1], d->bias - 0.5 * logf(in_scale), wb, toRGB);
   }
 
-  dt_free_align(buf);
   dt_free_align(tmp);
   dt_free_align(precond);
 
@@ -1468,6 +1468,13 @@ static float nlmeans_scattering(int *nbhood, const dt_iop_denoiseprofile_data_t
     K = MAX(MIN(4, K), K * scale);
     scattering = (maxk - K) * 6.0 / (K * K * K + 7.0 * K * sqrt(K));
   }
+  if(dt_dev_pixelpipe_performance_allows(piece->pipe, "denoiseprofile", 0.5f))
+  {
+    // same on exports downscaled at the end, the search window shrinks with the output size
+    const int maxk = (K * K * K + 7.0 * K * sqrt(K)) * scattering / 6.0 + K;
+    K = MAX(MIN(4, K), K * piece->pipe->export_scale);
+    scattering = (maxk - K) * 6.0 / (K * K * K + 7.0 * K * sqrt(K));
+  }
   *nbhood = K;
   return scattering;
 }
@@ -1612,7 +1619,7 @@ static void process_nlmeans_cpu(dt_dev_pixelpipe_iop_t *piece,
                                       .sharpness = norm,
                                       .patch_radius = P,
                                       .search_radius = K,
-                                      .decimate = 0,
+                                      .decimate = nlmeans_search_decimate(piece->pipe->type),
                                       .norm = norm2 };
   denoiser(in,ovoid,roi_in,roi_out,&params);
 
@@ -1848,7 +1855,7 @@ static int process_nlmeans_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop
         .sharpness = norm,
         .patch_radius = P,
         .search_radius = K,
-        .decimate = 0,
+        .decimate = nlmeans_search_decimate(piece->pipe->type),
         .norm = norm2,
         .pipetype = piece->pipe->type,
         .kernel_init = gd->kernel_denoiseprofile_init,
@@ -2631,7 +2638,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(d->mode == MODE_NLMEANS || d->mode == MODE_NLMEANS_AUTO)
     process_nlmeans(self, piece, ivoid, ovoid, roi_in, roi_out);
   else if(d->mode == MODE_WAVELETS || d->mode == MODE_WAVELETS_AUTO)
-    process_wavelets(self, piece, ivoid, ovoid, roi_in, roi_out, eaw_dn_decompose, eaw_synthesize);
+    process_wavelets(self, piece, ivoid, ovoid, roi_in, roi_out, eaw_dn_decompose);
   else
     process_variance(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
@@ -2644,7 +2651,7 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
   if(d->mode == MODE_NLMEANS || d->mode == MODE_NLMEANS_AUTO)
     process_nlmeans_sse(self, piece, ivoid, ovoid, roi_in, roi_out);
   else if(d->mode == MODE_WAVELETS || d->mode == MODE_WAVELETS_AUTO)
-    process_wavelets(self, piece, ivoid, ovoid, roi_in, roi_out, eaw_dn_decompose_sse, eaw_synthesize_sse2);
+    process_wavelets(self, piece, ivoid, ovoid, roi_in, roi_out, eaw_dn_decompose_sse);
   else
     process_variance(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
@@ -36,6 +36,7 @@
 #include "develop/imageop_math.h"
 #include "develop/noise_generator.h"
 #include "develop/openmp_maths.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "dtgtk/button.h"
 #include "dtgtk/drawingarea.h"
@@ -884,7 +885,8 @@ static inline gint wavelets_process(const float *const restrict in, float *const
                                     const int has_mask,
                                     float *const restrict HF[MAX_NUM_SCALES],
                                     float *const restrict LF_odd,
-                                    float *const restrict LF_even)
+                                    float *const restrict LF_even,
+                                    float *const restrict tempbuf, const size_t padded_size)
 {
   gint success = TRUE;
 
@@ -907,9 +909,6 @@ static inline gint wavelets_process(const float *const restrict in, float *const
   // there is a paper from a guy we know that explains it : https://jo.dreggn.org/home/2010_atrous.pdf
   // the wavelets decomposition here is the same as the equalizer/atrous module,
   float *restrict residual; // will store the temp buffer containing the last step of blur
-  // allocate a one-row temporary buffer for the decomposition
-  size_t padded_size;
-  float *const DT_ALIGNED_ARRAY tempbuf = dt_alloc_perthread_float(4 * width, &padded_size); //TODO: alloc in caller
   for(int s = 0; s < scales; ++s)
   {
     /* fprintf(stdout, "Wavelet decompose : scale %i\n", s); */
@@ -947,8 +946,6 @@ static inline gint wavelets_process(const float *const restrict in, float *const
     dump_PFM(name, buffer_out, width, height);
 #endif
   }
-  dt_free_align(tempbuf);
-
   // will store the temp buffer NOT containing the last step of blur
   float *restrict temp = (residual == LF_even) ? LF_odd : LF_even;
 
@@ -1067,13 +1064,13 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   float *restrict in = DT_IS_ALIGNED((float *const restrict)ivoid);
   float *const restrict out = DT_IS_ALIGNED((float *const restrict)ovoid);
 
-  float *const restrict temp1 = dt_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
-  float *const restrict temp2 = dt_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
+  float *const restrict temp1 = dt_pixelpipe_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
+  float *const restrict temp2 = dt_pixelpipe_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
 
   float *restrict temp_in = NULL;
   float *restrict temp_out = NULL;
 
-  uint8_t *const restrict mask = dt_alloc_align(sizeof(uint8_t) * roi_out->width * roi_out->height);
+  uint8_t *const restrict mask = dt_pixelpipe_alloc_align(sizeof(uint8_t) * roi_out->width * roi_out->height);
 
   const float scale = fmaxf(piece->iscale / roi_in->scale, 1.f);
   const float final_radius = (data->radius + data->radius_center) * 2.f / scale;
@@ -1088,18 +1085,22 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   float *restrict HF[MAX_NUM_SCALES];
   for(int s = 0; s < scales; s++)
   {
-    HF[s] = dt_alloc_align_float(width * height * 4);
+    HF[s] = dt_pixelpipe_alloc_align_float(width * height * 4);
     if(!HF[s]) out_of_memory = TRUE;
   }
 
   // temp buffer for blurs. We will need to cycle between them for memory efficiency
-  float *const restrict LF_odd = dt_alloc_align_float(width * height * 4);
-  float *const restrict LF_even = dt_alloc_align_float(width * height * 4);
+  float *const restrict LF_odd = dt_pixelpipe_alloc_align_float(width * height * 4);
+  float *const restrict LF_even = dt_pixelpipe_alloc_align_float(width * height * 4);
+
+  // one-row temporary buffer per thread for the decompositions, shared by all iterations
+  size_t padded_size;
+  float *const restrict tempbuf = dt_pixelpipe_alloc_perthread_float(4 * width, &padded_size);
 
   // PAUSE !
   // check that all buffers exist before processing,
   // because we use a lot of memory here.
-  if(!temp1 || !temp2 || !LF_odd || !LF_even || out_of_memory)
+  if(!temp1 || !temp2 || !LF_odd || !LF_even || !tempbuf || out_of_memory)
   {
     dt_control_log(_("diffuse/sharpen failed to allocate memory, check your RAM settings"));
     goto error;
@@ -1120,6 +1121,9 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
   for(int it = 0; it < iterations; it++)
   {
+    // params changed meanwhile, the pipe will discard this output
+    if(dt_dev_pixelpipe_cancelled()) break;
+
     if(it == 0)
     {
       temp_in = in;
@@ -1141,16 +1145,17 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
     wavelets_process(temp_in, temp_out, mask,
                      roi_out->width, roi_out->height,
-                     data, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even);
+                     data, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even, tempbuf, padded_size);
   }
 
 error:
-  if(mask) dt_free_align(mask);
-  if(temp1) dt_free_align(temp1);
-  if(temp2) dt_free_align(temp2);
-  if(LF_even) dt_free_align(LF_even);
-  if(LF_odd) dt_free_align(LF_odd);
-  for(int s = 0; s < scales; s++) if(HF[s]) dt_free_align(HF[s]);
+  if(mask) dt_pixelpipe_free_align(mask);
+  if(temp1) dt_pixelpipe_free_align(temp1);
+  if(temp2) dt_pixelpipe_free_align(temp2);
+  if(LF_even) dt_pixelpipe_free_align(LF_even);
+  if(LF_odd) dt_pixelpipe_free_align(LF_odd);
+  if(tempbuf) dt_pixelpipe_free_align(tempbuf);
+  for(int s = 0; s < scales; s++) if(HF[s]) dt_pixelpipe_free_align(HF[s]);
 }
 
 #if HAVE_OPENCL
@@ -1393,6 +1398,9 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   for(int it = 0; it < iterations; it++)
   {
+    // params changed meanwhile, the pipe will discard this output
+    if(dt_dev_pixelpipe_cancelled()) break;
+
     if(it == 0)
     {
       temp_in = in;
@@ -91,6 +91,11 @@ typedef struct dt_iop_dither_data_t
   } random;
 } dt_iop_dither_data_t;
 
+typedef struct dt_iop_dither_global_data_t
+{
+  int kernel_dither;
+} dt_iop_dither_global_data_t;
+
 
 const char *name()
 {
@@ -610,6 +615,16 @@ static void process_floyd_steinberg_sse2(struct dt_iop_module_t *self, dt_dev_pi
 }
 #endif
 
+// the noise of a pixel only depends on its position in the full image: encrypting the coordinates gives
+// an independent random number per pixel, so the loop vectorizes, tiles join seamlessly and the result
+// doesn't depend on the number of threads
+static inline float _random_dither(const unsigned int x, const unsigned int y, const float dither)
+{
+  unsigned int tea_state[2] = { x, y };
+  encrypt_tea(tea_state);
+  return dither * tpdf(tea_state[0]);
+}
+
 static void process_random(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                            const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                            const dt_iop_roi_t *const roi_out)
@@ -618,49 +633,76 @@ static void process_random(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
 
   const int width = roi_in->width;
   const int height = roi_in->height;
+  const int x0 = roi_out->x;
+  const int y0 = roi_out->y;
   assert(piece->colors == 4);
 
   const float dither = powf(2.0f, data->random.damping / 10.0f);
 
-  unsigned int *const tea_states = alloc_tea_states(dt_get_num_threads());
-
 #ifdef _OPENMP
-#pragma omp parallel default(none) \
-  dt_omp_firstprivate(dither, height, width) \
-  dt_omp_sharedconst(tea_states, ivoid, ovoid)
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(dither, height, width, x0, y0) \
+  dt_omp_sharedconst(ivoid, ovoid) \
+  schedule(static)
 #endif
+  for(int j = 0; j < height; j++)
   {
-    // get a pointer to each thread's private buffer *outside* the for loop, to avoid a function call per iteration
-    unsigned int *const tea_state = get_tea_state(tea_states,dt_get_thread_num());
+    const size_t k = (size_t)4 * width * j;
+    const float *const restrict in = (const float *)ivoid + k;
+    float *const restrict out = (float *)ovoid + k;
 #ifdef _OPENMP
-#pragma omp for schedule(static)
+#pragma omp simd aligned(in, out : 64)
 #endif
-    for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
     {
-      const size_t k = (size_t)4 * width * j;
-      const float *const in = (const float *)ivoid + k;
-      float *const out = (float *)ovoid + k;
-      tea_state[0] = j * height; /* + dt_get_thread_num() -- do not include, makes results unreproducible */
-      for(int i = 0; i < width; i++)
+      const float dith = _random_dither(x0 + i, y0 + j, dither);
+      for(int c = 0; c < 4; c++)
       {
-        encrypt_tea(tea_state);
-        float dith = dither * tpdf(tea_state[0]);
-
-#ifdef _OPENMP
-#pragma omp simd aligned(in, out : 64)
-#endif
-        for(int c = 0; c < 4; c++)
-        {
-          out[4*i+c] = CLIP(in[4*i+c] + dith);
-        }
+        out[4*i+c] = CLIP(in[4*i+c] + dith);
       }
     }
   }
-  free_tea_states(tea_states);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_dither_data_t *const data = (dt_iop_dither_data_t *)piece->data;
+  const dt_iop_dither_global_data_t *const gd = (dt_iop_dither_global_data_t *)self->global_data;
+
+  // error diffusion walks the image in order, it stays on the CPU
+  if(data->dither_type != DITHER_RANDOM) return FALSE;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int x0 = roi_out->x;
+  const int y0 = roi_out->y;
+  const float dither = powf(2.0f, data->random.damping / 10.0f);
+  const int keep_alpha = (piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) != 0;
+
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 4, sizeof(int), (void *)&x0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 5, sizeof(int), (void *)&y0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 6, sizeof(float), (void *)&dither);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_dither, 7, sizeof(int), (void *)&keep_alpha);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_dither, sizes);
+  if(err != CL_SUCCESS) goto error;
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[opencl_dither] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
 
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -740,6 +782,22 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->random.damping = p->random.damping;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 8; // extended.cl from programs.conf
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)malloc(sizeof(dt_iop_dither_global_data_t));
+  module->data = gd;
+  gd->kernel_dither = dt_opencl_create_kernel(program, "dither");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_dither);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   piece->data = malloc(sizeof(dt_iop_dither_data_t));
@@ -24,6 +24,7 @@
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_arena.h"
 #include "gui/draw.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
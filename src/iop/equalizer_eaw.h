@@ -46,7 +46,7 @@ static void dt_iop_equalizer_wtf(float *const buf, float **weight_a, const int l
   const int st = step / 2;
 
   size_t scratch_size;
-  float *const restrict tmp_width_buf = dt_alloc_perthread_float(width, &scratch_size);
+  float *const restrict tmp_width_buf = dt_pixelpipe_alloc_perthread_float(width, &scratch_size);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(height, l, st, step, tmp_width_buf, scratch_size, wd, width) \
@@ -79,9 +79,9 @@ static void dt_iop_equalizer_wtf(float *const buf, float **weight_a, const int l
       for(ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i - st, j) * .5f;
   }
 
-  dt_free_align(tmp_width_buf);
+  dt_pixelpipe_free_align(tmp_width_buf);
 
-  float *const restrict tmp_height_buf = dt_alloc_perthread_float(height, &scratch_size);
+  float *const restrict tmp_height_buf = dt_pixelpipe_alloc_perthread_float(height, &scratch_size);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(height, l, st, step, tmp_height_buf, scratch_size, wd, width) \
@@ -114,7 +114,7 @@ static void dt_iop_equalizer_wtf(float *const buf, float **weight_a, const int l
       for(ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st) * .5f;
   }
 
-  dt_free_align(tmp_height_buf);
+  dt_pixelpipe_free_align(tmp_height_buf);
 }
 
 static void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, const int width, const int height)
@@ -124,7 +124,7 @@ static void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, con
   const int wd = (int)(1 + (width >> (l - 1)));
 
   size_t scratch_size;
-  float *const restrict tmp_height_buf = dt_alloc_perthread_float(height, &scratch_size);
+  float *const restrict tmp_height_buf = dt_pixelpipe_alloc_perthread_float(height, &scratch_size);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(height, l, st, step, tmp_height_buf, scratch_size, wd, width) \
@@ -154,9 +154,9 @@ static void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, con
       for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i, j - st);
   }
 
-  dt_free_align(tmp_height_buf);
+  dt_pixelpipe_free_align(tmp_height_buf);
 
-  float *const restrict tmp_width_buf = dt_alloc_perthread_float(width, &scratch_size);
+  float *const restrict tmp_width_buf = dt_pixelpipe_alloc_perthread_float(width, &scratch_size);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
   dt_omp_firstprivate(height, l, st, step, tmp_width_buf, scratch_size, wd, width) \
@@ -186,7 +186,7 @@ static void dt_iop_equalizer_iwtf(float *buf, float **weight_a, const int l, con
       for(int ch = 0; ch < 3; ch++) gbuf(buf, i, j) += gbuf(buf, i - st, j);
   }
 
-  dt_free_align(tmp_width_buf);
+  dt_pixelpipe_free_align(tmp_width_buf);
 }
 
 #undef gbuf
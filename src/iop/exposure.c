@@ -141,7 +141,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_SCALE_INDEPENDENT | IOP_FLAGS_INPLACE;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -415,6 +415,17 @@ static void _process_common_setup(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
   d->scale = 1.0 / (white - d->black);
 }
 
+void output_format(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                   dt_iop_buffer_dsc_t *dsc)
+{
+  default_output_format(self, pipe, piece, dsc);
+
+  // the deflicker scale is only known at processing time, process() updates the maximum then
+  const dt_iop_exposure_data_t *const d = (const dt_iop_exposure_data_t *const)piece->data;
+  if(!d->deflicker)
+    for(int k = 0; k < 3; k++) dsc->processed_maximum[k] *= d->scale;
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -438,7 +449,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dt_opencl_set_kernel_arg(devid, gd->kernel_exposure, 5, sizeof(float), (void *)&(d->scale));
   err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_exposure, sizes);
   if(err != CL_SUCCESS) goto error;
-  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
+  if(d->deflicker)
+    for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
 
   return TRUE;
 
@@ -457,8 +469,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   const int ch = piece->colors;
 
-  const float *const restrict in = (float*)i;
-  float *const restrict out = (float*)o;
+  // in and out may be the same buffer
+  const float *const in = (float*)i;
+  float *const out = (float*)o;
   const float black = d->black;
   const float scale = d->scale;
   const size_t npixels = (size_t)roi_out->width * roi_out->height;
@@ -475,7 +488,18 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
 
-  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
+  if(d->deflicker)
+    for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] *= d->scale;
+}
+
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_exposure_data_t *const d = (const dt_iop_exposure_data_t *const)piece->data;
+  const float black = d->black;
+  const float scale = d->scale;
+
+  for(size_t k = 0; k < 4 * npixels; k++) out[k] = (in[k] - black) * scale;
 }
 
 
@@ -519,11 +543,21 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   {
     d->deflicker = 1;
   }
+
+  // the manual scale doesn't depend on the image, output_format() and process_pixels() need it ahead
+  if(!d->deflicker)
+  {
+    d->black = d->params.black;
+    const float white = exposure2white(d->params.exposure);
+    d->scale = 1.0 / (white - d->black);
+  }
+  // deflicker computes its scale from the raw histogram in process()
+  piece->process_pixels_ready = !d->deflicker;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_exposure_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_exposure_data_t));
   piece->data_size = sizeof(dt_iop_exposure_data_t);
 }
 
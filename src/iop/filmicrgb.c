@@ -365,7 +365,8 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING
+         | IOP_FLAGS_DISPLAY_REFERRED;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -950,28 +951,103 @@ static inline gint mask_clipped_pixels(const float *const restrict in, float *co
 }
 
 
+// bounding box of the pixels of mask weighing more than 2^-10 in the reconstruction, padded by the support of
+// the wavelets over scales so the reconstruction inside the box doesn't depend on where its borders are.
+// out of it, the pixels would take less than 2^-10 of the reconstruction, they are kept as they are.
+static void reconstruction_bounds(const float *const restrict mask, const size_t width, const size_t height,
+                                  const int scales, size_t *const x, size_t *const y, size_t *const box_width,
+                                  size_t *const box_height)
+{
+  // the B-spline blurs reach 2 * 2^s pixels at scale s, the high frequencies are blurred once more at scale 0
+  const size_t padding = (size_t)1 << (scales + 1);
+  const float threshold = 1.0f / 1024.0f;
+
+  size_t x_min = width, x_max = 0, y_min = height, y_max = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(mask, width, height, threshold) \
+  reduction(min: x_min, y_min) reduction(max: x_max, y_max) \
+  schedule(static)
+#endif
+  for(size_t i = 0; i < height; i++)
+  {
+    const float *const restrict row = mask + i * width;
+    size_t first = width, last = 0;
+    for(size_t j = 0; j < width; j++)
+      if(row[j] > threshold)
+      {
+        first = MIN(first, j);
+        last = j;
+      }
+    if(first == width) continue;
+    x_min = MIN(x_min, first);
+    x_max = MAX(x_max, last);
+    y_min = MIN(y_min, i);
+    y_max = MAX(y_max, i);
+  }
+
+  if(x_min > x_max || y_min > y_max)
+  {
+    // nothing to reconstruct, keep the whole buffer
+    *x = *y = 0;
+    *box_width = width;
+    *box_height = height;
+    return;
+  }
+
+  *x = (x_min > padding) ? x_min - padding : 0;
+  *y = (y_min > padding) ? y_min - padding : 0;
+  *box_width = MIN(x_max + padding + 1, width) - *x;
+  *box_height = MIN(y_max + padding + 1, height) - *y;
+}
+
+
+// copy the width x height box at (x, y) of buf into box, or box back into buf if to_box is FALSE
+static void copy_box(float *const restrict box, float *const restrict buf, const size_t buf_width, const size_t x,
+                     const size_t y, const size_t width, const size_t height, const size_t ch,
+                     const gboolean to_box)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(box, buf, buf_width, x, y, width, height, ch, to_box) \
+  schedule(static)
+#endif
+  for(size_t i = 0; i < height; i++)
+  {
+    float *const restrict box_row = box + i * width * ch;
+    float *const restrict buf_row = buf + ((y + i) * buf_width + x) * ch;
+    if(to_box)
+      memcpy(box_row, buf_row, sizeof(float) * width * ch);
+    else
+      memcpy(buf_row, box_row, sizeof(float) * width * ch);
+  }
+}
+
+
 #ifdef _OPENMP
-#pragma omp declare simd aligned(in, mask, inpainted:64) uniform(width, height, noise_level, noise_distribution, threshold)
+#pragma omp declare simd aligned(in, mask, inpainted:64) uniform(width, height, x, y, noise_level, noise_distribution, threshold)
 #endif
 inline static void inpaint_noise(const float *const in, const float *const mask,
                                  float *const inpainted, const float noise_level, const float threshold,
                                  const dt_noise_distribution_t noise_distribution,
-                                 const size_t width, const size_t height)
+                                 const size_t width, const size_t height, const size_t x, const size_t y)
 {
   // add statistical noise in highlights to fill-in texture
   // this creates "particules" in highlights, that will help the implicit partial derivative equation
   // solver used in wavelets reconstruction to generate texture
+  // (x, y) is the position of the buffer in the image, so the noise doesn't depend on the reconstructed box
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, mask, inpainted, width, height, noise_level, noise_distribution, threshold) \
+  dt_omp_firstprivate(in, mask, inpainted, width, height, x, y, noise_level, noise_distribution, threshold) \
   schedule(simd:static) collapse(2)
 #endif
   for(size_t i = 0; i < height; i++)
     for(size_t j = 0; j < width; j++)
     {
       // Init random number generator
-      uint32_t DT_ALIGNED_ARRAY state[4] = { splitmix32(j + 1), splitmix32((j + 1) * (i + 3)), splitmix32(1337), splitmix32(666) };
+      uint32_t DT_ALIGNED_ARRAY state[4] = { splitmix32(x + j + 1), splitmix32((x + j + 1) * (y + i + 3)), splitmix32(1337), splitmix32(666) };
       xoshiro128plus(state);
       xoshiro128plus(state);
       xoshiro128plus(state);
@@ -2120,34 +2196,65 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
   // if fast mode is not in use
   if(recover_highlights && mask && reconstructed)
   {
-    // init the blown areas with noise to create particles
-    float *const restrict inpainted =  dt_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
-    inpaint_noise(in, mask, inpainted, data->noise_level / scale, data->reconstruct_threshold, data->noise_distribution,
-                  roi_out->width, roi_out->height);
+    // the wavelets only run on the box around the clipped pixels, out of it the image is kept as is
+    size_t x = 0, y = 0, width = roi_out->width, height = roi_out->height;
+    reconstruction_bounds(mask, roi_out->width, roi_out->height, get_scales(roi_in, piece), &x, &y, &width,
+                          &height);
+    const gboolean cropped = width < roi_out->width || height < roi_out->height;
+
+    dt_iop_roi_t roi_box = *roi_out;
+    roi_box.width = width;
+    roi_box.height = height;
+
+    float *box_in = in;
+    float *box_mask = mask;
+    float *box_reconstructed = reconstructed;
+    if(cropped)
+    {
+      box_in = dt_alloc_align_float(width * height * 4);
+      box_mask = dt_alloc_align_float(width * height);
+      box_reconstructed = dt_alloc_align_float(width * height * 4);
+      if(box_in && box_mask && box_reconstructed)
+      {
+        copy_box(box_in, in, roi_out->width, x, y, width, height, 4, TRUE);
+        copy_box(box_mask, mask, roi_out->width, x, y, width, height, 1, TRUE);
+      }
+    }
 
-    // diffuse particles with wavelets reconstruction
-    // PASS 1 on RGB channels
-    const gint success_1 = reconstruct_highlights(inpainted, mask, reconstructed, DT_FILMIC_RECONSTRUCT_RGB, ch, data, piece, roi_in, roi_out);
+    // init the blown areas with noise to create particles
+    float *const restrict inpainted = dt_alloc_align_float(width * height * 4);
+    gint success_1 = FALSE;
     gint success_2 = TRUE;
 
-    dt_free_align(inpainted);
+    if(inpainted && box_in && box_mask && box_reconstructed)
+    {
+      inpaint_noise(box_in, box_mask, inpainted, data->noise_level / scale, data->reconstruct_threshold,
+                    data->noise_distribution, width, height, x, y);
+
+      // diffuse particles with wavelets reconstruction
+      // PASS 1 on RGB channels
+      success_1 = reconstruct_highlights(inpainted, box_mask, box_reconstructed, DT_FILMIC_RECONSTRUCT_RGB, ch,
+                                         data, piece, roi_in, &roi_box);
+    }
+
+    if(inpainted) dt_free_align(inpainted);
 
     if(data->high_quality_reconstruction > 0 && success_1)
     {
-      float *const restrict norms = dt_alloc_align_float((size_t)roi_out->width * roi_out->height);
-      float *const restrict ratios = dt_alloc_align_float((size_t)roi_out->width * roi_out->height * 4);
+      float *const restrict norms = dt_alloc_align_float(width * height);
+      float *const restrict ratios = dt_alloc_align_float(width * height * 4);
 
       // reconstruct highlights PASS 2 on ratios
       if(norms && ratios)
       {
         for(int i = 0; i < data->high_quality_reconstruction; i++)
         {
-          compute_ratios(reconstructed, norms, ratios, work_profile, DT_FILMIC_METHOD_EUCLIDEAN_NORM_V1,
-                         roi_out->width, roi_out->height);
+          compute_ratios(box_reconstructed, norms, ratios, work_profile, DT_FILMIC_METHOD_EUCLIDEAN_NORM_V1,
+                         width, height);
           success_2 = success_2
-                      && reconstruct_highlights(ratios, mask, reconstructed, DT_FILMIC_RECONSTRUCT_RATIOS, ch,
-                                                data, piece, roi_in, roi_out);
-          restore_ratios(reconstructed, norms, roi_out->width, roi_out->height);
+                      && reconstruct_highlights(ratios, box_mask, box_reconstructed, DT_FILMIC_RECONSTRUCT_RATIOS,
+                                                ch, data, piece, roi_in, &roi_box);
+          restore_ratios(box_reconstructed, norms, width, height);
         }
       }
 
@@ -2155,7 +2262,22 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       if(ratios) dt_free_align(ratios);
     }
 
-    if(success_1 && success_2) in = reconstructed; // use reconstructed buffer as tonemapping input
+    if(success_1 && success_2)
+    {
+      if(cropped)
+      {
+        memcpy(reconstructed, in, sizeof(float) * roi_out->width * roi_out->height * 4);
+        copy_box(box_reconstructed, reconstructed, roi_out->width, x, y, width, height, 4, FALSE);
+      }
+      in = reconstructed; // use reconstructed buffer as tonemapping input
+    }
+
+    if(cropped)
+    {
+      if(box_in) dt_free_align(box_in);
+      if(box_mask) dt_free_align(box_mask);
+      if(box_reconstructed) dt_free_align(box_reconstructed);
+    }
   }
 
   if(mask) dt_free_align(mask);
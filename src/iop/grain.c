@@ -24,6 +24,7 @@
 
 #include "bauhaus/bauhaus.h"
 #include "common/math.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
@@ -84,6 +85,11 @@ typedef struct dt_iop_grain_data_t
   float grain_lut[GRAIN_LUT_SIZE * GRAIN_LUT_SIZE];
 } dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_global_data_t
+{
+  int kernel_grain;
+} dt_iop_grain_global_data_t;
+
 
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params,
                   const int new_version)
@@ -144,151 +150,77 @@ static void _simplex_noise_init()
 {
   for(int i = 0; i < 512; i++) perm[i] = permutation[i & 255];
 }
-static double dot(int g[], double x, double y, double z)
-{
-  return g[0] * x + g[1] * y + g[2] * z;
-}
 
 #define FASTFLOOR(x) (x > 0 ? (int)(x) : (int)(x)-1)
 
-static double _simplex_noise(double xin, double yin, double zin)
+// the simplex is chosen from comparisons instead of nested branches and the corners with no contribution
+// are clamped to zero, so that the noise of consecutive pixels can be evaluated in SIMD lanes.
+// the float version is precise enough as long as the coordinates stay small, see _grain_octaves().
+#ifdef _OPENMP
+#pragma omp declare simd
+#endif
+static inline float _simplex_noise(const float xin, const float yin, const float zin)
 {
-  double n0, n1, n2, n3; // Noise contributions from the four corners
-                         // Skew the input space to determine which simplex cell we're in
-  const double F3 = 1.0 / 3.0;
-  const double s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
+  // Skew the input space to determine which simplex cell we're in
+  const float F3 = 1.0f / 3.0f;
+  const float s = (xin + yin + zin) * F3; // Very nice and simple skew factor for 3D
   const int i = FASTFLOOR(xin + s);
   const int j = FASTFLOOR(yin + s);
   const int k = FASTFLOOR(zin + s);
-  const double G3 = 1.0 / 6.0; // Very nice and simple unskew factor, too
-  const double t = (i + j + k) * G3;
-  const double X0 = i - t; // Unskew the cell origin back to (x,y,z) space
-  const double Y0 = j - t;
-  const double Z0 = k - t;
-  const double x0 = xin - X0; // The x,y,z distances from the cell origin
-  const double y0 = yin - Y0;
-  const double z0 = zin - Z0;
+  const float G3 = 1.0f / 6.0f; // Very nice and simple unskew factor, too
+  const float t = (i + j + k) * G3;
+  const float x0 = xin - (i - t); // The x,y,z distances from the cell origin
+  const float y0 = yin - (j - t);
+  const float z0 = zin - (k - t);
   // For the 3D case, the simplex shape is a slightly irregular tetrahedron.
-  // Determine which simplex we are in.
-  int i1, j1, k1; // Offsets for second corner of simplex in (i,j,k) coords
-  int i2, j2, k2; // Offsets for third corner of simplex in (i,j,k) coords
-  if(x0 >= y0)
-  {
-    if(y0 >= z0)
-    {
-      i1 = 1; // X Y Z order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
-    else if(x0 >= z0)
-    {
-      i1 = 1; // X Z Y order
-      j1 = 0;
-      k1 = 0;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Z X Y order
-      j1 = 0;
-      k1 = 1;
-      i2 = 1;
-      j2 = 0;
-      k2 = 1;
-    }
-  }
-  else // x0<y0
-  {
-    if(y0 < z0)
-    {
-      i1 = 0; // Z Y X order
-      j1 = 0;
-      k1 = 1;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else if(x0 < z0)
-    {
-      i1 = 0; // Y Z X order
-      j1 = 1;
-      k1 = 0;
-      i2 = 0;
-      j2 = 1;
-      k2 = 1;
-    }
-    else
-    {
-      i1 = 0; // Y X Z order
-      j1 = 1;
-      k1 = 0;
-      i2 = 1;
-      j2 = 1;
-      k2 = 0;
-    }
-  }
+  // Determine which simplex we are in: the second corner steps along the largest distance,
+  // the third one along the two largest.
+  const int xy = x0 >= y0;
+  const int yz = y0 >= z0;
+  const int xz = x0 >= z0;
+  const int i1 = xy && xz;
+  const int j1 = !xy && yz;
+  const int k1 = !yz && !xz;
+  const int i2 = xy || xz;
+  const int j2 = !xy || yz;
+  const int k2 = !yz || !xz;
   //  A step of (1,0,0) in (i,j,k) means a step of (1-c,-c,-c) in (x,y,z),
   //  a step of (0,1,0) in (i,j,k) means a step of (-c,1-c,-c) in (x,y,z), and
   //  a step of (0,0,1) in (i,j,k) means a step of (-c,-c,1-c) in (x,y,z), where
   //  c = 1/6.
-  const double x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
-  const double y1 = y0 - j1 + G3;
-  const double z1 = z0 - k1 + G3;
-  const double x2 = x0 - i2 + 2.0 * G3; // Offsets for third corner in (x,y,z) coords
-  const double y2 = y0 - j2 + 2.0 * G3;
-  const double z2 = z0 - k2 + 2.0 * G3;
-  const double x3 = x0 - 1.0 + 3.0 * G3; // Offsets for last corner in (x,y,z) coords
-  const double y3 = y0 - 1.0 + 3.0 * G3;
-  const double z3 = z0 - 1.0 + 3.0 * G3;
+  const float x1 = x0 - i1 + G3; // Offsets for second corner in (x,y,z) coords
+  const float y1 = y0 - j1 + G3;
+  const float z1 = z0 - k1 + G3;
+  const float x2 = x0 - i2 + 2.0f * G3; // Offsets for third corner in (x,y,z) coords
+  const float y2 = y0 - j2 + 2.0f * G3;
+  const float z2 = z0 - k2 + 2.0f * G3;
+  const float x3 = x0 - 1.0f + 3.0f * G3; // Offsets for last corner in (x,y,z) coords
+  const float y3 = y0 - 1.0f + 3.0f * G3;
+  const float z3 = z0 - 1.0f + 3.0f * G3;
   // Work out the hashed gradient indices of the four simplex corners
   const int ii = i & 255;
   const int jj = j & 255;
   const int kk = k & 255;
-  const int gi0 = perm[ii + perm[jj + perm[kk]]] % 12;
-  const int gi1 = perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12;
-  const int gi2 = perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12;
-  const int gi3 = perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12;
+  const int *const g0 = grad3[perm[ii + perm[jj + perm[kk]]] % 12];
+  const int *const g1 = grad3[perm[ii + i1 + perm[jj + j1 + perm[kk + k1]]] % 12];
+  const int *const g2 = grad3[perm[ii + i2 + perm[jj + j2 + perm[kk + k2]]] % 12];
+  const int *const g3 = grad3[perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12];
   // Calculate the contribution from the four corners
-  double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
-  if(t0 < 0)
-    n0 = 0.0;
-  else
-  {
-    t0 *= t0;
-    n0 = t0 * t0 * dot(grad3[gi0], x0, y0, z0);
-  }
-  double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
-  if(t1 < 0)
-    n1 = 0.0;
-  else
-  {
-    t1 *= t1;
-    n1 = t1 * t1 * dot(grad3[gi1], x1, y1, z1);
-  }
-  double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
-  if(t2 < 0)
-    n2 = 0.0;
-  else
-  {
-    t2 *= t2;
-    n2 = t2 * t2 * dot(grad3[gi2], x2, y2, z2);
-  }
-  double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
-  if(t3 < 0)
-    n3 = 0.0;
-  else
-  {
-    t3 *= t3;
-    n3 = t3 * t3 * dot(grad3[gi3], x3, y3, z3);
-  }
+  float t0 = fmaxf(0.6f - x0 * x0 - y0 * y0 - z0 * z0, 0.0f);
+  float t1 = fmaxf(0.6f - x1 * x1 - y1 * y1 - z1 * z1, 0.0f);
+  float t2 = fmaxf(0.6f - x2 * x2 - y2 * y2 - z2 * z2, 0.0f);
+  float t3 = fmaxf(0.6f - x3 * x3 - y3 * y3 - z3 * z3, 0.0f);
+  t0 *= t0;
+  t1 *= t1;
+  t2 *= t2;
+  t3 *= t3;
+  const float n0 = t0 * t0 * (g0[0] * x0 + g0[1] * y0 + g0[2] * z0);
+  const float n1 = t1 * t1 * (g1[0] * x1 + g1[1] * y1 + g1[2] * z1);
+  const float n2 = t2 * t2 * (g2[0] * x2 + g2[1] * y2 + g2[2] * z2);
+  const float n3 = t3 * t3 * (g3[0] * x3 + g3[1] * y3 + g3[2] * z3);
   // Add contributions from each corner to get the final noise value.
   // The result is scaled to stay just inside [-1,1]
-  return 32.0 * (n0 + n1 + n2 + n3);
+  return 32.0f * (n0 + n1 + n2 + n3);
 }
 
 #define PRIME_LEVELS 4
@@ -347,18 +279,32 @@ static double _perlin_2d_noise(double x,double y,uint32_t octaves,double persist
   return total;
 }*/
 
-static double _simplex_2d_noise(double x, double y, uint32_t octaves, double persistance, double z)
-{
-  double total = 0;
+#define GRAIN_OCTAVES 3
+// the permutation wraps every 256 cells, which makes the noise periodic along x with this period
+#define GRAIN_NOISE_PERIOD 768.0
 
-  // parametrization of octaves to match power spectrum of real grain scans
-  static double f[] = {0.4910, 0.9441, 1.7280};
-  static double a[] = {0.2340, 0.7850, 1.2150};
+// parametrization of octaves to match power spectrum of real grain scans
+static const float _octave_freq[GRAIN_OCTAVES] = { 0.4910f, 0.9441f, 1.7280f };
+static const float _octave_amp[GRAIN_OCTAVES] = { 0.2340f, 0.7850f, 1.2150f };
 
-  for(uint32_t o = 0; o < octaves; o++)
+// the frequency of each octave and the offset of the per-image hash in noise space. the offset grows with
+// the image width and would eat all the precision of the float noise, it is reduced modulo the period here.
+static void _grain_octaves(const double hash, const double zoom, float scale[GRAIN_OCTAVES],
+                           float offset[GRAIN_OCTAVES])
+{
+  for(int o = 0; o < GRAIN_OCTAVES; o++)
   {
-    total += (_simplex_noise(x * f[o] / z, y * f[o] / z, o) * a[o]);
+    scale[o] = _octave_freq[o] / zoom;
+    offset[o] = fmod(hash * _octave_freq[o] / zoom, GRAIN_NOISE_PERIOD);
   }
+}
+
+static inline float _simplex_2d_noise(const float x, const float y, const float *const scale,
+                                      const float *const offset)
+{
+  float total = 0.0f;
+  for(int o = 0; o < GRAIN_OCTAVES; o++)
+    total += _simplex_noise(x * scale[o] + offset[o], y * scale[o], o) * _octave_amp[o];
   return total;
 }
 
@@ -389,7 +335,7 @@ static void evaluate_grain_lut(float *grain_lut, const float mb)
   }
 }
 
-static float dt_lut_lookup_2d_1c(const float *grain_lut, const float x, const float y)
+static inline float dt_lut_lookup_2d_1c(const float *grain_lut, const float x, const float y)
 {
   const float _x = CLAMPS((x + 0.5) * (GRAIN_LUT_SIZE - 1), 0, GRAIN_LUT_SIZE - 1);
   const float _y = CLAMPS(y * (GRAIN_LUT_SIZE - 1), 0, GRAIN_LUT_SIZE - 1);
@@ -455,49 +401,54 @@ static unsigned int _hash_string(char *s)
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
+  const dt_iop_grain_data_t *const data = (dt_iop_grain_data_t *)piece->data;
 
-  unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  const unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
 
   const int ch = piece->colors;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
   // Apply grain to image
-  const double strength = (data->strength / 100.0);
-  const double octaves = 3;
+  const float strength = (data->strength / 100.0) * GRAIN_LIGHTNESS_STRENGTH_SCALE;
   // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
   const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
+  // x, y in a resolution independent way: full image pixel coords normalized to the shorter side of the
+  // image, so with pixel aspect = 1.
+  const float xyscale = 1.0 / (roi_out->scale * wd);
+  const int x0 = roi_out->x;
+  const int y0 = roi_out->y;
   // in fastpipe mode, skip the downsampling for zoomed-out views
   const int filter = fabsf(roi_out->scale - 1.0f) > 0.01f;
   // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to
   // pixelpipe iscale)
-  const double filtermul = piece->iscale / (roi_out->scale * wd);
+  const float filtermul = piece->iscale / (roi_out->scale * wd);
   const float fib1 = 34.0, fib2 = 21.0;
   const float fib1div2 = fib1 / fib2;
 
+  float scale[GRAIN_OCTAVES], offset[GRAIN_OCTAVES];
+  _grain_octaves(hash, zoom, scale, offset);
+  const float *const grain_lut = data->grain_lut;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, filter, filtermul, ivoid, ovoid, roi_out, strength, \
-                      wd, zoom, octaves, fib2, fib1div2) \
-  shared(data, hash)
+  dt_omp_firstprivate(ch, filter, filtermul, ivoid, ovoid, width, height, x0, y0, xyscale, strength, \
+                      fib2, fib1div2, grain_lut) \
+  shared(scale, offset)
 #endif
-  for(int j = 0; j < roi_out->height; j++)
+  for(int j = 0; j < height; j++)
   {
-    float *in = ((float *)ivoid) + (size_t)roi_out->width * j * ch;
-    float *out = ((float *)ovoid) + (size_t)roi_out->width * j * ch;
-    const double wy = (roi_out->y + j) / roi_out->scale;
-    const double y = wy / wd;
-    // y: normalized to shorter side of image, so with pixel aspect = 1.
+    const float *const restrict in = ((const float *)ivoid) + (size_t)width * j * ch;
+    float *const restrict out = ((float *)ovoid) + (size_t)width * j * ch;
+    const float y = (y0 + j) * xyscale;
 
-    for(int i = 0; i < roi_out->width; i++)
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for(int i = 0; i < width; i++)
     {
-      // calculate x, y in a resolution independent way:
-      // wx,wy: worldspace in full image pixel coords:
-      const double wx = (roi_out->x + i) / roi_out->scale;
-      // x: normalized to shorter side of image, so with pixel aspect = 1.
-      const double x = wx / wd;
-      //  double noise=_perlin_2d_noise(x, y, octaves,0.25, zoom)*1.5;
-      double noise = 0.0;
+      const float x = (x0 + i) * xyscale;
+      float noise = 0.0f;
       if(filter)
       {
         // if zoomed out a lot, use rank-1 lattice downsampling
@@ -505,26 +456,83 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         {
           float px = l / fib2, py = l * fib1div2;
           py -= (int)py;
-          float dx = px * filtermul, dy = py * filtermul;
-          noise += (1.0 / fib2) * _simplex_2d_noise(x + dx + hash, y + dy, octaves, 1.0, zoom);
+          const float dx = px * filtermul, dy = py * filtermul;
+          noise += (1.0f / fib2) * _simplex_2d_noise(x + dx, y + dy, scale, offset);
         }
       }
       else
       {
-        noise = _simplex_2d_noise(x + hash, y, octaves, 1.0, zoom);
+        noise = _simplex_2d_noise(x, y, scale, offset);
       }
 
-      out[0] = in[0] + dt_lut_lookup_2d_1c(data->grain_lut, (noise * strength) * GRAIN_LIGHTNESS_STRENGTH_SCALE, in[0] / 100.0f);
-      out[1] = in[1];
-      out[2] = in[2];
-      out[3] = in[3];
-
-      out += ch;
-      in += ch;
+      const size_t k = (size_t)ch * i;
+      out[k] = in[k] + dt_lut_lookup_2d_1c(grain_lut, noise * strength, in[k] / 100.0f);
+      out[k + 1] = in[k + 1];
+      out[k + 2] = in[k + 2];
+      out[k + 3] = in[k + 3];
     }
   }
 }
 
+#ifdef HAVE_OPENCL
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_grain_data_t *const data = (dt_iop_grain_data_t *)piece->data;
+  const dt_iop_grain_global_data_t *const gd = (dt_iop_grain_global_data_t *)self->global_data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  // same parameters as process()
+  const unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)fmax(roi_out->width * 0.3, 1.0);
+  const float strength = (data->strength / 100.0) * GRAIN_LIGHTNESS_STRENGTH_SCALE;
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  const double zoom = (1.0 + 8 * data->scale / 100) / 800.0;
+  const float xyscale = 1.0 / (roi_out->scale * wd);
+  const int x0 = roi_out->x;
+  const int y0 = roi_out->y;
+  const int filter = fabsf(roi_out->scale - 1.0f) > 0.01f;
+  const float filtermul = piece->iscale / (roi_out->scale * wd);
+
+  float scale[GRAIN_OCTAVES], offset[GRAIN_OCTAVES];
+  _grain_octaves(hash, zoom, scale, offset);
+  const float octave_scale[4] = { scale[0], scale[1], scale[2], 0.0f };
+  const float octave_offset[4] = { offset[0], offset[1], offset[2], 0.0f };
+
+  cl_mem dev_lut
+      = dt_opencl_copy_host_to_device_constant(devid, sizeof(data->grain_lut), (void *)data->grain_lut);
+  if(dev_lut == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 4, sizeof(int), (void *)&x0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 5, sizeof(int), (void *)&y0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 6, sizeof(float), (void *)&xyscale);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 7, 4 * sizeof(float), (void *)octave_scale);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 8, 4 * sizeof(float), (void *)octave_offset);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 9, sizeof(int), (void *)&filter);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 10, sizeof(float), (void *)&filtermul);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 11, sizeof(float), (void *)&strength);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 12, sizeof(cl_mem), (void *)&dev_lut);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_grain, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_lut);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_lut);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_grain] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
@@ -554,6 +562,19 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 void init_global(struct dt_iop_module_so_t *self)
 {
   _simplex_noise_init();
+
+  const int program = 8; // extended.cl from programs.conf
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)malloc(sizeof(dt_iop_grain_global_data_t));
+  self->data = gd;
+  gd->kernel_grain = dt_opencl_create_kernel(program, "grain");
+}
+
+void cleanup_global(struct dt_iop_module_so_t *self)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->data;
+  dt_opencl_free_kernel(gd->kernel_grain);
+  free(self->data);
+  self->data = NULL;
 }
 
 void gui_init(struct dt_iop_module_t *self)
@@ -491,16 +491,40 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     dt_iop_gui_leave_critical_section(self);
   }
 
-  // calculate the transition map
-  gray_image trans_map = new_gray_image(width, height);
-  transition_map(img_in, trans_map, w1, A0, strength);
-
-  // refine the transition map
-  dt_box_min(trans_map.data, trans_map.height, trans_map.width, 1, w1);
   gray_image trans_map_filtered = new_gray_image(width, height);
-  // apply guided filter with no clipping
-  guided_filter(img_in.data, trans_map.data, trans_map_filtered.data, width, height, ch, w2, eps, 1.f, -FLT_MAX,
-                FLT_MAX);
+  if(MIN(width, height) >= 4 * w2)
+  {
+    // the transition map is smooth once filtered, estimate it on a copy at half the resolution and let the
+    // guided filter bring it back to full resolution, following the edges of the input
+    const dt_iop_roi_t roi_full = { 0, 0, width, height, 1.f };
+    const dt_iop_roi_t roi_small = { 0, 0, width / 2, height / 2, 0.5f };
+    float *const small = dt_alloc_align_float((size_t)roi_small.width * roi_small.height * 4);
+    dt_iop_clip_and_zoom(small, img_in.data, &roi_small, &roi_full, roi_small.width, roi_full.width);
+    const const_rgb_image img_small = (const_rgb_image){ small, roi_small.width, roi_small.height, 4 };
+
+    // calculate and refine the transition map, with the windows scaled down as well
+    gray_image trans_map = new_gray_image(roi_small.width, roi_small.height);
+    transition_map(img_small, trans_map, w1 / 2, A0, strength);
+    dt_box_min(trans_map.data, trans_map.height, trans_map.width, 1, w1 / 2);
+    // apply guided filter with no clipping
+    guided_filter_upsample(img_in.data, small, trans_map.data, trans_map_filtered.data, width, height,
+                           roi_small.width, roi_small.height, ch, (w2 + 1) / 2, eps, 1.f, -FLT_MAX, FLT_MAX);
+    free_gray_image(&trans_map);
+    dt_free_align(small);
+  }
+  else
+  {
+    // calculate the transition map
+    gray_image trans_map = new_gray_image(width, height);
+    transition_map(img_in, trans_map, w1, A0, strength);
+
+    // refine the transition map
+    dt_box_min(trans_map.data, trans_map.height, trans_map.width, 1, w1);
+    // apply guided filter with no clipping
+    guided_filter(img_in.data, trans_map.data, trans_map_filtered.data, width, height, ch, w2, eps, 1.f, -FLT_MAX,
+                  FLT_MAX);
+    free_gray_image(&trans_map);
+  }
 
   // finally, calculate the haze-free image
   const float t_min
@@ -522,7 +546,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     pixel_out[2] = (pixel_in[2] - c_A0[2]) / t + c_A0[2];
   }
 
-  free_gray_image(&trans_map);
   free_gray_image(&trans_map_filtered);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
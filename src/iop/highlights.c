@@ -34,6 +34,7 @@
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
 #include "develop/noise_generator.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -47,6 +48,14 @@
 // Downsampling factor for guided-laplacian
 #define DS_FACTOR 4
 
+// Size of the tiles of the downsampled image in which guided-laplacian looks for clipped pixels
+#define CLIPPED_TILE_SIZE 32
+
+// Guided-laplacian stops iterating once the mean relative change of the clipped pixels over an iteration
+// gets below this. The GPU checks it every CONVERGENCE_STEP iterations only, as it has to read the image back.
+#define CONVERGENCE_THRESHOLD 1e-4f
+#define CONVERGENCE_STEP 8
+
 // Set to one to output intermediate image steps as PFM in /tmp
 #define DEBUG_DUMP_PFM 0
 
@@ -418,10 +427,11 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     const int max_filter_radius = (1 << scales);
 
     // Warning : in and out are single-channel in RAW mode
-    // in + out + interpolated + ds_interpolated + ds_tmp + 2 * ds_LF + ds_HF + mask + ds_mask
+    // in + out + interpolated + ds_interpolated + ds_tmp + ds_previous + 2 * ds_LF + ds_HF + mask + ds_mask,
+    // plus the copies of the clipped regions when they cover less than 3/4 of the image
     if(filters) // RAW
     {
-      tiling->factor = 2.f + 2.f * 4 + 6.f * 4 / DS_FACTOR;
+      tiling->factor = 2.f + 2.f * 4 + 8.f * 4 / DS_FACTOR;
       tiling->factor_cl =  2.f + 3.f * 4 + 5.f * 4 / DS_FACTOR;
 
       // The wavelets decomposition uses a temp buffer of size 4 x ds_width
@@ -429,7 +439,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     }
     else
     {
-      tiling->factor = 2.f + 2.f + 6.f / DS_FACTOR;
+      tiling->factor = 2.f + 2.f + 8.f / DS_FACTOR;
       tiling->factor_cl = 2.f + 3.f + 5.f / DS_FACTOR;
 
       // The wavelets decomposition uses a temp buffer of size 4 x width
@@ -1176,7 +1186,8 @@ static inline void guide_laplacians(const float *const restrict high_freq, const
                                     float *const restrict output,
                                     const size_t width, const size_t height, const int mult,
                                     const float noise_level, const int salt,
-                                    const uint8_t scale, const float radius_sq)
+                                    const uint8_t scale, const float radius_sq,
+                                    const size_t x0, const size_t y0)
 {
   float *const restrict out = DT_IS_ALIGNED(output);
   const float *const restrict LF = DT_IS_ALIGNED(low_freq);
@@ -1184,7 +1195,7 @@ static inline void guide_laplacians(const float *const restrict high_freq, const
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none)                                                                            \
-    dt_omp_firstprivate(out, clipping_mask, HF, LF, height, width, mult, noise_level, salt, scale, radius_sq) \
+    dt_omp_firstprivate(out, clipping_mask, HF, LF, height, width, mult, noise_level, salt, scale, radius_sq, x0, y0) \
     schedule(static)
 #endif
   for(size_t row = 0; row < height; ++row)
@@ -1310,8 +1321,10 @@ static inline void guide_laplacians(const float *const restrict high_freq, const
       // Last step of RGB reconstruct : add noise
       if((scale & LAST_SCALE) && salt && alpha > 0.f)
       {
-        // Init random number generator
-        uint32_t DT_ALIGNED_ARRAY state[4] = { splitmix32(j + 1), splitmix32((j + 1) * (i + 3)), splitmix32(1337), splitmix32(666) };
+        // Init random number generator, seeded by the coordinates in the whole image so the noise doesn't
+        // depend on the region being reconstructed
+        uint32_t DT_ALIGNED_ARRAY state[4] = { splitmix32(j + x0 + 1), splitmix32((j + x0 + 1) * (i + y0 + 3)),
+                                               splitmix32(1337), splitmix32(666) };
         xoshiro128plus(state);
         xoshiro128plus(state);
         xoshiro128plus(state);
@@ -1488,7 +1501,8 @@ static inline gint wavelets_process(const float *const restrict in, float
                                     float *const restrict LF_even,
                                     const diffuse_reconstruct_variant_t variant,
                                     const float noise_level,
-                                    const int salt, const float first_order_factor)
+                                    const int salt, const float first_order_factor,
+                                    const size_t x0, const size_t y0)
 {
   gint success = TRUE;
 
@@ -1498,7 +1512,7 @@ static inline gint wavelets_process(const float *const restrict in, float
 
   // allocate a one-row temporary buffer for the decomposition
   size_t padded_size;
-  float *const DT_ALIGNED_ARRAY tempbuf = dt_alloc_perthread_float(4 * width, &padded_size); //TODO: alloc in caller
+  float *const DT_ALIGNED_ARRAY tempbuf = dt_pixelpipe_alloc_perthread_float(4 * width, &padded_size); //TODO: alloc in caller
   for(int s = 0; s < scales; ++s)
   {
     //fprintf(stderr, "CPU Wavelet decompose : scale %i\n", s);
@@ -1529,7 +1543,8 @@ static inline gint wavelets_process(const float *const restrict in, float
     const float radius = sqf(equivalent_sigma_at_step(B_SPLINE_SIGMA, s * DS_FACTOR));
 
     if(variant == DIFFUSE_RECONSTRUCT_RGB)
-      guide_laplacians(HF, buffer_out, clipping_mask, reconstructed, width, height, mult, noise_level, salt, current_scale_type, radius);
+      guide_laplacians(HF, buffer_out, clipping_mask, reconstructed, width, height, mult, noise_level, salt,
+                       current_scale_type, radius, x0, y0);
     else
       heat_PDE_diffusion(HF, buffer_out, clipping_mask, reconstructed, width, height, mult, current_scale_type, first_order_factor);
 
@@ -1542,12 +1557,195 @@ static inline gint wavelets_process(const float *const restrict in, float
     dump_PFM(name, buffer_out, width, height);
 #endif
   }
-  dt_free_align(tempbuf);
+  dt_pixelpipe_free_align(tempbuf);
 
   return success;
 }
 
 
+typedef struct dt_iop_highlights_region_t
+{
+  size_t x, y, width, height;
+} dt_iop_highlights_region_t;
+
+// Distance over which the wavelets decomposition and the guided laplacians read their neighbours, over all scales.
+// The B-spline of scale s reads up to 2 * 2^s pixels away and the laplacians 2^s more.
+static inline size_t _wavelets_support(const int scales)
+{
+  return (size_t)3 << scales;
+}
+
+static inline gboolean _regions_overlap(const dt_iop_highlights_region_t *const a,
+                                        const dt_iop_highlights_region_t *const b)
+{
+  return a->x < b->x + b->width && b->x < a->x + a->width
+         && a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+// Dilate a line of tiles by radius tiles, through the prefix sum of the line
+static void _dilate_tiles(uint8_t *const restrict tiles, int *const restrict sum, const size_t n, const size_t stride,
+                          const size_t radius)
+{
+  sum[0] = 0;
+  for(size_t k = 0; k < n; k++) sum[k + 1] = sum[k] + tiles[k * stride];
+  for(size_t k = 0; k < n; k++)
+    tiles[k * stride] = sum[MIN(k + radius + 1, n)] > sum[k > radius ? k - radius : 0];
+}
+
+// Guided laplacians only change the clipped pixels, and what they get out of an iteration only depends on the
+// pixels within the support of the wavelets around them, which don't change. Find the rectangles made of the tiles
+// holding clipped pixels, dilated by that support, merged until they don't overlap. Returns their number, regions
+// has to be freed by the caller.
+static int _clipped_regions(const float *const restrict clipping_mask, const size_t width, const size_t height,
+                            const size_t padding, dt_iop_highlights_region_t **regions)
+{
+  const size_t tiles_x = (width + CLIPPED_TILE_SIZE - 1) / CLIPPED_TILE_SIZE;
+  const size_t tiles_y = (height + CLIPPED_TILE_SIZE - 1) / CLIPPED_TILE_SIZE;
+  uint8_t *const restrict tiles = calloc(tiles_x * tiles_y, sizeof(uint8_t));
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(clipping_mask, tiles, width, height, tiles_x, tiles_y) \
+  schedule(static)
+#endif
+  for(size_t ty = 0; ty < tiles_y; ty++)
+    for(size_t i = ty * CLIPPED_TILE_SIZE; i < MIN((ty + 1) * CLIPPED_TILE_SIZE, height); i++)
+      for(size_t j = 0; j < width; j++)
+        if(clipping_mask[(i * width + j) * 4 + ALPHA] > 0.f) tiles[ty * tiles_x + j / CLIPPED_TILE_SIZE] = 1;
+
+  // add the context
+  const size_t radius = (padding + CLIPPED_TILE_SIZE - 1) / CLIPPED_TILE_SIZE;
+  int *const sum = malloc(sizeof(int) * (MAX(tiles_x, tiles_y) + 1));
+  for(size_t ty = 0; ty < tiles_y; ty++) _dilate_tiles(tiles + ty * tiles_x, sum, tiles_x, 1, radius);
+  for(size_t tx = 0; tx < tiles_x; tx++) _dilate_tiles(tiles + tx, sum, tiles_y, tiles_x, radius);
+  free(sum);
+
+  // bounding boxes of the connected sets of tiles
+  int count = 0;
+  *regions = malloc(sizeof(dt_iop_highlights_region_t) * tiles_x * tiles_y);
+  size_t *const stack = malloc(sizeof(size_t) * tiles_x * tiles_y);
+  for(size_t t = 0; t < tiles_x * tiles_y; t++)
+  {
+    if(tiles[t] != 1) continue;
+
+    size_t x_min = tiles_x, y_min = tiles_y, x_max = 0, y_max = 0;
+    size_t top = 0;
+    stack[top++] = t;
+    tiles[t] = 2;
+    while(top)
+    {
+      const size_t k = stack[--top];
+      const size_t tx = k % tiles_x;
+      const size_t ty = k / tiles_x;
+      x_min = MIN(x_min, tx);
+      x_max = MAX(x_max, tx);
+      y_min = MIN(y_min, ty);
+      y_max = MAX(y_max, ty);
+      if(tx > 0 && tiles[k - 1] == 1) { tiles[k - 1] = 2; stack[top++] = k - 1; }
+      if(tx < tiles_x - 1 && tiles[k + 1] == 1) { tiles[k + 1] = 2; stack[top++] = k + 1; }
+      if(ty > 0 && tiles[k - tiles_x] == 1) { tiles[k - tiles_x] = 2; stack[top++] = k - tiles_x; }
+      if(ty < tiles_y - 1 && tiles[k + tiles_x] == 1) { tiles[k + tiles_x] = 2; stack[top++] = k + tiles_x; }
+    }
+
+    dt_iop_highlights_region_t *r = *regions + count++;
+    r->x = x_min * CLIPPED_TILE_SIZE;
+    r->y = y_min * CLIPPED_TILE_SIZE;
+    r->width = MIN((x_max + 1) * CLIPPED_TILE_SIZE, width) - r->x;
+    r->height = MIN((y_max + 1) * CLIPPED_TILE_SIZE, height) - r->y;
+  }
+  free(stack);
+  free(tiles);
+
+  // merge the bounding boxes that overlap, the regions are reconstructed independently
+  gboolean merged = TRUE;
+  while(merged)
+  {
+    merged = FALSE;
+    for(int a = 0; a < count; a++)
+      for(int b = a + 1; b < count; b++)
+      {
+        dt_iop_highlights_region_t *ra = *regions + a;
+        dt_iop_highlights_region_t *rb = *regions + b;
+        if(!_regions_overlap(ra, rb)) continue;
+
+        const size_t x_end = MAX(ra->x + ra->width, rb->x + rb->width);
+        const size_t y_end = MAX(ra->y + ra->height, rb->y + rb->height);
+        ra->x = MIN(ra->x, rb->x);
+        ra->y = MIN(ra->y, rb->y);
+        ra->width = x_end - ra->x;
+        ra->height = y_end - ra->y;
+        *rb = (*regions)[--count];
+        merged = TRUE;
+        b = a;
+      }
+  }
+
+  return count;
+}
+
+static void _copy_region(float *const restrict out, const size_t out_width, const size_t out_x, const size_t out_y,
+                         const float *const restrict in, const size_t in_width, const size_t in_x, const size_t in_y,
+                         const size_t width, const size_t height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(out, out_width, out_x, out_y, in, in_width, in_x, in_y, width, height) \
+  schedule(static)
+#endif
+  for(size_t i = 0; i < height; i++)
+    memcpy(out + ((i + out_y) * out_width + out_x) * 4, in + ((i + in_y) * in_width + in_x) * 4,
+           sizeof(float) * 4 * width);
+}
+
+// mean relative change of the clipped pixels between two iterations
+static float _reconstruction_change(const float *const restrict previous, const float *const restrict current,
+                                    const float *const restrict clipping_mask, const size_t npixels)
+{
+  double change = 0.;
+  double total = 0.;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(previous, current, clipping_mask, npixels) \
+  reduction(+ : change, total) schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    if(clipping_mask[k * 4 + ALPHA] <= 0.f) continue;
+    for(size_t c = 0; c < 3; c++)
+    {
+      change += fabsf(current[k * 4 + c] - previous[k * 4 + c]);
+      total += fabsf(previous[k * 4 + c]);
+    }
+  }
+  return (total > 0.) ? (float)(change / total) : 0.f;
+}
+
+// Run up to iterations of guided laplacians over a region of the downsampled image at (x0, y0),
+// in place in interpolated
+static void _reconstruct_region(float *const restrict interpolated, const float *const restrict clipping_mask,
+                                float *const restrict temp, float *const restrict previous,
+                                float *const restrict HF, float *const restrict LF_odd,
+                                float *const restrict LF_even, const size_t width, const size_t height,
+                                const size_t x0, const size_t y0, const int scales, const int iterations,
+                                const float noise_level, const float solid_color)
+{
+  for(int i = 0; i < iterations; i++)
+  {
+    const int salt = (i == iterations - 1); // add noise on the last iteration only
+    const gboolean check = (i < iterations - 2);
+    if(check) dt_iop_image_copy_by_size(previous, interpolated, width, height, 4);
+
+    wavelets_process(interpolated, temp, clipping_mask, width, height, scales, HF, LF_odd,
+                     LF_even, DIFFUSE_RECONSTRUCT_RGB, noise_level, salt, solid_color, x0, y0);
+    wavelets_process(temp, interpolated, clipping_mask, width, height, scales, HF, LF_odd,
+                     LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, solid_color, x0, y0);
+
+    // converged : go straight to the last iteration, which adds the noise
+    if(check && _reconstruction_change(previous, interpolated, clipping_mask, width * height) < CONVERGENCE_THRESHOLD)
+      i = iterations - 2;
+  }
+}
+
 static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
                                     const void *const restrict ivoid, void *const restrict ovoid,
                                     const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
@@ -1575,19 +1773,12 @@ static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpi
   float *const restrict interpolated = dt_alloc_align_float(size * 4);  // [R, G, B, norm] for each pixel
   float *const restrict clipping_mask = dt_alloc_align_float(size * 4); // [R, G, B, norm] for each pixel
 
-  // temp buffer for blurs. We will need to cycle between them for memory efficiency
-  float *const restrict LF_odd = dt_alloc_align_float(ds_size * 4);
-  float *const restrict LF_even = dt_alloc_align_float(ds_size * 4);
-  float *const restrict temp = dt_alloc_align_float(ds_size * 4);
-
   const float scale = fmaxf(DS_FACTOR * piece->iscale / (roi_in->scale), 1.f);
   const float final_radius = (float)((int)(1 << data->scales)) / scale;
   const int scales = CLAMP((int)ceilf(log2f(final_radius)), 1, MAX_NUM_SCALES);
 
   const float noise_level = data->noise_level / scale;
 
-  // wavelets scales buffers
-  float *restrict HF = dt_alloc_align_float(ds_size * 4);
   float *restrict ds_interpolated = dt_alloc_align_float(ds_size * 4);
   float *restrict ds_clipping_mask = dt_alloc_align_float(ds_size * 4);
 
@@ -1601,15 +1792,75 @@ static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpi
   interpolate_bilinear(clipping_mask, width, height, ds_clipping_mask, ds_width, ds_height, 4);
   interpolate_bilinear(interpolated, width, height, ds_interpolated, ds_width, ds_height, 4);
 
-  for(int i = 0; i < data->iterations; i++)
+  // Only iterate over the clipped parts of the image and their context
+  dt_iop_highlights_region_t *regions = NULL;
+  int nregions = _clipped_regions(ds_clipping_mask, ds_width, ds_height, _wavelets_support(scales), &regions);
+
+  size_t area = 0;
+  size_t max_area = 0;
+  for(int r = 0; r < nregions; r++)
   {
-    const int salt = (i == data->iterations - 1); // add noise on the last iteration only
-    wavelets_process(ds_interpolated, temp, ds_clipping_mask, ds_width, ds_height, scales, HF, LF_odd,
-                     LF_even, DIFFUSE_RECONSTRUCT_RGB, noise_level, salt, data->solid_color);
-    wavelets_process(temp, ds_interpolated, ds_clipping_mask, ds_width, ds_height, scales, HF, LF_odd,
-                     LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, data->solid_color);
+    area += regions[r].width * regions[r].height;
+    max_area = MAX(max_area, regions[r].width * regions[r].height);
   }
 
+  // not worth copying the regions out when they cover most of the image
+  const gboolean cropped = (area < ds_size * 3 / 4);
+  if(nregions > 0 && !cropped)
+  {
+    nregions = 1;
+    regions[0] = (dt_iop_highlights_region_t){ 0, 0, ds_width, ds_height };
+    max_area = ds_size;
+  }
+
+  if(nregions > 0)
+  {
+    // temp buffer for blurs. We will need to cycle between them for memory efficiency
+    float *const restrict LF_odd = dt_alloc_align_float(max_area * 4);
+    float *const restrict LF_even = dt_alloc_align_float(max_area * 4);
+    float *const restrict temp = dt_alloc_align_float(max_area * 4);
+    float *const restrict previous = dt_alloc_align_float(max_area * 4);
+
+    // wavelets scales buffers
+    float *restrict HF = dt_alloc_align_float(max_area * 4);
+
+    // regions, unless we process the whole image
+    float *restrict region_interpolated = cropped ? dt_alloc_align_float(max_area * 4) : ds_interpolated;
+    float *restrict region_mask = cropped ? dt_alloc_align_float(max_area * 4) : ds_clipping_mask;
+
+    for(int r = 0; r < nregions; r++)
+    {
+      const dt_iop_highlights_region_t *const region = regions + r;
+      if(cropped)
+      {
+        _copy_region(region_interpolated, region->width, 0, 0, ds_interpolated, ds_width, region->x, region->y,
+                     region->width, region->height);
+        _copy_region(region_mask, region->width, 0, 0, ds_clipping_mask, ds_width, region->x, region->y,
+                     region->width, region->height);
+      }
+
+      _reconstruct_region(region_interpolated, region_mask, temp, previous, HF, LF_odd, LF_even, region->width,
+                          region->height, region->x, region->y, scales, data->iterations, noise_level,
+                          data->solid_color);
+
+      if(cropped)
+        _copy_region(ds_interpolated, ds_width, region->x, region->y, region_interpolated, region->width, 0, 0,
+                     region->width, region->height);
+    }
+
+    if(cropped)
+    {
+      dt_free_align(region_interpolated);
+      dt_free_align(region_mask);
+    }
+    dt_free_align(temp);
+    dt_free_align(previous);
+    dt_free_align(LF_even);
+    dt_free_align(LF_odd);
+    dt_free_align(HF);
+  }
+  free(regions);
+
   // Upsample
   interpolate_bilinear(ds_interpolated, ds_width, ds_height, interpolated, width, height, 4);
   _remosaic_and_replace(input, interpolated, clipping_mask, output, wb, filters, width, height);
@@ -1621,10 +1872,6 @@ static void process_laplacian_bayer(struct dt_iop_module_t *self, dt_dev_pixelpi
 
   dt_free_align(interpolated);
   dt_free_align(clipping_mask);
-  dt_free_align(temp);
-  dt_free_align(LF_even);
-  dt_free_align(LF_odd);
-  dt_free_align(HF);
   dt_free_align(ds_interpolated);
   dt_free_align(ds_clipping_mask);
 }
@@ -1792,6 +2039,12 @@ static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pi
   cl_mem clips_cl = dt_opencl_copy_host_to_device_constant(devid, 4 * sizeof(float), (float*)clips);
   cl_mem wb_cl = dt_opencl_copy_host_to_device_constant(devid, 4 * sizeof(float), (float*)wb);
 
+  // host copies of the downsampled image to check the convergence of the iterations
+  const gboolean converge = (data->iterations > CONVERGENCE_STEP + 1);
+  float *host_mask = NULL;
+  float *host_previous = NULL;
+  float *host_current = NULL;
+
   dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_bilinear_and_mask, 0, sizeof(cl_mem), (void *)&dev_in);
   dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_bilinear_and_mask, 1, sizeof(cl_mem), (void *)&interpolated);
   dt_opencl_set_kernel_arg(devid, gd->kernel_highlights_bilinear_and_mask, 2, sizeof(cl_mem), (void *)&temp);
@@ -1834,6 +2087,18 @@ static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pi
   err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_interpolate_bilinear, ds_sizes);
   if(err != CL_SUCCESS) goto error;
 
+  if(converge)
+  {
+    host_mask = dt_alloc_align_float((size_t)ds_width * ds_height * 4);
+    host_previous = dt_alloc_align_float((size_t)ds_width * ds_height * 4);
+    host_current = dt_alloc_align_float((size_t)ds_width * ds_height * 4);
+    err = dt_opencl_read_host_from_device(devid, host_mask, ds_clipping_mask, ds_width, ds_height, 4 * sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+    err = dt_opencl_read_host_from_device(devid, host_previous, ds_interpolated, ds_width, ds_height,
+                                          4 * sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+  }
+
   for(int i = 0; i < data->iterations; i++)
   {
     const int salt = (i == data->iterations - 1); // add noise on the last iteration only
@@ -1844,6 +2109,21 @@ static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pi
     err = wavelets_process_cl(devid, temp, ds_interpolated, ds_clipping_mask, ds_sizes, ds_width, ds_height, gd, scales, HF,
                               LF_odd, LF_even, DIFFUSE_RECONSTRUCT_CHROMA, noise_level, salt, data->solid_color);
     if(err != CL_SUCCESS) goto error;
+
+    // converged : go straight to the last iteration, which adds the noise
+    if(converge && i < data->iterations - 2 && (i + 1) % CONVERGENCE_STEP == 0)
+    {
+      err = dt_opencl_read_host_from_device(devid, host_current, ds_interpolated, ds_width, ds_height,
+                                            4 * sizeof(float));
+      if(err != CL_SUCCESS) goto error;
+
+      const float change = _reconstruction_change(host_previous, host_current, host_mask, (size_t)ds_width * ds_height);
+      if(change / CONVERGENCE_STEP < CONVERGENCE_THRESHOLD) i = data->iterations - 2;
+
+      float *const swap = host_previous;
+      host_previous = host_current;
+      host_current = swap;
+    }
   }
 
   // Upsample
@@ -1878,6 +2158,9 @@ static cl_int process_laplacian_bayer_cl(struct dt_iop_module_t *self, dt_dev_pi
   if(HF) dt_opencl_release_mem_object(HF);
   dt_opencl_release_mem_object(ds_clipping_mask);
   dt_opencl_release_mem_object(ds_interpolated);
+  dt_free_align(host_mask);
+  dt_free_align(host_previous);
+  dt_free_align(host_current);
   return err;
 
 error:
@@ -1888,6 +2171,11 @@ error:
   if(LF_even) dt_opencl_release_mem_object(LF_even);
   if(LF_odd) dt_opencl_release_mem_object(LF_odd);
   if(HF) dt_opencl_release_mem_object(HF);
+  if(ds_clipping_mask) dt_opencl_release_mem_object(ds_clipping_mask);
+  if(ds_interpolated) dt_opencl_release_mem_object(ds_interpolated);
+  dt_free_align(host_mask);
+  dt_free_align(host_previous);
+  dt_free_align(host_current);
 
   dt_print(DT_DEBUG_OPENCL, "[opencl_highlights] couldn't enqueue kernel! %s\n", cl_errstr(err));
   return err;
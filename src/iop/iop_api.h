@@ -181,6 +181,14 @@ REQUIRED(void, process, struct dt_iop_module_t *self, struct dt_dev_pixelpipe_io
 DEFAULT(void, process_tiling, struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                                void *const o, const struct dt_iop_roi_t *const roi_in,
                                const struct dt_iop_roi_t *const roi_out, const int bpp);
+/** a per-pixel variant of process() for modules that are pure point operations on RGBa float pixels :
+  * no neighbourhood, no ROI change, no side effect on the piece or the pipe. It processes npixels contiguous
+  * pixels and has to work in place (in == out). It is called from worker threads, on small blocks of rows,
+  * so it must not open its own OpenMP parallel region.
+  * The pipe may then run consecutive modules providing it fused on cache-resident blocks, skipping
+  * the intermediate buffers. process() still has to be provided and to give the same output. */
+OPTIONAL(void, process_pixels, struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                               const float *const in, float *const out, const size_t npixels);
 
 #if defined(__SSE__)
 /** a variant process(), that can contain SSE2 intrinsics. */
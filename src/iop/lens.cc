@@ -30,6 +30,7 @@ extern "C" {
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/imageop_gui.h"
+#include "develop/pixelpipe_arena.h"
 #include "develop/tiling.h"
 #include "dtgtk/button.h"
 #include "dtgtk/resetlabel.h"
@@ -124,8 +125,37 @@ typedef struct dt_iop_lensfun_global_data_t
   int kernel_lens_distort_lanczos2;
   int kernel_lens_distort_lanczos3;
   int kernel_lens_vignette;
+
+  // distortion maps shared by all the pipes, see _get_map()
+  dt_pthread_mutex_t map_lock;
+  GList *maps; // dt_iop_lensfun_map_t, most recently used first
 } dt_iop_lensfun_global_data_t;
 
+static lfDatabase *_lensfun_db(dt_iop_lensfun_global_data_t *gd);
+
+// nodes of the distortion maps are this many pixels apart
+#define DT_IOP_LENS_MAP_STEP 8
+#define DT_IOP_LENS_MAPS 6
+
+// The coordinates lensfun gives for a grid of nodes over the whole image, interpolated in between. The
+// corrections are smooth, so this is far below the precision of the resampling, and lensfun only runs for
+// 1/64th of the pixels, once for all the pipes and images using the same lens with the same settings.
+typedef struct dt_iop_lensfun_map_t
+{
+  // key: settings of the lens, size of the image and modifications asked
+  uint64_t hash;
+  int width;
+  int height;
+  int mask;
+
+  int flags; // modifications lensfun did
+  int grid_width;
+  int grid_height;
+  float *coords; // 6 per node, same layout as ApplySubpixelGeometryDistortion()
+  int users;
+  gboolean cached;
+} dt_iop_lensfun_map_t;
+
 typedef struct dt_iop_lensfun_data_t
 {
   lfLens *lens;
@@ -140,6 +170,18 @@ typedef struct dt_iop_lensfun_data_t
   gboolean do_nan_checks;
   gboolean tca_override;
   lfLensCalibTCA custom_tca;
+  uint64_t map_hash; // of the settings above, to find the distortion maps
+
+  // lensfun modifiers of the point transforms, see _get_point_modifier()
+  dt_pthread_mutex_t modifier_lock;
+  struct
+  {
+    lfModifier *modifier;
+    int flags;
+    int mask;
+    int width;
+    int height;
+  } point_modifier[2];
 } dt_iop_lensfun_data_t;
 
 
@@ -175,7 +217,7 @@ int operation_tags()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_FULL_ROI | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -367,6 +409,130 @@ static lfModifier * get_modifier(int *mods_done, int w, int h, const dt_iop_lens
   return mod;
 }
 
+static void _free_map(dt_iop_lensfun_map_t *map)
+{
+  dt_free_align(map->coords);
+  free(map);
+}
+
+static dt_iop_lensfun_map_t *_new_map(const dt_iop_lensfun_data_t *d, const int w, const int h, const int mask)
+{
+  dt_iop_lensfun_map_t *map = (dt_iop_lensfun_map_t *)calloc(1, sizeof(dt_iop_lensfun_map_t));
+  if(!map) return NULL;
+  map->hash = d->map_hash;
+  map->width = w;
+  map->height = h;
+  map->mask = mask;
+  // one node past the last pixel so every pixel has 4 nodes around it
+  map->grid_width = w / DT_IOP_LENS_MAP_STEP + 2;
+  map->grid_height = h / DT_IOP_LENS_MAP_STEP + 2;
+  map->coords = dt_alloc_align_float((size_t)map->grid_width * map->grid_height * 6);
+  if(!map->coords)
+  {
+    free(map);
+    return NULL;
+  }
+
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  const lfModifier *modifier = get_modifier(&map->flags, w, h, d, mask, FALSE);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+  if(map->flags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
+  {
+    const int grid_width = map->grid_width;
+    float *const coords = map->coords;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(coords, grid_width, modifier) \
+    shared(map) \
+    schedule(static)
+#endif
+    for(int j = 0; j < map->grid_height; j++)
+      for(int i = 0; i < grid_width; i++)
+        modifier->ApplySubpixelGeometryDistortion(i * DT_IOP_LENS_MAP_STEP, j * DT_IOP_LENS_MAP_STEP, 1, 1,
+                                                  coords + ((size_t)j * grid_width + i) * 6);
+  }
+  delete modifier;
+
+  dt_print(DT_DEBUG_PERF, "[lens] distortion map of %ix%i nodes for %ix%i pixels\n", map->grid_width,
+           map->grid_height, w, h);
+  return map;
+}
+
+// The distortion map of the committed lens settings for an image of w x h, to release with _release_map().
+// Maps are kept in the global data, so other pipes and the next images with the same settings reuse it.
+static dt_iop_lensfun_map_t *_get_map(dt_iop_lensfun_global_data_t *gd, const dt_iop_lensfun_data_t *d,
+                                      const int w, const int h, const int mask)
+{
+  dt_pthread_mutex_lock(&gd->map_lock);
+  dt_iop_lensfun_map_t *map = NULL;
+  for(GList *l = gd->maps; l; l = g_list_next(l))
+  {
+    dt_iop_lensfun_map_t *m = (dt_iop_lensfun_map_t *)l->data;
+    if(m->hash == d->map_hash && m->width == w && m->height == h && m->mask == mask)
+    {
+      map = m;
+      gd->maps = g_list_remove_link(gd->maps, l);
+      gd->maps = g_list_concat(l, gd->maps);
+      break;
+    }
+  }
+
+  if(!map)
+  {
+    // built under the lock: pipes asking for the same map wait for it rather than computing it again
+    map = _new_map(d, w, h, mask);
+    if(map)
+    {
+      map->cached = TRUE;
+      gd->maps = g_list_prepend(gd->maps, map);
+      if(g_list_length(gd->maps) > DT_IOP_LENS_MAPS)
+      {
+        GList *last = g_list_last(gd->maps);
+        dt_iop_lensfun_map_t *old = (dt_iop_lensfun_map_t *)last->data;
+        gd->maps = g_list_delete_link(gd->maps, last);
+        old->cached = FALSE;
+        if(old->users == 0) _free_map(old);
+      }
+    }
+  }
+
+  if(map) map->users++;
+  dt_pthread_mutex_unlock(&gd->map_lock);
+  return map;
+}
+
+static void _release_map(dt_iop_lensfun_global_data_t *gd, dt_iop_lensfun_map_t *map)
+{
+  dt_pthread_mutex_lock(&gd->map_lock);
+  map->users--;
+  if(map->users == 0 && !map->cached) _free_map(map);
+  dt_pthread_mutex_unlock(&gd->map_lock);
+}
+
+// what ApplySubpixelGeometryDistortion(x, y, width, 1, coords) gives, interpolated from the map
+static inline void _map_distort_row(const dt_iop_lensfun_map_t *const map, const int x, const int y,
+                                    const int width, float *const coords)
+{
+  const int j = CLAMP(y / DT_IOP_LENS_MAP_STEP, 0, map->grid_height - 2);
+  const float fy = (float)(y - j * DT_IOP_LENS_MAP_STEP) / DT_IOP_LENS_MAP_STEP;
+  const float *const row0 = map->coords + (size_t)j * map->grid_width * 6;
+  const float *const row1 = row0 + (size_t)map->grid_width * 6;
+  for(int k = 0; k < width; k++)
+  {
+    const int i = CLAMP((x + k) / DT_IOP_LENS_MAP_STEP, 0, map->grid_width - 2);
+    const float fx = (float)(x + k - i * DT_IOP_LENS_MAP_STEP) / DT_IOP_LENS_MAP_STEP;
+    const float *const n00 = row0 + 6 * i;
+    const float *const n10 = row1 + 6 * i;
+    for(int c = 0; c < 6; c++)
+    {
+      const float top = n00[c] + fx * (n00[c + 6] - n00[c]);
+      const float bottom = n10[c] + fx * (n10[c + 6] - n10[c]);
+      coords[6 * k + c] = top + fy * (bottom - top);
+    }
+  }
+}
+
 /* Why do we care about being a monochrome image or not?
  The lensfun library does not have an algorithm for distortion or tca correction specialized for monochrome images,
    the builtin correction works with subtle differences for the color channels leading to some colorizing of the images.
@@ -382,6 +548,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   const dt_iop_lensfun_data_t *const d = (dt_iop_lensfun_data_t *)piece->data;
+  dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
 
   const int ch = piece->colors;
@@ -401,12 +568,24 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
   const float orig_w = roi_in->scale * piece->buf_in.width, orig_h = roi_in->scale * piece->buf_in.height;
 
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-
-  int modflags;
-  const lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, used_lf_mask, FALSE);
+  // the coordinates come from the shared map, lensfun only runs here for the vignetting
+  dt_iop_lensfun_map_t *map = _get_map(gd, d, orig_w, orig_h, used_lf_mask & ~LF_MODIFY_VIGNETTING);
+  if(!map)
+  {
+    dt_iop_image_copy_by_size((float*)ovoid, (float*)ivoid, roi_out->width, roi_out->height, ch);
+    return;
+  }
 
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  int modflags = map->flags;
+  lfModifier *modifier = NULL;
+  if(d->modify_flags & LF_MODIFY_VIGNETTING)
+  {
+    int vignetting = 0;
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    modifier = get_modifier(&vignetting, orig_w, orig_h, d, LF_MODIFY_VIGNETTING, FALSE);
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+    modflags |= vignetting;
+  }
 
   const struct dt_interpolation *const interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF_WARP);
 
@@ -419,19 +598,18 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       const size_t bufsize = (size_t)roi_out->width * 2 * 3;
 
       size_t padded_bufsize;
-      float *const buf = dt_alloc_perthread_float(bufsize, &padded_bufsize);
+      float *const buf = dt_pixelpipe_alloc_perthread_float(bufsize, &padded_bufsize);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(padded_bufsize, ch, ch_width, d, interpolation, ivoid, mask_display, ovoid, roi_in, roi_out)	\
+      dt_omp_firstprivate(padded_bufsize, ch, ch_width, d, interpolation, ivoid, map, mask_display, ovoid, roi_in, roi_out)	\
       dt_omp_sharedconst(buf, raw_monochrome) \
-      shared(modifier) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *bufptr = (float*)dt_get_perthread(buf, padded_bufsize);
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, bufptr);
+        _map_distort_row(map, roi_out->x, roi_out->y + y, roi_out->width, bufptr);
 
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
@@ -471,7 +649,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
           }
         }
       }
-      dt_free_align(buf);
+      dt_pixelpipe_free_align(buf);
     }
     else
     {
@@ -526,20 +704,19 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
       // acquire temp memory for distorted pixel coords
       const size_t buf2size = (size_t)roi_out->width * 2 * 3;
       size_t padded_buf2size;
-      float *const buf2 = dt_alloc_perthread_float(buf2size, &padded_buf2size);
+      float *const buf2 = dt_pixelpipe_alloc_perthread_float(buf2size, &padded_buf2size);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(padded_buf2size, ch, ch_width, d, interpolation, mask_display, ovoid, roi_in, roi_out) \
+      dt_omp_firstprivate(padded_buf2size, ch, ch_width, d, interpolation, map, mask_display, ovoid, roi_in, roi_out) \
       dt_omp_sharedconst(buf2, raw_monochrome) \
-      shared(buf, modifier) \
+      shared(buf) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *buf2ptr = (float*)dt_get_perthread(buf2, padded_buf2size);
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width,
-                                                  1, buf2ptr);
+        _map_distort_row(map, roi_out->x, roi_out->y + y, roi_out->width, buf2ptr);
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + (size_t)y * roi_out->width * ch;
         for(int x = 0; x < roi_out->width; x++, buf2ptr += 6, out += ch)
@@ -576,7 +753,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
           }
         }
       }
-      dt_free_align(buf2);
+      dt_pixelpipe_free_align(buf2);
     }
     else
     {
@@ -585,6 +762,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     dt_free_align(buf);
   }
   delete modifier;
+  _release_map(gd, map);
 
   if(self->dev->gui_attached && g && (piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
   {
@@ -611,6 +789,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
 
   float *tmpbuf = NULL;
   lfModifier *modifier = NULL;
+  dt_iop_lensfun_map_t *map = NULL;
 
   const int devid = piece->pipe->devid;
   const int iwidth = roi_in->width;
@@ -674,9 +853,17 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dev_tmpbuf = (cl_mem)dt_opencl_alloc_device_buffer(devid, tmpbuflen);
   if(dev_tmpbuf == NULL) goto error;
 
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  modifier = get_modifier(&modflags, orig_w, orig_h, d, used_lf_mask, FALSE);
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  map = _get_map(gd, d, orig_w, orig_h, used_lf_mask & ~LF_MODIFY_VIGNETTING);
+  if(map == NULL) goto error;
+  modflags = map->flags;
+  if(d->modify_flags & LF_MODIFY_VIGNETTING)
+  {
+    int vignetting = 0;
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    modifier = get_modifier(&vignetting, orig_w, orig_h, d, LF_MODIFY_VIGNETTING, FALSE);
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+    modflags |= vignetting;
+  }
 
   if(d->inverse)
   {
@@ -685,15 +872,14 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     {
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(tmpbufwidth, roi_out) \
-      dt_omp_sharedconst(raw_monochrome) \
-      shared(tmpbuf, d, modifier) \
+      dt_omp_firstprivate(map, tmpbufwidth, roi_out) \
+      shared(tmpbuf) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, pi);
+        _map_distort_row(map, roi_out->x, roi_out->y + y, roi_out->width, pi);
       }
 
       /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
@@ -804,15 +990,14 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     {
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-      dt_omp_firstprivate(tmpbufwidth, roi_out) \
-      dt_omp_sharedconst(raw_monochrome) \
-      shared(tmpbuf, d, modifier) \
+      dt_omp_firstprivate(map, tmpbufwidth, roi_out) \
+      shared(tmpbuf) \
       schedule(static)
 #endif
       for(int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + (size_t)y * tmpbufwidth;
-        modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, pi);
+        _map_distort_row(map, roi_out->x, roi_out->y + y, roi_out->width, pi);
       }
 
       /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
@@ -852,6 +1037,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
   dt_opencl_release_mem_object(dev_tmp);
   if(tmpbuf != NULL) dt_free_align(tmpbuf);
   if(modifier != NULL) delete modifier;
+  if(map != NULL) _release_map(gd, map);
   return TRUE;
 
 error:
@@ -859,6 +1045,7 @@ error:
   dt_opencl_release_mem_object(dev_tmpbuf);
   if(tmpbuf != NULL) dt_free_align(tmpbuf);
   if(modifier != NULL) delete modifier;
+  if(map != NULL) _release_map(gd, map);
   dt_print(DT_DEBUG_OPENCL, "[opencl_lens] couldn't enqueue kernel! %d\n", err);
   return FALSE;
 }
@@ -877,6 +1064,35 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   return;
 }
 
+static void _free_point_modifiers(dt_iop_lensfun_data_t *d)
+{
+  for(int k = 0; k < 2; k++)
+  {
+    delete d->point_modifier[k].modifier;
+    d->point_modifier[k].modifier = NULL;
+  }
+}
+
+// Masks, guides and color pickers send points through the pipe on every mouse move, and building a modifier
+// costs much more than distorting a handful of points. The modifiers only depend on the committed data and the
+// size of the buffer, so keep them until the next commit. Called with d->modifier_lock held.
+static const lfModifier *_get_point_modifier(dt_iop_lensfun_data_t *d, int *modflags, const int w, const int h,
+                                             const int mask, const gboolean force_inverse)
+{
+  const int k = force_inverse ? 1 : 0;
+  if(d->point_modifier[k].modifier == NULL || d->point_modifier[k].width != w || d->point_modifier[k].height != h
+     || d->point_modifier[k].mask != mask)
+  {
+    delete d->point_modifier[k].modifier;
+    d->point_modifier[k].modifier = get_modifier(&d->point_modifier[k].flags, w, h, d, mask, force_inverse);
+    d->point_modifier[k].mask = mask;
+    d->point_modifier[k].width = w;
+    d->point_modifier[k].height = h;
+  }
+  *modflags = d->point_modifier[k].flags;
+  return d->point_modifier[k].modifier;
+}
+
 int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *const __restrict points, size_t points_count)
 {
   dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)piece->data;
@@ -887,7 +1103,8 @@ int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, floa
 
   const int used_lf_mask = (dt_image_is_monochrome(&self->dev->image_storage)) ? LF_MODIFY_ALL & ~LF_MODIFY_TCA : LF_MODIFY_ALL;
 
-  const lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, used_lf_mask, TRUE);
+  dt_pthread_mutex_lock(&d->modifier_lock);
+  const lfModifier *modifier = _get_point_modifier(d, &modflags, orig_w, orig_h, used_lf_mask, TRUE);
   if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
   {
 
@@ -905,7 +1122,7 @@ int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, floa
     }
   }
 
-  delete modifier;
+  dt_pthread_mutex_unlock(&d->modifier_lock);
   return 1;
 }
 
@@ -920,7 +1137,8 @@ int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
 
   const float orig_w = piece->buf_in.width, orig_h = piece->buf_in.height;
   int modflags;
-  const lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, used_lf_mask, FALSE);
+  dt_pthread_mutex_lock(&d->modifier_lock);
+  const lfModifier *modifier = _get_point_modifier(d, &modflags, orig_w, orig_h, used_lf_mask, FALSE);
 
   if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
   {
@@ -939,7 +1157,7 @@ int distort_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     }
   }
 
-  delete modifier;
+  dt_pthread_mutex_unlock(&d->modifier_lock);
   return 1;
 }
 
@@ -955,17 +1173,14 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
     return;
   }
 
+  dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
   const float orig_w = roi_in->scale * piece->buf_in.width, orig_h = roi_in->scale * piece->buf_in.height;
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  int modflags;
-  const lfModifier *modifier = get_modifier(&modflags, orig_w, orig_h, d, /*LF_MODIFY_TCA |*/ LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE, FALSE);
+  dt_iop_lensfun_map_t *map = _get_map(gd, d, orig_w, orig_h, /*LF_MODIFY_TCA |*/ LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE);
 
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-
-  if(!(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)))
+  if(!map || !(map->flags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)))
   {
     dt_iop_image_copy_by_size(out, in, roi_out->width, roi_out->height, 1);
-    delete modifier;
+    if(map) _release_map(gd, map);
     return;
   }
 
@@ -974,19 +1189,18 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
   // acquire temp memory for distorted pixel coords
   const size_t bufsize = (size_t)roi_out->width * 2 * 3;
   size_t padded_bufsize;
-  float *const buf = dt_alloc_perthread_float(bufsize, &padded_bufsize);
+  float *const buf = dt_pixelpipe_alloc_perthread_float(bufsize, &padded_bufsize);
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(padded_bufsize, d, in, interpolation, out, roi_in, roi_out) \
+  dt_omp_firstprivate(padded_bufsize, d, in, interpolation, map, out, roi_in, roi_out) \
   dt_omp_sharedconst(buf) \
-  shared(modifier) \
   schedule(static)
 #endif
   for(int y = 0; y < roi_out->height; y++)
   {
     float *bufptr = (float*)dt_get_perthread(buf, padded_bufsize);
-    modifier->ApplySubpixelGeometryDistortion(roi_out->x, roi_out->y + y, roi_out->width, 1, bufptr);
+    _map_distort_row(map, roi_out->x, roi_out->y + y, roi_out->width, bufptr);
 
     // reverse transform the global coords from lf to our buffer
     float *_out = out + (size_t)y * roi_out->width;
@@ -1005,8 +1219,8 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                                               roi_in->width);
     }
   }
-  dt_free_align(buf);
-  delete modifier;
+  dt_pixelpipe_free_align(buf);
+  _release_map(gd, map);
 }
 
 void modify_roi_out(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, dt_iop_roi_t *roi_out,
@@ -1142,8 +1356,13 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)piece->data;
 
+  // the modifiers of the point transforms are built from the data we are about to change
+  dt_pthread_mutex_lock(&d->modifier_lock);
+  _free_point_modifiers(d);
+  dt_pthread_mutex_unlock(&d->modifier_lock);
+
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   const lfCamera *camera = NULL;
   const lfCamera **cam = NULL;
   if(d->lens)
@@ -1217,6 +1436,15 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->do_nan_checks = TRUE;
   d->tca_override = p->tca_override;
 
+  // everything get_modifier() reads, the lens being found from the names
+  uint64_t hash = 5381;
+  hash = dt_hash(hash, p->camera, strnlen(p->camera, sizeof(p->camera)));
+  hash = dt_hash(hash, p->lens, strnlen(p->lens, sizeof(p->lens)));
+  const float settings[] = { d->crop, d->scale, d->focal, d->aperture, d->distance, p->tca_r, p->tca_b };
+  const int modes[] = { d->modify_flags, d->inverse, (int)d->target_geom, d->tca_override };
+  hash = dt_hash(hash, (const char *)settings, sizeof(settings));
+  d->map_hash = dt_hash(hash, (const char *)modes, sizeof(modes));
+
   /*
    * there are certain situations when LensFun can return NAN coordinated.
    * most common case would be when the FOV is increased.
@@ -1233,7 +1461,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = calloc(1, sizeof(dt_iop_lensfun_data_t));
+  dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)calloc(1, sizeof(dt_iop_lensfun_data_t));
+  dt_pthread_mutex_init(&d->modifier_lock, NULL);
+  piece->data = d;
   piece->data_size = sizeof(dt_iop_lensfun_data_t);
 }
 
@@ -1241,6 +1471,8 @@ void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev
 {
   dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)piece->data;
 
+  _free_point_modifiers(d);
+  dt_pthread_mutex_destroy(&d->modifier_lock);
   if(d->lens)
   {
     delete d->lens;
@@ -1261,57 +1493,69 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_lens_distort_lanczos2 = dt_opencl_create_kernel(program, "lens_distort_lanczos2");
   gd->kernel_lens_distort_lanczos3 = dt_opencl_create_kernel(program, "lens_distort_lanczos3");
   gd->kernel_lens_vignette = dt_opencl_create_kernel(program, "lens_vignette");
+  dt_pthread_mutex_init(&gd->map_lock, NULL);
+
+  // the database is loaded on first use, see _lensfun_db()
+  gd->db = NULL;
+}
 
-  lfDatabase *dt_iop_lensfun_db = new lfDatabase;
-  gd->db = (lfDatabase *)dt_iop_lensfun_db;
+// parsing the lensfun XML files takes a while, it's done when an image first needs it rather than at startup
+static lfDatabase *_lensfun_db(dt_iop_lensfun_global_data_t *gd)
+{
+  if(g_once_init_enter(&gd->db))
+  {
+    lfDatabase *dt_iop_lensfun_db = new lfDatabase;
 
 #if defined(__MACH__) || defined(__APPLE__)
 #else
-  if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
+    if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
 #endif
-  {
-    char datadir[PATH_MAX] = { 0 };
-    dt_loc_get_datadir(datadir, sizeof(datadir));
+    {
+      char datadir[PATH_MAX] = { 0 };
+      dt_loc_get_datadir(datadir, sizeof(datadir));
 
-    // get parent directory
-    GFile *file = g_file_parse_name(datadir);
-    gchar *path = g_file_get_path(g_file_get_parent(file));
-    g_object_unref(file);
+      // get parent directory
+      GFile *file = g_file_parse_name(datadir);
+      gchar *path = g_file_get_path(g_file_get_parent(file));
+      g_object_unref(file);
 #ifdef LF_MAX_DATABASE_VERSION
-    gchar *sysdbpath = g_build_filename(path, "lensfun", "version_" STR(LF_MAX_DATABASE_VERSION), (char *)NULL);
+      gchar *sysdbpath = g_build_filename(path, "lensfun", "version_" STR(LF_MAX_DATABASE_VERSION), (char *)NULL);
 #endif
 
 #ifdef LF_0395
-    const long userdbts = dt_iop_lensfun_db->ReadTimestamp(dt_iop_lensfun_db->UserUpdatesLocation);
-    const long sysdbts = dt_iop_lensfun_db->ReadTimestamp(sysdbpath);
-    const char *dbpath = userdbts > sysdbts ? dt_iop_lensfun_db->UserUpdatesLocation : sysdbpath;
-    if(dt_iop_lensfun_db->Load(dbpath) != LF_NO_ERROR)
-      fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", dbpath);
-    else
-      dt_iop_lensfun_db->Load(dt_iop_lensfun_db->UserLocation);
+      const long userdbts = dt_iop_lensfun_db->ReadTimestamp(dt_iop_lensfun_db->UserUpdatesLocation);
+      const long sysdbts = dt_iop_lensfun_db->ReadTimestamp(sysdbpath);
+      const char *dbpath = userdbts > sysdbts ? dt_iop_lensfun_db->UserUpdatesLocation : sysdbpath;
+      if(dt_iop_lensfun_db->Load(dbpath) != LF_NO_ERROR)
+        fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", dbpath);
+      else
+        dt_iop_lensfun_db->Load(dt_iop_lensfun_db->UserLocation);
 #else
-    // code for older lensfun preserved as-is
+      // code for older lensfun preserved as-is
 #ifdef LF_MAX_DATABASE_VERSION
-    g_free(dt_iop_lensfun_db->HomeDataDir);
-    dt_iop_lensfun_db->HomeDataDir = g_strdup(sysdbpath);
-    if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
-    {
-      fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", sysdbpath);
-#endif
       g_free(dt_iop_lensfun_db->HomeDataDir);
-      dt_iop_lensfun_db->HomeDataDir = g_build_filename(path, "lensfun", (char *)NULL);
+      dt_iop_lensfun_db->HomeDataDir = g_strdup(sysdbpath);
       if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
-        fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", dt_iop_lensfun_db->HomeDataDir);
+      {
+        fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", sysdbpath);
+#endif
+        g_free(dt_iop_lensfun_db->HomeDataDir);
+        dt_iop_lensfun_db->HomeDataDir = g_build_filename(path, "lensfun", (char *)NULL);
+        if(dt_iop_lensfun_db->Load() != LF_NO_ERROR)
+          fprintf(stderr, "[iop_lens]: could not load lensfun database in `%s'!\n", dt_iop_lensfun_db->HomeDataDir);
 #ifdef LF_MAX_DATABASE_VERSION
-    }
+      }
 #endif
 #endif
 
 #ifdef LF_MAX_DATABASE_VERSION
-    g_free(sysdbpath);
+      g_free(sysdbpath);
 #endif
-    g_free(path);
+      g_free(path);
+    }
+    g_once_init_leave(&gd->db, dt_iop_lensfun_db);
   }
+  return gd->db;
 }
 
 static float get_autoscale(dt_iop_module_t *self, dt_iop_lensfun_params_t *p, const lfCamera *camera);
@@ -1353,15 +1597,16 @@ void reload_defaults(dt_iop_module_t *module)
     dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)module->global_data;
 
     // just to be sure
-    if(!gd || !gd->db) return;
+    lfDatabase *db = gd ? _lensfun_db(gd) : NULL;
+    if(!db) return;
 
     dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-    const lfCamera **cam = gd->db->FindCamerasExt(img->exif_maker, img->exif_model, 0);
+    const lfCamera **cam = db->FindCamerasExt(img->exif_maker, img->exif_model, 0);
     dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
     if(cam)
     {
       dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-      const lfLens **lens = gd->db->FindLenses(cam[0], NULL, d->lens, 0);
+      const lfLens **lens = db->FindLenses(cam[0], NULL, d->lens, 0);
       dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
       if(!lens && islower(cam[0]->Mount[0]))
@@ -1376,7 +1621,7 @@ void reload_defaults(dt_iop_module_t *module)
         g_strlcpy(d->lens, "", sizeof(d->lens));
 
         dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-        lens = gd->db->FindLenses(cam[0], NULL, d->lens, 0);
+        lens = db->FindLenses(cam[0], NULL, d->lens, 0);
         dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
       }
 
@@ -1434,14 +1679,17 @@ void reload_defaults(dt_iop_module_t *module)
 void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)module->data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
-  delete dt_iop_lensfun_db;
+  // NULL if it was never needed
+  delete gd->db;
 
   dt_opencl_free_kernel(gd->kernel_lens_distort_bilinear);
   dt_opencl_free_kernel(gd->kernel_lens_distort_bicubic);
   dt_opencl_free_kernel(gd->kernel_lens_distort_lanczos2);
   dt_opencl_free_kernel(gd->kernel_lens_distort_lanczos3);
   dt_opencl_free_kernel(gd->kernel_lens_vignette);
+  // the pipes are gone, nobody uses the maps anymore
+  g_list_free_full(gd->maps, (GDestroyNotify)_free_map);
+  dt_pthread_mutex_destroy(&gd->map_lock);
   free(module->data);
   module->data = NULL;
 }
@@ -1682,7 +1930,7 @@ static void camera_menusearch_clicked(GtkWidget *button, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
 
   (void)button;
@@ -1701,7 +1949,7 @@ static void camera_autosearch_clicked(GtkWidget *button, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
   char make[200], model[200];
   const gchar *txt = (const gchar *)((dt_iop_lensfun_params_t *)self->default_params)->camera;
@@ -2027,7 +2275,7 @@ static void lens_menusearch_clicked(GtkWidget *button, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
   const lfLens **lenslist;
 
@@ -2047,7 +2295,7 @@ static void lens_autosearch_clicked(GtkWidget *button, gpointer user_data)
 {
   dt_iop_module_t *self = (dt_iop_module_t *)user_data;
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
   const lfLens **lenslist;
   char model[200];
@@ -2125,7 +2373,7 @@ void gui_changed(dt_iop_module_t *self, GtkWidget *w, void *previous)
 static float get_autoscale(dt_iop_module_t *self, dt_iop_lensfun_params_t *p, const lfCamera *camera)
 {
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   float scale = 1.0;
   if(p->lens[0] != '\0')
   {
@@ -2425,7 +2673,7 @@ void gui_update(struct dt_iop_module_t *self)
   }
 
   dt_iop_lensfun_global_data_t *gd = (dt_iop_lensfun_global_data_t *)self->global_data;
-  lfDatabase *dt_iop_lensfun_db = (lfDatabase *)gd->db;
+  lfDatabase *dt_iop_lensfun_db = _lensfun_db(gd);
   // these are the wrong (untranslated) strings in general but that's ok, they will be overwritten further
   // down
   gtk_label_set_text(GTK_LABEL(gtk_bin_get_child(GTK_BIN(g->camera_model))), p->camera);
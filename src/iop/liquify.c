@@ -261,6 +261,30 @@ typedef struct
   int warp_kernel;
 } dt_iop_liquify_global_data_t;
 
+// the warp map of the last request of one kind, see _get_cached_map()
+typedef struct dt_iop_liquify_map_t
+{
+  uint64_t hash;
+  float scale; // map pixels per piece pixel, < 1 for reduced maps
+  cairo_rectangle_int_t extent;
+  float complex *map;
+} dt_iop_liquify_map_t;
+
+typedef enum dt_iop_liquify_map_kind_t
+{
+  DT_LIQUIFY_MAP_PROCESS = 0,  // per-pixel map for roi_out
+  DT_LIQUIFY_MAP_BACKTRANSFORM, // all warps, for point back-transforms
+  DT_LIQUIFY_MAP_TRANSFORM,     // all warps inverted, for point transforms
+  DT_LIQUIFY_MAP_LAST
+} dt_iop_liquify_map_kind_t;
+
+typedef struct dt_iop_liquify_data_t
+{
+  dt_iop_liquify_params_t params; // first, piece->data is read as params
+  dt_pthread_mutex_t lock;
+  dt_iop_liquify_map_t maps[DT_LIQUIFY_MAP_LAST];
+} dt_iop_liquify_data_t;
+
 typedef struct
 {
   dt_iop_liquify_params_t params;
@@ -1207,12 +1231,79 @@ static float complex *create_global_distortion_map(const cairo_rectangle_int_t *
   return map;
 }
 
+// largest warp map kept for point transforms, larger ones are computed at a reduced resolution
+#define LIQUIFY_POINTS_MAP_MAX_PIXELS ((size_t)1 << 20)
+
+// the warps depend on our params, the scale, and the upstream distortions bringing them from raw to piece
+// coordinates, see dt_dev_distort_transform_locked()
+static uint64_t _warp_hash(const dt_iop_module_t *const module, const dt_dev_pixelpipe_iop_t *const piece,
+                           const float scale)
+{
+  const dt_dev_pixelpipe_t *const pipe = piece->pipe;
+  const dt_develop_t *const dev = module->dev;
+
+  uint64_t hash = dt_hash(5381, (const char *)piece->data, sizeof(dt_iop_liquify_params_t));
+  hash = dt_hash(hash, (const char *)&scale, sizeof(float));
+  hash = dt_hash(hash, (const char *)&pipe->iscale, sizeof(float));
+
+  for(const GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *const p = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(p->module->iop_order >= module->iop_order) break;
+
+    if(p->enabled && (p->module->operation_tags() & IOP_TAG_DISTORT)
+       && !(dev->gui_module && dev->gui_module != p->module
+            && (dev->gui_module->operation_tags_filter() & p->module->operation_tags())))
+    {
+      hash = dt_hash(hash, (const char *)&p->hash, sizeof(uint64_t));
+      hash = dt_hash(hash, (const char *)&p->buf_in, sizeof(dt_iop_roi_t));
+      hash = dt_hash(hash, (const char *)&p->buf_out, sizeof(dt_iop_roi_t));
+    }
+  }
+
+  return hash;
+}
+
+// replace the map of one kind kept by the piece, which takes ownership of map
+static void _set_cached_map(dt_iop_liquify_data_t *d, const dt_iop_liquify_map_kind_t kind, const uint64_t hash,
+                            const float scale, const cairo_rectangle_int_t *extent, float complex *map)
+{
+  dt_iop_liquify_map_t *cached = &d->maps[kind];
+  if(cached->map) dt_free_align((void *)cached->map);
+  cached->hash = hash;
+  cached->scale = scale;
+  cached->extent = *extent;
+  cached->map = map;
+}
+
 static float complex *build_global_distortion_map(struct dt_iop_module_t *module,
                                                    const dt_dev_pixelpipe_iop_t *piece,
                                                    const dt_iop_roi_t *roi_in,
                                                    const dt_iop_roi_t *roi_out,
                                                    cairo_rectangle_int_t *map_extent)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+
+  // upstream changes re-run us with the same warps, don't rebuild them
+  uint64_t hash = _warp_hash(module, piece, roi_in->scale);
+  hash = dt_hash(hash, (const char *)roi_out, sizeof(dt_iop_roi_t));
+
+  float complex *map = NULL;
+  dt_pthread_mutex_lock(&d->lock);
+  const dt_iop_liquify_map_t *cached = &d->maps[DT_LIQUIFY_MAP_PROCESS];
+  if(cached->map && cached->hash == hash)
+  {
+    const size_t mapsize = sizeof(float complex) * cached->extent.width * cached->extent.height;
+    map = dt_alloc_align(mapsize);
+    if(map)
+    {
+      memcpy(map, cached->map, mapsize);
+      *map_extent = cached->extent;
+    }
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  if(map) return map;
+
   // copy params
   dt_iop_liquify_params_t copy_params;
   memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
@@ -1222,13 +1313,81 @@ static float complex *build_global_distortion_map(struct dt_iop_module_t *module
   GList *interpolated = interpolate_paths(&copy_params);
   GSList *interpolated_in_roi = _get_map_extent(roi_out, interpolated, map_extent);
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated_in_roi, FALSE);
+  map = create_global_distortion_map(map_extent, interpolated_in_roi, FALSE);
 
   g_slist_free(interpolated_in_roi);
   g_list_free_full(interpolated, free);
+
+  if(map)
+  {
+    const size_t mapsize = sizeof(float complex) * map_extent->width * map_extent->height;
+    float complex *copy = dt_alloc_align(mapsize);
+    if(copy)
+    {
+      memcpy(copy, map, mapsize);
+      dt_pthread_mutex_lock(&d->lock);
+      _set_cached_map(d, DT_LIQUIFY_MAP_PROCESS, hash, roi_in->scale, map_extent, copy);
+      dt_pthread_mutex_unlock(&d->lock);
+    }
+  }
   return map;
 }
 
+// build the map of all the warps for point transforms, at a resolution holding it within
+// LIQUIFY_POINTS_MAP_MAX_PIXELS. Returns the scale of the map, map is NULL if there are no warps.
+static float _build_points_map(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const gboolean inverted,
+                               cairo_rectangle_int_t *extent, float complex **map)
+{
+  // all the warps, wherever the points are
+  const dt_iop_roi_t everywhere = { .x = -(1 << 28), .y = -(1 << 28), .width = 1 << 29, .height = 1 << 29 };
+  float scale = piece->iscale;
+  *map = NULL;
+
+  for(int pass = 0; pass < 2; pass++)
+  {
+    dt_iop_liquify_params_t copy_params;
+    memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
+    distort_paths_raw_to_piece(self, piece->pipe, scale, &copy_params, TRUE);
+
+    GList *interpolated = interpolate_paths(&copy_params);
+    GSList *interpolated_in_roi = _get_map_extent(&everywhere, interpolated, extent);
+
+    const size_t mapsize = (size_t)extent->width * extent->height;
+    if(pass == 0 && mapsize > LIQUIFY_POINTS_MAP_MAX_PIXELS)
+    {
+      // the warp field is smooth, sample it on a coarser grid
+      scale *= sqrtf((float)LIQUIFY_POINTS_MAP_MAX_PIXELS / mapsize);
+      g_slist_free(interpolated_in_roi);
+      g_list_free_full(interpolated, free);
+      continue;
+    }
+
+    *map = create_global_distortion_map(extent, interpolated_in_roi, inverted);
+    g_slist_free(interpolated_in_roi);
+    g_list_free_full(interpolated, free);
+    break;
+  }
+
+  return scale;
+}
+
+// bilinear sample of the displacement at (x, y) in map coordinates
+static inline float complex _sample_map(const float complex *const map, const cairo_rectangle_int_t *const extent,
+                                        const float x, const float y)
+{
+  const float fx = CLAMPS(x - 0.5f - extent->x, 0.f, extent->width - 1);
+  const float fy = CLAMPS(y - 0.5f - extent->y, 0.f, extent->height - 1);
+  const int x0 = (int)fx;
+  const int y0 = (int)fy;
+  const int x1 = MIN(x0 + 1, extent->width - 1);
+  const int y1 = MIN(y0 + 1, extent->height - 1);
+  const float wx = fx - x0;
+  const float wy = fy - y0;
+  const float complex *const row0 = map + (size_t)y0 * extent->width;
+  const float complex *const row1 = map + (size_t)y1 * extent->width;
+  return (1.f - wy) * ((1.f - wx) * row0[x0] + wx * row0[x1]) + wy * ((1.f - wx) * row1[x0] + wx * row1[x1]);
+}
+
 // 1st pass: how large would the output be, given this input roi?
 // this is always called with the full buffer before processing.
 void modify_roi_out(struct dt_iop_module_t *module,
@@ -1301,62 +1460,40 @@ void modify_roi_in(struct dt_iop_module_t *module,
 static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *const restrict points, const size_t points_count,
                                const gboolean inverted)
 {
-  const float scale = piece->iscale;
+  if(points_count == 0) return 1;
 
-  // compute the extent of all points (all computations are done in RAW coordinate)
-  float xmin = FLT_MAX, xmax = FLT_MIN, ymin = FLT_MAX, ymax = FLT_MIN;
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  const dt_iop_liquify_map_kind_t kind = inverted ? DT_LIQUIFY_MAP_TRANSFORM : DT_LIQUIFY_MAP_BACKTRANSFORM;
 
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-    dt_omp_firstprivate(points_count, points, scale) \
-    schedule(simd:static) if(points_count > 100)          \
-    reduction(min:xmin, ymin) reduction(max:xmax, ymax)
-#endif
-  for(size_t i = 0; i < points_count * 2; i += 2)
+  // masks and GUI query the same points over and over, keep the map of all the warps
+  // instead of building one around the points for each call
+  const uint64_t hash = _warp_hash(self, piece, piece->iscale);
+
+  dt_pthread_mutex_lock(&d->lock);
+  dt_iop_liquify_map_t *cached = &d->maps[kind];
+  if(cached->map == NULL || cached->hash != hash)
   {
-    const float x = points[i] * scale;
-    const float y = points[i + 1] * scale;
-    xmin = fmin(xmin, x);
-    xmax = fmax(xmax, x);
-    ymin = fmin(ymin, y);
-    ymax = fmax(ymax, y);
+    cairo_rectangle_int_t extent = { 0 };
+    float complex *map = NULL;
+    const float map_scale = _build_points_map(self, piece, inverted, &extent, &map);
+    if(map)
+      _set_cached_map(d, kind, hash, map_scale, &extent, map);
+    else
+      _set_cached_map(d, kind, 0, 0.f, &extent, NULL);
   }
 
-  cairo_rectangle_int_t extent = { .x = (int)(xmin - .5), .y = (int)(ymin - .5),
-                                   .width = (int)(xmax - xmin + 2.5), .height = (int)(ymax - ymin + 2.5) };
-
-  if(extent.width > 0 && extent.height > 0)
+  if(cached->map)
   {
-    // copy params
-    dt_iop_liquify_params_t copy_params;
-    memcpy(&copy_params, (dt_iop_liquify_params_t *)piece->data, sizeof(dt_iop_liquify_params_t));
-
-    distort_paths_raw_to_piece(self, piece->pipe, scale, &copy_params, TRUE);
-
-    // create the distortion map for this extent
-
-    GList *interpolated = interpolate_paths(&copy_params);
-
-    // we need to adjust the extent to be the union enclosing all the points (currently in extent) and
-    // the warps that are in (possibly partly) in this same region.
-
-    dt_iop_roi_t roi_in = { .x = extent.x, .y = extent.y, .width = extent.width, .height = extent.height };
-    GSList *interpolated_in_roi = _get_map_extent(&roi_in, interpolated, &extent);
-
-    float complex *map = create_global_distortion_map(&extent, interpolated_in_roi, inverted);
-    g_slist_free(interpolated_in_roi);
-    g_list_free_full(interpolated, free);
-
-    if(map == NULL) return 0;
-
-    const int map_size =  extent.width * extent.height;
+    const float scale = cached->scale;
+    const float complex *const map = cached->map;
+    const cairo_rectangle_int_t extent = cached->extent;
     const int x_last = extent.x + extent.width;
     const int y_last = extent.y + extent.height;
 
-    // apply distortion to all points (this is a simple displacement given by a vector at this same point in the map)
+    // apply distortion to all points (this is a displacement given by the vector at this same point in the map)
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(points_count, points, scale, extent, map, map_size, y_last, x_last) \
+    dt_omp_firstprivate(points_count, points, scale, extent, map, y_last, x_last) \
     schedule(static) if(points_count > 100)
 #endif
     for(size_t i = 0; i < points_count; i++)
@@ -1365,18 +1502,16 @@ static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
       float *py = &points[i*2+1];
       const float x = *px * scale;
       const float y = *py * scale;
-      const int map_offset = ((int)(x - 0.5) - extent.x) + ((int)(y - 0.5) - extent.y) * extent.width;
 
-      if(x >= extent.x && x < x_last && y >= extent.y && y < y_last && map_offset >= 0 && map_offset < map_size)
+      if(x >= extent.x && x < x_last && y >= extent.y && y < y_last)
       {
-        const float complex dist = map[map_offset] / scale;
+        const float complex dist = _sample_map(map, &extent, x, y) / scale;
         *px += crealf(dist);
         *py += cimagf(dist);
       }
     }
-
-    dt_free_align((void *) map);
   }
+  dt_pthread_mutex_unlock(&d->lock);
 
   return 1;
 }
@@ -1688,12 +1823,18 @@ void init(dt_iop_module_t *module)
 
 void init_pipe(struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)calloc(1, sizeof(dt_iop_liquify_data_t));
+  dt_pthread_mutex_init(&d->lock, NULL);
+  piece->data = d;
   piece->data_size = module->params_size;
 }
 
 void cleanup_pipe(struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  for(int k = 0; k < DT_LIQUIFY_MAP_LAST; k++)
+    if(d->maps[k].map) dt_free_align((void *)d->maps[k].map);
+  dt_pthread_mutex_destroy(&d->lock);
   free(piece->data);
   piece->data = NULL;
 }
@@ -2788,10 +2929,10 @@ void gui_post_expose(struct dt_iop_module_t *module,
   dt_iop_gui_leave_critical_section(module);
 
   // distort all points
-  dt_pthread_mutex_lock(&develop->pipe_mutex);
+  dt_pthread_mutex_lock(&develop->preview_pipe_mutex);
   const distort_params_t d_params = { develop, develop->preview_pipe, iscale, 1.0 / scale, DT_DEV_TRANSFORM_DIR_ALL, FALSE };
   _distort_paths(module, &d_params, &copy_params);
-  dt_pthread_mutex_unlock(&develop->pipe_mutex);
+  dt_pthread_mutex_unlock(&develop->preview_pipe_mutex);
 
   // You're not supposed to understand this
   const float zoom_x = dt_control_get_dev_zoom_x();
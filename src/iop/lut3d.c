@@ -22,6 +22,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/imageio_png.h"
 #include "common/imagebuf.h"
+#include "common/clut.h"
 #include "common/colorspaces.h"
 #include "common/colorspaces_inline_conversions.h"
 #include "common/file_location.h"
@@ -108,12 +109,30 @@ typedef struct dt_iop_lut3d_data_t
   uint16_t level; // cube_size
 } dt_iop_lut3d_data_t;
 
+// parsed cluts are shared between pipes (darkroom, preview, exports) so that
+// the same file is not parsed again for each of them
+#define DT_IOP_LUT3D_CACHE_SIZE 4
+
+typedef struct dt_iop_lut3d_cache_entry_t
+{
+  gchar *key;     // full path and lut name
+  uint64_t hash;  // compressed keypoints, if any
+  gint64 mtime;   // modification time of the file when it was read
+  float *clut;
+  uint16_t level;
+  int users;      // pipes currently using clut
+  uint64_t last_use;
+} dt_iop_lut3d_cache_entry_t;
+
 typedef struct dt_iop_lut3d_global_data_t
 {
   int kernel_lut3d_tetrahedral;
   int kernel_lut3d_trilinear;
   int kernel_lut3d_pyramid;
   int kernel_lut3d_none;
+  GMutex cache_lock;
+  dt_iop_lut3d_cache_entry_t cache[DT_IOP_LUT3D_CACHE_SIZE];
+  uint64_t cache_clock;
 } dt_iop_lut3d_global_data_t;
 
 #ifdef HAVE_GMIC
@@ -145,7 +164,7 @@ const char **description(struct dt_iop_module_t *self)
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_group()
@@ -202,6 +221,7 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
   return 1;
 }
 // From `HaldCLUT_correct.c' by Eskil Steenberg (http://www.quelsolaar.com) (BSD licensed)
+__DT_CLONE_TARGETS__
 void correct_pixel_trilinear(const float *const in, float *const out,
                              const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
 {
@@ -278,96 +298,23 @@ void correct_pixel_trilinear(const float *const in, float *const out,
  }
 }
 
-// from OpenColorIO
-// https://github.com/imageworks/OpenColorIO/blob/master/src/OpenColorIO/ops/Lut3D/Lut3DOp.cpp
+// the kernel is shared with the color profile tables, see common/clut.h
+__DT_CLONE_TARGETS__
 void correct_pixel_tetrahedral(const float *const in, float *const out,
                                const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
 {
-  const int level2 = level * level;
 #ifdef _OPENMP
 #pragma omp parallel for SIMD() default(none) \
-  dt_omp_firstprivate(clut, in, level, level2, out, pixel_nb) \
+  dt_omp_firstprivate(clut, in, level, out, pixel_nb) \
   schedule(static)
 #endif
   for(size_t k = 0; k < (size_t)(pixel_nb * 4); k+=4)
-  {
-    float *const input = ((float *const)in) + k;
-    float *const output = ((float *const)out) + k;
-
-    int rgbi[3];
-    dt_aligned_pixel_t rgbd;
-    for(int c = 0; c < 3; ++c) input[c] = fminf(fmaxf(input[c], 0.0f), 1.0f);
-
-    rgbd[0] = input[0] * (float)(level - 1);
-    rgbd[1] = input[1] * (float)(level - 1);
-    rgbd[2] = input[2] * (float)(level - 1);
-
-    rgbi[0] = CLAMP((int)rgbd[0], 0, level - 2);
-    rgbi[1] = CLAMP((int)rgbd[1], 0, level - 2);
-    rgbi[2] = CLAMP((int)rgbd[2], 0, level - 2);
-
-    rgbd[0] = rgbd[0] - rgbi[0]; // delta red
-    rgbd[1] = rgbd[1] - rgbi[1]; // delta green
-    rgbd[2] = rgbd[2] - rgbi[2]; // delta blue
-
-  // indexes of P000 to P111 in clut
-    const int color = rgbi[0] + rgbi[1] * level + rgbi[2] * level * level;
-    const int i000 = color * 3;                     // P000
-    const int i100 = i000 + 3;                      // P100
-    const int i010 = (color + level) * 3;           // P010
-    const int i110 = i010 + 3;                      // P110
-    const int i001 = (color + level2) * 3;          // P001
-    const int i101 = i001 + 3;                      // P101
-    const int i011 = (color + level + level2) * 3;  // P011
-    const int i111 = i011 + 3;                      // P111
-
-    if (rgbd[0] > rgbd[1])
-    {
-      if (rgbd[1] > rgbd[2])
-      {
-        output[0] = (1-rgbd[0])*clut[i000] + (rgbd[0]-rgbd[1])*clut[i100] + (rgbd[1]-rgbd[2])*clut[i110] + rgbd[2]*clut[i111];
-        output[1] = (1-rgbd[0])*clut[i000+1] + (rgbd[0]-rgbd[1])*clut[i100+1] + (rgbd[1]-rgbd[2])*clut[i110+1] + rgbd[2]*clut[i111+1];
-        output[2] = (1-rgbd[0])*clut[i000+2] + (rgbd[0]-rgbd[1])*clut[i100+2] + (rgbd[1]-rgbd[2])*clut[i110+2] + rgbd[2]*clut[i111+2];
-      }
-      else if (rgbd[0] > rgbd[2])
-      {
-        output[0] = (1-rgbd[0])*clut[i000] + (rgbd[0]-rgbd[2])*clut[i100] + (rgbd[2]-rgbd[1])*clut[i101] + rgbd[1]*clut[i111];
-        output[1] = (1-rgbd[0])*clut[i000+1] + (rgbd[0]-rgbd[2])*clut[i100+1] + (rgbd[2]-rgbd[1])*clut[i101+1] + rgbd[1]*clut[i111+1];
-        output[2] = (1-rgbd[0])*clut[i000+2] + (rgbd[0]-rgbd[2])*clut[i100+2] + (rgbd[2]-rgbd[1])*clut[i101+2] + rgbd[1]*clut[i111+2];
-      }
-      else
-      {
-        output[0] = (1-rgbd[2])*clut[i000] + (rgbd[2]-rgbd[0])*clut[i001] + (rgbd[0]-rgbd[1])*clut[i101] + rgbd[1]*clut[i111];
-        output[1] = (1-rgbd[2])*clut[i000+1] + (rgbd[2]-rgbd[0])*clut[i001+1] + (rgbd[0]-rgbd[1])*clut[i101+1] + rgbd[1]*clut[i111+1];
-        output[2] = (1-rgbd[2])*clut[i000+2] + (rgbd[2]-rgbd[0])*clut[i001+2] + (rgbd[0]-rgbd[1])*clut[i101+2] + rgbd[1]*clut[i111+2];
-      }
-    }
-    else
-    {
-      if (rgbd[2] > rgbd[1])
-      {
-        output[0] = (1-rgbd[2])*clut[i000] + (rgbd[2]-rgbd[1])*clut[i001] + (rgbd[1]-rgbd[0])*clut[i011] + rgbd[0]*clut[i111];
-        output[1] = (1-rgbd[2])*clut[i000+1] + (rgbd[2]-rgbd[1])*clut[i001+1] + (rgbd[1]-rgbd[0])*clut[i011+1] + rgbd[0]*clut[i111+1];
-        output[2] = (1-rgbd[2])*clut[i000+2] + (rgbd[2]-rgbd[1])*clut[i001+2] + (rgbd[1]-rgbd[0])*clut[i011+2] + rgbd[0]*clut[i111+2];
-      }
-      else if (rgbd[2] > rgbd[0])
-      {
-        output[0] = (1-rgbd[1])*clut[i000] + (rgbd[1]-rgbd[2])*clut[i010] + (rgbd[2]-rgbd[0])*clut[i011] + rgbd[0]*clut[i111];
-        output[1] = (1-rgbd[1])*clut[i000+1] + (rgbd[1]-rgbd[2])*clut[i010+1] + (rgbd[2]-rgbd[0])*clut[i011+1] + rgbd[0]*clut[i111+1];
-        output[2] = (1-rgbd[1])*clut[i000+2] + (rgbd[1]-rgbd[2])*clut[i010+2] + (rgbd[2]-rgbd[0])*clut[i011+2] + rgbd[0]*clut[i111+2];
-      }
-      else
-      {
-        output[0] = (1-rgbd[1])*clut[i000] + (rgbd[1]-rgbd[0])*clut[i010] + (rgbd[0]-rgbd[2])*clut[i110] + rgbd[2]*clut[i111];
-        output[1] = (1-rgbd[1])*clut[i000+1] + (rgbd[1]-rgbd[0])*clut[i010+1] + (rgbd[0]-rgbd[2])*clut[i110+1] + rgbd[2]*clut[i111+1];
-        output[2] = (1-rgbd[1])*clut[i000+2] + (rgbd[1]-rgbd[0])*clut[i010+2] + (rgbd[0]-rgbd[2])*clut[i110+2] + rgbd[2]*clut[i111+2];
-      }
-    }
-  }
+    dt_clut_tetrahedral(in + k, out + k, clut, level);
 }
 
 // from Study on the 3D Interpolation Models Used in Color Conversion
 // http://ijetch.org/papers/318-T860.pdf
+__DT_CLONE_TARGETS__
 void correct_pixel_pyramid(const float *const in, float *const out,
                            const size_t pixel_nb, const float *const restrict clut, const uint16_t level)
 {
@@ -1119,6 +1066,9 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_lut3d_trilinear = dt_opencl_create_kernel(program, "lut3d_trilinear");
   gd->kernel_lut3d_pyramid = dt_opencl_create_kernel(program, "lut3d_pyramid");
   gd->kernel_lut3d_none = dt_opencl_create_kernel(program, "lut3d_none");
+  g_mutex_init(&gd->cache_lock);
+  memset(gd->cache, 0, sizeof(gd->cache));
+  gd->cache_clock = 0;
 
 #ifdef HAVE_GMIC
   // make sure the cache dir exists
@@ -1136,6 +1086,12 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_lut3d_trilinear);
   dt_opencl_free_kernel(gd->kernel_lut3d_pyramid);
   dt_opencl_free_kernel(gd->kernel_lut3d_none);
+  for(int i = 0; i < DT_IOP_LUT3D_CACHE_SIZE; i++)
+  {
+    g_free(gd->cache[i].key);
+    dt_free_align(gd->cache[i].clut);
+  }
+  g_mutex_clear(&gd->cache_lock);
   free(module->data);
   module->data = NULL;
 }
@@ -1178,6 +1134,96 @@ static int calculate_clut(dt_iop_lut3d_params_t *const p, float **clut)
   return level;
 }
 
+// get the clut for p from the shared cache, reading it on a miss. The clut must
+// be given back with release_clut() and must not be freed by the caller.
+static uint16_t acquire_clut(dt_iop_lut3d_global_data_t *const gd, dt_iop_lut3d_params_t *const p,
+                             float **clut)
+{
+  *clut = NULL;
+  if(!p->filepath[0]) return 0;
+
+  gchar *lutfolder = dt_conf_get_string("plugins/darkroom/lut3d/def_path");
+  char *fullpath = g_build_filename(lutfolder, p->filepath, NULL);
+  g_free(lutfolder);
+  gchar *key = g_strconcat(fullpath, "\n", p->lutname, NULL);
+  GStatBuf st;
+  const gint64 mtime = g_stat(fullpath, &st) == 0 ? (gint64)st.st_mtime : 0;
+  g_free(fullpath);
+  const uint64_t hash = p->nb_keypoints
+    ? dt_hash(5381, p->c_clut, (size_t)MIN(p->nb_keypoints, DT_IOP_LUT3D_MAX_KEYPOINTS) * 2 * 3) : 0;
+
+  uint16_t level = 0;
+  g_mutex_lock(&gd->cache_lock);
+  dt_iop_lut3d_cache_entry_t *entry = NULL;
+  for(int i = 0; i < DT_IOP_LUT3D_CACHE_SIZE; i++)
+  {
+    dt_iop_lut3d_cache_entry_t *e = gd->cache + i;
+    if(e->key && e->mtime == mtime && e->hash == hash && !strcmp(e->key, key))
+    {
+      entry = e;
+      break;
+    }
+  }
+
+  if(!entry)
+  {
+    // read it while holding the lock: pipes asking for the same lut at the same
+    // time wait for this one instead of reading it again
+    level = calculate_clut(p, clut);
+    if(*clut)
+    {
+      // take the least recently used slot nobody is using anymore
+      for(int i = 0; i < DT_IOP_LUT3D_CACHE_SIZE; i++)
+      {
+        dt_iop_lut3d_cache_entry_t *e = gd->cache + i;
+        if(e->users == 0 && (!entry || !e->key || (entry->key && e->last_use < entry->last_use)))
+          entry = e;
+      }
+      if(entry)
+      {
+        g_free(entry->key);
+        dt_free_align(entry->clut);
+        entry->key = key;
+        key = NULL;
+        entry->hash = hash;
+        entry->mtime = mtime;
+        entry->clut = *clut;
+        entry->level = level;
+      }
+      // else all slots are in use: the clut stays private to the pipe, see release_clut()
+    }
+  }
+
+  if(entry)
+  {
+    entry->users++;
+    entry->last_use = ++gd->cache_clock;
+    *clut = entry->clut;
+    level = entry->level;
+  }
+  g_mutex_unlock(&gd->cache_lock);
+  g_free(key);
+  return level;
+}
+
+static void release_clut(dt_iop_lut3d_global_data_t *const gd, float *const clut)
+{
+  if(!clut) return;
+  g_mutex_lock(&gd->cache_lock);
+  gboolean cached = FALSE;
+  for(int i = 0; i < DT_IOP_LUT3D_CACHE_SIZE; i++)
+  {
+    if(gd->cache[i].clut == clut)
+    {
+      gd->cache[i].users--;
+      cached = TRUE;
+      break;
+    }
+  }
+  g_mutex_unlock(&gd->cache_lock);
+  if(!cached) dt_free_align(clut);
+}
+
 #ifdef HAVE_GMIC
 static gboolean list_match_string(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, dt_iop_lut3d_gui_data_t *g)
 {
@@ -1348,16 +1394,17 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 {
   dt_iop_lut3d_params_t *p = (dt_iop_lut3d_params_t *)p1;
   dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;
+  dt_iop_lut3d_global_data_t *gd = (dt_iop_lut3d_global_data_t *)self->global_data;
 
   if (strcmp(p->filepath, d->params.filepath) != 0 || strcmp(p->lutname, d->params.lutname) != 0 )
   { // new clut file
     if (d->clut)
     { // reset current clut if any
-      dt_free_align(d->clut);
+      release_clut(gd, d->clut);
       d->clut = NULL;
       d->level = 0;
     }
-    d->level = calculate_clut(p, &d->clut);
+    d->level = acquire_clut(gd, p, &d->clut);
   }
   memcpy(&d->params, p, sizeof(dt_iop_lut3d_params_t));
 }
@@ -1375,9 +1422,8 @@ void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pi
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;;
-  if (d->clut)
-    dt_free_align(d->clut);
+  dt_iop_lut3d_data_t *d = (dt_iop_lut3d_data_t *)piece->data;
+  release_clut((dt_iop_lut3d_global_data_t *)self->global_data, d->clut);
   d->clut = NULL;
   d->level = 0;
   free(piece->data);
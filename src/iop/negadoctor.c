@@ -161,7 +161,8 @@ const char **description(struct dt_iop_module_t *self)
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_SCALE_INDEPENDENT
+         | IOP_FLAGS_INPLACE;
 }
 
 
@@ -260,53 +261,66 @@ void commit_params(dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_
 }
 
 
+static inline void _negadoctor_pixel(const dt_iop_negadoctor_data_t *const d, const float *const pix_in,
+                                     float *const pix_out)
+{
+  for(size_t c = 0; c < 4; c++)
+  {
+    // Unpack vectors one by one with extra pragmas to be sure the compiler understands they can be vectorized
+    const float *const restrict Dmin = __builtin_assume_aligned(d->Dmin, 16);
+    const float *const restrict wb_high = __builtin_assume_aligned(d->wb_high, 16);
+    const float *const restrict offset = __builtin_assume_aligned(d->offset, 16);
+
+    // Convert transmission to density using Dmin as a fulcrum
+    const float density = - log10f(Dmin[c] / fmaxf(pix_in[c], THRESHOLD)); // threshold to -32 EV
+
+    // Correct density in log space
+    const float corrected_de = wb_high[c] * density + offset[c];
+
+    // Print density on paper : ((1 - 10^corrected_de + black) * exposure)^gamma rewritten for FMA
+    const float print_linear = -(d->exposure * fast_exp10f(corrected_de) + d->black);
+    const float print_gamma = powf(fmaxf(print_linear, 0.0f), d->gamma); // note : this is always > 0
+
+    // Compress highlights. from https://lists.gnu.org/archive/html/openexr-devel/2005-03/msg00009.html
+    pix_out[c] =  (print_gamma > d->soft_clip) ? d->soft_clip + (1.0f - fast_expf(-(print_gamma - d->soft_clip) / d->soft_clip_comp)) * d->soft_clip_comp
+                                               : print_gamma;
+  }
+}
+
 void process(struct dt_iop_module_t *const self, dt_dev_pixelpipe_iop_t *const piece,
-             const void *const restrict ivoid, void *const restrict ovoid,
+             const void *const ivoid, void *const ovoid,
              const dt_iop_roi_t *const restrict roi_in, const dt_iop_roi_t *const restrict roi_out)
 {
   const dt_iop_negadoctor_data_t *const d = piece->data;
   assert(piece->colors = 4);
 
-  const float *const restrict in = (float *)ivoid;
-  float *const restrict out = (float *)ovoid;
+  // in and out may be the same buffer, each pixel is read before being written
+  const float *const in = (float *)ivoid;
+  float *const out = (float *)ovoid;
 
 
 #ifdef _OPENMP
   #pragma omp parallel for simd default(none) \
     dt_omp_firstprivate(d, in, out, roi_out) \
-    aligned(in, out:64) collapse(2)
+    aligned(in, out:64)
 #endif
   for(size_t k = 0; k < (size_t)roi_out->height * roi_out->width * 4; k += 4)
-  {
-    for(size_t c = 0; c < 4; c++)
-    {
-      // Unpack vectors one by one with extra pragmas to be sure the compiler understands they can be vectorized
-      const float *const restrict pix_in = in + k;
-      float *const restrict pix_out = out + k;
-      const float *const restrict Dmin = __builtin_assume_aligned(d->Dmin, 16);
-      const float *const restrict wb_high = __builtin_assume_aligned(d->wb_high, 16);
-      const float *const restrict offset = __builtin_assume_aligned(d->offset, 16);
-
-      // Convert transmission to density using Dmin as a fulcrum
-      const float density = - log10f(Dmin[c] / fmaxf(pix_in[c], THRESHOLD)); // threshold to -32 EV
-
-      // Correct density in log space
-      const float corrected_de = wb_high[c] * density + offset[c];
-
-      // Print density on paper : ((1 - 10^corrected_de + black) * exposure)^gamma rewritten for FMA
-      const float print_linear = -(d->exposure * fast_exp10f(corrected_de) + d->black);
-      const float print_gamma = powf(fmaxf(print_linear, 0.0f), d->gamma); // note : this is always > 0
-
-      // Compress highlights. from https://lists.gnu.org/archive/html/openexr-devel/2005-03/msg00009.html
-      pix_out[c] =  (print_gamma > d->soft_clip) ? d->soft_clip + (1.0f - fast_expf(-(print_gamma - d->soft_clip) / d->soft_clip_comp)) * d->soft_clip_comp
-                                                 : print_gamma;
-    }
-  }
+    _negadoctor_pixel(d, in + k, out + k);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_negadoctor_data_t *const d = piece->data;
+
+  // channels are processed independently, so working in place is fine
+  for(size_t k = 0; k < npixels * 4; k += 4)
+    _negadoctor_pixel(d, in + k, out + k);
+}
+
 
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *const self, dt_dev_pixelpipe_iop_t *const piece, cl_mem dev_in, cl_mem dev_out,
@@ -182,7 +182,7 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     .sharpness = sharpness,
     .patch_radius = P,
     .search_radius = K,
-    .decimate = 0,
+    .decimate = nlmeans_search_decimate(piece->pipe->type),
     .norm = norm2,
     .pipetype = piece->pipe->type,
     .kernel_init = gd->kernel_nlmeans_init,
@@ -420,7 +420,7 @@ static void process_cpu(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
   const dt_aligned_pixel_t norm2 = { nL * nL, nC * nC, nC * nC, 1.0f };
 
   // faster but less accurate processing by skipping half the patches on previews and thumbnails
-  int decimate = (piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW || piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL);
+  const int decimate = nlmeans_search_decimate(piece->pipe->type);
 
   const dt_nlmeans_param_t params = { .scattering = 0,
                                       .scale = scale,
@@ -112,7 +112,7 @@ int default_group()
 int flags()
 {
   return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_INCLUDE_IN_STYLES
-         | IOP_FLAGS_SUPPORTS_BLENDING;
+         | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -30,6 +30,7 @@
 #include "develop/imageop.h"      // for dt_iop_module_t, dt_iop_roi_t, dt_...
 #include "develop/imageop_math.h" // for FC, FCxtrans
 #include "develop/pixelpipe.h"    // for dt_dev_pixelpipe_type_t::DT_DEV_PI...
+#include "develop/pixelpipe_arena.h" // for dt_pixelpipe_alloc_perthread_float, dt_pixelpipe_free_align
 #include "develop/tiling.h"
 #include "iop/iop_api.h"          // for dt_iop_params_t
 #include <glib/gi18n.h>           // for _
@@ -76,7 +77,8 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_HIDDEN | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_HISTORY_STACK;
+  return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_HIDDEN | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_NO_HISTORY_STACK
+         | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -155,7 +157,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
   // acquire temp memory for distorted pixel coords
   size_t coordbufsize;
-  float *const restrict coordbuf = dt_alloc_perthread_float(2*roi_out->width, &coordbufsize);
+  float *const restrict coordbuf = dt_pixelpipe_alloc_perthread_float(2*roi_out->width, &coordbufsize);
 
 #ifdef _OPENMP
 #pragma omp parallel for SIMD() default(none) \
@@ -221,7 +223,7 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
     }
   }
 
-  dt_free_align(coordbuf);
+  dt_pixelpipe_free_align(coordbuf);
 
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
 
@@ -188,6 +188,11 @@ typedef struct dt_iop_retouch_global_data_t
   int kernel_retouch_image_rgb2lab;
   int kernel_retouch_image_lab2rgb;
   int kernel_retouch_copy_mask_to_alpha;
+
+  // healed patches, most recent first, see _retouch_heal()
+  GList *heal_cache;
+  size_t heal_cache_size;
+  dt_pthread_mutex_t heal_cache_lock;
 } dt_iop_retouch_global_data_t;
 
 
@@ -1250,6 +1255,18 @@ static int rt_scale_has_shapes(dt_iop_retouch_params_t *p, const int scale)
   return has_shapes;
 }
 
+// shapes on the image itself are processed before the wavelet decomposition starts,
+// so the decomposition is only needed for shapes on the wavelet scales or to preview one of them
+static gboolean rt_needs_decomposition(dt_iop_retouch_params_t *p, const int return_layer)
+{
+  if(return_layer > 0) return TRUE;
+
+  for(int i = 0; i < RETOUCH_NO_FORMS; i++)
+    if(p->rt_forms[i].formid != 0 && p->rt_forms[i].scale > 0) return TRUE;
+
+  return FALSE;
+}
+
 static gboolean rt_wdbar_draw(GtkWidget *widget, cairo_t *crf, dt_iop_module_t *self)
 {
   dt_iop_retouch_gui_data_t *g = (dt_iop_retouch_gui_data_t *)self->gui_data;
@@ -1938,6 +1955,78 @@ void init(dt_iop_module_t *module)
   d->algorithm = dt_conf_get_int("plugins/darkroom/retouch/default_algo");
 }
 
+// memory kept by the healed patches of all the retouch instances
+#define RT_HEAL_CACHE_SIZE ((size_t)64 << 20)
+
+typedef struct rt_heal_patch_t
+{
+  uint64_t hash; // source, destination, mask and iterations
+  size_t size;
+  float *healed;
+} rt_heal_patch_t;
+
+static void rt_heal_patch_free(rt_heal_patch_t *patch)
+{
+  dt_free_align(patch->healed);
+  free(patch);
+}
+
+// copy a cached healed patch to dest and make it the most recent, FALSE if there is none
+static gboolean rt_heal_cache_get(dt_iop_retouch_global_data_t *gd, const uint64_t hash, const size_t size,
+                                  float *const dest)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&gd->heal_cache_lock);
+  for(GList *l = gd->heal_cache; l; l = g_list_next(l))
+  {
+    rt_heal_patch_t *patch = (rt_heal_patch_t *)l->data;
+    if(patch->hash == hash && patch->size == size)
+    {
+      memcpy(dest, patch->healed, size * sizeof(float));
+      gd->heal_cache = g_list_remove_link(gd->heal_cache, l);
+      gd->heal_cache = g_list_concat(l, gd->heal_cache);
+      found = TRUE;
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->heal_cache_lock);
+  return found;
+}
+
+static void rt_heal_cache_put(dt_iop_retouch_global_data_t *gd, const uint64_t hash, const size_t size,
+                              const float *const healed)
+{
+  if(size * sizeof(float) > RT_HEAL_CACHE_SIZE / 4) return;
+
+  rt_heal_patch_t *patch = malloc(sizeof(rt_heal_patch_t));
+  float *copy = dt_alloc_align_float(size);
+  if(!patch || !copy)
+  {
+    free(patch);
+    if(copy) dt_free_align(copy);
+    return;
+  }
+  memcpy(copy, healed, size * sizeof(float));
+  patch->hash = hash;
+  patch->size = size;
+  patch->healed = copy;
+
+  dt_pthread_mutex_lock(&gd->heal_cache_lock);
+  gd->heal_cache = g_list_prepend(gd->heal_cache, patch);
+  gd->heal_cache_size += size * sizeof(float);
+
+  // drop the least recently used patches
+  while(gd->heal_cache_size > RT_HEAL_CACHE_SIZE)
+  {
+    GList *last = g_list_last(gd->heal_cache);
+    rt_heal_patch_t *old = (rt_heal_patch_t *)last->data;
+    gd->heal_cache_size -= old->size * sizeof(float);
+    gd->heal_cache = g_list_delete_link(gd->heal_cache, last);
+    rt_heal_patch_free(old);
+  }
+  dt_pthread_mutex_unlock(&gd->heal_cache_lock);
+}
+
 void init_global(dt_iop_module_so_t *module)
 {
   const int program = 21; // retouch.cl, from programs.conf
@@ -1955,6 +2044,10 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_retouch_image_rgb2lab = dt_opencl_create_kernel(program, "retouch_image_rgb2lab");
   gd->kernel_retouch_image_lab2rgb = dt_opencl_create_kernel(program, "retouch_image_lab2rgb");
   gd->kernel_retouch_copy_mask_to_alpha = dt_opencl_create_kernel(program, "retouch_copy_mask_to_alpha");
+
+  gd->heal_cache = NULL;
+  gd->heal_cache_size = 0;
+  dt_pthread_mutex_init(&gd->heal_cache_lock, NULL);
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
@@ -1972,6 +2065,9 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_retouch_image_lab2rgb);
   dt_opencl_free_kernel(gd->kernel_retouch_copy_mask_to_alpha);
 
+  g_list_free_full(gd->heal_cache, (GDestroyNotify)rt_heal_patch_free);
+  dt_pthread_mutex_destroy(&gd->heal_cache_lock);
+
   free(module->data);
   module->data = NULL;
 }
@@ -3262,8 +3358,11 @@ cleanup:
   if(img_dest) dt_free_align(img_dest);
 }
 
-static void _retouch_heal(float *const in, dt_iop_roi_t *const roi_in, float *const mask_scaled,
-                          dt_iop_roi_t *const roi_mask_scaled, const int dx, const int dy, const float opacity, const int max_iter)
+// healing solves a Laplace equation over the whole patch, which is the most expensive part of retouching.
+// The result only depends on the pixels of the patch, so editing one spot lets all the others be reused.
+static void _retouch_heal(dt_iop_retouch_global_data_t *gd, float *const in, dt_iop_roi_t *const roi_in,
+                          float *const mask_scaled, dt_iop_roi_t *const roi_mask_scaled, const int dx, const int dy,
+                          const float opacity, const int max_iter)
 {
   float *img_src = NULL;
   float *img_dest = NULL;
@@ -3281,8 +3380,20 @@ static void _retouch_heal(float *const in, dt_iop_roi_t *const roi_in, float *co
   rt_copy_in_to_out(in, roi_in, img_src, roi_mask_scaled, 4, dx, dy);
   rt_copy_in_to_out(in, roi_in, img_dest, roi_mask_scaled, 4, 0, 0);
 
+  const size_t size = (size_t)4 * roi_mask_scaled->width * roi_mask_scaled->height;
+  uint64_t hash = 5381;
+  hash = dt_hash(hash, (const char *)roi_mask_scaled, sizeof(dt_iop_roi_t));
+  hash = dt_hash(hash, (const char *)&max_iter, sizeof(int));
+  hash = dt_hash(hash, (const char *)mask_scaled, sizeof(float) * size / 4);
+  hash = dt_hash(hash, (const char *)img_src, sizeof(float) * size);
+  hash = dt_hash(hash, (const char *)img_dest, sizeof(float) * size);
+
   // heal it
-  dt_heal(img_src, img_dest, mask_scaled, roi_mask_scaled->width, roi_mask_scaled->height, 4, max_iter);
+  if(!rt_heal_cache_get(gd, hash, size, img_dest))
+  {
+    dt_heal(img_src, img_dest, mask_scaled, roi_mask_scaled->width, roi_mask_scaled->height, 4, max_iter);
+    rt_heal_cache_put(gd, hash, size, img_dest);
+  }
 
   // copy healed (temp) image to destination image
   rt_copy_image_masked(img_dest, in, roi_in, mask_scaled, roi_mask_scaled, opacity);
@@ -3419,7 +3530,9 @@ static void rt_process_forms(float *layer, dwt_params_t *const wt_p, const int s
           }
           else if(algo == DT_IOP_RETOUCH_HEAL)
           {
-            _retouch_heal(layer, roi_layer, mask_scaled, &roi_mask_scaled, dx, dy, form_opacity, p->max_heal_iter);
+            _retouch_heal((dt_iop_retouch_global_data_t *)self->global_data, layer, roi_layer, mask_scaled,
+                          &roi_mask_scaled, dx, dy, form_opacity,
+                          dt_heal_max_iter(piece->pipe->type, p->max_heal_iter));
           }
           else if(algo == DT_IOP_RETOUCH_BLUR)
           {
@@ -3531,6 +3644,8 @@ static void process_internal(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     if(g) g->first_scale_visible = dt_dwt_first_scale_visible(dwt_p);
   }
 
+  if(!rt_needs_decomposition(p, dwt_p->return_layer)) dwt_p->scales = 0;
+
   // decompose it
   dwt_decompose(dwt_p, rt_process_forms);
 
@@ -4229,7 +4344,8 @@ static cl_int rt_process_forms_cl(cl_mem dev_layer, dwt_params_cl_t *const wt_p,
           else if(algo == DT_IOP_RETOUCH_HEAL)
           {
             err = _retouch_heal_cl(devid, dev_layer, roi_layer, mask_scaled, dev_mask_scaled, &roi_mask_scaled, dx,
-                                   dy, form_opacity, gd, p->max_heal_iter);
+                                   dy, form_opacity, gd,
+                                   dt_heal_max_iter(piece->pipe->type, p->max_heal_iter));
           }
           else if(algo == DT_IOP_RETOUCH_BLUR)
           {
@@ -4366,6 +4482,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     if(g) g->first_scale_visible = dt_dwt_first_scale_visible_cl(dwt_p);
   }
 
+  if(!rt_needs_decomposition(p, dwt_p->return_layer)) dwt_p->scales = 0;
+
   // decompose it
   err = dwt_decompose_cl(dwt_p, rt_process_forms_cl);
   if(err != CL_SUCCESS) goto cleanup;
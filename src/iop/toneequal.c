@@ -189,7 +189,19 @@ typedef struct dt_iop_toneequalizer_data_t
 
 typedef struct dt_iop_toneequalizer_global_data_t
 {
-  // TODO: put OpenCL kernels here at some point
+  int kernel_toneeq_luminance_mask;
+  int kernel_toneeq_resample;
+  int kernel_toneeq_quantize;
+  int kernel_toneeq_guided_pack;
+  int kernel_toneeq_eigf_pack;
+  int kernel_toneeq_box_mean_x;
+  int kernel_toneeq_box_mean_y;
+  int kernel_toneeq_guided_ab;
+  int kernel_toneeq_guided_blend;
+  int kernel_toneeq_eigf_variance;
+  int kernel_toneeq_eigf_blend;
+  int kernel_toneeq_apply;
+  int kernel_toneeq_show_mask;
 } dt_iop_toneequalizer_global_data_t;
 
 
@@ -315,7 +327,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_VOLATILE_COMMIT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -902,6 +914,116 @@ static inline void display_luminance_mask(const float *const restrict in,
 }
 
 
+/***
+ * GUI caches of the luminance mask, shared by the CPU and OpenCL paths
+ **/
+
+static float *get_luminance_cache(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                  const size_t width, const size_t height, gboolean *cached)
+{
+  // Return the GUI buffer holding the luminance mask of the full and preview pipes,
+  // *cached is FALSE for the other pipes which don't keep it
+  dt_iop_toneequalizer_gui_data_t *const g = (dt_iop_toneequalizer_gui_data_t *)self->gui_data;
+  const size_t num_elem = width * height;
+  float *luminance = NULL;
+  *cached = FALSE;
+
+  if(!self->dev->gui_attached) return NULL;
+
+  // If the module instance has changed order in the pipe, invalidate the caches
+  const int position = self->iop_order;
+  if(g->pipe_order != position)
+  {
+    dt_iop_gui_enter_critical_section(self);
+    g->ui_preview_hash = 0;
+    g->thumb_preview_hash = 0;
+    g->pipe_order = position;
+    g->luminance_valid = FALSE;
+    g->histogram_valid = FALSE;
+    dt_iop_gui_leave_critical_section(self);
+  }
+
+  if((piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
+  {
+    // For DT_DEV_PIXELPIPE_FULL, we cache the luminance mask for performance
+    // but it's not accessed from GUI
+    // no need for threads lock since no other function is writing/reading that buffer
+
+    // Re-allocate a new buffer if the full preview size has changed
+    if(g->full_preview_buf_width != width || g->full_preview_buf_height != height)
+    {
+      if(g->full_preview_buf) dt_free_align(g->full_preview_buf);
+      g->full_preview_buf = dt_alloc_sse_ps(num_elem);
+      g->full_preview_buf_width = width;
+      g->full_preview_buf_height = height;
+    }
+
+    luminance = g->full_preview_buf;
+    *cached = TRUE;
+  }
+  else if((piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
+  {
+    // For DT_DEV_PIXELPIPE_PREVIEW, we need to cache is too to compute the full image stats
+    // upon user request in GUI
+    // threads locks are required since GUI reads and writes on that buffer.
+
+    // Re-allocate a new buffer if the thumb preview size has changed
+    dt_iop_gui_enter_critical_section(self);
+    if(g->thumb_preview_buf_width != width || g->thumb_preview_buf_height != height)
+    {
+      if(g->thumb_preview_buf) dt_free_align(g->thumb_preview_buf);
+      g->thumb_preview_buf = dt_alloc_sse_ps(num_elem);
+      g->thumb_preview_buf_width = width;
+      g->thumb_preview_buf_height = height;
+      g->luminance_valid = FALSE;
+    }
+
+    luminance = g->thumb_preview_buf;
+    *cached = TRUE;
+
+    dt_iop_gui_leave_critical_section(self);
+  }
+
+  return luminance;
+}
+
+
+static uint64_t luminance_mask_hash(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in)
+{
+  // The mask only depends on the input and the mask parameters, not on the correction curve:
+  // changing the curve only needs the correction to be applied again
+  const dt_iop_toneequalizer_data_t *const d = (const dt_iop_toneequalizer_data_t *const)piece->data;
+  uint64_t hash = dt_hash(piece->input_hash, (const char *)roi_in, sizeof(dt_iop_roi_t));
+  hash = dt_hash(hash, (const char *)&d->method, sizeof(d->method));
+  hash = dt_hash(hash, (const char *)&d->details, sizeof(d->details));
+  hash = dt_hash(hash, (const char *)&d->iterations, sizeof(d->iterations));
+  hash = dt_hash(hash, (const char *)&d->radius, sizeof(d->radius));
+  hash = dt_hash(hash, (const char *)&d->scale, sizeof(d->scale));
+  hash = dt_hash(hash, (const char *)&d->feathering, sizeof(d->feathering));
+  hash = dt_hash(hash, (const char *)&d->quantization, sizeof(d->quantization));
+  hash = dt_hash(hash, (const char *)&d->contrast_boost, sizeof(d->contrast_boost));
+  return dt_hash(hash, (const char *)&d->exposure_boost, sizeof(d->exposure_boost));
+}
+
+
+static gboolean luminance_cache_outdated(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
+                                         uint64_t hash)
+{
+  // TRUE if the cached mask doesn't match the upstream pipe state anymore
+  dt_iop_toneequalizer_gui_data_t *const g = (dt_iop_toneequalizer_gui_data_t *)self->gui_data;
+  const gboolean full = (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL;
+
+  uint64_t saved_hash;
+  hash_set_get(full ? &g->ui_preview_hash : &g->thumb_preview_hash, &saved_hash, &self->gui_lock);
+
+  dt_iop_gui_enter_critical_section(self);
+  const int luminance_valid = g->luminance_valid;
+  dt_iop_gui_leave_critical_section(self);
+
+  return hash != saved_hash || !luminance_valid;
+}
+
+
 __DT_CLONE_TARGETS__
 static
 void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
@@ -928,9 +1050,8 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
   const size_t num_elem = width * height;
   const size_t ch = 4;
 
-  // Get the hash of the upstream pipe to track changes
-  const int position = self->iop_order;
-  uint64_t hash = piece->global_hash;
+  // Get the hash of the upstream pipe and the mask parameters to track changes
+  uint64_t hash = luminance_mask_hash(piece, roi_in);
 
   // Sanity checks
   if(width < 1 || height < 1) return;
@@ -946,73 +1067,10 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
 
   // Init the luminance masks buffers
   gboolean cached = FALSE;
+  luminance = get_luminance_cache(self, piece, width, height, &cached);
 
-  if(self->dev->gui_attached)
-  {
-    // If the module instance has changed order in the pipe, invalidate the caches
-    if(g->pipe_order != position)
-    {
-      dt_iop_gui_enter_critical_section(self);
-      g->ui_preview_hash = 0;
-      g->thumb_preview_hash = 0;
-      g->pipe_order = position;
-      g->luminance_valid = FALSE;
-      g->histogram_valid = FALSE;
-      dt_iop_gui_leave_critical_section(self);
-    }
-
-    if((piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
-    {
-      // For DT_DEV_PIXELPIPE_FULL, we cache the luminance mask for performance
-      // but it's not accessed from GUI
-      // no need for threads lock since no other function is writing/reading that buffer
-
-      // Re-allocate a new buffer if the full preview size has changed
-      if(g->full_preview_buf_width != width || g->full_preview_buf_height != height)
-      {
-        if(g->full_preview_buf) dt_free_align(g->full_preview_buf);
-        g->full_preview_buf = dt_alloc_sse_ps(num_elem);
-        g->full_preview_buf_width = width;
-        g->full_preview_buf_height = height;
-      }
-
-      luminance = g->full_preview_buf;
-      cached = TRUE;
-    }
-
-    else if((piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
-    {
-      // For DT_DEV_PIXELPIPE_PREVIEW, we need to cache is too to compute the full image stats
-      // upon user request in GUI
-      // threads locks are required since GUI reads and writes on that buffer.
-
-      // Re-allocate a new buffer if the thumb preview size has changed
-      dt_iop_gui_enter_critical_section(self);
-      if(g->thumb_preview_buf_width != width || g->thumb_preview_buf_height != height)
-      {
-        if(g->thumb_preview_buf) dt_free_align(g->thumb_preview_buf);
-        g->thumb_preview_buf = dt_alloc_sse_ps(num_elem);
-        g->thumb_preview_buf_width = width;
-        g->thumb_preview_buf_height = height;
-        g->luminance_valid = FALSE;
-      }
-
-      luminance = g->thumb_preview_buf;
-      cached = TRUE;
-
-      dt_iop_gui_leave_critical_section(self);
-    }
-    else // just to please GCC
-    {
-      luminance = dt_alloc_sse_ps(num_elem);
-    }
-
-  }
-  else
-  {
-    // no interactive editing/caching : just allocate a local temp buffer
-    luminance = dt_alloc_sse_ps(num_elem);
-  }
+  // no interactive editing/caching : just allocate a local temp buffer
+  if(!cached) luminance = dt_alloc_sse_ps(num_elem);
 
   // Check if the luminance buffer exists
   if(!luminance)
@@ -1028,14 +1086,7 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
 
     if((piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
     {
-      uint64_t saved_hash;
-      hash_set_get(&g->ui_preview_hash, &saved_hash, &self->gui_lock);
-
-      dt_iop_gui_enter_critical_section(self);
-      const int luminance_valid = g->luminance_valid;
-      dt_iop_gui_leave_critical_section(self);
-
-      if(hash != saved_hash || !luminance_valid)
+      if(luminance_cache_outdated(self, piece, hash))
       {
         /* compute only if upstream pipe state has changed */
         compute_luminance_mask(in, luminance, width, height, ch, d);
@@ -1044,14 +1095,7 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
     }
     else if((piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
     {
-      uint64_t saved_hash;
-      hash_set_get(&g->thumb_preview_hash, &saved_hash, &self->gui_lock);
-
-      dt_iop_gui_enter_critical_section(self);
-      const int luminance_valid = g->luminance_valid;
-      dt_iop_gui_leave_critical_section(self);
-
-      if(saved_hash != hash || !luminance_valid)
+      if(luminance_cache_outdated(self, piece, hash))
       {
         /* compute only if upstream pipe state has changed */
         dt_iop_gui_enter_critical_section(self);
@@ -1100,6 +1144,446 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
   toneeq_process(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
 
+#ifdef HAVE_OPENCL
+static cl_int resample_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                          cl_mem in, cl_mem out, const int width_in, const int height_in,
+                          const int width_out, const int height_out)
+{
+  size_t sizes[] = { ROUNDUPDWD(width_out, devid), ROUNDUPDHT(height_out, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 0, sizeof(cl_mem), (void *)&in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 1, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 2, sizeof(int), (void *)&width_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 3, sizeof(int), (void *)&height_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 4, sizeof(int), (void *)&width_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_resample, 5, sizeof(int), (void *)&height_out);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_resample, sizes);
+}
+
+
+static cl_int quantize_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                          cl_mem in, cl_mem out, const int width, const int height,
+                          const float sampling, const float clip_min, const float clip_max)
+{
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+
+  // No-op
+  if(sampling == 0.0f) return dt_opencl_enqueue_copy_image(devid, in, out, origin, origin, region);
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 0, sizeof(cl_mem), (void *)&in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 1, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 4, sizeof(float), (void *)&sampling);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 5, sizeof(float), (void *)&clip_min);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_quantize, 6, sizeof(float), (void *)&clip_max);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_quantize, sizes);
+}
+
+
+static cl_int pack_cl(const int kernel, const int devid, cl_mem guide, cl_mem mask, cl_mem out,
+                      const int width, const int height)
+{
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&guide);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&mask);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(cl_mem), (void *)&out);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&height);
+  return dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+}
+
+
+static cl_int box_mean_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                          cl_mem image, cl_mem temp, const int width, const int height, const int radius)
+{
+  // in-place box average of a 4 channels image, using temp as scratch
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_x, 0, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_x, 1, sizeof(cl_mem), (void *)&temp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_x, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_x, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_x, 4, sizeof(int), (void *)&radius);
+  cl_int err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_box_mean_x, sizes);
+  if(err != CL_SUCCESS) return err;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_y, 0, sizeof(cl_mem), (void *)&temp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_y, 1, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_y, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_y, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_box_mean_y, 4, sizeof(int), (void *)&radius);
+  return dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_box_mean_y, sizes);
+}
+
+
+static cl_int guided_blend_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                              cl_mem image, cl_mem ab, cl_mem temp, const int width, const int height,
+                              const int geomean)
+{
+  // in-place blending of a grey image, using temp as scratch
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 0, sizeof(cl_mem), (void *)&image);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 1, sizeof(cl_mem), (void *)&ab);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 2, sizeof(cl_mem), (void *)&temp);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_blend, 5, sizeof(int), (void *)&geomean);
+  const cl_int err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_guided_blend, sizes);
+  if(err != CL_SUCCESS) return err;
+  return dt_opencl_enqueue_copy_image(devid, temp, image, origin, origin, region);
+}
+
+
+static cl_int fast_surface_blur_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                                   cl_mem image, const int width, const int height,
+                                   const dt_iop_toneequalizer_data_t *const d,
+                                   const dt_iop_guided_filter_blending_t filter)
+{
+  // Same as fast_surface_blur() from fast_guided_filter.h, in-place on a grey image
+  const float scaling = 4.0f;
+  const int ds_radius = (d->radius < 4) ? 1 : d->radius / scaling;
+  const int ds_width = width / scaling;
+  const int ds_height = height / scaling;
+  if(ds_width < 1 || ds_height < 1) return DT_OPENCL_DEFAULT_ERROR;
+
+  cl_int err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  cl_mem ds_image = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float));
+  cl_mem ds_mask = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float));
+  cl_mem ds_stats = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ds_ab = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ds_temp = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ab = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem temp = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(!ds_image || !ds_mask || !ds_stats || !ds_ab || !ds_temp || !ab || !temp) goto cleanup;
+
+  size_t ds_sizes[] = { ROUNDUPDWD(ds_width, devid), ROUNDUPDHT(ds_height, devid), 1 };
+  const float feathering = d->feathering;
+
+  // Downsample the image for speed-up
+  err = resample_cl(gd, devid, image, ds_image, width, height, ds_width, ds_height);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // Iterations of filter models the diffusion, sort of
+  for(int i = 0; i < d->iterations; ++i)
+  {
+    // (Re)build the mask from the quantized image to help guiding
+    err = quantize_cl(gd, devid, ds_image, ds_mask, ds_width, ds_height, d->quantization, exp2f(-14.0f), 4.0f);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    // Perform the patch-wise variance analyse to get
+    // the a and b parameters for the linear blending s.t. mask = a * I + b
+    err = pack_cl(gd->kernel_toneeq_guided_pack, devid, ds_mask, ds_image, ds_stats, ds_width, ds_height);
+    if(err != CL_SUCCESS) goto cleanup;
+    err = box_mean_cl(gd, devid, ds_stats, ds_temp, ds_width, ds_height, ds_radius);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_ab, 0, sizeof(cl_mem), (void *)&ds_stats);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_ab, 1, sizeof(cl_mem), (void *)&ds_ab);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_ab, 2, sizeof(int), (void *)&ds_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_ab, 3, sizeof(int), (void *)&ds_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_guided_ab, 4, sizeof(float), (void *)&feathering);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_guided_ab, ds_sizes);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    // Compute the patch-wise average of parameters a and b
+    err = box_mean_cl(gd, devid, ds_ab, ds_temp, ds_width, ds_height, ds_radius);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    if(i != d->iterations - 1)
+    {
+      // Process the intermediate filtered image, the mask is rebuilt from it anyway
+      err = guided_blend_cl(gd, devid, ds_image, ds_ab, ds_mask, ds_width, ds_height, FALSE);
+      if(err != CL_SUCCESS) goto cleanup;
+    }
+  }
+
+  // Upsample the blending parameters a and b
+  err = resample_cl(gd, devid, ds_ab, ab, ds_width, ds_height, width, height);
+  if(err != CL_SUCCESS) goto cleanup;
+
+  // Finally, blend the guided image
+  err = guided_blend_cl(gd, devid, image, ab, temp, width, height, filter == DT_GF_BLENDING_GEOMEAN);
+
+cleanup:
+  dt_opencl_release_mem_object(temp);
+  dt_opencl_release_mem_object(ab);
+  dt_opencl_release_mem_object(ds_temp);
+  dt_opencl_release_mem_object(ds_ab);
+  dt_opencl_release_mem_object(ds_stats);
+  dt_opencl_release_mem_object(ds_mask);
+  dt_opencl_release_mem_object(ds_image);
+  return err;
+}
+
+
+static cl_int fast_eigf_surface_blur_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                                        cl_mem image, const int width, const int height,
+                                        const dt_iop_toneequalizer_data_t *const d,
+                                        const dt_iop_guided_filter_blending_t filter)
+{
+  // Same as fast_eigf_surface_blur() from eigf.h, in-place on a grey image.
+  // Without quantization, the image is its own mask, which gives the same result as the
+  // specialized no-mask functions of the CPU.
+  const float sigma = d->radius;
+  const float scaling = fmaxf(fminf(sigma, 4.0f), 1.0f);
+  const float ds_sigma = fmaxf(sigma / scaling, 1.0f);
+  const int ds_width = width / scaling;
+  const int ds_height = height / scaling;
+  if(ds_width < 1 || ds_height < 1) return DT_OPENCL_DEFAULT_ERROR;
+
+  const gboolean quantize = (d->quantization != 0.0f);
+
+  // the statistics are positive, the gaussian doesn't need the image bounds
+  const float max[4] = { INFINITY, INFINITY, INFINITY, INFINITY };
+  const float min[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  cl_int err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  dt_gaussian_cl_t *gauss = dt_gaussian_init_cl(devid, ds_width, ds_height, 4, max, min, ds_sigma, 0);
+  cl_mem mask = quantize ? dt_opencl_alloc_device(devid, width, height, sizeof(float)) : NULL;
+  cl_mem ds_image = dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float));
+  cl_mem ds_mask = quantize ? dt_opencl_alloc_device(devid, ds_width, ds_height, sizeof(float)) : NULL;
+  cl_mem ds_stats = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem ds_av = dt_opencl_alloc_device(devid, ds_width, ds_height, 4 * sizeof(float));
+  cl_mem av = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
+  cl_mem temp = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(!gauss || (quantize && (!mask || !ds_mask)) || !ds_image || !ds_stats || !ds_av || !av || !temp)
+    goto cleanup;
+
+  size_t ds_sizes[] = { ROUNDUPDWD(ds_width, devid), ROUNDUPDHT(ds_height, devid), 1 };
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  const float feathering = d->feathering;
+
+  // Iterations of filter models the diffusion, sort of
+  for(int i = 0; i < d->iterations; i++)
+  {
+    // blend linear for all intermediate images, use filter for last iteration
+    const int geomean = (i == d->iterations - 1) && (filter == DT_GF_BLENDING_GEOMEAN);
+
+    err = resample_cl(gd, devid, image, ds_image, width, height, ds_width, ds_height);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    if(quantize)
+    {
+      // (Re)build the mask from the quantized image to help guiding
+      err = quantize_cl(gd, devid, image, mask, width, height, d->quantization, exp2f(-14.0f), 4.0f);
+      if(err != CL_SUCCESS) goto cleanup;
+      // Downsample the image for speed-up
+      err = resample_cl(gd, devid, mask, ds_mask, width, height, ds_width, ds_height);
+      if(err != CL_SUCCESS) goto cleanup;
+    }
+
+    cl_mem guide = quantize ? ds_mask : ds_image;
+    cl_mem full_mask = quantize ? mask : image;
+
+    err = pack_cl(gd->kernel_toneeq_eigf_pack, devid, guide, ds_image, ds_stats, ds_width, ds_height);
+    if(err != CL_SUCCESS) goto cleanup;
+    err = dt_gaussian_blur_cl(gauss, ds_stats, ds_av);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_variance, 0, sizeof(cl_mem), (void *)&ds_av);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_variance, 1, sizeof(cl_mem), (void *)&ds_stats);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_variance, 2, sizeof(int), (void *)&ds_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_variance, 3, sizeof(int), (void *)&ds_height);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_eigf_variance, ds_sizes);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    // Upsample the variances and averages
+    err = resample_cl(gd, devid, ds_stats, av, ds_width, ds_height, width, height);
+    if(err != CL_SUCCESS) goto cleanup;
+
+    // Blend the guided image
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 0, sizeof(cl_mem), (void *)&image);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 1, sizeof(cl_mem), (void *)&full_mask);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 2, sizeof(cl_mem), (void *)&av);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 3, sizeof(cl_mem), (void *)&temp);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 4, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 5, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 6, sizeof(float), (void *)&feathering);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_eigf_blend, 7, sizeof(int), (void *)&geomean);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_eigf_blend, sizes);
+    if(err != CL_SUCCESS) goto cleanup;
+    err = dt_opencl_enqueue_copy_image(devid, temp, image, origin, origin, region);
+    if(err != CL_SUCCESS) goto cleanup;
+  }
+
+cleanup:
+  dt_opencl_release_mem_object(temp);
+  dt_opencl_release_mem_object(av);
+  dt_opencl_release_mem_object(ds_av);
+  dt_opencl_release_mem_object(ds_stats);
+  dt_opencl_release_mem_object(ds_mask);
+  dt_opencl_release_mem_object(ds_image);
+  dt_opencl_release_mem_object(mask);
+  if(gauss) dt_gaussian_free_cl(gauss);
+  return err;
+}
+
+
+static cl_int compute_luminance_mask_cl(const dt_iop_toneequalizer_global_data_t *const gd, const int devid,
+                                        cl_mem dev_in, cl_mem luminance, const int width, const int height,
+                                        const dt_iop_toneequalizer_data_t *const d)
+{
+  // Same as compute_luminance_mask() : contrast boosting only for the non-averaged filters
+  const gboolean boost = (d->details == DT_TONEEQ_GUIDED || d->details == DT_TONEEQ_EIGF);
+  const float fulcrum = boost ? CONTRAST_FULCRUM : 0.0f;
+  const float contrast_boost = boost ? d->contrast_boost : 1.0f;
+  const int method = d->method;
+
+  size_t sizes[] = { ROUNDUPDWD(width, devid), ROUNDUPDHT(height, devid), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 1, sizeof(cl_mem), (void *)&luminance);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 4, sizeof(int), (void *)&method);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 5, sizeof(float), (void *)&d->exposure_boost);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 6, sizeof(float), (void *)&fulcrum);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_luminance_mask, 7, sizeof(float), (void *)&contrast_boost);
+  const cl_int err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_luminance_mask, sizes);
+  if(err != CL_SUCCESS) return err;
+
+  switch(d->details)
+  {
+    case(DT_TONEEQ_AVG_GUIDED):
+      return fast_surface_blur_cl(gd, devid, luminance, width, height, d, DT_GF_BLENDING_GEOMEAN);
+    case(DT_TONEEQ_GUIDED):
+      return fast_surface_blur_cl(gd, devid, luminance, width, height, d, DT_GF_BLENDING_LINEAR);
+    case(DT_TONEEQ_AVG_EIGF):
+      return fast_eigf_surface_blur_cl(gd, devid, luminance, width, height, d, DT_GF_BLENDING_GEOMEAN);
+    case(DT_TONEEQ_EIGF):
+      return fast_eigf_surface_blur_cl(gd, devid, luminance, width, height, d, DT_GF_BLENDING_LINEAR);
+    default:
+      return CL_SUCCESS;
+  }
+}
+
+
+int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+               const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const dt_iop_toneequalizer_data_t *const d = (const dt_iop_toneequalizer_data_t *const)piece->data;
+  dt_iop_toneequalizer_gui_data_t *const g = (dt_iop_toneequalizer_gui_data_t *)self->gui_data;
+  const dt_iop_toneequalizer_global_data_t *const gd = (dt_iop_toneequalizer_global_data_t *)self->global_data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  const int out_width = roi_out->width;
+  const int out_height = roi_out->height;
+
+  // Sanity checks, the CPU path deals with the failures
+  if(width < 1 || height < 1) return FALSE;
+  if(roi_in->width < roi_out->width || roi_in->height < roi_out->height) return FALSE;
+  if(piece->colors != 4) return FALSE;
+
+  size_t sizes[] = { ROUNDUPDWD(out_width, devid), ROUNDUPDHT(out_height, devid), 1 };
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { out_width, out_height, 1 };
+
+  if(!sanity_check(self))
+  {
+    // if module just got disabled by sanity checks, due to pipe position, just pass input through
+    return dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region) == CL_SUCCESS;
+  }
+
+  cl_int err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  cl_mem dev_lut = NULL;
+  cl_mem dev_luminance = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if(!dev_luminance) goto error;
+
+  // The GUI pipes keep the mask on the host for the histogram and the cursor readout
+  uint64_t hash = luminance_mask_hash(piece, roi_in);
+  gboolean cached = FALSE;
+  float *const luminance = get_luminance_cache(self, piece, width, height, &cached);
+  if(cached && !luminance) goto error;
+
+  if(cached && !luminance_cache_outdated(self, piece, hash))
+  {
+    err = dt_opencl_write_host_to_device(devid, luminance, dev_luminance, width, height, sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+  }
+  else
+  {
+    err = compute_luminance_mask_cl(gd, devid, dev_in, dev_luminance, width, height, d);
+    if(err != CL_SUCCESS) goto error;
+
+    if(cached && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
+    {
+      err = dt_opencl_read_host_from_device(devid, luminance, dev_luminance, width, height, sizeof(float));
+      if(err != CL_SUCCESS) goto error;
+      hash_set_get(&hash, &g->ui_preview_hash, &self->gui_lock);
+    }
+    else if(cached)
+    {
+      dt_iop_gui_enter_critical_section(self);
+      g->thumb_preview_hash = hash;
+      g->histogram_valid = FALSE;
+      err = dt_opencl_read_host_from_device(devid, luminance, dev_luminance, width, height, sizeof(float));
+      g->luminance_valid = (err == CL_SUCCESS);
+      dt_iop_gui_leave_critical_section(self);
+      if(err != CL_SUCCESS) goto error;
+    }
+  }
+
+  // Display output
+  if(self->dev->gui_attached && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL
+     && g->mask_display)
+  {
+    const int offset_x = (roi_in->x < roi_out->x) ? roi_out->x - roi_in->x : 0;
+    const int offset_y = (roi_in->y < roi_out->y) ? roi_out->y - roi_in->y : 0;
+    const int copy_alpha = (piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) ? 1 : 0;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 1, sizeof(cl_mem), (void *)&dev_luminance);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 3, sizeof(int), (void *)&out_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 4, sizeof(int), (void *)&out_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 5, sizeof(int), (void *)&offset_x);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 6, sizeof(int), (void *)&offset_y);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_show_mask, 7, sizeof(int), (void *)&copy_alpha);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_show_mask, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    piece->pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_PASSTHRU;
+    piece->pipe->bypass_blendif = 1;
+  }
+  else
+  {
+    dev_lut = dt_opencl_copy_host_to_device_constant(devid, sizeof(d->correction_lut), (void *)d->correction_lut);
+    if(!dev_lut)
+    {
+      err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+      goto error;
+    }
+
+    const int lut_resolution = LUT_RESOLUTION;
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 1, sizeof(cl_mem), (void *)&dev_luminance);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 3, sizeof(int), (void *)&out_width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 4, sizeof(int), (void *)&out_height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 5, sizeof(cl_mem), (void *)&dev_lut);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_toneeq_apply, 6, sizeof(int), (void *)&lut_resolution);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_toneeq_apply, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_luminance);
+  return TRUE;
+
+error:
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_luminance);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_toneequal] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 
 void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                    const dt_iop_roi_t *roi_out, dt_iop_roi_t *roi_in)
@@ -1507,15 +1991,43 @@ static inline gboolean update_curve_lut(struct dt_iop_module_t *self)
 
 void init_global(dt_iop_module_so_t *module)
 {
+  const int program = 37; // toneequal.cl, from programs.conf
   dt_iop_toneequalizer_global_data_t *gd
       = (dt_iop_toneequalizer_global_data_t *)malloc(sizeof(dt_iop_toneequalizer_global_data_t));
 
   module->data = gd;
+  gd->kernel_toneeq_luminance_mask = dt_opencl_create_kernel(program, "toneeq_luminance_mask");
+  gd->kernel_toneeq_resample = dt_opencl_create_kernel(program, "toneeq_resample");
+  gd->kernel_toneeq_quantize = dt_opencl_create_kernel(program, "toneeq_quantize");
+  gd->kernel_toneeq_guided_pack = dt_opencl_create_kernel(program, "toneeq_guided_pack");
+  gd->kernel_toneeq_eigf_pack = dt_opencl_create_kernel(program, "toneeq_eigf_pack");
+  gd->kernel_toneeq_box_mean_x = dt_opencl_create_kernel(program, "toneeq_box_mean_x");
+  gd->kernel_toneeq_box_mean_y = dt_opencl_create_kernel(program, "toneeq_box_mean_y");
+  gd->kernel_toneeq_guided_ab = dt_opencl_create_kernel(program, "toneeq_guided_ab");
+  gd->kernel_toneeq_guided_blend = dt_opencl_create_kernel(program, "toneeq_guided_blend");
+  gd->kernel_toneeq_eigf_variance = dt_opencl_create_kernel(program, "toneeq_eigf_variance");
+  gd->kernel_toneeq_eigf_blend = dt_opencl_create_kernel(program, "toneeq_eigf_blend");
+  gd->kernel_toneeq_apply = dt_opencl_create_kernel(program, "toneeq_apply");
+  gd->kernel_toneeq_show_mask = dt_opencl_create_kernel(program, "toneeq_show_mask");
 }
 
 
 void cleanup_global(dt_iop_module_so_t *module)
 {
+  dt_iop_toneequalizer_global_data_t *gd = (dt_iop_toneequalizer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_toneeq_luminance_mask);
+  dt_opencl_free_kernel(gd->kernel_toneeq_resample);
+  dt_opencl_free_kernel(gd->kernel_toneeq_quantize);
+  dt_opencl_free_kernel(gd->kernel_toneeq_guided_pack);
+  dt_opencl_free_kernel(gd->kernel_toneeq_eigf_pack);
+  dt_opencl_free_kernel(gd->kernel_toneeq_box_mean_x);
+  dt_opencl_free_kernel(gd->kernel_toneeq_box_mean_y);
+  dt_opencl_free_kernel(gd->kernel_toneeq_guided_ab);
+  dt_opencl_free_kernel(gd->kernel_toneeq_guided_blend);
+  dt_opencl_free_kernel(gd->kernel_toneeq_eigf_variance);
+  dt_opencl_free_kernel(gd->kernel_toneeq_eigf_blend);
+  dt_opencl_free_kernel(gd->kernel_toneeq_apply);
+  dt_opencl_free_kernel(gd->kernel_toneeq_show_mask);
   free(module->data);
   module->data = NULL;
 }
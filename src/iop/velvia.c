@@ -86,7 +86,8 @@ const char *aliases()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED
+         | IOP_FLAGS_SCALE_INDEPENDENT | IOP_FLAGS_INPLACE;
 }
 
 int default_group()
@@ -122,6 +123,28 @@ int legacy_params(dt_iop_module_t *self, const void *const old_params, const int
   return 1;
 }
 
+static inline void _velvia_pixel(const float *const in, float *const out, const float strength, const float bias)
+{
+  // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+  const float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
+  const float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
+  const float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
+  const float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                                    : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+
+  const float pweight
+      = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - bias)))
+                   / (1.0f + (1.0f - bias)),
+               0.0f, 1.0f);                    // The weight of pixel
+  const float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
+
+  // Apply velvia saturation values. Read all channels first, out may alias in.
+  const float r = in[0], g = in[1], b = in[2];
+  out[0] = CLAMPS(r + saturation * (r - 0.5f * (g + b)), 0.0f, 1.0f);
+  out[1] = CLAMPS(g + saturation * (g - 0.5f * (b + r)), 0.0f, 1.0f);
+  out[2] = CLAMPS(b + saturation * (b - 0.5f * (r + g)), 0.0f, 1.0f);
+}
+
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
@@ -129,45 +152,43 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   const size_t ch = piece->colors;
   const float strength = data->strength / 100.0f;
+  const float bias = data->bias;
 
   // Apply velvia saturation
   if(strength <= 0.0)
-    dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+  {
+    if(ivoid != ovoid) dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+  }
   else
   {
 #ifdef _OPENMP
 #pragma omp parallel for SIMD() default(none) \
-    dt_omp_firstprivate(ch, data, ivoid, ovoid, roi_out, strength) \
+    dt_omp_firstprivate(ch, ivoid, ovoid, roi_out, strength, bias) \
     schedule(static)
 #endif
     for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++)
-    {
-      const float *const in = (const float *const)ivoid + ch * k;
-      float *const out = (float *const)ovoid + ch * k;
-
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax = MAX(in[0], MAX(in[1], in[2])); // max value in RGB set
-      float pmin = MIN(in[0], MIN(in[1], in[2])); // min value in RGB set
-      float plum = (pmax + pmin) / 2.0f;          // pixel luminocity
-      float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
-                                  : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
-
-      float pweight
-          = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
-                       / (1.0f + (1.0f - data->bias)),
-                   0.0f, 1.0f);              // The weight of pixel
-      float saturation = strength * pweight; // So lets calculate the final affection of filter on pixel
-
-      // Apply velvia saturation values
-      out[0] = CLAMPS(in[0] + saturation * (in[0] - 0.5f * (in[1] + in[2])), 0.0f, 1.0f);
-      out[1] = CLAMPS(in[1] + saturation * (in[1] - 0.5f * (in[2] + in[0])), 0.0f, 1.0f);
-      out[2] = CLAMPS(in[2] + saturation * (in[2] - 0.5f * (in[0] + in[1])), 0.0f, 1.0f);
-    }
+      _velvia_pixel((const float *const)ivoid + ch * k, (float *const)ovoid + ch * k, strength, bias);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
+  const float strength = data->strength / 100.0f;
+
+  if(strength <= 0.0f)
+  {
+    if(in != out) memcpy(out, in, npixels * 4 * sizeof(float));
+    return;
+  }
+
+  for(size_t k = 0; k < npixels; k++)
+    _velvia_pixel(in + 4 * k, out + 4 * k, strength, data->bias);
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -75,7 +75,7 @@ const char *aliases()
 int flags()
 {
   return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING
-    | IOP_FLAGS_DEPRECATED;
+    | IOP_FLAGS_DEPRECATED | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_group()
@@ -120,6 +120,29 @@ typedef struct dt_iop_watermark_gui_data_t
   GtkWidget *color_picker_button;
 } dt_iop_watermark_gui_data_t;
 
+// an svg watermark rasterized at one scale. batch exports of images of the same size render the same
+// document at the same scale, they share it instead of going through rsvg, and its lock, for each image.
+typedef struct dt_iop_watermark_raster_t
+{
+  uint64_t hash; // of the svg document, once its variables are substituted
+  float scale;
+  RsvgDimensionData dimension;
+  int width, height, stride;
+  guint8 *pixels; // premultiplied ARGB32
+  int users;         // pipes painting it right now
+  gboolean evicted;  // out of the cache, freed by its last user
+} dt_iop_watermark_raster_t;
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  GList *rasters; // most recently used first
+  size_t size;
+  dt_pthread_mutex_t lock;
+} dt_iop_watermark_global_data_t;
+
+// memory the rasters are kept in, the last rendered one is kept whatever its size
+#define DT_WATERMARK_CACHE_SIZE ((size_t)64 << 20)
+
 int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
                   void *new_params, const int new_version)
 {
@@ -302,7 +325,7 @@ const char **description(struct dt_iop_module_t *self)
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_SCALE_INDEPENDENT;
 }
 
 int default_group()
@@ -375,6 +398,141 @@ static gchar *_string_substitute(gchar *string, const gchar *search, const gchar
   return result;
 }
 
+static void _raster_free(dt_iop_watermark_raster_t *raster)
+{
+  g_free(raster->pixels);
+  g_free(raster);
+}
+
+// the dimension of a document already rasterized at some scale, without parsing it again
+static gboolean _raster_dimension(dt_iop_watermark_global_data_t *gd, const uint64_t hash,
+                                  RsvgDimensionData *dimension)
+{
+  gboolean found = FALSE;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(const GList *l = gd->rasters; l && !found; l = g_list_next(l))
+  {
+    const dt_iop_watermark_raster_t *raster = (dt_iop_watermark_raster_t *)l->data;
+    if(raster->hash == hash)
+    {
+      *dimension = raster->dimension;
+      found = TRUE;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return found;
+}
+
+// the cached raster of the document at this scale, to be given back with _raster_release()
+static dt_iop_watermark_raster_t *_raster_get(dt_iop_watermark_global_data_t *gd, const uint64_t hash,
+                                              const float scale)
+{
+  dt_iop_watermark_raster_t *found = NULL;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *l = gd->rasters; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_raster_t *raster = (dt_iop_watermark_raster_t *)l->data;
+    if(raster->hash == hash && raster->scale == scale)
+    {
+      found = raster;
+      found->users++;
+      gd->rasters = g_list_remove_link(gd->rasters, l);
+      gd->rasters = g_list_concat(l, gd->rasters);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return found;
+}
+
+// add a raster just rendered by the caller, who still uses it
+static void _raster_put(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_raster_t *raster)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  gd->rasters = g_list_prepend(gd->rasters, raster);
+  gd->size += (size_t)raster->height * raster->stride;
+  GList *l = g_list_last(gd->rasters);
+  while(gd->size > DT_WATERMARK_CACHE_SIZE && l->data != raster)
+  {
+    GList *prev = g_list_previous(l);
+    dt_iop_watermark_raster_t *old = (dt_iop_watermark_raster_t *)l->data;
+    gd->size -= (size_t)old->height * old->stride;
+    gd->rasters = g_list_delete_link(gd->rasters, l);
+    if(old->users)
+      old->evicted = TRUE;
+    else
+      _raster_free(old);
+    l = prev;
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+static void _raster_release(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_raster_t *raster)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  const gboolean unused = --raster->users == 0 && raster->evicted;
+  dt_pthread_mutex_unlock(&gd->lock);
+  if(unused) _raster_free(raster);
+}
+
+static RsvgHandle *_svg_load(const gchar *svgdoc)
+{
+  GError *error = NULL;
+  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  RsvgHandle *svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  if(!svg || error)
+  {
+    fprintf(stderr, "[watermark] error processing svg file: %s\n", error ? error->message : "unknown error");
+    if(error) g_error_free(error);
+    if(svg) g_object_unref(svg);
+    return NULL;
+  }
+  return svg;
+}
+
+/* For the rotation we need an extra cairo image as rotations are buggy  via rsvg_handle_render_cairo.
+   distortions and blurred images are obvious but you also can easily have crashes.
+   the offsets allow safe text boxes as they might render out of the dimensions.
+*/
+static dt_iop_watermark_raster_t *_raster_render(RsvgHandle *svg, const uint64_t hash,
+                                                 const RsvgDimensionData dimension, const float scale,
+                                                 const float offset_x, const float offset_y)
+{
+  dt_iop_watermark_raster_t *raster = g_malloc0(sizeof(dt_iop_watermark_raster_t));
+  raster->hash = hash;
+  raster->scale = scale;
+  raster->dimension = dimension;
+  raster->width = (int)((dimension.width * scale) + 3 * offset_x);
+  raster->height = (int)((dimension.height * scale) + 3 * offset_y);
+  raster->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, raster->width);
+  raster->pixels = (guint8 *)g_malloc0_n(raster->height, raster->stride);
+  raster->users = 1;
+
+  cairo_surface_t *surface = cairo_image_surface_create_for_data(raster->pixels, CAIRO_FORMAT_ARGB32,
+                                                                 raster->width, raster->height, raster->stride);
+  if((cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) || (raster->pixels == NULL))
+  {
+    fprintf(stderr, "[watermark] cairo surface 2 error: %s\n",
+            cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy(surface);
+    _raster_free(raster);
+    return NULL;
+  }
+
+  cairo_t *cr = cairo_create(surface);
+  cairo_translate(cr, offset_x, offset_y);
+  cairo_scale(cr, scale, scale);
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  dt_render_svg(svg, cr, dimension.width, dimension.height, 0, 0);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  cairo_destroy(cr);
+  cairo_surface_flush(surface);
+  cairo_surface_destroy(surface);
+  return raster;
+}
+
 static gchar *_watermark_get_svgdoc(dt_iop_module_t *self, dt_iop_watermark_data_t *data,
                                     const dt_image_t *image, const gchar *filename)
 {
@@ -448,6 +606,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
   dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->global_data;
   float *in = (float *)ivoid;
   float *out = (float *)ovoid;
   const int ch = piece->colors;
@@ -496,6 +655,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   /* Load svg if not loaded */
   gchar *svgdoc = NULL;
+  uint64_t svghash = 0;
   if(type == DT_WTM_SVG)
   {
     svgdoc = _watermark_get_svgdoc(self, data, &piece->pipe->image, filename);
@@ -504,6 +664,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
       return;
     }
+    // the document, read again and with its variables expanded for this image, identifies the rasters
+    svghash = dt_hash(5381, svgdoc, strlen(svgdoc));
   }
 
   /* setup stride for performance */
@@ -511,6 +673,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(stride == -1)
   {
     fprintf(stderr, "[watermark] cairo stride error\n");
+    g_free(svgdoc);
     dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
     return;
   }
@@ -524,34 +687,16 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     fprintf(stderr, "[watermark] cairo surface error: %s\n",
             cairo_status_to_string(cairo_surface_status(surface)));
     g_free(image);
+    g_free(svgdoc);
     dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
     return;
   }
 
-  // rsvg (or some part of cairo which is used underneath) isn't thread safe, for example when handling fonts
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-
+  // the svg is only parsed when its raster isn't cached
   RsvgHandle *svg = NULL;
-  if(type == DT_WTM_SVG)
-  {
-    /* create the rsvghandle from parsed svg data */
-    GError *error = NULL;
-    svg = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
-    g_free(svgdoc);
-    if(!svg || error)
-    {
-      cairo_surface_destroy(surface);
-      g_free(image);
-      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-      fprintf(stderr, "[watermark] error processing svg file: %s\n", error->message);
-      g_error_free(error);
-      return;
-    }
-  }
+  dt_iop_watermark_raster_t *raster = NULL;
 
   // we use a second surface
-  guint8 *image_two = NULL;
   cairo_surface_t *surface_two = NULL;
 
   /* get the dimension of svg or png */
@@ -559,11 +704,25 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   switch(type)
   {
     case DT_WTM_SVG:
+      if(_raster_dimension(gd, svghash, &dimension)) break;
+      svg = _svg_load(svgdoc);
+      if(!svg)
+      {
+        cairo_surface_destroy(surface);
+        g_free(image);
+        g_free(svgdoc);
+        dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+        return;
+      }
+      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
       dimension = dt_get_svg_dimension(svg);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
       break;
     case DT_WTM_PNG:
       // load png into surface 2
+      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
       surface_two = cairo_image_surface_create_from_png(filename);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
       if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS))
       {
         fprintf(stderr, "[watermark] cairo png surface 2 error: %s\n",
@@ -571,7 +730,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         cairo_surface_destroy(surface);
         g_free(image);
         dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-        dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
         return;
       }
       dimension.width = cairo_image_surface_get_width(surface_two);
@@ -659,10 +817,6 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     }
   }
 
-  /* For the rotation we need an extra cairo image as rotations are buggy  via rsvg_handle_render_cairo.
-     distortions and blurred images are obvious but you also can easily have crashes.
-  */
-
   float svg_offset_x = 0;
   float svg_offset_y = 0;
   if(type == DT_WTM_SVG)
@@ -671,31 +825,30 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     svg_offset_x = ceilf(3.0f * scale);
     svg_offset_y = ceilf(3.0f * scale);
 
-    const int watermark_width  = (int)((dimension.width  * scale) + 3* svg_offset_x);
-    const int watermark_height = (int)((dimension.height * scale) + 3* svg_offset_y) ;
-
-    const int stride_two = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, watermark_width);
-    image_two = (guint8 *)g_malloc0_n(watermark_height, stride_two);
-    surface_two = cairo_image_surface_create_for_data(image_two, CAIRO_FORMAT_ARGB32, watermark_width,
-                                                                   watermark_height, stride_two);
-    if((cairo_surface_status(surface_two) != CAIRO_STATUS_SUCCESS) || (image_two == NULL))
+    // the raster doesn't depend on the rotation and placement, they are applied when painting it
+    raster = _raster_get(gd, svghash, scale);
+    if(!raster)
     {
-      fprintf(stderr, "[watermark] cairo surface 2 error: %s\n",
-              cairo_status_to_string(cairo_surface_status(surface_two)));
-      cairo_surface_destroy(surface);
-      g_object_unref(svg);
-      g_free(image);
-      g_free(image_two);
-      dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-      return;
+      if(!svg) svg = _svg_load(svgdoc);
+      if(svg) raster = _raster_render(svg, svghash, dimension, scale, svg_offset_x, svg_offset_y);
+      if(!raster)
+      {
+        cairo_surface_destroy(surface);
+        if(svg) g_object_unref(svg);
+        g_free(image);
+        g_free(svgdoc);
+        dt_iop_image_copy_by_size(ovoid, ivoid, roi_out->width, roi_out->height, ch);
+        return;
+      }
+      _raster_put(gd, raster);
     }
+    // a surface of our own over the shared pixels, which are only read
+    surface_two = cairo_image_surface_create_for_data(raster->pixels, CAIRO_FORMAT_ARGB32, raster->width,
+                                                      raster->height, raster->stride);
   }
 
   /* create cairo context and setup transformation/scale */
   cairo_t *cr = cairo_create(surface);
-  /* create cairo context for the scaled watermark */
-  cairo_t *cr_two = cairo_create(surface_two);
 
   // compute bounding box of rotated watermark
   const float bb_width = fabsf(svg_width * cosf(angle)) + fabsf(svg_height * sinf(angle));
@@ -737,31 +890,14 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   cairo_rotate(cr, angle);
   cairo_translate(cr, -cX, -cY);
 
-  // now set proper scale and translationfor the watermark itself
-  cairo_translate(cr_two, svg_offset_x, svg_offset_y);
-
-  switch(type)
-  {
-    case DT_WTM_SVG:
-      cairo_scale(cr_two, scale, scale);
-      /* render svg into surface*/
-      dt_render_svg(svg, cr_two, dimension.width, dimension.height, 0, 0);
-      break;
-    case DT_WTM_PNG:
-      cairo_scale(cr, scale, scale);
-      break;
-  }
-  cairo_surface_flush(surface_two);
+  // the svg raster is already scaled
+  if(type == DT_WTM_PNG) cairo_scale(cr, scale, scale);
 
   // paint the watermark
   cairo_set_source_surface(cr, surface_two, -svg_offset_x, -svg_offset_y);
   cairo_paint(cr);
 
-  // no more non-thread safe rsvg usage
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-
   cairo_destroy(cr);
-  cairo_destroy(cr_two);
 
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush(surface);
@@ -791,11 +927,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   cairo_surface_destroy(surface);
   cairo_surface_destroy(surface_two);
   g_free(image);
-  if(type == DT_WTM_SVG)
-  {
-    g_free(image_two);
-    g_object_unref(svg);
-  }
+  if(raster) _raster_release(gd, raster);
+  if(svg) g_object_unref(svg);
+  g_free(svgdoc);
 
 }
 
@@ -1006,6 +1140,23 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 // fprintf(stderr, "Commit params: %s...\n",d->filename);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd
+      = (dt_iop_watermark_global_data_t *)calloc(1, sizeof(dt_iop_watermark_global_data_t));
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  module->data = gd;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->rasters, (GDestroyNotify)_raster_free);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   piece->data = malloc(sizeof(dt_iop_watermark_data_t));
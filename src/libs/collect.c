@@ -77,6 +77,14 @@ typedef struct dt_lib_collect_t
   GtkTreeModel *treefilter;
   GtkTreeModel *listfilter;
 
+  // folders with their image count for the folders tree, counted in the background for folders_where.
+  // folders_lazy maps the path of the rows whose subfolders are not in the tree yet to their range in folders.
+  GPtrArray *folders;
+  gchar *folders_where;
+  gchar *folders_counting;
+  gboolean folders_valid;
+  GHashTable *folders_lazy;
+
   struct dt_lib_collect_params_t *params;
 #ifdef _WIN32
   GVolumeMonitor *vmonitor;
@@ -128,6 +136,8 @@ static void collection_updated(gpointer instance, dt_collection_change_t query_c
 static void row_activated_with_event(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *col, GdkEventButton *event, dt_lib_collect_t *d);
 static int is_time_property(int property);
 static void _populate_collect_combo(GtkWidget *w);
+static void tree_view(dt_lib_collect_rule_t *dr);
+static void _folders_populate(dt_lib_collect_t *d, GtkTreeStore *store, GtkTreeIter *iter);
 
 static gboolean item_is_folder_collection(dt_collection_properties_t item)
 {
@@ -1103,8 +1113,12 @@ static GtkTreeModel *_create_filtered_model(GtkTreeModel *model, dt_lib_collect_
     GtkTreeIter child, iter;
     int level = 0;
 
-    while(gtk_tree_model_iter_n_children(model, level > 0 ? &iter : NULL) > 0)
+    while(TRUE)
     {
+      // descending into a row needs its subfolders
+      if(level > 0) _folders_populate(get_collect(dr), GTK_TREE_STORE(model), &iter);
+      if(gtk_tree_model_iter_n_children(model, level > 0 ? &iter : NULL) <= 0) break;
+
       if(level > 0)
       {
         sqlite3_stmt *stmt = NULL;
@@ -1241,6 +1255,371 @@ static char *tag_collate_key(char *tag)
 }
 
 
+// a folder of the library with its image count, for the folders tree
+typedef struct _folder_t
+{
+  char **tokens; // path components, from split_path()
+  int length;
+  int count, status;
+  gchar *collate_key;
+} _folder_t;
+
+// range of d->folders below a row of the folders tree which has not been populated yet
+typedef struct _folder_range_t
+{
+  guint start, end;
+} _folder_range_t;
+
+// background count of the folders
+typedef struct _folders_job_t
+{
+  int generation;
+  gchar *where;
+  GPtrArray *folders;
+  dt_lib_collect_t *d;
+} _folders_job_t;
+
+static GMutex _folders_lock;
+static int _folders_generation = 0;
+
+static void _folder_free(gpointer data)
+{
+  _folder_t *f = (_folder_t *)data;
+  g_strfreev(f->tokens);
+  g_free(f->collate_key);
+  g_free(f);
+}
+
+static gint _folder_sort(gconstpointer a, gconstpointer b)
+{
+  const _folder_t *fa = *(const _folder_t **)a;
+  const _folder_t *fb = *(const _folder_t **)b;
+  return g_strcmp0(fa->collate_key, fb->collate_key);
+}
+
+static void _folders_job_free(void *data)
+{
+  _folders_job_t *j = (_folders_job_t *)data;
+  g_free(j->where);
+  if(j->folders) g_ptr_array_unref(j->folders);
+  g_free(j);
+}
+
+// gui thread: keep the counted folders and show them if the folders tree is displayed
+static gboolean _folders_job_apply(gpointer user_data)
+{
+  _folders_job_t *j = (_folders_job_t *)user_data;
+
+  // a newer count was requested or the module is gone, d can't be used
+  g_mutex_lock(&_folders_lock);
+  const gboolean current = j->generation == _folders_generation;
+  g_mutex_unlock(&_folders_lock);
+  if(!current)
+  {
+    _folders_job_free(j);
+    return FALSE;
+  }
+
+  dt_lib_collect_t *d = j->d;
+  if(d->folders) g_ptr_array_unref(d->folders);
+  g_free(d->folders_where);
+  d->folders = j->folders;
+  d->folders_where = j->where;
+  d->folders_valid = TRUE;
+  g_free(d->folders_counting);
+  d->folders_counting = NULL;
+  j->folders = NULL;
+  j->where = NULL;
+  _folders_job_free(j);
+
+  dt_lib_collect_rule_t *dr = get_active_rule(d);
+  if(_combo_get_active_collection(dr->combo) == DT_COLLECTION_PROP_FOLDERS)
+  {
+    d->view_rule = -1;
+    tree_view(dr);
+  }
+  return FALSE;
+}
+
+static int32_t _folders_job_run(dt_job_t *job)
+{
+  _folders_job_t *j = (_folders_job_t *)dt_control_job_get_params(job);
+
+  g_mutex_lock(&_folders_lock);
+  const gboolean stale = j->generation != _folders_generation;
+  g_mutex_unlock(&_folders_lock);
+  if(stale) return 0;
+
+  // clang-format off
+  gchar *query = g_strdup_printf("SELECT folder, film_rolls_id, COUNT(*) AS count, status"
+                                 " FROM main.images AS mi"
+                                 " JOIN (SELECT fr.id AS film_rolls_id, folder, status"
+                                 "       FROM main.film_rolls AS fr"
+                                 "       JOIN memory.film_folder AS ff"
+                                 "       ON fr.id = ff.id)"
+                                 "   ON film_id = film_rolls_id "
+                                 " WHERE %s"
+                                 " GROUP BY folder, film_rolls_id", j->where);
+  // clang-format on
+
+  sqlite3 *handle = dt_database_get_reader(darktable.db);
+  sqlite3_stmt *stmt = NULL;
+  j->folders = g_ptr_array_new_with_free_func(_folder_free);
+  int rc = sqlite3_prepare_v2(handle, query, -1, &stmt, NULL);
+  if(rc == SQLITE_OK)
+  {
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+      const char *name = (const char *)sqlite3_column_text(stmt, 0);
+      char **tokens = split_path(name);
+      if(!tokens) continue; // safeguard against degenerated db entries
+
+      _folder_t *f = g_malloc0(sizeof(_folder_t));
+      f->tokens = tokens;
+      f->length = string_array_length(tokens);
+      f->count = sqlite3_column_int(stmt, 2);
+      f->status = sqlite3_column_int(stmt, 3);
+      char *name_folded = g_utf8_casefold(name, -1);
+      char *name_folded_slash = g_strconcat(name_folded, G_DIR_SEPARATOR_S, NULL);
+      f->collate_key = g_utf8_collate_key_for_filename(name_folded_slash, -1);
+      g_free(name_folded_slash);
+      g_free(name_folded);
+      if(f->length) g_ptr_array_add(j->folders, f);
+      else _folder_free(f);
+    }
+  }
+  sqlite3_finalize(stmt);
+  dt_database_release_reader(darktable.db, handle);
+  g_free(query);
+
+  if(rc != SQLITE_DONE)
+  {
+    fprintf(stderr, "[collect] counting the folders failed: %s\n", sqlite3_errstr(rc));
+    return 0;
+  }
+
+  // subfolders come right after their parent, the tree is fed in this order
+  g_ptr_array_sort(j->folders, _folder_sort);
+  if(dt_conf_get_bool("plugins/collect/descending"))
+  {
+    for(guint a = 0, b = j->folders->len; a + 1 < b; a++, b--)
+    {
+      gpointer tmp = j->folders->pdata[a];
+      j->folders->pdata[a] = j->folders->pdata[b - 1];
+      j->folders->pdata[b - 1] = tmp;
+    }
+  }
+
+  // hand the result over to the gui thread, the job params are freed with the job
+  _folders_job_t *result = g_malloc0(sizeof(_folders_job_t));
+  *result = *j;
+  j->where = NULL;
+  j->folders = NULL;
+  g_main_context_invoke(NULL, _folders_job_apply, result);
+  return 0;
+}
+
+// start counting the folders for where, unless that is already running
+static void _folders_count(dt_lib_collect_t *d, const gchar *where)
+{
+  if(d->folders_counting && !g_strcmp0(d->folders_counting, where)) return;
+
+  g_mutex_lock(&_folders_lock);
+  const int generation = ++_folders_generation;
+  g_mutex_unlock(&_folders_lock);
+
+  _folders_job_t *j = g_malloc0(sizeof(_folders_job_t));
+  j->generation = generation;
+  j->where = g_strdup(where);
+  j->d = d;
+
+  dt_job_t *job = dt_control_job_create(_folders_job_run, "count folders");
+  if(!job)
+  {
+    _folders_job_free(j);
+    return;
+  }
+  g_free(d->folders_counting);
+  d->folders_counting = g_strdup(where);
+  dt_control_job_set_params(job, j, _folders_job_free);
+  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_FG, job);
+}
+
+// the counts are outdated. a count running meanwhile may have missed the change, so it is dropped too
+static void _folders_invalidate(dt_lib_collect_t *d)
+{
+  d->folders_valid = FALSE;
+  g_free(d->folders_counting);
+  d->folders_counting = NULL;
+  g_mutex_lock(&_folders_lock);
+  _folders_generation++;
+  g_mutex_unlock(&_folders_lock);
+}
+
+static gchar *_folder_path(const _folder_t *f, const int depth)
+{
+  GString *path = g_string_new(NULL);
+  for(int i = 0; i <= depth; i++)
+  {
+#ifdef _WIN32
+    if(i > 0)
+#endif
+      g_string_append(path, G_DIR_SEPARATOR_S);
+    g_string_append(path, f->tokens[i]);
+  }
+  return g_string_free(path, FALSE);
+}
+
+// add the rows of the folders [start, end) of d->folders at depth, below parent. rows with subfolders only
+// get a placeholder child, the subfolders are added when they are expanded.
+static void _folders_insert(dt_lib_collect_t *d, GtkTreeStore *store, GtkTreeIter *parent, const guint start,
+                            const guint end, const int depth)
+{
+  guint k = start;
+  while(k < end)
+  {
+    const _folder_t *first = g_ptr_array_index(d->folders, k);
+    // the folder of parent itself
+    if(first->length <= depth)
+    {
+      k++;
+      continue;
+    }
+
+    const char *name = first->tokens[depth];
+    int count = 0, unreachable = 0;
+    gboolean children = FALSE;
+    guint next = k;
+    for(; next < end; next++)
+    {
+      const _folder_t *f = g_ptr_array_index(d->folders, next);
+      if(f->length <= depth || g_strcmp0(f->tokens[depth], name)) break;
+      if(f->length == depth + 1)
+      {
+        count += f->count;
+        unreachable = !f->status;
+      }
+      else
+        children = TRUE;
+    }
+
+    gchar *path = _folder_path(first, depth);
+    GtkTreeIter iter;
+    gtk_tree_store_insert_with_values(store, &iter, parent, -1,
+                                      DT_LIB_COLLECT_COL_TEXT, name,
+                                      DT_LIB_COLLECT_COL_PATH, path, DT_LIB_COLLECT_COL_VISIBLE, TRUE,
+                                      DT_LIB_COLLECT_COL_COUNT, count, DT_LIB_COLLECT_COL_INDEX, k,
+                                      DT_LIB_COLLECT_COL_UNREACHABLE, unreachable, -1);
+    if(children)
+    {
+      GtkTreeIter placeholder;
+      gtk_tree_store_insert_with_values(store, &placeholder, &iter, -1,
+                                        DT_LIB_COLLECT_COL_TEXT, "", DT_LIB_COLLECT_COL_PATH, "",
+                                        DT_LIB_COLLECT_COL_VISIBLE, TRUE, -1);
+      _folder_range_t *range = g_malloc(sizeof(_folder_range_t));
+      range->start = k;
+      range->end = next;
+      g_hash_table_insert(d->folders_lazy, path, range);
+    }
+    else
+      g_free(path);
+    k = next;
+  }
+}
+
+// replace the placeholder child of iter by the actual subfolders
+static void _folders_populate(dt_lib_collect_t *d, GtkTreeStore *store, GtkTreeIter *iter)
+{
+  if(!d->folders_lazy || !g_hash_table_size(d->folders_lazy)) return;
+
+  gchar *path = NULL;
+  gtk_tree_model_get(GTK_TREE_MODEL(store), iter, DT_LIB_COLLECT_COL_PATH, &path, -1);
+  const _folder_range_t *range = path ? g_hash_table_lookup(d->folders_lazy, path) : NULL;
+  GtkTreeIter placeholder;
+  if(range && gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &placeholder, iter))
+  {
+    _folders_insert(d, store, iter, range->start, range->end, gtk_tree_store_iter_depth(store, iter) + 1);
+    gtk_tree_store_remove(store, &placeholder);
+    g_hash_table_remove(d->folders_lazy, path);
+  }
+  g_free(path);
+}
+
+static void _folders_populate_all(dt_lib_collect_t *d, GtkTreeStore *store, GtkTreeIter *parent)
+{
+  GtkTreeIter iter;
+  gboolean valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &iter, parent);
+  while(valid && d->folders_lazy && g_hash_table_size(d->folders_lazy))
+  {
+    _folders_populate(d, store, &iter);
+    _folders_populate_all(d, store, &iter);
+    valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter);
+  }
+}
+
+// populate the rows down to the folder of the rule, so it can be found, selected and expanded
+static void _folders_reveal(dt_lib_collect_t *d, GtkTreeStore *store, const char *text)
+{
+  gchar *needle = g_utf8_strdown(text, -1);
+  if(g_str_has_suffix(needle, "%")) needle[strlen(needle) - 1] = '\0';
+  if(g_str_has_suffix(needle, "*")) needle[strlen(needle) - 1] = '\0';
+  if(g_str_has_suffix(needle, G_DIR_SEPARATOR_S)) needle[strlen(needle) - 1] = '\0';
+
+  GtkTreeIter iter;
+  gboolean valid = *needle && gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &iter, NULL);
+  while(valid)
+  {
+    gchar *path = NULL;
+    gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, DT_LIB_COLLECT_COL_PATH, &path, -1);
+    gchar *haystack = g_utf8_strdown(path, -1);
+    const size_t len = strlen(haystack);
+    const gboolean ancestor = !strncmp(needle, haystack, len)
+                              && (needle[len] == '\0' || needle[len] == G_DIR_SEPARATOR);
+    g_free(haystack);
+    g_free(path);
+
+    if(ancestor)
+    {
+      _folders_populate(d, store, &iter);
+      GtkTreeIter parent = iter;
+      valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &iter, &parent);
+    }
+    else
+      valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &iter);
+  }
+  g_free(needle);
+}
+
+// fill the folders tree from the counted folders. they get counted again in the background if they are
+// missing, outdated or were counted for other rules, the tree is then rebuilt.
+static void _folders_fill(dt_lib_collect_t *d, dt_lib_collect_rule_t *dr, GtkTreeStore *store)
+{
+  gchar *where_ext = dt_collection_get_extended_where(darktable.collection, dr->num);
+  const gboolean same_where = !g_strcmp0(where_ext, d->folders_where);
+  if(!d->folders || !d->folders_valid || !same_where) _folders_count(d, where_ext);
+  g_free(where_ext);
+
+  if(d->folders_lazy) g_hash_table_remove_all(d->folders_lazy);
+  else d->folders_lazy = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  // until then, outdated counts are better than an empty tree
+  if(d->folders && same_where) _folders_insert(d, store, NULL, 0, d->folders->len, 0);
+}
+
+static gboolean _view_test_expand_row(GtkTreeView *view, GtkTreeIter *iter, GtkTreePath *path,
+                                      dt_lib_collect_t *d)
+{
+  if(d->view_rule != DT_COLLECTION_PROP_FOLDERS) return FALSE;
+
+  GtkTreeModel *filter = gtk_tree_view_get_model(view);
+  GtkTreeIter store_iter;
+  gtk_tree_model_filter_convert_iter_to_child_iter(GTK_TREE_MODEL_FILTER(filter), &store_iter, iter);
+  _folders_populate(d, GTK_TREE_STORE(gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(filter))),
+                    &store_iter);
+  return FALSE;
+}
+
+
 void tree_count_show(GtkTreeViewColumn *col, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter,
                      gpointer data)
 {
@@ -1272,9 +1651,6 @@ static void tree_view(dt_lib_collect_rule_t *dr)
 
   switch(property)
   {
-    case DT_COLLECTION_PROP_FOLDERS:
-      format_separator = "%s" G_DIR_SEPARATOR_S;
-      break;
     case DT_COLLECTION_PROP_TAG:
     case DT_COLLECTION_PROP_GEOTAGGING:
       format_separator = "%s|";
@@ -1297,7 +1673,28 @@ static void tree_view(dt_lib_collect_rule_t *dr)
   gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model),
                                        GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
 
-  if(d->view_rule != property)
+  if(d->view_rule != property && property == DT_COLLECTION_PROP_FOLDERS)
+  {
+    // tree creation/recreation from the counted folders, only their top level for now
+    g_object_ref(model);
+    g_object_unref(d->treefilter);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), NULL);
+    gtk_tree_store_clear(GTK_TREE_STORE(model));
+    gtk_widget_hide(GTK_WIDGET(d->view));
+
+    _folders_fill(d, dr, GTK_TREE_STORE(model));
+
+    gtk_tree_view_set_tooltip_column(GTK_TREE_VIEW(d->view), DT_LIB_COLLECT_COL_TOOLTIP);
+    d->treefilter = _create_filtered_model(model, dr);
+    gtk_tree_selection_set_mode(gtk_tree_view_get_selection(GTK_TREE_VIEW(d->view)), GTK_SELECTION_SINGLE);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(d->view), d->treefilter);
+    gtk_widget_set_no_show_all(GTK_WIDGET(d->view), FALSE);
+    gtk_widget_show_all(GTK_WIDGET(d->view));
+
+    g_object_unref(model);
+    d->view_rule = property;
+  }
+  else if(d->view_rule != property)
   {
     // tree creation/recreation
     sqlite3_stmt *stmt;
@@ -1315,19 +1712,6 @@ static void tree_view(dt_lib_collect_rule_t *dr)
     gchar *query = 0;
     switch (property)
     {
-      case DT_COLLECTION_PROP_FOLDERS:
-        // clang-format off
-        query = g_strdup_printf("SELECT folder, film_rolls_id, COUNT(*) AS count, status"
-                                " FROM main.images AS mi"
-                                " JOIN (SELECT fr.id AS film_rolls_id, folder, status"
-                                "       FROM main.film_rolls AS fr"
-                                "       JOIN memory.film_folder AS ff"
-                                "       ON fr.id = ff.id)"
-                                "   ON film_id = film_rolls_id "
-                                " WHERE %s"
-                                " GROUP BY folder, film_rolls_id", where_ext);
-          // clang-format on
-        break;
       case DT_COLLECTION_PROP_TAG:
       {
         // clang-format off
@@ -1441,26 +1825,14 @@ static void tree_view(dt_lib_collect_rule_t *dr)
         const char* sqlite_name = (const char *)sqlite3_column_text(stmt, 0);
         name = sqlite_name == NULL ? g_strdup("") : g_strdup(sqlite_name);
       }
-      gchar *collate_key = NULL;
-
       const int count = sqlite3_column_int(stmt, 2);
-
-      if(property == DT_COLLECTION_PROP_FOLDERS)
-      {
-        char *name_folded = g_utf8_casefold(name, -1);
-        char *name_folded_slash = g_strconcat(name_folded, G_DIR_SEPARATOR_S, NULL);
-        collate_key = g_utf8_collate_key_for_filename(name_folded_slash, -1);
-        g_free(name_folded_slash);
-        g_free(name_folded);
-      }
-      else
-        collate_key = tag_collate_key(name);
+      gchar *collate_key = tag_collate_key(name);
 
       name_key_tuple_t *tuple = (name_key_tuple_t *)malloc(sizeof(name_key_tuple_t));
       tuple->name = name;
       tuple->collate_key = collate_key;
       tuple->count = count;
-      tuple->status = property == DT_COLLECTION_PROP_FOLDERS ? sqlite3_column_int(stmt, 3) : -1;
+      tuple->status = -1;
       sorted_names = g_list_prepend(sorted_names, tuple);
     }
     sqlite3_finalize(stmt);
@@ -1517,9 +1889,7 @@ static void tree_view(dt_lib_collect_rule_t *dr)
       if(!uncategorized_found)
       {
         char **tokens;
-        if(property == DT_COLLECTION_PROP_FOLDERS)
-          tokens = split_path(name);
-        else if(property == DT_COLLECTION_PROP_DAY)
+        if(property == DT_COLLECTION_PROP_DAY)
           tokens = g_strsplit(name, ":", -1);
         else if(is_time_property(property))
           tokens = g_strsplit_set(name, ": ", 4);
@@ -1552,9 +1922,6 @@ static void tree_view(dt_lib_collect_rule_t *dr)
           // insert everything from tokens past the common part
 
           char *pth = NULL;
-#ifndef _WIN32
-          if(property == DT_COLLECTION_PROP_FOLDERS) pth = g_strdup("/");
-#endif
           for(int i = 0; i < common_length; i++)
             pth = dt_util_dstrcat(pth, format_separator, tokens[i]);
 
@@ -1631,6 +1998,16 @@ static void tree_view(dt_lib_collect_rule_t *dr)
     d->view_rule = property;
   }
 
+  // the rows to match or to expand have to be in the tree
+  if(property == DT_COLLECTION_PROP_FOLDERS)
+  {
+    const char *text = gtk_entry_get_text(GTK_ENTRY(dr->text));
+    if(dr->typing || g_str_has_prefix(text, "%"))
+      _folders_populate_all(d, GTK_TREE_STORE(model), NULL);
+    else
+      _folders_reveal(d, GTK_TREE_STORE(model), text);
+  }
+
   // if needed, we restrict the tree to matching entries
   if(dr->typing) tree_set_visibility(model, dr);
   // we update tree expansion and selection
@@ -2812,6 +3189,9 @@ static void collection_updated(gpointer instance, dt_collection_change_t query_c
   dt_lib_collect_rule_t *active_rule = get_active_rule(d);
   active_rule->typing = FALSE;
 
+  // images may have been added, removed or changed, the folders are counted again when shown
+  if(query_change == DT_COLLECTION_CHANGE_RELOAD) _folders_invalidate(d);
+
   // determine if we want to refresh the tree or not
   gboolean refresh = TRUE;
   if(query_change == DT_COLLECTION_CHANGE_RELOAD && changed_property != DT_COLLECTION_PROP_UNDEF)
@@ -2840,6 +3220,7 @@ static void filmrolls_updated(gpointer instance, gpointer self)
   dt_lib_module_t *dm = (dt_lib_module_t *)self;
   dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
   d->view_rule = -1;
+  _folders_invalidate(d);
   _lib_collect_gui_update(self);
 }
 
@@ -2850,6 +3231,7 @@ static void filmrolls_imported(gpointer instance, int film_id, gpointer self)
 
   // update tree
   d->view_rule = -1;
+  _folders_invalidate(d);
   dt_lib_collect_rule_t *active_rule = get_active_rule(d);
   active_rule->typing = FALSE;
   _lib_collect_gui_update(self);
@@ -2870,6 +3252,7 @@ static void filmrolls_removed(gpointer instance, gpointer self)
   {
     d->view_rule = -1;
   }
+  _folders_invalidate(d);
   dt_lib_collect_rule_t *active_rule = get_active_rule(d);
   active_rule->typing = FALSE;
   _lib_collect_gui_update(self);
@@ -3173,6 +3556,7 @@ void _mount_changed(GUnixMountMonitor *monitor, dt_lib_module_t *self)
 {
   dt_lib_collect_t *d = (dt_lib_collect_t *)self->data;
   dt_film_set_folder_status();
+  _folders_invalidate(d);
   // very rough update (rebuild the view). As these events are not too many that remains acceptable
   // adding film_id to treeview and listview would be cleaner to update just the parameter "reachable"
   dt_lib_collect_rule_t *dr = get_active_rule(d);
@@ -3268,6 +3652,7 @@ void gui_init(dt_lib_module_t *self)
   gtk_widget_set_can_focus(GTK_WIDGET(view), TRUE);
   g_signal_connect(G_OBJECT(view), "button-press-event", G_CALLBACK(view_onButtonPressed), d);
   g_signal_connect(G_OBJECT(view), "popup-menu", G_CALLBACK(view_onPopupMenu), d);
+  g_signal_connect(G_OBJECT(view), "test-expand-row", G_CALLBACK(_view_test_expand_row), d);
 
   GtkTreeViewColumn *col = gtk_tree_view_column_new();
   gtk_tree_view_append_column(view, col);
@@ -3355,6 +3740,15 @@ void gui_cleanup(dt_lib_module_t *self)
   g_object_unref(d->listfilter);
   g_object_unref(d->vmonitor);
 
+  // drop a running count of the folders, it would land on freed data
+  g_mutex_lock(&_folders_lock);
+  _folders_generation++;
+  g_mutex_unlock(&_folders_lock);
+  if(d->folders) g_ptr_array_unref(d->folders);
+  if(d->folders_lazy) g_hash_table_destroy(d->folders_lazy);
+  g_free(d->folders_where);
+  g_free(d->folders_counting);
+
   /* TODO: Make sure we are cleaning up all allocations */
 
   free(self->data);
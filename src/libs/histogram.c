@@ -45,6 +45,7 @@
 
 #define HISTOGRAM_BINS 256
 #define TONES 128
+#define WAVEFORM_BLOCK 16 // columns binned by the same thread in horizontal waveforms
 #define GAMMA 1.f / 1.5f
 
 DT_MODULE(1)
@@ -82,6 +83,7 @@ typedef struct dt_lib_histogram_t
 
   dt_lib_histogram_cache_t cache;
   cairo_surface_t *cst;
+  guint tick_id; // pending recompute, run on the next frame of the widget
 } dt_lib_histogram_t;
 
 const char *name(dt_lib_module_t *self)
@@ -262,31 +264,47 @@ static inline void _bin_pixels_waveform(const float *const restrict image, uint3
 #endif
   for(size_t k = 0; k < binning_size; k++) bins[k] = 0;
 
-  // Process
+  // Process: each thread owns whole rows (vertical) or blocks of columns (horizontal) of bins,
+  // so there are no private copies of the bins to merge
+  if(vertical)
+  {
 #ifdef _OPENMP
-#ifndef _WIN32
-#pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, height, width, binning_size, vertical) \
-        reduction(+: bins[0: binning_size]) \
-        schedule(static) collapse(3)
-#else
 #pragma omp parallel for default(none) \
-        dt_omp_firstprivate(image, height, width, binning_size, vertical) \
-        shared(bins) \
-        schedule(static) collapse(3)
+        dt_omp_firstprivate(image, height, width, bins) \
+        schedule(static)
 #endif
+    for(size_t i = 0; i < height; i++)
+    {
+      uint32_t *const restrict row = bins + i * TONES * 4;
+      for(size_t j = 0; j < width; j++)
+        for(size_t c = 0; c < 3; c++)
+        {
+          const float value = image[(i * width + j) * 4 + c];
+          const size_t index = (uint8_t)CLAMP(roundf(value * (TONES - 1)), 0, TONES - 1);
+          row[index * 4 + c]++;
+        }
+    }
+  }
+  else
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+        dt_omp_firstprivate(image, height, width, bins) \
+        schedule(static)
 #endif
-  for(size_t i = 0; i < height; i++)
-    for(size_t j = 0; j < width; j++)
-      for(size_t c = 0; c < 3; c++)
-      {
-        const float value = image[(i * width + j) * 4 + c];
-        const size_t index = (uint8_t)CLAMP(roundf(value * (TONES - 1)), 0, TONES - 1);
-        if(vertical)
-          bins[((i * (TONES)) + index) * 4 + c]++;
-        else
-          bins[(((TONES - 1) - index) * width + j) * 4 + c]++;
-      }
+    for(size_t block = 0; block < width; block += WAVEFORM_BLOCK)
+    {
+      const size_t end = MIN(block + WAVEFORM_BLOCK, width);
+      for(size_t i = 0; i < height; i++)
+        for(size_t j = block; j < end; j++)
+          for(size_t c = 0; c < 3; c++)
+          {
+            const float value = image[(i * width + j) * 4 + c];
+            const size_t index = (uint8_t)CLAMP(roundf(value * (TONES - 1)), 0, TONES - 1);
+            bins[(((TONES - 1) - index) * width + j) * 4 + c]++;
+          }
+    }
+  }
 }
 
 static void _create_waveform_image(const uint32_t *const restrict bins, uint8_t *const restrict image,
@@ -805,12 +823,28 @@ gboolean _trigger_recompute(dt_lib_histogram_t *d)
 }
 
 
-// this is only called in darkroom view when preview pipe finishes
+static gboolean _recompute_tick_callback(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  dt_lib_histogram_t *d = (dt_lib_histogram_t *)user_data;
+  d->tick_id = 0;
+  if(_trigger_recompute(d)) _redraw_scopes(d);
+  return G_SOURCE_REMOVE;
+}
+
+static void _cancel_recompute(dt_lib_histogram_t *d)
+{
+  if(d->tick_id) gtk_widget_remove_tick_callback(d->scope_draw, d->tick_id);
+  d->tick_id = 0;
+}
+
+// this is only called in darkroom view when preview pipe finishes.
+// the scopes are recomputed at most once per frame of the display, and not at all while hidden:
+// tick callbacks only run for mapped widgets.
 static void _lib_histogram_preview_updated_callback(gpointer instance, dt_lib_module_t *self)
 {
   dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
   d->backbuf = _get_backuf(darktable.develop, d->op);
-  if(_trigger_recompute(d)) _redraw_scopes(d);
+  if(!d->tick_id) d->tick_id = gtk_widget_add_tick_callback(d->scope_draw, _recompute_tick_callback, d, NULL);
 }
 
 
@@ -827,6 +861,7 @@ void view_leave(struct dt_lib_module_t *self, struct dt_view_t *old_view, struct
 {
   dt_lib_histogram_t *d = self->data;
   _reset_cache(d);
+  _cancel_recompute(d);
 
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_histogram_preview_updated_callback), self);
 }
@@ -950,6 +985,7 @@ void gui_init(dt_lib_module_t *self)
 void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_histogram_t *d = self->data;
+  _cancel_recompute(d);
   _destroy_surface(d);
   dt_free_align(self->data);
   self->data = NULL;
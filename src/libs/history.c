@@ -41,13 +41,22 @@ DT_MODULE(1)
 
 typedef struct dt_undo_history_t
 {
+  // the history items are shared with the other records when unchanged, see _undo_share_items()
   GList *before_snapshot, *after_snapshot;
   int before_end, after_end;
   GList *before_iop_order_list, *after_iop_order_list;
   dt_masks_edit_mode_t mask_edit_mode;
   dt_dev_pixelpipe_display_mask_t request_mask_display;
+  struct dt_lib_history_t *lib; // owner of the shared items
 } dt_undo_history_t;
 
+// a history item held by undo records
+typedef struct dt_undo_history_ref_t
+{
+  int count;   // number of snapshots holding the item
+  size_t size; // memory it takes, as it was recorded
+} dt_undo_history_ref_t;
+
 typedef struct dt_lib_history_t
 {
   /* vbox with managed history items */
@@ -62,6 +71,10 @@ typedef struct dt_lib_history_t
   GList *previous_snapshot;
   int previous_history_end;
   GList *previous_iop_order_list;
+  // the history items of the undo records, dt_dev_history_item_t * -> dt_undo_history_ref_t
+  GHashTable *undo_items;
+  size_t undo_size;  // memory taken by undo_items
+  GList *undo_last;  // the last recorded snapshot, holding a reference on its items to share them
 } dt_lib_history_t;
 
 /* 3 widgets in each history line */
@@ -112,6 +125,9 @@ void gui_init(dt_lib_module_t *self)
   d->previous_snapshot = NULL;
   d->previous_history_end = 0;
   d->previous_iop_order_list = NULL;
+  d->undo_items = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  d->undo_size = 0;
+  d->undo_last = NULL;
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
   gtk_widget_set_name(self->widget, "history-ui");
@@ -153,11 +169,20 @@ void gui_init(dt_lib_module_t *self)
                             G_CALLBACK(_lib_history_module_remove_callback), self);
 }
 
+static void _undo_items_unref(dt_lib_history_t *d, GList *snapshot);
+
 void gui_cleanup(dt_lib_module_t *self)
 {
+  dt_lib_history_t *d = (dt_lib_history_t *)self->data;
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_history_change_callback), self);
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_history_will_change_callback), self);
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_history_module_remove_callback), self);
+  // the records refer to the items owned here, the undo module is cleaned up later
+  dt_undo_clear(darktable.undo, DT_UNDO_HISTORY);
+  _undo_items_unref(d, d->undo_last);
+  g_hash_table_destroy(d->undo_items);
+  g_list_free_full(d->previous_snapshot, dt_dev_free_history_item);
+  g_list_free_full(d->previous_iop_order_list, free);
   g_free(self->data);
   self->data = NULL;
 }
@@ -521,6 +546,118 @@ static int _create_deleted_modules(GList **_iop_list, GList *history_list)
   return changed;
 }
 
+static gboolean _iop_order_list_equal(GList *a, GList *b)
+{
+  for(; a && b; a = g_list_next(a), b = g_list_next(b))
+  {
+    const dt_iop_order_entry_t *ea = (dt_iop_order_entry_t *)a->data;
+    const dt_iop_order_entry_t *eb = (dt_iop_order_entry_t *)b->data;
+    if(ea->o.iop_order != eb->o.iop_order || ea->instance != eb->instance || strcmp(ea->operation, eb->operation))
+      return FALSE;
+  }
+  return !a && !b;
+}
+
+static size_t _form_point_size(const dt_masks_form_t *form)
+{
+  if(form->type & DT_MASKS_GROUP) return sizeof(dt_masks_point_group_t);
+  return form->functions ? form->functions->point_struct_size : 0;
+}
+
+static gboolean _forms_equal(GList *a, GList *b)
+{
+  for(; a && b; a = g_list_next(a), b = g_list_next(b))
+  {
+    const dt_masks_form_t *fa = (dt_masks_form_t *)a->data;
+    const dt_masks_form_t *fb = (dt_masks_form_t *)b->data;
+    if(fa->type != fb->type || fa->formid != fb->formid || fa->version != fb->version
+       || fa->functions != fb->functions || memcmp(fa->source, fb->source, sizeof(fa->source))
+       || strcmp(fa->name, fb->name))
+      return FALSE;
+
+    const size_t point_size = _form_point_size(fa);
+    GList *pa = fa->points, *pb = fb->points;
+    for(; pa && pb; pa = g_list_next(pa), pb = g_list_next(pb))
+      if(memcmp(pa->data, pb->data, point_size)) return FALSE;
+    if(pa || pb) return FALSE;
+  }
+  return !a && !b;
+}
+
+static gboolean _history_item_equal(const dt_dev_history_item_t *a, const dt_dev_history_item_t *b)
+{
+  return a->module && a->module == b->module && a->enabled == b->enabled && a->iop_order == b->iop_order
+         && a->multi_priority == b->multi_priority && a->num == b->num && !strcmp(a->op_name, b->op_name)
+         && !strcmp(a->multi_name, b->multi_name)
+         && !memcmp(a->params, b->params, a->module->params_size)
+         && !memcmp(a->blend_params, b->blend_params, sizeof(dt_develop_blend_params_t))
+         && _forms_equal(a->forms, b->forms);
+}
+
+static size_t _history_item_size(const dt_dev_history_item_t *item)
+{
+  size_t size = sizeof(dt_dev_history_item_t) + sizeof(dt_develop_blend_params_t);
+  if(item->module) size += item->module->params_size;
+  for(const GList *f = item->forms; f; f = g_list_next(f))
+  {
+    const dt_masks_form_t *form = (dt_masks_form_t *)f->data;
+    size += sizeof(dt_masks_form_t) + g_list_length(form->points) * _form_point_size(form);
+  }
+  return size;
+}
+
+static void _undo_item_ref(dt_lib_history_t *d, dt_dev_history_item_t *item)
+{
+  dt_undo_history_ref_t *ref = (dt_undo_history_ref_t *)g_hash_table_lookup(d->undo_items, item);
+  if(!ref)
+  {
+    ref = g_new0(dt_undo_history_ref_t, 1);
+    ref->size = _history_item_size(item);
+    d->undo_size += ref->size;
+    g_hash_table_insert(d->undo_items, item, ref);
+  }
+  ref->count++;
+}
+
+// releases the items of snapshot and the list itself
+static void _undo_items_unref(dt_lib_history_t *d, GList *snapshot)
+{
+  for(GList *l = snapshot; l; l = g_list_next(l))
+  {
+    dt_dev_history_item_t *item = (dt_dev_history_item_t *)l->data;
+    dt_undo_history_ref_t *ref = (dt_undo_history_ref_t *)g_hash_table_lookup(d->undo_items, item);
+    if(ref && --ref->count > 0) continue;
+    if(ref)
+    {
+      d->undo_size -= ref->size;
+      g_hash_table_remove(d->undo_items, item);
+    }
+    dt_dev_free_history_item(item);
+  }
+  g_list_free(snapshot);
+}
+
+// most changes only touch the last history items: the items of snapshot equal to the one at the same place
+// in reference are replaced by it, so an undo step only stores what it changed. takes a reference on all the
+// items of the returned snapshot
+static GList *_undo_share_items(dt_lib_history_t *d, GList *snapshot, GList *reference)
+{
+  GList *ref = reference;
+  for(GList *l = snapshot; l; l = g_list_next(l))
+  {
+    dt_dev_history_item_t *item = (dt_dev_history_item_t *)l->data;
+    dt_dev_history_item_t *shared = ref ? (dt_dev_history_item_t *)ref->data : NULL;
+    if(shared && shared != item && _history_item_equal(item, shared))
+    {
+      dt_dev_free_history_item(item);
+      l->data = item = shared;
+    }
+    _undo_item_ref(d, item);
+    ref = ref ? g_list_next(ref) : NULL;
+  }
+  return snapshot;
+}
+
 static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t data, dt_undo_action_t action, GList **imgs)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
@@ -534,25 +671,27 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
     // we will work on a copy of history and modules
     // when we're done we'll replace dev->history and dev->iop
     GList *history_temp = NULL;
+    GList *iop_order_list = NULL;
     int hist_end = 0;
 
     if(action == DT_ACTION_UNDO)
     {
       history_temp = dt_history_duplicate(hist->before_snapshot);
       hist_end = hist->before_end;
-      dev->iop_order_list = dt_ioppr_iop_order_copy_deep(hist->before_iop_order_list);
+      iop_order_list = hist->before_iop_order_list;
     }
     else
     {
       history_temp = dt_history_duplicate(hist->after_snapshot);
       hist_end = hist->after_end;
-      dev->iop_order_list = dt_ioppr_iop_order_copy_deep(hist->after_iop_order_list);
+      iop_order_list = hist->after_iop_order_list;
     }
 
-    GList *iop_temp = g_list_copy(dev->iop);
-
     // topology has changed?
-    int pipe_remove = 0;
+    int pipe_remove = !_iop_order_list_equal(dev->iop_order_list, iop_order_list);
+    dev->iop_order_list = dt_ioppr_iop_order_copy_deep(iop_order_list);
+
+    GList *iop_temp = g_list_copy(dev->iop);
 
     // we have to check if multi_priority has changed since history was saved
     // we will adjust it here
@@ -601,7 +740,11 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
 
     // write new history and reload
     dt_dev_write_history(dev);
-    dt_dev_reload_history_items(dev);
+    if(pipe_remove)
+      dt_dev_reload_history_items(dev);
+    else
+      // same modules in the same order, only update the ones that change
+      dt_dev_pop_history_items_synch(dev, hist_end);
 
     dt_ioppr_resync_modules_order(dev);
 
@@ -623,8 +766,8 @@ static void _pop_undo(gpointer user_data, dt_undo_type_t type, dt_undo_data_t da
 static void _history_undo_data_free(gpointer data)
 {
   dt_undo_history_t *hist = (dt_undo_history_t *)data;
-  g_list_free_full(hist->before_snapshot, dt_dev_free_history_item);
-  g_list_free_full(hist->after_snapshot, dt_dev_free_history_item);
+  _undo_items_unref(hist->lib, hist->before_snapshot);
+  _undo_items_unref(hist->lib, hist->after_snapshot);
   g_list_free_full(hist->before_iop_order_list, free);
   g_list_free_full(hist->after_iop_order_list, free);
   free(data);
@@ -645,7 +788,7 @@ static void _lib_history_will_change_callback(gpointer instance, GList *history,
   {
     // history is about to change, here we want to record a snapshot of the history for the undo
     // record previous history
-    g_list_free_full(lib->previous_snapshot, free);
+    g_list_free_full(lib->previous_snapshot, dt_dev_free_history_item);
     g_list_free_full(lib->previous_iop_order_list, free);
     lib->previous_snapshot = history;
     lib->previous_history_end = history_end;
@@ -1006,12 +1149,21 @@ static void _lib_history_change_callback(gpointer instance, gpointer user_data)
   if (d->record_undo == TRUE && (d->record_history_level == 0))
   {
     /* record undo/redo history snapshot */
+    // the records are gone with the previous image, so are the modules of the last snapshot
+    if(!dt_is_undo_list_populated(darktable.undo, DT_UNDO_HISTORY))
+    {
+      _undo_items_unref(d, d->undo_last);
+      d->undo_last = NULL;
+    }
+
     dt_undo_history_t *hist = malloc(sizeof(dt_undo_history_t));
-    hist->before_snapshot = dt_history_duplicate(d->previous_snapshot);
+    hist->lib = d;
+    hist->before_snapshot = _undo_share_items(d, dt_history_duplicate(d->previous_snapshot), d->undo_last);
     hist->before_end = d->previous_history_end;
     hist->before_iop_order_list = dt_ioppr_iop_order_copy_deep(d->previous_iop_order_list);
 
-    hist->after_snapshot = dt_history_duplicate(darktable.develop->history);
+    hist->after_snapshot
+        = _undo_share_items(d, dt_history_duplicate(darktable.develop->history), hist->before_snapshot);
     hist->after_end = dt_dev_get_history_end(darktable.develop);
     hist->after_iop_order_list = dt_ioppr_iop_order_copy_deep(darktable.develop->iop_order_list);
 
@@ -1026,8 +1178,18 @@ static void _lib_history_change_callback(gpointer instance, gpointer user_data)
       hist->request_mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
     }
 
+    GList *last = d->undo_last;
+    d->undo_last = g_list_copy(hist->after_snapshot);
+    for(GList *l = d->undo_last; l; l = g_list_next(l)) _undo_item_ref(d, (dt_dev_history_item_t *)l->data);
+    _undo_items_unref(d, last);
+
     dt_undo_record(darktable.undo, self, DT_UNDO_HISTORY, (dt_undo_data_t)hist,
                    _pop_undo, _history_undo_data_free);
+
+    // drop the oldest steps past the memory budget
+    const size_t max_size = (size_t)MAX(dt_conf_get_int("undo_history_memory"), 0) << 20;
+    while(max_size && d->undo_size > max_size && dt_undo_drop_oldest(darktable.undo, DT_UNDO_HISTORY))
+      ;
   }
   else
     d->record_undo = TRUE;
@@ -605,13 +605,13 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
   g_free(images);
 
   int img_id = mouse_over_id;
-  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, img_id, 'r');
+  const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, img_id);
 
   if(!img) goto fill_minuses;
 
   if(img->film_id == -1)
   {
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
     goto fill_minuses;
   }
 
@@ -961,7 +961,7 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
       }
     }
   }
-  dt_image_cache_read_release(darktable.image_cache, img);
+  dt_image_cache_snapshot_release(darktable.image_cache, img);
 
   if(mouse_over_id >= 0)
   {
@@ -1002,9 +1002,9 @@ static void _jump_to()
   if(imgid != -1)
   {
     char path[512];
-    const dt_image_t *img = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+    const dt_image_t *img = dt_image_cache_snapshot(darktable.image_cache, imgid);
     dt_image_film_roll_directory(img, path, sizeof(path));
-    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_image_cache_snapshot_release(darktable.image_cache, img);
     char collect[1024];
     snprintf(collect, sizeof(collect), "1:0:0:%s$", path);
     dt_collection_deserialize(collect);
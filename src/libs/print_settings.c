@@ -23,6 +23,7 @@
 #include "common/colorspaces.h"
 #include "common/cups_print.h"
 #include "common/file_location.h"
+#include "common/history.h"
 #include "common/image_cache.h"
 #include "common/metadata.h"
 #include "common/pdf.h"
@@ -131,6 +132,7 @@ typedef struct dt_lib_print_job_t
   dt_iop_color_intent_t buf_icc_intent, p_icc_intent;
   dt_images_box imgs;
   uint16_t *buf; // ??? should be removed
+  uint32_t generation; // of the export cache
   dt_pdf_page_t *pdf_page;
   char pdf_filename[PATH_MAX];
 } dt_lib_print_job_t;
@@ -278,8 +280,8 @@ static const char *mime(dt_imageio_module_data_t *data)
 
 static int write_image(dt_imageio_module_data_t *data, const char *filename, const void *in,
                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                       void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                       const gboolean export_masks)
+                       void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                       dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   dt_print_format_t *d = (dt_print_format_t *)data;
 
@@ -309,6 +311,121 @@ static int write_image(dt_imageio_module_data_t *data, const char *filename, con
   return 0;
 }
 
+// working-space exports of the last print job, before the printer profile is applied. printing the same
+// page again with another paper profile, intent or black point compensation only redoes the colour
+// transform. entries not used by a job are dropped at its end, so at most one page is kept in memory.
+
+typedef struct _export_cache_entry_t
+{
+  gchar *key;
+  void *buf;
+  int width, height, bpp;
+  uint32_t generation;
+} _export_cache_entry_t;
+
+static GMutex _export_cache_lock;
+static GList *_export_cache = NULL;
+static uint32_t _export_cache_generation = 0;
+
+static void _export_cache_entry_free(gpointer data)
+{
+  _export_cache_entry_t *e = (_export_cache_entry_t *)data;
+  g_free(e->key);
+  free(e->buf);
+  free(e);
+}
+
+// everything the pipe output depends on before the printer profile
+static gchar *_export_cache_key(const dt_lib_print_job_t *params, const dt_image_box *img, const int bpp)
+{
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, img->imgid, 'r');
+  if(!image) return NULL;
+  const GTimeSpan changed = image->change_timestamp;
+  dt_image_cache_read_release(darktable.image_cache, image);
+
+  dt_history_hash_values_t hash;
+  dt_history_hash_read(img->imgid, &hash);
+  gchar *history = hash.current
+    ? g_compute_checksum_for_data(G_CHECKSUM_MD5, hash.current, hash.current_len)
+    : g_strdup("");
+  free(hash.basic);
+  free(hash.auto_apply);
+  free(hash.current);
+
+  gchar *key = g_strdup_printf("%d|%" G_GINT64_FORMAT "|%s|%d|%d|%d|%s|%d|%d|%s|%d", img->imgid, changed, history,
+                               img->max_width, img->max_height, bpp, params->style ? params->style : "",
+                               params->style_append, params->buf_icc_type,
+                               params->buf_icc_profile ? params->buf_icc_profile : "", params->buf_icc_intent);
+  g_free(history);
+  return key;
+}
+
+// copy the cached export for key into params->buf, returns FALSE on a miss
+static gboolean _export_cache_get(dt_lib_print_job_t *params, const char *key, const uint32_t generation,
+                                  int *width, int *height)
+{
+  gboolean found = FALSE;
+  g_mutex_lock(&_export_cache_lock);
+  for(GList *l = _export_cache; l; l = g_list_next(l))
+  {
+    _export_cache_entry_t *e = (_export_cache_entry_t *)l->data;
+    if(strcmp(e->key, key)) continue;
+    const size_t size = (size_t)3 * (e->bpp == 8 ? 1 : 2) * e->width * e->height;
+    params->buf = (uint16_t *)malloc(size);
+    if(params->buf)
+    {
+      memcpy(params->buf, e->buf, size);
+      *width = e->width;
+      *height = e->height;
+      e->generation = generation;
+      found = TRUE;
+    }
+    break;
+  }
+  g_mutex_unlock(&_export_cache_lock);
+  return found;
+}
+
+static void _export_cache_put(const dt_lib_print_job_t *params, const char *key, const uint32_t generation,
+                              const int width, const int height, const int bpp)
+{
+  const size_t size = (size_t)3 * (bpp == 8 ? 1 : 2) * width * height;
+  void *buf = malloc(size);
+  if(!buf) return;
+  memcpy(buf, params->buf, size);
+
+  _export_cache_entry_t *e = malloc(sizeof(_export_cache_entry_t));
+  e->key = g_strdup(key);
+  e->buf = buf;
+  e->width = width;
+  e->height = height;
+  e->bpp = bpp;
+  e->generation = generation;
+
+  g_mutex_lock(&_export_cache_lock);
+  _export_cache = g_list_prepend(_export_cache, e);
+  g_mutex_unlock(&_export_cache_lock);
+}
+
+// drop the entries no job used since generation
+static void _export_cache_prune(const uint32_t generation)
+{
+  g_mutex_lock(&_export_cache_lock);
+  GList *l = _export_cache;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    _export_cache_entry_t *e = (_export_cache_entry_t *)l->data;
+    if((int32_t)(e->generation - generation) < 0)
+    {
+      _export_cache_entry_free(e);
+      _export_cache = g_list_delete_link(_export_cache, l);
+    }
+    l = next;
+  }
+  g_mutex_unlock(&_export_cache_lock);
+}
+
 // export image imgid with given max_width & max_height, set iwidth & iheight with the
 // final image size as exported.
 static int _export_image(dt_job_t *job, dt_image_box *img)
@@ -338,10 +455,22 @@ static int _export_image(dt_job_t *job, dt_image_box *img)
   const gboolean export_masks = FALSE;
   const gboolean is_scaling = FALSE;
 
-  dt_imageio_export_with_flags
-    (img->imgid, "unused", &buf, (dt_imageio_module_data_t *)&dat, TRUE, FALSE,
-     TRUE, is_scaling, FALSE, NULL, FALSE, export_masks, params->buf_icc_type,
-     params->buf_icc_profile, params->buf_icc_intent,  NULL, NULL, 1, 1, NULL);
+  gchar *key = _export_cache_key(params, img, dat.bpp);
+  if(key && _export_cache_get(params, key, params->generation, &dat.head.width, &dat.head.height))
+  {
+    dt_print(DT_DEBUG_PRINT, "[print] reusing the export of image %d\n", img->imgid);
+  }
+  else
+  {
+    dt_imageio_export_with_flags
+      (img->imgid, "unused", &buf, (dt_imageio_module_data_t *)&dat, TRUE, FALSE,
+       TRUE, is_scaling, FALSE, NULL, FALSE, export_masks, params->buf_icc_type,
+       params->buf_icc_profile, params->buf_icc_intent,  NULL, NULL, 1, 1, NULL);
+
+    if(key && params->buf)
+      _export_cache_put(params, key, params->generation, dat.head.width, dat.head.height, dat.bpp);
+  }
+  g_free(key);
 
   img->exp_width = dat.head.width;
   img->exp_height = dat.head.height;
@@ -505,6 +634,10 @@ static int _print_job_run(dt_job_t *job)
 {
   dt_lib_print_job_t *params = dt_control_job_get_params(job);
 
+  g_mutex_lock(&_export_cache_lock);
+  params->generation = ++_export_cache_generation;
+  g_mutex_unlock(&_export_cache_lock);
+
   // get first image on a box, needed as print leader
 
   int imgid = -1;
@@ -521,6 +654,8 @@ static int _print_job_run(dt_job_t *job)
     }
   }
 
+  _export_cache_prune(params->generation);
+
   if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) return 0;
   dt_control_job_set_progress(job, 0.9);
 
@@ -3209,6 +3344,11 @@ void gui_cleanup(dt_lib_module_t *self)
   g_free(ps->v_piccprofile);
   g_free(ps->v_style);
 
+  g_mutex_lock(&_export_cache_lock);
+  g_list_free_full(_export_cache, _export_cache_entry_free);
+  _export_cache = NULL;
+  g_mutex_unlock(&_export_cache_lock);
+
   free(self->data);
   self->data = NULL;
 }
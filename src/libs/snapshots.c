@@ -41,6 +41,11 @@ typedef struct dt_lib_snapshot_t
   GtkWidget *button;
   float zoom_x, zoom_y, zoom_scale;
   int32_t zoom, closeup;
+  // the rendered view, kept in memory. it is only written to filename when lua asks for it
+  cairo_surface_t *surface;
+  // image and hash of the main pipe output the snapshot was taken from
+  int32_t imgid;
+  uint64_t hash;
   char filename[512];
 } dt_lib_snapshot_t;
 
@@ -330,17 +335,28 @@ static void _lib_snapshots_toggle_last(dt_action_t *action)
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->snapshot[0].button), !gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(d->snapshot[0].button)));
 }
 
+static void _lib_snapshots_free_surfaces(dt_lib_snapshots_t *d)
+{
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
+  d->snapshot_image = NULL;
+  for(uint32_t k = 0; k < d->size; k++)
+  {
+    if(d->snapshot[k].surface) cairo_surface_destroy(d->snapshot[k].surface);
+    d->snapshot[k].surface = NULL;
+  }
+}
+
 void gui_reset(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
   d->num_snapshots = 0;
-  d->snapshot_image = NULL;
 
   for(uint32_t k = 0; k < d->size; k++)
   {
     gtk_widget_hide(d->snapshot[k].button);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->snapshot[k].button), FALSE);
   }
+  _lib_snapshots_free_surfaces(d);
 
   dt_control_queue_redraw_center();
 }
@@ -415,6 +431,7 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
+  _lib_snapshots_free_surfaces(d);
   g_free(d->snapshot);
 
   g_free(self->data);
@@ -426,8 +443,10 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
-  /* backup last snapshot slot */
+  /* backup last snapshot slot, its surface goes away */
   dt_lib_snapshot_t last = d->snapshot[d->size - 1];
+  if(last.surface) cairo_surface_destroy(last.surface);
+  last.surface = NULL;
 
   /* rotate slots down to make room for new one on top */
   for(int k = d->size - 1; k > 0; k--)
@@ -463,6 +482,16 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   s->zoom = dt_control_get_dev_zoom();
   s->closeup = dt_control_get_dev_closeup();
   s->zoom_scale = dt_control_get_dev_zoom_scale();
+  s->imgid = darktable.develop->image_storage.id;
+  s->hash = dt_dev_hash(darktable.develop, darktable.develop->pipe);
+
+  /* the same history seen through the same viewport renders the same, share the surface of the previous
+     snapshot rather than waiting for the next expose */
+  const dt_lib_snapshot_t *previous = d->snapshot + 1;
+  const gboolean same = d->num_snapshots > 0 && previous->surface && previous->imgid == s->imgid
+                        && previous->hash == s->hash && previous->zoom == s->zoom
+                        && previous->closeup == s->closeup && previous->zoom_x == s->zoom_x
+                        && previous->zoom_y == s->zoom_y && previous->zoom_scale == s->zoom_scale;
 
   /* update slots used */
   if(d->num_snapshots != d->size) d->num_snapshots++;
@@ -471,7 +500,10 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   for(uint32_t k = 0; k < d->num_snapshots; k++) gtk_widget_show(d->snapshot[k].button);
 
   /* request a new snapshot for top slot */
-  dt_dev_snapshot_request(darktable.develop, (const char *)&d->snapshot[0].filename);
+  if(same)
+    s->surface = cairo_surface_reference(previous->surface);
+  else
+    dt_dev_snapshot_request(darktable.develop, &s->surface);
 }
 
 static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer user_data)
@@ -499,16 +531,26 @@ static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer us
     /* setup snapshot */
     d->selected = which;
     dt_lib_snapshot_t *s = d->snapshot + (which - 1);
-    dt_control_set_dev_zoom_y(s->zoom_y);
-    dt_control_set_dev_zoom_x(s->zoom_x);
-    dt_control_set_dev_zoom(s->zoom);
-    dt_control_set_dev_closeup(s->closeup);
-    dt_control_set_dev_zoom_scale(s->zoom_scale);
 
-    dt_dev_invalidate(darktable.develop);
-    dt_dev_refresh_ui_images(darktable.develop);
+    /* the main pipe only needs to run again if the viewport of the snapshot is not the current one,
+       and then only for the new region of interest: the history is unchanged and its cache lines still
+       hold the upstream modules */
+    if(dt_control_get_dev_zoom_y() != s->zoom_y || dt_control_get_dev_zoom_x() != s->zoom_x
+       || dt_control_get_dev_zoom() != s->zoom || dt_control_get_dev_closeup() != s->closeup
+       || dt_control_get_dev_zoom_scale() != s->zoom_scale)
+    {
+      dt_control_set_dev_zoom_y(s->zoom_y);
+      dt_control_set_dev_zoom_x(s->zoom_x);
+      dt_control_set_dev_zoom(s->zoom);
+      dt_control_set_dev_closeup(s->closeup);
+      dt_control_set_dev_zoom_scale(s->zoom_scale);
+
+      dt_dev_invalidate_zoom(darktable.develop);
+      dt_dev_refresh_ui_images(darktable.develop);
+    }
 
-    d->snapshot_image = dt_cairo_image_surface_create_from_png(s->filename);
+    /* the surface may still be NULL if the snapshot was not drawn yet */
+    d->snapshot_image = s->surface ? cairo_surface_reference(s->surface) : NULL;
   }
 
   /* redraw center view */
@@ -705,7 +747,10 @@ static int filename_member(lua_State *L)
   {
     return luaL_error(L, "Accessing a non-existent snapshot");
   }
-  lua_pushstring(L, d->snapshot[index].filename);
+  // snapshots live in memory, write this one out for the script
+  const dt_lib_snapshot_t *s = &d->snapshot[index];
+  if(s->surface) cairo_surface_write_to_png(s->surface, s->filename);
+  lua_pushstring(L, s->filename);
   return 1;
 }
 static int name_member(lua_State *L)
@@ -17,6 +17,7 @@
 */
 #include "common/collection.h"
 #include "common/selection.h"
+#include "common/sidecar_writer.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/tags.h"
@@ -59,6 +60,8 @@ typedef struct dt_lib_tagging_t
   gboolean tree_flag, suggestion_flag, sort_count_flag, hide_path_flag, dttags_flag;
   char *collection;
   char *last_tag;
+  // rows of the dictionary store by tag id, NULL when they have to be searched (see _dictionary_row_t)
+  GHashTable *dictionary_rows;
   struct
   {
     gchar *tagname;
@@ -89,6 +92,15 @@ typedef enum dt_lib_tagging_cols_t
   DT_LIB_TAGGING_NUM_COLS
 } dt_lib_tagging_cols_t;
 
+// a tag of the dictionary store, as loaded by _init_treeview(). the stores keep their iters valid as long as
+// the row exists, so the index is dropped whenever rows are removed outside _init_treeview().
+typedef struct _dictionary_row_t
+{
+  GtkTreeIter iter;
+  gchar *name;
+  gchar *synonym;
+} _dictionary_row_t;
+
 typedef enum dt_tag_sort_id
 {
   DT_TAG_SORT_PATH_ID,
@@ -354,6 +366,132 @@ static gboolean _select_next_user_attached_tag(const int index, GtkTreeView *vie
   return FALSE;
 }
 
+static void _dictionary_row_free(gpointer data)
+{
+  _dictionary_row_t *row = (_dictionary_row_t *)data;
+  g_free(row->name);
+  g_free(row->synonym);
+  g_free(row);
+}
+
+static void _dictionary_rows_invalidate(dt_lib_tagging_t *d)
+{
+  if(d->dictionary_rows) g_hash_table_destroy(d->dictionary_rows);
+  d->dictionary_rows = NULL;
+}
+
+static void _dictionary_rows_add(dt_lib_tagging_t *d, const dt_tag_t *tag, GtkTreeIter *iter)
+{
+  _dictionary_row_t *row = g_new(_dictionary_row_t, 1);
+  row->iter = *iter;
+  row->name = g_strdup(tag->tag);
+  row->synonym = g_strdup(tag->synonym);
+  g_hash_table_insert(d->dictionary_rows, GINT_TO_POINTER(tag->id), row);
+}
+
+static gboolean _find_tag_iter_tagid(GtkTreeModel *model, GtkTreeIter *iter, const gint tagid);
+
+// find the row of tagid in the dictionary store
+static gboolean _dictionary_iter_tagid(dt_lib_tagging_t *d, GtkTreeModel *store, GtkTreeIter *iter,
+                                       const gint tagid)
+{
+  if(d->dictionary_rows)
+  {
+    const _dictionary_row_t *row = g_hash_table_lookup(d->dictionary_rows, GINT_TO_POINTER(tagid));
+    if(row) *iter = row->iter;
+    return row != NULL;
+  }
+  return gtk_tree_model_get_iter_first(store, iter) && _find_tag_iter_tagid(store, iter, tagid);
+}
+
+// set the selection of the rows from iter on, and of their children, to their state in states (tag id ->
+// dt_tag_selection_t), a parent being partially selected when one of its children is. only the rows
+// which change are written. returns whether any of these rows is selected.
+static gboolean _set_sel_on_path(GtkTreeModel *model, GtkTreeIter *iter, GHashTable *states)
+{
+  gboolean any = FALSE;
+  GtkTreeIter row = *iter;
+  do
+  {
+    guint tagid = 0, sel = DT_TS_NO_IMAGE;
+    gtk_tree_model_get(model, &row, DT_LIB_TAGGING_COL_ID, &tagid, DT_LIB_TAGGING_COL_SEL, &sel, -1);
+    guint new_sel = tagid ? GPOINTER_TO_UINT(g_hash_table_lookup(states, GUINT_TO_POINTER(tagid)))
+                          : DT_TS_NO_IMAGE;
+    GtkTreeIter child;
+    if(gtk_tree_model_iter_children(model, &child, &row) && _set_sel_on_path(model, &child, states)
+       && new_sel == DT_TS_NO_IMAGE)
+      new_sel = DT_TS_SOME_IMAGES;
+    if(new_sel != sel)
+    {
+      if(GTK_IS_TREE_STORE(model))
+        gtk_tree_store_set(GTK_TREE_STORE(model), &row, DT_LIB_TAGGING_COL_SEL, new_sel, -1);
+      else
+        gtk_list_store_set(GTK_LIST_STORE(model), &row, DT_LIB_TAGGING_COL_SEL, new_sel, -1);
+    }
+    if(new_sel != DT_TS_NO_IMAGE) any = TRUE;
+  } while(gtk_tree_model_iter_next(model, &row));
+  return any;
+}
+
+// the dictionary store holds exactly tags, with the same names and synonyms
+static gboolean _dictionary_rows_match(dt_lib_tagging_t *d, GList *tags, const uint32_t count)
+{
+  if(!d->dictionary_rows || g_hash_table_size(d->dictionary_rows) != count) return FALSE;
+  for(const GList *l = tags; l; l = g_list_next(l))
+  {
+    const dt_tag_t *t = (dt_tag_t *)l->data;
+    const _dictionary_row_t *row = g_hash_table_lookup(d->dictionary_rows, GINT_TO_POINTER(t->id));
+    if(!row || g_strcmp0(row->name, t->tag) || g_strcmp0(row->synonym, t->synonym)) return FALSE;
+  }
+  return TRUE;
+}
+
+// refresh the counts, flags and selection of the dictionary rows in place. returns FALSE if the tags
+// themselves changed, the store has to be built again then.
+static gboolean _update_dictionary(dt_lib_module_t *self)
+{
+  dt_lib_tagging_t *d = (dt_lib_tagging_t *)self->data;
+  GList *tags = NULL;
+  const uint32_t count = (!d->tree_flag && d->suggestion_flag) ? dt_tag_get_suggestions(&tags)
+                                                                 : dt_tag_get_with_usage(&tags);
+  if(!_dictionary_rows_match(d, tags, count))
+  {
+    dt_tag_free_result(&tags);
+    return FALSE;
+  }
+
+  GtkTreeModel *store = d->tree_flag ? GTK_TREE_MODEL(d->dictionary_treestore)
+                                     : GTK_TREE_MODEL(d->dictionary_liststore);
+  GHashTable *states = g_hash_table_new(NULL, NULL);
+  for(const GList *l = tags; l; l = g_list_next(l))
+  {
+    const dt_tag_t *t = (dt_tag_t *)l->data;
+    const _dictionary_row_t *row = g_hash_table_lookup(d->dictionary_rows, GINT_TO_POINTER(t->id));
+    GtkTreeIter iter = row->iter;
+    guint row_count = 0, flags = 0;
+    gtk_tree_model_get(store, &iter, DT_LIB_TAGGING_COL_COUNT, &row_count, DT_LIB_TAGGING_COL_FLAGS, &flags, -1);
+    if(row_count != t->count || flags != t->flags)
+    {
+      if(d->tree_flag)
+        gtk_tree_store_set(d->dictionary_treestore, &iter, DT_LIB_TAGGING_COL_COUNT, t->count,
+                           DT_LIB_TAGGING_COL_FLAGS, t->flags, -1);
+      else
+        gtk_list_store_set(d->dictionary_liststore, &iter, DT_LIB_TAGGING_COL_COUNT, t->count,
+                           DT_LIB_TAGGING_COL_FLAGS, t->flags, -1);
+    }
+    if(t->select != DT_TS_NO_IMAGE)
+      g_hash_table_insert(states, GUINT_TO_POINTER(t->id), GUINT_TO_POINTER(t->select));
+  }
+
+  GtkTreeIter first;
+  if(gtk_tree_model_get_iter_first(store, &first)) _set_sel_on_path(store, &first, states);
+  g_hash_table_destroy(states);
+  dt_tag_free_result(&tags);
+
+  if(d->sort_count_flag) _sort_dictionary_list(self, TRUE);
+  return TRUE;
+}
+
 static void _init_treeview(dt_lib_module_t *self, const int which)
 {
   dt_lib_tagging_t *d = (dt_lib_tagging_t *)self->data;
@@ -390,6 +528,12 @@ static void _init_treeview(dt_lib_module_t *self, const int which)
   g_object_ref(model);
   gtk_tree_view_set_model(GTK_TREE_VIEW(view), NULL);
 
+  if(which)
+  {
+    _dictionary_rows_invalidate(d);
+    d->dictionary_rows = g_hash_table_new_full(NULL, NULL, NULL, _dictionary_row_free);
+  }
+
   gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(store), GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID, GTK_SORT_ASCENDING);
   if(which && d->tree_flag)
   {
@@ -453,6 +597,8 @@ static void _init_treeview(dt_lib_module_t *self, const int which)
                               -1);
             if(((dt_tag_t *)taglist->data)->select)
               _propagate_sel_to_parents(GTK_TREE_MODEL(store), &iter);
+            if(token == &tokens[tokens_length-1])
+              _dictionary_rows_add(d, (dt_tag_t *)taglist->data, &iter);
             common_length++;
             parent = iter;
             g_free(pth2);
@@ -497,6 +643,7 @@ static void _init_treeview(dt_lib_module_t *self, const int which)
                           DT_LIB_TAGGING_COL_SYNONYM, ((dt_tag_t *)tag->data)->synonym,
                           DT_LIB_TAGGING_COL_VISIBLE, TRUE,
                           -1);
+        if(which) _dictionary_rows_add(d, (dt_tag_t *)tag->data, &iter);
       }
     }
     if(which && d->keyword[0])
@@ -589,7 +736,7 @@ static void _tree_select_show(GtkTreeViewColumn *col, GtkCellRenderer *renderer,
 static void _lib_tagging_tags_changed_callback(gpointer instance, dt_lib_module_t *self)
 {
   _init_treeview(self, 0);
-  _init_treeview(self, 1);
+  if(!_update_dictionary(self)) _init_treeview(self, 1);
 }
 
 static void _collection_updated_callback(gpointer instance, dt_collection_change_t query_change,
@@ -677,27 +824,6 @@ static void _reset_sel_on_path(GtkTreeModel *model, GtkTreeIter *iter, const gbo
   } while (!root && gtk_tree_model_iter_next(model, &parent));
 }
 
-// reset all selection (1 & 2) on the tree
-static void _reset_sel_on_path_full(GtkTreeModel *model, GtkTreeIter *iter, const gboolean root)
-{
-  GtkTreeIter child, parent = *iter;
-  do
-  {
-    if(GTK_IS_TREE_STORE(model))
-    {
-      gtk_tree_store_set(GTK_TREE_STORE(model), &parent,
-                         DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
-      if(gtk_tree_model_iter_children(model, &child, &parent))
-        _reset_sel_on_path_full(model, &child, FALSE);
-    }
-    else
-    {
-      gtk_list_store_set(GTK_LIST_STORE(model), &parent,
-                         DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
-    }
-  } while (!root && gtk_tree_model_iter_next(model, &parent));
-}
-
 //  try to find a node fully attached (2) which is the root of the update loop. If not the full tree will be used
 static void _find_root_iter_iter(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent)
 {
@@ -748,29 +874,16 @@ static void _update_sel_on_tree(GtkTreeModel *model)
 {
   GList *tags = NULL;
   dt_tag_get_attached(-1, &tags, TRUE);
-  GtkTreeIter parent;
-  if(gtk_tree_model_get_iter_first(model, &parent))
+  GHashTable *states = g_hash_table_new(NULL, NULL);
+  for(const GList *tag = tags; tag; tag = g_list_next(tag))
   {
-    _reset_sel_on_path_full(model, &parent, FALSE);
-    for (GList *tag = tags; tag; tag = g_list_next(tag))
-    {
-      GtkTreeIter iter = parent;
-      if(_find_tag_iter_tagid(model, &iter, ((dt_tag_t *)tag->data)->id))
-      {
-        if(GTK_IS_TREE_STORE(model))
-        {
-          gtk_tree_store_set(GTK_TREE_STORE(model), &iter,
-                             DT_LIB_TAGGING_COL_SEL, ((dt_tag_t *)tag->data)->select, -1);
-          _propagate_sel_to_parents(model, &iter);
-        }
-        else
-        {
-          gtk_list_store_set(GTK_LIST_STORE(model), &iter,
-                             DT_LIB_TAGGING_COL_SEL, ((dt_tag_t *)tag->data)->select, -1);
-        }
-      }
-    }
+    const dt_tag_t *t = (dt_tag_t *)tag->data;
+    if(t->select != DT_TS_NO_IMAGE)
+      g_hash_table_insert(states, GUINT_TO_POINTER(t->id), GUINT_TO_POINTER(t->select));
   }
+  GtkTreeIter first;
+  if(gtk_tree_model_get_iter_first(model, &first)) _set_sel_on_path(model, &first, states);
+  g_hash_table_destroy(states);
   if(tags)
     dt_tag_free_result(&tags);
 }
@@ -935,29 +1048,27 @@ static gboolean _update_tag_name_per_name(GtkTreeModel *model, GtkTreePath *path
   return FALSE;
 }
 
-static void _update_attached_count(const int tagid, GtkTreeView *view, const gboolean tree_flag)
+static void _update_attached_count(dt_lib_tagging_t *d, const int tagid, GtkTreeView *view,
+                                   const gboolean tree_flag)
 {
   const guint count = dt_tag_images_count(tagid);
   GtkTreeModel *model = gtk_tree_view_get_model(view);
   GtkTreeModel *store = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(model));
   GtkTreeIter iter;
-  if(gtk_tree_model_get_iter_first(store, &iter))
+  if(_dictionary_iter_tagid(d, store, &iter, tagid))
   {
-    if(_find_tag_iter_tagid(store, &iter, tagid))
+    if(tree_flag)
     {
-      if(tree_flag)
-      {
-        gtk_tree_store_set(GTK_TREE_STORE(store), &iter,
-                           DT_LIB_TAGGING_COL_COUNT, count,
-                           DT_LIB_TAGGING_COL_SEL, DT_TS_ALL_IMAGES, -1);
-        _calculate_sel_on_tree(GTK_TREE_MODEL(store), &iter);
-      }
-      else
-      {
-        gtk_list_store_set(GTK_LIST_STORE(store), &iter,
-                           DT_LIB_TAGGING_COL_COUNT, count,
-                           DT_LIB_TAGGING_COL_SEL, DT_TS_ALL_IMAGES, -1);
-      }
+      gtk_tree_store_set(GTK_TREE_STORE(store), &iter,
+                         DT_LIB_TAGGING_COL_COUNT, count,
+                         DT_LIB_TAGGING_COL_SEL, DT_TS_ALL_IMAGES, -1);
+      _calculate_sel_on_tree(GTK_TREE_MODEL(store), &iter);
+    }
+    else
+    {
+      gtk_list_store_set(GTK_LIST_STORE(store), &iter,
+                         DT_LIB_TAGGING_COL_COUNT, count,
+                         DT_LIB_TAGGING_COL_SEL, DT_TS_ALL_IMAGES, -1);
     }
   }
 }
@@ -1015,7 +1126,7 @@ int set_params(dt_lib_module_t *self, const void *params, int size)
       gboolean change = FALSE;
       for(GList *tag = tags; tag; tag = g_list_next(tag))
       {
-        _update_attached_count(GPOINTER_TO_INT(tag->data), d->dictionary_view, d->tree_flag);
+        _update_attached_count(d, GPOINTER_TO_INT(tag->data), d->dictionary_view, d->tree_flag);
         change = TRUE;
       }
 
@@ -1113,23 +1224,20 @@ static void _detach_selected_tag(GtkTreeView *view, dt_lib_module_t *self)
       const guint count = dt_tag_images_count(tagid);
       model = gtk_tree_view_get_model(d->dictionary_view);
       GtkTreeModel *store = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(model));
-      if(gtk_tree_model_get_iter_first(store, &iter))
+      if(_dictionary_iter_tagid(d, store, &iter, tagid))
       {
-        if(_find_tag_iter_tagid(store, &iter, tagid))
+        if(d->tree_flag)
         {
-          if(d->tree_flag)
-          {
-            gtk_tree_store_set(GTK_TREE_STORE(store), &iter,
-                               DT_LIB_TAGGING_COL_COUNT, count,
-                               DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
-            _calculate_sel_on_tree(GTK_TREE_MODEL(store), &iter);
-          }
-          else
-          {
-            gtk_list_store_set(GTK_LIST_STORE(store), &iter,
-                               DT_LIB_TAGGING_COL_COUNT, count,
-                               DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
-          }
+          gtk_tree_store_set(GTK_TREE_STORE(store), &iter,
+                             DT_LIB_TAGGING_COL_COUNT, count,
+                             DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
+          _calculate_sel_on_tree(GTK_TREE_MODEL(store), &iter);
+        }
+        else
+        {
+          gtk_list_store_set(GTK_LIST_STORE(store), &iter,
+                             DT_LIB_TAGGING_COL_COUNT, count,
+                             DT_LIB_TAGGING_COL_SEL, DT_TS_NO_IMAGE, -1);
         }
       }
     }
@@ -1140,7 +1248,7 @@ static void _detach_selected_tag(GtkTreeView *view, dt_lib_module_t *self)
     if(res)
     {
       _raise_signal_tag_changed(self);
-      dt_image_synch_xmps(affected_images);
+      dt_sidecar_writer_queue_list(affected_images);
     }
     g_list_free(affected_images);
   }
@@ -1351,7 +1459,7 @@ static void _new_button_clicked(GtkButton *button, dt_lib_module_t *self)
   }
 
   const gboolean res = dt_tag_attach_string_list(tag, imgs, TRUE);
-  if(res) dt_image_synch_xmps(imgs);
+  if(res) dt_sidecar_writer_queue_list(imgs);
   g_list_free(imgs);
 
   /** record last tag used */
@@ -1511,9 +1619,10 @@ static void _pop_menu_dictionary_delete_tag(GtkWidget *menuitem, dt_lib_module_t
   gtk_tree_model_filter_convert_iter_to_child_iter(GTK_TREE_MODEL_FILTER(model),
                             &store_iter, &iter);
   _delete_tree_tag(GTK_TREE_MODEL(store), &store_iter, d->tree_flag);
+  _dictionary_rows_invalidate(d);
   _init_treeview(self, 0);
 
-  dt_image_synch_xmps(tagged_images);
+  dt_sidecar_writer_queue_list(tagged_images);
   g_list_free(tagged_images);
   g_free(tagname);
   _raise_signal_tag_changed(self);
@@ -1596,10 +1705,11 @@ static void _pop_menu_dictionary_delete_node(GtkWidget *menuitem, dt_lib_module_
   gtk_tree_model_filter_convert_iter_to_child_iter(GTK_TREE_MODEL_FILTER(model),
                             &store_iter, &iter);
   _delete_tree_path(GTK_TREE_MODEL(store), &store_iter, TRUE, d->tree_flag);
+  _dictionary_rows_invalidate(d);
   _init_treeview(self, 0);
 
   dt_tag_free_result(&tag_family);
-  dt_image_synch_xmps(tagged_images);
+  dt_sidecar_writer_queue_list(tagged_images);
   g_list_free(tagged_images);
   _raise_signal_tag_changed(self);
   g_free(tagname);
@@ -1906,7 +2016,7 @@ static void _pop_menu_dictionary_edit_tag(GtkWidget *menuitem, dt_lib_module_t *
 
       _raise_signal_tag_changed(self);
       dt_tag_free_result(&tag_family);
-      dt_image_synch_xmps(tagged_images);
+      dt_sidecar_writer_queue_list(tagged_images);
       g_list_free(tagged_images);
     }
 
@@ -1994,7 +2104,7 @@ static gboolean _apply_rename_path(GtkWidget *dialog, const char *tagname,
     }
     _init_treeview(self, 0);
     _init_treeview(self, 1);
-    dt_image_synch_xmps(tagged_images);
+    dt_sidecar_writer_queue_list(tagged_images);
     _raise_signal_tag_changed(self);
     _show_tag_on_view(d->dictionary_view, newtag, FALSE, TRUE);
     success = TRUE;
@@ -2530,6 +2640,7 @@ static void _update_layout(dt_lib_module_t *self)
 
   ++darktable.gui->reset;
 
+  _dictionary_rows_invalidate(d);
   d->suggestion_flag = dt_conf_get_bool("plugins/lighttable/tagging/nosuggestion");
   gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(d->toggle_suggestion_button), d->suggestion_flag);
   d->tree_flag = dt_conf_get_bool("plugins/lighttable/tagging/treeview");
@@ -2899,7 +3010,7 @@ static void _event_dnd_received(GtkWidget *widget, GdkDragContext *context, gint
       if(tagid)
         dt_tag_attach_images(tagid, imgs, TRUE);
       g_list_free(imgs);
-      _update_attached_count(tagid, d->dictionary_view, d->tree_flag);
+      _update_attached_count(d, tagid, d->dictionary_view, d->tree_flag);
       _init_treeview(self, 0);
       _raise_signal_tag_changed(self);
       dt_image_synch_xmp(-1);
@@ -3267,6 +3378,7 @@ void gui_cleanup(dt_lib_module_t *self)
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_tagging_tags_changed_callback), self);
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_selection_changed_callback), self);
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_collection_updated_callback), self);
+  _dictionary_rows_invalidate(d);
   g_free(d->collection);
   if(d->drag.tagname) g_free(d->drag.tagname);
   if(d->drag.path) gtk_tree_path_free(d->drag.path);
@@ -3292,7 +3404,7 @@ static gboolean _lib_tagging_tag_key_press(GtkWidget *entry, GdkEventKey *event,
     {
       const gchar *tag = gtk_entry_get_text(GTK_ENTRY(entry));
       const gboolean res = dt_tag_attach_string_list(tag, d->floating_tag_imgs, TRUE);
-      if(res) dt_image_synch_xmps(d->floating_tag_imgs);
+      if(res) dt_sidecar_writer_queue_list(d->floating_tag_imgs);
       g_list_free(d->floating_tag_imgs);
 
       /** record last tag used */
@@ -3325,7 +3437,7 @@ static void _lib_tagging_tag_redo(dt_action_t *action)
   {
     GList *imgs = dt_act_on_get_images(FALSE, TRUE, FALSE);
     const gboolean res = dt_tag_attach_string_list(d->last_tag, imgs, TRUE);
-    if(res) dt_image_synch_xmps(imgs);
+    if(res) dt_sidecar_writer_queue_list(imgs);
     g_list_free(imgs);
     _init_treeview(self, 0);
     _init_treeview(self, 1);
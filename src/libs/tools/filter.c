@@ -238,7 +238,7 @@ static gboolean _text_entry_changed_wait(gpointer user_data)
       if(g_strcmp0(dt_collection_get_text_filter(darktable.collection), text))
       {
         dt_collection_set_text_filter(darktable.collection, text);
-        dt_collection_update_query(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_SORT, NULL);
+        dt_collection_update_query_async(darktable.collection, DT_COLLECTION_CHANGE_RELOAD, DT_COLLECTION_PROP_SORT);
       }
       else g_free(text);
       _set_widget_dimmed(d->text, FALSE);
@@ -17,6 +17,9 @@
  */
 #include "common/imageio.h"
 #include "control/conf.h"
+#include "control/jobs/control_jobs.h"
+#include "lua/call.h"
+#include "lua/events.h"
 #include "lua/image.h"
 #include "lua/modules.h"
 #include "lua/types.h"
@@ -166,6 +169,79 @@ static int write_image(lua_State *L)
   return 1;
 }
 
+static void _batch_image_done(const int32_t imgid, const char *filename, const gboolean success,
+                              gpointer user_data)
+{
+  dt_lua_async_call_alien(dt_lua_event_trigger_wrapper,
+      0, NULL, NULL,
+      LUA_ASYNC_TYPENAME, "const char*", "batch-export-image",
+      LUA_ASYNC_TYPENAME, "int32_t", user_data,
+      LUA_ASYNC_TYPENAME, "dt_lua_image_t", GINT_TO_POINTER(imgid),
+      LUA_ASYNC_TYPENAME_WITH_FREE, "char*", g_strdup(filename), g_cclosure_new(G_CALLBACK(&g_free), NULL, NULL),
+      LUA_ASYNC_TYPENAME, "bool", GINT_TO_POINTER(success),
+      LUA_ASYNC_DONE);
+}
+
+static void _batch_done(gpointer user_data)
+{
+  dt_lua_async_call_alien(dt_lua_event_trigger_wrapper,
+      0, NULL, NULL,
+      LUA_ASYNC_TYPENAME, "const char*", "batch-export-done",
+      LUA_ASYNC_TYPENAME, "int32_t", user_data,
+      LUA_ASYNC_DONE);
+}
+
+// format:write_images(images, filenames) exports each image of the table to the file at the same index, in
+// a background job. returns at once with the id of the batch, the batch-export-image event follows each
+// image and batch-export-done the end of the batch
+static int write_images(lua_State *L)
+{
+  static int32_t batch_id = 0;
+
+  /* check that param 1 is a module_format_t */
+  luaL_argcheck(L, dt_lua_isa(L, 1, dt_imageio_module_format_t), -1, "dt_imageio_module_format_t expected");
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  const lua_Integer count = luaL_len(L, 2);
+  luaL_argcheck(L, luaL_len(L, 3) == count, 3, "one filename per image expected");
+
+  lua_getmetatable(L, 1);
+  lua_getfield(L, -1, "__luaA_Type");
+  luaA_Type format_type = luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, -1, "__associated_object");
+  dt_imageio_module_format_t *format = lua_touserdata(L, -1);
+  lua_pop(L, 2);
+
+  GList *imgs = NULL;
+  GList *filenames = NULL;
+  for(lua_Integer i = count; i > 0; i--)
+  {
+    lua_geti(L, 2, i);
+    lua_geti(L, 3, i);
+    if(!dt_lua_isa(L, -2, dt_lua_image_t) || !lua_isstring(L, -1))
+    {
+      g_list_free(imgs);
+      g_list_free_full(filenames, g_free);
+      return luaL_error(L, "image and filename expected at index %d", (int)i);
+    }
+    dt_lua_image_t imgid;
+    luaA_to(L, dt_lua_image_t, &imgid, -2);
+    const char *filename = lua_tostring(L, -1);
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(imgid));
+    filenames = g_list_prepend(filenames, g_strdup(filename));
+    lua_pop(L, 2);
+  }
+
+  dt_imageio_module_data_t *fdata = format->get_params(format);
+  luaA_to_type(L, format_type, fdata, 1);
+
+  const int32_t id = ++batch_id;
+  dt_control_export_files(imgs, filenames, format, fdata, _batch_image_done, _batch_done, GINT_TO_POINTER(id));
+  lua_pushinteger(L, id);
+  return 1;
+}
+
 void dt_lua_register_format_type(lua_State *L, dt_imageio_module_format_t *module, luaA_Type type_id)
 {
   dt_lua_type_register_parent_type(L, type_id, luaA_type_find(L, "dt_imageio_module_format_t"));
@@ -205,6 +281,9 @@ int dt_lua_init_early_format(lua_State *L)
   lua_pushcfunction(L, write_image);
   lua_pushcclosure(L, dt_lua_type_member_common, 1);
   dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_image");
+  lua_pushcfunction(L, write_images);
+  lua_pushcclosure(L, dt_lua_type_member_common, 1);
+  dt_lua_type_register_const(L, dt_imageio_module_format_t, "write_images");
 
   dt_lua_module_new(L, "format");
 
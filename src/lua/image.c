@@ -133,6 +133,8 @@ static int generate_cache(lua_State *L)
 
     // if a valid thumbnail file is already on disc - do nothing
     if(dt_util_test_image_file(filename)) continue;
+    // same if it is in the packed store or was written with another codec
+    if(dt_mipmap_cache_has_disk_thumbnail(darktable.mipmap_cache, imgid, k)) continue;
     // else, generate thumbnail and store in mipmap cache.
     dt_mipmap_buffer_t buf;
     dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
@@ -0,0 +1,352 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// ansel-bench-darkroom: latency of the darkroom after parameter changes.
+//
+// Loads an image in a develop without GUI and replays a script of parameter changes to named modules, like a
+// slider drag. Each change goes through dt_dev_add_history_item(), then the preview and main pipes are run at
+// once by dt_dev_process_preview_job() and dt_dev_process_image_job() as the darkroom workers do. It reports,
+// per line of the script, the time from the change to the preview and to the full view, and the pixelpipe
+// cache hits and misses of the metrics registry.
+//
+// Script lines are `<module> <param> <value>` or `<module> <param> <from> <to> <steps>` for a drag, where
+// params are the introspection names of the module params. `#' starts a comment.
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/metrics.h"
+#include "control/control.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// drag the exposure slider, then drag it again over the same values: the second drag should reuse the
+// cached outputs of the modules before exposure
+static const char *_default_script = "exposure exposure 0.0 1.0 10\n"
+                                     "exposure exposure 0.0 1.0 10\n";
+
+typedef struct _step_t
+{
+  double preview;
+  double full;
+  uint64_t hits;
+  uint64_t misses;
+} _step_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s -i <image> [-s <script>] [-W <width>] [-H <height>] [--zoom fit|1]\n"
+                  "       [--core <ansel options>]\n\n"
+                  "  -i, --image    the image to develop\n"
+                  "  -s, --script   parameter changes to replay, an exposure drag by default\n"
+                  "  -W, -H         size of the darkroom view, default 1920 x 1080\n"
+                  "  --zoom         fit the image in the view, or show it at 100 %%\n",
+          progname);
+}
+
+static dt_iop_module_t *_find_module(dt_develop_t *dev, const char *op)
+{
+  for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    if(!strcmp(module->op, op) && module->multi_priority == 0) return module;
+  }
+  return NULL;
+}
+
+static gboolean _set_param(dt_iop_module_t *module, const char *name, const double value)
+{
+  if(!module->so->have_introspection) return FALSE;
+  dt_introspection_field_t *f = module->get_f(name);
+  void *p = module->get_p(module->params, name);
+  if(!f || !p) return FALSE;
+
+  switch(f->header.type)
+  {
+    case DT_INTROSPECTION_TYPE_FLOAT:
+      *(float *)p = CLAMP((float)value, f->Float.Min, f->Float.Max);
+      break;
+    case DT_INTROSPECTION_TYPE_DOUBLE:
+      *(double *)p = CLAMP(value, f->Double.Min, f->Double.Max);
+      break;
+    case DT_INTROSPECTION_TYPE_INT:
+      *(int *)p = CLAMP((int)lround(value), f->Int.Min, f->Int.Max);
+      break;
+    case DT_INTROSPECTION_TYPE_UINT:
+      *(unsigned int *)p = CLAMP((unsigned int)lround(value), f->UInt.Min, f->UInt.Max);
+      break;
+    case DT_INTROSPECTION_TYPE_ENUM:
+      *(int *)p = (int)lround(value);
+      break;
+    case DT_INTROSPECTION_TYPE_BOOL:
+      *(gboolean *)p = value != 0.0;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+typedef struct _preview_job_t
+{
+  dt_develop_t *dev;
+  double start;
+  double time;
+} _preview_job_t;
+
+static gpointer _preview_thread(gpointer data)
+{
+  _preview_job_t *job = (_preview_job_t *)data;
+  dt_dev_process_preview_job(job->dev);
+  job->time = dt_get_wtime() - job->start;
+  return NULL;
+}
+
+static void _pipe_cache_counters(uint64_t *hits, uint64_t *misses)
+{
+  dt_metrics_snapshot_t snapshot;
+  dt_metrics_snapshot(&snapshot);
+  *hits = snapshot.counters[DT_METRICS_PIXELPIPE_CACHE_HIT];
+  *misses = snapshot.counters[DT_METRICS_PIXELPIPE_CACHE_MISS];
+  dt_metrics_snapshot_cleanup(&snapshot);
+}
+
+// change one param, then run both pipes as the darkroom does after a change
+static void _run_step(dt_develop_t *dev, dt_iop_module_t *module, _step_t *step)
+{
+  uint64_t hits, misses;
+  _pipe_cache_counters(&hits, &misses);
+
+  _preview_job_t job = { dev, dt_get_wtime(), 0.0 };
+  module->enabled = TRUE;
+  dt_dev_add_history_item(dev, module, TRUE);
+
+  GThread *preview = g_thread_new("preview", _preview_thread, &job);
+  dt_dev_process_image_job(dev);
+  step->full = dt_get_wtime() - job.start;
+  g_thread_join(preview);
+  step->preview = job.time;
+
+  uint64_t hits_after, misses_after;
+  _pipe_cache_counters(&hits_after, &misses_after);
+  step->hits = hits_after - hits;
+  step->misses = misses_after - misses;
+}
+
+static int _sort_double(const void *a, const void *b)
+{
+  const double da = *(const double *)a;
+  const double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static double _percentile(const double *sorted, const int count, const double q)
+{
+  return sorted[MIN(count - 1, MAX(0, (int)ceil(q * count) - 1))];
+}
+
+static void _report(const char *label, const _step_t *steps, const int count)
+{
+  double *preview = malloc(sizeof(double) * count);
+  double *full = malloc(sizeof(double) * count);
+  uint64_t hits = 0, misses = 0;
+  for(int k = 0; k < count; k++)
+  {
+    preview[k] = steps[k].preview;
+    full[k] = steps[k].full;
+    hits += steps[k].hits;
+    misses += steps[k].misses;
+  }
+  qsort(preview, count, sizeof(double), _sort_double);
+  qsort(full, count, sizeof(double), _sort_double);
+  printf("%-40s %3d steps\n", label, count);
+  printf("  preview  p50 %8.1f ms   p90 %8.1f ms   max %8.1f ms\n", 1000.0 * _percentile(preview, count, 0.5),
+         1000.0 * _percentile(preview, count, 0.9), 1000.0 * preview[count - 1]);
+  printf("  full     p50 %8.1f ms   p90 %8.1f ms   max %8.1f ms\n", 1000.0 * _percentile(full, count, 0.5),
+         1000.0 * _percentile(full, count, 0.9), 1000.0 * full[count - 1]);
+  printf("  pixelpipe cache %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses\n", hits, misses);
+  free(preview);
+  free(full);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *image = NULL;
+  const char *script_file = NULL;
+  int width = 1920, height = 1080;
+  dt_dev_zoom_t zoom = DT_ZOOM_FIT;
+
+  char *m_arg[64] = { "ansel-bench-darkroom", "--library", ":memory:", "--conf", "write_sidecar_files=never" };
+  int m_argc = 5;
+
+  for(int k = 1; k < argc; k++)
+  {
+    const char *arg = argv[k];
+    const gboolean has_value = k + 1 < argc;
+    if((!strcmp(arg, "-i") || !strcmp(arg, "--image")) && has_value)
+      image = argv[++k];
+    else if((!strcmp(arg, "-s") || !strcmp(arg, "--script")) && has_value)
+      script_file = argv[++k];
+    else if(!strcmp(arg, "-W") && has_value)
+      width = atoi(argv[++k]);
+    else if(!strcmp(arg, "-H") && has_value)
+      height = atoi(argv[++k]);
+    else if(!strcmp(arg, "--zoom") && has_value)
+      zoom = !strcmp(argv[++k], "1") ? DT_ZOOM_1 : DT_ZOOM_FIT;
+    else if(!strcmp(arg, "--core"))
+    {
+      for(k++; k < argc && m_argc < G_N_ELEMENTS(m_arg) - 1; k++) m_arg[m_argc++] = argv[k];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  m_arg[m_argc] = NULL;
+
+  if(!image || width <= 0 || height <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  gchar *script = NULL;
+  if(script_file && !g_file_get_contents(script_file, &script, NULL, NULL))
+  {
+    fprintf(stderr, "[ansel-bench-darkroom] can't read script `%s'\n", script_file);
+    return 1;
+  }
+  if(!script) script = g_strdup(_default_script);
+
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL))
+  {
+    g_free(script);
+    return 1;
+  }
+
+  int res = 1;
+  gchar **lines = g_strsplit(script, "\n", -1);
+  g_free(script);
+
+  // a develop without GUI, with the two pipes of the darkroom
+  dt_develop_t dev;
+  dt_dev_init(&dev, FALSE);
+  dev.pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
+  dev.preview_pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
+  dt_dev_pixelpipe_init(dev.pipe);
+  dt_dev_pixelpipe_init_preview(dev.preview_pipe);
+  dev.width = width;
+  dev.height = height;
+  dt_control_set_dev_zoom(zoom);
+
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(image);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  const int32_t imgid = dt_image_import(filmid, image, TRUE);
+  if(!imgid || dt_dev_load_image(&dev, imgid))
+  {
+    fprintf(stderr, "[ansel-bench-darkroom] can't open image `%s'\n", image);
+    goto cleanup;
+  }
+
+  // first development, from empty caches
+  {
+    _preview_job_t job = { &dev, dt_get_wtime(), 0.0 };
+    GThread *preview = g_thread_new("preview", _preview_thread, &job);
+    dt_dev_process_image_job(&dev);
+    const double full = dt_get_wtime() - job.start;
+    g_thread_join(preview);
+    printf("%s, view %dx%d, %s\n", image, width, height, zoom == DT_ZOOM_1 ? "100 %" : "fit");
+    printf("first preview %.1f ms, full view %.1f ms\n\n", 1000.0 * job.time, 1000.0 * full);
+  }
+
+  for(int l = 0; lines[l]; l++)
+  {
+    gchar *line = g_strstrip(g_strdup(lines[l]));
+    gchar *comment = strchr(line, '#');
+    if(comment) *comment = '\0';
+    gchar **split = g_strsplit_set(g_strstrip(line), " \t", -1);
+    const char *words[6];
+    int count = 0;
+    for(int w = 0; split[w] && count < 6; w++)
+      if(*split[w]) words[count++] = split[w];
+
+    if(count == 3 || count == 5)
+    {
+      dt_iop_module_t *module = _find_module(&dev, words[0]);
+      const double from = g_ascii_strtod(words[2], NULL);
+      const double to = count == 5 ? g_ascii_strtod(words[3], NULL) : from;
+      const int steps = count == 5 ? MAX(1, atoi(words[4])) : 1;
+      if(!module)
+        fprintf(stderr, "[ansel-bench-darkroom] line %d: no module `%s'\n", l + 1, words[0]);
+      else
+      {
+        _step_t *results = calloc(steps, sizeof(_step_t));
+        gboolean valid = TRUE;
+        for(int s = 0; s < steps && valid; s++)
+        {
+          const double value = steps > 1 ? from + (to - from) * s / (steps - 1) : from;
+          valid = _set_param(module, words[1], value);
+          if(valid) _run_step(&dev, module, &results[s]);
+        }
+        if(valid)
+        {
+          gchar *label = g_strdup_printf("%d: %s.%s", l + 1, words[0], words[1]);
+          _report(label, results, steps);
+          g_free(label);
+        }
+        else
+          fprintf(stderr, "[ansel-bench-darkroom] line %d: `%s' has no numeric param `%s'\n", l + 1, words[0],
+                  words[1]);
+        free(results);
+      }
+    }
+    else if(count)
+      fprintf(stderr, "[ansel-bench-darkroom] line %d: expected `module param value [to steps]'\n", l + 1);
+
+    g_strfreev(split);
+    g_free(line);
+  }
+  res = 0;
+
+cleanup:
+  g_strfreev(lines);
+  dt_dev_cleanup(&dev);
+  dt_cleanup();
+  return res;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,350 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// ansel-bench-iop: microbenchmark of a single image operation.
+//
+// Runs process() and process_cl() of one module, with given params, on a synthetic RGBa float buffer or on
+// the downscaled mipmap of a real image, and reports the median and 95th percentile times and the throughput.
+// Only modules working on RGBa float buffers make sense here, raw modules would need a mosaiced input.
+
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/iop_profile.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s -m <operation> [-W <width>] [-H <height>] [-r <runs>] [-p <hex params>] [-i <image>]\n"
+                  "       [--cpu-only | --cl-only] [--core <ansel options>]\n\n"
+                  "  -m, --module   name of the module operation, e.g. `exposure'\n"
+                  "  -W, -H         size of the synthetic buffer, default 4000 x 3000\n"
+                  "  -r, --runs     number of timed runs, default 20\n"
+                  "  -p, --params   module params as an hex string, like the op_params of the library,\n"
+                  "                 the module defaults are used otherwise\n"
+                  "  -i, --image    process the float mipmap of this image instead of a synthetic buffer\n",
+          progname);
+}
+
+static dt_iop_module_so_t *_find_module_so(const char *op)
+{
+  for(GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+  {
+    dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+    if(!strcmp(so->op, op)) return so;
+  }
+  return NULL;
+}
+
+static gboolean _parse_params(const char *hex, uint8_t *params, const size_t size)
+{
+  if(strlen(hex) != 2 * size) return FALSE;
+
+  for(size_t k = 0; k < size; k++)
+  {
+    const int hi = g_ascii_xdigit_value(hex[2 * k]);
+    const int lo = g_ascii_xdigit_value(hex[2 * k + 1]);
+    if(hi < 0 || lo < 0) return FALSE;
+    params[k] = (uint8_t)(hi << 4 | lo);
+  }
+  return TRUE;
+}
+
+// smooth gradients with some noise, so modules don't hit trivial fast paths on flat or black pixels.
+static void _fill_synthetic(float *const buf, const int width, const int height)
+{
+  uint32_t state = 0x9e3779b9u;
+  for(int j = 0; j < height; j++)
+    for(int i = 0; i < width; i++)
+    {
+      float *const px = buf + 4 * ((size_t)j * width + i);
+      const float x = (float)i / width;
+      const float y = (float)j / height;
+      for(int c = 0; c < 3; c++)
+      {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const float noise = (float)(state & 0xffff) / 65535.0f - 0.5f;
+        px[c] = fmaxf(0.0f, 0.02f + x * (0.6f + 0.2f * c) * (0.5f + y) + 0.02f * noise);
+      }
+      px[3] = 0.0f;
+    }
+}
+
+static int _sort_double(const void *a, const void *b)
+{
+  const double da = *(const double *)a;
+  const double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static void _report(const char *label, double *times, const int runs, const size_t bytes)
+{
+  qsort(times, runs, sizeof(double), _sort_double);
+  const double median = times[runs / 2];
+  const double p95 = times[MIN(runs - 1, (int)ceil(0.95 * runs) - 1)];
+  printf("%-8s median %9.3f ms   p95 %9.3f ms   min %9.3f ms   %7.2f GB/s\n", label, 1000.0 * median,
+         1000.0 * p95, 1000.0 * times[0], (double)bytes / median / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *op = NULL;
+  const char *hex_params = NULL;
+  const char *image = NULL;
+  int width = 4000, height = 3000, runs = 20;
+  gboolean cpu = TRUE, cl = TRUE;
+
+  char *m_arg[64] = { "ansel-bench-iop", "--library", ":memory:", "--conf", "write_sidecar_files=never" };
+  int m_argc = 5;
+
+  for(int k = 1; k < argc; k++)
+  {
+    const char *arg = argv[k];
+    const gboolean has_value = k + 1 < argc;
+    if((!strcmp(arg, "-m") || !strcmp(arg, "--module")) && has_value)
+      op = argv[++k];
+    else if(!strcmp(arg, "-W") && has_value)
+      width = atoi(argv[++k]);
+    else if(!strcmp(arg, "-H") && has_value)
+      height = atoi(argv[++k]);
+    else if((!strcmp(arg, "-r") || !strcmp(arg, "--runs")) && has_value)
+      runs = atoi(argv[++k]);
+    else if((!strcmp(arg, "-p") || !strcmp(arg, "--params")) && has_value)
+      hex_params = argv[++k];
+    else if((!strcmp(arg, "-i") || !strcmp(arg, "--image")) && has_value)
+      image = argv[++k];
+    else if(!strcmp(arg, "--cpu-only"))
+      cl = FALSE;
+    else if(!strcmp(arg, "--cl-only"))
+      cpu = FALSE;
+    else if(!strcmp(arg, "--core"))
+    {
+      for(k++; k < argc && m_argc < G_N_ELEMENTS(m_arg) - 1; k++) m_arg[m_argc++] = argv[k];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  m_arg[m_argc] = NULL;
+
+  if(!op || width <= 0 || height <= 0 || runs <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if(dt_init(m_argc, m_arg, FALSE, TRUE, NULL)) return 1;
+
+  int res = 1;
+  dt_develop_t dev;
+  dt_dev_init(&dev, FALSE);
+  dt_mipmap_buffer_t buf = { 0 };
+  dt_iop_module_t *module = NULL;
+  dt_dev_pixelpipe_t pipe = { 0 };
+  gboolean pipe_inited = FALSE;
+  float *in = NULL, *out = NULL;
+  double *times = calloc(runs, sizeof(double));
+
+  dt_iop_module_so_t *so = _find_module_so(op);
+  if(!so)
+  {
+    fprintf(stderr, "[ansel-bench-iop] unknown module `%s'\n", op);
+    goto cleanup;
+  }
+
+  if(image)
+  {
+    dt_film_t film;
+    gchar *directory = g_path_get_dirname(image);
+    const int filmid = dt_film_new(&film, directory);
+    g_free(directory);
+    const int32_t imgid = dt_image_import(filmid, image, TRUE);
+    if(!imgid)
+    {
+      fprintf(stderr, "[ansel-bench-iop] can't open image `%s'\n", image);
+      goto cleanup;
+    }
+    dt_dev_load_image(&dev, imgid);
+    dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
+    if(!buf.buf || !buf.width || !buf.height)
+    {
+      fprintf(stderr, "[ansel-bench-iop] can't decode image `%s'\n", image);
+      goto cleanup;
+    }
+    width = buf.width;
+    height = buf.height;
+  }
+
+  // dt_iop_load_module() frees the module itself on failure
+  dt_iop_module_t *candidate = (dt_iop_module_t *)calloc(1, sizeof(dt_iop_module_t));
+  if(dt_iop_load_module(candidate, so, &dev))
+  {
+    fprintf(stderr, "[ansel-bench-iop] can't load module `%s'\n", op);
+    goto cleanup;
+  }
+  module = candidate;
+  if(module->reload_defaults) module->reload_defaults(module);
+  memcpy(module->params, module->default_params, module->params_size);
+  module->enabled = TRUE;
+
+  if(hex_params && !_parse_params(hex_params, (uint8_t *)module->params, module->params_size))
+  {
+    fprintf(stderr, "[ansel-bench-iop] params of `%s' have to be %d bytes, given as %d hex digits\n", op,
+            module->params_size, 2 * module->params_size);
+    goto cleanup;
+  }
+
+  // a pipe of a single node, working in linear Rec2020 RGB
+  dt_dev_pixelpipe_init_dummy(&pipe, width, height);
+  pipe_inited = TRUE;
+  pipe.image = dev.image_storage;
+  pipe.iwidth = pipe.processed_width = width;
+  pipe.iheight = pipe.processed_height = height;
+  pipe.iscale = 1.0f;
+  pipe.dsc.channels = 4;
+  pipe.dsc.datatype = TYPE_FLOAT;
+  pipe.dsc.cst = IOP_CS_RGB;
+  for(int c = 0; c < 4; c++) pipe.dsc.processed_maximum[c] = 1.0f;
+  dt_ioppr_set_pipe_work_profile_info(&dev, &pipe, DT_COLORSPACE_LIN_REC2020, "", DT_INTENT_PERCEPTUAL);
+
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)calloc(1, sizeof(dt_dev_pixelpipe_iop_t));
+  piece->module = module;
+  piece->pipe = &pipe;
+  piece->enabled = TRUE;
+  piece->colors = 4;
+  piece->iscale = 1.0f;
+  piece->iwidth = width;
+  piece->iheight = height;
+  piece->buf_in = piece->buf_out = (dt_iop_roi_t){ 0, 0, width, height, 1.0f };
+  piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
+  // cleaned up with the pipe
+  pipe.nodes = g_list_append(NULL, piece);
+  pipe.pieces = (dt_dev_pixelpipe_iop_t **)calloc(1, sizeof(dt_dev_pixelpipe_iop_t *));
+  pipe.pieces[pipe.num_pieces++] = piece;
+  dt_iop_init_pipe(module, &pipe, piece);
+  dt_iop_commit_params(module, module->params, module->default_blendop_params, &pipe, piece);
+  piece->dsc_in = piece->dsc_out = pipe.dsc;
+
+  const dt_iop_roi_t roi_out = { 0, 0, width, height, 1.0f };
+  dt_iop_roi_t roi_in = roi_out;
+  module->modify_roi_in(module, piece, &roi_out, &roi_in);
+  piece->processed_roi_in = piece->planned_roi_in = roi_in;
+  piece->processed_roi_out = piece->planned_roi_out = roi_out;
+
+  const size_t in_pixels = (size_t)roi_in.width * roi_in.height;
+  const size_t out_pixels = (size_t)roi_out.width * roi_out.height;
+  const size_t bytes = (in_pixels + out_pixels) * 4 * sizeof(float);
+  in = dt_alloc_align_float(4 * in_pixels);
+  out = dt_alloc_align_float(4 * out_pixels);
+  if(!in || !out)
+  {
+    fprintf(stderr, "[ansel-bench-iop] out of memory for %dx%d buffers\n", width, height);
+    goto cleanup;
+  }
+
+  if(buf.buf && roi_in.width == width && roi_in.height == height)
+    memcpy(in, buf.buf, 4 * sizeof(float) * in_pixels);
+  else
+    _fill_synthetic(in, roi_in.width, roi_in.height);
+
+  printf("%s (%s) on %dx%d -> %dx%d, %d runs, %d threads\n", op, image ? image : "synthetic", roi_in.width,
+         roi_in.height, roi_out.width, roi_out.height, runs, (int)dt_get_num_threads());
+
+  if(cpu)
+  {
+    // one warm-up run to page the buffers in and init the lazy module data
+    module->process(module, piece, in, out, &roi_in, &roi_out);
+    for(int r = 0; r < runs; r++)
+    {
+      const double start = dt_get_wtime();
+      module->process(module, piece, in, out, &roi_in, &roi_out);
+      times[r] = dt_get_wtime() - start;
+    }
+    _report("cpu", times, runs, bytes);
+  }
+
+#ifdef HAVE_OPENCL
+  if(cl && darktable.opencl->inited && module->process_cl && piece->process_cl_ready)
+  {
+    const int devid = dt_opencl_lock_device(pipe.type);
+    if(devid >= 0)
+    {
+      pipe.devid = devid;
+      cl_mem dev_in = dt_opencl_copy_host_to_device(devid, in, roi_in.width, roi_in.height, 4 * sizeof(float));
+      cl_mem dev_out = dt_opencl_alloc_device(devid, roi_out.width, roi_out.height, 4 * sizeof(float));
+      gboolean success = dev_in && dev_out;
+      for(int r = -1; r < runs && success; r++)
+      {
+        const double start = dt_get_wtime();
+        success = module->process_cl(module, piece, dev_in, dev_out, &roi_in, &roi_out)
+                  && dt_opencl_finish(devid);
+        if(r >= 0) times[r] = dt_get_wtime() - start;
+      }
+      if(success)
+        _report("opencl", times, runs, bytes);
+      else
+        fprintf(stderr, "[ansel-bench-iop] process_cl() of `%s' failed\n", op);
+      dt_opencl_release_mem_object(dev_in);
+      dt_opencl_release_mem_object(dev_out);
+      dt_opencl_unlock_device(devid);
+      pipe.devid = -1;
+    }
+  }
+#endif
+  res = 0;
+
+cleanup:
+  dt_free_align(in);
+  dt_free_align(out);
+  free(times);
+  if(pipe_inited) dt_dev_pixelpipe_cleanup(&pipe);
+  if(module)
+  {
+    dt_iop_cleanup_module(module);
+    free(module);
+  }
+  if(buf.buf) dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+  dt_dev_cleanup(&dev);
+  dt_cleanup();
+  return res;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
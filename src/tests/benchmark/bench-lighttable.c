@@ -0,0 +1,378 @@
+/*
+    This file is part of ansel,
+    Copyright (C) 2026 ansel developers.
+
+    ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// ansel-bench-lighttable: scrolling and thumbnail throughput of the lighttable.
+//
+// Builds a library of N copies of one image in a work directory, opens it in the lighttable and scrolls the
+// thumbtable with dt_thumbtable_set_offset() at fixed speeds, one step per frame. For each speed it reports the
+// frames where all visible thumbnails were shown at their final size, the mipmap cache hit ratio, the length
+// of the thumbnail job queue, and the time to get all thumbnails once the scrolling stops.
+//
+// The library and the mipmap disk cache stay in the work directory: the first run starts from a cold disk
+// cache, the next ones from a warm one. --cold empties it first. This needs a display, as the whole GUI runs.
+
+#include "common/collection.h"
+#include "common/darktable.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/metrics.h"
+#include "control/control.h"
+#include "dtgtk/thumbnail.h"
+#include "dtgtk/thumbtable.h"
+#include "gui/gtk.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// one tick per frame at 60 fps
+#define FRAME_MS 16
+// give up waiting for the thumbnails after this many seconds
+#define SETTLE_TIMEOUT 120.0
+
+typedef enum _state_t
+{
+  STATE_FIRST_SCREEN = 0, // waiting for the thumbnails of the first screen
+  STATE_SCROLL,           // scrolling at speeds[speed]
+  STATE_SETTLE,           // waiting for the thumbnails after the scrolling stopped
+  STATE_REWIND,           // back to the top, waiting for its thumbnails before the next speed
+} _state_t;
+
+typedef struct _bench_t
+{
+  float speeds[8]; // rows per second
+  int nb_speeds;
+  int speed;
+  _state_t state;
+  double state_start;
+  double last_tick;
+  float rows; // fractional rows scrolled and not yet applied
+  double scroll_time;
+  int count;  // images in the collection
+
+  // of the current speed
+  int frames, complete_frames;
+  uint64_t queue_total;
+  int queue_max;
+  uint64_t mipmap_hits, mipmap_misses;
+} _bench_t;
+
+static void usage(const char *progname)
+{
+  fprintf(stderr, "usage: %s -i <image> -d <work directory> [-n <images>] [-s <rows per second>,...] [--cold]\n"
+                  "       [--core <ansel options>]\n\n"
+                  "  -i, --image    image copied to build the library, a raw with an embedded JPEG is best\n"
+                  "  -d, --dir      where the images, library and caches are kept between runs\n"
+                  "  -n             number of images of the library, default 2000\n"
+                  "  -s, --speeds   scrolling speeds in rows per second, default 2,8,32\n"
+                  "  --cold         empty the mipmap disk cache before running\n",
+          progname);
+}
+
+static void _remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if(dir)
+  {
+    const gchar *name;
+    while((name = g_dir_read_name(dir)))
+    {
+      gchar *child = g_build_filename(path, name, NULL);
+      _remove_tree(child);
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+  g_remove(path);
+}
+
+// copies of the source image, a thumbnail cache entry per copy
+static gboolean _make_images(const char *source, const char *directory, const int count)
+{
+  const char *ext = strrchr(source, '.');
+  GFile *src = g_file_new_for_path(source);
+  gboolean ok = TRUE;
+  for(int k = 0; k < count && ok; k++)
+  {
+    gchar *name = g_strdup_printf("bench-%05d%s", k, ext ? ext : "");
+    gchar *path = g_build_filename(directory, name, NULL);
+    if(!g_file_test(path, G_FILE_TEST_EXISTS))
+    {
+      GFile *dst = g_file_new_for_path(path);
+      ok = g_file_copy(src, dst, G_FILE_COPY_NONE, NULL, NULL, NULL, NULL);
+      g_object_unref(dst);
+    }
+    g_free(path);
+    g_free(name);
+  }
+  g_object_unref(src);
+  return ok;
+}
+
+static void _mipmap_counters(uint64_t *hits, uint64_t *misses)
+{
+  dt_metrics_snapshot_t snapshot;
+  dt_metrics_snapshot(&snapshot);
+  *hits = snapshot.counters[DT_METRICS_MIPMAP_CACHE_HIT];
+  *misses = snapshot.counters[DT_METRICS_MIPMAP_CACHE_MISS];
+  dt_metrics_snapshot_cleanup(&snapshot);
+}
+
+// thumbnails shown at their final size, over the ones in the view
+static int _thumbs_ready(const dt_thumbtable_t *table, int *total)
+{
+  int ready = 0;
+  *total = 0;
+  for(const GList *l = table->list; l; l = g_list_next(l))
+  {
+    const dt_thumbnail_t *thumb = (const dt_thumbnail_t *)l->data;
+    (*total)++;
+    if(thumb->img_surf && !thumb->img_surf_dirty) ready++;
+  }
+  return ready;
+}
+
+static void _start_speed(_bench_t *b, const double now)
+{
+  b->state = STATE_SCROLL;
+  b->state_start = now;
+  b->rows = 0.0f;
+  b->frames = b->complete_frames = 0;
+  b->queue_total = 0;
+  b->queue_max = 0;
+  _mipmap_counters(&b->mipmap_hits, &b->mipmap_misses);
+}
+
+static void _report_speed(_bench_t *b, const double scroll_time, const double settle_time)
+{
+  uint64_t hits, misses;
+  _mipmap_counters(&hits, &misses);
+  hits -= b->mipmap_hits;
+  misses -= b->mipmap_misses;
+
+  printf("%5.1f rows/s   %5.1f s   frames %5d, complete %5.1f %%   mipmap hits %5.1f %%   "
+         "queue avg %5.1f max %4d   all visible after %7.1f ms\n",
+         b->speeds[b->speed], scroll_time, b->frames, 100.0 * b->complete_frames / MAX(b->frames, 1),
+         100.0 * hits / MAX(hits + misses, 1), (double)b->queue_total / MAX(b->frames, 1), b->queue_max,
+         1000.0 * settle_time);
+}
+
+static gboolean _tick(gpointer user_data)
+{
+  _bench_t *b = (_bench_t *)user_data;
+  dt_thumbtable_t *table = dt_ui_thumbtable(darktable.gui->ui);
+  const double now = dt_get_wtime();
+  const double dt = now - b->last_tick;
+  b->last_tick = now;
+
+  int total = 0;
+  const int ready = _thumbs_ready(table, &total);
+  const gboolean all_ready = total > 0 && ready == total;
+  const gboolean timeout = now - b->state_start > SETTLE_TIMEOUT;
+
+  switch(b->state)
+  {
+    case STATE_FIRST_SCREEN:
+      if(all_ready || timeout)
+      {
+        printf("first screen: %d thumbnails in %.1f ms%s\n\n", total, 1000.0 * (now - b->state_start),
+               timeout ? " (timed out)" : "");
+        _start_speed(b, now);
+      }
+      break;
+
+    case STATE_SCROLL:
+    {
+      const int queue = dt_atomic_get_int(&darktable.control->queue_length[DT_JOB_QUEUE_SYSTEM_FG]);
+      b->frames++;
+      if(all_ready) b->complete_frames++;
+      b->queue_total += queue;
+      b->queue_max = MAX(b->queue_max, queue);
+
+      b->rows += b->speeds[b->speed] * dt;
+      const int rows = (int)b->rows;
+      if(rows > 0)
+      {
+        b->rows -= rows;
+        const int last = MAX(1, b->count - table->thumbs_per_row * (table->rows - 1));
+        const int offset = MIN(table->offset + rows * table->thumbs_per_row, last);
+        if(!dt_thumbtable_set_offset(table, offset, TRUE))
+        {
+          // reached the end of the collection
+          b->state = STATE_SETTLE;
+          b->scroll_time = now - b->state_start;
+          b->state_start = now;
+        }
+      }
+      break;
+    }
+
+    case STATE_SETTLE:
+      if(all_ready || timeout)
+      {
+        _report_speed(b, b->scroll_time, now - b->state_start);
+        b->speed++;
+        b->state = STATE_REWIND;
+        b->state_start = now;
+        dt_thumbtable_set_offset(table, 1, TRUE);
+      }
+      break;
+
+    case STATE_REWIND:
+      if(b->speed >= b->nb_speeds)
+      {
+        dt_control_quit();
+        return G_SOURCE_REMOVE;
+      }
+      if(all_ready || timeout) _start_speed(b, now);
+      break;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *image = NULL;
+  const char *workdir = NULL;
+  const char *speeds = "2,8,32";
+  int count = 2000;
+  gboolean cold = FALSE;
+
+  char *m_arg[64] = { "ansel-bench-lighttable", "--conf", "write_sidecar_files=never",
+                      "--conf", "cache_disk_backend=TRUE" };
+  int m_argc = 5;
+  int core_argc = 0;
+  char *core_arg[48];
+
+  for(int k = 1; k < argc; k++)
+  {
+    const char *arg = argv[k];
+    const gboolean has_value = k + 1 < argc;
+    if((!strcmp(arg, "-i") || !strcmp(arg, "--image")) && has_value)
+      image = argv[++k];
+    else if((!strcmp(arg, "-d") || !strcmp(arg, "--dir")) && has_value)
+      workdir = argv[++k];
+    else if(!strcmp(arg, "-n") && has_value)
+      count = atoi(argv[++k]);
+    else if((!strcmp(arg, "-s") || !strcmp(arg, "--speeds")) && has_value)
+      speeds = argv[++k];
+    else if(!strcmp(arg, "--cold"))
+      cold = TRUE;
+    else if(!strcmp(arg, "--core"))
+    {
+      for(k++; k < argc && core_argc < G_N_ELEMENTS(core_arg); k++) core_arg[core_argc++] = argv[k];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  _bench_t bench = { { 0 } };
+  gchar **split = g_strsplit(speeds, ",", -1);
+  for(int k = 0; split[k] && bench.nb_speeds < G_N_ELEMENTS(bench.speeds); k++)
+  {
+    const float speed = g_ascii_strtod(split[k], NULL);
+    if(speed > 0.0f) bench.speeds[bench.nb_speeds++] = speed;
+  }
+  g_strfreev(split);
+
+  if(!image || !workdir || count <= 0 || !bench.nb_speeds)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  gchar *images = g_build_filename(workdir, "images", NULL);
+  gchar *library = g_build_filename(workdir, "library.db", NULL);
+  gchar *configdir = g_build_filename(workdir, "config", NULL);
+  gchar *cachedir = g_build_filename(workdir, "cache", NULL);
+  if(cold) _remove_tree(cachedir);
+  const gboolean warm = g_file_test(cachedir, G_FILE_TEST_IS_DIR);
+  g_mkdir_with_parents(images, 0755);
+  g_mkdir_with_parents(configdir, 0755);
+  g_mkdir_with_parents(cachedir, 0755);
+
+  m_arg[m_argc++] = "--library";
+  m_arg[m_argc++] = library;
+  m_arg[m_argc++] = "--configdir";
+  m_arg[m_argc++] = configdir;
+  m_arg[m_argc++] = "--cachedir";
+  m_arg[m_argc++] = cachedir;
+  for(int k = 0; k < core_argc && m_argc < G_N_ELEMENTS(m_arg) - 1; k++) m_arg[m_argc++] = core_arg[k];
+  m_arg[m_argc] = NULL;
+
+  int res = 1;
+  printf("creating %d images...\n", count);
+  if(!_make_images(image, images, count))
+  {
+    fprintf(stderr, "[ansel-bench-lighttable] can't copy `%s' to `%s'\n", image, images);
+    goto cleanup;
+  }
+
+  if(dt_init(m_argc, m_arg, TRUE, TRUE, NULL)) goto cleanup;
+
+  // importing the images the library already has only finds their ids
+  dt_film_t film;
+  const int filmid = dt_film_new(&film, images);
+  GDir *dir = g_dir_open(images, 0, NULL);
+  const gchar *name;
+  while(dir && (name = g_dir_read_name(dir)))
+  {
+    gchar *path = g_build_filename(images, name, NULL);
+    dt_image_import(filmid, path, FALSE);
+    g_free(path);
+  }
+  if(dir) g_dir_close(dir);
+
+  dt_film_open(filmid);
+  dt_ctl_switch_mode_to("lighttable");
+  bench.count = dt_collection_get_count(darktable.collection);
+  printf("%d images, %s disk cache\n", bench.count, warm ? "warm" : "cold");
+
+  const double now = dt_get_wtime();
+  bench.state = STATE_FIRST_SCREEN;
+  bench.state_start = bench.last_tick = now;
+  g_timeout_add(FRAME_MS, _tick, &bench);
+
+  // runs until _tick() quits, and cleans up
+  dt_gui_gtk_run(darktable.gui);
+  res = 0;
+
+cleanup:
+  g_free(images);
+  g_free(library);
+  g_free(configdir);
+  g_free(cachedir);
+  return res;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
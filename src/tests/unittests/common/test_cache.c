@@ -0,0 +1,163 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the sharded cache in common/cache.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "common/cache.h"
+#include "common/darktable.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define NKEYS 20000
+
+// the shards have to agree with each other and with the global cost
+static void _check_consistency(dt_cache_t *cache)
+{
+  size_t cost = 0;
+  guint entries = 0;
+  for(uint32_t k = 0; k < (1u << cache->shard_bits); k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    assert_int_equal(g_hash_table_size(shard->hashtable), shard->clock->len);
+    size_t shard_cost = 0;
+    for(guint i = 0; i < shard->clock->len; i++)
+    {
+      dt_cache_entry_t *entry = g_ptr_array_index(shard->clock, i);
+      assert_int_equal(entry->_slot, i);
+      assert_ptr_equal(g_hash_table_lookup(shard->hashtable, GINT_TO_POINTER(entry->key)), entry);
+      shard_cost += entry->cost;
+    }
+    assert_int_equal(shard_cost, shard->cost);
+    cost += shard_cost;
+    entries += shard->clock->len;
+  }
+  assert_int_equal(cost, cache->cost);
+  // every entry costs 1 here
+  assert_int_equal(entries, cache->cost);
+}
+
+static void test_get_remove(void **state)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 64, 1000);
+
+  for(uint32_t key = 0; key < 100; key++)
+  {
+    assert_false(dt_cache_contains(&cache, key));
+    dt_cache_entry_t *entry = dt_cache_get(&cache, key, 'w');
+    assert_non_null(entry);
+    assert_int_equal(entry->key, key);
+    *(uint32_t *)entry->data = key;
+    dt_cache_release(&cache, entry);
+    assert_true(dt_cache_contains(&cache, key));
+  }
+  assert_int_equal(cache.cost, 100);
+
+  for(uint32_t key = 0; key < 100; key++)
+  {
+    dt_cache_entry_t *entry = dt_cache_testget(&cache, key, 'r');
+    assert_non_null(entry);
+    assert_int_equal(*(uint32_t *)entry->data, key);
+    dt_cache_release(&cache, entry);
+  }
+  assert_null(dt_cache_testget(&cache, 1000, 'r'));
+
+  for(uint32_t key = 0; key < 100; key += 2) assert_int_equal(dt_cache_remove(&cache, key), 0);
+  assert_int_equal(dt_cache_remove(&cache, 0), 1);
+  assert_int_equal(cache.cost, 50);
+  _check_consistency(&cache);
+
+  dt_cache_cleanup(&cache);
+}
+
+static void test_quota(void **state)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 64, 100);
+
+  for(uint32_t key = 0; key < NKEYS; key++)
+  {
+    dt_cache_entry_t *entry = dt_cache_get(&cache, key, 'r');
+    dt_cache_release(&cache, entry);
+    // collection kicks in above 80% and brings it back below, plus the new entry
+    assert_true(cache.cost <= 81);
+  }
+  _check_consistency(&cache);
+
+  dt_cache_gc(&cache, 0.0f);
+  assert_int_equal(cache.cost, 0);
+  _check_consistency(&cache);
+
+  dt_cache_cleanup(&cache);
+}
+
+static void test_concurrent(void **state)
+{
+  dt_cache_t cache;
+  // really hammer it, make quota insanely low:
+  dt_cache_init(&cache, 64, 16);
+
+  int errors = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(guided) shared(cache) reduction(+ : errors) num_threads(16)
+#endif
+  for(int k = 0; k < NKEYS; k++)
+  {
+    // a few hot keys shared by all threads, and a lot of cold ones
+    const uint32_t key = (k % 3) ? (uint32_t)k : (uint32_t)(k % 7);
+    dt_cache_entry_t *entry = dt_cache_get(&cache, key, 'w');
+    *(uint32_t *)entry->data = key;
+    dt_cache_release(&cache, entry);
+    entry = dt_cache_get(&cache, key, 'r');
+    if(*(uint32_t *)entry->data != key) errors++;
+    dt_cache_release(&cache, entry);
+  }
+  assert_int_equal(errors, 0);
+  _check_consistency(&cache);
+
+  dt_cache_cleanup(&cache);
+}
+
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_get_remove),
+    cmocka_unit_test(test_quota),
+    cmocka_unit_test(test_concurrent),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
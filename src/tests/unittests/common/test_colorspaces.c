@@ -0,0 +1,176 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the polynomial approximations in common/math.h and the
+ * row conversions in common/colorspaces_inline_conversions.h
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+
+#include "common/colorspaces_inline_conversions.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// number of pixels per test row, enough to cover the vectorized body and a scalar tail
+#define NPIXELS 1027
+
+// double precision version of the per-channel PQ curve of JzAzBz
+static double _PQ(const double x)
+{
+  const double xn = pow(fmax(x / 10000.0, 0.0), 0.159301758);
+  return pow((0.8359375 + 18.8515625 * xn) / (1.0 + 18.6875 * xn), 134.034375);
+}
+
+// double precision version of dt_XYZ_2_JzAzBz()
+static void _XYZ_2_JzAzBz_ref(const float *const XYZ_D65, double JzAzBz[3])
+{
+  const double X = 1.15 * XYZ_D65[0] - 0.15 * XYZ_D65[2];
+  const double Y = 0.66 * XYZ_D65[1] + 0.34 * XYZ_D65[0];
+  const double Z = XYZ_D65[2];
+  const double L = _PQ(0.41478972 * X + 0.579999 * Y + 0.0146480 * Z);
+  const double M = _PQ(-0.2015100 * X + 1.120649 * Y + 0.0531008 * Z);
+  const double S = _PQ(-0.0166008 * X + 0.264800 * Y + 0.6684799 * Z);
+  const double Iz = 0.5 * L + 0.5 * M;
+  JzAzBz[0] = fmax(0.44 * Iz / (1.0 - 0.56 * Iz) - 1.6295499532821566e-11, 0.0);
+  JzAzBz[1] = 3.524000 * L - 4.066708 * M + 0.542708 * S;
+  JzAzBz[2] = 0.199076 * L + 1.096799 * M - 1.295875 * S;
+}
+
+// fill a row with XYZ values covering [0, 1] on each channel
+static void _fill_XYZ(float *const XYZ, const size_t npixels)
+{
+  unsigned int state = 1;
+  for(size_t k = 0; k < 4 * npixels; k++)
+  {
+    state = state * 1103515245u + 12345u;
+    XYZ[k] = (float)(state >> 8) / (float)(1 << 24);
+  }
+}
+
+static void test_fast_log2f(void **state)
+{
+  for(float x = 1e-37f; x < 1e37f; x *= 1.0137f)
+  {
+    const double expected = log2((double)x);
+    assert_float_equal(dt_fast_log2f(x), expected, 2e-7 * fmax(1.0, fabs(expected)));
+  }
+}
+
+static void test_fast_exp2f(void **state)
+{
+  for(float x = -125.0f; x < 125.0f; x += 0.0173f)
+  {
+    const double expected = exp2((double)x);
+    assert_float_equal(dt_fast_exp2f(x), expected, 2e-7 * expected);
+  }
+}
+
+static void test_fast_powf(void **state)
+{
+  assert_float_equal(dt_fast_powf(0.0f, 0.5f), 0.0f, 1e-30f);
+  assert_float_equal(dt_fast_powf(1.0f, 134.0f), 1.0f, 1e-7f);
+  for(float x = 1e-3f; x <= 1.0f; x += 1.3e-3f)
+    for(float y = 0.1f; y < 140.0f; y *= 1.7f)
+    {
+      const double expected = pow((double)x, (double)y);
+      if(expected < 1e-30) continue;
+      assert_float_equal(dt_fast_powf(x, y), expected, 2e-6 * fmax(1.0, y) * expected);
+    }
+}
+
+static void test_Lab_row(void **state)
+{
+  float *const XYZ = dt_alloc_align_float(4 * NPIXELS);
+  float *const Lab = dt_alloc_align_float(4 * NPIXELS);
+  float *const back = dt_alloc_align_float(4 * NPIXELS);
+  _fill_XYZ(XYZ, NPIXELS);
+
+  dt_XYZ_to_Lab_row(XYZ, Lab, NPIXELS);
+  dt_Lab_to_XYZ_row(Lab, back, NPIXELS);
+  for(size_t k = 0; k < NPIXELS; k++)
+  {
+    dt_aligned_pixel_t expected;
+    dt_XYZ_to_Lab(XYZ + 4 * k, expected);
+    for(int c = 0; c < 3; c++)
+    {
+      assert_float_equal(Lab[4 * k + c], expected[c], 1e-3f);
+      assert_float_equal(back[4 * k + c], XYZ[4 * k + c], 1e-4f);
+    }
+    assert_float_equal(Lab[4 * k + 3], XYZ[4 * k + 3], 0.0f);
+  }
+
+  dt_free_align(XYZ);
+  dt_free_align(Lab);
+  dt_free_align(back);
+}
+
+static void test_JzAzBz_row(void **state)
+{
+  float *const XYZ = dt_alloc_align_float(4 * NPIXELS);
+  float *const JzAzBz = dt_alloc_align_float(4 * NPIXELS);
+  float *const back = dt_alloc_align_float(4 * NPIXELS);
+  _fill_XYZ(XYZ, NPIXELS);
+
+  dt_XYZ_2_JzAzBz_row(XYZ, JzAzBz, NPIXELS);
+  dt_JzAzBz_2_XYZ_row(JzAzBz, back, NPIXELS);
+  for(size_t k = 0; k < NPIXELS; k++)
+  {
+    double expected[3];
+    _XYZ_2_JzAzBz_ref(XYZ + 4 * k, expected);
+    const double tolerance = 1e-3 * fmax(expected[0], 1e-4);
+    for(int c = 0; c < 3; c++)
+    {
+      assert_float_equal(JzAzBz[4 * k + c], expected[c], tolerance);
+      assert_float_equal(back[4 * k + c], XYZ[4 * k + c], 1e-2f * fmaxf(XYZ[4 * k + c], 1e-2f));
+    }
+  }
+
+  dt_free_align(XYZ);
+  dt_free_align(JzAzBz);
+  dt_free_align(back);
+}
+
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fast_log2f),
+    cmocka_unit_test(test_fast_exp2f),
+    cmocka_unit_test(test_fast_powf),
+    cmocka_unit_test(test_Lab_row),
+    cmocka_unit_test(test_JzAzBz_row),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
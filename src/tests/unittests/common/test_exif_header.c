@@ -0,0 +1,273 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the header-only exif reader in common/exif_header.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "common/exif_header.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define ASCII 2
+#define SHORT 3
+#define LONG 4
+#define RATIONAL 5
+#define UNDEFINED 7
+
+typedef struct tag_t
+{
+  uint16_t tag;
+  uint16_t type;
+  uint32_t count;
+  uint32_t values[6]; // numbers, or rationals as numerator, denominator
+  const char *text;   // ascii and undefined
+} tag_t;
+
+typedef struct tiff_t
+{
+  uint8_t data[4096];
+  size_t len;
+  int motorola;
+} tiff_t;
+
+static void put16(tiff_t *t, size_t pos, uint16_t v)
+{
+  t->data[pos + (t->motorola ? 0 : 1)] = v >> 8;
+  t->data[pos + (t->motorola ? 1 : 0)] = v & 0xff;
+}
+
+static void put32(tiff_t *t, size_t pos, uint32_t v)
+{
+  put16(t, pos + (t->motorola ? 0 : 2), v >> 16);
+  put16(t, pos + (t->motorola ? 2 : 0), v & 0xffff);
+}
+
+static size_t type_size(uint16_t type)
+{
+  return type == SHORT ? 2 : type == LONG ? 4 : type == RATIONAL ? 8 : 1;
+}
+
+// append an ifd and its values, returns its offset. pointers to other ifds are LONG tags
+static uint32_t add_ifd(tiff_t *t, const tag_t *tags, int n)
+{
+  const uint32_t at = t->len;
+  size_t values = at + 2 + 12 * n + 4;
+  put16(t, at, n);
+  for(int k = 0; k < n; k++)
+  {
+    const tag_t *tag = tags + k;
+    const size_t e = at + 2 + 12 * k;
+    const size_t size = type_size(tag->type) * tag->count;
+    put16(t, e, tag->tag);
+    put16(t, e + 2, tag->type);
+    put32(t, e + 4, tag->count);
+    size_t pos = e + 8;
+    if(size > 4)
+    {
+      put32(t, e + 8, values);
+      pos = values;
+      values += (size + 1) & ~1;
+    }
+    if(tag->text)
+      memcpy(t->data + pos, tag->text, tag->count);
+    else
+      for(uint32_t i = 0; i < tag->count * (tag->type == RATIONAL ? 2 : 1); i++)
+      {
+        if(tag->type == SHORT)
+          put16(t, pos + 2 * i, tag->values[i]);
+        else
+          put32(t, pos + 4 * i, tag->values[i]);
+      }
+  }
+  put32(t, at + 2 + 12 * n, 0);
+  t->len = values;
+  return at;
+}
+
+#define STR(tag, s) { tag, ASCII, sizeof(s), { 0 }, s }
+
+// a tiff with everything main.images needs, the exif and gps ifds go right after the header
+static void make_tiff(tiff_t *t, int motorola, const char *maker, const tag_t *extra, int n_extra,
+                      const tag_t *extra_exif, int n_extra_exif)
+{
+  memset(t, 0, sizeof(tiff_t));
+  t->motorola = motorola;
+  t->data[0] = t->data[1] = motorola ? 'M' : 'I';
+  put16(t, 2, 42);
+  t->len = 8;
+
+  tag_t exif[16] = {
+    { 0x829A, RATIONAL, 1, { 1, 250 }, NULL },
+    { 0x829D, RATIONAL, 1, { 28, 10 }, NULL },
+    { 0x8827, SHORT, 1, { 400 }, NULL },
+    STR(0x9003, "2024:05:17 10:11:12"),
+    { 0x920A, RATIONAL, 1, { 35, 1 }, NULL },
+    STR(0x9291, "42"),
+    { 0xA405, SHORT, 1, { 53 }, NULL },
+    STR(0xA434, "XF35mmF1.4 R"),
+  };
+  int n_exif = 8;
+  for(int k = 0; k < n_extra_exif; k++) exif[n_exif++] = extra_exif[k];
+  const uint32_t exif_ifd = add_ifd(t, exif, n_exif);
+
+  const tag_t gps[] = {
+    STR(0x0001, "N"),
+    { 0x0002, RATIONAL, 3, { 48, 1, 30, 1, 0, 1 }, NULL },
+    STR(0x0003, "W"),
+    { 0x0004, RATIONAL, 3, { 2, 1, 15, 1, 30, 1 }, NULL },
+  };
+  const uint32_t gps_ifd = add_ifd(t, gps, G_N_ELEMENTS(gps));
+
+  tag_t ifd0[16] = {
+    { 0x010F, ASCII, strlen(maker) + 1, { 0 }, maker },
+    STR(0x0110, "X-T3  "),
+    { 0x0112, SHORT, 1, { 6 }, NULL },
+    { 0x8769, LONG, 1, { exif_ifd }, NULL },
+    { 0x8825, LONG, 1, { gps_ifd }, NULL },
+  };
+  int n = 5;
+  for(int k = 0; k < n_extra; k++) ifd0[n++] = extra[k];
+  put32(t, 4, add_ifd(t, ifd0, n));
+}
+
+static void test_tiff(void **state)
+{
+  for(int motorola = 0; motorola < 2; motorola++)
+  {
+    tiff_t t;
+    make_tiff(&t, motorola, "FUJIFILM", NULL, 0, NULL, 0);
+
+    dt_exif_header_t h;
+    assert_true(dt_exif_header_parse(&h, t.data, t.len));
+    assert_string_equal(h.maker, "FUJIFILM");
+    assert_string_equal(h.model, "X-T3");
+    assert_string_equal(h.lens, "XF35mmF1.4 R");
+    assert_string_equal(h.datetime, "2024:05:17 10:11:12");
+    assert_string_equal(h.subsec, "42");
+    assert_float_equal(h.exposure, 1.0f / 250.0f, 1e-6f);
+    assert_float_equal(h.aperture, 2.8f, 1e-6f);
+    assert_float_equal(h.iso, 400.0f, 0.0f);
+    assert_float_equal(h.focal_length, 35.0f, 0.0f);
+    assert_true(h.has_focal_length_35mm);
+    assert_float_equal(h.focal_length_35mm, 53.0f, 0.0f);
+    assert_int_equal(h.orientation, 6);
+    assert_int_equal(h.rating, -2);
+    assert_true(h.has_latitude);
+    assert_int_equal(h.gps_latitude_ref, 'N');
+    assert_float_equal(h.gps_latitude[2], 30.0, 0.0);
+    assert_true(h.has_longitude);
+    assert_int_equal(h.gps_longitude_ref, 'W');
+    assert_float_equal(h.gps_longitude[4], 30.0, 0.0);
+    assert_false(h.has_elevation);
+    dt_exif_header_cleanup(&h);
+  }
+}
+
+// whatever only exiv2 decodes sends the file there
+static void test_exiv2_fallback(void **state)
+{
+  const tag_t xmp[] = { { 0x02BC, UNDEFINED, 4, { 0 }, "<x:x" } };
+  const tag_t dng[] = { { 0xC612, UNDEFINED, 4, { 0 }, "\1\4\0\0" } };
+  const tag_t makernote[] = { { 0x927C, UNDEFINED, 4, { 0 }, "abcd" } };
+  tiff_t t;
+  dt_exif_header_t h;
+
+  make_tiff(&t, 0, "FUJIFILM", xmp, 1, NULL, 0);
+  assert_false(dt_exif_header_parse(&h, t.data, t.len));
+  make_tiff(&t, 0, "FUJIFILM", dng, 1, NULL, 0);
+  assert_false(dt_exif_header_parse(&h, t.data, t.len));
+
+  // the maker note only matters for the makers exiv2 takes lens and focus distance from
+  make_tiff(&t, 0, "FUJIFILM", NULL, 0, makernote, 1);
+  assert_true(dt_exif_header_parse(&h, t.data, t.len));
+  dt_exif_header_cleanup(&h);
+  make_tiff(&t, 0, "NIKON CORPORATION", NULL, 0, makernote, 1);
+  assert_false(dt_exif_header_parse(&h, t.data, t.len));
+
+  // everything there but truncated in the middle of the ifds
+  make_tiff(&t, 0, "FUJIFILM", NULL, 0, NULL, 0);
+  assert_false(dt_exif_header_parse(&h, t.data, 40));
+
+  // no tiff at all
+  assert_false(dt_exif_header_parse(&h, (const uint8_t *)"\x89PNG\r\n\x1a\n", 8));
+}
+
+static void test_jpeg(void **state)
+{
+  tiff_t t;
+  make_tiff(&t, 1, "Apple", NULL, 0, NULL, 0);
+
+  static uint8_t jpeg[8192];
+  size_t len = 0;
+  jpeg[len++] = 0xFF;
+  jpeg[len++] = 0xD8;
+  // app1 with the exif
+  jpeg[len++] = 0xFF;
+  jpeg[len++] = 0xE1;
+  jpeg[len++] = (t.len + 8) >> 8;
+  jpeg[len++] = (t.len + 8) & 0xff;
+  memcpy(jpeg + len, "Exif\0\0", 6);
+  len += 6;
+  memcpy(jpeg + len, t.data, t.len);
+  len += t.len;
+  // start of frame, 4032x3024
+  const uint8_t sof[] = { 0xFF, 0xC0, 0, 11, 8, 0x0B, 0xD0, 0x0F, 0xC0, 1, 1, 0x11, 0 };
+  memcpy(jpeg + len, sof, sizeof(sof));
+
+  dt_exif_header_t h;
+  assert_true(dt_exif_header_parse(&h, jpeg, len + sizeof(sof)));
+  assert_string_equal(h.maker, "Apple");
+  assert_int_equal(h.width, 4032);
+  assert_int_equal(h.height, 3024);
+  dt_exif_header_cleanup(&h);
+
+  // the same with some xmp in front of the frame
+  const uint8_t xmp[] = { 0xFF, 0xE1, 0, 31, 'h', 't', 't', 'p', ':', '/', '/', 'n', 's', '.', 'a', 'd', 'o', 'b',
+                          'e', '.', 'c', 'o', 'm', '/', 'x', 'a', 'p', '/', '1', '.', '0', '/', 0 };
+  memcpy(jpeg + len, xmp, sizeof(xmp));
+  memcpy(jpeg + len + sizeof(xmp), sof, sizeof(sof));
+  assert_false(dt_exif_header_parse(&h, jpeg, len + sizeof(xmp) + sizeof(sof)));
+}
+
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_tiff),
+    cmocka_unit_test(test_exiv2_fallback),
+    cmocka_unit_test(test_jpeg),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,280 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the common image processing kernels: a correctness
+ * check on small test images, then a throughput measurement against the
+ * baseline of the CPU class (see util/perf.h).
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <float.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/perf.h"
+#include "../util/testimg.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/bilateral.h"
+#include "common/box_filters.h"
+#include "common/colorspaces_inline_conversions.h"
+#include "common/dwt.h"
+#include "common/eaw.h"
+#include "common/gaussian.h"
+#include "common/guided_filter.h"
+#include "common/interpolation.h"
+#include "common/locallaplacian.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// size of the correctness test images:
+#define CHECK_WIDTH 67
+#define CHECK_HEIGHT 53
+
+// size of the throughput test images, 1 megapixel:
+#define PERF_WIDTH 1024
+#define PERF_HEIGHT 1024
+
+typedef struct Workload
+{
+  int width;
+  int height;
+  float *in;     // 4 channels
+  float *out;    // 4 channels, the first pixels only for downscaling kernels
+  float *tmp;    // 4 channels, scratch
+  float *detail; // 4 channels, scratch
+} Workload;
+
+typedef struct Kernel
+{
+  const char *name;
+  void (*run)(void *data);
+  float scale;       // of the test images, the kernels working on Lab use L in [0; 100]
+  int constant;      // check that a constant image stays constant, else that
+                     // the kernel gives its input back
+  int out_ch;        // channels per output pixel
+  int downscale;     // output is half the size of the input
+  int checked;       // channels of the output compared to the input
+  float eps;         // relative to scale
+} Kernel;
+
+static Workload *workload_new(const Testimg *const ti, const float scale)
+{
+  Workload *w = calloc(1, sizeof(Workload));
+  w->width = ti->width;
+  w->height = ti->height;
+  const size_t npixels = (size_t)ti->width * ti->height;
+  w->in = dt_alloc_align_float(4 * npixels);
+  w->out = dt_calloc_align_float(4 * npixels);
+  w->tmp = dt_calloc_align_float(4 * npixels);
+  w->detail = dt_calloc_align_float(4 * npixels);
+  for (size_t k = 0; k < 4 * npixels; k++)
+    w->in[k] = scale * ti->pixels[k];
+  return w;
+}
+
+static void workload_free(Workload *w)
+{
+  dt_free_align(w->in);
+  dt_free_align(w->out);
+  dt_free_align(w->tmp);
+  dt_free_align(w->detail);
+  free(w);
+}
+
+/*
+ * KERNELS
+ */
+
+static void run_gaussian(void *data)
+{
+  Workload *w = (Workload *)data;
+  const float max[4] = { 1e6f, 1e6f, 1e6f, 1e6f };
+  const float min[4] = { -1e6f, -1e6f, -1e6f, -1e6f };
+  dt_gaussian_t *g = dt_gaussian_init(w->width, w->height, 4, max, min, 8.0f,
+                                      0);
+  assert_non_null(g);
+  dt_gaussian_blur_4c(g, w->in, w->out);
+  dt_gaussian_free(g);
+}
+
+static void run_bilateral(void *data)
+{
+  Workload *w = (Workload *)data;
+  dt_bilateral_t *b = dt_bilateral_init(w->width, w->height, 16.0f, 10.0f);
+  assert_non_null(b);
+  dt_bilateral_splat(b, w->in);
+  dt_bilateral_blur(b);
+  dt_bilateral_slice(b, w->in, w->out, -1.0f);
+  dt_bilateral_free(b);
+}
+
+static void run_locallaplacian(void *data)
+{
+  Workload *w = (Workload *)data;
+  local_laplacian(w->in, w->out, w->width, w->height, 0.2f, 0.5f, 0.5f, 0.25f,
+                  NULL);
+}
+
+static void run_box_mean(void *data)
+{
+  Workload *w = (Workload *)data;
+  memcpy(w->out, w->in, sizeof(float) * 4 * w->width * w->height);
+  dt_box_mean(w->out, w->height, w->width, 4, 8, 3);
+}
+
+static void run_guided_filter(void *data)
+{
+  Workload *w = (Workload *)data;
+  const size_t npixels = (size_t)w->width * w->height;
+  for (size_t k = 0; k < npixels; k++) w->tmp[k] = w->in[4 * k];
+  guided_filter(w->in, w->tmp, w->out, w->width, w->height, 4, 8, 0.1f, 1.0f,
+                -FLT_MAX, FLT_MAX);
+}
+
+// decomposition then synthesis without threshold nor boost gives the input
+// back:
+static void run_eaw(void *data)
+{
+  Workload *w = (Workload *)data;
+  const dt_aligned_pixel_t threshold = { 0.0f, 0.0f, 0.0f, 0.0f };
+  const dt_aligned_pixel_t boost = { 1.0f, 1.0f, 1.0f, 1.0f };
+  eaw_decompose(w->tmp, w->in, w->detail, 2, 1.0f, w->width, w->height);
+  eaw_synthesize(w->out, w->tmp, w->detail, threshold, boost, w->width,
+                 w->height);
+}
+
+// denoising without noise gives the input back:
+static void run_dwt(void *data)
+{
+  Workload *w = (Workload *)data;
+  const size_t npixels = (size_t)w->width * w->height;
+  const float noise[5] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+  for (size_t k = 0; k < npixels; k++) w->out[k] = w->in[4 * k];
+  dwt_denoise(w->out, w->width, w->height, 5, noise);
+}
+
+static void run_interpolation(void *data)
+{
+  Workload *w = (Workload *)data;
+  const struct dt_interpolation *itor
+      = dt_interpolation_new(DT_INTERPOLATION_LANCZOS3);
+  const dt_iop_roi_t roi_in = { 0, 0, w->width, w->height, 1.0f };
+  const dt_iop_roi_t roi_out = { 0, 0, w->width / 2, w->height / 2, 0.5f };
+  dt_interpolation_resample(itor, w->out, &roi_out, w->in, &roi_in);
+}
+
+// to Lab and back:
+static void run_colorspaces(void *data)
+{
+  Workload *w = (Workload *)data;
+  const size_t npixels = (size_t)w->width * w->height;
+  dt_XYZ_to_Lab_row(w->in, w->tmp, npixels);
+  dt_Lab_to_XYZ_row(w->tmp, w->out, npixels);
+}
+
+static const Kernel kernels[] = {
+  { "gaussian", run_gaussian, 1.0f, TRUE, 4, FALSE, 4, 1e-3f },
+  { "bilateral", run_bilateral, 100.0f, TRUE, 4, FALSE, 1, 1e-3f },
+  { "locallaplacian", run_locallaplacian, 100.0f, TRUE, 4, FALSE, 1, 1e-2f },
+  { "box_mean", run_box_mean, 1.0f, TRUE, 4, FALSE, 4, 1e-4f },
+  { "guided_filter", run_guided_filter, 1.0f, TRUE, 1, FALSE, 1, 1e-3f },
+  { "eaw", run_eaw, 1.0f, FALSE, 4, FALSE, 4, 1e-4f },
+  { "dwt", run_dwt, 1.0f, FALSE, 1, FALSE, 1, 1e-4f },
+  { "interpolation", run_interpolation, 1.0f, TRUE, 4, TRUE, 4, 1e-3f },
+  { "colorspaces", run_colorspaces, 1.0f, FALSE, 4, FALSE, 3, 1e-4f },
+};
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_kernel(void **state)
+{
+  const Kernel *kernel = (const Kernel *)*state;
+
+  TR_STEP("verify %s on a %s image", kernel->name,
+          kernel->constant ? "constant" : "gradient");
+  Testimg *ti = kernel->constant
+    ? testimg_gen_all_grey(CHECK_WIDTH, CHECK_HEIGHT, 0.5f)
+    : testimg_gen_rgb_gradient(CHECK_WIDTH, CHECK_HEIGHT);
+  Workload *w = workload_new(ti, kernel->scale);
+  kernel->run(w);
+
+  // downscaling kernels only fill the first pixels, but a constant image
+  // gives the same value everywhere:
+  const int npixels = kernel->downscale
+    ? (w->width / 2) * (w->height / 2)
+    : w->width * w->height;
+  for (int k = 0; k < npixels; k++)
+    for (int c = 0; c < kernel->checked; c++)
+      assert_float_equal(w->out[kernel->out_ch * k + c], w->in[4 * k + c],
+                         kernel->eps * kernel->scale);
+  workload_free(w);
+  testimg_free(ti);
+
+  if (perf_mode() == PERF_OFF) return;
+
+  TR_STEP("measure the throughput of %s", kernel->name);
+  ti = testimg_gen_rgb_gradient(PERF_WIDTH, PERF_HEIGHT);
+  w = workload_new(ti, kernel->scale);
+  const double seconds = perf_time(kernel->run, w);
+  perf_report(kernel->name, (double)w->width * w->height / seconds * 1e-6);
+  workload_free(w);
+  testimg_free(ti);
+}
+
+int main(int argc, char* argv[])
+{
+  // the kernels size their per-thread buffers with it
+  darktable.num_openmp_threads = dt_get_num_threads();
+
+  const size_t count = sizeof(kernels) / sizeof(kernels[0]);
+  struct CMUnitTest tests[sizeof(kernels) / sizeof(kernels[0])];
+  for (size_t k = 0; k < count; k++)
+    tests[k] = (struct CMUnitTest){ kernels[k].name, test_kernel, NULL, NULL,
+                                    (void *)&kernels[k] };
+
+  if (perf_mode() != PERF_OFF)
+    TR_NOTE("performance tests for CPU class %s", perf_cpu_class());
+
+  const int failed = _cmocka_run_group_tests("kernels", tests, count, NULL,
+                                             NULL);
+  perf_finish();
+  return failed;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
+
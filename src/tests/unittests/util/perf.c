@@ -0,0 +1,227 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <ctype.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmocka.h>
+#include <glib.h>
+
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include "tracing.h"
+#include "perf.h"
+
+#ifndef PERF_BASELINE_DIR
+#define PERF_BASELINE_DIR "."
+#endif
+
+#define PERF_MAX_KERNELS 64
+#define PERF_MIN_RUNS 3
+#define PERF_MIN_SECONDS 1.0
+
+typedef struct Baseline
+{
+  char kernel[64];
+  double mpix_per_s;
+} Baseline;
+
+static Baseline baselines[PERF_MAX_KERNELS];
+static int num_baselines = -1; // not loaded yet
+
+PerfMode perf_mode(void)
+{
+  const char *mode = g_getenv("ANSEL_PERF_TESTS");
+  if (!mode || !*mode) return PERF_OFF;
+  if (!strcmp(mode, "record")) return PERF_RECORD;
+  return PERF_CHECK;
+}
+
+// lower case letters and digits, anything else becomes a single dash:
+static void sanitize(char *name)
+{
+  char *out = name;
+  for (const char *in = name; *in; in++)
+  {
+    if (isalnum((unsigned char)*in))
+      *out++ = tolower((unsigned char)*in);
+    else if (out > name && out[-1] != '-')
+      *out++ = '-';
+  }
+  if (out > name && out[-1] == '-') out--;
+  *out = '\0';
+}
+
+const char *perf_cpu_class(void)
+{
+  static char cpu_class[256] = { 0 };
+  if (cpu_class[0]) return cpu_class;
+
+  const char *env = g_getenv("ANSEL_PERF_CPU_CLASS");
+  if (env && *env)
+  {
+    g_strlcpy(cpu_class, env, sizeof(cpu_class));
+    return cpu_class;
+  }
+
+  char model[200] = "unknown";
+#if defined(__linux__)
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f)
+  {
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+      const char *colon = strchr(line, ':');
+      if (!strncmp(line, "model name", 10) && colon)
+      {
+        g_strlcpy(model, colon + 1, sizeof(model));
+        break;
+      }
+    }
+    fclose(f);
+  }
+#elif defined(__APPLE__)
+  size_t size = sizeof(model);
+  if (sysctlbyname("machdep.cpu.brand_string", model, &size, NULL, 0))
+    g_strlcpy(model, "unknown", sizeof(model));
+#elif defined(_WIN32)
+  const char *identifier = g_getenv("PROCESSOR_IDENTIFIER");
+  if (identifier) g_strlcpy(model, identifier, sizeof(model));
+#endif
+
+  snprintf(cpu_class, sizeof(cpu_class), "%s %ut", model, g_get_num_processors());
+  sanitize(cpu_class);
+  return cpu_class;
+}
+
+static gchar *baseline_file(void)
+{
+  gchar *name = g_strdup_printf("%s.txt", perf_cpu_class());
+  gchar *path = g_build_filename(PERF_BASELINE_DIR, name, NULL);
+  g_free(name);
+  return path;
+}
+
+static void load_baselines(void)
+{
+  if (num_baselines >= 0) return;
+  num_baselines = 0;
+
+  gchar *path = baseline_file();
+  FILE *f = fopen(path, "r");
+  if (f)
+  {
+    char line[256];
+    while (fgets(line, sizeof(line), f) && num_baselines < PERF_MAX_KERNELS)
+    {
+      Baseline *b = &baselines[num_baselines];
+      if (line[0] != '#' && sscanf(line, "%63s %lf", b->kernel, &b->mpix_per_s) == 2)
+        num_baselines++;
+    }
+    fclose(f);
+  }
+  g_free(path);
+}
+
+static Baseline *find_baseline(const char *kernel)
+{
+  load_baselines();
+  for (int k = 0; k < num_baselines; k++)
+    if (!strcmp(baselines[k].kernel, kernel)) return &baselines[k];
+  return NULL;
+}
+
+double perf_time(void (*func)(void *data), void *data)
+{
+  double best = G_MAXDOUBLE;
+  double total = 0.0;
+  for (int run = 0; run < PERF_MIN_RUNS || total < PERF_MIN_SECONDS; run++)
+  {
+    const gint64 start = g_get_monotonic_time();
+    func(data);
+    const double seconds = (g_get_monotonic_time() - start) * 1e-6;
+    best = MIN(best, seconds);
+    total += seconds;
+  }
+  return best;
+}
+
+void perf_report(const char *kernel, const double mpix_per_s)
+{
+  const PerfMode mode = perf_mode();
+  if (mode == PERF_OFF) return;
+
+  Baseline *b = find_baseline(kernel);
+  if (mode == PERF_RECORD)
+  {
+    if (!b && num_baselines < PERF_MAX_KERNELS)
+    {
+      b = &baselines[num_baselines++];
+      g_strlcpy(b->kernel, kernel, sizeof(b->kernel));
+    }
+    if (b) b->mpix_per_s = mpix_per_s;
+    TR_NOTE("%s: %.1f Mpix/s recorded", kernel, mpix_per_s);
+    return;
+  }
+
+  if (!b)
+  {
+    TR_NOTE("%s: %.1f Mpix/s, no baseline for %s", kernel, mpix_per_s,
+            perf_cpu_class());
+    return;
+  }
+
+  const char *env = g_getenv("ANSEL_PERF_TOLERANCE");
+  const double tolerance = env ? g_ascii_strtod(env, NULL) : 0.15;
+  TR_NOTE("%s: %.1f Mpix/s, baseline %.1f Mpix/s", kernel, mpix_per_s,
+          b->mpix_per_s);
+  assert_true(mpix_per_s >= (1.0 - tolerance) * b->mpix_per_s);
+}
+
+void perf_finish(void)
+{
+  if (perf_mode() != PERF_RECORD || num_baselines <= 0) return;
+
+  gchar *path = baseline_file();
+  g_mkdir_with_parents(PERF_BASELINE_DIR, 0755);
+  FILE *f = fopen(path, "w");
+  if (f)
+  {
+    fprintf(f, "# throughput in Mpix/s on %s\n", perf_cpu_class());
+    for (int k = 0; k < num_baselines; k++)
+      fprintf(f, "%s %.2f\n", baselines[k].kernel, baselines[k].mpix_per_s);
+    fclose(f);
+    TR_NOTE("baselines written to %s", path);
+  }
+  else
+    TR_NOTE("can't write %s", path);
+  g_free(path);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
+
@@ -0,0 +1,65 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2026 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Throughput measurements against stored baselines, to be used for unit
+ * testing with cmocka.
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+
+
+/*
+ * Mode
+ */
+
+typedef enum PerfMode
+{
+  PERF_OFF = 0, // ANSEL_PERF_TESTS unset: no measurement
+  PERF_CHECK,   // ANSEL_PERF_TESTS=check: compare with the baseline
+  PERF_RECORD   // ANSEL_PERF_TESTS=record: store as the baseline
+} PerfMode;
+
+// mode of the performance tests, from the environment:
+PerfMode perf_mode(void);
+
+// class of CPU the baselines are stored for, from ANSEL_PERF_CPU_CLASS or
+// from the CPU model and the number of threads:
+const char *perf_cpu_class(void);
+
+
+/*
+ * Measurement
+ */
+
+// best time of one call of func(data) in seconds, over at least 3 calls and
+// 1 second:
+double perf_time(void (*func)(void *data), void *data);
+
+// check (PERF_CHECK) that the throughput of a kernel in megapixels per second
+// is not lower than its baseline by more than ANSEL_PERF_TOLERANCE (default
+// 0.15), or keep it as the new baseline (PERF_RECORD):
+void perf_report(const char *kernel, const double mpix_per_s);
+
+// write the baselines kept by perf_report() in PERF_RECORD mode:
+void perf_finish(void);
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
+
@@ -216,6 +216,23 @@ Testimg *testimg_gen_rgb_space(const int width)
   return ti;
 }
 
+Testimg *testimg_gen_rgb_gradient(const int width, const int height)
+{
+  Testimg *ti = testimg_alloc(width, height);
+  ti->name = "rgb gradient";
+
+  for_testimg_pixels_p_yx(ti)
+  {
+    const float u = (float)(x) / (float)(width-1);
+    const float v = (float)(y) / (float)(height-1);
+    p[0] = testimg_val_to_exp(u);
+    p[1] = testimg_val_to_exp(v);
+    p[2] = testimg_val_to_exp(0.5f * (u + v));
+    p[3] = 1.0f;
+  }
+  return ti;
+}
+
 Testimg *testimg_gen_grey_max_dr()
 {
   const int width = 10;
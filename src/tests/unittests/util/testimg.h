@@ -145,6 +145,10 @@ Testimg *testimg_gen_three_color_space(const int width);
 // create a full rgb color space of given width and fixed height=width*width:
 Testimg *testimg_gen_rgb_space(const int width);
 
+// create a smooth image of given size, red grows from left to right, green from
+// top to bottom and blue along the diagonal, mask is 1:
+Testimg *testimg_gen_rgb_gradient(const int width, const int height);
+
 
 /*
  * Bad and nonsense value image generation
@@ -30,9 +30,13 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/metrics.h"
+#include "common/mipmap_cache.h"
 #include "common/selection.h"
+#include "common/sidecar_writer.h"
 #include "common/styles.h"
 #include "common/tags.h"
+#include "common/trace.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -149,18 +153,20 @@ void cleanup(dt_view_t *self)
   free(dev);
 }
 
-static cairo_status_t _write_snapshot_data(void *closure, const unsigned char *data, unsigned int length)
+static dt_darkroom_layout_t _lib_darkroom_get_layout(dt_view_t *self)
 {
-  const int fd = GPOINTER_TO_INT(closure);
-  ssize_t res = write(fd, data, length);
-  if(res != length)
-    return CAIRO_STATUS_WRITE_ERROR;
-  return CAIRO_STATUS_SUCCESS;
+  return DT_DARKROOM_LAYOUT_EDITING;
 }
 
-static dt_darkroom_layout_t _lib_darkroom_get_layout(dt_view_t *self)
+// focus-peaking overlay of the main pipe backbuffer it was computed from
+static cairo_surface_t *_focus_peaking = NULL;
+static uint64_t _focus_peaking_hash = 0;
+static int32_t _focus_peaking_imgid = -1;
+
+static void _focus_peaking_free()
 {
-  return DT_DARKROOM_LAYOUT_EDITING;
+  if(_focus_peaking) cairo_surface_destroy(_focus_peaking);
+  _focus_peaking = NULL;
 }
 
 static cairo_filter_t _get_filtering_level(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup)
@@ -322,6 +328,110 @@ static void _darkroom_pickers_draw(dt_view_t *self, cairo_t *cri,
   cairo_restore(cri);
 }
 
+static const char *_run_state_name(const dt_dev_pixelpipe_run_state_t state)
+{
+  switch(state)
+  {
+    case DT_DEV_PIXELPIPE_RUN_CACHED:
+      return _("cached");
+    case DT_DEV_PIXELPIPE_RUN_SHARED:
+      return _("shared");
+    case DT_DEV_PIXELPIPE_RUN_DISK:
+      return _("on disk");
+    case DT_DEV_PIXELPIPE_RUN_FUSED:
+      return _("fused");
+    case DT_DEV_PIXELPIPE_RUN_COMPUTED:
+      return _("computed");
+    default:
+      return "";
+  }
+}
+
+// what the last run of the pipe recomputed, which module it waited for and how its cache copes
+static void _pipe_stats_append(GString *text, const char *name, dt_dev_pixelpipe_t *pipe)
+{
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  g_string_append_printf(text, _("%s pipe, last run %.0f ms\n"), name, pipe->run_time * 1000.);
+
+  const dt_dev_pixelpipe_run_stats_t *slowest = NULL;
+  for(GList *l = pipe->run_stats; l; l = g_list_next(l))
+  {
+    const dt_dev_pixelpipe_run_stats_t *stat = (dt_dev_pixelpipe_run_stats_t *)l->data;
+    // the modules before the first cached output were not reached
+    if(stat->state == DT_DEV_PIXELPIPE_RUN_SKIPPED) continue;
+
+    gchar *label = stat->multi_name[0] ? g_strdup_printf("%s %s", stat->op, stat->multi_name) : g_strdup(stat->op);
+    g_string_append_printf(text, "  %-24.24s %-9s", label, _run_state_name(stat->state));
+    if(stat->state == DT_DEV_PIXELPIPE_RUN_COMPUTED) g_string_append_printf(text, " %7.1f ms", stat->time * 1000.);
+    g_string_append_c(text, '\n');
+    g_free(label);
+
+    if(!slowest || stat->time > slowest->time) slowest = stat;
+  }
+  if(slowest && slowest->time > 0.0 && pipe->run_time > 0.0)
+    g_string_append_printf(text, _("  bottleneck: %s, %.0f %% of the run\n"), slowest->op,
+                           100. * slowest->time / pipe->run_time);
+
+  const dt_dev_pixelpipe_cache_t *cache = &pipe->cache;
+  const double hits = cache->queries ? 100. * (cache->queries - cache->misses) / cache->queries : 0.;
+  if(cache->mode == DT_DEV_PIXELPIPE_CACHE_HASHED)
+    g_string_append_printf(text, _("  cache: %zu of %zu MiB, %.0f %% hits, %llu evictions, %s\n"),
+                           cache->current_memory / (1024 * 1024), cache->max_memory / (1024 * 1024), hits,
+                           (long long unsigned int)cache->evictions,
+                           cache->evictions ? _("a larger cache may help") : _("never full"));
+  else
+    g_string_append_printf(text, _("  cache: %d lines, %.0f %% hits\n"), cache->entries, hits);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+}
+
+static void _darkroom_pipe_stats_draw(dt_develop_t *dev, cairo_t *cri)
+{
+  GString *text = g_string_new(NULL);
+  _pipe_stats_append(text, _("full"), dev->pipe);
+  g_string_append_c(text, '\n');
+  _pipe_stats_append(text, _("preview"), dev->preview_pipe);
+
+  // over the whole session, from the metrics registry
+  dt_metrics_snapshot_t snapshot;
+  dt_metrics_snapshot(&snapshot);
+  const uint64_t hits = snapshot.counters[DT_METRICS_PIXELPIPE_CACHE_HIT];
+  const uint64_t queries = hits + snapshot.counters[DT_METRICS_PIXELPIPE_CACHE_MISS];
+  g_string_append_printf(text, _("\nsession: %.0f %% of the module outputs found in caches\n"),
+                         queries ? 100. * hits / queries : 0.);
+  if(snapshot.modules)
+  {
+    const dt_metrics_module_t *slowest = (dt_metrics_module_t *)snapshot.modules->data;
+    const dt_metrics_summary_t *summary
+        = slowest->opencl.count > slowest->cpu.count ? &slowest->opencl : &slowest->cpu;
+    g_string_append_printf(text, _("slowest module: %s, %.1f s in total, p90 %.1f ms"), slowest->op,
+                           slowest->cpu.total + slowest->opencl.total, summary->p90 * 1000.);
+  }
+  dt_metrics_snapshot_cleanup(&snapshot);
+
+  PangoFontDescription *desc = pango_font_description_copy_static(darktable.bauhaus->pango_font_desc);
+  pango_font_description_set_family(desc, "monospace");
+  pango_font_description_set_absolute_size(desc, DT_PIXEL_APPLY_DPI(11) * PANGO_SCALE);
+  PangoLayout *layout = pango_cairo_create_layout(cri);
+  pango_layout_set_font_description(layout, desc);
+  pango_layout_set_text(layout, text->str, -1);
+  PangoRectangle ink;
+  pango_layout_get_pixel_extents(layout, NULL, &ink);
+
+  const double margin = DT_PIXEL_APPLY_DPI(10);
+  cairo_save(cri);
+  cairo_rectangle(cri, margin, margin, ink.width + 2. * margin, ink.height + 2. * margin);
+  dt_gui_gtk_set_source_rgba(cri, DT_GUI_COLOR_LOG_BG, 0.8);
+  cairo_fill(cri);
+  cairo_move_to(cri, 2. * margin, 2. * margin);
+  dt_gui_gtk_set_source_rgb(cri, DT_GUI_COLOR_LOG_FG);
+  pango_cairo_show_layout(cri, layout);
+  cairo_restore(cri);
+
+  pango_font_description_free(desc);
+  g_object_unref(layout);
+  g_string_free(text, TRUE);
+}
+
 void expose(
     dt_view_t *self,
     cairo_t *cri,
@@ -330,6 +440,7 @@ void expose(
     int32_t pointerx,
     int32_t pointery)
 {
+  const double trace_start = dt_get_wtime();
   cairo_set_source_rgb(cri, .2, .2, .2);
   cairo_save(cri);
 
@@ -363,10 +474,21 @@ void expose(
   cairo_surface_t *surface;
   cairo_t *cr = cairo_create(image_surface);
 
+  // region of the image we want to show, at backbuf_scale. The backbuffer may be larger than that
+  // when a margin was rendered around the viewport for panning, or smaller for coarse passes.
+  int vis_x, vis_y, vis_wd, vis_ht;
+  dt_dev_get_viewport(dev, backbuf_scale, zoom_x, zoom_y, closeup, 0.f, &vis_x, &vis_y, &vis_wd, &vis_ht);
+  const float downscale = dev->pipe->backbuf_downscale;
+  const float tolerance = 1.f / downscale; // rounding of coarse passes
+  const gboolean covered
+      = vis_x >= dev->pipe->backbuf_x && vis_y >= dev->pipe->backbuf_y
+        && vis_x + vis_wd <= dev->pipe->backbuf_x + dev->pipe->output_backbuf_width / downscale + tolerance
+        && vis_y + vis_ht <= dev->pipe->backbuf_y + dev->pipe->output_backbuf_height / downscale + tolerance;
+
   if(dev->pipe->output_backbuf && // do we have an image?
     dev->pipe->output_imgid == dev->image_storage.id && // is the right image?
     dev->pipe->backbuf_scale == backbuf_scale && // is this the zoom scale we want to display?
-    dev->pipe->backbuf_zoom_x == zoom_x && dev->pipe->backbuf_zoom_y == zoom_y)
+    covered) // does it contain what we want to see?
   {
     // draw image
     mutex = &dev->pipe->backbuf_mutex;
@@ -375,8 +497,13 @@ void expose(
     float ht = dev->pipe->output_backbuf_height;
     stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
     surface = dt_cairo_image_surface_create_for_data(dev->pipe->output_backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
-    wd /= darktable.gui->ppd;
-    ht /= darktable.gui->ppd;
+    // coarse passes of progressive rendering are upscaled to the final size
+    wd /= darktable.gui->ppd * downscale;
+    ht /= darktable.gui->ppd * downscale;
+    const float vis_w = vis_wd / darktable.gui->ppd;
+    const float vis_h = vis_ht / darktable.gui->ppd;
+    const float offset_x = (vis_x - dev->pipe->backbuf_x) / darktable.gui->ppd;
+    const float offset_y = (vis_y - dev->pipe->backbuf_y) / darktable.gui->ppd;
 
     if(dev->iso_12646.enabled)
     {
@@ -392,36 +519,55 @@ void expose(
     }
     cairo_paint(cr);
 
-    cairo_translate(cr, ceilf(.5f * (width - wd)), ceilf(.5f * (height - ht)));
+    cairo_translate(cr, ceilf(.5f * (width - vis_w)), ceilf(.5f * (height - vis_h)));
     if(closeup)
     {
       const double scale = 1<<closeup;
       cairo_scale(cr, scale, scale);
-      cairo_translate(cr, -(.5 - 0.5/scale) * wd, -(.5 - 0.5/scale) * ht);
+      cairo_translate(cr, -(.5 - 0.5/scale) * vis_w, -(.5 - 0.5/scale) * vis_h);
     }
 
     if(dev->iso_12646.enabled)
     {
       // draw the white frame around picture
-      cairo_rectangle(cr, -tb / 3., -tb / 3.0, wd + 2. * tb / 3., ht + 2. * tb / 3.);
+      cairo_rectangle(cr, -tb / 3., -tb / 3.0, vis_w + 2. * tb / 3., vis_h + 2. * tb / 3.);
       cairo_set_source_rgb(cr, 1., 1., 1.);
       cairo_fill(cr);
     }
 
-    cairo_rectangle(cr, 0, 0, wd, ht);
+    cairo_save(cr);
+    cairo_rectangle(cr, 0, 0, vis_w, vis_h);
+    cairo_clip(cr);
+    cairo_translate(cr, -offset_x, -offset_y);
+
+    cairo_save(cr);
+    cairo_scale(cr, 1. / downscale, 1. / downscale);
     cairo_set_source_surface(cr, surface, 0, 0);
-    cairo_pattern_set_filter(cairo_get_source(cr), _get_filtering_level(dev, zoom, closeup));
+    cairo_pattern_set_filter(cairo_get_source(cr), (downscale < 1.f) ? CAIRO_FILTER_BILINEAR
+                                                                      : _get_filtering_level(dev, zoom, closeup));
     cairo_paint(cr);
+    cairo_restore(cr);
 
-    if(darktable.gui->show_focus_peaking)
+    if(darktable.gui->show_focus_peaking && downscale == 1.f)
     {
+      // the overlay only changes with the backbuffer, not with the guides, masks or pickers drawn over it
+      if(!_focus_peaking || _focus_peaking_hash != dev->pipe->backbuf_hash
+         || _focus_peaking_imgid != dev->pipe->output_imgid
+         || cairo_image_surface_get_width(_focus_peaking) != dev->pipe->output_backbuf_width
+         || cairo_image_surface_get_height(_focus_peaking) != dev->pipe->output_backbuf_height)
+      {
+        _focus_peaking_free();
+        _focus_peaking = dt_focuspeaking_surface(dev->pipe->output_backbuf, dev->pipe->output_backbuf_width,
+                                                 dev->pipe->output_backbuf_height);
+        _focus_peaking_hash = dev->pipe->backbuf_hash;
+        _focus_peaking_imgid = dev->pipe->output_imgid;
+      }
       cairo_save(cr);
       cairo_scale(cr, 1./ darktable.gui->ppd, 1. / darktable.gui->ppd);
-      dt_focuspeaking(cr, wd, ht, cairo_image_surface_get_data(surface),
-                                  cairo_image_surface_get_width(surface),
-                                  cairo_image_surface_get_height(surface));
+      dt_focuspeaking_draw(cr, _focus_peaking);
       cairo_restore(cr);
     }
+    cairo_restore(cr);
 
     cairo_surface_destroy(surface);
     dt_pthread_mutex_unlock(mutex);
@@ -556,15 +702,19 @@ void expose(
     /* reset the request */
     darktable.develop->proxy.snapshot.request = FALSE;
 
-    /* validation of snapshot filename */
-    g_assert(darktable.develop->proxy.snapshot.filename != NULL);
+    /* validation of snapshot destination */
+    cairo_surface_t **snapshot = darktable.develop->proxy.snapshot.surface;
+    g_assert(snapshot != NULL);
 
-    /* Store current image surface to snapshot file.
+    /* Keep a copy of the current image surface in memory, toggling the snapshot is then only a paint.
        FIXME: add checks so that we don't make snapshots of preview pipe image surface.
     */
-    const int fd = g_open(darktable.develop->proxy.snapshot.filename, O_CREAT | O_WRONLY | O_BINARY, 0600);
-    cairo_surface_write_to_png_stream(image_surface, _write_snapshot_data, GINT_TO_POINTER(fd));
-    close(fd);
+    if(*snapshot) cairo_surface_destroy(*snapshot);
+    *snapshot = dt_cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *snapshot_cr = cairo_create(*snapshot);
+    cairo_set_source_surface(snapshot_cr, image_surface, 0, 0);
+    cairo_paint(snapshot_cr);
+    cairo_destroy(snapshot_cr);
   }
 
   // Displaying sample areas if enabled
@@ -645,6 +795,16 @@ void expose(
     pango_font_description_free(desc);
     g_object_unref(layout);
   }
+
+  if(dt_conf_get_bool("darkroom/ui/pipe_stats")) _darkroom_pipe_stats_draw(dev, cri);
+
+  if(dt_trace_enabled())
+  {
+    // ends the flow of the history change that produced the image just drawn
+    const int flow = dt_atomic_exch_int(&dev->trace_redraw_flow, 0);
+    dt_trace_span("gui", "darkroom expose", trace_start, dt_get_wtime());
+    dt_trace_flow(flow, DT_TRACE_FLOW_END, "history change", trace_start);
+  }
 }
 
 void reset(dt_view_t *self)
@@ -702,6 +862,104 @@ static void _view_darkroom_filmstrip_activate_callback(gpointer instance, int32_
   }
 }
 
+typedef struct _prefetch_t
+{
+  int32_t imgid;
+  int generation;
+} _prefetch_t;
+
+// bumped each time darkroom shows another image: pending prefetches for the old neighbours are dropped
+static dt_atomic_int _prefetch_generation;
+
+// 1 or -1 when the image shown was reached by stepping forward or backward in the collection, 0 otherwise
+static int _prefetch_direction = 0;
+
+static int32_t _prefetch_job_run(dt_job_t *job)
+{
+  const _prefetch_t *params = (_prefetch_t *)dt_control_job_get_params(job);
+  if(dt_atomic_get_int(&_prefetch_generation) != params->generation) return 0;
+
+  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, params->imgid, 'r');
+  if(!img) return 1;
+  const size_t estimate
+      = (size_t)img->width * img->height * (dt_image_is_raw(img) ? sizeof(float) : 4 * sizeof(float));
+  dt_image_cache_read_release(darktable.image_cache, img);
+
+  // stay within the budget of the full size mipmap cache, so we don't push out the image being edited
+  const dt_cache_t *full = &darktable.mipmap_cache->mip_full.cache;
+  if(full->cost + estimate > full->cost_quota)
+  {
+    dt_print(DT_DEBUG_DEV, "[darkroom] not enough cache memory to prefetch image %i\n", params->imgid);
+    return 0;
+  }
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+
+  if(dt_atomic_get_int(&_prefetch_generation) != params->generation) return 0;
+
+  dt_mipmap_cache_get(darktable.mipmap_cache, &buf, params->imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING, 'r');
+  dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+
+  // warm up the database pages of the history. dt_dev_read_history_ext() can't run here:
+  // it rebuilds memory.history, which belongs to the image being edited.
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT num, operation, op_params, blendop_params FROM main.history WHERE imgid = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, params->imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW);
+  sqlite3_finalize(stmt);
+
+  dt_print(DT_DEBUG_DEV, "[darkroom] prefetched image %i\n", params->imgid);
+  return 0;
+}
+
+// decode the next and previous images of the collection in the background, nearest first,
+// so jumping to them skips the raw loading. when stepping through the collection, the images
+// ahead are the likely next ones: twice as many of them are fetched, before the ones behind.
+static void _prefetch_neighbours(const int32_t imgid)
+{
+  const int generation = dt_atomic_add_int(&_prefetch_generation, 1) + 1;
+  const int direction = _prefetch_direction;
+  _prefetch_direction = 0;
+  const int count = dt_conf_get_int("darkroom_prefetch_images");
+  if(count <= 0) return;
+
+  const int ahead = direction ? 2 * count : count;
+  const int before = direction < 0 ? ahead : count;
+  const int after = direction < 0 ? count : ahead;
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT c.imgid "
+                              "FROM memory.collected_images AS c, "
+                              "     (SELECT rowid FROM memory.collected_images WHERE imgid = ?1) AS cur "
+                              "WHERE c.rowid BETWEEN cur.rowid - ?2 AND cur.rowid + ?3 AND c.imgid != ?1 "
+                              "ORDER BY ABS(c.rowid - cur.rowid)"
+                              "          * (CASE WHEN (c.rowid - cur.rowid) * ?4 < 0 THEN 2 ELSE 1 END),"
+                              "         (c.rowid - cur.rowid) * ?4 DESC, c.rowid DESC",
+                              -1, &stmt, NULL);
+  // clang-format on
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, before);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, after);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 4, direction);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_job_t *job = dt_control_job_create(&_prefetch_job_run, "prefetch image");
+    if(!job) break;
+    _prefetch_t *params = (_prefetch_t *)malloc(sizeof(_prefetch_t));
+    params->imgid = sqlite3_column_int(stmt, 0);
+    params->generation = generation;
+    dt_control_job_set_params(job, params, free);
+    dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_BG, job);
+  }
+  sqlite3_finalize(stmt);
+}
+
 static void dt_dev_jump_image(dt_develop_t *dev, int diff, gboolean by_key)
 {
   const int32_t imgid = dev->image_storage.id;
@@ -757,6 +1015,7 @@ static void dt_dev_jump_image(dt_develop_t *dev, int diff, gboolean by_key)
   dt_thumbtable_set_offset(dt_ui_thumbtable(darktable.gui->ui), new_offset, TRUE);
 
   // if id seems valid, we change the image and move filmstrip
+  _prefetch_direction = diff > 0 ? 1 : -1;
   _dev_change_image(new_id);
 }
 
@@ -828,9 +1087,30 @@ static void skip_b_key_accel_callback(dt_action_t *action)
   dt_dev_jump_image(dt_action_view(action)->data, -1, TRUE);
 }
 
+// id of the pending frame callback redrawing the center view, 0 if none
+static guint _redraw_tick = 0;
+
+static gboolean _darkroom_redraw_tick_callback(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
+  _redraw_tick = 0;
+  gtk_widget_queue_draw(widget);
+  return G_SOURCE_REMOVE;
+}
+
+static void _darkroom_cancel_redraw_tick()
+{
+  if(_redraw_tick) gtk_widget_remove_tick_callback(dt_ui_center(darktable.gui->ui), _redraw_tick);
+  _redraw_tick = 0;
+}
+
+// pipes finish at their own pace, the preview and the main pipe sometimes within the same frame.
+// the center view is redrawn with the latest backbuffers at the next frame of the display, once,
+// and not at all while it is not mapped.
 static void _darkroom_ui_pipe_finish_signal_callback(gpointer instance, gpointer data)
 {
-  dt_control_queue_redraw_center();
+  if(!_redraw_tick)
+    _redraw_tick = gtk_widget_add_tick_callback(dt_ui_center(darktable.gui->ui), _darkroom_redraw_tick_callback,
+                                                NULL, NULL);
 }
 
 static void _darkroom_ui_apply_style_activate_callback(gchar *name)
@@ -1286,6 +1566,12 @@ static void _overlay_cycle_callback(dt_action_t *action)
   dt_control_queue_redraw_center();
 }
 
+static void _toggle_pipe_stats_callback(dt_action_t *action)
+{
+  dt_conf_set_bool("darkroom/ui/pipe_stats", !dt_conf_get_bool("darkroom/ui/pipe_stats"));
+  dt_control_queue_redraw_center();
+}
+
 static void _toggle_mask_visibility_callback(dt_action_t *action)
 {
   if(darktable.gui->reset) return;
@@ -1897,6 +2183,9 @@ void gui_init(dt_view_t *self)
   // toggle visibility of drawn masks for current gui module
   dt_action_register(DT_ACTION(self), N_("show drawn masks"), _toggle_mask_visibility_callback, 0, 0);
 
+  // toggle the pipeline statistics overlay
+  dt_action_register(DT_ACTION(self), N_("show pipeline statistics"), _toggle_pipe_stats_callback, 0, 0);
+
   // brush size +/-
   dt_action_register(DT_ACTION(self), N_("increase brush size"), _brush_size_up_callback, 0, 0);
   dt_action_register(DT_ACTION(self), N_("decrease brush size"), _brush_size_down_callback, 0, 0);
@@ -2265,7 +2554,7 @@ static int _auto_save_edit(gpointer data)
   {
     history_top = dt_dev_get_history_end(dev);
     dt_dev_write_history_ext(dev, dev->image_storage.id);
-    dt_image_write_sidecar_file(dev->image_storage.id);
+    dt_sidecar_writer_queue(dev->image_storage.id);
   }
 
   dt_pthread_mutex_unlock(&dev->history_mutex);
@@ -2275,6 +2564,9 @@ static int _auto_save_edit(gpointer data)
 
 void enter(dt_view_t *self)
 {
+  // the module widgets below need their actions and shortcuts, if startup didn't get to them yet
+  dt_shortcuts_init();
+
   // prevent accels_window to refresh
   darktable.view_manager->accels_window.prevent_refresh = TRUE;
 
@@ -2290,6 +2582,7 @@ void enter(dt_view_t *self)
 
   // Make sure we don't start computing pipes until we have a proper history
   dt_pthread_mutex_lock(&dev->pipe_mutex);
+  dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
 
   if(!dev->form_gui)
   {
@@ -2407,8 +2700,11 @@ void enter(dt_view_t *self)
 
   dt_image_check_camera_missing_sample(&dev->image_storage);
 
+  dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
   dt_pthread_mutex_unlock(&dev->pipe_mutex);
 
+  _prefetch_neighbours(dev->image_storage.id);
+
   // Init the starting point of undo/redo
   dt_dev_undo_start_record(dev);
   dt_dev_undo_end_record(dev);
@@ -2441,6 +2737,8 @@ void leave(dt_view_t *self)
   /* disconnect from pipe finish signal */
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_darkroom_ui_pipe_finish_signal_callback),
                                (gpointer)self);
+  _darkroom_cancel_redraw_tick();
+  _focus_peaking_free();
 
   // store groups for next time:
   dt_conf_set_int("plugins/darkroom/groups", dt_dev_modulegroups_get(darktable.develop));
@@ -2481,7 +2779,7 @@ void leave(dt_view_t *self)
   // be sure light table will regenerate the thumbnail:
   if(!dt_history_hash_is_mipmap_synced(dev->image_storage.id))
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    dt_mipmap_cache_regenerate(darktable.mipmap_cache, dev->image_storage.id);
     dt_image_update_final_size(dev->image_storage.id);
     // possibly dump new xmp data
     const dt_history_hash_t hash_status = dt_history_hash_get_status(dev->image_storage.id);
@@ -2489,7 +2787,7 @@ void leave(dt_view_t *self)
     const gboolean fresh = (hash_status == DT_HISTORY_HASH_BASIC) || (hash_status == DT_HISTORY_HASH_AUTO);
     const dt_imageio_write_xmp_t xmp_mode = dt_image_get_xmp_mode();
     if((xmp_mode == DT_WRITE_XMP_ALWAYS) || ((xmp_mode == DT_WRITE_XMP_LAZY) && !fresh))
-      dt_image_synch_xmp(dev->image_storage.id);
+      dt_sidecar_writer_queue(dev->image_storage.id);
     dt_history_hash_set_mipmap(dev->image_storage.id);
 #ifdef USE_LUA
     dt_lua_async_call_alien(dt_lua_event_trigger_wrapper,
@@ -2503,6 +2801,7 @@ void leave(dt_view_t *self)
   // clear gui.
 
   dt_pthread_mutex_lock(&dev->pipe_mutex);
+  dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
 
   dt_dev_pixelpipe_cleanup_nodes(dev->pipe);
   dt_dev_pixelpipe_cleanup_nodes(dev->preview_pipe);
@@ -2535,6 +2834,7 @@ void leave(dt_view_t *self)
 
   dt_pthread_mutex_unlock(&dev->history_mutex);
 
+  dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
   dt_pthread_mutex_unlock(&dev->pipe_mutex);
 
   // cleanup visible masks
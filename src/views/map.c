@@ -46,6 +46,15 @@ typedef struct dt_geo_position_t
   int imgid;
 } dt_geo_position_t;
 
+// the clusters of the images of one tile of the map at one zoom level. the tiles seen while moving
+// the map are kept in dt_map_t::tiles until the images or their locations change.
+typedef struct dt_map_tile_t
+{
+  dt_geo_position_t *points; // ordered by longitude, x and y in radians
+  int nb_points;
+  int nb_clusters;
+} dt_map_tile_t;
+
 typedef struct dt_map_image_t
 {
   gint imgid;
@@ -76,6 +85,9 @@ typedef struct dt_map_t
   int start_drag_offset_x, start_drag_offset_y;
   float thumb_lat_angle, thumb_lon_angle;
   sqlite3_stmt *main_query;
+  GHashTable *tiles;
+  int tiles_points;
+  int tiles_epsilon_factor, tiles_min_images;
   gboolean drop_filmstrip_activated;
   gboolean filter_images_drawn;
   int max_images_drawn;
@@ -176,10 +188,11 @@ static void _view_map_dnd_remove_callback(GtkWidget *widget, GdkDragContext *con
                                           GtkSelectionData *selection_data, guint target_type, guint time,
                                           gpointer data);
 // find the images clusters on the map
-static void _dbscan(dt_geo_position_t *points, unsigned int num_points, double epsilon,
-                    unsigned int minpts);
+static int _dbscan(dt_geo_position_t *points, unsigned int num_points, double epsilon,
+                   unsigned int minpts);
 static gboolean _view_map_prefs_changed(dt_map_t *lib);
 static void _view_map_build_main_query(dt_map_t *lib);
+static void _view_map_tiles_invalidate(dt_map_t *lib);
 
 /* center map to on the baricenter of the image list */
 static gboolean _view_map_center_on_image_list(dt_view_t *self, const char *table);
@@ -714,6 +727,7 @@ void init(dt_view_t *self)
   /* build the query string */
   lib->main_query = NULL;
   _view_map_build_main_query(lib);
+  lib->tiles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _view_map_tile_free);
 
 #ifdef USE_LUA
   lua_State *L = darktable.lua_state.state;
@@ -794,6 +808,7 @@ void cleanup(dt_view_t *self)
     //     g_object_unref(G_OBJECT(lib->map));
   }
   if(lib->main_query) sqlite3_finalize(lib->main_query);
+  if(lib->tiles) g_hash_table_destroy(lib->tiles);
   free(self->data);
 }
 
@@ -1137,18 +1152,18 @@ static GdkPixbuf *_draw_image(const int imgid, int *width, int *height,
 
     if(buf.buf && buf.width > 0)
     {
-      for(int i = 3; i < (size_t)4 * buf.width * buf.height; i += 4) buf.buf[i] = UINT8_MAX;
-
       int w = _thumb_size, h = _thumb_size;
       if(buf.width < buf.height)
         w = (buf.width * _thumb_size) / buf.height; // portrait
       else
         h = (buf.height * _thumb_size) / buf.width; // landscape
 
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(buf.buf, GDK_COLORSPACE_RGB, TRUE,
-                                        8, buf.width, buf.height,
-                                        buf.width * 4, NULL, NULL);
+      // next we get a pixbuf for the image, the mipmap is in the layout of cairo surfaces
+      cairo_surface_t *surface = cairo_image_surface_create_for_data(
+          buf.buf, CAIRO_FORMAT_RGB24, buf.width, buf.height,
+          cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width));
+      source = gdk_pixbuf_get_from_surface(surface, 0, 0, buf.width, buf.height);
+      cairo_surface_destroy(surface);
       dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
       if(!source) goto map_changed_failure;
       // now we want a slightly larger pixbuf that we can put the image on
@@ -1268,11 +1283,85 @@ static void _view_map_get_bounding_box(dt_map_t *lib, dt_map_box_t *bbox)
   memcpy(bbox, &box, sizeof(dt_map_box_t));
 }
 
+// zoom varies from 0 (156412 m/pixel) to 20 (0.149 m/pixel)
+// https://wiki.openstreetmap.org/wiki/Zoom_levels
+// a tile spans 4 osm tiles of 256 pixels, in degrees of longitude and of latitude
+static double _view_map_tile_size(const int zoom)
+{
+  return 4.0 * 360.0 / (double)(1u << CLAMP(zoom, 0, 30));
+}
+
+static void _view_map_tile_free(gpointer data)
+{
+  dt_map_tile_t *tile = (dt_map_tile_t *)data;
+  g_free(tile->points);
+  g_free(tile);
+}
+
+static void _view_map_tiles_invalidate(dt_map_t *lib)
+{
+  if(lib->tiles) g_hash_table_remove_all(lib->tiles);
+  lib->tiles_points = 0;
+}
+
+// the clusters of tile (tx, ty) at zoom, from the cache or computed now
+static dt_map_tile_t *_view_map_get_tile(dt_map_t *lib, const int zoom, const int tx, const int ty)
+{
+  gchar *key = g_strdup_printf("%d/%d/%d", zoom, tx, ty);
+  dt_map_tile_t *tile = g_hash_table_lookup(lib->tiles, key);
+  if(tile)
+  {
+    g_free(key);
+    return tile;
+  }
+
+  const double size = _view_map_tile_size(zoom);
+  const double lon1 = -180.0 + tx * size, lon2 = lon1 + size;
+  const double lat2 = -90.0 + ty * size, lat1 = lat2 + size;
+
+  /* let's reset and reuse the main_query statement */
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->main_query);
+  DT_DEBUG_SQLITE3_RESET(lib->main_query);
+
+  /* bind the tile coords for the main query, the last tiles include the edges of the world */
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 1, lon1);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 2, lon2 >= 180.0 ? 181.0 : lon2);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 3, lat1 >= 90.0 ? 91.0 : lat1);
+  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 4, lat2);
+
+  tile = g_new0(dt_map_tile_t, 1);
+  GArray *points = g_array_new(FALSE, FALSE, sizeof(dt_geo_position_t));
+  while(sqlite3_step(lib->main_query) == SQLITE_ROW)
+  {
+    dt_geo_position_t point;
+    point.imgid = sqlite3_column_int(lib->main_query, 0);
+    point.x = sqlite3_column_double(lib->main_query, 1) * M_PI / 180;
+    point.y = sqlite3_column_double(lib->main_query, 2) * M_PI / 180;
+    point.cluster_id = UNCLASSIFIED;
+    g_array_append_val(points, point);
+  }
+  tile->nb_points = points->len;
+  tile->points = (dt_geo_position_t *)g_array_free(points, FALSE);
+
+  if(tile->nb_points)
+  {
+    // each time zoom increases by 1 the size is divided by 2
+    // epsilon factor = 100 => epsilon covers more or less a thumbnail surface
+    #define R 6371   // earth radius (km)
+    const double epsilon = thumb_size * (((unsigned int)(156412000 >> zoom))
+                                         * lib->tiles_epsilon_factor * 0.01 * 0.000001 / R);
+    tile->nb_clusters = _dbscan(tile->points, tile->nb_points, epsilon, lib->tiles_min_images);
+  }
+
+  lib->tiles_points += tile->nb_points;
+  g_hash_table_insert(lib->tiles, key, tile);
+  return tile;
+}
+
 static void _view_map_changed_callback_delayed(gpointer user_data)
 {
   dt_view_t *self = (dt_view_t *)user_data;
   dt_map_t *lib = (dt_map_t *)self->data;
-  gboolean all_good = TRUE;
   gboolean needs_redraw = FALSE;
   gboolean prefs_changed = _view_map_prefs_changed(lib);
 
@@ -1310,115 +1399,123 @@ static void _view_map_changed_callback_delayed(gpointer user_data)
     dt_conf_set_float("plugins/map/latitude", center_lat);
     dt_conf_set_int("plugins/map/zoom", zoom);
 
-    /* let's reset and reuse the main_query statement */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->main_query);
+    // the clusters are computed per tile and kept, moving the map only computes the tiles not seen yet
+    const int epsilon_factor = dt_conf_get_int("plugins/map/epsilon_factor");
+    const int min_images = dt_conf_get_int("plugins/map/min_images_per_group");
+    if(prefs_changed || epsilon_factor != lib->tiles_epsilon_factor || min_images != lib->tiles_min_images)
+    {
+      _view_map_tiles_invalidate(lib);
+      lib->tiles_epsilon_factor = epsilon_factor;
+      lib->tiles_min_images = min_images;
+    }
 
-    /* bind bounding box coords for the main query */
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 1, lib->bbox.lon1);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 2, lib->bbox.lon2);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 3, lib->bbox.lat1);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->main_query, 4, lib->bbox.lat2);
+    // keep the memory bounded, the tiles of the current view are computed again
+    if(lib->tiles_points > 1024 * 1024) _view_map_tiles_invalidate(lib);
 
-    // count the images
+    const double size = _view_map_tile_size(zoom);
+    // the last tiles hold the edges of the world
+    const int tx1 = floor((lib->bbox.lon1 + 180.0) / size);
+    const int tx2 = MIN(floor((lib->bbox.lon2 + 180.0) / size), ceil(360.0 / size) - 1);
+    const int ty1 = floor((lib->bbox.lat2 + 90.0) / size);
+    const int ty2 = MIN(floor((lib->bbox.lat1 + 90.0) / size), ceil(180.0 / size) - 1);
+
+    GPtrArray *tiles = g_ptr_array_new();
     int img_count = 0;
-    while(sqlite3_step(lib->main_query) == SQLITE_ROW)
-    {
-      img_count++;
-    }
+    dt_times_t start;
+    dt_get_times(&start);
+    for(int ty = ty1; ty <= ty2; ty++)
+      for(int tx = tx1; tx <= tx2; tx++)
+      {
+        dt_map_tile_t *tile = _view_map_get_tile(lib, zoom, tx, ty);
+        g_ptr_array_add(tiles, tile);
+        img_count += tile->nb_points;
+      }
+    dt_show_times(&start, "[map] clusters of the visible tiles");
 
-    if(lib->points)
-      g_free(lib->points);
+    // the points of the visible tiles, with cluster ids unique to the whole view
+    g_free(lib->points);
     lib->points = NULL;
     lib->nb_points = img_count;
     if(img_count > 0)
-      lib->points = (dt_geo_position_t *)calloc(img_count, sizeof(dt_geo_position_t));
+      lib->points = g_new(dt_geo_position_t, img_count);
     dt_geo_position_t *p = lib->points;
     if(p)
     {
-      DT_DEBUG_SQLITE3_RESET(lib->main_query);
-      /* make the image list */
-      int i = 0;
-      while(sqlite3_step(lib->main_query) == SQLITE_ROW && all_good && i < img_count)
-      {
-        p[i].imgid = sqlite3_column_int(lib->main_query, 0);
-        p[i].x = sqlite3_column_double(lib->main_query, 1) * M_PI / 180;
-        p[i].y = sqlite3_column_double(lib->main_query, 2) * M_PI / 180;
-        p[i].cluster_id = UNCLASSIFIED;
-        i++;
-      }
-
-      const float epsilon_factor = dt_conf_get_int("plugins/map/epsilon_factor");
-      const int min_images = dt_conf_get_int("plugins/map/min_images_per_group");
-      // zoom varies from 0 (156412 m/pixel) to 20 (0.149 m/pixel)
-      // https://wiki.openstreetmap.org/wiki/Zoom_levels
-      // each time zoom increases by 1 the size is divided by 2
-      // epsilon factor = 100 => epsilon covers more or less a thumbnail surface
-      #define R 6371   // earth radius (km)
-      double epsilon = thumb_size * (((unsigned int)(156412000 >> zoom))
-                                  * epsilon_factor * 0.01 * 0.000001 / R);
-
-      dt_times_t start;
-      dt_get_times(&start);
-      _dbscan(p, img_count, epsilon, min_images);
-      dt_show_times(&start, "[map] dbscan calculation");
-
-      // set the clusters
       GList *sel_imgs = dt_act_on_get_images(FALSE, FALSE, FALSE);
-      int group = -1;
-      for(i = 0; i< img_count; i++)
+      GHashTable *selected = g_hash_table_new(NULL, NULL);
+      for(GList *l = sel_imgs; l; l = g_list_next(l)) g_hash_table_add(selected, l->data);
+      g_list_free(sel_imgs);
+
+      int i = 0, group = 0;
+      for(guint t = 0; t < tiles->len; t++)
       {
-        if(p[i].cluster_id == NOISE)
+        const dt_map_tile_t *tile = g_ptr_array_index(tiles, t);
+        // the entry of each cluster of the tile and the position of its first image
+        dt_map_image_t **entries = g_new0(dt_map_image_t *, tile->nb_clusters);
+        const dt_geo_position_t **firsts = g_new0(const dt_geo_position_t *, tile->nb_clusters);
+        for(int k = 0; k < tile->nb_points; k++, i++)
         {
-          dt_map_image_t *entry = (dt_map_image_t *)calloc(1, sizeof(dt_map_image_t));
-          entry->imgid = p[i].imgid;
-          entry->group = p[i].cluster_id;
-          entry->group_count = 1;
-          entry->longitude = p[i].x * 180 / M_PI;
-          entry->latitude = p[i].y * 180 / M_PI;
-          entry->group_same_loc = TRUE;
-          if(sel_imgs)
-            entry->selected_in_group = g_list_find((GList *)sel_imgs,
-                                                   GINT_TO_POINTER(entry->imgid))
-                                       ? TRUE : FALSE;
-          lib->images = g_slist_prepend(lib->images, entry);
-        }
-        else if(p[i].cluster_id > group)
-        {
-          group = p[i].cluster_id;
-          dt_map_image_t *entry = (dt_map_image_t *)calloc(1, sizeof(dt_map_image_t));
-          entry->imgid = p[i].imgid;
-          entry->group = p[i].cluster_id;
-          entry->group_same_loc = TRUE;
-          entry->selected_in_group = (sel_imgs && g_list_find((GList *)sel_imgs,
-                                                               GINT_TO_POINTER(p[i].imgid)))
-                                     ? TRUE : FALSE;
-          const double lon = p[i].x, lat = p[i].y;
-          for(int j = 0; j < img_count; j++)
+          const dt_geo_position_t *tp = &tile->points[k];
+          p[i] = *tp;
+          const gboolean sel = g_hash_table_contains(selected, GINT_TO_POINTER(tp->imgid));
+          if(tp->cluster_id == NOISE)
           {
-            if(p[j].cluster_id == group)
-            {
-              entry->group_count++;
-              entry->longitude += p[j].x;
-              entry->latitude += p[j].y;
-              if(entry->group_same_loc && (p[j].x != lon || p[j].y != lat))
-              {
-                entry->group_same_loc = FALSE;
-              }
-              if(sel_imgs && !entry->selected_in_group)
-              {
-                if(g_list_find((GList *)sel_imgs, GINT_TO_POINTER(p[j].imgid)))
-                  entry->selected_in_group = TRUE;
-              }
-            }
+            const double lon = tp->x * 180 / M_PI, lat = tp->y * 180 / M_PI;
+            if(lon < lib->bbox.lon1 || lon > lib->bbox.lon2 || lat > lib->bbox.lat1 || lat < lib->bbox.lat2)
+              continue;
+            dt_map_image_t *entry = (dt_map_image_t *)calloc(1, sizeof(dt_map_image_t));
+            entry->imgid = tp->imgid;
+            entry->group = NOISE;
+            entry->group_count = 1;
+            entry->longitude = lon;
+            entry->latitude = lat;
+            entry->group_same_loc = TRUE;
+            entry->selected_in_group = sel;
+            lib->images = g_slist_prepend(lib->images, entry);
+            continue;
+          }
+          else if(tp->cluster_id < 0)
+            continue;
+
+          p[i].cluster_id = group + tp->cluster_id;
+          dt_map_image_t *entry = entries[tp->cluster_id];
+          if(!entry)
+          {
+            entry = entries[tp->cluster_id] = (dt_map_image_t *)calloc(1, sizeof(dt_map_image_t));
+            entry->imgid = tp->imgid;
+            entry->group = p[i].cluster_id;
+            entry->group_same_loc = TRUE;
+            firsts[tp->cluster_id] = tp;
           }
-          entry->latitude = entry->latitude  * 180 / M_PI / entry->group_count;
+          entry->group_count++;
+          entry->longitude += tp->x;
+          entry->latitude += tp->y;
+          const dt_geo_position_t *first = firsts[tp->cluster_id];
+          if(entry->group_same_loc && (tp->x != first->x || tp->y != first->y))
+            entry->group_same_loc = FALSE;
+          if(sel) entry->selected_in_group = TRUE;
+        }
+
+        // the clusters of the tiles on the edges may lie outside of the view
+        for(int c = 0; c < tile->nb_clusters; c++)
+        {
+          dt_map_image_t *entry = entries[c];
+          if(!entry) continue;
+          entry->latitude = entry->latitude * 180 / M_PI / entry->group_count;
           entry->longitude = entry->longitude * 180 / M_PI / entry->group_count;
-          lib->images = g_slist_prepend(lib->images, entry);
+          if(entry->longitude < lib->bbox.lon1 || entry->longitude > lib->bbox.lon2
+             || entry->latitude > lib->bbox.lat1 || entry->latitude < lib->bbox.lat2)
+            free(entry);
+          else
+            lib->images = g_slist_prepend(lib->images, entry);
         }
+        g_free(entries);
+        g_free(firsts);
+        group += tile->nb_clusters;
       }
-      g_list_free(sel_imgs);
+      g_hash_table_destroy(selected);
     }
+    g_ptr_array_free(tiles, TRUE);
 
     needs_redraw = _view_map_draw_images(self);
     _view_map_draw_main_location(lib, &lib->loc.main);
@@ -2496,6 +2593,9 @@ static void _view_map_collection_changed(gpointer instance, dt_collection_change
 {
   dt_view_t *self = (dt_view_t *)user_data;
   dt_map_t *lib = (dt_map_t *)self->data;
+  // images may have been added, removed or filtered out
+  _view_map_tiles_invalidate(lib);
+
   // avoid to centre the map on collection while a location is active
   if(darktable.view_manager->proxy.map.view && !lib->loc.main.id)
   {
@@ -2525,6 +2625,7 @@ static void _view_map_geotag_changed(gpointer instance, GList *imgs, const int l
   {
     dt_view_t *self = (dt_view_t *)user_data;
     dt_map_t *lib = (dt_map_t *)self->data;
+    _view_map_tiles_invalidate(lib);
     if(darktable.view_manager->proxy.map.view) g_signal_emit_by_name(lib->map, "changed");
   }
 }
@@ -2788,8 +2889,8 @@ static void _view_map_build_main_query(dt_map_t *lib)
   // clang-format off
   geo_query = g_strdup_printf("SELECT * FROM"
                               " (SELECT id, longitude, latitude "
-                              "   FROM %s WHERE longitude >= ?1 AND longitude <= ?2"
-                              "           AND latitude <= ?3 AND latitude >= ?4 "
+                              "   FROM %s WHERE longitude >= ?1 AND longitude < ?2"
+                              "           AND latitude < ?3 AND latitude >= ?4 "
                               "           AND longitude NOT NULL AND latitude NOT NULL)"
                               "   ORDER BY longitude ASC",  // critical to make dbscan work
                               lib->filter_images_drawn
@@ -2913,8 +3014,9 @@ static int _dbscan_expand(unsigned int index)
   return return_value;
 }
 
-static void _dbscan(dt_geo_position_t *points, unsigned int num_points,
-                    double epsilon, unsigned int minpts)
+// returns the number of clusters
+static int _dbscan(dt_geo_position_t *points, unsigned int num_points,
+                   double epsilon, unsigned int minpts)
 {
   db.points = points;
   db.num_points = num_points;
@@ -2942,6 +3044,7 @@ static void _dbscan(dt_geo_position_t *points, unsigned int num_points,
   g_free(db.seeds);
   g_free(db.spreads);
   }
+  return db.cluster_id;
 }
 
 // clang-format off
@@ -20,10 +20,13 @@
 #include "common/colorspaces.h"
 #include "common/debug.h"
 #include "common/dtpthread.h"
+#include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "develop/imageop_math.h"
 #include "dtgtk/thumbtable.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -41,21 +44,16 @@ typedef enum dt_slideshow_event_t
   S_REQUEST_STEP_BACK,
 } dt_slideshow_event_t;
 
-typedef enum dt_slideshow_slot_t
-{
-  S_LEFT      = 0,
-  S_CURRENT   = 1,
-  S_RIGHT     = 2,
-  S_SLOT_LAST = 3
-} dt_slideshow_slot_t;
+// upper bound of the frames rendered ahead and kept behind the current one
+#define S_MAX_FRAMES 16
 
 typedef struct _slideshow_buf_t
 {
   uint32_t *buf;
   uint32_t width;
   uint32_t height;
-  int32_t rank;
-  gboolean invalidated;
+  int32_t rank;        // -1 if the frame holds no image
+  gboolean invalidated; // reserved for rank, not rendered yet
 } dt_slideshow_buf_t;
 
 typedef struct dt_slideshow_t
@@ -63,14 +61,17 @@ typedef struct dt_slideshow_t
   int32_t col_count;
   uint32_t width, height;
 
-  // buffers
-  dt_slideshow_buf_t buf[S_SLOT_LAST];
-  gboolean init_phase;
+  // ring of screen-size frames around the current image, see _wanted_rank()
+  dt_slideshow_buf_t buf[S_MAX_FRAMES];
+  int frames;
+  int32_t rank;  // displayed image
+  int direction; // 1 or -1, the direction of travel
 
   // state machine stuff for image transitions:
   dt_pthread_mutex_t lock;
 
   gboolean auto_advance;
+  gboolean job_pending; // a job is rendering the frames, or about to
   int exporting;
   int delay;
 
@@ -107,8 +108,8 @@ static const char *mime(dt_imageio_module_data_t *data)
 
 static int write_image(dt_imageio_module_data_t *datai, const char *filename, const void *in,
                        dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
-                       void *exif, int exif_len, int imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
-                       const gboolean export_masks)
+                       void *exif, int exif_len, const char *xmp, int imgid, int num, int total,
+                       dt_dev_pixelpipe_t *pipe, const gboolean export_masks)
 {
   dt_slideshow_format_t *data = (dt_slideshow_format_t *)datai;
 
@@ -120,42 +121,83 @@ static int write_image(dt_imageio_module_data_t *datai, const char *filename, co
   return 0;
 }
 
-static void shift_left(dt_slideshow_t *d)
+// the rank of the p-th frame to render, by priority: the current image, the next one and the previous
+// one, then the other ones ahead in the direction of travel, then the other ones behind, so going back
+// a couple of images is instant as well.
+static int32_t _wanted_rank(const dt_slideshow_t *d, const int p)
+{
+  const int behind = MAX(1, (d->frames - 1) / 3);
+  const int ahead = d->frames - 1 - behind;
+  int offset;
+  if(p == 0)
+    offset = 0;
+  else if(p == 1)
+    offset = 1;
+  else if(p == 2)
+    offset = -1;
+  else if(p <= ahead + 1)
+    offset = p - 1;
+  else
+    offset = -(p - ahead);
+  return d->rank + offset * d->direction;
+}
+
+static gboolean _is_wanted(const dt_slideshow_t *d, const int32_t rank)
 {
-  uint32_t *tmp_buf = d->buf[S_LEFT].buf;
+  for(int p = 0; p < d->frames; p++)
+    if(_wanted_rank(d, p) == rank) return TRUE;
+  return FALSE;
+}
 
-  for(int k=S_LEFT; k<S_RIGHT; k++)
-  {
-    d->buf[k].buf         = d->buf[k+1].buf;
-    d->buf[k].rank        = d->buf[k+1].rank;
-    d->buf[k].width       = d->buf[k+1].width;
-    d->buf[k].height      = d->buf[k+1].height;
-    d->buf[k].invalidated = d->buf[k+1].invalidated;
-  }
-  d->buf[S_RIGHT].invalidated = TRUE;
-  d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
-  d->buf[S_RIGHT].buf = tmp_buf;
+static dt_slideshow_buf_t *_get_frame(dt_slideshow_t *d, const int32_t rank)
+{
+  for(int k = 0; k < d->frames; k++)
+    if(d->buf[k].rank == rank) return &d->buf[k];
+  return NULL;
 }
 
-static void shift_right(dt_slideshow_t *d)
+static gboolean _frame_ready(dt_slideshow_t *d, const int32_t rank)
 {
-  uint32_t *tmp_buf = d->buf[S_RIGHT].buf;
+  const dt_slideshow_buf_t *frame = _get_frame(d, rank);
+  return frame && !frame->invalidated;
+}
 
-  for(int k=S_RIGHT; k>S_LEFT; k--)
+// reserve a frame for the most wanted image not rendered yet, recycling the frame of the image farthest
+// from the current one. renders of images which are no longer wanted are dropped this way, before they
+// start. returns the rank to render, or -1 if all the wanted frames are there. call with the lock held.
+static int32_t _reserve_frame(dt_slideshow_t *d)
+{
+  for(int p = 0; p < d->frames; p++)
   {
-    d->buf[k].buf         = d->buf[k-1].buf;
-    d->buf[k].rank        = d->buf[k-1].rank;
-    d->buf[k].width       = d->buf[k-1].width;
-    d->buf[k].height      = d->buf[k-1].height;
-    d->buf[k].invalidated = d->buf[k-1].invalidated;
+    const int32_t rank = _wanted_rank(d, p);
+    if(rank < 0 || rank >= d->col_count || _get_frame(d, rank)) continue;
+
+    dt_slideshow_buf_t *frame = NULL;
+    int32_t distance = -1;
+    for(int k = 0; k < d->frames; k++)
+    {
+      const int32_t dist = d->buf[k].rank < 0 ? INT32_MAX : abs(d->buf[k].rank - d->rank);
+      if(dist > distance && (d->buf[k].rank < 0 || !_is_wanted(d, d->buf[k].rank)))
+      {
+        frame = &d->buf[k];
+        distance = dist;
+      }
+    }
+    if(!frame) return -1;
+
+    frame->rank = rank;
+    frame->invalidated = TRUE;
+    d->exporting++;
+    return rank;
   }
-  d->buf[S_LEFT].invalidated = TRUE;
-  d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-  d->buf[S_LEFT].buf = tmp_buf;
+  return -1;
 }
 
 static void requeue_job(dt_slideshow_t *d)
 {
+  // a single job renders the frames one after the other, it picks the next one when it is done
+  if(d->job_pending) return;
+  d->job_pending = TRUE;
   dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, process_job_create(d));
 }
 
@@ -165,7 +207,46 @@ static void _set_delay(dt_slideshow_t *d, int value)
   dt_conf_set_int("slideshow_delay", d->delay);
 }
 
-static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
+// the screen-size render of an image, taken from its thumbnail when one in memory or on disk covers it
+// in the display colorspace. this is a lot cheaper than running the export pipe.
+static gboolean _thumbnail_frame(const int32_t id, const uint32_t width, const uint32_t height,
+                                 dt_slideshow_buf_t *out)
+{
+  const dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'r');
+  const int32_t final_width = img->final_width;
+  const int32_t final_height = img->final_height;
+  dt_image_cache_read_release(darktable.image_cache, img);
+  if(final_width <= 0 || final_height <= 0) return FALSE;
+
+  // the size of the render: fitted to the screen, not upscaled
+  const float scale = fminf(1.0f, fminf(width / (float)final_width, height / (float)final_height));
+  const int32_t fit_width = final_width * scale;
+  const int32_t fit_height = final_height * scale;
+
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(cache, fit_width, fit_height);
+  if(cache->max_width[mip] < fit_width || cache->max_height[mip] < fit_height) return FALSE;
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(cache, &buf, id, mip, DT_MIPMAP_TESTLOCK, 'r');
+  if(!buf.buf && dt_mipmap_cache_has_disk_thumbnail(cache, id, mip))
+    dt_mipmap_cache_get(cache, &buf, id, mip, DT_MIPMAP_BLOCKING, 'r');
+  if(!buf.buf) return FALSE;
+
+  // thumbnails made from a small embedded jpeg don't cover the screen
+  const gboolean covers = buf.color_space == DT_COLORSPACE_DISPLAY && buf.width + 1 >= fit_width
+                          && buf.height + 1 >= fit_height;
+  if(covers)
+  {
+    dt_iop_flip_and_zoom_8(buf.buf, buf.width, buf.height, (uint8_t *)out->buf, MIN(fit_width, buf.width),
+                           MIN(fit_height, buf.height), ORIENTATION_NONE, &out->width, &out->height);
+    out->invalidated = FALSE;
+  }
+  dt_mipmap_cache_release(cache, &buf);
+  return covers;
+}
+
+static int process_image(dt_slideshow_t *d, const int32_t rank)
 {
   dt_imageio_module_format_t buf;
   buf.mime = mime;
@@ -179,75 +260,64 @@ static int process_image(dt_slideshow_t *d, dt_slideshow_slot_t slot)
   dat.head.width = dat.head.max_width = d->width;
   dat.head.height = dat.head.max_height = d->height;
   dat.head.style[0] = '\0';
-  dat.rank = d->buf[slot].rank;
+  dat.rank = rank;
   dat.buf.buf = dt_alloc_align(sizeof(uint32_t) * d->width * d->height);
-
-  d->exporting++;
-
-  const int32_t rank = dat.rank;
+  dat.buf.invalidated = TRUE;
   const gchar *query = dt_collection_get_query(darktable.collection);
-
-  if(rank<0 || rank>=d->col_count || !query)
-  {
-    d->exporting--;
-    dt_pthread_mutex_unlock(&d->lock);
-    goto error;
-  }
-
   dt_pthread_mutex_unlock(&d->lock);
 
   // get random image id from sql
   int32_t id = 0;
 
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rank);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
-  if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  if(query && dat.buf.buf)
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rank);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, 1);
+    if(sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
 
-  if(id)
+  if(id && !_thumbnail_frame(id, dat.head.max_width, dat.head.max_height, &dat.buf))
   {
     // the flags are: ignore exif, display byteorder, high quality, upscale, thumbnail
     dt_imageio_export_with_flags(id, "unused", &buf, (dt_imageio_module_data_t *)&dat, TRUE, TRUE,
                                  FALSE, FALSE, FALSE, NULL, FALSE, FALSE, DT_COLORSPACE_DISPLAY,
                                  NULL, DT_INTENT_LAST, NULL, NULL, 1, 1, NULL);
+  }
 
-    // lock to copy back into the slot the rendered buffer, not that this is done only if
-    // the slot rank is still the same as the local buffer rank. This can be false if the
-    // buffers have been shifted to advance to next image.
-    dt_pthread_mutex_lock(&d->lock);
-    if(dat.rank == d->buf[slot].rank)
-    {
-      memcpy(d->buf[slot].buf, dat.buf.buf, sizeof(uint32_t) * dat.buf.width * dat.buf.height);
-      d->buf[slot].width = dat.buf.width;
-      d->buf[slot].height = dat.buf.height;
-      d->buf[slot].invalidated = FALSE;
-    }
-    d->exporting--;
-    dt_pthread_mutex_unlock(&d->lock);
+  // lock to copy back the rendered buffer into the frame, if it is still reserved for this image.
+  // it may have been recycled for another one after a few steps.
+  dt_pthread_mutex_lock(&d->lock);
+  dt_slideshow_buf_t *frame = _get_frame(d, rank);
+  if(frame && frame->invalidated)
+  {
+    // an image that can't be rendered is shown as an empty frame, rather than tried again and again
+    if(dat.buf.invalidated)
+      dat.buf.width = dat.buf.height = 0;
+    else
+      memcpy(frame->buf, dat.buf.buf, sizeof(uint32_t) * dat.buf.width * dat.buf.height);
+    frame->width = dat.buf.width;
+    frame->height = dat.buf.height;
+    frame->invalidated = FALSE;
   }
+  const gboolean current = rank == d->rank;
+  d->exporting--;
+  dt_pthread_mutex_unlock(&d->lock);
 
-  dt_free_align(dat.buf.buf);
-  return 0;
+  if(current) dt_control_queue_redraw_center();
 
- error:
   dt_free_align(dat.buf.buf);
-  return 1;
-}
-
-static gboolean _is_idle(dt_slideshow_t *d)
-{
-  return !((d->buf[S_LEFT].invalidated && d->buf[S_LEFT].rank <= d->col_count)
-           || (d->buf[S_CURRENT].invalidated && d->buf[S_CURRENT].rank <= d->col_count)
-           || (d->buf[S_RIGHT].invalidated && d->buf[S_RIGHT].rank <= d->col_count));
+  return dat.buf.invalidated;
 }
 
 static gboolean auto_advance(gpointer user_data)
 {
   dt_slideshow_t *d = (dt_slideshow_t *)user_data;
   if(!d->auto_advance) return FALSE;
-  if(!_is_idle(d)) return TRUE; // never try to advance if still exporting, but call me back again
+  // never try to advance before the next image is ready, but call me back again
+  if(d->rank < d->col_count - 1 && !_frame_ready(d, d->rank + 1)) return TRUE;
   _step_state(d, S_REQUEST_STEP);
   return FALSE;
 }
@@ -256,23 +326,16 @@ static int32_t process_job_run(dt_job_t *job)
 {
   dt_slideshow_t *d = dt_control_job_get_params(job);
 
-  if(d->buf[S_CURRENT].invalidated && d->buf[S_CURRENT].rank <= d->col_count)
-  {
-    process_image(d, S_CURRENT);
-    dt_control_queue_redraw_center();
-  }
-  else if(d->buf[S_RIGHT].invalidated && d->buf[S_RIGHT].rank <= d->col_count)
+  while(TRUE)
   {
-    process_image(d, S_RIGHT);
-  }
-  else if(d->buf[S_LEFT].invalidated && d->buf[S_LEFT].rank >= 0)
-  {
-    process_image(d, S_LEFT);
-  }
+    dt_pthread_mutex_lock(&d->lock);
+    const int32_t rank = _reserve_frame(d);
+    if(rank < 0) d->job_pending = FALSE;
+    dt_pthread_mutex_unlock(&d->lock);
 
-  // any other slot to fill?
-  if(!_is_idle(d))
-    requeue_job(d);
+    if(rank < 0) break;
+    process_image(d, rank);
+  }
 
   return 0;
 }
@@ -287,7 +350,7 @@ static dt_job_t *process_job_create(dt_slideshow_t *d)
 
 static void _refresh_display(dt_slideshow_t *d)
 {
-  if(!d->buf[S_CURRENT].invalidated && d->buf[S_CURRENT].rank >= 0)
+  if(_frame_ready(d, d->rank))
     dt_control_queue_redraw_center();
 }
 
@@ -298,11 +361,10 @@ static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event)
 
   if(event == S_REQUEST_STEP)
   {
-    if(d->buf[S_CURRENT].rank < d->col_count - 1)
+    if(d->rank < d->col_count - 1)
     {
-      shift_left(d);
-      d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
-      d->buf[S_RIGHT].invalidated = d->buf[S_RIGHT].rank < d->col_count;
+      d->rank++;
+      d->direction = 1;
       _refresh_display(d);
       requeue_job(d);
     }
@@ -314,11 +376,10 @@ static void _step_state(dt_slideshow_t *d, dt_slideshow_event_t event)
   }
   else if(event == S_REQUEST_STEP_BACK)
   {
-    if(d->buf[S_CURRENT].rank > 0)
+    if(d->rank > 0)
     {
-      shift_right(d);
-      d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-      d->buf[S_LEFT].invalidated = d->buf[S_LEFT].rank >= 0;
+      d->rank--;
+      d->direction = -1;
       _refresh_display(d);
       requeue_job(d);
     }
@@ -406,11 +467,17 @@ void enter(dt_view_t *self)
   d->width = rect.width * darktable.gui->ppd;
   d->height = rect.height * darktable.gui->ppd;
 
-  for(int k=S_LEFT; k<S_SLOT_LAST; k++)
+  // as many frames as configured, as long as they take less than a quarter of the memory budget
+  const size_t frame_size = sizeof(uint32_t) * d->width * d->height;
+  const int fit = MAX(3, (int)MIN((size_t)S_MAX_FRAMES, dt_get_available_mem() / 4 / frame_size));
+  d->frames = MIN(CLAMP(dt_conf_get_int("slideshow_frames"), 3, S_MAX_FRAMES), fit);
+
+  for(int k = 0; k < d->frames; k++)
   {
-    d->buf[k].buf = dt_alloc_align(sizeof(uint32_t) * d->width * d->height);
+    d->buf[k].buf = dt_alloc_align(frame_size);
     d->buf[k].width =  d->width;
     d->buf[k].height = d->height;
+    d->buf[k].rank = -1;
     d->buf[k].invalidated = TRUE;
   }
 
@@ -431,21 +498,21 @@ void enter(dt_view_t *self)
     sqlite3_finalize(stmt);
   }
 
-  d->buf[S_CURRENT].rank = selrank == -1 ? dt_thumbtable_get_offset(dt_ui_thumbtable(darktable.gui->ui)) : selrank;
-  d->buf[S_LEFT].rank = d->buf[S_CURRENT].rank - 1;
-  d->buf[S_RIGHT].rank = d->buf[S_CURRENT].rank + 1;
+  d->rank = selrank == -1 ? dt_thumbtable_get_offset(dt_ui_thumbtable(darktable.gui->ui)) : selrank;
+  d->direction = 1;
 
   d->col_count = dt_collection_get_count(darktable.collection);
 
   d->auto_advance = FALSE;
+  d->job_pending = FALSE;
   d->delay = dt_conf_get_int("slideshow_delay");
-  // restart from beginning, will first increment counter by step and then prefetch
+
+  // start first job
+  requeue_job(d);
   dt_pthread_mutex_unlock(&d->lock);
 
   gtk_widget_grab_focus(dt_ui_center(darktable.gui->ui));
 
-  // start first job
-  dt_control_add_job(darktable.control, DT_JOB_QUEUE_USER_BG, process_job_create(d));
   dt_control_log(_("waiting to start slideshow"));
 }
 
@@ -462,15 +529,18 @@ void leave(dt_view_t *self)
   // otherwise we will crash releasing lock and memory.
   while(d->exporting > 0) sleep(1);
 
-  dt_thumbtable_set_offset(dt_ui_thumbtable(darktable.gui->ui), d->buf[S_CURRENT].rank, FALSE);
+  dt_thumbtable_set_offset(dt_ui_thumbtable(darktable.gui->ui), d->rank, FALSE);
 
   dt_pthread_mutex_lock(&d->lock);
 
-  for(int k=S_LEFT; k<S_SLOT_LAST; k++)
+  for(int k = 0; k < d->frames; k++)
   {
     dt_free_align(d->buf[k].buf);
     d->buf[k].buf = NULL;
+    d->buf[k].rank = -1;
   }
+  // a job still queued finds nothing left to render
+  d->frames = 0;
   dt_pthread_mutex_unlock(&d->lock);
 }
 
@@ -482,9 +552,9 @@ void expose(dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t
   dt_pthread_mutex_lock(&d->lock);
   cairo_paint(cr);
 
-  const dt_slideshow_buf_t *slot = &(d->buf[S_CURRENT]);
+  const dt_slideshow_buf_t *slot = _get_frame(d, d->rank);
 
-  if(slot->buf && slot->rank >= 0 && !slot->invalidated)
+  if(slot && slot->buf && !slot->invalidated && slot->width > 0 && slot->height > 0)
   {
     // cope with possible resize of the window
     const float tr_width = d->width < slot->width ? 0.f : (d->width - slot->width) * .5f / darktable.gui->ppd;
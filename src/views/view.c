@@ -69,8 +69,6 @@ void dt_view_manager_init(dt_view_manager_t *vm)
                               &vm->statements.make_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT num FROM main.history WHERE imgid = ?1", -1,
                               &vm->statements.have_history, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT color FROM main.color_labels WHERE imgid=?1",
-                              -1, &vm->statements.get_color, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(
       dt_database_get(darktable.db),
       "SELECT id FROM main.images WHERE group_id = (SELECT group_id FROM main.images WHERE id=?1) AND id != ?2",
@@ -677,74 +675,73 @@ dt_view_surface_value_t dt_view_image_get_surface(int imgid, int width, int heig
   scale = fmaxf(img_width / (float)buf_wd, img_height / (float)buf_ht);
   *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, img_width, img_height);
 
-  // we transfer cached image on a cairo_surface (with colorspace transform if needed)
+  // the cached image is in the layout of cairo surfaces. without colorspace transform, we draw it straight
+  // from the locked buffer, otherwise we transform it into a temporary surface.
   cairo_surface_t *tmp_surface = NULL;
-  uint8_t *rgbbuf = (uint8_t *)calloc((size_t)buf_wd * buf_ht * 4, sizeof(uint8_t));
-  if(rgbbuf)
+  gboolean have_lock = FALSE;
+  cmsHTRANSFORM transform = NULL;
+
+  if(dt_conf_get_bool("cache_color_managed"))
   {
-    gboolean have_lock = FALSE;
-    cmsHTRANSFORM transform = NULL;
+    pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
+    have_lock = TRUE;
 
-    if(dt_conf_get_bool("cache_color_managed"))
+    // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the
+    // screen
+    if(buf.color_space == DT_COLORSPACE_SRGB
+       && darktable.color_profiles->transform_srgb_to_display)
     {
-      pthread_rwlock_rdlock(&darktable.color_profiles->xprofile_lock);
-      have_lock = TRUE;
-
-      // we only color manage when a thumbnail is sRGB or AdobeRGB. everything else just gets dumped to the
-      // screen
-      if(buf.color_space == DT_COLORSPACE_SRGB
-         && darktable.color_profiles->transform_srgb_to_display)
+      transform = darktable.color_profiles->transform_srgb_to_display;
+    }
+    else if(buf.color_space == DT_COLORSPACE_ADOBERGB
+            && darktable.color_profiles->transform_adobe_rgb_to_display)
+    {
+      transform = darktable.color_profiles->transform_adobe_rgb_to_display;
+    }
+    else
+    {
+      pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+      have_lock = FALSE;
+      if(buf.color_space == DT_COLORSPACE_NONE)
       {
-        transform = darktable.color_profiles->transform_srgb_to_display;
+        fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
       }
-      else if(buf.color_space == DT_COLORSPACE_ADOBERGB
-              && darktable.color_profiles->transform_adobe_rgb_to_display)
+      else if(buf.color_space != DT_COLORSPACE_DISPLAY)
       {
-        transform = darktable.color_profiles->transform_adobe_rgb_to_display;
-      }
-      else
-      {
-        pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
-        have_lock = FALSE;
-        if(buf.color_space == DT_COLORSPACE_NONE)
-        {
-          fprintf(stderr, "oops, there seems to be a code path not setting the color space of thumbnails!\n");
-        }
-        else if(buf.color_space != DT_COLORSPACE_DISPLAY)
-        {
-          fprintf(stderr,
-                  "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
-                  dt_colorspaces_get_name(buf.color_space, "from file"));
-        }
+        fprintf(stderr,
+                "oops, there seems to be a code path setting an unhandled color space of thumbnails (%s)!\n",
+                dt_colorspaces_get_name(buf.color_space, "from file"));
       }
     }
+  }
 
+  // rows of mipmaps are never padded, and neither are the ones of RGB24 surfaces
+  const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf_wd);
+  if(transform)
+  {
+    tmp_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, buf_wd, buf_ht);
+    uint8_t *rgbbuf = cairo_image_surface_get_data(tmp_surface);
+    if(rgbbuf)
+    {
+      cairo_surface_flush(tmp_surface);
 #ifdef _OPENMP
-#pragma omp parallel for schedule(static) default(none) shared(buf, rgbbuf, transform)
+#pragma omp parallel for schedule(static) default(none) shared(buf, transform) dt_omp_firstprivate(rgbbuf, stride)
 #endif
-    for(int i = 0; i < buf.height; i++)
-    {
-      const uint8_t *in = buf.buf + i * buf.width * 4;
-      uint8_t *out = rgbbuf + i * buf.width * 4;
-
-      if(transform)
-      {
-        cmsDoTransform(transform, in, out, buf.width);
-      }
-      else
-      {
-        for(int j = 0; j < buf.width; j++, in += 4, out += 4)
-        {
-          out[0] = in[2];
-          out[1] = in[1];
-          out[2] = in[0];
-        }
-      }
+      for(int i = 0; i < buf.height; i++)
+        cmsDoTransform(transform, buf.buf + (size_t)i * buf.width * 4, rgbbuf + (size_t)i * stride, buf.width);
+      cairo_surface_mark_dirty(tmp_surface);
     }
-    if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
+  }
+  else
+  {
+    tmp_surface = cairo_image_surface_create_for_data(buf.buf, CAIRO_FORMAT_RGB24, buf_wd, buf_ht, stride);
+  }
+  if(have_lock) pthread_rwlock_unlock(&darktable.color_profiles->xprofile_lock);
 
-    const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf_wd);
-    tmp_surface = cairo_image_surface_create_for_data(rgbbuf, CAIRO_FORMAT_RGB24, buf_wd, buf_ht, stride);
+  if(cairo_surface_status(tmp_surface) != CAIRO_STATUS_SUCCESS)
+  {
+    cairo_surface_destroy(tmp_surface);
+    tmp_surface = NULL;
   }
 
   // draw the image scaled:
@@ -778,10 +775,12 @@ dt_view_surface_value_t dt_view_image_get_surface(int imgid, int width, int heig
        So we pass the raw data to be processed, this is more data but correct.
     */
     if(darktable.gui->show_focus_peaking && mip == buf.size)
-      dt_focuspeaking(cr, img_width, img_height, rgbbuf, buf_wd, buf_ht);
+      dt_focuspeaking(cr, img_width, img_height, cairo_image_surface_get_data(tmp_surface), buf_wd, buf_ht);
 
-    cairo_surface_destroy(tmp_surface);
     cairo_destroy(cr);
+    // the surface may wrap the cache buffer, it must be gone before we release it
+    cairo_surface_finish(tmp_surface);
+    cairo_surface_destroy(tmp_surface);
   }
 
   // we consider skull as ok as the image hasn't to be reload
@@ -793,7 +792,6 @@ dt_view_surface_value_t dt_view_image_get_surface(int imgid, int width, int heig
     ret = DT_VIEW_SURFACE_OK;
 
   dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-  if(rgbbuf) free(rgbbuf);
 
   // logs
   if((darktable.unmuted & (DT_DEBUG_LIGHTTABLE | DT_DEBUG_PERF)) == (DT_DEBUG_LIGHTTABLE | DT_DEBUG_PERF))
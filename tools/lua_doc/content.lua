@@ -669,6 +669,11 @@ darktable.debug.type:set_text([[Similar to the system function type() but it wil
 	types.dt_imageio_module_format_t.write_image:add_parameter("filename","string",[[The filename to export to.]])
 	types.dt_imageio_module_format_t.write_image:add_parameter("allow_upscale","boolean",[[Set to true to allow upscaling of the image.]]):set_attribute("optional",true)
 	types.dt_imageio_module_format_t.write_image:add_return("boolean",[[Returns true on success.]])
+	types.dt_imageio_module_format_t.write_images:set_text([[Exports images to files in a background job, several at a time when the resources allow it. The call returns at once, the batch-export-image event is triggered after each image and batch-export-done at the end of the batch.]])
+	types.dt_imageio_module_format_t.write_images:add_parameter("self",types.dt_imageio_module_format_t,[[The format that will be used to export.]]):set_attribute("is_self",true)
+	types.dt_imageio_module_format_t.write_images:add_parameter("images","table of "..my_tostring(types.dt_lua_image_t),[[The images to export.]])
+	types.dt_imageio_module_format_t.write_images:add_parameter("filenames","table of string",[[The file to export each image to, at the same index.]])
+	types.dt_imageio_module_format_t.write_images:add_return("integer",[[The id of the batch, passed to the events.]])
 
 	types.dt_imageio_module_format_data_png:set_text([[Type object describing parameters to export to png.]])
 	types.dt_imageio_module_format_data_png.bpp:set_text([[The bpp parameter to use when exporting.]])
@@ -1028,6 +1033,21 @@ local widget = dt.new_widget("button"){
 	events["intermediate-export-image"].extra_registration_parameters:set_text([[This event has no extra registration parameters.]])
 
 
+	events["batch-export-image"]:set_text([[This event is triggered after each image of a batch started by format:write_images() has been exported, or failed to. This event can be registered multiple times.]])
+	events["batch-export-image"].callback:add_parameter("event","string",[[The name of the event that triggered the callback.]])
+	events["batch-export-image"].callback:add_parameter("batch","integer",[[The id of the batch, as returned by write_images().]])
+	events["batch-export-image"].callback:add_parameter("image",types.dt_lua_image_t,[[The image object that has been exported.]])
+	events["batch-export-image"].callback:add_parameter("filename","string",[[The file the image was exported to.]])
+	events["batch-export-image"].callback:add_parameter("success","boolean",[[True if the file has been written.]])
+	events["batch-export-image"].extra_registration_parameters:set_text([[This event has no extra registration parameters.]])
+
+
+	events["batch-export-done"]:set_text([[This event is triggered when all the images of a batch started by format:write_images() have been processed. This event can be registered multiple times.]])
+	events["batch-export-done"].callback:add_parameter("event","string",[[The name of the event that triggered the callback.]])
+	events["batch-export-done"].callback:add_parameter("batch","integer",[[The id of the batch, as returned by write_images().]])
+	events["batch-export-done"].extra_registration_parameters:set_text([[This event has no extra registration parameters.]])
+
+
 	events["post-import-image"]:set_text([[This event is triggered whenever a new image is imported into the database.
 
 	This event can be registered multiple times, all callbacks will be called. The call is blocking.]])